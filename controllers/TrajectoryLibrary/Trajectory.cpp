@@ -7,13 +7,20 @@
 
 #include "Trajectory.hpp"
 
+#include <sys/mman.h>
 
-Trajectory::Trajectory() {
+TrajlibBinaryFile::~TrajlibBinaryFile() {
+    munmap((void*)data, size);
+}
+
+Trajectory::Trajectory() : memory_(MEMORY_TRAJECTORIES) {
     trajectory_number_ = -1;
     dimension_ = 0;
     udimension_ = 0;
     filename_prefix_ = "";
     dt_ = 0;
+    min_altitude_ = 0;
+    time_invariant_ = false;
 }
 
 // Constructor that loads a trajectory from a file
@@ -63,6 +70,15 @@ void Trajectory::LoadTrajectory(std::string filename_prefix, bool quiet) {
             exit(1);
     }
 
+    time_invariant_ = upoints_.rows() == 1;
+
+    if (ComputeSamples(xpoints_) == false) {
+        std::cerr << "Error: expected a " << TRAJECTORY_DIMENSION << " dimensional state and " << TRAJECTORY_U_DIMENSION << " inputs in " << filename_prefix << " but found " << dimension_ << " and " << udimension_ << std::endl;
+        exit(1);
+    }
+
+    ComputeSegments();
+
     // set the minimum altitude
     BotTrans trans;
     bot_trans_set_identity(&trans);
@@ -83,86 +99,353 @@ void Trajectory::LoadTrajectory(std::string filename_prefix, bool quiet) {
 }
 
 
-void Trajectory::LoadMatrixFromCSV( const std::string& filename, Eigen::MatrixXd &matrix, bool quiet) {
+/**
+ * Loads a trajectory from its entry in a compiled library file (see
+ * TrajectoryLibrary::LoadBinary()).  The CSVs were checked when the file was
+ * compiled, so this only checks that the matrices are inside the file.
+ *
+ * @param entry the trajectory's entry in the file's table
+ * @param file_data the whole file
+ * @param file_size size of the file in bytes
+ *
+ * @retval false if a matrix isn't inside the file
+ */
+bool Trajectory::LoadBinary(const TrajlibBinaryTrajectory &entry, const char *file_data, size_t file_size) {
 
-    if (!quiet) {
-        std::cout << "Loading " << filename << std::endl;
+    Eigen::MatrixXd *matrices[4] = { &xpoints_, &upoints_, &kpoints_, &affine_points_ };
+
+    for (int i = 0; i < 4; i++) {
+        if (LoadBinaryMatrix(entry.matrices[i], file_data, file_size, *matrices[i]) == false) {
+            return false;
+        }
+    }
+
+    trajectory_number_ = entry.trajectory_number;
+    dt_ = entry.dt;
+    min_altitude_ = entry.min_altitude;
+
+    filename_prefix_ = std::string(entry.filename_prefix, strnlen(entry.filename_prefix, sizeof(entry.filename_prefix)));
+
+    dimension_ = xpoints_.cols() - 1; // minus 1 because of time index
+    udimension_ = upoints_.cols() - 1;
+    time_invariant_ = upoints_.rows() == 1;
+
+    if (ComputeSamples(xpoints_) == false) {
+        return false;
     }
 
-    int number_of_lines = GetNumberOfLines(filename);
-    int row_num = 0;
+    ComputeSegments();
+
+    return true;
+}
+
+/**
+ * Loads only what the searches need from a trajectory's entry in a compiled
+ * library file: the time, x, y and z of its points (the first columns of
+ * its x matrix, so one block of the file).  Load() gets the rest from the
+ * file the first time something needs it.
+ *
+ * @param entry the trajectory's entry in the file's table
+ * @param file the mapped file, kept until the trajectory is loaded
+ *
+ * @retval false if a matrix isn't inside the file or the matrices aren't
+ *      TRAJECTORY_DIMENSION x TRAJECTORY_U_DIMENSION, so Load() can't fail
+ */
+bool Trajectory::LoadBinaryIndex(const TrajlibBinaryTrajectory &entry, std::shared_ptr<const TrajlibBinaryFile> file) {
+
+    const TrajlibBinaryMatrix &x = entry.matrices[0];
+    const TrajlibBinaryMatrix &u = entry.matrices[1];
+    const TrajlibBinaryMatrix &k = entry.matrices[2];
+    const TrajlibBinaryMatrix &affine = entry.matrices[3];
+
+    for (int i = 0; i < 4; i++) {
+        if (BinaryMatrixInFile(entry.matrices[i], file->size) == false) {
+            return false;
+        }
+    }
 
-    int i =  0;
-    //                                   file, delimiter, first_line_is_header?
-    CsvParser *csvparser = CsvParser_new(filename.c_str(), ",", true);
-    CsvRow *header;
-    CsvRow *row;
+    if (x.cols != TRAJECTORY_DIMENSION + 1 || u.cols != TRAJECTORY_U_DIMENSION + 1
+        || k.cols != TRAJECTORY_DIMENSION * TRAJECTORY_U_DIMENSION + 1 || affine.cols != TRAJECTORY_U_DIMENSION + 1
+        || u.rows < 1 || x.rows < 1) {
 
-    header = CsvParser_getHeader(csvparser);
-    if (header == NULL) {
-        printf("%s\n", CsvParser_getErrorMessage(csvparser));
+        return false;
+    }
+
+    // column-major, so time, x, y and z come first
+    TrajlibBinaryMatrix positions = x;
+    positions.cols = 4;
+
+    if (LoadBinaryMatrix(positions, file->data, file->size, xpoints_) == false) {
+        return false;
+    }
+
+    trajectory_number_ = entry.trajectory_number;
+    dt_ = entry.dt;
+    min_altitude_ = entry.min_altitude;
+
+    filename_prefix_ = std::string(entry.filename_prefix, strnlen(entry.filename_prefix, sizeof(entry.filename_prefix)));
+
+    dimension_ = TRAJECTORY_DIMENSION;
+    udimension_ = TRAJECTORY_U_DIMENSION;
+    time_invariant_ = u.rows == 1;
+
+    ComputeSegments();
+
+    paged_ = std::make_shared<PagedMatrices>();
+    paged_->file = file;
+    paged_->entry = entry;
+
+    loaded_.value = false;
+
+    return true;
+}
+
+/**
+ * Load()'s slow path: copies a lazily loaded trajectory's matrices out of
+ * its file and unpacks its samples.  Safe to call from several threads at
+ * once.
+ */
+void Trajectory::LoadPaged() const {
+
+    std::lock_guard<std::mutex> lock(paged_->mutex);
+
+    if (loaded_.value.load()) {
+        // someone else got here first
         return;
     }
 
-    // note: do not remove the getFields(header) call as it has
-    // side effects we need even if we don't use the headers
-    //char **headerFields = CsvParser_getFields(header);
-    CsvParser_getFields(header);
-    for (i = 0 ; i < CsvParser_getNumFields(header) ; i++) {
-        //printf("TITLE: %s\n", headerFields[i]);
+    const TrajlibBinaryTrajectory &entry = paged_->entry;
+    const TrajlibBinaryFile &file = *paged_->file;
+
+    // checked by LoadBinaryIndex()
+    Eigen::MatrixXd xpoints;
+
+    LoadBinaryMatrix(entry.matrices[0], file.data, file.size, xpoints);
+    LoadBinaryMatrix(entry.matrices[1], file.data, file.size, upoints_);
+    LoadBinaryMatrix(entry.matrices[2], file.data, file.size, kpoints_);
+    LoadBinaryMatrix(entry.matrices[3], file.data, file.size, affine_points_);
+
+    ComputeSamples(xpoints);
+
+    loaded_.value.store(true, std::memory_order_release);
+}
+
+/**
+ * @retval every point's time and state (for lazily loaded trajectories,
+ *      from their samples)
+ */
+Eigen::MatrixXd Trajectory::GetXpoints() const {
+
+    if (paged_ == nullptr) {
+        return xpoints_;
     }
 
-    matrix.resize(number_of_lines - 1, i); // minus 1 for header, i = number of columns
+    Load();
+
+    Eigen::MatrixXd xpoints(GetNumberOfPoints(), TRAJECTORY_DIMENSION + 1);
 
-    while ((row = CsvParser_getRow(csvparser)) ) {
-        //printf("NEW LINE:\n");
-        char **rowFields = CsvParser_getFields(row);
-        for (i = 0 ; i < CsvParser_getNumFields(row) ; i++) {
+    for (int i = 0; i < GetNumberOfPoints(); i++) {
+        xpoints(i, 0) = samples_[i].t;
+        xpoints.block<1, TRAJECTORY_DIMENSION>(i, 1) = samples_[i].x.transpose();
+    }
 
-            matrix(row_num, i) = atof(rowFields[i]);
+    return xpoints;
+}
 
-            //printf("FIELD: %20.20f\n", atof(rowFields[i]));
+/**
+ * Writes the trajectory's matrices at the end of a compiled library file
+ * and fills in its entry for the file's table.
+ *
+ * @param file file to write to
+ * @param entry (output) where everything was written
+ *
+ * @retval false if writing failed
+ */
+bool Trajectory::SaveBinary(FILE *file, TrajlibBinaryTrajectory *entry) const {
+
+    Load();
+
+    memset(entry, 0, sizeof(*entry));
+
+    entry->trajectory_number = trajectory_number_;
+    entry->dt = dt_;
+    entry->min_altitude = min_altitude_;
+
+    strncpy(entry->filename_prefix, filename_prefix_.c_str(), sizeof(entry->filename_prefix) - 1);
+
+    Eigen::MatrixXd xpoints = GetXpoints();
+
+    const Eigen::MatrixXd *matrices[4] = { &xpoints, &upoints_, &kpoints_, &affine_points_ };
+
+    for (int i = 0; i < 4; i++) {
+        if (SaveBinaryMatrix(file, *matrices[i], &entry->matrices[i]) == false) {
+            return false;
         }
-        CsvParser_destroy_row(row);
+    }
 
-        if (row_num == 1) {
-            dt_ = matrix(1, 0) - matrix(0, 0);
-        } else if (row_num > 1) {
-            if (matrix(row_num, 0) - matrix(row_num - 1, 0) - dt_ > 5*std::numeric_limits<double>::epsilon()) {
-                std::cerr << "Error: non-constant dt. Expected dt = " << dt_ << " but got matrix[" << row_num << "][0] - matrix[" << row_num - 1 << "][0] = " << matrix(row_num, 0) - matrix(row_num - 1, 0) << " (residual = " << (matrix(row_num, 0) - matrix(row_num - 1, 0) - dt_) << std::endl;
+    return true;
+}
 
-                std::cout << matrix << std::endl;
-                exit(1);
-            }
+/**
+ * Unpacks every point's state, input and gain matrix into samples_ for At(),
+ * with their slopes to the next point for Interpolate().  Time invariant
+ * trajectories have one input and gain for all of their states.
+ *
+ * @param xpoints every point's time and state
+ *
+ * @retval false if the trajectory isn't TRAJECTORY_DIMENSION x
+ *      TRAJECTORY_U_DIMENSION
+ */
+bool Trajectory::ComputeSamples(const Eigen::MatrixXd &xpoints) const {
+
+    if (dimension_ != TRAJECTORY_DIMENSION || udimension_ != TRAJECTORY_U_DIMENSION
+        || kpoints_.cols() - 1 != dimension_ * udimension_ || upoints_.rows() < 1) {
+
+        return false;
+    }
+
+    samples_.resize(GetNumberOfPoints());
+
+    for (int i = 0; i < GetNumberOfPoints(); i++) {
+        TrajectorySample &sample = samples_[i];
+
+        int u_index = std::min(i, int(upoints_.rows()) - 1);
+
+        sample.t = xpoints(i, 0);
+
+        // +1 because column 0 is time
+        sample.x = xpoints.block<1, TRAJECTORY_DIMENSION>(i, 1).transpose();
+        sample.u = upoints_.block<1, TRAJECTORY_U_DIMENSION>(u_index, 1).transpose();
+
+        for (int j = 0; j < TRAJECTORY_U_DIMENSION; j++) {
+            sample.k.row(j) = kpoints_.block<1, TRAJECTORY_DIMENSION>(u_index, j * TRAJECTORY_DIMENSION + 1);
+        }
+    }
+
+    // slopes to the next sample, for Interpolate()
+    for (int i = 0; i < GetNumberOfPoints(); i++) {
+        TrajectorySample &sample = samples_[i];
+
+        double dt = i + 1 < GetNumberOfPoints() ? samples_[i + 1].t - sample.t : 0;
+
+        if (dt > 0) {
+            const TrajectorySample &next = samples_[i + 1];
+
+            sample.x_slope = (next.x - sample.x) / dt;
+            sample.u_slope = (next.u - sample.u) / dt;
+            sample.k_slope = (next.k - sample.k) / dt;
+        } else {
+            sample.x_slope.setZero();
+            sample.u_slope.setZero();
+            sample.k_slope.setZero();
+        }
+    }
+
+    MeasureMemory();
+
+    return true;
+}
+
+// reports the trajectory's size to MEMORY_TRAJECTORIES
+void Trajectory::MeasureMemory() const {
+
+    int64_t bytes = sizeof(double) * (xpoints_.size() + upoints_.size() + kpoints_.size() + affine_points_.size())
+        + VectorBytes(samples_) + VectorBytes(segment_x_) + VectorBytes(segment_y_) + VectorBytes(segment_z_)
+        + VectorBytes(segment_radii_);
+
+    memory_.Set(bytes);
+}
+
+bool Trajectory::BinaryMatrixInFile(const TrajlibBinaryMatrix &location, size_t file_size) {
+
+    if (location.offset < 0 || location.rows < 0 || location.cols < 0) {
+        return false;
+    }
+
+    size_t bytes = (size_t)location.rows * location.cols * sizeof(double);
+
+    return (size_t)location.offset <= file_size && bytes <= file_size - location.offset;
+}
+
+bool Trajectory::LoadBinaryMatrix(const TrajlibBinaryMatrix &location, const char *file_data, size_t file_size, Eigen::MatrixXd &matrix) {
+
+    if (BinaryMatrixInFile(location, file_size) == false) {
+        return false;
+    }
+
+    size_t bytes = (size_t)location.rows * location.cols * sizeof(double);
+
+    matrix.resize(location.rows, location.cols);
+
+    memcpy(matrix.data(), file_data + location.offset, bytes);
+
+    return true;
+}
+
+bool Trajectory::SaveBinaryMatrix(FILE *file, const Eigen::MatrixXd &matrix, TrajlibBinaryMatrix *location) {
+
+    long offset = ftell(file);
+
+    if (offset < 0) {
+        return false;
+    }
+
+    // pad up to the alignment
+    while (offset % TRAJLIB_BINARY_ALIGNMENT != 0) {
+        if (fputc(0, file) == EOF) {
+            return false;
         }
 
-        row_num ++;
+        offset ++;
     }
-    CsvParser_destroy(csvparser);
 
+    location->offset = offset;
+    location->rows = matrix.rows();
+    location->cols = matrix.cols();
 
+    size_t count = (size_t)matrix.rows() * matrix.cols();
+
+    return fwrite(matrix.data(), sizeof(double), count, file) == count;
 }
 
-int Trajectory::GetNumberOfLines(std::string filename) const {
-    int number_of_lines = 0;
-    std::string line;
-    std::ifstream myfile(filename);
 
-    while (getline(myfile, line)) {
-        ++number_of_lines;
+void Trajectory::LoadMatrixFromCSV( const std::string& filename, Eigen::MatrixXd &matrix, bool quiet) {
+
+    if (!quiet) {
+        std::cout << "Loading " << filename << std::endl;
+    }
+
+    CsvReader csv_reader;
+
+    if (csv_reader.Open(filename) != true || csv_reader.ReadMatrix(&matrix) != true) {
+        printf("%s\n", csv_reader.GetError().c_str());
+        return;
     }
 
-    return number_of_lines;
+    for (int row_num = 1; row_num < matrix.rows(); row_num ++) {
+
+        if (row_num == 1) {
+            dt_ = matrix(1, 0) - matrix(0, 0);
+        } else {
+            if (matrix(row_num, 0) - matrix(row_num - 1, 0) - dt_ > 5*std::numeric_limits<double>::epsilon()) {
+                std::cerr << "Error: non-constant dt. Expected dt = " << dt_ << " but got matrix[" << row_num << "][0] - matrix[" << row_num - 1 << "][0] = " << matrix(row_num, 0) - matrix(row_num - 1, 0) << " (residual = " << (matrix(row_num, 0) - matrix(row_num - 1, 0) - dt_) << std::endl;
+
+                std::cout << matrix << std::endl;
+                exit(1);
+            }
+        }
+    }
 }
 
 Eigen::VectorXd Trajectory::GetState(double t) const {
-    int index = GetIndexAtTime(t);
-    Eigen::VectorXd row_vec = xpoints_.row(index);
+    Load();
 
-    return row_vec.tail(xpoints_.cols() - 1); // remove time
+    return samples_[GetIndexAtTime(t)].x;
 }
 
 Eigen::VectorXd Trajectory::GetUCommand(double t) const {
+    Load();
+
     int index = GetIndexAtTime(t);
 
     Eigen::VectorXd row_vec = upoints_.row(index);
@@ -234,39 +517,68 @@ TEST(Trajectory, GetIndexAtTimeTest) {
 }
 
 /**
- * Unpacks the gain matrix for a specific time t.
+ * Gets the state, input and gains at a time by linear interpolation between
+ * the samples on either side (with the slopes from ComputeSamples()), so
+ * a controller running faster than the trajectory's dt doesn't step at each
+ * sample.  Doesn't allocate.
  *
- * This could be pre-computed if it becomes a performance bottleneck.
- *
- * @param t time along the trajectory
- *
- * @retval gain matrix at that time with dimension: state_dimension x u_dimension
+ * @param t time along the trajectory (clamped to its start and end)
+ * @param sample (output) the interpolated sample (its slopes are the
+ *      sample's before it)
  */
-Eigen::MatrixXd Trajectory::GetGainMatrix(double t) const {
-    int index = GetIndexAtTime(t);
+void Trajectory::Interpolate(double t, TrajectorySample *sample) const {
+
+    Load();
 
-    Eigen::VectorXd k_row = kpoints_.row(index);
+    int last = GetNumberOfPoints() - 1;
 
+    // samples are dt_ apart from the first one
+    int index = (int)std::floor((t - samples_[0].t) / dt_);
 
-    Eigen::MatrixXd k_mat(udimension_, dimension_);
+    index = std::max(0, std::min(index, last));
 
-    for (int i = 0; i < udimension_; i++) {
+    const TrajectorySample &before = samples_[index];
 
-        // +1 because the column index is time
-        int start_pos = i * dimension_ + 1;
+    double since = std::max(0.0, t - before.t);
 
-        k_mat.row(i) = k_row.segment(start_pos, dimension_);
+    if (index == last) {
+        since = 0;
+    } else {
+        // rounding at the boundary can put t just past the next sample
+        since = std::min(since, samples_[index + 1].t - before.t);
     }
 
-    return k_mat;
+    sample->t = before.t + since;
 
+    sample->x = before.x + since * before.x_slope;
+    sample->u = before.u + since * before.u_slope;
+    sample->k = before.k + since * before.k_slope;
 
+    sample->x_slope = before.x_slope;
+    sample->u_slope = before.u_slope;
+    sample->k_slope = before.k_slope;
+}
+
+/**
+ * Gets the gain matrix for a specific time t.  Controllers that need the
+ * state and input too should look up the index once and use At().
+ *
+ * @param t time along the trajectory
+ *
+ * @retval gain matrix at that time with dimension: u_dimension x state_dimension
+ */
+Eigen::MatrixXd Trajectory::GetGainMatrix(double t) const {
+    Load();
+
+    return samples_[GetIndexAtTime(t)].k;
 }
 
 
 
 
 void Trajectory::Print() const {
+    Load();
+
     std::cout << "------------ Trajectory print -------------" << std::endl;
     std::cout << "Filename: " << filename_prefix_ << std::endl;
     std::cout << "Trajectory number: " << trajectory_number_ << std::endl;
@@ -275,7 +587,7 @@ void Trajectory::Print() const {
 
     std::cout << " t\t x\t y\t z\t roll\t pitch\t yaw \t xdot\t ydot\t zdot\t rolld\t pitchd\t yawd" << std::endl;
 
-    std::cout << xpoints_ << std::endl;
+    std::cout << GetXpoints() << std::endl;
 
     std::cout << "------------- u points ----------------" << std::endl;
 
@@ -296,32 +608,100 @@ void Trajectory::Print() const {
  * Returns a point along the trajectory transformed with xyz and yaw.  Ignores pitch and roll.
  */
 void Trajectory::GetXyzYawTransformedPoint(double t, const BotTrans &transform, double *xyz) const {
-    // apply the transformation from the global frame: orgin = (0,0,0)
-    // to the local frame point
+    int index = GetIndexAtTime(t);
 
-    Eigen::VectorXd state = GetState(t);
+    GetXyzYawTransformedPoints(transform, index, index + 1, xyz);
+}
 
-    double original_point[3];
-    original_point[0] = state(0);
-    original_point[1] = state(1);
-    original_point[2] = state(2);
+/**
+ * Transforms a run of the trajectory's points with xyz and yaw, like
+ * GetXyzYawTransformedPoint() but with the yaw worked out once for all of
+ * them.  The x, y and z of the points are columns of xpoints_, so they're
+ * read straight out of it and each point is a few multiply-adds.
+ *
+ * @param transform transform to apply (roll and pitch are ignored)
+ * @param start_index first point to transform
+ * @param end_index one past the last point to transform
+ * @param xyz (output) end_index - start_index points, x, y, z each
+ */
+void Trajectory::GetXyzYawTransformedPoints(const BotTrans &transform, int start_index, int end_index, double *xyz) const {
 
-    // remove roll and pitch from the transform
-    BotTrans trans_xyz_yaw;
+    // the columns after time
+    TransformXyzYaw(transform, &xpoints_(start_index, 1), &xpoints_(start_index, 2), &xpoints_(start_index, 3), end_index - start_index, xyz);
+}
+
+/**
+ * Transforms the centers of the segments' bounding spheres like
+ * GetXyzYawTransformedPoints() does the points.
+ *
+ * @param transform transform to apply (roll and pitch are ignored)
+ * @param xyz (output) GetNumberOfSegments() points, x, y, z each
+ */
+void Trajectory::GetXyzYawTransformedSegmentCenters(const BotTrans &transform, double *xyz) const {
+    TransformXyzYaw(transform, segment_x_.data(), segment_y_.data(), segment_z_.data(), GetNumberOfSegments(), xyz);
+}
 
-    bot_trans_copy(&trans_xyz_yaw, &transform);
+void Trajectory::TransformXyzYaw(const BotTrans &transform, const double *x, const double *y, const double *z, int num_points, double *xyz) {
 
     double rpy[3];
-    bot_quat_to_roll_pitch_yaw(trans_xyz_yaw.rot_quat, rpy);
+    bot_quat_to_roll_pitch_yaw(transform.rot_quat, rpy);
 
-    rpy[0] = 0;
-    rpy[1] = 0;
+    const double cos_yaw = cos(rpy[2]);
+    const double sin_yaw = sin(rpy[2]);
 
-    bot_roll_pitch_yaw_to_quat(rpy, trans_xyz_yaw.rot_quat);
+    const double *trans_vec = transform.trans_vec;
 
+    for (int i = 0; i < num_points; i++) {
+        xyz[3 * i] = cos_yaw * x[i] - sin_yaw * y[i] + trans_vec[0];
+        xyz[3 * i + 1] = sin_yaw * x[i] + cos_yaw * y[i] + trans_vec[1];
+        xyz[3 * i + 2] = z[i] + trans_vec[2];
+    }
+}
 
-    bot_trans_apply_vec(&trans_xyz_yaw, original_point, xyz);
+/**
+ * Splits the points into segments of TRAJECTORY_SEGMENT_POINTS and puts a
+ * sphere around each (centered on its bounding box).
+ */
+void Trajectory::ComputeSegments() {
+
+    int number_of_points = GetNumberOfPoints();
+    int num_segments = (number_of_points + TRAJECTORY_SEGMENT_POINTS - 1) / TRAJECTORY_SEGMENT_POINTS;
+
+    segment_x_.resize(num_segments);
+    segment_y_.resize(num_segments);
+    segment_z_.resize(num_segments);
+    segment_radii_.resize(num_segments);
+
+    for (int segment = 0; segment < num_segments; segment++) {
+        int start = GetSegmentStart(segment);
+        int end = GetSegmentEnd(segment);
+
+        double center[3];
+
+        for (int j = 0; j < 3; j++) {
+            // the columns after time
+            Eigen::VectorXd values = xpoints_.block(start, j + 1, end - start, 1);
+
+            center[j] = (values.minCoeff() + values.maxCoeff()) / 2;
+        }
+
+        double sqr_radius = 0;
+
+        for (int i = start; i < end; i++) {
+            double sqr_dist = (xpoints_(i, 1) - center[0]) * (xpoints_(i, 1) - center[0])
+                + (xpoints_(i, 2) - center[1]) * (xpoints_(i, 2) - center[1])
+                + (xpoints_(i, 3) - center[2]) * (xpoints_(i, 3) - center[2]);
+
+            sqr_radius = std::max(sqr_radius, sqr_dist);
+        }
+
+        segment_x_[segment] = center[0];
+        segment_y_[segment] = center[1];
+        segment_z_[segment] = center[2];
+        segment_radii_[segment] = sqrt(sqr_radius);
+    }
 
+    MeasureMemory();
 }
 
 void Trajectory::Draw(bot_lcmgl_t *lcmgl, const BotTrans *transform, double final_time) const {
@@ -355,22 +735,28 @@ void Trajectory::Draw(bot_lcmgl_t *lcmgl, const BotTrans *transform, double fina
     }
     bot_lcmgl_end(lcmgl);
 
+    // knot points, all in one batch (a sphere each is 400 quads for the
+    // viewer to draw)
+    bot_lcmgl_point_size(lcmgl, 6.0f);
+    bot_lcmgl_begin(lcmgl, GL_POINTS);
+
     t = 0;
     while (t < final_time) {
         GetXyzYawTransformedPoint(t, *transform, xyz);
 
-        bot_lcmgl_sphere(lcmgl, xyz, 0.05, 20, 20);
+        bot_lcmgl_vertex3f(lcmgl, xyz[0], xyz[1], xyz[2]);
 
         t += GetDT();
     }
+    bot_lcmgl_end(lcmgl);
+
+    // draw roll angle with a line on the z axis, all in one batch of lines
+    bot_lcmgl_begin(lcmgl, GL_LINES);
 
     t = 0;
     while (t < final_time) {
         GetXyzYawTransformedPoint(t, *transform, xyz);
 
-        bot_lcmgl_begin(lcmgl, GL_LINE_STRIP);
-        // draw roll angle with a line on the z axis
-
         Eigen::Vector3d unit_z;
         unit_z << 0, 0, 1;
 
@@ -383,10 +769,10 @@ void Trajectory::Draw(bot_lcmgl_t *lcmgl, const BotTrans *transform, double fina
 
         bot_lcmgl_vertex3f(lcmgl, xyz[0], xyz[1], xyz[2]);
         bot_lcmgl_vertex3f(lcmgl, xyz[0]+rot_z(0), xyz[1]+rot_z(1), xyz[2]+rot_z(2));
-        bot_lcmgl_end(lcmgl);
 
         t += 2*GetDT();
     }
+    bot_lcmgl_end(lcmgl);
 
 
 
@@ -411,10 +797,16 @@ void Trajectory::Draw(bot_lcmgl_t *lcmgl, const BotTrans *transform, double fina
  * @param octomap Obstacle map
  * @param bodyToLocal Current position of the aircraft
  * @param current_t Time along the trajectory
+ * @param min_altitude_allowed Trajectories that go below this are at distance 0
+ * @param max_distance Obstacles further away than this don't matter (and
+ *      aren't searched for); the trajectory is then at distance -1, as with
+ *      no obstacles at all.  -1 to search everywhere.
+ * @param cache (optional) clearances from the last call, to only search
+ *      again where the map changed
  *
  * @retval Distance to the closest obstacle along the remainder of the trajectory
  */
-double Trajectory::ClosestObstacleInRemainderOfTrajectory(const StereoOctomap &octomap, const BotTrans &body_to_local, double current_t, double min_altitude_allowed) const {
+double Trajectory::ClosestObstacleInRemainderOfTrajectory(const StereoOctomap &octomap, const BotTrans &body_to_local, double current_t, double min_altitude_allowed, double max_distance, TrajectoryClearanceCache *cache) const {
 
     // for each point remaining in the trajectory
     int number_of_points = GetNumberOfPoints();
@@ -423,19 +815,20 @@ double Trajectory::ClosestObstacleInRemainderOfTrajectory(const StereoOctomap &o
     std::vector<double> point_distances(number_of_points); // TODO: potentially inefficient
     double closest_obstacle_distance = -1;
 
-    for (int i = starting_index; i < number_of_points; i++) {
-        // for each point in the trajectory
+    std::vector<double> transformed_points(3 * number_of_points);
 
-        // subtract the current position (ie move the trajectory to where we are)
-        double transformed_point[3];
+    if (cache != nullptr) {
+        // only what changed since the last call is searched
+        const double *distances = cache->Clearances(*this, octomap, body_to_local, starting_index, max_distance);
 
-        double this_t = GetTimeAtIndex(i);
+        std::copy(distances + starting_index, distances + number_of_points, point_distances.begin() + starting_index);
 
-        GetXyzYawTransformedPoint(this_t, body_to_local, transformed_point);
+    } else if (starting_index < number_of_points) {
+        // move the trajectory to where we are
+        GetXyzYawTransformedPoints(body_to_local, starting_index, number_of_points, &transformed_points[3 * starting_index]);
 
         // check if there is an obstacle nearby
-        point_distances.at(i) = octomap.NearestNeighbor(transformed_point);
-
+        octomap.Clearances(&transformed_points[3 * starting_index], number_of_points - starting_index, &point_distances[starting_index], max_distance);
     }
 
     for (int i = starting_index; i < number_of_points; i++) {
@@ -458,3 +851,155 @@ double Trajectory::ClosestObstacleInRemainderOfTrajectory(const StereoOctomap &o
 
     return closest_obstacle_distance;
 }
+
+TrajectoryClearanceCache::TrajectoryClearanceCache(double pose_tolerance) {
+    pose_tolerance_ = pose_tolerance;
+
+    traj_ = nullptr;
+    start_index_ = 0;
+    max_distance_ = -1;
+    max_radius_ = 0;
+
+    version_.epoch = -1;
+    version_.changes = 0;
+
+    num_searched_ = 0;
+    num_reused_ = 0;
+}
+
+/**
+ * Gets the clearances of a trajectory's points from where the aircraft is,
+ * like transforming them and calling StereoOctomap::Clearances(), but
+ * keeping the ones from last time that the map's changes since can't have
+ * touched.  A point's clearance can only have changed if a changed voxel is
+ * within it (or within max_distance, for points that had nothing that
+ * close), plus the map's change margin and the pose tolerance.
+ *
+ * @param traj trajectory
+ * @param octomap obstacle map
+ * @param body_to_local where the aircraft is in the map
+ * @param start_index first point needed
+ * @param max_distance as for StereoOctomap::Clearances()
+ *
+ * @retval each point's clearance (from start_index on), valid until the
+ *      next call
+ */
+const double* TrajectoryClearanceCache::Clearances(const Trajectory &traj, const StereoOctomap &octomap, const BotTrans &body_to_local, int start_index, double max_distance) {
+
+    int number_of_points = traj.GetNumberOfPoints();
+
+    bool search_all = traj_ != &traj || start_index < start_index_ || max_distance != max_distance_
+        || PoseMovement(body_to_local) > pose_tolerance_ || octomap.GetChangesSince(version_, &changes_) == false;
+
+    if (search_all) {
+        traj_ = &traj;
+        max_distance_ = max_distance;
+        pose_ = body_to_local;
+
+        points_.resize(3 * number_of_points);
+        distances_.assign(number_of_points, -1);
+
+        max_radius_ = 0;
+
+        if (start_index < number_of_points) {
+            traj.GetXyzYawTransformedPoints(body_to_local, start_index, number_of_points, &points_[3 * start_index]);
+
+            octomap.Clearances(&points_[3 * start_index], number_of_points - start_index, &distances_[start_index], max_distance);
+
+            for (int i = start_index; i < number_of_points; i++) {
+                double dx = points_[3 * i] - body_to_local.trans_vec[0];
+                double dy = points_[3 * i + 1] - body_to_local.trans_vec[1];
+
+                max_radius_ = std::max(max_radius_, sqrt(dx * dx + dy * dy));
+            }
+
+            num_searched_ += number_of_points - start_index;
+        }
+    } else {
+        double margin = octomap.GetChangeMargin() + pose_tolerance_;
+        int num_changes = changes_.size() / 3;
+
+        stale_.clear();
+
+        for (int i = start_index; i < number_of_points && num_changes > 0; i++) {
+
+            // -1 is nothing within max_distance, or with no max distance,
+            // nothing at all, which anything new changes
+            double reach = distances_[i] >= 0 ? distances_[i] : max_distance;
+
+            if (reach < 0) {
+                stale_.push_back(i);
+                continue;
+            }
+
+            double sqr_reach = (reach + margin) * (reach + margin);
+            const double *point = &points_[3 * i];
+
+            for (int j = 0; j < num_changes; j++) {
+                const double *change = &changes_[3 * j];
+
+                double sqr_dist = (point[0] - change[0]) * (point[0] - change[0])
+                    + (point[1] - change[1]) * (point[1] - change[1])
+                    + (point[2] - change[2]) * (point[2] - change[2]);
+
+                if (sqr_dist <= sqr_reach) {
+                    stale_.push_back(i);
+                    break;
+                }
+            }
+        }
+
+        int num_stale = stale_.size();
+
+        if (num_stale > 0) {
+            // searched together, like the whole trajectory would be
+            stale_points_.resize(3 * num_stale);
+            stale_distances_.resize(num_stale);
+
+            for (int i = 0; i < num_stale; i++) {
+                std::copy(&points_[3 * stale_[i]], &points_[3 * stale_[i]] + 3, &stale_points_[3 * i]);
+            }
+
+            octomap.Clearances(stale_points_.data(), num_stale, stale_distances_.data(), max_distance);
+
+            for (int i = 0; i < num_stale; i++) {
+                distances_[stale_[i]] = stale_distances_[i];
+            }
+        }
+
+        num_searched_ += num_stale;
+        num_reused_ += std::max(0, number_of_points - start_index - num_stale);
+    }
+
+    start_index_ = start_index;
+    version_ = octomap.GetVersion();
+
+    return distances_.data();
+}
+
+/**
+ * @param body_to_local where the aircraft is now
+ *
+ * @retval furthest any point has moved since it was searched (from the
+ *      translation and the change in yaw, like TransformXyzYaw()), or
+ *      infinity if nothing has been searched
+ */
+double TrajectoryClearanceCache::PoseMovement(const BotTrans &body_to_local) const {
+
+    if (traj_ == nullptr) {
+        return std::numeric_limits<double>::infinity();
+    }
+
+    double dx = body_to_local.trans_vec[0] - pose_.trans_vec[0];
+    double dy = body_to_local.trans_vec[1] - pose_.trans_vec[1];
+    double dz = body_to_local.trans_vec[2] - pose_.trans_vec[2];
+
+    double rpy[3], old_rpy[3];
+    bot_quat_to_roll_pitch_yaw(body_to_local.rot_quat, rpy);
+    bot_quat_to_roll_pitch_yaw(pose_.rot_quat, old_rpy);
+
+    double yaw_change = fabs(remainder(rpy[2] - old_rpy[2], 2 * M_PI));
+
+    // a chord is shorter than its arc
+    return sqrt(dx * dx + dy * dy + dz * dz) + yaw_change * max_radius_;
+}
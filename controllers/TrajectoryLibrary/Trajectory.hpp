@@ -14,6 +14,13 @@
 #include <vector>
 #include <sstream>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <limits>
 
 #include <bot_core/rotations.h>
 #include <bot_frames/bot_frames.h>
@@ -22,11 +29,91 @@
 #include <bot_vis/gl_util.h>
 #include "gtest/gtest.h"
 #include "../../utils/utils/RealtimeUtils.hpp"
+#include "../../utils/utils/MemoryAccounting.hpp"
 
-#include "../../externals/csvparser/csvparser.h"
+#include "../../utils/CsvReader/CsvReader.hpp"
 #include "../../estimators/StereoOctomap/StereoOctomap.hpp"
 
 #include <Eigen/Core>
+#include <Eigen/StdVector>
+
+// the points of a trajectory are split into segments of this many, each
+// with a sphere around it, so searches can bound a whole segment's distance
+// to obstacles from its center's (see TrajectoryLibrary::FindFarthestTrajectory())
+#define TRAJECTORY_SEGMENT_POINTS 16
+
+// every trajectory has this state (x, y, z, roll, pitch, yaw and their
+// rates) and this many inputs, so a point's gains can be a fixed-size matrix
+#define TRAJECTORY_DIMENSION 12
+#define TRAJECTORY_U_DIMENSION 3
+
+// matrices in a compiled library file start on multiples of this many bytes
+#define TRAJLIB_BINARY_ALIGNMENT 64
+
+/**
+ * Where one matrix of a trajectory is in a compiled library file
+ * (TrajectoryLibrary::SaveBinary()): rows * cols doubles in Eigen's
+ * column-major order, starting offset bytes into the file.
+ */
+struct TrajlibBinaryMatrix {
+    int64_t offset;
+    int32_t rows;
+    int32_t cols;
+};
+
+/**
+ * One trajectory's entry in a compiled library file's table.
+ */
+struct TrajlibBinaryTrajectory {
+    int32_t trajectory_number;
+    int32_t padding;
+
+    double dt;
+    double min_altitude;
+
+    // the CSVs it was compiled from, for Print()
+    char filename_prefix[256];
+
+    // x, u, controller, affine
+    TrajlibBinaryMatrix matrices[4];
+};
+
+/**
+ * A compiled library file mapped into memory.  Lazily loaded trajectories
+ * (Trajectory::LoadBinaryIndex()) hold on to it until they've loaded the
+ * rest of their matrices from it.
+ */
+struct TrajlibBinaryFile {
+    TrajlibBinaryFile(const char *data, size_t size) : data(data), size(size) {}
+    ~TrajlibBinaryFile();
+
+    const char *data;
+    size_t size;
+};
+
+/**
+ * One point of a trajectory with its gain matrix already unpacked, so the
+ * controller can get everything for a time with one lookup (Trajectory::At()).
+ */
+struct TrajectorySample {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    double t;
+
+    Eigen::Matrix<double, TRAJECTORY_DIMENSION, 1> x;
+    Eigen::Matrix<double, TRAJECTORY_U_DIMENSION, 1> u;
+
+    // u_dimension x state_dimension
+    Eigen::Matrix<double, TRAJECTORY_U_DIMENSION, TRAJECTORY_DIMENSION> k;
+
+    // how fast each of them changes (per second) on the way to the next
+    // sample, for Trajectory::Interpolate().  Zero at the last one.
+    Eigen::Matrix<double, TRAJECTORY_DIMENSION, 1> x_slope;
+    Eigen::Matrix<double, TRAJECTORY_U_DIMENSION, 1> u_slope;
+    Eigen::Matrix<double, TRAJECTORY_U_DIMENSION, TRAJECTORY_DIMENSION> k_slope;
+};
+
+class TrajectoryClearanceCache;
 
 class Trajectory
 {
@@ -37,12 +124,36 @@ class Trajectory
 
         void LoadTrajectory(std::string filename_prefix, bool quiet = false);
 
+        bool LoadBinary(const TrajlibBinaryTrajectory &entry, const char *file_data, size_t file_size);
+        bool LoadBinaryIndex(const TrajlibBinaryTrajectory &entry, std::shared_ptr<const TrajlibBinaryFile> file);
+        bool SaveBinary(FILE *file, TrajlibBinaryTrajectory *entry) const;
+
+        // loads the rest of a lazily loaded trajectory.  Everything that
+        // needs more than its positions calls this itself, so it only has
+        // to be called to get the loading out of the way early.
+        void Load() const {
+            if (loaded_.value.load(std::memory_order_acquire) == false) {
+                LoadPaged();
+            }
+        }
+
+        bool IsLoaded() const { return loaded_.value.load(std::memory_order_acquire); }
+
         int GetDimension() const { return dimension_; }
         int GetUDimension() const { return udimension_; }
         int GetTrajectoryNumber() const { return trajectory_number_; }
         double GetDT() const { return dt_; }
 
         void GetXyzYawTransformedPoint(double t, const BotTrans &transform, double *xyz) const;
+        void GetXyzYawTransformedPoints(const BotTrans &transform, int start_index, int end_index, double *xyz) const;
+
+        int GetNumberOfSegments() const { return int(segment_radii_.size()); }
+        int GetSegmentStart(int segment) const { return segment * TRAJECTORY_SEGMENT_POINTS; }
+        int GetSegmentEnd(int segment) const { return std::min((segment + 1) * TRAJECTORY_SEGMENT_POINTS, GetNumberOfPoints()); }
+        double GetSegmentRadius(int segment) const { return segment_radii_[segment]; }
+
+        void GetXyzYawTransformedSegmentCenters(const BotTrans &transform, double *xyz) const;
+        static void TransformXyzYaw(const BotTrans &transform, const double *x, const double *y, const double *z, int num_points, double *xyz);
         void Draw(bot_lcmgl_t *lcmgl, const BotTrans *transform = nullptr, double final_time = -1) const;
 
         int GetIndexAtTime(double t) const;
@@ -50,7 +161,7 @@ class Trajectory
 
         double GetMaxTime() const { return xpoints_(xpoints_.rows() - 1, 0); }
 
-        bool IsTimeInvariant() const { return upoints_.rows() == 1; }
+        bool IsTimeInvariant() const { return time_invariant_; }
 
         int GetNumberOfPoints() const { return int(xpoints_.rows()); }
 
@@ -58,9 +169,12 @@ class Trajectory
         Eigen::VectorXd GetUCommand(double t) const;
         Eigen::MatrixXd GetGainMatrix(double t) const;
 
-        Eigen::MatrixXd GetXpoints() const { return xpoints_; }
+        const TrajectorySample& At(int index) const { Load(); return samples_[index]; }
+        void Interpolate(double t, TrajectorySample *sample) const;
 
-        double ClosestObstacleInRemainderOfTrajectory(const StereoOctomap &octomap, const BotTrans &body_to_local, double current_t, double min_altitude_allowed) const;
+        Eigen::MatrixXd GetXpoints() const;
+
+        double ClosestObstacleInRemainderOfTrajectory(const StereoOctomap &octomap, const BotTrans &body_to_local, double current_t, double min_altitude_allowed, double max_distance = -1, TrajectoryClearanceCache *cache = nullptr) const;
 
         void Print() const;
 
@@ -70,14 +184,49 @@ class Trajectory
 
     private:
 
+        // std::atomic<bool> that the default copy of a Trajectory can copy
+        struct LoadedFlag {
+            LoadedFlag() : value(true) {}
+            LoadedFlag(const LoadedFlag &other) : value(other.value.load()) {}
+            LoadedFlag& operator=(const LoadedFlag &other) { value = other.value.load(); return *this; }
+
+            std::atomic<bool> value;
+        };
+
+        // where a lazily loaded trajectory's other matrices are.  Shared by
+        // its copies, which each load their own.
+        struct PagedMatrices {
+            std::shared_ptr<const TrajlibBinaryFile> file;
+            TrajlibBinaryTrajectory entry;
+            std::mutex mutex;
+        };
+
+        // time and state of each point.  Lazily loaded trajectories only
+        // have the time, x, y and z columns, which is all the searches use.
         Eigen::MatrixXd xpoints_;
-        Eigen::MatrixXd upoints_;
 
-        Eigen::MatrixXd kpoints_;
-        Eigen::MatrixXd affine_points_;
+        // mutable so Load() can fill them in for lazily loaded trajectories
+        mutable Eigen::MatrixXd upoints_;
+
+        mutable Eigen::MatrixXd kpoints_;
+        mutable Eigen::MatrixXd affine_points_;
 
         double dt_;
         double min_altitude_;
+        bool time_invariant_;
+
+        // each point's state, input and unpacked gains, and their slopes to
+        // the next point (ComputeSamples())
+        mutable std::vector<TrajectorySample, Eigen::aligned_allocator<TrajectorySample> > samples_;
+
+        // null unless lazily loaded (LoadBinaryIndex())
+        std::shared_ptr<PagedMatrices> paged_;
+        mutable LoadedFlag loaded_;
+
+        // center of each segment's bounding sphere (x's, y's and z's) and
+        // its radius
+        std::vector<double> segment_x_, segment_y_, segment_z_;
+        std::vector<double> segment_radii_;
 
 
         int dimension_; // state space dimension
@@ -86,10 +235,78 @@ class Trajectory
         int trajectory_number_;
         std::string filename_prefix_;
 
+        // what the matrices, samples and segments take up, which grows
+        // when a lazily loaded trajectory is loaded
+        mutable MemoryGauge memory_;
+
         void LoadMatrixFromCSV(const std::string& filename, Eigen::MatrixXd &matrix, bool quiet = false);
 
-        int GetNumberOfLines(std::string filename) const;
+        void ComputeSegments();
+        bool ComputeSamples(const Eigen::MatrixXd &xpoints) const;
+
+        void LoadPaged() const;
+        void MeasureMemory() const;
+
+        static bool BinaryMatrixInFile(const TrajlibBinaryMatrix &location, size_t file_size);
+        static bool LoadBinaryMatrix(const TrajlibBinaryMatrix &location, const char *file_data, size_t file_size, Eigen::MatrixXd &matrix);
+        static bool SaveBinaryMatrix(FILE *file, const Eigen::MatrixXd &matrix, TrajlibBinaryMatrix *location);
+
+};
+
+/**
+ * The clearances of a trajectory's points from the last
+ * Trajectory::ClosestObstacleInRemainderOfTrajectory() that used it, so the
+ * next one on the same trajectory only searches again around where the map
+ * changed (StereoOctomap::GetChangesSince()).  Everything is searched again
+ * when the trajectory, the search's max distance or the map's epoch
+ * changes, or when the aircraft has moved too far.  Keep one per thread.
+ */
+class TrajectoryClearanceCache {
+
+    public:
+        TrajectoryClearanceCache(double pose_tolerance = 0);
+
+        // how far (in meters) the aircraft can move any of the points before
+        // they're all searched again.  Answers can be off by this much.
+        void SetPoseTolerance(double tolerance) { pose_tolerance_ = tolerance; }
+
+        const double* Clearances(const Trajectory &traj, const StereoOctomap &octomap, const BotTrans &body_to_local, int start_index, double max_distance);
+
+        void Clear() { traj_ = nullptr; }
+
+        // points searched and points whose clearance was kept (for
+        // benchmarks)
+        int64_t GetNumSearched() const { return num_searched_; }
+        int64_t GetNumReused() const { return num_reused_; }
+
+    private:
+        double PoseMovement(const BotTrans &body_to_local) const;
+
+        double pose_tolerance_;
+
+        // what the clearances are for
+        const Trajectory *traj_;
+        int start_index_;
+        double max_distance_;
+        BotTrans pose_;
+        StereoOctomapVersion version_;
+
+        // furthest any point is from the pose horizontally, for how far a
+        // yaw moves them
+        double max_radius_;
+
+        // each point where it was searched (x, y, z each) and its clearance
+        std::vector<double> points_;
+        std::vector<double> distances_;
+
+        // reused between calls
+        std::vector<double> changes_;
+        std::vector<int> stale_;
+        std::vector<double> stale_points_;
+        std::vector<double> stale_distances_;
 
+        int64_t num_searched_;
+        int64_t num_reused_;
 };
 
 #endif
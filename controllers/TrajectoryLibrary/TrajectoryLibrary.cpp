@@ -6,14 +6,72 @@
  */
 
 #include "TrajectoryLibrary.hpp"
+#include "../../utils/utils/Trace.hpp"
+#include "../../utils/ThreadPool/ThreadPool.hpp"
 
 // Constructor that loads a trajectorys from a directory
 TrajectoryLibrary::TrajectoryLibrary(double ground_safety_distance)
 {
     ground_safety_distance_ = ground_safety_distance;
+    parallel_trajectories_ = false;
+    use_shape_index_ = false;
+    use_swept_volumes_ = false;
+    swept_words_ = 0;
+    lazy_loading_ = false;
+    background_prefetch_ = false;
+    prefetch_cancelled_ = false;
+    rollout_candidates_ = 0;
+    rollout_time_constant_ = 1.0;
 }
 
-bool TrajectoryLibrary::LoadLibrary(std::string dirname, bool quiet) {
+TrajectoryLibrary::~TrajectoryLibrary() {
+    // prefetches that haven't started are skipped, the rest are waited for
+    prefetch_cancelled_ = true;
+    prefetch_group_.reset();
+}
+
+/**
+ * Loads a lazily loaded trajectory in the background, on the shared thread
+ * pool at low priority, so it's ready when it's picked.  Does nothing for
+ * trajectories that are already loaded.
+ *
+ * @param number trajectory to load
+ */
+void TrajectoryLibrary::Prefetch(int number) const {
+
+    if (number < 0 || number >= GetNumberTrajectories() || traj_vec_[number].IsLoaded()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(prefetch_mutex_);
+
+    if (prefetch_group_ == nullptr) {
+        prefetch_group_.reset(new ThreadPoolGroup(ThreadPool::GetShared(), THREAD_POOL_LOW));
+    }
+
+    const Trajectory *traj = &traj_vec_[number];
+    const std::atomic<bool> *cancelled = &prefetch_cancelled_;
+
+    prefetch_group_->Run([traj, cancelled]() {
+        if (cancelled->load() == false) {
+            traj->Load();
+        }
+    });
+}
+
+/**
+ * Loads every trajectory in a directory.  If the directory has a compiled
+ * library (TRAJLIB_BINARY_FILENAME) that's newer than all of its CSVs, that
+ * is loaded instead, which is much faster (and can be lazy, see
+ * SetLazyLoading()).
+ *
+ * @param dirname directory with the trajectories' CSVs
+ * @param quiet true to not print what's being loaded
+ * @param use_binary false to always load the CSVs
+ *
+ * @retval true if at least one trajectory was loaded
+ */
+bool TrajectoryLibrary::LoadLibrary(std::string dirname, bool quiet, bool use_binary) {
     // if dirname does not end in "/", add a "/"
     if (dirname.back() != '/')
     {
@@ -30,25 +88,52 @@ bool TrajectoryLibrary::LoadLibrary(std::string dirname, bool quiet) {
         return false;
     }
 
-    vector<Trajectory> temp_traj;
+    vector<std::string> prefixes;
 
-    int count = 0;
+    // when the newest CSV was changed
+    time_t newest_csv = 0;
 
     while ((dp = readdir(dirp)) != NULL) {
         std::string this_file = dp->d_name;
 
-        if (this_file.length() > 4 && this_file.compare(this_file.length()-6, 6, "-x.csv") == 0) {
+        if (this_file.length() > 4 && this_file.compare(this_file.length()-4, 4, ".csv") == 0) {
+            struct stat csv_stat;
+
+            if (stat((dirname + this_file).c_str(), &csv_stat) == 0 && csv_stat.st_mtime > newest_csv) {
+                newest_csv = csv_stat.st_mtime;
+            }
+        }
+
+        if (this_file.length() > 6 && this_file.compare(this_file.length()-6, 6, "-x.csv") == 0) {
             // found a .csv file
-            // load a trajectory
+            prefixes.push_back(dirname + this_file.substr(0, this_file.length()-6));
+        }
+    }
 
-            Trajectory this_traj(dirname + this_file.substr(0, this_file.length()-6), quiet);
+    closedir(dirp);
 
-            temp_traj.push_back(this_traj);
+    std::string binary_file = dirname + TRAJLIB_BINARY_FILENAME;
+    struct stat binary_stat;
 
-            count ++;
+    if (use_binary && stat(binary_file.c_str(), &binary_stat) == 0) {
+        if (binary_stat.st_mtime < newest_csv) {
+            std::cerr << "WARNING: " << binary_file << " is older than the CSVs, loading them instead (run trajlib-compile to update it)." << std::endl;
+        } else if (LoadBinary(binary_file, quiet)) {
+            return true;
+        } else {
+            std::cerr << "WARNING: failed to load " << binary_file << ", loading the CSVs instead." << std::endl;
         }
     }
 
+    vector<Trajectory> temp_traj;
+
+    for (const std::string &prefix : prefixes) {
+        // load a trajectory
+        Trajectory this_traj(prefix, quiet);
+
+        temp_traj.push_back(this_traj);
+    }
+
     // now we have loaded everything into memory, so sort
     for (int i = 0; i < (int)temp_traj.size(); i++) {
 
@@ -67,18 +152,167 @@ bool TrajectoryLibrary::LoadLibrary(std::string dirname, bool quiet) {
         }
     }
 
-    //(void)closedir(dirp);
-
     if (!quiet) {
         std::cout << "Loaded " << traj_vec_.size() << " trajectorie(s)" << std::endl;
     }
 
+    BuildShapeIndex();
+
     if (traj_vec_.size() > 0) {
         return true;
     }
     return false;
 }
 
+/**
+ * Loads a library compiled by SaveBinary().  The file is mapped into memory
+ * and each matrix copied out of it in one go, instead of parsing CSVs.
+ *
+ * With SetLazyLoading(), only the positions are copied, and the file stays
+ * mapped for the trajectories to load the rest from.
+ *
+ * @param filename compiled library
+ * @param quiet true to not print what's being loaded
+ *
+ * @retval true if the file was valid and had at least one trajectory
+ */
+bool TrajectoryLibrary::LoadBinary(std::string filename, bool quiet) {
+
+    int fd = open(filename.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+        std::cerr << "ERROR: failed to open " << filename << std::endl;
+        return false;
+    }
+
+    struct stat file_stat;
+
+    if (fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(TrajlibBinaryHeader)) {
+        std::cerr << "ERROR: " << filename << " is too short to be a compiled library." << std::endl;
+        close(fd);
+        return false;
+    }
+
+    size_t file_size = file_stat.st_size;
+
+    void *mapped = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if (mapped == MAP_FAILED) {
+        std::cerr << "ERROR: failed to map " << filename << std::endl;
+        return false;
+    }
+
+    // unmapped once nothing needs it
+    std::shared_ptr<const TrajlibBinaryFile> file = std::make_shared<const TrajlibBinaryFile>((const char*)mapped, file_size);
+
+    const char *file_data = file->data;
+    const TrajlibBinaryHeader *header = (const TrajlibBinaryHeader*)file_data;
+
+    int number_of_trajectories = header->number_of_trajectories;
+
+    bool valid = memcmp(header->magic, TRAJLIB_BINARY_MAGIC, sizeof(header->magic)) == 0
+        && number_of_trajectories > 0
+        && (size_t)number_of_trajectories <= (file_size - sizeof(TrajlibBinaryHeader)) / sizeof(TrajlibBinaryTrajectory);
+
+    vector<Trajectory> temp_traj(valid ? number_of_trajectories : 0);
+
+    if (valid) {
+        const TrajlibBinaryTrajectory *entries = (const TrajlibBinaryTrajectory*)(file_data + sizeof(TrajlibBinaryHeader));
+
+        // written in order, so trajectory i is entry i
+        for (int i = 0; i < number_of_trajectories && valid; i++) {
+            if (lazy_loading_) {
+                valid = entries[i].trajectory_number == i && temp_traj[i].LoadBinaryIndex(entries[i], file);
+            } else {
+                valid = entries[i].trajectory_number == i && temp_traj[i].LoadBinary(entries[i], file_data, file_size);
+            }
+        }
+    }
+
+    if (valid == false) {
+        std::cerr << "ERROR: " << filename << " is not a valid compiled library." << std::endl;
+        return false;
+    }
+
+    traj_vec_.insert(traj_vec_.end(), temp_traj.begin(), temp_traj.end());
+
+    BuildShapeIndex();
+
+    if (!quiet) {
+        std::cout << "Loaded " << traj_vec_.size() << " trajectorie(s) from " << filename << (lazy_loading_ ? " (lazily)" : "") << std::endl;
+    }
+
+    if (lazy_loading_ && background_prefetch_) {
+        for (int i = 0; i < GetNumberTrajectories(); i++) {
+            Prefetch(i);
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Writes the library to one file that LoadBinary() can load: a header, a
+ * table with each trajectory's matrices' places in the file, then the
+ * matrices themselves (each aligned to TRAJLIB_BINARY_ALIGNMENT bytes).
+ *
+ * @param filename file to write
+ *
+ * @retval false if there's nothing to write or writing failed
+ */
+bool TrajectoryLibrary::SaveBinary(std::string filename) const {
+
+    if (traj_vec_.size() == 0) {
+        std::cerr << "ERROR: no trajectories to save." << std::endl;
+        return false;
+    }
+
+    // written next to it and renamed over it, since lazily loaded libraries
+    // keep the old one mapped
+    std::string temp_filename = filename + ".tmp";
+
+    FILE *file = fopen(temp_filename.c_str(), "wb");
+
+    if (file == NULL) {
+        std::cerr << "ERROR: failed to open " << temp_filename << " for writing." << std::endl;
+        return false;
+    }
+
+    TrajlibBinaryHeader header;
+    memset(&header, 0, sizeof(header));
+
+    memcpy(header.magic, TRAJLIB_BINARY_MAGIC, sizeof(header.magic));
+    header.number_of_trajectories = traj_vec_.size();
+
+    vector<TrajlibBinaryTrajectory> entries(traj_vec_.size());
+
+    // the table is filled in once the matrices are written after it
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(entries.data(), sizeof(TrajlibBinaryTrajectory), entries.size(), file) == entries.size();
+
+    for (unsigned int i = 0; i < traj_vec_.size() && ok; i++) {
+        ok = traj_vec_[i].SaveBinary(file, &entries[i]);
+    }
+
+    ok = ok && fseek(file, sizeof(header), SEEK_SET) == 0
+        && fwrite(entries.data(), sizeof(TrajlibBinaryTrajectory), entries.size(), file) == entries.size();
+
+    if (fclose(file) != 0) {
+        ok = false;
+    }
+
+    ok = ok && rename(temp_filename.c_str(), filename.c_str()) == 0;
+
+    if (ok == false) {
+        std::cerr << "ERROR: failed to write " << filename << std::endl;
+        remove(temp_filename.c_str());
+    }
+
+    return ok;
+}
+
 void TrajectoryLibrary::Print() const {
 
     std::cout << "Time-varying trajectories" << std::endl << "------------------------" << std::endl;
@@ -105,6 +339,9 @@ const Trajectory* TrajectoryLibrary::GetTrajectoryByNumber(int number) const {
  * In the case  that there is no such trajectory, returns the trajectory that is furthest from obstacles and
  * the ground.
  *
+ * With SetUseShapeIndex(), a trajectory the shape index shows is clear can be
+ * picked over ones before it that would have been far enough away too.
+ *
  * @param octomap obstacle map
  * @param body_to_local tranform for the aircraft that describes where we are in the map
  * @param threshold minimum safe distance for the aircraft
@@ -114,6 +351,7 @@ const Trajectory* TrajectoryLibrary::GetTrajectoryByNumber(int number) const {
  * @retval the distance to the closest obstacle or -1 if there are no obstacles
  */
 std::tuple<double, const Trajectory*> TrajectoryLibrary::FindFarthestTrajectory(const StereoOctomap &octomap, const BotTrans &body_to_local, double threshold, bot_lcmgl_t* lcmgl, int preferred_traj) const {
+    TRACE_SCOPE("trajectory-search");
 
     const Trajectory *farthest_traj = nullptr;
 
@@ -124,77 +362,71 @@ std::tuple<double, const Trajectory*> TrajectoryLibrary::FindFarthestTrajectory(
     }
 
 
-    // for each point in each trajectory, find the point that is closest in the octree
-    for (int i = 0; i < GetNumberTrajectories(); i++) {
-
-        int this_traj = i;
+    if (preferred_traj >= GetNumberTrajectories()) {
+        std::cerr << "WARNING: preferred trajectory number exceeds library size, ignoring it." << std::endl;
+        preferred_traj = -1;
+    }
 
-        if (preferred_traj >= GetNumberTrajectories()) {
-            std::cerr << "WARNING: preferred trajectory number exceeds library size, ignoring it." << std::endl;
-            preferred_traj = -1;
-        }
+    // the order to check the trajectories in: the preferred one (if there
+    // is one) and then the rest in number order
+    vector<int> order;
 
-        if (preferred_traj >= 0) {
-            // there is a preferred trajectory active
+    if (preferred_traj >= 0) {
+        order.push_back(preferred_traj);
+    }
 
-            if (i == 0) {
-                // search for the preferred traj
-                this_traj = preferred_traj;
-            } else {
-                // searching for something else, make sure to skip searching
-                // for the preferred traj
-                if (i <= preferred_traj) {
-                    this_traj = i - 1;
-                } else {
-                    this_traj = i;
-                }
-            }
+    for (int i = 0; i < GetNumberTrajectories(); i++) {
+        if (i != preferred_traj) {
+            order.push_back(i);
         }
+    }
 
-        //std::cout << "Searching trajectory: " << this_traj << std::endl;
-
-        double closest_obstacle_distance = -1;
-
-        int number_of_points = traj_vec_.at(this_traj).GetNumberOfPoints();
-        vector<double> point_distances(number_of_points);
+    // with the shape index, the first trajectory (in order) that's clear of
+    // obstacles by more than the threshold is picked without checking the
+    // others
+    bool found_clear = false;
 
-        // check minumum altitude
-        double min_altitude = traj_vec_.at(this_traj).GetMinimumAltitude() + body_to_local.trans_vec[2];
-        if (min_altitude < ground_safety_distance_) {
-            // this trajectory would impact the ground
-            closest_obstacle_distance = 0;
-            //std::cout << "Trajectory " << this_traj << " would violate ground safety." << std::endl;
-        } else {
+    if (use_shape_index_) {
+        vector<char> clear;
+        ClearTrajectories(octomap, body_to_local, threshold, &clear);
 
-            // for each trajectory, look at each point
+        for (int i = 0; i < (int)order.size() && found_clear == false; i++) {
+            if (clear[order[i]]) {
+                // its distance is still found exactly (and it might go into
+                // the ground)
+                double distance = TrajectoryClearance(traj_vec_.at(order[i]), octomap, body_to_local, -1);
 
-            // use all availble processors
-            #pragma omp parallel for
-            for (int j = 0; j < number_of_points; j++) {
-                // now we are looking at a single point in a trajectorybot_lcmgl_t *lcmgl
-
-                double transformedPoint[3];
+                if (distance > threshold || distance < 0) {
+                    traj_closest_dist = distance;
+                    farthest_traj = &traj_vec_.at(order[i]);
+                    found_clear = true;
+                }
+            }
+        }
+    }
 
-                double this_t = traj_vec_.at(this_traj).GetTimeAtIndex(j);
+    // with parallel_trajectories_, all of them are checked up front
+    vector<double> distances;
 
-                traj_vec_.at(this_traj).GetXyzYawTransformedPoint(this_t, body_to_local, transformedPoint);
+    if (parallel_trajectories_ && found_clear == false) {
+        TrajectoryDistances(octomap, body_to_local, threshold, order, &distances);
+    }
 
-                //std::cout << "searching at (" << transformedPoint[0] << ", " << transformedPoint[1] << ", " << transformedPoint[2] << ")...";
+    // for each point in each trajectory, find the point that is closest in the octree
+    for (int i = 0; i < (int)order.size() && found_clear == false; i++) {
 
-                point_distances.at(j) = octomap.NearestNeighbor(transformedPoint);
+        int this_traj = order[i];
 
-                //std::cout << "distance is: " << distance_to_point << std::endl;
+        //std::cout << "Searching trajectory: " << this_traj << std::endl;
 
-            }
+        double closest_obstacle_distance;
 
-            for (int j = 0; j < number_of_points; j++) {
-                double distance_to_point = point_distances.at(j);
-                if (distance_to_point >= 0) {
-                    if (distance_to_point < closest_obstacle_distance || closest_obstacle_distance < 0) {
-                        closest_obstacle_distance = distance_to_point;
-                    }
-                }
-            }
+        if (parallel_trajectories_) {
+            closest_obstacle_distance = distances[i];
+        } else {
+            // trajectories that can't beat the best so far are only searched
+            // far enough to know that
+            closest_obstacle_distance = TrajectoryClearance(traj_vec_.at(this_traj), octomap, body_to_local, traj_closest_dist);
         }
 
         //std::cout << "Trajectory " << this_traj << " has distance = " << closest_obstacle_distance << std::endl;
@@ -236,6 +468,761 @@ std::tuple<double, const Trajectory*> TrajectoryLibrary::FindFarthestTrajectory(
     return std::tuple<double, const Trajectory*>(traj_closest_dist, farthest_traj);
 }
 
+/**
+ * Finds every trajectory's exact distance to obstacles and sorts them, for
+ * PickTrajectory() to pick from later.  Slower than FindFarthestTrajectory()
+ * (which stops at the first one that's far enough away), so it's for
+ * ranking ahead of time, off of the thread that needs the answer.
+ *
+ * With rollout verification, the farthest few are then rolled out from the
+ * aircraft's velocity (RolloutClearance()) and sorted again by that.
+ *
+ * @param octomap obstacle map
+ * @param body_to_local where the aircraft is in the map
+ * @param ranking (output) the distances and order.  Its buffers are reused.
+ * @param body_velocity (optional) the aircraft's velocity in the body frame,
+ *      for rollout verification.  Without it, nothing is rolled out.
+ */
+void TrajectoryLibrary::RankTrajectories(const StereoOctomap &octomap, const BotTrans &body_to_local, TrajectoryRanking *ranking, const double *body_velocity) const {
+    TRACE_SCOPE("trajectory-rank");
+
+    int num_trajectories = GetNumberTrajectories();
+
+    ranking->distances.resize(num_trajectories);
+    ranking->order.resize(num_trajectories);
+
+    // a trajectory per task, like TrajectoryDistances()
+    ThreadPool::GetShared()->ParallelFor(0, num_trajectories, [&](int i) {
+        ranking->distances[i] = TrajectoryClearance(traj_vec_.at(i), octomap, body_to_local, -1);
+    });
+
+    for (int i = 0; i < num_trajectories; i++) {
+        ranking->order[i] = i;
+    }
+
+    const vector<double> &distances = ranking->distances;
+
+    // no obstacles at all (-1) is the farthest
+    auto farther = [&distances](int a, int b) {
+        return (distances[a] < 0 && distances[b] >= 0) || (distances[b] >= 0 && distances[a] > distances[b]);
+    };
+
+    std::stable_sort(ranking->order.begin(), ranking->order.end(), farther);
+
+    if (rollout_candidates_ <= 0 || body_velocity == nullptr) {
+        ranking->verified.clear();
+        return;
+    }
+
+    int num_candidates = std::min(rollout_candidates_, num_trajectories);
+
+    // a candidate per task
+    ThreadPool::GetShared()->ParallelFor(0, num_candidates, [&](int i) {
+        int number = ranking->order[i];
+        ranking->distances[number] = RolloutClearance(traj_vec_.at(number), octomap, body_to_local, body_velocity);
+    });
+
+    ranking->verified.assign(num_trajectories, 0);
+
+    for (int i = 0; i < num_candidates; i++) {
+        ranking->verified[ranking->order[i]] = 1;
+    }
+
+    // the rest keep their places after the candidates
+    std::stable_sort(ranking->order.begin(), ranking->order.begin() + num_candidates, farther);
+}
+
+/**
+ * Picks a trajectory from a ranking the way FindFarthestTrajectory() would
+ * have from the same map: the preferred trajectory if it's far enough away,
+ * then the first one (in number order) that is, and otherwise the farthest
+ * one.  Doesn't search the map.
+ *
+ * If the ranking has rollouts, only the trajectories that were rolled out
+ * are picked from.
+ *
+ * @param ranking from RankTrajectories() on this library
+ * @param threshold minimum safe distance for the aircraft
+ * @param preferred_traj trajectory to pick first if it's far enough away
+ *      (-1 for none)
+ *
+ * @retval the distance to the closest obstacle (or -1 if there are no
+ *      obstacles) and the trajectory, or nullptr if there are no
+ *      trajectories
+ */
+std::tuple<double, const Trajectory*> TrajectoryLibrary::PickTrajectory(const TrajectoryRanking &ranking, double threshold, int preferred_traj) const {
+
+    if (ranking.order.size() == 0) {
+        return std::tuple<double, const Trajectory*>(-1, nullptr);
+    }
+
+    if (preferred_traj >= (int)ranking.distances.size()) {
+        preferred_traj = -1;
+    }
+
+    // without rollouts, every trajectory can be picked
+    auto pickable = [&ranking](int number) {
+        return ranking.verified.empty() || ranking.verified[number];
+    };
+
+    if (preferred_traj >= 0 && pickable(preferred_traj) == false) {
+        preferred_traj = -1;
+    }
+
+    int farthest = ranking.order[0];
+    double farthest_dist = ranking.distances[farthest];
+
+    if (farthest_dist >= 0 && farthest_dist <= threshold) {
+        // none are far enough away, so it's the farthest one (the preferred
+        // one wins a tie since it's checked first)
+        if (preferred_traj >= 0 && ranking.distances[preferred_traj] == farthest_dist) {
+            farthest = preferred_traj;
+        }
+
+        return std::tuple<double, const Trajectory*>(farthest_dist, &traj_vec_.at(farthest));
+    }
+
+    if (preferred_traj >= 0) {
+        double dist = ranking.distances[preferred_traj];
+
+        if (dist > threshold || dist < 0) {
+            return std::tuple<double, const Trajectory*>(dist, &traj_vec_.at(preferred_traj));
+        }
+    }
+
+    for (int i = 0; i < (int)ranking.distances.size(); i++) {
+        double dist = ranking.distances[i];
+
+        if (pickable(i) && (dist > threshold || dist < 0)) {
+            return std::tuple<double, const Trajectory*>(dist, &traj_vec_.at(i));
+        }
+    }
+
+    // not reached: the farthest one is far enough away
+    return std::tuple<double, const Trajectory*>(farthest_dist, &traj_vec_.at(farthest));
+}
+
+/**
+ * Finds the distance to the closest obstacle along a trajectory by branch
+ * and bound on its segments: every point is within its segment's radius of
+ * the segment's center, so its distance to obstacles is within that much of
+ * the center's.  The centers are searched first, and then only the points
+ * in segments that could hold the closest one.  Trajectories that would go
+ * below ground_safety_distance_ are at distance 0.
+ *
+ * @param traj trajectory to check
+ * @param octomap obstacle map
+ * @param body_to_local where the aircraft is in the map
+ * @param to_beat distance of the best trajectory so far (-1 for none).  If
+ *      this trajectory can't be further than that, its points aren't
+ *      searched, and once any of its points is closer than that, the rest
+ *      of them aren't either.
+ *
+ * @retval distance to the closest obstacle, -1 if there are no obstacles,
+ *      or something less than to_beat if it can't beat that
+ */
+double TrajectoryLibrary::TrajectoryClearance(const Trajectory &traj, const StereoOctomap &octomap, const BotTrans &body_to_local, double to_beat) const {
+
+    // check minumum altitude
+    double min_altitude = traj.GetMinimumAltitude() + body_to_local.trans_vec[2];
+    if (min_altitude < ground_safety_distance_) {
+        // this trajectory would impact the ground
+        return 0;
+    }
+
+    int num_segments = traj.GetNumberOfSegments();
+
+    vector<double> centers(3 * num_segments);
+    vector<double> center_distances(num_segments);
+
+    traj.GetXyzYawTransformedSegmentCenters(body_to_local, centers.data());
+    octomap.Clearances(centers.data(), num_segments, center_distances.data());
+
+    // the trajectory is no further than this from an obstacle
+    double upper_bound = -1;
+
+    for (int i = 0; i < num_segments; i++) {
+        if (center_distances[i] < 0) {
+            // no obstacles at all
+            return -1;
+        }
+
+        double segment_upper = center_distances[i] + traj.GetSegmentRadius(i);
+
+        if (segment_upper < upper_bound || upper_bound < 0) {
+            upper_bound = segment_upper;
+        }
+    }
+
+    if (to_beat >= 0 && upper_bound < to_beat) {
+        return upper_bound;
+    }
+
+    // only segments that might have a point closer than upper_bound, the
+    // ones that might be closest first, so the running minimum drops (and
+    // the trajectory is given up on, or the rest skipped) as soon as it can
+    vector<std::pair<double, int> > segments;
+
+    for (int i = 0; i < num_segments; i++) {
+        double segment_lower = center_distances[i] - traj.GetSegmentRadius(i);
+
+        if (segment_lower <= upper_bound) {
+            segments.push_back(std::make_pair(segment_lower, i));
+        }
+    }
+
+    std::sort(segments.begin(), segments.end());
+
+    // closest point found so far.  The segment with the closest point can't
+    // be skipped unless this is already its distance, so it ends up exact.
+    std::atomic<double> closest(upper_bound);
+
+    // a segment per task.  Inside TrajectoryDistances()'s tasks this nests,
+    // and whichever threads are free help.
+    ThreadPool::GetShared()->ParallelFor(0, segments.size(), [&](int i) {
+
+        double closest_so_far = closest.load();
+
+        if (to_beat >= 0 && closest_so_far < to_beat) {
+            // can't win anymore, cancel the rest
+            return;
+        }
+
+        if (segments[i].first >= closest_so_far) {
+            // can't have anything closer
+            return;
+        }
+
+        int start = traj.GetSegmentStart(segments[i].second);
+        int end = traj.GetSegmentEnd(segments[i].second);
+
+        double transformed_points[3 * TRAJECTORY_SEGMENT_POINTS];
+        double point_distances[TRAJECTORY_SEGMENT_POINTS];
+
+        traj.GetXyzYawTransformedPoints(body_to_local, start, end, transformed_points);
+
+        octomap.Clearances(transformed_points, end - start, point_distances);
+
+        double segment_closest = -1;
+
+        for (int j = 0; j < end - start; j++) {
+            if (point_distances[j] >= 0 && (point_distances[j] < segment_closest || segment_closest < 0)) {
+                segment_closest = point_distances[j];
+            }
+        }
+
+        while (segment_closest >= 0 && segment_closest < closest_so_far
+            && closest.compare_exchange_weak(closest_so_far, segment_closest) == false) {}
+    });
+
+    double closest_obstacle_distance = closest.load();
+
+    return closest_obstacle_distance;
+}
+
+/**
+ * Finds the distance to the closest obstacle along where the aircraft will
+ * actually fly a trajectory from its current velocity, instead of along the
+ * trajectory itself.  The library doesn't have the aircraft's dynamics, so
+ * the closed loop is modeled as the velocity error (against the trajectory's
+ * first state) dying off over the rollout time constant, which moves each
+ * point by that error times tau * (1 - e^(-t / tau)).  Points are checked in
+ * segments of TRAJECTORY_SEGMENT_POINTS, on the stack.
+ *
+ * @param traj trajectory to roll out
+ * @param octomap obstacle map
+ * @param body_to_local where the aircraft is in the map
+ * @param body_velocity the aircraft's velocity in the body frame, like the
+ *      trajectories' states
+ *
+ * @retval distance to the closest obstacle, -1 if there are no obstacles,
+ *      or 0 if the rollout goes below ground_safety_distance_
+ */
+double TrajectoryLibrary::RolloutClearance(const Trajectory &traj, const StereoOctomap &octomap, const BotTrans &body_to_local, const double body_velocity[3]) const {
+
+    const TrajectorySample &start = traj.At(0);
+
+    // the velocity error in the map, yawed like the trajectory's points
+    double rpy[3];
+    bot_quat_to_roll_pitch_yaw(body_to_local.rot_quat, rpy);
+
+    double error_x = body_velocity[0] - start.x(6);
+    double error_y = body_velocity[1] - start.x(7);
+
+    double error[3] = {
+        cos(rpy[2]) * error_x - sin(rpy[2]) * error_y,
+        sin(rpy[2]) * error_x + cos(rpy[2]) * error_y,
+        body_velocity[2] - start.x(8)
+    };
+
+    double tau = rollout_time_constant_;
+    double t0 = traj.GetTimeAtIndex(0);
+
+    double closest = -1;
+
+    for (int segment = 0; segment < traj.GetNumberOfSegments(); segment++) {
+        int segment_start = traj.GetSegmentStart(segment);
+        int segment_end = traj.GetSegmentEnd(segment);
+
+        double points[3 * TRAJECTORY_SEGMENT_POINTS];
+        double distances[TRAJECTORY_SEGMENT_POINTS];
+
+        traj.GetXyzYawTransformedPoints(body_to_local, segment_start, segment_end, points);
+
+        for (int j = 0; j < segment_end - segment_start; j++) {
+            double t = traj.GetTimeAtIndex(segment_start + j) - t0;
+            double drift = tau > 0 ? tau * (1 - exp(-t / tau)) : 0;
+
+            points[3 * j] += error[0] * drift;
+            points[3 * j + 1] += error[1] * drift;
+            points[3 * j + 2] += error[2] * drift;
+
+            if (points[3 * j + 2] < ground_safety_distance_) {
+                // this rollout would impact the ground
+                return 0;
+            }
+        }
+
+        octomap.Clearances(points, segment_end - segment_start, distances);
+
+        for (int j = 0; j < segment_end - segment_start; j++) {
+            if (distances[j] >= 0 && (distances[j] < closest || closest < 0)) {
+                closest = distances[j];
+            }
+        }
+    }
+
+    return closest;
+}
+
+/**
+ * Checks every trajectory at once, a trajectory per thread, for
+ * FindFarthestTrajectory() to then go through in order.  The best distance
+ * so far is shared, so trajectories that can't beat it (or the threshold)
+ * aren't searched fully.  Once a trajectory is past the threshold, the ones
+ * after it in order can't be picked and aren't searched at all.
+ *
+ * @param octomap obstacle map
+ * @param body_to_local where the aircraft is in the map
+ * @param threshold minimum safe distance for the aircraft
+ * @param order trajectory numbers in the order they're picked from
+ * @param distances (output) distance of each trajectory in order, as from
+ *      TrajectoryClearance(), or 0 for ones after the first past the
+ *      threshold
+ */
+void TrajectoryLibrary::TrajectoryDistances(const StereoOctomap &octomap, const BotTrans &body_to_local, double threshold, const vector<int> &order, vector<double> *distances) const {
+
+    int num_trajectories = order.size();
+
+    distances->assign(num_trajectories, 0);
+
+    // largest distance found so far (-1 for none)
+    std::atomic<double> best(-1);
+
+    // first trajectory (in order) found to be past the threshold
+    std::atomic<int> first_past_threshold(num_trajectories);
+
+    ThreadPool::GetShared()->ParallelFor(0, num_trajectories, [&](int i) {
+
+        if (i > first_past_threshold.load()) {
+            // cancelled, an earlier one is already good enough
+            return;
+        }
+
+        // a trajectory under the threshold and the best so far can't be
+        // picked, whatever it is exactly
+        double best_so_far = best.load();
+        double to_beat = best_so_far >= 0 ? std::min(best_so_far, threshold) : -1;
+
+        double distance = TrajectoryClearance(traj_vec_.at(order[i]), octomap, body_to_local, to_beat);
+
+        (*distances)[i] = distance;
+
+        while (distance > best_so_far && best.compare_exchange_weak(best_so_far, distance) == false) {}
+
+        if (distance > threshold || distance < 0) {
+            int first = first_past_threshold.load();
+
+            while (i < first && first_past_threshold.compare_exchange_weak(first, i) == false) {}
+        }
+    });
+}
+
+/**
+ * Builds the shape index: a bounding sphere around each trajectory (from its
+ * segments' spheres) and trajectories grouped by the TRAJLIB_INDEX_CELL_SIZE
+ * cell they end in, with a sphere around each group.  A group's trajectories
+ * have similar shapes, so its sphere isn't much bigger than theirs, and one
+ * search around it can clear all of them.
+ */
+void TrajectoryLibrary::BuildShapeIndex() {
+
+    int num_trajectories = GetNumberTrajectories();
+
+    traj_sphere_x_.resize(num_trajectories);
+    traj_sphere_y_.resize(num_trajectories);
+    traj_sphere_z_.resize(num_trajectories);
+    traj_sphere_radii_.resize(num_trajectories);
+
+    group_members_.clear();
+
+    // group number of each endpoint cell
+    std::map<std::tuple<int, int, int>, int> cell_groups;
+
+    BotTrans identity;
+    bot_trans_set_identity(&identity);
+
+    for (int i = 0; i < num_trajectories; i++) {
+        const Trajectory &traj = traj_vec_[i];
+
+        int num_segments = traj.GetNumberOfSegments();
+
+        // x, y, z and radius of each segment
+        vector<double> centers(3 * num_segments);
+        vector<double> spheres(4 * num_segments);
+
+        traj.GetXyzYawTransformedSegmentCenters(identity, centers.data());
+
+        for (int j = 0; j < num_segments; j++) {
+            for (int k = 0; k < 3; k++) {
+                spheres[4 * j + k] = centers[3 * j + k];
+            }
+
+            spheres[4 * j + 3] = traj.GetSegmentRadius(j);
+        }
+
+        double sphere[4];
+        BoundingSphere(spheres.data(), num_segments, sphere);
+
+        traj_sphere_x_[i] = sphere[0];
+        traj_sphere_y_[i] = sphere[1];
+        traj_sphere_z_[i] = sphere[2];
+        traj_sphere_radii_[i] = sphere[3];
+
+        // positions only, so lazily loaded trajectories stay that way
+        double end[3];
+        traj.GetXyzYawTransformedPoints(identity, traj.GetNumberOfPoints() - 1, traj.GetNumberOfPoints(), end);
+
+        std::tuple<int, int, int> cell(int(floor(end[0] / TRAJLIB_INDEX_CELL_SIZE)),
+            int(floor(end[1] / TRAJLIB_INDEX_CELL_SIZE)), int(floor(end[2] / TRAJLIB_INDEX_CELL_SIZE)));
+
+        auto found = cell_groups.find(cell);
+
+        if (found == cell_groups.end()) {
+            cell_groups[cell] = group_members_.size();
+            group_members_.push_back(vector<int>(1, i));
+        } else {
+            group_members_[found->second].push_back(i);
+        }
+    }
+
+    int num_groups = group_members_.size();
+
+    group_sphere_x_.resize(num_groups);
+    group_sphere_y_.resize(num_groups);
+    group_sphere_z_.resize(num_groups);
+    group_sphere_radii_.resize(num_groups);
+
+    for (int i = 0; i < num_groups; i++) {
+        vector<double> spheres;
+
+        for (int member : group_members_[i]) {
+            spheres.push_back(traj_sphere_x_[member]);
+            spheres.push_back(traj_sphere_y_[member]);
+            spheres.push_back(traj_sphere_z_[member]);
+            spheres.push_back(traj_sphere_radii_[member]);
+        }
+
+        double sphere[4];
+        BoundingSphere(spheres.data(), group_members_[i].size(), sphere);
+
+        group_sphere_x_[i] = sphere[0];
+        group_sphere_y_[i] = sphere[1];
+        group_sphere_z_[i] = sphere[2];
+        group_sphere_radii_[i] = sphere[3];
+    }
+
+    BuildSweptVolumes();
+}
+
+/**
+ * Finds the trajectories that have no obstacles within the threshold of
+ * their bounding spheres (or their swept volumes, with SetUseSweptVolumes()),
+ * so are all further than that from obstacles (though they might go into the
+ * ground).  Each group is searched around once, and only the trajectories in
+ * groups that aren't clear are checked one by one.
+ *
+ * @param octomap obstacle map
+ * @param body_to_local where the aircraft is in the map
+ * @param threshold minimum safe distance for the aircraft
+ * @param clear (output) for each trajectory, nonzero if it's clear
+ */
+void TrajectoryLibrary::ClearTrajectories(const StereoOctomap &octomap, const BotTrans &body_to_local, double threshold, vector<char> *clear) const {
+
+    clear->assign(GetNumberTrajectories(), 0);
+
+    int num_groups = group_members_.size();
+
+    vector<double> group_centers(3 * num_groups);
+    Trajectory::TransformXyzYaw(body_to_local, group_sphere_x_.data(), group_sphere_y_.data(), group_sphere_z_.data(), num_groups, group_centers.data());
+
+    // cells near obstacles, for the swept volumes
+    vector<uint64_t> occupied;
+
+    for (int i = 0; i < num_groups; i++) {
+        if (octomap.AnyWithin(&group_centers[3 * i], group_sphere_radii_[i] + threshold) == false) {
+            for (int member : group_members_[i]) {
+                (*clear)[member] = 1;
+            }
+
+            continue;
+        }
+
+        if (use_swept_volumes_) {
+            if (occupied.size() == 0) {
+                // once, the first time it's needed
+                RasterizeObstacles(octomap, body_to_local, threshold, &occupied);
+            }
+
+            for (int member : group_members_[i]) {
+                const uint64_t *swept = &swept_bits_[(size_t)member * swept_words_];
+
+                bool overlap = false;
+
+                for (int j = 0; j < swept_words_ && overlap == false; j++) {
+                    overlap = (swept[j] & occupied[j]) != 0;
+                }
+
+                (*clear)[member] = overlap ? 0 : 1;
+            }
+
+            continue;
+        }
+
+        for (int member : group_members_[i]) {
+            double center[3];
+            Trajectory::TransformXyzYaw(body_to_local, &traj_sphere_x_[member], &traj_sphere_y_[member], &traj_sphere_z_[member], 1, center);
+
+            if (octomap.AnyWithin(center, traj_sphere_radii_[member] + threshold) == false) {
+                (*clear)[member] = 1;
+            }
+        }
+    }
+}
+
+/**
+ * A box around every trajectory's points, in the body frame (yawed with
+ * the aircraft, like GetXyzYawTransformedPoints()) and rounded out to the
+ * swept volume grid.  Nothing outside it can be on any trajectory.
+ *
+ * @param low (output) lowest x, y and z (meters)
+ * @param high (output) highest x, y and z
+ *
+ * @retval false if there are no trajectories
+ */
+bool TrajectoryLibrary::GetBoundingBox(double low[3], double high[3]) const {
+
+    if (swept_words_ == 0) {
+        return false;
+    }
+
+    for (int k = 0; k < 3; k++) {
+        low[k] = swept_origin_[k];
+        high[k] = swept_origin_[k] + swept_cells_[k] * TRAJLIB_SWEPT_CELL_SIZE;
+    }
+
+    return true;
+}
+
+/**
+ * Builds the trajectories' swept volumes: a grid in the body frame (yawed
+ * with the aircraft, like GetXyzYawTransformedPoints()) that holds all of
+ * them, and for each trajectory a bitset of the cells its points are in.
+ */
+void TrajectoryLibrary::BuildSweptVolumes() {
+
+    int num_trajectories = GetNumberTrajectories();
+
+    swept_words_ = 0;
+    swept_bits_.clear();
+
+    if (num_trajectories < 1) {
+        return;
+    }
+
+    BotTrans identity;
+    bot_trans_set_identity(&identity);
+
+    // every trajectory's points (positions only, so lazily loaded
+    // trajectories stay that way)
+    vector<vector<double> > points(num_trajectories);
+
+    for (int t = 0; t < num_trajectories; t++) {
+        const Trajectory &traj = traj_vec_[t];
+
+        points[t].resize(3 * traj.GetNumberOfPoints());
+        traj.GetXyzYawTransformedPoints(identity, 0, traj.GetNumberOfPoints(), points[t].data());
+    }
+
+    double low[3], high[3];
+
+    for (int k = 0; k < 3; k++) {
+        low[k] = points[0][k];
+        high[k] = low[k];
+    }
+
+    for (const vector<double> &traj_points : points) {
+        for (size_t i = 0; i < traj_points.size(); i += 3) {
+            for (int k = 0; k < 3; k++) {
+                low[k] = std::min(low[k], traj_points[i + k]);
+                high[k] = std::max(high[k], traj_points[i + k]);
+            }
+        }
+    }
+
+    for (int k = 0; k < 3; k++) {
+        swept_origin_[k] = low[k];
+        swept_cells_[k] = int(floor((high[k] - low[k]) / TRAJLIB_SWEPT_CELL_SIZE)) + 1;
+    }
+
+    int num_cells = swept_cells_[0] * swept_cells_[1] * swept_cells_[2];
+
+    swept_words_ = (num_cells + 63) / 64;
+    swept_bits_.assign((size_t)num_trajectories * swept_words_, 0);
+
+    for (int t = 0; t < num_trajectories; t++) {
+        uint64_t *swept = &swept_bits_[(size_t)t * swept_words_];
+
+        for (size_t i = 0; i < points[t].size(); i += 3) {
+            int cell = GetSweptCell(&points[t][i]);
+
+            swept[cell / 64] |= uint64_t(1) << (cell % 64);
+        }
+    }
+}
+
+/**
+ * @param body_xyz point in the swept volumes' body frame grid
+ *
+ * @retval the point's cell, or -1 if it's not on the grid
+ */
+int TrajectoryLibrary::GetSweptCell(const double body_xyz[3]) const {
+
+    int coords[3];
+
+    for (int k = 0; k < 3; k++) {
+        coords[k] = int(floor((body_xyz[k] - swept_origin_[k]) / TRAJLIB_SWEPT_CELL_SIZE));
+
+        if (coords[k] < 0 || coords[k] >= swept_cells_[k]) {
+            return -1;
+        }
+    }
+
+    return (coords[0] * swept_cells_[1] + coords[1]) * swept_cells_[2] + coords[2];
+}
+
+/**
+ * Marks the swept volume grid's cells that have an obstacle within the
+ * threshold of them (a cube around each obstacle, so maybe a few more).  A
+ * trajectory whose swept volume has none of these cells is further than the
+ * threshold from every obstacle.
+ *
+ * @param octomap obstacle map
+ * @param body_to_local where the aircraft is in the map
+ * @param threshold minimum safe distance for the aircraft
+ * @param occupied (output) the grid's cells near obstacles, as a bitset
+ */
+void TrajectoryLibrary::RasterizeObstacles(const StereoOctomap &octomap, const BotTrans &body_to_local, double threshold, vector<uint64_t> *occupied) const {
+
+    occupied->assign(swept_words_, 0);
+
+    if (swept_words_ == 0) {
+        return;
+    }
+
+    // obstacles within the threshold of the grid, from a sphere around it
+    double center[3], sqr_half_diagonal = 0;
+
+    for (int k = 0; k < 3; k++) {
+        double half_size = swept_cells_[k] * TRAJLIB_SWEPT_CELL_SIZE / 2;
+
+        center[k] = swept_origin_[k] + half_size;
+        sqr_half_diagonal += half_size * half_size;
+    }
+
+    double local_center[3];
+    Trajectory::TransformXyzYaw(body_to_local, &center[0], &center[1], &center[2], 1, local_center);
+
+    vector<double> obstacles;
+    octomap.PointsWithin(local_center, sqrt(sqr_half_diagonal) + threshold, &obstacles);
+
+    // into the body frame
+    double rpy[3];
+    bot_quat_to_roll_pitch_yaw(body_to_local.rot_quat, rpy);
+
+    const double cos_yaw = cos(rpy[2]);
+    const double sin_yaw = sin(rpy[2]);
+
+    for (unsigned int i = 0; i < obstacles.size(); i += 3) {
+        double dx = obstacles[i] - body_to_local.trans_vec[0];
+        double dy = obstacles[i + 1] - body_to_local.trans_vec[1];
+
+        double body[3] = { cos_yaw * dx + sin_yaw * dy, -sin_yaw * dx + cos_yaw * dy, obstacles[i + 2] - body_to_local.trans_vec[2] };
+
+        int low[3], high[3];
+
+        for (int k = 0; k < 3; k++) {
+            low[k] = std::max(0, int(floor((body[k] - threshold - swept_origin_[k]) / TRAJLIB_SWEPT_CELL_SIZE)));
+            high[k] = std::min(swept_cells_[k] - 1, int(floor((body[k] + threshold - swept_origin_[k]) / TRAJLIB_SWEPT_CELL_SIZE)));
+        }
+
+        for (int x = low[0]; x <= high[0]; x++) {
+            for (int y = low[1]; y <= high[1]; y++) {
+                for (int z = low[2]; z <= high[2]; z++) {
+                    int cell = (x * swept_cells_[1] + y) * swept_cells_[2] + z;
+
+                    (*occupied)[cell / 64] |= uint64_t(1) << (cell % 64);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Finds a sphere around spheres (centered on their bounding box).
+ *
+ * @param spheres x, y, z and radius of each sphere
+ * @param num_spheres number of spheres
+ * @param sphere (output) x, y, z and radius of the sphere around them
+ */
+void TrajectoryLibrary::BoundingSphere(const double *spheres, int num_spheres, double sphere[4]) {
+
+    for (int k = 0; k < 3; k++) {
+        double low = spheres[k] - spheres[3];
+        double high = spheres[k] + spheres[3];
+
+        for (int i = 1; i < num_spheres; i++) {
+            low = std::min(low, spheres[4 * i + k] - spheres[4 * i + 3]);
+            high = std::max(high, spheres[4 * i + k] + spheres[4 * i + 3]);
+        }
+
+        sphere[k] = (low + high) / 2;
+    }
+
+    double radius = 0;
+
+    for (int i = 0; i < num_spheres; i++) {
+        const double *this_sphere = &spheres[4 * i];
+
+        double dist = sqrt((this_sphere[0] - sphere[0]) * (this_sphere[0] - sphere[0])
+            + (this_sphere[1] - sphere[1]) * (this_sphere[1] - sphere[1])
+            + (this_sphere[2] - sphere[2]) * (this_sphere[2] - sphere[2]));
+
+        radius = std::max(radius, dist + this_sphere[3]);
+    }
+
+    sphere[3] = radius;
+}
 
 void TrajectoryLibrary::Draw(lcm_t *lcm, const BotTrans *transform) const {
     if (transform == nullptr) {
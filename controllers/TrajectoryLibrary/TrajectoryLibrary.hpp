@@ -15,7 +15,16 @@
 #include <sstream>
 
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <tuple>
+#include <map>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <algorithm>
 
 #include <bot_core/rotations.h>
 #include <bot_frames/bot_frames.h>
@@ -26,29 +35,161 @@
 #include "Trajectory.hpp"
 #include "../../estimators/StereoOctomap/StereoOctomap.hpp"
 
+// LoadLibrary() uses this compiled file in the directory (from
+// trajlib-compile) instead of the CSVs when it's newer than all of them
+#define TRAJLIB_BINARY_FILENAME "trajlib.bin"
+#define TRAJLIB_BINARY_MAGIC "TRAJLIB1"
+
+// the shape index groups trajectories that end in the same cell of this
+// size (in meters, in the body frame)
+#define TRAJLIB_INDEX_CELL_SIZE 5.0
+
+// swept volumes are bitsets on a grid of cells this size (in meters) that
+// moves and yaws with the aircraft
+#define TRAJLIB_SWEPT_CELL_SIZE 1.0
+
+class ThreadPoolGroup;
+
+/**
+ * Start of a compiled library file, followed by a TrajlibBinaryTrajectory
+ * for each trajectory (in order) and then their matrices.
+ */
+struct TrajlibBinaryHeader {
+    char magic[8];
+    int32_t number_of_trajectories;
+    int32_t padding;
+};
+
+/**
+ * Every trajectory's distance to obstacles from one place in one map (see
+ * TrajectoryLibrary::RankTrajectories()), to pick trajectories from later
+ * without searching the map.
+ */
+struct TrajectoryRanking {
+    // each trajectory's distance, as from FindFarthestTrajectory() (-1 for
+    // no obstacles at all), by trajectory number
+    std::vector<double> distances;
+
+    // trajectory numbers, farthest from obstacles first (ties in number
+    // order)
+    std::vector<int> order;
+
+    // with rollout verification (TrajectoryLibrary::SetRolloutVerification()),
+    // which trajectories were rolled out, by trajectory number.  Their
+    // distances are their rollouts' and they come first in order.  Empty
+    // without it.
+    std::vector<char> verified;
+};
+
 class TrajectoryLibrary
 {
 
     public:
         TrajectoryLibrary(double ground_safety_distance = 0);
+        ~TrajectoryLibrary();
 
         void SetGroundSafetyDistance(double dist) { ground_safety_distance_ = dist; }
+
+        // check all of the trajectories at once, a trajectory per thread,
+        // instead of one at a time with the threads on its points
+        void SetParallelTrajectories(bool parallel) { parallel_trajectories_ = parallel; }
+
+        // pick a trajectory that the shape index shows is clear of
+        // obstacles before checking any others point by point
+        void SetUseShapeIndex(bool use_index) { use_shape_index_ = use_index; }
+
+        // with the shape index, check trajectories by their swept volumes
+        // instead of their bounding spheres
+        void SetUseSweptVolumes(bool use_swept) { use_swept_volumes_ = use_swept; }
+
+        // RankTrajectories() rolls out the num_candidates farthest
+        // trajectories from the aircraft's velocity, with the velocity error
+        // dying off over time_constant seconds, and PickTrajectory() only
+        // picks from those.  0 candidates turns it off.
+        void SetRolloutVerification(int num_candidates, double time_constant) {
+            rollout_candidates_ = num_candidates;
+            rollout_time_constant_ = time_constant;
+        }
+
+        // load only the trajectories' positions from a compiled library,
+        // and the rest of each one the first time it's used
+        // (Trajectory::Load()).  Set before LoadLibrary().
+        void SetLazyLoading(bool lazy) { lazy_loading_ = lazy; }
+
+        // with lazy loading, load every trajectory in the background after
+        // the library is loaded, so the first use of one doesn't wait
+        void SetBackgroundPrefetch(bool prefetch) { background_prefetch_ = prefetch; }
+
+        void Prefetch(int number) const;
+
         const Trajectory* GetTrajectoryByNumber(int number) const;
 
         int GetNumberTrajectories() const { return int(traj_vec_.size()); }
 
-        bool LoadLibrary(std::string dirname, bool quiet = false);  // loads a trajectory from a directory of .csv files
+        bool GetBoundingBox(double low[3], double high[3]) const;
+
+        bool LoadLibrary(std::string dirname, bool quiet = false, bool use_binary = true);  // loads a trajectory from a directory of .csv files
+
+        bool LoadBinary(std::string filename, bool quiet = false);
+        bool SaveBinary(std::string filename) const;
 
         std::tuple<double, const Trajectory*> FindFarthestTrajectory(const StereoOctomap &octomap, const BotTrans &bodyToLocal, double threshold, bot_lcmgl_t* lcmgl = nullptr, int preferred_traj = -1) const;
 
+        void RankTrajectories(const StereoOctomap &octomap, const BotTrans &body_to_local, TrajectoryRanking *ranking, const double *body_velocity = nullptr) const;
+        std::tuple<double, const Trajectory*> PickTrajectory(const TrajectoryRanking &ranking, double threshold, int preferred_traj = -1) const;
+
         void Print() const;
         void Draw(lcm_t *lcm, const BotTrans *transform = nullptr) const;
 
 
 
     private:
+        double TrajectoryClearance(const Trajectory &traj, const StereoOctomap &octomap, const BotTrans &body_to_local, double to_beat) const;
+        double RolloutClearance(const Trajectory &traj, const StereoOctomap &octomap, const BotTrans &body_to_local, const double body_velocity[3]) const;
+        void TrajectoryDistances(const StereoOctomap &octomap, const BotTrans &body_to_local, double threshold, const std::vector<int> &order, std::vector<double> *distances) const;
+
+        void BuildShapeIndex();
+        void ClearTrajectories(const StereoOctomap &octomap, const BotTrans &body_to_local, double threshold, std::vector<char> *clear) const;
+        static void BoundingSphere(const double *spheres, int num_spheres, double sphere[4]);
+
+        void BuildSweptVolumes();
+        void RasterizeObstacles(const StereoOctomap &octomap, const BotTrans &body_to_local, double threshold, std::vector<uint64_t> *occupied) const;
+        int GetSweptCell(const double body_xyz[3]) const;
+
         std::vector<Trajectory> traj_vec_;
         double ground_safety_distance_;
+        bool parallel_trajectories_;
+        bool use_shape_index_;
+
+        bool lazy_loading_;
+        bool background_prefetch_;
+
+        // Prefetch()'s loads, on the shared thread pool.  The destructor
+        // cancels the ones that haven't started.
+        mutable std::mutex prefetch_mutex_;
+        mutable std::unique_ptr<ThreadPoolGroup> prefetch_group_;
+        std::atomic<bool> prefetch_cancelled_;
+
+        // shape index (BuildShapeIndex()): a sphere around each trajectory
+        // and around each group of trajectories that end near each other,
+        // in the body frame (x's, y's, z's and radii)
+        std::vector<double> traj_sphere_x_, traj_sphere_y_, traj_sphere_z_, traj_sphere_radii_;
+        std::vector<double> group_sphere_x_, group_sphere_y_, group_sphere_z_, group_sphere_radii_;
+        std::vector<std::vector<int> > group_members_;
+
+        // swept volumes (BuildSweptVolumes()): the cells each trajectory's
+        // points are in, on a body frame grid around all of them.  Cell
+        // (x, y, z) is bit (x * cells[1] + y) * cells[2] + z of the
+        // trajectory's swept_words_ words in swept_bits_.
+        bool use_swept_volumes_;
+        double swept_origin_[3];
+        int swept_cells_[3];
+        int swept_words_;
+        AccountedVector<uint64_t, MEMORY_TRAJECTORIES> swept_bits_;
+
+        // rollout verification (SetRolloutVerification())
+        int rollout_candidates_;
+        double rollout_time_constant_;
 
 };
 
@@ -169,6 +169,79 @@ TEST_F(TrajectoryLibraryTest, LoadTrajectory) {
 
 }
 
+/**
+ * The precomputed samples should match the trajectory's files, with the one
+ * input and gain matrix of a time invariant trajectory at every point.
+ */
+TEST_F(TrajectoryLibraryTest, Samples) {
+    Trajectory traj("trajtest/full/unit-testing-TI-straight-pd-no-yaw-00000", true);
+
+    Eigen::Matrix<double, 3, 12> k0;
+    k0 << 0, 0, 0, 0.4, 0.4, 0, 0, 0, 0, 0.02, 0.02, 0,
+          0, 0, 0, -0.4, 0.4, 0, 0, 0, 0, -0.02, 0.02, 0,
+          0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0;
+
+    Eigen::Vector3d u0(0.19141, 0.19141, 5.0797);
+
+    Eigen::MatrixXd xpoints = traj.GetXpoints();
+
+    for (int i = 0; i < traj.GetNumberOfPoints(); i++) {
+        const TrajectorySample &sample = traj.At(i);
+
+        EXPECT_EQ_ARM(sample.t, traj.GetTimeAtIndex(i));
+
+        Eigen::VectorXd x = xpoints.row(i).tail(12);
+
+        EXPECT_APPROX_MAT(sample.x, x, TOLERANCE);
+        EXPECT_APPROX_MAT(sample.u, u0, TOLERANCE);
+        EXPECT_APPROX_MAT(sample.k, k0, TOLERANCE);
+    }
+
+    // and the two point trajectory, which varies with time
+    Trajectory traj2("trajtest/simple/two-point-00000", true);
+
+    Eigen::Vector3d u1(1, 2, 3);
+
+    EXPECT_APPROX_MAT(traj2.At(1).u, u1, TOLERANCE);
+    EXPECT_APPROX_MAT(traj2.At(1).x, traj2.GetState(0.01), TOLERANCE);
+}
+
+/**
+ * Interpolating lands on the samples at their times and goes in a straight
+ * line between them.
+ */
+TEST_F(TrajectoryLibraryTest, Interpolate) {
+    Trajectory traj("trajtest/simple/two-point-00000", true);
+
+    TrajectorySample sample;
+
+    for (int i = 0; i < traj.GetNumberOfPoints(); i++) {
+        traj.Interpolate(traj.GetTimeAtIndex(i), &sample);
+
+        EXPECT_APPROX_MAT(sample.x, traj.At(i).x, TOLERANCE);
+        EXPECT_APPROX_MAT(sample.u, traj.At(i).u, TOLERANCE);
+        EXPECT_APPROX_MAT(sample.k, traj.At(i).k, TOLERANCE);
+    }
+
+    double t0 = traj.GetTimeAtIndex(0);
+    double t1 = traj.GetTimeAtIndex(1);
+
+    traj.Interpolate(0.25 * t0 + 0.75 * t1, &sample);
+
+    Eigen::Matrix<double, 12, 1> x = 0.25 * traj.At(0).x + 0.75 * traj.At(1).x;
+    Eigen::Vector3d u = 0.25 * traj.At(0).u + 0.75 * traj.At(1).u;
+
+    EXPECT_LT((sample.x - x).norm(), TOLERANCE);
+    EXPECT_LT((sample.u - u).norm(), TOLERANCE);
+
+    // past the ends, it's the ends
+    traj.Interpolate(t0 - 1, &sample);
+    EXPECT_APPROX_MAT(sample.u, traj.At(0).u, TOLERANCE);
+
+    traj.Interpolate(t1 + 1, &sample);
+    EXPECT_APPROX_MAT(sample.u, traj.At(1).u, TOLERANCE);
+}
+
 TEST_F(TrajectoryLibraryTest, MinimumAltitude) {
     Trajectory traj("trajtest/simple/two-point-00000", true);
     EXPECT_EQ_ARM(traj.GetMinimumAltitude(), 0);
@@ -233,6 +306,57 @@ TEST_F(TrajectoryLibraryTest, GetTransformedPoint) {
 
 }
 
+TEST_F(TrajectoryLibraryTest, GetTransformedPoints) {
+    Trajectory traj("trajtest/full/unit-testing-super-aggressive-left-turn-open-loop-00006", true);
+
+    BotTrans trans;
+    bot_trans_set_identity(&trans);
+
+    trans.trans_vec[0] = 3;
+    trans.trans_vec[1] = -2;
+    trans.trans_vec[2] = 10;
+
+    // roll and pitch are ignored, only yaw is used
+    double rpy[3] = { 0.3, -0.2, 2.5 };
+    bot_roll_pitch_yaw_to_quat(rpy, trans.rot_quat);
+
+    BotTrans yaw_trans;
+    bot_trans_copy(&yaw_trans, &trans);
+
+    double yaw_only[3] = { 0, 0, rpy[2] };
+    bot_roll_pitch_yaw_to_quat(yaw_only, yaw_trans.rot_quat);
+
+    int number_of_points = traj.GetNumberOfPoints();
+    std::vector<double> points(3 * number_of_points);
+
+    traj.GetXyzYawTransformedPoints(trans, 0, number_of_points, points.data());
+
+    for (int i = 0; i < number_of_points; i++) {
+        Eigen::VectorXd state = traj.GetState(traj.GetTimeAtIndex(i));
+
+        double point[3] = { state(0), state(1), state(2) };
+        double expected[3];
+
+        bot_trans_apply_vec(&yaw_trans, point, expected);
+
+        for (int j = 0; j < 3; j++) {
+            EXPECT_NEAR(points[3 * i + j], expected[j], TOLERANCE);
+        }
+    }
+
+    // a run from the middle
+    int start = number_of_points / 2;
+
+    traj.GetXyzYawTransformedPoints(trans, start, number_of_points, points.data());
+
+    double output[3];
+    traj.GetXyzYawTransformedPoint(traj.GetTimeAtIndex(start), trans, output);
+
+    for (int j = 0; j < 3; j++) {
+        EXPECT_NEAR(points[j], output[j], TOLERANCE);
+    }
+}
+
 TEST_F(TrajectoryLibraryTest, CheckBounds) {
     Trajectory traj("trajtest/simple/two-point-00000", true);
 
@@ -285,6 +409,148 @@ TEST_F(TrajectoryLibraryTest, LoadLibrary) {
     EXPECT_EQ_ARM(lib.GetTrajectoryByNumber(0)->GetTrajectoryNumber(), 0);
 }
 
+TEST_F(TrajectoryLibraryTest, BoundingBox) {
+    TrajectoryLibrary lib(0);
+
+    double low[3], high[3];
+    EXPECT_FALSE(lib.GetBoundingBox(low, high));
+
+    ASSERT_TRUE(lib.LoadLibrary("trajtest/many", true));
+    ASSERT_TRUE(lib.GetBoundingBox(low, high));
+
+    BotTrans identity;
+    bot_trans_set_identity(&identity);
+
+    // every point of every trajectory is in it
+    for (int t = 0; t < lib.GetNumberTrajectories(); t++) {
+        const Trajectory *traj = lib.GetTrajectoryByNumber(t);
+
+        std::vector<double> points(3 * traj->GetNumberOfPoints());
+        traj->GetXyzYawTransformedPoints(identity, 0, traj->GetNumberOfPoints(), points.data());
+
+        for (size_t i = 0; i < points.size(); i += 3) {
+            for (int k = 0; k < 3; k++) {
+                EXPECT_GE(points[i + k], low[k]);
+                EXPECT_LE(points[i + k], high[k]);
+            }
+        }
+    }
+}
+
+TEST_F(TrajectoryLibraryTest, CompiledLibrary) {
+    TrajectoryLibrary lib(0);
+
+    ASSERT_TRUE(lib.LoadLibrary("trajtest/full", true));
+
+    std::string filename = "/tmp/trajlib-test.bin";
+
+    ASSERT_TRUE(lib.SaveBinary(filename));
+
+    TrajectoryLibrary compiled(0);
+
+    ASSERT_TRUE(compiled.LoadBinary(filename, true));
+
+    ASSERT_EQ(compiled.GetNumberTrajectories(), lib.GetNumberTrajectories());
+
+    for (int i = 0; i < lib.GetNumberTrajectories(); i++) {
+        const Trajectory *traj = lib.GetTrajectoryByNumber(i);
+        const Trajectory *compiled_traj = compiled.GetTrajectoryByNumber(i);
+
+        EXPECT_EQ_ARM(compiled_traj->GetTrajectoryNumber(), i);
+        EXPECT_EQ_ARM(compiled_traj->GetDimension(), traj->GetDimension());
+        EXPECT_EQ_ARM(compiled_traj->GetUDimension(), traj->GetUDimension());
+        EXPECT_EQ_ARM(compiled_traj->GetDT(), traj->GetDT());
+        EXPECT_EQ_ARM(compiled_traj->GetMinimumAltitude(), traj->GetMinimumAltitude());
+
+        EXPECT_TRUE(compiled_traj->GetXpoints() == traj->GetXpoints());
+
+        for (double t = 0; t < traj->GetMaxTime(); t += 0.1) {
+            EXPECT_TRUE(compiled_traj->GetUCommand(t) == traj->GetUCommand(t));
+            EXPECT_TRUE(compiled_traj->GetGainMatrix(t) == traj->GetGainMatrix(t));
+        }
+    }
+
+    // not a compiled library
+    TrajectoryLibrary bad(0);
+
+    EXPECT_FALSE(bad.LoadBinary("trajtest/simple/two-point-00000-x.csv", true));
+    EXPECT_EQ_ARM(bad.GetNumberTrajectories(), 0);
+
+    remove(filename.c_str());
+}
+
+TEST_F(TrajectoryLibraryTest, LazyCompiledLibrary) {
+    TrajectoryLibrary lib(0);
+
+    ASSERT_TRUE(lib.LoadLibrary("trajtest/full", true));
+
+    std::string filename = "/tmp/trajlib-lazy-test.bin";
+
+    ASSERT_TRUE(lib.SaveBinary(filename));
+
+    TrajectoryLibrary lazy(0);
+    lazy.SetLazyLoading(true);
+
+    ASSERT_TRUE(lazy.LoadBinary(filename, true));
+
+    ASSERT_EQ(lazy.GetNumberTrajectories(), lib.GetNumberTrajectories());
+
+    BotTrans trans;
+    bot_trans_set_identity(&trans);
+    trans.trans_vec[0] = 1;
+    trans.trans_vec[2] = 2;
+
+    for (int i = 0; i < lib.GetNumberTrajectories(); i++) {
+        const Trajectory *traj = lib.GetTrajectoryByNumber(i);
+        const Trajectory *lazy_traj = lazy.GetTrajectoryByNumber(i);
+
+        EXPECT_FALSE(lazy_traj->IsLoaded());
+
+        // everything the searches use is there without loading
+        EXPECT_EQ_ARM(lazy_traj->GetNumberOfPoints(), traj->GetNumberOfPoints());
+        EXPECT_EQ_ARM(lazy_traj->GetMaxTime(), traj->GetMaxTime());
+        EXPECT_EQ_ARM(lazy_traj->GetMinimumAltitude(), traj->GetMinimumAltitude());
+        EXPECT_EQ_ARM(lazy_traj->IsTimeInvariant(), traj->IsTimeInvariant());
+        EXPECT_EQ_ARM(lazy_traj->GetNumberOfSegments(), traj->GetNumberOfSegments());
+
+        std::vector<double> points(3 * traj->GetNumberOfPoints()), lazy_points(points.size());
+
+        traj->GetXyzYawTransformedPoints(trans, 0, traj->GetNumberOfPoints(), points.data());
+        lazy_traj->GetXyzYawTransformedPoints(trans, 0, traj->GetNumberOfPoints(), lazy_points.data());
+
+        EXPECT_TRUE(points == lazy_points);
+        EXPECT_FALSE(lazy_traj->IsLoaded());
+
+        // and the rest loads when it's asked for
+        EXPECT_TRUE(lazy_traj->GetXpoints() == traj->GetXpoints());
+        EXPECT_TRUE(lazy_traj->IsLoaded());
+
+        for (double t = 0; t < traj->GetMaxTime(); t += 0.1) {
+            EXPECT_TRUE(lazy_traj->GetUCommand(t) == traj->GetUCommand(t));
+            EXPECT_TRUE(lazy_traj->GetGainMatrix(t) == traj->GetGainMatrix(t));
+        }
+    }
+
+    // prefetched in the background
+    TrajectoryLibrary prefetched(0);
+    prefetched.SetLazyLoading(true);
+    prefetched.SetBackgroundPrefetch(true);
+
+    ASSERT_TRUE(prefetched.LoadBinary(filename, true));
+
+    for (int i = 0; i < prefetched.GetNumberTrajectories(); i++) {
+        const Trajectory *traj = prefetched.GetTrajectoryByNumber(i);
+
+        for (int tries = 0; tries < 1000 && traj->IsLoaded() == false; tries++) {
+            usleep(1000);
+        }
+
+        EXPECT_TRUE(traj->IsLoaded()) << i;
+    }
+
+    remove(filename.c_str());
+}
+
 /**
  * Test FindFarthestTrajectory on:
  *      - no obstacles
@@ -486,6 +752,275 @@ TEST_F(TrajectoryLibraryTest, ManyTrajectoriesWithTransform) {
     EXPECT_NEAR(dist, 0.327772, TOLERANCE);
 }
 
+TEST_F(TrajectoryLibraryTest, SegmentBoundsMatchFullSearch) {
+    StereoOctomap octomap(bot_frames_);
+
+    TrajectoryLibrary lib(0);
+    lib.LoadLibrary("trajtest/full", true);
+
+    double altitude = 30;
+
+    AddManyPointsToOctree(&octomap, x_points_, y_points_, z_points_, number_of_reference_points_, altitude);
+
+    double yaws[4] = { 0, 0.7, -2.1, 3.0 };
+
+    for (int k = 0; k < 4; k++) {
+        BotTrans trans;
+        bot_trans_set_identity(&trans);
+        trans.trans_vec[0] = 2 * k;
+        trans.trans_vec[1] = -k;
+        trans.trans_vec[2] = altitude;
+
+        double rpy[3] = { 0, 0, yaws[k] };
+        bot_roll_pitch_yaw_to_quat(rpy, trans.rot_quat);
+
+        // every point of every trajectory
+        double best_dist = -1;
+        int best_number = -1;
+
+        for (int i = 0; i < lib.GetNumberTrajectories(); i++) {
+            double traj_dist = lib.GetTrajectoryByNumber(i)->ClosestObstacleInRemainderOfTrajectory(octomap, trans, 0, 0);
+
+            if (best_number < 0 || traj_dist > best_dist) {
+                best_dist = traj_dist;
+                best_number = i;
+            }
+        }
+
+        double dist;
+        const Trajectory *best_traj;
+
+        // a threshold that nothing meets, so every trajectory is checked
+        std::tie(dist, best_traj) = lib.FindFarthestTrajectory(octomap, trans, 1000);
+
+        ASSERT_TRUE(best_traj != nullptr);
+        EXPECT_EQ_ARM(best_traj->GetTrajectoryNumber(), best_number);
+        EXPECT_NEAR(dist, best_dist, TOLERANCE);
+    }
+}
+
+TEST_F(TrajectoryLibraryTest, ParallelTrajectoriesMatchSerial) {
+    StereoOctomap octomap(bot_frames_);
+
+    TrajectoryLibrary lib(0);
+    lib.LoadLibrary("trajtest/full", true);
+
+    TrajectoryLibrary parallel_lib(0);
+    parallel_lib.LoadLibrary("trajtest/full", true);
+    parallel_lib.SetParallelTrajectories(true);
+
+    double altitude = 30;
+
+    AddManyPointsToOctree(&octomap, x_points_, y_points_, z_points_, number_of_reference_points_, altitude);
+
+    BotTrans trans;
+    bot_trans_set_identity(&trans);
+    trans.trans_vec[2] = altitude;
+
+    double thresholds[3] = { 0.5, 2.0, 1000 };
+
+    for (int k = 0; k < 3; k++) {
+        // with and without a preferred trajectory
+        for (int preferred = -1; preferred < lib.GetNumberTrajectories(); preferred += 3) {
+            double dist, parallel_dist;
+            const Trajectory *best_traj, *parallel_best_traj;
+
+            std::tie(dist, best_traj) = lib.FindFarthestTrajectory(octomap, trans, thresholds[k], nullptr, preferred);
+            std::tie(parallel_dist, parallel_best_traj) = parallel_lib.FindFarthestTrajectory(octomap, trans, thresholds[k], nullptr, preferred);
+
+            ASSERT_TRUE(best_traj != nullptr);
+            ASSERT_TRUE(parallel_best_traj != nullptr);
+
+            EXPECT_EQ_ARM(parallel_best_traj->GetTrajectoryNumber(), best_traj->GetTrajectoryNumber());
+            EXPECT_NEAR(parallel_dist, dist, TOLERANCE);
+        }
+    }
+
+    // no obstacles
+    StereoOctomap empty_octomap(bot_frames_);
+
+    double dist;
+    const Trajectory *best_traj;
+
+    std::tie(dist, best_traj) = parallel_lib.FindFarthestTrajectory(empty_octomap, trans, 2.0, nullptr, 2);
+
+    EXPECT_EQ_ARM(best_traj->GetTrajectoryNumber(), 2);
+    EXPECT_EQ_ARM(dist, -1);
+}
+
+TEST_F(TrajectoryLibraryTest, ShapeIndex) {
+    StereoOctomap octomap(bot_frames_);
+
+    TrajectoryLibrary lib(0);
+    lib.LoadLibrary("trajtest/full", true);
+
+    TrajectoryLibrary index_lib(0);
+    index_lib.LoadLibrary("trajtest/full", true);
+    index_lib.SetUseShapeIndex(true);
+
+    double altitude = 30;
+
+    AddManyPointsToOctree(&octomap, x_points_, y_points_, z_points_, number_of_reference_points_, altitude);
+
+    BotTrans trans;
+    bot_trans_set_identity(&trans);
+    trans.trans_vec[2] = altitude;
+
+    double thresholds[3] = { 0.5, 2.0, 1000 };
+
+    // with bounding spheres and then with swept volumes
+    for (int swept = 0; swept < 2; swept++) {
+        index_lib.SetUseSweptVolumes(swept == 1);
+
+        for (int k = 0; k < 3; k++) {
+            double dist, index_dist;
+            const Trajectory *best_traj, *index_best_traj;
+
+            std::tie(dist, best_traj) = lib.FindFarthestTrajectory(octomap, trans, thresholds[k]);
+            std::tie(index_dist, index_best_traj) = index_lib.FindFarthestTrajectory(octomap, trans, thresholds[k]);
+
+            ASSERT_TRUE(best_traj != nullptr);
+            ASSERT_TRUE(index_best_traj != nullptr);
+
+            if (dist > thresholds[k]) {
+                // any trajectory past the threshold will do, but its distance
+                // should be exact
+                EXPECT_TRUE(index_dist > thresholds[k]);
+                EXPECT_NEAR(index_dist, index_best_traj->ClosestObstacleInRemainderOfTrajectory(octomap, trans, 0, 0), TOLERANCE);
+            } else {
+                EXPECT_EQ_ARM(index_best_traj->GetTrajectoryNumber(), best_traj->GetTrajectoryNumber());
+                EXPECT_NEAR(index_dist, dist, TOLERANCE);
+            }
+        }
+    }
+
+    // an obstacle far away from everything, so the preferred trajectory is
+    // clear without checking its points
+    StereoOctomap far_octomap(bot_frames_);
+
+    double far_point[3] = { 500, 500, 0 };
+    AddPointToOctree(&far_octomap, far_point, altitude);
+
+    double dist;
+    const Trajectory *best_traj;
+
+    std::tie(dist, best_traj) = index_lib.FindFarthestTrajectory(far_octomap, trans, 2.0, nullptr, 2);
+
+    ASSERT_TRUE(best_traj != nullptr);
+    EXPECT_EQ_ARM(best_traj->GetTrajectoryNumber(), 2);
+    EXPECT_NEAR(dist, best_traj->ClosestObstacleInRemainderOfTrajectory(far_octomap, trans, 0, 0), TOLERANCE);
+}
+
+TEST_F(TrajectoryLibraryTest, RankedPick) {
+    StereoOctomap octomap(bot_frames_);
+
+    TrajectoryLibrary lib(0);
+    lib.LoadLibrary("trajtest/full", true);
+
+    double altitude = 30;
+
+    AddManyPointsToOctree(&octomap, x_points_, y_points_, z_points_, number_of_reference_points_, altitude);
+
+    BotTrans trans;
+    bot_trans_set_identity(&trans);
+    trans.trans_vec[2] = altitude;
+
+    TrajectoryRanking ranking;
+    lib.RankTrajectories(octomap, trans, &ranking);
+
+    ASSERT_EQ((int)ranking.order.size(), lib.GetNumberTrajectories());
+
+    for (int i = 1; i < (int)ranking.order.size(); i++) {
+        EXPECT_GE(ranking.distances[ranking.order[i - 1]], ranking.distances[ranking.order[i]]);
+    }
+
+    double thresholds[3] = { 0.5, 2.0, 1000 };
+    int preferred[2] = { -1, 2 };
+
+    for (int k = 0; k < 3; k++) {
+        for (int j = 0; j < 2; j++) {
+            double dist, ranked_dist;
+            const Trajectory *best_traj, *ranked_traj;
+
+            std::tie(dist, best_traj) = lib.FindFarthestTrajectory(octomap, trans, thresholds[k], nullptr, preferred[j]);
+            std::tie(ranked_dist, ranked_traj) = lib.PickTrajectory(ranking, thresholds[k], preferred[j]);
+
+            ASSERT_TRUE(best_traj != nullptr);
+            ASSERT_TRUE(ranked_traj != nullptr);
+
+            EXPECT_EQ_ARM(ranked_traj->GetTrajectoryNumber(), best_traj->GetTrajectoryNumber());
+            EXPECT_NEAR(ranked_dist, dist, TOLERANCE);
+        }
+    }
+}
+
+TEST_F(TrajectoryLibraryTest, RolloutVerification) {
+    StereoOctomap octomap(bot_frames_);
+
+    TrajectoryLibrary lib(0);
+    lib.LoadLibrary("trajtest/full", true);
+
+    double altitude = 30;
+
+    AddManyPointsToOctree(&octomap, x_points_, y_points_, z_points_, number_of_reference_points_, altitude);
+
+    BotTrans trans;
+    bot_trans_set_identity(&trans);
+    trans.trans_vec[2] = altitude;
+
+    TrajectoryRanking nominal;
+    lib.RankTrajectories(octomap, trans, &nominal);
+
+    EXPECT_TRUE(nominal.verified.empty());
+
+    // a velocity error that dies off right away flies the trajectories
+    lib.SetRolloutVerification(2, 0.000001);
+
+    double velocity[3] = { 0, 20, 0 };
+
+    TrajectoryRanking ranking;
+    lib.RankTrajectories(octomap, trans, &ranking, velocity);
+
+    ASSERT_EQ((int)ranking.verified.size(), lib.GetNumberTrajectories());
+
+    int num_verified = 0;
+
+    for (int i = 0; i < lib.GetNumberTrajectories(); i++) {
+        EXPECT_NEAR(ranking.distances[i], nominal.distances[i], TOLERANCE);
+        num_verified += ranking.verified[i];
+    }
+
+    EXPECT_EQ_ARM(num_verified, 2);
+    EXPECT_TRUE(ranking.verified[nominal.order[0]] && ranking.verified[nominal.order[1]]);
+
+    // a big sideways error moves where the candidates go, and only they can
+    // be picked
+    lib.SetRolloutVerification(2, 1.0);
+    lib.RankTrajectories(octomap, trans, &ranking, velocity);
+
+    double thresholds[3] = { 0.5, 2.0, 1000 };
+
+    for (int k = 0; k < 3; k++) {
+        double dist;
+        const Trajectory *traj;
+
+        std::tie(dist, traj) = lib.PickTrajectory(ranking, thresholds[k], -1);
+
+        ASSERT_TRUE(traj != nullptr);
+        EXPECT_TRUE(ranking.verified[traj->GetTrajectoryNumber()]);
+        EXPECT_NEAR(dist, ranking.distances[traj->GetTrajectoryNumber()], TOLERANCE);
+    }
+
+    // nothing is far enough away, so it's the farthest rollout
+    double dist;
+    const Trajectory *traj;
+    std::tie(dist, traj) = lib.PickTrajectory(ranking, 1000, -1);
+
+    if (ranking.distances[ranking.order[0]] >= 0) {
+        EXPECT_EQ_ARM(traj->GetTrajectoryNumber(), ranking.order[0]);
+    }
+}
+
 TEST_F(TrajectoryLibraryTest, ManyPointsAgainstMatlab) {
     StereoOctomap octomap(bot_frames_);
     double altitude = 30;
@@ -685,6 +1220,61 @@ TEST_F(TrajectoryLibraryTest, RemainderTrajectoryTi) {
 
 }
 
+TEST_F(TrajectoryLibraryTest, RemainderTrajectoryCached) {
+    StereoOctomap octomap(bot_frames_);
+
+    TrajectoryLibrary lib(0);
+    lib.LoadLibrary("trajtest/many", true);
+
+    double altitude = 30;
+    BotTrans trans;
+    bot_trans_set_identity(&trans);
+    trans.trans_vec[2] = altitude;
+
+    const Trajectory *traj = lib.GetTrajectoryByNumber(1);
+
+    TrajectoryClearanceCache cache, bounded_cache;
+
+    EXPECT_EQ_ARM(traj->ClosestObstacleInRemainderOfTrajectory(octomap, trans, 0, 0, -1, &cache), -1);
+
+    // points near and far from the trajectory, one at a time, and the
+    // cached answers match searching everything
+    double points[][3] = { { 6.65, -7.23, 9.10 }, { 50, 40, 2 }, { 2, 0.5, 0.2 }, { -30, 10, -5 }, { 3, -1, 0.5 } };
+
+    for (int i = 0; i < 5; i++) {
+        AddPointToOctree(&octomap, points[i], altitude);
+
+        for (double t : { 0.0, 0.5, 0.95 }) {
+            EXPECT_NEAR(traj->ClosestObstacleInRemainderOfTrajectory(octomap, trans, t, 0, -1, &cache),
+                traj->ClosestObstacleInRemainderOfTrajectory(octomap, trans, t, 0), TOLERANCE) << i << " " << t;
+
+            EXPECT_NEAR(traj->ClosestObstacleInRemainderOfTrajectory(octomap, trans, t, 0, 2.0, &bounded_cache),
+                traj->ClosestObstacleInRemainderOfTrajectory(octomap, trans, t, 0, 2.0), TOLERANCE) << i << " " << t;
+        }
+    }
+
+    // a point far from everything only gets the points near it searched
+    int64_t searched = cache.GetNumSearched();
+    int64_t reused = cache.GetNumReused();
+
+    double far_point[3] = { 200, 200, 0 };
+    AddPointToOctree(&octomap, far_point, altitude);
+
+    EXPECT_NEAR(traj->ClosestObstacleInRemainderOfTrajectory(octomap, trans, 0.95, 0, -1, &cache),
+        traj->ClosestObstacleInRemainderOfTrajectory(octomap, trans, 0.95, 0), TOLERANCE);
+
+    EXPECT_EQ(cache.GetNumSearched(), searched);
+    EXPECT_GT(cache.GetNumReused(), reused);
+
+    // moving searches everything again
+    trans.trans_vec[0] = 1;
+
+    EXPECT_NEAR(traj->ClosestObstacleInRemainderOfTrajectory(octomap, trans, 0.95, 0, -1, &cache),
+        traj->ClosestObstacleInRemainderOfTrajectory(octomap, trans, 0.95, 0), TOLERANCE);
+
+    EXPECT_GT(cache.GetNumSearched(), searched);
+}
+
 TEST_F(TrajectoryLibraryTest, FindFarthestWithTI) {
     StereoOctomap octomap(bot_frames_);
 
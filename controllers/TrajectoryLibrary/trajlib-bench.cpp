@@ -0,0 +1,347 @@
+/*
+ * Benchmark for searching the trajectory library.
+ *
+ * Examples:
+ *   ./trajlib-bench -c ../../config/plane.cfg -d trajtest/full -n 10,100,1000,5000
+ *   ./trajlib-bench -c ../../config/plane.cfg -d trajtest/full -p map-points.txt -I -S
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2013-2015
+ *
+ */
+
+#include "trajlib-bench.hpp"
+
+// every allocation in the program, so a search's can be counted
+static std::atomic<int64_t> num_allocations(0);
+
+void* operator new(size_t size) {
+    num_allocations.fetch_add(1, std::memory_order_relaxed);
+
+    void *ptr = malloc(size);
+
+    if (ptr == NULL) {
+        throw std::bad_alloc();
+    }
+
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+    free(ptr);
+}
+
+int main(int argc, char *argv[]) {
+
+    string config_file = "";
+    string trajectory_dir = "";
+    string points_file = "";
+    string sizes_str = "10,100,1000,5000";
+    string output_file = "";
+    int num_trees = 200;
+    int num_searches = 200;
+    int seed = 0;
+    double threshold = 2.0;
+    bool parallel = false;
+    bool shape_index = false;
+    bool swept_volumes = false;
+
+    ConciseArgs parser(argc, argv);
+    parser.add(config_file, "c", "config", "Configuration file (like config/plane.cfg) with the camera's frames.", true);
+    parser.add(trajectory_dir, "d", "trajectory-dir", "Trajectory library to search with.", true);
+    parser.add(points_file, "p", "points", "Search a map of these points (x, y, z in the local frame on each line, like StereoOctomap::PrintAllPoints() prints) instead of a random forest.");
+    parser.add(sizes_str, "n", "sizes", "Library sizes to search with, comma separated.  The library is repeated until it's at least each size.");
+    parser.add(num_trees, "f", "trees", "Number of trees in the random forest.");
+    parser.add(num_searches, "s", "searches", "Number of searches for each library size.");
+    parser.add(seed, "r", "seed", "Random seed for the forest and where the aircraft is.");
+    parser.add(threshold, "t", "threshold", "Distance a trajectory has to be from obstacles to be picked.");
+    parser.add(parallel, "P", "parallel", "Check every trajectory at once (SetParallelTrajectories()).");
+    parser.add(shape_index, "I", "shape-index", "Use the shape index (SetUseShapeIndex()).");
+    parser.add(swept_volumes, "S", "swept-volumes", "Use swept volumes with the shape index (SetUseSweptVolumes()).");
+    parser.add(output_file, "o", "output", "Write the CSV results to this file instead of stdout.");
+    parser.parse();
+
+    vector<int> sizes;
+
+    if (ParseSizes(sizes_str, &sizes) == false) {
+        fprintf(stderr, "Error: failed to parse library sizes \"%s\".\n", sizes_str.c_str());
+        return 1;
+    }
+
+    BotParam *param = bot_param_new_from_file(config_file.c_str());
+
+    if (param == NULL) {
+        fprintf(stderr, "Failed to parse configuration file, quitting.\n");
+        return 1;
+    }
+
+    lcm_t *lcm = lcm_create("memq://");
+
+    if (lcm == NULL) {
+        fprintf(stderr, "Error: LCM creation failed.\n");
+        return 1;
+    }
+
+    BotFrames *bot_frames = bot_frames_new(lcm, param);
+
+    // the aircraft is at the origin of the local frame, this high up
+    double altitude = 30;
+
+    vector<double> points;
+
+    if (points_file.length() > 0) {
+        if (LoadPoints(points_file, &points) == false) {
+            fprintf(stderr, "Error: failed to read points from %s.\n", points_file.c_str());
+            return 1;
+        }
+    } else {
+        MakeForest(num_trees, seed, altitude, &points);
+    }
+
+    StereoOctomap octomap(bot_frames);
+    InsertPoints(bot_frames, points, &octomap);
+
+    fprintf(stderr, "%d points in the map, %d voxels\n", int(points.size() / 3), octomap.GetNumVoxels());
+
+    FILE *out = stdout;
+
+    if (output_file.length() > 0) {
+        out = fopen(output_file.c_str(), "w");
+
+        if (out == NULL) {
+            fprintf(stderr, "Error: failed to open %s for writing.\n", output_file.c_str());
+            return 1;
+        }
+    }
+
+    fprintf(out, "trajectories,searches,search_p50_ms,search_p99_ms,search_max_ms,queries_per_search,allocations_per_search\n");
+
+    for (int size : sizes) {
+
+        TrajectoryLibrary trajlib;
+
+        while (trajlib.GetNumberTrajectories() < size) {
+            if (trajlib.LoadLibrary(trajectory_dir, true) == false) {
+                fprintf(stderr, "Error: failed to load the trajectory library from %s.\n", trajectory_dir.c_str());
+                return 1;
+            }
+        }
+
+        trajlib.SetParallelTrajectories(parallel);
+        trajlib.SetUseShapeIndex(shape_index);
+        trajlib.SetUseSweptVolumes(swept_volumes);
+
+        // the same places for each size
+        std::default_random_engine rand_engine(seed);
+        std::uniform_real_distribution<double> yaw_dist(-0.3, 0.3);
+        std::uniform_real_distribution<double> offset_dist(-5, 5);
+
+        TrajlibBenchResult result;
+        result.trajectories = trajlib.GetNumberTrajectories();
+        result.searches = num_searches;
+
+        int64_t queries = 0, allocations = 0;
+
+        for (int i = 0; i < num_searches; i++) {
+            BotTrans body_to_local;
+            bot_trans_set_identity(&body_to_local);
+
+            body_to_local.trans_vec[0] = offset_dist(rand_engine);
+            body_to_local.trans_vec[1] = offset_dist(rand_engine);
+            body_to_local.trans_vec[2] = altitude;
+
+            double rpy[3] = { 0, 0, yaw_dist(rand_engine) };
+            bot_roll_pitch_yaw_to_quat(rpy, body_to_local.rot_quat);
+
+            int64_t queries_before = octomap.GetNumQueries();
+            int64_t allocations_before = num_allocations.load();
+
+            int64_t start = GetRawMonotonicNow();
+            trajlib.FindFarthestTrajectory(octomap, body_to_local, threshold);
+            int64_t end = GetRawMonotonicNow();
+
+            allocations += num_allocations.load() - allocations_before;
+            queries += octomap.GetNumQueries() - queries_before;
+
+            result.search_ms.push_back(ElapsedMs(start, end));
+        }
+
+        result.queries_per_search = num_searches > 0 ? double(queries) / num_searches : 0;
+        result.allocations_per_search = num_searches > 0 ? double(allocations) / num_searches : 0;
+
+        WriteResult(out, &result);
+    }
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    return 0;
+}
+
+/**
+ * Makes a random forest: tree trunks (vertical lines of points) in front of
+ * the aircraft, from the ground to above it.
+ *
+ * @param num_trees number of trees
+ * @param seed random seed
+ * @param altitude how high the aircraft is
+ * @param xyz (output) x, y, z of each point in the local frame
+ */
+void MakeForest(int num_trees, int seed, double altitude, vector<double> *xyz) {
+
+    std::default_random_engine rand_engine(seed);
+    std::uniform_real_distribution<double> x_dist(5, 80);
+    std::uniform_real_distribution<double> y_dist(-40, 40);
+    std::uniform_real_distribution<double> height_dist(altitude, 2 * altitude);
+
+    xyz->clear();
+
+    for (int i = 0; i < num_trees; i++) {
+        double x = x_dist(rand_engine);
+        double y = y_dist(rand_engine);
+        double height = height_dist(rand_engine);
+
+        // a point in each voxel up the trunk
+        for (double z = 0; z < height; z += OCTOMAP_VOXEL_SIZE) {
+            xyz->push_back(x);
+            xyz->push_back(y);
+            xyz->push_back(z);
+        }
+    }
+}
+
+/**
+ * Reads points, one x, y, z on each line either as "x, y, z" or as
+ * StereoOctomap::PrintAllPoints() prints them: "(x, y, z)".
+ *
+ * @param filename file to read
+ * @param xyz (output) x, y, z of each point
+ *
+ * @retval false if the file couldn't be read or had no points
+ */
+bool LoadPoints(string filename, vector<double> *xyz) {
+
+    FILE *file = fopen(filename.c_str(), "r");
+
+    if (file == NULL) {
+        return false;
+    }
+
+    xyz->clear();
+
+    char line[256];
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        double point[3];
+
+        if (sscanf(line, " (%lf, %lf, %lf)", &point[0], &point[1], &point[2]) == 3
+            || sscanf(line, "%lf, %lf, %lf", &point[0], &point[1], &point[2]) == 3) {
+
+            xyz->insert(xyz->end(), point, point + 3);
+        }
+    }
+
+    fclose(file);
+
+    return xyz->size() > 0;
+}
+
+/**
+ * Puts points in the map like the stereo system would: in one message, in
+ * the camera's frame.
+ *
+ * @param bot_frames frames with the camera
+ * @param xyz x, y, z of each point in the local frame
+ * @param octomap map to put them in
+ */
+void InsertPoints(BotFrames *bot_frames, const vector<double> &xyz, StereoOctomap *octomap) {
+
+    BotTrans local_to_camera;
+    bot_frames_get_trans(bot_frames, "local", "opencvFrame", &local_to_camera);
+
+    lcmt::stereo msg;
+
+    msg.timestamp = GetTimestampNow();
+
+    for (unsigned int i = 0; i < xyz.size(); i += 3) {
+        double point[3];
+
+        bot_trans_apply_vec(&local_to_camera, &xyz[i], point);
+
+        msg.x.push_back(point[0]);
+        msg.y.push_back(point[1]);
+        msg.z.push_back(point[2]);
+    }
+
+    msg.number_of_points = msg.x.size();
+    msg.frame_number = 0;
+    msg.video_number = 0;
+
+    octomap->ProcessStereoMessage(&msg);
+}
+
+/**
+ * @param sizes_str comma separated sizes, like "10,100,1000"
+ * @param sizes (output) the sizes
+ *
+ * @retval false if any of them isn't a positive number
+ */
+bool ParseSizes(string sizes_str, vector<int> *sizes) {
+
+    sizes->clear();
+
+    size_t start = 0;
+
+    while (start <= sizes_str.length()) {
+        size_t end = sizes_str.find(',', start);
+
+        if (end == string::npos) {
+            end = sizes_str.length();
+        }
+
+        int size = atoi(sizes_str.substr(start, end - start).c_str());
+
+        if (size < 1) {
+            return false;
+        }
+
+        sizes->push_back(size);
+
+        start = end + 1;
+    }
+
+    return sizes->size() > 0;
+}
+
+float ElapsedMs(int64_t start_usec, int64_t end_usec) {
+    return (end_usec - start_usec) / 1000.0f;
+}
+
+/**
+ * @param values times to take the percentile of (gets sorted)
+ * @param percent 0 to 100
+ *
+ * @retval the percentile, or 0 if there are no values
+ */
+float Percentile(vector<float> *values, int percent) {
+    if (values->size() == 0) {
+        return 0;
+    }
+
+    sort(values->begin(), values->end());
+
+    return (*values)[min(values->size() - 1, (values->size() * percent) / 100)];
+}
+
+/**
+ * Writes one library size's results as a line of CSV.
+ *
+ * @param out file to write to
+ * @param result the results (the times get sorted)
+ */
+void WriteResult(FILE *out, TrajlibBenchResult *result) {
+
+    fprintf(out, "%d,%d,%.3f,%.3f,%.3f,%.1f,%.1f\n", result->trajectories, result->searches,
+        Percentile(&result->search_ms, 50), Percentile(&result->search_ms, 99), Percentile(&result->search_ms, 100),
+        result->queries_per_search, result->allocations_per_search);
+}
@@ -0,0 +1,58 @@
+/*
+ * Benchmark for searching the trajectory library.  Builds an obstacle map
+ * (a random forest, or points saved from a flight) and times
+ * FindFarthestTrajectory() on it with libraries of different sizes, to
+ * check search optimizations against.
+ *
+ * Prints, for each library size, the search time's distribution and how
+ * many map lookups and allocations a search takes, as CSV.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2013-2015
+ *
+ */
+
+#ifndef TRAJLIB_BENCH_HPP
+#define TRAJLIB_BENCH_HPP
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <atomic>
+#include <new>
+
+#include <lcm/lcm.h>
+
+#include "../../externals/ConciseArgs.hpp"
+#include "../../utils/utils/RealtimeUtils.hpp"
+
+#include "TrajectoryLibrary.hpp"
+
+using namespace std;
+
+// how the searches went for one library size
+struct TrajlibBenchResult {
+    int trajectories;
+    int searches;
+
+    vector<float> search_ms;
+
+    double queries_per_search;
+    double allocations_per_search;
+};
+
+void MakeForest(int num_trees, int seed, double altitude, vector<double> *xyz);
+bool LoadPoints(string filename, vector<double> *xyz);
+void InsertPoints(BotFrames *bot_frames, const vector<double> &xyz, StereoOctomap *octomap);
+
+bool ParseSizes(string sizes_str, vector<int> *sizes);
+
+float ElapsedMs(int64_t start_usec, int64_t end_usec);
+float Percentile(vector<float> *values, int percent);
+
+void WriteResult(FILE *out, TrajlibBenchResult *result);
+
+#endif
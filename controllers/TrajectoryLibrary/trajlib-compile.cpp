@@ -0,0 +1,50 @@
+/*
+ * Compiles a directory of trajectory CSVs into one file that
+ * TrajectoryLibrary::LoadLibrary() loads much faster.
+ *
+ * Example:
+ *   ./trajlib-compile -d trajlib/
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2013-2015
+ *
+ */
+
+#include "TrajectoryLibrary.hpp"
+#include "../../externals/ConciseArgs.hpp"
+
+int main(int argc, char **argv) {
+
+    std::string dirname = "";
+    std::string output_file = "";
+    bool quiet = false;
+
+    ConciseArgs parser(argc, argv);
+    parser.add(dirname, "d", "directory", "Directory of trajectory CSVs to compile.", true);
+    parser.add(output_file, "o", "output", "File to write (defaults to " TRAJLIB_BINARY_FILENAME " in the directory, where LoadLibrary looks for it).");
+    parser.add(quiet, "q", "quiet", "Don't print each file loaded.");
+    parser.parse();
+
+    if (dirname.back() != '/') {
+        dirname.append("/");
+    }
+
+    if (output_file.length() == 0) {
+        output_file = dirname + TRAJLIB_BINARY_FILENAME;
+    }
+
+    TrajectoryLibrary lib;
+
+    // from the CSVs, even if there's a compiled file already
+    if (lib.LoadLibrary(dirname, quiet, false) == false) {
+        std::cerr << "ERROR: failed to load the trajectories in " << dirname << std::endl;
+        return 1;
+    }
+
+    if (lib.SaveBinary(output_file) == false) {
+        return 1;
+    }
+
+    std::cout << "Wrote " << lib.GetNumberTrajectories() << " trajectorie(s) to " << output_file << std::endl;
+
+    return 0;
+}
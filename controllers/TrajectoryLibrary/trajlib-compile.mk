@@ -0,0 +1,5 @@
+TARGET = trajlib-compile
+SOURCES = trajlib-compile.cpp Trajectory.cpp TrajectoryLibrary.cpp ../../utils/utils/RealtimeUtils.cpp ../../utils/CsvReader/CsvReader.cpp ../../estimators/StereoOctomap/StereoOctomap.cpp ../../utils/ThreadPool/ThreadPool.cpp
+
+# include a standard makefile that uses these variables and builds everything
+include ../../utils/make/flight.mk
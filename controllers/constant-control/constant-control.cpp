@@ -13,6 +13,7 @@
 #include "lcmtypes/mav_pose_t.h" // from pronto
 
 #include "../../externals/ConciseArgs.hpp"
+#include "../../utils/utils/Clock.hpp"
 
 lcm_t * lcm;
 lcmt_deltawing_u_subscription_t * mav_pose_sub;
@@ -33,20 +34,13 @@ void sighandler(int dum)
     exit(0);
 }
 
-int64_t getTimestampNow()
-{
-    struct timeval thisTime;
-    gettimeofday(&thisTime, NULL);
-    return (thisTime.tv_sec * 1000000.0) + (float)thisTime.tv_usec + 0.5;
-}
-
 void pose_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_deltawing_u *msg, void *user)
 {
     // publish control message
 
     lcmt_deltawing_u delta_u;
 
-    delta_u.timestamp = getTimestampNow();
+    delta_u.timestamp = GetWallNow();
     delta_u.throttle = 0;
     delta_u.elevonL = 128;
     delta_u.elevonR = 128;
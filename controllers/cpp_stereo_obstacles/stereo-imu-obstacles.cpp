@@ -9,81 +9,57 @@
 
 #include "stereo-imu-obstacles.hpp"
 
-#define PUBLISH_MAP_TO_STEREO_AT_EVERY_FRAME
-
-
 using Eigen::Matrix3d;
 using Eigen::Vector3d;
 
 using namespace std;
-using namespace octomap;
 
-lcm_t * lcm;
-char *lcm_out = NULL;
+lcm::LCM *lcm_obj;
 int numFrames = 0;
 unsigned long totalTime = 0;
 
 bool disable_filtering = false;
 
-int64_t currentOctreeTimestamp, buildingOctreeTimestamp;
-
 // global trajectory library
 TrajectoryLibrary trajlib;
 
 bot_lcmgl_t* lcmgl;
 
 
-// globals for subscription functions, so we can unsubscribe in the control-c handler
-lcmt_stereo_subscription_t * stereo_sub;
+// globals for subscription functions, so we can unsubscribe and print
+// stats in the control-c handler
+lcm::Subscription *stereo_sub;
+StereoPointPipeline *pipeline;
 
 
 
-
-
-void stereo_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo *msg, void *user) {
+void stereo_handler(const lcm::ReceiveBuffer *rbuf, const std::string &chan, const lcmt::stereo *msg, StereoHandlerData *data) {
 
     // start the rate clock
     struct timeval start, now;
     unsigned long elapsed;
     gettimeofday( &start, NULL );
 
+    // get transform from the camera to local now, since the transforms
+    // update live
+    BotTrans to_open_cv;
+    bot_frames_get_trans(data->bot_frames, "opencvFrame", "local", &to_open_cv);
 
-
-    StereoHandlerData *data = (StereoHandlerData*)user;
-
-    StereoOctomap *octomap = data->octomap;
-    StereoFilter *filter = data->filter;
-
-    lcmt_stereo *filtered_msg;
-
-    // filter the stereo message
-    if (disable_filtering == false) {
-        filtered_msg = filter->ProcessMessage(msg);
-    } else {
-        filtered_msg = lcmt_stereo_copy(msg);
-    }
-
-    //cout << "Number of points: " << msg->number_of_points << " --> " << filtered_msg->number_of_points << endl;
-
-    octomap->ProcessStereoMessage(filtered_msg);
+    // filter the stereo message and add what's left to the map
+    data->pipeline->ProcessStereoMessage(*msg, &to_open_cv, data->octomap);
 
     if (numFrames%15 == 0) {
-        octomap->PublishOctomap(lcm);
+        data->octomap->PublishToHud(lcm_obj->getUnderlyingLCM());
+        data->pipeline->PublishPrimitives(lcm_obj->getUnderlyingLCM());
     }
 
-    #ifdef PUBLISH_MAP_TO_STEREO_AT_EVERY_FRAME
-
-        octomap->PublishToStereo(lcm, msg->frame_number, msg->video_number);
-
-    #endif
-
     // search the trajectory library for the best trajectory
     /*
     Trajectory* farthestTraj = trajlib.FindFarthestTrajectory(currentOctree, &bodyToLocal, lcmgl);
 
     // publish the farthest trajectory number over LCM for visualization
     lcmt_trajectory_number trajNumMsg;
-    trajNumMsg.timestamp = getTimestampNow();
+    trajNumMsg.timestamp = GetWallNow();
     trajNumMsg.trajNum = farthestTraj->GetTrajectoryNumber();
 
     lcmt_trajectory_number_publish(lcm, "trajectory_number", &trajNumMsg);
@@ -97,8 +73,6 @@ void stereo_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_
     */
     numFrames ++;
 
-    delete filtered_msg;
-
     // compute framerate
     gettimeofday( &now, NULL );
 
@@ -113,12 +87,14 @@ int main(int argc,char** argv) {
     bool ttl_one = false;
     string config_file = "";
     string trajectory_dir = "";
+    double cluster_distance = 0;
 
     ConciseArgs parser(argc, argv);
     parser.add(ttl_one, "t", "ttl-one", "Pass to set LCM TTL=1");
     parser.add(disable_filtering, "f", "disable-filtering", "Disable filtering.");
     parser.add(config_file, "c", "config", "Configuration file containing camera GUIDs, etc.", true);
     parser.add(trajectory_dir, "d", "trajectory-dir" "Directory containing CSV files with trajectories.");
+    parser.add(cluster_distance, "C", "cluster-distance", "Group the hits into obstacles (hits this far apart, in meters, are in the same one) and publish them.");
     parser.parse();
 
     if (disable_filtering) {
@@ -155,38 +131,48 @@ int main(int argc,char** argv) {
 
 
     if (ttl_one) {
-        lcm = lcm_create ("udpm://239.255.76.67:7667?ttl=1");
+        lcm_obj = new lcm::LCM("udpm://239.255.76.67:7667?ttl=1");
     } else {
-        lcm = lcm_create ("udpm://239.255.76.67:7667?ttl=0");
+        lcm_obj = new lcm::LCM("udpm://239.255.76.67:7667?ttl=0");
     }
 
-    if (!lcm)
+    if (!lcm_obj->good())
     {
         fprintf(stderr, "lcm_create for recieve failed.  Quitting.\n");
         return 1;
     }
 
     // init frames
-    BotParam *param = bot_param_new_from_server(lcm, 0);
-    BotFrames *bot_frames = bot_frames_new(lcm, param);
+    BotParam *param = bot_param_new_from_server(lcm_obj->getUnderlyingLCM(), 0);
+    BotFrames *bot_frames = bot_frames_new(lcm_obj->getUnderlyingLCM(), param);
 
     // init octomap
     StereoOctomap octomap(bot_frames);
 
     octomap.SetStereoConfig(stereo_config, stereo_calibration);
 
-    StereoFilter filter(0.1);
+    // the same stages the state machine's map uses, set up here by hand
+    pipeline = new StereoPointPipeline();
+
+    if (disable_filtering == false) {
+        pipeline->EnableTemporalFilter(0.1);
+    }
+
+    if (cluster_distance > 0) {
+        pipeline->EnableClustering(cluster_distance, 1);
+    }
 
     StereoHandlerData user_data;
     user_data.octomap = &octomap;
-    user_data.filter = &filter;
+    user_data.pipeline = pipeline;
+    user_data.bot_frames = bot_frames;
 
     char *stereo_channel;
     if (bot_param_get_str(param, "lcm_channels.stereo", &stereo_channel) >= 0) {
-        stereo_sub = lcmt_stereo_subscribe(lcm, stereo_channel, &stereo_handler, &user_data);
+        stereo_sub = lcm_obj->subscribeFunction(stereo_channel, &stereo_handler, &user_data);
     }
 
-    lcmgl = bot_lcmgl_init(lcm, "lcmgl-stereo-transformed");
+    lcmgl = bot_lcmgl_init(lcm_obj->getUnderlyingLCM(), "lcmgl-stereo-transformed");
     bot_lcmgl_enable(lcmgl, GL_BLEND);
 
 
@@ -200,7 +186,7 @@ int main(int argc,char** argv) {
     while (true)
     {
         // read the LCM channel
-        lcm_handle (lcm);
+        lcm_obj->handle();
     }
 
     return 0;
@@ -210,10 +196,12 @@ void sighandler(int dum)
 {
     printf("\n\nclosing... ");
 
-    lcmt_stereo_unsubscribe(lcm, stereo_sub);
-    lcm_destroy (lcm);
+    lcm_obj->unsubscribe(stereo_sub);
+    delete lcm_obj;
 
     printf("done.\n");
 
+    pipeline->PrintStats(stdout);
+
     exit(0);
 }
@@ -31,7 +31,8 @@ using namespace std;
 //#include <octomap/OcTree.h>
 #include "../../estimators/StereoOctomap/StereoOctomap.hpp"
 
-#include "../../LCM/lcmt_stereo.h"
+#include <lcm/lcm-cpp.hpp>
+#include "../../LCM/lcmt/stereo.hpp"
 #include "../../LCM/lcmt_trajectory_number.h"
 
 #include "../TrajectoryLibrary/TrajectoryLibrary.hpp"
@@ -40,19 +41,19 @@ using namespace std;
 
 #include "../../sensors/stereo/opencv-stereo-util.hpp"
 
-#include "../../estimators/StereoFilter/StereoFilter.hpp"
+#include "../../estimators/StereoPointPipeline/StereoPointPipeline.hpp"
 
 
-void sighandler(int dum);
-
-void stereo_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo *msg, void *user);
-
+// what the stereo handler adds messages with
+struct StereoHandlerData {
+    StereoOctomap *octomap;
+    StereoPointPipeline *pipeline;
+    BotFrames *bot_frames;
+};
 
-void InsertPointsIntoOctree(const lcmt_stereo *msg, BotTrans *toOpenCv, BotTrans *bodyToLocal);
-
-void RemoveOldPoints(int64_t lastMsgTime);
+void sighandler(int dum);
 
-void PublishOctomap();
+void stereo_handler(const lcm::ReceiveBuffer *rbuf, const std::string &chan, const lcmt::stereo *msg, StereoHandlerData *data);
 
 
 #endif
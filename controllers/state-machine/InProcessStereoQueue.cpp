@@ -0,0 +1,95 @@
+#include "InProcessStereoQueue.hpp"
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <algorithm>
+
+InProcessStereoQueue::InProcessStereoQueue() {
+    for (int i = 0; i < IN_PROCESS_STEREO_QUEUE_SIZE - 1; i++) {
+        free_slots_.Push(i);
+    }
+
+    event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    num_dropped_ = 0;
+}
+
+InProcessStereoQueue::~InProcessStereoQueue() {
+    if (event_fd_ >= 0) {
+        close(event_fd_);
+    }
+}
+
+/**
+ * Queues a frame of hits, copying them.
+ *
+ * @param timestamp frame's timestamp
+ * @param frame_number frame number
+ * @param video_number video number
+ * @param number_of_points number of hits
+ * @param x hits' x coordinates
+ * @param y hits' y coordinates
+ * @param z hits' z coordinates
+ * @param grey hits' brightness, or NULL for none
+ *
+ * @retval false if the queue was full and the frame was dropped
+ */
+bool InProcessStereoQueue::Push(int64_t timestamp, int32_t frame_number, int32_t video_number, int number_of_points,
+    const float *x, const float *y, const float *z, const uint8_t *grey) {
+
+    int slot;
+
+    if (free_slots_.Pop(&slot) != true) {
+        num_dropped_ ++;
+        return false;
+    }
+
+    lcmt::stereo *msg = &slots_[slot];
+
+    msg->timestamp = timestamp;
+    msg->frame_number = frame_number;
+    msg->video_number = video_number;
+    msg->number_of_points = number_of_points;
+
+    msg->x.assign(x, x + number_of_points);
+    msg->y.assign(y, y + number_of_points);
+    msg->z.assign(z, z + number_of_points);
+
+    if (grey != NULL) {
+        msg->grey.assign(grey, grey + number_of_points);
+    } else {
+        msg->grey.assign(number_of_points, 0);
+    }
+
+    ready_slots_.Push(slot);
+
+    uint64_t one = 1;
+
+    if (write(event_fd_, &one, sizeof(one)) < 0) {
+        // the counter is already huge, so the reader is awake anyway
+    }
+
+    return true;
+}
+
+/**
+ * Takes the oldest queued frame.  msg's old buffers go back in the queue
+ * to be reused.
+ *
+ * @param msg (output) the frame
+ *
+ * @retval false if there wasn't one
+ */
+bool InProcessStereoQueue::Pop(lcmt::stereo *msg) {
+    int slot;
+
+    if (ready_slots_.Pop(&slot) != true) {
+        return false;
+    }
+
+    std::swap(*msg, slots_[slot]);
+
+    free_slots_.Push(slot);
+
+    return true;
+}
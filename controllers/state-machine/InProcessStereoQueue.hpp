@@ -0,0 +1,58 @@
+#ifndef IN_PROCESS_STEREO_QUEUE_HPP
+#define IN_PROCESS_STEREO_QUEUE_HPP
+
+/*
+ * Hands stereo hits from a stereo pipeline in the same process to the state
+ * machine without going through LCM.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <stdint.h>
+#include <atomic>
+#include "../../LCM/lcmt/stereo.hpp"
+#include "../../sensors/stereo/SpscQueue.hpp"
+
+// slots in the queue (one is always kept empty).  Must be a power of two.
+#define IN_PROCESS_STEREO_QUEUE_SIZE 8
+
+/**
+ * Frames of stereo hits from one thread (the stereo loop) to another (the
+ * state machine's reactor), which wakes up on GetFd().  The messages'
+ * buffers are reused, so passing a frame along doesn't allocate once
+ * they've grown to size.  When the reader falls behind, new frames are
+ * dropped (and counted) instead of waiting.
+ */
+class InProcessStereoQueue {
+
+    public:
+        InProcessStereoQueue();
+        ~InProcessStereoQueue();
+
+        // writer only
+        bool Push(int64_t timestamp, int32_t frame_number, int32_t video_number, int number_of_points,
+            const float *x, const float *y, const float *z, const uint8_t *grey);
+
+        // reader only
+        bool Pop(lcmt::stereo *msg);
+
+        // readable when there are frames (read it to clear it)
+        int GetFd() const { return event_fd_; }
+
+        int64_t GetNumDropped() const { return num_dropped_.load(); }
+
+    private:
+        lcmt::stereo slots_[IN_PROCESS_STEREO_QUEUE_SIZE - 1];
+
+        // indices into slots_: the reader gives read ones back in
+        // free_slots_ and the writer hands it filled ones in ready_slots_
+        SpscQueue<int, IN_PROCESS_STEREO_QUEUE_SIZE> free_slots_;
+        SpscQueue<int, IN_PROCESS_STEREO_QUEUE_SIZE> ready_slots_;
+
+        int event_fd_;
+
+        std::atomic<int64_t> num_dropped_;
+};
+
+#endif
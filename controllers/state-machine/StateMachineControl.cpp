@@ -1,10 +1,18 @@
 #include "StateMachineControl.hpp"
+#include "../../utils/utils/Trace.hpp"
+#include "../../utils/utils/NoAllocGuard.hpp"
 
-StateMachineControl::StateMachineControl(lcm::LCM *lcm, std::string traj_dir, std::string tvlqr_action_out_channel, std::string state_message_channel, std::string altitude_reset_channel, bool visualization, bool traj_visualization) : fsm_(*this) {
+StateMachineControl::StateMachineControl(lcm::LCM *lcm, std::string traj_dir, std::string tvlqr_action_out_channel, std::string state_message_channel, std::string altitude_reset_channel, bool visualization, bool traj_visualization, BotParam *param) : fsm_(*this) {
     lcm_ = lcm;
 
-    param_ = bot_param_new_from_server(lcm_->getUnderlyingLCM(), 0);
+    if (param != nullptr) {
+        param_ = param;
+    } else {
+        param_ = bot_param_new_from_server(lcm_->getUnderlyingLCM(), 0);
+    }
+
     bot_frames_ = bot_frames_new(lcm_->getUnderlyingLCM(), param_);
+    transforms_ = TransformCache::Get(bot_frames_);
 
     safe_distance_ = bot_param_get_double_or_fail(param_, "obstacle_avoidance.safe_distance_threshold");
     min_improvement_to_switch_trajs_ = bot_param_get_double_or_fail(param_, "obstacle_avoidance.min_improvement_to_switch_trajs");
@@ -30,7 +38,55 @@ StateMachineControl::StateMachineControl(lcm::LCM *lcm, std::string traj_dir, st
     bearing_tolerance_ = bot_param_get_double_or_fail(param_, "bearing_controller.bearing_tolerance");
     bearing_offset_ = bot_param_get_double_or_fail(param_, "bearing_controller.offset");
 
-    spacial_stereo_filter_ = new SpacialStereoFilter(filter_distance_threshold, filter_num_points_threshold);
+    stereo_pipeline_ = new StereoPointPipeline();
+
+    // optionally drop stereo points too close or too far to trust
+    double stereo_min_range, stereo_max_range;
+
+    if (bot_param_get_double(param_, "obstacle_avoidance.stereo_min_range", &stereo_min_range) == 0
+        && bot_param_get_double(param_, "obstacle_avoidance.stereo_max_range", &stereo_max_range) == 0) {
+
+        stereo_pipeline_->EnableRangeGate(stereo_min_range, stereo_max_range);
+    }
+
+    // optionally keep only points seen in earlier frames too
+    double temporal_distance;
+
+    if (bot_param_get_double(param_, "obstacle_avoidance.stereo_temporal_filter_distance", &temporal_distance) == 0) {
+        int history_frames, min_frames;
+
+        if (bot_param_get_int(param_, "obstacle_avoidance.stereo_temporal_history_frames", &history_frames) != 0) {
+            history_frames = 1;
+        }
+
+        if (bot_param_get_int(param_, "obstacle_avoidance.stereo_temporal_min_frames", &min_frames) != 0) {
+            min_frames = 1;
+        }
+
+        stereo_pipeline_->EnableTemporalFilter(temporal_distance, history_frames, min_frames);
+    }
+
+    stereo_pipeline_->EnableSpacialFilter(filter_distance_threshold, filter_num_points_threshold);
+
+    // optionally thin out the points before they get to the map
+    double stereo_voxel_size;
+
+    if (bot_param_get_double(param_, "obstacle_avoidance.stereo_voxel_size", &stereo_voxel_size) == 0) {
+        stereo_pipeline_->EnableVoxelDownsample(stereo_voxel_size);
+    }
+
+    // optionally group the points into obstacles for the HUD
+    double cluster_distance;
+
+    if (bot_param_get_double(param_, "obstacle_avoidance.stereo_cluster_distance", &cluster_distance) == 0) {
+        int cluster_min_points;
+
+        if (bot_param_get_int(param_, "obstacle_avoidance.stereo_cluster_min_points", &cluster_min_points) != 0) {
+            cluster_min_points = 1;
+        }
+
+        stereo_pipeline_->EnableClustering(cluster_distance, cluster_min_points);
+    }
 
     if (min_improvement_to_switch_trajs_ <= 0) {
         std::cerr << "ERROR: obstacle_avoidance.min_improvement_to_switch_trajs must be greater than 0." << std::endl;
@@ -39,15 +95,163 @@ StateMachineControl::StateMachineControl(lcm::LCM *lcm, std::string traj_dir, st
 
     int stable_traj_num = bot_param_get_int_or_fail(param_, "tvlqr_controller.stable_controller");
 
-    octomap_ = new StereoOctomap(bot_frames_);
+    // optionally add stereo points on their own thread so that searching
+    // the map doesn't wait for them
+    int map_thread;
+
+    if (bot_param_get_boolean(param_, "obstacle_avoidance.map_thread", &map_thread) != 0) {
+        map_thread = 0;
+    }
+
+    octomap_ = new ConcurrentStereoOctomap(bot_frames_, map_thread == 1);
+
+    // the pipeline runs wherever the points are added (on the map thread,
+    // if there is one), marking the points to add instead of copying them
+    octomap_->SetFilter([this](const lcmt::stereo &msg, BotTrans *to_open_cv, std::vector<uint8_t> *keep) { return stereo_pipeline_->Filter(msg, to_open_cv, keep); });
+
+    // optionally search for trajectories on their own thread too, so the
+    // FSM only reads the result
+    int planner_thread;
+
+    if (bot_param_get_boolean(param_, "obstacle_avoidance.planner_thread", &planner_thread) != 0) {
+        planner_thread = 0;
+    }
+
+    use_planner_thread_ = planner_thread == 1;
+
+    if (use_planner_thread_ && map_thread != 1) {
+        std::cerr << "ERROR: obstacle_avoidance.planner_thread needs obstacle_avoidance.map_thread." << std::endl;
+        exit(1);
+    }
+
+    // optional distance field around the aircraft for faster trajectory
+    // checks
+    double field_cell_size, field_max_distance;
+    int field_cells;
+
+    if (bot_param_get_double(param_, "obstacle_avoidance.distance_field_cell_size", &field_cell_size) == 0
+        && bot_param_get_int(param_, "obstacle_avoidance.distance_field_cells", &field_cells) == 0
+        && bot_param_get_double(param_, "obstacle_avoidance.distance_field_max_distance", &field_max_distance) == 0) {
+
+        if (field_max_distance <= safe_distance_) {
+            std::cerr << "ERROR: obstacle_avoidance.distance_field_max_distance must be greater than safe_distance_threshold." << std::endl;
+            exit(1);
+        }
+
+        octomap_->EnableDistanceField(field_cell_size, field_cells, field_max_distance);
+    }
+
+    // optional cap on the map's size, so a flood of stereo hits can't
+    // slow down the searches without bound
+    int max_voxels;
+
+    if (bot_param_get_int(param_, "obstacle_avoidance.map_max_voxels", &max_voxels) == 0) {
+        octomap_->SetMaxVoxels(max_voxels);
+    }
+
+    // optionally save the map every so often and start from the last one,
+    // so restarting this process doesn't forget the obstacles it had
+    char *snapshot_file;
+
+    if (bot_param_get_str(param_, "obstacle_avoidance.map_snapshot_file", &snapshot_file) == 0) {
+        double snapshot_rate;
+
+        if (bot_param_get_double(param_, "obstacle_avoidance.map_snapshot_rate", &snapshot_rate) != 0) {
+            snapshot_rate = 4;
+        }
+
+        if (octomap_->ReadSnapshot(snapshot_file, GetTimestampNow())) {
+            std::cout << "Restored the obstacle map from " << snapshot_file << std::endl;
+        }
+
+        octomap_->EnableSnapshots(snapshot_file, snapshot_rate);
+
+        free(snapshot_file);
+    }
+
+    // optional reuse of the running trajectory's clearances between checks
+    double clearance_pose_tolerance;
+
+    if (bot_param_get_double(param_, "obstacle_avoidance.clearance_cache_pose_tolerance", &clearance_pose_tolerance) == 0) {
+        use_clearance_cache_ = true;
+        fsm_clearances_.SetPoseTolerance(clearance_pose_tolerance);
+        planner_clearances_.SetPoseTolerance(clearance_pose_tolerance);
+    }
 
     trajlib_ = new TrajectoryLibrary(ground_safety_distance_);
 
+    // optionally check all of the trajectories at once
+    int parallel_trajectories;
+
+    if (bot_param_get_boolean(param_, "obstacle_avoidance.parallel_trajectories", &parallel_trajectories) == 0) {
+        trajlib_->SetParallelTrajectories(parallel_trajectories == 1);
+    }
+
+    // optionally pick trajectories the shape index shows are clear first
+    int trajectory_shape_index;
+
+    if (bot_param_get_boolean(param_, "obstacle_avoidance.trajectory_shape_index", &trajectory_shape_index) == 0) {
+        trajlib_->SetUseShapeIndex(trajectory_shape_index == 1);
+    }
+
+    int trajectory_swept_volumes;
+
+    if (bot_param_get_boolean(param_, "obstacle_avoidance.trajectory_swept_volumes", &trajectory_swept_volumes) == 0) {
+        trajlib_->SetUseSweptVolumes(trajectory_swept_volumes == 1);
+    }
+
+    // optionally roll out the planner's best few trajectories from the
+    // aircraft's velocity and only pick from those
+    int rollout_candidates;
+
+    if (bot_param_get_int(param_, "obstacle_avoidance.rollout_candidates", &rollout_candidates) == 0) {
+        double rollout_time_constant;
+
+        if (bot_param_get_double(param_, "obstacle_avoidance.rollout_time_constant", &rollout_time_constant) != 0) {
+            rollout_time_constant = 1.0;
+        }
+
+        trajlib_->SetRolloutVerification(rollout_candidates, rollout_time_constant);
+    }
+
+    // the searches only need the trajectories' positions
+    int trajectory_lazy_loading;
+
+    if (bot_param_get_boolean(param_, "obstacle_avoidance.trajectory_lazy_loading", &trajectory_lazy_loading) == 0) {
+        trajlib_->SetLazyLoading(trajectory_lazy_loading == 1);
+    }
+
     if (trajlib_->LoadLibrary(traj_dir, true) == false) {
         std::cerr << "ERROR: Failed to load trajectory library." << std::endl;
         exit(1);
     }
 
+    // optionally only add obstacles that a trajectory could get near
+    double map_cull_margin;
+
+    if (bot_param_get_double(param_, "obstacle_avoidance.map_cull_margin", &map_cull_margin) == 0) {
+        double low[3], high[3];
+
+        if (trajlib_->GetBoundingBox(low, high)) {
+            for (int i = 0; i < 3; i++) {
+                low[i] -= safe_distance_ + map_cull_margin;
+                high[i] += safe_distance_ + map_cull_margin;
+            }
+
+            if (octomap_->SetInsertRegion(low, high) == false) {
+                std::cerr << "WARNING: no body to camera transform, not culling the obstacle map." << std::endl;
+            }
+        }
+    }
+
+    double map_min_altitude, map_max_altitude;
+
+    if (bot_param_get_double(param_, "obstacle_avoidance.map_min_altitude", &map_min_altitude) == 0
+        && bot_param_get_double(param_, "obstacle_avoidance.map_max_altitude", &map_max_altitude) == 0) {
+
+        octomap_->SetAltitudeBand(map_min_altitude, map_max_altitude);
+    }
+
     current_traj_ = trajlib_->GetTrajectoryByNumber(climb_no_throttle_trajnum_);
 
     if (current_traj_ == nullptr) {
@@ -71,12 +275,28 @@ StateMachineControl::StateMachineControl(lcm::LCM *lcm, std::string traj_dir, st
     tvlqr_action_out_channel_ = tvlqr_action_out_channel;
     state_message_channel_ = state_message_channel;
     altitude_reset_channel_ = altitude_reset_channel;
+
+    if (use_planner_thread_) {
+        planner_current_traj_ = current_traj_->GetTrajectoryNumber();
+
+        pthread_create(&planner_thread_, NULL, PlannerThread, this);
+    }
 }
 
 StateMachineControl::~StateMachineControl() {
+    if (use_planner_thread_) {
+        {
+            std::lock_guard<std::mutex> lock(plan_mutex_);
+            planner_shutting_down_ = true;
+        }
+
+        cv_new_pose_.notify_one();
+        pthread_join(planner_thread_, NULL);
+    }
+
     delete octomap_;
     delete trajlib_;
-    delete spacial_stereo_filter_;
+    delete stereo_pipeline_;
 }
 
 void StateMachineControl::SetNextTrajectoryByNumber(int traj_num) {
@@ -102,38 +322,151 @@ void StateMachineControl::ProcessImuMsg(const lcm::ReceiveBuffer *rbuf, const st
         current_bearing_ = AngleUnwrap(rpy[2], current_bearing_);
     }
     last_imu_msg_ = *msg;
+
+    if (wind_enabled_) {
+        double velocity_x, velocity_y;
+        WindEstimator::PoseToGroundVelocity(msg->orientation, msg->vel, &velocity_x, &velocity_y);
+
+        // stamped with when it got here, since the airspeed is too
+        wind_estimator_.AddGroundVelocity(GetTimestampNow(), velocity_x, velocity_y);
+    }
+
+    if (use_planner_thread_) {
+        {
+            std::lock_guard<std::mutex> lock(plan_mutex_);
+
+            planner_pose_number_ ++;
+
+            std::copy(msg->vel, msg->vel + 3, planner_velocity_);
+        }
+
+        cv_new_pose_.notify_one();
+    }
+}
+
+void StateMachineControl::EnableWindEstimate(std::string wind_channel) {
+    wind_enabled_ = true;
+    wind_channel_ = wind_channel;
+}
+
+void StateMachineControl::ProcessBaroAirspeedMsg(const lcm::ReceiveBuffer *rbus, const std::string &chan, const lcmt::baro_airspeed *msg) {
+    if (wind_enabled_ == false) {
+        return;
+    }
+
+    int64_t now = GetTimestampNow();
+
+    // paired with the last pose, if it's recent
+    wind_estimator_.AddAirspeed(now, msg->airspeed);
+
+    if (wind_channel_.length() == 0) {
+        return;
+    }
+
+    WindEstimate estimate;
+    wind_estimator_.GetEstimate(&estimate);
+
+    lcmt::wind_groundspeed wind_msg;
+    wind_msg.utime = now;
+    wind_msg.airspeed = msg->airspeed;
+
+    // no wind until the estimate has settled, like wind-estimator
+    if (estimate.valid) {
+        wind_msg.estimatedGroundSpeed = wind_estimator_.GetGroundSpeed(msg->airspeed);
+        wind_msg.wind_x = estimate.wind_x;
+        wind_msg.wind_y = estimate.wind_y;
+    } else {
+        wind_msg.estimatedGroundSpeed = msg->airspeed;
+        wind_msg.wind_x = 0;
+        wind_msg.wind_y = 0;
+    }
+
+    wind_msg.wind_z = 0;
+
+    lcm_->publish(wind_channel_, &wind_msg);
 }
 
 void StateMachineControl::DoDelayedImuUpdate() {
     if (need_imu_update_) {
-        fsm_.ImuUpdate(last_imu_msg_);
+        {
+            TRACE_SCOPE("fsm-imu-update");
+            NO_ALLOC_SCOPE("fsm-imu-update");
+            fsm_.ImuUpdate(last_imu_msg_);
+        }
+        TraceStateChange();
         need_imu_update_ = false;
 
-        if (visualization_) {
+        if (visualization_ && GetTimestampNow() - last_visualization_t_ >= visualization_period_) {
+            last_visualization_t_ = GetTimestampNow();
+
             octomap_->Draw(lcm_->getUnderlyingLCM());
             octomap_->PublishToHud(lcm_->getUnderlyingLCM());
+            stereo_pipeline_->PublishPrimitives(lcm_->getUnderlyingLCM());
             PublishDebugMsg("StateMachineControl: visualization");
         }
     }
 }
 
+void StateMachineControl::SetVisualizationRate(double rate_hz) {
+    visualization_period_ = rate_hz > 0 ? 1000000.0 / rate_hz : 0;
+}
+
 void StateMachineControl::ProcessStereoMsg(const lcm::ReceiveBuffer *rbus, const std::string &chan, const lcmt::stereo *msg) {
-    const lcmt::stereo *msg2 = spacial_stereo_filter_->ProcessMessage(*msg);
-    octomap_->ProcessStereoMessage(msg2);
-    delete msg2;
+    // filtered and added on the map thread if there is one
+    octomap_->ProcessStereoMessage(msg);
+
+    int64_t num_evicted = octomap_->GetNumEvictedVoxels();
+
+    if (num_evicted > last_num_evicted_voxels_ && map_full_ == false) {
+        std::cerr << "WARNING: obstacle map is full, dropping its oldest voxels." << std::endl;
+        PublishDebugMsg("StateMachineControl: obstacle map full");
+        map_full_ = true;
+    } else if (num_evicted == last_num_evicted_voxels_ && map_full_) {
+        std::cerr << "Obstacle map has room again (" << num_evicted << " voxels dropped so far)." << std::endl;
+        map_full_ = false;
+    }
+
+    last_num_evicted_voxels_ = num_evicted;
 }
 
 void StateMachineControl::ProcessRcTrajectoryMsg(const lcm::ReceiveBuffer *rbus, const std::string &chan, const lcmt::tvlqr_controller_action *msg) {
     std::cout << "got trajectory request message" << std::endl;
-    fsm_.SingleTrajectoryRequest(msg->trajectory_number);
+    {
+        TRACE_SCOPE("fsm-single-trajectory-request");
+        fsm_.SingleTrajectoryRequest(msg->trajectory_number);
+    }
+    TraceStateChange();
 }
 
 void StateMachineControl::ProcessGoAutonomousMsg(const lcm::ReceiveBuffer *rbus, const std::string &chan, const lcmt::timestamp *msg) {
-    fsm_.AutonomousMode();
+    {
+        TRACE_SCOPE("fsm-autonomous-mode");
+        fsm_.AutonomousMode();
+    }
+    TraceStateChange();
 }
 
 void StateMachineControl::ProcessArmForTakeoffMsg(const lcm::ReceiveBuffer *rbus, const std::string &chan, const lcmt::timestamp *msg) {
-    fsm_.ArmForTakeoff();
+    {
+        TRACE_SCOPE("fsm-arm-for-takeoff");
+        fsm_.ArmForTakeoff();
+    }
+    TraceStateChange();
+}
+
+/**
+ * Records an instant in the trace (see Trace.hpp), named for the new state,
+ * if the last FSM event changed states.  With the events' and guards'
+ * scopes, a dump shows what the FSM did and how long each step took.
+ */
+void StateMachineControl::TraceStateChange() {
+    // the states are static, so their names outlive the trace
+    const char *state = fsm_.getState().getName();
+
+    if (state != last_traced_state_) {
+        TRACE_INSTANT(state);
+        last_traced_state_ = state;
+    }
 }
 
 void StateMachineControl::PublishDebugMsg(std::string debug_str) const {
@@ -146,13 +479,27 @@ void StateMachineControl::PublishDebugMsg(std::string debug_str) const {
 
 void StateMachineControl::SetBestTrajectory() {
     std::cout << "set BEST traj" << std::endl;
-    BotTrans body_to_local;
-    bot_frames_get_trans(bot_frames_, "body", "local", &body_to_local);
 
     double dist;
     const Trajectory *traj;
 
-    std::tie(dist, traj) = trajlib_->FindFarthestTrajectory(*octomap_, body_to_local, safe_distance_, nullptr, GetBearingPreferredTrajectoryNumber());
+    std::shared_ptr<const StateMachinePlan> plan = GetPlan();
+
+    if (plan != nullptr) {
+        std::tie(dist, traj) = trajlib_->PickTrajectory(plan->ranking, safe_distance_, GetBearingPreferredTrajectoryNumber());
+
+        SetNextTrajectory(*traj);
+        return;
+    }
+
+    BotTrans body_to_local;
+    transforms_->GetBodyToLocal(&body_to_local);
+
+    octomap_->UpdateDistanceField(body_to_local.trans_vec);
+
+    StereoOctomapSnapshot octomap(*octomap_);
+
+    std::tie(dist, traj) = trajlib_->FindFarthestTrajectory(*octomap, body_to_local, safe_distance_, nullptr, GetBearingPreferredTrajectoryNumber());
 
     SetNextTrajectory(*traj);
 }
@@ -178,27 +525,82 @@ int StateMachineControl::GetBearingPreferredTrajectoryNumber() const {
     }
 }
 
+/**
+ * @param traj trajectory that's running
+ * @param start_t when it started (-1 for unknown)
+ * @param now timestamp to get the time for
+ *
+ * @retval how far into the trajectory it is at now, in seconds
+ */
+double StateMachineControl::GetTrajectoryTime(const Trajectory &traj, int64_t start_t, int64_t now) const {
+
+    if (traj.IsTimeInvariant()) {
+        return 0;
+    } else if (start_t > 0) {
+        return (now - start_t) / 1000000.0;
+    } else {
+        std::cerr << "WARNING: TV trajectory with UNSET start t.  Good luck." << std::endl;
+        return 0;
+    }
+}
+
 bool StateMachineControl::BetterTrajectoryAvailable() {
     //std::cout << "better traj available()" << std::endl;
-    // search for an obstacle in the path
-    BotTrans body_to_local;
-    bot_frames_get_trans(bot_frames_, "body", "local", &body_to_local);
+    TRACE_SCOPE("fsm-better-trajectory-available");
 
-    double t;
+    // the planner thread's ranking, if it has a recent one
+    std::shared_ptr<const StateMachinePlan> plan = GetPlan();
 
-    if (current_traj_->IsTimeInvariant()) {
-        t = 0;
-    } else if (traj_start_t_ > 0) {
-        t = (GetTimestampNow() - traj_start_t_) / 1000000.0;
+    double dist;
+
+    if (plan != nullptr && plan->current_traj == current_traj_->GetTrajectoryNumber() && plan->current_traj_start_t == traj_start_t_) {
+        dist = plan->current_dist;
     } else {
-        std::cerr << "WARNING: TV trajectory with UNSET start t.  Good luck." << std::endl;
-        t = 0;
+        // search for an obstacle in the path
+        BotTrans body_to_local;
+        transforms_->GetBodyToLocal(&body_to_local);
+
+        octomap_->UpdateDistanceField(body_to_local.trans_vec);
+
+        double t = GetTrajectoryTime(*current_traj_, traj_start_t_, GetTimestampNow());
+
+        // every search below sees the same map
+        StereoOctomapSnapshot octomap(*octomap_);
+
+        // obstacles past safe_distance_ don't matter, so they aren't searched for
+        dist = current_traj_->ClosestObstacleInRemainderOfTrajectory(*octomap, body_to_local, t, ground_safety_distance_, safe_distance_,
+            use_clearance_cache_ ? &fsm_clearances_ : nullptr);
+
+        if (plan == nullptr) {
+            return SwitchIfBetter(dist, [&](int preferred_traj) {
+                return trajlib_->FindFarthestTrajectory(*octomap, body_to_local, safe_distance_, nullptr, preferred_traj);
+            });
+        }
+
+        // otherwise the trajectory changed after the ranking started, so
+        // only it was checked here
     }
 
+    return SwitchIfBetter(dist, [&](int preferred_traj) {
+        return trajlib_->PickTrajectory(plan->ranking, safe_distance_, preferred_traj);
+    });
+}
+
+/**
+ * Decides whether to switch trajectories.
+ *
+ * @param dist how close the rest of the current trajectory comes to
+ *      obstacles (-1 for none)
+ * @param find_best finds the best trajectory for a preferred trajectory
+ *      number (-1 for none), like TrajectoryLibrary::FindFarthestTrajectory()
+ *
+ * @retval true if the next trajectory was set to a better one
+ */
+bool StateMachineControl::SwitchIfBetter(double dist, const std::function<std::tuple<double, const Trajectory*>(int)> &find_best) {
+
     double new_dist;
     const Trajectory *traj;
 
-    double dist = current_traj_->ClosestObstacleInRemainderOfTrajectory(*octomap_, body_to_local, t, ground_safety_distance_);
     if (dist > safe_distance_ || dist < 0) {
         // we're still OK
         //std::cout << "dist OK = " << dist << std::endl;
@@ -207,7 +609,7 @@ bool StateMachineControl::BetterTrajectoryAvailable() {
         // check if we could turn towards a better bearing or stop turning
 
         if ((GetBearingPreferredTrajectoryNumber() == -1 && current_traj_ != 0) || GetBearingPreferredTrajectoryNumber() != -1) {
-            std::tie(new_dist, traj) = trajlib_->FindFarthestTrajectory(*octomap_, body_to_local, safe_distance_, nullptr, GetBearingPreferredTrajectoryNumber());
+            std::tie(new_dist, traj) = find_best(GetBearingPreferredTrajectoryNumber());
 
             if (current_traj_->GetTrajectoryNumber() != traj->GetTrajectoryNumber() && (traj->GetTrajectoryNumber() == 0 || traj->GetTrajectoryNumber() == traj_left_turn_ || traj->GetTrajectoryNumber() == traj_right_turn_)) {
                 std::cout << "CHANGE FOR BEARING: " << current_traj_->GetTrajectoryNumber() << " -> " << traj->GetTrajectoryNumber() << ", dist = " << new_dist << std::endl;
@@ -220,7 +622,7 @@ bool StateMachineControl::BetterTrajectoryAvailable() {
         return false;
     }
 
-    std::tie(new_dist, traj) = trajlib_->FindFarthestTrajectory(*octomap_, body_to_local, safe_distance_);
+    std::tie(new_dist, traj) = find_best(-1);
 
     double dist_diff = new_dist - dist;
 
@@ -235,6 +637,132 @@ bool StateMachineControl::BetterTrajectoryAvailable() {
     }
 }
 
+void* StateMachineControl::PlannerThread(void *x) {
+
+    ((StateMachineControl*) x)->RunPlanner();
+
+    return NULL;
+}
+
+/**
+ * Ranks the whole library against the latest map and pose, over and over
+ * while IMU messages keep coming (in the states that will pick a trajectory,
+ * see SetPlanAhead()), and checks the rest of the running trajectory too.
+ * The FSM picks from the latest ranking (TrajectoryLibrary::PickTrajectory())
+ * instead of searching, so how long it takes doesn't depend on the
+ * library's size.  New stereo points are added on the map thread
+ * meanwhile.
+ */
+void StateMachineControl::RunPlanner() {
+
+    int64_t last_pose_number = 0;
+
+    // the aircraft's velocity with that pose, for rollouts
+    double velocity[3];
+
+    while (true) {
+
+        // a new one each time, since the FSM might still have the last one
+        std::shared_ptr<StateMachinePlan> plan = std::make_shared<StateMachinePlan>();
+
+        {
+            std::unique_lock<std::mutex> lock(plan_mutex_);
+
+            while ((planner_pose_number_ == last_pose_number || planner_plan_ahead_ == false) && planner_shutting_down_ == false) {
+                cv_new_pose_.wait(lock);
+            }
+
+            if (planner_shutting_down_) {
+                return;
+            }
+
+            last_pose_number = planner_pose_number_;
+
+            plan->current_traj = planner_current_traj_;
+            plan->current_traj_start_t = planner_current_traj_start_t_;
+
+            std::copy(planner_velocity_, planner_velocity_ + 3, velocity);
+        }
+
+        plan->utime = GetTimestampNow();
+
+        BotTrans body_to_local;
+        transforms_->GetBodyToLocal(&body_to_local);
+
+        octomap_->UpdateDistanceField(body_to_local.trans_vec);
+
+        {
+            // the ranking and the running trajectory see the same map
+            StereoOctomapSnapshot octomap(*octomap_);
+
+            trajlib_->RankTrajectories(*octomap, body_to_local, &plan->ranking, velocity);
+
+            const Trajectory *current_traj = trajlib_->GetTrajectoryByNumber(plan->current_traj);
+
+            if (current_traj->IsTimeInvariant() || plan->current_traj_start_t > 0) {
+                double t = GetTrajectoryTime(*current_traj, plan->current_traj_start_t, plan->utime);
+
+                plan->current_dist = current_traj->ClosestObstacleInRemainderOfTrajectory(*octomap, body_to_local, t, ground_safety_distance_, safe_distance_,
+                    use_clearance_cache_ ? &planner_clearances_ : nullptr);
+            } else {
+                // not started yet, so the FSM checks it itself
+                plan->current_traj = -1;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(plan_mutex_);
+        plan_ = plan;
+    }
+}
+
+/**
+ * Turns the planner thread's ranking on or off.  The FSM's states call this
+ * on entry (see AircraftStateMachine.sm): the ones that can pick a
+ * trajectory next turn it on, so a ranking is already there when their
+ * transition fires instead of the search starting then, and the ones on
+ * the ground turn it off so it doesn't compete with the takeoff for CPU.
+ *
+ * @param plan_ahead true to rank after each pose
+ */
+void StateMachineControl::SetPlanAhead(bool plan_ahead) {
+    if (use_planner_thread_ == false) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(plan_mutex_);
+
+        planner_plan_ahead_ = plan_ahead;
+
+        if (plan_ahead == false) {
+            plan_ = nullptr;
+        }
+    }
+
+    cv_new_pose_.notify_one();
+}
+
+/**
+ * Gets the planner thread's latest plan.
+ *
+ * @retval the plan, or nullptr if there is no planner thread or it has no
+ *      plan from the last STATE_MACHINE_MAX_PLAN_AGE
+ */
+std::shared_ptr<const StateMachinePlan> StateMachineControl::GetPlan() {
+
+    if (use_planner_thread_ == false) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(plan_mutex_);
+
+    if (plan_ == nullptr || GetTimestampNow() - plan_->utime > STATE_MACHINE_MAX_PLAN_AGE) {
+        return nullptr;
+    }
+
+    return plan_;
+}
+
 /**
  * Sends an LCM message requesting the controller to switch to a new
  * trajectory.  Also updates internal state about which trajectory we
@@ -261,6 +789,13 @@ void StateMachineControl::RequestNewTrajectory() {
     current_traj_ = next_traj_;
     traj_start_t_ = msg.timestamp;
 
+    if (use_planner_thread_) {
+        std::lock_guard<std::mutex> lock(plan_mutex_);
+
+        planner_current_traj_ = current_traj_->GetTrajectoryNumber();
+        planner_current_traj_start_t_ = traj_start_t_;
+    }
+
     std::cout << "Requesting trajectory: " << msg.trajectory_number << std::endl;
 
     lcm_->publish(tvlqr_action_out_channel_, &msg);
@@ -268,7 +803,7 @@ void StateMachineControl::RequestNewTrajectory() {
     if (traj_visualization_) {
         // draw new the trajectory via lcmgl
         BotTrans body_to_local;
-        bot_frames_get_trans(bot_frames_, "body", "local", &body_to_local);
+        transforms_->GetBodyToLocal(&body_to_local);
 
         std::string lcmgl_name = "StateMachineControl Trajectory: " + std::to_string(traj_start_t_);
 
@@ -290,6 +825,7 @@ void StateMachineControl::RequestNewTrajectory() {
  * and we should switch to something else.
  */
 bool StateMachineControl::CheckTrajectoryExpired() {
+    TRACE_SCOPE("fsm-check-trajectory-expired");
 
     if (current_traj_->GetTrajectoryNumber() == stable_traj_->GetTrajectoryNumber()) {
         // stable trajectory never times out
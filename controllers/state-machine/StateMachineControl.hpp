@@ -9,23 +9,52 @@
  */
 
 #include <iostream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <pthread.h>
 #include <lcm/lcm-cpp.hpp>
 #include "../../LCM/mav/pose_t.hpp"
 #include "../../LCM/lcmt/stereo.hpp"
 #include "../../LCM/lcmt/tvlqr_controller_action.hpp"
 #include "../../LCM/lcmt/timestamp.hpp"
 #include "../../LCM/lcmt/debug.hpp"
+#include "../../LCM/lcmt/baro_airspeed.hpp"
+#include "../../LCM/lcmt/wind_groundspeed.hpp"
 #include "AircraftStateMachine_sm.h"
 #include <bot_param/param_client.h>
 #include "../../controllers/TrajectoryLibrary/Trajectory.hpp"
 #include "../../controllers/TrajectoryLibrary/TrajectoryLibrary.hpp"
-#include "../../estimators/StereoOctomap/StereoOctomap.hpp"
-#include "../../estimators/SpacialStereoFilter/SpacialStereoFilter.hpp"
+#include "../../estimators/StereoOctomap/ConcurrentStereoOctomap.hpp"
+#include "../../estimators/StereoPointPipeline/StereoPointPipeline.hpp"
+#include "../../estimators/cpp_wind/WindEstimator.hpp"
+
+// plans from the planner thread older than this (in usec) aren't used;
+// the FSM searches the map itself instead
+#define STATE_MACHINE_MAX_PLAN_AGE 100000
+
+/**
+ * The planner thread's latest ranking of the library and how close the rest
+ * of the trajectory that was running comes to obstacles.
+ */
+struct StateMachinePlan {
+    // when the pose and map were taken
+    int64_t utime = -1;
+
+    TrajectoryRanking ranking;
+
+    // the running trajectory and when it started
+    int current_traj = -1;
+    int64_t current_traj_start_t = -1;
+    double current_dist = -1;
+};
 
 class StateMachineControl {
 
     public:
-        StateMachineControl(lcm::LCM *lcm, std::string traj_dir, std::string tvlqr_action_out_channel, std::string state_message_channel, std::string altitude_reset_channel, bool visualization, bool traj_visualization);
+        // param is the configuration, or nullptr to get it from the param server
+        StateMachineControl(lcm::LCM *lcm, std::string traj_dir, std::string tvlqr_action_out_channel, std::string state_message_channel, std::string altitude_reset_channel, bool visualization, bool traj_visualization, BotParam *param = nullptr);
         ~StateMachineControl();
 
         void DoDelayedImuUpdate();
@@ -39,6 +68,12 @@ class StateMachineControl {
         void RequestNewTrajectory();
         void SetBestTrajectory();
 
+        void SetPlanAhead(bool plan_ahead);
+
+        // most times a second to draw the obstacle map with visualization
+        // on (0 for every IMU update)
+        void SetVisualizationRate(double rate_hz);
+
         void SetNextTrajectory(const Trajectory &traj) { next_traj_ = &traj; }
         void SetNextTrajectoryByNumber(int traj_num);
 
@@ -47,6 +82,15 @@ class StateMachineControl {
         void ProcessRcTrajectoryMsg(const lcm::ReceiveBuffer *rbus, const std::string &chan, const lcmt::tvlqr_controller_action *msg);
         void ProcessGoAutonomousMsg(const lcm::ReceiveBuffer *rbus, const std::string &chan, const lcmt::timestamp *msg);
         void ProcessArmForTakeoffMsg(const lcm::ReceiveBuffer *rbus, const std::string &chan, const lcmt::timestamp *msg);
+        void ProcessBaroAirspeedMsg(const lcm::ReceiveBuffer *rbus, const std::string &chan, const lcmt::baro_airspeed *msg);
+
+        // estimate the wind from the airspeed messages and the pose's
+        // velocity, and publish it on wind_channel (empty to only keep it
+        // for GetWindEstimate())
+        void EnableWindEstimate(std::string wind_channel);
+
+        // from the LCM thread only
+        void GetWindEstimate(WindEstimate *estimate) const { wind_estimator_.GetEstimate(estimate); }
 
         void SetTakeoffTime() { t_takeoff_ = ConvertTimestampToSeconds(GetTimestampNow()); }
         void SetTakeoffBearing() { desired_bearing_ = current_bearing_ + bearing_offset_; }
@@ -59,8 +103,9 @@ class StateMachineControl {
 
 
         AircraftStateMachineContext* GetFsmContext() { return &fsm_; }
-        const StereoOctomap* GetOctomap() const { return octomap_; }
+        const ConcurrentStereoOctomap* GetOctomap() const { return octomap_; }
         const TrajectoryLibrary* GetTrajectoryLibrary() const { return trajlib_; }
+        const StereoPointPipeline* GetStereoPipeline() const { return stereo_pipeline_; }
 
         std::string GetCurrentStateName() { return std::string(fsm_.getState().getName()); }
 
@@ -89,17 +134,27 @@ class StateMachineControl {
         void PublishDebugMsg(std::string debug_str) const;
         int GetBearingPreferredTrajectoryNumber() const;
 
+        double GetTrajectoryTime(const Trajectory &traj, int64_t start_t, int64_t now) const;
+        bool SwitchIfBetter(double dist, const std::function<std::tuple<double, const Trajectory*>(int)> &find_best);
+
+        static void* PlannerThread(void *x);
+        void RunPlanner();
+        std::shared_ptr<const StateMachinePlan> GetPlan();
+
+        void TraceStateChange();
+
         AircraftStateMachineContext fsm_;
 
-        StereoOctomap *octomap_;
+        ConcurrentStereoOctomap *octomap_;
         TrajectoryLibrary *trajlib_;
 
-        SpacialStereoFilter *spacial_stereo_filter_;
+        StereoPointPipeline *stereo_pipeline_;
 
         lcm::LCM *lcm_;
 
         BotParam *param_;
         BotFrames *bot_frames_;
+        TransformCache *transforms_;
 
         double safe_distance_;
         double min_improvement_to_switch_trajs_;
@@ -133,14 +188,55 @@ class StateMachineControl {
 
         std::string tvlqr_action_out_channel_, state_message_channel_, altitude_reset_channel_;
 
+        // for reporting when the map overflows
+        int64_t last_num_evicted_voxels_ = 0;
+        bool map_full_ = false;
+
         bool need_imu_update_;
         bool visualization_;
         bool traj_visualization_;
 
+        int64_t visualization_period_ = 0; // usec
+        int64_t last_visualization_t_ = 0;
+
         mav::pose_t last_imu_msg_;
 
+        // in process instead of from wind-estimator, to save an LCM hop
+        bool wind_enabled_ = false;
+        std::string wind_channel_;
+        WindEstimator wind_estimator_;
+
+        // with obstacle_avoidance.planner_thread, the planner ranks the
+        // library after each IMU message and the FSM reads its latest plan_
+        bool use_planner_thread_ = false;
+        pthread_t planner_thread_;
+
+        std::mutex plan_mutex_;
+        std::condition_variable cv_new_pose_;
+        int64_t planner_pose_number_ = 0;
+        double planner_velocity_[3] = { 0, 0, 0 };
+        bool planner_shutting_down_ = false;
+
+        // the planner only ranks in states that will pick a trajectory
+        // (SetPlanAhead())
+        bool planner_plan_ahead_ = false;
+
+        // what the FSM is running, for the planner to check
+        int planner_current_traj_ = -1;
+        int64_t planner_current_traj_start_t_ = -1;
+
+        std::shared_ptr<const StateMachinePlan> plan_;
+
+        // the running trajectory's clearances from the last check, one for
+        // BetterTrajectoryAvailable() and one for the planner thread
+        bool use_clearance_cache_ = false;
+        TrajectoryClearanceCache fsm_clearances_;
+        TrajectoryClearanceCache planner_clearances_;
+
         BotTrans last_draw_transform_;
 
+        // state the trace last saw, for TraceStateChange()
+        const char *last_traced_state_ = nullptr;
 };
 
 #endif
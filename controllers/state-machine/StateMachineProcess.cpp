@@ -0,0 +1,165 @@
+#include "StateMachineProcess.hpp"
+#include "StateMachineControl.hpp"
+#include "../../utils/ShmRing/ShmRing.hpp"
+#include "../../utils/utils/Trace.hpp"
+#include "../../LCM/lcmt/trace_request.hpp"
+
+static void TraceRequestHandler(const lcm::ReceiveBuffer *rbuf, const std::string &channel, const lcmt::trace_request *msg, void *user) {
+    TraceHandleRequest(msg->process_name, msg->dir);
+}
+
+/**
+ * Sets up the state machine and runs it until the process exits.
+ *
+ * @param options channels and visualization
+ * @param stereo_queue stereo hits from this process (instead of from LCM
+ *      or a shared memory ring), or NULL
+ *
+ * @retval exit code, if it fails to start
+ */
+int RunStateMachine(const StateMachineOptions &options, InProcessStereoQueue *stereo_queue) {
+
+    std::string lcm_url;
+    // create an lcm instance
+    if (options.ttl_one) {
+        lcm_url = "udpm://239.255.76.67:7667?ttl=1";
+    } else {
+        lcm_url = "udpm://239.255.76.67:7667?ttl=0";
+    }
+    lcm::LCM lcm(lcm_url);
+
+    if (!lcm.good()) {
+        std::cerr << "LCM creation failed." << std::endl;
+        return 1;
+    }
+
+    BotParam *param = NewParamWithSnapshot(lcm.getUnderlyingLCM(), lcm_url);
+
+    std::string trajectory_dir = std::string(bot_param_get_str_or_fail(param, "tvlqr_controller.library_dir"));
+
+
+    trajectory_dir = ReplaceUserVarInPath(trajectory_dir);
+
+    StateMachineControl fsm_control(&lcm, trajectory_dir, options.tvlqr_action_out_channel, options.state_message_channel, options.altitude_reset_channel, options.visualization, options.traj_visualization, param);
+    fsm_control.SetVisualizationRate(options.visualization_rate);
+    //fsm_control.GetFsmContext()->setDebugFlag(true);
+
+    // subscribe to LCM channels
+    lcm.subscribe(options.pose_channel, &StateMachineControl::ProcessImuMsg, &fsm_control);
+
+    // stereo comes from this process if it's doing stereo, from the ring
+    // if the stereo process made one, otherwise from LCM
+    ShmRingReader ring;
+    bool use_ring = false;
+
+    if (stereo_queue == NULL && options.stereo_ring.length() > 0) {
+        use_ring = ring.Open(options.stereo_ring);
+
+        if (use_ring != true) {
+            std::cerr << "WARNING: no shared memory ring \"" << options.stereo_ring << "\", listening for stereo on LCM." << std::endl;
+        }
+    }
+
+    if (stereo_queue == NULL && use_ring != true) {
+        lcm.subscribe(options.stereo_channel, &StateMachineControl::ProcessStereoMsg, &fsm_control);
+    }
+
+    lcm.subscribe(options.rc_trajectory_commands_channel, &StateMachineControl::ProcessRcTrajectoryMsg, &fsm_control);
+    lcm.subscribe(options.state_machine_go_autonomous_channel, &StateMachineControl::ProcessGoAutonomousMsg, &fsm_control);
+    lcm.subscribe(options.arm_for_takeoff_channel, &StateMachineControl::ProcessArmForTakeoffMsg, &fsm_control);
+
+    if (options.trace_request_channel.length() > 0) {
+        lcm.subscribeFunction(options.trace_request_channel, &TraceRequestHandler, (void*) NULL);
+    }
+
+    if (options.baro_airspeed_channel.length() > 0) {
+        fsm_control.EnableWindEstimate(options.wind_channel);
+        lcm.subscribe(options.baro_airspeed_channel, &StateMachineControl::ProcessBaroAirspeedMsg, &fsm_control);
+
+        printf("Estimating wind from %s, sending it on %s\n", options.baro_airspeed_channel.c_str(), options.wind_channel.length() > 0 ? options.wind_channel.c_str() : "(nothing)");
+    }
+
+    std::string stereo_source = options.stereo_channel;
+
+    if (stereo_queue != NULL) {
+        stereo_source = "(this process)";
+    } else if (use_ring) {
+        stereo_source = options.stereo_ring + " (shared memory)";
+    }
+
+    printf("Receiving LCM:\n\tPose: %s\n\tStereo: %s\n\tRC Trajectories: %s\n\tGo Autonomous: %s\n\tArm for Takeoff: %s\n\nSending LCM:\n\tTVLQR Action: %s\n\tState Machine State: %s\n\tAltitude reset: %s\n", options.pose_channel.c_str(), stereo_source.c_str(), options.rc_trajectory_commands_channel.c_str(), options.state_machine_go_autonomous_channel.c_str(), options.arm_for_takeoff_channel.c_str(), options.tvlqr_action_out_channel.c_str(), options.state_message_channel.c_str(), options.altitude_reset_channel.c_str());
+
+    // sleep until messages arrive, handle all of them, then update the
+    // state machine once with the latest IMU message
+    LcmReactor reactor(lcm.getUnderlyingLCM());
+    reactor.SetIdleTask([&fsm_control]() { fsm_control.DoDelayedImuUpdate(); });
+
+    std::vector<uint8_t> ring_data;
+    lcmt::stereo ring_msg;
+
+    if (use_ring) {
+        int ring_fd = ring.StartNotifier();
+
+        if (ring_fd < 0) {
+            std::cerr << "ERROR: failed to start the shared memory ring's notifier." << std::endl;
+            return 1;
+        }
+
+        reactor.AddFd(ring_fd, [&]() {
+            uint64_t count;
+
+            if (read(ring_fd, &count, sizeof(count)) < 0) {
+                // already cleared
+            }
+
+            // copied out of the ring before decoding, so a message the
+            // stereo process overwrites while we read it is dropped
+            // instead of decoded half-old
+            while (ring.Read(&ring_data)) {
+                if (ring_msg.decode(ring_data.data(), 0, ring_data.size()) < 0) {
+                    std::cerr << "WARNING: failed to decode a stereo message from the shared memory ring." << std::endl;
+                    continue;
+                }
+
+                fsm_control.ProcessStereoMsg(NULL, options.stereo_ring, &ring_msg);
+            }
+        });
+    }
+
+    lcmt::stereo queue_msg;
+    int64_t last_num_dropped = 0;
+
+    if (stereo_queue != NULL) {
+        int queue_fd = stereo_queue->GetFd();
+
+        reactor.AddFd(queue_fd, [&]() {
+            uint64_t count;
+
+            if (read(queue_fd, &count, sizeof(count)) < 0) {
+                // already cleared
+            }
+
+            // already in the message, so there's nothing to decode
+            while (stereo_queue->Pop(&queue_msg)) {
+                fsm_control.ProcessStereoMsg(NULL, stereo_source, &queue_msg);
+            }
+
+            int64_t num_dropped = stereo_queue->GetNumDropped();
+
+            if (num_dropped > last_num_dropped) {
+                std::cerr << "WARNING: state machine fell behind stereo, dropped " << num_dropped - last_num_dropped << " frames." << std::endl;
+                last_num_dropped = num_dropped;
+            }
+        });
+    }
+
+    if (stereo_queue == NULL) {
+        // trajectories are loaded.  Inside the stereo process, stereo says
+        // when the process is ready.
+        PublishProcessReady(lcm.getUnderlyingLCM());
+    }
+
+    reactor.Run();
+
+    return 0;
+}
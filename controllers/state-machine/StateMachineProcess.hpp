@@ -0,0 +1,43 @@
+#ifndef STATE_MACHINE_PROCESS_HPP
+#define STATE_MACHINE_PROCESS_HPP
+
+/*
+ * The state machine controller's setup and main loop, for
+ * state-machine-controller and for the stereo process when it's built with
+ * the state machine in it (sensors/stereo, "make STATE_MACHINE=1").  Then
+ * the stereo loop hands its hits to the obstacle map through an
+ * InProcessStereoQueue instead of LCM, saving the encode, the network hop
+ * and the decode, and the state machine runs on a thread of the stereo
+ * process.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <string>
+#include "InProcessStereoQueue.hpp"
+
+struct StateMachineOptions {
+    bool ttl_one = false;
+    bool visualization = false;
+    bool traj_visualization = false;
+    double visualization_rate = 10;
+
+    std::string pose_channel = "STATE_ESTIMATOR_POSE";
+    std::string stereo_channel = "stereo";
+    std::string stereo_ring = "";
+    std::string rc_trajectory_commands_channel = "rc-trajectory-commands";
+    std::string state_machine_go_autonomous_channel = "state-machine-go-autonomous";
+
+    std::string tvlqr_action_out_channel = "tvlqr-action";
+    std::string arm_for_takeoff_channel = "arm-for-takeoff";
+    std::string state_message_channel = "state-machine-state";
+    std::string altitude_reset_channel = "altitude-reset";
+    std::string baro_airspeed_channel = "";
+    std::string wind_channel = "wind-groundspeed";
+    std::string trace_request_channel = "trace_request";
+};
+
+int RunStateMachine(const StateMachineOptions &options, InProcessStereoQueue *stereo_queue = NULL);
+
+#endif
@@ -1,6 +1,8 @@
 #include "StateMachineControl.hpp"
+#include "InProcessStereoQueue.hpp"
 #include "gtest/gtest.h"
 #include "../../utils/utils/RealtimeUtils.hpp"
+#include "../../utils/utils/Trace.hpp"
 #include <ctime>
 #include <stack>
 
@@ -722,6 +724,110 @@ TEST_F(StateMachineControlTest, BearingController) {
     UnsubscribeLcmChannels();
 }
 
+TEST_F(StateMachineControlTest, TracesEventsAndTransitions) {
+    StateMachineControl *fsm_control = new StateMachineControl(lcm_, "../TrajectoryLibrary/trajtest/full", "tvlqr-action-out", "state-machine-state", "altitude-reset", false, false);
+
+    TraceRing *ring = TraceGetThreadRing();
+    ASSERT_TRUE(ring != NULL);
+    uint64_t begin = ring->count.load();
+
+    lcmt::tvlqr_controller_action msg;
+    msg.timestamp = 0;
+    msg.trajectory_number = 0;
+
+    fsm_control->ProcessRcTrajectoryMsg(NULL, "", &msg);
+
+    EXPECT_TRUE(fsm_control->GetCurrentStateName().compare("AirplaneFsm::RunSingleTrajectory") == 0) << "In wrong state: " << fsm_control->GetCurrentStateName();
+
+    bool found_event = false, found_transition = false;
+
+    for (uint64_t i = begin; i < ring->count.load(); i++) {
+        const TraceEvent &event = ring->events[i & (TRACE_RING_EVENTS - 1)];
+
+        if (std::string(event.name) == "fsm-single-trajectory-request" && event.end > event.start) {
+            found_event = true;
+        } else if (std::string(event.name) == "AirplaneFsm::RunSingleTrajectory" && event.end == event.start) {
+            found_transition = true;
+        }
+    }
+
+    EXPECT_TRUE(found_event);
+    EXPECT_TRUE(found_transition);
+
+    // another request starts the trajectory over without leaving the state,
+    // so there's no instant for it
+    begin = ring->count.load();
+    fsm_control->ProcessRcTrajectoryMsg(NULL, "", &msg);
+
+    for (uint64_t i = begin; i < ring->count.load(); i++) {
+        const TraceEvent &event = ring->events[i & (TRACE_RING_EVENTS - 1)];
+        EXPECT_NE(event.end, event.start) << event.name;
+    }
+
+    delete fsm_control;
+}
+
+TEST(StateMachineInProcessStereo, PassesFramesInOrder) {
+    InProcessStereoQueue queue;
+
+    float x[3] = { 1, 2, 3 }, y[3] = { 4, 5, 6 }, z[3] = { 7, 8, 9 };
+    uint8_t grey[3] = { 10, 11, 12 };
+
+    lcmt::stereo msg;
+    EXPECT_FALSE(queue.Pop(&msg));
+
+    EXPECT_TRUE(queue.Push(100, 1, 2, 3, x, y, z, grey));
+    EXPECT_TRUE(queue.Push(200, 2, 2, 1, x + 2, y + 2, z + 2, NULL));
+
+    // the reader gets woken up
+    uint64_t count;
+    EXPECT_EQ(read(queue.GetFd(), &count, sizeof(count)), (ssize_t)sizeof(count));
+    EXPECT_EQ(count, 2u);
+
+    ASSERT_TRUE(queue.Pop(&msg));
+    EXPECT_EQ(msg.timestamp, 100);
+    EXPECT_EQ(msg.frame_number, 1);
+    EXPECT_EQ(msg.video_number, 2);
+    ASSERT_EQ(msg.number_of_points, 3);
+    EXPECT_EQ(msg.x, std::vector<float>(x, x + 3));
+    EXPECT_EQ(msg.y, std::vector<float>(y, y + 3));
+    EXPECT_EQ(msg.z, std::vector<float>(z, z + 3));
+    EXPECT_EQ(msg.grey, std::vector<int8_t>(grey, grey + 3));
+
+    ASSERT_TRUE(queue.Pop(&msg));
+    EXPECT_EQ(msg.timestamp, 200);
+    ASSERT_EQ(msg.number_of_points, 1);
+    EXPECT_EQ(msg.x[0], 3);
+    EXPECT_EQ(msg.grey[0], 0);
+
+    EXPECT_FALSE(queue.Pop(&msg));
+}
+
+TEST(StateMachineInProcessStereo, DropsWhenFull) {
+    InProcessStereoQueue queue;
+
+    float point[1] = { 1 };
+
+    for (int i = 0; i < IN_PROCESS_STEREO_QUEUE_SIZE - 1; i++) {
+        EXPECT_TRUE(queue.Push(i, i, 0, 1, point, point, point, NULL));
+    }
+
+    // the reader fell behind
+    EXPECT_FALSE(queue.Push(99, 99, 0, 1, point, point, point, NULL));
+    EXPECT_EQ(queue.GetNumDropped(), 1);
+
+    lcmt::stereo msg;
+
+    for (int i = 0; i < IN_PROCESS_STEREO_QUEUE_SIZE - 1; i++) {
+        ASSERT_TRUE(queue.Pop(&msg));
+        EXPECT_EQ(msg.frame_number, i);
+    }
+
+    // and has room again
+    EXPECT_TRUE(queue.Push(100, 100, 0, 1, point, point, point, NULL));
+    ASSERT_TRUE(queue.Pop(&msg));
+    EXPECT_EQ(msg.frame_number, 100);
+}
 
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,543 @@
+/*
+ * Closed-loop simulation of the state machine and TVLQR control.
+ *
+ * Example:
+ *   ./state-machine-sim -c ../../config/plane-odroid-gps1.cfg -d ../TrajectoryLibrary/trajtest/full -o sim.csv
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include "state-machine-sim.hpp"
+
+int main(int argc, char *argv[]) {
+
+    string config_file = "";
+    string trajectory_dir = "";
+    string output_file = "";
+    string pose_channel = "STATE_ESTIMATOR_POSE";
+    double duration = 30;
+    double pose_rate = 100;
+    double stereo_rate = 30;
+    double stereo_range = 25;
+    double altitude = 30;
+    double forest_length = 300;
+    int num_trees = 100;
+    int seed = 0;
+    bool interpolate = false;
+
+    ConciseArgs parser(argc, argv);
+    parser.add(config_file, "c", "config", "Configuration file (like config/plane-odroid-gps1.cfg) with the frames, servo, tvlqr_controller and obstacle_avoidance settings.", true);
+    parser.add(output_file, "o", "output", "Write the CSV results to this file (the state machine prints to stdout).", true);
+    parser.add(trajectory_dir, "d", "trajectory-dir", "Trajectory library to fly with (defaults to the config file's).");
+    parser.add(pose_channel, "p", "pose-channel", "LCM channel the config file's body frame is updated on.");
+    parser.add(duration, "T", "duration", "Seconds of simulated flight.");
+    parser.add(pose_rate, "r", "pose-rate", "Pose (and control) steps per second.");
+    parser.add(stereo_rate, "e", "stereo-rate", "Stereo messages per second.");
+    parser.add(stereo_range, "R", "stereo-range", "How far away the stereo system sees trees, in meters.");
+    parser.add(altitude, "a", "altitude", "Altitude to fly at.  The trees are taller.");
+    parser.add(forest_length, "l", "forest-length", "How far ahead the forest goes, in meters.");
+    parser.add(num_trees, "f", "trees", "Number of trees in the random forest.");
+    parser.add(seed, "s", "seed", "Random seed for the forest.");
+    parser.add(interpolate, "i", "interpolate", "Interpolate the trajectories in the control (SetInterpolate()).");
+    parser.parse();
+
+    if (pose_rate <= 0 || stereo_rate <= 0) {
+        fprintf(stderr, "Error: the pose and stereo rates must be positive.\n");
+        return 1;
+    }
+
+    BotParam *param = bot_param_new_from_file(config_file.c_str());
+
+    if (param == NULL) {
+        fprintf(stderr, "Failed to parse configuration file, quitting.\n");
+        return 1;
+    }
+
+    if (trajectory_dir.length() == 0) {
+        trajectory_dir = ReplaceUserVarInPath(bot_param_get_str_or_fail(param, "tvlqr_controller.library_dir"));
+    }
+
+    // everything from here on (trajectory timing, map expiry, plan ages)
+    // runs on the simulated clock
+    SetSimulatedTime(SIM_START_UTIME);
+
+    // in-process, so nothing else on the network sees (or adds to) the run
+    lcm::LCM lcm("memq://");
+
+    if (!lcm.good()) {
+        fprintf(stderr, "Error: LCM creation failed.\n");
+        return 1;
+    }
+
+    StateMachineControl fsm_control(&lcm, trajectory_dir, "tvlqr-action", "state-machine-state", "altitude-reset", false, false, param);
+
+    lcm.subscribe(pose_channel, &StateMachineControl::ProcessImuMsg, &fsm_control);
+    lcm.subscribe("stereo", &StateMachineControl::ProcessStereoMsg, &fsm_control);
+
+    const TrajectoryLibrary *trajlib = fsm_control.GetTrajectoryLibrary();
+    const Trajectory *stable_traj = trajlib->GetTrajectoryByNumber(bot_param_get_int_or_fail(param, "tvlqr_controller.stable_controller"));
+
+    ServoConverter converter(param);
+
+    TvlqrControl control(&converter, *stable_traj);
+    control.SetInterpolate(interpolate);
+
+    SimAircraft aircraft;
+
+    aircraft.pos[0] = 0;
+    aircraft.pos[1] = 0;
+    aircraft.pos[2] = altitude;
+
+    for (int i = 0; i < 3; i++) {
+        aircraft.rpy[i] = 0;
+        aircraft.vel[i] = 0;
+        aircraft.rotation_rate[i] = 0;
+    }
+
+    StartTrajectory(*stable_traj, SIM_START_UTIME, &aircraft);
+    control.SetTrajectory(*stable_traj);
+
+    SimContext context;
+    context.trajlib = trajlib;
+    context.control = &control;
+    context.aircraft = &aircraft;
+    context.num_switches = 0;
+
+    lcm.subscribeFunction("tvlqr-action", &HandleTvlqrAction, &context);
+
+    BotFrames *bot_frames = bot_frames_new(lcm.getUnderlyingLCM(), param);
+
+    BotTrans body_to_camera;
+    bot_frames_get_trans(bot_frames, "body", "opencvFrame", &body_to_camera);
+
+    vector<SimTree> trees;
+    MakeTrees(num_trees, seed, altitude, forest_length, &trees);
+
+    mav::pose_t pose_msg;
+    AircraftToPoseMsg(aircraft, SIM_START_UTIME, &pose_msg);
+
+    lcm.publish(pose_channel, &pose_msg);
+    while (NonBlockingLcm(lcm.getUnderlyingLCM())) {}
+    fsm_control.DoDelayedImuUpdate();
+
+    // straight to flying autonomously, as if the takeoff and climb were done
+    lcmt::tvlqr_controller_action single_trajectory_msg;
+    single_trajectory_msg.timestamp = SIM_START_UTIME;
+    single_trajectory_msg.trajectory_number = stable_traj->GetTrajectoryNumber();
+
+    fsm_control.ProcessRcTrajectoryMsg(nullptr, "", &single_trajectory_msg);
+
+    lcmt::timestamp autonomous_msg;
+    autonomous_msg.timestamp = SIM_START_UTIME;
+
+    fsm_control.ProcessGoAutonomousMsg(nullptr, "", &autonomous_msg);
+
+    while (NonBlockingLcm(lcm.getUnderlyingLCM())) {}
+
+    FILE *out = fopen(output_file.c_str(), "w");
+
+    if (out == NULL) {
+        fprintf(stderr, "Error: failed to open %s for writing.\n", output_file.c_str());
+        return 1;
+    }
+
+    fprintf(out, "t,state,trajectory,stereo_ms,decision_ms,cpu_ms,control_ms,clearance\n");
+
+    int64_t dt_utime = 1000000.0 / pose_rate;
+    int64_t stereo_dt_utime = 1000000.0 / stereo_rate;
+    int64_t next_stereo_utime = SIM_START_UTIME + stereo_dt_utime;
+
+    int num_steps = duration * pose_rate;
+
+    vector<float> all_stereo_ms, all_decision_ms, all_cpu_ms, all_control_ms;
+
+    double min_clearance = -1;
+    int collision_steps = 0;
+
+    for (int i = 1; i <= num_steps; i++) {
+
+        int64_t utime = SIM_START_UTIME + i * dt_utime;
+        SetSimulatedTime(utime);
+
+        StepAircraft(utime, dt_utime / 1000000.0, &aircraft);
+
+        SimStep step;
+        step.t = (utime - SIM_START_UTIME) / 1000000.0;
+        step.stereo_ms = 0;
+
+        struct timespec start, end, cpu_start, cpu_end;
+
+        if (utime >= next_stereo_utime) {
+            lcmt::stereo stereo_msg;
+            MakeStereoMsg(trees, aircraft, body_to_camera, stereo_range, utime, &stereo_msg);
+
+            lcm.publish("stereo", &stereo_msg);
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            while (NonBlockingLcm(lcm.getUnderlyingLCM())) {}
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            step.stereo_ms = ElapsedMs(start, end);
+            all_stereo_ms.push_back(step.stereo_ms);
+
+            next_stereo_utime += stereo_dt_utime;
+        }
+
+        AircraftToPoseMsg(aircraft, utime, &pose_msg);
+        lcm.publish(pose_channel, &pose_msg);
+
+        // the pose arriving through the state machine's decision
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+
+        while (NonBlockingLcm(lcm.getUnderlyingLCM())) {}
+        fsm_control.DoDelayedImuUpdate();
+
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        step.decision_ms = ElapsedMs(start, end);
+        step.cpu_ms = ElapsedMs(cpu_start, cpu_end);
+
+        // hands a new trajectory (if the state machine asked for one) to the
+        // control and the aircraft
+        while (NonBlockingLcm(lcm.getUnderlyingLCM())) {}
+
+        mav_pose_t pose_msg_c;
+        PoseMsgToC(pose_msg, &pose_msg_c);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        control.GetControl(&pose_msg_c);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        step.control_ms = ElapsedMs(start, end);
+
+        step.state = fsm_control.GetCurrentStateName();
+        step.trajectory = aircraft.trajectory->GetTrajectoryNumber();
+        step.clearance = Clearance(trees, aircraft.pos);
+
+        if (min_clearance < 0 || step.clearance < min_clearance) {
+            min_clearance = step.clearance;
+        }
+
+        if (step.clearance <= 0) {
+            collision_steps ++;
+        }
+
+        all_decision_ms.push_back(step.decision_ms);
+        all_cpu_ms.push_back(step.cpu_ms);
+        all_control_ms.push_back(step.control_ms);
+
+        WriteStep(out, step);
+    }
+
+    fclose(out);
+
+    ClearSimulatedTime();
+
+    fprintf(stderr, "%d steps, %d trajectory switches, min clearance %.2f m, %d steps in collision\n", num_steps,
+        context.num_switches, min_clearance, collision_steps);
+
+    fprintf(stderr, "stereo: p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", Percentile(&all_stereo_ms, 50),
+        Percentile(&all_stereo_ms, 99), Percentile(&all_stereo_ms, 100));
+
+    fprintf(stderr, "decision: p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", Percentile(&all_decision_ms, 50),
+        Percentile(&all_decision_ms, 99), Percentile(&all_decision_ms, 100));
+
+    fprintf(stderr, "cpu: p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", Percentile(&all_cpu_ms, 50),
+        Percentile(&all_cpu_ms, 99), Percentile(&all_cpu_ms, 100));
+
+    float control_p50 = Percentile(&all_control_ms, 50);
+    float control_p99 = Percentile(&all_control_ms, 99);
+
+    fprintf(stderr, "control: p50 %.3f ms, p99 %.3f ms, max %.3f ms, jitter (p99 - p50) %.3f ms\n", control_p50,
+        control_p99, Percentile(&all_control_ms, 100), control_p99 - control_p50);
+
+    fsm_control.GetStereoPipeline()->PrintStats(stderr);
+
+#ifdef USE_NO_ALLOC_GUARD
+    // the control path has to stay off the heap
+    NoAllocPrintSummary(stderr);
+
+    if (NoAllocGetNumViolations() > 0) {
+        fprintf(stderr, "Error: %lld allocations in no-alloc regions.\n", (long long)NoAllocGetNumViolations());
+        return 1;
+    }
+#endif
+
+    return 0;
+}
+
+/**
+ * Starts the control and the aircraft on the trajectory the state machine
+ * asked for.
+ */
+void HandleTvlqrAction(const lcm::ReceiveBuffer *rbuf, const std::string &chan, const lcmt::tvlqr_controller_action *msg, SimContext *context) {
+
+    const Trajectory *trajectory = context->trajlib->GetTrajectoryByNumber(msg->trajectory_number);
+
+    if (trajectory == nullptr) {
+        fprintf(stderr, "Warning: the state machine asked for trajectory #%d, which doesn't exist.\n", msg->trajectory_number);
+        return;
+    }
+
+    context->control->SetTrajectory(*trajectory);
+    StartTrajectory(*trajectory, msg->timestamp, context->aircraft);
+
+    context->num_switches ++;
+}
+
+/**
+ * Makes a random forest ahead of the aircraft (which starts at the origin,
+ * facing +x), with every tree taller than it flies.
+ *
+ * @param num_trees number of trees
+ * @param seed random seed
+ * @param altitude how high the aircraft flies
+ * @param length how far ahead the forest goes
+ * @param trees (output) the trees
+ */
+void MakeTrees(int num_trees, int seed, double altitude, double length, vector<SimTree> *trees) {
+
+    std::default_random_engine rand_engine(seed);
+    std::uniform_real_distribution<double> x_dist(20, 20 + length);
+    std::uniform_real_distribution<double> y_dist(-40, 40);
+    std::uniform_real_distribution<double> height_dist(altitude + 5, 2 * altitude);
+
+    trees->clear();
+
+    for (int i = 0; i < num_trees; i++) {
+        SimTree tree;
+
+        tree.x = x_dist(rand_engine);
+        tree.y = y_dist(rand_engine);
+        tree.height = height_dist(rand_engine);
+
+        trees->push_back(tree);
+    }
+}
+
+/**
+ * Makes the stereo message the aircraft would get now: a point in each voxel
+ * up every trunk in front of the camera (90 degrees across) and within range,
+ * in the camera's frame.
+ *
+ * @param trees the forest
+ * @param aircraft where the aircraft is
+ * @param body_to_camera transform from the body frame to the camera's (opencvFrame)
+ * @param range how far the stereo system sees
+ * @param utime time of the message
+ * @param msg (output) the message
+ */
+void MakeStereoMsg(const vector<SimTree> &trees, const SimAircraft &aircraft, const BotTrans &body_to_camera, double range, int64_t utime, lcmt::stereo *msg) {
+
+    BotTrans local_to_body;
+
+    for (int i = 0; i < 3; i++) {
+        local_to_body.trans_vec[i] = aircraft.pos[i];
+    }
+
+    bot_roll_pitch_yaw_to_quat(aircraft.rpy, local_to_body.rot_quat);
+    bot_trans_invert(&local_to_body);
+
+    msg->timestamp = utime;
+    msg->frame_number = 0;
+    msg->video_number = 0;
+
+    msg->x.clear();
+    msg->y.clear();
+    msg->z.clear();
+    msg->grey.clear();
+
+    for (const SimTree &tree : trees) {
+        double dx = tree.x - aircraft.pos[0];
+        double dy = tree.y - aircraft.pos[1];
+
+        if (dx * dx + dy * dy > range * range) {
+            continue;
+        }
+
+        for (double z = 0; z < tree.height; z += OCTOMAP_VOXEL_SIZE) {
+            double point[3] = { tree.x, tree.y, z };
+            double point_body[3], point_camera[3];
+
+            bot_trans_apply_vec(&local_to_body, point, point_body);
+
+            if (point_body[0] <= 0 || point_body[0] > range
+                || fabs(point_body[1]) > point_body[0] || fabs(point_body[2]) > point_body[0]) {
+
+                continue;
+            }
+
+            bot_trans_apply_vec(&body_to_camera, point_body, point_camera);
+
+            msg->x.push_back(point_camera[0]);
+            msg->y.push_back(point_camera[1]);
+            msg->z.push_back(point_camera[2]);
+            msg->grey.push_back(0);
+        }
+    }
+
+    msg->number_of_points = msg->x.size();
+}
+
+/**
+ * @param trees the forest
+ * @param pos where the aircraft is
+ *
+ * @retval how far the aircraft is from the nearest trunk's surface or the
+ *      ground (0 or less is a collision)
+ */
+double Clearance(const vector<SimTree> &trees, const double pos[3]) {
+
+    double clearance = pos[2];
+
+    for (const SimTree &tree : trees) {
+        double dx = tree.x - pos[0];
+        double dy = tree.y - pos[1];
+        double dz = std::max(pos[2] - tree.height, 0.0);
+
+        clearance = std::min(clearance, sqrt(dx * dx + dy * dy + dz * dz) - SIM_TRUNK_RADIUS);
+    }
+
+    return clearance;
+}
+
+/**
+ * Starts the aircraft on a trajectory from where it is now.  Trajectories
+ * are relative to their start's position and yaw (like
+ * Trajectory::GetXyzYawTransformedPoint() uses).
+ *
+ * @param trajectory trajectory to fly
+ * @param utime when it starts
+ * @param aircraft the aircraft
+ */
+void StartTrajectory(const Trajectory &trajectory, int64_t utime, SimAircraft *aircraft) {
+
+    aircraft->trajectory = &trajectory;
+    aircraft->trajectory_start_utime = utime;
+
+    for (int i = 0; i < 3; i++) {
+        aircraft->trajectory_start.trans_vec[i] = aircraft->pos[i];
+    }
+
+    double rpy[3] = { 0, 0, aircraft->rpy[2] };
+    bot_roll_pitch_yaw_to_quat(rpy, aircraft->trajectory_start.rot_quat);
+}
+
+/**
+ * Moves the aircraft along its trajectory to utime.  Time-invariant
+ * trajectories, and time-varying ones that have run out, fly straight ahead
+ * at the forward speed they had.
+ *
+ * @param utime time now
+ * @param dt time since the last step, in seconds
+ * @param aircraft the aircraft
+ */
+void StepAircraft(int64_t utime, double dt, SimAircraft *aircraft) {
+
+    const Trajectory *trajectory = aircraft->trajectory;
+
+    double t = (utime - aircraft->trajectory_start_utime) / 1000000.0;
+
+    if (trajectory->IsTimeInvariant() || t > trajectory->GetMaxTime()) {
+
+        if (trajectory->IsTimeInvariant()) {
+            const TrajectorySample &sample = trajectory->At(0);
+
+            aircraft->rpy[0] = sample.x(3);
+            aircraft->rpy[1] = sample.x(4);
+
+            for (int i = 0; i < 3; i++) {
+                aircraft->vel[i] = sample.x(6 + i);
+                aircraft->rotation_rate[i] = sample.x(9 + i);
+            }
+        }
+
+        aircraft->pos[0] += cos(aircraft->rpy[2]) * aircraft->vel[0] * dt;
+        aircraft->pos[1] += sin(aircraft->rpy[2]) * aircraft->vel[0] * dt;
+
+        return;
+    }
+
+    TrajectorySample sample;
+    trajectory->Interpolate(t, &sample);
+
+    Trajectory::TransformXyzYaw(aircraft->trajectory_start, &sample.x(0), &sample.x(1), &sample.x(2), 1, aircraft->pos);
+
+    double start_rpy[3];
+    bot_quat_to_roll_pitch_yaw(aircraft->trajectory_start.rot_quat, start_rpy);
+
+    aircraft->rpy[0] = sample.x(3);
+    aircraft->rpy[1] = sample.x(4);
+    aircraft->rpy[2] = start_rpy[2] + sample.x(5);
+
+    for (int i = 0; i < 3; i++) {
+        aircraft->vel[i] = sample.x(6 + i);
+        aircraft->rotation_rate[i] = sample.x(9 + i);
+    }
+}
+
+void AircraftToPoseMsg(const SimAircraft &aircraft, int64_t utime, mav::pose_t *msg) {
+
+    msg->utime = utime;
+
+    bot_roll_pitch_yaw_to_quat(aircraft.rpy, msg->orientation);
+
+    for (int i = 0; i < 3; i++) {
+        msg->pos[i] = aircraft.pos[i];
+        msg->vel[i] = aircraft.vel[i];
+        msg->rotation_rate[i] = aircraft.rotation_rate[i];
+        msg->accel[i] = 0;
+    }
+}
+
+// the control takes the C type
+void PoseMsgToC(const mav::pose_t &msg, mav_pose_t *msg_c) {
+
+    msg_c->utime = msg.utime;
+
+    for (int i = 0; i < 3; i++) {
+        msg_c->pos[i] = msg.pos[i];
+        msg_c->vel[i] = msg.vel[i];
+        msg_c->rotation_rate[i] = msg.rotation_rate[i];
+        msg_c->accel[i] = msg.accel[i];
+    }
+
+    for (int i = 0; i < 4; i++) {
+        msg_c->orientation[i] = msg.orientation[i];
+    }
+}
+
+float ElapsedMs(const struct timespec &start, const struct timespec &end) {
+    return (end.tv_sec - start.tv_sec) * 1000.0f + (end.tv_nsec - start.tv_nsec) / 1000000.0f;
+}
+
+/**
+ * @param values times to take the percentile of (gets sorted)
+ * @param percent 0 to 100
+ *
+ * @retval the percentile, or 0 if there are no values
+ */
+float Percentile(vector<float> *values, int percent) {
+    if (values->size() == 0) {
+        return 0;
+    }
+
+    sort(values->begin(), values->end());
+
+    return (*values)[min(values->size() - 1, (values->size() * percent) / 100)];
+}
+
+/**
+ * Writes one pose step as a line of CSV.
+ *
+ * @param out file to write to
+ * @param step the step
+ */
+void WriteStep(FILE *out, const SimStep &step) {
+
+    fprintf(out, "%.3f,%s,%d,%.3f,%.3f,%.3f,%.3f,%.2f\n", step.t, step.state.c_str(), step.trajectory,
+        step.stereo_ms, step.decision_ms, step.cpu_ms, step.control_ms, step.clearance);
+}
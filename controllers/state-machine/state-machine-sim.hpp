@@ -0,0 +1,121 @@
+/*
+ * Closed-loop simulation of the autonomy stack for performance testing.
+ * Runs StateMachineControl (with its StereoOctomap and TrajectoryLibrary)
+ * and TvlqrControl in one process on a simulated clock
+ * (SetSimulatedTime()), so a run only depends on its arguments.  The
+ * aircraft flies through a random forest: each pose step it flies the
+ * trajectory the state machine asked for, the state machine gets the pose,
+ * and at the stereo rate it also gets the trees the camera would see.
+ *
+ * Prints, for each pose step, the state machine's decision time, the CPU
+ * time the whole process spent on it (including the map and planner
+ * threads if they're on), the control's time and how close the aircraft
+ * is to the trees, as CSV, and a summary with the control's jitter and
+ * what each stage of the stereo pipeline kept at the end.  Built with
+ * "make NO_ALLOC_GUARD=1", it also fails if the control path allocated
+ * once warmed up (see NoAllocGuard.hpp).
+ *
+ * The aircraft model is kinematic: it follows the running trajectory's
+ * nominal states exactly, starting where the aircraft was when the
+ * trajectory started, so the loop is closed through the state machine's
+ * choices and the control's commands are only timed.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#ifndef STATE_MACHINE_SIM_HPP
+#define STATE_MACHINE_SIM_HPP
+
+#include <time.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <random>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include "../../externals/ConciseArgs.hpp"
+#include "../../utils/utils/RealtimeUtils.hpp"
+#include "../../utils/utils/NoAllocGuard.hpp"
+#include "../../utils/ServoConverter/ServoConverter.hpp"
+#include "../tvlqr/TvlqrControl.hpp"
+
+#include "StateMachineControl.hpp"
+
+using namespace std;
+
+// the simulated clock starts here (Jan 1, 2015), in usec
+#define SIM_START_UTIME 1420070400000000
+
+// trees are this thick, so closer than this to a trunk is a collision
+#define SIM_TRUNK_RADIUS 0.25
+
+// a tree trunk: a vertical line from the ground up to height
+struct SimTree {
+    double x;
+    double y;
+    double height;
+};
+
+// the simulated aircraft and the trajectory it's flying
+struct SimAircraft {
+    double pos[3];
+    double rpy[3];
+
+    // body frame
+    double vel[3];
+    double rotation_rate[3];
+
+    const Trajectory *trajectory;
+    int64_t trajectory_start_utime;
+
+    // where the aircraft was when the trajectory started
+    BotTrans trajectory_start;
+};
+
+// what the tvlqr-action handler needs to start a trajectory
+struct SimContext {
+    const TrajectoryLibrary *trajlib;
+    TvlqrControl *control;
+    SimAircraft *aircraft;
+
+    int num_switches;
+};
+
+// everything measured on one pose step
+struct SimStep {
+    double t;
+
+    string state;
+    int trajectory;
+
+    float stereo_ms;
+    float decision_ms;
+    float cpu_ms;
+    float control_ms;
+
+    double clearance;
+};
+
+void HandleTvlqrAction(const lcm::ReceiveBuffer *rbuf, const std::string &chan, const lcmt::tvlqr_controller_action *msg, SimContext *context);
+
+void MakeTrees(int num_trees, int seed, double altitude, double length, vector<SimTree> *trees);
+void MakeStereoMsg(const vector<SimTree> &trees, const SimAircraft &aircraft, const BotTrans &body_to_camera, double range, int64_t utime, lcmt::stereo *msg);
+double Clearance(const vector<SimTree> &trees, const double pos[3]);
+
+void StartTrajectory(const Trajectory &trajectory, int64_t utime, SimAircraft *aircraft);
+void StepAircraft(int64_t utime, double dt, SimAircraft *aircraft);
+void AircraftToPoseMsg(const SimAircraft &aircraft, int64_t utime, mav::pose_t *msg);
+void PoseMsgToC(const mav::pose_t &msg, mav_pose_t *msg_c);
+
+float ElapsedMs(const struct timespec &start, const struct timespec &end);
+float Percentile(vector<float> *values, int percent);
+
+void WriteStep(FILE *out, const SimStep &step);
+
+#endif
@@ -0,0 +1,17 @@
+TARGET = state-machine-sim
+
+SM_SOURCES = AircraftStateMachine.sm
+
+SOURCES = $(SM_SOURCES:.sm=_sm.cpp) StateMachineControl.cpp ../tvlqr/TvlqrControl.cpp ../TrajectoryLibrary/TrajectoryLibrary.cpp ../TrajectoryLibrary/Trajectory.cpp ../../utils/CsvReader/CsvReader.cpp ../../utils/utils/RealtimeUtils.cpp ../../utils/ServoConverter/ServoConverter.cpp ../../estimators/StereoOctomap/StereoOctomap.cpp ../../estimators/StereoOctomap/ConcurrentStereoOctomap.cpp state-machine-sim.cpp ../../estimators/SpacialStereoFilter/SpacialStereoFilter.cpp ../../estimators/StereoFilter/StereoFilter.cpp ../../estimators/StereoPointPipeline/StereoPointPipeline.cpp ../../estimators/StereoPointPipeline/StereoHitClusterer.cpp ../../estimators/cpp_wind/WindEstimator.cpp ../../utils/ThreadPool/ThreadPool.cpp
+
+SMC = java -jar ../../externals/smc/bin/Smc.jar
+
+# Uncomment to turn on debug message generation.
+TRACE=          -g $(NO_STREAMS)
+
+SMC_FLAGS = -c++ $(TRACE) $(NO_CATCH) $(NO_EXCEPT) $(CRTP) $(TRACE)
+
+%_sm.h %_sm.cpp : %.sm
+		$(SMC) $(SMC_FLAGS) $<
+
+include ../../utils/make/flight.mk
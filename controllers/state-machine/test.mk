@@ -2,7 +2,7 @@ TARGET = test
 
 SM_SOURCES = AircraftStateMachine.sm
 
-SOURCES = $(SM_SOURCES:.sm=_sm.cpp) StateMachineControl.cpp ../tvlqr/TvlqrControl.cpp ../TrajectoryLibrary/TrajectoryLibrary.cpp ../TrajectoryLibrary/Trajectory.cpp ../../externals/csvparser/csvparser.c ../../utils/utils/RealtimeUtils.cpp ../../utils/ServoConverter/ServoConverter.cpp ../../estimators/StereoOctomap/StereoOctomap.cpp StateMachineTests.cpp ../../estimators/SpacialStereoFilter/SpacialStereoFilter.cpp
+SOURCES = $(SM_SOURCES:.sm=_sm.cpp) StateMachineControl.cpp ../tvlqr/TvlqrControl.cpp ../TrajectoryLibrary/TrajectoryLibrary.cpp ../TrajectoryLibrary/Trajectory.cpp ../../utils/CsvReader/CsvReader.cpp ../../utils/utils/RealtimeUtils.cpp ../../utils/ServoConverter/ServoConverter.cpp ../../estimators/StereoOctomap/StereoOctomap.cpp ../../estimators/StereoOctomap/ConcurrentStereoOctomap.cpp StateMachineTests.cpp InProcessStereoQueue.cpp ../../estimators/SpacialStereoFilter/SpacialStereoFilter.cpp ../../estimators/StereoFilter/StereoFilter.cpp ../../estimators/StereoPointPipeline/StereoPointPipeline.cpp ../../estimators/StereoPointPipeline/StereoHitClusterer.cpp ../../estimators/cpp_wind/WindEstimator.cpp ../../utils/ThreadPool/ThreadPool.cpp
 
 SMC = java -jar ../../externals/smc/bin/Smc.jar
 
@@ -6,10 +6,13 @@
  */
 
 #include "TvlqrControl.hpp"
+#include "../../utils/utils/Trace.hpp"
+#include "../../utils/utils/NoAllocGuard.hpp"
 
 TvlqrControl::TvlqrControl(const ServoConverter *converter, const Trajectory &stable_controller) {
     current_trajectory_ = nullptr;
     state_initialized_ = false;
+    interpolate_ = false;
     t0_ = 0;
     last_ti_state_estimator_reset_ = 0;
     converter_ = converter;
@@ -19,15 +22,23 @@ TvlqrControl::TvlqrControl(const ServoConverter *converter, const Trajectory &st
 
 void TvlqrControl::SetTrajectory(const Trajectory &trajectory) {
 
+    // a lazily loaded trajectory's gains get loaded here, not in the
+    // middle of GetControl()
+    trajectory.Load();
+
     current_trajectory_ = &trajectory;
 
     state_initialized_ = false;
 
 }
 
-Eigen::VectorXi TvlqrControl::GetControl(const mav_pose_t *msg) {
+Eigen::Vector3i TvlqrControl::GetControl(const mav_pose_t *msg) {
+    TRACE_SCOPE("tvlqr-control");
+    NO_ALLOC_SCOPE("tvlqr-control");
+
+    const Trajectory *trajectory = current_trajectory_.load();
 
-    if (current_trajectory_ == NULL) {
+    if (trajectory == NULL) {
         std::cerr << "Warning: NULL trajectory in GetControl." << std::endl;
         return converter_->GetTrimCommands();
     }
@@ -41,59 +52,62 @@ Eigen::VectorXi TvlqrControl::GetControl(const mav_pose_t *msg) {
         InitializeState(msg);
     }
 
-    Eigen::VectorXd state_minus_init = GetStateMinusInit(msg);
-
-
-    // unwrap angles
-    state_minus_init(3) = AngleUnwrap(state_minus_init(3), last_state_(3));
-    state_minus_init(4) = AngleUnwrap(state_minus_init(4), last_state_(4));
-    state_minus_init(5) = AngleUnwrap(state_minus_init(5), last_state_(5));
-
-    last_state_ = state_minus_init;
-
     double t_along_trajectory;
 
     // check for TILQR case
-    if (current_trajectory_->IsTimeInvariant()) {
+    if (trajectory->IsTimeInvariant()) {
         t_along_trajectory = 0;
     } else {
         t_along_trajectory = GetTNow();
     }
 
-    if (t_along_trajectory <= current_trajectory_->GetMaxTime()) {
-
-        Eigen::VectorXd x0 = current_trajectory_->GetState(t_along_trajectory);
-        Eigen::MatrixXd gain_matrix = current_trajectory_->GetGainMatrix(t_along_trajectory);
+    if (t_along_trajectory > trajectory->GetMaxTime()) {
+        // we are past the max time, switch to the stabilizing controller
+        // (time invariant, so it never runs out)
+        SetTrajectory(*stable_controller_);
+        InitializeState(msg);
 
-        Eigen::VectorXd state_error = state_minus_init - x0;
+        trajectory = stable_controller_;
 
-        //std:: << "state error = " << std::endl << state_error << std::endl;
+        t_along_trajectory = 0;
+    }
 
-        Eigen::VectorXd additional_control_action = gain_matrix * state_error;
+    Vector12d state_minus_init = GetStateMinusInit(msg);
 
-        //std:: << "additional control action = " << std::endl << additional_control_action << std::endl;
 
-//std:: << "t = " << t_along_trajectory << std::endl;
-//std:: << "gain" << std::endl << gain_matrix << std::endl << "state_error" << std::endl << state_error << std::endl << "additional" << std::endl << additional_control_action << std::endl;
+    // unwrap angles
+    state_minus_init(3) = AngleUnwrap(state_minus_init(3), last_state_(3));
+    state_minus_init(4) = AngleUnwrap(state_minus_init(4), last_state_(4));
+    state_minus_init(5) = AngleUnwrap(state_minus_init(5), last_state_(5));
 
-        Eigen::VectorXd command_in_rad = current_trajectory_->GetUCommand(t_along_trajectory) + additional_control_action;
+    last_state_ = state_minus_init;
 
-//std:: << "command_in_rad" << std::endl << command_in_rad << std::endl;
+    // everything at this time in one lookup
+    const TrajectorySample *sample;
 
-        return converter_->RadiansToServoCommands(command_in_rad);
+    if (interpolate_) {
+        trajectory->Interpolate(t_along_trajectory, &interpolated_sample_);
+        sample = &interpolated_sample_;
     } else {
-        // we are past the max time, return stabilizing controller
-        SetTrajectory(*stable_controller_);
-        return GetControl(msg);
+        sample = &trajectory->At(trajectory->GetIndexAtTime(t_along_trajectory));
+    }
 
-        //return converter_->GetTrimCommands();
+    Vector12d state_error = state_minus_init - sample->x;
 
-    }
+    //std:: << "state error = " << std::endl << state_error << std::endl;
+
+    Eigen::Vector3d command_in_rad = sample->u + sample->k * state_error;
+
+//std:: << "t = " << t_along_trajectory << std::endl;
+//std:: << "gain" << std::endl << sample->k << std::endl << "state_error" << std::endl << state_error << std::endl;
+//std:: << "command_in_rad" << std::endl << command_in_rad << std::endl;
+
+    return converter_->RadiansToServoCommands(command_in_rad);
 }
 
 void TvlqrControl::InitializeState(const mav_pose_t *msg) {
 
-    initial_state_ = PoseMsgToStateEstimatorVector(msg);
+    initial_state_ = PoseMsgToStateEstimatorVector12d(msg);
     last_state_ = initial_state_;
 
     // get the yaw from the initial state
@@ -104,33 +118,32 @@ void TvlqrControl::InitializeState(const mav_pose_t *msg) {
 
     Mz_ = rotz(-rpy[2]);
 
-    t0_ = GetTimestampNow();
+    // the monotonic clock, so the wall clock being set mid-trajectory
+    // doesn't jump t
+    t0_ = GetMonotonicNow();
 
     state_initialized_ = true;
 
 }
 
-Eigen::VectorXd TvlqrControl::GetStateMinusInit(const mav_pose_t *msg) {
+Vector12d TvlqrControl::GetStateMinusInit(const mav_pose_t *msg) {
 
     // subtract out x0, y0, z0
 
-    mav_pose_t *msg2 = mav_pose_t_copy(msg);
-
-    msg2->pos[0] -= initial_state_(0); // x
-    msg2->pos[1] -= initial_state_(1); // y
-    msg2->pos[2] -= initial_state_(2); // z
-
-    Eigen::VectorXd state = PoseMsgToStateEstimatorVector(msg2, Mz_);
+    // all fixed-size fields, so a copy on the stack will do
+    mav_pose_t msg2 = *msg;
 
-    mav_pose_t_destroy(msg2);
+    msg2.pos[0] -= initial_state_(0); // x
+    msg2.pos[1] -= initial_state_(1); // y
+    msg2.pos[2] -= initial_state_(2); // z
 
-    return state;
+    return PoseMsgToStateEstimatorVector12d(&msg2, Mz_);
 
 }
 
 double TvlqrControl::GetTNow() const {
 
-    int64_t delta_t = GetTimestampNow() - t0_;
+    int64_t delta_t = GetMonotonicNow() - t0_;
 
     // convert to seconds
     return double(delta_t) / 1000000.0;
@@ -13,6 +13,7 @@
 #include <fstream>
 #include <vector>
 #include <sstream>
+#include <atomic>
 
 #include <bot_core/rotations.h>
 #include <bot_frames/bot_frames.h>
@@ -27,37 +28,56 @@
 #include "../../utils/ServoConverter/ServoConverter.hpp"
 
 
+static_assert(TRAJECTORY_DIMENSION == 12 && TRAJECTORY_U_DIMENSION == 3, "TvlqrControl expects 12 states and 3 inputs");
+
 class TvlqrControl
 {
 
     public:
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
         TvlqrControl(const ServoConverter *converter, const Trajectory &stable_controller);
 
         void SetTrajectory(const Trajectory &trajectory);
 
-        bool HasTrajectory() const { return current_trajectory_ != nullptr; }
+        // safe to call from another thread than GetControl()'s
+        bool HasTrajectory() const { return current_trajectory_.load() != nullptr; }
 
-        Eigen::VectorXi GetControl(const mav_pose_t *msg);
+        Eigen::Vector3i GetControl(const mav_pose_t *msg);
 
         void SetStateEstimatorInitialized();
 
-        bool IsTimeInvariant() const { return HasTrajectory() && current_trajectory_->IsTimeInvariant(); }
+        // interpolate between the trajectory's samples instead of using the
+        // nearest one (Trajectory::Interpolate())
+        void SetInterpolate(bool interpolate) { interpolate_ = interpolate; }
+
+        bool IsTimeInvariant() const {
+            const Trajectory *trajectory = current_trajectory_.load();
+            return trajectory != nullptr && trajectory->IsTimeInvariant();
+        }
 
     private:
 
         void InitializeState(const mav_pose_t *msg);
         double GetTNow() const;
-        Eigen::VectorXd GetStateMinusInit(const mav_pose_t *msg);
+        Vector12d GetStateMinusInit(const mav_pose_t *msg);
 
-        const Trajectory *current_trajectory_;
+        // atomic so the LCM thread can check it while a real-time thread
+        // runs the control (see tvlqr-controller.cpp)
+        std::atomic<const Trajectory*> current_trajectory_;
         const Trajectory *stable_controller_;
 
-        Eigen::VectorXd initial_state_;
-        Eigen::VectorXd last_state_; // keep so we can do angle unwrapping
+        // fixed-size (like the trajectories' samples) so a control tick
+        // doesn't allocate
+        Vector12d initial_state_;
+        Vector12d last_state_; // keep so we can do angle unwrapping
         Eigen::Matrix3d Mz_; // rotation matrix that transforms global state into local state by removing yaw
 
         bool state_initialized_;
 
+        bool interpolate_;
+        TrajectorySample interpolated_sample_;
+
         const ServoConverter *converter_;
 
         int64_t t0_;
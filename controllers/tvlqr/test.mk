@@ -1,6 +1,6 @@
 TARGET = test
 
-SOURCES = tvlqr-controller.cpp tests.cpp TvlqrControl.cpp ../TrajectoryLibrary/TrajectoryLibrary.cpp ../TrajectoryLibrary/Trajectory.cpp ../../externals/csvparser/csvparser.c ../../utils/utils/RealtimeUtils.cpp  ../../utils/ServoConverter/ServoConverter.cpp ../../estimators/StereoOctomap/StereoOctomap.cpp ../../estimators/StereoFilter/StereoFilter.cpp
+SOURCES = tvlqr-controller.cpp tests.cpp TvlqrControl.cpp ../TrajectoryLibrary/TrajectoryLibrary.cpp ../TrajectoryLibrary/Trajectory.cpp ../../utils/CsvReader/CsvReader.cpp ../../utils/utils/RealtimeUtils.cpp  ../../utils/ServoConverter/ServoConverter.cpp ../../estimators/StereoOctomap/StereoOctomap.cpp ../../estimators/StereoFilter/StereoFilter.cpp ../../utils/ThreadPool/ThreadPool.cpp
 
 
 include ../../utils/make/flight.mk
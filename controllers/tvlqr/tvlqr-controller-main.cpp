@@ -28,6 +28,7 @@ extern string deltawing_u_channel;
 extern string pronto_init_channel;
 extern string pronto_reset_complete_channel;
 extern string tvlqr_action_out_channel;
+extern string control_latency_channel;
 
 extern double sigma0_vb;
 
@@ -37,12 +38,23 @@ extern double sigma0_delta_z;
 extern double sigma0_chi_xy;
 extern double sigma0_chi_z;
 
+extern bool realtime;
+extern int realtime_priority;
+extern int realtime_cpu;
+extern pthread_t control_thread;
+extern DeadlineMonitor deadline_monitor;
+extern bool latency_compensation;
+extern int64_t actuation_delay_usec;
+extern int64_t max_prediction_usec;
+
 int main(int argc,char** argv) {
 
     bool ttl_one = false;
     string pose_channel = "STATE_ESTIMATOR_POSE";
     string tvlqr_action_channel = "tvlqr-action";
     string pronto_state_channel = "STATE_ESTIMATOR_STATE";
+    string trace_request_channel = "trace_request";
+    string trace_dir = "/tmp";
 
 
     ConciseArgs parser(argc, argv);
@@ -54,21 +66,33 @@ int main(int argc,char** argv) {
     parser.add(pronto_init_channel, "i", "pronto-init-channel", "LCM channel to send pronto re-init messages on.");
     parser.add(pronto_state_channel, "s", "pronto-state-channel", "LCM channel that pronto publishes its state on.");
     parser.add(pronto_reset_complete_channel, "c", "pronto-reset-complete-channel", "LCM channel to listen for pronto's reset complete messages.");
+    parser.add(control_latency_channel, "l", "latency-channel", "LCM channel to send control latency traces on (none if not given).");
+    parser.add(trace_request_channel, "T", "trace-request-channel", "LCM channel to listen for trace requests on (empty to only dump traces on SIGUSR2).");
+    parser.add(trace_dir, "d", "trace-dir", "Directory to write traces to.");
     parser.parse();
 
+    // before any threads start, so they leave SIGUSR2 to the trace thread
+    TraceDumpOnSignal(SIGUSR2, trace_dir, "tvlqr-controller");
+
+    std::string lcm_url;
+
     if (ttl_one) {
-        lcm = lcm_create ("udpm://239.255.76.67:7667?ttl=1");
+        lcm_url = "udpm://239.255.76.67:7667?ttl=1";
     } else {
-        lcm = lcm_create ("udpm://239.255.76.67:7667?ttl=0");
+        lcm_url = "udpm://239.255.76.67:7667?ttl=0";
     }
 
+    lcm = lcm_create (lcm_url.c_str());
+
     if (!lcm)
     {
         fprintf(stderr, "lcm_create for recieve failed.  Quitting.\n");
         return 1;
     }
 
-    BotParam *param = bot_param_new_from_server(lcm, 0);
+    // from the last snapshot if there is one, so a restart doesn't wait
+    // for the param server
+    BotParam *param = NewParamWithSnapshot(lcm, lcm_url);
 
     if (param == NULL) {
         fprintf(stderr, "Error: no param server.  Quitting.\n");
@@ -90,6 +114,39 @@ int main(int argc,char** argv) {
 
     double ground_safety_distance = bot_param_get_double_or_fail(param, "tvlqr_controller.ground_safety_distance");
 
+    // optional real-time mode
+    int realtime_int;
+
+    if (bot_param_get_boolean(param, "tvlqr_controller.realtime", &realtime_int) == 0) {
+        realtime = realtime_int == 1;
+    }
+
+    bot_param_get_int(param, "tvlqr_controller.realtime_priority", &realtime_priority);
+    bot_param_get_int(param, "tvlqr_controller.realtime_cpu", &realtime_cpu);
+
+    int deadline_usec;
+
+    if (bot_param_get_int(param, "tvlqr_controller.control_deadline_usec", &deadline_usec) == 0) {
+        deadline_monitor.SetDeadline(deadline_usec);
+    }
+
+    // optionally move poses ahead to when their commands take effect
+    int latency_compensation_int;
+
+    if (bot_param_get_boolean(param, "tvlqr_controller.latency_compensation", &latency_compensation_int) == 0) {
+        latency_compensation = latency_compensation_int == 1;
+    }
+
+    int delay_usec;
+
+    if (bot_param_get_int(param, "tvlqr_controller.actuation_delay_usec", &delay_usec) == 0) {
+        actuation_delay_usec = delay_usec;
+    }
+
+    if (bot_param_get_int(param, "tvlqr_controller.max_prediction_usec", &delay_usec) == 0) {
+        max_prediction_usec = delay_usec;
+    }
+
     stable_controller = bot_param_get_int_or_fail(param, "tvlqr_controller.stable_controller");
     int start_controller = bot_param_get_int_or_fail(param, "tvlqr_controller.climb_no_throttle_controller");
 
@@ -98,6 +155,17 @@ int main(int argc,char** argv) {
 
     trajlib.SetGroundSafetyDistance(ground_safety_distance);
 
+    // optionally load each trajectory's gains when it's first run
+    int lazy_load_library, prefetch_library;
+
+    if (bot_param_get_boolean(param, "tvlqr_controller.lazy_load_library", &lazy_load_library) == 0) {
+        trajlib.SetLazyLoading(lazy_load_library == 1);
+    }
+
+    if (bot_param_get_boolean(param, "tvlqr_controller.prefetch_library", &prefetch_library) == 0) {
+        trajlib.SetBackgroundPrefetch(prefetch_library == 1);
+    }
+
     if (trajectory_dir != "") {
         // load a trajectory library
         if (!trajlib.LoadLibrary(trajectory_dir)) {
@@ -114,6 +182,12 @@ int main(int argc,char** argv) {
 
     control = new TvlqrControl(converter, *stable_controller_traj);
 
+    int interpolate;
+
+    if (bot_param_get_boolean(param, "tvlqr_controller.interpolate_trajectories", &interpolate) == 0) {
+        control->SetInterpolate(interpolate == 1);
+    }
+
 
 
     mav_pose_t_sub = mav_pose_t_subscribe(lcm, pose_channel.c_str(), &mav_pose_t_handler, NULL);
@@ -124,13 +198,34 @@ int main(int argc,char** argv) {
 
     tvlqr_controller_action_sub = lcmt_tvlqr_controller_action_subscribe(lcm, tvlqr_action_channel.c_str(), &lcmt_tvlqr_controller_action_handler, NULL);
 
+    if (trace_request_channel.length() > 0) {
+        lcmt_trace_request_subscribe(lcm, trace_request_channel.c_str(), &trace_request_handler, NULL);
+    }
+
     // control-c handler
     signal(SIGINT,sighandler);
 
     control->SetTrajectory(*start_controller_traj);
 
+    if (realtime) {
+        // before the control thread starts, so its stack is locked too
+        LockMemory();
+
+        pthread_create(&control_thread, NULL, ControlThread, NULL);
+
+        printf("Real-time control: SCHED_FIFO priority %d, CPU %d\n", realtime_priority, realtime_cpu);
+    }
+
+    if (latency_compensation) {
+        printf("Latency compensation: poses moved ahead by their age (up to %lld us) plus %lld us\n",
+            (long long)max_prediction_usec, (long long)actuation_delay_usec);
+    }
+
     printf("Receiving LCM:\n\tState estimate: %s\n\tTVLQR action: %s\nSending LCM:\n\t%s\n", pose_channel.c_str(), tvlqr_action_channel.c_str(), deltawing_u_channel.c_str());
 
+    // trajectories are loaded
+    PublishProcessReady(lcm);
+
     while (true)
     {
         // read the LCM channel
@@ -26,11 +26,18 @@ string pronto_init_channel = "MAV_STATE_EST_INITIALIZER";
 string pronto_reset_complete_channel = "MAV_STATE_EST_INIT_COMPLETE";
 string tvlqr_action_out_channel = "tvlqr-action-out";
 
+// where to send an lcmt_control_latency with each control action, or empty
+// for none
+string control_latency_channel = "";
+
 int stable_controller;
 
 bool state_estimator_init = true;
 
-mav_pose_t *last_pose_msg;
+// kept by value (all of its fields are fixed-size) so each pose isn't
+// copied onto the heap
+mav_pose_t last_pose_msg;
+bool have_last_pose = false;
 
 mav_filter_state_t *last_filter_state = NULL;
 
@@ -44,6 +51,34 @@ double sigma0_chi_z;
 
 int64_t last_ti_state_estimator_reset = 0;
 
+// real-time mode (tvlqr_controller.realtime): the pose handler hands each
+// pose to a SCHED_FIFO control thread through the mailbox, and trajectory
+// changes go through pending_trajectory so only that thread changes control
+bool realtime = false;
+int realtime_priority = 80;
+int realtime_cpu = -1;
+
+LatestValueMailbox<TimedPose> pose_mailbox;
+std::atomic<const Trajectory*> pending_trajectory(nullptr);
+pthread_t control_thread;
+
+// pose-to-servo latency against tvlqr_controller.control_deadline_usec
+DeadlineMonitor deadline_monitor;
+int64_t last_deadline_report = 0;
+
+// latency compensation (tvlqr_controller.latency_compensation): each pose is
+// moved ahead by how old it is when the control runs (measured per pose, from
+// the IMU utime pronto stamps it with) plus the servo link's delay, which
+// can't be measured here.  Poses older than max_prediction_usec are only
+// moved ahead that far.
+bool latency_compensation = false;
+int64_t actuation_delay_usec = 0;
+int64_t max_prediction_usec = 50000;
+
+// how far poses have been moved ahead, for the latency report
+std::atomic<int64_t> prediction_total_usec(0);
+std::atomic<int64_t> num_predictions(0);
+
 
 void pronto_reset_complete_handler(const lcm_recv_buf_t *rbuf, const char* channel, const pronto_utime_t *msg, void *user) {
 
@@ -65,8 +100,17 @@ void mav_filter_state_t_handler(const lcm_recv_buf_t *rbuf, const char* channel,
 
 }
 
+void trace_request_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_trace_request *msg, void *user) {
+    TraceHandleRequest(msg->process_name, msg->dir);
+}
+
 void mav_pose_t_handler(const lcm_recv_buf_t *rbuf, const char* channel, const mav_pose_t *msg, void *user) {
 
+    int64_t arrival_utime = GetTimestampNow();
+
+    // LCM's is from when the packet came in, before it waited for us
+    int64_t receive_utime = rbuf->recv_utime > 0 ? rbuf->recv_utime : arrival_utime;
+
     if (!control->HasTrajectory()) {
 
         return;
@@ -77,10 +121,8 @@ void mav_pose_t_handler(const lcm_recv_buf_t *rbuf, const char* channel, const m
         return;
     }
 
-    if (last_pose_msg != NULL) {
-        mav_pose_t_destroy(last_pose_msg);
-    }
-    last_pose_msg = mav_pose_t_copy(msg);
+    last_pose_msg = *msg;
+    have_last_pose = true;
 
     // whenever we get a state estimate, we want to output a new control action
 
@@ -92,7 +134,50 @@ void mav_pose_t_handler(const lcm_recv_buf_t *rbuf, const char* channel, const m
         SendStateEstimatorResetRequest();
     }
 
-    Eigen::VectorXi control_vec = control->GetControl(msg);
+    if (deadline_monitor.GetDeadline() > 0 && arrival_utime - last_deadline_report > TVLQR_DEADLINE_REPORT_EVERY) {
+        ReportDeadlineMisses();
+        last_deadline_report = arrival_utime;
+    }
+
+    if (realtime) {
+        TimedPose pose;
+
+        pose.msg = *msg;
+        pose.receive_utime = receive_utime;
+        pose.arrival_utime = arrival_utime;
+
+        pose_mailbox.Put(pose);
+        return;
+    }
+
+    SendControl(msg, receive_utime, arrival_utime);
+}
+
+/**
+ * Computes the control action for a pose and sends it out.
+ *
+ * @param msg pose
+ * @param receive_utime when LCM received the pose, for the latency trace
+ * @param arrival_utime when the pose arrived, for the deadline monitor
+ */
+void SendControl(const mav_pose_t *msg, int64_t receive_utime, int64_t arrival_utime) {
+
+    Eigen::Vector3i control_vec;
+
+    if (latency_compensation) {
+        int64_t pose_age = std::min(std::max(GetTimestampNow() - msg->utime, (int64_t)0), max_prediction_usec);
+        int64_t horizon = pose_age + actuation_delay_usec;
+
+        mav_pose_t predicted;
+        PredictPose(msg, horizon / 1000000.0, &predicted);
+
+        control_vec = control->GetControl(&predicted);
+
+        prediction_total_usec += horizon;
+        num_predictions++;
+    } else {
+        control_vec = control->GetControl(msg);
+    }
 
     // send control out through LCM
 
@@ -109,6 +194,61 @@ void mav_pose_t_handler(const lcm_recv_buf_t *rbuf, const char* channel, const m
 
     lcmt_deltawing_u_publish(lcm, deltawing_u_channel.c_str(), &u_msg);
 
+    deadline_monitor.Add(GetTimestampNow() - arrival_utime);
+
+    if (!control_latency_channel.empty()) {
+        lcmt_control_latency latency_msg;
+
+        latency_msg.timestamp = u_msg.timestamp;
+        latency_msg.pose_utime = msg->utime;
+        latency_msg.pose_receive_utime = receive_utime;
+        latency_msg.pose_handled_utime = arrival_utime;
+
+        lcmt_control_latency_publish(lcm, control_latency_channel.c_str(), &latency_msg);
+    }
+}
+
+/**
+ * Runs the control in real-time mode: sleeps until the pose handler puts a
+ * pose in the mailbox, switches trajectories if asked to, and sends the
+ * control action for the newest pose.
+ */
+void* ControlThread(void *x) {
+
+    MakeThreadRealtime(realtime_priority, realtime_cpu);
+
+    TimedPose pose;
+
+    while (true) {
+        if (pose_mailbox.Wait(&pose) == false) {
+            continue;
+        }
+
+        const Trajectory *traj = pending_trajectory.exchange(nullptr);
+
+        if (traj != nullptr) {
+            control->SetTrajectory(*traj);
+        }
+
+        SendControl(&pose.msg, pose.receive_utime, pose.arrival_utime);
+    }
+
+    return NULL;
+}
+
+void ReportDeadlineMisses() {
+
+    int64_t num_samples = deadline_monitor.GetNumSamples();
+    int64_t num_misses = deadline_monitor.GetNumMisses();
+
+    printf("Control latency: %lld of %lld over the %lld us deadline (%.2f%%), worst %lld us\n",
+        (long long)num_misses, (long long)num_samples, (long long)deadline_monitor.GetDeadline(),
+        num_samples > 0 ? 100.0 * num_misses / num_samples : 0.0, (long long)deadline_monitor.GetWorstLatency());
+
+    if (latency_compensation && num_predictions > 0) {
+        printf("Latency compensation: poses moved ahead %lld us on average\n",
+            (long long)(prediction_total_usec / num_predictions));
+    }
 }
 
 void lcmt_tvlqr_controller_action_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_tvlqr_controller_action *msg, void *user) {
@@ -127,7 +267,12 @@ void lcmt_tvlqr_controller_action_handler(const lcm_recv_buf_t *rbuf, const char
     msg_out.trajectory_number = lib_num;
     lcmt_tvlqr_controller_action_publish(lcm, tvlqr_action_out_channel.c_str(), &msg_out);
 
-    control->SetTrajectory(*traj);
+    if (realtime) {
+        // the control thread switches on its next pose
+        pending_trajectory.store(traj);
+    } else {
+        control->SetTrajectory(*traj);
+    }
 
 
     std::cout << "Starting trajectory " << lib_num << std::endl;
@@ -191,11 +336,11 @@ void SendStateEstimatorDefaultResetRequest() {
     msg.utime = GetTimestampNow();
 
     // copy in the states from the last position, but reset the covariance
-    if (last_pose_msg != NULL) {
-        msg.quat[0] = last_pose_msg->orientation[0];
-        msg.quat[1] = last_pose_msg->orientation[1];
-        msg.quat[2] = last_pose_msg->orientation[2];
-        msg.quat[3] = last_pose_msg->orientation[3];
+    if (have_last_pose) {
+        msg.quat[0] = last_pose_msg.orientation[0];
+        msg.quat[1] = last_pose_msg.orientation[1];
+        msg.quat[2] = last_pose_msg.orientation[2];
+        msg.quat[3] = last_pose_msg.orientation[3];
     } else {
         msg.quat[0] = 1;
         msg.quat[1] = 0;
@@ -208,14 +353,14 @@ void SendStateEstimatorDefaultResetRequest() {
 
     double states[msg.num_states];
 
-    if (last_pose_msg != NULL) {
-        states[0] = last_pose_msg->rotation_rate[0];
-        states[1] = last_pose_msg->rotation_rate[1];
-        states[2] = last_pose_msg->rotation_rate[2];
+    if (have_last_pose) {
+        states[0] = last_pose_msg.rotation_rate[0];
+        states[1] = last_pose_msg.rotation_rate[1];
+        states[2] = last_pose_msg.rotation_rate[2];
 
-        states[3] = last_pose_msg->vel[0];
-        states[4] = last_pose_msg->vel[1];
-        states[5] = last_pose_msg->vel[2];
+        states[3] = last_pose_msg.vel[0];
+        states[4] = last_pose_msg.vel[1];
+        states[5] = last_pose_msg.vel[2];
 
     } else {
         states[0] = 0;
@@ -231,15 +376,15 @@ void SendStateEstimatorDefaultResetRequest() {
     states[7] = 0;
     states[8] = 0;
 
-    if (last_pose_msg != NULL) {
+    if (have_last_pose) {
 
-        states[9] = last_pose_msg->pos[0];
-        states[10] = last_pose_msg->pos[1];
-        states[11] = last_pose_msg->pos[2];
+        states[9] = last_pose_msg.pos[0];
+        states[10] = last_pose_msg.pos[1];
+        states[11] = last_pose_msg.pos[2];
 
-        states[12] = last_pose_msg->accel[0];
-        states[13] = last_pose_msg->accel[1];
-        states[14] = last_pose_msg->accel[2];
+        states[12] = last_pose_msg.accel[0];
+        states[13] = last_pose_msg.accel[1];
+        states[14] = last_pose_msg.accel[2];
 
     } else {
         states[9] = 0;
@@ -289,6 +434,10 @@ void SendStateEstimatorDefaultResetRequest() {
 
 void sighandler(int dum)
 {
+    if (deadline_monitor.GetDeadline() > 0) {
+        ReportDeadlineMisses();
+    }
+
     printf("\n\nclosing... ");
 
     mav_pose_t_unsubscribe(lcm, mav_pose_t_sub);
@@ -301,7 +450,8 @@ void sighandler(int dum)
         delete converter;
     }
 
-    if (control != NULL) {
+    // the control thread might still be using it, and exit() cleans up anyway
+    if (control != NULL && realtime == false) {
         delete control;
     }
 
@@ -1,20 +1,38 @@
 #ifndef TVLQR_CONTROLLER_HPP
 #define TVLQR_CONTROLLER_HPP
 
+#include <algorithm>
+
 #include "../../LCM/mav_pose_t.h"
 #include "../../LCM/lcmt_tvlqr_controller_action.h"
 #include "../../LCM/lcmt_deltawing_u.h"
+#include "../../LCM/lcmt_control_latency.h"
+#include "../../LCM/lcmt_trace_request.h"
 
 #include "../TrajectoryLibrary/TrajectoryLibrary.hpp"
 
 #include "TvlqrControl.hpp"
 
 #include "../../utils/utils/RealtimeUtils.hpp"
+#include "../../utils/utils/Trace.hpp"
 #include <bot_param/param_client.h>
 
 #include "lcmtypes/pronto_utime_t.h"
 #include "lcmtypes/mav_filter_state_t.h"
 
+// how often (in usec) to print how many control ticks missed the deadline
+#define TVLQR_DEADLINE_REPORT_EVERY 10000000
+
+/**
+ * A pose on its way to the control thread, with when LCM received it and
+ * when the handler got it.
+ */
+struct TimedPose {
+    mav_pose_t msg;
+    int64_t receive_utime;
+    int64_t arrival_utime;
+};
+
 void sighandler(int dum);
 
 void mav_pose_t_handler(const lcm_recv_buf_t *rbuf, const char* channel, const mav_pose_t *msg, void *user);
@@ -25,10 +43,18 @@ void pronto_reset_complete_handler(const lcm_recv_buf_t *rbuf, const char* chann
 
 void mav_filter_state_t_handler(const lcm_recv_buf_t *rbuf, const char* channel, const mav_filter_state_t *msg, void *user);
 
+void trace_request_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_trace_request *msg, void *user);
+
 int ServoToTrajectorySwitchPosition(int servo_value);
 
 void SendStateEstimatorResetRequest();
 
 void SendStateEstimatorDefaultResetRequest();
 
+void SendControl(const mav_pose_t *msg, int64_t receive_utime, int64_t arrival_utime);
+
+void* ControlThread(void *x);
+
+void ReportDeadlineMisses();
+
 #endif
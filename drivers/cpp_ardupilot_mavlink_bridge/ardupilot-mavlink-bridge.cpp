@@ -19,6 +19,16 @@ double elev_origin;
 
 int global_beep = 0;
 
+// servo commands go through the mailbox to their own thread, which sends
+// the newest one no more often than the link can carry them, so a burst
+// of commands can't queue up behind each other on the way to the APM
+LatestValueMailbox<ServoCommand> servo_mailbox;
+pthread_t servo_sender_thread;
+int64_t servo_period_usec = 0;
+
+int64_t num_servo_commands = 0;
+std::atomic<int64_t> num_servo_sent(0);
+
 std::string mavlink_channel = "MAVLINK";
 std::string attitude_channel = "attitude";
 std::string airspeed_channel = "airspeed-unchecked";
@@ -47,10 +57,55 @@ double altimeter_r, airspeed_r, sideslip_r;
 
 uint8_t systemID = getSystemID();
 
+// handlers for each MAVLink message id (NULL for ones we don't know)
+MavlinkMessageHandler mavlink_handlers[MAVLINK_MAX_MESSAGE_ID];
+
+int64_t unknown_message_counts[MAVLINK_MAX_MESSAGE_ID];
+int64_t num_heartbeats = 0;
+
+// stream requests (mavlink_bridge.request_streams): the rate (Hz) to ask
+// for each MAV_DATA_STREAM, 0 for off
+bool request_streams = false;
+int stream_rates[MAV_DATA_STREAM_ENUM_END];
+
+// the APM, from its heartbeats
+uint8_t apm_system_id = 0;
+uint8_t apm_component_id = 0;
+
+int64_t last_heartbeat_utime = 0;
+int64_t last_stream_request_utime = 0;
+uint64_t last_imu_device_time = 0;
+int64_t num_stream_requests = 0;
+
+// outgoing messages, filled in again for each incoming one so the parts
+// that don't change are only set once
+mav_ins_t ins_msg;
+mav_gps_data_t gps_msg;
+lcmt_battery_status battery_msg;
+lcmt_deltawing_u servo_out_msg;
+
+mav_indexed_measurement_t altimeter_msg, airspeed_msg, sideslip_msg;
+int altimeter_z_ind[1], airspeed_z_ind[1], sideslip_z_ind[1];
+double altimeter_value[1], airspeed_value[1], sideslip_value[1];
+double altimeter_cov[1], airspeed_cov[1], sideslip_cov[1];
+
 void sighandler(int dum)
 {
     printf("\nClosing... ");
 
+    printf("\n\theartbeats: %ld\n", (long)num_heartbeats);
+    printf("\tservo commands: %ld, sent: %ld\n", (long)num_servo_commands, (long)num_servo_sent.load());
+
+    if (request_streams) {
+        printf("\tstream requests: %ld\n", (long)num_stream_requests);
+    }
+
+    for (int i = 0; i < MAVLINK_MAX_MESSAGE_ID; i++) {
+        if (unknown_message_counts[i] > 0) {
+            printf("\tunknown message id %d: %ld\n", i, (long)unknown_message_counts[i]);
+        }
+    }
+
     mavlink_msg_container_t_unsubscribe(lcm_, mavlink_sub);
     lcmt_deltawing_u_unsubscribe(lcm_, deltawing_u_sub);
     lcmt_beep_unsubscribe(lcm_, beep_sub);
@@ -61,13 +116,6 @@ void sighandler(int dum)
     exit(0);
 }
 
-int64_t getTimestampNow()
-{
-    struct timeval thisTime;
-    gettimeofday(&thisTime, NULL);
-    return (thisTime.tv_sec * 1000000.0) + (float)thisTime.tv_usec + 0.5;
-}
-
 void beep_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_beep *msg, void *user)
 {
     global_beep = msg->beep;
@@ -76,403 +124,449 @@ void beep_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_be
 void deltawing_u_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_deltawing_u *msg, void *user)
 {
     // translate a local LCM message for servos into a message for the airplane over
-    // mavlink
+    // mavlink (on the sender thread)
 
-    mavlink_message_t mavmsg;
+    ServoCommand command;
 
-    int beep;
-    if (global_beep > 0) {
-        beep = 1999;
-    } else {
-        beep = 1000;
-    }
-
-    mavlink_msg_rc_channels_override_pack(systemID, 200, &mavmsg, 1, 200, msg->elevonL, msg->elevonR, msg->throttle, 1000, 1000, 1000, 1000, beep);
-    // Publish the message on the LCM IPC bus
-    sendMAVLinkMessage(lcm_, &mavmsg);
+    command.msg = *msg;
+    command.beep = global_beep;
 
+    servo_mailbox.Put(command);
+    num_servo_commands ++;
 }
 
-void mavlink_handler(const lcm_recv_buf_t *rbuf, const char* channel, const mavlink_msg_container_t *msg, void *user)
+/**
+ * Sends servo commands as they come in, but waits out servo_period_usec
+ * after each so the serial link never has more than one queued.  Whatever
+ * came in while it waited replaces the command it woke up for.
+ */
+void* ServoSenderThread(void *x)
 {
-    // load MAVLINK LCM message
-
-    // debug -- print message
-    /*
-    lcmt_deltawing_gains msg2 = ConvertFromMidiLcmToPlane(msg);
-
-    struct timeval thisTime;
-    gettimeofday(&thisTime, NULL);
-    msg2.timestamp = (thisTime.tv_sec * 1000.0) + (float)thisTime.tv_usec/1000.0 + 0.5;
-
-    lastMsg = msg2;
-
-    // send via LCM
-    lcmt_deltawing_gains_publish (lcmSend, lcm_out, &msg2);
-*/
-    // extract the message out of the container
-    mavlink_message_t mavmsg = msg->msg;
+    ServoCommand command;
+    int64_t last_sent = 0;
 
-    if (mavmsg.sysid == IGNORE_SYS_ID1 || mavmsg.sysid == IGNORE_SYS_ID2) {
-        // this is from a system we are ignoring
-        return;
-    }
-
-    Eigen::Vector3i state_estimator_index;
-    int stabilization_mode;
-
-    switch(mavmsg.msgid)
-    {
-        // process messages here
-        case MAVLINK_MSG_ID_HEARTBEAT:
-            std::cout << "got a heartbeat" << std::endl;
-            break;
-        case MAVLINK_MSG_ID_RAW_IMU:
-            mavlink_raw_imu_t rawImu;
-            mavlink_msg_raw_imu_decode(&mavmsg, &rawImu);
-
-            // convert to LCM type
-            mav_ins_t insMsg;
-            insMsg.utime = getTimestampNow();
-            insMsg.device_time = rawImu.time_usec;
-
-            insMsg.gyro[0] = (double)rawImu.xgyro/1000;
-            insMsg.gyro[1] = (double)rawImu.ygyro/1000;
-            insMsg.gyro[2] = (double)rawImu.zgyro/1000;
-
-            insMsg.accel[0] = (double)rawImu.xacc/1000*GRAVITY_MSS;
-            insMsg.accel[1] = (double)rawImu.yacc/1000*GRAVITY_MSS;
-            insMsg.accel[2] = (double)rawImu.zacc/1000*GRAVITY_MSS;
-
-            insMsg.mag[0] = rawImu.xmag;
-            insMsg.mag[1] = rawImu.ymag;
-            insMsg.mag[2] = rawImu.zmag;
-
-            insMsg.quat[0] = 0; // unused
-            insMsg.quat[1] = 0; // unused
-            insMsg.quat[2] = 0; // unused
-            insMsg.quat[3] = 0; // unused
-
-            insMsg.pressure = 0; // set somewhere else
-            insMsg.rel_alt = 0; // set somewhere else
-
-            mav_ins_t_publish(lcm_, attitude_channel.c_str(), &insMsg);
-
-            break;
-        case MAVLINK_MSG_ID_ATTITUDE:
-            mavlink_attitude_t attitude;
-            mavlink_msg_attitude_decode(&mavmsg, &attitude);
-
-            // convert to LCM type
-            lcmt_attitude attitudeMsg;
-            attitudeMsg.timestamp = getTimestampNow();
-
-            attitudeMsg.roll = attitude.roll;
-            attitudeMsg.pitch = attitude.pitch;
-            attitudeMsg.yaw = attitude.yaw;
-
-            attitudeMsg.rollspeed = attitude.rollspeed;
-            attitudeMsg.pitchspeed = attitude.pitchspeed;
-            attitudeMsg.yawspeed = attitude.yawspeed;
-            //DISABLED: USING RAW IMU DATA INSTEAD
-            //lcmt_attitude_publish (lcmAttitude, channelAttitude, &attitudeMsg);
-            break;
-         /*
-        case MAVLINK_MSG_ID_GLOBAL_POSITION_INT:
-            mavlink_global_position_int_t pos;
-            mavlink_msg_global_position_int_decode(&mavmsg, &pos);
-
-            // convert to LCM type
-            lcmt_gps gpsMsg;
-            gpsMsg.timestamp = getTimestampNow();
-
-            gpsMsg.latitude = pos.lat;
-            gpsMsg.longitude = pos.lon;
-            gpsMsg.alt = pos.alt;
-            gpsMsg.relative_alt = pos.relative_alt;
-
-            gpsMsg.vx = pos.vx;
-            gpsMsg.vy = pos.vy;
-            gpsMsg.vz = pos.vz;
-            gpsMsg.hdg = pos.hdg;
-
-            lcmt_gps_publish (lcmGps, channelGps, &gpsMsg);
-
-
-            break;
-           */
-        case MAVLINK_MSG_ID_GPS_RAW_INT:
-            mavlink_gps_raw_int_t pos;
-            mavlink_msg_gps_raw_int_decode(&mavmsg, &pos);
-
-            // convert to LCM type
-            mav_gps_data_t gpsMsg;
-            gpsMsg.utime = getTimestampNow();
-            //gpsMsg.utime = pos.time_usec;
-
-            gpsMsg.gps_lock = pos.fix_type;  //0-1: no fix, 2: 2D fix, 3: 3D fix.
-
-            gpsMsg.latitude = (double)pos.lat/1e7; //Latitude comes in at 1E7 degrees
-            gpsMsg.longitude = (double)pos.lon/1e7; //Latitude comes in at 1E7 degrees
-            gpsMsg.elev = (double)pos.alt/1e3; //Altitude comes in at 1E3 meters (millimeters) above MSL
-
-            gpsMsg.horizontal_accuracy = pos.eph; //GPS HDOP horizontal dilution of position in cm (m*100). If unknown, set to: 65535
-            gpsMsg.vertical_accuracy = pos.epv; //GPS VDOP horizontal dilution of position in cm (m*100). If unknown, set to: 65535
-
-            gpsMsg.speed = (double)pos.vel/100; // GPS ground speed comes in at (m/s * 100). If unknown, set to: 65535
-            gpsMsg.heading = (double)pos.cog/100; //Course over ground (NOT heading, but direction of movement) comes in at degrees * 100, 0.0..359.99 degrees. If unknown, set to: 65535
-            gpsMsg.numSatellites = pos.satellites_visible; //Number of satellites visible. If unknown, set to 255
-
-
-            /**
-            * Get lineared XYZ.
-            * This code from Fixie/drivers/ublox_comm/src/driver/ublox_comm.c
-            *
-            */
-            double latlong[2];
-            latlong[0] = gpsMsg.latitude;
-            latlong[1] = gpsMsg.longitude;
-            double xy[2]; //xy in ENU coordinates
-            //require 3d lock to linearize gps
-            if (gpsMsg.gps_lock == 3 && origin_init == 1)
-            {
-                bot_gps_linearize_to_xy(&gpsLinearize, latlong, xy);
-            }
-            else {
-                xy[0] = xy[1] = 0;
-            }
-
-            double xyz[3];
-            xyz[0] = xy[0];
-            xyz[1] = xy[1];
-            xyz[2] = gpsMsg.elev - elev_origin;
-            memcpy(gpsMsg.xyz_pos, xyz, 3 * sizeof(double));
+    while (true) {
+        if (servo_mailbox.Wait(&command) == false) {
+            continue;
+        }
 
-            mav_gps_data_t_publish (lcm_, gps_channel.c_str(), &gpsMsg);
+        int64_t wait = last_sent + servo_period_usec - GetRawMonotonicNow();
 
-            break;
+        if (wait > 0) {
+            usleep(wait);
 
-        case MAVLINK_MSG_ID_SCALED_PRESSURE: // hacked this message to give what I want on the firmware side
-            mavlink_scaled_pressure_t pressure;
-            mavlink_msg_scaled_pressure_decode(&mavmsg, &pressure);
+            // a newer one, if there is one
+            servo_mailbox.Take(&command);
+        }
 
-            // convert to LCM type
-            mav_indexed_measurement_t altimeter_msg;
-            mav_indexed_measurement_t airspeed_msg;
-            mav_indexed_measurement_t sideslip_msg;
+        SendServoCommand(command);
 
-            int64_t msg_timestamp;
-            msg_timestamp = getTimestampNow();
+        last_sent = GetRawMonotonicNow();
+        num_servo_sent ++;
+    }
 
+    return NULL;
+}
 
-            // altimeter
-            altimeter_msg.utime = msg_timestamp;
-            altimeter_msg.state_utime = msg_timestamp;
+void SendServoCommand(const ServoCommand &command)
+{
+    mavlink_message_t mavmsg;
 
-            double altitude;
-            altitude = pressure.press_diff + elev_origin;  // HACK
+    int beep;
+    if (command.beep > 0) {
+        beep = 1999;
+    } else {
+        beep = 1000;
+    }
 
-            altimeter_msg.measured_dim = 1; // altitude only measures 1 dimension (z-axis)
+    mavlink_msg_rc_channels_override_pack(systemID, 200, &mavmsg, 1, 200, command.msg.elevonL, command.msg.elevonR, command.msg.throttle, 1000, 1000, 1000, 1000, beep);
+    // Publish the message on the LCM IPC bus
+    sendMAVLinkMessage(lcm_, &mavmsg);
 
-            int altimeter_z_ind[1];
+}
 
-            state_estimator_index = eigen_utils::RigidBodyState::positionInds();
+/**
+ * Adds a handler for a MAVLink message id, replacing any there was.
+ */
+void AddMavlinkHandler(uint8_t msgid, MavlinkMessageHandler handler)
+{
+    mavlink_handlers[msgid] = handler;
+}
 
-            altimeter_z_ind[0] = state_estimator_index[2]; // measurement on the Z axis (index = 2)
-            altimeter_msg.z_indices = altimeter_z_ind;
+void mavlink_handler(const lcm_recv_buf_t *rbuf, const char* channel, const mavlink_msg_container_t *msg, void *user)
+{
+    // use the message in the container, don't copy it out
+    const mavlink_message_t *mavmsg = &msg->msg;
 
-            double altimeter_value[1];
-            altimeter_value[0] = altitude;
-            altimeter_msg.z_effective = altimeter_value;
+    if (mavmsg->sysid == IGNORE_SYS_ID1 || mavmsg->sysid == IGNORE_SYS_ID2) {
+        // this is from a system we are ignoring
+        return;
+    }
 
+    // stamp with when LCM read the message off the socket rather than when
+    // we got to it, so time it spent queued here shows up as latency
+    // downstream instead of being hidden (LCM leaves it 0 if it can't tell)
+    int64_t recv_utime = rbuf->recv_utime > 0 ? rbuf->recv_utime : GetWallNow();
 
+    MavlinkMessageHandler handler = mavlink_handlers[mavmsg->msgid];
 
-            altimeter_msg.measured_cov_dim = 1;
+    if (handler != NULL) {
+        handler(mavmsg, recv_utime);
+        return;
+    }
 
-            double altimeter_cov[1];
-            altimeter_cov[0] = altimeter_r;
-            altimeter_msg.R_effective = altimeter_cov;
+    // only say so the first time, since it'll keep coming
+    if (unknown_message_counts[mavmsg->msgid] == 0) {
+        std::cout << "unknown message id = " << (int)mavmsg->msgid << " from sysid = " << (float)mavmsg->sysid << std::endl;
+    }
 
-            //altimeter_msg.temperature = pressure.temperature;
+    unknown_message_counts[mavmsg->msgid] ++;
+}
 
+void HandleHeartbeat(const mavlink_message_t *mavmsg, int64_t recv_utime)
+{
+    // counted, not printed: they come every second
+    num_heartbeats ++;
 
+    if (request_streams) {
+        apm_system_id = mavmsg->sysid;
+        apm_component_id = mavmsg->compid;
 
-            airspeed_msg.utime = msg_timestamp;
-            airspeed_msg.state_utime = msg_timestamp;
+        // the first heartbeat, one after a gap (a reboot), or just time to
+        // say it again
+        if (last_stream_request_utime == 0 || recv_utime - last_heartbeat_utime > STREAM_REBOOT_HEARTBEAT_GAP_USEC
+            || recv_utime - last_stream_request_utime > STREAM_REQUEST_PERIOD_USEC) {
 
-            double airspeed;
-            airspeed = pressure.press_abs;  // HACK
+            RequestStreams(apm_system_id, apm_component_id);
+            last_stream_request_utime = recv_utime;
+        }
+    }
 
-            airspeed_msg.measured_dim = 1; // altitude only measures 1 dimension (x-axis)
+    last_heartbeat_utime = recv_utime;
+}
 
-            int airspeed_z_ind[1];
-            state_estimator_index = eigen_utils::RigidBodyState::velocityInds();
-            airspeed_z_ind[0] = state_estimator_index[0]; // measurement on the X axis (index = 0)
-            airspeed_msg.z_indices = airspeed_z_ind;
+void HandleIgnored(const mavlink_message_t *mavmsg, int64_t recv_utime)
+{
+    // RC_CHANNELS_OVERRIDE: we sent this message.  ATTITUDE: using the raw
+    // IMU instead.
+}
 
-            double airspeed_value[1];
-            airspeed_value[0] = airspeed;
-            airspeed_msg.z_effective = airspeed_value;
+void HandleRawImu(const mavlink_message_t *mavmsg, int64_t recv_utime)
+{
+    mavlink_raw_imu_t buffer;
+    const mavlink_raw_imu_t *rawImu = MavlinkView(mavmsg, &buffer);
 
-            airspeed_msg.measured_cov_dim = 1;
+    if (request_streams && rawImu->time_usec < last_imu_device_time && last_stream_request_utime > 0) {
+        // the APM's clock started over, so it rebooted and is back on its
+        // own stream rates
+        std::cout << "APM rebooted, requesting streams again." << std::endl;
 
-            double airspeed_cov[1];
-            airspeed_cov[0] = airspeed_r;
-            airspeed_msg.R_effective = airspeed_cov;
+        RequestStreams(apm_system_id, apm_component_id);
+        last_stream_request_utime = recv_utime;
+    }
 
+    last_imu_device_time = rawImu->time_usec;
 
+    // convert to LCM type (quat, pressure, and rel_alt are set once in
+    // InitMavlinkHandlers())
+    ins_msg.utime = recv_utime;
+    ins_msg.device_time = rawImu->time_usec;
 
+    // x, y and z are next to each other in the payload
+    ScaleInt16(&rawImu->xgyro, 1.0/1000, ins_msg.gyro, 3);
+    ScaleInt16(&rawImu->xacc, 1.0/1000*GRAVITY_MSS, ins_msg.accel, 3);
+    ScaleInt16(&rawImu->xmag, 1.0, ins_msg.mag, 3);
 
+    mav_ins_t_publish(lcm_, attitude_channel.c_str(), &ins_msg);
+}
 
-            sideslip_msg.utime = msg_timestamp;
-            sideslip_msg.state_utime = msg_timestamp;
+void HandleGpsRawInt(const mavlink_message_t *mavmsg, int64_t recv_utime)
+{
+    mavlink_gps_raw_int_t buffer;
+    const mavlink_gps_raw_int_t &pos = *MavlinkView(mavmsg, &buffer);
+
+    // convert to LCM type
+    gps_msg.utime = recv_utime;
+    //gps_msg.utime = pos.time_usec;
+
+    gps_msg.gps_lock = pos.fix_type;  //0-1: no fix, 2: 2D fix, 3: 3D fix.
+
+    gps_msg.latitude = (double)pos.lat/1e7; //Latitude comes in at 1E7 degrees
+    gps_msg.longitude = (double)pos.lon/1e7; //Latitude comes in at 1E7 degrees
+    gps_msg.elev = (double)pos.alt/1e3; //Altitude comes in at 1E3 meters (millimeters) above MSL
+
+    gps_msg.horizontal_accuracy = pos.eph; //GPS HDOP horizontal dilution of position in cm (m*100). If unknown, set to: 65535
+    gps_msg.vertical_accuracy = pos.epv; //GPS VDOP horizontal dilution of position in cm (m*100). If unknown, set to: 65535
+
+    gps_msg.speed = (double)pos.vel/100; // GPS ground speed comes in at (m/s * 100). If unknown, set to: 65535
+    gps_msg.heading = (double)pos.cog/100; //Course over ground (NOT heading, but direction of movement) comes in at degrees * 100, 0.0..359.99 degrees. If unknown, set to: 65535
+    gps_msg.numSatellites = pos.satellites_visible; //Number of satellites visible. If unknown, set to 255
+
+
+    /**
+    * Get lineared XYZ.
+    * This code from Fixie/drivers/ublox_comm/src/driver/ublox_comm.c
+    *
+    */
+    double latlong[2];
+    latlong[0] = gps_msg.latitude;
+    latlong[1] = gps_msg.longitude;
+    double xy[2]; //xy in ENU coordinates
+    //require 3d lock to linearize gps
+    if (gps_msg.gps_lock == 3 && origin_init == 1)
+    {
+        bot_gps_linearize_to_xy(&gpsLinearize, latlong, xy);
+    }
+    else {
+        xy[0] = xy[1] = 0;
+    }
 
-            double sideslip;
-            sideslip = 0;
+    gps_msg.xyz_pos[0] = xy[0];
+    gps_msg.xyz_pos[1] = xy[1];
+    gps_msg.xyz_pos[2] = gps_msg.elev - elev_origin;
 
-            sideslip_msg.measured_dim = 1; // altitude only measures 1 dimension (y-axis)
+    mav_gps_data_t_publish (lcm_, gps_channel.c_str(), &gps_msg);
+}
 
-            int sideslip_z_ind[1];
-            state_estimator_index = eigen_utils::RigidBodyState::velocityInds();
-            sideslip_z_ind[0] = state_estimator_index[1]; // measurement on the Y axis (index = 1)
-            sideslip_msg.z_indices = sideslip_z_ind;
+void HandleScaledPressure(const mavlink_message_t *mavmsg, int64_t recv_utime)
+{
+    // hacked this message to give what I want on the firmware side
+    mavlink_scaled_pressure_t buffer;
+    const mavlink_scaled_pressure_t &pressure = *MavlinkView(mavmsg, &buffer);
 
-            double sideslip_value[1];
-            sideslip_value[0] = sideslip;
-            sideslip_msg.z_effective = sideslip_value;
+    // the indices, dimensions, and covariances are set once in
+    // InitMavlinkHandlers()
+    int64_t msg_timestamp = recv_utime;
 
-            sideslip_msg.measured_cov_dim = 1;
+    // altimeter
+    altimeter_msg.utime = msg_timestamp;
+    altimeter_msg.state_utime = msg_timestamp;
+    altimeter_value[0] = pressure.press_diff + elev_origin;  // HACK
 
-            double sideslip_cov[1];
-            sideslip_cov[0] = sideslip_r;
-            sideslip_msg.R_effective = sideslip_cov;
+    //altimeter_msg.temperature = pressure.temperature;
 
+    airspeed_msg.utime = msg_timestamp;
+    airspeed_msg.state_utime = msg_timestamp;
+    airspeed_value[0] = pressure.press_abs;  // HACK
 
+    sideslip_msg.utime = msg_timestamp;
+    sideslip_msg.state_utime = msg_timestamp;
+    sideslip_value[0] = 0;
 
-            mav_indexed_measurement_t_publish(lcm_, altimeter_channel.c_str(), &altimeter_msg);
-            mav_indexed_measurement_t_publish(lcm_, airspeed_channel.c_str(), &airspeed_msg);
-            mav_indexed_measurement_t_publish(lcm_, sideslip_channel.c_str(), &sideslip_msg);
+    mav_indexed_measurement_t_publish(lcm_, altimeter_channel.c_str(), &altimeter_msg);
+    mav_indexed_measurement_t_publish(lcm_, airspeed_channel.c_str(), &airspeed_msg);
+    mav_indexed_measurement_t_publish(lcm_, sideslip_channel.c_str(), &sideslip_msg);
+}
 
-            break;
+void HandleBatteryStatus(const mavlink_message_t *mavmsg, int64_t recv_utime)
+{
+    mavlink_battery_status_t batmsg;
+    mavlink_msg_battery_status_decode(mavmsg, &batmsg);
 
-        case MAVLINK_MSG_ID_RC_CHANNELS_OVERRIDE:
-            // we sent this message, so ignore it
-            break;
+    battery_msg.timestamp = recv_utime;
 
-        case MAVLINK_MSG_ID_BATTERY_STATUS:
-            mavlink_battery_status_t batmsg;
-            mavlink_msg_battery_status_decode(&mavmsg, &batmsg);
+    battery_msg.voltage = batmsg.voltage_cell_1/1000.0;
+    battery_msg.amps_now = batmsg.current_battery/100.0;
+    battery_msg.milliamp_hours_total = batmsg.voltage_cell_6/100.0;
+    battery_msg.percent_remaining = batmsg.battery_remaining;
 
-            lcmt_battery_status lcmmsg;
+    //std::cout << "v: " << batmsg.voltage_cell_1/1000.0 << " curr: " << batmsg.current_battery/100.0 << " remain: " << batmsg.battery_remaining <<  " total amph " << batmsg.voltage_cell_6/100.0 << std::endl;
 
-            lcmmsg.timestamp = getTimestampNow();
+    lcmt_battery_status_publish (lcm_, battery_status_channel.c_str(), &battery_msg);
+}
 
-            lcmmsg.voltage = batmsg.voltage_cell_1/1000.0;
-            lcmmsg.amps_now = batmsg.current_battery/100.0;
-            lcmmsg.milliamp_hours_total = batmsg.voltage_cell_6/100.0;
-            lcmmsg.percent_remaining = batmsg.battery_remaining;
+void HandleServoOutputRaw(const mavlink_message_t *mavmsg, int64_t recv_utime)
+{
+    // decode the mavlink message
+    mavlink_servo_output_raw_t buffer;
+    const mavlink_servo_output_raw_t &servomsg = *MavlinkView(mavmsg, &buffer);
 
-            //std::cout << "v: " << batmsg.voltage_cell_1/1000.0 << " curr: " << batmsg.current_battery/100.0 << " remain: " << batmsg.battery_remaining <<  " total amph " << batmsg.voltage_cell_6/100.0 << std::endl;
+    // fill in the LCM message
+    servo_out_msg.timestamp = recv_utime;
 
-            lcmt_battery_status_publish (lcm_, battery_status_channel.c_str(), &lcmmsg);
-            break;
+    /*
+     * Output channels:
+     *  1: Elevon L
+     *  2: Elevon R
+     *  3: Throttle
+     *  4:
+     *  5: autonmous switch
+     *  6: trajectory selection switch
+     *  7:
+     *  8:
+     */
+
+    servo_out_msg.elevonL = servomsg.servo1_raw;
+    servo_out_msg.elevonR = servomsg.servo2_raw;
+    servo_out_msg.throttle = servomsg.servo3_raw;
+
+    int stabilization_mode = 0;
+
+    if (servomsg.servo5_raw > 1703) {
+        // fully autonomous
+        servo_out_msg.is_autonomous = 1;
+        servo_out_msg.video_record = -1;
+    } else if (servomsg.servo5_raw > 1303) {
+        // stabilization
+        servo_out_msg.is_autonomous = 1;
+        servo_out_msg.video_record = -1;
+        stabilization_mode = 1;
+    } else {
+        // manual
+        servo_out_msg.is_autonomous = 0;
+        servo_out_msg.video_record = -1;
+    }
 
-        case MAVLINK_MSG_ID_SERVO_OUTPUT_RAW:
+    // send the lcm message
+    lcmt_deltawing_u_publish(lcm_, servo_out_channel.c_str(), &servo_out_msg);
 
-            // decode the mavlink message
+    //std::cout << servomsg.servo6_raw << std::endl;
 
-            mavlink_servo_output_raw_t servomsg;
-            mavlink_msg_servo_output_raw_decode(&mavmsg, &servomsg);
 
-            // create the LCM message
-            lcmt_deltawing_u servoOutMsg;
+    if (last_is_autonomous != servo_out_msg.is_autonomous ||
+        last_stabilization_mode != stabilization_mode ||
+        abs(servomsg.servo6_raw - last_servo6_raw) > rc_switch_delta) {
 
-            servoOutMsg.timestamp = getTimestampNow();
+        // something has changed in the switch configuration, send a new message
 
-            /*
-             * Output channels:
-             *  1: Elevon L
-             *  2: Elevon R
-             *  3: Throttle
-             *  4:
-             *  5: autonmous switch
-             *  6: trajectory selection switch
-             *  7:
-             *  8:
-             */
+        lcmt_rc_switch_action rc_msg;
+        rc_msg.timestamp = servo_out_msg.timestamp;
 
-            servoOutMsg.elevonL = servomsg.servo1_raw;
-            servoOutMsg.elevonR = servomsg.servo2_raw;
-            servoOutMsg.throttle = servomsg.servo3_raw;
+        if (stabilization_mode > 0) {
+            rc_msg.pulse_us = -1;
+        } else {
+            rc_msg.pulse_us = servomsg.servo6_raw;
+        }
 
-            stabilization_mode = 0;
 
-            if (servomsg.servo5_raw > 1703) {
-                // fully autonomous
-                servoOutMsg.is_autonomous = 1;
-                servoOutMsg.video_record = -1;
-            } else if (servomsg.servo5_raw > 1303) {
-                // stabilization
-                servoOutMsg.is_autonomous = 1;
-                servoOutMsg.video_record = -1;
-                stabilization_mode = 1;
-            } else {
-                // manual
-                servoOutMsg.is_autonomous = 0;
-                servoOutMsg.video_record = -1;
-            }
+        lcmt_rc_switch_action_publish(lcm_, rc_action_channel.c_str(), &rc_msg);
 
-            // send the lcm message
-            lcmt_deltawing_u_publish(lcm_, servo_out_channel.c_str(), &servoOutMsg);
+        last_is_autonomous = servo_out_msg.is_autonomous;
+        last_stabilization_mode = stabilization_mode;
+    }
 
-            //std::cout << servomsg.servo6_raw << std::endl;
+    last_servo6_raw = servomsg.servo6_raw;
+}
 
+void HandleStatusText(const mavlink_message_t *mavmsg, int64_t recv_utime)
+{
+    // rare, and meant to be read
+    mavlink_statustext_t textMsg;
+    mavlink_msg_statustext_decode(mavmsg, &textMsg);
 
-            if (last_is_autonomous != servoOutMsg.is_autonomous ||
-                last_stabilization_mode != stabilization_mode ||
-                abs(servomsg.servo6_raw - last_servo6_raw) > rc_switch_delta) {
+    std::cout << "status text: " << textMsg.text << std::endl;
+}
 
-                // something has changed in the switch configuration, send a new message
+/**
+ * Reads which streams to ask the APM for (the mavlink_bridge section).
+ * Streams that aren't given stay off.
+ */
+void ReadStreamRates(BotParam *param)
+{
+    memset(stream_rates, 0, sizeof(stream_rates));
 
-                lcmt_rc_switch_action rc_msg;
-                rc_msg.timestamp = getTimestampNow();
+    int request;
 
-                if (stabilization_mode > 0) {
-                    rc_msg.pulse_us = -1;
-                } else {
-                    rc_msg.pulse_us = servomsg.servo6_raw;
-                }
+    if (bot_param_get_boolean(param, "mavlink_bridge.request_streams", &request) != 0 || request != 1) {
+        request_streams = false;
+        return;
+    }
 
+    request_streams = true;
 
-                lcmt_rc_switch_action_publish(lcm_, rc_action_channel.c_str(), &rc_msg);
+    bot_param_get_int(param, "mavlink_bridge.raw_sensors_rate", &stream_rates[MAV_DATA_STREAM_RAW_SENSORS]);
+    bot_param_get_int(param, "mavlink_bridge.extended_status_rate", &stream_rates[MAV_DATA_STREAM_EXTENDED_STATUS]);
+    bot_param_get_int(param, "mavlink_bridge.rc_channels_rate", &stream_rates[MAV_DATA_STREAM_RC_CHANNELS]);
+}
 
-                last_is_autonomous = servoOutMsg.is_autonomous;
-                last_stabilization_mode = stabilization_mode;
-            }
+/**
+ * Turns off all of the APM's streams and then turns on the ones in
+ * stream_rates, at their rates.
+ */
+void RequestStreams(uint8_t target_system, uint8_t target_component)
+{
+    mavlink_message_t mavmsg;
 
-            last_servo6_raw = servomsg.servo6_raw;
+    mavlink_msg_request_data_stream_pack(systemID, 200, &mavmsg, target_system, target_component, MAV_DATA_STREAM_ALL, 0, 0);
+    sendMAVLinkMessage(lcm_, &mavmsg);
 
-            break;
+    for (int i = 0; i < MAV_DATA_STREAM_ENUM_END; i++) {
+        if (i == MAV_DATA_STREAM_ALL || stream_rates[i] <= 0) {
+            continue;
+        }
 
-        case MAVLINK_MSG_ID_STATUSTEXT:
-            mavlink_statustext_t textMsg;
-            mavlink_msg_statustext_decode(&mavmsg, &textMsg);
+        mavlink_msg_request_data_stream_pack(systemID, 200, &mavmsg, target_system, target_component, i, stream_rates[i], 1);
+        sendMAVLinkMessage(lcm_, &mavmsg);
+    }
 
+    num_stream_requests ++;
+}
 
+/**
+ * Fills in the table of handlers, and the parts of the outgoing messages
+ * that never change.  Call once the R values have been read.
+ */
+void InitMavlinkHandlers()
+{
+    memset(mavlink_handlers, 0, sizeof(mavlink_handlers));
+    memset(unknown_message_counts, 0, sizeof(unknown_message_counts));
+
+    AddMavlinkHandler(MAVLINK_MSG_ID_HEARTBEAT, &HandleHeartbeat);
+    AddMavlinkHandler(MAVLINK_MSG_ID_RAW_IMU, &HandleRawImu);
+    AddMavlinkHandler(MAVLINK_MSG_ID_ATTITUDE, &HandleIgnored);
+    AddMavlinkHandler(MAVLINK_MSG_ID_GPS_RAW_INT, &HandleGpsRawInt);
+    AddMavlinkHandler(MAVLINK_MSG_ID_SCALED_PRESSURE, &HandleScaledPressure);
+    AddMavlinkHandler(MAVLINK_MSG_ID_RC_CHANNELS_OVERRIDE, &HandleIgnored);
+    AddMavlinkHandler(MAVLINK_MSG_ID_BATTERY_STATUS, &HandleBatteryStatus);
+    AddMavlinkHandler(MAVLINK_MSG_ID_SERVO_OUTPUT_RAW, &HandleServoOutputRaw);
+    AddMavlinkHandler(MAVLINK_MSG_ID_STATUSTEXT, &HandleStatusText);
+
+    memset(&ins_msg, 0, sizeof(ins_msg));
+
+    ins_msg.quat[0] = 0; // unused
+    ins_msg.quat[1] = 0; // unused
+    ins_msg.quat[2] = 0; // unused
+    ins_msg.quat[3] = 0; // unused
+
+    ins_msg.pressure = 0; // set somewhere else
+    ins_msg.rel_alt = 0; // set somewhere else
+
+    memset(&gps_msg, 0, sizeof(gps_msg));
+    memset(&battery_msg, 0, sizeof(battery_msg));
+    memset(&servo_out_msg, 0, sizeof(servo_out_msg));
+
+    // each measurement is on one axis of the state estimator's state
+    altimeter_z_ind[0] = eigen_utils::RigidBodyState::positionInds()[2]; // measurement on the Z axis (index = 2)
+    airspeed_z_ind[0] = eigen_utils::RigidBodyState::velocityInds()[0]; // measurement on the X axis (index = 0)
+    sideslip_z_ind[0] = eigen_utils::RigidBodyState::velocityInds()[1]; // measurement on the Y axis (index = 1)
+
+    altimeter_cov[0] = altimeter_r;
+    airspeed_cov[0] = airspeed_r;
+    sideslip_cov[0] = sideslip_r;
+
+    InitIndexedMeasurement(&altimeter_msg, altimeter_z_ind, altimeter_value, altimeter_cov);
+    InitIndexedMeasurement(&airspeed_msg, airspeed_z_ind, airspeed_value, airspeed_cov);
+    InitIndexedMeasurement(&sideslip_msg, sideslip_z_ind, sideslip_value, sideslip_cov);
+}
 
-            std::cout << "status text: " << textMsg.text << std::endl;
-            break;
+/**
+ * Points a one-dimensional measurement at its (static) arrays.
+ */
+void InitIndexedMeasurement(mav_indexed_measurement_t *msg, int *z_index, double *value, double *cov)
+{
+    memset(msg, 0, sizeof(*msg));
 
-        default:
-            std::cout << "unknown message id = " << (int)mavmsg.msgid << " from sysid = " << (float)mavmsg.sysid << std::endl;
-            break;
+    msg->measured_dim = 1;
+    msg->z_indices = z_index;
+    msg->z_effective = value;
 
-    }
+    msg->measured_cov_dim = 1;
+    msg->R_effective = cov;
 }
 
-
 int main(int argc,char** argv)
 {
+    int link_baud = DEFAULT_LINK_BAUD;
 
     ConciseArgs parser(argc, argv);
     parser.add(mavlink_channel, "m", "mavlink-channel", "LCM channel for mavlink.");
@@ -487,10 +581,13 @@ int main(int argc,char** argv)
     parser.add(stereo_control_channel, "c", "stereo-control-channel", "LCM channel for stereo control.");
     parser.add(beep_channel, "p", "beep-channel", "LCM channel for beep messages.");
     parser.add(rc_action_channel, "r", "rc-action-channel", "LCM channel for RC switch action messages.");
+    parser.add(link_baud, "k", "link-baud", "Baud rate of the serial link to the APM, to pace servo commands to (0 to send each as it comes).");
     parser.parse();
 
 
-    lcm_ = lcm_create ("udpm://239.255.76.67:7667?ttl=1");
+    std::string lcm_url = "udpm://239.255.76.67:7667?ttl=1";
+
+    lcm_ = lcm_create (lcm_url.c_str());
     if (!lcm_)
     {
         fprintf(stderr, "lcm_create for recieve failed.  Quitting.\n");
@@ -505,7 +602,7 @@ int main(int argc,char** argv)
 
     // init GPS origin
     double latlong_origin[2];
-    BotParam *param = bot_param_new_from_server(lcm_, 0);
+    BotParam *param = NewParamWithSnapshot(lcm_, lcm_url);
     if (param != NULL) {
         if (bot_param_get_double_array(param, "gps_origin.latlon", latlong_origin, 2) == -1) {
             fprintf(stderr, "error: unable to get gps_origin.latlon from param server\n");
@@ -527,6 +624,8 @@ int main(int argc,char** argv)
 
         rc_switch_delta = bot_param_get_int_or_fail(param, "rc_switch_action.rc_switch_delta_trigger");
 
+        ReadStreamRates(param);
+
     } else {
         fprintf(stderr, "Error: no param server, no gps_origin.latlon\n");
         fprintf(stderr, "Error: no param server, can't find R values for state estimator.\n");
@@ -534,6 +633,20 @@ int main(int argc,char** argv)
         exit(1);
     }
 
+    InitMavlinkHandlers();
+
+    if (link_baud > 0) {
+        // 10 bits a byte on the wire
+        servo_period_usec = (int64_t)(MAVLINK_NUM_NON_PAYLOAD_BYTES + MAVLINK_MSG_ID_RC_CHANNELS_OVERRIDE_LEN) * 10 * 1000000 / link_baud;
+    }
+
+    pthread_create(&servo_sender_thread, NULL, ServoSenderThread, NULL);
+
+    if (request_streams) {
+        printf("Requesting streams from the APM: raw sensors %d Hz, extended status %d Hz, RC channels %d Hz, the rest off\n",
+            stream_rates[MAV_DATA_STREAM_RAW_SENSORS], stream_rates[MAV_DATA_STREAM_EXTENDED_STATUS], stream_rates[MAV_DATA_STREAM_RC_CHANNELS]);
+    }
+
     printf("Receiving:\n\tMavlink LCM: %s\n\tDeltawing u: %s\n\tBeep: %s\nPublishing LCM:\n\tAttiude: %s\n\tBarometric altitude: %s\n\tAirspeed: %s\n\tGPS: %s\n\tBattery status: %s\n\tServo Outputs: %s\n\tStereo Control: %s\n\tRC Action: %s\n", mavlink_channel.c_str(), deltawing_u_channel.c_str(), beep_channel.c_str(), attitude_channel.c_str(), altimeter_channel.c_str(), airspeed_channel.c_str(), gps_channel.c_str(), battery_status_channel.c_str(), servo_out_channel.c_str(), stereo_control_channel.c_str(), rc_action_channel.c_str());
 
     while (true)
@@ -17,6 +17,8 @@
 #include <signal.h>
 #include <time.h>
 #include <sys/time.h>
+#include <pthread.h>
+#include <atomic>
 
 #include "../../LCM/mavlink_msg_container_t.h"
 #include "../../LCM/lcmt_gps.h"
@@ -42,6 +44,7 @@
 
 
 #include "../../externals/ConciseArgs.hpp"
+#include "../../utils/utils/RealtimeUtils.hpp"
 
 #include "mavconn.h" // from mavconn
 
@@ -49,8 +52,18 @@
 #include "../../mavlink-generated2/csailrlg/mavlink.h"
 //#include "../../mavlink-generated2/csailrlg/mavlink_msg_scaled_pressure_and_airspeed.h"
 
+#include "../../utils/utils/MavlinkView.hpp" // after mavlink.h
+
 #define GRAVITY_MSS 9.80665f // this matches the ArduPilot definition
 
+// baud rate of the serial link to the APM when not given
+#define DEFAULT_LINK_BAUD 115200
+
+// with stream requests, how often (usec) to send them again in case one
+// was lost, and how long without a heartbeat means the APM rebooted
+#define STREAM_REQUEST_PERIOD_USEC 5000000
+#define STREAM_REBOOT_HEARTBEAT_GAP_USEC 3000000
+
 /* XXX XXX XXX XXX
  *
  * You must add
@@ -65,13 +78,48 @@
 
 
 void sighandler(int dum);
-int64_t getTimestampNow();
-
 void beep_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_beep *msg, void *user);
 
 void deltawing_u_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_deltawing_u *msg, void *user);
 
+/**
+ * A servo command on its way to the sender thread.
+ */
+struct ServoCommand {
+    lcmt_deltawing_u msg;
+    int beep;
+};
+
+void* ServoSenderThread(void *x);
+void SendServoCommand(const ServoCommand &command);
+
 void mavlink_handler(const lcm_recv_buf_t *rbuf, const char* channel, const mavlink_msg_container_t *msg, void *user);
 
+// MAVLink 1 message ids are one byte
+#define MAVLINK_MAX_MESSAGE_ID 256
+
+/**
+ * Translates one kind of MAVLink message.  mavlink_handler() looks them up
+ * by message id.  recv_utime is when the message came in, for stamping
+ * what's published.
+ */
+typedef void (*MavlinkMessageHandler)(const mavlink_message_t *mavmsg, int64_t recv_utime);
+
+void AddMavlinkHandler(uint8_t msgid, MavlinkMessageHandler handler);
+void InitMavlinkHandlers();
+void InitIndexedMeasurement(mav_indexed_measurement_t *msg, int *z_index, double *value, double *cov);
+
+void HandleHeartbeat(const mavlink_message_t *mavmsg, int64_t recv_utime);
+void HandleIgnored(const mavlink_message_t *mavmsg, int64_t recv_utime);
+void HandleRawImu(const mavlink_message_t *mavmsg, int64_t recv_utime);
+void HandleGpsRawInt(const mavlink_message_t *mavmsg, int64_t recv_utime);
+void HandleScaledPressure(const mavlink_message_t *mavmsg, int64_t recv_utime);
+void HandleBatteryStatus(const mavlink_message_t *mavmsg, int64_t recv_utime);
+void HandleServoOutputRaw(const mavlink_message_t *mavmsg, int64_t recv_utime);
+void HandleStatusText(const mavlink_message_t *mavmsg, int64_t recv_utime);
+
+void ReadStreamRates(BotParam *param);
+void RequestStreams(uint8_t target_system, uint8_t target_component);
+
 #endif
 
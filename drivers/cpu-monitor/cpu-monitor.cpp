@@ -1,5 +1,20 @@
 /*
- * Monitors the CPU clock and temperature and publishes info to LCM.
+ * Monitors the CPU clock, temperature, per-core and per-process load and
+ * thermal throttling, and publishes info to LCM.
+ *
+ * Also sets the CPU policy by flight phase, from the state machine's state
+ * messages:
+ *   ground      the governor and frequency floor the system had, normal fan
+ *   launch      the flight governor (performance) with the floor at the top
+ *               speed, and the fan on full to cool the CPU down before the
+ *               autonomous flight
+ *   autonomous  the flight governor and floor, with the fan coming on
+ *               FLIGHT_FAN_OFFSET degrees earlier than on the ground
+ * so stereo doesn't get throttled mid-maneuver.  Throttling incidents go
+ * out on their own channel as they start and end.
+ *
+ * The sysfs and /proc files are opened once and re-read with pread() each
+ * tick, so watching the CPU doesn't cost much of it.
  *
  * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
  *
@@ -10,43 +25,124 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <ctype.h>
 #include <signal.h>
 #include <time.h>
+#include <fcntl.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/select.h>
 #include <unistd.h>
 
 #include <dirent.h>
 
 #include <fstream>
+#include <sstream>
+#include <vector>
 
 
 #include "../../LCM/lcmt_cpu_info.h"
+#include "../../LCM/lcmt_cpu_throttle.h"
+#include "../../LCM/lcmt_debug.h"
 
 #include "../../externals/ConciseArgs.hpp"
 
 #include "../../utils/utils/RealtimeUtils.hpp"
 
+// ticks between looking for flight processes that aren't running
+#define PROCESS_SEARCH_PERIOD 5
+
+// /proc/<pid>/comm is cut off at this many characters
+#define PROCESS_COMM_LEN 15
+
+// degrees sooner the fan comes on in autonomous flight
+#define FLIGHT_FAN_OFFSET 10
+
+enum FlightPhase { PHASE_GROUND, PHASE_LAUNCH, PHASE_AUTONOMOUS };
+
 
 std::string cpu_freq_file =  "/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq";
 
+// the thermal limit lowers scaling_max_freq under cpuinfo_max_freq
+std::string cpu_max_freq_file =  "/sys/devices/system/cpu/cpu0/cpufreq/scaling_max_freq";
+std::string cpu_top_freq_file =  "/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq";
+
+std::string cpu_min_freq_file =  "/sys/devices/system/cpu/cpu0/cpufreq/scaling_min_freq";
+std::string cpu_governor_file =  "/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor";
+
 std::string cpu_temp_file = "/sys/class/thermal/thermal_zone0/temp";
 
 std::string fan_auto_manual_file = "/sys/devices/platform/odroidu2-fan/fan_mode";
 
 std::string fan_pwm_file = "/sys/devices/platform/odroidu2-fan/pwm_duty";
 
+std::string proc_stat_file = "/proc/stat";
+
+std::string flight_processes_str = "pushbroom-stereo,state-machine-controller,tvlqr-controller,ardupilot-mavlink-bridge,se-fusion";
+
+
+int cpu_freq_fd = -1;
+int cpu_max_freq_fd = -1;
+int cpu_temp_fd = -1;
+int fan_pwm_fd = -1;
+int proc_stat_fd = -1;
+
+int cpu_top_freq = -1;
+
+bool throttled = false;
+int throttle_count = 0;
+int64_t throttle_start_utime = 0;
+
+// what the system had when we started, for the ground and for exiting
+std::string ground_governor;
+std::string ground_min_freq;
+
+std::string flight_governor = "performance";
+
+FlightPhase flight_phase = PHASE_GROUND;
+std::string state_machine_state = "unknown";
+
+struct CoreTimes {
+    unsigned long long busy;
+    unsigned long long total;
+};
+
+std::vector<CoreTimes> last_core_times;
+
+struct FlightProcess {
+    std::string name;
+    int pid;
+    int stat_fd;
+    unsigned long long last_ticks;
+};
+
+std::vector<FlightProcess> flight_processes;
+
+int ticks_since_search = PROCESS_SEARCH_PERIOD;
+
+int64_t last_publish_utime = 0;
+
 
 lcm_t * lcm;
 
 bool disable_fan_control = false;
+bool disable_cpu_policy = false;
 
 std::string cpu_info_channel_str = "cpu-info-hostname";
+std::string cpu_throttle_channel_str = "cpu-throttle-hostname";
+std::string state_machine_state_channel_str = "state-machine-state";
 
+void SetCpuPolicy(FlightPhase phase);
 
 void sighandler(int dum) {
+    if (!disable_cpu_policy) {
+        printf("\nRestoring the CPU governor...");
+        SetCpuPolicy(PHASE_GROUND);
+    }
+
     printf("\nRestoring automatic fan control...");
     std::ofstream auto_man_file;
     auto_man_file.open(fan_auto_manual_file);
@@ -62,11 +158,36 @@ void sighandler(int dum) {
     exit(0);
 }
 
-void SetFanSpeed(float cpu_temp, int fan_pwm) {
+const char* FlightPhaseName(FlightPhase phase) {
+    switch (phase) {
+        case PHASE_GROUND:      return "ground";
+        case PHASE_LAUNCH:      return "launch";
+        case PHASE_AUTONOMOUS:  return "autonomous";
+        default:                return "unknown";
+    }
+}
+
+// from the names the state machine sends in its state messages
+FlightPhase FlightPhaseForState(const std::string &state) {
+    if (state == "ExecuteTrajectory" || state == "RunSingleTrajectory") {
+        return PHASE_AUTONOMOUS;
+    } else if (state == "LargeAccel1" || state == "TakeoffNoThrottle" || state == "Climb") {
+        return PHASE_LAUNCH;
+    } else {
+        return PHASE_GROUND;
+    }
+}
+
+void SetFanSpeed(float cpu_temp, int fan_pwm, FlightPhase phase) {
 
     int new_pwm;
 
-    if (cpu_temp >= 70) {
+    if (phase == PHASE_AUTONOMOUS) {
+        // same curve, sooner
+        cpu_temp += FLIGHT_FAN_OFFSET;
+    }
+
+    if (cpu_temp >= 70 || phase == PHASE_LAUNCH) {
         new_pwm = 255;
     } else {
 
@@ -111,56 +232,423 @@ void SetFanSpeed(float cpu_temp, int fan_pwm) {
     }
 }
 
-void PublishCpuInfo() {
 
-    // get cpu freq
+/**
+ * Writes a value to a sysfs file, like the governor.
+ *
+ * @retval false if it couldn't be written
+ */
+bool WriteSysfsFile(const std::string &filename, const std::string &value) {
+    std::ofstream file;
+    file.open(filename);
+    file << value;
+    file.close();
+
+    if (file.fail()) {
+        fprintf(stderr, "Warning: failed to write \"%s\" to %s.\n", value.c_str(), filename.c_str());
+        return false;
+    }
 
-    std::ifstream cpu_freq_file_stream(cpu_freq_file);
-    std::string cpu_freq_string;
-    getline(cpu_freq_file_stream, cpu_freq_string);
+    return true;
+}
 
+std::string ReadSysfsFile(const std::string &filename) {
+    std::ifstream file(filename);
+    std::string value;
+    file >> value;
+    return value;
+}
+
+/**
+ * Sets the governor and frequency floor for a flight phase.  The ground
+ * gets back whatever the system had when cpu-monitor started.
+ */
+void SetCpuPolicy(FlightPhase phase) {
+    if (phase == PHASE_GROUND) {
+        // the floor first, in case the governor takes it as it is
+        if (ground_min_freq.length() > 0) {
+            WriteSysfsFile(cpu_min_freq_file, ground_min_freq);
+        }
+        if (ground_governor.length() > 0) {
+            WriteSysfsFile(cpu_governor_file, ground_governor);
+        }
+    } else {
+        WriteSysfsFile(cpu_governor_file, flight_governor);
 
+        if (cpu_top_freq > 0) {
+            WriteSysfsFile(cpu_min_freq_file, std::to_string(cpu_top_freq));
+        }
+    }
+}
 
-    std::ifstream cpu_temp_file_stream(cpu_temp_file);
-    std::string cpu_temp_string;
-    getline(cpu_temp_file_stream, cpu_temp_string);
+void state_machine_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_debug *msg, void *user) {
+    state_machine_state = msg->debug;
+
+    FlightPhase phase = FlightPhaseForState(state_machine_state);
+
+    if (phase == flight_phase) {
+        return;
+    }
 
+    printf("State machine in %s: %s -> %s.\n", msg->debug, FlightPhaseName(flight_phase), FlightPhaseName(phase));
 
-    int cpu_freq = stoi(cpu_freq_string);
+    flight_phase = phase;
+
+    if (!disable_cpu_policy) {
+        SetCpuPolicy(phase);
+    }
+}
+
+void PublishThrottle(int64_t now, const lcmt_cpu_info &info) {
+    lcmt_cpu_throttle msg;
+
+    msg.timestamp = now;
+    msg.throttled = throttled;
+    msg.duration = throttled ? 0 : (now - throttle_start_utime) / 1000000.0;
+
+    msg.cpu_max_freq = info.cpu_max_freq;
+    msg.cpu_top_freq = cpu_top_freq;
+    msg.cpu_temp = info.cpu_temp;
+    msg.fan_pwm = info.fan_pwm;
+
+    msg.flight_phase = (char*)FlightPhaseName(flight_phase);
+    msg.state_machine_state = (char*)state_machine_state.c_str();
+
+    msg.throttle_count = throttle_count;
+
+    lcmt_cpu_throttle_publish(lcm, cpu_throttle_channel_str.c_str(), &msg);
+}
+
+int OpenForReading(const std::string &filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+        fprintf(stderr, "Warning: failed to open %s: %s\n", filename.c_str(), strerror(errno));
+    }
+
+    return fd;
+}
+
+/**
+ * Reads a file we keep open from the start.  sysfs and /proc regenerate
+ * their contents on a read at offset 0.
+ *
+ * @retval number of bytes read, or -1 on error
+ */
+int ReadOpenFile(int fd, char *buf, int buf_size) {
+    if (fd < 0) {
+        return -1;
+    }
+
+    ssize_t len = pread(fd, buf, buf_size - 1, 0);
+
+    if (len < 0) {
+        return -1;
+    }
+
+    buf[len] = '\0';
+    return len;
+}
+
+long ReadOpenFileLong(int fd, long default_value) {
+    char buf[64];
+
+    if (ReadOpenFile(fd, buf, sizeof(buf)) <= 0) {
+        return default_value;
+    }
+
+    return strtol(buf, NULL, 10);
+}
+
+/**
+ * Reads /proc/stat and sets the fraction of each core's time that wasn't
+ * idle since the last call.  Cores that are unplugged (they aren't listed)
+ * read 0.
+ */
+void ReadCoreUtilization(std::vector<float> *utilization) {
+    // the per-core lines come first, so the interrupt counts can be cut off
+    char buf[4096];
+
+    utilization->clear();
+
+    if (ReadOpenFile(proc_stat_fd, buf, sizeof(buf)) <= 0) {
+        return;
+    }
+
+    char *line = buf;
+
+    while (line != NULL && strncmp(line, "cpu", 3) == 0) {
+        int core;
+        unsigned long long user, nice, system, idle, iowait, irq, softirq, steal;
+
+        if (isdigit(line[3])
+            && sscanf(line, "cpu%d %llu %llu %llu %llu %llu %llu %llu %llu", &core,
+                &user, &nice, &system, &idle, &iowait, &irq, &softirq, &steal) == 9
+            && core >= 0) {
+
+            CoreTimes times;
+            times.total = user + nice + system + idle + iowait + irq + softirq + steal;
+            times.busy = times.total - idle - iowait;
+
+            if (core >= (int)last_core_times.size()) {
+                CoreTimes zero = { 0, 0 };
+                last_core_times.resize(core + 1, zero);
+            }
+
+            if (core >= (int)utilization->size()) {
+                utilization->resize(core + 1, 0);
+            }
+
+            unsigned long long d_total = times.total - last_core_times[core].total;
+            unsigned long long d_busy = times.busy - last_core_times[core].busy;
+
+            // a core that was unplugged starts its count over
+            if (times.total > last_core_times[core].total && times.busy >= last_core_times[core].busy) {
+                (*utilization)[core] = (float)d_busy / d_total;
+            }
+
+            last_core_times[core] = times;
+        }
+
+        line = strchr(line, '\n');
+        if (line != NULL) {
+            line++;
+        }
+    }
+}
+
+/**
+ * Finds a process by name in /proc.
+ *
+ * @retval pid, or -1 if it isn't running
+ */
+int FindProcess(const std::string &name) {
+    std::string comm_name = name.substr(0, PROCESS_COMM_LEN);
+
+    DIR *proc_dir = opendir("/proc");
+    if (proc_dir == NULL) {
+        return -1;
+    }
+
+    int found_pid = -1;
+    struct dirent *entry;
+
+    while ((entry = readdir(proc_dir)) != NULL) {
+        if (!isdigit(entry->d_name[0])) {
+            continue;
+        }
+
+        std::string comm_file = "/proc/" + std::string(entry->d_name) + "/comm";
+
+        int fd = open(comm_file.c_str(), O_RDONLY);
+        if (fd < 0) {
+            continue;
+        }
+
+        char comm[32];
+        int len = ReadOpenFile(fd, comm, sizeof(comm));
+        close(fd);
+
+        if (len <= 0) {
+            continue;
+        }
+
+        if (comm[len - 1] == '\n') {
+            comm[len - 1] = '\0';
+        }
+
+        if (comm_name == comm) {
+            found_pid = atoi(entry->d_name);
+            break;
+        }
+    }
+
+    closedir(proc_dir);
+
+    return found_pid;
+}
+
+/**
+ * Reads a process's user + system time from its /proc/<pid>/stat.
+ *
+ * @retval false if the process is gone
+ */
+bool ReadProcessTicks(int fd, unsigned long long *ticks) {
+    char buf[1024];
+
+    if (ReadOpenFile(fd, buf, sizeof(buf)) <= 0) {
+        return false;
+    }
+
+    // the name can have spaces and parentheses in it, so start after the
+    // last ')'
+    char *fields = strrchr(buf, ')');
+    if (fields == NULL) {
+        return false;
+    }
+
+    unsigned long utime, stime;
+
+    if (sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+        return false;
+    }
+
+    *ticks = (unsigned long long)utime + stime;
+    return true;
+}
+
+/**
+ * Updates each flight process's CPU use since the last call, in cores.
+ * Looks for the ones that aren't running every PROCESS_SEARCH_PERIOD calls.
+ */
+void ReadProcessCpu(double dt_sec, std::vector<float> *process_cpu) {
+    static const long ticks_per_sec = sysconf(_SC_CLK_TCK);
+
+    bool search = ticks_since_search >= PROCESS_SEARCH_PERIOD;
+
+    if (search) {
+        ticks_since_search = 0;
+    } else {
+        ticks_since_search ++;
+    }
+
+    process_cpu->assign(flight_processes.size(), 0);
+
+    for (unsigned int i = 0; i < flight_processes.size(); i++) {
+        FlightProcess &process = flight_processes[i];
+
+        if (process.pid < 0) {
+            if (!search) {
+                continue;
+            }
+
+            int pid = FindProcess(process.name);
+            if (pid < 0) {
+                continue;
+            }
+
+            std::string stat_file = "/proc/" + std::to_string(pid) + "/stat";
+            int fd = open(stat_file.c_str(), O_RDONLY);
+
+            if (fd < 0 || !ReadProcessTicks(fd, &process.last_ticks)) {
+                if (fd >= 0) {
+                    close(fd);
+                }
+                continue;
+            }
+
+            process.pid = pid;
+            process.stat_fd = fd;
+
+            // nothing to compare to until next time
+            continue;
+        }
+
+        unsigned long long ticks;
+
+        if (!ReadProcessTicks(process.stat_fd, &ticks)) {
+            // it exited
+            close(process.stat_fd);
+            process.stat_fd = -1;
+            process.pid = -1;
+            continue;
+        }
+
+        if (dt_sec > 0) {
+            (*process_cpu)[i] = (ticks - process.last_ticks) / (double)ticks_per_sec / dt_sec;
+        }
+
+        process.last_ticks = ticks;
+    }
+}
+
+void PublishCpuInfo() {
+
+    int64_t now = GetTimestampNow();
+    double dt_sec = last_publish_utime > 0 ? (now - last_publish_utime) / 1000000.0 : 0;
+    last_publish_utime = now;
 
     lcmt_cpu_info msg;
-    msg.cpu_freq = cpu_freq;
+
+    // get cpu freq (in khz)
+    msg.cpu_freq = ReadOpenFileLong(cpu_freq_fd, -1);
 
     // get CPU temp
-    float cpu_temp = stof(cpu_temp_string);
+    float cpu_temp = ReadOpenFileLong(cpu_temp_fd, 0);
     cpu_temp /= 1000;
     msg.cpu_temp = cpu_temp;
 
+    // check for throttling
+    msg.cpu_max_freq = ReadOpenFileLong(cpu_max_freq_fd, -1);
+
+    bool now_throttled = cpu_top_freq > 0 && msg.cpu_max_freq > 0 && msg.cpu_max_freq < cpu_top_freq;
+
+    bool throttle_changed = now_throttled != throttled;
+
+    if (now_throttled && !throttled) {
+        throttle_count ++;
+        throttle_start_utime = now;
+        printf("Throttled to %.2f Ghz at %.0f C (%s).\n", msg.cpu_max_freq / 1000000.0, cpu_temp, FlightPhaseName(flight_phase));
+    } else if (!now_throttled && throttled) {
+        printf("No longer throttled (%.0f C) after %.0f sec.\n", cpu_temp, (now - throttle_start_utime) / 1000000.0);
+    }
+
+    throttled = now_throttled;
+    msg.throttled = throttled;
+    msg.throttle_count = throttle_count;
+
 
     // get fan speed
     if (!disable_fan_control) {
-        std::ifstream fan_file_stream(fan_pwm_file);
-        std::string fan_string;
-        getline(fan_file_stream, fan_string);
-        fan_file_stream.close();
+        char fan_string[64];
 
-        fan_string = fan_string.substr(22, std::string::npos);
-        std::size_t first_space = fan_string.find_first_of(" ");
+        int fan_pwm = -1;
 
-        fan_string = fan_string.substr(0, first_space);
+        // the number starts at character 22, after a label
+        if (ReadOpenFile(fan_pwm_fd, fan_string, sizeof(fan_string)) > 22) {
+            fan_pwm = strtol(fan_string + 22, NULL, 10);
+        }
 
-        int fan_pwm = stoi(fan_string);
         msg.fan_pwm = fan_pwm;
 
-        SetFanSpeed(cpu_temp, fan_pwm);
+        if (fan_pwm >= 0) {
+            SetFanSpeed(cpu_temp, fan_pwm, flight_phase);
+        }
     } else {
         msg.fan_pwm = -1;
     }
 
-    msg.timestamp = GetTimestampNow();
+    // per-core load
+    std::vector<float> core_utilization;
+    ReadCoreUtilization(&core_utilization);
+
+    msg.num_cores = core_utilization.size();
+    msg.core_utilization = core_utilization.data();
+
+    // flight processes
+    std::vector<float> process_cpu;
+    ReadProcessCpu(dt_sec, &process_cpu);
+
+    std::vector<char*> process_names;
+    std::vector<int32_t> process_pids;
+
+    for (unsigned int i = 0; i < flight_processes.size(); i++) {
+        process_names.push_back((char*)flight_processes[i].name.c_str());
+        process_pids.push_back(flight_processes[i].pid);
+    }
+
+    msg.num_processes = flight_processes.size();
+    msg.process_names = process_names.data();
+    msg.process_pids = process_pids.data();
+    msg.process_cpu = process_cpu.data();
+
+    msg.timestamp = now;
 
     lcmt_cpu_info_publish(lcm, cpu_info_channel_str.c_str(), &msg);
 
+    if (throttle_changed) {
+        PublishThrottle(now, msg);
+    }
 
 }
 
@@ -172,6 +660,7 @@ int main(int argc,char** argv) {
 
     gethostname(hostname, hostname_len);
     cpu_info_channel_str = "cpu-info-" + std::string(hostname);
+    cpu_throttle_channel_str = "cpu-throttle-" + std::string(hostname);
 
     ConciseArgs parser(argc, argv);
     parser.add(cpu_info_channel_str, "c", "cpu-info-channel",
@@ -180,15 +669,54 @@ int main(int argc,char** argv) {
         "File to read containing CPU frequency.");
     parser.add(cpu_temp_file, "t", "cpu-temp-file",
         "File to read containing CPU temperature.");
+    parser.add(flight_processes_str, "p", "processes",
+        "Comma-separated names of processes to report the CPU use of.");
+    parser.add(cpu_throttle_channel_str, "T", "cpu-throttle-channel",
+        "LCM channel for publishing throttling incidents.");
+    parser.add(state_machine_state_channel_str, "s", "state-machine-state-channel",
+        "LCM channel the state machine sends its state on, for the flight phase (empty to stay in the ground phase).");
+    parser.add(flight_governor, "g", "flight-governor",
+        "CPU governor to use in flight.");
     parser.add(disable_fan_control, "n", "disable-fan-control", "Pass to disable ODROID-U3 fan control.");
+    parser.add(disable_cpu_policy, "P", "disable-cpu-policy", "Pass to leave the CPU governor and frequency floor alone.");
     parser.parse();
 
+    std::stringstream processes_stream(flight_processes_str);
+    std::string process_name;
+
+    while (getline(processes_stream, process_name, ',')) {
+        if (process_name.length() > 0) {
+            FlightProcess process = { process_name, -1, -1, 0 };
+            flight_processes.push_back(process);
+        }
+    }
+
     lcm = lcm_create ("udpm://239.255.76.67:7667?ttl=1");
     if (!lcm) {
         fprintf(stderr, "lcm_create failed.  Quitting.\n");
         return 1;
     }
 
+    cpu_freq_fd = OpenForReading(cpu_freq_file);
+    cpu_max_freq_fd = OpenForReading(cpu_max_freq_file);
+    cpu_temp_fd = OpenForReading(cpu_temp_file);
+    proc_stat_fd = OpenForReading(proc_stat_file);
+
+    // the top speed doesn't change
+    int cpu_top_freq_fd = OpenForReading(cpu_top_freq_file);
+    cpu_top_freq = ReadOpenFileLong(cpu_top_freq_fd, -1);
+
+    if (cpu_top_freq_fd >= 0) {
+        close(cpu_top_freq_fd);
+    }
+
+    ground_governor = ReadSysfsFile(cpu_governor_file);
+    ground_min_freq = ReadSysfsFile(cpu_min_freq_file);
+
+    if (state_machine_state_channel_str.length() > 0) {
+        lcmt_debug_subscribe(lcm, state_machine_state_channel_str.c_str(), &state_machine_handler, NULL);
+    }
+
     signal(SIGINT,sighandler);
 
     if (!disable_fan_control) {
@@ -198,16 +726,33 @@ int main(int argc,char** argv) {
         auto_man_file.open(fan_auto_manual_file);
         auto_man_file << "manual";
         auto_man_file.close();
+
+        fan_pwm_fd = OpenForReading(fan_pwm_file);
     }
 
-    printf("Publishing:\n\tCPU Info: %s\n", cpu_info_channel_str.c_str());
+    printf("Publishing:\n\tCPU Info: %s\n\tThrottling: %s\n", cpu_info_channel_str.c_str(), cpu_throttle_channel_str.c_str());
+
+    int lcm_fd = lcm_get_fileno(lcm);
 
     while (true) {
 
         PublishCpuInfo();
 
-        // wait 1 second
-        sleep(1);
+        // handle state messages until it's time to publish again, 1 second
+        int64_t next_publish_utime = GetTimestampNow() + 1000000;
+        int64_t wait_usec;
+
+        while ((wait_usec = next_publish_utime - GetTimestampNow()) > 0) {
+            fd_set fds;
+            FD_ZERO(&fds);
+            FD_SET(lcm_fd, &fds);
+
+            struct timeval timeout = { (time_t)(wait_usec / 1000000), (suseconds_t)(wait_usec % 1000000) };
+
+            if (select(lcm_fd + 1, &fds, 0, 0, &timeout) > 0) {
+                lcm_handle(lcm);
+            }
+        }
     }
 
     return 0;
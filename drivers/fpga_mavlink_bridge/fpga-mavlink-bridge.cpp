@@ -32,17 +32,24 @@ using namespace std;
 #include "mavconn.h" // from mavconn
 
 //#include "../../mavlink-generated/ardupilotmega/mavlink.h"
-#include "../../mavlink-generated2/csailrlg/mavlink.h"
+#include "../../mavlink-rlg/csailrlg/mavlink.h" // has LCM_TRANSPORT
+#include "../../utils/utils/Clock.hpp"
+#include "../../utils/utils/MavlinkView.hpp"
+#include "../lcm_to_xbee_bridge2/LcmTransportPart.hpp"
 //#include "../../mavlink-generated2/csailrlg/mavlink_msg_scaled_pressure_and_airspeed.h"
 
 #define FPGA_TARGET_SYSTEM_ID 99
 #define FPGA_TARGET_COMPONENT_ID 48
 
+// shortest time between timestamp messages to the FPGA: about what one
+// takes on the serial link at 57600 baud
+#define SYSTEM_TIME_MIN_PERIOD_USEC ((MAVLINK_NUM_NON_PAYLOAD_BYTES + MAVLINK_MSG_ID_SYSTEM_TIME_LEN) * 10 * 1000000 / 57600)
+
 
 /* XXX XXX XXX XXX
  *
  * You must add
- *      #include "../mavlink-generated2/ardupilotmega/mavlink.h"
+  *      #include "../mavlink-rlg/ardupilotmega/mavlink.h"
  * to
  *      ../../LCM/mavlink_message_t.h
  * and comment out its definition of
@@ -65,6 +72,12 @@ lcmt_deltawing_u_subscription_t *servo_out_sub;
 
 uint8_t systemID = getSystemID();
 
+int64_t last_system_time_sent = 0;
+
+// the FPGA sends its stereo hits as LCM messages in LCM_TRANSPORT packets,
+// which get put back together here and published on their own channels
+LcmTransportTable incoming_messages;
+
 static void usage(void) {
         fprintf(stderr, "usage: fpga-mavlink-bridge stereo-control-channel-name mavlink-channel-name\n");
         fprintf(stderr, "    stereo-control-channel-name : LCM channel to receive stereo control commands on\n");
@@ -85,12 +98,6 @@ void sighandler(int dum) {
 
     exit(0);
 }
-
-int64_t getTimestampNow() {
-    struct timeval thisTime;
-    gettimeofday(&thisTime, NULL);
-    return (thisTime.tv_sec * 1000000.0) + (float)thisTime.tv_usec + 0.5;
-}
 void stereo_control_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo_control *msg, void *user) {
 
     mavlink_message_t mavmsg;
@@ -105,11 +112,22 @@ void stereo_control_handler(const lcm_recv_buf_t *rbuf, const char* channel, con
 }
 
 void servo_out_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_deltawing_u *msg, void *user) {
-    // send a timestamp message on every servo_out message
+    // send a timestamp message on every servo_out message, unless they're
+    // coming faster than the link can take them.  The timestamp is made
+    // here, so skipping one just means the next is fresher, instead of a
+    // line of old ones waiting for the serial port.
+
+    int64_t now = GetWallNow();
+
+    if (now - last_system_time_sent < SYSTEM_TIME_MIN_PERIOD_USEC && now >= last_system_time_sent) {
+        return;
+    }
+
+    last_system_time_sent = now;
 
     mavlink_message_t mavmsg;
 
-	mavlink_msg_system_time_pack(systemID, 200, &mavmsg, getTimestampNow(), 0);
+	mavlink_msg_system_time_pack(systemID, 200, &mavmsg, now, 0);
 
     //cout << "sending timestamp" << endl;
 
@@ -134,8 +152,8 @@ void mavlink_handler(const lcm_recv_buf_t *rbuf, const char* channel, const mavl
 	// send via LCM
 	lcmt_deltawing_gains_publish (lcmSend, lcm_out, &msg2);
 */
-    // extract the message out of the container
-    mavlink_message_t mavmsg = msg->msg;
+    // use the message in the container, don't copy it out
+    const mavlink_message_t &mavmsg = msg->msg;
 
 
     if (mavmsg.sysid != FPGA_TARGET_SYSTEM_ID) {
@@ -155,6 +173,26 @@ void mavlink_handler(const lcm_recv_buf_t *rbuf, const char* channel, const mavl
             cout << "heatbeat from system: " << (int) mavmsg.sysid << endl;
             break;
 
+        case MAVLINK_MSG_ID_LCM_TRANSPORT:
+        {
+            mavlink_lcm_transport_t buffer;
+            const mavlink_lcm_transport_t *transportIn = MavlinkView(&mavmsg, &buffer);
+
+            LcmTransportPart *part = incoming_messages.AddMessage(*transportIn, GetWallNow());
+
+            if (part != NULL) {
+                // that was the last piece.  The FPGA doesn't delta encode.
+                if (part->delta) {
+                    cout << "dropping delta encoded message on " << part->GetChannel() << endl;
+                } else {
+                    lcm_publish(lcm, part->GetChannel(), part->GetData(), part->GetDataSize());
+                }
+
+                incoming_messages.Release(part);
+            }
+            break;
+        }
+
         default:
             cout << "unknown message id = " << (int)mavmsg.msgid << endl;
             break;
@@ -34,6 +34,7 @@ using namespace std;
 
 //#include "../../mavlink-generated/ardupilotmega/mavlink.h"
 #include "../../mavlink-generated2/csailrlg/mavlink.h"
+#include "../../utils/utils/Clock.hpp"
 //#include "../../mavlink-generated2/csailrlg/mavlink_msg_scaled_pressure_and_airspeed.h"
 
 #define FPGA_TARGET_SYSTEM_ID 99
@@ -43,13 +44,6 @@ using namespace std;
 
 using namespace std;
 
-int64_t getTimestampNow()
-{
-    struct timeval thisTime;
-    gettimeofday(&thisTime, NULL);
-    return (thisTime.tv_sec * 1000000.0) + (float)thisTime.tv_usec + 0.5;
-}
-
 int main(int argc,char** argv) {
 
     lcm_t * lcm;
@@ -0,0 +1,369 @@
+#include <string.h>
+#include "u3stream.h"
+
+static void *u3StreamThread(void *arg);
+static long u3StreamSendSimple(HANDLE hDevice, uint8 command, const char *name);
+
+long u3StreamStart(u3Stream *stream, HANDLE hDevice, u3CalibrationInfo *caliInfo, int numChannels, const uint8 *channels, int scanRate)
+{
+    uint8 sendBuff[12 + 2*U3_STREAM_MAX_CHANNELS], recBuff[8];
+    uint8 curTCConfig, curDAC1Enable, curFIOAnalog, curEIOAnalog;
+    uint8 fioAnalog = 0, eioAnalog = 0, scanConfig = 0;
+    uint16 checksumTotal;
+    long scanInterval, error;
+    int i, sendBuffSize;
+
+    if(numChannels < 1 || numChannels > U3_STREAM_MAX_CHANNELS || scanRate < 1)
+    {
+        printf("u3StreamStart error : invalid number of channels or scan rate\n");
+        return -1;
+    }
+
+    if(isCalibrationInfoValid(caliInfo) != 1)
+    {
+        printf("u3StreamStart error : calibration information is required\n");
+        return -1;
+    }
+
+    memset(stream, 0, sizeof(*stream));
+
+    stream->hDevice = hDevice;
+    stream->caliInfo = caliInfo;
+    stream->numChannels = numChannels;
+    memcpy(stream->channels, channels, numChannels);
+
+    stream->samplesPerPacket = U3_STREAM_MAX_SAMPLES_PER_PACKET / numChannels * numChannels;
+
+    //Setting the channels to analog, leaving the rest as they are
+    for(i = 0; i < numChannels; i++)
+    {
+        if(channels[i] <= 7)
+            fioAnalog |= 1 << channels[i];
+        else if(channels[i] <= 15)
+            eioAnalog |= 1 << (channels[i] - 8);
+    }
+
+    if((error = ehConfigIO(hDevice, 0, 0, 0, 0, 0, &curTCConfig, &curDAC1Enable, &curFIOAnalog, &curEIOAnalog)) != 0)
+        return error;
+
+    if((fioAnalog | curFIOAnalog) != curFIOAnalog || (eioAnalog | curEIOAnalog) != curEIOAnalog)
+    {
+        if((error = ehConfigIO(hDevice, 12, curTCConfig, 0, fioAnalog | curFIOAnalog, eioAnalog | curEIOAnalog, NULL, NULL, &curFIOAnalog, &curEIOAnalog)) != 0)
+            return error;
+    }
+
+    //The scan interval is in ticks of a 4 MHz clock, or 4 MHz / 256 for
+    //slow scans
+    scanInterval = 4000000 / scanRate;
+
+    if(scanInterval > 65535)
+    {
+        scanConfig |= 4;   //DivideClockBy256
+        scanInterval = 4000000 / 256 / scanRate;
+
+        if(scanInterval > 65535)
+            scanInterval = 65535;
+    }
+
+    if(scanInterval < 1)
+        scanInterval = 1;
+
+    /* StreamConfig */
+    sendBuffSize = 12 + 2*numChannels;
+
+    sendBuff[1] = (uint8)(0xF8);  //Command byte
+    sendBuff[2] = (uint8)(numChannels + 3);  //Number of data words
+    sendBuff[3] = (uint8)(0x11);  //Extended command number
+    sendBuff[6] = (uint8)numChannels;  //NumChannels
+    sendBuff[7] = (uint8)stream->samplesPerPacket;  //SamplesPerPacket
+    sendBuff[8] = 0;  //Reserved
+    sendBuff[9] = scanConfig;  //ScanConfig : 4 MHz clock, full resolution
+    sendBuff[10] = (uint8)(scanInterval & 0xFF);  //ScanInterval (low)
+    sendBuff[11] = (uint8)(scanInterval / 256);   //ScanInterval (high)
+
+    for(i = 0; i < numChannels; i++)
+    {
+        sendBuff[12 + i*2] = channels[i];  //PChannel
+        sendBuff[13 + i*2] = 31;           //NChannel : single ended
+    }
+
+    extendedChecksum(sendBuff, sendBuffSize);
+
+    if(LJUSB_BulkWrite(hDevice, U3_PIPE_EP1_OUT, sendBuff, sendBuffSize) < sendBuffSize)
+    {
+        printf("u3StreamStart error : StreamConfig write failed\n");
+        return -1;
+    }
+
+    if(LJUSB_BulkRead(hDevice, U3_PIPE_EP2_IN, recBuff, 8) < 8)
+    {
+        printf("u3StreamStart error : StreamConfig read failed\n");
+        return -1;
+    }
+
+    checksumTotal = extendedChecksum16(recBuff, 8);
+    if( (uint8)((checksumTotal / 256) & 0xff) != recBuff[5] || (uint8)(checksumTotal & 0xff) != recBuff[4]
+        || extendedChecksum8(recBuff) != recBuff[0] )
+    {
+        printf("u3StreamStart error : StreamConfig response has bad checksum\n");
+        return -1;
+    }
+
+    if( recBuff[1] != (uint8)(0xF8) || recBuff[2] != (uint8)(0x01) || recBuff[3] != (uint8)(0x11) )
+    {
+        printf("u3StreamStart error : StreamConfig response has wrong command bytes\n");
+        return -1;
+    }
+
+    if( recBuff[6] != 0 )
+    {
+        printf("u3StreamStart error : StreamConfig received errorcode %d\n", recBuff[6]);
+        return (long)recBuff[6];
+    }
+
+    pthread_mutex_init(&stream->mutex, NULL);
+    pthread_cond_init(&stream->newScan, NULL);
+
+    /* StreamStart */
+    if((error = u3StreamSendSimple(hDevice, 0xA8, "StreamStart")) != 0)
+        return error;
+
+    stream->running = 1;
+
+    if(pthread_create(&stream->thread, NULL, u3StreamThread, stream) != 0)
+    {
+        printf("u3StreamStart error : failed to start the reader thread\n");
+        stream->running = 0;
+        u3StreamSendSimple(hDevice, 0xB0, "StreamStop");
+        return -1;
+    }
+
+    return 0;
+}
+
+long u3StreamStop(u3Stream *stream)
+{
+    long error;
+
+    pthread_mutex_lock(&stream->mutex);
+    stream->running = 0;
+    pthread_mutex_unlock(&stream->mutex);
+
+    error = u3StreamSendSimple(stream->hDevice, 0xB0, "StreamStop");
+
+    //The reader's read times out once the data stops
+    pthread_join(stream->thread, NULL);
+
+    pthread_cond_destroy(&stream->newScan);
+    pthread_mutex_destroy(&stream->mutex);
+
+    return error;
+}
+
+long u3StreamGetLatest(u3Stream *stream, double *voltages)
+{
+    long totalScans;
+
+    pthread_mutex_lock(&stream->mutex);
+
+    totalScans = stream->totalScans;
+
+    if(totalScans > 0)
+        memcpy(voltages, stream->latest, stream->numChannels*sizeof(double));
+
+    pthread_mutex_unlock(&stream->mutex);
+
+    return totalScans;
+}
+
+long u3StreamGetMeans(u3Stream *stream, long numScans, double *means)
+{
+    long numSummed;
+    int i;
+
+    pthread_mutex_lock(&stream->mutex);
+
+    while(stream->numSummed < numScans && !stream->failed)
+        pthread_cond_wait(&stream->newScan, &stream->mutex);
+
+    numSummed = stream->numSummed;
+
+    if(stream->failed || numSummed < 1)
+    {
+        pthread_mutex_unlock(&stream->mutex);
+        return -1;
+    }
+
+    for(i = 0; i < stream->numChannels; i++)
+    {
+        means[i] = stream->sums[i] / numSummed;
+        stream->sums[i] = 0;
+    }
+
+    stream->numSummed = 0;
+
+    pthread_mutex_unlock(&stream->mutex);
+
+    return numSummed;
+}
+
+long u3StreamDecodePacket(u3Stream *stream, uint8 *packet)
+{
+    int packetSize = 14 + 2*stream->samplesPerPacket;
+    uint16 checksumTotal, bytesVolt;
+    double voltage;
+    int i;
+
+    checksumTotal = extendedChecksum16(packet, packetSize);
+    if( (uint8)((checksumTotal / 256) & 0xff) != packet[5] || (uint8)(checksumTotal & 0xff) != packet[4]
+        || extendedChecksum8(packet) != packet[0] )
+        return -1;
+
+    if( packet[1] != (uint8)(0xF9) || packet[2] != (uint8)(4 + stream->samplesPerPacket) || packet[3] != (uint8)(0xC0) )
+        return -1;
+
+    if( packet[11] != 0 )
+    {
+        //59 : the U3's buffer overflowed and it's dropping scans.  60 : it's
+        //caught up, and the packet says how many it dropped.  Either way
+        //the packet doesn't have samples in it.
+        stream->nextChannel = 0;
+        stream->packetCounter = packet[10] + 1;
+        return -1;
+    }
+
+    if( packet[10] != stream->packetCounter )
+    {
+        //lost a packet.  This one starts a scan, so just carry on.
+        stream->nextChannel = 0;
+
+        pthread_mutex_lock(&stream->mutex);
+        stream->numErrors++;
+        pthread_mutex_unlock(&stream->mutex);
+    }
+
+    stream->packetCounter = packet[10] + 1;
+
+    for(i = 0; i < stream->samplesPerPacket; i++)
+    {
+        int channel = stream->channels[stream->nextChannel];
+
+        bytesVolt = packet[12 + i*2] + packet[13 + i*2]*256;
+
+        if(stream->caliInfo->hardwareVersion < 1.30)
+            getAinVoltCalibrated(stream->caliInfo, 0, 31, bytesVolt, &voltage);
+        else
+            getAinVoltCalibrated_hw130(stream->caliInfo, channel, 31, bytesVolt, &voltage);
+
+        stream->scan[stream->nextChannel] = voltage;
+        stream->nextChannel++;
+
+        if(stream->nextChannel == stream->numChannels)
+        {
+            int c;
+
+            stream->nextChannel = 0;
+
+            pthread_mutex_lock(&stream->mutex);
+
+            for(c = 0; c < stream->numChannels; c++)
+            {
+                stream->latest[c] = stream->scan[c];
+                stream->sums[c] += stream->scan[c];
+            }
+
+            stream->totalScans++;
+            stream->numSummed++;
+
+            pthread_cond_broadcast(&stream->newScan);
+            pthread_mutex_unlock(&stream->mutex);
+        }
+    }
+
+    return stream->samplesPerPacket;
+}
+
+static void *u3StreamThread(void *arg)
+{
+    u3Stream *stream = (u3Stream*)arg;
+    uint8 packet[14 + 2*U3_STREAM_MAX_SAMPLES_PER_PACKET];
+    int packetSize = 14 + 2*stream->samplesPerPacket;
+    int failures = 0;
+    int running = 1;
+
+    while(running)
+    {
+        int recChars = LJUSB_Stream(stream->hDevice, packet, packetSize);
+
+        pthread_mutex_lock(&stream->mutex);
+        running = stream->running;
+        pthread_mutex_unlock(&stream->mutex);
+
+        if(recChars < packetSize)
+        {
+            if(!running)
+                break;
+
+            failures++;
+
+            if(failures >= U3_STREAM_MAX_READ_FAILURES)
+            {
+                printf("u3Stream error : reads failed %d times in a row, giving up\n", failures);
+
+                pthread_mutex_lock(&stream->mutex);
+                stream->failed = 1;
+                pthread_cond_broadcast(&stream->newScan);
+                pthread_mutex_unlock(&stream->mutex);
+                break;
+            }
+            continue;
+        }
+
+        failures = 0;
+
+        if(u3StreamDecodePacket(stream, packet) < 0)
+        {
+            pthread_mutex_lock(&stream->mutex);
+            stream->numErrors++;
+            pthread_mutex_unlock(&stream->mutex);
+        }
+    }
+
+    return NULL;
+}
+
+//Sends StreamStart (0xA8) or StreamStop (0xB0), which are two bytes with
+//four back.
+static long u3StreamSendSimple(HANDLE hDevice, uint8 command, const char *name)
+{
+    uint8 sendBuff[2], recBuff[4];
+
+    sendBuff[0] = command;
+    sendBuff[1] = command;
+
+    if(LJUSB_BulkWrite(hDevice, U3_PIPE_EP1_OUT, sendBuff, 2) < 2)
+    {
+        printf("%s error : write failed\n", name);
+        return -1;
+    }
+
+    if(LJUSB_BulkRead(hDevice, U3_PIPE_EP2_IN, recBuff, 4) < 4)
+    {
+        printf("%s error : read failed\n", name);
+        return -1;
+    }
+
+    if( recBuff[1] != (uint8)(command + 1) || recBuff[3] != 0 )
+    {
+        printf("%s error : response has wrong command bytes\n", name);
+        return -1;
+    }
+
+    if( recBuff[2] != 0 )
+    {
+        printf("%s error : received errorcode %d\n", name, recBuff[2]);
+        return (long)recBuff[2];
+    }
+
+    return 0;
+}
@@ -0,0 +1,103 @@
+/*
+ * Reads U3 analog inputs in stream mode: the U3 samples the channels on its
+ * own clock and sends them 25 at a time, and a reader thread decodes the
+ * packets as they come in.  That's one USB transfer per packet instead of a
+ * command/response round trip (about 1 ms) per sample.
+ *
+ * The newest scan (one sample of each channel) is always available, and
+ * u3StreamGetMeans() averages the scans since it was last called.
+ *
+ * Other commands (like I2C to an LJTDAC) can still be sent while streaming.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#ifndef _U3STREAM_H
+#define _U3STREAM_H
+
+#include <pthread.h>
+#include "u3.h"
+
+#define U3_STREAM_MAX_CHANNELS 16
+
+// most samples the U3 puts in a packet
+#define U3_STREAM_MAX_SAMPLES_PER_PACKET 25
+
+// reads in a row that can fail before the reader gives up on the device
+#define U3_STREAM_MAX_READ_FAILURES 10
+
+typedef struct {
+    HANDLE hDevice;
+    u3CalibrationInfo *caliInfo;
+
+    int numChannels;
+    uint8 channels[U3_STREAM_MAX_CHANNELS];
+
+    // a multiple of numChannels, so a lost packet doesn't shift the
+    // channels
+    int samplesPerPacket;
+
+    pthread_t thread;
+    int running;
+
+    // reader thread only: the scan being filled in and the next packet's
+    // number
+    double scan[U3_STREAM_MAX_CHANNELS];
+    int nextChannel;
+    uint8 packetCounter;
+
+    // everything below is under the mutex
+    pthread_mutex_t mutex;
+    pthread_cond_t newScan;
+
+    double latest[U3_STREAM_MAX_CHANNELS];
+    long totalScans;
+
+    double sums[U3_STREAM_MAX_CHANNELS];
+    long numSummed;
+
+    long numErrors;
+
+    // the reader stopped because the device did
+    int failed;
+} u3Stream;
+
+long u3StreamStart( u3Stream *stream,
+                    HANDLE hDevice,
+                    u3CalibrationInfo *caliInfo,
+                    int numChannels,
+                    const uint8 *channels,
+                    int scanRate);
+//Sets the channels to analog, configures and starts a stream, and starts the
+//reader thread.  Returns -1 or errorcode (>1 value) on error, 0 on success.
+//stream = stream to start
+//hDevice = handle to a U3 device
+//caliInfo = calibration information from getCalibrationInfo (must stay
+//           around while streaming)
+//numChannels = number of channels (1 to U3_STREAM_MAX_CHANNELS)
+//channels = positive channels to read (single ended)
+//scanRate = scans per second
+
+long u3StreamStop( u3Stream *stream);
+//Stops the stream and waits for the reader thread.  Returns -1 or errorcode
+//(>1 value) on error, 0 on success.
+
+long u3StreamGetLatest( u3Stream *stream,
+                        double *voltages);
+//Copies the newest scan into voltages (numChannels of them).  Returns the
+//number of scans so far (0 if voltages wasn't set).
+
+long u3StreamGetMeans( u3Stream *stream,
+                       long numScans,
+                       double *means);
+//Waits until numScans scans have come in since the last call, then sets
+//means to their average and starts over.  Returns the number averaged, or -1
+//if the stream failed first.
+
+long u3StreamDecodePacket( u3Stream *stream,
+                           uint8 *packet);
+//Decodes one StreamData packet (used by the reader thread).  Returns -1 if
+//the packet is bad, or the number of samples in it.
+
+#endif
@@ -0,0 +1,184 @@
+#include "LcmDeltaCodec.hpp"
+
+/**
+ * @param keyframe_interval send a whole message at least this often, or 0
+ *      to leave the channel alone
+ */
+LcmDeltaEncoder::LcmDeltaEncoder(int keyframe_interval)
+{
+    keyframe_interval_ = keyframe_interval;
+    keyframe_number_ = 0;
+    since_keyframe_ = -1;
+}
+
+/**
+ * @param data LCM message
+ * @param size its size (up to 65535 bytes)
+ * @param force_keyframe true to send this one whole (like when the last
+ *      keyframe was never sent)
+ * @param out (output) encoded message
+ *
+ * @retval true if it's a keyframe
+ */
+bool LcmDeltaEncoder::Encode(const void *data, int size, bool force_keyframe, vector<uint8_t> *out)
+{
+    const uint8_t *bytes = (const uint8_t*)data;
+
+    out->clear();
+
+    if (force_keyframe == false && since_keyframe_ >= 0 && since_keyframe_ + 1 < keyframe_interval_ && size <= 65535)
+    {
+        out->reserve(LCM_DELTA_HEADER_SIZE + 2 + size + size / 128 + 1);
+
+        out->push_back(LCM_DELTA_DELTA);
+        out->push_back(keyframe_number_);
+        out->push_back(size & 0xff);
+        out->push_back(size >> 8);
+
+        int keyframeSize = keyframe_.size();
+        int i = 0;
+
+        while (i < size)
+        {
+            int run = 0;
+
+            while (i + run < size && run < 128
+                && bytes[i + run] == (i + run < keyframeSize ? keyframe_[i + run] : 0))
+            {
+                run ++;
+            }
+
+            if (run > 0)
+            {
+                out->push_back(run - 1);
+                i += run;
+                continue;
+            }
+
+            // literals until the next pair of unchanged bytes (a lone one
+            // isn't worth a control byte)
+            int start = i;
+
+            while (i < size && i - start < 128)
+            {
+                bool same = bytes[i] == (i < keyframeSize ? keyframe_[i] : 0);
+                bool nextSame = i + 1 >= size || bytes[i + 1] == (i + 1 < keyframeSize ? keyframe_[i + 1] : 0);
+
+                if (same && nextSame)
+                {
+                    break;
+                }
+                i ++;
+            }
+
+            out->push_back(127 + i - start);
+
+            for (int j = start; j < i; j++)
+            {
+                out->push_back(bytes[j] ^ (j < keyframeSize ? keyframe_[j] : 0));
+            }
+        }
+
+        if ((int)out->size() < LCM_DELTA_HEADER_SIZE + size)
+        {
+            since_keyframe_ ++;
+            return false;
+        }
+
+        // didn't help, so it may as well be a keyframe
+        out->clear();
+    }
+
+    keyframe_.assign(bytes, bytes + size);
+    keyframe_number_ ++;
+    since_keyframe_ = 0;
+
+    out->reserve(LCM_DELTA_HEADER_SIZE + size);
+    out->push_back(LCM_DELTA_KEYFRAME);
+    out->push_back(keyframe_number_);
+    out->insert(out->end(), bytes, bytes + size);
+
+    return true;
+}
+
+LcmDeltaDecoder::LcmDeltaDecoder()
+{
+    keyframe_number_ = -1;
+}
+
+/**
+ * @param data encoded message
+ * @param size its size
+ * @param out (output) the LCM message
+ *
+ * @retval false if it can't be decoded (it's a delta on a keyframe we
+ *      didn't get, or it's malformed)
+ */
+bool LcmDeltaDecoder::Decode(const void *data, int size, vector<uint8_t> *out)
+{
+    const uint8_t *bytes = (const uint8_t*)data;
+
+    if (size < LCM_DELTA_HEADER_SIZE)
+    {
+        return false;
+    }
+
+    if (bytes[0] == LCM_DELTA_KEYFRAME)
+    {
+        keyframe_.assign(bytes + LCM_DELTA_HEADER_SIZE, bytes + size);
+        keyframe_number_ = bytes[1];
+
+        out->assign(keyframe_.begin(), keyframe_.end());
+        return true;
+    }
+
+    if (bytes[0] != LCM_DELTA_DELTA || bytes[1] != keyframe_number_ || size < LCM_DELTA_HEADER_SIZE + 2)
+    {
+        return false;
+    }
+
+    int outSize = bytes[2] | bytes[3] << 8;
+    int keyframeSize = keyframe_.size();
+
+    out->resize(outSize);
+
+    int i = LCM_DELTA_HEADER_SIZE + 2;
+    int o = 0;
+
+    while (i < size)
+    {
+        int control = bytes[i++];
+
+        if (control < 128)
+        {
+            int run = control + 1;
+
+            if (o + run > outSize)
+            {
+                return false;
+            }
+
+            for (int j = o; j < o + run; j++)
+            {
+                (*out)[j] = j < keyframeSize ? keyframe_[j] : 0;
+            }
+            o += run;
+
+        } else {
+            int run = control - 127;
+
+            if (o + run > outSize || i + run > size)
+            {
+                return false;
+            }
+
+            for (int j = 0; j < run; j++, o++)
+            {
+                (*out)[o] = bytes[i + j] ^ (o < keyframeSize ? keyframe_[o] : 0);
+            }
+            i += run;
+        }
+    }
+
+    return o == outSize;
+}
@@ -0,0 +1,70 @@
+#ifndef LCM_DELTA_CODEC_H
+#define LCM_DELTA_CODEC_H
+
+/*
+ * Shrinks messages on channels where each one is a lot like the last (like
+ * pose) before they go over the Xbee.
+ *
+ * Every so often a message goes out whole as a keyframe.  The ones in
+ * between are sent as their XOR with the last keyframe, with the runs of
+ * zeros that leaves squeezed out.  Deltas are against the keyframe rather
+ * than the message before so that losing one doesn't lose the ones after
+ * it: only a lost keyframe costs anything, and just until the next.
+ *
+ * Encoded messages start with a byte for the kind (LCM_DELTA_KEYFRAME or
+ * LCM_DELTA_DELTA) and one for which keyframe it is.  A keyframe is then
+ * the message; a delta is its size (two bytes, little-endian) and then
+ * control bytes: 0 to 127 for that many + 1 zero bytes, and 128 to 255 for
+ * (that - 127) bytes that follow as they are.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+using namespace std;
+
+#define LCM_DELTA_KEYFRAME 0
+#define LCM_DELTA_DELTA 1
+
+#define LCM_DELTA_HEADER_SIZE 2
+
+// messages between keyframes when the channel doesn't say
+#define LCM_DELTA_DEFAULT_KEYFRAME_INTERVAL 20
+
+class LcmDeltaEncoder {
+    public:
+        LcmDeltaEncoder(int keyframe_interval = 0);
+
+        bool IsEnabled() const { return keyframe_interval_ > 0; }
+
+        bool Encode(const void *data, int size, bool force_keyframe, vector<uint8_t> *out);
+
+    private:
+        int keyframe_interval_;
+
+        vector<uint8_t> keyframe_;
+        uint8_t keyframe_number_;
+
+        // messages since the last keyframe, or -1 before the first
+        int since_keyframe_;
+};
+
+class LcmDeltaDecoder {
+    public:
+        LcmDeltaDecoder();
+
+        bool Decode(const void *data, int size, vector<uint8_t> *out);
+
+    private:
+        vector<uint8_t> keyframe_;
+
+        // -1 until we have one
+        int keyframe_number_;
+};
+
+#endif
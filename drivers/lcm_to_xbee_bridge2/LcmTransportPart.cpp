@@ -2,116 +2,442 @@
 
 LcmTransportPart::LcmTransportPart()
 {
-    channelNameLen = -1;
+    in_use = false;
+    finished = false;
+    id = -1;
+    numTotal = 0;
     receivedSoFar = 0;
+    delta = false;
+    recovered = 0;
+    last_used = 0;
+    last_packet_us = 0;
+
+    rawSize_ = 0;
+    channelNameLen_ = 0;
+    fec_k_ = 0;
+    fec_m_ = 0;
 }
 
-LcmTransportPart::LcmTransportPart(mavlink_lcm_transport_t firstMessage)
+/**
+ * Gets ready for a new message, keeping the buffers from the last one.
+ */
+void LcmTransportPart::Start(int id, int numTotal, bool delta, uint64_t stamp)
 {
-    channelNameLen = -1;
+    in_use = true;
+    finished = false;
+    this->id = id;
+    this->numTotal = numTotal;
+    this->delta = delta;
     receivedSoFar = 0;
-    has_been_completed_ = false;
-    
-    AddMessage(firstMessage);
+    recovered = 0;
+    last_used = stamp;
+
+    rawSize_ = 0;
+    channelNameLen_ = 0;
+    fec_k_ = 0;
+    fec_m_ = 0;
+
+    if ((int)buffer_.size() < numTotal * MAVLINK_LCM_PAYLOAD_SIZE)
+    {
+        buffer_.resize(numTotal * MAVLINK_LCM_PAYLOAD_SIZE);
+    }
+
+    received_.assign(numTotal, false);
+    part_size_.assign(numTotal, 0);
 }
 
+/**
+ * Copies a packet into place, or rebuilds a lost one if it's parity.
+ *
+ * @retval false if it's a repeat, doesn't fit this message, or the message
+ *      is already done (it's ignored)
+ */
+bool LcmTransportPart::AddMessage(const mavlink_lcm_transport_t &mavmsg)
+{
+    if (DoComplete() || IsForThis(mavmsg) == false)
+    {
+        return false;
+    }
+
+    if (mavmsg.message_part_counter & LCM_TRANSPORT_PARITY_FLAG)
+    {
+        return AddParity(mavmsg);
+    } else {
+        return AddData(mavmsg);
+    }
+}
 
+bool LcmTransportPart::IsForThis(const mavlink_lcm_transport_t &mavmsg) const
+{
+    return (int)(mavmsg.message_part_total & ~LCM_TRANSPORT_DELTA_FLAG) == numTotal
+        && ((mavmsg.message_part_total & LCM_TRANSPORT_DELTA_FLAG) != 0) == delta;
+}
 
-void LcmTransportPart::AddMessage(mavlink_lcm_transport_t mavmsg)
+bool LcmTransportPart::AddData(const mavlink_lcm_transport_t &mavmsg)
 {
-    id = mavmsg.msg_id;
-    numTotal = mavmsg.message_part_total;
-    
-    receivedSoFar ++;
-    
-    // copy the data in from this message
-    
-    
-    char *thisData = new char[MAVLINK_LCM_PAYLOAD_SIZE];
-    
+    int part = mavmsg.message_part_counter;
+
+    if (part < 0 || part >= numTotal || received_[part])
+    {
+        return false;
+    }
+
     int nameOffset = 0;
-    
+
     // if this is the first message, it will contain the channel name
-    if (mavmsg.message_part_counter == 0)
-    {
-        // since the first data is the string, we can just read a string off which will terminate
-        // at the \0 and then we can ask the string how long it is
-        channelName = mavmsg.payload;
-        
-        channelNameLen = channelName.length() + 1; // + 1 for the \0 at the end of the string
-        //channelName += "-recv";
-        
-        nameOffset = channelNameLen;
-    }
-    
-    memcpy(thisData, mavmsg.payload + nameOffset, mavmsg.payload_size);
-    
-    dataArray[mavmsg.message_part_counter] = thisData;
-    sizeArray[mavmsg.message_part_counter] = mavmsg.payload_size;
-        
-    totalDataSizeSoFar += mavmsg.payload_size;
-    
-    
-}
-
-bool LcmTransportPart::DoComplete()
-{
-    //cout << "do complete (" << receivedSoFar << "/" << numTotal << ")" << endl;
-    
-    // check to see if we have received all of the parts of the message
-    if (receivedSoFar != numTotal)
+    if (part == 0)
+    {
+        nameOffset = strnlen(mavmsg.payload, MAVLINK_LCM_PAYLOAD_SIZE) + 1; // + 1 for the \0 at the end of the string
+    }
+
+    int rawSize = nameOffset + (int)mavmsg.payload_size;
+
+    // every packet but the last is full, which is what lets them go
+    // straight to their place
+    if (nameOffset > MAVLINK_LCM_PAYLOAD_SIZE || rawSize > MAVLINK_LCM_PAYLOAD_SIZE
+        || (part < numTotal - 1 && rawSize != MAVLINK_LCM_PAYLOAD_SIZE))
     {
         return false;
     }
-    
-    int dataLoc = 0;
-    
-    // we have received everything, so build the data array
-    for (int i=0;i<numTotal;i++)
+
+    memcpy(buffer_.data() + part * MAVLINK_LCM_PAYLOAD_SIZE, mavmsg.payload, rawSize);
+
+    SetReceived(part, rawSize);
+
+    if (fec_k_ > 0)
     {
-        memcpy(data + dataLoc, dataArray[i], sizeArray[i]);
-        dataLoc += sizeArray[i];
+        Recover(LcmTransportParityIndex(part, fec_k_, fec_m_));
     }
 
-    has_been_completed_ = true;
     return true;
 }
 
-bool LcmTransportPart::IsThisTheMessageWeJustSent(string channel, const lcm_recv_buf_t *rbuf)
+bool LcmTransportPart::AddParity(const mavlink_lcm_transport_t &mavmsg)
 {
-    // check if this message has been completed
-    if (has_been_completed_ == false)
+    int fec_k = (mavmsg.message_part_counter >> 24) & 0x7f;
+    int fec_m = (mavmsg.message_part_counter >> 16) & 0xff;
+    int parity_index = mavmsg.message_part_counter & 0xffff;
+
+    if (fec_k < 1 || fec_m < 1 || fec_m > fec_k)
     {
         return false;
     }
 
-    // check to see if this is on the same channel
-    if (channel.compare(channelName) != 0)
+    if (fec_k_ == 0)
     {
+        fec_k_ = fec_k;
+        fec_m_ = fec_m;
+
+        int numParity = LcmTransportNumParity(numTotal, fec_k_, fec_m_);
+
+        if ((int)parity_.size() < numParity * MAVLINK_LCM_PAYLOAD_SIZE)
+        {
+            parity_.resize(numParity * MAVLINK_LCM_PAYLOAD_SIZE);
+        }
+
+        parity_received_.assign(numParity, false);
+        parity_size_.assign(numParity, 0);
+
+    } else if (fec_k != fec_k_ || fec_m != fec_m_) {
         return false;
     }
 
-    // check to see if the data size matches
-    if ((int)rbuf->data_size != totalDataSizeSoFar)
+    if (parity_index >= (int)parity_received_.size() || parity_received_[parity_index])
     {
         return false;
     }
-    
-    // check to see if the data matches
-    if (strcmp((char*)rbuf->data, data) == 0)
+
+    memcpy(parity_.data() + parity_index * MAVLINK_LCM_PAYLOAD_SIZE, mavmsg.payload, MAVLINK_LCM_PAYLOAD_SIZE);
+
+    parity_received_[parity_index] = true;
+    parity_size_[parity_index] = mavmsg.payload_size;
+
+    Recover(parity_index);
+
+    return true;
+}
+
+/**
+ * If exactly one of the packets a parity packet covers is missing, XORs
+ * the parity with the rest to get it back.
+ */
+void LcmTransportPart::Recover(int parity_index)
+{
+    if (parity_received_[parity_index] == false)
+    {
+        return;
+    }
+
+    int group_start = parity_index / fec_m_ * fec_k_;
+    int group_end = min(group_start + fec_k_, numTotal);
+
+    int missing = -1;
+
+    for (int i = group_start + parity_index % fec_m_; i < group_end; i += fec_m_)
     {
-        return true;
+        if (received_[i] == false)
+        {
+            if (missing >= 0)
+            {
+                // two gone, nothing to do (yet)
+                return;
+            }
+            missing = i;
+        }
     }
 
-    return false;
-    
+    if (missing < 0)
+    {
+        return;
+    }
+
+    char rebuilt[MAVLINK_LCM_PAYLOAD_SIZE];
+    memcpy(rebuilt, parity_.data() + parity_index * MAVLINK_LCM_PAYLOAD_SIZE, MAVLINK_LCM_PAYLOAD_SIZE);
+
+    int rawSize = parity_size_[parity_index];
+
+    for (int i = group_start + parity_index % fec_m_; i < group_end; i += fec_m_)
+    {
+        if (i == missing)
+        {
+            continue;
+        }
+
+        const char *part = buffer_.data() + i * MAVLINK_LCM_PAYLOAD_SIZE;
+
+        for (int j = 0; j < part_size_[i]; j++)
+        {
+            rebuilt[j] ^= part[j];
+        }
+
+        rawSize ^= part_size_[i];
+    }
+
+    if (rawSize < 0 || rawSize > MAVLINK_LCM_PAYLOAD_SIZE
+        || (missing < numTotal - 1 && rawSize != MAVLINK_LCM_PAYLOAD_SIZE))
+    {
+        // the parity doesn't go with what we have
+        return;
+    }
+
+    if (missing == 0 && (rawSize < 1 || (int)strnlen(rebuilt, rawSize) >= rawSize))
+    {
+        // no end to the channel name
+        return;
+    }
+
+    memcpy(buffer_.data() + missing * MAVLINK_LCM_PAYLOAD_SIZE, rebuilt, rawSize);
+
+    SetReceived(missing, rawSize);
+    recovered ++;
 }
 
-LcmTransportPart::~LcmTransportPart()
+void LcmTransportPart::SetReceived(int part, int rawSize)
 {
-    // zap all the char arrays
-    for (int i=0; i<numTotal; i++)
+    if (part == 0)
     {
-        delete dataArray[i];
+        channelNameLen_ = strnlen(buffer_.data(), rawSize) + 1;
     }
+
+    received_[part] = true;
+    part_size_[part] = rawSize;
+    receivedSoFar ++;
+    rawSize_ += rawSize;
+}
+
+LcmTransportTable::LcmTransportTable()
+{
+    clock_ = 0;
+    next_expire_us_ = 0;
+
+    num_abandoned_ = 0;
+    num_expired_ = 0;
+    num_recovered_ = 0;
+}
+
+/**
+ * Adds a packet to its message, starting a new one if it's the first we've
+ * seen of it.
+ *
+ * @param now_us the time, for giving up on messages that have gone quiet
+ *
+ * @retval the message if that finished it, otherwise NULL.  Release() it
+ *      when done.
+ */
+LcmTransportPart* LcmTransportTable::AddMessage(const mavlink_lcm_transport_t &mavmsg, int64_t now_us)
+{
+    int numTotal = mavmsg.message_part_total & ~LCM_TRANSPORT_DELTA_FLAG;
+
+    if (numTotal == 0 || numTotal > MAX_MESSAGE_PARTS)
+    {
+        return NULL;
+    }
+
+    if (now_us >= next_expire_us_)
+    {
+        Expire(now_us);
+        next_expire_us_ = now_us + LCM_TRANSPORT_EXPIRE_US / 4;
+    }
+
+    clock_ ++;
+
+    int id = mavmsg.msg_id;
+    int start = id & (LCM_TRANSPORT_TABLE_SIZE - 1);
+
+    LcmTransportPart *part = NULL;
+    LcmTransportPart *empty = NULL;
+    LcmTransportPart *oldest = NULL;
+
+    // look at every slot in range, not just up to the first empty one,
+    // since slots free up in any order
+    for (int i = 0; i < LCM_TRANSPORT_MAX_PROBES; i++)
+    {
+        LcmTransportPart *slot = &slots_[(start + i) & (LCM_TRANSPORT_TABLE_SIZE - 1)];
+
+        if ((slot->in_use || slot->finished) && slot->id == id)
+        {
+            if (slot->finished)
+            {
+                // a packet we didn't need
+                return NULL;
+            }
+
+            part = slot;
+            break;
+
+        } else if (slot->in_use == false) {
+            if (empty == NULL)
+            {
+                empty = slot;
+            }
+        } else if (oldest == NULL || slot->last_used < oldest->last_used) {
+            oldest = slot;
+        }
+    }
+
+    if (part == NULL)
+    {
+        if (empty != NULL)
+        {
+            part = empty;
+        } else {
+            // some of that one's packets must have been lost
+            part = oldest;
+            num_abandoned_ ++;
+        }
+
+        part->Start(id, numTotal, (mavmsg.message_part_total & LCM_TRANSPORT_DELTA_FLAG) != 0, clock_);
+    }
+
+    if (part->AddMessage(mavmsg) == false)
+    {
+        return NULL;
+    }
+
+    part->last_used = clock_;
+    part->last_packet_us = now_us;
+
+    if (part->DoComplete() == false)
+    {
+        return NULL;
+    }
+
+    if (part->recovered > 0)
+    {
+        num_recovered_ ++;
+    }
+
+    return part;
+}
+
+void LcmTransportTable::Release(LcmTransportPart *part)
+{
+    part->in_use = false;
+    part->finished = true;
+}
+
+/**
+ * Frees the slots of messages that haven't had a packet in
+ * LCM_TRANSPORT_EXPIRE_US, and forgets finished ones that long ago.
+ */
+void LcmTransportTable::Expire(int64_t now_us)
+{
+    for (int i = 0; i < LCM_TRANSPORT_TABLE_SIZE; i++)
+    {
+        LcmTransportPart *slot = &slots_[i];
+
+        if (now_us - slot->last_packet_us <= LCM_TRANSPORT_EXPIRE_US)
+        {
+            continue;
+        }
+
+        if (slot->in_use)
+        {
+            slot->in_use = false;
+            num_expired_ ++;
+        }
+
+        slot->finished = false;
+    }
+}
+
+LcmEchoFilter::LcmEchoFilter()
+{
+    memset(hashes_, 0, sizeof(hashes_));
+    next_ = 0;
+}
+
+/**
+ * FNV-1a of the channel (with its \0) and data.  Never 0.
+ */
+uint64_t LcmEchoFilter::Hash(const char *channel, const void *data, int size)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    const uint8_t *bytes = (const uint8_t*)channel;
+
+    do
+    {
+        hash = (hash ^ *bytes) * 1099511628211ULL;
+    } while (*bytes++ != 0);
+
+    bytes = (const uint8_t*)data;
+
+    for (int i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+
+    return hash != 0 ? hash : 1;
+}
+
+/**
+ * Remembers a message we're about to publish.  The oldest is forgotten
+ * once there are LCM_TRANSPORT_MAX_ECHOES.
+ */
+void LcmEchoFilter::Add(const char *channel, const void *data, int size)
+{
+    hashes_[next_] = Hash(channel, data, size);
+
+    next_ = (next_ + 1) % LCM_TRANSPORT_MAX_ECHOES;
+}
+
+/**
+ * @retval true if we published this message (and it's forgotten, so the
+ *      next copy of it goes through)
+ */
+bool LcmEchoFilter::Remove(const char *channel, const void *data, int size)
+{
+    uint64_t hash = Hash(channel, data, size);
+
+    for (int i = 0; i < LCM_TRANSPORT_MAX_ECHOES; i++)
+    {
+        if (hashes_[i] == hash)
+        {
+            hashes_[i] = 0;
+            return true;
+        }
+    }
+
+    return false;
 }
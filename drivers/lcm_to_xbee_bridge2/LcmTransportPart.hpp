@@ -1,45 +1,199 @@
 #ifndef LCM_TRANSPORT_PART_H
 #define LCM_TRANSPORT_PART_H
 
+/*
+ * Puts LCM messages back together from lcm_transport packets.
+ *
+ * Packet i of a message carries bytes [i * MAVLINK_LCM_PAYLOAD_SIZE, ...)
+ * of (channel name, \0, data), so each packet is copied straight to where
+ * it goes, in whatever order they come in.
+ *
+ * Messages being put together are kept in a fixed table, found by id.
+ * Their buffers are kept when they finish, so once the table has seen
+ * messages of a size it doesn't allocate any more.
+ *
+ * A sender can add parity packets so a message survives losing some of
+ * its packets.  The data packets are split into groups of K, and each
+ * group gets M parity packets: parity packet j is the XOR of the group's
+ * packets j, j + M, j + 2M, ..., so any one of those can be rebuilt from
+ * the rest.  A burst of up to M lost packets in a row is always
+ * recoverable.  Parity packets are marked in message_part_counter (see
+ * LcmTransportParityCounter()), so nothing needs to be set up on this end.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2013
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
 
 #include <string>
 #include <iostream>
 #include <vector>
 #include "../../mavlink-rlg/csailrlg/mavlink.h"
 
-#include <lcm/lcm.h>
-
 using namespace std;
 
 #define MAX_MESSAGE_PARTS 255
 #define MAVLINK_LCM_PAYLOAD_SIZE 124
 
+// messages that can be partway in at once (a power of two, since ids are
+// looked up by their low bits)
+#define LCM_TRANSPORT_TABLE_SIZE 256
+
+// slots after an id's own that it can go in.  When they're all taken, the
+// one that's waited longest is given up on.
+#define LCM_TRANSPORT_MAX_PROBES 8
+
+// a message that hasn't had a packet in this long never will
+#define LCM_TRANSPORT_EXPIRE_US 2000000
+
+// messages we've published that we could hear back from LCM
+#define LCM_TRANSPORT_MAX_ECHOES 64
+
+// a parity packet's message_part_counter has this bit set, the group size
+// (K) in bits 24-30, the parity packets per group (M) in bits 16-23, and
+// which parity packet it is in the low 16 bits
+#define LCM_TRANSPORT_PARITY_FLAG 0x80000000u
+
+#define LCM_TRANSPORT_MAX_FEC_GROUP 127
+
+// set in message_part_total on every packet of a message that's been
+// delta encoded (see LcmDeltaCodec.hpp)
+#define LCM_TRANSPORT_DELTA_FLAG 0x80000000u
+
+inline uint32_t LcmTransportParityCounter(int fec_k, int fec_m, int parity_index)
+{
+    return LCM_TRANSPORT_PARITY_FLAG | (uint32_t)fec_k << 24 | (uint32_t)fec_m << 16 | (uint32_t)parity_index;
+}
+
+// parity packets a message of num_parts packets gets
+inline int LcmTransportNumParity(int num_parts, int fec_k, int fec_m)
+{
+    return (num_parts + fec_k - 1) / fec_k * fec_m;
+}
+
+// the parity packet that covers data packet part
+inline int LcmTransportParityIndex(int part, int fec_k, int fec_m)
+{
+    return part / fec_k * fec_m + part % fec_k % fec_m;
+}
+
 class LcmTransportPart {
-    public: 
+    public:
         LcmTransportPart();
-        LcmTransportPart(mavlink_lcm_transport_t firstMessage);
-        ~LcmTransportPart();
-    
-        std::string channelName;
+
+        void Start(int id, int numTotal, bool delta, uint64_t stamp);
+
+        bool AddMessage(const mavlink_lcm_transport_t &mavmsg);
+
+        bool DoComplete() const { return receivedSoFar == numTotal; }
+
+        // valid once DoComplete()
+        const char* GetChannel() const { return buffer_.data(); }
+        const char* GetData() const { return buffer_.data() + channelNameLen_; }
+        int GetDataSize() const { return rawSize_ - channelNameLen_; }
+
+        bool in_use;
+
+        // done and published, but remembered so late packets (like parity
+        // that wasn't needed) don't start it again
+        bool finished;
+
         int id;
         int numTotal;
-        
         int receivedSoFar;
-        char data[MAX_MESSAGE_PARTS*MAVLINK_LCM_PAYLOAD_SIZE];
-        
-        int totalDataSizeSoFar;
 
-        void AddMessage(mavlink_lcm_transport_t mavmsg);
-        
-        bool DoComplete();
+        // the data needs an LcmDeltaDecoder
+        bool delta;
+
+        // packets rebuilt from parity
+        int recovered;
+
+        // when it last got a packet (LcmTransportTable's count and the time)
+        uint64_t last_used;
+        int64_t last_packet_us;
+
+    private:
+        bool AddData(const mavlink_lcm_transport_t &mavmsg);
+        bool AddParity(const mavlink_lcm_transport_t &mavmsg);
+
+        void Recover(int parity_index);
+        void SetReceived(int part, int rawSize);
+
+        bool IsForThis(const mavlink_lcm_transport_t &mavmsg) const;
+
+        // packet i at i * MAVLINK_LCM_PAYLOAD_SIZE
+        vector<char> buffer_;
+        vector<bool> received_;
+
+        // bytes in each packet, channel name included
+        vector<int> part_size_;
+
+        // bytes of buffer_ filled in, channel name included
+        int rawSize_;
+
+        // including the \0, or 0 until the first packet is in
+        int channelNameLen_;
+
+        // 0 until a parity packet comes in
+        int fec_k_;
+        int fec_m_;
+
+        vector<char> parity_;
+        vector<bool> parity_received_;
+
+        // the XOR of the sizes of the packets each parity packet covers
+        vector<int> parity_size_;
+};
+
+class LcmTransportTable {
+    public:
+        LcmTransportTable();
+
+        LcmTransportPart* AddMessage(const mavlink_lcm_transport_t &mavmsg, int64_t now_us);
+
+        void Release(LcmTransportPart *part);
+
+        int64_t GetNumAbandoned() const { return num_abandoned_; }
+        int64_t GetNumExpired() const { return num_expired_; }
+        int64_t GetNumRecovered() const { return num_recovered_; }
+
+    private:
+        void Expire(int64_t now_us);
+
+        LcmTransportPart slots_[LCM_TRANSPORT_TABLE_SIZE];
+
+        // goes up with every packet, to tell which message is oldest
+        uint64_t clock_;
+
+        int64_t next_expire_us_;
+
+        // messages pushed out for newer ones, dropped for having gone
+        // quiet, and saved by parity
+        int64_t num_abandoned_;
+        int64_t num_expired_;
+        int64_t num_recovered_;
+};
+
+/**
+ * Remembers what we've published so we can tell when LCM hands it back to
+ * us, by a hash of the channel and data.
+ */
+class LcmEchoFilter {
+    public:
+        LcmEchoFilter();
+
+        void Add(const char *channel, const void *data, int size);
+
+        bool Remove(const char *channel, const void *data, int size);
 
-        bool IsThisTheMessageWeJustSent(string channel, const lcm_recv_buf_t *rbuf);
-        
     private:
-        int channelNameLen;
-        char* dataArray[MAX_MESSAGE_PARTS];
-        int sizeArray[MAX_MESSAGE_PARTS];
-        bool has_been_completed_;
+        static uint64_t Hash(const char *channel, const void *data, int size);
+
+        // 0 for an empty entry
+        uint64_t hashes_[LCM_TRANSPORT_MAX_ECHOES];
+        int next_;
 };
 
 #endif
@@ -0,0 +1,414 @@
+#include "XbeeSendScheduler.hpp"
+
+#include <errno.h>
+
+#include "../../utils/utils/Clock.hpp"
+
+/**
+ * @param fd serial port to write to
+ * @param baud_rate the port's baud rate (8N1, so a tenth of it is bytes)
+ * @param system_id MAVLink system id to send from
+ */
+XbeeSendScheduler::XbeeSendScheduler(int fd, int baud_rate, uint8_t system_id) {
+    fd_ = fd;
+    system_id_ = system_id;
+
+    bytes_per_second_ = XBEE_RATE_FRACTION * baud_rate / 10.0;
+    tokens_ = XBEE_BURST_BYTES;
+    last_refill_us_ = NowMicroseconds();
+
+    next_id_ = 0;
+    last_served_ = -1;
+
+    started_ = false;
+    shutting_down_ = false;
+}
+
+XbeeSendScheduler::~XbeeSendScheduler() {
+
+    if (started_ == false) {
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(mutex_);
+        shutting_down_ = true;
+    }
+
+    cv_new_message_.notify_one();
+
+    pthread_join(thread_, NULL);
+}
+
+/**
+ * Sets up a channel.  Call for every channel before Start().
+ *
+ * @param channel LCM channel
+ * @param priority 0 is sent first, then 1, ...
+ * @param latest_only true to only keep the newest unsent message (for
+ *      state like pose, where an old one is no use)
+ * @param fec_k data packets in each parity group, or 0 for no parity
+ * @param fec_m parity packets per group (up to fec_k): a run of this many
+ *      lost packets can be rebuilt
+ * @param keyframe_interval delta encode, sending a whole message at least
+ *      this often, or 0 to send messages as they are
+ */
+void XbeeSendScheduler::AddChannel(const string &channel, int priority, bool latest_only, int fec_k, int fec_m,
+    int keyframe_interval) {
+
+    XbeeChannelQueue queue;
+
+    queue.channel = channel;
+    queue.priority = priority;
+    queue.latest_only = latest_only;
+    queue.fec_k = fec_k > 0 && fec_m > 0 ? min(fec_k, LCM_TRANSPORT_MAX_FEC_GROUP) : 0;
+    queue.fec_m = queue.fec_k > 0 ? min(fec_m, queue.fec_k) : 0;
+    queue.delta = LcmDeltaEncoder(keyframe_interval);
+    queue.force_keyframe = false;
+    queue.num_sent = 0;
+    queue.num_dropped = 0;
+
+    queue_indices_[channel] = queues_.size();
+    queues_.push_back(queue);
+}
+
+void XbeeSendScheduler::Start() {
+    started_ = true;
+
+    pthread_create(&thread_, NULL, WriterThread, this);
+}
+
+/**
+ * Queues a message to send.  Never blocks on the serial port.  Call from
+ * one thread (the LCM thread).
+ *
+ * @param channel LCM channel (added with AddChannel())
+ * @param data encoded LCM message
+ * @param size its size
+ */
+void XbeeSendScheduler::Enqueue(const char *channel, const void *data, int size) {
+
+    auto index = queue_indices_.find(channel);
+
+    if (index == queue_indices_.end()) {
+        return;
+    }
+
+    // only this thread changes the settings or the encoder, so they're
+    // safe to use without the lock
+    XbeeChannelQueue &queue = queues_[index->second];
+
+    XbeeOutgoingMessage msg;
+    uint32_t totalFlags = 0;
+
+    msg.keyframe = false;
+
+    if (queue.delta.IsEnabled()) {
+        bool force_keyframe;
+
+        {
+            lock_guard<mutex> lock(mutex_);
+            force_keyframe = queue.force_keyframe;
+            queue.force_keyframe = false;
+        }
+
+        msg.keyframe = queue.delta.Encode(data, size, force_keyframe, &encoded_);
+
+        data = encoded_.data();
+        size = encoded_.size();
+        totalFlags = LCM_TRANSPORT_DELTA_FLAG;
+    }
+
+    // pack it before taking the lock
+    BuildPackets(channel, data, size, totalFlags, queue.fec_k, queue.fec_m, &msg);
+
+    {
+        lock_guard<mutex> lock(mutex_);
+
+        if (queue.latest_only) {
+            // anything that hasn't started going out is out of date
+            while (queue.messages.size() > 0 && queue.messages.back().next_packet == 0) {
+                Drop(&queue, queue.messages.size() - 1);
+            }
+        }
+
+        if (queue.messages.size() >= XBEE_MAX_QUEUED_MESSAGES) {
+            // the radio isn't keeping up with this channel: drop the
+            // oldest, unless it's partway out
+            Drop(&queue, queue.messages.front().next_packet > 0 ? 1 : 0);
+        }
+
+        queue.messages.push_back(std::move(msg));
+    }
+
+    cv_new_message_.notify_one();
+}
+
+/**
+ * Takes a message out of a queue before it's (all) sent.  Call with mutex_
+ * held.
+ */
+void XbeeSendScheduler::Drop(XbeeChannelQueue *queue, int index) {
+
+    if (queue->messages[index].keyframe) {
+        // the deltas after it are no good without it
+        queue->force_keyframe = true;
+    }
+
+    queue->messages.erase(queue->messages.begin() + index);
+    queue->num_dropped ++;
+}
+
+/**
+ * Breaks an LCM message into lcm_transport packets: the first one starts
+ * with the channel name, and each carries up to MAVLINK_LCM_PAYLOAD_SIZE
+ * bytes.  Parity packets, if any, go after the data.  Only the LCM thread
+ * calls this, so next_id_ isn't shared.
+ */
+void XbeeSendScheduler::BuildPackets(const char *channel, const void *data, int size, uint32_t totalFlags, int fec_k, int fec_m,
+    XbeeOutgoingMessage *msg) {
+
+    int channelStringLength = strlen(channel) + 1; // + 1 for the \0 at the end of the string
+    int totalBytes = size + channelStringLength;
+    int numMessagesNeeded = totalBytes / MAVLINK_LCM_PAYLOAD_SIZE + 1;
+
+    char payload[MAVLINK_LCM_PAYLOAD_SIZE];
+    int payloadSize, payloadStart;
+    int bufferLocation = 0;
+
+    const char *buffer = (const char*) data;
+
+    int64_t timestamp = GetWallNow();
+
+    int numParity = fec_k > 0 ? LcmTransportNumParity(numMessagesNeeded, fec_k, fec_m) : 0;
+
+    // each parity packet's data, and the XOR of the sizes of what it covers
+    vector<char> parity(numParity * MAVLINK_LCM_PAYLOAD_SIZE, 0);
+    vector<int> paritySize(numParity, 0);
+
+    msg->packets.resize(numMessagesNeeded + numParity);
+    msg->next_packet = 0;
+
+    for (int i = 0; i < numMessagesNeeded; i++)
+    {
+        if (i == 0 && numMessagesNeeded == 1)
+        {
+            // first and last message
+            payloadSize = size;
+            payloadStart = channelStringLength;
+            strcpy(payload, channel);
+
+        } else if (i == 0) {
+            // first but not last message
+            payloadSize = MAVLINK_LCM_PAYLOAD_SIZE - channelStringLength;
+            payloadStart = channelStringLength;
+            strcpy(payload, channel);
+
+        } else if (i == numMessagesNeeded - 1) {
+            // not the first, but is the last message
+            payloadSize = size - bufferLocation;
+            payloadStart = 0;
+        } else {
+            // not the first or the last message
+            payloadSize = MAVLINK_LCM_PAYLOAD_SIZE;
+            payloadStart = 0;
+        }
+
+        memcpy(payload + payloadStart, buffer + bufferLocation, payloadSize);
+        bufferLocation += payloadSize;
+
+        if (numParity > 0)
+        {
+            int p = LcmTransportParityIndex(i, fec_k, fec_m);
+            char *parityPayload = &parity[p * MAVLINK_LCM_PAYLOAD_SIZE];
+
+            for (int j = 0; j < payloadStart + payloadSize; j++)
+            {
+                parityPayload[j] ^= payload[j];
+            }
+            paritySize[p] ^= payloadStart + payloadSize;
+        }
+
+        PackPacket(timestamp, i, numMessagesNeeded | totalFlags, payloadSize, payload, &msg->packets[i]);
+    }
+
+    for (int p = 0; p < numParity; p++)
+    {
+        if (p % fec_m >= numMessagesNeeded - p / fec_m * fec_k)
+        {
+            // the last group is too short for this one to cover anything
+            continue;
+        }
+
+        PackPacket(timestamp, LcmTransportParityCounter(fec_k, fec_m, p), numMessagesNeeded | totalFlags, paritySize[p],
+            &parity[p * MAVLINK_LCM_PAYLOAD_SIZE], &msg->packets[numMessagesNeeded + p]);
+    }
+
+    // drop the ones skipped
+    msg->packets.erase(remove_if(msg->packets.begin() + numMessagesNeeded, msg->packets.end(),
+        [](const vector<uint8_t> &packet) { return packet.empty(); }), msg->packets.end());
+
+    next_id_++;
+    if (next_id_ > 65535)
+    {
+        next_id_ = 0;
+    }
+}
+
+void XbeeSendScheduler::PackPacket(int64_t timestamp, uint32_t part, uint32_t numParts, int payloadSize, const char *payload, vector<uint8_t> *packet) {
+
+    mavlink_message_t mavmsg;
+
+    mavlink_msg_lcm_transport_pack(
+        system_id_,
+        201,
+        &mavmsg,
+        (int32_t) timestamp,            // timestamp
+        next_id_,                       // ID for this message
+        part,                           // which message this is
+        numParts,                       // total messages required
+        payloadSize,                    // size of this payload
+        payload);                       // payload data
+
+    packet->resize(MAVLINK_MAX_PACKET_LEN);
+    packet->resize(mavlink_msg_to_send_buffer(packet->data(), &mavmsg));
+}
+
+void* XbeeSendScheduler::WriterThread(void *x) {
+    ((XbeeSendScheduler*) x)->RunWriter();
+
+    return NULL;
+}
+
+/**
+ * Sends packets as they're queued, most important channel first.
+ */
+void XbeeSendScheduler::RunWriter() {
+
+    vector<uint8_t> packet;
+
+    while (true) {
+        int channel_index;
+
+        {
+            unique_lock<mutex> lock(mutex_);
+
+            while ((channel_index = PickChannel()) < 0 && shutting_down_ == false) {
+                cv_new_message_.wait(lock);
+            }
+
+            if (channel_index < 0) {
+                return;
+            }
+
+            XbeeChannelQueue &queue = queues_[channel_index];
+            XbeeOutgoingMessage &msg = queue.messages.front();
+
+            // copy it out so Enqueue() can change the queue while it's
+            // being written
+            packet.swap(msg.packets[msg.next_packet]);
+            msg.next_packet ++;
+
+            if (msg.next_packet >= (int)msg.packets.size()) {
+                queue.messages.pop_front();
+                queue.num_sent ++;
+            }
+
+            last_served_ = channel_index;
+        }
+
+        WaitForTokens(packet.size());
+
+        if (WriteAll(packet.data(), packet.size()) != true) {
+            fprintf(stderr, "\nERROR: Unable to send message over serial port.\n");
+        }
+    }
+}
+
+/**
+ * @retval the index of the channel to send from next, or -1 if nothing is
+ *      queued.  Call with mutex_ held.
+ */
+int XbeeSendScheduler::PickChannel() {
+
+    int num_queues = queues_.size();
+    int best = -1;
+
+    // start after the last one served, so ties go around in turn
+    for (int i = 1; i <= num_queues; i++) {
+        int index = (last_served_ + i) % num_queues;
+
+        if (queues_[index].messages.empty()) {
+            continue;
+        }
+
+        if (best < 0 || queues_[index].priority < queues_[best].priority) {
+            best = index;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Sleeps until the radio can take bytes more.
+ */
+void XbeeSendScheduler::WaitForTokens(int bytes) {
+
+    while (true) {
+        int64_t now = NowMicroseconds();
+
+        tokens_ += (now - last_refill_us_) * bytes_per_second_ / 1000000.0;
+        last_refill_us_ = now;
+
+        // a full packet can always go once the bucket is full
+        double burst = XBEE_BURST_BYTES > bytes ? XBEE_BURST_BYTES : bytes;
+
+        if (tokens_ > burst) {
+            tokens_ = burst;
+        }
+
+        if (tokens_ >= bytes) {
+            tokens_ -= bytes;
+            return;
+        }
+
+        usleep((bytes - tokens_) / bytes_per_second_ * 1000000.0 + 1);
+    }
+}
+
+bool XbeeSendScheduler::WriteAll(const uint8_t *data, int size) {
+
+    while (size > 0) {
+        int written = write(fd_, data, size);
+
+        if (written < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            return false;
+        }
+
+        data += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+/**
+ * Prints how many messages each channel has sent and dropped.
+ */
+void XbeeSendScheduler::PrintStats(FILE *out) {
+
+    lock_guard<mutex> lock(mutex_);
+
+    for (const XbeeChannelQueue &queue : queues_) {
+        fprintf(out, "\t%s (priority %d%s%s): sent %ld, dropped %ld, queued %d\n", queue.channel.c_str(), queue.priority,
+            queue.latest_only ? ", latest only" : "", queue.delta.IsEnabled() ? ", delta" : "", (long)queue.num_sent, (long)queue.num_dropped, (int)queue.messages.size());
+    }
+}
+
+int64_t XbeeSendScheduler::NowMicroseconds() {
+    return GetRawMonotonicNow();
+}
@@ -0,0 +1,165 @@
+#ifndef XBEE_SEND_SCHEDULER_H
+#define XBEE_SEND_SCHEDULER_H
+
+/*
+ * Decides what goes out over the Xbee next, and sends it from its own
+ * thread so the LCM thread never blocks on the serial port.
+ *
+ * Each channel has a priority (0 is the most important) and a queue of
+ * messages, already broken into MAVLink packets.  The writer sends one
+ * packet at a time from the most important channel that has something
+ * queued (taking turns between channels with the same priority), so a big
+ * message only holds up telemetry for one packet.  The receiver puts
+ * messages back together by id, so packets from different messages can be
+ * mixed.
+ *
+ * Writes are held to what the radio can send (a token bucket filled at
+ * the baud rate), so packets wait here, where they can still be
+ * reordered, instead of in the serial driver's buffer.
+ *
+ * Channels marked latest-only (like pose) keep just the newest message
+ * that hasn't started going out: a newer one replaces it.
+ *
+ * Channels can also send parity packets after each message's data, so the
+ * other end can rebuild a few lost packets instead of losing the whole
+ * message (see LcmTransportPart.hpp), and can be delta encoded (see
+ * LcmDeltaCodec.hpp).  If a keyframe is dropped before it goes out, the
+ * channel's next message is a keyframe.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "../../mavlink-rlg/csailrlg/mavlink.h"
+
+#include "LcmTransportPart.hpp" // for MAVLINK_LCM_PAYLOAD_SIZE
+#include "LcmDeltaCodec.hpp"
+
+using namespace std;
+
+// messages a channel can have queued before the oldest is dropped
+#define XBEE_MAX_QUEUED_MESSAGES 8
+
+// fraction of the baud rate to use, leaving room for the radio's own
+// overhead
+#define XBEE_RATE_FRACTION 0.9
+
+// most bytes that can go out back-to-back (about one packet)
+#define XBEE_BURST_BYTES MAVLINK_MAX_PACKET_LEN
+
+// priority for channels that don't say
+#define XBEE_DEFAULT_PRIORITY 1
+
+/**
+ * One LCM message, packed into MAVLink packets.
+ */
+struct XbeeOutgoingMessage {
+    vector< vector<uint8_t> > packets;
+
+    // the next one to send
+    int next_packet;
+
+    // a delta encoding keyframe
+    bool keyframe;
+};
+
+struct XbeeChannelQueue {
+    string channel;
+
+    int priority;
+    bool latest_only;
+
+    // parity packets for every fec_m of every fec_k data packets, or 0 for
+    // none
+    int fec_k;
+    int fec_m;
+
+    // only the LCM thread uses it
+    LcmDeltaEncoder delta;
+
+    // a keyframe was dropped, so the next message has to be one
+    bool force_keyframe;
+
+    deque<XbeeOutgoingMessage> messages;
+
+    int64_t num_sent;
+    int64_t num_dropped;
+};
+
+class XbeeSendScheduler {
+
+    public:
+        XbeeSendScheduler(int fd, int baud_rate, uint8_t system_id);
+        ~XbeeSendScheduler();
+
+        void AddChannel(const string &channel, int priority, bool latest_only, int fec_k = 0, int fec_m = 0,
+            int keyframe_interval = 0);
+
+        void Enqueue(const char *channel, const void *data, int size);
+
+        void Start();
+
+        void PrintStats(FILE *out);
+
+    private:
+        static void* WriterThread(void *x);
+        void RunWriter();
+
+        int PickChannel();
+        void Drop(XbeeChannelQueue *queue, int index);
+        void WaitForTokens(int bytes);
+        bool WriteAll(const uint8_t *data, int size);
+
+        void BuildPackets(const char *channel, const void *data, int size, uint32_t totalFlags, int fec_k, int fec_m,
+            XbeeOutgoingMessage *msg);
+        void PackPacket(int64_t timestamp, uint32_t part, uint32_t numParts, int payloadSize, const char *payload, vector<uint8_t> *packet);
+
+        static int64_t NowMicroseconds();
+
+        int fd_;
+        uint8_t system_id_;
+
+        double bytes_per_second_;
+        double tokens_;
+        int64_t last_refill_us_;
+
+        // the id of the next message (wraps at 65535).  Only Enqueue()
+        // uses it.
+        int next_id_;
+
+        // delta encoded messages, reused (only Enqueue() uses it)
+        vector<uint8_t> encoded_;
+
+        // everything below is shared with the writer thread
+        mutex mutex_;
+        condition_variable cv_new_message_;
+
+        vector<XbeeChannelQueue> queues_;
+        map<string, int> queue_indices_;
+
+        // the channel served last, so ones with the same priority take
+        // turns
+        int last_served_;
+
+        pthread_t thread_;
+        bool started_;
+        atomic<bool> shutting_down_;
+};
+
+#endif
@@ -31,6 +31,9 @@ using namespace std;
 #include "mavconn.h" // from mavconn
 
 #include "LcmTransportPart.hpp" // for message size defines
+#include "XbeeSendScheduler.hpp"
+#include "LcmDeltaCodec.hpp"
+#include "../../utils/BufferedSerialReader/BufferedSerialReader.hpp"
     
 #include <string>
 
@@ -44,20 +47,17 @@ using namespace std;
 #include <inttypes.h>
 #include <fstream>
 #include <mutex>
+#include "../../utils/utils/Clock.hpp"
 
 #define BAUD_RATE 57600
 
 #define MAX_CHANNELS 255
 
-#define MAX_HOLDING_MESSAGES 255
-
 map<string, int> downsampleAmounts;
 map<string, int> downsampleCounters;
 
 lcm_subscription_t* lcm_sub_array[MAX_CHANNELS];
 
-int globalId = 0;
-
 
 lcm_t * lcm;
 
@@ -71,30 +71,43 @@ mav_pose_t_subscription_t *pose_sub;
 
 uint8_t systemID = getSystemID();
 
-uint8_t serialBuffer[MAVLINK_MAX_PACKET_LEN];
-
 int serialPort_fd;
 
+XbeeSendScheduler *send_scheduler = NULL;
+
 int open_port(char *port);
 bool setup_port(int fd, int baud, int data_bits, int stop_bits, bool parity, bool hardware_control);
 void close_port(int fd);
-void* serial_wait(void* serial_ptr);
+void serial_wait(BufferedSerialReader *reader, mavlink_status_t *lastStatus);
 
-LcmTransportPart* globalHoldingArray[MAX_HOLDING_MESSAGES];
-int globalNextMessageSlot = 0;
+// messages coming in from the Xbee (only the serial thread uses these)
+LcmTransportTable incoming_messages;
+map<string, LcmDeltaDecoder> delta_decoders;
+vector<uint8_t> decoded_message;
+int64_t num_undecodable = 0;
 
-mutex holding_array_mutex;
+// messages we've published on channels we also send, which LCM will hand
+// back to message_handler
+LcmEchoFilter echo_filter;
+mutex echo_filter_mutex;
 
 
 static void usage(void)
 {
-        fprintf(stderr, "usage: lcm-to-xbee-bridge2 xbee-device channel1 downsample1 [channel2 downsample2] [channel3 downsample3...]\n");
+        fprintf(stderr, "usage: lcm-to-xbee-bridge2 xbee-device channel1 downsample1[:priority1[:latest][:fecK/M][:delta[N]]] [channel2 downsample2] [channel3 downsample3...]\n");
         fprintf(stderr, "    xbee-device: Location of the Xbee (often /dev/ttyUSB0)\n");
         fprintf(stderr, "    channels: LCM channel to transfer over Xbee\n");
         fprintf(stderr, "    downsample: Messages to skip, aka if 2, then send a message, skip 2, send another\n");
         fprintf(stderr, "    \tset to 0 to send all messages\n");
+        fprintf(stderr, "    priority: 0 goes out first, then 1, ... (default %d)\n", XBEE_DEFAULT_PRIORITY);
+        fprintf(stderr, "    latest: only send the newest message on the channel, dropping older\n");
+        fprintf(stderr, "    \tones that haven't gone out yet (for state, like pose)\n");
+        fprintf(stderr, "    fecK/M: after each message, send M parity packets for every K data packets,\n");
+        fprintf(stderr, "    \tso the other end can rebuild up to M lost packets in a row (M <= K <= %d)\n", LCM_TRANSPORT_MAX_FEC_GROUP);
+        fprintf(stderr, "    deltaN: send messages as changes from a whole one sent every N (default %d),\n", LCM_DELTA_DEFAULT_KEYFRAME_INTERVAL);
+        fprintf(stderr, "    \tfor channels where each message is a lot like the last\n");
         fprintf(stderr, "  example:\n");
-        fprintf(stderr, "    ./lcm-to-xbee-bridge2 /dev/ttyUSB0 STATE_ESTIMATOR_POSE 15 TIMESYNC 0\n");
+        fprintf(stderr, "    ./lcm-to-xbee-bridge2 /dev/ttyUSB0 STATE_ESTIMATOR_POSE 15:0:latest:delta TIMESYNC 0 stereo-compact 10:2:fec8/2\n");
 }
 
 
@@ -102,6 +115,16 @@ void sighandler(int dum)
 {
     printf("\nClosing... ");
 
+    if (send_scheduler != NULL)
+    {
+        printf("\n");
+        send_scheduler->PrintStats(stdout);
+    }
+
+    printf("\tincoming messages given up on: %ld pushed out, %ld expired, %ld missing their keyframe | rebuilt from parity: %ld\n",
+        (long)incoming_messages.GetNumAbandoned(), (long)incoming_messages.GetNumExpired(), (long)num_undecodable,
+        (long)incoming_messages.GetNumRecovered());
+
     for (int i=0; i < (int)downsampleAmounts.size(); i++)
     {
         lcm_unsubscribe (lcm, lcm_sub_array[i]);
@@ -116,56 +139,19 @@ void sighandler(int dum)
     exit(0);
 }
 
-int64_t getTimestampNow()
-{
-    struct timeval thisTime;
-    gettimeofday(&thisTime, NULL);
-    return (thisTime.tv_sec * 1000000.0) + (float)thisTime.tv_usec + 0.5;
-}
-
-int GetMessageIndex(int id)
-{
-    for (int i=0;i<MAX_HOLDING_MESSAGES; i++)
-    {
-        if (globalHoldingArray[i] != NULL && id == globalHoldingArray[i]->id)
-        {
-            return i;
-        }
-    }
-    return -1;
-}
-
-// returns the message index if we just sent it, otherwise returns -1
-int DidWeJustSendThatMessage(string channel, const lcm_recv_buf_t *rbuf)
-{
-    for (int i=0;i<MAX_HOLDING_MESSAGES; i++)
-    {
-        if (globalHoldingArray[i] != NULL && globalHoldingArray[i]->IsThisTheMessageWeJustSent(channel, rbuf) == true)
-        {
-            return i;
-        }
-    }
-    return -1;
-}
-
-
-
 void message_handler(const lcm_recv_buf_t *rbuf, const char* channel, void *userdata)
 {
     // we know that we will fire on every message we send,
     // so if we just sent a message on this channel, we should ignore it.
-    holding_array_mutex.lock();
-    int sent_ind = DidWeJustSendThatMessage(channel, rbuf);
-    if (sent_ind >= 0)
+    echo_filter_mutex.lock();
+    bool echo = echo_filter.Remove(channel, rbuf->data, rbuf->data_size);
+    echo_filter_mutex.unlock();
+
+    if (echo)
     {
         // we just sent this message, don't do anything
-        
-        // go ahead and zap it from the list
-        delete globalHoldingArray[sent_ind];
-        holding_array_mutex.unlock();
         return;
     }
-    holding_array_mutex.unlock();
 
 
     //
@@ -178,92 +164,9 @@ void message_handler(const lcm_recv_buf_t *rbuf, const char* channel, void *user
     } else {
         downsampleCounters.at(channel) = 0;
     }
-    
-    
-    
-    
-    // first, break up the LCM message into a few different parts (if needed)
-    int channelStringLength = strlen(channel) + 1; // + 1 for the \0 at the end of the string
-    int totalBytes = rbuf->data_size + channelStringLength;
-    int numMessagesNeeded = totalBytes / MAVLINK_LCM_PAYLOAD_SIZE + 1;
-    
-    char payload[MAVLINK_LCM_PAYLOAD_SIZE];
-    int payloadSize, payloadStart;
-    int bufferLocation = 0;
-    
-    // we cast the void* to a char* so that we can do arithmetic on it
-    char *buffer = (char*) rbuf->data;
-    
-    
-    for (int i=0; i < numMessagesNeeded; i++)
-    {
-        // send a message with this part of the message
-        // send the message via Xbee
-        printf("sending on %s (%d/%d)\n", channel, i+1, numMessagesNeeded);
-        
-        //if this is the first message, we add the channel name to it
-        if (i == 0 && numMessagesNeeded == 1)
-        {
-            // first and last message
-            payloadSize = rbuf->data_size;
-            payloadStart = channelStringLength;
-            //memcpy(&payload, channel, channelStringLength); // copy in the channel name
-            strcpy(payload, channel);
-            
-        } else if (i == 0) {
-            // first but not last message
-            payloadSize = MAVLINK_LCM_PAYLOAD_SIZE - channelStringLength;
-            payloadStart = channelStringLength;
-            //memcpy(&payload, channel, channelStringLength); // copy in the channel name
-            strcpy(payload, channel);
-            
-        } else if (i == numMessagesNeeded - 1) {
-            // not the first, but is the last message
-            payloadSize = rbuf->data_size - bufferLocation;
-            payloadStart = 0;
-        } else {
-            // not the first or the last message
-            payloadSize = MAVLINK_LCM_PAYLOAD_SIZE;
-            payloadStart = 0;
-            
-        }
-        
-        // copy in the relavent payload
-        memcpy(payload + payloadStart, buffer + bufferLocation, payloadSize);
-        bufferLocation += payloadSize;
-        
-        
-        // build mavlink message
-        mavlink_message_t mavmsg;
-        //printf("sending message on channel %s (%d/%d)\n", channel, i + 1, numMessagesNeeded);
-
-        mavlink_msg_lcm_transport_pack(
-            systemID,   
-            201,
-            &mavmsg,
-		    (int32_t) getTimestampNow(),    // timestamp
-            globalId,                       // ID for this message
-		    i,                              // which message this is
-            numMessagesNeeded,              // total messages required
-            payloadSize,                     // size of this payload
-            payload);                       // payload data
-            
-        int messageLength = mavlink_msg_to_send_buffer(serialBuffer, &mavmsg);
-        int written = write(serialPort_fd, (char*)serialBuffer, messageLength);
 
-        if (written != messageLength)
-        {
-	        fprintf(stderr, "\nERROR: Unable to send message over serial port.\n");
-        }
-            
-    }
-    
-    globalId++;
-    if (globalId > 65535)
-    {
-        globalId = 0;
-    }
-    
+    // the writer thread breaks it up and sends it when its turn comes
+    send_scheduler->Enqueue(channel, rbuf->data, rbuf->data_size);
 }
 
 // called when we just got a message from the serial port
@@ -280,47 +183,43 @@ void sendLcmMessage(mavlink_message_t *message)
             
             mavlink_msg_lcm_transport_decode(message, &transportIn);
             
-            // check to see if we know about this message
-            int index;
-            index = GetMessageIndex(transportIn.msg_id);
-            if (index >= 0)
+            // put it with the rest of its message
+            LcmTransportPart *part;
+            part = incoming_messages.AddMessage(transportIn, GetWallNow());
+
+            if (part != NULL)
             {
-                
-                globalHoldingArray[index]->AddMessage(transportIn);
-                
-            } else {
-                // we don't know about this message yet
-                globalHoldingArray[globalNextMessageSlot] = new LcmTransportPart(transportIn);
-                index = globalNextMessageSlot;
-                globalNextMessageSlot ++;
-                if (globalNextMessageSlot >= MAX_HOLDING_MESSAGES)
+                // that was the last piece, so send the lcm message
+                const void *data = part->GetData();
+                int dataSize = part->GetDataSize();
+
+                if (part->delta)
                 {
-                    globalNextMessageSlot = 0;
+                    if (delta_decoders[part->GetChannel()].Decode(data, dataSize, &decoded_message) == false)
+                    {
+                        // we missed the keyframe it goes with
+                        num_undecodable ++;
+                        incoming_messages.Release(part);
+                        break;
+                    }
+
+                    data = decoded_message.data();
+                    dataSize = decoded_message.size();
                 }
-                
-            }
-            
-            if (globalHoldingArray[index]->DoComplete())
-            {
-                // send the message
-                
-                // send the lcm message
-                
-                holding_array_mutex.lock();
-                lcm_publish(lcm, globalHoldingArray[index]->channelName.c_str(), globalHoldingArray[index]->data,     
-                    globalHoldingArray[index]->totalDataSizeSoFar);
-                    
+
                 // check to see if this message will show up since we're also transmitting on this channel
-                if (downsampleAmounts.count(globalHoldingArray[index]->channelName) <= 0)
+                if (downsampleAmounts.count(part->GetChannel()) > 0)
                 {
-                    // we are not also transmitting this message, so delete it
-                    delete globalHoldingArray[index];
+                    echo_filter_mutex.lock();
+                    echo_filter.Add(part->GetChannel(), data, dataSize);
+                    echo_filter_mutex.unlock();
                 }
-                
-                holding_array_mutex.unlock();
-                
+
+                lcm_publish(lcm, part->GetChannel(), data, dataSize);
+
+                incoming_messages.Release(part);
             }
-            
+
             break;            
             
             
@@ -332,10 +231,15 @@ void sendLcmMessage(mavlink_message_t *message)
 
 // threaded mavlink reading
 void* MavlinkReadingThread(void *fd_ptr)
-{  
+{
+    BufferedSerialReader reader(*((int*) fd_ptr));
+
+    mavlink_status_t lastStatus;
+    lastStatus.packet_rx_drop_count = 0;
+
     while (true)
     {
-        serial_wait((void*)fd_ptr);
+        serial_wait(&reader, &lastStatus);
     }
     return NULL;
 }
@@ -413,6 +317,8 @@ int main(int argc,char** argv)
         return 1;
     }
     
+    send_scheduler = new XbeeSendScheduler(serialPort_fd, BAUD_RATE, systemID);
+
     printf("Publishing/receiving on Xbee: %s\nSending:\n", xbeeDevice);
 
     if (numChannels == 0)
@@ -425,25 +331,81 @@ int main(int argc,char** argv)
     {
         lcm_sub_array[i] = lcm_subscribe(lcm, argv[2+i*2], &message_handler, NULL);
         
-        // ensure that the next argument is a number
+        // the next argument is downsample[:priority[:latest][:fecK/M][:delta[N]]]
+        string options = argv[3+i*2];
         int thisDownsampleAmount;
+        int thisPriority = XBEE_DEFAULT_PRIORITY;
+        bool thisLatestOnly = false;
+        int thisFecK = 0, thisFecM = 0;
+        int thisKeyframeInterval = 0;
+
+        size_t priorityStart = options.find(':');
+        size_t flagStart = priorityStart == string::npos ? string::npos : options.find(':', priorityStart + 1);
+
         try
         {
-            thisDownsampleAmount = std::stoi(argv[3+i*2]);
+            thisDownsampleAmount = std::stoi(options.substr(0, priorityStart));
+
+            if (priorityStart != string::npos)
+            {
+                thisPriority = std::stoi(options.substr(priorityStart + 1, flagStart - priorityStart - 1));
+            }
         } catch (const std::invalid_argument &ia) {
-            printf("\nError: invalid downsample factor of \"%s\" for channel: %s\n\n", argv[3+2*i], argv[2+2*i]);
+            printf("\nError: invalid downsample factor or priority of \"%s\" for channel: %s\n\n", argv[3+2*i], argv[2+2*i]);
             exit(0);
         }
-        
+
+        while (flagStart != string::npos)
+        {
+            size_t flagEnd = options.find(':', flagStart + 1);
+            string flag = options.substr(flagStart + 1, flagEnd - flagStart - 1);
+
+            if (flag == "latest")
+            {
+                thisLatestOnly = true;
+            } else if (flag == "delta") {
+                thisKeyframeInterval = LCM_DELTA_DEFAULT_KEYFRAME_INTERVAL;
+            } else if (flag.compare(0, 5, "delta") == 0) {
+                if (sscanf(flag.c_str(), "delta%d", &thisKeyframeInterval) != 1 || thisKeyframeInterval < 1)
+                {
+                    printf("\nError: invalid keyframe interval \"%s\" in \"%s\" for channel: %s\n\n", flag.c_str(), argv[3+2*i], argv[2+2*i]);
+                    exit(0);
+                }
+            } else if (sscanf(flag.c_str(), "fec%d/%d", &thisFecK, &thisFecM) != 2
+                || thisFecK < 1 || thisFecK > LCM_TRANSPORT_MAX_FEC_GROUP || thisFecM < 1 || thisFecM > thisFecK) {
+
+                printf("\nError: expected \"latest\", \"deltaN\" or \"fecK/M\" (1 <= M <= K <= %d), not \"%s\" in \"%s\" for channel: %s\n\n",
+                    LCM_TRANSPORT_MAX_FEC_GROUP, flag.c_str(), argv[3+2*i], argv[2+2*i]);
+                exit(0);
+            }
+
+            flagStart = flagEnd;
+        }
+
         downsampleAmounts.insert(pair<string, int>(argv[2+i*2], thisDownsampleAmount));
         downsampleCounters.insert(pair<string, int>(argv[2+i*2], 0));
 
-        
-        printf("\t%s | downsample: %d\n", argv[2+i*2], thisDownsampleAmount);
+        send_scheduler->AddChannel(argv[2+i*2], thisPriority, thisLatestOnly, thisFecK, thisFecM, thisKeyframeInterval);
+
+        printf("\t%s | downsample: %d | priority: %d%s", argv[2+i*2], thisDownsampleAmount, thisPriority, thisLatestOnly ? " | latest only" : "");
+
+        if (thisFecK > 0)
+        {
+            printf(" | parity: %d per %d packets", thisFecM, thisFecK);
+        }
+
+        if (thisKeyframeInterval > 0)
+        {
+            printf(" | delta, keyframe every %d", thisKeyframeInterval);
+        }
+
+        printf("\n");
     }
 
     signal(SIGINT,sighandler);
-    
+
+    send_scheduler->Start();
+
     pthread_t lcmReadThread, mavlinkReadThread;
     
     int* fd_ptr = &serialPort_fd;
@@ -539,11 +501,12 @@ bool setup_port(int fd, int baud, int data_bits, int stop_bits, bool parity, boo
 	config.c_cflag |= CS8;
 	config.c_cflag |= CLOCAL;
 	//
-	// One input byte is enough to return from read()
+	// One input byte is enough to return from read(), and it returns
+	// everything that's there (see BufferedSerialReader)
 	// Inter-character timer off
 	//
 	config.c_cc[VMIN]  = 1;
-	config.c_cc[VTIME] = 10; // was 0
+	config.c_cc[VTIME] = 0;
 
 	// Get the current options for the port
 	//tcgetattr(fd, &options);
@@ -678,95 +641,77 @@ void close_port(int fd)
 * @brief Serial function
 *
 * This function blocks waiting for serial data in it's own thread
-* and forwards the data once received.
+* and forwards each message in it once received.
 */
-void* serial_wait(void* serial_ptr)
+void serial_wait(BufferedSerialReader *reader, mavlink_status_t *lastStatus)
 {
     bool verbose = false;
     bool debug = false;
     bool silent = false;
-    
-	int fd = *((int*) serial_ptr);
-
-	mavlink_status_t lastStatus;
-	lastStatus.packet_rx_drop_count = 0;
 
-	//if (debug) printf("Checking for new data on serial port\n");
-	// Block until data is available, read only one byte to be able to continue immediately
-	//char buf[MAVLINK_MAX_PACKET_LEN];
-	uint8_t cp;
 	mavlink_message_t message;
 	mavlink_status_t status;
-	uint8_t msgReceived = false;
-	//tcflush(fd, TCIFLUSH);
-    
-    // before we do a read we need to grab the serial port mutex
-	if (read(fd, &cp, 1) > 0)
+
+	// wait for data and take everything that's there at once
+	int bytes = reader->Read(1000);
+
+	if (bytes < 0)
+	{
+		if (!silent) fprintf(stderr, "ERROR: Could not read from port %s\n", xbeeDevice);
+
+		// don't spin if the port went away
+		usleep(100000);
+		return;
+	}
+
+	const uint8_t *data = reader->GetData();
+
+	for (int i = 0; i < bytes; i++)
 	{
-    
 		// Check if a message could be decoded, return the message in case yes
-		msgReceived = mavlink_parse_char(MAVLINK_COMM_1, cp, &message, &status);
-		if (lastStatus.packet_rx_drop_count != status.packet_rx_drop_count)
+		uint8_t msgReceived = mavlink_parse_char(MAVLINK_COMM_1, data[i], &message, &status);
+		if (lastStatus->packet_rx_drop_count != status.packet_rx_drop_count)
 		{
 			if (verbose || debug) printf("ERROR: DROPPED %d PACKETS\n", status.packet_rx_drop_count);
 			if (debug)
 			{
-				unsigned char v=cp;
+				unsigned char v=data[i];
 				fprintf(stderr,"%02x ", v);
 			}
 		}
-		lastStatus = status;
-	}
-	else
-	{
-		if (!silent) fprintf(stderr, "ERROR: Could not read from port %s\n", xbeeDevice);
-	}
-
-	// If a message could be decoded, handle it
-	if(msgReceived)
-	{
-		if (verbose || debug) std::cout << std::dec << "Received and forwarded serial port message with id " << static_cast<unsigned int>(message.msgid) << " from system " << static_cast<int>(message.sysid) << std::endl;
-
-		// Do not send images over serial port
+		*lastStatus = status;
 
-		// DEBUG output
-		if (debug)
+		// If a message could be decoded, handle it
+		if(msgReceived)
 		{
-			//fprintf(stderr,"Forwarding SERIAL -> LCM: ");
-			unsigned int i;
-			uint8_t buffer[MAVLINK_MAX_PACKET_LEN];
-			unsigned int messageLength = mavlink_msg_to_send_buffer(buffer, &message);
-			if (messageLength > MAVLINK_MAX_PACKET_LEN)
-			{
-				fprintf(stderr, "\nFATAL ERROR: MESSAGE LENGTH IS LARGER THAN BUFFER SIZE\n");
-			}
-			else
+			if (verbose || debug) std::cout << std::dec << "Received and forwarded serial port message with id " << static_cast<unsigned int>(message.msgid) << " from system " << static_cast<int>(message.sysid) << std::endl;
+
+			// DEBUG output
+			if (debug)
 			{
-				for (i=0; i<messageLength; i++)
+				unsigned int j;
+				uint8_t buffer[MAVLINK_MAX_PACKET_LEN];
+				unsigned int messageLength = mavlink_msg_to_send_buffer(buffer, &message);
+				if (messageLength > MAVLINK_MAX_PACKET_LEN)
 				{
-					unsigned char v=buffer[i];
-					fprintf(stderr,"%02x ", v);
+					fprintf(stderr, "\nFATAL ERROR: MESSAGE LENGTH IS LARGER THAN BUFFER SIZE\n");
+				}
+				else
+				{
+					for (j=0; j<messageLength; j++)
+					{
+						unsigned char v=buffer[j];
+						fprintf(stderr,"%02x ", v);
+					}
+					fprintf(stderr,"\n");
 				}
-				fprintf(stderr,"\n");
 			}
-		}
 
-		// Send out packets to LCM
-		// Send over LCM
-        /*
-		if (pc2serial)
-		{
-			sendMAVLinkMessage(lcm, &message, MAVCONN_LINK_TYPE_UART_VICON);
+			// Send out packets to LCM
+			sendLcmMessage(&message);
 		}
-		else
-		{
-			sendMAVLinkMessage(lcm, &message, MAVCONN_LINK_TYPE_UART);
-		}
-		*/
-		sendLcmMessage(&message); 
 	}
-	return NULL;
-				}
+}
 
 // -----------------------------------------------------------
 
@@ -42,15 +42,6 @@ void sighandler(int dum)
         exit(0);
 }
 
-int64_t getTimestampNow()
-{
-    struct timeval thisTime;
-    gettimeofday(&thisTime, NULL);
-    return (thisTime.tv_sec * 1000000.0) + (float)thisTime.tv_usec + 0.5;
-}
-
-
-
 void lcm_midi_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_midi *msg, void *user)
 {
 	// convert message and send it via LCM
@@ -63,14 +54,56 @@ void lcm_midi_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcm
      * Stop button: stop recording and stop stereo, write recording to disk
      * Repeat button: stop recording
      * 
+     * Keypad buttons 32-39: start a process
+     * "M" buttons 48-55: stop a process
+     * 
      */
-     
-    lcmt_stereo_control msg2;
+    
+    // we only want key releases, so slider and knob updates stop here
+    // without building anything
+    if (msg->event[2] != 0)
+    {
+        return;
+    }
+    
+    int button = msg->event[1];
+    
+    // stamp the output with when the button came in, not when it got here
+    int64_t timestamp = msg->timestamp * 1000;
+    
+    if (button == 42 || button == 43 || button == 45)
+    {
+        lcmt_stereo_control msg2;
+        
+        msg2.timestamp = timestamp;
+        
+        // record (45) turns stereo and recording on, rewind (43) stops
+        // recording and stop (42, the square) stops both
+        msg2.recOn = (button == 45);
+        msg2.stereoOn = (button != 42);
+        
+        lcmt_stereo_control_publish (lcm, lcm_out, &msg2);
+        return;
+    }
+    
+    int command;
+    
+    if (button >= 32 && button <= 39)
+    {
+        command = 1; // start
+    } else if (button >= 48 && button <= 55)
+    {
+        command = 2; // stop
+    } else {
+        // something else
+        
+        // don't send a message
+        return;
+    }
+    
     lcmt_process_control msgProc;
     
-    // default values if something unexpected is pressed
-    msg2.timestamp = getTimestampNow();
-    msgProc.timestamp = getTimestampNow();
+    msgProc.timestamp = timestamp;
     
     msgProc.paramServer = 0;
     msgProc.mavlinkLcmBridge = 0;
@@ -81,139 +114,14 @@ void lcm_midi_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcm
     msgProc.stereo = 0;
     msgProc.logger = 0;
     
+    // processes in keypad order
+    int8_t *processes[] = { &msgProc.paramServer, &msgProc.mavlinkLcmBridge,
+        &msgProc.mavlinkSerial, &msgProc.windEstimator, &msgProc.stateEstimator,
+        &msgProc.controller, &msgProc.logger, &msgProc.stereo };
     
-    int value = 2*msg->event[2];
-    
-    // events that we want all of:
-    
-    // NONE RIGHT NOW
-    
-    
-    // events that we only want key releases of
-    if (msg->event[2] ==0)
-    {
-        switch (msg->event[1])
-        {
-            case 45:
-                // record button
-                msg2.recOn = 1;
-                msg2.stereoOn = 1;
-                lcmt_stereo_control_publish (lcm, lcm_out, &msg2);
-                
-                break;
-            case 42:
-                // stop button (the square)
-                
-                msg2.recOn = 0;
-                msg2.stereoOn = 0;
-                lcmt_stereo_control_publish (lcm, lcm_out, &msg2);
-                break;
-                
-            case 43:
-                // rewind button
-                
-                msg2.recOn = 0;
-                msg2.stereoOn = 1;
-                lcmt_stereo_control_publish (lcm, lcm_out, &msg2);
-                break;
-                
-            case 32:
-                // param start
-                msgProc.paramServer = 1;
-                lcmt_process_control_publish (lcm, processChan, &msgProc);
-                break;
-                
-            
-            case 33:
-                msgProc.mavlinkLcmBridge = 1;
-                lcmt_process_control_publish (lcm, processChan, &msgProc);
-                break;
-            
-            
-            case 34:
-                msgProc.mavlinkSerial = 1;
-                lcmt_process_control_publish (lcm, processChan, &msgProc);
-                break;
-            
-            case 35:
-                msgProc.windEstimator = 1;
-                lcmt_process_control_publish (lcm, processChan, &msgProc);
-                break;
-            
-            case 36:
-                msgProc.stateEstimator = 1;
-                lcmt_process_control_publish (lcm, processChan, &msgProc);
-                break;
-            
-            case 37:
-                msgProc.controller = 1;
-                lcmt_process_control_publish (lcm, processChan, &msgProc);
-                break;
-            
-            case 38:
-                msgProc.logger = 1;
-                lcmt_process_control_publish (lcm, processChan, &msgProc);
-                break;
-                
-            case 39:
-                msgProc.stereo = 1;
-                lcmt_process_control_publish (lcm, processChan, &msgProc);
-                break;
-                
-            // --- stop buttons (the "M"s on the keypad) ---
-            case 48:
-                msgProc.paramServer = 2;
-                lcmt_process_control_publish (lcm, processChan, &msgProc);
-                break;
-                
-            
-            case 49:
-                msgProc.mavlinkLcmBridge = 2;
-                lcmt_process_control_publish (lcm, processChan, &msgProc);
-                break;
-            
-            
-            case 50:
-                msgProc.mavlinkSerial = 2;
-                lcmt_process_control_publish (lcm, processChan, &msgProc);
-                break;
-            
-            case 51:
-                msgProc.windEstimator = 2;
-                lcmt_process_control_publish (lcm, processChan, &msgProc);
-                break;
-            
-            case 52:
-                msgProc.stateEstimator = 2;
-                lcmt_process_control_publish (lcm, processChan, &msgProc);
-                break;
-            
-            case 53:
-                msgProc.controller = 2;
-                lcmt_process_control_publish (lcm, processChan, &msgProc);
-                break;
-            
-            case 54:
-                msgProc.logger = 2;
-                lcmt_process_control_publish (lcm, processChan, &msgProc);
-                break;
-            
-            case 55:
-                msgProc.stereo = 2;
-                lcmt_process_control_publish (lcm, processChan, &msgProc);
-                break;
-                
-            
-            default:
-                // something else
-                
-                // don't send a message
-                
-                
-                break;
-        }
-    }
+    *processes[button % 16] = command;
     
+    lcmt_process_control_publish (lcm, processChan, &msgProc);
 }
 
 
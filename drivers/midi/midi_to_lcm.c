@@ -1,68 +1,271 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
 #include <asoundlib.h> // requires libasound2-dev (sudo apt-get install libasound2-dev)
 #include <signal.h>
+#include <poll.h>
 #include <time.h>
 #include <sys/time.h>
 
 #include "../../LCM/lcmt_midi.h"
 
+// default cap on how often each controller's value is published
+#define DEFAULT_MAX_RATE_HZ 50
+
+#define NUM_CHANNELS 16
+#define NUM_CONTROLLERS 128
+
 static void usage(void)
 {
-        fprintf(stderr, "usage: midi-lcm device-id channel-name\n");
-        fprintf(stderr, "    device-id : test ALSA input device (find them in /dev/snd/midi*)\n");
+        fprintf(stderr, "usage: midi-lcm device channel-name [max-rate-hz]\n");
+        fprintf(stderr, "    device : MIDI input, as a sound card (hw:1,0,0), a sequencer port (20:0)\n");
+        fprintf(stderr, "             or a sequencer client name (nanoKONTROL)\n");
         fprintf(stderr, "    channel-name : LCM channel name to output\n");
+        fprintf(stderr, "    max-rate-hz : most updates per second for a slider or knob (default %d)\n", DEFAULT_MAX_RATE_HZ);
         fprintf(stderr, "  example:\n");
-        fprintf(stderr, "    midi-lcm hw:0,0 midi_out\n");
-        fprintf(stderr, "    reads input on card 0, device 0, using snd_rawmidi API\n");
-        fprintf(stderr, "    and outputs it on LCM channel \"midi-out\"\n");
+        fprintf(stderr, "    midi-lcm hw:1,0,0 midi_out\n");
+        fprintf(stderr, "    reads input from card 1 through the ALSA sequencer\n");
+        fprintf(stderr, "    and outputs it on LCM channel \"midi_out\"\n");
         fprintf(stderr, "\n");
         fprintf(stderr, "Here, I'll search your available MIDI devices for you:\n---------------------------\n");
 
-        system("amidi -l");
-        fprintf(stderr, "\n---------------------------\n");
-
-        system("ls /dev/snd/midi*");
+        system("aconnect -i");
 
         fprintf(stderr, "\n---------------------------\n");
 }
 
+/*
+ * Slider and knob (control change) events come in bursts as they're moved.
+ * Only the latest value of each controller is kept and they're published
+ * at most every publish_period_ms, the first one right away.  A value at
+ * either end (0 or 127) is published before it's replaced, so button
+ * presses and releases and sliders hitting their stops always get through.
+ */
+typedef struct
+{
+    int pending;
+    int listed;
+    int value;
+    int64_t timestamp;
+} controller_state_t;
+
 int stop=0;
 lcm_t * lcm;
-snd_rawmidi_t *handle_in = 0;
+snd_seq_t *seq = NULL;
+char *lcm_out = NULL;
+
+controller_state_t controllers[NUM_CHANNELS][NUM_CONTROLLERS];
+
+// controllers with a pending value, in the order they first changed
+int pending_list[NUM_CHANNELS * NUM_CONTROLLERS];
+int num_pending = 0;
+
+int64_t publish_period_ms;
+int64_t last_publish_ms = 0;
+
+// wall clock time (ms) when the sequencer's timestamp queue started
+int64_t queue_start_ms;
+
+int num_events = 0;
+int num_published = 0;
 
 void sighandler(int dum)
 {
         stop=1;
+}
 
-        fprintf(stderr,"Closing.\n");
+int64_t getTimestampNowMs()
+{
+    struct timeval thisTime;
+    gettimeofday(&thisTime, NULL);
+    return (thisTime.tv_sec * 1000.0) + (float)thisTime.tv_usec/1000.0 + 0.5;
+}
+
+void PublishEvent(int status, int data1, int data2, int64_t timestamp)
+{
+    lcmt_midi msg;
+
+    msg.timestamp = timestamp;
+
+    msg.event[0] = status;
+    msg.event[1] = data1;
+    msg.event[2] = data2;
+
+    lcmt_midi_publish (lcm, lcm_out, &msg);
+
+    num_published ++;
+}
+
+void PublishController(int channel, int controller)
+{
+    controller_state_t *state = &controllers[channel][controller];
+
+    PublishEvent(0xB0 | channel, controller, state->value, state->timestamp);
 
-        if (handle_in) {
-                snd_rawmidi_drain(handle_in);
-                snd_rawmidi_close(handle_in);
+    state->pending = 0;
+}
+
+void PublishPending()
+{
+    int i;
+
+    for (i = 0; i < num_pending; i++)
+    {
+        int channel = pending_list[i] / NUM_CONTROLLERS;
+        int controller = pending_list[i] % NUM_CONTROLLERS;
+
+        controllers[channel][controller].listed = 0;
+
+        // might have been published already to keep a button press
+        if (controllers[channel][controller].pending)
+        {
+            PublishController(channel, controller);
         }
+    }
 
-        lcm_destroy (lcm);
+    num_pending = 0;
+}
 
-        exit(0);
+void HandleController(int channel, int controller, int value, int64_t timestamp)
+{
+    controller_state_t *state = &controllers[channel][controller];
+
+    if (state->pending)
+    {
+        if (state->value == 0 || state->value == 127)
+        {
+            PublishController(channel, controller);
+        } else {
+            state->value = value;
+            state->timestamp = timestamp;
+            return;
+        }
+    }
+
+    state->pending = 1;
+    state->value = value;
+    state->timestamp = timestamp;
+
+    if (state->listed == 0)
+    {
+        state->listed = 1;
+        pending_list[num_pending] = channel * NUM_CONTROLLERS + controller;
+        num_pending ++;
+    }
 }
 
-int main(int argc,char** argv)
+/**
+ * Handles one sequencer event.  Controller changes wait to be published,
+ * and note events go out right away, after anything waiting so the order
+ * is kept.
+ *
+ * @param ev sequencer event
+ * @param timestamp when it arrived at the sequencer (ms)
+ */
+void HandleEvent(const snd_seq_event_t *ev, int64_t timestamp)
 {
-        int i;
-        int err;
-        int thru=0;
-        int verbose = 0;
-        char *device_in = NULL;
-        char *lcm_out = NULL;
+    int status;
+
+    switch (ev->type)
+    {
+        case SND_SEQ_EVENT_CONTROLLER:
+            HandleController(ev->data.control.channel & 0x0F, ev->data.control.param & 0x7F,
+                ev->data.control.value & 0x7F, timestamp);
+            num_events ++;
+            return;
+
+        case SND_SEQ_EVENT_NOTEON:
+            status = 0x90;
+            break;
+
+        case SND_SEQ_EVENT_NOTEOFF:
+            status = 0x80;
+            break;
+
+        case SND_SEQ_EVENT_KEYPRESS:
+            status = 0xA0;
+            break;
+
+        default:
+            // system exclusive, clock, etc.
+            return;
+    }
+
+    num_events ++;
+
+    PublishPending();
+
+    PublishEvent(status | (ev->data.note.channel & 0x0F), ev->data.note.note & 0x7F,
+        ev->data.note.velocity & 0x7F, timestamp);
+}
+
+/**
+ * Finds the sequencer port for the input device.
+ *
+ * @param device sound card (hw:1,0,0), sequencer port (20:0) or client name
+ * @param addr (output) the port's address
+ *
+ * @retval 0 on success
+ */
+int FindInputPort(const char *device, snd_seq_addr_t *addr)
+{
+    if (strncmp(device, "hw:", 3) != 0)
+    {
+        return snd_seq_parse_address(seq, addr, device);
+    }
 
+    // the card's sequencer client has the card's name.  Use its first port
+    // we can read from.
+    char *card_name;
 
+    if (snd_card_get_name(atoi(device + 3), &card_name) < 0)
+    {
+        return -1;
+    }
 
-        int fd_in = -1,fd_out = -1;
-        snd_rawmidi_t *handle_out = 0;
+    snd_seq_client_info_t *client_info;
+    snd_seq_port_info_t *port_info;
 
-        if (argc!=3) {
+    snd_seq_client_info_alloca(&client_info);
+    snd_seq_port_info_alloca(&port_info);
+
+    snd_seq_client_info_set_client(client_info, -1);
+
+    while (snd_seq_query_next_client(seq, client_info) >= 0)
+    {
+        if (strcmp(snd_seq_client_info_get_name(client_info), card_name) != 0)
+        {
+            continue;
+        }
+
+        snd_seq_port_info_set_client(port_info, snd_seq_client_info_get_client(client_info));
+        snd_seq_port_info_set_port(port_info, -1);
+
+        while (snd_seq_query_next_port(seq, port_info) >= 0)
+        {
+            unsigned int needed = SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ;
+
+            if ((snd_seq_port_info_get_capability(port_info) & needed) == needed)
+            {
+                *addr = *snd_seq_port_info_get_addr(port_info);
+                free(card_name);
+                return 0;
+            }
+        }
+    }
+
+    free(card_name);
+    return -1;
+}
+
+int main(int argc,char** argv)
+{
+        int err;
+        char *device_in = NULL;
+        int max_rate_hz = DEFAULT_MAX_RATE_HZ;
+
+        if (argc != 3 && argc != 4) {
             usage();
             exit(0);
         }
@@ -70,92 +273,120 @@ int main(int argc,char** argv)
         device_in = argv[1];
         lcm_out = argv[2];
 
+        if (argc == 4) {
+            max_rate_hz = atoi(argv[3]);
+        }
+
+        if (max_rate_hz < 1) {
+            fprintf(stderr, "max-rate-hz must be at least 1.\n");
+            return 1;
+        }
+
+        publish_period_ms = 1000 / max_rate_hz;
+
+        memset(controllers, 0, sizeof(controllers));
 
         lcm = lcm_create ("udpm://239.255.76.67:7667?ttl=0");
         if (!lcm)
             return 1;
 
-        struct timeval thisTime;
+        err = snd_seq_open(&seq, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK);
+        if (err < 0) {
+            fprintf(stderr,"snd_seq_open failed: %s\n", snd_strerror(err));
+            return -1;
+        }
 
-        fprintf(stderr,"Using: \n");
-        fprintf(stderr,"Input: ");
-        fprintf(stderr,"device %s\n",device_in);
-        fprintf(stderr,"Output: ");
-        fprintf(stderr,"LCM channel %s\n", lcm_out);
-        fprintf(stderr,"Read midi in\n");
-        fprintf(stderr,"Press ctrl-c to stop\n");
-        fprintf(stderr,"Broadcasting LCM: %s\n", lcm_out);
+        snd_seq_set_client_name(seq, "midi-lcm");
 
+        // the sequencer stamps each event with when it arrived, on a
+        // real-time queue started right before the wall clock is read
+        int queue = snd_seq_alloc_queue(seq);
 
-        if (device_in) {
-            err = snd_rawmidi_open(&handle_in,NULL,device_in,0);
-            if (err) {
-                fprintf(stderr,"snd_rawmidi_open %s failed: %d\n",device_in,err);
-                return -1;
-            }
+        snd_seq_port_info_t *port_info;
+        snd_seq_port_info_alloca(&port_info);
+
+        snd_seq_port_info_set_name(port_info, "midi-lcm in");
+        snd_seq_port_info_set_capability(port_info, SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE);
+        snd_seq_port_info_set_type(port_info, SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+        snd_seq_port_info_set_timestamping(port_info, 1);
+        snd_seq_port_info_set_timestamp_real(port_info, 1);
+        snd_seq_port_info_set_timestamp_queue(port_info, queue);
+
+        err = snd_seq_create_port(seq, port_info);
+        if (queue < 0 || err < 0) {
+            fprintf(stderr,"Setting up the sequencer port failed: %s\n", snd_strerror(queue < 0 ? queue : err));
+            return -1;
         }
 
-        signal(SIGINT,sighandler);
+        int port = snd_seq_port_info_get_port(port_info);
 
+        snd_seq_start_queue(seq, queue, NULL);
+        snd_seq_drain_output(seq);
+        queue_start_ms = getTimestampNowMs();
 
-        int num = 0;
-        int val[10];
+        snd_seq_addr_t addr;
 
-        int sysExclusive = 0;
+        if (FindInputPort(device_in, &addr) != 0) {
+            fprintf(stderr,"Couldn't find MIDI input %s\n", device_in);
+            usage();
+            return -1;
+        }
 
-        if (handle_in) {
-            unsigned char ch;
-            while (!stop) {
-                snd_rawmidi_read(handle_in,&ch,1);
+        err = snd_seq_connect_from(seq, port, addr.client, addr.port);
+        if (err < 0) {
+            fprintf(stderr,"Connecting to %d:%d failed: %s\n", addr.client, addr.port, snd_strerror(err));
+            return -1;
+        }
 
-                // check to make sure this isn't a system exclusive message (begins with 0xF0. Ends with a 0xF7)
-                if (ch == 0xF0)
-                {
-                    sysExclusive = 1;
-                    //fprintf(stderr,"sys exclusive\n");
-                }
+        fprintf(stderr,"Using: \n");
+        fprintf(stderr,"Input: ");
+        fprintf(stderr,"device %s (sequencer port %d:%d)\n", device_in, addr.client, addr.port);
+        fprintf(stderr,"Output: ");
+        fprintf(stderr,"LCM channel %s, sliders and knobs at most %d Hz\n", lcm_out, max_rate_hz);
+        fprintf(stderr,"Press ctrl-c to stop\n");
+        fprintf(stderr,"Broadcasting LCM: %s\n", lcm_out);
+
+        signal(SIGINT,sighandler);
 
-                if (sysExclusive == 0)
-                {
-                    val[num] = (int)ch;
-                    if (num >= 2)
-                    {
-                        //fprintf(stderr,"read %02x --> %02x --> %d\n", val[0], val[1], val[2]);
-                        num = 0;
+        int num_fds = snd_seq_poll_descriptors_count(seq, POLLIN);
+        struct pollfd *fds = (struct pollfd*)malloc(num_fds * sizeof(struct pollfd));
+        snd_seq_poll_descriptors(seq, fds, num_fds, POLLIN);
 
-                        // send LCM message
-                        lcmt_midi msg;
+        while (!stop) {
 
-                        gettimeofday(&thisTime, NULL);
-                        msg.timestamp = (thisTime.tv_sec * 1000.0) + (float)thisTime.tv_usec/1000.0 + 0.5;
+            // wait for an event, or until the pending values are due
+            int timeout = -1;
 
-                        msg.event[0] = val[0];
-                        msg.event[1] = val[1];
-                        msg.event[2] = val[2];
+            if (num_pending > 0) {
+                int64_t wait = last_publish_ms + publish_period_ms - getTimestampNowMs();
+                timeout = wait > 0 ? (int)wait : 0;
+            }
 
-                        lcmt_midi_publish (lcm, lcm_out, &msg);
+            if (poll(fds, num_fds, timeout) > 0) {
 
+                snd_seq_event_t *ev;
 
-                    } else {
-                        num ++;
-                    }
-                    //fprintf(stderr,"read %02x\n", ch);
+                // the sequencer was opened non-blocking, so this stops when
+                // there are no more events
+                while (snd_seq_event_input(seq, &ev) >= 0) {
+                    HandleEvent(ev, queue_start_ms + ev->time.time.tv_sec * (int64_t)1000
+                        + ev->time.time.tv_nsec / 1000000);
                 }
+            }
 
-                if (ch == 0xF7)
-                {
-                    sysExclusive = 0;
-                }
+            if (num_pending > 0 && getTimestampNowMs() >= last_publish_ms + publish_period_ms) {
+                PublishPending();
+                last_publish_ms = getTimestampNowMs();
             }
         }
 
-
         fprintf(stderr,"Closing.\n");
+        fprintf(stderr,"%d MIDI events, %d LCM messages\n", num_events, num_published);
 
-        if (handle_in) {
-                snd_rawmidi_drain(handle_in);
-                snd_rawmidi_close(handle_in);
-        }
+        free(fds);
+
+        snd_seq_free_queue(seq, queue);
+        snd_seq_close(seq);
 
         lcm_destroy (lcm);
 
@@ -1,4 +1,8 @@
 #include "ProcessControlProc.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../utils/utils/Clock.hpp"
 
 
 ProcessControlProc::ProcessControlProc(char **argumentsIn, int numArgsIn)
@@ -6,6 +10,26 @@ ProcessControlProc::ProcessControlProc(char **argumentsIn, int numArgsIn)
     arguments = argumentsIn;
     numArgs = numArgsIn;
     pid = -1;
+
+    lastExitStatus = 0;
+    numExits = 0;
+
+    lastCpuTicks = 0;
+    lastStatsUtime = 0;
+
+    signalsReady = false;
+    readyTimeoutUsec = 0;
+    startRequested = false;
+    startUtime = 0;
+    readyUtime = 0;
+    startupUsec = -1;
+}
+
+void ProcessControlProc::SetStartup(std::vector<std::string> dependsOnIn, bool signalsReadyIn, int64_t readyTimeoutUsecIn)
+{
+    dependsOn = dependsOnIn;
+    signalsReady = signalsReadyIn;
+    readyTimeoutUsec = readyTimeoutUsecIn;
 }
 
 
@@ -36,6 +60,12 @@ pid_t ProcessControlProc::StartProcess() // the first argument in processArgs mu
         }
         printf("\n");
 
+        // process-control blocks SIGCHLD to read it from a signalfd, and
+        // the blocked set survives exec
+        sigset_t noSignals;
+        sigemptyset(&noSignals);
+        sigprocmask(SIG_SETMASK, &noSignals, NULL);
+
         execvp (arguments[0], arguments);
 
         fprintf (stderr, "ERROR!!!! couldn't start [%s]!\n", arguments[0]);
@@ -50,12 +80,27 @@ pid_t ProcessControlProc::StartProcess() // the first argument in processArgs mu
     } else {
         // this branch will execute in the parent process
         my_fd = stdin_fd;
+        lastCpuTicks = 0;
+        lastStatsUtime = 0;
+
+        startRequested = false;
+        startUtime = GetRawMonotonicNow();
+        readyUtime = 0;
+        startupUsec = -1;
+
+        if (!signalsReady)
+        {
+            MarkReady(startUtime);
+        }
+
         return pid;
     }
 }
 
 void ProcessControlProc::StopProcess()
 {
+    startRequested = false;
+
     if (pid <= 0)
     {
         // already stopped, don't do anything
@@ -65,6 +110,7 @@ void ProcessControlProc::StopProcess()
     if (kill(pid, SIGINT) == 0)
     {
         pid = -1;
+        readyUtime = 0;
     } else {
         // error
         printf("ERROR: failed to kill %s with pid = %d\n", arguments[0], pid);
@@ -89,6 +135,135 @@ bool ProcessControlProc::IsAlive()
     }
 }
 
+bool ProcessControlProc::Reaped(pid_t reapedPid, int status)
+{
+    // a process we stopped has already forgotten its pid
+    if (pid <= 0 || reapedPid != pid)
+    {
+        return false;
+    }
+
+    if (WIFEXITED(status))
+    {
+        lastExitStatus = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        lastExitStatus = -WTERMSIG(status);
+    } else {
+        // stopped or continued, not gone
+        return false;
+    }
+
+    printf("%s (pid = %d) exited with status %d\n", arguments[0], pid, lastExitStatus);
+
+    pid = -1;
+    readyUtime = 0;
+    numExits ++;
+
+    return true;
+}
+
+// returns true if it wasn't ready before
+bool ProcessControlProc::MarkReady(int64_t now)
+{
+    if (pid <= 0 || readyUtime > 0)
+    {
+        return false;
+    }
+
+    readyUtime = now;
+    startupUsec = now - startUtime;
+
+    if (signalsReady)
+    {
+        printf("%s (pid = %d) ready after %.2f s\n", arguments[0], pid, GetStartupSec());
+    }
+
+    return true;
+}
+
+// gives up waiting for an lcmt_process_ready.  Returns true if it did.
+bool ProcessControlProc::CheckReadyTimeout(int64_t now)
+{
+    if (pid <= 0 || readyUtime > 0 || now - startUtime < readyTimeoutUsec)
+    {
+        return false;
+    }
+
+    printf("WARNING: %s (pid = %d) didn't say it was ready in %.1f s, starting what depends on it anyway\n",
+        arguments[0], pid, readyTimeoutUsec / 1000000.0);
+
+    return MarkReady(now);
+}
+
+void ProcessControlProc::GetStats(int64_t now, ProcessStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    if (pid <= 0)
+    {
+        return;
+    }
+
+    char filename[64], buf[1024];
+
+    // cpu time and rss from /proc/<pid>/stat
+    sprintf(filename, "/proc/%d/stat", pid);
+    FILE *statFile = fopen(filename, "r");
+    if (statFile == NULL)
+    {
+        return;
+    }
+
+    size_t len = fread(buf, 1, sizeof(buf) - 1, statFile);
+    fclose(statFile);
+    buf[len] = '\0';
+
+    // the name can have spaces in it, so start after the last ')'
+    char *fields = strrchr(buf, ')');
+    unsigned long utime, stime;
+    long rssPages;
+
+    if (fields != NULL && sscanf(fields + 1,
+        " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %*d %*d %*d %*u %*u %ld",
+        &utime, &stime, &rssPages) == 3)
+    {
+        unsigned long long ticks = (unsigned long long)utime + stime;
+
+        stats->rss_kb = rssPages * (sysconf(_SC_PAGESIZE) / 1024);
+
+        if (lastStatsUtime > 0 && now > lastStatsUtime && ticks >= lastCpuTicks)
+        {
+            double cpuSec = (double)(ticks - lastCpuTicks) / sysconf(_SC_CLK_TCK);
+            stats->cpu_percent = 100.0 * cpuSec / ((now - lastStatsUtime) / 1000000.0);
+        }
+
+        lastCpuTicks = ticks;
+        lastStatsUtime = now;
+    }
+
+    // context switches from /proc/<pid>/status
+    sprintf(filename, "/proc/%d/status", pid);
+    FILE *statusFile = fopen(filename, "r");
+    if (statusFile == NULL)
+    {
+        return;
+    }
+
+    while (fgets(buf, sizeof(buf), statusFile) != NULL)
+    {
+        long long count;
+
+        if (sscanf(buf, "voluntary_ctxt_switches: %lld", &count) == 1)
+        {
+            stats->voluntary_switches = count;
+        } else if (sscanf(buf, "nonvoluntary_ctxt_switches: %lld", &count) == 1) {
+            stats->involuntary_switches = count;
+        }
+    }
+
+    fclose(statusFile);
+}
+
 void ProcessControlProc::PrintIO()
 {
     printf("printing io...\n");
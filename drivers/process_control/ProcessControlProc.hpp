@@ -2,11 +2,23 @@
 #define PROCESS_CONTROL_PROC_H
 
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <string>
+#include <vector>
 #include <pty.h>
 #include <iostream>
 #include <signal.h>
+#include <stdint.h>
+
+// resource use of a running process (all zero if it isn't)
+struct ProcessStats
+{
+    int64_t rss_kb;
+    float cpu_percent; // of one core, since the last call
+    int64_t voluntary_switches;
+    int64_t involuntary_switches;
+};
 
 class ProcessControlProc
 {
@@ -17,12 +29,58 @@ class ProcessControlProc
         void PrintIO();
         bool IsAlive();
 
+        // call with each child waitpid() returns.  Returns true if it was
+        // this process, which exited without being stopped.
+        bool Reaped(pid_t reapedPid, int status);
+
+        void GetStats(int64_t now, ProcessStats *stats);
+
+        pid_t GetPid() { return pid; }
+        int GetLastExitStatus() { return lastExitStatus; }
+        int GetNumExits() { return numExits; }
+
+        // startup ordering: processes to wait for, and whether this one
+        // sends an lcmt_process_ready (otherwise it's ready once started).
+        // If it never does, it's taken as ready after readyTimeoutUsec.
+        void SetStartup(std::vector<std::string> dependsOnIn, bool signalsReadyIn, int64_t readyTimeoutUsecIn);
+        const std::vector<std::string>& GetDependencies() { return dependsOn; }
+
+        // asked to start, but waiting for its dependencies
+        void RequestStart() { startRequested = true; }
+        bool IsStartRequested() { return startRequested; }
+
+        bool IsReady() { return pid > 0 && readyUtime > 0; }
+        bool MarkReady(int64_t now);
+        bool CheckReadyTimeout(int64_t now);
+
+        // from start to ready, the last time it started (-1 if it hasn't
+        // been ready yet)
+        float GetStartupSec() { return startupUsec < 0 ? -1 : startupUsec / 1000000.0f; }
+
     private:
         char **arguments;
         pid_t pid;
         int numArgs;
         int my_fd;
 
+        int lastExitStatus;
+        int numExits;
+
+        std::vector<std::string> dependsOn;
+        bool signalsReady;
+        int64_t readyTimeoutUsec;
+
+        bool startRequested;
+
+        // monotonic times
+        int64_t startUtime;
+        int64_t readyUtime;
+        int64_t startupUsec;
+
+        // for the cpu use between GetStats calls
+        unsigned long long lastCpuTicks;
+        int64_t lastStatsUtime;
+
 };
 
 
@@ -14,13 +14,33 @@
 #include <signal.h>
 #include <time.h>
 #include <sys/time.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
 #include <glib.h> // for configuration files
 
 #include "../../LCM/lcmt_process_control.h"
+#include "../../LCM/lcmt_process_status.h"
 #include "../../LCM/lcmt_stereo_control.h"
+#include "../../LCM/lcmt_process_ready.h"
 
 #include "ProcessControlProc.hpp"
 #include <map>
+#include <mutex>
+#include <vector>
+#include "../../utils/utils/Clock.hpp"
+
+// status messages go out at least this often, and right away when a process
+// exits
+#define STATUS_PERIOD_USEC 1000000
+
+// same as PROCESS_READY_CHANNEL in utils/utils/RealtimeUtils.hpp, which the
+// processes publish on
+#define DEFAULT_PROCESS_READY_CHANNEL "process-ready"
+
+// how long to wait for a ready_signal process's lcmt_process_ready before
+// starting what depends on it anyway
+#define DEFAULT_READY_TIMEOUT_SEC 30.0
 
 lcm_t * lcm;
 
@@ -28,16 +48,28 @@ char *channelStereoControl = NULL;
 char *channelProcessReport = NULL;
 
 lcmt_process_control_subscription_t *process_control_sub;
+lcmt_process_ready_subscription_t *process_ready_sub;
 
 std::map<std::string, ProcessControlProc> processMap;
 
+// processMap is used by the LCM and status threads
+std::mutex processMutex;
+
+int childSignalFd = -1;
+
 static void usage(void)
 {
-        fprintf(stderr, "usage: process-control chan-process-control chan-stereo-control chan-process-report config-file\n");
+        fprintf(stderr, "usage: process-control chan-process-control chan-stereo-control chan-process-report config-file [chan-process-ready]\n");
         fprintf(stderr, "    chan-process-control: LCM channel with process_control messages\n");
         fprintf(stderr, "    chan-stereo-control: TODO\n");
-        fprintf(stderr, "    chan-process report: publishes process reports on this channel\n");
+        fprintf(stderr, "    chan-process report: publishes lcmt_process_status reports on this channel\n");
         fprintf(stderr, "    configfile: config file listing processes and arguments\n");
+        fprintf(stderr, "    chan-process-ready: LCM channel processes send lcmt_process_ready on (default: %s)\n", DEFAULT_PROCESS_READY_CHANNEL);
+        fprintf(stderr, "  each process's group in the config file can also have:\n");
+        fprintf(stderr, "    depends_on: processes that have to be ready before it starts\n");
+        fprintf(stderr, "    ready_signal: true if it sends lcmt_process_ready when it's ready (otherwise it's ready once started)\n");
+        fprintf(stderr, "    ready_timeout: seconds to wait for that before giving up (default: %.0f)\n", DEFAULT_READY_TIMEOUT_SEC);
+        fprintf(stderr, "    autostart: true to start it when process-control starts\n");
         fprintf(stderr, "  example:\n");
         fprintf(stderr, "    ./process-control process_control stereo_control process_status ../../config/processControl.conf\n");
         fprintf(stderr, "    reads LCM process-control messages and starts/stops processes based on those commands.\n");
@@ -49,6 +81,7 @@ void sighandler(int dum)
     printf("\nClosing... ");
 
     lcmt_process_control_unsubscribe(lcm, process_control_sub);
+    lcmt_process_ready_unsubscribe(lcm, process_ready_sub);
     lcm_destroy (lcm);
 
     printf("done.\n");
@@ -56,78 +89,223 @@ void sighandler(int dum)
     exit(0);
 }
 
-int64_t getTimestampNow()
+// processes the control message has fields for
+struct ControlledProcess
 {
-    struct timeval thisTime;
-    gettimeofday(&thisTime, NULL);
-    return (thisTime.tv_sec * 1000000.0) + (float)thisTime.tv_usec + 0.5;
-}
-
-void procces_control_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_process_control *msg, void *user)
+    const char *name;
+    int8_t lcmt_process_control::*field;
+};
+
+const ControlledProcess controlledProcesses[] = {
+    { "paramServer", &lcmt_process_control::paramServer },
+    { "mavlinkLcmBridge", &lcmt_process_control::mavlinkLcmBridge },
+    { "mavlinkSerial", &lcmt_process_control::mavlinkSerial },
+    { "stateEstimator", &lcmt_process_control::stateEstimator },
+    { "windEstimator", &lcmt_process_control::windEstimator },
+    { "controller", &lcmt_process_control::controller },
+    { "logger", &lcmt_process_control::logger },
+    { "stereo", &lcmt_process_control::stereo }
+};
+
+const int numControlledProcesses = sizeof(controlledProcesses) / sizeof(controlledProcesses[0]);
+
+void PublishStatus()
 {
-    // got a process control message
+    std::lock_guard<std::mutex> lock(processMutex);
 
-    // start or stop processes based on it
+    int64_t now = GetWallNow();
 
-    // the message sends the full requested state at once
-    //processMap.at("paramServer").PrintIO();
-    if (msg->paramServer == 1)
-    {
-        processMap.at("paramServer").StartProcess();
-    } else if (msg->paramServer == 2) {
-        processMap.at("paramServer").StopProcess();
-    }
+    int numProcesses = processMap.size();
+
+    std::vector<char*> names;
+    std::vector<int8_t> running;
+    std::vector<int32_t> pids, exitStatus, numExits;
+    std::vector<int64_t> rss, voluntary, involuntary;
+    std::vector<float> cpu, startupSec;
+    std::vector<int8_t> ready;
 
-    if (msg->mavlinkLcmBridge == 1)
+    for (std::map<std::string, ProcessControlProc>::iterator it = processMap.begin(); it != processMap.end(); it++)
     {
-        processMap.at("mavlinkLcmBridge").StartProcess();
-    } else if (msg->mavlinkLcmBridge == 2) {
-        processMap.at("mavlinkLcmBridge").StopProcess();
+        ProcessControlProc &proc = it->second;
+
+        ProcessStats stats;
+        proc.GetStats(now, &stats);
+
+        names.push_back((char*)it->first.c_str());
+        running.push_back(proc.IsAlive());
+        pids.push_back(proc.GetPid() > 0 ? proc.GetPid() : -1);
+        exitStatus.push_back(proc.GetLastExitStatus());
+        numExits.push_back(proc.GetNumExits());
+        rss.push_back(stats.rss_kb);
+        cpu.push_back(stats.cpu_percent);
+        voluntary.push_back(stats.voluntary_switches);
+        involuntary.push_back(stats.involuntary_switches);
+        ready.push_back(proc.IsReady());
+        startupSec.push_back(proc.GetStartupSec());
     }
 
-    if (msg->mavlinkSerial == 1)
+    lcmt_process_status statMsg;
+
+    statMsg.timestamp = now;
+    statMsg.num_processes = numProcesses;
+    statMsg.name = names.data();
+    statMsg.running = running.data();
+    statMsg.pid = pids.data();
+    statMsg.exit_status = exitStatus.data();
+    statMsg.num_exits = numExits.data();
+    statMsg.rss_kb = rss.data();
+    statMsg.cpu_percent = cpu.data();
+    statMsg.voluntary_switches = voluntary.data();
+    statMsg.involuntary_switches = involuntary.data();
+    statMsg.ready = ready.data();
+    statMsg.startup_sec = startupSec.data();
+
+    // send the message
+    lcmt_process_status_publish (lcm, channelProcessReport, &statMsg);
+}
+
+// starts the processes that were asked to start and whose dependencies are
+// all ready.  Processes that don't send a ready signal are ready as soon as
+// they start, so this goes around until nothing else can start.  Call with
+// processMutex held.  Returns true if anything started or became ready.
+bool StartPendingProcesses()
+{
+    int64_t now = GetRawMonotonicNow();
+
+    bool changed = false;
+
+    for (std::map<std::string, ProcessControlProc>::iterator it = processMap.begin(); it != processMap.end(); it++)
     {
-        processMap.at("mavlinkSerial").StartProcess();
-    } else if (msg->mavlinkSerial == 2) {
-        processMap.at("mavlinkSerial").StopProcess();
+        if (it->second.CheckReadyTimeout(now))
+        {
+            changed = true;
+        }
     }
 
-    if (msg->stateEstimator == 1)
+    bool started = true;
+
+    while (started)
     {
-        processMap.at("stateEstimator").StartProcess();
-    } else if (msg->stateEstimator == 2) {
-        processMap.at("stateEstimator").StopProcess();
+        started = false;
+
+        for (std::map<std::string, ProcessControlProc>::iterator it = processMap.begin(); it != processMap.end(); it++)
+        {
+            ProcessControlProc &proc = it->second;
+
+            if (!proc.IsStartRequested() || proc.IsAlive())
+            {
+                continue;
+            }
+
+            bool waiting = false;
+
+            for (const std::string &dependency : proc.GetDependencies())
+            {
+                ProcessControlProc &dependencyProc = processMap.at(dependency);
+
+                // one that isn't running and isn't going to be doesn't hold
+                // anything up (what depends on it will complain itself)
+                if (!dependencyProc.IsReady() && (dependencyProc.IsAlive() || dependencyProc.IsStartRequested()))
+                {
+                    waiting = true;
+                    break;
+                }
+            }
+
+            if (!waiting)
+            {
+                proc.StartProcess();
+                started = true;
+                changed = true;
+            }
+        }
     }
 
-    if (msg->windEstimator == 1)
+    return changed;
+}
+
+void procces_control_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_process_control *msg, void *user)
+{
+    // got a process control message
+
+    // start or stop processes based on it
+
+    // the message sends the full requested state at once
+    bool changed = false;
+
     {
-        processMap.at("windEstimator").StartProcess();
-    } else if (msg->windEstimator == 2) {
-        processMap.at("windEstimator").StopProcess();
+        std::lock_guard<std::mutex> lock(processMutex);
+
+        for (int i = 0; i < numControlledProcesses; i++)
+        {
+            ProcessControlProc &proc = processMap.at(controlledProcesses[i].name);
+            int8_t command = msg->*(controlledProcesses[i].field);
+
+            pid_t pidBefore = proc.GetPid();
+
+            if (command == 1 && !proc.IsAlive())
+            {
+                // started once what it depends on is ready
+                proc.RequestStart();
+            } else if (command == 2) {
+                proc.StopProcess();
+            }
+
+            if (proc.GetPid() != pidBefore)
+            {
+                changed = true;
+            }
+        }
+
+        if (StartPendingProcesses())
+        {
+            changed = true;
+        }
     }
 
-    if (msg->controller == 1)
+    if (changed)
     {
-        processMap.at("controller").StartProcess();
-    } else if (msg->controller == 2) {
-        processMap.at("controller").StopProcess();
+        PublishStatus();
     }
+}
+
+void process_ready_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_process_ready *msg, void *user)
+{
+    bool changed = false;
 
-    if (msg->logger == 1)
     {
-        processMap.at("logger").StartProcess();
-    } else if (msg->logger == 2) {
-        processMap.at("logger").StopProcess();
+        std::lock_guard<std::mutex> lock(processMutex);
+
+        int64_t now = GetRawMonotonicNow();
+
+        for (std::map<std::string, ProcessControlProc>::iterator it = processMap.begin(); it != processMap.end(); it++)
+        {
+            if (it->second.GetPid() == msg->pid && it->second.MarkReady(now))
+            {
+                changed = true;
+            }
+        }
+
+        if (changed)
+        {
+            StartPendingProcesses();
+        }
     }
 
-    if (msg->stereo == 1)
+    if (changed)
     {
-        processMap.at("stereo").StartProcess();
-    } else if (msg->stereo == 2) {
-        processMap.at("stereo").StopProcess();
+        PublishStatus();
     }
 }
 
+// starts what was waiting on a process that timed out
+bool UpdateStartup()
+{
+    std::lock_guard<std::mutex> lock(processMutex);
+
+    return StartPendingProcesses();
+}
+
 void CheckForProc(std::string procString)
 {
     if (processMap.find(procString) == processMap.end())
@@ -137,36 +315,66 @@ void CheckForProc(std::string procString)
     }
 }
 
-// thread that sends a status message every n seconds
-// threaded lcm reading
+// reaps exited children.  Returns true if any of them weren't stopped by us.
+bool ReapChildren()
+{
+    std::lock_guard<std::mutex> lock(processMutex);
+
+    bool crashed = false;
+    int status;
+    pid_t reapedPid;
+
+    while ((reapedPid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+        for (std::map<std::string, ProcessControlProc>::iterator it = processMap.begin(); it != processMap.end(); it++)
+        {
+            if (it->second.Reaped(reapedPid, status))
+            {
+                crashed = true;
+            }
+        }
+    }
+
+    return crashed;
+}
+
+// thread that sends a status message as soon as a process exits, and every
+// STATUS_PERIOD_USEC otherwise
 void* ProcessStatusThreadFunc(void *nothing)
 {
+    int64_t nextStatus = 0;
+
     while (true)
     {
-        // sleep for 1 second
-        sleep(1);
-        // send process status messages
+        int64_t now = GetRawMonotonicNow();
+        int timeoutMs = nextStatus > now ? (nextStatus - now) / 1000 + 1 : 0;
 
+        struct pollfd pfd = { childSignalFd, POLLIN, 0 };
 
-        // get a new lcm message
-        lcmt_process_control statMsg;
+        int ret = poll(&pfd, 1, timeoutMs);
 
-        statMsg.timestamp = getTimestampNow();
+        bool crashed = false;
 
-        statMsg.paramServer = processMap.at("paramServer").IsAlive();
-        statMsg.mavlinkLcmBridge = processMap.at("mavlinkLcmBridge").IsAlive();
-        statMsg.mavlinkSerial = processMap.at("mavlinkSerial").IsAlive();
-        statMsg.stateEstimator = processMap.at("stateEstimator").IsAlive();
-        statMsg.windEstimator = processMap.at("windEstimator").IsAlive();
-        statMsg.controller = processMap.at("controller").IsAlive();
-        statMsg.logger = processMap.at("logger").IsAlive();
-        statMsg.stereo = processMap.at("stereo").IsAlive();
+        if (ret > 0)
+        {
+            // SIGCHLDs merge, so just clear them all and reap everything
+            struct signalfd_siginfo info;
+            while (read(childSignalFd, &info, sizeof(info)) == sizeof(info))
+            {
+            }
 
+            crashed = ReapChildren();
+        }
 
-        // send the message
-        lcmt_process_control_publish (lcm, channelProcessReport, &statMsg);
+        bool started = UpdateStartup();
 
+        now = GetRawMonotonicNow();
 
+        if (crashed || started || now >= nextStatus)
+        {
+            PublishStatus();
+            nextStatus = now + STATUS_PERIOD_USEC;
+        }
     }
     return NULL;
 }
@@ -176,8 +384,9 @@ int main(int argc,char** argv)
 
     char *channelProcessControl = NULL;
     char *configurationFile = NULL;
+    const char *channelProcessReady = DEFAULT_PROCESS_READY_CHANNEL;
 
-    if (argc!=5) {
+    if (argc != 5 && argc != 6) {
         usage();
         exit(0);
     }
@@ -187,6 +396,10 @@ int main(int argc,char** argv)
     channelProcessReport = argv[3];
     configurationFile = argv[4];
 
+    if (argc == 6) {
+        channelProcessReady = argv[5];
+    }
+
 
     // read the configuration file to get the processes we'll need
     GKeyFile *keyfile;
@@ -224,15 +437,69 @@ int main(int argc,char** argv)
         }
     }
 
+    // startup ordering, all optional
+    std::vector<std::string> autostart;
+
+    for (std::map<std::string, ProcessControlProc>::iterator it = processMap.begin(); it != processMap.end(); it++)
+    {
+        const char *group = it->first.c_str();
+
+        std::vector<std::string> dependsOn;
+        gsize numDepends = 0;
+
+        char **dependsList = g_key_file_get_string_list(keyfile, group, "depends_on", &numDepends, NULL);
+
+        for (int j = 0; j < (int)numDepends; j++)
+        {
+            if (processMap.find(dependsList[j]) == processMap.end())
+            {
+                fprintf(stderr, "Error: %s depends on %s, which isn't in the configuration file\n", group, dependsList[j]);
+                exit(-1);
+            }
+
+            dependsOn.push_back(dependsList[j]);
+        }
+
+        g_strfreev(dependsList);
+
+        bool signalsReady = g_key_file_get_boolean(keyfile, group, "ready_signal", NULL);
+
+        GError *timeoutError = NULL;
+        double readyTimeout = g_key_file_get_double(keyfile, group, "ready_timeout", &timeoutError);
+
+        if (timeoutError != NULL)
+        {
+            readyTimeout = DEFAULT_READY_TIMEOUT_SEC;
+            g_error_free(timeoutError);
+        }
+
+        it->second.SetStartup(dependsOn, signalsReady, readyTimeout * 1000000);
+
+        if (g_key_file_get_boolean(keyfile, group, "autostart", NULL))
+        {
+            autostart.push_back(it->first);
+        }
+    }
+
     // now throw an error if the configuration file doesn't have all the right parts
-    CheckForProc("paramServer");
-    CheckForProc("mavlinkLcmBridge");
-    CheckForProc("mavlinkSerial");
-    CheckForProc("stateEstimator");
-    CheckForProc("windEstimator");
-    CheckForProc("controller");
-    CheckForProc("logger");
-    CheckForProc("stereo");
+    for (int i = 0; i < numControlledProcesses; i++)
+    {
+        CheckForProc(controlledProcesses[i].name);
+    }
+
+    // children exiting are read from a signalfd by the status thread, so
+    // block SIGCHLD before starting any threads
+    sigset_t childSignal;
+    sigemptyset(&childSignal);
+    sigaddset(&childSignal, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &childSignal, NULL);
+
+    childSignalFd = signalfd(-1, &childSignal, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (childSignalFd < 0)
+    {
+        perror("signalfd");
+        return 1;
+    }
 
 
     lcm = lcm_create ("udpm://239.255.76.67:7667?ttl=1");
@@ -243,6 +510,19 @@ int main(int argc,char** argv)
     }
 
     process_control_sub = lcmt_process_control_subscribe(lcm, channelProcessControl, &procces_control_handler, NULL);
+    process_ready_sub = lcmt_process_ready_subscribe(lcm, channelProcessReady, &process_ready_handler, NULL);
+
+    // everything that doesn't wait on anything starts at once
+    {
+        std::lock_guard<std::mutex> lock(processMutex);
+
+        for (const std::string &name : autostart)
+        {
+            processMap.at(name).RequestStart();
+        }
+
+        StartPendingProcesses();
+    }
 
     signal(SIGINT,sighandler);
 
@@ -250,7 +530,7 @@ int main(int argc,char** argv)
 
     pthread_create( &processStatusThread, NULL, ProcessStatusThreadFunc, NULL);
 
-    printf("Receiving:\n\tProcess Control LCM: %s\nPublishing LCM:\n\tStereo: %s\n\tStatus: %s\n", channelProcessControl, channelStereoControl, channelProcessReport);
+    printf("Receiving:\n\tProcess Control LCM: %s\n\tProcess Ready: %s\nPublishing LCM:\n\tStereo: %s\n\tStatus: %s\n", channelProcessControl, channelProcessReady, channelStereoControl, channelProcessReport);
 
     while (true)
     {
@@ -18,7 +18,7 @@
 #include "main.h"
 
 // labjack header
-#include "u3.h"
+#include "u3stream.h"
 #include <unistd.h>
 
 #define true 1
@@ -57,6 +57,9 @@
 #define THROTTLE_FEEDBACK 3
 #define AILERON_FEEDBACK 1
 
+// feedback scans per second while estimating the bias
+#define FEEDBACK_SCAN_RATE 1000
+
 // function that converts 0-255 to voltage
 float ServoToVoltage(int servo);
 
@@ -171,57 +174,35 @@ int radio_labjack()
     throttleE = SetVoltage(throttleV + biasThrottle, THROTTLE, hDevice, caliInfo1, caliInfo2);
     rudderE = SetVoltage(rudderV + biasRudder, RUDDER, hDevice, caliInfo1, caliInfo2);
     
-    double dblVoltage, biasSumElevator, biasSumAileron, biasSumThrottle, biasSumRudder;
-    
-    int q;
+    // read the feedback in stream mode: the U3 samples all four on its own
+    // clock, instead of a USB round trip per reading
+    u3Stream feedbackStream;
+    uint8 feedbackChannels[4] = { ELEVATOR_FEEDBACK, RUDDER_FEEDBACK, THROTTLE_FEEDBACK, AILERON_FEEDBACK };
+    double feedbackMeans[4];
+
     int biasNum = 1000;
-    
-    biasSumElevator = 0;
-    biasSumAileron = 0;
-    biasSumThrottle = 0;
-    biasSumRudder = 0;
 
-    for (q=0;q<biasNum;q++)
+    if((error = u3StreamStart(&feedbackStream, hDevice, &caliInfo, 4, feedbackChannels, FEEDBACK_SCAN_RATE)) != 0)
     {
-        if((error = eAIN(hDevice, &caliInfo, 1, &DAC1Enable, ELEVATOR_FEEDBACK, 31, &dblVoltage, 0, 0, 0, 0, 0, 0)) != 0)
-        {
-            printf("Received an error code of %ld\n", error);
-            closeUSBConnection(hDevice);
-            return 0;
-        }
-        biasSumElevator += dblVoltage;
-        
-        if((error = eAIN(hDevice, &caliInfo, 1, &DAC1Enable, RUDDER_FEEDBACK, 31, &dblVoltage, 0, 0, 0, 0, 0, 0)) != 0)
-        {
-            printf("Received an error code of %ld\n", error);
-            closeUSBConnection(hDevice);
-            return 0;
-        }
-        biasSumRudder += dblVoltage;
-        
-        if((error = eAIN(hDevice, &caliInfo, 1, &DAC1Enable, THROTTLE_FEEDBACK, 31, &dblVoltage, 0, 0, 0, 0, 0, 0)) != 0)
-        {
-            printf("Received an error code of %ld\n", error);
-            closeUSBConnection(hDevice);
-            return 0;
-        }
-        biasSumThrottle += dblVoltage;
-        
-        if((error = eAIN(hDevice, &caliInfo, 1, &DAC1Enable, AILERON_FEEDBACK, 31, &dblVoltage, 0, 0, 0, 0, 0, 0)) != 0)
-        {
-            printf("Received an error code of %ld\n", error);
-            closeUSBConnection(hDevice);
-            return 0;
-        }
-        biasSumAileron += dblVoltage;
-        
-        sleep(0.1);
+        printf("Received an error code of %ld\n", error);
+        closeUSBConnection(hDevice);
+        return 0;
     }
-    
-    biasElevator = biasSumElevator / (float)biasNum - elevatorV;
-    biasRudder = biasSumRudder / (float)biasNum - rudderV;
-    biasThrottle = biasSumThrottle / (float)biasNum - throttleV;
-    biasAileron = biasSumAileron / (float)biasNum - aileronV;
+
+    if(u3StreamGetMeans(&feedbackStream, biasNum, feedbackMeans) < 0)
+    {
+        printf("Error: feedback stream failed.\n");
+        u3StreamStop(&feedbackStream);
+        closeUSBConnection(hDevice);
+        return 0;
+    }
+
+    u3StreamStop(&feedbackStream);
+
+    biasElevator = feedbackMeans[0] - elevatorV;
+    biasRudder = feedbackMeans[1] - rudderV;
+    biasThrottle = feedbackMeans[2] - throttleV;
+    biasAileron = feedbackMeans[3] - aileronV;
     printf("Elevator bias:\t%.3f\n", biasElevator);
     printf("Rudder bias:\t%.3f\n", biasRudder);
     printf("Throttle bias:\t%.3f\n", biasThrottle);
@@ -8,6 +8,8 @@ SpacialStereoFilter::SpacialStereoFilter(float distance_threshold, int number_of
     // always include a point as a hit itself, which effectively means that the number
     // of points is reduced by one
     num_points_threshold_ = number_of_nearby_points_threshold - 1;
+
+    cell_size_ = distance_threshold_ > 0 ? distance_threshold_ : 1;
 }
 
 /**
@@ -27,44 +29,143 @@ const lcmt::stereo* SpacialStereoFilter::ProcessMessage(const lcmt::stereo &msg)
     filtered_msg->frame_number = msg.frame_number;
     filtered_msg->video_number = msg.video_number;
 
-    if (msg.number_of_points < num_points_threshold_) {
-        filtered_msg->number_of_points = 0;
-        return filtered_msg;
+    keep_.assign(msg.number_of_points, 1);
+
+    int point_counter = FilterPoints(msg, &keep_);
+
+    filtered_msg->x.reserve(point_counter);
+    filtered_msg->y.reserve(point_counter);
+    filtered_msg->z.reserve(point_counter);
+
+    for (int i = 0; i < msg.number_of_points; i++) {
+        if (keep_[i] != 0) {
+            filtered_msg->x.push_back(msg.x[i]);
+            filtered_msg->y.push_back(msg.y[i]);
+            filtered_msg->z.push_back(msg.z[i]);
+        }
     }
 
-    std::vector<int> hit_counter(msg.number_of_points);
+    filtered_msg->grey.assign(point_counter, 0);
+    filtered_msg->number_of_points = point_counter;
+
+    return filtered_msg;
+}
+
+/**
+ * Filters a stereo message's points in place: drops the points that don't
+ * have enough neighbors by setting their bytes in keep to 0.  Only the
+ * points keep already has are looked at (as points and as neighbors), so
+ * filters can run one after another on the same mask without copying the
+ * message.
+ *
+ * Points are binned into a hashed grid first, so each one is only compared
+ * with the points in the cells around it, and only until it has enough
+ * neighbors.
+ *
+ * @param msg LCM stereo message to be filtered
+ * @param keep a byte for each point in msg, nonzero for the points still in
+ *      (all 1 for the first filter).  Points that are filtered out get 0.
+ *
+ * @retval number of points left
+ */
+int SpacialStereoFilter::FilterPoints(const lcmt::stereo &msg, std::vector<uint8_t> *keep) {
+
+    uint8_t *keep_data = keep->data();
+
+    cell_points_.clear();
 
     for (int i = 0; i < msg.number_of_points; i++) {
+        if (keep_data[i] != 0) {
+            int64_t key = GetCellKey(floor(msg.x[i] / cell_size_), floor(msg.y[i] / cell_size_), floor(msg.z[i] / cell_size_));
 
-        for (int j = i+1; j < msg.number_of_points; j++) {
-            float dist = DistanceFunction(msg.x[i], msg.x[j], msg.y[i], msg.y[j], msg.z[i], msg.z[j]);
-            if (dist <= distance_threshold_) {
-                hit_counter[i] ++;
-                hit_counter[j] ++;
-            }
+            cell_points_.push_back(std::make_pair(key, i));
+        }
+    }
+
+    int num_in = cell_points_.size();
+
+    if (num_in < num_points_threshold_) {
+        std::fill(keep->begin(), keep->end(), 0);
+        return 0;
+    }
+
+    std::sort(cell_points_.begin(), cell_points_.end());
+
+    cells_.clear();
+
+    for (int i = 0; i < num_in; ) {
+        int end = i + 1;
+
+        while (end < num_in && cell_points_[end].first == cell_points_[i].first) {
+            end ++;
         }
+
+        cells_[cell_points_[i].first] = std::make_pair(i, end);
+        i = end;
     }
 
+    float sqr_threshold = distance_threshold_ * distance_threshold_;
+
+    // neighbors come from cell_points_, which is already built, so dropping
+    // a point here doesn't change the counts of the ones after it
     int point_counter = 0;
     for (int i = 0; i < msg.number_of_points; i++) {
-        if (hit_counter[i] >= num_points_threshold_) {
-            filtered_msg->x.push_back(msg.x[i]);
-            filtered_msg->y.push_back(msg.y[i]);
-            filtered_msg->z.push_back(msg.z[i]);
-            filtered_msg->grey.push_back(0);
 
+        if (keep_data[i] == 0) {
+            continue;
+        }
+
+        int64_t cell[3] = { (int64_t)floor(msg.x[i] / cell_size_), (int64_t)floor(msg.y[i] / cell_size_), (int64_t)floor(msg.z[i] / cell_size_) };
+
+        int hits = 0;
+
+        for (int dx = -1; dx <= 1 && hits < num_points_threshold_; dx++) {
+            for (int dy = -1; dy <= 1 && hits < num_points_threshold_; dy++) {
+                for (int dz = -1; dz <= 1 && hits < num_points_threshold_; dz++) {
+
+                    auto found = cells_.find(GetCellKey(cell[0] + dx, cell[1] + dy, cell[2] + dz));
+
+                    if (found == cells_.end()) {
+                        continue;
+                    }
+
+                    for (int k = found->second.first; k < found->second.second && hits < num_points_threshold_; k++) {
+                        int j = cell_points_[k].second;
+
+                        if (j == i) {
+                            continue;
+                        }
+
+                        float x = msg.x[i] - msg.x[j];
+                        float y = msg.y[i] - msg.y[j];
+                        float z = msg.z[i] - msg.z[j];
+
+                        if (x * x + y * y + z * z <= sqr_threshold) {
+                            hits ++;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (hits >= num_points_threshold_) {
             point_counter ++;
+        } else {
+            keep_data[i] = 0;
         }
     }
 
-    filtered_msg->number_of_points = point_counter;
-
-    return filtered_msg;
+    return point_counter;
 }
 
-float SpacialStereoFilter::DistanceFunction(float x1, float x2, float y1, float y2, float z1, float z2) {
-    //std::cout << "sqrt( ( " << x1 << " - " << x2 << ")^2 + (" << y1 << " - " << y2 << ")^2 + (" << z1 << " - " << z2 << ")^2  ) = " << sqrt(  (x1-x2)*(x1-x2) + (y1-y2)*(y1-y2) + (z1-z2)*(z1-z2)   ) << std::endl;
-    return sqrt(  (x1-x2)*(x1-x2) + (y1-y2)*(y1-y2) + (z1-z2)*(z1-z2)   );
+/**
+ * @retval a key for the cell at (x, y, z), with 21 bits for each
+ *      coordinate
+ */
+int64_t SpacialStereoFilter::GetCellKey(int64_t x, int64_t y, int64_t z) {
+    const int64_t mask = (1 << 21) - 1;
+
+    return ((x & mask) << 42) | ((y & mask) << 21) | (z & mask);
 }
 
 
@@ -218,6 +319,113 @@ TEST(SpacialStereoFilterTest, SomeHitsSomeMisses) {
 
 
 
+TEST(SpacialStereoFilterTest, MatchesPairwise) {
+    // the grid has to find the same points as comparing every pair does,
+    // including across cell boundaries
+    SpacialStereoFilter filter(0.5, 4);
+
+    lcmt::stereo msg;
+
+    msg.timestamp = GetTimestampNow();
+
+    msg.video_number = 3;
+    msg.frame_number = 452;
+
+    srand(0);
+
+    for (int i = 0; i < 1000; i++) {
+        msg.x.push_back(-4 + 8.0 * rand() / RAND_MAX);
+        msg.y.push_back(-4 + 8.0 * rand() / RAND_MAX);
+        msg.z.push_back(-1 + 2.0 * rand() / RAND_MAX);
+        msg.grey.push_back(0);
+    }
+
+    msg.number_of_points = msg.x.size();
+
+    std::vector<int> expected;
+
+    for (int i = 0; i < msg.number_of_points; i++) {
+        int hits = 0;
+
+        for (int j = 0; j < msg.number_of_points; j++) {
+            float dist = sqrt((msg.x[i] - msg.x[j]) * (msg.x[i] - msg.x[j]) + (msg.y[i] - msg.y[j]) * (msg.y[i] - msg.y[j])
+                + (msg.z[i] - msg.z[j]) * (msg.z[i] - msg.z[j]));
+
+            if (j != i && dist <= 0.5) {
+                hits ++;
+            }
+        }
+
+        if (hits >= 3) {
+            expected.push_back(i);
+        }
+    }
+
+    const lcmt::stereo *msg2 = filter.ProcessMessage(msg);
+
+    ASSERT_TRUE(msg2->number_of_points == int(expected.size())) << "Number of points = " << msg2->number_of_points << ", expected " << expected.size();
+
+    for (int i = 0; i < msg2->number_of_points; i++) {
+        EXPECT_NEAR(msg2->x[i], msg.x[expected[i]], THRESHOLD);
+        EXPECT_NEAR(msg2->y[i], msg.y[expected[i]], THRESHOLD);
+        EXPECT_NEAR(msg2->z[i], msg.z[expected[i]], THRESHOLD);
+    }
+
+    delete msg2;
+}
+
+TEST(SpacialStereoFilterTest, FilterPointsMatchesProcessMessage) {
+    // the mask keeps the same points ProcessMessage() copies, and points
+    // already dropped aren't anyone's neighbors
+    SpacialStereoFilter filter(1.0, 3);
+
+    lcmt::stereo msg;
+
+    msg.timestamp = GetTimestampNow();
+
+    msg.video_number = 3;
+    msg.frame_number = 452;
+
+    float points[5][3] = { { 0, 0, 0 }, { -0.1, -0.1, -0.5 }, { -0.2, 0, 0 }, { 10, 0, 0 }, { 0.1, 0, 0 } };
+
+    for (int i = 0; i < 5; i++) {
+        msg.x.push_back(points[i][0]);
+        msg.y.push_back(points[i][1]);
+        msg.z.push_back(points[i][2]);
+        msg.grey.push_back(0);
+    }
+
+    msg.number_of_points = 5;
+
+    std::vector<uint8_t> keep(5, 1);
+
+    EXPECT_EQ(filter.FilterPoints(msg, &keep), 4);
+
+    uint8_t expected[5] = { 1, 1, 1, 0, 1 };
+
+    for (int i = 0; i < 5; i++) {
+        EXPECT_EQ(keep[i], expected[i]) << "point " << i;
+    }
+
+    const lcmt::stereo *msg2 = filter.ProcessMessage(msg);
+
+    ASSERT_TRUE(msg2->number_of_points == 4);
+    EXPECT_NEAR(msg2->x[3], 0.1, THRESHOLD);
+
+    delete msg2;
+
+    // without two of them, the others don't have enough neighbors
+    keep.assign(5, 1);
+    keep[1] = 0;
+    keep[2] = 0;
+
+    EXPECT_EQ(filter.FilterPoints(msg, &keep), 0);
+
+    for (int i = 0; i < 5; i++) {
+        EXPECT_EQ(keep[i], 0) << "point " << i;
+    }
+}
+
 //TEST(SpacialStereoFilterTest, NoHitPoints) {
     //StereoFilter filter(0.01);
 
@@ -5,6 +5,9 @@
 #include <iostream>
 #include <math.h>
 #include <mutex>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
 
 #include <lcm/lcm-cpp.hpp>
 #include "gtest/gtest.h"
@@ -19,13 +22,27 @@ class SpacialStereoFilter {
     public:
         SpacialStereoFilter(float distance_threshold, int number_of_nearby_points_threshold);
         const lcmt::stereo* ProcessMessage(const lcmt::stereo &msg);
+        int FilterPoints(const lcmt::stereo &msg, std::vector<uint8_t> *keep);
 
     private:
-        static float DistanceFunction(float x1, float x2, float y1, float y2, float z1, float z2);
+        static int64_t GetCellKey(int64_t x, int64_t y, int64_t z);
 
         int num_points_threshold_;
         float distance_threshold_;
 
+        // points are binned into cells distance_threshold_ on a side, so a
+        // point's neighbors are all in its cell or the 26 around it
+        float cell_size_;
+
+        // each point's cell key and index, sorted by cell, and where each
+        // cell's run of them is.  Kept between messages so they don't
+        // allocate once they're big enough.
+        std::vector<std::pair<int64_t, int> > cell_points_;
+        std::unordered_map<int64_t, std::pair<int, int> > cells_;
+
+        // ProcessMessage()'s mask
+        std::vector<uint8_t> keep_;
+
 };
 
 #endif
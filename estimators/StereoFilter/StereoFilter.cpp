@@ -1,9 +1,14 @@
 #include "StereoFilter.hpp"
 
-StereoFilter::StereoFilter(float distance_threshold) {
-    last_stereo_msg_ = nullptr;
+StereoFilter::StereoFilter(float distance_threshold, int history_frames, int min_frames) {
     distance_threshold_ = distance_threshold;
+    cell_size_ = distance_threshold_ > 0 ? distance_threshold_ : 1;
 
+    frames_.resize(std::max(history_frames, 1));
+    newest_frame_ = 0;
+    num_frames_ = 0;
+
+    min_frames_ = std::max(std::min(min_frames, int(frames_.size())), 1);
 }
 
 /**
@@ -18,9 +23,6 @@ StereoFilter::StereoFilter(float distance_threshold) {
  */
 const lcmt::stereo* StereoFilter::ProcessMessage(const lcmt::stereo &msg) {
 
-
-    //std::cout << "Process message called" << std::endl << "=================================" << std::endl;
-
     // build a new stereo message to return
 
     lcmt::stereo *filtered_msg = new lcmt::stereo();
@@ -29,25 +31,52 @@ const lcmt::stereo* StereoFilter::ProcessMessage(const lcmt::stereo &msg) {
     filtered_msg->frame_number = msg.frame_number;
     filtered_msg->video_number = msg.video_number;
 
+    keep_.assign(msg.number_of_points, 1);
 
-    // check to see if filtering is possible
-    if (last_stereo_msg_ == nullptr) {
-        filtered_msg->number_of_points = 0;
+    int point_counter = FilterPoints(msg, &keep_);
 
+    filtered_msg->x.reserve(point_counter);
+    filtered_msg->y.reserve(point_counter);
+    filtered_msg->z.reserve(point_counter);
 
-        last_stereo_msg_ = new lcmt::stereo(msg);
-        return filtered_msg;
+    for (int i = 0; i < msg.number_of_points; i++) {
+        if (keep_[i] != 0) {
+            filtered_msg->x.push_back(msg.x[i]);
+            filtered_msg->y.push_back(msg.y[i]);
+            filtered_msg->z.push_back(msg.z[i]);
+        }
     }
 
+    filtered_msg->number_of_points = point_counter;
+
+    return filtered_msg;
 
-    //PrintMsg(last_stereo_msg_, "last message");
-    //PrintMsg(msg, "this message");
+}
 
-    if (msg.frame_number - last_stereo_msg_->frame_number < 0) {
-        //std::cout << "JUMP BACK" << std::endl;
-        delete last_stereo_msg_;
-        last_stereo_msg_ = new lcmt::stereo(msg);
-        return filtered_msg;
+/**
+ * Filters a stereo message's points in place: drops the points that aren't
+ * near points in enough of the last frames by setting their bytes in keep
+ * to 0.  Points keep has already dropped are skipped, so this can run
+ * after (or before) other filters on the same mask without copying the
+ * message.  All of the message's points go in the history either way.
+ *
+ * @param msg LCM stereo message to be filtered
+ * @param keep a byte for each point in msg, nonzero for the points still in
+ *      (all 1 for the first filter).  Points that are filtered out get 0.
+ *
+ * @retval number of points left
+ */
+int StereoFilter::FilterPoints(const lcmt::stereo &msg, std::vector<uint8_t> *keep) {
+
+    uint8_t *keep_data = keep->data();
+
+    // check to see if filtering is possible
+    if (num_frames_ == 0 || msg.frame_number - frames_[newest_frame_].frame_number < 0) {
+        // first frame, or a jump back in a log
+        num_frames_ = 0;
+        std::fill(keep->begin(), keep->end(), 0);
+        AddFrame(msg);
+        return 0;
     }
 
     int point_counter = 0;
@@ -55,49 +84,135 @@ const lcmt::stereo* StereoFilter::ProcessMessage(const lcmt::stereo &msg) {
     // filtering is possible
     for (int i = 0; i < msg.number_of_points; i++) {
 
-        if (FilterSinglePoint(msg.x[i], msg.y[i], msg.z[i])) {
-            filtered_msg->x.push_back(msg.x[i]);
-            filtered_msg->y.push_back(msg.y[i]);
-            filtered_msg->z.push_back(msg.z[i]);
+        if (keep_data[i] == 0) {
+            continue;
+        }
 
+        if (FilterSinglePoint(msg.x[i], msg.y[i], msg.z[i])) {
             point_counter ++;
+        } else {
+            keep_data[i] = 0;
         }
     }
 
-    filtered_msg->number_of_points = point_counter;
+    AddFrame(msg);
+
+    return point_counter;
+}
 
-    delete last_stereo_msg_;
-    last_stereo_msg_ = new lcmt::stereo(msg);
 
+/**
+ * @retval true if the point is near a point in enough of the last frames
+ */
+bool StereoFilter::FilterSinglePoint(float x, float y, float z) const {
 
+    int hits = 0;
 
-    return filtered_msg;
+    for (int i = 0; i < num_frames_; i++) {
+        int frame = (newest_frame_ - i + frames_.size()) % frames_.size();
 
+        if (AnyNearPoint(frames_[frame], x, y, z)) {
+            hits ++;
+
+            if (hits >= min_frames_) {
+                return true;
+            }
+        }
+    }
+
+    return false;
 }
 
+/**
+ * @retval true if any of the frame's points is closer than
+ *      distance_threshold_ to the point
+ */
+bool StereoFilter::AnyNearPoint(const StereoFilterFrame &frame, float x, float y, float z) const {
+
+    int64_t cell[3] = { (int64_t)floor(x / cell_size_), (int64_t)floor(y / cell_size_), (int64_t)floor(z / cell_size_) };
 
-bool StereoFilter::FilterSinglePoint(float x, float y, float z) {
+    float sqr_threshold = distance_threshold_ * distance_threshold_;
 
-    // check to see if this is near any of the points in the last message
-    // NOTE: could implement an octree search if this linear search turns out to be too slow
-    for (int i = 0; i < last_stereo_msg_->number_of_points; i++) {
-        // compute distance to this point
-        float dist = DistanceFunction(x, last_stereo_msg_->x[i], y, last_stereo_msg_->y[i], z, last_stereo_msg_->z[i]);
-       // std::cout << "dist = " << dist << std::endl;
-        if (dist < distance_threshold_) {
+    for (int dx = -1; dx <= 1; dx++) {
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dz = -1; dz <= 1; dz++) {
 
-      //      std::cout << "(" << last_stereo_msg_->x[i] << ", " << x << ") , (" << last_stereo_msg_->y[i] << ", " << y << ") , (" << last_stereo_msg_->z[i] << ", " << z << ")" << std::endl;
-            return true;
+                auto found = frame.cells.find(GetCellKey(cell[0] + dx, cell[1] + dy, cell[2] + dz));
+
+                if (found == frame.cells.end()) {
+                    continue;
+                }
+
+                for (int k = found->second.first; k < found->second.second; k++) {
+                    int j = frame.cell_points[k].second;
+
+                    float x_dist = x - frame.x[j];
+                    float y_dist = y - frame.y[j];
+                    float z_dist = z - frame.z[j];
+
+                    if (x_dist * x_dist + y_dist * y_dist + z_dist * z_dist < sqr_threshold) {
+                        return true;
+                    }
+                }
+            }
         }
     }
+
     return false;
+}
+
+/**
+ * Puts a message's points in the oldest frame's buffers (or an empty one's)
+ * and makes it the newest.
+ */
+void StereoFilter::AddFrame(const lcmt::stereo &msg) {
+
+    newest_frame_ = (newest_frame_ + 1) % frames_.size();
+    num_frames_ = std::min(num_frames_ + 1, int(frames_.size()));
+
+    StereoFilterFrame &frame = frames_[newest_frame_];
+
+    frame.frame_number = msg.frame_number;
+
+    frame.x.assign(msg.x.begin(), msg.x.begin() + msg.number_of_points);
+    frame.y.assign(msg.y.begin(), msg.y.begin() + msg.number_of_points);
+    frame.z.assign(msg.z.begin(), msg.z.begin() + msg.number_of_points);
+
+    frame.cell_points.resize(msg.number_of_points);
+
+    for (int i = 0; i < msg.number_of_points; i++) {
+        frame.cell_points[i].first = GetCellKey(frame.x[i], frame.y[i], frame.z[i]);
+        frame.cell_points[i].second = i;
+    }
+
+    std::sort(frame.cell_points.begin(), frame.cell_points.end());
+
+    frame.cells.clear();
+
+    for (int i = 0; i < msg.number_of_points; ) {
+        int end = i + 1;
 
+        while (end < msg.number_of_points && frame.cell_points[end].first == frame.cell_points[i].first) {
+            end ++;
+        }
+
+        frame.cells[frame.cell_points[i].first] = std::make_pair(i, end);
+        i = end;
+    }
+}
 
+int64_t StereoFilter::GetCellKey(float x, float y, float z) const {
+    return GetCellKey((int64_t)floor(x / cell_size_), (int64_t)floor(y / cell_size_), (int64_t)floor(z / cell_size_));
 }
 
-float StereoFilter::DistanceFunction(float x1, float x2, float y1, float y2, float z1, float z2) {
-    //std::cout << "sqrt( ( " << x1 << " - " << x2 << ")^2 + (" << y1 << " - " << y2 << ")^2 + (" << z1 << " - " << z2 << ")^2  ) = " << sqrt(  (x1-x2)*(x1-x2) + (y1-y2)*(y1-y2) + (z1-z2)*(z1-z2)   ) << std::endl;
-    return sqrt(  (x1-x2)*(x1-x2) + (y1-y2)*(y1-y2) + (z1-z2)*(z1-z2)   );
+/**
+ * @retval a key for the cell at (x, y, z), with 21 bits for each
+ *      coordinate
+ */
+int64_t StereoFilter::GetCellKey(int64_t x, int64_t y, int64_t z) {
+    const int64_t mask = (1 << 21) - 1;
+
+    return ((x & mask) << 42) | ((y & mask) << 21) | (z & mask);
 }
 
 void StereoFilter::PrintMsg(const lcmt::stereo &msg, std::string header) const {
@@ -186,3 +301,100 @@ TEST(StereoFilterTest, NoHitPoints) {
     delete msg2;
 }
 
+TEST(StereoFilterTest, KOfNFrames) {
+    // kept only if it was near a point in 2 of the last 3 frames
+    StereoFilter filter(0.5, 3, 2);
+
+    lcmt::stereo msg;
+
+    msg.timestamp = GetTimestampNow();
+
+    msg.video_number = 1;
+    msg.frame_number = 0;
+
+    msg.x.push_back(5);
+    msg.y.push_back(0);
+    msg.z.push_back(0);
+
+    msg.number_of_points = 1;
+
+    const lcmt::stereo *msg2;
+    msg2 = filter.ProcessMessage(msg);
+    delete msg2;
+
+    // only one frame before it
+    msg.frame_number = 1;
+    msg2 = filter.ProcessMessage(msg);
+
+    EXPECT_EQ_ARM(msg2->number_of_points, 0);
+    delete msg2;
+
+    // two frames before it, across a cell boundary
+    msg.frame_number = 2;
+    msg.x[0] = 4.8;
+    msg2 = filter.ProcessMessage(msg);
+
+    ASSERT_TRUE(msg2->number_of_points == 1);
+    EXPECT_NEAR(msg2->x[0], 4.8, 0.0001);
+    delete msg2;
+
+    // a point that's new
+    msg.frame_number = 3;
+    msg.x[0] = 10;
+    msg2 = filter.ProcessMessage(msg);
+
+    EXPECT_EQ_ARM(msg2->number_of_points, 0);
+    delete msg2;
+
+    // jumping back starts over
+    msg.frame_number = 0;
+    msg2 = filter.ProcessMessage(msg);
+
+    EXPECT_EQ_ARM(msg2->number_of_points, 0);
+    delete msg2;
+}
+
+TEST(StereoFilterTest, FilterPointsChains) {
+    // points an earlier filter dropped stay dropped, but still go in the
+    // history
+    StereoFilter filter(0.5);
+
+    lcmt::stereo msg;
+
+    msg.timestamp = GetTimestampNow();
+
+    msg.video_number = 1;
+    msg.frame_number = 0;
+
+    msg.x.push_back(0);
+    msg.y.push_back(0);
+    msg.z.push_back(0);
+
+    msg.x.push_back(5);
+    msg.y.push_back(0);
+    msg.z.push_back(0);
+
+    msg.number_of_points = 2;
+
+    std::vector<uint8_t> keep(2, 1);
+
+    // nothing to compare the first frame with
+    EXPECT_EQ(filter.FilterPoints(msg, &keep), 0);
+    EXPECT_EQ(keep[0], 0);
+    EXPECT_EQ(keep[1], 0);
+
+    msg.frame_number = 1;
+    keep[0] = 0;
+    keep[1] = 1;
+
+    EXPECT_EQ(filter.FilterPoints(msg, &keep), 1);
+    EXPECT_EQ(keep[0], 0);
+    EXPECT_EQ(keep[1], 1);
+
+    msg.frame_number = 2;
+    keep.assign(2, 1);
+
+    EXPECT_EQ(filter.FilterPoints(msg, &keep), 2);
+    EXPECT_EQ(keep[0], 1);
+    EXPECT_EQ(keep[1], 1);
+}
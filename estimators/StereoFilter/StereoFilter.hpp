@@ -5,6 +5,9 @@
 #include <iostream>
 #include <math.h>
 #include <mutex>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
 
 #include <lcm/lcm-cpp.hpp>
 #include "gtest/gtest.h"
@@ -13,24 +16,59 @@
 #include "../../utils/utils/RealtimeUtils.hpp"
 
 
+/**
+ * One earlier frame's points, binned into cells distance_threshold_ on a
+ * side so a point's neighbors are all in its cell or the 26 around it.
+ */
+struct StereoFilterFrame {
+    int64_t frame_number;
+
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+
+    // each point's cell key and index, sorted by cell, and where each
+    // cell's run of them is
+    std::vector<std::pair<int64_t, int> > cell_points;
+    std::unordered_map<int64_t, std::pair<int, int> > cells;
+};
+
 class StereoFilter {
 
 
     public:
-        StereoFilter(float distance_threshold);
+        // a point is kept if it's near a point in at least min_frames of
+        // the last history_frames frames
+        StereoFilter(float distance_threshold, int history_frames = 1, int min_frames = 1);
         const lcmt::stereo* ProcessMessage(const lcmt::stereo &msg);
+        int FilterPoints(const lcmt::stereo &msg, std::vector<uint8_t> *keep);
 
     private:
 
 
-        bool FilterSinglePoint(float x, float y, float z);
-        float DistanceFunction(float x1, float x2, float y1, float y2, float z1, float z2);
+        bool FilterSinglePoint(float x, float y, float z) const;
+        bool AnyNearPoint(const StereoFilterFrame &frame, float x, float y, float z) const;
+        void AddFrame(const lcmt::stereo &msg);
+
+        int64_t GetCellKey(float x, float y, float z) const;
+        static int64_t GetCellKey(int64_t x, int64_t y, int64_t z);
 
         void PrintMsg(const lcmt::stereo &msg, std::string header = "begin message") const;
 
-        const lcmt::stereo *last_stereo_msg_;
+        // the last frames, reused in a ring so they don't allocate once
+        // they're big enough.  frames_[newest_frame_] is the newest and
+        // num_frames_ of them are filled.
+        std::vector<StereoFilterFrame> frames_;
+        int newest_frame_;
+        int num_frames_;
+
+        int min_frames_;
+
+        // ProcessMessage()'s mask
+        std::vector<uint8_t> keep_;
 
         float distance_threshold_;
+        float cell_size_;
 
         std::mutex process_mutex_;
 
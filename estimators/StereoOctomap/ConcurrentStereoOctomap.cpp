@@ -0,0 +1,428 @@
+#include "ConcurrentStereoOctomap.hpp"
+
+/**
+ * Sets up the map.
+ *
+ * @param bot_frames frames to get the camera's transform from
+ * @param use_thread true to add messages on a background thread, false to
+ *      add them right away in ProcessStereoMessage()
+ */
+ConcurrentStereoOctomap::ConcurrentStereoOctomap(BotFrames *bot_frames, bool use_thread) {
+
+    bot_frames_ = bot_frames;
+    transforms_ = TransformCache::Get(bot_frames_);
+    use_thread_ = use_thread;
+
+    maps_[0] = new StereoOctomap(bot_frames_);
+    maps_[1] = use_thread_ ? new StereoOctomap(bot_frames_) : NULL;
+
+    active_ = 0;
+    readers_[0] = 0;
+    readers_[1] = 0;
+
+    num_pending_ = 0;
+    num_dropped_ = 0;
+
+    distance_field_center_[0] = 0;
+    distance_field_center_[1] = 0;
+    distance_field_center_[2] = 0;
+
+    hud_lcm_ = NULL;
+
+    snapshot_period_us_ = 0;
+    last_snapshot_time_ = -1;
+    snapshot_failed_ = false;
+
+    shutting_down_ = false;
+
+    if (use_thread_) {
+        for (int i = 0; i < OCTOMAP_QUEUE_SIZE - 1; i++) {
+            free_jobs_.Push(i);
+        }
+
+        pthread_create(&thread_, NULL, WriterThread, this);
+    }
+}
+
+ConcurrentStereoOctomap::~ConcurrentStereoOctomap() {
+
+    if (use_thread_) {
+        {
+            lock_guard<mutex> lock(job_mutex_);
+            shutting_down_ = true;
+        }
+
+        cv_new_job_.notify_one();
+
+        // the writer adds whatever is still queued before it exits
+        pthread_join(thread_, NULL);
+    }
+
+    delete maps_[0];
+    delete maps_[1];
+}
+
+/**
+ * Adds a stereo message to the map (through the filter, if there is one).
+ * With a thread, the message is copied (with the camera's transform right
+ * now) and this returns right away; the writer filters it.  If
+ * the writer is somehow still busy with a whole queue of older messages,
+ * this one is dropped.
+ *
+ * @param msg stereo message
+ */
+void ConcurrentStereoOctomap::ProcessStereoMessage(const lcmt::stereo *msg) {
+
+    if (use_thread_ == false) {
+        if (filter_) {
+            BotTrans to_open_cv;
+            transforms_->GetCameraToLocalAt(msg->timestamp, &to_open_cv);
+
+            maps_[0]->ProcessStereoMessage(msg, &to_open_cv, FilterMessage(*msg, &to_open_cv));
+        } else {
+            maps_[0]->ProcessStereoMessage(msg);
+        }
+
+        WriteSnapshotIfDue(maps_[0], msg->timestamp);
+        return;
+    }
+
+    int job_number;
+
+    if (free_jobs_.Pop(&job_number) != true) {
+        num_dropped_ ++;
+        return;
+    }
+
+    StereoOctomapJob *job = &jobs_[job_number];
+
+    // copies into the job's buffers, which keep their size from last time
+    job->msg = *msg;
+
+    // the camera's transform when the frame was taken
+    transforms_->GetCameraToLocalAt(msg->timestamp, &job->to_open_cv);
+
+    num_pending_ ++;
+
+    ready_jobs_.Push(job_number);
+
+    {
+        lock_guard<mutex> lock(job_mutex_);
+    }
+
+    cv_new_job_.notify_one();
+}
+
+void ConcurrentStereoOctomap::EnableDistanceField(double cell_size, int cells_per_side, double max_distance) {
+
+    maps_[0]->EnableDistanceField(cell_size, cells_per_side, max_distance);
+
+    if (use_thread_) {
+        maps_[1]->EnableDistanceField(cell_size, cells_per_side, max_distance);
+    }
+}
+
+void ConcurrentStereoOctomap::SetMaxVoxels(int max_voxels) {
+
+    maps_[0]->SetMaxVoxels(max_voxels);
+
+    if (use_thread_) {
+        maps_[1]->SetMaxVoxels(max_voxels);
+    }
+}
+
+bool ConcurrentStereoOctomap::SetInsertRegion(const double low[3], const double high[3]) {
+
+    bool success = maps_[0]->SetInsertRegion(low, high);
+
+    if (use_thread_) {
+        maps_[1]->SetInsertRegion(low, high);
+    }
+
+    return success;
+}
+
+void ConcurrentStereoOctomap::SetAltitudeBand(double min_altitude, double max_altitude) {
+
+    maps_[0]->SetAltitudeBand(min_altitude, max_altitude);
+
+    if (use_thread_) {
+        maps_[1]->SetAltitudeBand(min_altitude, max_altitude);
+    }
+}
+
+/**
+ * Saves the map to a file every so often, from wherever messages are added
+ * (the writer thread, if there is one).  Call before the first
+ * ProcessStereoMessage().
+ *
+ * @param filename file to save to, best in /dev/shm so it stays off of the
+ *      disk (see StereoOctomap::WriteSnapshot())
+ * @param rate_hz most times a second to save it, going by the stereo
+ *      messages' timestamps
+ */
+void ConcurrentStereoOctomap::EnableSnapshots(const std::string &filename, double rate_hz) {
+
+    snapshot_filename_ = filename;
+    snapshot_period_us_ = rate_hz > 0 ? 1000000.0 / rate_hz : 0;
+}
+
+/**
+ * Starts from a saved map.  Call before the first ProcessStereoMessage().
+ *
+ * @param filename file from EnableSnapshots()
+ * @param now timestamp to age the saved voxels out against
+ *
+ * @retval false if there was no snapshot to read
+ */
+bool ConcurrentStereoOctomap::ReadSnapshot(const std::string &filename, int64_t now) {
+
+    if (maps_[0]->ReadSnapshot(filename, now) == false) {
+        return false;
+    }
+
+    if (use_thread_) {
+        maps_[1]->ReadSnapshot(filename, now);
+    }
+
+    return true;
+}
+
+int64_t ConcurrentStereoOctomap::GetNumEvictedVoxels() const {
+    StereoOctomapSnapshot snapshot(*this);
+
+    return snapshot->GetNumEvictedVoxels();
+}
+
+int64_t ConcurrentStereoOctomap::GetNumCulledPoints() const {
+    StereoOctomapSnapshot snapshot(*this);
+
+    return snapshot->GetNumCulledPoints();
+}
+
+/**
+ * Centers the distance field on a point.  Without a thread, this brings the
+ * field up to date right away (see StereoOctomap::UpdateDistanceField()).
+ * With one, the writer updates the field after each message, around the
+ * last point given here.
+ *
+ * @param center usually the aircraft's position
+ */
+void ConcurrentStereoOctomap::UpdateDistanceField(const double center[3]) {
+
+    if (use_thread_ == false) {
+        maps_[0]->UpdateDistanceField(center);
+        return;
+    }
+
+    lock_guard<mutex> lock(center_mutex_);
+
+    for (int i = 0; i < 3; i++) {
+        distance_field_center_[i] = center[i];
+    }
+}
+
+void ConcurrentStereoOctomap::Flush() {
+
+    while (num_pending_ > 0) {
+        usleep(1000);
+    }
+}
+
+void ConcurrentStereoOctomap::Draw(lcm_t *lcm) const {
+    StereoOctomapSnapshot snapshot(*this);
+
+    snapshot->Draw(lcm);
+}
+
+/**
+ * Sends the HUD what changed in the map (see StereoOctomap::PublishToHud()).
+ * With a thread, the writer sends it after adding the next message, since
+ * only it can change the map.
+ *
+ * @param lcm LCM to publish on
+ */
+void ConcurrentStereoOctomap::PublishToHud(lcm_t *lcm) {
+
+    if (use_thread_ == false) {
+        maps_[0]->PublishToHud(lcm);
+        return;
+    }
+
+    hud_lcm_ = lcm;
+}
+
+/**
+ * Counts a reader in on the active map.
+ *
+ * @retval which map the reader gets
+ */
+int ConcurrentStereoOctomap::BeginRead() const {
+
+    while (true) {
+        int side = active_.load();
+
+        readers_[side] ++;
+
+        // if the writer switched maps in between, it might not have seen
+        // this reader before starting on the old one
+        if (active_.load() == side) {
+            return side;
+        }
+
+        readers_[side] --;
+    }
+}
+
+void ConcurrentStereoOctomap::EndRead(int side) const {
+    readers_[side] --;
+}
+
+void* ConcurrentStereoOctomap::WriterThread(void *x) {
+
+    ((ConcurrentStereoOctomap*) x)->RunWriter();
+
+    return NULL;
+}
+
+/**
+ * Adds jobs to the map as ProcessStereoMessage() queues them.
+ */
+void ConcurrentStereoOctomap::RunWriter() {
+
+    while (true) {
+
+        int job_number;
+
+        if (ready_jobs_.Pop(&job_number)) {
+            ApplyJob(&jobs_[job_number]);
+
+            // only the first map keeps track of what the HUD has.  Readers
+            // might be searching it, but publishing only changes its HUD
+            // bookkeeping, which they never look at.
+            lcm_t *hud_lcm = hud_lcm_.exchange(NULL);
+
+            if (hud_lcm != NULL) {
+                maps_[0]->PublishToHud(hud_lcm);
+            }
+
+            free_jobs_.Push(job_number);
+
+            num_pending_ --;
+            continue;
+        }
+
+        if (shutting_down_) {
+            return;
+        }
+
+        unique_lock<mutex> lock(job_mutex_);
+
+        while (ready_jobs_.Empty() && shutting_down_ == false) {
+            cv_new_job_.wait(lock);
+        }
+    }
+}
+
+/**
+ * Filters a message, adds it to the inactive map, switches readers over to
+ * it and then adds the message to the other map too, so they stay the same.
+ *
+ * @param job message to add
+ */
+void ConcurrentStereoOctomap::ApplyJob(StereoOctomapJob *job) {
+
+    double center[3];
+
+    {
+        lock_guard<mutex> lock(center_mutex_);
+
+        for (int i = 0; i < 3; i++) {
+            center[i] = distance_field_center_[i];
+        }
+    }
+
+    // both maps get the same points
+    const lcmt::stereo *msg = &job->msg;
+    const uint8_t *keep = NULL;
+
+    if (filter_) {
+        keep = FilterMessage(job->msg, &job->to_open_cv);
+    }
+
+    int old_side = active_.load();
+    int new_side = 1 - old_side;
+
+    // readers from before the last switch might still be on it
+    WaitForReaders(new_side);
+
+    maps_[new_side]->ProcessStereoMessage(msg, &job->to_open_cv, keep);
+    maps_[new_side]->UpdateDistanceField(center);
+
+    active_.store(new_side);
+
+    WaitForReaders(old_side);
+
+    maps_[old_side]->ProcessStereoMessage(msg, &job->to_open_cv, keep);
+    maps_[old_side]->UpdateDistanceField(center);
+
+    // readers are all on the other map now
+    WriteSnapshotIfDue(maps_[old_side], msg->timestamp);
+}
+
+/**
+ * Runs the filter on a message.  Only the writer calls this, so the mask
+ * is kept from one message to the next instead of being allocated.
+ *
+ * @param msg stereo message
+ * @param to_open_cv transform from the camera (opencvFrame) to local
+ *
+ * @retval which points to add (a byte for each, nonzero to add it)
+ */
+const uint8_t* ConcurrentStereoOctomap::FilterMessage(const lcmt::stereo &msg, BotTrans *to_open_cv) {
+
+    keep_.assign(msg.number_of_points, 1);
+
+    filter_(msg, to_open_cv, &keep_);
+
+    return keep_.data();
+}
+
+/**
+ * Saves a map if it's been snapshot_period_us_ since the last time.  Only
+ * whoever adds the messages calls this, so the map can't change under it.
+ *
+ * @param map map to save
+ * @param timestamp the newest message's
+ */
+void ConcurrentStereoOctomap::WriteSnapshotIfDue(const StereoOctomap *map, int64_t timestamp) {
+
+    if (snapshot_filename_.empty()) {
+        return;
+    }
+
+    // (a log that jumps back starts the clock over)
+    if (last_snapshot_time_ >= 0 && timestamp >= last_snapshot_time_
+        && timestamp - last_snapshot_time_ < snapshot_period_us_) {
+
+        return;
+    }
+
+    last_snapshot_time_ = timestamp;
+
+    bool written = map->WriteSnapshot(snapshot_filename_);
+
+    if (written == false && snapshot_failed_ == false) {
+        std::cerr << "WARNING: failed to write map snapshot " << snapshot_filename_ << std::endl;
+    }
+
+    snapshot_failed_ = !written;
+}
+
+void ConcurrentStereoOctomap::WaitForReaders(int side) {
+
+    while (readers_[side] > 0) {
+        // searches take about a millisecond
+        usleep(100);
+    }
+}
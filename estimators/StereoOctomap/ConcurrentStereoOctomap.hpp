@@ -0,0 +1,185 @@
+/**
+ * A StereoOctomap that one thread can add stereo messages to while others
+ * search it, without either waiting on the other.
+ *
+ * There are two copies of the map.  Readers take a StereoOctomapSnapshot
+ * of the active one, which just counts them in.  The writer (a background
+ * thread, if it has one) adds each message to the inactive copy, makes it
+ * the active one, waits for the readers still on the old one to finish and
+ * then adds the message to that one too.
+ *
+ * A filter (SetFilter()) runs on the writer too, so with a thread the
+ * whole stereo pipeline is off of the caller's.
+ *
+ * The writer can also save the map to a file every so often
+ * (EnableSnapshots()), from the copy readers aren't on, so a process that
+ * restarts can read it back (ReadSnapshot()) instead of starting empty.
+ *
+ * (C) 2015 Andrew Barry <abarry@csail.mit.edu>
+ */
+
+#ifndef CONCURRENT_STEREO_OCTOMAP_H_
+#define CONCURRENT_STEREO_OCTOMAP_H_
+
+#include "StereoOctomap.hpp"
+#include "../../sensors/stereo/SpscQueue.hpp"
+
+#include <atomic>
+#include <string>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <pthread.h>
+#include <unistd.h>
+
+// slots in the writer's queues (one is always kept empty).  Must be a
+// power of two.
+#define OCTOMAP_QUEUE_SIZE 8
+
+using namespace std;
+
+// takes a stereo message, the transform from the camera to local from when
+// it arrived and a byte for each of its points (all 1 to start), sets the
+// ones for points not to add to 0 and returns how many are left, like
+// StereoPointPipeline::Filter()
+typedef function<int(const lcmt::stereo&, BotTrans*, std::vector<uint8_t>*)> StereoFilterFunction;
+
+/**
+ * One stereo message waiting to be added to the map, with the transform
+ * from when it arrived.  The buffers are reused.
+ */
+struct StereoOctomapJob {
+    lcmt::stereo msg;
+
+    BotTrans to_open_cv;
+};
+
+class ConcurrentStereoOctomap {
+
+    public:
+
+        ConcurrentStereoOctomap(BotFrames *bot_frames, bool use_thread);
+        ~ConcurrentStereoOctomap();
+
+        void ProcessStereoMessage(const lcmt::stereo *msg);
+
+        // call before the first ProcessStereoMessage()
+        void EnableDistanceField(double cell_size, int cells_per_side, double max_distance);
+        void UpdateDistanceField(const double center[3]);
+
+        // also call before the first ProcessStereoMessage()
+        void SetMaxVoxels(int max_voxels);
+        bool SetInsertRegion(const double low[3], const double high[3]);
+        void SetAltitudeBand(double min_altitude, double max_altitude);
+        void SetFilter(StereoFilterFunction filter) { filter_ = filter; }
+        void EnableSnapshots(const std::string &filename, double rate_hz);
+        bool ReadSnapshot(const std::string &filename, int64_t now);
+        int64_t GetNumEvictedVoxels() const;
+        int64_t GetNumCulledPoints() const;
+
+        // waits for the writer to add everything queued so far
+        void Flush();
+
+        // messages dropped because the writer was a whole queue behind
+        int GetNumDroppedMessages() const { return num_dropped_; }
+
+        void Draw(lcm_t *lcm) const;
+        void PublishToHud(lcm_t *lcm);
+
+    private:
+
+        friend class StereoOctomapSnapshot;
+
+        int BeginRead() const;
+        void EndRead(int side) const;
+        const StereoOctomap* GetSide(int side) const { return maps_[side]; }
+
+        static void* WriterThread(void *x);
+        void RunWriter();
+        void ApplyJob(StereoOctomapJob *job);
+        const uint8_t* FilterMessage(const lcmt::stereo &msg, BotTrans *to_open_cv);
+        void WriteSnapshotIfDue(const StereoOctomap *map, int64_t timestamp);
+        void WaitForReaders(int side);
+
+        BotFrames *bot_frames_;
+        TransformCache *transforms_;
+        bool use_thread_;
+
+        // run on each message before it's added, if set, and the points
+        // it keeps
+        StereoFilterFunction filter_;
+        std::vector<uint8_t> keep_;
+
+        // where to save the map (empty for nowhere), how often, in the
+        // messages' time, when it was last saved and whether that failed
+        std::string snapshot_filename_;
+        int64_t snapshot_period_us_;
+        int64_t last_snapshot_time_;
+        bool snapshot_failed_;
+
+        // without a thread, only the first one is used
+        StereoOctomap *maps_[2];
+
+        // which map new readers get and how many are reading each
+        atomic<int> active_;
+        mutable atomic<int> readers_[2];
+
+        StereoOctomapJob jobs_[OCTOMAP_QUEUE_SIZE - 1];
+
+        // indices into jobs_: the writer gives added ones back in
+        // free_jobs_ and ProcessStereoMessage() hands it filled ones in
+        // ready_jobs_
+        SpscQueue<int, OCTOMAP_QUEUE_SIZE> free_jobs_;
+        SpscQueue<int, OCTOMAP_QUEUE_SIZE> ready_jobs_;
+
+        atomic<int> num_pending_;
+        atomic<int> num_dropped_;
+
+        // where the writer centers the distance field
+        mutex center_mutex_;
+        double distance_field_center_[3];
+
+        // set by PublishToHud() for the writer to publish on after its
+        // next message
+        atomic<lcm_t*> hud_lcm_;
+
+        pthread_t thread_;
+
+        atomic<bool> shutting_down_;
+
+        // the writer sleeps on this until ProcessStereoMessage() queues a job
+        mutex job_mutex_;
+        condition_variable cv_new_job_;
+};
+
+/**
+ * Read access to a ConcurrentStereoOctomap.  The map it points to doesn't
+ * change while the snapshot is around, so keep them short-lived: the
+ * writer can't finish a message until the snapshots from before it are
+ * gone.
+ */
+class StereoOctomapSnapshot {
+
+    public:
+
+        StereoOctomapSnapshot(const ConcurrentStereoOctomap &map) : map_(map) {
+            side_ = map_.BeginRead();
+        }
+
+        ~StereoOctomapSnapshot() {
+            map_.EndRead(side_);
+        }
+
+        const StereoOctomap& operator*() const { return *map_.GetSide(side_); }
+        const StereoOctomap* operator->() const { return map_.GetSide(side_); }
+
+    private:
+
+        StereoOctomapSnapshot(const StereoOctomapSnapshot&);
+        StereoOctomapSnapshot& operator=(const StereoOctomapSnapshot&);
+
+        const ConcurrentStereoOctomap &map_;
+        int side_;
+};
+
+#endif
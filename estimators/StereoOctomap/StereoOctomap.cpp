@@ -1,156 +1,1814 @@
 #include "StereoOctomap.hpp"
+#include "../../utils/utils/Trace.hpp"
+#include "../../utils/utils/NoAllocGuard.hpp"
+#include "../../utils/ThreadPool/ThreadPool.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <algorithm>
+#include <random>
+
+// SSE2 does two doubles at a time.  32-bit ARM (NEON) has no double
+// vectors, so it gets the scalar loop.
+#if defined(__SSE2__) && !defined(NO_SIMD)
+#define OCTOMAP_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+// length of each expiry bucket, in usec
+#define OCTOMAP_BUCKET_LIFE (OCTREE_LIFE / OCTOMAP_EXPIRY_BUCKETS)
+
+// a snapshot file is this, then num_voxels OctomapSnapshotVoxels
+struct OctomapSnapshotHeader {
+    char magic[8];
+    int64_t last_msg_time;
+    int64_t num_voxels;
+};
+
+struct OctomapSnapshotVoxel {
+    double xyz[3];
+    int64_t last_seen;
+};
+
+// set while CalibrateBruteForce() makes its maps, so they don't calibrate
+static thread_local bool calibrating_brute_force = false;
 
-#define OCTREE_RESOLUTION 128.0f // TODO: set me
 
+StereoOctomap::StereoOctomap(BotFrames *bot_frames) {
+    bot_frames_ = bot_frames;
+    transforms_ = TransformCache::Get(bot_frames_);
+
+    last_msg_time_ = -1;
+
+    max_voxels_ = 0;
+    num_evicted_voxels_ = 0;
+    num_queries_ = 0;
+
+    use_insert_region_ = false;
+    bot_trans_set_identity(&body_to_camera_);
+
+    use_altitude_band_ = false;
+    min_altitude_ = 0;
+    max_altitude_ = 0;
+    num_culled_points_ = 0;
+
+    change_log_.resize(3 * OCTOMAP_CHANGE_LOG_SIZE);
+    num_changes_ = 0;
+    epoch_ = 0;
+    distance_field_changes_ = 0;
+
+    coarse_blocks_.assign(OCTOMAP_COARSE_CELLS * OCTOMAP_COARSE_CELLS * OCTOMAP_COARSE_CELLS, 0);
+    coarse_bits_.assign(OCTOMAP_COARSE_CELLS * OCTOMAP_COARSE_CELLS, 0);
+
+    distance_field_cell_size_ = 0;
+    distance_field_cells_ = 0;
+    distance_field_max_distance_ = 0;
+    distance_field_margin_ = 0;
+    distance_field_valid_ = false;
+    map_changed_ = false;
+
+    hud_tracking_ = false;
+    hud_reset_ = true;
+    hud_publishes_since_reset_ = 0;
+
+    hud_origin_[0] = 0;
+    hud_origin_[1] = 0;
+    hud_origin_[2] = 0;
+
+    stereo_calibration_set_ = false;
+
+    // measured the first time a map is made
+    brute_force_max_voxels_ = calibrating_brute_force ? 0 : CalibrateBruteForce(bot_frames_);
+
+}
+
+void StereoOctomap::ProcessStereoMessage(const lcmt::stereo *msg) {
+
+    // the camera's transform when the frame was taken
+    BotTrans to_open_cv;
+    transforms_->GetCameraToLocalAt(msg->timestamp, &to_open_cv);
+
+    ProcessStereoMessage(msg, &to_open_cv);
+}
+
+/**
+ * Adds a stereo message's points with the transform from when it arrived.
+ *
+ * @param msg stereo message
+ * @param to_open_cv transform from the camera (opencvFrame) to local
+ * @param keep a byte for each point: only points with a nonzero byte are
+ *      added (like a filter's FilterPoints() leaves), or NULL for all of them
+ */
+void StereoOctomap::ProcessStereoMessage(const lcmt::stereo *msg, BotTrans *to_open_cv, const uint8_t *keep) {
+    TRACE_SCOPE("octree-insert");
+    NO_ALLOC_SCOPE("octree-insert");
+
+    if (last_msg_time_ > msg->timestamp) {
+        // can happen if you're replaying a log and jump back
+        Clear();
+
+        std::cout << std::endl << "clearing the map because jump back in time" << std::endl;
+    }
+
+    last_msg_time_ = msg->timestamp;
+
+    // insert the points into the octree
+    InsertPointsIntoOctree(msg, to_open_cv, keep);
+
+    // zap the old points from the tree
+    RemoveOldPoints(msg->timestamp);
+
+    if (max_voxels_ > 0 && (int)voxels_.size() > max_voxels_) {
+        EvictOldestVoxels();
+    }
+
+    map_changed_ = true;
+
+}
+
+void StereoOctomap::InsertPointsIntoOctree(const lcmt::stereo *msg, BotTrans *to_open_cv, const uint8_t *keep) {
+
+    int num_points = msg->number_of_points;
+
+    // one matrix for the whole message instead of rotating each point by
+    // the quaternion
+    double mat[12];
+    bot_trans_get_mat_3x4(to_open_cv, mat);
+
+    insert_xyz_.resize(3 * num_points);
+    insert_voxels_.resize(3 * num_points);
+
+    const float *x = msg->x.data();
+    const float *y = msg->y.data();
+    const float *z = msg->z.data();
+
+    double *local_x = insert_xyz_.data();
+    double *local_y = local_x + num_points;
+    double *local_z = local_y + num_points;
+
+    // apply this matrix to each point (no branches, so it vectorizes, and
+    // it's cheaper to transform the dropped points too than to skip them)
+    for (int i = 0; i < num_points; i++) {
+        local_x[i] = mat[0] * x[i] + mat[1] * y[i] + mat[2] * z[i] + mat[3];
+        local_y[i] = mat[4] * x[i] + mat[5] * y[i] + mat[6] * z[i] + mat[7];
+        local_z[i] = mat[8] * x[i] + mat[9] * y[i] + mat[10] * z[i] + mat[11];
+    }
+
+    for (int i = 0; i < num_points; i++) {
+        insert_voxels_[3 * i] = floor(local_x[i] / OCTOMAP_VOXEL_SIZE);
+        insert_voxels_[3 * i + 1] = floor(local_y[i] / OCTOMAP_VOXEL_SIZE);
+        insert_voxels_[3 * i + 2] = floor(local_z[i] / OCTOMAP_VOXEL_SIZE);
+    }
+
+    if (use_insert_region_ || use_altitude_band_) {
+        insert_keep_.resize(num_points);
+
+        CullPoints(local_x, local_y, local_z, num_points, to_open_cv, keep, insert_keep_.data());
+
+        keep = insert_keep_.data();
+    }
+
+    // all of the voxels seen now go in the same bucket, which is new
+    // every OCTOMAP_BUCKET_LIFE
+    OctomapKeyList *bucket_voxels;
+
+    {
+        NO_ALLOC_ALLOW();
+        bucket_voxels = &expiry_buckets_[msg->timestamp / OCTOMAP_BUCKET_LIFE];
+    }
+
+    for (int i = 0; i < num_points; i++) {
+        if (keep != NULL && keep[i] == 0) {
+            continue;
+        }
+
+        const int64_t *voxel_coords = &insert_voxels_[3 * i];
+
+        // hits come a row at a time, so neighbors are often in the same
+        // voxel.  Only the last one would be kept.
+        if (i + 1 < num_points && (keep == NULL || keep[i + 1] != 0) && voxel_coords[0] == voxel_coords[3] && voxel_coords[1] == voxel_coords[4] && voxel_coords[2] == voxel_coords[5]) {
+            continue;
+        }
+
+        double xyz[3] = { local_x[i], local_y[i], local_z[i] };
+
+        InsertPoint(xyz, voxel_coords, msg->timestamp, bucket_voxels);
+    }
+}
+
+/**
+ * Marks which points to add: the ones keep has that are in the insert
+ * region and altitude band.
+ *
+ * @param local_x, local_y, local_z the points in the local frame
+ * @param num_points number of points
+ * @param to_open_cv transform from the camera to local when they were seen
+ * @param keep a byte for each point (nonzero to add it), or NULL for all
+ * @param insert_keep (output) a byte for each point, nonzero to add it
+ */
+void StereoOctomap::CullPoints(const double *local_x, const double *local_y, const double *local_z, int num_points, const BotTrans *to_open_cv, const uint8_t *keep, uint8_t *insert_keep) {
+
+    // where the body was, and its yaw, from where the camera was
+    BotTrans body_to_local = body_to_camera_;
+    bot_trans_apply_trans(&body_to_local, to_open_cv);
+
+    double rpy[3];
+    bot_quat_to_roll_pitch_yaw(body_to_local.rot_quat, rpy);
+
+    const double cos_yaw = cos(rpy[2]);
+    const double sin_yaw = sin(rpy[2]);
+    const double *origin = body_to_local.trans_vec;
+
+    // without a band, any altitude
+    double min_altitude = use_altitude_band_ ? min_altitude_ : -INFINITY;
+    double max_altitude = use_altitude_band_ ? max_altitude_ : INFINITY;
+
+    for (int i = 0; i < num_points; i++) {
+        bool inside = local_z[i] >= min_altitude && local_z[i] <= max_altitude;
+
+        if (use_insert_region_) {
+            // the inverse of Trajectory::TransformXyzYaw()
+            double dx = local_x[i] - origin[0];
+            double dy = local_y[i] - origin[1];
+
+            double x = cos_yaw * dx + sin_yaw * dy;
+            double y = -sin_yaw * dx + cos_yaw * dy;
+            double z = local_z[i] - origin[2];
+
+            inside = inside && x >= insert_low_[0] && x <= insert_high_[0]
+                && y >= insert_low_[1] && y <= insert_high_[1]
+                && z >= insert_low_[2] && z <= insert_high_[2];
+        }
+
+        bool wanted = keep == NULL || keep[i] != 0;
+
+        insert_keep[i] = wanted && inside;
+
+        if (wanted && !inside) {
+            num_culled_points_ ++;
+        }
+    }
+}
+
+/**
+ * Adds a point to the map.  If its voxel already has one, the new point
+ * replaces it.
+ *
+ * @param xyz point in the local frame
+ * @param voxel_coords the point's voxel
+ * @param timestamp when the point was seen
+ * @param bucket_voxels expiry bucket for timestamp
+ */
+void StereoOctomap::InsertPoint(const double xyz[3], const int64_t voxel_coords[3], int64_t timestamp, OctomapKeyList *bucket_voxels) {
+
+    int64_t voxel_key = GetCellKey(voxel_coords);
+    int64_t bucket = timestamp / OCTOMAP_BUCKET_LIFE;
+
+    OctomapMap<OctomapVoxel>::iterator it = voxels_.find(voxel_key);
+
+    bool new_voxel = (it == voxels_.end());
+
+    if (new_voxel) {
+        // the map growing, which MEMORY_OCTOMAP keeps track of
+        NO_ALLOC_ALLOW();
+        it = voxels_.emplace(voxel_key, OctomapVoxel()).first;
+    }
+
+    OctomapVoxel &voxel = it->second;
+
+    if (new_voxel) {
+        NO_ALLOC_ALLOW();
+
+        int64_t block_coords[3];
+
+        for (int i = 0; i < 3; i++) {
+            block_coords[i] = voxel_coords[i] / OCTOMAP_VOXELS_PER_BLOCK;
+
+            // round down for negative coordinates too
+            if (voxel_coords[i] < 0 && voxel_coords[i] % OCTOMAP_VOXELS_PER_BLOCK != 0) {
+                block_coords[i] --;
+            }
+        }
+
+        voxel.block = GetCellKey(block_coords);
+
+        OctomapBlock &block = blocks_[voxel.block];
+
+        voxel.block_data = &block;
+
+        if (block.voxels.empty()) {
+            for (int i = 0; i < 3; i++) {
+                block.coords[i] = block_coords[i];
+            }
+
+            UpdateCoarseCell(block_coords, 1);
+        }
+
+        voxel.block_index = block.voxels.size();
+        block.voxels.push_back(voxel_key);
+        block.xyz.insert(block.xyz.end(), xyz, xyz + 3);
+
+        voxel.flat_index = flat_voxels_.size();
+        flat_voxels_.push_back(&voxel);
+        flat_x_.push_back(xyz[0]);
+        flat_y_.push_back(xyz[1]);
+        flat_z_.push_back(xyz[2]);
+
+        voxel.bucket = -1;
+
+        if (hud_tracking_) {
+            hud_changes_[voxel_key] = true;
+        }
+    } else {
+        double *block_xyz = &(voxel.block_data->xyz[3 * voxel.block_index]);
+
+        for (int i = 0; i < 3; i++) {
+            block_xyz[i] = xyz[i];
+        }
+
+        flat_x_[voxel.flat_index] = xyz[0];
+        flat_y_[voxel.flat_index] = xyz[1];
+        flat_z_[voxel.flat_index] = xyz[2];
+    }
+
+    // new or moved within its voxel
+    RecordChange(voxel_coords);
+
+    voxel.last_seen = timestamp;
+
+    if (voxel.bucket != bucket) {
+        // the voxel stays in its older buckets, which skip it when they
+        // expire since it isn't their newest
+        voxel.bucket = bucket;
+
+        NO_ALLOC_ALLOW();
+        bucket_voxels->push_back(voxel_key);
+    }
+}
+
+/**
+ * Removes the voxels that haven't been seen in OCTREE_LIFE, a bucket at a
+ * time as each bucket gets that old.
+ *
+ * @param last_msg_time timestamp of the newest message
+ */
+void StereoOctomap::RemoveOldPoints(int64_t last_msg_time) {
+
+    OctomapMap<OctomapKeyList>::iterator it = expiry_buckets_.begin();
+
+    while (it != expiry_buckets_.end()) {
+
+        // the newest voxel in this bucket was seen just before the next one
+        // starts
+        if ((it->first + 1) * OCTOMAP_BUCKET_LIFE + OCTREE_LIFE > last_msg_time) {
+            it ++;
+            continue;
+        }
+
+        for (int64_t voxel_key : it->second) {
+            OctomapMap<OctomapVoxel>::iterator voxel = voxels_.find(voxel_key);
+
+            if (voxel != voxels_.end() && voxel->second.bucket == it->first) {
+                RemoveVoxel(voxel_key);
+            }
+        }
+
+        it = expiry_buckets_.erase(it);
+    }
+}
+
+/**
+ * Limits how many voxels the map keeps, so a flood of stereo hits (glare,
+ * say) can't make it or its searches grow without bound.  Once it's full,
+ * the voxels that were seen longest ago go first.
+ *
+ * @param max_voxels most voxels to keep, or 0 for no limit
+ */
+void StereoOctomap::SetMaxVoxels(int max_voxels) {
+    max_voxels_ = max_voxels;
+
+    if (max_voxels_ > 0) {
+        // so the hash never grows past this
+        voxels_.reserve(max_voxels_);
+
+        if ((int)voxels_.size() > max_voxels_) {
+            EvictOldestVoxels();
+        }
+    }
+}
+
+/**
+ * Only adds points inside a box that follows the aircraft, so points no
+ * trajectory could get near (far off to the side, behind it) don't take up
+ * the map or the searches' time.  The box is in the frame the trajectories
+ * are checked in: the body's position and yaw, without its roll and pitch
+ * (see Trajectory::GetXyzYawTransformedPoints()).
+ *
+ * Points stay in the map for OCTREE_LIFE while the aircraft moves, so make
+ * the box big enough to hold anything that could come into reach by then
+ * (see TrajectoryLibrary::GetBoundingBox()).
+ *
+ * @param low lowest x, y and z to add (meters)
+ * @param high highest x, y and z to add
+ *
+ * @retval false if the camera's place on the body isn't known (every point
+ *      is still added)
+ */
+bool StereoOctomap::SetInsertRegion(const double low[3], const double high[3]) {
+
+    if (bot_frames_ == NULL || bot_frames_get_trans(bot_frames_, "body", "opencvFrame", &body_to_camera_) == 0) {
+        use_insert_region_ = false;
+        return false;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        insert_low_[i] = low[i];
+        insert_high_[i] = high[i];
+    }
+
+    use_insert_region_ = true;
+
+    return true;
+}
+
+/**
+ * Only adds points between two altitudes in the local frame, like above
+ * the ground (reflections off of water or wet pavement come out below it).
+ *
+ * @param min_altitude lowest local z to add (meters)
+ * @param max_altitude highest local z to add
+ */
+void StereoOctomap::SetAltitudeBand(double min_altitude, double max_altitude) {
+    min_altitude_ = min_altitude;
+    max_altitude_ = max_altitude;
+
+    use_altitude_band_ = true;
+}
+
+/**
+ * Removes voxels, oldest expiry bucket first, until there are max_voxels_.
+ */
+void StereoOctomap::EvictOldestVoxels() {
+
+    while ((int)voxels_.size() > max_voxels_ && expiry_buckets_.empty() == false) {
+
+        OctomapMap<OctomapKeyList>::iterator oldest = expiry_buckets_.begin();
+
+        for (OctomapMap<OctomapKeyList>::iterator it = expiry_buckets_.begin(); it != expiry_buckets_.end(); it++) {
+            if (it->first < oldest->first) {
+                oldest = it;
+            }
+        }
+
+        // buckets are in the order the voxels were seen
+        OctomapKeyList &bucket_voxels = oldest->second;
+        unsigned int i;
+
+        for (i = 0; i < bucket_voxels.size() && (int)voxels_.size() > max_voxels_; i++) {
+            OctomapMap<OctomapVoxel>::iterator voxel = voxels_.find(bucket_voxels[i]);
+
+            if (voxel != voxels_.end() && voxel->second.bucket == oldest->first) {
+                RemoveVoxel(bucket_voxels[i]);
+                num_evicted_voxels_ ++;
+            }
+        }
+
+        if (i == bucket_voxels.size()) {
+            expiry_buckets_.erase(oldest);
+        } else {
+            bucket_voxels.erase(bucket_voxels.begin(), bucket_voxels.begin() + i);
+        }
+    }
+}
+
+void StereoOctomap::RemoveVoxel(int64_t voxel_key) {
+
+    OctomapMap<OctomapVoxel>::iterator voxel = voxels_.find(voxel_key);
+
+    OctomapMap<OctomapBlock>::iterator block = blocks_.find(voxel->second.block);
+    OctomapBlock &b = block->second;
+
+    // move the block's last voxel into this one's place
+    int index = voxel->second.block_index;
+    int last = b.voxels.size() - 1;
+
+    if (index != last) {
+        b.voxels[index] = b.voxels[last];
+        std::copy(&b.xyz[3 * last], &b.xyz[3 * last] + 3, &b.xyz[3 * index]);
+
+        voxels_[b.voxels[index]].block_index = index;
+    }
+
+    b.voxels.pop_back();
+    b.xyz.resize(3 * last);
+
+    // and the same in the flat lists
+    index = voxel->second.flat_index;
+    last = flat_voxels_.size() - 1;
+
+    if (index != last) {
+        flat_voxels_[index] = flat_voxels_[last];
+        flat_x_[index] = flat_x_[last];
+        flat_y_[index] = flat_y_[last];
+        flat_z_[index] = flat_z_[last];
+
+        flat_voxels_[index]->flat_index = index;
+    }
+
+    flat_voxels_.pop_back();
+    flat_x_.pop_back();
+    flat_y_.pop_back();
+    flat_z_.pop_back();
+
+    if (b.voxels.empty()) {
+        UpdateCoarseCell(b.coords, -1);
+        blocks_.erase(block);
+    }
+
+    voxels_.erase(voxel);
+
+    if (hud_tracking_) {
+        NO_ALLOC_ALLOW();
+        hud_changes_[voxel_key] = false;
+    }
+
+    int64_t voxel_coords[3];
+    GetCellCoords(voxel_key, voxel_coords);
+
+    RecordChange(voxel_coords);
+}
+
+void StereoOctomap::RecordChange(const int64_t voxel_coords[3]) {
+    double *center = &change_log_[3 * (num_changes_ % OCTOMAP_CHANGE_LOG_SIZE)];
+
+    for (int i = 0; i < 3; i++) {
+        center[i] = (voxel_coords[i] + 0.5) * OCTOMAP_VOXEL_SIZE;
+    }
+
+    num_changes_ ++;
+}
+
+/**
+ * Where the map is in its history, for GetChangesSince() later.  Queries
+ * that use the distance field see the map as it was when the field was
+ * last computed, so that's what this is with one.
+ *
+ * @retval the map's version
+ */
+StereoOctomapVersion StereoOctomap::GetVersion() const {
+    StereoOctomapVersion version;
+
+    version.epoch = epoch_;
+    version.changes = distance_field_valid_ ? distance_field_changes_ : num_changes_;
+
+    return version;
+}
+
+/**
+ * Finds where the map changed since a version.  A query's answer (from
+ * NearestNeighbors(), Clearances() and the like) can only have changed if
+ * its point is within the answer it got then plus GetChangeMargin() of one
+ * of these, so callers can keep the answers for the rest.
+ *
+ * @param version from GetVersion() (on this map or the other one of a
+ *      ConcurrentStereoOctomap)
+ * @param xyz (output) the centers of the voxels that changed, x, y, z each
+ *
+ * @retval false if the whole map might have changed (it was cleared, the
+ *      distance field moved, or there were too many changes to remember),
+ *      in which case xyz isn't set
+ */
+bool StereoOctomap::GetChangesSince(const StereoOctomapVersion &version, std::vector<double> *xyz) const {
+
+    if (version.epoch != epoch_ || version.changes > num_changes_
+        || num_changes_ - version.changes > OCTOMAP_CHANGE_LOG_SIZE) {
+
+        return false;
+    }
+
+    xyz->clear();
+
+    for (int64_t n = version.changes; n < num_changes_; n++) {
+        const double *center = &change_log_[3 * (n % OCTOMAP_CHANGE_LOG_SIZE)];
+
+        xyz->insert(xyz->end(), center, center + 3);
+    }
+
+    return true;
+}
+
+/**
+ * @retval how much further than its old answer a query's point can be from
+ *      a changed voxel's center (GetChangesSince()) and still get a
+ *      different answer: the rest of the voxel, and with a distance field,
+ *      the interpolation between cells and the diagonal taken off of them
+ */
+double StereoOctomap::GetChangeMargin() const {
+    double margin = sqrt(3) * OCTOMAP_VOXEL_SIZE / 2;
+
+    if (distance_field_cells_ > 0) {
+        margin += 2 * sqrt(3) * distance_field_cell_size_;
+    }
+
+    return margin;
+}
+
+/**
+ * Writes the voxels to a file, for ReadSnapshot() after a restart.  The
+ * file is written under another name and renamed into place, so it always
+ * holds a whole snapshot, even if this process dies partway through.  A
+ * file in /dev/shm never touches the disk.
+ *
+ * @param filename file to write
+ *
+ * @retval false if it couldn't be written
+ */
+bool StereoOctomap::WriteSnapshot(const std::string &filename) const {
+    TRACE_SCOPE("octree-snapshot");
+
+    OctomapSnapshotHeader header;
+
+    memcpy(header.magic, OCTOMAP_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.last_msg_time = last_msg_time_;
+    header.num_voxels = voxels_.size();
+
+    std::vector<OctomapSnapshotVoxel> snapshot_voxels(voxels_.size());
+
+    int i = 0;
+
+    for (OctomapMap<OctomapVoxel>::const_iterator it = voxels_.begin(); it != voxels_.end(); it++) {
+        const OctomapVoxel &voxel = it->second;
+        const double *xyz = &(voxel.block_data->xyz[3 * voxel.block_index]);
+
+        std::copy(xyz, xyz + 3, snapshot_voxels[i].xyz);
+        snapshot_voxels[i].last_seen = voxel.last_seen;
+
+        i++;
+    }
+
+    std::string temp_filename = filename + ".tmp";
+
+    FILE *file = fopen(temp_filename.c_str(), "wb");
+
+    if (file == NULL) {
+        return false;
+    }
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(snapshot_voxels.data(), sizeof(OctomapSnapshotVoxel), snapshot_voxels.size(), file) == snapshot_voxels.size();
+
+    if (fclose(file) != 0 || written == false) {
+        remove(temp_filename.c_str());
+        return false;
+    }
+
+    return rename(temp_filename.c_str(), filename.c_str()) == 0;
+}
+
+/**
+ * Adds the voxels from a WriteSnapshot() file.  Voxels that would have
+ * aged out by now are left out, so an old file adds nothing.
+ *
+ * @param filename file to read
+ * @param now timestamp to age the voxels out against, in the stereo
+ *      messages' time
+ *
+ * @retval false if there is no file or it isn't a snapshot
+ */
+bool StereoOctomap::ReadSnapshot(const std::string &filename, int64_t now) {
+
+    FILE *file = fopen(filename.c_str(), "rb");
+
+    if (file == NULL) {
+        return false;
+    }
+
+    OctomapSnapshotHeader header;
+    std::vector<OctomapSnapshotVoxel> snapshot_voxels;
+
+    bool ok = fread(&header, sizeof(header), 1, file) == 1
+        && memcmp(header.magic, OCTOMAP_SNAPSHOT_MAGIC, sizeof(header.magic)) == 0
+        && header.num_voxels >= 0;
+
+    if (ok) {
+        snapshot_voxels.resize(header.num_voxels);
+
+        ok = fread(snapshot_voxels.data(), sizeof(OctomapSnapshotVoxel), snapshot_voxels.size(), file) == snapshot_voxels.size();
+    }
+
+    fclose(file);
+
+    if (ok == false) {
+        std::cerr << "WARNING: " << filename << " is not a map snapshot, ignoring it." << std::endl;
+        return false;
+    }
+
+    // expiry buckets are in the order their voxels were seen
+    std::sort(snapshot_voxels.begin(), snapshot_voxels.end(),
+        [](const OctomapSnapshotVoxel &a, const OctomapSnapshotVoxel &b) { return a.last_seen < b.last_seen; });
+
+    for (const OctomapSnapshotVoxel &snapshot_voxel : snapshot_voxels) {
+        int64_t voxel_coords[3];
+
+        for (int i = 0; i < 3; i++) {
+            voxel_coords[i] = floor(snapshot_voxel.xyz[i] / OCTOMAP_VOXEL_SIZE);
+        }
+
+        InsertPoint(snapshot_voxel.xyz, voxel_coords, snapshot_voxel.last_seen, &expiry_buckets_[snapshot_voxel.last_seen / OCTOMAP_BUCKET_LIFE]);
+    }
+
+    last_msg_time_ = std::max(last_msg_time_, header.last_msg_time);
+
+    RemoveOldPoints(now);
+
+    if (max_voxels_ > 0 && (int)voxels_.size() > max_voxels_) {
+        EvictOldestVoxels();
+    }
+
+    map_changed_ = true;
+
+    return true;
+}
+
+void StereoOctomap::Clear() {
+    voxels_.clear();
+    blocks_.clear();
+
+    flat_voxels_.clear();
+    flat_x_.clear();
+    flat_y_.clear();
+    flat_z_.clear();
+    expiry_buckets_.clear();
+
+    std::fill(coarse_blocks_.begin(), coarse_blocks_.end(), 0);
+    std::fill(coarse_bits_.begin(), coarse_bits_.end(), 0);
+
+    hud_changes_.clear();
+    hud_reset_ = true;
+
+    epoch_ ++;
+}
+
+/**
+ * Packs voxel or block coordinates into a key, 21 bits each (over 500km
+ * of 0.25m voxels).
+ */
+int64_t StereoOctomap::GetCellKey(const int64_t coords[3]) {
+    const int64_t mask = (1 << 21) - 1;
+
+    return ((coords[0] & mask) << 42) | ((coords[1] & mask) << 21) | (coords[2] & mask);
+}
+
+/**
+ * Unpacks a key from GetCellKey().
+ */
+void StereoOctomap::GetCellCoords(int64_t key, int64_t coords[3]) {
+    const int64_t mask = (1 << 21) - 1;
+
+    for (int i = 0; i < 3; i++) {
+        coords[i] = (key >> (42 - 21 * i)) & mask;
+
+        // sign extend
+        if (coords[i] & (1 << 20)) {
+            coords[i] -= (1 << 21);
+        }
+    }
+}
+
+/**
+ * Finds the coarse grid cell a block is in, wrapped onto the grid.
+ *
+ * @param block_coords the block
+ * @param coarse set to the cell's x, y, z, each 0 to OCTOMAP_COARSE_CELLS - 1
+ */
+void StereoOctomap::GetCoarseCell(const int64_t block_coords[3], int coarse[3]) {
+
+    for (int i = 0; i < 3; i++) {
+        int64_t cell = block_coords[i] / OCTOMAP_BLOCKS_PER_COARSE_CELL;
+
+        // round down for negative coordinates too
+        if (block_coords[i] < 0 && block_coords[i] % OCTOMAP_BLOCKS_PER_COARSE_CELL != 0) {
+            cell --;
+        }
+
+        cell %= OCTOMAP_COARSE_CELLS;
+
+        if (cell < 0) {
+            cell += OCTOMAP_COARSE_CELLS;
+        }
+
+        coarse[i] = cell;
+    }
+}
+
+/**
+ * Counts a block added to (change = 1) or removed from (change = -1) the map
+ * in its coarse cell.
+ */
+void StereoOctomap::UpdateCoarseCell(const int64_t block_coords[3], int change) {
+
+    int coarse[3];
+
+    GetCoarseCell(block_coords, coarse);
+
+    int row = coarse[0] * OCTOMAP_COARSE_CELLS + coarse[1];
+    int &count = coarse_blocks_[row * OCTOMAP_COARSE_CELLS + coarse[2]];
+
+    count += change;
+
+    if (count > 0) {
+        coarse_bits_[row] |= (uint32_t)1 << coarse[2];
+    } else {
+        coarse_bits_[row] &= ~((uint32_t)1 << coarse[2]);
+    }
+}
+
+/**
+ * @retval false if the block is certainly empty (nothing in its coarse cell)
+ */
+bool StereoOctomap::CoarseOccupied(const int64_t block_coords[3]) const {
+
+    int coarse[3];
+
+    GetCoarseCell(block_coords, coarse);
+
+    return (coarse_bits_[coarse[0] * OCTOMAP_COARSE_CELLS + coarse[1]] >> coarse[2]) & 1;
+}
+
+/**
+ * Checks the coarse grid for a box of blocks, a row of cells (one word) at a
+ * time.
+ *
+ * @param low lowest block coordinates of the box
+ * @param high highest block coordinates of the box
+ *
+ * @retval true if every block in the box is certainly empty
+ */
+bool StereoOctomap::CoarseEmpty(const int64_t low[3], const int64_t high[3]) const {
+
+    // first cell on the (wrapped) grid and how many cells along each axis
+    int start[3], span[3];
+
+    GetCoarseCell(low, start);
+
+    for (int i = 0; i < 3; i++) {
+        int64_t low_cell = low[i] / OCTOMAP_BLOCKS_PER_COARSE_CELL;
+        int64_t high_cell = high[i] / OCTOMAP_BLOCKS_PER_COARSE_CELL;
+
+        // round down for negative coordinates too
+        if (low[i] < 0 && low[i] % OCTOMAP_BLOCKS_PER_COARSE_CELL != 0) {
+            low_cell --;
+        }
+
+        if (high[i] < 0 && high[i] % OCTOMAP_BLOCKS_PER_COARSE_CELL != 0) {
+            high_cell --;
+        }
+
+        span[i] = std::min<int64_t>(high_cell - low_cell + 1, OCTOMAP_COARSE_CELLS);
+    }
+
+    uint32_t z_mask = 0;
+
+    for (int z = 0; z < span[2]; z++) {
+        z_mask |= (uint32_t)1 << ((start[2] + z) % OCTOMAP_COARSE_CELLS);
+    }
+
+    for (int x = 0; x < span[0]; x++) {
+        int row_x = (start[0] + x) % OCTOMAP_COARSE_CELLS;
+
+        for (int y = 0; y < span[1]; y++) {
+            int row_y = (start[1] + y) % OCTOMAP_COARSE_CELLS;
+
+            if (coarse_bits_[row_x * OCTOMAP_COARSE_CELLS + row_y] & z_mask) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Find the distance to the nearest neighbor of a point
+ *
+ * @param point the xyz point to search
+ *
+ * @retval distance to the nearest neighbor or -1 if no points found.
+ */
+double StereoOctomap::NearestNeighbor(double point[3]) const {
+
+    num_queries_.fetch_add(1, std::memory_order_relaxed);
+
+    // ensure there is at least one point in the map
+    if (voxels_.empty()) {
+        // no points in octomap
+        return -1;
+    }
+
+    double best_sqr_dist = -1;
+
+    // a block is never empty, so something is found
+    FindNearest(point, &best_sqr_dist);
+
+    return sqrt(best_sqr_dist);
+
+}
+
+/**
+ * Finds the distances to the nearest neighbors of a batch of points, such
+ * as the points along a trajectory.  Consecutive points are expected to be
+ * close together: each search starts out bounded by the distance to the
+ * last point's neighbor, which usually cuts it down to a shell or two.
+ * Safe to call from several threads at once.
+ *
+ * @param xyz num_points points, x, y, z each
+ * @param num_points number of points
+ * @param distances distance to the nearest neighbor of each point, or -1
+ *      if there's none (or none closer than max_distance)
+ * @param max_distance distances past this aren't needed (and aren't
+ *      searched for), or -1 for no limit
+ */
+void StereoOctomap::NearestNeighbors(const double *xyz, int num_points, double *distances, double max_distance) const {
+    TRACE_SCOPE("octree-nearest-neighbors");
+
+    num_queries_.fetch_add(num_points, std::memory_order_relaxed);
+
+    const double *last_neighbor = nullptr;
+
+    for (int i = 0; i < num_points; i++) {
+        const double *point = &xyz[3 * i];
+
+        if (voxels_.empty()) {
+            distances[i] = -1;
+            continue;
+        }
+
+        double best_sqr_dist = max_distance >= 0 ? max_distance * max_distance : -1;
+        const double *nearest = nullptr;
+
+        if (last_neighbor != nullptr) {
+            double sqr_dist = (last_neighbor[0] - point[0]) * (last_neighbor[0] - point[0])
+                + (last_neighbor[1] - point[1]) * (last_neighbor[1] - point[1])
+                + (last_neighbor[2] - point[2]) * (last_neighbor[2] - point[2]);
+
+            if (sqr_dist < best_sqr_dist || best_sqr_dist < 0) {
+                best_sqr_dist = sqr_dist;
+                nearest = last_neighbor;
+            }
+        }
+
+        const double *closer = FindNearest(point, &best_sqr_dist, nearest != nullptr);
+
+        if (closer != nullptr) {
+            nearest = closer;
+        }
+
+        if (nearest == nullptr) {
+            distances[i] = -1;
+        } else {
+            distances[i] = sqrt(best_sqr_dist);
+
+            last_neighbor = nearest;
+        }
+    }
+}
+
+/**
+ * Checks if there's any point within a radius, stopping at the first one
+ * found.  Only looks in the blocks the radius reaches.
+ *
+ * @param point the xyz point to search around
+ * @param radius how far to search
+ *
+ * @retval true if a point is within radius
+ */
+bool StereoOctomap::AnyWithin(const double point[3], double radius) const {
+
+    num_queries_.fetch_add(1, std::memory_order_relaxed);
+
+    if (voxels_.empty() || radius < 0) {
+        return false;
+    }
+
+    const double block_size = OCTOMAP_VOXEL_SIZE * OCTOMAP_VOXELS_PER_BLOCK;
+
+    int64_t low[3], high[3];
+    double num_cells = 1;
+
+    for (int i = 0; i < 3; i++) {
+        low[i] = floor((point[i] - radius) / block_size);
+        high[i] = floor((point[i] + radius) / block_size);
+
+        num_cells *= high[i] - low[i] + 1;
+    }
+
+    if (CoarseEmpty(low, high)) {
+        // nothing anywhere near, the usual case in the open
+        return false;
+    }
+
+    double sqr_radius = radius * radius;
+
+    if (num_cells > blocks_.size()) {
+        // cheaper to go through the blocks than to look up every cell
+        for (const std::pair<const int64_t, OctomapBlock> &block : blocks_) {
+            const int64_t *coords = block.second.coords;
+
+            if (coords[0] >= low[0] && coords[0] <= high[0]
+                && coords[1] >= low[1] && coords[1] <= high[1]
+                && coords[2] >= low[2] && coords[2] <= high[2]
+                && AnyInBlock(block.second, point, sqr_radius)) {
+
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    int64_t coords[3];
+
+    for (coords[0] = low[0]; coords[0] <= high[0]; coords[0]++) {
+        for (coords[1] = low[1]; coords[1] <= high[1]; coords[1]++) {
+            for (coords[2] = low[2]; coords[2] <= high[2]; coords[2]++) {
+
+                if (CoarseOccupied(coords) == false) {
+                    continue;
+                }
+
+                OctomapMap<OctomapBlock>::const_iterator block = blocks_.find(GetCellKey(coords));
+
+                if (block != blocks_.end() && AnyInBlock(block->second, point, sqr_radius)) {
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Finds the distance to the nearest neighbor of a point, but doesn't
+ * search past max_radius.
+ *
+ * @param point the xyz point to search
+ * @param max_radius how far to search
+ *
+ * @retval distance to the nearest neighbor, or max_radius if there's
+ *      nothing closer (or no points at all)
+ */
+/**
+ * Gets every point within a radius, looking in the blocks the radius reaches
+ * like AnyWithin().
+ *
+ * @param point the xyz point to search around
+ * @param radius how far to search
+ * @param xyz (output) x, y, z of each point found
+ */
+void StereoOctomap::PointsWithin(const double point[3], double radius, std::vector<double> *xyz) const {
+
+    num_queries_.fetch_add(1, std::memory_order_relaxed);
 
-StereoOctomap::StereoOctomap(BotFrames *bot_frames) {
-    bot_frames_ = bot_frames;
+    xyz->clear();
+
+    if (voxels_.empty() || radius < 0) {
+        return;
+    }
 
-    current_cloud_ = pcl::PointCloud<pcl::PointXYZ>::Ptr(new pcl::PointCloud<pcl::PointXYZ>());
-    building_cloud_ = pcl::PointCloud<pcl::PointXYZ>::Ptr(new pcl::PointCloud<pcl::PointXYZ>());
+    const double block_size = OCTOMAP_VOXEL_SIZE * OCTOMAP_VOXELS_PER_BLOCK;
 
+    int64_t low[3], high[3];
+    double num_cells = 1;
 
-    current_octree_ = new pcl::octree::OctreePointCloudSearch<pcl::PointXYZ>(OCTREE_RESOLUTION);
-    current_octree_->setInputCloud((pcl::PointCloud<pcl::PointXYZ>::Ptr)current_cloud_);
+    for (int i = 0; i < 3; i++) {
+        low[i] = floor((point[i] - radius) / block_size);
+        high[i] = floor((point[i] + radius) / block_size);
 
-    building_octree_ = new pcl::octree::OctreePointCloudSearch<pcl::PointXYZ>(OCTREE_RESOLUTION);
-    building_octree_->setInputCloud(building_cloud_);
+        num_cells *= high[i] - low[i] + 1;
+    }
+
+    if (CoarseEmpty(low, high)) {
+        return;
+    }
 
+    double sqr_radius = radius * radius;
 
-    current_octree_timestamp_ = -1;
-    building_octree_timestamp_ = -1;
+    if (num_cells > blocks_.size()) {
+        for (const std::pair<const int64_t, OctomapBlock> &block : blocks_) {
+            const int64_t *coords = block.second.coords;
 
-    stereo_calibration_set_ = false;
+            if (coords[0] >= low[0] && coords[0] <= high[0]
+                && coords[1] >= low[1] && coords[1] <= high[1]
+                && coords[2] >= low[2] && coords[2] <= high[2]) {
 
+                PointsInBlock(block.second, point, sqr_radius, xyz);
+            }
+        }
+
+        return;
+    }
+
+    int64_t coords[3];
+
+    for (coords[0] = low[0]; coords[0] <= high[0]; coords[0]++) {
+        for (coords[1] = low[1]; coords[1] <= high[1]; coords[1]++) {
+            for (coords[2] = low[2]; coords[2] <= high[2]; coords[2]++) {
+
+                if (CoarseOccupied(coords) == false) {
+                    continue;
+                }
+
+                OctomapMap<OctomapBlock>::const_iterator block = blocks_.find(GetCellKey(coords));
+
+                if (block != blocks_.end()) {
+                    PointsInBlock(block->second, point, sqr_radius, xyz);
+                }
+            }
+        }
+    }
 }
 
-void StereoOctomap::ProcessStereoMessage(const lcmt::stereo *msg) {
+double StereoOctomap::MinDistanceClamped(const double point[3], double max_radius) const {
 
-    // get transform from global to body frame
-    // note that these transforms update live so don't try
-    // to cache them
-    BotTrans to_open_cv;
-    bot_frames_get_trans(bot_frames_, "opencvFrame", "local", &to_open_cv);
+    num_queries_.fetch_add(1, std::memory_order_relaxed);
 
-    // insert the points into the octree
-    InsertPointsIntoOctree(msg, &to_open_cv);
+    if (voxels_.empty()) {
+        return max_radius;
+    }
 
-    // zap the old points from the tree
-    RemoveOldPoints(msg->timestamp);
+    double best_sqr_dist = max_radius * max_radius;
+
+    if (FindNearest(point, &best_sqr_dist) == nullptr) {
+        return max_radius;
+    }
+
+    return sqrt(best_sqr_dist);
+}
+
+/**
+ * Keeps a distance field around the aircraft, so clearance lookups
+ * (Clearances()) near it are a trilinear interpolation on a grid instead
+ * of a search.  The field is never further than the true distance and
+ * within about a cell of it.
+ *
+ * @param cell_size size of the grid cells, in meters
+ * @param cells_per_side number of cells along each side of the grid
+ * @param max_distance distances are only kept up to this, in meters.  The
+ *      field is only used this far inside the grid's edges.
+ */
+void StereoOctomap::EnableDistanceField(double cell_size, int cells_per_side, double max_distance) {
+    distance_field_cell_size_ = cell_size;
+    distance_field_cells_ = cells_per_side;
+    distance_field_max_distance_ = max_distance;
+
+    distance_field_margin_ = ceil(max_distance / cell_size);
+
+    if (2 * distance_field_margin_ + 2 > cells_per_side) {
+        std::cerr << "WARNING: distance field is too small for its max distance, not using it." << std::endl;
+        distance_field_cells_ = 0;
+    }
+
+    distance_field_.resize((size_t)distance_field_cells_ * distance_field_cells_ * distance_field_cells_);
 
+    distance_field_valid_ = false;
+    epoch_ ++;
 }
 
-void StereoOctomap::InsertPointsIntoOctree(const lcmt::stereo *msg, BotTrans *to_open_cv) {
-    // apply this matrix to each point
-    for (int i = 0; i<msg->number_of_points; i++) {
-        double this_point_d[3];
-        double trans_point[3];
+/**
+ * Moves the distance field to be centered on a point and brings it up to
+ * date with the map.  Does nothing if neither has changed since the last
+ * call, so it's fine to call before every search.
+ *
+ * @param center usually the aircraft's position
+ */
+void StereoOctomap::UpdateDistanceField(const double center[3]) {
+    TRACE_SCOPE("octree-distance-field");
+
+    if (distance_field_cells_ <= 0) {
+        return;
+    }
+
+    bool moved = false;
 
-        this_point_d[0] = msg->x[i];
-        this_point_d[1] = msg->y[i];
-        this_point_d[2] = msg->z[i];
+    for (int i = 0; i < 3; i++) {
+        // the grid moves a whole cell at a time
+        double origin = (floor(center[i] / distance_field_cell_size_) - distance_field_cells_ / 2) * distance_field_cell_size_;
 
-        // add the position vector
-        bot_trans_apply_vec(to_open_cv, this_point_d, trans_point);
+        if (origin != distance_field_origin_[i]) {
+            distance_field_origin_[i] = origin;
+            moved = true;
+        }
+    }
+
+    if (distance_field_valid_ && moved == false && map_changed_ == false) {
+        return;
+    }
+
+    ComputeDistanceField();
 
-        // add point to cloud
-        pcl::PointXYZ this_point(trans_point[0], trans_point[1], trans_point[2]);
-        current_octree_->addPointToCloud(this_point, current_cloud_);
-        building_octree_->addPointToCloud(this_point, building_cloud_);
+    if (moved || distance_field_valid_ == false) {
+        // cells that were off of the grid (and searched instead) aren't
+        // anymore, and the other way around
+        epoch_ ++;
     }
+
+    distance_field_valid_ = true;
+    distance_field_changes_ = num_changes_;
+    map_changed_ = false;
 }
 
+/**
+ * Recomputes the whole distance field: marks the cells with points in
+ * them, then runs an exact distance transform along x, y and z.
+ */
+void StereoOctomap::ComputeDistanceField() {
 
-void StereoOctomap::RemoveOldPoints(int64_t last_msg_time) {
-    // check timestamps
-    if (current_octree_timestamp_ < 0) {
-         current_octree_timestamp_ = last_msg_time;
-         building_octree_timestamp_ = last_msg_time + OCTREE_LIFE/2; // half a life in the future
-    } else if (current_octree_timestamp_ > last_msg_time) {
-        // can happen if you're replaying a log and jump back
+    const int n = distance_field_cells_;
+    const double cell_size = distance_field_cell_size_;
+    const double block_size = OCTOMAP_VOXEL_SIZE * OCTOMAP_VOXELS_PER_BLOCK;
+
+    // further (squared, in cells) than anything in the grid can be
+    const float far = 3.0f * n * n + 1;
+
+    std::fill(distance_field_.begin(), distance_field_.end(), far);
+
+    for (const std::pair<const int64_t, OctomapBlock> &block : blocks_) {
+
+        bool overlaps = true;
+
+        for (int i = 0; i < 3; i++) {
+            double block_min = block.second.coords[i] * block_size;
+
+            if (block_min + block_size < distance_field_origin_[i] || block_min > distance_field_origin_[i] + n * cell_size) {
+                overlaps = false;
+            }
+        }
+
+        if (overlaps == false) {
+            continue;
+        }
+
+        const OctomapPointList &xyz = block.second.xyz;
+
+        for (unsigned int j = 0; j < xyz.size(); j += 3) {
+            int cell[3];
+            bool in_grid = true;
+
+            for (int i = 0; i < 3; i++) {
+                cell[i] = floor((xyz[j + i] - distance_field_origin_[i]) / cell_size);
+
+                if (cell[i] < 0 || cell[i] >= n) {
+                    in_grid = false;
+                }
+            }
+
+            if (in_grid) {
+                distance_field_[((size_t)cell[0] * n + cell[1]) * n + cell[2]] = 0;
+            }
+        }
+    }
+
+    // one row at a time along each axis
+    size_t strides[3] = { (size_t)n * n, (size_t)n, 1 };
+
+    for (int axis = 2; axis >= 0; axis--) {
 
-        // replaying a log, so reinit everything.
-        delete current_octree_;
-        delete building_octree_;
+        size_t stride = strides[axis];
 
-        // we don't have to delete the clouds since they are shared pointers and will auto-delete
+        // the other two axes' strides, the smaller one on the inside so
+        // neighboring rows share cache lines
+        size_t stride_a = strides[axis == 0 ? 1 : 0];
+        size_t stride_b = strides[axis == 2 ? 1 : 2];
 
-        current_octree_timestamp_ = last_msg_time;
-        building_octree_timestamp_ = last_msg_time + OCTREE_LIFE/2;
+        ThreadPool::GetShared()->ParallelFor(0, n, [&](int a) {
 
-        current_cloud_ = pcl::PointCloud<pcl::PointXYZ>::Ptr(new pcl::PointCloud<pcl::PointXYZ>());
-        building_cloud_ = pcl::PointCloud<pcl::PointXYZ>::Ptr(new pcl::PointCloud<pcl::PointXYZ>());
+            std::vector<float> row_in(n), row_out(n), z(n + 1);
+            std::vector<int> v(n);
 
-        current_octree_ = new pcl::octree::OctreePointCloudSearch<pcl::PointXYZ>(OCTREE_RESOLUTION);
-        current_octree_->setInputCloud((pcl::PointCloud<pcl::PointXYZ>::Ptr)current_cloud_);
+            for (int b = 0; b < n; b++) {
+                float *row = &distance_field_[a * stride_a + b * stride_b];
 
-        building_octree_ = new pcl::octree::OctreePointCloudSearch<pcl::PointXYZ>(OCTREE_RESOLUTION);
-        building_octree_->setInputCloud((pcl::PointCloud<pcl::PointXYZ>::Ptr)building_cloud_);
+                bool empty = true;
 
-        std::cout << std::endl << "swapping octrees because jump back in time" << std::endl;
+                for (int i = 0; i < n; i++) {
+                    row_in[i] = row[i * stride];
 
+                    if (row_in[i] < far) {
+                        empty = false;
+                    }
+                }
 
-    } else if (current_octree_timestamp_ + OCTREE_LIFE < last_msg_time && last_msg_time - building_octree_timestamp_ > OCTREE_LIFE/2) {
-        std::cout << "swapping octrees (old: " << (current_octree_timestamp_ - last_msg_time) / 1000000.0f << ", new: " << (building_octree_timestamp_ - last_msg_time) / 1000000.0f << ")" << std::endl;
-        // swap out trees since this one has expired
-        delete current_octree_;
-        current_octree_ = building_octree_;
+                if (empty) {
+                    // nothing near this row yet
+                    continue;
+                }
 
-        // we don't have to delete clouds since they are shared pointers and will auto-delete
-        current_cloud_ = building_cloud_;
+                DistanceTransform(row_in.data(), n, row_out.data(), v.data(), z.data());
 
-        current_octree_timestamp_ = building_octree_timestamp_;
-        building_octree_timestamp_ = last_msg_time;
+                for (int i = 0; i < n; i++) {
+                    row[i * stride] = row_out[i];
+                }
+            }
+        });
+    }
 
-        building_cloud_ = pcl::PointCloud<pcl::PointXYZ>::Ptr(new pcl::PointCloud<pcl::PointXYZ>());
+    // the transform is between cell centers, but the points can be anywhere
+    // in their cells, and the lookups interpolate between the centers.
+    // Taking a cell's diagonal off keeps the field from ever saying an
+    // obstacle is further than it is.
+    double diagonal = sqrt(3) * cell_size;
 
-        building_octree_ = new pcl::octree::OctreePointCloudSearch<pcl::PointXYZ>(OCTREE_RESOLUTION);
-        building_octree_->setInputCloud((pcl::PointCloud<pcl::PointXYZ>::Ptr)building_cloud_);
+    for (size_t i = 0; i < distance_field_.size(); i++) {
+        double distance = sqrt(distance_field_[i]) * cell_size - diagonal;
 
-        //std::cout << std::endl << "swapping octrees" << std::endl;
+        distance_field_[i] = std::min(std::max(distance, 0.0), distance_field_max_distance_);
     }
 }
 
 /**
- * Find the distance to the nearest neighbor of a point
+ * One dimensional squared distance transform (Felzenszwalb and
+ * Huttenlocher): d[q] = min over p of (q - p)^2 + f[p].
+ *
+ * @param f input, n long
+ * @param n length of the row
+ * @param d output, n long
+ * @param v scratch, n long
+ * @param z scratch, n + 1 long
+ */
+void StereoOctomap::DistanceTransform(const float *f, int n, float *d, int *v, float *z) {
+
+    int k = 0;
+
+    v[0] = 0;
+    z[0] = -INFINITY;
+    z[1] = INFINITY;
+
+    for (int q = 1; q < n; q++) {
+        float s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+
+        while (s <= z[k]) {
+            k--;
+            s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+        }
+
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = INFINITY;
+    }
+
+    k = 0;
+
+    for (int q = 0; q < n; q++) {
+        while (z[k + 1] < q) {
+            k++;
+        }
+
+        d[q] = (q - v[k]) * (q - v[k]) + f[v[k]];
+    }
+}
+
+/**
+ * Looks up the distance to the nearest obstacle in the distance field.
+ *
+ * @param point the xyz point to look up
+ * @param distance set to the distance (at most the field's max distance)
+ *
+ * @retval false if there is no distance field or the point isn't far
+ *      enough inside it
+ */
+bool StereoOctomap::DistanceFieldLookup(const double point[3], double *distance) const {
+
+    if (distance_field_valid_ == false) {
+        return false;
+    }
+
+    const int n = distance_field_cells_;
+
+    int cell[3];
+    double frac[3];
+
+    for (int i = 0; i < 3; i++) {
+        // relative to the cell centers
+        double u = (point[i] - distance_field_origin_[i]) / distance_field_cell_size_ - 0.5;
+
+        if (u < distance_field_margin_ || u >= n - 1 - distance_field_margin_) {
+            return false;
+        }
+
+        cell[i] = floor(u);
+        frac[i] = u - cell[i];
+    }
+
+    const float *corner = &distance_field_[((size_t)cell[0] * n + cell[1]) * n + cell[2]];
+
+    double result = 0;
+
+    for (int dx = 0; dx < 2; dx++) {
+        for (int dy = 0; dy < 2; dy++) {
+            for (int dz = 0; dz < 2; dz++) {
+                double weight = (dx ? frac[0] : 1 - frac[0]) * (dy ? frac[1] : 1 - frac[1]) * (dz ? frac[2] : 1 - frac[2]);
+
+                result += weight * corner[(dx * n + dy) * n + dz];
+            }
+        }
+    }
+
+    *distance = result;
+
+    return true;
+}
+
+/**
+ * Distances to the nearest obstacles for a batch of points, from the
+ * distance field where it covers them and otherwise from
+ * NearestNeighbors().  Without a distance field, this is just
+ * NearestNeighbors().
+ *
+ * @param xyz num_points points, x, y, z each
+ * @param num_points number of points
+ * @param distances distance to the nearest obstacle from each point, or -1
+ *      if there's none (or none closer than max_distance).  Distances from
+ *      the field stop at its max distance.
+ * @param max_distance distances past this aren't needed, or -1 for no limit
+ */
+void StereoOctomap::Clearances(const double *xyz, int num_points, double *distances, double max_distance) const {
+    TRACE_SCOPE("octree-clearances");
+
+    // points the field doesn't cover are searched for a run at a time
+    int run_start = 0;
+
+    for (int i = 0; i < num_points; i++) {
+        double distance;
+
+        if (DistanceFieldLookup(&xyz[3 * i], &distance) == false) {
+            continue;
+        }
+
+        // the rest are counted by NearestNeighbors()
+        num_queries_.fetch_add(1, std::memory_order_relaxed);
+
+        if (i > run_start) {
+            NearestNeighbors(&xyz[3 * run_start], i - run_start, &distances[run_start], max_distance);
+        }
+
+        run_start = i + 1;
+
+        if (max_distance >= 0 && distance >= max_distance) {
+            distances[i] = -1;
+        } else {
+            distances[i] = distance;
+        }
+    }
+
+    if (num_points > run_start) {
+        NearestNeighbors(&xyz[3 * run_start], num_points - run_start, &distances[run_start], max_distance);
+    }
+}
+
+/**
+ * Searches the blocks in shells around the point's block until the next
+ * shell is further away than the best point so far.
  *
  * @param point the xyz point to search
+ * @param best_sqr_dist squared distance to beat (-1 for none), set to the
+ *      squared distance to the point found
+ * @param close_bound true if best_sqr_dist is probably about the answer
+ *      (not just a limit)
  *
- * @retval distance to the nearest neighbor or -1 if no points found.
+ * @retval the point found, or nullptr if there was none closer than
+ *      best_sqr_dist
  */
-double StereoOctomap::NearestNeighbor(double point[3]) const {
+const double* StereoOctomap::FindNearest(const double point[3], double *best_sqr_dist, bool close_bound) const {
+
+    if ((int)flat_voxels_.size() <= brute_force_max_voxels_) {
+        // small enough that looking at everything is faster
+        return FindNearestBruteForce(point, best_sqr_dist);
+    }
 
-    pcl::PointXYZ search_point;
-    search_point.x = point[0];
-    search_point.y = point[1];
-    search_point.z = point[2];
+    const double block_size = OCTOMAP_VOXEL_SIZE * OCTOMAP_VOXELS_PER_BLOCK;
 
-    // init output parameters
-    std::vector<int> point_out_indices(1);
-    std::vector<float> k_sqr_distances(1);
+    int64_t center[3];
 
-    // ensure there is at least one point in the tree
-    if (current_octree_->getLeafCount() < 1) {
-        // no points in octree
-        return -1;
+    for (int i = 0; i < 3; i++) {
+        center[i] = floor(point[i] / block_size);
     }
 
-    int num_points_found = current_octree_->nearestKSearch(search_point, 1, point_out_indices, k_sqr_distances);
+    const double *nearest = nullptr;
 
-    if (num_points_found < 1) {
-        // no points found
-        return -1;
-    } else {
+    if (*best_sqr_dist >= 0) {
+        // nothing to beat it if the whole area is empty
+        double radius = sqrt(*best_sqr_dist);
+        int64_t low[3], high[3];
+
+        for (int i = 0; i < 3; i++) {
+            low[i] = floor((point[i] - radius) / block_size);
+            high[i] = floor((point[i] + radius) / block_size);
+        }
+
+        if (CoarseEmpty(low, high)) {
+            return nullptr;
+        }
+    }
+
+    // with something close to beat, it's known up front about how many
+    // shells will have to be searched
+    bool scan_blocks = false;
 
-        return sqrt(k_sqr_distances.at(0));
+    if (close_bound && *best_sqr_dist >= 0) {
+        int64_t last_side = 2 * ((int64_t)(sqrt(*best_sqr_dist) / block_size) + 1) + 1;
+
+        scan_blocks = last_side * last_side * last_side > (int64_t)blocks_.size();
+    }
+
+    for (int64_t shell = 0; ; shell++) {
+
+        // every point in this shell is at least this far away
+        double shell_dist = (shell - 1) * block_size;
+
+        if (*best_sqr_dist >= 0 && shell_dist > 0 && shell_dist * shell_dist >= *best_sqr_dist) {
+            break;
+        }
+
+        int64_t side = 2 * shell + 1;
+
+        if (scan_blocks || side * side * side > (int64_t)blocks_.size()) {
+            // cheaper to go through the rest of the blocks than to look up
+            // every cell out here
+            for (const std::pair<const int64_t, OctomapBlock> &block : blocks_) {
+                int64_t block_shell = 0;
+
+                for (int i = 0; i < 3; i++) {
+                    block_shell = std::max(block_shell, std::abs(block.second.coords[i] - center[i]));
+                }
+
+                double block_dist = (block_shell - 1) * block_size;
+
+                if (block_shell >= shell && (*best_sqr_dist < 0 || block_dist <= 0 || block_dist * block_dist < *best_sqr_dist)) {
+                    SearchBlock(block.second, point, best_sqr_dist, &nearest);
+                }
+            }
+
+            break;
+        }
+
+        int64_t coords[3];
+
+        for (int64_t dx = -shell; dx <= shell; dx++) {
+            for (int64_t dy = -shell; dy <= shell; dy++) {
+
+                bool on_shell = (std::abs(dx) == shell || std::abs(dy) == shell);
+
+                // only the faces of the cube, not the inside
+                int64_t dz_step = on_shell ? 1 : std::max<int64_t>(2 * shell, 1);
+
+                for (int64_t dz = -shell; dz <= shell; dz += dz_step) {
+                    coords[0] = center[0] + dx;
+                    coords[1] = center[1] + dy;
+                    coords[2] = center[2] + dz;
+
+                    // a bit instead of a hash lookup for the empty blocks
+                    if (CoarseOccupied(coords) == false) {
+                        continue;
+                    }
+
+                    OctomapMap<OctomapBlock>::const_iterator block = blocks_.find(GetCellKey(coords));
+
+                    if (block != blocks_.end()) {
+                        SearchBlock(block->second, point, best_sqr_dist, &nearest);
+                    }
+                }
+            }
+        }
+    }
+
+    return nearest;
+}
+
+/**
+ * FindNearest() by scanning every point in the flat lists.
+ *
+ * @param point the xyz point to search
+ * @param best_sqr_dist squared distance to beat (-1 for none), set to the
+ *      squared distance to the point found
+ *
+ * @retval the point found (in its block), or nullptr if there was none
+ *      closer than best_sqr_dist
+ */
+const double* StereoOctomap::FindNearestBruteForce(const double point[3], double *best_sqr_dist) const {
+
+    int num_points = flat_voxels_.size();
+
+    if (num_points == 0) {
+        return nullptr;
+    }
+
+    const double *x = flat_x_.data();
+    const double *y = flat_y_.data();
+    const double *z = flat_z_.data();
+
+    int i = 0;
+    int best_index = 0;
+    double best = (x[0] - point[0]) * (x[0] - point[0])
+        + (y[0] - point[1]) * (y[0] - point[1])
+        + (z[0] - point[2]) * (z[0] - point[2]);
+
+#ifdef OCTOMAP_USE_SSE2
+    __m128d px = _mm_set1_pd(point[0]);
+    __m128d py = _mm_set1_pd(point[1]);
+    __m128d pz = _mm_set1_pd(point[2]);
+
+    // best distance and its index in each lane
+    __m128d lane_best = _mm_set1_pd(best);
+    __m128d lane_index = _mm_setzero_pd();
+    __m128d index = _mm_set_pd(1, 0);
+    const __m128d two = _mm_set1_pd(2);
+
+    for (; i + 2 <= num_points; i += 2) {
+        __m128d dx = _mm_sub_pd(_mm_loadu_pd(&x[i]), px);
+        __m128d dy = _mm_sub_pd(_mm_loadu_pd(&y[i]), py);
+        __m128d dz = _mm_sub_pd(_mm_loadu_pd(&z[i]), pz);
+
+        __m128d sqr_dist = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_mul_pd(dz, dz));
+
+        __m128d closer = _mm_cmplt_pd(sqr_dist, lane_best);
+
+        lane_best = _mm_or_pd(_mm_and_pd(closer, sqr_dist), _mm_andnot_pd(closer, lane_best));
+        lane_index = _mm_or_pd(_mm_and_pd(closer, index), _mm_andnot_pd(closer, lane_index));
+
+        index = _mm_add_pd(index, two);
+    }
+
+    double bests[2], indices[2];
+    _mm_storeu_pd(bests, lane_best);
+    _mm_storeu_pd(indices, lane_index);
+
+    for (int lane = 0; lane < 2; lane++) {
+        if (bests[lane] < best) {
+            best = bests[lane];
+            best_index = indices[lane];
+        }
+    }
+#endif // OCTOMAP_USE_SSE2
+
+    for (; i < num_points; i++) {
+        double sqr_dist = (x[i] - point[0]) * (x[i] - point[0])
+            + (y[i] - point[1]) * (y[i] - point[1])
+            + (z[i] - point[2]) * (z[i] - point[2]);
+
+        if (sqr_dist < best) {
+            best = sqr_dist;
+            best_index = i;
+        }
+    }
+
+    if (*best_sqr_dist >= 0 && best >= *best_sqr_dist) {
+        return nullptr;
+    }
+
+    *best_sqr_dist = best;
+
+    const OctomapVoxel *voxel = flat_voxels_[best_index];
+
+    return &voxel->block_data->xyz[3 * voxel->block_index];
+}
+
+/**
+ * Times nearest neighbor searches on random maps of more and more voxels,
+ * scanning and by block, once per process.
+ *
+ * @param bot_frames for making the maps
+ *
+ * @retval most voxels that scanning was faster for (0 for never)
+ */
+int StereoOctomap::CalibrateBruteForce(BotFrames *bot_frames) {
+
+    static const int max_voxels = [bot_frames]() {
+        calibrating_brute_force = true;
+
+        // about what's around the aircraft in a forest
+        std::default_random_engine rand_engine(1);
+        std::uniform_real_distribution<double> uniform_dist(-30, 30);
+
+        const int num_searches = 500;
+
+        std::vector<double> search_points(3 * num_searches);
+
+        for (double &coord : search_points) {
+            coord = uniform_dist(rand_engine);
+        }
+
+        // so the searches aren't optimized out
+        volatile double sum = 0;
+
+        int fastest = 0;
+
+        for (int num_voxels = 16; num_voxels <= OCTOMAP_BRUTE_FORCE_CALIBRATE_MAX; num_voxels *= 2) {
+            StereoOctomap map(bot_frames);
+            OctomapKeyList bucket_voxels;
+
+            while ((int)map.voxels_.size() < num_voxels) {
+                double xyz[3];
+                int64_t voxel_coords[3];
+
+                for (int i = 0; i < 3; i++) {
+                    xyz[i] = uniform_dist(rand_engine);
+                    voxel_coords[i] = floor(xyz[i] / OCTOMAP_VOXEL_SIZE);
+                }
+
+                map.InsertPoint(xyz, voxel_coords, 0, &bucket_voxels);
+            }
+
+            int64_t elapsed[2];
+
+            // brute force, then blocks
+            for (int brute_force = 1; brute_force >= 0; brute_force--) {
+                map.brute_force_max_voxels_ = brute_force ? INT_MAX : 0;
+
+                int64_t start = GetMonotonicNow();
+
+                for (int i = 0; i < num_searches; i++) {
+                    double best_sqr_dist = -1;
+                    map.FindNearest(&search_points[3 * i], &best_sqr_dist);
+                    sum = sum + best_sqr_dist;
+                }
+
+                elapsed[brute_force] = GetMonotonicNow() - start;
+            }
+
+            if (elapsed[1] > elapsed[0]) {
+                break;
+            }
+
+            fastest = num_voxels;
+        }
+
+        calibrating_brute_force = false;
+
+        return fastest;
+    }();
+
+    return max_voxels;
+}
+
+bool StereoOctomap::AnyInBlock(const OctomapBlock &block, const double point[3], double sqr_radius) const {
+
+    for (unsigned int i = 0; i < block.xyz.size(); i += 3) {
+        const double *xyz = &block.xyz[i];
+
+        double sqr_dist = (xyz[0] - point[0]) * (xyz[0] - point[0])
+            + (xyz[1] - point[1]) * (xyz[1] - point[1])
+            + (xyz[2] - point[2]) * (xyz[2] - point[2]);
+
+        if (sqr_dist <= sqr_radius) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void StereoOctomap::PointsInBlock(const OctomapBlock &block, const double point[3], double sqr_radius, std::vector<double> *xyz) const {
+
+    for (unsigned int i = 0; i < block.xyz.size(); i += 3) {
+        const double *this_xyz = &block.xyz[i];
+
+        double sqr_dist = (this_xyz[0] - point[0]) * (this_xyz[0] - point[0])
+            + (this_xyz[1] - point[1]) * (this_xyz[1] - point[1])
+            + (this_xyz[2] - point[2]) * (this_xyz[2] - point[2]);
+
+        if (sqr_dist <= sqr_radius) {
+            xyz->insert(xyz->end(), this_xyz, this_xyz + 3);
+        }
     }
+}
+
+void StereoOctomap::SearchBlock(const OctomapBlock &block, const double point[3], double *best_sqr_dist, const double **nearest) const {
+
+    for (unsigned int i = 0; i < block.xyz.size(); i += 3) {
+        const double *xyz = &block.xyz[i];
+
+        double sqr_dist = (xyz[0] - point[0]) * (xyz[0] - point[0])
+            + (xyz[1] - point[1]) * (xyz[1] - point[1])
+            + (xyz[2] - point[2]) * (xyz[2] - point[2]);
 
+        if (sqr_dist < *best_sqr_dist || *best_sqr_dist < 0) {
+            *best_sqr_dist = sqr_dist;
+            *nearest = xyz;
+        }
+    }
 }
 
 
 void StereoOctomap::PrintAllPoints() const {
-    for(pcl::PointCloud<pcl::PointXYZ>::iterator it = current_cloud_->begin(); it != current_cloud_->end(); it++) {
-        std::cout << "(" << it->x << ", " << it->y << ", " << it->z << ")" << std::endl;
+    for (const std::pair<const int64_t, OctomapBlock> &block : blocks_) {
+        const OctomapPointList &xyz = block.second.xyz;
+
+        for (unsigned int i = 0; i < xyz.size(); i += 3) {
+            std::cout << "(" << xyz[i] << ", " << xyz[i + 1] << ", " << xyz[i + 2] << ")" << std::endl;
+        }
     }
 
 }
@@ -159,17 +1817,18 @@ void StereoOctomap::Draw(lcm_t *lcm) const {
     bot_lcmgl_t *lcmgl = bot_lcmgl_init(lcm, "PointCloud");
     bot_lcmgl_color3f(lcmgl, 1, 0, 0);
 
-    for(pcl::PointCloud<pcl::PointXYZ>::iterator it = current_cloud_->begin(); it != current_cloud_->end(); it++) {
-        double xyz[3];
-        xyz[0] = it->x;
-        xyz[1] = it->y;
-        xyz[2] = it->z;
+    // one batch of points instead of a box per voxel: a vertex is a
+    // quarter of the message a box is, and much less for the viewer to draw
+    bot_lcmgl_point_size(lcmgl, OCTOMAP_DRAW_POINT_SIZE);
+    bot_lcmgl_begin(lcmgl, GL_POINTS);
 
-        float box_size[3] = { .25, .25, .25 };
-
-        //bot_lcmgl_sphere(lcmgl, xyz, 0.5, 20, 20);
-        bot_lcmgl_box(lcmgl, xyz, box_size);
+    for (const std::pair<const int64_t, OctomapBlock> &block : blocks_) {
+        for (unsigned int j = 0; j < block.second.xyz.size(); j += 3) {
+            bot_lcmgl_vertex3f(lcmgl, block.second.xyz[j], block.second.xyz[j + 1], block.second.xyz[j + 2]);
+        }
     }
+
+    bot_lcmgl_end(lcmgl);
     bot_lcmgl_switch_buffer(lcmgl);
 
     bot_lcmgl_color3f(lcmgl, 1, 0, 0);
@@ -180,50 +1839,106 @@ void StereoOctomap::Draw(lcm_t *lcm) const {
  * Publishes the entire map to the camera frame
  * as a stereo message for drawing in the HUD
  */
-void StereoOctomap::PublishToHud(lcm_t *lcm) const {
-    BotTrans trans;
-    bot_frames_get_trans(bot_frames_, "local", "body", &trans);
+/**
+ * Sends the HUD the voxels added and removed since the last call (or all of
+ * them, the first time and every OCTOMAP_HUD_RESET_EVERY calls), as 16-bit
+ * voxel coordinates in the local frame.  Voxels more than 32767 voxels
+ * from where the aircraft was at the last reset aren't sent.
+ *
+ * @param lcm LCM to publish on
+ */
+void StereoOctomap::PublishToHud(lcm_t *lcm) {
 
-    lcmt_stereo msg;
-    msg.timestamp = GetTimestampNow();
-    msg.frame_number = -1;
-    msg.video_number = -1;
+    hud_tracking_ = true;
 
-    int counter = 0;
+    if (hud_publishes_since_reset_ >= OCTOMAP_HUD_RESET_EVERY) {
+        hud_reset_ = true;
+    }
+
+    OctomapHudVoxels *lists[2] = { &hud_added_, &hud_removed_ };
 
-    // point cloud size
-    // TODO: this must be a function call
-    for(pcl::PointCloud<pcl::PointXYZ>::iterator it = current_cloud_->begin(); it != current_cloud_->end(); it++) {
-        counter ++;
+    for (OctomapHudVoxels *list : lists) {
+        list->x.clear();
+        list->y.clear();
+        list->z.clear();
     }
 
-    float x[counter], y[counter], z[counter];
-    unsigned char grey[counter];
+    if (hud_reset_) {
+        BotTrans body_to_local;
+        transforms_->GetBodyToLocal(&body_to_local);
 
-    int i = 0;
-    for(pcl::PointCloud<pcl::PointXYZ>::iterator it = current_cloud_->begin(); it != current_cloud_->end(); it++) {
-        double xyz[3], xyz_camera_frame[3];
-        xyz[0] = it->x;
-        xyz[1] = it->y;
-        xyz[2] = it->z;
+        for (int i = 0; i < 3; i++) {
+            hud_origin_[i] = floor(body_to_local.trans_vec[i] / OCTOMAP_VOXEL_SIZE);
+        }
 
-        // transform this point into the camera frame
-        bot_trans_apply_vec(&trans, xyz, xyz_camera_frame);
+        for (const std::pair<const int64_t, OctomapVoxel> &voxel : voxels_) {
+            AddHudVoxel(voxel.first, &hud_added_);
+        }
+    } else {
+        for (const std::pair<const int64_t, bool> &change : hud_changes_) {
+            AddHudVoxel(change.first, change.second ? &hud_added_ : &hud_removed_);
+        }
+    }
 
-        x[i] = xyz_camera_frame[0];
-        y[i] = xyz_camera_frame[1];
-        z[i] = xyz_camera_frame[2];
+    hud_changes_.clear();
 
-        grey[i] = 0;
+    if (hud_reset_ == false && hud_added_.x.empty() && hud_removed_.x.empty()) {
+        // nothing new to send
+        hud_publishes_since_reset_ ++;
+        return;
+    }
 
-        i++;
+    lcmt_octomap_delta msg;
+    msg.timestamp = GetTimestampNow();
+    msg.reset = hud_reset_;
+    msg.voxel_size = OCTOMAP_VOXEL_SIZE;
+
+    for (int i = 0; i < 3; i++) {
+        msg.origin[i] = hud_origin_[i];
+    }
+
+    msg.number_added = hud_added_.x.size();
+    msg.added_x = hud_added_.x.data();
+    msg.added_y = hud_added_.y.data();
+    msg.added_z = hud_added_.z.data();
+
+    msg.number_removed = hud_removed_.x.size();
+    msg.removed_x = hud_removed_.x.data();
+    msg.removed_y = hud_removed_.y.data();
+    msg.removed_z = hud_removed_.z.data();
+
+    lcmt_octomap_delta_publish(lcm, "octomap-hud", &msg);
+
+    if (hud_reset_) {
+        hud_reset_ = false;
+        hud_publishes_since_reset_ = 0;
+    } else {
+        hud_publishes_since_reset_ ++;
     }
+}
 
-    msg.number_of_points = counter;
-    msg.x = x;
-    msg.y = y;
-    msg.z = z;
-    msg.grey = grey;
+/**
+ * Adds a voxel to a list for PublishToHud(), unless it's too far from the
+ * HUD's origin to fit.
+ *
+ * @param voxel_key key of the voxel
+ * @param hud_voxels list to add it to
+ */
+void StereoOctomap::AddHudVoxel(int64_t voxel_key, OctomapHudVoxels *hud_voxels) const {
+
+    int64_t coords[3];
+
+    GetCellCoords(voxel_key, coords);
+
+    for (int i = 0; i < 3; i++) {
+        coords[i] -= hud_origin_[i];
+
+        if (coords[i] < -32767 || coords[i] > 32767) {
+            return;
+        }
+    }
 
-    lcmt_stereo_publish(lcm, "octomap-hud", &msg);
+    hud_voxels->x.push_back(coords[0]);
+    hud_voxels->y.push_back(coords[1]);
+    hud_voxels->z.push_back(coords[2]);
 }
@@ -1,8 +1,9 @@
 /**
- * Implements a octree data structure using PCL as a backend
- * for pushbroom stereo data.
+ * Keeps the pushbroom stereo hits from the last OCTREE_LIFE in a hash of
+ * small voxels, each with the last point seen in it and when, so adding a
+ * point is O(1) and obstacles age out one voxel at a time.
  *
- * Supports checking trajectories against the octree to determine nearest neighbor.
+ * Supports checking trajectories against the map to determine nearest neighbor.
  *
  * (C) 2015 Andrew Barry <abarry@csail.mit.edu>
  */
@@ -12,6 +13,9 @@
 
 
 #include <iostream>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
 
 #include "opencv2/opencv.hpp"
 
@@ -23,14 +27,124 @@
 #include <bot_frames/bot_frames.h>
 #include <bot_param/param_client.h>
 #include <lcmtypes/octomap_raw_t.h>
-#include <pcl/point_cloud.h>
-#include <pcl/octree/octree.h>
 #include "../../LCM/lcmt_stereo_with_xy.h"
+#include "../../LCM/lcmt_octomap_delta.h"
 #include "../../LCM/lcmt/stereo.hpp"
 #include "../../sensors/stereo/opencv-stereo-util.hpp"
+#include "../../utils/utils/RealtimeUtils.hpp"
+#include "../../utils/utils/MemoryAccounting.hpp"
 
 #define OCTREE_LIFE 4000000 // in usec
 
+// points closer than this are merged (the newest one is kept), in meters
+#define OCTOMAP_VOXEL_SIZE 0.25
+
+// pixels for each voxel in Draw()
+#define OCTOMAP_DRAW_POINT_SIZE 8.0f
+
+// nearest neighbor searches go out block by block.  Blocks are this many
+// voxels on a side.
+#define OCTOMAP_VOXELS_PER_BLOCK 16
+
+// which blocks are occupied is also kept on a coarse grid of cells this
+// many blocks on a side, so searches can skip empty areas without looking
+// up each block.  The grid is OCTOMAP_COARSE_CELLS cells on a side (32, one
+// bit per cell in each row's word) and wraps around, so far away blocks
+// can share a cell; that only makes an area look occupied when it isn't.
+#define OCTOMAP_BLOCKS_PER_COARSE_CELL 4
+#define OCTOMAP_COARSE_CELLS 32
+
+// OCTREE_LIFE is split into this many buckets of voxels to expire
+#define OCTOMAP_EXPIRY_BUCKETS 8
+
+// PublishToHud() sends only what changed, and everything every this many
+// publishes so a HUD that starts late (or missed a message) catches up
+#define OCTOMAP_HUD_RESET_EVERY 100
+
+// voxel changes remembered for GetChangesSince().  Callers further behind
+// than this start over.
+#define OCTOMAP_CHANGE_LOG_SIZE 16384
+
+// first bytes of a WriteSnapshot() file, with the format's version
+#define OCTOMAP_SNAPSHOT_MAGIC "OCTSNAP1"
+
+// nearest neighbor searches in maps up to about this many voxels are timed
+// both ways at startup, to find where scanning every point stops being
+// faster than the block search (see SetBruteForceMaxVoxels())
+#define OCTOMAP_BRUTE_FORCE_CALIBRATE_MAX 4096
+
+struct OctomapBlock;
+struct OctomapVoxel;
+
+// the map's containers count what they hold against MEMORY_OCTOMAP (see
+// MemoryAccounting.hpp)
+typedef AccountedVector<int64_t, MEMORY_OCTOMAP> OctomapKeyList;
+typedef AccountedVector<double, MEMORY_OCTOMAP> OctomapPointList;
+
+template <typename T>
+using OctomapMap = std::unordered_map<int64_t, T, std::hash<int64_t>, std::equal_to<int64_t>,
+    AccountedAllocator<std::pair<const int64_t, T>, MEMORY_OCTOMAP> >;
+
+/**
+ * An occupied voxel: when it was last seen.  Its point is kept in its
+ * block.
+ */
+struct OctomapVoxel {
+    int64_t last_seen;
+
+    // newest expiry bucket the voxel is in
+    int64_t bucket;
+
+    int64_t block;
+
+    // the block itself (which stays put in the map until it's empty)
+    OctomapBlock *block_data;
+
+    // where the voxel is in its block's lists
+    int block_index;
+
+    // where the voxel is in the map's flat lists
+    int flat_index;
+};
+
+/**
+ * The occupied voxels in a block and the last point seen in each, packed
+ * so searches don't have to look up every voxel.
+ */
+struct OctomapBlock {
+    int64_t coords[3];
+
+    OctomapKeyList voxels;
+
+    // x, y, z of each voxel's point
+    OctomapPointList xyz;
+};
+
+/**
+ * Voxel coordinates on their way to the HUD, relative to the origin voxel
+ * of the lcmt_octomap_delta.
+ */
+struct OctomapHudVoxels {
+    std::vector<int16_t> x;
+    std::vector<int16_t> y;
+    std::vector<int16_t> z;
+};
+
+/**
+ * A point in a map's history (StereoOctomap::GetVersion()), to find what
+ * changed since then with StereoOctomap::GetChangesSince().  The two maps
+ * of a ConcurrentStereoOctomap get the same changes, so their versions can
+ * be compared too.
+ */
+struct StereoOctomapVersion {
+    // changes everywhere at once (clearing the map, moving the distance
+    // field) start a new epoch
+    int64_t epoch;
+
+    // voxel changes that queries have seen
+    int64_t changes;
+};
+
 using Eigen::Matrix3d;
 using Eigen::Vector3d;
 
@@ -42,10 +156,10 @@ class StereoOctomap {
         StereoOctomap(BotFrames *bot_frames);
 
         void ProcessStereoMessage(const lcmt::stereo *msg);
+        void ProcessStereoMessage(const lcmt::stereo *msg, BotTrans *to_open_cv, const uint8_t *keep = NULL);
 
-        void PublishOctomap(lcm_t *lcm);
         //void PublishToStereo(lcm_t *lcm, int frame_number, int video_number);
-        void PublishToHud(lcm_t *lcm) const;
+        void PublishToHud(lcm_t *lcm);
 
         void SetStereoConfig(OpenCvStereoConfig stereo_config, OpenCvStereoCalibration stereo_calibration) {
             stereo_config_  = stereo_config;
@@ -60,31 +174,190 @@ class StereoOctomap {
 
 
         double NearestNeighbor(double point[3]) const;
+        void NearestNeighbors(const double *xyz, int num_points, double *distances, double max_distance = -1) const;
+
+        bool AnyWithin(const double point[3], double radius) const;
+        void PointsWithin(const double point[3], double radius, std::vector<double> *xyz) const;
+        double MinDistanceClamped(const double point[3], double max_radius) const;
+
+        void EnableDistanceField(double cell_size, int cells_per_side, double max_distance);
+        void UpdateDistanceField(const double center[3]);
+        bool DistanceFieldLookup(const double point[3], double *distance) const;
+
+        void Clearances(const double *xyz, int num_points, double *distances, double max_distance = -1) const;
+
+        void SetMaxVoxels(int max_voxels);
+
+        bool SetInsertRegion(const double low[3], const double high[3]);
+        void SetAltitudeBand(double min_altitude, double max_altitude);
+
+        // points not added because they were outside the insert region or
+        // altitude band
+        int64_t GetNumCulledPoints() const { return num_culled_points_; }
+
+        // maps with up to this many voxels answer nearest neighbor
+        // searches by scanning every point instead of by block.  Starts
+        // out at what was fastest on this machine.
+        void SetBruteForceMaxVoxels(int max_voxels) { brute_force_max_voxels_ = max_voxels; }
+        int GetBruteForceMaxVoxels() const { return brute_force_max_voxels_; }
+
+        int GetNumVoxels() const { return voxels_.size(); }
+
+        // voxels thrown out early because the map was full
+        int64_t GetNumEvictedVoxels() const { return num_evicted_voxels_; }
+
+        // points looked up by the queries so far (for benchmarks)
+        int64_t GetNumQueries() const { return num_queries_.load(); }
+
+        StereoOctomapVersion GetVersion() const;
+        bool GetChangesSince(const StereoOctomapVersion &version, std::vector<double> *xyz) const;
+        double GetChangeMargin() const;
+
+        // the voxels and when each was seen, to pick up where a process
+        // that restarted left off
+        bool WriteSnapshot(const std::string &filename) const;
+        bool ReadSnapshot(const std::string &filename, int64_t now);
+
+        // timestamp of the newest message added (-1 for none)
+        int64_t GetLastMessageTime() const { return last_msg_time_; }
 
 
     private:
 
-        void InsertPointsIntoOctree(const lcmt::stereo *msg, BotTrans *to_open_cv);
+        void InsertPointsIntoOctree(const lcmt::stereo *msg, BotTrans *to_open_cv, const uint8_t *keep);
+        void CullPoints(const double *local_x, const double *local_y, const double *local_z, int num_points, const BotTrans *to_open_cv, const uint8_t *keep, uint8_t *insert_keep);
         void RemoveOldPoints(int64_t last_msg_time);
+        void EvictOldestVoxels();
+        void Clear();
+
+        void InsertPoint(const double xyz[3], const int64_t voxel_coords[3], int64_t timestamp, OctomapKeyList *bucket_voxels);
+        void RemoveVoxel(int64_t voxel_key);
+        void RecordChange(const int64_t voxel_coords[3]);
+
+        static int64_t GetCellKey(const int64_t coords[3]);
+        static void GetCellCoords(int64_t key, int64_t coords[3]);
+
+        static void GetCoarseCell(const int64_t block_coords[3], int coarse[3]);
+        void UpdateCoarseCell(const int64_t block_coords[3], int change);
+        bool CoarseOccupied(const int64_t block_coords[3]) const;
+        bool CoarseEmpty(const int64_t low[3], const int64_t high[3]) const;
+
+        void AddHudVoxel(int64_t voxel_key, OctomapHudVoxels *hud_voxels) const;
+
+        const double* FindNearest(const double point[3], double *best_sqr_dist, bool close_bound = false) const;
+        const double* FindNearestBruteForce(const double point[3], double *best_sqr_dist) const;
+        static int CalibrateBruteForce(BotFrames *bot_frames);
+        bool AnyInBlock(const OctomapBlock &block, const double point[3], double sqr_radius) const;
+        void PointsInBlock(const OctomapBlock &block, const double point[3], double sqr_radius, std::vector<double> *xyz) const;
+        void SearchBlock(const OctomapBlock &block, const double point[3], double *best_sqr_dist, const double **nearest) const;
+
+        void ComputeDistanceField();
+        static void DistanceTransform(const float *f, int n, float *d, int *v, float *z);
 
         OpenCvStereoCalibration stereo_calibration_;
         OpenCvStereoConfig stereo_config_;
         bool stereo_calibration_set_;
 
-        pcl::octree::OctreePointCloudSearch<pcl::PointXYZ> *current_octree_;
-        pcl::octree::OctreePointCloudSearch<pcl::PointXYZ> *building_octree_;
+        // voxels by their voxel's key
+        OctomapMap<OctomapVoxel> voxels_;
 
-        int64_t current_octree_timestamp_, building_octree_timestamp_;
+        OctomapMap<OctomapBlock> blocks_;
 
-        BotFrames *bot_frames_;
+        // every voxel's point again, in one list per axis for scanning, and
+        // the voxel (which doesn't move in voxels_) for each
+        OctomapPointList flat_x_;
+        OctomapPointList flat_y_;
+        OctomapPointList flat_z_;
+        AccountedVector<OctomapVoxel*, MEMORY_OCTOMAP> flat_voxels_;
+
+        int brute_force_max_voxels_;
+
+        // number of blocks in each coarse cell, and a bit for each one that
+        // has any.  Cell (x, y, z) is at index (x * cells + y) * cells + z
+        // of coarse_blocks_ and bit z of coarse_bits_[x * cells + y].
+        std::vector<int> coarse_blocks_;
+        std::vector<uint32_t> coarse_bits_;
+
+        // keys of the voxels seen in each of the last OCTREE_LIFE's buckets,
+        // by bucket number (timestamp / bucket length).  A voxel seen again
+        // later is in a newer bucket too and stays.
+        OctomapMap<OctomapKeyList> expiry_buckets_;
+
+        int64_t last_msg_time_;
+
+        // most voxels to keep (0 for no limit) and how many didn't fit
+        int max_voxels_;
+        int64_t num_evicted_voxels_;
+
+        // queries can come from several threads at once
+        mutable std::atomic<int64_t> num_queries_;
+
+        // the centers of the last OCTOMAP_CHANGE_LOG_SIZE voxels added,
+        // moved or removed (x, y, z each), in a ring: change n is at n %
+        // OCTOMAP_CHANGE_LOG_SIZE.  See GetVersion().
+        OctomapPointList change_log_;
+        int64_t num_changes_;
+        int64_t epoch_;
 
-        pcl::PointCloud<pcl::PointXYZ>::Ptr current_cloud_;
-        pcl::PointCloud<pcl::PointXYZ>::Ptr building_cloud_;
+        // num_changes_ when the distance field was last computed
+        int64_t distance_field_changes_;
 
+        // the points of the message being inserted, in the local frame
+        // (all the x's, then y's, then z's), their voxels, and which are
+        // added once they're culled
+        std::vector<double> insert_xyz_;
+        std::vector<int64_t> insert_voxels_;
+        std::vector<uint8_t> insert_keep_;
 
+        // points are only added inside this box (SetInsertRegion()), in
+        // the frame that follows the body's position and yaw, and between
+        // these local altitudes (SetAltitudeBand())
+        bool use_insert_region_;
+        double insert_low_[3];
+        double insert_high_[3];
+        BotTrans body_to_camera_;
 
+        bool use_altitude_band_;
+        double min_altitude_;
+        double max_altitude_;
 
+        int64_t num_culled_points_;
 
+        // distance field (EnableDistanceField()) on a grid that follows
+        // the aircraft.  Cell (x, y, z) is at index (x * cells + y) * cells
+        // + z and its center is at origin + (index + 0.5) * cell size.
+        double distance_field_cell_size_;
+        int distance_field_cells_;
+        double distance_field_max_distance_;
+
+        // cells this close to the edge of the grid might have obstacles
+        // just outside closer than what they hold, so aren't looked up
+        int distance_field_margin_;
+
+        double distance_field_origin_[3];
+        bool distance_field_valid_;
+        bool map_changed_;
+
+        AccountedVector<float, MEMORY_OCTOMAP> distance_field_;
+
+        // voxels added (true) or removed (false) since the last
+        // PublishToHud(), kept once it has been called
+        std::unordered_map<int64_t, bool> hud_changes_;
+        bool hud_tracking_;
+
+        // send everything next time, because the HUD doesn't have it
+        bool hud_reset_;
+        int hud_publishes_since_reset_;
+
+        // voxel the HUD's 16-bit voxel coordinates are relative to
+        int64_t hud_origin_[3];
+
+        // what's being published
+        OctomapHudVoxels hud_added_;
+        OctomapHudVoxels hud_removed_;
+
+        BotFrames *bot_frames_;
+        TransformCache *transforms_;
 };
 
 #endif
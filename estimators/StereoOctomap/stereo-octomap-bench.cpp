@@ -0,0 +1,300 @@
+/**
+ * Benchmark for the obstacle map on a recorded flight.
+ *
+ * Example:
+ *   ./stereo-octomap-bench -c ../../config/plane.cfg -l lcmlog-2015-03-10.00
+ *       -i 1.0 -o map.csv
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#include "stereo-octomap-bench.hpp"
+
+int main(int argc, char *argv[]) {
+
+    string config_file = "";
+    string log_file = "";
+    string stereo_channel = "stereo";
+    string trajectory_dir = "";
+    string output_file = "";
+    double interval = 1.0;
+    int max_messages = 0;
+
+    ConciseArgs parser(argc, argv);
+    parser.add(config_file, "c", "config", "Configuration file (like config/plane.cfg) with the frames and obstacle_avoidance settings.", true);
+    parser.add(log_file, "l", "log", "LCM log to replay.", true);
+    parser.add(stereo_channel, "e", "stereo-channel", "LCM channel of the stereo messages in the log.");
+    parser.add(trajectory_dir, "t", "trajectory-dir", "Trajectory library to search with (defaults to the config file's).");
+    parser.add(interval, "i", "interval", "Seconds of log time in each line of output.");
+    parser.add(max_messages, "m", "max-messages", "Stop after this many stereo messages (0 for the whole log).");
+    parser.add(output_file, "o", "output", "Write the CSV results to this file instead of stdout.");
+    parser.parse();
+
+    BotParam *param = bot_param_new_from_file(config_file.c_str());
+
+    if (param == NULL) {
+        fprintf(stderr, "Failed to parse configuration file, quitting.\n");
+        return 1;
+    }
+
+    // the log's messages are published here, so BotFrames keeps up with the
+    // pose like it does in flight
+    lcm_t *lcm = lcm_create("memq://");
+
+    if (lcm == NULL) {
+        fprintf(stderr, "Error: LCM creation failed.\n");
+        return 1;
+    }
+
+    BotFrames *bot_frames = bot_frames_new(lcm, param);
+
+    if (trajectory_dir.length() == 0) {
+        trajectory_dir = ReplaceUserVarInPath(bot_param_get_str_or_fail(param, "tvlqr_controller.library_dir"));
+    }
+
+    double safe_distance = bot_param_get_double_or_fail(param, "obstacle_avoidance.safe_distance_threshold");
+    double ground_safety_distance = bot_param_get_double_or_fail(param, "tvlqr_controller.ground_safety_distance");
+
+    TrajectoryLibrary trajlib(ground_safety_distance);
+
+    if (trajlib.LoadLibrary(trajectory_dir, true) == false) {
+        fprintf(stderr, "Error: failed to load the trajectory library from %s.\n", trajectory_dir.c_str());
+        return 1;
+    }
+
+    StereoOctomap octomap(bot_frames);
+    SetupOctomap(param, &octomap);
+
+    lcm_eventlog_t *log = lcm_eventlog_create(log_file.c_str(), "r");
+
+    if (log == NULL) {
+        fprintf(stderr, "Error: failed to open log %s.\n", log_file.c_str());
+        return 1;
+    }
+
+    FILE *out = stdout;
+
+    if (output_file.length() > 0) {
+        out = fopen(output_file.c_str(), "w");
+
+        if (out == NULL) {
+            fprintf(stderr, "Error: failed to open %s for writing.\n", output_file.c_str());
+            return 1;
+        }
+    }
+
+    fprintf(out, "log_time,messages,points,points_per_sec,insert_p50_ms,insert_p99_ms,search_p50_ms,search_p99_ms,search_max_ms,voxels,rss_mb\n");
+
+    OctomapBenchSample sample;
+    sample.messages = 0;
+    sample.points = 0;
+
+    // over the whole log
+    vector<float> all_insert_ms, all_search_ms;
+    int total_messages = 0;
+    int64_t total_points = 0;
+
+    int64_t first_utime = -1;
+    int64_t sample_start_utime = -1;
+
+    lcm_eventlog_event_t *event;
+
+    while ((event = lcm_eventlog_read_next_event(log)) != NULL) {
+
+        if (first_utime < 0) {
+            first_utime = event->timestamp;
+            sample_start_utime = event->timestamp;
+        }
+
+        if (stereo_channel != event->channel) {
+            lcm_publish(lcm, event->channel, event->data, event->datalen);
+
+            while (NonBlockingLcm(lcm)) {}
+
+            lcm_eventlog_free_event(event);
+            continue;
+        }
+
+        lcmt::stereo msg;
+
+        if (msg.decode(event->data, 0, event->datalen) < 0) {
+            fprintf(stderr, "Warning: failed to decode a stereo message, skipping it.\n");
+
+            lcm_eventlog_free_event(event);
+            continue;
+        }
+
+        int64_t start = GetRawMonotonicNow();
+        octomap.ProcessStereoMessage(&msg);
+        int64_t inserted = GetRawMonotonicNow();
+
+        // the same search as StateMachineControl::SetBestTrajectory()
+        BotTrans body_to_local;
+        bot_frames_get_trans(bot_frames, "body", "local", &body_to_local);
+
+        octomap.UpdateDistanceField(body_to_local.trans_vec);
+        trajlib.FindFarthestTrajectory(octomap, body_to_local, safe_distance);
+
+        int64_t searched = GetRawMonotonicNow();
+
+        sample.insert_ms.push_back(ElapsedMs(start, inserted));
+        sample.search_ms.push_back(ElapsedMs(inserted, searched));
+        sample.messages ++;
+        sample.points += msg.number_of_points;
+
+        if (event->timestamp - sample_start_utime >= interval * 1000000.0) {
+            sample.log_time = (event->timestamp - first_utime) / 1000000.0;
+            sample.voxels = octomap.GetNumVoxels();
+            sample.rss_mb = GetRssMb();
+
+            all_insert_ms.insert(all_insert_ms.end(), sample.insert_ms.begin(), sample.insert_ms.end());
+            all_search_ms.insert(all_search_ms.end(), sample.search_ms.begin(), sample.search_ms.end());
+
+            WriteSample(out, &sample);
+
+            sample.messages = 0;
+            sample.points = 0;
+            sample.insert_ms.clear();
+            sample.search_ms.clear();
+
+            sample_start_utime = event->timestamp;
+        }
+
+        total_messages ++;
+        total_points += msg.number_of_points;
+
+        lcm_eventlog_free_event(event);
+
+        if (max_messages > 0 && total_messages >= max_messages) {
+            break;
+        }
+    }
+
+    all_insert_ms.insert(all_insert_ms.end(), sample.insert_ms.begin(), sample.insert_ms.end());
+    all_search_ms.insert(all_search_ms.end(), sample.search_ms.begin(), sample.search_ms.end());
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    lcm_eventlog_destroy(log);
+
+    if (total_messages < 1) {
+        fprintf(stderr, "Error: no messages on %s in %s.\n", stereo_channel.c_str(), log_file.c_str());
+        return 1;
+    }
+
+    float insert_total_ms = 0;
+
+    for (unsigned int i = 0; i < all_insert_ms.size(); i++) {
+        insert_total_ms += all_insert_ms[i];
+    }
+
+    fprintf(stderr, "%d messages, %lld points, %.0f points/sec inserted\n", total_messages,
+        (long long)total_points, total_points / (insert_total_ms / 1000.0f));
+
+    fprintf(stderr, "insert: p50 %.3f ms, p99 %.3f ms\n", Percentile(&all_insert_ms, 50), Percentile(&all_insert_ms, 99));
+    fprintf(stderr, "search: p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", Percentile(&all_search_ms, 50),
+        Percentile(&all_search_ms, 99), Percentile(&all_search_ms, 100));
+
+    return 0;
+}
+
+/**
+ * Sets up the map from the obstacle_avoidance settings the same way
+ * StateMachineControl does (without the map thread, which would only add
+ * waiting to the insert times).
+ *
+ * @param param parsed configuration file
+ * @param octomap map to set up
+ */
+void SetupOctomap(BotParam *param, StereoOctomap *octomap) {
+
+    double field_cell_size, field_max_distance;
+    int field_cells;
+
+    if (bot_param_get_double(param, "obstacle_avoidance.distance_field_cell_size", &field_cell_size) == 0
+        && bot_param_get_int(param, "obstacle_avoidance.distance_field_cells", &field_cells) == 0
+        && bot_param_get_double(param, "obstacle_avoidance.distance_field_max_distance", &field_max_distance) == 0) {
+
+        fprintf(stderr, "distance field: %d cells of %.2f m\n", field_cells, field_cell_size);
+        octomap->EnableDistanceField(field_cell_size, field_cells, field_max_distance);
+    }
+
+    int max_voxels;
+
+    if (bot_param_get_int(param, "obstacle_avoidance.map_max_voxels", &max_voxels) == 0) {
+        fprintf(stderr, "at most %d voxels\n", max_voxels);
+        octomap->SetMaxVoxels(max_voxels);
+    }
+
+    fprintf(stderr, "scanning every point for searches in maps of up to %d voxels\n", octomap->GetBruteForceMaxVoxels());
+}
+
+float ElapsedMs(int64_t start_usec, int64_t end_usec) {
+    return (end_usec - start_usec) / 1000.0f;
+}
+
+/**
+ * @param values times to take the percentile of (gets sorted)
+ * @param percent 0 to 100
+ *
+ * @retval the percentile, or 0 if there are no values
+ */
+float Percentile(vector<float> *values, int percent) {
+    if (values->size() == 0) {
+        return 0;
+    }
+
+    sort(values->begin(), values->end());
+
+    return (*values)[min(values->size() - 1, (values->size() * percent) / 100)];
+}
+
+/**
+ * @retval how much memory the process is using right now, in MB
+ */
+double GetRssMb() {
+    FILE *statm = fopen("/proc/self/statm", "r");
+
+    if (statm == NULL) {
+        return -1;
+    }
+
+    long size, resident;
+
+    if (fscanf(statm, "%ld %ld", &size, &resident) != 2) {
+        resident = -1;
+    }
+
+    fclose(statm);
+
+    if (resident < 0) {
+        return -1;
+    }
+
+    return resident * (double)sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+/**
+ * Writes one interval as a line of CSV.
+ *
+ * @param out file to write to
+ * @param sample the interval (its times get sorted)
+ */
+void WriteSample(FILE *out, OctomapBenchSample *sample) {
+
+    float insert_total_ms = 0;
+
+    for (unsigned int i = 0; i < sample->insert_ms.size(); i++) {
+        insert_total_ms += sample->insert_ms[i];
+    }
+
+    double points_per_sec = insert_total_ms > 0 ? sample->points / (insert_total_ms / 1000.0) : 0;
+
+    fprintf(out, "%.2f,%d,%d,%.0f,%.3f,%.3f,%.3f,%.3f,%.3f,%d,%.1f\n", sample->log_time, sample->messages,
+        sample->points, points_per_sec, Percentile(&sample->insert_ms, 50), Percentile(&sample->insert_ms, 99),
+        Percentile(&sample->search_ms, 50), Percentile(&sample->search_ms, 99), Percentile(&sample->search_ms, 100),
+        sample->voxels, sample->rss_mb);
+}
@@ -0,0 +1,64 @@
+/**
+ * Benchmark for the obstacle map.  Replays an LCM log: the stereo messages
+ * go through StereoOctomap::ProcessStereoMessage() and after each one the
+ * trajectory library searches the map the way the state machine does.
+ * Everything else in the log (the pose, mostly) is handed to BotFrames, so
+ * the transforms are the ones from the flight.
+ *
+ * Prints insertion throughput, insert and search p50 / p99 times and the
+ * map's size every interval of log time as CSV.  The map settings come from
+ * the config file's obstacle_avoidance block, so different settings (or
+ * builds) can be compared on the same log.
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#ifndef STEREO_OCTOMAP_BENCH_HPP
+#define STEREO_OCTOMAP_BENCH_HPP
+
+#include <unistd.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <lcm/lcm.h>
+#include <lcm/eventlog.h>
+
+#include "../../externals/ConciseArgs.hpp"
+#include "../../utils/utils/RealtimeUtils.hpp"
+#include "../../controllers/TrajectoryLibrary/TrajectoryLibrary.hpp"
+
+#include "StereoOctomap.hpp"
+
+using namespace std;
+
+// timing and size of the map over one interval of the log
+struct OctomapBenchSample {
+    double log_time;
+
+    int messages;
+    int points;
+
+    vector<float> insert_ms;
+    vector<float> search_ms;
+
+    int voxels;
+    double rss_mb;
+};
+
+void SetupOctomap(BotParam *param, StereoOctomap *octomap);
+
+float ElapsedMs(int64_t start_usec, int64_t end_usec);
+
+float Percentile(vector<float> *values, int percent);
+
+double GetRssMb();
+
+void WriteSample(FILE *out, OctomapBenchSample *sample);
+
+#endif
@@ -0,0 +1,5 @@
+TARGET = stereo-octomap-bench
+SOURCES = stereo-octomap-bench.cpp StereoOctomap.cpp ../../controllers/TrajectoryLibrary/TrajectoryLibrary.cpp ../../controllers/TrajectoryLibrary/Trajectory.cpp ../../utils/CsvReader/CsvReader.cpp ../../utils/utils/RealtimeUtils.cpp ../../utils/ThreadPool/ThreadPool.cpp
+
+# include a standard makefile that uses these variables and builds everything
+include ../../utils/make/flight.mk
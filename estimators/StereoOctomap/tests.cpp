@@ -1,14 +1,34 @@
 #include "StereoOctomap.hpp"
+#include "ConcurrentStereoOctomap.hpp"
 #include "gtest/gtest.h"
 #include "../../LCM/lcmt_stereo.h"
 #include "../../utils/utils/RealtimeUtils.hpp"
 #include "../../LCM/mav_pose_t.h"
+#include "../../LCM/lcmt_octomap_delta.h"
 #include <ctime>
 #include <stack>
+#include <thread>
 
 #define TOLERANCE 0.0001
 
 
+// what the last octomap-hud message had
+struct HudDeltaCounts {
+    int messages = 0;
+    bool reset = false;
+    int number_added = 0;
+    int number_removed = 0;
+};
+
+static void hud_delta_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_octomap_delta *msg, void *user) {
+    HudDeltaCounts *counts = (HudDeltaCounts*)user;
+
+    counts->messages ++;
+    counts->reset = msg->reset;
+    counts->number_added = msg->number_added;
+    counts->number_removed = msg->number_removed;
+}
+
 class StereoOctomapTest : public testing::Test {
 
     protected:
@@ -77,6 +97,17 @@ class StereoOctomapTest : public testing::Test {
             bot_trans_apply_vec(&camera_to_global_trans_, point_in, point_out);
         }
 
+        // process LCM messages until one more hud message arrives (or give
+        // up after about a second)
+        void WaitForHudDelta(HudDeltaCounts *counts) {
+            int messages = counts->messages;
+
+            for (int i = 0; i < 100 && counts->messages == messages; i++) {
+                while (NonBlockingLcm(lcm_)) {}
+                usleep(10000);
+            }
+        }
+
         std::stack<double> tictoc_wall_stack;
 
         void tic() {
@@ -298,6 +329,1035 @@ TEST_F(StereoOctomapTest, CheckAgainstLinearSearch) {
 }
 
 
+TEST_F(StereoOctomapTest, BruteForceMatchesBlocks) {
+
+    StereoOctomap *stereo_octomap = new StereoOctomap(bot_frames_);
+
+    // calibrated for this machine, but never past where it was timed
+    EXPECT_GE(stereo_octomap->GetBruteForceMaxVoxels(), 0);
+    EXPECT_LE(stereo_octomap->GetBruteForceMaxVoxels(), OCTOMAP_BRUTE_FORCE_CALIBRATE_MAX);
+
+    std::uniform_real_distribution<double> uniform_dist(-20, 20);
+    std::default_random_engine rand_engine(7);
+
+    lcmt::stereo msg;
+
+    msg.timestamp = GetTimestampNow();
+    msg.frame_number = 0;
+    msg.video_number = 0;
+
+    // two messages a bucket apart, so the first can be evicted
+    for (int i = 0; i < 400; i++) {
+        if (i == 200) {
+            msg.number_of_points = msg.x.size();
+            stereo_octomap->ProcessStereoMessage(&msg);
+
+            msg.x.clear();
+            msg.y.clear();
+            msg.z.clear();
+
+            msg.timestamp += OCTREE_LIFE / OCTOMAP_EXPIRY_BUCKETS;
+        }
+
+        double point[3] = { uniform_dist(rand_engine), uniform_dist(rand_engine), uniform_dist(rand_engine) };
+        double trans_point[3];
+
+        GlobalToCameraFrame(point, trans_point);
+
+        msg.x.push_back(trans_point[0]);
+        msg.y.push_back(trans_point[1]);
+        msg.z.push_back(trans_point[2]);
+    }
+
+    msg.number_of_points = msg.x.size();
+    stereo_octomap->ProcessStereoMessage(&msg);
+
+    // once with every voxel, and once after removing some
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            stereo_octomap->SetMaxVoxels(250);
+            ASSERT_GT(stereo_octomap->GetNumEvictedVoxels(), 0);
+        }
+
+        for (int i = 0; i < 200; i++) {
+            double search_point[3] = { uniform_dist(rand_engine), uniform_dist(rand_engine), uniform_dist(rand_engine) };
+
+            stereo_octomap->SetBruteForceMaxVoxels(0);
+            double block_dist = stereo_octomap->NearestNeighbor(search_point);
+            double block_clamped = stereo_octomap->MinDistanceClamped(search_point, 1.0);
+
+            stereo_octomap->SetBruteForceMaxVoxels(OCTOMAP_BRUTE_FORCE_CALIBRATE_MAX);
+            double brute_dist = stereo_octomap->NearestNeighbor(search_point);
+            double brute_clamped = stereo_octomap->MinDistanceClamped(search_point, 1.0);
+
+            EXPECT_NEAR(brute_dist, block_dist, TOLERANCE);
+            EXPECT_NEAR(brute_clamped, block_clamped, TOLERANCE);
+        }
+    }
+
+    delete stereo_octomap;
+
+}
+
+TEST_F(StereoOctomapTest, BatchNearestNeighbors) {
+
+    int num_points = 10000;
+
+    vector<float> x;
+    vector<float> y;
+    vector<float> z;
+
+    StereoOctomap *stereo_octomap = new StereoOctomap(bot_frames_);
+
+    // check that an empty map finds nothing
+    double empty_query[6] = { 0, 0, 0, 1, 1, 1 };
+    double empty_dists[2];
+
+    stereo_octomap->NearestNeighbors(empty_query, 2, empty_dists);
+
+    EXPECT_EQ_ARM(empty_dists[0], -1);
+    EXPECT_EQ_ARM(empty_dists[1], -1);
+
+    // create a random point cloud
+
+    std::uniform_real_distribution<double> uniform_dist(-100, 100);
+    std::random_device rd;
+    std::default_random_engine rand_engine(rd());
+
+    for (int i = 0; i < num_points; i++) {
+
+        double this_point[3];
+
+        this_point[0] = uniform_dist(rand_engine);
+        this_point[1] = uniform_dist(rand_engine);
+        this_point[2] = uniform_dist(rand_engine);
+
+        double translated_point[3];
+
+        GlobalToCameraFrame(this_point, translated_point);
+
+        x.push_back(translated_point[0]);
+        y.push_back(translated_point[1]);
+        z.push_back(translated_point[2]);
+    }
+
+    lcmt::stereo msg;
+
+    msg.timestamp = GetTimestampNow();
+
+    msg.x = x;
+    msg.y = y;
+    msg.z = z;
+
+    msg.number_of_points = num_points;
+
+    msg.frame_number = 0;
+    msg.video_number = 0;
+
+    stereo_octomap->ProcessStereoMessage(&msg);
+
+    // a path through the points, like a trajectory
+    int num_searches = 1000;
+
+    vector<double> search_points(3 * num_searches);
+    vector<double> dists(num_searches), bounded_dists(num_searches);
+
+    for (int i = 0; i < num_searches; i++) {
+        search_points[3 * i] = -50 + 0.1 * i;
+        search_points[3 * i + 1] = 20 - 0.05 * i;
+        search_points[3 * i + 2] = 0.01 * i;
+    }
+
+    double max_distance = 2;
+
+    stereo_octomap->NearestNeighbors(search_points.data(), num_searches, dists.data());
+    stereo_octomap->NearestNeighbors(search_points.data(), num_searches, bounded_dists.data(), max_distance);
+
+    for (int i = 0; i < num_searches; i++) {
+        double dist = stereo_octomap->NearestNeighbor(&search_points[3 * i]);
+
+        EXPECT_NEAR(dists[i], dist, TOLERANCE);
+
+        if (dist < max_distance) {
+            EXPECT_NEAR(bounded_dists[i], dist, TOLERANCE);
+        } else {
+            EXPECT_EQ_ARM(bounded_dists[i], -1);
+        }
+    }
+
+    delete stereo_octomap;
+
+}
+
+TEST_F(StereoOctomapTest, BoundedQueries) {
+
+    StereoOctomap *stereo_octomap = new StereoOctomap(bot_frames_);
+
+    double origin[3] = { 0, 0, 0 };
+
+    EXPECT_FALSE(stereo_octomap->AnyWithin(origin, 10));
+    EXPECT_EQ_ARM(stereo_octomap->MinDistanceClamped(origin, 10), 10);
+
+    int num_points = 10000;
+
+    vector<float> x, y, z;
+
+    std::uniform_real_distribution<double> uniform_dist(-100, 100);
+    std::random_device rd;
+    std::default_random_engine rand_engine(rd());
+
+    for (int i = 0; i < num_points; i++) {
+
+        double this_point[3];
+
+        this_point[0] = uniform_dist(rand_engine);
+        this_point[1] = uniform_dist(rand_engine);
+        this_point[2] = uniform_dist(rand_engine);
+
+        double translated_point[3];
+
+        GlobalToCameraFrame(this_point, translated_point);
+
+        x.push_back(translated_point[0]);
+        y.push_back(translated_point[1]);
+        z.push_back(translated_point[2]);
+    }
+
+    lcmt::stereo msg;
+
+    msg.timestamp = GetTimestampNow();
+
+    msg.x = x;
+    msg.y = y;
+    msg.z = z;
+
+    msg.number_of_points = num_points;
+
+    msg.frame_number = 0;
+    msg.video_number = 0;
+
+    stereo_octomap->ProcessStereoMessage(&msg);
+
+    int num_searches = 1000;
+
+    for (int i = 0; i < num_searches; i++) {
+
+        double search_point[3];
+
+        search_point[0] = uniform_dist(rand_engine);
+        search_point[1] = uniform_dist(rand_engine);
+        search_point[2] = uniform_dist(rand_engine);
+
+        // from well inside the typical spacing to well past it
+        double radius = 0.5 + (i % 10);
+
+        double dist = stereo_octomap->NearestNeighbor(search_point);
+
+        EXPECT_EQ(stereo_octomap->AnyWithin(search_point, radius), dist <= radius);
+        EXPECT_NEAR(stereo_octomap->MinDistanceClamped(search_point, radius), std::min(dist, radius), TOLERANCE);
+
+        vector<double> within;
+        stereo_octomap->PointsWithin(search_point, radius, &within);
+
+        EXPECT_EQ(within.size() > 0, dist <= radius);
+
+        for (unsigned int j = 0; j < within.size(); j += 3) {
+            double sqr_dist = (within[j] - search_point[0]) * (within[j] - search_point[0])
+                + (within[j + 1] - search_point[1]) * (within[j + 1] - search_point[1])
+                + (within[j + 2] - search_point[2]) * (within[j + 2] - search_point[2]);
+
+            EXPECT_TRUE(sqr_dist <= radius * radius);
+        }
+    }
+
+    delete stereo_octomap;
+
+}
+
+TEST_F(StereoOctomapTest, CoarseGridSkipsEmptyAreas) {
+
+    StereoOctomap *stereo_octomap = new StereoOctomap(bot_frames_);
+
+    // the second point is a whole coarse grid away from the first, so they
+    // share a coarse cell
+    double grid_size = OCTOMAP_VOXEL_SIZE * OCTOMAP_VOXELS_PER_BLOCK * OCTOMAP_BLOCKS_PER_COARSE_CELL * OCTOMAP_COARSE_CELLS;
+
+    double points[3][3] = { { 10, 0, 0 }, { 10 + grid_size, 0, 0 }, { -10, -10, -10 } };
+
+    lcmt::stereo msg;
+
+    msg.timestamp = GetTimestampNow();
+    msg.frame_number = 0;
+    msg.video_number = 0;
+
+    for (int i = 0; i < 3; i++) {
+        double trans_point[3];
+
+        GlobalToCameraFrame(points[i], trans_point);
+
+        msg.x.push_back(trans_point[0]);
+        msg.y.push_back(trans_point[1]);
+        msg.z.push_back(trans_point[2]);
+    }
+
+    msg.number_of_points = msg.x.size();
+    stereo_octomap->ProcessStereoMessage(&msg);
+
+    double origin[3] = { 0, 0, 0 };
+    double empty_area[3] = { 300, 0, 0 };
+    double beside_alias[3] = { grid_size, 0, 0 };
+    double near_negative[3] = { -12, -10, -10 };
+
+    EXPECT_FALSE(stereo_octomap->AnyWithin(empty_area, 5));
+    EXPECT_EQ_ARM(stereo_octomap->MinDistanceClamped(empty_area, 20), 20);
+    EXPECT_TRUE(stereo_octomap->AnyWithin(origin, 10.5));
+    EXPECT_TRUE(stereo_octomap->AnyWithin(near_negative, 3));
+    EXPECT_NEAR(stereo_octomap->NearestNeighbor(beside_alias), 10, TOLERANCE);
+    EXPECT_NEAR(stereo_octomap->NearestNeighbor(points[1]), 0, TOLERANCE);
+
+    // once the far point ages out, its coarse cell still has the first one
+    msg.timestamp += OCTREE_LIFE + OCTREE_LIFE / OCTOMAP_EXPIRY_BUCKETS;
+
+    msg.x.erase(msg.x.begin() + 1);
+    msg.y.erase(msg.y.begin() + 1);
+    msg.z.erase(msg.z.begin() + 1);
+
+    msg.number_of_points = msg.x.size();
+    stereo_octomap->ProcessStereoMessage(&msg);
+
+    EXPECT_FALSE(stereo_octomap->AnyWithin(points[1], 5));
+    EXPECT_TRUE(stereo_octomap->AnyWithin(points[0], 1));
+    EXPECT_NEAR(stereo_octomap->NearestNeighbor(beside_alias), grid_size - 10, TOLERANCE);
+
+    delete stereo_octomap;
+
+}
+
+TEST_F(StereoOctomapTest, DistanceField) {
+
+    StereoOctomap *stereo_octomap = new StereoOctomap(bot_frames_);
+
+    double cell_size = 0.5;
+    double max_distance = 6;
+
+    double center[3] = { 0, 0, 0 };
+
+    // not there until it's enabled
+    double dist;
+    EXPECT_FALSE(stereo_octomap->DistanceFieldLookup(center, &dist));
+
+    stereo_octomap->EnableDistanceField(cell_size, 64, max_distance);
+
+    int num_points = 2000;
+
+    vector<float> x, y, z;
+
+    std::uniform_real_distribution<double> uniform_dist(-20, 20);
+    std::random_device rd;
+    std::default_random_engine rand_engine(rd());
+
+    for (int i = 0; i < num_points; i++) {
+
+        double this_point[3];
+
+        this_point[0] = uniform_dist(rand_engine);
+        this_point[1] = uniform_dist(rand_engine);
+        this_point[2] = uniform_dist(rand_engine);
+
+        double translated_point[3];
+
+        GlobalToCameraFrame(this_point, translated_point);
+
+        x.push_back(translated_point[0]);
+        y.push_back(translated_point[1]);
+        z.push_back(translated_point[2]);
+    }
+
+    lcmt::stereo msg;
+
+    msg.timestamp = GetTimestampNow();
+
+    msg.x = x;
+    msg.y = y;
+    msg.z = z;
+
+    msg.number_of_points = num_points;
+
+    msg.frame_number = 0;
+    msg.video_number = 0;
+
+    stereo_octomap->ProcessStereoMessage(&msg);
+
+    stereo_octomap->UpdateDistanceField(center);
+
+    int num_searches = 1000;
+
+    for (int i = 0; i < num_searches; i++) {
+
+        double search_point[3];
+
+        search_point[0] = uniform_dist(rand_engine) / 2;
+        search_point[1] = uniform_dist(rand_engine) / 2;
+        search_point[2] = uniform_dist(rand_engine) / 2;
+
+        double clamped_dist = stereo_octomap->MinDistanceClamped(search_point, max_distance);
+
+        if (stereo_octomap->DistanceFieldLookup(search_point, &dist)) {
+            // never further than the obstacle, and within a cell's diagonal
+            // (for where the points are in their cells) and another (for
+            // the interpolation)
+            EXPECT_LE(dist, clamped_dist + TOLERANCE);
+            EXPECT_GE(dist, clamped_dist - 2 * sqrt(3) * cell_size - TOLERANCE);
+        } else {
+            // the field is only looked up at least max_distance inside
+            // the grid (64 cells around the center)
+            double inside = (32 - max_distance / cell_size - 0.5) * cell_size;
+
+            double max_coord = std::max(fabs(search_point[0]), std::max(fabs(search_point[1]), fabs(search_point[2])));
+
+            EXPECT_GE(max_coord, inside - TOLERANCE);
+        }
+    }
+
+    // far outside the field
+    double far_point[3] = { 500, 0, 0 };
+    EXPECT_FALSE(stereo_octomap->DistanceFieldLookup(far_point, &dist));
+
+    delete stereo_octomap;
+
+}
+
+TEST_F(StereoOctomapTest, SameVoxelKeepsNewest) {
+
+    StereoOctomap *stereo_octomap = new StereoOctomap(bot_frames_);
+
+    // three hits in one voxel and one in the next, in one message
+    double points[4][3] = { { 1.01, 0, 0 }, { 1.05, 0.02, 0.01 }, { 1.1, 0.01, 0 }, { 1.3, 0, 0 } };
+
+    lcmt::stereo msg;
+
+    msg.timestamp = GetTimestampNow();
+
+    for (int i = 0; i < 4; i++) {
+        double trans_point[3];
+
+        GlobalToCameraFrame(points[i], trans_point);
+
+        msg.x.push_back(trans_point[0]);
+        msg.y.push_back(trans_point[1]);
+        msg.z.push_back(trans_point[2]);
+    }
+
+    msg.number_of_points = 4;
+    msg.frame_number = 0;
+    msg.video_number = 0;
+
+    stereo_octomap->ProcessStereoMessage(&msg);
+
+    double origin[3] = { 0, 0, 0 };
+
+    // the last hit in the voxel is the one kept
+    EXPECT_NEAR(stereo_octomap->NearestNeighbor(origin), sqrt(1.1*1.1 + 0.01*0.01), TOLERANCE);
+
+    delete stereo_octomap;
+
+}
+
+/**
+ * Only the points the mask keeps are added, even when the next point in
+ * the same voxel is dropped.
+ */
+TEST_F(StereoOctomapTest, KeepMask) {
+
+    StereoOctomap *stereo_octomap = new StereoOctomap(bot_frames_);
+
+    // two hits in one voxel and one far away
+    double points[3][3] = { { 1.01, 0, 0 }, { 1.1, 0.01, 0 }, { 5, 0, 0 } };
+    uint8_t keep[3] = { 1, 0, 0 };
+
+    lcmt::stereo msg;
+
+    msg.timestamp = GetTimestampNow();
+
+    for (int i = 0; i < 3; i++) {
+        double trans_point[3];
+
+        GlobalToCameraFrame(points[i], trans_point);
+
+        msg.x.push_back(trans_point[0]);
+        msg.y.push_back(trans_point[1]);
+        msg.z.push_back(trans_point[2]);
+    }
+
+    msg.number_of_points = 3;
+    msg.frame_number = 0;
+    msg.video_number = 0;
+
+    stereo_octomap->ProcessStereoMessage(&msg, &camera_to_global_trans_, keep);
+
+    double origin[3] = { 0, 0, 0 };
+    double far_point[3] = { 5, 0, 0 };
+
+    EXPECT_EQ(stereo_octomap->GetNumVoxels(), 1);
+    EXPECT_NEAR(stereo_octomap->NearestNeighbor(origin), 1.01, TOLERANCE);
+    EXPECT_NEAR(stereo_octomap->NearestNeighbor(far_point), 5 - 1.01, TOLERANCE);
+
+    delete stereo_octomap;
+
+}
+
+/**
+ * Points outside the insert region (which follows the body's position and
+ * yaw) or the altitude band aren't added.
+ */
+TEST_F(StereoOctomapTest, CullsOutsideRegion) {
+
+    StereoOctomap *stereo_octomap = new StereoOctomap(bot_frames_);
+
+    BotTrans body_to_local;
+    bot_frames_get_trans(bot_frames_, "body", "local", &body_to_local);
+
+    double rpy[3];
+    bot_quat_to_roll_pitch_yaw(body_to_local.rot_quat, rpy);
+
+    // ahead, behind, off to the side and below, in the body's yawed frame
+    double body_points[4][3] = { { 10, 0, 0 }, { -10, 0, 0 }, { 10, 50, 0 }, { 10, 0, -10 } };
+
+    double low[3] = { -2, -20, -20 };
+    double high[3] = { 50, 20, 20 };
+
+    ASSERT_TRUE(stereo_octomap->SetInsertRegion(low, high));
+    stereo_octomap->SetAltitudeBand(body_to_local.trans_vec[2] - 5, body_to_local.trans_vec[2] + 100);
+
+    lcmt::stereo msg;
+
+    msg.timestamp = GetTimestampNow();
+
+    double local_points[4][3];
+
+    for (int i = 0; i < 4; i++) {
+        const double *p = body_points[i];
+
+        local_points[i][0] = cos(rpy[2]) * p[0] - sin(rpy[2]) * p[1] + body_to_local.trans_vec[0];
+        local_points[i][1] = sin(rpy[2]) * p[0] + cos(rpy[2]) * p[1] + body_to_local.trans_vec[1];
+        local_points[i][2] = p[2] + body_to_local.trans_vec[2];
+
+        double trans_point[3];
+
+        GlobalToCameraFrame(local_points[i], trans_point);
+
+        msg.x.push_back(trans_point[0]);
+        msg.y.push_back(trans_point[1]);
+        msg.z.push_back(trans_point[2]);
+    }
+
+    msg.number_of_points = 4;
+    msg.frame_number = 0;
+    msg.video_number = 0;
+
+    stereo_octomap->ProcessStereoMessage(&msg, &camera_to_global_trans_);
+
+    EXPECT_EQ(stereo_octomap->GetNumVoxels(), 1);
+    EXPECT_EQ(stereo_octomap->GetNumCulledPoints(), 3);
+
+    // the one ahead is the only one there
+    EXPECT_NEAR(stereo_octomap->NearestNeighbor(local_points[1]), 20, OCTOMAP_VOXEL_SIZE);
+
+    delete stereo_octomap;
+
+}
+
+TEST_F(StereoOctomapTest, PointsAgeOut) {
+
+    StereoOctomap *stereo_octomap = new StereoOctomap(bot_frames_);
+
+    double origin[3] = { 0, 0, 0 };
+    double point[3] = { 1, 0, 0 };
+    double far_point[3] = { 0, 10, 0 };
+
+    double trans_point[3], trans_far_point[3];
+
+    GlobalToCameraFrame(point, trans_point);
+    GlobalToCameraFrame(far_point, trans_far_point);
+
+    lcmt::stereo msg;
+
+    msg.timestamp = GetTimestampNow();
+
+    msg.x.push_back(trans_point[0]);
+    msg.y.push_back(trans_point[1]);
+    msg.z.push_back(trans_point[2]);
+
+    msg.number_of_points = 1;
+    msg.frame_number = 0;
+    msg.video_number = 0;
+
+    lcmt::stereo far_msg = msg;
+
+    far_msg.x[0] = trans_far_point[0];
+    far_msg.y[0] = trans_far_point[1];
+    far_msg.z[0] = trans_far_point[2];
+
+    int64_t start_time = msg.timestamp;
+
+    stereo_octomap->ProcessStereoMessage(&msg);
+
+    // still there just before it expires
+    far_msg.timestamp = start_time + OCTREE_LIFE - 1;
+    stereo_octomap->ProcessStereoMessage(&far_msg);
+
+    EXPECT_NEAR(stereo_octomap->NearestNeighbor(origin), 1, TOLERANCE);
+
+    // seeing it again keeps it around
+    msg.timestamp = far_msg.timestamp;
+    stereo_octomap->ProcessStereoMessage(&msg);
+
+    far_msg.timestamp = start_time + 2 * OCTREE_LIFE - 1;
+    stereo_octomap->ProcessStereoMessage(&far_msg);
+
+    EXPECT_NEAR(stereo_octomap->NearestNeighbor(origin), 1, TOLERANCE);
+
+    // then gone a bucket after OCTREE_LIFE without being seen
+    far_msg.timestamp = msg.timestamp + OCTREE_LIFE + OCTREE_LIFE / OCTOMAP_EXPIRY_BUCKETS;
+    stereo_octomap->ProcessStereoMessage(&far_msg);
+
+    EXPECT_NEAR(stereo_octomap->NearestNeighbor(origin), 10, TOLERANCE);
+
+    // jumping back in time (replaying a log) starts over
+    msg.timestamp = start_time;
+    stereo_octomap->ProcessStereoMessage(&msg);
+
+    EXPECT_NEAR(stereo_octomap->NearestNeighbor(far_point), sqrt(1*1 + 10*10), TOLERANCE);
+
+    delete stereo_octomap;
+
+}
+
+TEST_F(StereoOctomapTest, MaxVoxelsDropsOldest) {
+
+    StereoOctomap *stereo_octomap = new StereoOctomap(bot_frames_);
+
+    stereo_octomap->SetMaxVoxels(3);
+
+    double points[5][3] = { { 10, 0, 0 }, { 0, 10, 0 }, { 0, 0, 10 }, { 20, 0, 0 }, { 0, 20, 0 } };
+
+    lcmt::stereo msg;
+
+    msg.timestamp = GetTimestampNow();
+    msg.frame_number = 0;
+    msg.video_number = 0;
+
+    // three in one message, then two more a bucket later
+    for (int i = 0; i < 5; i++) {
+        if (i == 3) {
+            msg.number_of_points = msg.x.size();
+            stereo_octomap->ProcessStereoMessage(&msg);
+
+            msg.x.clear();
+            msg.y.clear();
+            msg.z.clear();
+
+            msg.timestamp += OCTREE_LIFE / OCTOMAP_EXPIRY_BUCKETS;
+        }
+
+        double trans_point[3];
+
+        GlobalToCameraFrame(points[i], trans_point);
+
+        msg.x.push_back(trans_point[0]);
+        msg.y.push_back(trans_point[1]);
+        msg.z.push_back(trans_point[2]);
+    }
+
+    msg.number_of_points = msg.x.size();
+    stereo_octomap->ProcessStereoMessage(&msg);
+
+    EXPECT_EQ(stereo_octomap->GetNumEvictedVoxels(), 2);
+
+    // the first two seen are gone
+    EXPECT_NEAR(stereo_octomap->NearestNeighbor(points[0]), 10, TOLERANCE);
+    EXPECT_NEAR(stereo_octomap->NearestNeighbor(points[1]), 10, TOLERANCE);
+    EXPECT_NEAR(stereo_octomap->NearestNeighbor(points[2]), 0, TOLERANCE);
+    EXPECT_NEAR(stereo_octomap->NearestNeighbor(points[3]), 0, TOLERANCE);
+    EXPECT_NEAR(stereo_octomap->NearestNeighbor(points[4]), 0, TOLERANCE);
+
+    delete stereo_octomap;
+
+}
+
+TEST_F(StereoOctomapTest, HudGetsOnlyChanges) {
+
+    StereoOctomap *stereo_octomap = new StereoOctomap(bot_frames_);
+
+    HudDeltaCounts counts;
+    lcmt_octomap_delta_subscription_t *sub = lcmt_octomap_delta_subscribe(lcm_, "octomap-hud", &hud_delta_handler, &counts);
+
+    double points[3][3] = { { 1, 0, 0 }, { 0, 2, 0 }, { 0, 0, 3 } };
+    double trans_point[3];
+
+    lcmt::stereo msg;
+
+    msg.timestamp = GetTimestampNow();
+    msg.number_of_points = 2;
+    msg.frame_number = 0;
+    msg.video_number = 0;
+
+    for (int i = 0; i < 2; i++) {
+        GlobalToCameraFrame(points[i], trans_point);
+
+        msg.x.push_back(trans_point[0]);
+        msg.y.push_back(trans_point[1]);
+        msg.z.push_back(trans_point[2]);
+    }
+
+    stereo_octomap->ProcessStereoMessage(&msg);
+
+    // the first one has everything
+    stereo_octomap->PublishToHud(lcm_);
+    WaitForHudDelta(&counts);
+
+    EXPECT_EQ(counts.messages, 1);
+    EXPECT_TRUE(counts.reset);
+    EXPECT_EQ(counts.number_added, 2);
+    EXPECT_EQ(counts.number_removed, 0);
+
+    // nothing changed, so nothing is sent
+    stereo_octomap->PublishToHud(lcm_);
+    WaitForHudDelta(&counts);
+
+    EXPECT_EQ(counts.messages, 1);
+
+    // a new point after the old ones have expired
+    GlobalToCameraFrame(points[2], trans_point);
+
+    msg.timestamp += OCTREE_LIFE + OCTREE_LIFE / OCTOMAP_EXPIRY_BUCKETS;
+    msg.number_of_points = 1;
+    msg.x = { (float)trans_point[0] };
+    msg.y = { (float)trans_point[1] };
+    msg.z = { (float)trans_point[2] };
+
+    stereo_octomap->ProcessStereoMessage(&msg);
+
+    stereo_octomap->PublishToHud(lcm_);
+    WaitForHudDelta(&counts);
+
+    EXPECT_EQ(counts.messages, 2);
+    EXPECT_FALSE(counts.reset);
+    EXPECT_EQ(counts.number_added, 1);
+    EXPECT_EQ(counts.number_removed, 2);
+
+    lcmt_octomap_delta_unsubscribe(lcm_, sub);
+
+    delete stereo_octomap;
+
+}
+
+TEST_F(StereoOctomapTest, ChangesSinceVersion) {
+
+    StereoOctomap *stereo_octomap = new StereoOctomap(bot_frames_);
+
+    StereoOctomapVersion start = stereo_octomap->GetVersion();
+
+    std::vector<double> changes;
+
+    EXPECT_TRUE(stereo_octomap->GetChangesSince(start, &changes));
+    EXPECT_EQ(changes.size(), 0u);
+
+    double points[3][3] = { { 1, 0, 0 }, { 0, 2, 0 }, { 0, 0, 3 } };
+    double trans_point[3];
+
+    lcmt::stereo msg;
+
+    msg.timestamp = GetTimestampNow();
+    msg.number_of_points = 2;
+    msg.frame_number = 0;
+    msg.video_number = 0;
+
+    for (int i = 0; i < 2; i++) {
+        GlobalToCameraFrame(points[i], trans_point);
+
+        msg.x.push_back(trans_point[0]);
+        msg.y.push_back(trans_point[1]);
+        msg.z.push_back(trans_point[2]);
+    }
+
+    stereo_octomap->ProcessStereoMessage(&msg);
+
+    // both points, each at its voxel's center
+    ASSERT_TRUE(stereo_octomap->GetChangesSince(start, &changes));
+    ASSERT_EQ(changes.size(), 6u);
+
+    double margin = stereo_octomap->GetChangeMargin();
+
+    for (int i = 0; i < 2; i++) {
+        double dist = sqrt(pow(changes[3 * i] - points[i][0], 2) + pow(changes[3 * i + 1] - points[i][1], 2)
+            + pow(changes[3 * i + 2] - points[i][2], 2));
+
+        EXPECT_LE(dist, margin + TOLERANCE);
+    }
+
+    StereoOctomapVersion added = stereo_octomap->GetVersion();
+
+    EXPECT_TRUE(stereo_octomap->GetChangesSince(added, &changes));
+    EXPECT_EQ(changes.size(), 0u);
+
+    // the old points expire and a new one comes in: three changes
+    GlobalToCameraFrame(points[2], trans_point);
+
+    msg.timestamp += OCTREE_LIFE + OCTREE_LIFE / OCTOMAP_EXPIRY_BUCKETS;
+    msg.number_of_points = 1;
+    msg.x = { (float)trans_point[0] };
+    msg.y = { (float)trans_point[1] };
+    msg.z = { (float)trans_point[2] };
+
+    stereo_octomap->ProcessStereoMessage(&msg);
+
+    ASSERT_TRUE(stereo_octomap->GetChangesSince(added, &changes));
+    EXPECT_EQ(changes.size(), 9u);
+
+    // clearing changes everything
+    stereo_octomap->Clear();
+
+    EXPECT_FALSE(stereo_octomap->GetChangesSince(added, &changes));
+    EXPECT_NE(stereo_octomap->GetVersion().epoch, added.epoch);
+
+    delete stereo_octomap;
+
+}
+
+TEST_F(StereoOctomapTest, SearchWhileInserting) {
+
+    ConcurrentStereoOctomap *stereo_octomap = new ConcurrentStereoOctomap(bot_frames_, true);
+
+    double origin[3] = { 0, 0, 0 };
+
+    // each message has a point closer than the last, so a search should
+    // never see the closest distance go up
+    atomic<bool> done(false);
+    atomic<int> num_searches(0);
+    atomic<bool> went_backwards(false);
+
+    std::thread reader([&] {
+        double last_dist = -1;
+
+        while (done == false) {
+            StereoOctomapSnapshot octomap(*stereo_octomap);
+
+            double dist = octomap->NearestNeighbor(origin);
+
+            if (last_dist >= 0 && (dist < 0 || dist > last_dist + TOLERANCE)) {
+                went_backwards = true;
+            }
+
+            last_dist = dist;
+            num_searches ++;
+        }
+    });
+
+    lcmt::stereo msg;
+
+    msg.timestamp = GetTimestampNow();
+    msg.number_of_points = 1;
+    msg.frame_number = 0;
+    msg.video_number = 0;
+
+    msg.x.push_back(0);
+    msg.y.push_back(0);
+    msg.z.push_back(0);
+
+    for (int i = 50; i > 0; i--) {
+        double point[3] = { (double)i, 0, 0 };
+        double trans_point[3];
+
+        GlobalToCameraFrame(point, trans_point);
+
+        msg.x[0] = trans_point[0];
+        msg.y[0] = trans_point[1];
+        msg.z[0] = trans_point[2];
+
+        stereo_octomap->ProcessStereoMessage(&msg);
+
+        // keep the queue from filling up so nothing is dropped
+        stereo_octomap->Flush();
+    }
+
+    done = true;
+    reader.join();
+
+    EXPECT_EQ(stereo_octomap->GetNumDroppedMessages(), 0);
+    EXPECT_FALSE(went_backwards);
+    EXPECT_GT(num_searches, 0);
+
+    {
+        StereoOctomapSnapshot octomap(*stereo_octomap);
+
+        EXPECT_NEAR(octomap->NearestNeighbor(origin), 1, TOLERANCE);
+    }
+
+    delete stereo_octomap;
+
+}
+
+/**
+ * The filter runs on the writer and only the points it keeps go in the map.
+ */
+TEST_F(StereoOctomapTest, FilterOnWriter) {
+    ConcurrentStereoOctomap *stereo_octomap = new ConcurrentStereoOctomap(bot_frames_, true);
+
+    std::thread::id caller = std::this_thread::get_id();
+    atomic<int> num_filtered(0);
+    atomic<bool> filtered_on_caller(false);
+
+    // keeps only the first point
+    stereo_octomap->SetFilter([&](const lcmt::stereo &msg, BotTrans *to_open_cv, std::vector<uint8_t> *keep) {
+        if (std::this_thread::get_id() == caller) {
+            filtered_on_caller = true;
+        }
+
+        num_filtered ++;
+
+        for (int i = 1; i < msg.number_of_points; i++) {
+            (*keep)[i] = 0;
+        }
+
+        return 1;
+    });
+
+    lcmt::stereo msg;
+
+    msg.timestamp = GetTimestampNow();
+    msg.frame_number = 0;
+    msg.video_number = 0;
+
+    double origin[3] = { 0, 0, 0 };
+
+    for (int i = 0; i < 2; i++) {
+        double point[3] = { 10.0 - 5 * i, 0, 0 };
+        double trans_point[3];
+
+        GlobalToCameraFrame(point, trans_point);
+
+        msg.x.push_back(trans_point[0]);
+        msg.y.push_back(trans_point[1]);
+        msg.z.push_back(trans_point[2]);
+    }
+
+    msg.number_of_points = 2;
+
+    stereo_octomap->ProcessStereoMessage(&msg);
+    stereo_octomap->Flush();
+
+    EXPECT_EQ(num_filtered, 1);
+    EXPECT_FALSE(filtered_on_caller);
+
+    {
+        StereoOctomapSnapshot octomap(*stereo_octomap);
+
+        // the point at 5 was filtered out
+        EXPECT_EQ(octomap->GetNumVoxels(), 1);
+        EXPECT_NEAR(octomap->NearestNeighbor(origin), 10, TOLERANCE);
+    }
+
+    delete stereo_octomap;
+}
+
+TEST_F(StereoOctomapTest, SnapshotRestores) {
+
+    std::string filename = "/tmp/stereo-octomap-test-snapshot";
+
+    ConcurrentStereoOctomap *stereo_octomap = new ConcurrentStereoOctomap(bot_frames_, true);
+
+    stereo_octomap->EnableSnapshots(filename, 4);
+
+    double origin[3] = { 0, 0, 0 };
+    double points[2][3] = { { 5, 0, 0 }, { 0, 8, 0 } };
+
+    lcmt::stereo msg;
+
+    msg.timestamp = GetTimestampNow();
+    msg.frame_number = 0;
+    msg.video_number = 0;
+
+    int64_t start_time = msg.timestamp;
+
+    // one point now and the other 100 ms later, too soon to save again
+    for (int i = 0; i < 2; i++) {
+        double trans_point[3];
+
+        GlobalToCameraFrame(points[i], trans_point);
+
+        msg.x.assign(1, trans_point[0]);
+        msg.y.assign(1, trans_point[1]);
+        msg.z.assign(1, trans_point[2]);
+        msg.number_of_points = 1;
+
+        msg.timestamp = start_time + i * 100000;
+
+        stereo_octomap->ProcessStereoMessage(&msg);
+    }
+
+    stereo_octomap->Flush();
+
+    delete stereo_octomap;
+
+    // saved after the first message only (250 ms between snapshots)
+    StereoOctomap *restored = new StereoOctomap(bot_frames_);
+
+    ASSERT_TRUE(restored->ReadSnapshot(filename, start_time));
+
+    EXPECT_EQ(restored->GetNumVoxels(), 1);
+    EXPECT_EQ(restored->GetLastMessageTime(), start_time);
+    EXPECT_NEAR(restored->NearestNeighbor(origin), 5, TOLERANCE);
+
+    delete restored;
+
+    // a snapshot from long enough ago has nothing left in it
+    restored = new StereoOctomap(bot_frames_);
+
+    EXPECT_TRUE(restored->ReadSnapshot(filename, start_time + 2 * OCTREE_LIFE));
+    EXPECT_EQ(restored->GetNumVoxels(), 0);
+
+    // and the restored voxels age out like any others
+    delete restored;
+    restored = new StereoOctomap(bot_frames_);
+
+    ASSERT_TRUE(restored->ReadSnapshot(filename, start_time));
+
+    double trans_far_point[3], far_point[3] = { 0, 0, 20 };
+
+    GlobalToCameraFrame(far_point, trans_far_point);
+
+    msg.x.assign(1, trans_far_point[0]);
+    msg.y.assign(1, trans_far_point[1]);
+    msg.z.assign(1, trans_far_point[2]);
+    msg.timestamp = start_time + OCTREE_LIFE + OCTREE_LIFE / OCTOMAP_EXPIRY_BUCKETS;
+
+    restored->ProcessStereoMessage(&msg);
+
+    EXPECT_EQ(restored->GetNumVoxels(), 1);
+    EXPECT_NEAR(restored->NearestNeighbor(origin), 20, TOLERANCE);
+
+    delete restored;
+
+    // no file or not a snapshot
+    remove(filename.c_str());
+
+    restored = new StereoOctomap(bot_frames_);
+
+    EXPECT_FALSE(restored->ReadSnapshot(filename, start_time));
+
+    FILE *file = fopen(filename.c_str(), "w");
+    fputs("not a snapshot", file);
+    fclose(file);
+
+    EXPECT_FALSE(restored->ReadSnapshot(filename, start_time));
+    EXPECT_EQ(restored->GetNumVoxels(), 0);
+
+    delete restored;
+
+    remove(filename.c_str());
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
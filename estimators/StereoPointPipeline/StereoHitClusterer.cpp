@@ -0,0 +1,219 @@
+#include "StereoHitClusterer.hpp"
+
+#include <algorithm>
+
+/**
+ * @param cluster_distance hits closer than this (meters) are always in the
+ *      same cluster; ones up to about twice as far can be
+ * @param min_points clusters with fewer hits than this are dropped
+ */
+StereoHitClusterer::StereoHitClusterer(double cluster_distance, int min_points) {
+    cluster_distance_ = cluster_distance;
+    min_points_ = min_points;
+}
+
+/**
+ * Groups a stereo message's hits into obstacles.
+ *
+ * @param msg stereo message
+ * @param keep a byte for each point, nonzero for the ones to use (like
+ *      the filters leave), or NULL for all of them
+ * @param to_open_cv transform from the camera (opencvFrame) to local
+ * @param primitives (output) the obstacles, in the local frame
+ */
+void StereoHitClusterer::Cluster(const lcmt::stereo &msg, const uint8_t *keep, BotTrans *to_open_cv, std::vector<StereoObstaclePrimitive> *primitives) {
+
+    int num_points = msg.number_of_points;
+
+    double mat[12];
+    bot_trans_get_mat_3x4(to_open_cv, mat);
+
+    xyz_.resize(3 * num_points);
+    point_cells_.resize(num_points);
+
+    cells_.clear();
+    cell_coords_.clear();
+    parents_.clear();
+
+    // put the kept points in the local frame and bin them
+    int num_kept = 0;
+
+    for (int i = 0; i < num_points; i++) {
+        if (keep != NULL && keep[i] == 0) {
+            continue;
+        }
+
+        double *point = &xyz_[3 * num_kept];
+
+        point[0] = mat[0] * msg.x[i] + mat[1] * msg.y[i] + mat[2] * msg.z[i] + mat[3];
+        point[1] = mat[4] * msg.x[i] + mat[5] * msg.y[i] + mat[6] * msg.z[i] + mat[7];
+        point[2] = mat[8] * msg.x[i] + mat[9] * msg.y[i] + mat[10] * msg.z[i] + mat[11];
+
+        int64_t coords[3];
+
+        for (int j = 0; j < 3; j++) {
+            coords[j] = floor(point[j] / cluster_distance_);
+        }
+
+        auto inserted = cells_.insert(std::make_pair(GetCellKey(coords[0], coords[1], coords[2]), (int)parents_.size()));
+
+        if (inserted.second) {
+            cell_coords_.insert(cell_coords_.end(), coords, coords + 3);
+            parents_.push_back(parents_.size());
+        }
+
+        point_cells_[num_kept] = inserted.first->second;
+        num_kept ++;
+    }
+
+    // join each cell with the occupied ones around it
+    int num_cells = parents_.size();
+
+    for (int cell = 0; cell < num_cells; cell++) {
+        const int64_t *coords = &cell_coords_[3 * cell];
+
+        for (int dx = -1; dx <= 1; dx++) {
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dz = -1; dz <= 1; dz++) {
+
+                    auto found = cells_.find(GetCellKey(coords[0] + dx, coords[1] + dy, coords[2] + dz));
+
+                    if (found == cells_.end()) {
+                        continue;
+                    }
+
+                    int root = FindRoot(cell);
+                    int other_root = FindRoot(found->second);
+
+                    if (root != other_root) {
+                        parents_[std::max(root, other_root)] = std::min(root, other_root);
+                    }
+                }
+            }
+        }
+    }
+
+    // a primitive for each cluster, with its bounding box
+    primitives->clear();
+    cluster_primitives_.assign(num_cells, -1);
+
+    for (int i = 0; i < num_kept; i++) {
+        const double *point = &xyz_[3 * i];
+        int root = FindRoot(point_cells_[i]);
+
+        if (cluster_primitives_[root] < 0) {
+            cluster_primitives_[root] = primitives->size();
+
+            StereoObstaclePrimitive primitive;
+
+            for (int j = 0; j < 3; j++) {
+                primitive.min[j] = point[j];
+                primitive.max[j] = point[j];
+            }
+
+            primitive.num_points = 0;
+
+            primitives->push_back(primitive);
+        }
+
+        StereoObstaclePrimitive &primitive = (*primitives)[cluster_primitives_[root]];
+
+        for (int j = 0; j < 3; j++) {
+            primitive.min[j] = std::min(primitive.min[j], point[j]);
+            primitive.max[j] = std::max(primitive.max[j], point[j]);
+        }
+
+        primitive.num_points ++;
+    }
+
+    // the cylinder around each box's center
+    for (StereoObstaclePrimitive &primitive : *primitives) {
+        primitive.center[0] = 0.5 * (primitive.min[0] + primitive.max[0]);
+        primitive.center[1] = 0.5 * (primitive.min[1] + primitive.max[1]);
+        primitive.radius = 0;
+    }
+
+    for (int i = 0; i < num_kept; i++) {
+        const double *point = &xyz_[3 * i];
+        StereoObstaclePrimitive &primitive = (*primitives)[cluster_primitives_[FindRoot(point_cells_[i])]];
+
+        double x = point[0] - primitive.center[0];
+        double y = point[1] - primitive.center[1];
+
+        primitive.radius = std::max(primitive.radius, x * x + y * y);
+    }
+
+    for (StereoObstaclePrimitive &primitive : *primitives) {
+        primitive.radius = sqrt(primitive.radius);
+        primitive.cylinder = primitive.max[2] - primitive.min[2] >= CLUSTER_CYLINDER_ASPECT * 2 * primitive.radius;
+    }
+
+    // small clusters are more likely to be noise than obstacles
+    int min_points = min_points_;
+
+    primitives->erase(std::remove_if(primitives->begin(), primitives->end(),
+        [min_points](const StereoObstaclePrimitive &primitive) { return primitive.num_points < min_points; }), primitives->end());
+}
+
+/**
+ * @retval distance from a point to an obstacle (its cylinder or box,
+ *      whichever it is), 0 if the point is inside
+ */
+double StereoHitClusterer::Distance(const StereoObstaclePrimitive &primitive, const double point[3]) {
+
+    double vertical = std::max(0.0, std::max(primitive.min[2] - point[2], point[2] - primitive.max[2]));
+    double horizontal;
+
+    if (primitive.cylinder) {
+        double x = point[0] - primitive.center[0];
+        double y = point[1] - primitive.center[1];
+
+        horizontal = std::max(0.0, sqrt(x * x + y * y) - primitive.radius);
+    } else {
+        double x = std::max(0.0, std::max(primitive.min[0] - point[0], point[0] - primitive.max[0]));
+        double y = std::max(0.0, std::max(primitive.min[1] - point[1], point[1] - primitive.max[1]));
+
+        horizontal = sqrt(x * x + y * y);
+    }
+
+    return sqrt(horizontal * horizontal + vertical * vertical);
+}
+
+/**
+ * @retval distance from a point to the closest obstacle, or -1 if there
+ *      are none
+ */
+double StereoHitClusterer::MinDistance(const std::vector<StereoObstaclePrimitive> &primitives, const double point[3]) {
+
+    double best = -1;
+
+    for (const StereoObstaclePrimitive &primitive : primitives) {
+        double distance = Distance(primitive, point);
+
+        if (best < 0 || distance < best) {
+            best = distance;
+        }
+    }
+
+    return best;
+}
+
+int StereoHitClusterer::FindRoot(int cell) {
+    while (parents_[cell] != cell) {
+        // point it at its grandparent on the way up, so paths stay short
+        parents_[cell] = parents_[parents_[cell]];
+        cell = parents_[cell];
+    }
+
+    return cell;
+}
+
+/**
+ * @retval a key for the cell at (x, y, z), with 21 bits for each
+ *      coordinate
+ */
+int64_t StereoHitClusterer::GetCellKey(int64_t x, int64_t y, int64_t z) {
+    const int64_t mask = (1 << 21) - 1;
+
+    return ((x & mask) << 42) | ((y & mask) << 21) | (z & mask);
+}
@@ -0,0 +1,83 @@
+/**
+ * Groups stereo hits into obstacles: each cluster of hits becomes a box
+ * and a vertical cylinder around it, so the HUD and the radio carry tens
+ * of obstacles instead of thousands of points.  Tree trunks (tall, thin
+ * clusters) are marked as cylinders and everything else as boxes.
+ *
+ * Hits are binned on a grid of cluster_distance cells in the local frame
+ * and occupied cells that touch (including diagonally) are one cluster, so
+ * it's linear in the number of hits.
+ *
+ * (C) 2015 Andrew Barry <abarry@csail.mit.edu>
+ */
+
+#ifndef STEREO_HIT_CLUSTERER_HPP
+#define STEREO_HIT_CLUSTERER_HPP
+
+#include <math.h>
+
+#include <vector>
+#include <unordered_map>
+
+#include <bot_core/rotations.h>
+#include <bot_frames/bot_frames.h>
+
+#include "../../LCM/lcmt/stereo.hpp"
+
+// a cluster is a cylinder if it's at least this many times taller than it
+// is wide
+#define CLUSTER_CYLINDER_ASPECT 2.0
+
+/**
+ * One obstacle, in the local frame.
+ */
+struct StereoObstaclePrimitive {
+    double min[3];
+    double max[3];
+
+    // vertical cylinder from min[2] to max[2]
+    double center[2];
+    double radius;
+
+    // true if the cylinder is the better fit, false for the box
+    bool cylinder;
+
+    int num_points;
+};
+
+class StereoHitClusterer {
+
+    public:
+
+        StereoHitClusterer(double cluster_distance, int min_points);
+
+        void Cluster(const lcmt::stereo &msg, const uint8_t *keep, BotTrans *to_open_cv, std::vector<StereoObstaclePrimitive> *primitives);
+
+        static double Distance(const StereoObstaclePrimitive &primitive, const double point[3]);
+        static double MinDistance(const std::vector<StereoObstaclePrimitive> &primitives, const double point[3]);
+
+    private:
+
+        int FindRoot(int cell);
+
+        static int64_t GetCellKey(int64_t x, int64_t y, int64_t z);
+
+        double cluster_distance_;
+        int min_points_;
+
+        // the kept points in the local frame (x, y, z for each) and each
+        // one's cell
+        std::vector<double> xyz_;
+        std::vector<int> point_cells_;
+
+        // occupied cells: index by key, each one's coordinates, and the
+        // union-find parent of each
+        std::unordered_map<int64_t, int> cells_;
+        std::vector<int64_t> cell_coords_;
+        std::vector<int> parents_;
+
+        // the primitive each root cell's cluster is building, or -1
+        std::vector<int> cluster_primitives_;
+};
+
+#endif
@@ -0,0 +1,365 @@
+#include "StereoPointPipeline.hpp"
+#include "../../utils/utils/Clock.hpp"
+
+static inline int64_t NowMicroseconds() {
+    return GetRawMonotonicNow();
+}
+
+StereoPointPipeline::StereoPointPipeline() {
+    range_gate_ = false;
+    min_range_ = 0;
+    max_range_ = 0;
+
+    temporal_filter_ = NULL;
+    spacial_filter_ = NULL;
+
+    voxel_size_ = 0;
+
+    clusterer_ = NULL;
+    primitives_timestamp_ = 0;
+    primitives_frame_number_ = 0;
+
+    ResetStats();
+}
+
+StereoPointPipeline::~StereoPointPipeline() {
+    delete temporal_filter_;
+    delete spacial_filter_;
+    delete clusterer_;
+}
+
+void StereoPointPipeline::EnableRangeGate(float min_range, float max_range) {
+    range_gate_ = true;
+    min_range_ = min_range;
+    max_range_ = max_range;
+}
+
+void StereoPointPipeline::EnableTemporalFilter(float distance_threshold, int history_frames, int min_frames) {
+    delete temporal_filter_;
+    temporal_filter_ = new StereoFilter(distance_threshold, history_frames, min_frames);
+}
+
+void StereoPointPipeline::EnableSpacialFilter(float distance_threshold, int number_of_nearby_points_threshold) {
+    delete spacial_filter_;
+    spacial_filter_ = new SpacialStereoFilter(distance_threshold, number_of_nearby_points_threshold);
+}
+
+void StereoPointPipeline::EnableVoxelDownsample(float voxel_size) {
+    voxel_size_ = voxel_size;
+}
+
+void StereoPointPipeline::EnableClustering(double cluster_distance, int min_points) {
+    delete clusterer_;
+    clusterer_ = new StereoHitClusterer(cluster_distance, min_points);
+}
+
+/**
+ * Runs a message through the enabled stages up to (not including) the map.
+ * Has the same form as a ConcurrentStereoOctomap's filter.
+ *
+ * @param msg stereo message
+ * @param to_open_cv transform from the camera (opencvFrame) to local, for
+ *      clustering (which is skipped if it's NULL)
+ * @param keep a byte for each point in msg, nonzero for the points still in
+ *      (all 1 to start).  Points that are filtered out get 0.
+ *
+ * @retval number of points left
+ */
+int StereoPointPipeline::Filter(const lcmt::stereo &msg, BotTrans *to_open_cv, std::vector<uint8_t> *keep) {
+
+    int num_points = 0;
+
+    for (int i = 0; i < msg.number_of_points; i++) {
+        num_points += (*keep)[i] != 0;
+    }
+
+    if (range_gate_) {
+        int64_t start = NowMicroseconds();
+        int num_out = RangeGate(msg, keep->data());
+
+        RecordStage(STEREO_STAGE_RANGE, num_points, num_out, start);
+        num_points = num_out;
+    }
+
+    if (temporal_filter_ != NULL) {
+        // runs even with no points left so its history stays current
+        int64_t start = NowMicroseconds();
+        int num_out = temporal_filter_->FilterPoints(msg, keep);
+
+        RecordStage(STEREO_STAGE_TEMPORAL, num_points, num_out, start);
+        num_points = num_out;
+    }
+
+    if (spacial_filter_ != NULL) {
+        int64_t start = NowMicroseconds();
+        int num_out = spacial_filter_->FilterPoints(msg, keep);
+
+        RecordStage(STEREO_STAGE_SPACIAL, num_points, num_out, start);
+        num_points = num_out;
+    }
+
+    if (voxel_size_ > 0) {
+        int64_t start = NowMicroseconds();
+        int num_out = VoxelDownsample(msg, keep->data());
+
+        RecordStage(STEREO_STAGE_DOWNSAMPLE, num_points, num_out, start);
+        num_points = num_out;
+    }
+
+    if (clusterer_ != NULL && to_open_cv != NULL) {
+        int64_t start = NowMicroseconds();
+
+        clusterer_->Cluster(msg, keep->data(), to_open_cv, &clustered_);
+
+        int num_clustered = 0;
+
+        for (const StereoObstaclePrimitive &primitive : clustered_) {
+            num_clustered += primitive.num_points;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(primitives_mutex_);
+
+            primitives_.swap(clustered_);
+            primitives_timestamp_ = msg.timestamp;
+            primitives_frame_number_ = msg.frame_number;
+        }
+
+        // the points in obstacles (the rest were in clusters too small
+        // to keep), but they all go on to the map
+        RecordStage(STEREO_STAGE_CLUSTER, num_points, num_clustered, start);
+    }
+
+    return num_points;
+}
+
+/**
+ * Runs a message through all of the enabled stages and adds what's left to
+ * a map.
+ *
+ * @param msg stereo message
+ * @param to_open_cv transform from the camera (opencvFrame) to local from
+ *      when the message arrived
+ * @param octomap map to add the points to
+ *
+ * @retval number of points added
+ */
+int StereoPointPipeline::ProcessStereoMessage(const lcmt::stereo &msg, BotTrans *to_open_cv, StereoOctomap *octomap) {
+
+    keep_.assign(msg.number_of_points, 1);
+
+    int num_points = Filter(msg, to_open_cv, &keep_);
+
+    int64_t start = NowMicroseconds();
+
+    octomap->ProcessStereoMessage(&msg, to_open_cv, keep_.data());
+
+    RecordStage(STEREO_STAGE_INSERT, num_points, num_points, start);
+
+    return num_points;
+}
+
+/**
+ * Drops the points closer than min_range_ or farther than max_range_ from
+ * the camera.  No branches, so it vectorizes.
+ *
+ * @retval number of points left
+ */
+int StereoPointPipeline::RangeGate(const lcmt::stereo &msg, uint8_t *keep) const {
+
+    const float *x = msg.x.data();
+    const float *y = msg.y.data();
+    const float *z = msg.z.data();
+
+    float sqr_min = min_range_ * min_range_;
+    float sqr_max = max_range_ * max_range_;
+
+    int num_points = 0;
+
+    for (int i = 0; i < msg.number_of_points; i++) {
+        float sqr_range = x[i] * x[i] + y[i] * y[i] + z[i] * z[i];
+
+        keep[i] = (keep[i] != 0) & (sqr_range >= sqr_min) & (sqr_range <= sqr_max);
+        num_points += keep[i];
+    }
+
+    return num_points;
+}
+
+/**
+ * Keeps only the last point in each voxel, which is the one the map would
+ * keep anyway.
+ *
+ * @retval number of points left
+ */
+int StereoPointPipeline::VoxelDownsample(const lcmt::stereo &msg, uint8_t *keep) {
+
+    voxel_points_.clear();
+
+    int num_points = 0;
+
+    for (int i = 0; i < msg.number_of_points; i++) {
+        if (keep[i] == 0) {
+            continue;
+        }
+
+        int64_t key = GetCellKey(floor(msg.x[i] / voxel_size_), floor(msg.y[i] / voxel_size_), floor(msg.z[i] / voxel_size_));
+
+        auto inserted = voxel_points_.insert(std::make_pair(key, i));
+
+        if (inserted.second) {
+            num_points ++;
+        } else {
+            // replaces an earlier point
+            keep[inserted.first->second] = 0;
+            inserted.first->second = i;
+        }
+    }
+
+    return num_points;
+}
+
+void StereoPointPipeline::RecordStage(int stage, int points_in, int points_out, int64_t start_us) {
+
+    int64_t elapsed = NowMicroseconds() - start_us;
+
+    StereoPipelineStageStats &stats = stats_[stage];
+
+    stats.messages ++;
+    stats.points_in += points_in;
+    stats.points_out += points_out;
+    stats.total_us += elapsed;
+
+    // only one thread runs the stages, so this doesn't race with itself
+    if (elapsed > stats.max_us) {
+        stats.max_us = elapsed;
+    }
+}
+
+/**
+ * @param primitives (output) the obstacles from the last clustered message,
+ *      in the local frame
+ * @param timestamp (output) that message's timestamp
+ * @param frame_number (output) and its frame number
+ */
+void StereoPointPipeline::GetPrimitives(std::vector<StereoObstaclePrimitive> *primitives, int64_t *timestamp, int32_t *frame_number) {
+
+    std::lock_guard<std::mutex> lock(primitives_mutex_);
+
+    *primitives = primitives_;
+    *timestamp = primitives_timestamp_;
+    *frame_number = primitives_frame_number_;
+}
+
+/**
+ * Sends the obstacles from the last clustered message (for the HUD), if
+ * clustering is on.
+ */
+void StereoPointPipeline::PublishPrimitives(lcm_t *lcm) {
+
+    if (clusterer_ == NULL) {
+        return;
+    }
+
+    std::vector<StereoObstaclePrimitive> primitives;
+
+    lcmt_obstacle_primitives msg;
+
+    GetPrimitives(&primitives, &msg.timestamp, &msg.frame_number);
+
+    int num_primitives = primitives.size();
+
+    // the message's float arrays, one after another
+    std::vector<float> values(9 * num_primitives);
+    std::vector<int8_t> cylinder(num_primitives);
+    std::vector<int32_t> number_of_points(num_primitives);
+
+    float *arrays[9];
+
+    for (int j = 0; j < 9; j++) {
+        arrays[j] = values.data() + j * num_primitives;
+    }
+
+    for (int i = 0; i < num_primitives; i++) {
+        const StereoObstaclePrimitive &primitive = primitives[i];
+
+        for (int j = 0; j < 3; j++) {
+            arrays[j][i] = primitive.min[j];
+            arrays[3 + j][i] = primitive.max[j];
+        }
+
+        arrays[6][i] = primitive.center[0];
+        arrays[7][i] = primitive.center[1];
+        arrays[8][i] = primitive.radius;
+
+        cylinder[i] = primitive.cylinder;
+        number_of_points[i] = primitive.num_points;
+    }
+
+    msg.number_of_primitives = num_primitives;
+
+    msg.min_x = arrays[0];
+    msg.min_y = arrays[1];
+    msg.min_z = arrays[2];
+    msg.max_x = arrays[3];
+    msg.max_y = arrays[4];
+    msg.max_z = arrays[5];
+    msg.center_x = arrays[6];
+    msg.center_y = arrays[7];
+    msg.radius = arrays[8];
+    msg.cylinder = cylinder.data();
+    msg.number_of_points = number_of_points.data();
+
+    lcmt_obstacle_primitives_publish(lcm, "obstacle-primitives", &msg);
+}
+
+void StereoPointPipeline::ResetStats() {
+    for (int i = 0; i < STEREO_NUM_STAGES; i++) {
+        stats_[i].messages = 0;
+        stats_[i].points_in = 0;
+        stats_[i].points_out = 0;
+        stats_[i].total_us = 0;
+        stats_[i].max_us = 0;
+    }
+}
+
+/**
+ * Prints a line for each stage that has run: how many points it kept and
+ * its mean and max time per message.
+ */
+void StereoPointPipeline::PrintStats(FILE *out) const {
+
+    for (int i = 0; i < STEREO_NUM_STAGES; i++) {
+        const StereoPipelineStageStats &stats = stats_[i];
+
+        int64_t messages = stats.messages;
+
+        if (messages == 0) {
+            continue;
+        }
+
+        int64_t points_in = stats.points_in;
+        int64_t points_out = stats.points_out;
+
+        fprintf(out, "%-10s %8.1f -> %8.1f points/msg (%5.1f%% kept) | mean %.3f ms, max %.3f ms\n", GetStageName(i),
+            double(points_in) / messages, double(points_out) / messages,
+            points_in > 0 ? 100.0 * points_out / points_in : 100.0,
+            stats.total_us / 1000.0 / messages, stats.max_us / 1000.0);
+    }
+}
+
+const char* StereoPointPipeline::GetStageName(int stage) {
+    static const char *names[STEREO_NUM_STAGES] = { "range", "temporal", "spacial", "downsample", "cluster", "insert" };
+
+    return names[stage];
+}
+
+/**
+ * @retval a key for the cell at (x, y, z), with 21 bits for each
+ *      coordinate
+ */
+int64_t StereoPointPipeline::GetCellKey(int64_t x, int64_t y, int64_t z) {
+    const int64_t mask = (1 << 21) - 1;
+
+    return ((x & mask) << 42) | ((y & mask) << 21) | (z & mask);
+}
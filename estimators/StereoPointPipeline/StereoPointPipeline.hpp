@@ -0,0 +1,132 @@
+/**
+ * The steps a stereo message's points go through on their way into the
+ * obstacle map, so every program that builds a map does it the same way:
+ *
+ *   range gate -> temporal filter -> spacial filter -> voxel downsample
+ *     -> clustering -> map insert
+ *
+ * Each stage is off until it's enabled.  The stages don't copy the message:
+ * they share a keep mask (a byte for each point) that each one clears
+ * points from, and the map inserts whatever is left.  Clustering doesn't
+ * drop any points: it groups what's left into obstacles
+ * (StereoHitClusterer) for the HUD.
+ *
+ * Each stage counts the messages and points through it and how long it
+ * took, so a slow or over-eager stage shows up.
+ *
+ * (C) 2015 Andrew Barry <abarry@csail.mit.edu>
+ */
+
+#ifndef STEREO_POINT_PIPELINE_HPP
+#define STEREO_POINT_PIPELINE_HPP
+
+#include <stdio.h>
+#include <time.h>
+#include <math.h>
+
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+
+#include "../../LCM/lcmt/stereo.hpp"
+#include "../StereoFilter/StereoFilter.hpp"
+#include "../SpacialStereoFilter/SpacialStereoFilter.hpp"
+#include "../StereoOctomap/StereoOctomap.hpp"
+#include "../../LCM/lcmt_obstacle_primitives.h"
+#include "StereoHitClusterer.hpp"
+
+// stages a message goes through, in order
+enum StereoPipelineStage { STEREO_STAGE_RANGE, STEREO_STAGE_TEMPORAL, STEREO_STAGE_SPACIAL, STEREO_STAGE_DOWNSAMPLE, STEREO_STAGE_CLUSTER, STEREO_STAGE_INSERT, STEREO_NUM_STAGES };
+
+/**
+ * What went through a stage.  The stages can run on a map thread while
+ * another thread reads these, so they're atomic.
+ */
+struct StereoPipelineStageStats {
+    std::atomic<int64_t> messages;
+    std::atomic<int64_t> points_in;
+    std::atomic<int64_t> points_out;
+    std::atomic<int64_t> total_us;
+    std::atomic<int64_t> max_us;
+};
+
+class StereoPointPipeline {
+
+    public:
+
+        StereoPointPipeline();
+        ~StereoPointPipeline();
+
+        // keep points this far from the camera (meters)
+        void EnableRangeGate(float min_range, float max_range);
+
+        // keep points near points in min_frames of the last history_frames
+        // frames (see StereoFilter)
+        void EnableTemporalFilter(float distance_threshold, int history_frames = 1, int min_frames = 1);
+
+        // keep points with enough neighbors (see SpacialStereoFilter)
+        void EnableSpacialFilter(float distance_threshold, int number_of_nearby_points_threshold);
+
+        // keep only the last point in each voxel_size cube
+        void EnableVoxelDownsample(float voxel_size);
+
+        // group the points left into obstacles (see StereoHitClusterer)
+        void EnableClustering(double cluster_distance, int min_points);
+        bool IsClusteringEnabled() const { return clusterer_ != NULL; }
+
+        int Filter(const lcmt::stereo &msg, std::vector<uint8_t> *keep) { return Filter(msg, NULL, keep); }
+        int Filter(const lcmt::stereo &msg, BotTrans *to_open_cv, std::vector<uint8_t> *keep);
+        int ProcessStereoMessage(const lcmt::stereo &msg, BotTrans *to_open_cv, StereoOctomap *octomap);
+
+        const StereoPipelineStageStats& GetStageStats(int stage) const { return stats_[stage]; }
+        void ResetStats();
+        void PrintStats(FILE *out) const;
+
+        // the obstacles from the last clustered message
+        void GetPrimitives(std::vector<StereoObstaclePrimitive> *primitives, int64_t *timestamp, int32_t *frame_number);
+        void PublishPrimitives(lcm_t *lcm);
+
+        static const char* GetStageName(int stage);
+
+    private:
+
+        int RangeGate(const lcmt::stereo &msg, uint8_t *keep) const;
+        int VoxelDownsample(const lcmt::stereo &msg, uint8_t *keep);
+
+        void RecordStage(int stage, int points_in, int points_out, int64_t start_us);
+
+        static int64_t GetCellKey(int64_t x, int64_t y, int64_t z);
+
+        bool range_gate_;
+        float min_range_;
+        float max_range_;
+
+        StereoFilter *temporal_filter_;
+        SpacialStereoFilter *spacial_filter_;
+
+        // 0 when downsampling is off
+        float voxel_size_;
+
+        // the point kept so far in each voxel, by the voxel's key.  Kept
+        // between messages so it doesn't allocate once it's big enough.
+        std::unordered_map<int64_t, int> voxel_points_;
+
+        StereoHitClusterer *clusterer_;
+
+        // the stage fills clustered_ and then swaps it with primitives_
+        // (under primitives_mutex_), so readers never wait on clustering
+        std::vector<StereoObstaclePrimitive> clustered_;
+
+        std::mutex primitives_mutex_;
+        std::vector<StereoObstaclePrimitive> primitives_;
+        int64_t primitives_timestamp_;
+        int32_t primitives_frame_number_;
+
+        // ProcessStereoMessage()'s mask
+        std::vector<uint8_t> keep_;
+
+        StereoPipelineStageStats stats_[STEREO_NUM_STAGES];
+};
+
+#endif
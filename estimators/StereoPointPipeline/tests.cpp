@@ -0,0 +1,280 @@
+#include "StereoPointPipeline.hpp"
+#include "gtest/gtest.h"
+
+static void AddPoint(float x, float y, float z, lcmt::stereo *msg) {
+    msg->x.push_back(x);
+    msg->y.push_back(y);
+    msg->z.push_back(z);
+    msg->grey.push_back(0);
+
+    msg->number_of_points = msg->x.size();
+}
+
+static lcmt::stereo EmptyMsg(int64_t frame_number) {
+    lcmt::stereo msg;
+
+    msg.timestamp = GetTimestampNow();
+    msg.video_number = 0;
+    msg.frame_number = frame_number;
+    msg.number_of_points = 0;
+
+    return msg;
+}
+
+TEST(StereoPointPipelineTest, NothingEnabled) {
+    StereoPointPipeline pipeline;
+
+    lcmt::stereo msg = EmptyMsg(0);
+
+    AddPoint(0, 0, 1, &msg);
+    AddPoint(0, 0, 100, &msg);
+
+    std::vector<uint8_t> keep(2, 1);
+
+    EXPECT_EQ(pipeline.Filter(msg, &keep), 2);
+    EXPECT_EQ(keep[0], 1);
+    EXPECT_EQ(keep[1], 1);
+
+    for (int i = 0; i < STEREO_NUM_STAGES; i++) {
+        EXPECT_EQ(pipeline.GetStageStats(i).messages.load(), 0) << StereoPointPipeline::GetStageName(i);
+    }
+}
+
+TEST(StereoPointPipelineTest, RangeGate) {
+    StereoPointPipeline pipeline;
+
+    pipeline.EnableRangeGate(1, 20);
+
+    lcmt::stereo msg = EmptyMsg(0);
+
+    AddPoint(0, 0, 0.5, &msg);
+    AddPoint(3, 0, 4, &msg);
+    AddPoint(0, 0, 50, &msg);
+    AddPoint(0, -20, 0, &msg);
+
+    std::vector<uint8_t> keep(4, 1);
+
+    // already dropped, even though it's in range
+    keep[3] = 0;
+
+    EXPECT_EQ(pipeline.Filter(msg, &keep), 1);
+
+    uint8_t expected[4] = { 0, 1, 0, 0 };
+
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(keep[i], expected[i]) << "point " << i;
+    }
+
+    const StereoPipelineStageStats &stats = pipeline.GetStageStats(STEREO_STAGE_RANGE);
+
+    EXPECT_EQ(stats.messages.load(), 1);
+    EXPECT_EQ(stats.points_in.load(), 3);
+    EXPECT_EQ(stats.points_out.load(), 1);
+
+    pipeline.ResetStats();
+
+    EXPECT_EQ(pipeline.GetStageStats(STEREO_STAGE_RANGE).messages.load(), 0);
+}
+
+TEST(StereoPointPipelineTest, VoxelDownsampleKeepsLast) {
+    StereoPointPipeline pipeline;
+
+    pipeline.EnableVoxelDownsample(0.5);
+
+    lcmt::stereo msg = EmptyMsg(0);
+
+    // three in one voxel, with another in between
+    AddPoint(1.1, 0.1, 5.1, &msg);
+    AddPoint(1.2, 0.2, 5.2, &msg);
+    AddPoint(3, 0, 5, &msg);
+    AddPoint(1.3, 0.3, 5.3, &msg);
+
+    std::vector<uint8_t> keep(4, 1);
+
+    EXPECT_EQ(pipeline.Filter(msg, &keep), 2);
+
+    uint8_t expected[4] = { 0, 0, 1, 1 };
+
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(keep[i], expected[i]) << "point " << i;
+    }
+}
+
+TEST(StereoPointPipelineTest, MatchesFiltersInOrder) {
+    // the pipeline keeps what running the filters one after another on
+    // copied messages does
+    StereoPointPipeline pipeline;
+
+    pipeline.EnableRangeGate(0, 6);
+    pipeline.EnableTemporalFilter(0.5);
+    pipeline.EnableSpacialFilter(0.5, 3);
+
+    StereoFilter temporal(0.5);
+    SpacialStereoFilter spacial(0.5, 3);
+
+    srand(0);
+
+    for (int frame = 0; frame < 4; frame++) {
+        lcmt::stereo msg = EmptyMsg(frame);
+
+        for (int i = 0; i < 500; i++) {
+            AddPoint(-4 + 8.0 * rand() / RAND_MAX, -4 + 8.0 * rand() / RAND_MAX, 8.0 * rand() / RAND_MAX, &msg);
+        }
+
+        std::vector<uint8_t> keep(msg.number_of_points, 1);
+
+        int num_kept = pipeline.Filter(msg, &keep);
+
+        // by hand.  The temporal filter keeps all of the points in its
+        // history, not just the ones in range, so it gets the whole message.
+        std::vector<uint8_t> in_range_mask(msg.number_of_points, 1);
+
+        for (int i = 0; i < msg.number_of_points; i++) {
+            in_range_mask[i] = msg.x[i] * msg.x[i] + msg.y[i] * msg.y[i] + msg.z[i] * msg.z[i] <= 36;
+        }
+
+        temporal.FilterPoints(msg, &in_range_mask);
+
+        lcmt::stereo after_temporal = EmptyMsg(frame);
+
+        for (int i = 0; i < msg.number_of_points; i++) {
+            if (in_range_mask[i] != 0) {
+                AddPoint(msg.x[i], msg.y[i], msg.z[i], &after_temporal);
+            }
+        }
+
+        const lcmt::stereo *expected = spacial.ProcessMessage(after_temporal);
+
+        ASSERT_TRUE(num_kept == expected->number_of_points) << "frame " << frame;
+
+        int j = 0;
+
+        for (int i = 0; i < msg.number_of_points; i++) {
+            if (keep[i] != 0) {
+                EXPECT_EQ(msg.x[i], expected->x[j]);
+                EXPECT_EQ(msg.y[i], expected->y[j]);
+                EXPECT_EQ(msg.z[i], expected->z[j]);
+                j++;
+            }
+        }
+
+        delete expected;
+    }
+
+    EXPECT_EQ(pipeline.GetStageStats(STEREO_STAGE_TEMPORAL).messages.load(), 4);
+    EXPECT_EQ(pipeline.GetStageStats(STEREO_STAGE_SPACIAL).messages.load(), 4);
+    EXPECT_EQ(pipeline.GetStageStats(STEREO_STAGE_DOWNSAMPLE).messages.load(), 0);
+}
+
+TEST(StereoHitClustererTest, TrunksAndBoxes) {
+    StereoHitClusterer clusterer(0.5, 5);
+
+    BotTrans identity;
+    bot_trans_set_identity(&identity);
+
+    lcmt::stereo msg = EmptyMsg(0);
+
+    // two trunks, 3 meters apart
+    for (int i = 0; i < 40; i++) {
+        AddPoint(5, 0, 0.1 * i, &msg);
+        AddPoint(5, 3, 0.1 * i, &msg);
+    }
+
+    // a low, wide bush
+    for (int i = 0; i < 10; i++) {
+        AddPoint(10 + 0.2 * i, -3, 0.1 * (i % 2), &msg);
+    }
+
+    // noise, in too small of a cluster
+    AddPoint(20, 20, 20, &msg);
+    AddPoint(20.1, 20, 20, &msg);
+
+    std::vector<StereoObstaclePrimitive> primitives;
+
+    clusterer.Cluster(msg, NULL, &identity, &primitives);
+
+    ASSERT_EQ((int)primitives.size(), 3);
+
+    // in the order of their first points
+    for (int i = 0; i < 2; i++) {
+        const StereoObstaclePrimitive &trunk = primitives[i];
+
+        EXPECT_TRUE(trunk.cylinder);
+        EXPECT_EQ(trunk.num_points, 40);
+        EXPECT_NEAR(trunk.center[0], 5, 0.0001);
+        EXPECT_NEAR(trunk.center[1], 3 * i, 0.0001);
+        EXPECT_NEAR(trunk.radius, 0, 0.0001);
+        EXPECT_NEAR(trunk.min[2], 0, 0.0001);
+        EXPECT_NEAR(trunk.max[2], 3.9, 0.0001);
+    }
+
+    const StereoObstaclePrimitive &bush = primitives[2];
+
+    EXPECT_FALSE(bush.cylinder);
+    EXPECT_EQ(bush.num_points, 10);
+    EXPECT_NEAR(bush.min[0], 10, 0.0001);
+    EXPECT_NEAR(bush.max[0], 11.8, 0.0001);
+
+    // distances to the cylinder and to the box
+    double beside_trunk[3] = { 5, 1, 2 };
+    double above_bush[3] = { 10.5, -3, 2.1 };
+    double inside_bush[3] = { 11, -3, 0.05 };
+
+    EXPECT_NEAR(StereoHitClusterer::Distance(primitives[0], beside_trunk), 1, 0.0001);
+    EXPECT_NEAR(StereoHitClusterer::Distance(bush, above_bush), 2, 0.0001);
+    EXPECT_NEAR(StereoHitClusterer::Distance(bush, inside_bush), 0, 0.0001);
+    EXPECT_NEAR(StereoHitClusterer::MinDistance(primitives, beside_trunk), 1, 0.0001);
+
+    // only the kept points count
+    std::vector<uint8_t> keep(msg.number_of_points, 0);
+
+    for (int i = 0; i < 40; i++) {
+        keep[2 * i] = 1;
+    }
+
+    clusterer.Cluster(msg, keep.data(), &identity, &primitives);
+
+    ASSERT_EQ((int)primitives.size(), 1);
+    EXPECT_EQ(primitives[0].num_points, 40);
+}
+
+TEST(StereoPointPipelineTest, ClusteringStage) {
+    StereoPointPipeline pipeline;
+
+    pipeline.EnableClustering(0.5, 1);
+
+    BotTrans identity;
+    bot_trans_set_identity(&identity);
+
+    lcmt::stereo msg = EmptyMsg(7);
+
+    AddPoint(5, 0, 0, &msg);
+    AddPoint(5, 0, 0.2, &msg);
+    AddPoint(5, 4, 0, &msg);
+
+    std::vector<uint8_t> keep(3, 1);
+
+    // without a transform there's nothing to cluster in
+    EXPECT_EQ(pipeline.Filter(msg, &keep), 3);
+    EXPECT_EQ(pipeline.GetStageStats(STEREO_STAGE_CLUSTER).messages.load(), 0);
+
+    // clustering doesn't drop any points
+    EXPECT_EQ(pipeline.Filter(msg, &identity, &keep), 3);
+
+    std::vector<StereoObstaclePrimitive> primitives;
+    int64_t timestamp;
+    int32_t frame_number;
+
+    pipeline.GetPrimitives(&primitives, &timestamp, &frame_number);
+
+    EXPECT_EQ((int)primitives.size(), 2);
+    EXPECT_EQ(timestamp, msg.timestamp);
+    EXPECT_EQ(frame_number, 7);
+    EXPECT_EQ(pipeline.GetStageStats(STEREO_STAGE_CLUSTER).points_out.load(), 3);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  ::testing::GTEST_FLAG(filter) = "StereoPointPipelineTest*:StereoHitClustererTest*";
+  return RUN_ALL_TESTS();
+}
@@ -8,15 +8,55 @@
 #include "../../LCM/lcmt_optotrak.h"
 #include "../../LCM/lcmt_optotrak_xhat.h"
 
+/*
+ * Converts optotrak rigid body messages to the plane's state (positions,
+ * angles and their rates) for one of the bodies.
+ *
+ * All of the bodies are converted in one pass over fixed-size arrays (so
+ * nothing is allocated per message and the loops vectorize), the rates
+ * use the real time between messages instead of assuming 100 Hz, and the
+ * time from the message arriving to it going back out is measured and
+ * printed every OPTOTRAK_LATENCY_REPORT_EVERY messages.
+ */
+
+#define MAX_RIGID_BODIES 16
+
+// a gap longer than this (usec) between messages starts the rates over
+#define OPTOTRAK_MAX_DT_USEC 100000
+
+#define OPTOTRAK_LATENCY_REPORT_EVERY 1000
 
 lcm_t * lcmSend;
 char *lcm_out = NULL;
-double lastX[10];
-double lastAngles[10];
+
+// which rigid body goes out
+int body_number = 0;
+
+// last frame's state for each body, in plane coordinates
+float lastX[MAX_RIGID_BODIES];
+float lastY[MAX_RIGID_BODIES];
+float lastZ[MAX_RIGID_BODIES];
+float lastYaw[MAX_RIGID_BODIES];
+float lastPitch[MAX_RIGID_BODIES];
+float lastRoll[MAX_RIGID_BODIES];
+int64_t last_utime = -1;
+
+// rates for each body
+float xDot[MAX_RIGID_BODIES];
+float yDot[MAX_RIGID_BODIES];
+float zDot[MAX_RIGID_BODIES];
+float yawDot[MAX_RIGID_BODIES];
+float pitchDot[MAX_RIGID_BODIES];
+float rollDot[MAX_RIGID_BODIES];
+
+// arrival to publish latency since the last report
+int64_t latency_sum = 0;
+int64_t latency_max = 0;
+int latency_count = 0;
 
 static void usage(void)
 {
-        fprintf(stderr, "usage: optotrak-estimator input-channel-name output-channel-name\n\n");
+        fprintf(stderr, "usage: optotrak-estimator input-channel-name output-channel-name [rigid-body-number]\n\n");
 }
 
 int stop=0;
@@ -26,73 +66,128 @@ void sighandler(int dum)
         stop=1;
 }
 
+int64_t getTimestampNow()
+{
+    struct timeval thisTime;
+    gettimeofday(&thisTime, NULL);
+    return (thisTime.tv_sec * 1000000.0) + (float)thisTime.tv_usec + 0.5;
+}
+
+/*
+ * Finite difference rates for n bodies.
+ */
+static void UpdateRates(int n, float inv_dt, const float * __restrict__ now, float * __restrict__ last, float * __restrict__ rate)
+{
+    int i;
 
+    for (i = 0; i < n; i++)
+    {
+        rate[i] = (now[i] - last[i]) * inv_dt;
+        last[i] = now[i];
+    }
+}
 
-void lcm_optotrak_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_optotrak *msg, void *user)
+static void ResetRates(int n, const float *now, float *last, float *rate)
 {
-    // convert message and send it via LCM
-    //printf("msg: %d\n", msg->event[2]);
-    
-    // convert
-    lcmt_optotrak_xhat msg2;
-    
     int i;
-    
-    double yaw[10];
-    double pitch[10];
-    double roll[10];
-    
-    
-    //yaw = yaw - 0.33;
-    //roll = roll + 0.1;
-    
+
+    for (i = 0; i < n; i++)
+    {
+        rate[i] = 0;
+        last[i] = now[i];
+    }
+}
+
+void lcm_optotrak_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_optotrak *msg, void *user)
+{
+    int n = msg->number_rigid_bodies;
+
+    if (n > MAX_RIGID_BODIES)
+    {
+        n = MAX_RIGID_BODIES;
+    }
+
+    if (body_number >= n)
+    {
+        return;
+    }
+
     // to convert aligned coordinates to plane coordinates, we switch
     // yaw and roll because optotrak has a different definition of which is which
-    
+    const float *yaw = msg->roll;
+    const float *pitch = msg->pitch;
+    const float *roll = msg->yaw;
+
+    int64_t utime = rbuf->recv_utime;
+    int64_t dt = utime - last_utime;
+
+    if (last_utime < 0 || dt <= 0 || dt > OPTOTRAK_MAX_DT_USEC)
+    {
+        ResetRates(n, msg->x, lastX, xDot);
+        ResetRates(n, msg->y, lastY, yDot);
+        ResetRates(n, msg->z, lastZ, zDot);
+        ResetRates(n, yaw, lastYaw, yawDot);
+        ResetRates(n, pitch, lastPitch, pitchDot);
+        ResetRates(n, roll, lastRoll, rollDot);
+    } else {
+        float inv_dt = 1000000.0f / dt;
+
+        UpdateRates(n, inv_dt, msg->x, lastX, xDot);
+        UpdateRates(n, inv_dt, msg->y, lastY, yDot);
+        UpdateRates(n, inv_dt, msg->z, lastZ, zDot);
+        UpdateRates(n, inv_dt, yaw, lastYaw, yawDot);
+        UpdateRates(n, inv_dt, pitch, lastPitch, pitchDot);
+        UpdateRates(n, inv_dt, roll, lastRoll, rollDot);
+    }
+
+    last_utime = utime;
+
+    int b = body_number;
 
-    yaw[0] = msg->roll[0]; //yaw[0];
-    pitch[0] = msg->pitch[0];
-    roll[0] = msg->yaw[0]; //roll[0];
+    lcmt_optotrak_xhat msg2;
+
+    msg2.positions[0] = msg->x[b];
+    msg2.positions[1] = msg->y[b];
+    msg2.positions[2] = msg->z[b];
+
+    msg2.angles[0] = yaw[b];
+    msg2.angles[1] = pitch[b];
+    msg2.angles[2] = roll[b];
+
+    msg2.positions_dot[0] = xDot[b];
+    msg2.positions_dot[1] = yDot[b];
+    msg2.positions_dot[2] = zDot[b];
+
+    msg2.angles_dot[0] = yawDot[b];
+    msg2.angles_dot[1] = pitchDot[b];
+    msg2.angles_dot[2] = rollDot[b];
+
+    // milliseconds, like it has always been
+    int64_t now = getTimestampNow();
+    msg2.timestamp = now / 1000;
 
-    double x[10];
-    double y[10];
-    double z[10];
-    
-    x[0] = msg->x[0];
-    y[0] = msg->y[0];
-    z[0] = msg->z[0];
-    
-    msg2.positions[0] = x[0];
-    msg2.positions[1] = y[0];
-    msg2.positions[2] = z[0];
-    
-    msg2.angles[0] = yaw[0];
-    msg2.angles[1] = pitch[0];
-    msg2.angles[2] = roll[0];
-    
-    
-    msg2.positions_dot[0] = (x[0] - lastX[0]) * 100;
-    msg2.positions_dot[1] = (y[0] - lastX[1]) * 100;
-    msg2.positions_dot[2] = (z[0] - lastX[2]) * 100;
-    
-    lastX[0] = x[0];
-    lastX[1] = y[0];
-    lastX[2] = z[0];
-    
-    msg2.angles_dot[0] = (yaw[0] - lastAngles[0]) * 100;
-    msg2.angles_dot[1] = (pitch[0] - lastAngles[1]) * 100;
-    msg2.angles_dot[2] = (roll[0] - lastAngles[2]) * 100;
-    
-    lastAngles[0] = yaw[0];
-    lastAngles[1] = pitch[0];
-    lastAngles[2] = roll[0];
-    
-    struct timeval thisTime;
-    gettimeofday(&thisTime, NULL);
-    msg2.timestamp = (thisTime.tv_sec * 1000.0) + (float)thisTime.tv_usec/1000.0 + 0.5;
-    
     // send via LCM
     lcmt_optotrak_xhat_publish (lcmSend, lcm_out, &msg2);
+
+    int64_t latency = getTimestampNow() - utime;
+
+    latency_sum += latency;
+    latency_count ++;
+
+    if (latency > latency_max)
+    {
+        latency_max = latency;
+    }
+
+    if (latency_count >= OPTOTRAK_LATENCY_REPORT_EVERY)
+    {
+        printf("arrival to publish: mean %.0f us, max %lld us over %d messages\n", latency_sum / (double)latency_count, (long long)latency_max, latency_count);
+        fflush(stdout);
+
+        latency_sum = 0;
+        latency_max = 0;
+        latency_count = 0;
+    }
 }
 
 
@@ -100,13 +195,22 @@ int main(int argc,char** argv)
 {
         char *lcm_in = NULL;
         
-        if (argc!=3) {
+        if (argc!=3 && argc!=4) {
             usage();
             exit(0);
         }
         
         lcm_in = argv[1];
         lcm_out = argv[2];
+
+        if (argc == 4) {
+            body_number = atoi(argv[3]);
+
+            if (body_number < 0 || body_number >= MAX_RIGID_BODIES) {
+                fprintf(stderr, "rigid body number must be 0 to %d.\n", MAX_RIGID_BODIES - 1);
+                return 1;
+            }
+        }
         
         lcm_t * lcm;
         lcm = lcm_create ("udpm://239.255.76.67:7667?ttl=0");
@@ -117,20 +221,9 @@ int main(int argc,char** argv)
         }
         
         
-        lcmSend = lcm_create ("udpm://239.255.76.67:7667?ttl=0");
-        if (!lcmSend)
-        {
-            fprintf(stderr, "lcm_create for send failed.  Quitting.\n");
-            return 1;
-        }
-        
-        int i;
-        // init lastX
-        for (i=0;i<9;i++)
-        {
-            lastX[i] = 0;
-            lastAngles[i] = 0;
-        }
+        // publish from the same instance, so the message goes straight out
+        // from the handler
+        lcmSend = lcm;
         
         lcmt_optotrak_subscription_t * optotrak_sub =  lcmt_optotrak_subscribe (lcm, lcm_in, &lcm_optotrak_handler, NULL);
 
@@ -0,0 +1,194 @@
+#include "WindEstimator.hpp"
+
+/**
+ * Forgets everything, going back to no wind and the starting covariance.
+ */
+void WindEstimator::Reset() {
+    for (int i = 0; i < 3; i++) {
+        theta_[i] = 0;
+
+        for (int j = 0; j < 3; j++) {
+            P_[i][j] = 0;
+        }
+    }
+
+    P_[0][0] = WIND_INITIAL_VARIANCE;
+    P_[1][1] = WIND_INITIAL_VARIANCE;
+    P_[2][2] = WIND_INITIAL_SQUARED_VARIANCE;
+
+    num_samples_ = 0;
+
+    velocity_utime_ = -1;
+    velocity_x_ = 0;
+    velocity_y_ = 0;
+}
+
+/**
+ * Remembers the latest ground velocity, for the next AddAirspeed().
+ *
+ * @param utime when the velocity was measured
+ * @param velocity_x ground velocity (m/s)
+ * @param velocity_y ground velocity (m/s)
+ */
+void WindEstimator::AddGroundVelocity(int64_t utime, double velocity_x, double velocity_y) {
+    velocity_utime_ = utime;
+    velocity_x_ = velocity_x;
+    velocity_y_ = velocity_y;
+}
+
+/**
+ * Updates the estimate with an airspeed and the latest ground velocity, if
+ * that's recent enough.
+ *
+ * @param utime when the airspeed was measured
+ * @param airspeed airspeed (m/s)
+ *
+ * @retval true if the estimate was updated
+ */
+bool WindEstimator::AddAirspeed(int64_t utime, double airspeed) {
+    if (velocity_utime_ < 0 || llabs(utime - velocity_utime_) > WIND_MAX_VELOCITY_AGE_USEC) {
+        return false;
+    }
+
+    return Update(velocity_x_, velocity_y_, airspeed);
+}
+
+/**
+ * One recursive least squares step.
+ *
+ * @param velocity_x ground velocity (m/s)
+ * @param velocity_y ground velocity (m/s)
+ * @param airspeed airspeed at the same time (m/s)
+ *
+ * @retval true if the estimate was updated (false on the ground)
+ */
+bool WindEstimator::Update(double velocity_x, double velocity_y, double airspeed) {
+    if (airspeed < WIND_MIN_AIRSPEED) {
+        return false;
+    }
+
+    velocity_x_ = velocity_x;
+    velocity_y_ = velocity_y;
+
+    // 2 v.w - |w|^2 = |v|^2 - a^2
+    double phi[3] = { 2 * velocity_x, 2 * velocity_y, -1 };
+    double y = velocity_x * velocity_x + velocity_y * velocity_y - airspeed * airspeed;
+
+    double P_phi[3];
+    double denominator = WIND_FORGETTING_FACTOR;
+    double prediction = 0;
+
+    for (int i = 0; i < 3; i++) {
+        P_phi[i] = P_[i][0] * phi[0] + P_[i][1] * phi[1] + P_[i][2] * phi[2];
+        denominator += phi[i] * P_phi[i];
+        prediction += phi[i] * theta_[i];
+    }
+
+    double error = y - prediction;
+
+    double gain[3];
+    for (int i = 0; i < 3; i++) {
+        gain[i] = P_phi[i] / denominator;
+        theta_[i] += gain[i] * error;
+    }
+
+    double trace = 0;
+
+    // P = (P - k phi' P) / lambda, and P is symmetric so phi' P = P_phi'
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            P_[i][j] -= gain[i] * P_phi[j];
+        }
+
+        trace += P_[i][i];
+    }
+
+    double scale = trace < WIND_MAX_COVARIANCE_TRACE ? 1.0 / WIND_FORGETTING_FACTOR : 1.0;
+
+    // scale, and keep it symmetric against rounding
+    for (int i = 0; i < 3; i++) {
+        P_[i][i] *= scale;
+
+        for (int j = i + 1; j < 3; j++) {
+            double value = 0.5 * (P_[i][j] + P_[j][i]) * scale;
+
+            P_[i][j] = value;
+            P_[j][i] = value;
+        }
+    }
+
+    num_samples_ ++;
+
+    return true;
+}
+
+void WindEstimator::GetEstimate(WindEstimate *estimate) const {
+    estimate->wind_x = theta_[0];
+    estimate->wind_y = theta_[1];
+    estimate->variance = P_[0][0] + P_[1][1];
+    estimate->num_samples = num_samples_;
+
+    estimate->valid = num_samples_ >= WIND_MIN_SAMPLES && estimate->variance < WIND_VALID_VARIANCE;
+}
+
+/**
+ * Speed over the ground, along the last ground velocity's direction, that
+ * goes with an airspeed and the wind estimate.
+ *
+ * @param airspeed airspeed (m/s)
+ *
+ * @retval ground speed (m/s), or the airspeed if there's no ground
+ *      velocity to take the direction from
+ */
+double WindEstimator::GetGroundSpeed(double airspeed) const {
+    double speed = sqrt(velocity_x_ * velocity_x_ + velocity_y_ * velocity_y_);
+
+    if (speed < 1e-3) {
+        return airspeed;
+    }
+
+    // |s u - w| = a, for the unit direction u
+    double u_dot_w = (velocity_x_ * theta_[0] + velocity_y_ * theta_[1]) / speed;
+    double wind_squared = theta_[0] * theta_[0] + theta_[1] * theta_[1];
+
+    double discriminant = airspeed * airspeed - wind_squared + u_dot_w * u_dot_w;
+
+    if (discriminant < 0) {
+        // wind stronger than the airspeed, from the side
+        return fmax(0, u_dot_w);
+    }
+
+    return fmax(0, u_dot_w + sqrt(discriminant));
+}
+
+/**
+ * Ground velocity from a GPS's speed and course.
+ *
+ * @param speed speed over the ground (m/s)
+ * @param heading_deg course over the ground, in degrees clockwise from north
+ * @param velocity_x (output) east velocity (m/s)
+ * @param velocity_y (output) north velocity (m/s)
+ */
+void WindEstimator::GpsToGroundVelocity(double speed, double heading_deg, double *velocity_x, double *velocity_y) {
+    double heading = heading_deg * M_PI / 180.0;
+
+    *velocity_x = speed * sin(heading);
+    *velocity_y = speed * cos(heading);
+}
+
+/**
+ * Ground velocity in the local frame from a pose's body frame velocity.
+ *
+ * @param orientation pose's quaternion (w, x, y, z), body to local
+ * @param velocity_body velocity in the body frame (m/s)
+ * @param velocity_x (output) local x velocity (m/s)
+ * @param velocity_y (output) local y velocity (m/s)
+ */
+void WindEstimator::PoseToGroundVelocity(const double orientation[4], const double velocity_body[3], double *velocity_x, double *velocity_y) {
+    double w = orientation[0], x = orientation[1], y = orientation[2], z = orientation[3];
+    double vx = velocity_body[0], vy = velocity_body[1], vz = velocity_body[2];
+
+    // first two rows of the rotation matrix
+    *velocity_x = (1 - 2 * (y * y + z * z)) * vx + 2 * (x * y - w * z) * vy + 2 * (x * z + w * y) * vz;
+    *velocity_y = 2 * (x * y + w * z) * vx + (1 - 2 * (x * x + z * z)) * vy + 2 * (y * z - w * x) * vz;
+}
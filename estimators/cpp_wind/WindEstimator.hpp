@@ -0,0 +1,96 @@
+#ifndef WIND_ESTIMATOR_HPP
+#define WIND_ESTIMATOR_HPP
+
+/*
+ * Estimates the horizontal wind from airspeed and ground velocity with
+ * recursive least squares, without needing the heading.  The air-relative
+ * velocity is the ground velocity minus the wind, and its length is the
+ * airspeed:
+ *
+ *   |v - w|^2 = a^2   =>   2 v.w - |w|^2 = |v|^2 - a^2
+ *
+ * which is linear in (w_x, w_y, |w|^2).  Each sample is one row of that,
+ * folded into a 3x3 covariance with a forgetting factor, so an update is a
+ * fixed amount of work with no allocation.  The wind shows up once the
+ * aircraft has flown in a few directions.
+ *
+ * Used by wind-estimator on its own, or inside the state machine so the
+ * estimate doesn't take an extra LCM hop.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <stdint.h>
+#include <math.h>
+
+// weight of a sample falls by this much per sample (at 50 Hz, samples
+// older than about 20 seconds stop mattering)
+#define WIND_FORGETTING_FACTOR 0.999
+
+// starting covariance of the wind (m/s)^2 and of |w|^2 (m/s)^4
+#define WIND_INITIAL_VARIANCE 100.0
+#define WIND_INITIAL_SQUARED_VARIANCE 10000.0
+
+// the covariance stops growing past this, so a long straight line
+// doesn't make the next turn throw the estimate around
+#define WIND_MAX_COVARIANCE_TRACE 20000.0
+
+// airspeeds below this (m/s) are on the ground and not used
+#define WIND_MIN_AIRSPEED 4.0
+
+// a ground velocity older than this (usec) isn't paired with an airspeed
+#define WIND_MAX_VELOCITY_AGE_USEC 200000
+
+// the estimate is valid after this many samples, once the wind's variance
+// (x plus y, (m/s)^2) is below WIND_VALID_VARIANCE
+#define WIND_MIN_SAMPLES 50
+#define WIND_VALID_VARIANCE 1.0
+
+struct WindEstimate {
+    bool valid;
+
+    // wind in the ground velocity's frame (m/s)
+    double wind_x;
+    double wind_y;
+
+    // variance of wind_x plus wind_y's, (m/s)^2
+    double variance;
+
+    int num_samples;
+};
+
+class WindEstimator {
+
+    public:
+        WindEstimator() { Reset(); }
+
+        void Reset();
+
+        void AddGroundVelocity(int64_t utime, double velocity_x, double velocity_y);
+        bool AddAirspeed(int64_t utime, double airspeed);
+
+        bool Update(double velocity_x, double velocity_y, double airspeed);
+
+        void GetEstimate(WindEstimate *estimate) const;
+
+        // speed over the ground along the last ground velocity's direction
+        // if the air-relative speed is airspeed
+        double GetGroundSpeed(double airspeed) const;
+
+        static void GpsToGroundVelocity(double speed, double heading_deg, double *velocity_x, double *velocity_y);
+        static void PoseToGroundVelocity(const double orientation[4], const double velocity_body[3], double *velocity_x, double *velocity_y);
+
+    private:
+        // (w_x, w_y, |w|^2) and its covariance
+        double theta_[3];
+        double P_[3][3];
+
+        int num_samples_;
+
+        int64_t velocity_utime_;
+        double velocity_x_;
+        double velocity_y_;
+};
+
+#endif
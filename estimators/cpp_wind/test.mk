@@ -0,0 +1,6 @@
+TARGET = test
+
+SOURCES = WindEstimator.cpp tests.cpp
+
+
+include ../../utils/make/flight.mk
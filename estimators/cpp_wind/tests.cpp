@@ -0,0 +1,137 @@
+#include "WindEstimator.hpp"
+#include "gtest/gtest.h"
+
+// flies a circle at airspeed in a steady wind, one sample per degree
+static void FlyCircle(WindEstimator *estimator, double airspeed, double wind_x, double wind_y, int degrees) {
+    for (int i = 0; i < degrees; i++) {
+        double heading = i * M_PI / 180.0;
+
+        estimator->Update(airspeed * cos(heading) + wind_x, airspeed * sin(heading) + wind_y, airspeed);
+    }
+}
+
+TEST(WindEstimator, NotValidAtFirst) {
+    WindEstimator estimator;
+
+    WindEstimate estimate;
+    estimator.GetEstimate(&estimate);
+
+    EXPECT_FALSE(estimate.valid);
+    EXPECT_EQ(estimate.num_samples, 0);
+}
+
+TEST(WindEstimator, FindsSteadyWind) {
+    WindEstimator estimator;
+
+    FlyCircle(&estimator, 12, 3, -2, 720);
+
+    WindEstimate estimate;
+    estimator.GetEstimate(&estimate);
+
+    EXPECT_TRUE(estimate.valid);
+    EXPECT_NEAR(estimate.wind_x, 3, 0.05);
+    EXPECT_NEAR(estimate.wind_y, -2, 0.05);
+}
+
+TEST(WindEstimator, FollowsWindChange) {
+    WindEstimator estimator;
+
+    FlyCircle(&estimator, 12, 3, -2, 720);
+
+    // the old wind is forgotten after a few thousand samples
+    FlyCircle(&estimator, 12, -1, 4, 10 * 360);
+
+    WindEstimate estimate;
+    estimator.GetEstimate(&estimate);
+
+    EXPECT_NEAR(estimate.wind_x, -1, 0.2);
+    EXPECT_NEAR(estimate.wind_y, 4, 0.2);
+}
+
+TEST(WindEstimator, IgnoresSlowAirspeed) {
+    WindEstimator estimator;
+
+    EXPECT_FALSE(estimator.Update(1, 1, 1));
+
+    WindEstimate estimate;
+    estimator.GetEstimate(&estimate);
+
+    EXPECT_EQ(estimate.num_samples, 0);
+}
+
+TEST(WindEstimator, StraightLineStaysBounded) {
+    WindEstimator estimator;
+
+    FlyCircle(&estimator, 12, 3, -2, 720);
+
+    // no turning tells it nothing new, but it shouldn't wander off
+    for (int i = 0; i < 100000; i++) {
+        estimator.Update(12 + 3, -2, 12);
+    }
+
+    WindEstimate estimate;
+    estimator.GetEstimate(&estimate);
+
+    EXPECT_NEAR(estimate.wind_x, 3, 0.1);
+    EXPECT_NEAR(estimate.wind_y, -2, 0.5);
+    EXPECT_TRUE(std::isfinite(estimate.variance));
+
+    FlyCircle(&estimator, 12, 3, -2, 360);
+    estimator.GetEstimate(&estimate);
+
+    EXPECT_NEAR(estimate.wind_x, 3, 0.05);
+    EXPECT_NEAR(estimate.wind_y, -2, 0.05);
+}
+
+TEST(WindEstimator, PairsAirspeedWithRecentVelocity) {
+    WindEstimator estimator;
+
+    // no ground velocity yet
+    EXPECT_FALSE(estimator.AddAirspeed(1000000, 12));
+
+    estimator.AddGroundVelocity(1000000, 12, 0);
+    EXPECT_TRUE(estimator.AddAirspeed(1000000 + WIND_MAX_VELOCITY_AGE_USEC / 2, 12));
+    EXPECT_FALSE(estimator.AddAirspeed(1000000 + WIND_MAX_VELOCITY_AGE_USEC * 2, 12));
+}
+
+TEST(WindEstimator, GroundSpeed) {
+    WindEstimator estimator;
+
+    FlyCircle(&estimator, 12, 3, 0, 720);
+
+    // heading downwind
+    estimator.Update(15, 0, 12);
+    EXPECT_NEAR(estimator.GetGroundSpeed(12), 15, 0.05);
+
+    // heading upwind
+    estimator.Update(-9, 0, 12);
+    EXPECT_NEAR(estimator.GetGroundSpeed(12), 9, 0.05);
+}
+
+TEST(WindEstimator, GpsToGroundVelocity) {
+    double x, y;
+
+    WindEstimator::GpsToGroundVelocity(10, 90, &x, &y);
+    EXPECT_NEAR(x, 10, 1e-9);
+    EXPECT_NEAR(y, 0, 1e-9);
+
+    WindEstimator::GpsToGroundVelocity(10, 0, &x, &y);
+    EXPECT_NEAR(x, 0, 1e-9);
+    EXPECT_NEAR(y, 10, 1e-9);
+}
+
+TEST(WindEstimator, PoseToGroundVelocity) {
+    double x, y;
+    double velocity_body[3] = { 10, 0, 0 };
+
+    double identity[4] = { 1, 0, 0, 0 };
+    WindEstimator::PoseToGroundVelocity(identity, velocity_body, &x, &y);
+    EXPECT_NEAR(x, 10, 1e-9);
+    EXPECT_NEAR(y, 0, 1e-9);
+
+    // yawed 90 degrees
+    double yawed[4] = { cos(M_PI / 4), 0, 0, sin(M_PI / 4) };
+    WindEstimator::PoseToGroundVelocity(yawed, velocity_body, &x, &y);
+    EXPECT_NEAR(x, 0, 1e-9);
+    EXPECT_NEAR(y, 10, 1e-9);
+}
@@ -1,5 +1,6 @@
 /*
- * Simple estimator for 3D wind based on airspeed and GPS velocities
+ * Estimates the horizontal wind from airspeed and GPS velocities (see
+ * WindEstimator.hpp)
  *
  * Author: Andrew Barry, <abarry@csail.mit.edu> 2013
  *
@@ -16,13 +17,15 @@ using namespace std;
 #include <ctype.h>
 #include <signal.h>
 #include <time.h>
-#include <mutex>
 #include <sys/time.h>
 
 #include "../../../Fixie/build/include/lcmtypes/mav_gps_data_t.h"
 #include "../../LCM/lcmt_wind_groundspeed.h"
 #include "../../LCM/lcmt_baro_airspeed.h"
 
+#include "WindEstimator.hpp"
+#include "../../utils/utils/Clock.hpp"
+
 lcm_t * lcm;
 
 char *channelWind = NULL;
@@ -30,14 +33,8 @@ char *channelWind = NULL;
 mav_gps_data_t_subscription_t * gpsSub;
 lcmt_baro_airspeed_subscription_t * baroAirSub;
 
-// global mutexes
-std::mutex gps_mutex;
-
-// globals for ensuring data has arrived
-bool gpsFlag = false;
-
-// globals for holding state between messages
-mav_gps_data_t *lastGpsMsg;
+// both handlers run from lcm_handle, so this needs no locking
+WindEstimator wind_estimator;
 
 static void usage(void)
 {
@@ -64,47 +61,47 @@ void sighandler(int dum)
     exit(0);
 }
 
-int64_t getTimestampNow()
-{
-    struct timeval thisTime;
-    gettimeofday(&thisTime, NULL);
-    return (thisTime.tv_sec * 1000000.0) + (float)thisTime.tv_usec + 0.5;
-}
-
 void gps_handler(const lcm_recv_buf_t *rbuf, const char* channel, const mav_gps_data_t *msg, void *user)
 {
-    gps_mutex.lock();
-    lastGpsMsg = mav_gps_data_t_copy(msg);
-    gps_mutex.unlock();
+    if (msg->gps_lock < 1) {
+        return;
+    }
+
+    double velocity_x, velocity_y;
+    WindEstimator::GpsToGroundVelocity(msg->speed, msg->heading, &velocity_x, &velocity_y);
 
-    gpsFlag = true;
+    // stamped with when it got here, since the airspeed is too
+    wind_estimator.AddGroundVelocity(GetWallNow(), velocity_x, velocity_y);
 }
 
 void baro_airspeed_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_baro_airspeed *msg, void *user)
 {
-    // get the gps mutex lock
-    gps_mutex.lock();
-
-    // TODO TODO TODO
+    int64_t now = GetWallNow();
 
-    // for now, just return the airspeed as the ground speed
+    wind_estimator.AddAirspeed(now, msg->airspeed);
 
-    // STUB STUB STUB STUB STUB
+    WindEstimate estimate;
+    wind_estimator.GetEstimate(&estimate);
 
     lcmt_wind_groundspeed windMsg;
-    windMsg.utime = getTimestampNow();
+    windMsg.utime = now;
 
     windMsg.airspeed = msg->airspeed;
-    windMsg.estimatedGroundSpeed = msg->airspeed; // TODO TODO
 
-    windMsg.wind_x = 0;
-    windMsg.wind_y = 0;
+    // no wind until the estimate has settled
+    if (estimate.valid) {
+        windMsg.estimatedGroundSpeed = wind_estimator.GetGroundSpeed(msg->airspeed);
+        windMsg.wind_x = estimate.wind_x;
+        windMsg.wind_y = estimate.wind_y;
+    } else {
+        windMsg.estimatedGroundSpeed = msg->airspeed;
+        windMsg.wind_x = 0;
+        windMsg.wind_y = 0;
+    }
+
     windMsg.wind_z = 0;
 
     lcmt_wind_groundspeed_publish (lcm, channelWind, &windMsg);
-
-    // unlock
-    gps_mutex.unlock();
 }
 
 
@@ -20,13 +20,6 @@
 
 mav::ins_t *ins_msg = NULL;
 
-int64_t getTimestampNow()
-{
-    struct timeval thisTime;
-    gettimeofday(&thisTime, NULL);
-    return (thisTime.tv_sec * 1000000.0) + (float)thisTime.tv_usec + 0.5;
-}
-
 class InsHandler
 {
     public:
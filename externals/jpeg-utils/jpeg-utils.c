@@ -4,6 +4,10 @@
 #include <jpeglib.h>
 #include <jerror.h>
 
+#ifdef USE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
 #include "jpeg-utils.h"
 
 static void
@@ -243,3 +247,299 @@ jpeg_compress_8u_bgra (const uint8_t * src, int width, int height, int stride,
     jpeg_destroy_compress (&cinfo);
     return 0;
 }
+
+static int
+valid_scale_denom (int scale_denom)
+{
+    return scale_denom == 1 || scale_denom == 2 || scale_denom == 4 ||
+        scale_denom == 8;
+}
+
+int
+jpeg_utils_scaled_size (int size, int scale_denom)
+{
+    return (size + scale_denom - 1) / scale_denom;
+}
+
+#ifdef USE_TURBOJPEG
+
+struct _jpeg_utils_compressor {
+    tjhandle handle;
+
+    // for callers whose buffer is smaller than tjBufSize(), which TurboJPEG
+    // needs to compress straight into it.  Grown by TurboJPEG and kept.
+    unsigned char * buffer;
+    unsigned long buffer_size;
+};
+
+struct _jpeg_utils_decompressor {
+    tjhandle handle;
+};
+
+jpeg_utils_compressor_t *
+jpeg_utils_compressor_new (void)
+{
+    jpeg_utils_compressor_t * compressor =
+        (jpeg_utils_compressor_t *) calloc (1, sizeof (jpeg_utils_compressor_t));
+
+    compressor->handle = tjInitCompress ();
+    if (!compressor->handle) {
+        fprintf (stderr, "Error: tjInitCompress failed: %s\n", tjGetErrorStr ());
+        free (compressor);
+        return NULL;
+    }
+    return compressor;
+}
+
+void
+jpeg_utils_compressor_destroy (jpeg_utils_compressor_t * compressor)
+{
+    if (!compressor)
+        return;
+    tjDestroy (compressor->handle);
+    if (compressor->buffer)
+        tjFree (compressor->buffer);
+    free (compressor);
+}
+
+int
+jpeg_utils_compress_8u_gray (jpeg_utils_compressor_t * compressor,
+        const uint8_t * src, int width, int height, int stride,
+        uint8_t * dest, int * destsize, int quality)
+{
+    unsigned long out_size = *destsize;
+
+    if (out_size >= tjBufSize (width, height, TJSAMP_GRAY)) {
+        unsigned char * out = dest;
+
+        if (tjCompress2 (compressor->handle, (unsigned char *) src, width,
+                    stride, height, TJPF_GRAY, &out, &out_size, TJSAMP_GRAY,
+                    quality, TJFLAG_NOREALLOC) != 0) {
+            fprintf (stderr, "Error: tjCompress2 failed: %s\n", tjGetErrorStr ());
+            return -1;
+        }
+        *destsize = out_size;
+        return 0;
+    }
+
+    out_size = compressor->buffer_size;
+    if (tjCompress2 (compressor->handle, (unsigned char *) src, width,
+                stride, height, TJPF_GRAY, &compressor->buffer, &out_size,
+                TJSAMP_GRAY, quality, 0) != 0) {
+        fprintf (stderr, "Error: tjCompress2 failed: %s\n", tjGetErrorStr ());
+        return -1;
+    }
+    if (out_size > compressor->buffer_size)
+        compressor->buffer_size = out_size;
+
+    if (out_size > (unsigned long) *destsize) {
+        fprintf (stderr, "Error: JPEG compressor ran out of buffer space\n");
+        return -1;
+    }
+    memcpy (dest, compressor->buffer, out_size);
+    *destsize = out_size;
+    return 0;
+}
+
+jpeg_utils_decompressor_t *
+jpeg_utils_decompressor_new (void)
+{
+    jpeg_utils_decompressor_t * decompressor =
+        (jpeg_utils_decompressor_t *) calloc (1, sizeof (jpeg_utils_decompressor_t));
+
+    decompressor->handle = tjInitDecompress ();
+    if (!decompressor->handle) {
+        fprintf (stderr, "Error: tjInitDecompress failed: %s\n", tjGetErrorStr ());
+        free (decompressor);
+        return NULL;
+    }
+    return decompressor;
+}
+
+void
+jpeg_utils_decompressor_destroy (jpeg_utils_decompressor_t * decompressor)
+{
+    if (!decompressor)
+        return;
+    tjDestroy (decompressor->handle);
+    free (decompressor);
+}
+
+int
+jpeg_utils_decompress_8u_gray (jpeg_utils_decompressor_t * decompressor,
+        const uint8_t * src, int src_size, uint8_t * dest,
+        int width, int height, int stride, int scale_denom)
+{
+    int jpeg_width, jpeg_height, jpeg_subsamp;
+
+    if (!valid_scale_denom (scale_denom)) {
+        fprintf (stderr, "Error: can't decompress JPEG at 1/%d scale\n", scale_denom);
+        return -1;
+    }
+
+    if (tjDecompressHeader2 (decompressor->handle, (unsigned char *) src,
+                src_size, &jpeg_width, &jpeg_height, &jpeg_subsamp) != 0) {
+        fprintf (stderr, "Error: tjDecompressHeader2 failed: %s\n", tjGetErrorStr ());
+        return -1;
+    }
+
+    if (jpeg_width != width || jpeg_height != height) {
+        fprintf (stderr, "Error: Buffer was %dx%d but JPEG image is %dx%d\n",
+                width, height, jpeg_width, jpeg_height);
+        return -1;
+    }
+
+    // TurboJPEG picks the largest scale that fits in the size it's given
+    if (tjDecompress2 (decompressor->handle, (unsigned char *) src, src_size,
+                dest, jpeg_utils_scaled_size (width, scale_denom), stride,
+                jpeg_utils_scaled_size (height, scale_denom), TJPF_GRAY, 0) != 0) {
+        fprintf (stderr, "Error: tjDecompress2 failed: %s\n", tjGetErrorStr ());
+        return -1;
+    }
+    return 0;
+}
+
+#else
+
+struct _jpeg_utils_compressor {
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    struct jpeg_destination_mgr jdest;
+};
+
+struct _jpeg_utils_decompressor {
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    struct jpeg_source_mgr jsrc;
+};
+
+jpeg_utils_compressor_t *
+jpeg_utils_compressor_new (void)
+{
+    jpeg_utils_compressor_t * compressor =
+        (jpeg_utils_compressor_t *) calloc (1, sizeof (jpeg_utils_compressor_t));
+
+    compressor->cinfo.err = jpeg_std_error (&compressor->jerr);
+    jpeg_create_compress (&compressor->cinfo);
+
+    compressor->jdest.init_destination = init_destination;
+    compressor->jdest.empty_output_buffer = empty_output_buffer;
+    compressor->jdest.term_destination = term_destination;
+    compressor->cinfo.dest = &compressor->jdest;
+    return compressor;
+}
+
+void
+jpeg_utils_compressor_destroy (jpeg_utils_compressor_t * compressor)
+{
+    if (!compressor)
+        return;
+    jpeg_destroy_compress (&compressor->cinfo);
+    free (compressor);
+}
+
+int
+jpeg_utils_compress_8u_gray (jpeg_utils_compressor_t * compressor,
+        const uint8_t * src, int width, int height, int stride,
+        uint8_t * dest, int * destsize, int quality)
+{
+    struct jpeg_compress_struct * cinfo = &compressor->cinfo;
+    int out_size = *destsize;
+
+    compressor->jdest.next_output_byte = dest;
+    compressor->jdest.free_in_buffer = out_size;
+
+    cinfo->image_width = width;
+    cinfo->image_height = height;
+    cinfo->input_components = 1;
+    cinfo->in_color_space = JCS_GRAYSCALE;
+    jpeg_set_defaults (cinfo);
+    jpeg_set_quality (cinfo, quality, TRUE);
+
+    jpeg_start_compress (cinfo, TRUE);
+    while (cinfo->next_scanline < height) {
+        JSAMPROW row = (JSAMPROW)(src + cinfo->next_scanline * stride);
+        jpeg_write_scanlines (cinfo, &row, 1);
+    }
+    jpeg_finish_compress (cinfo);
+    *destsize = out_size - compressor->jdest.free_in_buffer;
+    return 0;
+}
+
+jpeg_utils_decompressor_t *
+jpeg_utils_decompressor_new (void)
+{
+    jpeg_utils_decompressor_t * decompressor =
+        (jpeg_utils_decompressor_t *) calloc (1, sizeof (jpeg_utils_decompressor_t));
+
+    decompressor->cinfo.err = jpeg_std_error (&decompressor->jerr);
+    decompressor->jerr.emit_message = jpeg_err_emit_message;
+    jpeg_create_decompress (&decompressor->cinfo);
+
+    decompressor->jsrc.init_source = init_source;
+    decompressor->jsrc.fill_input_buffer = fill_input_buffer;
+    decompressor->jsrc.skip_input_data = skip_input_data;
+    decompressor->jsrc.resync_to_restart = jpeg_resync_to_restart;
+    decompressor->jsrc.term_source = term_source;
+    decompressor->cinfo.src = &decompressor->jsrc;
+    return decompressor;
+}
+
+void
+jpeg_utils_decompressor_destroy (jpeg_utils_decompressor_t * decompressor)
+{
+    if (!decompressor)
+        return;
+    jpeg_destroy_decompress (&decompressor->cinfo);
+    free (decompressor);
+}
+
+int
+jpeg_utils_decompress_8u_gray (jpeg_utils_decompressor_t * decompressor,
+        const uint8_t * src, int src_size, uint8_t * dest,
+        int width, int height, int stride, int scale_denom)
+{
+    struct jpeg_decompress_struct * cinfo = &decompressor->cinfo;
+    int out_width, out_height;
+
+    if (!valid_scale_denom (scale_denom)) {
+        fprintf (stderr, "Error: can't decompress JPEG at 1/%d scale\n", scale_denom);
+        return -1;
+    }
+
+    decompressor->jsrc.next_input_byte = src;
+    decompressor->jsrc.bytes_in_buffer = src_size;
+
+    jpeg_read_header (cinfo, TRUE);
+
+    if (cinfo->image_width != width || cinfo->image_height != height) {
+        fprintf (stderr, "Error: Buffer was %dx%d but JPEG image is %dx%d\n",
+                width, height, cinfo->image_width, cinfo->image_height);
+        jpeg_abort_decompress (cinfo);
+        return -1;
+    }
+
+    cinfo->out_color_space = JCS_GRAYSCALE;
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = scale_denom;
+    jpeg_start_decompress (cinfo);
+
+    out_width = jpeg_utils_scaled_size (width, scale_denom);
+    out_height = jpeg_utils_scaled_size (height, scale_denom);
+
+    if (cinfo->output_width != out_width || cinfo->output_height != out_height) {
+        fprintf (stderr, "Error: JPEG decompressed to %dx%d, expected %dx%d\n",
+                cinfo->output_width, cinfo->output_height, out_width, out_height);
+        jpeg_abort_decompress (cinfo);
+        return -1;
+    }
+
+    while (cinfo->output_scanline < out_height) {
+        uint8_t * row = dest + cinfo->output_scanline * stride;
+        jpeg_read_scanlines (cinfo, &row, 1);
+    }
+    jpeg_finish_decompress (cinfo);
+    return 0;
+}
+
+#endif
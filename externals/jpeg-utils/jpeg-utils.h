@@ -58,6 +58,55 @@ int
 jpeg_compress_8u_bgra (const uint8_t * src, int width, int height, int stride,
         uint8_t * dest, int * destsize, int quality);
 
+/**
+ * Reusable compressor and decompressor.  The functions above set up and
+ * tear down a codec on every call; these keep one between images, and use
+ * TurboJPEG (libjpeg-turbo's SIMD API) when built with -DUSE_TURBOJPEG
+ * (make TURBOJPEG=1).  A handle may only be used by one thread at a time.
+ */
+typedef struct _jpeg_utils_compressor jpeg_utils_compressor_t;
+typedef struct _jpeg_utils_decompressor jpeg_utils_decompressor_t;
+
+jpeg_utils_compressor_t *
+jpeg_utils_compressor_new (void);
+
+void
+jpeg_utils_compressor_destroy (jpeg_utils_compressor_t * compressor);
+
+/**
+ * Same as jpeg_compress_8u_gray(), with a reusable compressor.
+ */
+int
+jpeg_utils_compress_8u_gray (jpeg_utils_compressor_t * compressor,
+        const uint8_t * src, int width, int height, int stride,
+        uint8_t * dest, int * destsize, int quality);
+
+jpeg_utils_decompressor_t *
+jpeg_utils_decompressor_new (void);
+
+void
+jpeg_utils_decompressor_destroy (jpeg_utils_decompressor_t * decompressor);
+
+/**
+ * Size of one side of an image decoded at 1/scale_denom.
+ */
+int
+jpeg_utils_scaled_size (int size, int scale_denom);
+
+/**
+ * @width, @height: size of the JPEG image, not of the output
+ * @scale_denom: 1, 2, 4 or 8.  Decodes at 1/scale_denom of the size in the
+ * DCT domain, which is much cheaper than decoding and shrinking.  dest must
+ * hold jpeg_utils_scaled_size(width, scale_denom) x
+ * jpeg_utils_scaled_size(height, scale_denom) pixels.
+ *
+ * Same as jpeg_decompress_8u_gray(), with a reusable decompressor.
+ */
+int
+jpeg_utils_decompress_8u_gray (jpeg_utils_decompressor_t * decompressor,
+        const uint8_t * src, int src_size, uint8_t * dest,
+        int width, int height, int stride, int scale_denom);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,67 @@
+function d = loadLogColumns(directory)
+% Memory-maps a log converted with log_to_columns.py.  Nothing is read until
+% it's used, so opening a whole flight is instant.
+%
+% d.(channel).(field) is a memmapfile whose .Data.x is values-by-messages:
+% one column per message, since that's how the file is laid out (a row for
+% one value per message).  Ragged fields (variable-length arrays and
+% strings) are flat, .Data is the values and d.(channel).([field '_offsets'])
+% says where each message's start (0-based, messages + 1 of them).
+%
+% Channel and field names have anything MATLAB can't use as a name
+% replaced with '_' ("pts.x" is pts_x).
+%
+% Example:
+%   d = loadLogColumns('lcmlog-2015-05-01.00.columns');
+%   pose = d.STATE_ESTIMATOR_POSE;
+%   plot(double(pose.log_utime.Data.x) / 1e6, pose.pos.Data.x(3, :));
+
+types = struct('int8', 'int8', 'int16', 'int16', 'int32', 'int32', 'int64', 'int64', ...
+    'uint8', 'uint8', 'float32', 'single', 'float64', 'double');
+
+fid = fopen(fullfile(directory, 'columns.txt'));
+
+if fid < 0
+    error('loadLogColumns:noManifest', 'No columns.txt in %s', directory);
+end
+
+manifest = textscan(fid, '%s %s %s %d64 %s', 'CommentStyle', '#');
+fclose(fid);
+
+d = struct();
+
+for i = 1 : length(manifest{1})
+    channel = manifest{1}{i};
+    field = manifest{2}{i};
+    type = types.(manifest{3}{i});
+    num_messages = double(manifest{4}(i));
+    shape = manifest{5}{i};
+
+    path = fullfile(directory, regexprep(channel, '[^A-Za-z0-9_.-]', '_'), field);
+
+    channel_name = matlab.lang.makeValidName(channel, 'ReplacementStyle', 'underscore');
+    field_name = matlab.lang.makeValidName(field, 'ReplacementStyle', 'underscore');
+
+    if strcmp(shape, 'ragged')
+        d.(channel_name).([field_name '_offsets']) = memmapfile([path '.offsets.bin'], ...
+            'Format', 'int64');
+        format = type;
+        repeat = Inf;
+    else
+        values = prod(str2double(strsplit(shape, 'x')));
+        format = {type, [values num_messages], 'x'};
+        repeat = 1;
+    end
+
+    % memmapfile can't map an empty file
+    info = dir([path '.bin']);
+
+    if num_messages == 0 || info.bytes == 0
+        d.(channel_name).(field_name) = [];
+        continue;
+    end
+
+    d.(channel_name).(field_name) = memmapfile([path '.bin'], 'Format', format, 'Repeat', repeat);
+end
+
+end
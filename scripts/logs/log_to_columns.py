@@ -0,0 +1,556 @@
+#!/usr/bin/python
+#
+# Converts a LCM log to columns: one flat binary file per field of each
+# channel, plus a manifest, so a whole flight's worth of one field can be
+# memory-mapped (numpy.memmap, MATLAB's memmapfile, or LogColumns.hpp in C++)
+# instead of loading the whole log like log_to_mat.py's .mat files.
+#
+# Channels are converted in parallel, one process per core.  If the log has
+# an up-to-date index from utils/LogIndex (lcmlog-xxx.idx, from log-index or
+# any playback tool) it is used to find each channel's messages; otherwise
+# the log's event headers are read once first.
+#
+# Layout of the output directory (lcmlog-xxx.columns by default):
+#
+#   columns.txt                       the manifest, see below
+#   <channel>/log_utime.bin           int64: when the log got each message
+#   <channel>/<field>.bin             the field, one row per message
+#   <channel>/<field>.offsets.bin     for variable-length fields: int64,
+#                                     messages + 1 of them, where each
+#                                     message's values start in <field>.bin
+#
+# Nested types are flattened to "parent.child".  Every file is a raw
+# little-endian array with no header.  Each line of columns.txt is
+#
+#   <channel> <field> <type> <messages> <shape>
+#
+# where <type> is int8, int16, int32, int64, uint8, float32 or float64 and
+# <shape> is the values per message ("1", "3", "4x4") or "ragged" if it
+# varies (strings are ragged uint8).
+#
+# Usage is like log_to_mat.py:
+#
+#   log_to_columns.py -l lcmt_stereo,pose_t lcmlog-2015-05-01.00
+#
+# and in Python:
+#
+#   from log_to_columns import load_columns
+#   d = load_columns('lcmlog-2015-05-01.00.columns')
+#   plot(d['STATE_ESTIMATOR_POSE']['log_utime'], d['STATE_ESTIMATOR_POSE']['pos'][:, 2])
+
+from __future__ import print_function
+
+import os
+import sys
+import re
+import struct
+import array
+import shutil
+import getopt
+import multiprocessing
+
+LCM_SYNC = 0xEDA1DA01
+LCM_EVENT_HEADER = struct.Struct('>IqqII')
+
+LOG_INDEX_MAGIC = b'LCMIDX01'
+LOG_INDEX_EVENT = struct.Struct('=qqII')
+
+MANIFEST_NAME = 'columns.txt'
+
+# messages buffered per column before writing
+CHUNK_MESSAGES = 4096
+
+# python 2's array has no 'q', but 'l' is 64 bits on 64-bit Linux
+try:
+    array.array('q')
+    INT64_TYPECODE = 'q'
+except ValueError:
+    INT64_TYPECODE = 'l'
+    assert array.array('l').itemsize == 8, 'needs a 64-bit python'
+
+# LCM type -> (column type, array typecode)
+PRIMITIVES = {
+    'int8_t': ('int8', 'b'),
+    'int16_t': ('int16', 'h'),
+    'int32_t': ('int32', 'i'),
+    'int64_t': ('int64', INT64_TYPECODE),
+    'float': ('float32', 'f'),
+    'double': ('float64', 'd'),
+    'boolean': ('uint8', 'B'),
+    'byte': ('uint8', 'B'),
+    'string': ('uint8', 'B'),
+}
+
+
+def usage():
+    pname, sname = os.path.split(sys.argv[0])
+    sys.stderr.write("usage: %s [options] <filename>\n" % sname)
+    print("""
+    -h --help                 print this message
+    -c --channels=chan        Convert channels that match Python regex [chan] defaults to [".*"]
+    -i --ignore=chan          Ignore channels that match Python regex [chan]
+                              ignores take precedence over includes!
+    -o --outdir=dir           write the columns to [dir] instead of [filename.columns]
+    -l --lcm_packages=pkgs    load python modules from comma seperated list of packages [pkgs]
+    -j --jobs=n               convert [n] channels at once, defaults to the number of cores
+    -v                        Verbose
+    """)
+    sys.exit()
+
+
+class LCMTypeDatabase:
+    def __init__(self, package_names, verbose):
+        self.klasses = {}
+
+        for p in package_names:
+            try:
+                __import__(p)
+            except ImportError:
+                if verbose:
+                    sys.stderr.write("couldn't load module %s\n" % p)
+                continue
+
+            pkg = sys.modules[p]
+
+            for mname in dir(pkg):
+                module = getattr(pkg, mname)
+
+                if hasattr(module, '_get_packed_fingerprint') and hasattr(module, '__typenames__'):
+                    self.klasses[module._get_packed_fingerprint()] = module
+
+    def find_type(self, packed_fingerprint):
+        return self.klasses.get(packed_fingerprint, None)
+
+    def find_type_by_name(self, typename, parent):
+        # nested fields name their type with its package ("mav.pose_t"),
+        # lcm-gen's classes know only the short name
+        short_name = typename.split('.')[-1]
+
+        for klass in self.klasses.values():
+            if klass.__name__ == short_name:
+                return klass
+
+        # not loaded with -l, but the parent type's module imported it
+        nested = getattr(sys.modules[parent.__module__], short_name, None)
+
+        if nested is not None and not hasattr(nested, '__slots__'):
+            nested = getattr(nested, short_name, None)
+
+        return nested
+
+
+def read_event_headers(fname):
+    """Returns {channel: [(offset, timestamp, data offset, data length)]}.
+    Uses the log's index if it has a current one."""
+
+    events = read_log_index(fname)
+
+    if events is not None:
+        return events
+
+    events = {}
+    log_size = os.path.getsize(fname)
+
+    with open(fname, 'rb') as log:
+        offset = 0
+
+        while True:
+            header = log.read(LCM_EVENT_HEADER.size)
+
+            if len(header) < LCM_EVENT_HEADER.size:
+                break
+
+            sync, event_number, timestamp, channel_len, data_len = LCM_EVENT_HEADER.unpack(header)
+            event_size = LCM_EVENT_HEADER.size + channel_len + data_len
+
+            if sync != LCM_SYNC:
+                sys.stderr.write("warning: corrupt event at offset %d, stopping there\n" % offset)
+                break
+
+            if offset + event_size > log_size:
+                break
+
+            channel = log.read(channel_len).decode('ascii', 'replace')
+            log.seek(data_len, os.SEEK_CUR)
+
+            events.setdefault(channel, []).append(
+                (offset, timestamp, offset + LCM_EVENT_HEADER.size + channel_len, data_len))
+
+            offset += event_size
+
+    return events
+
+
+def read_log_index(fname):
+    """Reads utils/LogIndex's index file, if there is one that matches the
+    log.  Returns None if not."""
+
+    try:
+        index = open(fname + '.idx', 'rb')
+    except IOError:
+        return None
+
+    with index:
+        stat = os.stat(fname)
+
+        if index.read(8) != LOG_INDEX_MAGIC:
+            return None
+
+        log_size, log_mtime, num_channels = struct.unpack('=qqI', index.read(20))
+
+        if log_size != stat.st_size or log_mtime != int(stat.st_mtime):
+            return None
+
+        channels = []
+
+        for i in range(num_channels):
+            length, = struct.unpack('=I', index.read(4))
+            channels.append(index.read(length).decode('ascii', 'replace'))
+
+        num_events, = struct.unpack('=Q', index.read(8))
+
+        events = {}
+
+        for i in range(num_events):
+            timestamp, offset, channel, data_len = LOG_INDEX_EVENT.unpack(index.read(LOG_INDEX_EVENT.size))
+            name = channels[channel]
+
+            events.setdefault(name, []).append(
+                (offset, timestamp, offset + LCM_EVENT_HEADER.size + len(name), data_len))
+
+    return events
+
+
+def is_fixed(dims):
+    for dim in dims:
+        if not isinstance(dim, int):
+            return False
+    return True
+
+
+class Column:
+    """One field of one channel, written out in chunks."""
+
+    def __init__(self, directory, name, typename, shape):
+        self.name = name
+        self.type, self.typecode = PRIMITIVES[typename]
+        self.shape = shape  # None for ragged
+
+        self.values = array.array(self.typecode)
+        self.out = open(os.path.join(directory, name + '.bin'), 'wb')
+
+        if shape is None:
+            self.count = 0
+            self.offsets = array.array(INT64_TYPECODE, [0])
+            self.offsets_out = open(os.path.join(directory, name + '.offsets.bin'), 'wb')
+
+    def end_message(self, start):
+        if self.shape is None:
+            self.count += len(self.values) - start
+            self.offsets.append(self.count)
+
+    def flush(self):
+        self.values.tofile(self.out)
+        del self.values[:]
+
+        if self.shape is None:
+            self.offsets.tofile(self.offsets_out)
+            del self.offsets[:]
+
+    def close(self):
+        self.flush()
+        self.out.close()
+
+        if self.shape is None:
+            self.offsets_out.close()
+
+    def shape_string(self):
+        if self.shape is None:
+            return 'ragged'
+        if len(self.shape) == 0:
+            return '1'
+        return 'x'.join(str(d) for d in self.shape)
+
+
+class ChannelWriter:
+    """Flattens each message of one LCM type into columns."""
+
+    def __init__(self, directory, lcmtype):
+        self.directory = directory
+        self.columns = []
+
+        self.utime = Column(directory, 'log_utime', 'int64_t', [])
+        self.plan = self.make_plan(lcmtype, '', [])
+
+        self.num_messages = 0
+
+    def make_plan(self, lcmtype, prefix, outer_dims):
+        # [(field, typename, column)] with the column a sub-plan for nested
+        # types.  Fields inside arrays of nested types are ragged unless
+        # every array around them is fixed size
+        plan = []
+
+        for name, typename, dims in zip(lcmtype.__slots__, lcmtype.__typenames__, lcmtype.__dimensions__):
+            dims = outer_dims + list(dims or [])
+
+            if typename in PRIMITIVES:
+                fixed = typename != 'string' and is_fixed(dims)
+                column = Column(self.directory, prefix + name, typename, dims if fixed else None)
+
+                self.columns.append(column)
+                plan.append((name, typename, column))
+            else:
+                nested = type_db.find_type_by_name(typename, lcmtype)
+
+                if nested is None:
+                    raise KeyError('no type %s (used in %s), add it with -l' % (typename, lcmtype.__name__))
+
+                plan.append((name, None, self.make_plan(nested, prefix + name + '.', dims)))
+
+        return plan
+
+    def add(self, msg, timestamp):
+        starts = [len(c.values) for c in self.columns]
+
+        append_fields(self.plan, msg)
+
+        for column, start in zip(self.columns, starts):
+            column.end_message(start)
+
+        self.utime.values.append(timestamp)
+        self.num_messages += 1
+
+        if self.num_messages % CHUNK_MESSAGES == 0:
+            self.flush()
+
+    def flush(self):
+        self.utime.flush()
+
+        for column in self.columns:
+            column.flush()
+
+    def close(self):
+        self.utime.close()
+
+        for column in self.columns:
+            column.close()
+
+
+def append_fields(plan, msg):
+    for name, typename, column in plan:
+        value = getattr(msg, name)
+
+        if typename is not None:
+            append_values(column, value, typename)
+        else:
+            append_nested(column, value)
+
+
+def append_nested(plan, value):
+    # arrays of a nested type put one value per element in each column
+    if isinstance(value, (list, tuple)):
+        for element in value:
+            append_nested(plan, element)
+    else:
+        append_fields(plan, value)
+
+
+def append_values(column, value, typename):
+    if typename == 'string':
+        column.values.extend(bytearray(value.encode('utf-8') if not isinstance(value, bytes) else value))
+    elif typename == 'byte' and isinstance(value, (bytes, bytearray, str)):
+        column.values.extend(bytearray(value))
+    elif isinstance(value, (list, tuple)):
+        for v in value:
+            append_values(column, v, typename)
+    elif typename == 'boolean':
+        column.values.append(1 if value else 0)
+    else:
+        column.values.append(value)
+
+
+def convert_channel(args):
+    fname, outdir, channel, events = args
+
+    directory = os.path.join(outdir, channel_dir(channel))
+
+    writer = None
+    num_failed = 0
+
+    with open(fname, 'rb') as log:
+        for offset, timestamp, data_offset, data_len in events:
+            log.seek(data_offset)
+            data = log.read(data_len)
+
+            if writer is None:
+                lcmtype = type_db.find_type(data[:8])
+
+                if lcmtype is None:
+                    return (channel, None, 'unknown type')
+
+                if not os.path.isdir(directory):
+                    os.makedirs(directory)
+
+                try:
+                    writer = ChannelWriter(directory, lcmtype)
+                except KeyError as err:
+                    shutil.rmtree(directory)
+                    return (channel, None, str(err))
+
+            try:
+                msg = lcmtype.decode(data)
+            except Exception:
+                num_failed += 1
+                continue
+
+            writer.add(msg, timestamp)
+
+    writer.close()
+
+    manifest = [(channel, c.name, c.type, writer.num_messages, c.shape_string())
+        for c in [writer.utime] + writer.columns]
+
+    note = '%d messages' % writer.num_messages
+
+    if num_failed > 0:
+        note += ', %d did not decode' % num_failed
+
+    return (channel, manifest, note)
+
+
+def channel_dir(channel):
+    return re.sub(r'[^A-Za-z0-9_.-]', '_', channel)
+
+
+def load_columns(directory):
+    """Memory-maps a directory written by this script.  Returns
+    {channel: {field: numpy array}}, with {field + '.offsets': ...} too for
+    ragged fields."""
+
+    import numpy
+
+    d = {}
+
+    with open(os.path.join(directory, MANIFEST_NAME)) as manifest:
+        for line in manifest:
+            if line.startswith('#') or not line.strip():
+                continue
+
+            channel, field, dtype, rows, shape = line.split()
+            rows = int(rows)
+
+            path = os.path.join(directory, channel_dir(channel), field)
+            columns = d.setdefault(channel, {})
+
+            if shape == 'ragged':
+                offsets = numpy.memmap(path + '.offsets.bin', dtype='<i8', mode='r')
+                columns[field + '.offsets'] = offsets
+                columns[field] = numpy.memmap(path + '.bin', dtype='<' + numpy.dtype(dtype).str[1:], mode='r') \
+                    if offsets[-1] > 0 else numpy.zeros(0, dtype=dtype)
+            else:
+                row_shape = tuple(int(s) for s in shape.split('x')) if shape != '1' else ()
+
+                if rows == 0:
+                    columns[field] = numpy.zeros((0,) + row_shape, dtype=dtype)
+                else:
+                    columns[field] = numpy.memmap(path + '.bin', dtype=numpy.dtype(dtype).newbyteorder('<'),
+                        mode='r', shape=(rows,) + row_shape)
+
+    return d
+
+
+type_db = None
+
+
+def main():
+    global type_db
+
+    longOpts = ["help", "channels=", "ignore=", "outdir=", "lcm_packages=", "jobs="]
+
+    try:
+        opts, args = getopt.gnu_getopt(sys.argv[1:], "hvc:i:o:l:j:", longOpts)
+    except getopt.GetoptError as err:
+        print(str(err))
+        usage()
+
+    if len(args) != 1:
+        usage()
+
+    fname = args[0]
+    outdir = fname + '.columns'
+    lcm_packages = ["botlcm"]
+    channels_to_process = ".*"
+    channels_to_ignore = None
+    jobs = multiprocessing.cpu_count()
+    verbose = False
+
+    for o, a in opts:
+        if o == "-v":
+            verbose = True
+        elif o in ("-h", "--help"):
+            usage()
+        elif o in ("-c", "--channels"):
+            channels_to_process = a
+        elif o in ("-i", "--ignore"):
+            channels_to_ignore = re.compile(a + '$')
+        elif o in ("-o", "--outdir"):
+            outdir = a
+        elif o in ("-l", "--lcm_packages"):
+            lcm_packages = a.split(",")
+        elif o in ("-j", "--jobs"):
+            jobs = int(a)
+
+    channels_to_process = re.compile(channels_to_process)
+
+    # made before the pool so the workers inherit it
+    type_db = LCMTypeDatabase(lcm_packages, verbose)
+
+    sys.stderr.write("indexing %s... " % fname)
+    events = read_event_headers(fname)
+    sys.stderr.write("%d channels\n" % len(events))
+
+    work = []
+
+    for channel in events:
+        if channels_to_ignore is not None and channels_to_ignore.match(channel):
+            continue
+        if not channels_to_process.match(channel):
+            continue
+
+        work.append((fname, outdir, channel, events[channel]))
+
+    # biggest channels first so one doesn't start last and hold everything up
+    work.sort(key=lambda w: -sum(e[3] for e in w[3]))
+
+    if not os.path.isdir(outdir):
+        os.makedirs(outdir)
+
+    pool = multiprocessing.Pool(max(1, jobs))
+    manifest = []
+
+    try:
+        for channel, columns, note in pool.imap_unordered(convert_channel, work):
+            if columns is None:
+                if verbose:
+                    sys.stderr.write("ignoring channel %s: %s\n" % (channel, note))
+                continue
+
+            manifest.extend(columns)
+            sys.stderr.write("%s: %s\n" % (channel, note))
+    finally:
+        pool.close()
+        pool.join()
+
+    manifest.sort()
+
+    with open(os.path.join(outdir, MANIFEST_NAME), 'w') as out:
+        out.write('# channel field type messages shape\n')
+
+        for line in manifest:
+            out.write('%s %s %s %d %s\n' % line)
+
+    sys.stderr.write("wrote %s\n" % outdir)
+
+
+if __name__ == '__main__':
+    main()
@@ -35,7 +35,7 @@ std::string altimeter_channel = "altitude";
 std::string gps_channel = "gps";
 
 
-RollingStatistics *rolling_stats = NULL;
+FixedRollingStatistics<NUMBER_MEASUREMENTS_ROLLING> rolling_stats;
 
 int debug_count = 0;
 
@@ -53,7 +53,7 @@ void airspeed_handler(const lcm_recv_buf_t *rbuf, const char* channel, const mav
     // compute statistics about airspeed to decide if it is reasonable
     double airspeed = msg->z_effective[0];
 
-    rolling_stats->AddValue(airspeed);
+    rolling_stats.AddValue(airspeed);
 
     if (force_fallback_airspeed) {
         SendNewAirspeedMessage(FALLBACK_AIRSPEED, msg);
@@ -61,7 +61,7 @@ void airspeed_handler(const lcm_recv_buf_t *rbuf, const char* channel, const mav
         return;
     }
 
-    if (rolling_stats->GetMean() < MIN_EXPECTED_MPS || rolling_stats->GetStandardDeviation() < MIN_EXPECTED_STAND_DEV) {
+    if (rolling_stats.GetMean() < MIN_EXPECTED_MPS || rolling_stats.GetStandardDeviation() < MIN_EXPECTED_STAND_DEV) {
         // potentially bad value (low mean or low stand dev)
 
         // check if GPS is ok
@@ -224,8 +224,6 @@ int main(int argc,char** argv) {
         return 1;
     }
 
-    rolling_stats = new RollingStatistics(NUMBER_MEASUREMENTS_ROLLING);
-
     airspeed_in_sub = mav_indexed_measurement_t_subscribe(lcm_, airspeed_in_channel.c_str(), &airspeed_handler, NULL);
     altitude_sub = mav_indexed_measurement_t_subscribe(lcm_, altimeter_channel.c_str(), &altimeter_handler, NULL);
     gps_sub = mav_gps_data_t_subscribe(lcm_, gps_channel.c_str(), &gps_handler, NULL);
@@ -260,10 +258,6 @@ void sighandler(int dum)
 
     lcm_destroy (lcm_);
 
-    if (rolling_stats != NULL) {
-        delete rolling_stats;
-    }
-
     printf("done.\n");
 
     exit(0);
@@ -190,7 +190,7 @@ int main(int argc,char** argv) {
 
         // put these 3D coordinates in an LCM message
         lcmt_stereo msg;
-        msg.timestamp = getTimestampNow();
+        msg.timestamp = GetWallNow();
 
         msg.frame_number = this_frame_number;
         msg.video_number = this_video_number;
@@ -0,0 +1,619 @@
+/**
+ * Compares pushbroom stereo, StereoBM and StereoSGBM on recorded frames.
+ *
+ * Example:
+ *   ./stereo-compare-bench -c ../stereo/deltawing-stereo-odroid-cam1.conf
+ *       -l ../stereo/vids/videoL-... -t ../stereo/vids/videoR-...
+ *       -n 1,2,4 -a pushbroom,multi,bm,sgbm -r sgbm -o compare.csv
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#include "stereo-compare-bench.hpp"
+
+int main(int argc, char *argv[]) {
+
+    string config_file = "";
+    string left_dir = "", right_dir = "";
+    string threads_arg = "1,2,4";
+    string algorithms_arg = "pushbroom,multi,bm,sgbm";
+    string reference_arg = "sgbm";
+    string output_file = "";
+    int max_frames = 100;
+    int iterations = 3;
+    int warmup = 1;
+    int tolerance = 1;
+
+    ConciseArgs parser(argc, argv);
+    parser.add(config_file, "c", "config", "Configuration file with the stereo settings and calibration directory.", true);
+    parser.add(left_dir, "l", "left-dir", "Directory of left PGM frames (left00000.pgm, ...).", true);
+    parser.add(right_dir, "t", "right-dir", "Directory of right PGM frames (right00000.pgm, ...).", true);
+    parser.add(max_frames, "m", "max-frames", "Most frames to load from the directories.");
+    parser.add(iterations, "i", "iterations", "Timed passes over all of the frames.");
+    parser.add(warmup, "w", "warmup", "Untimed passes over all of the frames before timing.");
+    parser.add(threads_arg, "n", "threads", "Comma separated thread counts to run.");
+    parser.add(algorithms_arg, "a", "algorithms", "Comma separated algorithms to run (pushbroom, multi, bm, sgbm).");
+    parser.add(reference_arg, "r", "reference", "Algorithm to measure agreement against.");
+    parser.add(tolerance, "d", "tolerance", "Disparities within this many pixels agree.");
+    parser.add(output_file, "o", "output", "Write the CSV results to this file instead of stdout.");
+    parser.parse();
+
+    OpenCvStereoConfig stereo_config;
+
+    if (ParseConfigFile(config_file, &stereo_config) != true) {
+        fprintf(stderr, "Failed to parse configuration file, quitting.\n");
+        return 1;
+    }
+
+    OpenCvStereoCalibration stereo_calibration;
+
+    if (LoadCalibration(stereo_config.calibrationDir, &stereo_calibration) != true) {
+        fprintf(stderr, "Error: failed to read calibration files. Quitting.\n");
+        return 1;
+    }
+
+    cv::vector<Mat> left_frames, right_frames;
+
+    int num_frames = LoadFrames(left_dir, right_dir, max_frames, &left_frames, &right_frames);
+
+    if (num_frames < 1) {
+        fprintf(stderr, "Error: no frames found in %s and %s.\n", left_dir.c_str(), right_dir.c_str());
+        return 1;
+    }
+
+    if (left_frames[0].size() != stereo_calibration.mx1fp.size()) {
+        fprintf(stderr, "Error: frames are %d x %d, the calibration is for %d x %d.\n",
+            left_frames[0].cols, left_frames[0].rows, stereo_calibration.mx1fp.cols, stereo_calibration.mx1fp.rows);
+        return 1;
+    }
+
+    PushbroomStereoState state;
+    SetupState(stereo_config, stereo_calibration, &state);
+
+    CompareRoi roi = GetRoi(state, left_frames[0].rows, left_frames[0].cols);
+
+    cv::vector<int> thread_counts = ParseIntList(threads_arg);
+
+    cv::vector<int> algorithms;
+    stringstream stream(algorithms_arg);
+    string item;
+
+    while (getline(stream, item, ',')) {
+        int algorithm = ParseAlgorithm(item);
+
+        if (algorithm < 0) {
+            fprintf(stderr, "Error: unknown algorithm \"%s\".\n", item.c_str());
+            return 1;
+        }
+
+        if (algorithm == ALGORITHM_PUSHBROOM_MULTI && state.num_disparities < 1) {
+            fprintf(stderr, "Warning: the config file has no disparities list, skipping multi.\n");
+            continue;
+        }
+
+        algorithms.push_back(algorithm);
+    }
+
+    int reference_algorithm = ParseAlgorithm(reference_arg);
+
+    if (reference_algorithm < 0 || (reference_algorithm == ALGORITHM_PUSHBROOM_MULTI && state.num_disparities < 1)) {
+        fprintf(stderr, "Error: can't use \"%s\" as the reference.\n", reference_arg.c_str());
+        return 1;
+    }
+
+    // the dense matchers get their threads from us, one frame each, so
+    // don't let OpenCV add its own on top
+    setNumThreads(1);
+
+    fprintf(stderr, "%d frames (%d x %d), ROI rows %d-%d, columns %d-%d, %d timed passes\n", num_frames,
+        left_frames[0].cols, left_frames[0].rows, roi.top, roi.bottom, roi.left, roi.right, iterations);
+
+    // the reference's output, computed once, untimed
+    cv::vector<FrameOutput> reference;
+    cv::vector<float> frame_ms;
+    float total_ms;
+
+    fprintf(stderr, "reference (%s)...\n", GetAlgorithmName(reference_algorithm));
+    RunAlgorithm(reference_algorithm, left_frames, right_frames, state, roi, 1, 1, 0, &frame_ms, &total_ms, &reference);
+
+    cv::vector<CompareResult> results;
+
+    for (unsigned int a = 0; a < algorithms.size(); a++) {
+
+        int algorithm = algorithms[a];
+
+        // disparities that count as hits (positive, like image_hits)
+        cv::vector<int> disparities;
+
+        if (algorithm == ALGORITHM_PUSHBROOM_MULTI) {
+            for (int k = 0; k < state.num_disparities; k++) {
+                disparities.push_back(abs(state.disparities[k]));
+            }
+        } else {
+            disparities.push_back(abs(state.disparity));
+        }
+
+        for (unsigned int t = 0; t < thread_counts.size(); t++) {
+
+            if (thread_counts[t] < 1 || thread_counts[t] > MAX_THREADS) {
+                fprintf(stderr, "Warning: skipping %d threads (must be 1 to %d).\n", thread_counts[t], MAX_THREADS);
+                continue;
+            }
+
+            fprintf(stderr, "%s, %d threads...\n", GetAlgorithmName(algorithm), thread_counts[t]);
+
+            cv::vector<FrameOutput> outputs;
+
+            RunAlgorithm(algorithm, left_frames, right_frames, state, roi, thread_counts[t], iterations, warmup, &frame_ms, &total_ms, &outputs);
+
+            int hits = 0;
+            int matched = 0, found = 0, reference_hits = 0, reference_found = 0;
+
+            for (int i = 0; i < num_frames; i++) {
+                hits += CountHits(outputs[i], disparities, roi, tolerance);
+
+                Agreement(outputs[i], reference[i], disparities, roi, state.blockSize, tolerance,
+                    &matched, &found, &reference_hits, &reference_found);
+            }
+
+            CompareResult result;
+            result.algorithm = GetAlgorithmName(algorithm);
+            result.num_threads = thread_counts[t];
+            result.hits_per_frame = (float)hits / num_frames;
+            result.precision = found > 0 ? (float)matched / found : 0;
+            result.recall = reference_hits > 0 ? (float)reference_found / reference_hits : 0;
+
+            result.count = frame_ms.size();
+            result.p50_ms = 0;
+            result.p99_ms = 0;
+            result.max_ms = 0;
+            result.fps = total_ms > 0 ? 1000.0f * frame_ms.size() / total_ms : 0;
+
+            if (frame_ms.size() > 0) {
+                sort(frame_ms.begin(), frame_ms.end());
+
+                result.p50_ms = frame_ms[frame_ms.size() / 2];
+                result.p99_ms = frame_ms[(frame_ms.size() * 99) / 100];
+                result.max_ms = frame_ms.back();
+            }
+
+            results.push_back(result);
+        }
+    }
+
+    FILE *out = stdout;
+
+    if (output_file.length() > 0) {
+        out = fopen(output_file.c_str(), "w");
+
+        if (out == NULL) {
+            fprintf(stderr, "Error: failed to open %s for writing.\n", output_file.c_str());
+            return 1;
+        }
+    }
+
+    WriteResults(out, results, GetAlgorithmName(reference_algorithm));
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    return 0;
+}
+
+const char* GetAlgorithmName(int algorithm) {
+    switch (algorithm) {
+        case ALGORITHM_PUSHBROOM:
+            return "pushbroom";
+        case ALGORITHM_PUSHBROOM_MULTI:
+            return "multi";
+        case ALGORITHM_BM:
+            return "bm";
+        case ALGORITHM_SGBM:
+            return "sgbm";
+        default:
+            return "unknown";
+    }
+}
+
+/**
+ * @retval the algorithm with this name, or -1
+ */
+int ParseAlgorithm(string name) {
+    for (int i = 0; i < NUM_ALGORITHMS; i++) {
+        if (name == GetAlgorithmName(i)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Works out the rows and columns stereo searches, the same way
+ * PushbroomStereo does: the ROI from the config file (where it's set),
+ * cut off at the last valid row.
+ *
+ * @param state stereo state
+ * @param rows number of rows in the image
+ * @param cols number of columns in the image
+ *
+ * @retval region to search
+ */
+CompareRoi GetRoi(const PushbroomStereoState &state, int rows, int cols) {
+    CompareRoi roi;
+
+    roi.top = max(0, state.roi_top);
+    roi.bottom = state.roi_bottom > 0 ? min(rows, state.roi_bottom) : rows;
+    roi.left = max(0, state.roi_left);
+    roi.right = state.roi_right > 0 ? min(cols, state.roi_right) : cols;
+
+    if (state.lastValidPixelRow > 0) {
+        roi.bottom = min(roi.bottom, state.lastValidPixelRow);
+    }
+
+    roi.bottom = max(roi.top, roi.bottom);
+    roi.right = max(roi.left, roi.right);
+
+    roi.cols = cols;
+    roi.mask = state.roi_mask;
+
+    return roi;
+}
+
+static float ElapsedMs(int64_t start_usec, int64_t end_usec) {
+    return (end_usec - start_usec) / 1000.0f;
+}
+
+/**
+ * Runs one algorithm over all of the frames.  Pushbroom gets a worker
+ * pool of num_threads and takes the frames one at a time.  The dense
+ * matchers run num_threads frames at once, one per thread, each thread
+ * with its own matcher.
+ *
+ * @param algorithm which algorithm (CompareAlgorithm)
+ * @param left_frames left images
+ * @param right_frames right images
+ * @param state stereo state
+ * @param roi region to search
+ * @param num_threads number of threads
+ * @param iterations timed passes over the frames
+ * @param warmup untimed passes over the frames before timing
+ * @param frame_ms (output) time each frame took, for each timed pass
+ * @param total_ms (output) time all of the timed passes took
+ * @param outputs (output) what was found on each frame (on the last pass)
+ */
+void RunAlgorithm(int algorithm, const cv::vector<Mat> &left_frames, const cv::vector<Mat> &right_frames, const PushbroomStereoState &state, const CompareRoi &roi, int num_threads, int iterations, int warmup, cv::vector<float> *frame_ms, float *total_ms, cv::vector<FrameOutput> *outputs) {
+
+    int num_frames = left_frames.size();
+
+    frame_ms->assign(iterations * num_frames, 0);
+    outputs->assign(num_frames, FrameOutput());
+
+    *total_ms = 0;
+
+    if (algorithm == ALGORITHM_PUSHBROOM || algorithm == ALGORITHM_PUSHBROOM_MULTI) {
+
+        PushbroomStereoState pushbroom_state = state;
+
+        if (algorithm == ALGORITHM_PUSHBROOM) {
+            pushbroom_state.num_disparities = 0;
+        }
+
+        PushbroomStereoThreadConfig thread_config = PushbroomStereo::DefaultThreadConfig();
+        thread_config.num_threads = num_threads;
+
+        PushbroomStereo pushbroom_stereo(thread_config);
+
+        PushbroomStereoFrameBuffers buffers;
+        buffers.number_of_points = 0;
+
+        for (int pass = 0; pass < warmup; pass++) {
+            for (int i = 0; i < num_frames; i++) {
+                pushbroom_stereo.ProcessImages(left_frames[i], right_frames[i], &buffers, pushbroom_state);
+            }
+        }
+
+        for (int pass = 0; pass < iterations; pass++) {
+            for (int i = 0; i < num_frames; i++) {
+                int64_t start = GetRawMonotonicNow();
+                pushbroom_stereo.ProcessImages(left_frames[i], right_frames[i], &buffers, pushbroom_state);
+                int64_t end = GetRawMonotonicNow();
+
+                (*frame_ms)[pass * num_frames + i] = ElapsedMs(start, end);
+                *total_ms += (*frame_ms)[pass * num_frames + i];
+
+                if (pass == iterations - 1) {
+                    (*outputs)[i].image_hits = buffers.image_hits;
+                }
+            }
+        }
+
+        return;
+    }
+
+    // dense matchers: each thread takes every num_threads'th frame and
+    // keeps its own matchers for all of the passes.  The timed passes
+    // take as long as the slowest thread.
+    cv::vector<std::thread> threads;
+    cv::vector<float> thread_ms(num_threads, 0);
+
+    for (int t = 0; t < num_threads; t++) {
+        threads.push_back(std::thread([&, t]() {
+
+            DenseMatchers matchers;
+            SetupDenseMatchers(&matchers);
+
+            FrameOutput output;
+
+            int64_t timed_start = GetRawMonotonicNow();
+
+            for (int pass = -warmup; pass < iterations; pass++) {
+
+                if (pass == 0) {
+                    timed_start = GetRawMonotonicNow();
+                }
+
+                for (int i = t; i < num_frames; i += num_threads) {
+                    int64_t start = GetRawMonotonicNow();
+                    RunDense(algorithm, &matchers, left_frames[i], right_frames[i], state, roi, &output);
+                    int64_t end = GetRawMonotonicNow();
+
+                    if (pass >= 0) {
+                        (*frame_ms)[pass * num_frames + i] = ElapsedMs(start, end);
+                    }
+
+                    if (pass == iterations - 1) {
+                        (*outputs)[i].disparity = output.disparity.clone();
+                    }
+                }
+            }
+
+            int64_t timed_end = GetRawMonotonicNow();
+
+            if (iterations > 0) {
+                thread_ms[t] = ElapsedMs(timed_start, timed_end);
+            }
+        }));
+    }
+
+    for (int t = 0; t < num_threads; t++) {
+        threads[t].join();
+
+        *total_ms = max(*total_ms, thread_ms[t]);
+    }
+}
+
+/**
+ * Sets up a thread's matchers with bm-stereo's StereoBM settings, and
+ * StereoSGBM with the same window and disparity range.
+ *
+ * @param matchers (output) matchers to set up
+ */
+void SetupDenseMatchers(DenseMatchers *matchers) {
+
+    matchers->bm.init(CV_STEREO_BM_BASIC);
+
+    matchers->bm.state->preFilterSize = BM_PRE_FILTER_SIZE;
+    matchers->bm.state->preFilterCap = BM_PRE_FILTER_CAP;
+    matchers->bm.state->SADWindowSize = BM_SAD_WINDOW_SIZE;
+    matchers->bm.state->minDisparity = BM_MIN_DISPARITY;
+    matchers->bm.state->numberOfDisparities = BM_NUMBER_OF_DISPARITIES;
+    matchers->bm.state->textureThreshold = BM_TEXTURE_THRESHOLD;
+    matchers->bm.state->uniquenessRatio = BM_UNIQUENESS_RATIO;
+    matchers->bm.state->speckleWindowSize = BM_SPECKLE_WINDOW_SIZE;
+    matchers->bm.state->speckleRange = BM_SPECKLE_RANGE;
+
+    // smoothness penalties that OpenCV suggests for one channel
+    int sad_area = BM_SAD_WINDOW_SIZE * BM_SAD_WINDOW_SIZE;
+
+    matchers->sgbm = StereoSGBM(BM_MIN_DISPARITY, BM_NUMBER_OF_DISPARITIES, BM_SAD_WINDOW_SIZE,
+        8 * sad_area, 32 * sad_area, 1, BM_PRE_FILTER_CAP, BM_UNIQUENESS_RATIO,
+        BM_SPECKLE_WINDOW_SIZE, BM_SPECKLE_RANGE);
+}
+
+/**
+ * Rectifies the ROI rows of a frame and runs StereoBM or StereoSGBM on
+ * them.
+ *
+ * @param algorithm ALGORITHM_BM or ALGORITHM_SGBM
+ * @param matchers this thread's matchers (see SetupDenseMatchers)
+ * @param left left image
+ * @param right right image
+ * @param state stereo state (for the rectification maps)
+ * @param roi region to search
+ * @param output (output) disparity in pixels for the ROI rows (row 0 is
+ *      roi.top), negative where there's no match
+ */
+void RunDense(int algorithm, DenseMatchers *matchers, const Mat &left, const Mat &right, const PushbroomStereoState &state, const CompareRoi &roi, FrameOutput *output) {
+
+    // only the ROI rows (all of the columns, since matches come from the
+    // left of the ROI in the right image)
+    remap(left, matchers->remap_left, state.mapxL.rowRange(roi.top, roi.bottom), Mat(), INTER_NEAREST);
+    remap(right, matchers->remap_right, state.mapxR.rowRange(roi.top, roi.bottom), Mat(), INTER_NEAREST);
+
+    if (algorithm == ALGORITHM_BM) {
+        matchers->bm(matchers->remap_left, matchers->remap_right, output->disparity, CV_32F);
+    } else {
+        matchers->sgbm(matchers->remap_left, matchers->remap_right, matchers->disparity_raw);
+
+        // fixed point with 4 fractional bits
+        matchers->disparity_raw.convertTo(output->disparity, CV_32F, 1.0 / 16.0);
+    }
+
+    // both mark no match with minDisparity - 1
+    output->disparity.setTo(-1, output->disparity < BM_MIN_DISPARITY);
+}
+
+static bool InRoi(const CompareRoi &roi, int row, int col) {
+    return row >= roi.top && row < roi.bottom && col >= roi.left && col < roi.right
+        && (roi.mask.empty() || roi.mask.at<uchar>(row, col) > 0);
+}
+
+static bool IsHit(float disparity, const cv::vector<int> &disparities, int tolerance) {
+    if (disparity < 0) {
+        return false;
+    }
+
+    for (unsigned int k = 0; k < disparities.size(); k++) {
+        if (fabs(disparity - disparities[k]) <= tolerance) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Counts hits: pushbroom's hit blocks, or the dense matcher's pixels in
+ * the ROI that are at one of the disparities.
+ *
+ * @param output what was found on a frame
+ * @param disparities disparities that count (positive)
+ * @param roi region searched
+ * @param tolerance how far a dense disparity can be from one of them
+ *
+ * @retval number of hits
+ */
+int CountHits(const FrameOutput &output, const cv::vector<int> &disparities, const CompareRoi &roi, int tolerance) {
+
+    if (output.disparity.empty()) {
+        return output.image_hits.size();
+    }
+
+    int hits = 0;
+
+    for (int row = roi.top; row < roi.bottom; row++) {
+        const float *disparity_row = output.disparity.ptr<float>(row - roi.top);
+
+        for (int col = roi.left; col < roi.right; col++) {
+            if (IsHit(disparity_row[col], disparities, tolerance) && InRoi(roi, row, col)) {
+                hits ++;
+            }
+        }
+    }
+
+    return hits;
+}
+
+/**
+ * Draws hits into a map of the ROI rows: each pushbroom hit fills its
+ * block with its disparity, dense hits are kept where they are, and
+ * everything else is -1.
+ */
+static Mat HitMap(const FrameOutput &output, const cv::vector<int> &disparities, const CompareRoi &roi, int block_size, int tolerance) {
+
+    Mat map(roi.bottom - roi.top, roi.cols, CV_32F, Scalar(-1));
+
+    if (output.disparity.empty()) {
+        for (unsigned int i = 0; i < output.image_hits.size(); i++) {
+            const Point3f &hit = output.image_hits[i];
+
+            Rect block(hit.x - block_size / 2.0f, hit.y - block_size / 2.0f - roi.top, block_size, block_size);
+            block &= Rect(0, 0, map.cols, map.rows);
+
+            map(block).setTo(hit.z);
+        }
+    } else {
+        for (int row = roi.top; row < roi.bottom; row++) {
+            const float *disparity_row = output.disparity.ptr<float>(row - roi.top);
+            float *map_row = map.ptr<float>(row - roi.top);
+
+            for (int col = roi.left; col < roi.right; col++) {
+                if (IsHit(disparity_row[col], disparities, tolerance) && InRoi(roi, row, col)) {
+                    map_row[col] = disparity_row[col];
+                }
+            }
+        }
+    }
+
+    return map;
+}
+
+/**
+ * Counts how many of one output's hits (blocks for pushbroom, pixels for
+ * the dense matchers) are confirmed by another output's hit map: a block
+ * is confirmed if any pixel in it has a disparity within tolerance, a
+ * pixel if it does.
+ */
+static void CountConfirmed(const FrameOutput &output, const Mat &other_map, const cv::vector<int> &disparities, const CompareRoi &roi, int block_size, int tolerance, int *confirmed, int *total) {
+
+    if (output.disparity.empty()) {
+        for (unsigned int i = 0; i < output.image_hits.size(); i++) {
+            const Point3f &hit = output.image_hits[i];
+
+            Rect block(hit.x - block_size / 2.0f, hit.y - block_size / 2.0f - roi.top, block_size, block_size);
+            block &= Rect(0, 0, other_map.cols, other_map.rows);
+
+            Mat diff = abs(other_map(block) - hit.z);
+
+            (*total) ++;
+
+            if (countNonZero((other_map(block) >= 0) & (diff <= tolerance)) > 0) {
+                (*confirmed) ++;
+            }
+        }
+
+        return;
+    }
+
+    for (int row = roi.top; row < roi.bottom; row++) {
+        const float *disparity_row = output.disparity.ptr<float>(row - roi.top);
+        const float *other_row = other_map.ptr<float>(row - roi.top);
+
+        for (int col = roi.left; col < roi.right; col++) {
+            if (IsHit(disparity_row[col], disparities, tolerance) && InRoi(roi, row, col)) {
+                (*total) ++;
+
+                if (other_row[col] >= 0 && fabs(other_row[col] - disparity_row[col]) <= tolerance) {
+                    (*confirmed) ++;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Adds up how well an output agrees with the reference on one frame.
+ * Only hits at the given disparities count, for both of them.
+ *
+ * @param output what the algorithm found
+ * @param reference what the reference algorithm found
+ * @param disparities disparities that count (positive)
+ * @param roi region searched
+ * @param block_size pushbroom's block size
+ * @param tolerance how far apart disparities can be and still agree
+ * @param matched (output) adds the output's hits the reference confirms
+ * @param found (output) adds the output's hits
+ * @param reference_hits (output) adds the reference's hits
+ * @param reference_found (output) adds the reference's hits the output
+ *      confirms
+ */
+void Agreement(const FrameOutput &output, const FrameOutput &reference, const cv::vector<int> &disparities, const CompareRoi &roi, int block_size, int tolerance, int *matched, int *found, int *reference_hits, int *reference_found) {
+
+    Mat output_map = HitMap(output, disparities, roi, block_size, tolerance);
+    Mat reference_map = HitMap(reference, disparities, roi, block_size, tolerance);
+
+    CountConfirmed(output, reference_map, disparities, roi, block_size, tolerance, matched, found);
+    CountConfirmed(reference, output_map, disparities, roi, block_size, tolerance, reference_found, reference_hits);
+}
+
+/**
+ * Writes the results as CSV with a header line.
+ *
+ * @param out file to write to
+ * @param results results to write
+ * @param reference name of the algorithm agreement was measured against
+ */
+void WriteResults(FILE *out, const cv::vector<CompareResult> &results, const char *reference) {
+    fprintf(out, "reference,algorithm,threads,count,p50_ms,p99_ms,max_ms,fps,hits_per_frame,precision,recall\n");
+
+    for (unsigned int i = 0; i < results.size(); i++) {
+        const CompareResult &r = results[i];
+
+        fprintf(out, "%s,%s,%d,%d,%.3f,%.3f,%.3f,%.1f,%.1f,%.3f,%.3f\n", reference, r.algorithm.c_str(),
+            r.num_threads, r.count, r.p50_ms, r.p99_ms, r.max_ms, r.fps, r.hits_per_frame,
+            r.precision, r.recall);
+    }
+}
@@ -0,0 +1,132 @@
+/**
+ * Benchmark that compares pushbroom stereo against OpenCV's dense block
+ * matchers on recorded frames.  Runs pushbroom (at the config file's one
+ * disparity and in multi-disparity mode), StereoBM over the search ROI
+ * and StereoSGBM with a range of thread counts, and prints the per-frame
+ * time, hits per frame and how well each agrees with a reference
+ * algorithm as CSV.
+ *
+ * Everything gets the same rectification (the calibration's nearest
+ * neighbor maps, like pushbroom uses) inside its timing, and the dense
+ * matchers run one frame per thread with cv::setNumThreads(1), so an
+ * N-thread row for any algorithm means N cores.
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#ifndef STEREO_COMPARE_BENCH_HPP
+#define STEREO_COMPARE_BENCH_HPP
+
+#include <cv.h>
+#include <highgui.h>
+
+#include "opencv2/opencv.hpp"
+
+#include "../../externals/ConciseArgs.hpp"
+#include "../../utils/utils/Clock.hpp"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "../../sensors/stereo/opencv-stereo-util.hpp"
+#include "../../sensors/stereo/pushbroom-stereo.hpp"
+#include "../../sensors/stereo/stereo-bench-util.hpp"
+
+using namespace std;
+using namespace cv;
+
+// StereoBM settings, from bm-stereo
+#define BM_PRE_FILTER_SIZE 105
+#define BM_PRE_FILTER_CAP 61
+#define BM_SAD_WINDOW_SIZE 5
+#define BM_MIN_DISPARITY 2
+#define BM_NUMBER_OF_DISPARITIES 112
+#define BM_TEXTURE_THRESHOLD 427
+#define BM_UNIQUENESS_RATIO 18
+#define BM_SPECKLE_WINDOW_SIZE 59
+#define BM_SPECKLE_RANGE 30
+
+enum CompareAlgorithm {
+    ALGORITHM_PUSHBROOM,
+    ALGORITHM_PUSHBROOM_MULTI,
+    ALGORITHM_BM,
+    ALGORITHM_SGBM,
+    NUM_ALGORITHMS
+};
+
+// what one algorithm found on one frame: hit blocks for pushbroom, a
+// disparity map (in pixels, negative where there's no match) for the
+// dense matchers
+struct FrameOutput {
+    cv::vector<Point3f> image_hits;
+    Mat disparity;
+};
+
+// region every algorithm searches, worked out from the state the same
+// way PushbroomStereo does
+struct CompareRoi {
+    int top;
+    int bottom;
+    int left;
+    int right;
+
+    // width of the whole image
+    int cols;
+
+    Mat mask;
+};
+
+// a thread's own StereoBM and StereoSGBM, set up the way bm-stereo sets
+// up StereoBM, and its scratch images
+struct DenseMatchers {
+    StereoBM bm;
+    StereoSGBM sgbm;
+
+    Mat remap_left;
+    Mat remap_right;
+    Mat disparity_raw;
+};
+
+struct CompareResult {
+    string algorithm;
+    int num_threads;
+
+    int count;
+    float p50_ms;
+    float p99_ms;
+    float max_ms;
+
+    // frames per second over the timed passes
+    float fps;
+
+    float hits_per_frame;
+
+    // fraction of this algorithm's hits that the reference agrees with,
+    // and fraction of the reference's hits that this algorithm found
+    float precision;
+    float recall;
+};
+
+const char* GetAlgorithmName(int algorithm);
+
+int ParseAlgorithm(string name);
+
+CompareRoi GetRoi(const PushbroomStereoState &state, int rows, int cols);
+
+void RunAlgorithm(int algorithm, const cv::vector<Mat> &left_frames, const cv::vector<Mat> &right_frames, const PushbroomStereoState &state, const CompareRoi &roi, int num_threads, int iterations, int warmup, cv::vector<float> *frame_ms, float *total_ms, cv::vector<FrameOutput> *outputs);
+
+void SetupDenseMatchers(DenseMatchers *matchers);
+
+void RunDense(int algorithm, DenseMatchers *matchers, const Mat &left, const Mat &right, const PushbroomStereoState &state, const CompareRoi &roi, FrameOutput *output);
+
+int CountHits(const FrameOutput &output, const cv::vector<int> &disparities, const CompareRoi &roi, int tolerance);
+
+void Agreement(const FrameOutput &output, const FrameOutput &reference, const cv::vector<int> &disparities, const CompareRoi &roi, int block_size, int tolerance, int *matched, int *found, int *reference_hits, int *reference_found);
+
+void WriteResults(FILE *out, const cv::vector<CompareResult> &results, const char *reference);
+
+#endif
@@ -0,0 +1,12 @@
+TARGET = stereo-compare-bench
+SOURCES = stereo-compare-bench.cpp ../../sensors/stereo/stereo-bench-util.cpp ../../sensors/stereo/opencv-stereo-util.cpp ../../sensors/stereo/pushbroom-stereo.cpp ../../sensors/stereo/pushbroom-stereo-opencl.cpp ../../externals/jpeg-utils/jpeg-utils.c ../../utils/utils/RealtimeUtils.cpp ../../utils/ThreadPool/ThreadPool.cpp
+
+# "make -f stereo-compare-bench.mk USE_OPENCL=1" builds pushbroom's GPU
+# backend (see pushbroom-stereo-opencl.hpp)
+ifeq ($(USE_OPENCL),1)
+CPPFLAGS_EXTRA += -DUSE_OPENCL
+LDPOSTFLAGS_EXTRA += -lOpenCL
+endif
+
+# include a standard makefile that uses these variables and builds everything
+include ../../utils/make/flight.mk
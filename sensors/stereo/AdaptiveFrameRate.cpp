@@ -0,0 +1,76 @@
+#include "AdaptiveFrameRate.hpp"
+
+#include <stdlib.h>
+#include <algorithm>
+
+/**
+ * @param band_thickness depth band thickness, in meters: how far the
+ *      aircraft flies between the frames it needs
+ * @param min_rate_hz process at least this many frames per second, however
+ *      slowly the aircraft is going
+ */
+AdaptiveFrameRate::AdaptiveFrameRate(float band_thickness, float min_rate_hz) {
+
+    band_thickness_ = band_thickness;
+    min_rate_hz_ = min_rate_hz;
+
+    have_airspeed_ = false;
+    airspeed_utime_ = 0;
+    airspeed_ = 0;
+
+    last_frame_ = 0;
+    last_processed_ = 0;
+
+    skipped_frames_ = 0;
+}
+
+/**
+ * @param utime time of the measurement, in microseconds
+ * @param airspeed in meters per second
+ */
+void AdaptiveFrameRate::SetAirspeed(int64_t utime, float airspeed) {
+    airspeed_utime_ = utime;
+    airspeed_ = airspeed;
+    have_airspeed_ = true;
+}
+
+/**
+ * Call once per frame.
+ *
+ * @param timestamp time of the frame, in microseconds
+ *
+ * @retval true if stereo should run on this frame
+ */
+bool AdaptiveFrameRate::ShouldProcess(int64_t timestamp) {
+
+    int64_t frame_period = timestamp - last_frame_;
+    last_frame_ = timestamp;
+
+    if (!have_airspeed_ || llabs(timestamp - airspeed_utime_) > ADAPTIVE_RATE_MAX_AIRSPEED_AGE_US
+        || last_processed_ == 0 || timestamp < last_processed_ || band_thickness_ <= 0) {
+
+        // nothing to go by (or the video started over)
+        last_processed_ = timestamp;
+        return true;
+    }
+
+    float rate_hz = std::max(min_rate_hz_, airspeed_ / band_thickness_);
+
+    if (rate_hz <= 0) {
+        // stopped, with no floor
+        skipped_frames_++;
+        return false;
+    }
+
+    int64_t interval = 1000000 / rate_hz;
+
+    // waiting for the next frame would leave a longer gap than the
+    // aircraft can fly through the band in
+    if (timestamp + frame_period - last_processed_ > interval) {
+        last_processed_ = timestamp;
+        return true;
+    }
+
+    skipped_frames_++;
+    return false;
+}
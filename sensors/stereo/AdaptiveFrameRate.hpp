@@ -0,0 +1,51 @@
+#ifndef ADAPTIVE_FRAME_RATE_H_
+#define ADAPTIVE_FRAME_RATE_H_
+
+/**
+ * Decides which frames stereo runs on, going by airspeed.  Pushbroom
+ * stereo only sees new obstacles once the aircraft has flown through its
+ * depth band, so it needs a frame every band_thickness / airspeed
+ * seconds, and slow flight (taxiing, hand launch) needs far fewer frames
+ * than the cameras give.  The rest of the frames still get recorded.
+ *
+ * Without a recent airspeed, every frame gets processed.
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#include <stdint.h>
+
+// airspeeds older than this don't count
+#define ADAPTIVE_RATE_MAX_AIRSPEED_AGE_US 1000000
+
+class AdaptiveFrameRate {
+
+    public:
+        AdaptiveFrameRate(float band_thickness, float min_rate_hz);
+
+        void SetAirspeed(int64_t utime, float airspeed);
+
+        bool ShouldProcess(int64_t timestamp);
+
+        // frames ShouldProcess() said no to
+        int GetSkippedFrames() const { return skipped_frames_; }
+
+    private:
+        // depth band thickness, in meters, and the slowest rate to
+        // process frames at
+        float band_thickness_;
+        float min_rate_hz_;
+
+        bool have_airspeed_;
+        int64_t airspeed_utime_;
+        float airspeed_;
+
+        // last frame seen and last frame processed
+        int64_t last_frame_;
+        int64_t last_processed_;
+
+        int skipped_frames_;
+};
+
+#endif
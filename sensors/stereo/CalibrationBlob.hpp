@@ -0,0 +1,266 @@
+#ifndef CALIBRATION_BLOB_H_
+#define CALIBRATION_BLOB_H_
+
+/**
+ * Binary copy of a stereo calibration, so startup doesn't have to parse
+ * the XML files and convert the remap maps.  stereo_calibrate writes it
+ * next to the XML files it came from, and LoadCalibration mmaps it
+ * instead of reading the XML when it's valid.
+ *
+ * The file is a header, a table of matrices (name, size, type and where
+ * the data is) and the matrix data, each aligned to 16 bytes.  The header
+ * has a hash of the XML files, so a blob left over from an earlier
+ * calibration is ignored.
+ *
+ * Header only, so that stereo_calibrate (which doesn't link anything
+ * else from here) can write it.
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#include "opencv2/opencv.hpp"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#define CALIBRATION_BLOB_FILE "calibration.blob"
+#define CALIBRATION_BLOB_MAGIC "PBCALIB1"
+#define CALIBRATION_BLOB_ALIGN 16
+#define CALIBRATION_BLOB_MAX_NAME 16
+
+// the XML files a blob is made from, in the order they are hashed
+static const char* const kCalibrationBlobSources[] = {
+    "Q.xml", "M1.xml", "D1.xml", "R1.xml", "P1.xml", "M2.xml", "D2.xml",
+    "R2.xml", "P2.xml", "mx1.xml", "my1.xml", "mx2.xml", "my2.xml"
+};
+
+struct CalibrationBlobHeader {
+    char magic[8];
+    uint64_t source_hash;
+    uint64_t file_size;
+    uint32_t num_entries;
+    uint32_t reserved;
+};
+
+struct CalibrationBlobEntry {
+    char name[CALIBRATION_BLOB_MAX_NAME];
+    int32_t rows;
+    int32_t cols;
+    int32_t type;
+    int32_t reserved;
+    uint64_t offset;
+    uint64_t bytes;
+};
+
+/**
+ * 64-bit FNV-1a hash of the calibration XML files in a directory.  A
+ * missing file hashes differently from an empty one.
+ *
+ * @param dir calibration directory
+ *
+ * @retval hash of all of the source files
+ */
+inline uint64_t HashCalibrationSources(const std::string &dir) {
+    uint64_t hash = 14695981039346656037ULL;
+
+    unsigned char buffer[65536];
+
+    for (unsigned int i = 0; i < sizeof(kCalibrationBlobSources) / sizeof(kCalibrationBlobSources[0]); i++) {
+
+        FILE *in = fopen((dir + "/" + kCalibrationBlobSources[i]).c_str(), "rb");
+
+        // separate the files, and mark the missing ones
+        unsigned char marker = in != NULL ? 1 : 2;
+        hash = (hash ^ marker) * 1099511628211ULL;
+
+        if (in == NULL) {
+            continue;
+        }
+
+        size_t length;
+
+        while ((length = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+            for (size_t b = 0; b < length; b++) {
+                hash = (hash ^ buffer[b]) * 1099511628211ULL;
+            }
+        }
+
+        fclose(in);
+    }
+
+    return hash;
+}
+
+/**
+ * Writes matrices to a blob.
+ *
+ * @param filename file to write
+ * @param source_hash HashCalibrationSources() of the XML files they came from
+ * @param names names of the matrices (shorter than CALIBRATION_BLOB_MAX_NAME)
+ * @param mats the matrices
+ *
+ * @retval false if the file couldn't be written
+ */
+inline bool WriteCalibrationBlob(const std::string &filename, uint64_t source_hash, const std::vector<std::string> &names, const std::vector<cv::Mat> &mats) {
+
+    CalibrationBlobHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CALIBRATION_BLOB_MAGIC, sizeof(header.magic));
+    header.source_hash = source_hash;
+    header.num_entries = mats.size();
+
+    std::vector<CalibrationBlobEntry> entries(mats.size());
+    std::vector<cv::Mat> continuous(mats.size());
+
+    uint64_t offset = sizeof(header) + sizeof(CalibrationBlobEntry) * entries.size();
+
+    for (unsigned int i = 0; i < mats.size(); i++) {
+        continuous[i] = mats[i].isContinuous() ? mats[i] : mats[i].clone();
+
+        CalibrationBlobEntry &entry = entries[i];
+        memset(&entry, 0, sizeof(entry));
+        strncpy(entry.name, names[i].c_str(), CALIBRATION_BLOB_MAX_NAME - 1);
+
+        entry.rows = continuous[i].rows;
+        entry.cols = continuous[i].cols;
+        entry.type = continuous[i].type();
+
+        offset = (offset + CALIBRATION_BLOB_ALIGN - 1) / CALIBRATION_BLOB_ALIGN * CALIBRATION_BLOB_ALIGN;
+        entry.offset = offset;
+        entry.bytes = continuous[i].total() * continuous[i].elemSize();
+
+        offset += entry.bytes;
+    }
+
+    header.file_size = offset;
+
+    // write to a temporary file and rename, so a reader never sees half
+    // a blob
+    std::string temp_filename = filename + ".tmp";
+
+    FILE *out = fopen(temp_filename.c_str(), "wb");
+
+    if (out == NULL) {
+        return false;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+
+    if (entries.size() > 0) {
+        ok = ok && fwrite(&entries[0], sizeof(CalibrationBlobEntry), entries.size(), out) == entries.size();
+    }
+
+    for (unsigned int i = 0; i < entries.size() && ok; i++) {
+        // padding up to the entry's offset
+        static const char zeros[CALIBRATION_BLOB_ALIGN] = { 0 };
+        long position = ftell(out);
+
+        ok = ok && fwrite(zeros, 1, entries[i].offset - position, out) == entries[i].offset - position;
+        ok = ok && fwrite(continuous[i].data, 1, entries[i].bytes, out) == entries[i].bytes;
+    }
+
+    ok = (fclose(out) == 0) && ok;
+
+    if (ok != true || rename(temp_filename.c_str(), filename.c_str()) != 0) {
+        remove(temp_filename.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Maps a blob and copies out the matrices asked for, if the blob is
+ * intact and was made from these XML files.  Matrices that aren't asked
+ * for (the float maps, usually) are never read.
+ *
+ * @param filename blob to read
+ * @param source_hash HashCalibrationSources() of the XML files now
+ * @param names matrices to read
+ * @param mats (output) the matrices, by name
+ *
+ * @retval false if the blob is missing, stale, damaged or doesn't have
+ *      all of the matrices
+ */
+inline bool ReadCalibrationBlob(const std::string &filename, uint64_t source_hash, const std::vector<std::string> &names, std::map<std::string, cv::Mat> *mats) {
+
+    int fd = open(filename.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat file_stat;
+
+    if (fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(CalibrationBlobHeader)) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = file_stat.st_size;
+
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    const unsigned char *data = (const unsigned char*)map;
+    const CalibrationBlobHeader *header = (const CalibrationBlobHeader*)data;
+
+    bool ok = memcmp(header->magic, CALIBRATION_BLOB_MAGIC, sizeof(header->magic)) == 0
+        && header->source_hash == source_hash
+        && header->file_size == size
+        && sizeof(CalibrationBlobHeader) + (uint64_t)header->num_entries * sizeof(CalibrationBlobEntry) <= size;
+
+    std::map<std::string, cv::Mat> found;
+
+    for (uint32_t i = 0; ok && i < header->num_entries; i++) {
+        const CalibrationBlobEntry *entry = (const CalibrationBlobEntry*)(data + sizeof(CalibrationBlobHeader)) + i;
+
+        std::string name(entry->name, strnlen(entry->name, CALIBRATION_BLOB_MAX_NAME));
+
+        if (std::find(names.begin(), names.end(), name) == names.end()) {
+            continue;
+        }
+
+        if (entry->rows < 0 || entry->cols < 0 || entry->offset + entry->bytes > size) {
+            ok = false;
+            break;
+        }
+
+        cv::Mat view(entry->rows, entry->cols, entry->type, (void*)(data + entry->offset));
+
+        if (view.total() * view.elemSize() != entry->bytes) {
+            ok = false;
+            break;
+        }
+
+        // copy out, so the matrices don't depend on the mapping
+        found[name] = view.clone();
+    }
+
+    munmap(map, size);
+
+    if (ok != true || found.size() != names.size()) {
+        return false;
+    }
+
+    mats->insert(found.begin(), found.end());
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,170 @@
+#include "CameraHealthMonitor.hpp"
+
+CameraHealthMonitor::CameraHealthMonitor() {
+
+    num_frames_ = 0;
+
+    left_ok_ = true;
+    right_ok_ = true;
+
+    left_bad_checks_ = 0;
+    left_good_checks_ = 0;
+    right_bad_checks_ = 0;
+    right_good_checks_ = 0;
+
+    checks_since_reset_ = 0;
+
+    mode_ = CAMERA_MODE_STEREO;
+}
+
+/**
+ * Tells the monitor about a new pair of frames.  Every
+ * CAMERA_HEALTH_EVERY_N_FRAMES frames it measures them and updates the
+ * cameras' health.
+ *
+ * @param left_image left camera frame
+ * @param right_image right camera frame
+ * @param stats_left (output) the left frame's stats, if it was measured
+ * @param stats_right (output) the right frame's stats, if it was measured
+ *
+ * @retval true if the frames were measured (and the stats are valid)
+ */
+bool CameraHealthMonitor::AddFrames(Mat left_image, Mat right_image, FrameStats *stats_left, FrameStats *stats_right) {
+
+    if (num_frames_ ++ % CAMERA_HEALTH_EVERY_N_FRAMES != 0) {
+        return false;
+    }
+
+    ExposureController::GetFrameStats(left_image, stats_left);
+    ExposureController::GetFrameStats(right_image, stats_right);
+
+    AddStats(*stats_left, *stats_right);
+
+    return true;
+}
+
+/**
+ * Updates the cameras' health from one check of their frames.
+ *
+ * @param stats_left left frame's stats
+ * @param stats_right right frame's stats
+ *
+ * @retval true if the mode changed
+ */
+bool CameraHealthMonitor::AddStats(const FrameStats &stats_left, const FrameStats &stats_right) {
+
+    UpdateCamera(stats_left, &left_ok_, &left_bad_checks_, &left_good_checks_);
+    UpdateCamera(stats_right, &right_ok_, &right_bad_checks_, &right_good_checks_);
+
+    int mode;
+
+    if (left_ok_ && right_ok_) {
+        mode = CAMERA_MODE_STEREO;
+    } else if (left_ok_) {
+        mode = CAMERA_MODE_MONO_LEFT;
+    } else if (right_ok_) {
+        mode = CAMERA_MODE_MONO_RIGHT;
+    } else {
+        mode = CAMERA_MODE_BLIND;
+    }
+
+    checks_since_reset_ ++;
+
+    if (mode == mode_) {
+        return false;
+    }
+
+    // give a camera that just died a full period before resetting it, in
+    // case it comes back on its own (lens cap, flying into the sun)
+    if (mode_ == CAMERA_MODE_STEREO) {
+        checks_since_reset_ = 0;
+    }
+
+    mode_ = mode;
+
+    return true;
+}
+
+/**
+ * Decides if it's time to try resetting the dead cameras.  Returns true
+ * once every CAMERA_RESET_EVERY_N_CHECKS checks while a camera is dead.
+ *
+ * @param reset_left (output) true if the left camera should be reset
+ * @param reset_right (output) true if the right camera should be reset
+ *
+ * @retval true if a camera should be reset
+ */
+bool CameraHealthMonitor::GetReset(bool *reset_left, bool *reset_right) {
+
+    *reset_left = false;
+    *reset_right = false;
+
+    if (mode_ == CAMERA_MODE_STEREO || checks_since_reset_ < CAMERA_RESET_EVERY_N_CHECKS) {
+        return false;
+    }
+
+    checks_since_reset_ = 0;
+
+    *reset_left = !left_ok_;
+    *reset_right = !right_ok_;
+
+    return true;
+}
+
+/**
+ * @param stats a frame's stats
+ *
+ * @retval true if the frame looks like it came from a dead camera
+ */
+bool CameraHealthMonitor::LooksDead(const FrameStats &stats) {
+    return stats.mean < CAMERA_DEAD_MAX_MEAN || stats.stddev < CAMERA_DEAD_MIN_STDDEV;
+}
+
+const char* CameraHealthMonitor::GetModeName(int mode) {
+    switch (mode) {
+        case CAMERA_MODE_STEREO:
+            return "stereo";
+        case CAMERA_MODE_MONO_LEFT:
+            return "mono (left)";
+        case CAMERA_MODE_MONO_RIGHT:
+            return "mono (right)";
+        case CAMERA_MODE_BLIND:
+            return "blind";
+        default:
+            return "unknown";
+    }
+}
+
+/**
+ * Counts one check for a camera and flips its health if it has looked
+ * dead (or alive) for long enough.
+ *
+ * @param stats the camera's frame's stats
+ * @param ok (input/output) the camera's health
+ * @param bad_checks (input/output) dead-looking checks in a row
+ * @param good_checks (input/output) good checks in a row
+ *
+ * @retval true if the camera's health changed
+ */
+bool CameraHealthMonitor::UpdateCamera(const FrameStats &stats, bool *ok, int *bad_checks, int *good_checks) {
+
+    if (LooksDead(stats)) {
+        (*bad_checks) ++;
+        *good_checks = 0;
+    } else {
+        (*good_checks) ++;
+        *bad_checks = 0;
+    }
+
+    if (*ok && *bad_checks >= CAMERA_DEAD_CHECKS) {
+        *ok = false;
+        return true;
+    }
+
+    if (*ok != true && *good_checks >= CAMERA_ALIVE_CHECKS) {
+        *ok = true;
+        return true;
+    }
+
+    return false;
+}
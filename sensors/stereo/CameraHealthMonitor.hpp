@@ -0,0 +1,77 @@
+#ifndef CAMERA_HEALTH_MONITOR_H_
+#define CAMERA_HEALTH_MONITOR_H_
+
+/**
+ * Watches the brightness of both cameras' frames for one that has died
+ * (black, or one flat grey level) and decides when to fall back from
+ * stereo to the mono alarms on the camera that's left, and when to try
+ * resetting the dead one.  Uses the same sampled pixels as
+ * ExposureController, so it costs next to nothing.
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#include "ExposureController.hpp"
+
+// check the frames every this many frames
+#define CAMERA_HEALTH_EVERY_N_FRAMES 10
+
+// a frame darker than this on average, or with less spread in its grey
+// levels than this, isn't from a working camera
+#define CAMERA_DEAD_MAX_MEAN 4.0f
+#define CAMERA_DEAD_MIN_STDDEV 1.5f
+
+// a camera is dead after this many dead-looking checks in a row, and back
+// after this many good checks in a row
+#define CAMERA_DEAD_CHECKS 3
+#define CAMERA_ALIVE_CHECKS 5
+
+// while a camera is dead, try to reset it every this many checks
+#define CAMERA_RESET_EVERY_N_CHECKS 50
+
+enum CameraMode {
+    CAMERA_MODE_STEREO,
+    CAMERA_MODE_MONO_LEFT,
+    CAMERA_MODE_MONO_RIGHT,
+    CAMERA_MODE_BLIND
+};
+
+class CameraHealthMonitor {
+
+    public:
+        CameraHealthMonitor();
+
+        bool AddFrames(Mat left_image, Mat right_image, FrameStats *stats_left, FrameStats *stats_right);
+
+        bool AddStats(const FrameStats &stats_left, const FrameStats &stats_right);
+
+        bool GetReset(bool *reset_left, bool *reset_right);
+
+        int GetMode() { return mode_; }
+        bool IsLeftOk() { return left_ok_; }
+        bool IsRightOk() { return right_ok_; }
+
+        static bool LooksDead(const FrameStats &stats);
+        static const char* GetModeName(int mode);
+
+    private:
+        bool UpdateCamera(const FrameStats &stats, bool *ok, int *bad_checks, int *good_checks);
+
+        int num_frames_;
+
+        bool left_ok_;
+        bool right_ok_;
+
+        // dead-looking and good checks in a row
+        int left_bad_checks_;
+        int left_good_checks_;
+        int right_bad_checks_;
+        int right_good_checks_;
+
+        int checks_since_reset_;
+
+        int mode_;
+};
+
+#endif
@@ -0,0 +1,374 @@
+#include "ExposureController.hpp"
+
+/**
+ * Starts the controller thread.  The cameras must already be set up.
+ *
+ * @param camera_left camera running auto exposure
+ * @param camera_right camera that gets the left camera's settings
+ * @param enable_gamma gamma setting to use if the cameras have to be set up
+ *      again (see InitBrightnessSettings())
+ */
+ExposureController::ExposureController(dc1394camera_t *camera_left, dc1394camera_t *camera_right, bool enable_gamma) {
+
+    camera_left_ = camera_left;
+    camera_right_ = camera_right;
+    enable_gamma_ = enable_gamma;
+
+    num_frames_ = 0;
+    num_updates_ = 0;
+    shutter_ = 0;
+    gain_ = 0;
+
+    check_pending_ = false;
+    shutting_down_ = false;
+    mean_left_ = 0;
+    mean_right_ = 0;
+
+    complete_set_pending_ = false;
+    force_brightness_ = -1;
+    force_exposure_ = -1;
+
+    health_pending_ = false;
+    left_ok_ = true;
+    right_ok_ = true;
+    reset_left_pending_ = false;
+    reset_right_pending_ = false;
+
+    pthread_create(&thread_, NULL, ControllerThread, this);
+}
+
+ExposureController::~ExposureController() {
+
+    {
+        lock_guard<mutex> lock(check_mutex_);
+        shutting_down_ = true;
+    }
+
+    cv_check_.notify_one();
+
+    pthread_join(thread_, NULL);
+}
+
+/**
+ * Tells the controller about a new pair of frames.  Every
+ * check_every_n_frames frames it measures their brightness and hands that
+ * to the controller thread, which decides if the right camera needs new
+ * settings.  Never waits on the cameras.
+ *
+ * @param left_image left camera frame
+ * @param right_image right camera frame
+ * @param check_every_n_frames how often to check the settings
+ * @param stats_left GetFrameStats() of left_image if the caller already
+ *      has it, or NULL to measure it here
+ * @param stats_right same as above, for right_image
+ */
+void ExposureController::AddFrames(Mat left_image, Mat right_image, int check_every_n_frames, const FrameStats *stats_left, const FrameStats *stats_right) {
+
+    if (num_frames_ ++ % check_every_n_frames != 0) {
+        return;
+    }
+
+    FrameStats measured_left, measured_right;
+
+    if (stats_left == NULL) {
+        GetFrameStats(left_image, &measured_left);
+        stats_left = &measured_left;
+    }
+
+    if (stats_right == NULL) {
+        GetFrameStats(right_image, &measured_right);
+        stats_right = &measured_right;
+    }
+
+    float mean_left = stats_left->mean;
+    float mean_right = stats_right->mean;
+
+    {
+        lock_guard<mutex> lock(check_mutex_);
+
+        // if the thread is still busy with the last check, this one
+        // replaces it
+        check_pending_ = true;
+        mean_left_ = mean_left;
+        mean_right_ = mean_right;
+    }
+
+    cv_check_.notify_one();
+}
+
+/**
+ * Asks the controller thread to do a complete MatchBrightnessSettings
+ * (letting the left camera's auto exposure settle, or forcing the
+ * brightness and exposure on both cameras).  Returns right away.
+ *
+ * @param force_brightness brightness to force, or -1
+ * @param force_exposure exposure to force, or -1
+ */
+void ExposureController::RequestCompleteSet(int force_brightness, int force_exposure) {
+
+    {
+        lock_guard<mutex> lock(check_mutex_);
+
+        complete_set_pending_ = true;
+        force_brightness_ = force_brightness;
+        force_exposure_ = force_exposure;
+    }
+
+    cv_check_.notify_one();
+}
+
+/**
+ * Tells the controller which cameras are giving usable frames.  Returns
+ * right away.
+ *
+ * @param left_ok true if the left camera is ok
+ * @param right_ok true if the right camera is ok
+ */
+void ExposureController::SetCameraHealth(bool left_ok, bool right_ok) {
+
+    {
+        lock_guard<mutex> lock(check_mutex_);
+
+        health_pending_ = true;
+        left_ok_ = left_ok;
+        right_ok_ = right_ok;
+    }
+
+    cv_check_.notify_one();
+}
+
+/**
+ * Asks the controller thread to restart the cameras' transmission and set
+ * up their settings again, to try to bring a dead camera back.  Returns
+ * right away.
+ *
+ * @param reset_left true to reset the left camera
+ * @param reset_right true to reset the right camera
+ */
+void ExposureController::RequestCameraReset(bool reset_left, bool reset_right) {
+
+    {
+        lock_guard<mutex> lock(check_mutex_);
+
+        reset_left_pending_ = reset_left_pending_ || reset_left;
+        reset_right_pending_ = reset_right_pending_ || reset_right;
+    }
+
+    cv_check_.notify_one();
+}
+
+void* ExposureController::ControllerThread(void *x) {
+
+    ((ExposureController*) x)->RunController();
+
+    return NULL;
+}
+
+/**
+ * Waits for checks from AddFrames() and copies the shutter and gain from
+ * the left camera to the right one if the brightness looks like it needs
+ * it.  Also does the complete sets from RequestCompleteSet() and the
+ * camera health changes and resets.
+ */
+void ExposureController::RunController() {
+
+    float last_update_mean_left = -1;
+    int checks_since_update = 0;
+
+    bool left_ok = true, right_ok = true;
+
+    while (true) {
+
+        float mean_left = 0, mean_right = 0;
+        bool complete_set, health_changed, reset_left, reset_right;
+        int force_brightness, force_exposure;
+
+        {
+            unique_lock<mutex> lock(check_mutex_);
+
+            while (check_pending_ == false && complete_set_pending_ == false
+                && health_pending_ == false && reset_left_pending_ == false
+                && reset_right_pending_ == false && shutting_down_ == false) {
+
+                cv_check_.wait(lock);
+            }
+
+            if (shutting_down_) {
+                return;
+            }
+
+            health_changed = health_pending_;
+            left_ok = left_ok_;
+            right_ok = right_ok_;
+            health_pending_ = false;
+
+            reset_left = reset_left_pending_;
+            reset_right = reset_right_pending_;
+            reset_left_pending_ = false;
+            reset_right_pending_ = false;
+
+            complete_set = complete_set_pending_;
+            force_brightness = force_brightness_;
+            force_exposure = force_exposure_;
+
+            if (complete_set) {
+                complete_set_pending_ = false;
+            } else {
+                check_pending_ = false;
+                mean_left = mean_left_;
+                mean_right = mean_right_;
+            }
+        }
+
+        if (reset_left) {
+            ResetCamera(camera_left_);
+        }
+
+        if (reset_right) {
+            ResetCamera(camera_right_);
+        }
+
+        if (health_changed || reset_left || reset_right) {
+            ApplyCameraHealth(left_ok, right_ok);
+
+            last_update_mean_left = -1;
+        }
+
+        // a dead camera's frames say nothing about the settings
+        if (left_ok != true || right_ok != true) {
+            continue;
+        }
+
+        if (complete_set) {
+            // the frame loop (or StereoCapture) is taking the frames, so
+            // just wait for the auto exposure
+            MatchBrightnessSettings(camera_left_, camera_right_, true, force_brightness, force_exposure, false);
+
+            // start over from the new settings
+            last_update_mean_left = -1;
+            num_updates_ ++;
+            ReadSettings();
+            continue;
+        }
+
+        checks_since_update ++;
+
+        // the left camera's auto exposure changes its settings when its
+        // brightness changes, and the right image gets darker or brighter
+        // than the left one until it gets the same settings
+        bool brightness_changed = last_update_mean_left < 0
+            || fabs(mean_left - last_update_mean_left) > EXPOSURE_BRIGHTNESS_CHANGE;
+
+        bool brightness_mismatch = fabs(mean_left - mean_right) > EXPOSURE_BRIGHTNESS_CHANGE;
+
+        if (brightness_changed || brightness_mismatch || checks_since_update >= EXPOSURE_FORCE_EVERY_N_CHECKS) {
+
+            MatchBrightnessSettings(camera_left_, camera_right_);
+
+            last_update_mean_left = mean_left;
+            checks_since_update = 0;
+            num_updates_ ++;
+            ReadSettings();
+        }
+    }
+}
+
+/**
+ * Sets up the cameras' exposure for the ones that are ok: the usual
+ * left-runs-auto-exposure, right-gets-a-copy when both are, or auto
+ * exposure on the right camera when it's the only one left.
+ *
+ * @param left_ok true if the left camera is ok
+ * @param right_ok true if the right camera is ok
+ */
+void ExposureController::ApplyCameraHealth(bool left_ok, bool right_ok) {
+
+    if (left_ok && right_ok) {
+        InitBrightnessSettings(camera_left_, camera_right_, enable_gamma_);
+        MatchBrightnessSettings(camera_left_, camera_right_, true, -1, -1, false);
+
+        num_updates_ ++;
+        ReadSettings();
+
+    } else if (right_ok) {
+        // InitBrightnessSettings sets its first camera up to run auto
+        // exposure
+        InitBrightnessSettings(camera_right_, NULL, enable_gamma_);
+
+    } else if (left_ok) {
+        InitBrightnessSettings(camera_left_, NULL, enable_gamma_);
+    }
+}
+
+/**
+ * Keeps the shutter and gain the cameras were just given, for anyone
+ * recording them.  Only called from the controller thread, which is the
+ * only one that talks to the cameras.
+ */
+void ExposureController::ReadSettings() {
+
+    uint32_t shutter, gain;
+
+    if (dc1394_feature_get_value(camera_left_, DC1394_FEATURE_SHUTTER, &shutter) == DC1394_SUCCESS) {
+        shutter_ = shutter;
+    }
+
+    if (dc1394_feature_get_value(camera_left_, DC1394_FEATURE_GAIN, &gain) == DC1394_SUCCESS) {
+        gain_ = gain;
+    }
+}
+
+/**
+ * Stops and restarts a camera's transmission, which brings back a Firefly
+ * that has stopped exposing.  The video mode and the capture buffers stay
+ * as they were, so the frame loop doesn't notice beyond a few missing
+ * frames.
+ *
+ * @param camera camera to reset
+ */
+void ExposureController::ResetCamera(dc1394camera_t *camera) {
+
+    if (dc1394_video_set_transmission(camera, DC1394_OFF) != DC1394_SUCCESS) {
+        fprintf(stderr, "Warning: failed to stop transmission on camera %llx for a reset.\n", (unsigned long long) camera->guid);
+    }
+
+    if (dc1394_video_set_transmission(camera, DC1394_ON) != DC1394_SUCCESS) {
+        fprintf(stderr, "Warning: failed to restart transmission on camera %llx after a reset.\n", (unsigned long long) camera->guid);
+    }
+}
+
+/**
+ * Average and standard deviation of the grey levels of an image, from
+ * every EXPOSURE_SAMPLE_STRIDE'th pixel of every EXPOSURE_SAMPLE_STRIDE'th
+ * row.
+ *
+ * @param image CV_8UC1 image
+ * @param stats (output) mean brightness (0-255) and its standard deviation
+ */
+void ExposureController::GetFrameStats(Mat image, FrameStats *stats) {
+
+    int64_t sum = 0, sum_squares = 0;
+    int count = 0;
+
+    for (int i = 0; i < image.rows; i += EXPOSURE_SAMPLE_STRIDE) {
+        const uchar *row = image.ptr<uchar>(i);
+
+        for (int j = 0; j < image.cols; j += EXPOSURE_SAMPLE_STRIDE) {
+            sum += row[j];
+            sum_squares += row[j] * row[j];
+            count ++;
+        }
+    }
+
+    if (count == 0) {
+        stats->mean = 0;
+        stats->stddev = 0;
+        return;
+    }
+
+    float mean = sum / (float)count;
+    float variance = sum_squares / (float)count - mean * mean;
+
+    stats->mean = mean;
+    stats->stddev = variance > 0 ? sqrt(variance) : 0;
+}
@@ -0,0 +1,117 @@
+#ifndef EXPOSURE_CONTROLLER_H_
+#define EXPOSURE_CONTROLLER_H_
+
+/**
+ * Keeps the right camera's shutter and gain matched to the left camera's
+ * (which runs auto exposure) from a background thread, so the frame loop
+ * never waits on camera registers over USB.
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#include "opencv-stereo-util.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <pthread.h>
+
+// only every this many rows and columns are used for the brightness means
+#define EXPOSURE_SAMPLE_STRIDE 8
+
+// the settings get copied if the left image's brightness changed by more
+// than this (in grey levels) since the last copy, or if the two images'
+// brightnesses differ by more than this
+#define EXPOSURE_BRIGHTNESS_CHANGE 2.0f
+
+// copy the settings at least every this many checks, even if nothing
+// seems to have changed
+#define EXPOSURE_FORCE_EVERY_N_CHECKS 10
+
+using namespace std;
+using namespace cv;
+
+// brightness of a frame, from the sampled pixels
+struct FrameStats {
+    float mean;
+    float stddev;
+};
+
+class ExposureController {
+
+    public:
+        ExposureController(dc1394camera_t *camera_left, dc1394camera_t *camera_right, bool enable_gamma = false);
+        ~ExposureController();
+
+        void AddFrames(Mat left_image, Mat right_image, int check_every_n_frames, const FrameStats *stats_left = NULL, const FrameStats *stats_right = NULL);
+
+        void RequestCompleteSet(int force_brightness = -1, int force_exposure = -1);
+
+        // for when a camera stops giving usable frames (see
+        // CameraHealthMonitor).  The settings aren't copied unless both
+        // cameras are ok, and the right camera runs its own auto exposure
+        // when only it is ok.
+        void SetCameraHealth(bool left_ok, bool right_ok);
+
+        // restarts the cameras' transmission and sets up their settings
+        // again, from the controller thread
+        void RequestCameraReset(bool reset_left, bool reset_right);
+
+        static void GetFrameStats(Mat image, FrameStats *stats);
+
+        // times the settings have been copied to the right camera
+        int GetNumUpdates() { return num_updates_; }
+
+        // shutter and gain from the last time the settings were copied (0
+        // until the first time)
+        uint32_t GetShutter() { return shutter_; }
+        uint32_t GetGain() { return gain_; }
+
+    private:
+        static void* ControllerThread(void *x);
+        void RunController();
+
+        void ApplyCameraHealth(bool left_ok, bool right_ok);
+        void ResetCamera(dc1394camera_t *camera);
+        void ReadSettings();
+
+        dc1394camera_t *camera_left_;
+        dc1394camera_t *camera_right_;
+
+        bool enable_gamma_;
+
+        int num_frames_;
+
+        pthread_t thread_;
+
+        // set (with the means) by AddFrames() when it is time for a check,
+        // all under check_mutex_.  The thread never holds it while it
+        // talks to the cameras.
+        mutex check_mutex_;
+        condition_variable cv_check_;
+        bool check_pending_;
+        bool shutting_down_;
+        float mean_left_;
+        float mean_right_;
+
+        // a complete MatchBrightnessSettings, from RequestCompleteSet()
+        bool complete_set_pending_;
+        int force_brightness_;
+        int force_exposure_;
+
+        // from SetCameraHealth() and RequestCameraReset()
+        bool health_pending_;
+        bool left_ok_;
+        bool right_ok_;
+        bool reset_left_pending_;
+        bool reset_right_pending_;
+
+        atomic<int> num_updates_;
+
+        // read on the controller thread, for GetShutter() and GetGain()
+        atomic<uint32_t> shutter_;
+        atomic<uint32_t> gain_;
+};
+
+#endif
@@ -0,0 +1,93 @@
+#include "FpgaHitSeeds.hpp"
+
+using namespace cv;
+
+/**
+ * @param Q reprojection matrix (state.Q), for the camera's focal length
+ *      and center
+ * @param margin pixels to search around each FPGA hit
+ * @param max_age_us FPGA hits older than this aren't used, and whole
+ *      frames get searched instead
+ */
+FpgaHitSeeds::FpgaHitSeeds(Mat Q, int margin, int64_t max_age_us) {
+
+    Mat q;
+    Q.convertTo(q, CV_64F);
+
+    // Q from stereoRectify maps (u, v, d) to (u - cx, v - cy, f)
+    focal_length_ = q.at<double>(2, 3);
+    center_x_ = -q.at<double>(0, 3);
+    center_y_ = -q.at<double>(1, 3);
+
+    margin_ = margin;
+    max_age_us_ = max_age_us;
+
+    hits_timestamp_ = 0;
+
+    last_seeds_ = 0;
+
+    num_seeds_ = 0;
+    num_confirmed_ = 0;
+}
+
+/**
+ * Keeps the FPGA's latest hits.
+ *
+ * @param msg the FPGA's hits for one of its frames
+ */
+void FpgaHitSeeds::SetHits(const lcmt_stereo *msg) {
+
+    hits_.clear();
+
+    for (int i = 0; i < msg->number_of_points; i++) {
+        if (msg->z[i] <= 0) {
+            continue;
+        }
+
+        hits_.push_back(Point2f(focal_length_ * msg->x[i] / msg->z[i] + center_x_,
+            focal_length_ * msg->y[i] / msg->z[i] + center_y_));
+    }
+
+    hits_timestamp_ = msg->timestamp;
+}
+
+/**
+ * Gives a region around each of the FPGA's latest hits.
+ *
+ * @param timestamp time of the frame about to be searched, in microseconds
+ * @param regions (output) regions of the remapped image to search.  Empty
+ *      if the FPGA didn't see anything.
+ *
+ * @retval true if the frame should only search the regions, false if the
+ *      FPGA's hits are too old to go by and it should search everything
+ */
+bool FpgaHitSeeds::GetRegions(int64_t timestamp, cv::vector<Rect> *regions) {
+
+    regions->clear();
+    last_seeds_ = 0;
+
+    if (hits_timestamp_ == 0 || llabs(timestamp - hits_timestamp_) > max_age_us_) {
+        return false;
+    }
+
+    int size = 2 * margin_ + 1;
+
+    for (size_t i = 0; i < hits_.size(); i++) {
+        regions->push_back(Rect(cvRound(hits_[i].x) - margin_, cvRound(hits_[i].y) - margin_, size, size));
+    }
+
+    last_seeds_ = regions->size();
+
+    return true;
+}
+
+/**
+ * Counts how the last GetRegions() frame went.
+ *
+ * @param num_confirmed hits the CPU found in the frame's regions
+ */
+void FpgaHitSeeds::AddFrame(int num_confirmed) {
+
+    num_seeds_ += last_seeds_;
+    num_confirmed_ += num_confirmed;
+}
@@ -0,0 +1,68 @@
+#ifndef FPGA_HIT_SEEDS_H_
+#define FPGA_HIT_SEEDS_H_
+
+/**
+ * Hybrid FPGA + CPU stereo.  The FPGA's hits (an lcmt_stereo that
+ * fpga-mavlink-bridge passes on from the board) become PushbroomStereo
+ * predicted regions, and the CPU searches only those, with its own
+ * horizontal invariance check, subpixel refinement and disparities.  A
+ * frame's hits are then the FPGA hits that passed the CPU's checks.
+ *
+ * The FPGA's points are taken to be in this camera's frame, in the units
+ * stereo publishes in.  They are projected through this camera's Q, so
+ * a board a few centimeters away just moves them by a few pixels, which
+ * the margin takes care of.
+ *
+ * Without recent FPGA hits (the board is off or the link is down), stereo
+ * searches whole frames as usual.
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "opencv2/opencv.hpp"
+#include "../../LCM/lcmt_stereo.h"
+
+class FpgaHitSeeds {
+
+    public:
+        FpgaHitSeeds(cv::Mat Q, int margin, int64_t max_age_us);
+
+        void SetHits(const lcmt_stereo *msg);
+
+        bool GetRegions(int64_t timestamp, cv::vector<cv::Rect> *regions);
+
+        void AddFrame(int num_confirmed);
+
+        // FPGA hits searched around and the hits found there, since the
+        // start
+        int64_t GetNumSeeds() const { return num_seeds_; }
+        int64_t GetNumConfirmed() const { return num_confirmed_; }
+
+    private:
+        // from the reprojection matrix
+        float focal_length_;
+        float center_x_;
+        float center_y_;
+
+        // pixels around each FPGA hit to search
+        int margin_;
+
+        // FPGA hits older than this are from a board that stopped sending
+        int64_t max_age_us_;
+
+        // the FPGA's latest hits, in image coordinates
+        int64_t hits_timestamp_;
+        cv::vector<cv::Point2f> hits_;
+
+        // regions the last GetRegions() gave out
+        int last_seeds_;
+
+        int64_t num_seeds_;
+        int64_t num_confirmed_;
+};
+
+#endif
@@ -0,0 +1,339 @@
+/**
+ * GStreamer video writer, for encoding on hardware.
+ *
+ * The pipeline is "appsrc ! <encoder> ! filesink", where the encoder comes
+ * from the configuration file (cameras.hardwareEncoder), like
+ * "videoconvert ! v4l2h264enc ! h264parse ! avimux".
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#include "HardwareVideoWriter.hpp"
+#include <stdio.h>
+#include <opencv2/imgproc/imgproc.hpp>
+
+using namespace cv;
+
+HardwareVideoWriter::HardwareVideoWriter() {
+    gst_ = NULL;
+
+    type_ = CV_8UC1;
+    fps_ = 30;
+    drop_when_behind_ = true;
+
+    num_frames_ = 0;
+    num_dropped_ = 0;
+}
+
+HardwareVideoWriter::~HardwareVideoWriter() {
+    Close();
+}
+
+/**
+ * Gets a Mat of the video's size and type that the encoder isn't using, to
+ * draw the next frame into.  Write() takes it without copying.
+ *
+ * @retval a frame buffer, or an empty Mat if the writer isn't open
+ */
+Mat HardwareVideoWriter::GetFrameBuffer() {
+    if (!IsOpened()) {
+        return Mat();
+    }
+
+    for (Mat &buffer : pool_) {
+        // only the pool has it: the encoder and whoever drew into it are
+        // done with it
+        if (*buffer.refcount == 1) {
+            return buffer;
+        }
+    }
+
+    if ((int)pool_.size() < HARDWARE_VIDEO_POOL_SIZE) {
+        pool_.push_back(Mat(frame_size_, type_));
+        return pool_.back();
+    }
+
+    // all of them are waiting on the encoder
+    return Mat(frame_size_, type_);
+}
+
+/**
+ * Sends a frame to the encoder.  Frames from GetFrameBuffer() go as they
+ * are.  Others are copied, and converted to 8-bit (scaling floats by 255
+ * like imshow) and to the video's number of channels.
+ *
+ * @param frame frame to write, the size the writer was opened with
+ *
+ * @retval false if it wasn't written (dropped, wrong size or the encoder
+ *      failed)
+ */
+bool HardwareVideoWriter::Write(const Mat &frame) {
+    if (!IsOpened() || CheckForErrors()) {
+        return false;
+    }
+
+    if (frame.size() != frame_size_) {
+        fprintf(stderr, "Warning: %dx%d frame for a %dx%d video, not writing it.\n", frame.cols, frame.rows,
+            frame_size_.width, frame_size_.height);
+        return false;
+    }
+
+    if (Behind()) {
+        // don't bother copying it
+        num_dropped_ ++;
+        return false;
+    }
+
+    if (frame.type() == type_ && InPool(frame)) {
+        return Push(frame);
+    }
+
+    Mat buffer = GetFrameBuffer();
+    Mat frame_8u = frame;
+
+    if (frame.depth() != CV_8U) {
+        frame.convertTo(frame_8u, CV_MAKETYPE(CV_8U, frame.channels()), 255.0);
+    }
+
+    if (frame_8u.channels() == buffer.channels()) {
+        frame_8u.copyTo(buffer);
+    } else if (frame_8u.channels() == 1) {
+        cvtColor(frame_8u, buffer, CV_GRAY2BGR);
+    } else {
+        cvtColor(frame_8u, buffer, CV_BGR2GRAY);
+    }
+
+    return Push(buffer);
+}
+
+bool HardwareVideoWriter::InPool(const Mat &frame) const {
+    for (const Mat &buffer : pool_) {
+        if (frame.data == buffer.data) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#ifdef USE_GSTREAMER
+
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+
+struct HardwareVideoWriterContext {
+    GstElement *pipeline;
+    GstAppSrc *src;
+    GstBus *bus;
+
+    guint64 frame_bytes;
+    guint64 max_bytes;
+};
+
+// runs when GStreamer is done with a frame, on one of its threads
+static void ReleaseFrame(gpointer frame) {
+    delete (Mat*)frame;
+}
+
+/**
+ * Starts a pipeline writing to a file.
+ *
+ * @param filename video file to write
+ * @param frame_size size of the frames
+ * @param is_color true for BGR frames, false for grayscale
+ * @param fps frame rate the video plays at
+ * @param encoder GStreamer elements between the raw frames and the file
+ * @param drop_when_behind true to drop frames when the encoder is behind
+ *      (for live video), false for Write() to wait for it
+ *
+ * @retval false if the pipeline couldn't be started
+ */
+bool HardwareVideoWriter::Open(std::string filename, Size frame_size, bool is_color, double fps, std::string encoder, bool drop_when_behind) {
+    Close();
+
+    static bool gst_initialized = false;
+
+    if (!gst_initialized) {
+        gst_init(NULL, NULL);
+        gst_initialized = true;
+    }
+
+    int fps_n, fps_d;
+    gst_util_double_to_fraction(fps, &fps_n, &fps_d);
+
+    char caps[200];
+    snprintf(caps, sizeof(caps), "video/x-raw,format=%s,width=%d,height=%d,framerate=%d/%d",
+        is_color ? "BGR" : "GRAY8", frame_size.width, frame_size.height, fps_n, fps_d);
+
+    std::string description = "appsrc name=src format=time caps=" + std::string(caps)
+        + " ! " + encoder + " ! filesink name=sink";
+
+    GError *error = NULL;
+    GstElement *pipeline = gst_parse_launch(description.c_str(), &error);
+
+    if (error != NULL) {
+        fprintf(stderr, "Error: bad encoder pipeline \"%s\": %s\n", encoder.c_str(), error->message);
+        g_error_free(error);
+
+        if (pipeline != NULL) {
+            gst_object_unref(pipeline);
+        }
+        return false;
+    }
+
+    GstElement *src = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+
+    guint64 frame_bytes = (guint64)frame_size.area() * (is_color ? 3 : 1);
+    guint64 max_bytes = frame_bytes * (HARDWARE_VIDEO_POOL_SIZE - 1);
+
+    // blocking is for writing recordings out, where every frame counts
+    g_object_set(src, "max-bytes", max_bytes, "block", drop_when_behind ? FALSE : TRUE, NULL);
+    g_object_set(sink, "location", filename.c_str(), NULL);
+    gst_object_unref(sink);
+
+    if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        fprintf(stderr, "Error: encoder pipeline \"%s\" failed to start.\n", encoder.c_str());
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        gst_object_unref(src);
+        gst_object_unref(pipeline);
+        return false;
+    }
+
+    gst_ = new HardwareVideoWriterContext;
+    gst_->pipeline = pipeline;
+    gst_->src = GST_APP_SRC(src);
+    gst_->bus = gst_element_get_bus(pipeline);
+    gst_->frame_bytes = frame_bytes;
+    gst_->max_bytes = max_bytes;
+
+    frame_size_ = frame_size;
+    type_ = is_color ? CV_8UC3 : CV_8UC1;
+    fps_ = fps;
+    drop_when_behind_ = drop_when_behind;
+
+    pool_.clear();
+
+    num_frames_ = 0;
+    num_dropped_ = 0;
+
+    return true;
+}
+
+/**
+ * Finishes the file (waiting for the encoder to get through the frames it
+ * has) and stops the pipeline.
+ */
+void HardwareVideoWriter::Close() {
+    if (gst_ == NULL) {
+        return;
+    }
+
+    gst_app_src_end_of_stream(gst_->src);
+
+    GstMessage *msg = gst_bus_timed_pop_filtered(gst_->bus, 10 * GST_SECOND,
+        (GstMessageType)(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+
+    if (msg == NULL) {
+        fprintf(stderr, "Warning: timed out waiting for the video encoder to finish.\n");
+    } else {
+        if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+            GError *error;
+            gst_message_parse_error(msg, &error, NULL);
+            fprintf(stderr, "Error: video encoder: %s\n", error->message);
+            g_error_free(error);
+        }
+        gst_message_unref(msg);
+    }
+
+    if (num_dropped_ > 0) {
+        printf("Video encoder dropped %d of %lld frames.\n", num_dropped_, (long long)(num_frames_ + num_dropped_));
+    }
+
+    Teardown();
+}
+
+// true if a frame now would go past the appsrc's queue
+bool HardwareVideoWriter::Behind() const {
+    return drop_when_behind_ && gst_app_src_get_current_level_bytes(gst_->src) + gst_->frame_bytes > gst_->max_bytes;
+}
+
+bool HardwareVideoWriter::Push(const Mat &frame) {
+    // the buffer keeps a reference to the frame, so it stays out of the
+    // pool until the encoder is done with it
+    Mat *held = new Mat(frame);
+
+    GstBuffer *buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, held->data, gst_->frame_bytes, 0,
+        gst_->frame_bytes, held, ReleaseFrame);
+
+    GST_BUFFER_PTS(buffer) = (GstClockTime)(num_frames_ * GST_SECOND / fps_);
+    GST_BUFFER_DURATION(buffer) = (GstClockTime)(GST_SECOND / fps_);
+
+    num_frames_ ++;
+
+    // takes the buffer either way
+    return gst_app_src_push_buffer(gst_->src, buffer) == GST_FLOW_OK;
+}
+
+// stops the pipeline if the encoder has failed
+bool HardwareVideoWriter::CheckForErrors() {
+    GstMessage *msg = gst_bus_pop_filtered(gst_->bus, GST_MESSAGE_ERROR);
+
+    if (msg == NULL) {
+        return false;
+    }
+
+    GError *error;
+    gst_message_parse_error(msg, &error, NULL);
+    fprintf(stderr, "Error: video encoder: %s.  Not writing any more of this video.\n", error->message);
+    g_error_free(error);
+    gst_message_unref(msg);
+
+    Teardown();
+
+    return true;
+}
+
+void HardwareVideoWriter::Teardown() {
+    gst_element_set_state(gst_->pipeline, GST_STATE_NULL);
+
+    gst_object_unref(gst_->bus);
+    gst_object_unref(gst_->src);
+    gst_object_unref(gst_->pipeline);
+
+    delete gst_;
+    gst_ = NULL;
+
+    pool_.clear();
+}
+
+#else // USE_GSTREAMER
+
+struct HardwareVideoWriterContext {
+};
+
+bool HardwareVideoWriter::Open(std::string filename, Size frame_size, bool is_color, double fps, std::string encoder, bool drop_when_behind) {
+    fprintf(stderr, "Warning: built without GStreamer (rebuild with \"make GSTREAMER=1\"), using VideoWriter.\n");
+    return false;
+}
+
+void HardwareVideoWriter::Close() {
+}
+
+bool HardwareVideoWriter::Behind() const {
+    return false;
+}
+
+bool HardwareVideoWriter::Push(const Mat &frame) {
+    return false;
+}
+
+bool HardwareVideoWriter::CheckForErrors() {
+    return false;
+}
+
+void HardwareVideoWriter::Teardown() {
+}
+
+#endif // USE_GSTREAMER
@@ -0,0 +1,71 @@
+/**
+ * Writes video through a GStreamer pipeline, so the encoding can happen on a
+ * hardware encoder (the Exynos' MFC on the Odroids, through v4l2h264enc)
+ * instead of on the CPU like OpenCV's VideoWriter.
+ *
+ * Frames go into an appsrc without being copied: the GStreamer buffer
+ * holds a reference to the Mat until the encoder is done with it.  Render
+ * into a GetFrameBuffer() Mat (the HUD does, see
+ * RecordingManager::GetHudFrameBuffer) and Write() hands it over as it is;
+ * other frames are copied into one first.
+ *
+ * Only built with GStreamer if USE_GSTREAMER is defined ("make
+ * GSTREAMER=1"), otherwise Open() always fails and RecordingManager uses
+ * VideoWriter.
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#ifndef HARDWARE_VIDEO_WRITER_HPP
+#define HARDWARE_VIDEO_WRITER_HPP
+
+#include <stdint.h>
+#include <opencv2/core/core.hpp>
+#include <string>
+#include <vector>
+
+// most frames that can be waiting on the encoder
+#define HARDWARE_VIDEO_POOL_SIZE 6
+
+// GStreamer pipeline, only defined when built with GStreamer
+struct HardwareVideoWriterContext;
+
+class HardwareVideoWriter {
+    private:
+        HardwareVideoWriterContext *gst_;
+
+        cv::Size frame_size_;
+        int type_;
+        double fps_;
+        bool drop_when_behind_;
+
+        std::vector<cv::Mat> pool_;
+
+        int64_t num_frames_;
+        int num_dropped_;
+
+        bool InPool(const cv::Mat &frame) const;
+        bool Behind() const;
+        bool Push(const cv::Mat &frame);
+        bool CheckForErrors();
+        void Teardown();
+
+    public:
+        HardwareVideoWriter();
+        ~HardwareVideoWriter();
+
+        bool Open(std::string filename, cv::Size frame_size, bool is_color, double fps, std::string encoder, bool drop_when_behind);
+        void Close();
+
+        bool IsOpened() const { return gst_ != NULL; }
+
+        cv::Mat GetFrameBuffer();
+
+        bool Write(const cv::Mat &frame);
+
+        // frames dropped because the encoder was behind
+        int GetNumDropped() const { return num_dropped_; }
+};
+
+#endif
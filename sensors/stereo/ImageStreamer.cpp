@@ -0,0 +1,254 @@
+#include "ImageStreamer.hpp"
+
+/**
+ * Starts the encoder threads.
+ *
+ * @param lcm LCM object to send the images on
+ * @param config stream settings (the stream* fields)
+ */
+ImageStreamer::ImageStreamer(lcm_t *lcm, const OpenCvStereoConfig &config) {
+
+    lcm_ = lcm;
+
+    downscale_ = max(config.streamDownscale, 1);
+    roi_ = config.streamRoi;
+    target_kbps_ = config.streamTargetKbps;
+    decimation_ = max(config.streamDecimation, 1);
+    quality_ = config.streamQuality;
+
+    num_frames_ = 0;
+    next_encoder_ = 0;
+
+    budget_bytes_ = 0;
+    last_budget_utime_ = 0;
+    bytes_sent_ = 0;
+
+    num_sent_ = 0;
+    num_dropped_ = 0;
+
+    shutting_down_ = false;
+
+    num_encoders_ = max(config.streamEncoderThreads, 1);
+    encoders_ = new ImageStreamEncoder[num_encoders_];
+
+    for (int i = 0; i < num_encoders_; i++) {
+        encoders_[i].parent = this;
+        encoders_[i].compressor = jpeg_utils_compressor_new();
+
+        for (int j = 0; j < IMAGE_STREAM_QUEUE_SIZE - 1; j++) {
+            encoders_[i].free_jobs.Push(j);
+        }
+
+        pthread_create(&(encoders_[i].thread), NULL, EncoderThread, &(encoders_[i]));
+    }
+}
+
+ImageStreamer::~ImageStreamer() {
+
+    shutting_down_ = true;
+
+    for (int i = 0; i < num_encoders_; i++) {
+        {
+            lock_guard<mutex> lock(encoders_[i].job_mutex);
+        }
+
+        encoders_[i].cv_new_job.notify_one();
+    }
+
+    // the encoders send whatever is still queued before they exit
+    for (int i = 0; i < num_encoders_; i++) {
+        pthread_join(encoders_[i].thread, NULL);
+        jpeg_utils_compressor_destroy(encoders_[i].compressor);
+    }
+
+    delete[] encoders_;
+}
+
+/**
+ * Sends a pair of images on stereo_image_left and stereo_image_right, if
+ * this frame isn't decimated away, the stream is under its bitrate and an
+ * encoder is free.  Only copies out the crops, the scaling and compression
+ * happen on the encoder threads.
+ *
+ * @param left_image left camera image
+ * @param right_image right camera image
+ */
+void ImageStreamer::SendImages(Mat left_image, Mat right_image) {
+
+    if (num_frames_ ++ % decimation_ != 0) {
+        return;
+    }
+
+    if (HaveBitrateBudget() != true) {
+        num_dropped_ ++;
+        return;
+    }
+
+    Mat images[2] = { left_image, right_image };
+
+    for (int i = 0; i < num_encoders_; i++) {
+
+        // spread the frames over the encoders
+        int encoder_number = (next_encoder_ + i) % num_encoders_;
+        ImageStreamEncoder *encoder = &encoders_[encoder_number];
+
+        int job_number;
+
+        if (encoder->free_jobs.Pop(&job_number) != true) {
+            continue;
+        }
+
+        ImageStreamJob *job = &(encoder->jobs[job_number]);
+
+        job->utime = GetWallNow();
+
+        for (int j = 0; j < 2; j++) {
+            Rect roi(0, 0, images[j].cols, images[j].rows);
+
+            if ((roi_ & roi).area() > 0) {
+                roi = roi_ & roi;
+            }
+
+            // the images might be DMA buffers that go back to the cameras
+            // before the encoder gets to them
+            images[j](roi).copyTo(job->images[j]);
+        }
+
+        encoder->ready_jobs.Push(job_number);
+
+        {
+            lock_guard<mutex> lock(encoder->job_mutex);
+        }
+
+        encoder->cv_new_job.notify_one();
+
+        next_encoder_ = (encoder_number + 1) % num_encoders_;
+
+        return;
+    }
+
+    num_dropped_ ++;
+}
+
+/**
+ * Checks the bitrate limit.  The budget fills at the target rate, up to a
+ * second's worth, and what the encoders have sent comes out of it.
+ *
+ * @retval true if the stream can send another pair
+ */
+bool ImageStreamer::HaveBitrateBudget() {
+
+    if (target_kbps_ <= 0) {
+        return true;
+    }
+
+    double bytes_per_second = target_kbps_ * 1000.0 / 8.0;
+
+    int64_t now = GetWallNow();
+
+    if (last_budget_utime_ > 0) {
+        budget_bytes_ += (now - last_budget_utime_) / 1000000.0 * bytes_per_second;
+    }
+
+    last_budget_utime_ = now;
+
+    budget_bytes_ = min(budget_bytes_, bytes_per_second);
+    budget_bytes_ -= bytes_sent_.exchange(0);
+
+    return budget_bytes_ >= 0;
+}
+
+void* ImageStreamer::EncoderThread(void *x) {
+
+    ImageStreamEncoder *encoder = (ImageStreamEncoder*) x;
+
+    encoder->parent->RunEncoder(encoder);
+
+    return NULL;
+}
+
+/**
+ * Scales, compresses and sends the images queued for one encoder.
+ *
+ * @param encoder the encoder this thread runs
+ */
+void ImageStreamer::RunEncoder(ImageStreamEncoder *encoder) {
+
+    while (true) {
+
+        int job_number;
+
+        if (encoder->ready_jobs.Pop(&job_number)) {
+
+            ImageStreamJob *job = &(encoder->jobs[job_number]);
+
+            SendImage(encoder, job->images[0], "stereo_image_left", job->utime);
+            SendImage(encoder, job->images[1], "stereo_image_right", job->utime);
+
+            num_sent_ ++;
+
+            encoder->free_jobs.Push(job_number);
+            continue;
+        }
+
+        if (shutting_down_) {
+            return;
+        }
+
+        unique_lock<mutex> lock(encoder->job_mutex);
+
+        while (encoder->ready_jobs.Empty() && shutting_down_ == false) {
+            encoder->cv_new_job.wait(lock);
+        }
+    }
+}
+
+/**
+ * Scales, compresses and sends one image, using the encoder's buffers.
+ *
+ * @param encoder encoder running this
+ * @param image cropped image
+ * @param channel LCM channel to send it on
+ * @param utime timestamp for the message
+ */
+void ImageStreamer::SendImage(ImageStreamEncoder *encoder, Mat image, const char *channel, int64_t utime) {
+
+    if (downscale_ > 1) {
+        Size scaled_size(max(image.cols / downscale_, 1), max(image.rows / downscale_, 1));
+
+        resize(image, encoder->scaled, scaled_size, 0, 0, INTER_AREA);
+        image = encoder->scaled;
+    }
+
+    if (image.type() != CV_8UC1) {
+        // colour video being replayed, not counted in the bitrate
+        SendImageOverLcm(lcm_, channel, image, quality_);
+        return;
+    }
+
+    int bufsize = image.cols * image.rows + IMAGE_STREAM_JPEG_SLACK;
+    encoder->jpeg_buffer.resize(bufsize);
+
+    if (jpeg_utils_compress_8u_gray(encoder->compressor, image.ptr(), image.cols, image.rows, image.step, encoder->jpeg_buffer.data(), &bufsize, quality_) != 0) {
+        return;
+    }
+
+    bot_core_image_t msg;
+
+    msg.utime = utime;
+
+    msg.width = image.cols;
+    msg.height = image.rows;
+    msg.row_stride = image.cols;
+
+    msg.nmetadata = 0;
+
+    msg.data = encoder->jpeg_buffer.data();
+    msg.size = bufsize;
+
+    msg.pixelformat = 1196444237; // see bot_core_image_t.lcm --> PIXEL_FORMAT_MJPEG
+
+    bot_core_image_t_publish(lcm_, channel, &msg);
+
+    bytes_sent_ += bufsize;
+}
@@ -0,0 +1,119 @@
+#ifndef IMAGE_STREAMER_H_
+#define IMAGE_STREAMER_H_
+
+/**
+ * Streams the camera images over LCM for viewing (-P) without slowing down
+ * the stereo loop.  The images can be cropped, downscaled, decimated and
+ * held to a bitrate, and the JPEG compression runs on a pool of encoder
+ * threads, one pair of images at a time on each.
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#include "opencv-stereo-util.hpp"
+#include "SpscQueue.hpp"
+
+#include <lcm/lcm.h>
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <pthread.h>
+
+// slots in each encoder's queues (one is always kept empty).  Must be a
+// power of two.
+#define IMAGE_STREAM_QUEUE_SIZE 4
+
+// extra room in the JPEG buffers for the headers on very small images
+#define IMAGE_STREAM_JPEG_SLACK 1024
+
+using namespace std;
+using namespace cv;
+
+/**
+ * A left and right image waiting to be encoded.  Its buffers get reused.
+ */
+struct ImageStreamJob {
+    int64_t utime;
+
+    // the cropped images, copied out of the camera frames
+    Mat images[2];
+};
+
+class ImageStreamer;
+
+/**
+ * An encoder thread and the jobs it owns.
+ */
+struct ImageStreamEncoder {
+    ImageStreamer *parent;
+
+    pthread_t thread;
+
+    ImageStreamJob jobs[IMAGE_STREAM_QUEUE_SIZE - 1];
+
+    // indices into jobs: the encoder gives sent ones back in free_jobs and
+    // SendImages() hands it filled ones in ready_jobs
+    SpscQueue<int, IMAGE_STREAM_QUEUE_SIZE> free_jobs;
+    SpscQueue<int, IMAGE_STREAM_QUEUE_SIZE> ready_jobs;
+
+    // the encoder sleeps on this until a job comes in
+    mutex job_mutex;
+    condition_variable cv_new_job;
+
+    // reused between images
+    Mat scaled;
+    cv::vector<uint8_t> jpeg_buffer;
+    jpeg_utils_compressor_t *compressor;
+};
+
+class ImageStreamer {
+
+    public:
+        ImageStreamer(lcm_t *lcm, const OpenCvStereoConfig &config);
+        ~ImageStreamer();
+
+        void SendImages(Mat left_image, Mat right_image);
+
+        // image pairs sent
+        int GetNumSent() { return num_sent_; }
+
+        // image pairs skipped because the encoders were busy or the stream
+        // was over its bitrate (not counting decimation)
+        int GetNumDropped() { return num_dropped_; }
+
+    private:
+        static void* EncoderThread(void *x);
+        void RunEncoder(ImageStreamEncoder *encoder);
+
+        void SendImage(ImageStreamEncoder *encoder, Mat image, const char *channel, int64_t utime);
+        bool HaveBitrateBudget();
+
+        lcm_t *lcm_;
+
+        int downscale_;
+        Rect roi_;
+        int target_kbps_;
+        int decimation_;
+        int quality_;
+
+        int num_encoders_;
+        ImageStreamEncoder *encoders_;
+        int next_encoder_;
+
+        int num_frames_;
+
+        // bitrate limit: bytes the stream may still send, topped up as time
+        // goes by.  The encoders add up what they send in bytes_sent_.
+        double budget_bytes_;
+        int64_t last_budget_utime_;
+        atomic<int> bytes_sent_;
+
+        atomic<int> num_sent_;
+        atomic<int> num_dropped_;
+
+        atomic<bool> shutting_down_;
+};
+
+#endif
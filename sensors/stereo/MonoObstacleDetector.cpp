@@ -0,0 +1,125 @@
+#include "MonoObstacleDetector.hpp"
+
+MonoObstacleDetector::MonoObstacleDetector() {
+    has_last_frame_ = false;
+}
+
+/**
+ * Runs the interest operator on one camera's frame and works out the
+ * texture, flow and alarms for each grid cell.
+ *
+ * @param image the camera's (unrectified) frame
+ * @param map the camera's fixed point remap map (state.mapxL or
+ *      state.mapxR)
+ * @param state stereo state, for the search region, block size and
+ *      sobelLimit
+ * @param alarms (output) the grid
+ */
+void MonoObstacleDetector::ProcessImage(Mat image, Mat map, const PushbroomStereoState &state, MonoObstacleAlarms *alarms) {
+
+    int rows = image.rows;
+    int cols = image.cols;
+    int blockSize = state.blockSize;
+
+    // same search region as PushbroomStereo
+    int roi_top = max(0, state.roi_top);
+    int roi_bottom = state.roi_bottom > 0 ? min(rows, state.roi_bottom) : rows;
+    int roi_left = max(0, state.roi_left);
+    int roi_right = state.roi_right > 0 ? min(cols, state.roi_right) : cols;
+
+    if (state.lastValidPixelRow > 0) {
+        roi_bottom = min(roi_bottom, state.lastValidPixelRow);
+    }
+
+    alarms->roi_top = roi_top;
+    alarms->roi_bottom = roi_bottom;
+    alarms->roi_left = roi_left;
+    alarms->roi_right = roi_right;
+
+    int num_cells = MONO_GRID_ROWS * MONO_GRID_COLS;
+
+    alarms->texture.assign(num_cells, 0);
+    alarms->flow.assign(num_cells, 0);
+    alarms->alarm.assign(num_cells, 0);
+    alarms->num_alarms = 0;
+
+    int roi_rows = roi_bottom - roi_top;
+    int roi_cols = roi_right - roi_left;
+
+    if (roi_rows < blockSize * MONO_GRID_ROWS || roi_cols < blockSize * MONO_GRID_COLS) {
+        has_last_frame_ = false;
+        return;
+    }
+
+    // rectify only the search region's rows, like the stereo remap
+    // stage, and keep the last frame's for the flow
+    swap(remapped_, last_remapped_);
+    remapped_.create(roi_rows, cols, CV_8UC1);
+
+    remap(image, remapped_, map.rowRange(roi_top, roi_bottom), Mat(), INTER_NEAREST);
+
+    Mat roi = remapped_.colRange(roi_left, roi_right);
+
+    // the interest operator, as in PushbroomStereo::RunRemapInterestOp
+    // and BuildInterestIntegral
+    laplacian_.create(roi_rows, roi_cols, CV_8UC1);
+    Laplacian(roi, laplacian_, -1, 3, 1, 0, BORDER_DEFAULT);
+
+    integral(laplacian_, interest_integral_, CV_32S);
+
+    bool have_flow = has_last_frame_ && last_remapped_.size() == remapped_.size();
+    has_last_frame_ = true;
+
+    for (int i = 0; i < MONO_GRID_ROWS; i++) {
+
+        int cell_top = roi_rows * i / MONO_GRID_ROWS;
+        int cell_bottom = roi_rows * (i + 1) / MONO_GRID_ROWS;
+
+        for (int j = 0; j < MONO_GRID_COLS; j++) {
+
+            int cell_left = roi_cols * j / MONO_GRID_COLS;
+            int cell_right = roi_cols * (j + 1) / MONO_GRID_COLS;
+
+            int blocks = 0, interesting = 0;
+
+            for (int y = cell_top; y + blockSize <= cell_bottom; y += blockSize) {
+
+                const int *top_row = interest_integral_.ptr<int>(y);
+                const int *bottom_row = interest_integral_.ptr<int>(y + blockSize);
+
+                for (int x = cell_left; x + blockSize <= cell_right; x += blockSize) {
+
+                    int interest = bottom_row[x + blockSize] - bottom_row[x]
+                        - top_row[x + blockSize] + top_row[x];
+
+                    if (interest >= state.sobelLimit) {
+                        interesting ++;
+                    }
+
+                    blocks ++;
+                }
+            }
+
+            int cell = i * MONO_GRID_COLS + j;
+
+            float texture = blocks > 0 ? interesting / (float)blocks : 0;
+            float flow = 0;
+
+            if (have_flow) {
+                Range cell_rows(cell_top, cell_bottom);
+                Range cell_cols(roi_left + cell_left, roi_left + cell_right);
+
+                flow = norm(remapped_(cell_rows, cell_cols), last_remapped_(cell_rows, cell_cols), NORM_L1)
+                    / ((cell_bottom - cell_top) * (cell_right - cell_left));
+            }
+
+            alarms->texture[cell] = texture;
+            alarms->flow[cell] = flow;
+
+            if (texture >= MONO_TEXTURE_ALARM && flow >= MONO_FLOW_ALARM) {
+                alarms->alarm[cell] = 1;
+                alarms->num_alarms ++;
+            }
+        }
+    }
+}
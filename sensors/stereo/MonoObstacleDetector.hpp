@@ -0,0 +1,74 @@
+#ifndef MONO_OBSTACLE_DETECTOR_H_
+#define MONO_OBSTACLE_DETECTOR_H_
+
+/**
+ * Coarse obstacle alarms from one camera, for when the other one has died
+ * (see CameraHealthMonitor).  The image is rectified and run through
+ * pushbroom stereo's interest operator (nearest neighbor remap of the
+ * search region, 3x3 Laplacian, block sums against sobelLimit), and for
+ * each cell of a coarse grid it reports:
+ *
+ *   texture: fraction of the cell's blocks that pass the interest operator
+ *   flow:    mean change in grey level since the last frame
+ *
+ * A cell alarms when it is both textured and changing fast, which is what
+ * something close and getting closer looks like to one camera.  It's a lot
+ * cheaper than stereo, which leaves CPU for resetting the dead camera.
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#include "opencv2/opencv.hpp"
+
+#include "pushbroom-stereo.hpp"
+
+// size of the alarm grid over the search region
+#define MONO_GRID_ROWS 4
+#define MONO_GRID_COLS 6
+
+// a cell alarms if at least this fraction of its blocks pass the interest
+// operator and its grey levels changed by at least this much (on average)
+// since the last frame
+#define MONO_TEXTURE_ALARM 0.4f
+#define MONO_FLOW_ALARM 12.0f
+
+using namespace std;
+using namespace cv;
+
+struct MonoObstacleAlarms {
+    // search region the grid covers, in rectified pixels
+    int roi_top;
+    int roi_bottom;
+    int roi_left;
+    int roi_right;
+
+    // MONO_GRID_ROWS * MONO_GRID_COLS cells, row by row
+    cv::vector<float> texture;
+    cv::vector<float> flow;
+    cv::vector<int8_t> alarm;
+
+    int num_alarms;
+};
+
+class MonoObstacleDetector {
+
+    public:
+        MonoObstacleDetector();
+
+        void ProcessImage(Mat image, Mat map, const PushbroomStereoState &state, MonoObstacleAlarms *alarms);
+
+        // forget the last frame, so the next one doesn't get a flow
+        // against a frame from another camera
+        void Reset() { has_last_frame_ = false; }
+
+    private:
+        Mat remapped_;
+        Mat last_remapped_;
+        Mat laplacian_;
+        Mat interest_integral_;
+
+        bool has_last_frame_;
+};
+
+#endif
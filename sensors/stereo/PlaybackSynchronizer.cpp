@@ -0,0 +1,189 @@
+#include "PlaybackSynchronizer.hpp"
+
+#include <algorithm>
+
+/**
+ * Sets up the synchronizer.  Call Open() before using it.
+ *
+ * @param lcm LCM object to deliver the log's messages on.  Usually a
+ *      "memq://" one, so the replay doesn't go out on the network.
+ * @param replay_channel channel with a stereo message for every frame
+ * @param speed 1 for real time, 2 for twice as fast, etc. or 0 for as fast
+ *      as possible
+ */
+PlaybackSynchronizer::PlaybackSynchronizer(lcm_t *lcm, string replay_channel, double speed) {
+
+    lcm_ = lcm;
+    replay_channel_ = replay_channel;
+    speed_ = max(speed, 0.0);
+
+    log_ = NULL;
+    next_frame_ = 0;
+    clock_started_ = false;
+    clock_start_utime_ = 0;
+    log_start_utime_ = 0;
+}
+
+PlaybackSynchronizer::~PlaybackSynchronizer() {
+
+    if (log_ != NULL) {
+        lcm_eventlog_destroy(log_);
+    }
+}
+
+/**
+ * Opens an LCM log and finds the frames.  The log's index (see LogIndex.hpp)
+ * is loaded, or built and saved the first time, so only the replay
+ * channel's messages are read, and those are decoded on several threads.
+ *
+ * @param log_filename LCM log to replay
+ *
+ * @retval true on success
+ */
+bool PlaybackSynchronizer::Open(string log_filename) {
+
+    log_ = lcm_eventlog_create(log_filename.c_str(), "r");
+
+    if (log_ == NULL) {
+        cerr << "Error: failed to open LCM log " << log_filename << endl;
+        return false;
+    }
+
+    printf("Indexing %s... ", log_filename.c_str());
+    fflush(stdout);
+
+    LogIndex index;
+
+    if (!index.Open(log_filename)) {
+        cerr << "Error: failed to index LCM log " << log_filename << endl;
+        return false;
+    }
+
+    int channel = index.GetChannel(replay_channel_);
+
+    frames_.resize(channel < 0 ? 0 : index.GetChannelEvents(channel).size());
+
+    index.ForEachEvent(replay_channel_, INT64_MIN, INT64_MAX,
+        [this](size_t i, const LogIndexEvent &event, const uint8_t *data) {
+
+            lcmt_stereo msg;
+
+            if (lcmt_stereo_decode(data, 0, event.data_size, &msg) < 0) {
+                // dropped below
+                frames_[i].offset = -1;
+                return false;
+            }
+
+            frames_[i].timestamp = event.timestamp;
+            frames_[i].offset = event.offset;
+            frames_[i].frame_number = msg.frame_number;
+            frames_[i].video_number = msg.video_number;
+
+            lcmt_stereo_decode_cleanup(&msg);
+            return true;
+        });
+
+    frames_.erase(remove_if(frames_.begin(), frames_.end(),
+        [](const PlaybackFrame &frame) { return frame.offset < 0; }), frames_.end());
+
+    printf("done (%d frames).\n", (int)frames_.size());
+
+    if (frames_.size() == 0) {
+        cerr << "Error: no messages on " << replay_channel_ << " in " << log_filename << endl;
+        return false;
+    }
+
+    SeekToFrame(0);
+
+    return true;
+}
+
+/**
+ * Moves to the first frame at or after a frame number.  The next
+ * NextFrame() delivers the messages from the frame before it on.
+ *
+ * @param frame_number frame to play next
+ */
+void PlaybackSynchronizer::SeekToFrame(int frame_number) {
+
+    next_frame_ = 0;
+
+    while (next_frame_ < (int)frames_.size() && frames_[next_frame_].frame_number < frame_number) {
+        next_frame_ ++;
+    }
+
+    if (next_frame_ == 0) {
+        fseeko(log_->f, 0, SEEK_SET);
+
+    } else {
+        // start right after the last frame's message
+        fseeko(log_->f, frames_[next_frame_ - 1].offset, SEEK_SET);
+
+        lcm_eventlog_event_t *event = lcm_eventlog_read_next_event(log_);
+
+        if (event != NULL) {
+            lcm_eventlog_free_event(event);
+        }
+    }
+
+    clock_started_ = false;
+}
+
+/**
+ * Delivers the log's messages up to and including the next frame's stereo
+ * message, waiting until it's due on the log's clock (unless running as
+ * fast as possible).  The messages are handled before this returns.
+ *
+ * @retval false at the end of the log
+ */
+bool PlaybackSynchronizer::NextFrame() {
+
+    if (next_frame_ >= (int)frames_.size()) {
+        return false;
+    }
+
+    const PlaybackFrame &frame = frames_[next_frame_];
+
+    while (true) {
+
+        off_t offset = ftello(log_->f);
+
+        lcm_eventlog_event_t *event = lcm_eventlog_read_next_event(log_);
+
+        if (event == NULL) {
+            break;
+        }
+
+        lcm_publish(lcm_, event->channel, event->data, event->datalen);
+
+        lcm_eventlog_free_event(event);
+
+        if (offset >= frame.offset) {
+            break;
+        }
+    }
+
+    if (speed_ > 0) {
+        int64_t now = GetWallNow();
+
+        if (clock_started_ != true) {
+            clock_started_ = true;
+            clock_start_utime_ = now;
+            log_start_utime_ = frame.timestamp;
+
+        } else {
+            // if stereo is slower than this, it just runs behind
+            int64_t due = clock_start_utime_ + (frame.timestamp - log_start_utime_) / speed_;
+
+            if (due > now) {
+                usleep(due - now);
+            }
+        }
+    }
+
+    while (NonBlockingLcm(lcm_)) {}
+
+    next_frame_ ++;
+
+    return true;
+}
@@ -0,0 +1,73 @@
+#ifndef PLAYBACK_SYNCHRONIZER_H_
+#define PLAYBACK_SYNCHRONIZER_H_
+
+/**
+ * Replays a video against an LCM log of the flight without lcm-logplayer.
+ * Finds the frames by the stereo messages on the replay channel (one per
+ * camera frame), then for each frame delivers every message up to and
+ * including that frame's, so the replay handlers pick the frame and the
+ * HUD is up to date.  Runs on the log's clock at any speed, or as fast as
+ * the frames get processed, and never skips a frame, so runs over the same
+ * log are repeatable.
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#include "opencv-stereo-util.hpp"
+
+#include <lcm/lcm.h>
+#include "../../LCM/lcmt_stereo.h"
+
+#include "../../utils/LogIndex/LogIndex.hpp"
+
+using namespace std;
+using namespace cv;
+
+/**
+ * A camera frame in the LCM log: where its stereo message is.
+ */
+struct PlaybackFrame {
+    int64_t timestamp;  // when the log got the message
+    off_t offset;       // of the message in the log
+
+    int64_t frame_number;
+    int32_t video_number;
+};
+
+class PlaybackSynchronizer {
+
+    public:
+        PlaybackSynchronizer(lcm_t *lcm, string replay_channel, double speed);
+        ~PlaybackSynchronizer();
+
+        bool Open(string log_filename);
+
+        void SeekToFrame(int frame_number);
+
+        bool NextFrame();
+
+        // frames played and in the log
+        int GetFrameIndex() { return next_frame_; }
+        int GetNumFrames() { return frames_.size(); }
+
+    private:
+        lcm_t *lcm_;
+        string replay_channel_;
+
+        // 1 for real time, 0 for as fast as possible
+        double speed_;
+
+        lcm_eventlog_t *log_;
+
+        cv::vector<PlaybackFrame> frames_;
+        int next_frame_;
+
+        // wall clock and log time of the first frame since the last seek,
+        // for pacing
+        bool clock_started_;
+        int64_t clock_start_utime_;
+        int64_t log_start_utime_;
+};
+
+#endif
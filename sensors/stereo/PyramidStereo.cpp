@@ -0,0 +1,207 @@
+#include "PyramidStereo.hpp"
+
+#include <stdio.h>
+#include <algorithm>
+
+// a full-resolution disparity or row at half resolution, keeping -1 (for
+// "the edge of the image") as it is
+static int Halve(int x) {
+    return x < 0 ? -((-x + 1) / 2) : (x + 1) / 2;
+}
+
+static int HalveLimit(int x) {
+    return x < 0 ? x : x / 2;
+}
+
+/**
+ * @param disparities full-resolution disparities to look for far
+ *      obstacles at (up to MAX_DISPARITIES).  Leave out the ones the main
+ *      search already does, or its hits get found twice.
+ * @param margin pixels to search around each coarse hit, at full
+ *      resolution
+ * @param thread_config workers for the coarse pass
+ */
+PyramidStereo::PyramidStereo(const cv::vector<int> &disparities, int margin, PushbroomStereoThreadConfig thread_config)
+    : coarse_stereo_(thread_config) {
+
+    disparities_.assign(disparities.begin(), disparities.begin() + min((int)disparities.size(), MAX_DISPARITIES));
+
+    margin_ = margin;
+
+    full_map_left_ = NULL;
+    full_map_right_ = NULL;
+
+    coarse_buffers_.number_of_points = 0;
+    fine_buffers_.number_of_points = 0;
+}
+
+/**
+ * Looks for far obstacles in a frame and adds the ones it finds to the
+ * frame's hits.
+ *
+ * @param _leftImage left camera image as a CV_8UC1
+ * @param _rightImage right camera image as a CV_8UC1
+ * @param stereo full-resolution stereo, with its last frame already
+ *      collected.  Its timing includes the confirming pass.
+ * @param state the frame's stereo settings, as for ProcessImages()
+ * @param buffers (input/output) the frame's hits, which the far ones are
+ *      added after
+ * @param unit_conversion the 3D points are divided by this
+ */
+void PyramidStereo::ProcessImages(InputArray _leftImage, InputArray _rightImage, PushbroomStereo *stereo, PushbroomStereoState state, PushbroomStereoFrameBuffers *buffers, float unit_conversion) {
+
+    candidates_.clear();
+
+    if (disparities_.empty()) {
+        return;
+    }
+
+    Mat left_image = _leftImage.getMat();
+    Mat right_image = _rightImage.getMat();
+
+    UpdateCoarseMaps(state);
+
+    // the camera images get blurred before they're halved, so texture
+    // finer than a coarse pixel doesn't alias into false matches
+    pyrDown(left_image, coarse_left_);
+    pyrDown(right_image, coarse_right_);
+
+    PushbroomStereoState coarse_state = state;
+
+    coarse_state.mapxL = coarse_map_left_;
+    coarse_state.mapxR = coarse_map_right_;
+
+    coarse_state.num_disparities = 0;
+
+    for (size_t i = 0; i < disparities_.size(); i++) {
+        int disparity = Halve(disparities_[i]);
+
+        // neighboring full-resolution disparities can halve to the same
+        // one
+        if (std::find(coarse_state.disparities, coarse_state.disparities + coarse_state.num_disparities, disparity)
+            == coarse_state.disparities + coarse_state.num_disparities) {
+
+            coarse_state.disparities[coarse_state.num_disparities++] = disparity;
+        }
+    }
+
+    coarse_state.disparity = coarse_state.disparities[0];
+    coarse_state.zero_dist_disparity = Halve(state.zero_dist_disparity);
+
+    coarse_state.lastValidPixelRow = HalveLimit(state.lastValidPixelRow);
+    coarse_state.roi_top = HalveLimit(state.roi_top);
+    coarse_state.roi_bottom = HalveLimit(state.roi_bottom);
+    coarse_state.roi_left = HalveLimit(state.roi_left);
+    coarse_state.roi_right = HalveLimit(state.roi_right);
+
+    if (!state.roi_mask.empty()) {
+        resize(state.roi_mask, coarse_state.roi_mask, coarse_map_left_.size(), 0, 0, INTER_NEAREST);
+    }
+
+    // only the coarse hits' image coordinates get used, so Q doesn't need
+    // scaling and nothing else is worth doing at this resolution
+    coarse_state.show_display = false;
+    coarse_state.keep_rectified = false;
+    coarse_state.subpixel_refinement = false;
+    coarse_state.temporal_skip = false;
+    coarse_state.deadline_us = 0;
+    coarse_state.random_results = -1;
+
+    coarse_stereo_.ProcessImages(coarse_left_, coarse_right_, &coarse_buffers_, coarse_state);
+
+    // a coarse block covers twice its size at full resolution
+    int extent = state.blockSize + margin_;
+
+    for (int i = 0; i < coarse_buffers_.number_of_points; i++) {
+        const Point3f &hit = coarse_buffers_.image_hits[i];
+
+        candidates_.push_back(Rect(cvRound(2 * hit.x) - extent, cvRound(2 * hit.y) - extent, 2 * extent, 2 * extent));
+    }
+
+    if (candidates_.empty()) {
+        return;
+    }
+
+    PushbroomStereoState fine_state = state;
+
+    fine_state.num_disparities = disparities_.size();
+    std::copy(disparities_.begin(), disparities_.end(), fine_state.disparities);
+    fine_state.disparity = disparities_[0];
+
+    // the candidates only work on the CPU, the main search already made
+    // the rectified images and has the temporal skip history, and the
+    // deadline was the main search's
+    fine_state.use_opencl = false;
+    fine_state.keep_rectified = false;
+    fine_state.temporal_skip = false;
+    fine_state.deadline_us = 0;
+
+    if (!stereo->Submit(left_image, right_image, fine_state, &candidates_)) {
+        fprintf(stderr, "Warning: stereo still has a frame in flight, skipping the far search.\n");
+        return;
+    }
+
+    if (!stereo->PollPredicted(&fine_buffers_, unit_conversion, true, false)) {
+        // none of the candidates were in the search region, so the
+        // whole frame got searched
+        stereo->Poll(&fine_buffers_, unit_conversion, true);
+    }
+
+    AppendHits(fine_buffers_, buffers);
+}
+
+/**
+ * Makes the half-resolution maps the first time and whenever the
+ * calibration changes.
+ *
+ * @param state full-resolution stereo settings with the maps
+ */
+void PyramidStereo::UpdateCoarseMaps(const PushbroomStereoState &state) {
+
+    if (state.mapxL.data == full_map_left_ && state.mapxR.data == full_map_right_) {
+        return;
+    }
+
+    Mat sampled;
+
+    // every other pixel of the rectified image, from half as far into the
+    // camera image
+    resize(state.mapxL, sampled, Size(state.mapxL.cols / 2, state.mapxL.rows / 2), 0, 0, INTER_NEAREST);
+    sampled.convertTo(coarse_map_left_, state.mapxL.type(), 0.5);
+
+    resize(state.mapxR, sampled, Size(state.mapxR.cols / 2, state.mapxR.rows / 2), 0, 0, INTER_NEAREST);
+    sampled.convertTo(coarse_map_right_, state.mapxR.type(), 0.5);
+
+    full_map_left_ = state.mapxL.data;
+    full_map_right_ = state.mapxR.data;
+}
+
+/**
+ * Adds one pass's hits after another's.
+ *
+ * @param from hits to add
+ * @param to (input/output) hits to add them to
+ */
+void PyramidStereo::AppendHits(const PushbroomStereoFrameBuffers &from, PushbroomStereoFrameBuffers *to) {
+
+    int start = to->number_of_points;
+    int count = from.number_of_points;
+
+    to->number_of_points = start + count;
+
+    to->x.resize(start + count);
+    to->y.resize(start + count);
+    to->z.resize(start + count);
+    to->grey.resize(start + count);
+    to->disparities.resize(start + count);
+    to->image_hits.resize(start + count);
+
+    std::copy(from.x.begin(), from.x.begin() + count, to->x.begin() + start);
+    std::copy(from.y.begin(), from.y.begin() + count, to->y.begin() + start);
+    std::copy(from.z.begin(), from.z.begin() + count, to->z.begin() + start);
+    std::copy(from.grey.begin(), from.grey.begin() + count, to->grey.begin() + start);
+    std::copy(from.disparities.begin(), from.disparities.begin() + count, to->disparities.begin() + start);
+    std::copy(from.image_hits.begin(), from.image_hits.begin() + count, to->image_hits.begin() + start);
+
+    to->pointVector2d.insert(to->pointVector2d.end(), from.pointVector2d.begin(), from.pointVector2d.end());
+}
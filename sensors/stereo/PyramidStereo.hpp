@@ -0,0 +1,64 @@
+#ifndef PYRAMID_STEREO_H_
+#define PYRAMID_STEREO_H_
+
+/**
+ * Coarse-to-fine search for far obstacles.  Far obstacles have small
+ * disparities, which at full resolution take extra disparities (and
+ * extra passes over the image) to cover.  Instead, a half-resolution pass
+ * looks for them at half the disparities on a quarter of the pixels, and
+ * only the blocks around its hits are searched at full resolution
+ * (through PushbroomStereo's predicted regions), so only those become
+ * hits.
+ *
+ *   pushbroom_stereo.Poll(&buffers, unit_conversion, true);
+ *   pyramid_stereo.ProcessImages(left, right, &pushbroom_stereo, state, &buffers, unit_conversion);
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#include "opencv2/opencv.hpp"
+#include "pushbroom-stereo.hpp"
+
+class PyramidStereo {
+
+    public:
+        PyramidStereo(const cv::vector<int> &disparities, int margin, PushbroomStereoThreadConfig thread_config);
+
+        void ProcessImages(InputArray _leftImage, InputArray _rightImage, PushbroomStereo *stereo, PushbroomStereoState state, PushbroomStereoFrameBuffers *buffers, float unit_conversion = 1);
+
+        // full-resolution regions the last frame's coarse pass found
+        // something in
+        const cv::vector<Rect>& GetCandidates() const { return candidates_; }
+
+    private:
+        void UpdateCoarseMaps(const PushbroomStereoState &state);
+        static void AppendHits(const PushbroomStereoFrameBuffers &from, PushbroomStereoFrameBuffers *to);
+
+        // full-resolution disparities to find far obstacles at
+        cv::vector<int> disparities_;
+
+        // pixels to search around each coarse hit, at full resolution
+        int margin_;
+
+        PushbroomStereo coarse_stereo_;
+
+        // the full-resolution maps sampled every other pixel, pointing
+        // into the half-resolution camera images
+        Mat coarse_map_left_;
+        Mat coarse_map_right_;
+
+        // what they were made from
+        const uchar *full_map_left_;
+        const uchar *full_map_right_;
+
+        Mat coarse_left_;
+        Mat coarse_right_;
+
+        PushbroomStereoFrameBuffers coarse_buffers_;
+        PushbroomStereoFrameBuffers fine_buffers_;
+
+        cv::vector<Rect> candidates_;
+};
+
+#endif
@@ -1,6 +1,6 @@
 #include "RecordingManager.hpp"
 
-RecordingManager::RecordingManager() {
+RecordingManager::RecordingManager() : compress_memory_(MEMORY_RECORDING) {
 
     using_video_from_disk_ = false;
     using_video_directory_ = false;
@@ -14,6 +14,43 @@ RecordingManager::RecordingManager() {
 
     left_video_capture_ = NULL;
     right_video_capture_ = NULL;
+    avi_frame_count_ = 0;
+    avi_next_position_ = -1;
+
+    prefetch_running_ = false;
+    stop_prefetch_ = false;
+    prefetch_next_ = 0;
+    prefetch_in_flight_ = -1;
+    prefetch_generation_ = 0;
+
+    ringbuffer_ = NULL;
+    ringbuffer_bytes_ = 0;
+    rec_num_frames_ = 0;
+    ring_size_ = RINGBUFFER_SIZE;
+
+    ring_head_ = 0;
+    ring_written_ = 0;
+
+    streaming_ = false;
+    stream_fd_ = -1;
+    stream_compressed_ = false;
+    compress_write_buffer_ = NULL;
+    compress_write_buffer_bytes_ = 0;
+    stop_writer_ = false;
+    num_dropped_frames_ = 0;
+
+    triggered_ = false;
+    trigger_pre_us_ = 0;
+    trigger_post_us_ = 0;
+    trigger_decimation_ = 1;
+    num_decimated_frames_ = 0;
+
+    metadata_file_ = NULL;
+
+    reading_recording_file_ = false;
+    recording_file_fd_ = -1;
+    recording_file_map_ = NULL;
+    recording_file_map_bytes_ = 0;
 
     init_ok_ = false;
 
@@ -21,6 +58,9 @@ RecordingManager::RecordingManager() {
 
 RecordingManager::~RecordingManager() {
 
+    // it reads from the captures
+    StopPrefetch();
+
     if (left_video_capture_) {
         delete left_video_capture_;
     }
@@ -28,11 +68,43 @@ RecordingManager::~RecordingManager() {
     if (right_video_capture_) {
         delete right_video_capture_;
     }
+
+    CloseRecordingFile();
+    CloseMetadataFile();
+
+    // the writer reads from the ringbuffer, so it has to stop first
+    FinishStreaming();
+    FreeRingbuffer();
+
+    free(compress_write_buffer_);
+    MemoryAccountFree(MEMORY_RECORDING, compress_write_buffer_bytes_);
 }
 
 void RecordingManager::Init(OpenCvStereoConfig stereo_config) {
 
     stereo_config_ = stereo_config;
+    streaming_ = stereo_config.streamRecording;
+
+    triggered_ = stereo_config.triggeredRecording;
+
+    if (triggered_) {
+        if (!streaming_) {
+            cerr << "Warning: cameras.triggeredRecording needs streamRecording, streaming the recording." << endl;
+            streaming_ = true;
+        }
+
+        trigger_pre_us_ = stereo_config.triggerPreSeconds * 1000000;
+        trigger_post_us_ = stereo_config.triggerPostSeconds * 1000000;
+        trigger_decimation_ = max(1, stereo_config.triggerDecimation);
+
+        // the writer stays the pre-trigger time behind, so that's all the
+        // ringbuffer has to hold
+        ring_size_ = min(RINGBUFFER_SIZE,
+            (int)((stereo_config.triggerPreSeconds + RECORDING_TRIGGER_SLACK_SECONDS) * RINGBUFFER_FRAMERATE));
+    } else {
+        ring_size_ = RINGBUFFER_SIZE;
+    }
+
     init_ok_ = true;
 
 }
@@ -50,13 +122,42 @@ bool RecordingManager::InitRecording(Mat image_left, Mat image_right) {
     printf("Allocating ringbuffer data... ");
     fflush(stdout);
 
-    for (int i=0; i<RINGBUFFER_SIZE; i++)
-    {
-        ringbufferL[i].create(image_left.size(), image_left.type());
-        ringbufferR[i].create(image_right.size(), image_right.type());
+    FinishStreaming();
+    FreeRingbuffer();
+
+    SetRecordLayout(image_left, image_right);
+
+    ringbuffer_bytes_ = ring_size_ * ringbuffer_slot_bytes_;
+    ringbuffer_bytes_ = (ringbuffer_bytes_ + RINGBUFFER_HUGEPAGE_SIZE - 1)
+        / RINGBUFFER_HUGEPAGE_SIZE * RINGBUFFER_HUGEPAGE_SIZE;
+
+    // use hugepages if the kernel has enough reserved, otherwise normal
+    // pages.  Either way, fault every page in now so the frame loop never
+    // has to.
+    bool hugepages = true;
+
+    void *ringbuffer = mmap(NULL, ringbuffer_bytes_, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_HUGETLB, -1, 0);
+
+    if (ringbuffer == MAP_FAILED) {
+        hugepages = false;
+
+        ringbuffer = mmap(NULL, ringbuffer_bytes_, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    }
+
+    if (ringbuffer == MAP_FAILED) {
+        cerr << endl << "Error: failed to allocate " << (ringbuffer_bytes_ >> 20)
+            << " MB for the recording ringbuffer." << endl;
+
+        ringbuffer_bytes_ = 0;
+        return false;
     }
 
-    printf("done.\n");
+    ringbuffer_ = (uchar*) ringbuffer;
+    MemoryAccountAlloc(MEMORY_RECORDING, ringbuffer_bytes_);
+
+    printf("done (%d MB%s).\n", (int)(ringbuffer_bytes_ >> 20), hugepages ? " in hugepages" : "");
 
     BeginNewRecording();
 
@@ -65,380 +166,1816 @@ bool RecordingManager::InitRecording(Mat image_left, Mat image_right) {
 }
 
 /**
- * Sets up variables to start recording on the next frame.
+ * Sets up variables to start recording on the next frame.  When streaming,
+ * finishes the last .rec file and starts a new one.
  */
 void RecordingManager::BeginNewRecording() {
 
-    // get a new filename
+    FinishStreaming();
+
+    // get a new filename (.rec files are numbered like AVIs)
     if (video_number_ < 0) {
-        video_number_ = GetNextVideoNumber(stereo_config_.usePGM, true);
+        video_number_ = GetNextVideoNumber(stereo_config_.usePGM && !streaming_, true);
     } else {
         video_number_ ++;
+        WriteNumberManifest(GetDateSring(), video_number_);
     }
 
     // reset the number of frames we've recorded
     rec_num_frames_ = 0;
+    ring_head_ = 0;
+    ring_written_ = 0;
+    num_dropped_frames_ = 0;
+    num_decimated_frames_ = 0;
+
+    {
+        std::unique_lock<std::mutex> locker(trigger_mutex_);
+        trigger_windows_.clear();
+    }
+
+    if (streaming_) {
+        StartStreaming();
+    }
+
+    if (stereo_config_.recordMetadata) {
+        OpenMetadataFile();
+    }
 
     recording_on_ = true;
 }
 
+/**
+ * Copies frames into the recording buffer.  The frames can be reused or go
+ * back to the camera as soon as this returns.
+ *
+ * @param image_left left camera image
+ * @param image_right right camera image
+ */
 void RecordingManager::AddFrames(Mat image_left, Mat image_right) {
 
-    if (recording_on_) {
-        ringbufferL[rec_num_frames_%RINGBUFFER_SIZE] = image_left;
-        ringbufferR[rec_num_frames_%RINGBUFFER_SIZE] = image_right;
+    if (recording_on_ && ringbuffer_ != NULL) {
+
+        if (image_left.size() != ringbuffer_frame_size_[0] || image_left.type() != ringbuffer_frame_type_[0]
+            || image_right.size() != ringbuffer_frame_size_[1] || image_right.type() != ringbuffer_frame_type_[1]) {
+
+            cerr << "Warning: frame doesn't match the ringbuffer, not recording it." << endl;
+            return;
+        }
+
+        long long head = ring_head_.load(memory_order_relaxed);
+
+        if (stream_fd_ >= 0 && head - ring_written_.load(memory_order_acquire) >= ring_size_) {
+            // the disk is a whole ringbuffer behind, so drop this frame
+            // instead of overwriting ones that aren't written yet
+            num_dropped_frames_ ++;
+            rec_num_frames_ ++;
+            return;
+        }
+
+        RecordingFrameHeader *frame_header = (RecordingFrameHeader*) GetRingbufferSlot(head);
+        frame_header->frame_number = rec_num_frames_;
+        frame_header->timestamp = GetWallNow();
+
+        // copy into the preallocated buffers instead of keeping the frame
+        // (which is usually still in the camera's DMA buffer).  The slots
+        // are the right size already, so copyTo just copies.
+        Mat slot_left = GetRingbufferFrame(0, head);
+        Mat slot_right = GetRingbufferFrame(1, head);
+
+        image_left.copyTo(slot_left);
+        image_right.copyTo(slot_right);
+
+        // hand the slot to the writer
+        ring_head_.store(head + 1, memory_order_release);
 
         rec_num_frames_ ++;
     }
 }
 
-void RecordingManager::FlushBufferToDisk() {
-
+/**
+ * Starts a .meta file for the recording, named like its .rec file.
+ * Finishes the last one.
+ */
+void RecordingManager::OpenMetadataFile() {
 
-    printf("Writing video...\n");
+    CloseMetadataFile();
 
-    int endI, firstFrame = 0;
-    if (rec_num_frames_ < RINGBUFFER_SIZE)
-    {
-        endI = rec_num_frames_;
-    } else {
-        // our buffer is smaller than the full movie.
-        // figure out where in the ringbuffer we are
-        firstFrame = rec_num_frames_%RINGBUFFER_SIZE+1;
-        if (firstFrame > RINGBUFFER_SIZE)
-        {
-            firstFrame = 0;
-        }
+    CheckOrCreateDirectory(stereo_config_.videoSaveDir);
 
-        endI = RINGBUFFER_SIZE;
+    string filename = GetNextVideoFilename("videoLR", true, false) + RECORDING_METADATA_FILE_EXTENSION;
 
-        printf("\nWARNING: buffer size exceeded by %d frames, which have been dropped.\n\n", rec_num_frames_ - RINGBUFFER_SIZE);
+    metadata_file_ = fopen(filename.c_str(), "wb");
 
+    if (metadata_file_ == NULL) {
+        cerr << "Warning: failed to open " << filename << " (" << strerror(errno) << "), not recording metadata." << endl;
+        return;
     }
 
-    if (stereo_config_.usePGM) {
-        printf("Using PGM format...\n");
+    setvbuf(metadata_file_, NULL, _IOFBF, RECORDING_METADATA_BUFFER_BYTES);
 
-        string video_l_dir = SetupVideoWriterPGM("videoL-skip-" + std::to_string(firstFrame), true);
+    RecordingMetadataFileHeader header;
+    memset(&header, 0, sizeof(header));
 
-        string video_r_dir = SetupVideoWriterPGM("videoR-skip-" + std::to_string(firstFrame), false);
+    memcpy(header.magic, RECORDING_METADATA_FILE_MAGIC, sizeof(header.magic));
+    header.record_bytes = sizeof(RecordingFrameMetadata);
 
-        // write the video
-        for (int i = 0; i < endI; i++) {
+    fwrite(&header, sizeof(header), 1, metadata_file_);
+}
 
-            boost::format formatter_left = boost::format("/left%05d.pgm") % i;
-            string im_name_left = formatter_left.str();
+void RecordingManager::CloseMetadataFile() {
 
-            boost::format formatter_right = boost::format("/right%05d.pgm") % i;
-            string im_name_right = formatter_right.str();
+    if (metadata_file_ != NULL) {
+        fclose(metadata_file_);
+        metadata_file_ = NULL;
+    }
+}
 
-            imwrite( video_l_dir + im_name_left, ringbufferL[(i+firstFrame)%RINGBUFFER_SIZE]);
+/**
+ * Adds a frame's metadata to the .meta file.  Does nothing unless
+ * cameras.recordMetadata is on and we're recording.
+ *
+ * @param metadata the frame's metadata
+ */
+void RecordingManager::AddFrameMetadata(const RecordingFrameMetadata &metadata) {
 
-            imwrite( video_r_dir + im_name_right, ringbufferR[(i+firstFrame)%RINGBUFFER_SIZE]);
+    if (metadata_file_ == NULL || !recording_on_) {
+        return;
+    }
 
-            if (quiet_mode_ == false || i % 100 == 0) {
-                printf("\rWriting video: (%.1f%%) -- %d/%d frames", (float)(i+1)/endI*100, i+1, endI);
-                fflush(stdout);
-            }
-        }
+    if (fwrite(&metadata, sizeof(metadata), 1, metadata_file_) != 1) {
+        cerr << "Warning: failed to write metadata (" << strerror(errno) << "), not recording any more of it." << endl;
+        CloseMetadataFile();
+    }
+}
+
+/**
+ * Reads a .meta file.
+ *
+ * @param filename file to read
+ * @param metadata (output) each frame's metadata, in the order they were
+ *      recorded
+ *
+ * @retval false if the file couldn't be read or isn't a .meta file
+ */
+bool RecordingManager::ReadMetadataFile(string filename, cv::vector<RecordingFrameMetadata> *metadata) {
 
+    metadata->clear();
 
-    } else {
-        VideoWriter recordL = SetupVideoWriterAVI("videoL-skip-" + std::to_string(firstFrame), ringbufferL[0].size(), true);
+    FILE *file = fopen(filename.c_str(), "rb");
 
-        VideoWriter recordR = SetupVideoWriterAVI("videoR-skip-"
-            + std::to_string(firstFrame), ringbufferR[0].size(), false);
+    if (file == NULL) {
+        cerr << "Error: failed to open " << filename << " (" << strerror(errno) << ")." << endl;
+        return false;
+    }
 
-        // write the video
-        for (int i=0; i<endI; i++)
-        {
-            recordL << ringbufferL[(i+firstFrame)%RINGBUFFER_SIZE];
-            recordR << ringbufferR[(i+firstFrame)%RINGBUFFER_SIZE];
+    RecordingMetadataFileHeader header;
 
-            if (quiet_mode_ == false || i % 100 == 0) {
-                printf("\rWriting video: (%.1f%%) -- %d/%d frames", (float)(i+1)/endI*100, i+1, endI);
-                fflush(stdout);
-            }
-        }
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.magic, RECORDING_METADATA_FILE_MAGIC, sizeof(header.magic)) != 0
+        || header.record_bytes != (int32_t)sizeof(RecordingFrameMetadata)) {
+
+        cerr << "Error: " << filename << " isn't a metadata file from this version." << endl;
+        fclose(file);
+        return false;
     }
-    printf("\ndone.\n");
+
+    RecordingFrameMetadata record;
+
+    // a partial record at the end is from the program dying while
+    // recording
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        metadata->push_back(record);
+    }
+
+    fclose(file);
+
+    return true;
 }
 
+/**
+ * Gets a slot in the ringbuffer.
+ *
+ * @param slot_number slot number (wraps around the ringbuffer)
+ *
+ * @retval start of the slot
+ */
+uchar* RecordingManager::GetRingbufferSlot(long long slot_number) {
 
+    return ringbuffer_ + (size_t)(slot_number % ring_size_) * ringbuffer_slot_bytes_;
+}
 
 /**
- * Sets up a video writer for .AVI files with the given filename
+ * Gets a frame in the ringbuffer.  The Mat points into the ringbuffer, so
+ * writing to it changes the recording.
  *
- * @param frameSize size of the frames
- * @param filenamePrefix prefix for the new video filename
- * @param configStruct OpenCvStereoConfig structure
- *   for reading the directory things should be saved in
- *   and other data.
- * @param increment_number Default is true.  Set to false to
- *   not increment the video number.  Used for stereo vision
- *   systems if you want to have a left and right video with
- *   the same number (ie set to false for the second writer
- *   you initialize.)
- * @param this_video_number (optional) if non-null, then the video number will be supplied
- * @param is_color true if it is color
- *  @default false
+ * @param camera_number 0 for left, 1 for right
+ * @param slot_number slot number (wraps around the ringbuffer)
  *
- * @retval VideoWriter object
+ * @retval the frame
  */
-VideoWriter RecordingManager::SetupVideoWriterAVI(string filenamePrefix, Size frameSize, bool increment_number, bool is_color, int *this_video_number) {
+Mat RecordingManager::GetRingbufferFrame(int camera_number, long long slot_number) {
 
-    VideoWriter recorder;
+    return GetRecordFrame(camera_number, GetRingbufferSlot(slot_number));
+}
 
-    CheckOrCreateDirectory(stereo_config_.videoSaveDir);
+/**
+ * Gets a frame in an uncompressed record, laid out like the ringbuffer
+ * slots.
+ *
+ * @param camera_number 0 for left, 1 for right
+ * @param record start of the record
+ *
+ * @retval the frame, pointing into the record
+ */
+Mat RecordingManager::GetRecordFrame(int camera_number, uchar *record) {
 
-    string filename = GetNextVideoFilename(filenamePrefix, false, increment_number, this_video_number);
+    uchar *frame = record + sizeof(RecordingFrameHeader);
 
-    char fourcc1 = stereo_config_.fourcc.at(0);
-    char fourcc2 = stereo_config_.fourcc.at(1);
-    char fourcc3 = stereo_config_.fourcc.at(2);
-    char fourcc4 = stereo_config_.fourcc.at(3);
+    if (camera_number == 1) {
+        frame += ringbuffer_frame_bytes_[0];
+    }
 
-    recorder.open(filename, CV_FOURCC(fourcc1, fourcc2, fourcc3, fourcc4), 30, frameSize, is_color);
-    if (!recorder.isOpened())
-    {
-        printf("VideoWriter failed to open!\n");
-    } else {
-        cout << endl << "Opened " << filename << endl;
+    return Mat(ringbuffer_frame_size_[camera_number], ringbuffer_frame_type_[camera_number], frame);
+}
+
+/**
+ * Sets up the layout of the ringbuffer slots (and .rec file records) for
+ * frames like these.
+ *
+ * @param image_left left camera image
+ * @param image_right right camera image
+ */
+void RecordingManager::SetRecordLayout(Mat image_left, Mat image_right) {
+
+    Mat images[2] = { image_left, image_right };
+
+    for (int i = 0; i < 2; i++) {
+        ringbuffer_frame_size_[i] = images[i].size();
+        ringbuffer_frame_type_[i] = images[i].type();
+        ringbuffer_frame_bytes_[i] = images[i].total() * images[i].elemSize();
     }
 
-    return recorder;
+    ringbuffer_slot_bytes_ = sizeof(RecordingFrameHeader) + ringbuffer_frame_bytes_[0] + ringbuffer_frame_bytes_[1];
+    ringbuffer_slot_bytes_ = (ringbuffer_slot_bytes_ + RECORDING_BLOCK_SIZE - 1)
+        / RECORDING_BLOCK_SIZE * RECORDING_BLOCK_SIZE;
 }
 
+void RecordingManager::FreeRingbuffer() {
+
+    if (ringbuffer_ != NULL) {
+        munmap(ringbuffer_, ringbuffer_bytes_);
+        MemoryAccountFree(MEMORY_RECORDING, ringbuffer_bytes_);
+        ringbuffer_ = NULL;
+    }
+}
 
 /**
- * Sets up the system to write .pgm files into a directory named in a nice way.
- *
- * @param dirnamePrefix prefix for the save directory
- * @param configStruct OpenCvStereoConfig struct, used for configStruct.videoSaveDir
+ * Opens a new .rec file and starts the writer thread that streams the
+ * ringbuffer into it.  If the file won't open, the recording stays in the
+ * ringbuffer and gets written out by FlushBufferToDisk() as usual.
+ */
+void RecordingManager::StartStreaming() {
+
+    if (ringbuffer_ == NULL) {
+        return;
+    }
+
+    CheckOrCreateDirectory(stereo_config_.videoSaveDir);
+
+    if (OpenStreamFile(GetNextVideoFilename("videoLR", true, false) + RECORDING_FILE_EXTENSION) != true) {
+        cerr << "Warning: keeping the recording in memory." << endl;
+        return;
+    }
+
+    cout << endl << "Streaming recording to " << stream_filename_
+        << (stream_direct_ ? " (O_DIRECT)" : "") << endl;
+
+    stop_writer_ = false;
+    pthread_create(&writer_thread_, NULL, WriterThread, this);
+}
+
+/**
+ * Creates a .rec file and writes its header, for records in the layout
+ * from SetRecordLayout().
  *
- * @retval directory path to use for saving images
+ * @param filename file to create
  *
+ * @retval true on success
  */
-string RecordingManager::SetupVideoWriterPGM(string dirnamePrefix, bool increment_number) {
+bool RecordingManager::OpenStreamFile(string filename) {
 
-    // make or use parent directory
+    stream_filename_ = filename;
+
+    // O_DIRECT keeps the video out of the page cache, but not every
+    // filesystem has it
+    stream_direct_ = true;
+    stream_fd_ = open(stream_filename_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+
+    if (stream_fd_ < 0 && errno == EINVAL) {
+        stream_direct_ = false;
+        stream_fd_ = open(stream_filename_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+
+    if (stream_fd_ < 0) {
+        cerr << endl << "Error: failed to open " << stream_filename_ << " (" << strerror(errno) << ")." << endl;
+        return false;
+    }
+
+    // O_DIRECT needs aligned memory
+    uchar *header_block;
+
+    if (posix_memalign((void**) &header_block, RECORDING_BLOCK_SIZE, RECORDING_BLOCK_SIZE) != 0) {
+        close(stream_fd_);
+        stream_fd_ = -1;
+        return false;
+    }
+
+    memset(header_block, 0, RECORDING_BLOCK_SIZE);
+
+    RecordingFileHeader *header = (RecordingFileHeader*) header_block;
+    memcpy(header->magic, RECORDING_FILE_MAGIC, sizeof(header->magic));
+
+    for (int i = 0; i < 2; i++) {
+        header->width[i] = ringbuffer_frame_size_[i].width;
+        header->height[i] = ringbuffer_frame_size_[i].height;
+        header->type[i] = ringbuffer_frame_type_[i];
+    }
+
+    header->record_bytes = ringbuffer_slot_bytes_;
+
+    stream_compressed_ = stereo_config_.compressRecording;
+    header->codec = stream_compressed_ ? RECORDING_CODEC_PNG : RECORDING_CODEC_RAW;
+
+    strncpy(header->metadata, recording_metadata_.c_str(), RECORDING_METADATA_BYTES - 1);
+
+    stream_unsynced_bytes_ = 0;
+    stream_write_failed_ = false;
+
+    stream_index_.clear();
+    stream_index_.reserve(RINGBUFFER_SIZE);
+
+    bool header_ok = WriteToStream(header_block, RECORDING_BLOCK_SIZE);
+
+    free(header_block);
+
+    if (header_ok != true) {
+        close(stream_fd_);
+        stream_fd_ = -1;
+        return false;
+    }
+
+    stream_offset_ = RECORDING_BLOCK_SIZE;
+
+    return true;
+}
+
+/**
+ * Waits for the writer to get everything in the ringbuffer onto disk, then
+ * closes the .rec file.  Does nothing if not streaming.
+ */
+void RecordingManager::FinishStreaming() {
+
+    if (stream_fd_ < 0) {
+        return;
+    }
+
+    // the writer drains the ringbuffer before it stops
+    stop_writer_ = true;
+    pthread_join(writer_thread_, NULL);
+
+    CloseStreamFile();
+
+    if (triggered_) {
+        printf("\nWrote %lld frames to %s (%d dropped, %d outside trigger windows).\n",
+            ring_written_.load() - num_decimated_frames_, stream_filename_.c_str(),
+            (int)num_dropped_frames_, (int)num_decimated_frames_);
+    } else {
+        printf("\nWrote %lld frames to %s (%d dropped).\n", ring_written_.load(), stream_filename_.c_str(), (int)num_dropped_frames_);
+    }
+}
+
+void* RecordingManager::WriterThread(void *x) {
+
+    ((RecordingManager*) x)->RunWriter();
+
+    return NULL;
+}
+
+/**
+ * Writes slots to the .rec file as AddFrames() fills them, in batches of
+ * whole slots straight out of the ringbuffer.  With triggered recording,
+ * skips the slots it doesn't keep.
+ */
+void RecordingManager::RunWriter() {
+
+    while (true) {
+
+        // stop_writer_ first, so nothing comes in after we've decided
+        // we're done
+        bool stopping = stop_writer_;
+
+        long long head = ring_head_.load(memory_order_acquire);
+        long long written = ring_written_.load(memory_order_relaxed);
+
+        if (triggered_ && !stopping) {
+            // leave the slots a trigger could still reach back to
+            head = GetDecidedHead(head, written);
+        }
+
+        if (head == written) {
+            if (stopping) {
+                return;
+            }
+
+            usleep(RECORDING_WRITER_POLL_US);
+            continue;
+        }
+
+        // write until the newest frame or the end of the ringbuffer,
+        // whichever is first
+        long long num_slots = min(head - written, (long long)(ring_size_ - written % ring_size_));
+        num_slots = min(num_slots, (long long)RECORDING_WRITE_BATCH);
+
+        if (triggered_) {
+            // just the run of slots that are all kept or all skipped
+            bool keep = KeepSlot(written);
+
+            long long run = 1;
+
+            while (run < num_slots && KeepSlot(written + run) == keep) {
+                run ++;
+            }
+
+            num_slots = run;
+
+            if (!keep) {
+                num_decimated_frames_ += num_slots;
+                ring_written_.store(written + num_slots, memory_order_release);
+                continue;
+            }
+        }
+
+        if (WriteRecords(GetRingbufferSlot(written), num_slots) != true) {
+            // those frames are lost, but keep trying with the next ones
+            num_dropped_frames_ += num_slots;
+        }
+
+        ring_written_.store(written + num_slots, memory_order_release);
+    }
+}
+
+/**
+ * Finds how far the triggered writer can go: slots older than the
+ * pre-trigger time, since no trigger from now on can reach back to them.
+ * If the ringbuffer is nearly full, it goes further anyway rather than
+ * making AddFrames() drop frames.
+ *
+ * @param head slots filled by AddFrames()
+ * @param written slots the writer has done
+ *
+ * @retval first slot the writer shouldn't touch yet
+ */
+long long RecordingManager::GetDecidedHead(long long head, long long written) {
+
+    int64_t now = GetWallNow();
+
+    long long decided = max(written, head - ring_size_ + RINGBUFFER_FRAMERATE * RECORDING_TRIGGER_SLACK_SECONDS / 2);
+
+    while (decided < head
+        && ((RecordingFrameHeader*) GetRingbufferSlot(decided))->timestamp + trigger_pre_us_ <= now) {
+
+        decided ++;
+    }
+
+    return decided;
+}
+
+/**
+ * Decides whether the triggered writer keeps a slot.  Has to be called on
+ * slots in order, since it forgets the windows that are past.
+ *
+ * @param slot_number slot to check
+ *
+ * @retval true if the frame is in a trigger window or on the decimation
+ */
+bool RecordingManager::KeepSlot(long long slot_number) {
+
+    const RecordingFrameHeader *frame_header = (RecordingFrameHeader*) GetRingbufferSlot(slot_number);
+
+    if (frame_header->frame_number % trigger_decimation_ == 0) {
+        return true;
+    }
+
+    std::unique_lock<std::mutex> locker(trigger_mutex_);
+
+    while (!trigger_windows_.empty() && trigger_windows_.front().second < frame_header->timestamp) {
+        trigger_windows_.pop_front();
+    }
+
+    return !trigger_windows_.empty() && trigger_windows_.front().first <= frame_header->timestamp;
+}
+
+/**
+ * Keeps every frame from triggerPreSeconds ago to triggerPostSeconds from
+ * now.  Does nothing unless cameras.triggeredRecording is on.  Safe to call
+ * from any thread.
+ */
+void RecordingManager::Trigger() {
+
+    if (!triggered_) {
+        return;
+    }
+
+    int64_t now = GetWallNow();
+
+    std::unique_lock<std::mutex> locker(trigger_mutex_);
+
+    if (!trigger_windows_.empty() && trigger_windows_.back().second >= now - trigger_pre_us_) {
+        // overlaps the last one, so make that one longer
+        trigger_windows_.back().second = now + trigger_post_us_;
+    } else {
+        trigger_windows_.push_back(make_pair(now - trigger_pre_us_, now + trigger_post_us_));
+    }
+}
+
+/**
+ * Appends to the .rec file.  Without O_DIRECT, syncs every
+ * RECORDING_SYNC_BYTES so the page cache doesn't fill up with video.
+ *
+ * @param data data to write (aligned to RECORDING_BLOCK_SIZE)
+ * @param bytes how much to write (a multiple of RECORDING_BLOCK_SIZE)
+ *
+ * @retval true on success
+ */
+bool RecordingManager::WriteToStream(const uchar *data, size_t bytes) {
+
+    size_t bytes_written = 0;
+
+    while (bytes_written < bytes) {
+
+        ssize_t result = write(stream_fd_, data + bytes_written, bytes - bytes_written);
+
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (result <= 0) {
+            if (stream_write_failed_ == false) {
+                cerr << endl << "Error: writing " << stream_filename_ << " failed (" << strerror(errno)
+                    << "), dropping frames." << endl;
+
+                stream_write_failed_ = true;
+            }
+
+            return false;
+        }
+
+        bytes_written += result;
+    }
+
+    if (stream_direct_ == false) {
+        stream_unsynced_bytes_ += bytes;
+
+        if (stream_unsynced_bytes_ >= RECORDING_SYNC_BYTES) {
+            fdatasync(stream_fd_);
+            stream_unsynced_bytes_ = 0;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Appends uncompressed records (laid out like the ringbuffer slots) to the
+ * .rec file, compressing them first if the file is compressed, and adds
+ * them to the index.
+ *
+ * @param records the records, one after another
+ * @param num_records how many (at most RECORDING_WRITE_BATCH)
+ *
+ * @retval true on success
+ */
+bool RecordingManager::WriteRecords(uchar *records, int num_records) {
+
+    if (stream_compressed_ != true) {
+
+        size_t bytes = num_records * ringbuffer_slot_bytes_;
+
+        if (WriteToStream(records, bytes) != true) {
+            // write the next ones over whatever part of these got written
+            lseek(stream_fd_, stream_offset_, SEEK_SET);
+            return false;
+        }
+
+        for (int i = 0; i < num_records; i++) {
+            AddToStreamIndex(records + i * ringbuffer_slot_bytes_, stream_offset_ + (off_t)i * ringbuffer_slot_bytes_);
+        }
+
+        stream_offset_ += bytes;
+
+        return true;
+    }
+
+    #pragma omp parallel for num_threads(max(stereo_config_.compressRecordingThreads, 1))
+    for (int i = 0; i < num_records; i++) {
+        CompressRecord(records + i * ringbuffer_slot_bytes_, i);
+    }
+
+    size_t bytes = 0;
+    int64_t compress_bytes = 0;
+
+    for (int i = 0; i < num_records; i++) {
+        bytes += compress_records_[i].size();
+    }
+
+    for (int i = 0; i < RECORDING_WRITE_BATCH; i++) {
+        compress_bytes += VectorBytes(compress_records_[i]) + VectorBytes(compress_png_[i][0]) + VectorBytes(compress_png_[i][1]);
+    }
+
+    compress_memory_.Set(compress_bytes);
+
+    if (bytes > compress_write_buffer_bytes_) {
+        free(compress_write_buffer_);
+        MemoryAccountFree(MEMORY_RECORDING, compress_write_buffer_bytes_);
+
+        // O_DIRECT needs aligned memory
+        if (posix_memalign((void**) &compress_write_buffer_, RECORDING_BLOCK_SIZE, bytes) != 0) {
+            compress_write_buffer_ = NULL;
+            compress_write_buffer_bytes_ = 0;
+            return false;
+        }
+
+        compress_write_buffer_bytes_ = bytes;
+        MemoryAccountAlloc(MEMORY_RECORDING, bytes);
+    }
+
+    size_t position = 0;
+
+    for (int i = 0; i < num_records; i++) {
+        memcpy(compress_write_buffer_ + position, compress_records_[i].data(), compress_records_[i].size());
+        position += compress_records_[i].size();
+    }
+
+    if (WriteToStream(compress_write_buffer_, bytes) != true) {
+        lseek(stream_fd_, stream_offset_, SEEK_SET);
+        return false;
+    }
+
+    for (int i = 0; i < num_records; i++) {
+        AddToStreamIndex(compress_records_[i].data(), stream_offset_);
+        stream_offset_ += compress_records_[i].size();
+    }
+
+    return true;
+}
+
+/**
+ * Compresses an uncompressed record into compress_records_[batch_number].
+ * PNG filters each row against the one above it before deflating, which
+ * is most of the win on camera images, and is exact.
+ *
+ * @param record the record, laid out like the ringbuffer slots
+ * @param batch_number which of the batch's buffers to use
+ */
+void RecordingManager::CompressRecord(uchar *record, int batch_number) {
+
+    cv::vector<int> params;
+    params.push_back(CV_IMWRITE_PNG_COMPRESSION);
+    params.push_back(RECORDING_PNG_COMPRESSION);
+
+    cv::vector<uchar> *png = compress_png_[batch_number];
+
+    for (int i = 0; i < 2; i++) {
+        imencode(".png", GetRecordFrame(i, record), png[i], params);
+    }
+
+    size_t bytes = sizeof(RecordingCompressedFrameHeader) + png[0].size() + png[1].size();
+    bytes = (bytes + RECORDING_BLOCK_SIZE - 1) / RECORDING_BLOCK_SIZE * RECORDING_BLOCK_SIZE;
+
+    cv::vector<uchar> *compressed = &compress_records_[batch_number];
+
+    // zeros the padding too
+    compressed->assign(bytes, 0);
+
+    RecordingCompressedFrameHeader *header = (RecordingCompressedFrameHeader*) compressed->data();
+    header->frame = *((RecordingFrameHeader*) record);
+    header->png_bytes[0] = png[0].size();
+    header->png_bytes[1] = png[1].size();
+    header->record_bytes = bytes;
+
+    uchar *data = compressed->data() + sizeof(RecordingCompressedFrameHeader);
+
+    memcpy(data, png[0].data(), png[0].size());
+    memcpy(data + png[0].size(), png[1].data(), png[1].size());
+}
+
+/**
+ * Adds a record that was just written to the index.
+ *
+ * @param record the record, in memory (starting with a
+ *   RecordingFrameHeader)
+ * @param offset where it is in the file
+ */
+void RecordingManager::AddToStreamIndex(const uchar *record, off_t offset) {
+
+    const RecordingFrameHeader *frame_header = (const RecordingFrameHeader*) record;
+
+    RecordingIndexEntry entry;
+    entry.frame_number = frame_header->frame_number;
+    entry.timestamp = frame_header->timestamp;
+    entry.offset = offset;
+
+    stream_index_.push_back(entry);
+}
+
+/**
+ * Writes the index and footer after the records and closes the .rec file.
+ */
+void RecordingManager::CloseStreamFile() {
+
+    // pad the index to whole blocks (for O_DIRECT) with the footer in the
+    // very last bytes of the file
+    size_t index_bytes = stream_index_.size() * sizeof(RecordingIndexEntry) + sizeof(RecordingIndexFooter);
+    index_bytes = (index_bytes + RECORDING_BLOCK_SIZE - 1) / RECORDING_BLOCK_SIZE * RECORDING_BLOCK_SIZE;
+
+    uchar *index_block;
+
+    if (posix_memalign((void**) &index_block, RECORDING_BLOCK_SIZE, index_bytes) == 0) {
+
+        memset(index_block, 0, index_bytes);
+
+        if (stream_index_.size() > 0) {
+            memcpy(index_block, stream_index_.data(), stream_index_.size() * sizeof(RecordingIndexEntry));
+        }
+
+        RecordingIndexFooter *footer = (RecordingIndexFooter*) (index_block + index_bytes - sizeof(RecordingIndexFooter));
+        footer->index_offset = stream_offset_;
+        footer->num_entries = stream_index_.size();
+        memcpy(footer->magic, RECORDING_INDEX_MAGIC, sizeof(footer->magic));
+
+        // without it, playback rebuilds the index from the records
+        WriteToStream(index_block, index_bytes);
+
+        free(index_block);
+    }
+
+    fdatasync(stream_fd_);
+    close(stream_fd_);
+    stream_fd_ = -1;
+}
+
+/**
+ * Checks if a file is a .rec recording.
+ *
+ * @param filename file to check
+ *
+ * @retval true if it ends in .rec
+ */
+bool RecordingManager::IsRecordingFile(string filename) {
+
+    string extension = RECORDING_FILE_EXTENSION;
+
+    return filename.length() > extension.length()
+        && boost::iequals(filename.substr(filename.length() - extension.length()), extension);
+}
+
+/**
+ * Writes out the recording.  When streaming, most of it is on disk
+ * already, so this just waits for the rest and closes the .rec file.
+ */
+void RecordingManager::FlushBufferToDisk() {
+
+    if (ringbuffer_ == NULL) {
+        // never started recording
+        return;
+    }
+
+    if (stream_fd_ >= 0) {
+        FinishStreaming();
+        return;
+    }
+
+    printf("Writing video...\n");
+
+    int endI, firstFrame = 0;
+    if (rec_num_frames_ < ring_size_)
+    {
+        endI = rec_num_frames_;
+    } else {
+        // our buffer is smaller than the full movie.
+        // figure out where in the ringbuffer we are
+        firstFrame = rec_num_frames_%ring_size_+1;
+        if (firstFrame > ring_size_)
+        {
+            firstFrame = 0;
+        }
+
+        endI = ring_size_;
+
+        printf("\nWARNING: buffer size exceeded by %d frames, which have been dropped.\n\n", rec_num_frames_ - ring_size_);
+
+    }
+
+    HardwareVideoWriter hw_record_l, hw_record_r;
+
+    if (stereo_config_.usePGM) {
+        printf("Using PGM format...\n");
+
+        string video_l_dir = SetupVideoWriterPGM("videoL-skip-" + std::to_string(firstFrame), true);
+
+        string video_r_dir = SetupVideoWriterPGM("videoR-skip-" + std::to_string(firstFrame), false);
+
+        // write the video
+        for (int i = 0; i < endI; i++) {
+
+            boost::format formatter_left = boost::format("/left%05d.pgm") % i;
+            string im_name_left = formatter_left.str();
+
+            boost::format formatter_right = boost::format("/right%05d.pgm") % i;
+            string im_name_right = formatter_right.str();
+
+            imwrite( video_l_dir + im_name_left, GetRingbufferFrame(0, i+firstFrame));
+
+            imwrite( video_r_dir + im_name_right, GetRingbufferFrame(1, i+firstFrame));
+
+            if (quiet_mode_ == false || i % 100 == 0) {
+                printf("\rWriting video: (%.1f%%) -- %d/%d frames", (float)(i+1)/endI*100, i+1, endI);
+                fflush(stdout);
+            }
+        }
+
+
+    } else if (stereo_config_.hardwareEncoder.length() > 0
+        && SetupHardwareWriter(&hw_record_l, "videoL-skip-" + std::to_string(firstFrame), ringbuffer_frame_size_[0], true, false, false)
+        && SetupHardwareWriter(&hw_record_r, "videoR-skip-" + std::to_string(firstFrame), ringbuffer_frame_size_[1], false, false, false)) {
+
+        // waits on the encoder instead of dropping frames
+        for (int i = 0; i < endI; i++) {
+            hw_record_l.Write(GetRingbufferFrame(0, i+firstFrame));
+            hw_record_r.Write(GetRingbufferFrame(1, i+firstFrame));
+
+            if (quiet_mode_ == false || i % 100 == 0) {
+                printf("\rWriting video: (%.1f%%) -- %d/%d frames", (float)(i+1)/endI*100, i+1, endI);
+                fflush(stdout);
+            }
+        }
+
+        hw_record_l.Close();
+        hw_record_r.Close();
+    } else {
+        VideoWriter recordL = SetupVideoWriterAVI("videoL-skip-" + std::to_string(firstFrame), ringbuffer_frame_size_[0], true);
+
+        VideoWriter recordR = SetupVideoWriterAVI("videoR-skip-"
+            + std::to_string(firstFrame), ringbuffer_frame_size_[1], false);
+
+        // write the video
+        for (int i=0; i<endI; i++)
+        {
+            recordL << GetRingbufferFrame(0, i+firstFrame);
+            recordR << GetRingbufferFrame(1, i+firstFrame);
+
+            if (quiet_mode_ == false || i % 100 == 0) {
+                printf("\rWriting video: (%.1f%%) -- %d/%d frames", (float)(i+1)/endI*100, i+1, endI);
+                fflush(stdout);
+            }
+        }
+    }
+    printf("\ndone.\n");
+}
+
+
+
+/**
+ * Sets up a video writer for .AVI files with the given filename
+ *
+ * @param frameSize size of the frames
+ * @param filenamePrefix prefix for the new video filename
+ * @param configStruct OpenCvStereoConfig structure
+ *   for reading the directory things should be saved in
+ *   and other data.
+ * @param increment_number Default is true.  Set to false to
+ *   not increment the video number.  Used for stereo vision
+ *   systems if you want to have a left and right video with
+ *   the same number (ie set to false for the second writer
+ *   you initialize.)
+ * @param this_video_number (optional) if non-null, then the video number will be supplied
+ * @param is_color true if it is color
+ *  @default false
+ *
+ * @retval VideoWriter object
+ */
+VideoWriter RecordingManager::SetupVideoWriterAVI(string filenamePrefix, Size frameSize, bool increment_number, bool is_color, int *this_video_number) {
+
+    VideoWriter recorder;
+
+    CheckOrCreateDirectory(stereo_config_.videoSaveDir);
+
+    string filename = GetNextVideoFilename(filenamePrefix, false, increment_number, this_video_number);
+
+    char fourcc1 = stereo_config_.fourcc.at(0);
+    char fourcc2 = stereo_config_.fourcc.at(1);
+    char fourcc3 = stereo_config_.fourcc.at(2);
+    char fourcc4 = stereo_config_.fourcc.at(3);
+
+    recorder.open(filename, CV_FOURCC(fourcc1, fourcc2, fourcc3, fourcc4), 30, frameSize, is_color);
+    if (!recorder.isOpened())
+    {
+        printf("VideoWriter failed to open!\n");
+    } else {
+        cout << endl << "Opened " << filename << endl;
+    }
+
+    return recorder;
+}
+
+
+/**
+ * Sets up a hardware encoder (stereo_config_.hardwareEncoder) to write an
+ * .AVI file, named like SetupVideoWriterAVI's.
+ *
+ * @param writer writer to open
+ * @param filenamePrefix prefix for the new video filename
+ * @param frameSize size of the frames
+ * @param increment_number false to use the same video number as the last
+ *   video (see SetupVideoWriterAVI)
+ * @param is_color true if it is color
+ * @param drop_when_behind true to drop frames when the encoder can't keep
+ *   up, for live video
+ * @param this_video_number (optional) if non-null, then the video number will be supplied
+ *
+ * @retval false if the encoder didn't start, so use SetupVideoWriterAVI
+ */
+bool RecordingManager::SetupHardwareWriter(HardwareVideoWriter *writer, string filenamePrefix, Size frameSize, bool increment_number, bool is_color, bool drop_when_behind, int *this_video_number) {
+
+    CheckOrCreateDirectory(stereo_config_.videoSaveDir);
+
+    string filename = GetNextVideoFilename(filenamePrefix, false, increment_number, this_video_number);
+
+    if (!writer->Open(filename, frameSize, is_color, 30, stereo_config_.hardwareEncoder, drop_when_behind)) {
+        printf("Hardware encoder failed to open, using VideoWriter.\n");
+        return false;
+    }
+
+    cout << endl << "Opened " << filename << " (hardware encoder)" << endl;
+
+    return true;
+}
+
+/**
+ * Sets up the system to write .pgm files into a directory named in a nice way.
+ *
+ * @param dirnamePrefix prefix for the save directory
+ * @param configStruct OpenCvStereoConfig struct, used for configStruct.videoSaveDir
+ *
+ * @retval directory path to use for saving images
+ *
+ */
+string RecordingManager::SetupVideoWriterPGM(string dirnamePrefix, bool increment_number) {
+
+    // make or use parent directory
+
+    CheckOrCreateDirectory(stereo_config_.videoSaveDir);
+
+    // make a new directory for a bunch of images
+    string dirpath = GetNextVideoFilename(dirnamePrefix, true, increment_number);
+
+
+    if (boost::filesystem::create_directory(dirpath)) {
+        cout << "Successfully created directory: " << dirpath << endl;
+    } else {
+        cout << "Warning: failed to create directory: " << dirpath << ", attempting to proceed with the default save directory." << endl;
+
+        return stereo_config_.videoSaveDir;
+    }
+    return dirpath;
+}
+
+/**
+ * Loads video files, either .avi or a directory of .pgm files.
+ *
+ * @param video_file_left path to directory of pgm files or .avi file for the left camera
+ * @param video_file_right same as above for the right camera
+ *
+ * @retval true on success, false on failure.
+ */
+bool RecordingManager::LoadVideoFiles(string video_file_left, string video_file_right) {
+
+    if (init_ok_ != true) {
+        cerr << "Error: You must call Init() before using RecordingManager." << endl;
+        return false;
+    }
+
+    // it reads from the old files
+    StopPrefetch();
+
+    using_video_from_disk_ = true;
+
+    if (IsRecordingFile(video_file_left)) {
+        // both cameras are in one file
+        return LoadRecordingFile(video_file_left);
+    }
+
+    reading_recording_file_ = false;
+
+    // determine if we are using pgm files or avi files
+    if (boost::iequals(video_file_left.substr(video_file_left.length() - 4), ".avi")) {
+
+        // using avi files
+
+        reading_pgm_ = false;
+
+        // attempt to create video capture objects
+
+        if (!left_video_capture_) {
+            left_video_capture_ = new VideoCapture();
+        } else {
+            left_video_capture_->release();
+        }
+
+        if (!right_video_capture_) {
+            right_video_capture_ = new VideoCapture();
+        } else {
+            right_video_capture_->release();
+        }
+
+        if (left_video_capture_->open(video_file_left) != true) {
+            cerr << endl << "Error: failed to open " << video_file_left
+                << endl;
+            return false;
+        } else {
+            cout << endl << endl << "Opened " << video_file_left << endl;
+        }
+
+        if (right_video_capture_->open(video_file_right) != true) {
+            cerr << endl << "Error: failed to open " << video_file_right
+                << endl;
+            return false;
+        } else {
+            cout << "Opened " << video_file_right << endl;
+        }
+
+        avi_frame_count_ = left_video_capture_->get(CV_CAP_PROP_FRAME_COUNT);
+        avi_next_position_ = -1;
+
+    } else {
+
+        // using pgm directory
+
+        reading_pgm_ = true;
+
+        // ensure that both directories exist
+
+        if (!boost::filesystem::exists(video_file_left)) {
+            cerr << "Error: failed to find directory of PGM files: " << video_file_left << endl;
+
+            return false;
+        }
+
+        if (!boost::filesystem::exists(video_file_right)) {
+            cerr << "Error: failed to find directory of PGM files: " << video_file_right << endl;
+
+            return false;
+        }
+
+        pgm_left_dir_ = video_file_left;
+        pgm_right_dir_ = video_file_right;
+
+    }
+
+    return true;
+}
+
+void RecordingManager::GetFrames(Mat &left_image, Mat &right_image) {
+
+    // check to see if there is a frame to get
+
+    if (using_video_directory_ && current_video_number_ < 0) {
+
+        // this is probably happening because we're waiting for
+        // LCM messages to load the video
+
+        // create an image to display that says "waiting for LCM"
+
+        left_image = Mat::zeros(240, 376, CV_8UC1);
+        right_image = Mat::zeros(240, 376, CV_8UC1);
+
+        // put text on the maps
+        putText(left_image, "Waiting for LCM messages...", Point(50,100), FONT_HERSHEY_DUPLEX, .5, Scalar(255));
+        putText(right_image, "Waiting for LCM messages...", Point(50,100), FONT_HERSHEY_DUPLEX, .5, Scalar(255));
+
+    } else {
+
+        if (reading_recording_file_) {
+            GetFrameRecordingFile(left_image, right_image);
+        } else {
+            GetFramePrefetched(left_image, right_image);
+        }
+    }
+}
+
+void RecordingManager::GetFramePGM(Mat &left_image, Mat &right_image) {
+    ReadFramePGM(file_frame_number_, left_image, right_image);
+}
+
+/**
+ * Loads a frame's PGM files.  Safe to call from the prefetch thread.
+ *
+ * @param frame_number frame to load
+ * @param left_image (output) left frame, or a message if it's missing
+ * @param right_image (output) right frame, or a message if it's missing
+ */
+void RecordingManager::ReadFramePGM(int frame_number, Mat &left_image, Mat &right_image) {
+
+    // load PGM files from a directory
+
+    // at this point, everything is already loaded up
+
+    // get the name of the image we want based on our position in the video
+
+    bool fail_flag = false;
+    string fail_text_left = "", fail_text_right = "";
+
+    int load_number = frame_number - file_frame_skip_;
+
+    if (load_number < 0) {
+        fail_flag = true;
+        boost::format formatter_skip = boost::format("First frame: %05d (at %05d)") % file_frame_skip_ % frame_number;
+        fail_text_left = formatter_skip.str();
+        fail_text_right = fail_text_left;
+
+    } else {
+
+        boost::format formatter_left = boost::format("left%05d.pgm") % load_number;
+        string im_name_left = formatter_left.str();
+
+        boost::format formatter_right = boost::format("right%05d.pgm") % load_number;
+        string im_name_right = formatter_right.str();
+
+
+        left_image = imread(pgm_left_dir_ + "/" + im_name_left, -1);
+        right_image = imread(pgm_right_dir_ + "/" + im_name_right, -1);
+
+        if (left_image.data == NULL) {
+            fail_flag = true;
+            fail_text_left = "Missing PGM file: " + im_name_left;
+        }
+
+        if (right_image.data == NULL) {
+            fail_flag = true;
+            fail_text_right = "Missing PGM file: " + im_name_right;
+        }
+
+    }
+
+
+
+    if (fail_flag) {
+        left_image = Mat::zeros(240, 376, CV_8UC1);
+        putText(left_image, fail_text_left, Point(50,100), FONT_HERSHEY_DUPLEX, .5, Scalar(255));
+
+
+        right_image = Mat::zeros(240, 376, CV_8UC1);
+        putText(right_image, fail_text_right, Point(50,100), FONT_HERSHEY_DUPLEX, .5, Scalar(255));
+    }
+
+
+}
+
+/**
+ * Gets a frame from an AVI file.  Gets the frame at locations based
+ * on the already-set file_frame_number_ and file_frame_skip_ values.
+ *
+ * @param left_image left image to put frame into
+ * @param right_image right image to put frame into
+ *
+ */
+void RecordingManager::GetFrameAVI(Mat &left_image, Mat &right_image) {
+    ClampFrameNumberAVI();
+    ReadFrameAVI(file_frame_number_, left_image, right_image);
+}
+
+/**
+ * Keeps file_frame_number_ inside the AVI files.
+ */
+void RecordingManager::ClampFrameNumberAVI() {
+
+    // make sure we don't run off the end of the video file and crash
+    if (file_frame_number_ - file_frame_skip_ >= avi_frame_count_) {
+        file_frame_number_ = avi_frame_count_ - 1 + file_frame_skip_;
+    }
+
+    // make sure we don't try to play before the file starts
+    if (file_frame_number_ - file_frame_skip_ < 0) {
+        file_frame_number_ = file_frame_skip_;
+    }
+}
+
+/**
+ * Decodes a frame from the AVI files, only seeking if it isn't the one
+ * after the last one read.  Safe to call from the prefetch thread.
+ *
+ * @param frame_number frame to decode, inside the files
+ * @param left_image (output) left frame
+ * @param right_image (output) right frame
+ */
+void RecordingManager::ReadFrameAVI(int frame_number, Mat &left_image, Mat &right_image) {
+
+    Mat matL_file, matR_file;
+
+    int position = frame_number - file_frame_skip_;
+
+    if (position != avi_next_position_) {
+        left_video_capture_->set(CV_CAP_PROP_POS_FRAMES, position);
+        right_video_capture_->set(CV_CAP_PROP_POS_FRAMES, position);
+    }
+
+    (*left_video_capture_) >> matL_file;
+    (*right_video_capture_) >> matR_file;
+
+    if (matL_file.empty() || matR_file.empty()) {
+        // seek next time, the captures could be anywhere
+        avi_next_position_ = -1;
+
+        left_image = Mat::zeros(240, 376, CV_8UC1);
+        putText(left_image, "Failed to read frame", Point(50,100), FONT_HERSHEY_DUPLEX, .5, Scalar(255));
+        right_image = left_image.clone();
+        return;
+    }
+
+    avi_next_position_ = position + 1;
+
+    // convert from a 3 channel array to a one channel array
+    cvtColor(matL_file, left_image, CV_BGR2GRAY);
+    cvtColor(matR_file, right_image, CV_BGR2GRAY);
+}
+
+/**
+ * Gets the frame at file_frame_number_ from the prefetch thread, starting
+ * it or restarting it there if it isn't already on its way.
+ *
+ * @param left_image (output) left frame
+ * @param right_image (output) right frame
+ */
+void RecordingManager::GetFramePrefetched(Mat &left_image, Mat &right_image) {
+
+    if (!reading_pgm_) {
+        ClampFrameNumberAVI();
+    }
+
+    StartPrefetch();
+
+    std::unique_lock<std::mutex> locker(prefetch_mutex_);
+
+    int frame_number = file_frame_number_;
+
+    // frames that were skipped over
+    while (!prefetch_queue_.empty() && prefetch_queue_.front().frame_number < frame_number) {
+        prefetch_queue_.pop_front();
+    }
+
+    bool on_its_way;
+
+    if (!prefetch_queue_.empty()) {
+        on_its_way = prefetch_queue_.front().frame_number == frame_number;
+    } else if (prefetch_in_flight_ >= 0) {
+        on_its_way = prefetch_in_flight_ == frame_number;
+    } else {
+        on_its_way = prefetch_next_ == frame_number;
+    }
+
+    if (!on_its_way) {
+        // a jump
+        prefetch_queue_.clear();
+        prefetch_next_ = frame_number;
+        prefetch_generation_ ++;
+    }
+
+    prefetch_cond_.notify_all();
+
+    prefetch_cond_.wait(locker, [this, frame_number]{
+        return !prefetch_queue_.empty() && prefetch_queue_.front().frame_number == frame_number; });
+
+    left_image = prefetch_queue_.front().left;
+    right_image = prefetch_queue_.front().right;
+
+    prefetch_queue_.pop_front();
+
+    // room for another one
+    prefetch_cond_.notify_all();
+}
+
+void RecordingManager::StartPrefetch() {
+
+    if (prefetch_running_) {
+        return;
+    }
+
+    prefetch_queue_.clear();
+    prefetch_next_ = file_frame_number_;
+    prefetch_in_flight_ = -1;
+    stop_prefetch_ = false;
+
+    pthread_create(&prefetch_thread_, NULL, PrefetchThread, this);
+    prefetch_running_ = true;
+}
+
+void RecordingManager::StopPrefetch() {
+
+    if (!prefetch_running_) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> locker(prefetch_mutex_);
+        stop_prefetch_ = true;
+    }
+
+    prefetch_cond_.notify_all();
+    pthread_join(prefetch_thread_, NULL);
+
+    prefetch_running_ = false;
+    prefetch_queue_.clear();
+}
+
+void* RecordingManager::PrefetchThread(void *x) {
+    ((RecordingManager*)x)->RunPrefetch();
+    return NULL;
+}
+
+void RecordingManager::RunPrefetch() {
+
+    std::unique_lock<std::mutex> locker(prefetch_mutex_);
+
+    while (!stop_prefetch_) {
+
+        // AVIs can't be read past the end
+        bool at_end = !reading_pgm_ && prefetch_next_ - file_frame_skip_ >= avi_frame_count_;
+
+        if (prefetch_queue_.size() >= PLAYBACK_PREFETCH_FRAMES || at_end) {
+            prefetch_cond_.wait(locker);
+            continue;
+        }
+
+        PrefetchedFrame frame;
+        frame.frame_number = prefetch_next_;
+
+        int generation = prefetch_generation_;
+
+        prefetch_in_flight_ = prefetch_next_;
+        prefetch_next_ ++;
+
+        // decode without holding up GetFrames()
+        locker.unlock();
+
+        if (reading_pgm_) {
+            ReadFramePGM(frame.frame_number, frame.left, frame.right);
+        } else {
+            ReadFrameAVI(frame.frame_number, frame.left, frame.right);
+        }
+
+        locker.lock();
+
+        prefetch_in_flight_ = -1;
+
+        if (generation == prefetch_generation_) {
+            prefetch_queue_.push_back(frame);
+            prefetch_cond_.notify_all();
+        }
+    }
+}
+
+/**
+ * Opens a .rec file for playback.  The whole file is mmap'd when it fits,
+ * so seeking anywhere in it is just a lookup.
+ *
+ * @param filename .rec file to play
+ *
+ * @retval true on success, false on failure.
+ */
+bool RecordingManager::LoadRecordingFile(string filename) {
+
+    CloseRecordingFile();
+
+    recording_file_fd_ = open(filename.c_str(), O_RDONLY);
+
+    if (recording_file_fd_ < 0) {
+        cerr << endl << "Error: failed to open " << filename << endl;
+        return false;
+    }
+
+    off_t file_bytes = lseek(recording_file_fd_, 0, SEEK_END);
+
+    if (pread(recording_file_fd_, &recording_file_header_, sizeof(recording_file_header_), 0) != sizeof(recording_file_header_)
+        || memcmp(recording_file_header_.magic, RECORDING_FILE_MAGIC, sizeof(recording_file_header_.magic)) != 0
+        || recording_file_header_.record_bytes <= 0
+        || (recording_file_header_.codec != RECORDING_CODEC_RAW && recording_file_header_.codec != RECORDING_CODEC_PNG)) {
+
+        cerr << endl << "Error: " << filename << " is not a recording." << endl;
+
+        CloseRecordingFile();
+        return false;
+    }
+
+    recording_file_header_.metadata[RECORDING_METADATA_BYTES - 1] = '\0';
+
+    // copy-on-write, so the frames handed out can be drawn on.  A long
+    // recording won't fit in a 32-bit address space, and then frames get
+    // read one at a time instead.
+    if ((uint64_t)file_bytes <= (uint64_t)SIZE_MAX) {
+        void *map = mmap(NULL, file_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, recording_file_fd_, 0);
+
+        if (map != MAP_FAILED) {
+            recording_file_map_ = (uchar*) map;
+            recording_file_map_bytes_ = file_bytes;
+        }
+    }
 
-    CheckOrCreateDirectory(stereo_config_.videoSaveDir);
+    if (LoadRecordingFileIndex(file_bytes) != true) {
+        cerr << endl << "Error: failed to read the index of " << filename << endl;
 
-    // make a new directory for a bunch of images
-    string dirpath = GetNextVideoFilename(dirnamePrefix, true, increment_number);
+        CloseRecordingFile();
+        return false;
+    }
 
+    reading_recording_file_ = true;
+    reading_pgm_ = false;
+    file_frame_skip_ = 0;
 
-    if (boost::filesystem::create_directory(dirpath)) {
-        cout << "Successfully created directory: " << dirpath << endl;
-    } else {
-        cout << "Warning: failed to create directory: " << dirpath << ", attempting to proceed with the default save directory." << endl;
+    cout << endl << endl << "Opened " << filename << " (" << recording_file_index_.size() << " frames"
+        << (recording_file_header_.codec == RECORDING_CODEC_PNG ? ", compressed" : "")
+        << (recording_file_map_ == NULL ? ", not mapped" : "") << ")" << endl;
 
-        return stereo_config_.videoSaveDir;
+    if (recording_file_header_.metadata[0] != '\0') {
+        cout << recording_file_header_.metadata << endl;
     }
-    return dirpath;
+
+    return true;
 }
 
 /**
- * Loads video files, either .avi or a directory of .pgm files.
+ * Reads the index at the end of the .rec file, or rebuilds it from the
+ * records if the file never got one, and fills in the frame number
+ * lookup.
  *
- * @param video_file_left path to directory of pgm files or .avi file for the left camera
- * @param video_file_right same as above for the right camera
+ * @param file_bytes size of the file
  *
- * @retval true on success, false on failure.
+ * @retval true on success
  */
-bool RecordingManager::LoadVideoFiles(string video_file_left, string video_file_right) {
+bool RecordingManager::LoadRecordingFileIndex(off_t file_bytes) {
 
-    if (init_ok_ != true) {
-        cerr << "Error: You must call Init() before using RecordingManager." << endl;
-        return false;
-    }
+    recording_file_index_.clear();
+    recording_file_lookup_.clear();
 
-    using_video_from_disk_ = true;
+    RecordingIndexFooter footer;
+    bool have_index = false;
 
-    // determine if we are using pgm files or avi files
-    if (boost::iequals(video_file_left.substr(video_file_left.length() - 4), ".avi")) {
+    if (file_bytes >= (off_t)(RECORDING_BLOCK_SIZE + sizeof(footer))
+        && pread(recording_file_fd_, &footer, sizeof(footer), file_bytes - sizeof(footer)) == sizeof(footer)
+        && memcmp(footer.magic, RECORDING_INDEX_MAGIC, sizeof(footer.magic)) == 0
+        && footer.num_entries >= 0 && footer.index_offset >= RECORDING_BLOCK_SIZE
+        && footer.index_offset + footer.num_entries * (off_t)sizeof(RecordingIndexEntry) <= file_bytes - (off_t)sizeof(footer)) {
 
-        // using avi files
+        size_t index_bytes = footer.num_entries * sizeof(RecordingIndexEntry);
 
-        reading_pgm_ = false;
+        recording_file_index_.resize(footer.num_entries);
 
-        // attempt to create video capture objects
+        have_index = index_bytes == 0
+            || pread(recording_file_fd_, recording_file_index_.data(), index_bytes, footer.index_offset) == (ssize_t)index_bytes;
+    }
 
-        if (!left_video_capture_) {
-            left_video_capture_ = new VideoCapture();
-        } else {
-            left_video_capture_->release();
-        }
+    if (have_index != true) {
+        cout << endl << "Warning: recording has no index (it didn't finish writing), scanning it..." << endl;
 
-        if (!right_video_capture_) {
-            right_video_capture_ = new VideoCapture();
-        } else {
-            right_video_capture_->release();
-        }
+        recording_file_index_.clear();
 
-        if (left_video_capture_->open(video_file_left) != true) {
-            cerr << endl << "Error: failed to open " << video_file_left
-                << endl;
-            return false;
-        } else {
-            cout << endl << endl << "Opened " << video_file_left << endl;
-        }
+        off_t offset = RECORDING_BLOCK_SIZE;
 
-        if (right_video_capture_->open(video_file_right) != true) {
-            cerr << endl << "Error: failed to open " << video_file_right
-                << endl;
-            return false;
-        } else {
-            cout << "Opened " << video_file_right << endl;
-        }
+        while (true) {
 
-    } else {
+            // uncompressed records only have the RecordingFrameHeader part,
+            // but they're much bigger than this anyway
+            RecordingCompressedFrameHeader frame_header;
 
-        // using pgm directory
+            if (pread(recording_file_fd_, &frame_header, sizeof(frame_header), offset) != sizeof(frame_header)) {
+                break;
+            }
 
-        reading_pgm_ = true;
+            off_t record_bytes = recording_file_header_.record_bytes;
 
-        // ensure that both directories exist
+            if (recording_file_header_.codec == RECORDING_CODEC_PNG) {
+                record_bytes = frame_header.record_bytes;
+            }
 
-        if (!boost::filesystem::exists(video_file_left)) {
-            cerr << "Error: failed to find directory of PGM files: " << video_file_left << endl;
+            if (record_bytes <= 0 || offset + record_bytes > file_bytes) {
+                // cut off in the middle of this one
+                break;
+            }
 
-            return false;
+            RecordingIndexEntry entry;
+            entry.frame_number = frame_header.frame.frame_number;
+            entry.timestamp = frame_header.frame.timestamp;
+            entry.offset = offset;
+
+            recording_file_index_.push_back(entry);
+
+            offset += record_bytes;
         }
+    }
 
-        if (!boost::filesystem::exists(video_file_right)) {
-            cerr << "Error: failed to find directory of PGM files: " << video_file_right << endl;
+    // the frame numbers only go up.  If they don't, the rest is a
+    // half-written record or garbage.
+    for (unsigned int i = 1; i < recording_file_index_.size(); i++) {
+        if (recording_file_index_[i].frame_number <= recording_file_index_[i - 1].frame_number) {
+            cerr << "Warning: recording is out of order after " << i << " frames, ignoring the rest." << endl;
 
-            return false;
+            recording_file_index_.resize(i);
+            break;
         }
+    }
 
-        pgm_left_dir_ = video_file_left;
-        pgm_right_dir_ = video_file_right;
+    if (recording_file_index_.size() == 0) {
+        return true;
+    }
+
+    int64_t first_frame = recording_file_index_.front().frame_number;
+    int64_t last_frame = recording_file_index_.back().frame_number;
+
+    recording_file_lookup_.resize(last_frame - first_frame + 1);
+
+    int record = 0;
+
+    for (int64_t frame = first_frame; frame <= last_frame; frame++) {
+        while (record + 1 < (int)recording_file_index_.size()
+            && recording_file_index_[record + 1].frame_number <= frame) {
+
+            record ++;
+        }
 
+        recording_file_lookup_[frame - first_frame] = record;
     }
 
     return true;
 }
 
-void RecordingManager::GetFrames(Mat &left_image, Mat &right_image) {
+/**
+ * Gets the frame at file_frame_number_ from a .rec file.  If that frame
+ * was dropped while recording, gets the one before it.
+ *
+ * @param left_image left image to put frame into
+ * @param right_image right image to put frame into
+ */
+void RecordingManager::GetFrameRecordingFile(Mat &left_image, Mat &right_image) {
 
-    // check to see if there is a frame to get
+    if (recording_file_index_.size() == 0) {
+        left_image = Mat::zeros(240, 376, CV_8UC1);
+        right_image = Mat::zeros(240, 376, CV_8UC1);
 
-    if (using_video_directory_ && current_video_number_ < 0) {
+        putText(left_image, "Empty recording", Point(50,100), FONT_HERSHEY_DUPLEX, .5, Scalar(255));
+        putText(right_image, "Empty recording", Point(50,100), FONT_HERSHEY_DUPLEX, .5, Scalar(255));
+        return;
+    }
 
-        // this is probably happening because we're waiting for
-        // LCM messages to load the video
+    // make sure we don't run off either end of the recording
+    int64_t first_frame = recording_file_index_.front().frame_number;
+    int64_t last_frame = recording_file_index_.back().frame_number;
 
-        // create an image to display that says "waiting for LCM"
+    if (file_frame_number_ < first_frame) {
+        file_frame_number_ = first_frame;
+    } else if (file_frame_number_ > last_frame) {
+        file_frame_number_ = last_frame;
+    }
 
-        left_image = Mat::zeros(240, 376, CV_8UC1);
-        right_image = Mat::zeros(240, 376, CV_8UC1);
+    const RecordingIndexEntry &entry = recording_file_index_[recording_file_lookup_[file_frame_number_ - first_frame]];
 
-        // put text on the maps
-        putText(left_image, "Waiting for LCM messages...", Point(50,100), FONT_HERSHEY_DUPLEX, .5, Scalar(255));
-        putText(right_image, "Waiting for LCM messages...", Point(50,100), FONT_HERSHEY_DUPLEX, .5, Scalar(255));
+    int64_t record_bytes = recording_file_header_.record_bytes;
 
-    } else {
+    if (recording_file_header_.codec == RECORDING_CODEC_PNG) {
+        RecordingCompressedFrameHeader frame_header;
 
-        if (reading_pgm_) {
-            GetFramePGM(left_image, right_image);
-        } else {
-            GetFrameAVI(left_image, right_image);
+        if (recording_file_map_ != NULL && entry.offset + (int64_t)sizeof(frame_header) <= (int64_t)recording_file_map_bytes_) {
+            memcpy(&frame_header, recording_file_map_ + entry.offset, sizeof(frame_header));
+        } else if (pread(recording_file_fd_, &frame_header, sizeof(frame_header), entry.offset) != sizeof(frame_header)) {
+            frame_header.record_bytes = sizeof(frame_header);
+            frame_header.png_bytes[0] = frame_header.png_bytes[1] = 0;
         }
+
+        record_bytes = frame_header.record_bytes;
     }
-}
 
-void RecordingManager::GetFramePGM(Mat &left_image, Mat &right_image) {
+    uchar *record;
 
-    // load PGM files from a directory
+    if (recording_file_map_ != NULL && entry.offset + record_bytes <= (int64_t)recording_file_map_bytes_) {
+        record = recording_file_map_ + entry.offset;
 
-    // at this point, everything is already loaded up
+    } else {
+        recording_file_buffer_.resize(record_bytes);
 
-    // get the name of the image we want based on our position in the video
+        ssize_t bytes_read = pread(recording_file_fd_, recording_file_buffer_.data(), record_bytes, entry.offset);
 
-    bool fail_flag = false;
-    string fail_text_left = "", fail_text_right = "";
+        if (bytes_read != record_bytes) {
+            cerr << "Warning: failed to read frame " << file_frame_number_ << " from the recording." << endl;
+        }
 
-    int load_number = file_frame_number_ - file_frame_skip_;
+        record = recording_file_buffer_.data();
+    }
 
-    if (load_number < 0) {
-        fail_flag = true;
-        boost::format formatter_skip = boost::format("First frame: %05d (at %05d)") % file_frame_skip_ % file_frame_number_;
-        fail_text_left = formatter_skip.str();
-        fail_text_right = fail_text_left;
+    if (recording_file_header_.codec == RECORDING_CODEC_PNG) {
+        RecordingCompressedFrameHeader *frame_header = (RecordingCompressedFrameHeader*) record;
 
-    } else {
+        uchar *png = record + sizeof(RecordingCompressedFrameHeader);
 
-        boost::format formatter_left = boost::format("left%05d.pgm") % load_number;
-        string im_name_left = formatter_left.str();
+        Mat images[2];
 
-        boost::format formatter_right = boost::format("right%05d.pgm") % load_number;
-        string im_name_right = formatter_right.str();
+        for (int i = 0; i < 2; i++) {
+            int png_bytes = frame_header->png_bytes[i];
 
+            if (png_bytes > 0 && png - record + png_bytes <= record_bytes) {
+                images[i] = imdecode(Mat(1, png_bytes, CV_8UC1, png), -1);
+            }
 
-        left_image = imread(pgm_left_dir_ + "/" + im_name_left, -1);
-        right_image = imread(pgm_right_dir_ + "/" + im_name_right, -1);
+            if (images[i].rows != recording_file_header_.height[i] || images[i].cols != recording_file_header_.width[i]
+                || images[i].type() != recording_file_header_.type[i]) {
 
-        if (left_image.data == NULL) {
-            fail_flag = true;
-            fail_text_left = "Missing PGM file: " + im_name_left;
-        }
+                cerr << "Warning: failed to decompress frame " << file_frame_number_ << " from the recording." << endl;
 
-        if (right_image.data == NULL) {
-            fail_flag = true;
-            fail_text_right = "Missing PGM file: " + im_name_right;
+                images[i] = Mat::zeros(recording_file_header_.height[i], recording_file_header_.width[i],
+                    recording_file_header_.type[i]);
+            }
+
+            png += max(png_bytes, 0);
         }
 
+        left_image = images[0];
+        right_image = images[1];
+        return;
     }
 
+    uchar *frame = record + sizeof(RecordingFrameHeader);
 
+    left_image = Mat(recording_file_header_.height[0], recording_file_header_.width[0],
+        recording_file_header_.type[0], frame);
 
-    if (fail_flag) {
-        left_image = Mat::zeros(240, 376, CV_8UC1);
-        putText(left_image, fail_text_left, Point(50,100), FONT_HERSHEY_DUPLEX, .5, Scalar(255));
+    frame += left_image.total() * left_image.elemSize();
 
+    right_image = Mat(recording_file_header_.height[1], recording_file_header_.width[1],
+        recording_file_header_.type[1], frame);
 
-        right_image = Mat::zeros(240, 376, CV_8UC1);
-        putText(right_image, fail_text_right, Point(50,100), FONT_HERSHEY_DUPLEX, .5, Scalar(255));
+    if (record == recording_file_buffer_.data()) {
+        // the buffer gets reused for the next frame
+        left_image = left_image.clone();
+        right_image = right_image.clone();
+    }
+}
+
+void RecordingManager::CloseRecordingFile() {
+
+    if (recording_file_map_ != NULL) {
+        munmap(recording_file_map_, recording_file_map_bytes_);
+        recording_file_map_ = NULL;
+        recording_file_map_bytes_ = 0;
     }
 
+    if (recording_file_fd_ >= 0) {
+        close(recording_file_fd_);
+        recording_file_fd_ = -1;
+    }
 
+    reading_recording_file_ = false;
+    recording_file_index_.clear();
+    recording_file_lookup_.clear();
 }
 
 /**
- * Gets a frame from an AVI file.  Gets the frame at locations based
- * on the already-set file_frame_number_ and file_frame_skip_ values.
+ * Gets the metadata stored in the .rec file being played.
  *
- * @param left_image left image to put frame into
- * @param right_image right image to put frame into
+ * @retval the metadata, or "" if not playing a .rec file
+ */
+string RecordingManager::GetPlaybackMetadata() {
+
+    if (reading_recording_file_ != true) {
+        return "";
+    }
+
+    return recording_file_header_.metadata;
+}
+
+/**
+ * Writes the PGM or AVI recording loaded with LoadVideoFiles() into one
+ * .rec file, which seeks much faster.  Can't be used while recording.
+ *
+ * @param filename .rec file to write
+ * @param first_frame_number frame number of the first frame (the skip
+ *   number in the old filenames), so the frame numbers stay the same
  *
+ * @retval true on success
  */
-void RecordingManager::GetFrameAVI(Mat &left_image, Mat &right_image) {
+bool RecordingManager::ConvertToRecordingFile(string filename, int first_frame_number) {
 
-    Mat matL_file, matR_file;
+    if (using_video_from_disk_ != true || reading_recording_file_ || ringbuffer_ != NULL) {
+        cerr << "Error: load PGM or AVI files with LoadVideoFiles() before converting them." << endl;
+        return false;
+    }
 
-    // make sure we don't run off the end of the video file and crash
-    if (file_frame_number_ - file_frame_skip_
-        >= left_video_capture_->get(CV_CAP_PROP_FRAME_COUNT)) {
+    // reads the files itself
+    StopPrefetch();
+
+    file_frame_skip_ = first_frame_number;
 
-        file_frame_number_ = left_video_capture_->get(CV_CAP_PROP_FRAME_COUNT) - 1 + file_frame_skip_;
+    int num_frames = 0;
+
+    if (reading_pgm_) {
+        while (boost::filesystem::exists(pgm_left_dir_ + (boost::format("/left%05d.pgm") % num_frames).str())) {
+            num_frames ++;
+        }
+    } else {
+        num_frames = left_video_capture_->get(CV_CAP_PROP_FRAME_COUNT);
     }
 
-    // make sure we don't try to play before the file starts
-    if (file_frame_number_ - file_frame_skip_ < 0) {
-        file_frame_number_ = file_frame_skip_;
+    if (num_frames <= 0) {
+        cerr << "Error: no frames to convert." << endl;
+        return false;
     }
 
-    left_video_capture_->set(CV_CAP_PROP_POS_FRAMES, file_frame_number_ - file_frame_skip_);
-    right_video_capture_->set(CV_CAP_PROP_POS_FRAMES, file_frame_number_ - file_frame_skip_);
+    // batches of records, so compression can run in parallel
+    uchar *records = NULL;
+    int num_batched = 0;
+    bool write_ok = true;
 
-    (*left_video_capture_) >> matL_file;
-    (*right_video_capture_) >> matR_file;
+    for (int i = 0; i < num_frames && write_ok; i++) {
 
-    // convert from a 3 channel array to a one channel array
-    cvtColor(matL_file, left_image, CV_BGR2GRAY);
-    cvtColor(matR_file, right_image, CV_BGR2GRAY);
+        Mat left_image, right_image;
+
+        file_frame_number_ = first_frame_number + i;
+
+        if (reading_pgm_) {
+            GetFramePGM(left_image, right_image);
+        } else {
+            GetFrameAVI(left_image, right_image);
+        }
+
+        if (records == NULL) {
+            // the first frame sets the layout
+            SetRecordLayout(left_image, right_image);
+
+            // O_DIRECT needs aligned memory
+            if (posix_memalign((void**) &records, RECORDING_BLOCK_SIZE, RECORDING_WRITE_BATCH * ringbuffer_slot_bytes_) != 0) {
+                return false;
+            }
+
+            memset(records, 0, RECORDING_WRITE_BATCH * ringbuffer_slot_bytes_);
+
+            if (OpenStreamFile(filename) != true) {
+                free(records);
+                return false;
+            }
+        }
+
+        if (left_image.size() != ringbuffer_frame_size_[0] || left_image.type() != ringbuffer_frame_type_[0]
+            || right_image.size() != ringbuffer_frame_size_[1] || right_image.type() != ringbuffer_frame_type_[1]) {
+
+            cerr << endl << "Warning: frame " << file_frame_number_ << " doesn't match the first frame, skipping it." << endl;
+            continue;
+        }
+
+        uchar *record = records + num_batched * ringbuffer_slot_bytes_;
+
+        RecordingFrameHeader *frame_header = (RecordingFrameHeader*) record;
+        frame_header->frame_number = file_frame_number_;
+        frame_header->timestamp = 0; // PGM and AVI recordings have no timestamps
+
+        Mat record_left = GetRecordFrame(0, record);
+        Mat record_right = GetRecordFrame(1, record);
+
+        left_image.copyTo(record_left);
+        right_image.copyTo(record_right);
+
+        num_batched ++;
+
+        if (num_batched == RECORDING_WRITE_BATCH || i == num_frames - 1) {
+            write_ok = WriteRecords(records, num_batched);
+            num_batched = 0;
+        }
+
+        if (quiet_mode_ == false || i % 100 == 0) {
+            printf("\rConverting: (%.1f%%) -- %d/%d frames", (float)(i+1)/num_frames*100, i+1, num_frames);
+            fflush(stdout);
+        }
+    }
+
+    if (num_batched > 0 && write_ok) {
+        // the last frames were skipped
+        write_ok = WriteRecords(records, num_batched);
+    }
+
+    free(records);
+
+    int num_written = stream_index_.size();
+
+    CloseStreamFile();
+
+    printf("\nWrote %d frames to %s.\n", num_written, filename.c_str());
+
+    return write_ok;
 }
 
 bool RecordingManager::SetPlaybackVideoDirectory(string video_directory) {
@@ -471,6 +2008,9 @@ void RecordingManager::SetPlaybackVideoNumber(int video_number, long long timest
 
     if (using_video_directory_ && video_number != current_video_number_ && video_number >= 0) {
 
+        // it reads file_frame_skip_ and the old files
+        StopPrefetch();
+
         // load a new video file
         file_frame_skip_ = LoadVideoFileFromDir(timestamp, video_number);
 
@@ -542,7 +2082,17 @@ int RecordingManager::GetNextVideoNumber(bool use_pgm, bool increment_number) {
 
     if (boost::filesystem::exists(stereo_config_.videoSaveDir)) {
 
-        max_number = MatchVideoFile(stereo_config_.videoSaveDir,  datechar, use_pgm);
+        max_number = ReadNumberManifest(datechar);
+
+        if (max_number < 0) {
+            // no manifest (or a broken one), so look through the
+            // recordings.  PGM directories and AVI/.rec files share the
+            // numbers from here on.
+            max_number = max(MatchVideoFile(stereo_config_.videoSaveDir, datechar, true),
+                MatchVideoFile(stereo_config_.videoSaveDir, datechar, false));
+
+            WriteNumberManifest(datechar, max_number);
+        }
 
     } else {
         cerr << "Warning: attemtped to find video files in " << stereo_config_.videoSaveDir <<
@@ -550,12 +2100,76 @@ int RecordingManager::GetNextVideoNumber(bool use_pgm, bool increment_number) {
     }
 
     if (increment_number == true) {
+        WriteNumberManifest(datechar, max_number + 1);
         return max_number + 1;
     } else {
         return max_number;
     }
 }
 
+/**
+ * Reads the last video number handed out from videoSaveDir's manifest.
+ *
+ * @param datestr today's date, from GetDateSring()
+ *
+ * @retval the number, 0 if the manifest is from another day (so nothing
+ *      has been recorded today), or -1 if there's no usable manifest and
+ *      the directory has to be scanned
+ */
+int RecordingManager::ReadNumberManifest(string datestr) {
+
+    ifstream manifest(stereo_config_.videoSaveDir + "/" + RECORDING_NUMBER_MANIFEST);
+
+    string manifest_date;
+    int number;
+
+    if (!(manifest >> manifest_date >> number) || number < 0) {
+        return -1;
+    }
+
+    if (manifest_date.compare(datestr) != 0) {
+        return 0;
+    }
+
+    return number;
+}
+
+/**
+ * Replaces videoSaveDir's manifest, atomically (write a new one and
+ * rename it over the old one), so a crash leaves either the old or the new
+ * number.
+ *
+ * @param datestr today's date, from GetDateSring()
+ * @param number last video number handed out
+ */
+void RecordingManager::WriteNumberManifest(string datestr, int number) {
+
+    if (ReadNumberManifest(datestr) > number) {
+        // someone's already further along
+        return;
+    }
+
+    string filename = stereo_config_.videoSaveDir + "/" + RECORDING_NUMBER_MANIFEST;
+    string temp_filename = filename + ".tmp";
+
+    FILE *manifest = fopen(temp_filename.c_str(), "w");
+
+    if (manifest == NULL) {
+        // next time just scans the directory again
+        return;
+    }
+
+    fprintf(manifest, "%s %d\n", datestr.c_str(), number);
+
+    bool ok = fflush(manifest) == 0 && fsync(fileno(manifest)) == 0;
+    ok = fclose(manifest) == 0 && ok;
+
+    if (!ok || rename(temp_filename.c_str(), filename.c_str()) != 0) {
+        cerr << "Warning: failed to update " << filename << " (" << strerror(errno) << ")." << endl;
+        unlink(temp_filename.c_str());
+    }
+}
+
 int RecordingManager::GetFrameNumber() {
     if (!UsingLiveCameras()) {
         return file_frame_number_;
@@ -572,15 +2186,40 @@ void RecordingManager::SetHudNumbers(Hud *hud) {
     hud->SetVideoNumber(current_video_number_);
 }
 
+/**
+ * Gives the HUD a frame to draw into, so RecFrameHud() can hand it to the
+ * hardware encoder without copying it.  Does nothing without a hardware
+ * encoder, or before the first RecFrameHud().
+ *
+ * @param hud_frame (output) Mat to draw the HUD into
+ */
+void RecordingManager::GetHudFrameBuffer(Mat *hud_frame) {
+    Mat buffer = record_hud_hw_writer_.GetFrameBuffer();
+
+    if (!buffer.empty()) {
+        *hud_frame = buffer;
+    }
+}
+
 void RecordingManager::RecFrameHud(Mat hud_frame, bool is_color, std::string prepend_str) {
     if (!record_hud_setup_) {
-        record_hud_writer_ = SetupVideoWriterAVI(prepend_str, hud_frame.size(), true, is_color, &hud_video_number_);
+        if (stereo_config_.hardwareEncoder.length() == 0
+            || !SetupHardwareWriter(&record_hud_hw_writer_, prepend_str, hud_frame.size(), true, is_color, true, &hud_video_number_)) {
+
+            record_hud_writer_ = SetupVideoWriterAVI(prepend_str, hud_frame.size(), true, is_color, &hud_video_number_);
+        }
         record_hud_setup_ = true;
     }
 
+    if (record_hud_hw_writer_.IsOpened()) {
+        // converts it if it has to
+        record_hud_hw_writer_.Write(hud_frame);
+        return;
+    }
+
     Mat write_hud;
 
-    if (is_color) {
+    if (is_color && hud_frame.depth() != CV_8U) {
         hud_frame.convertTo(write_hud, CV_8UC3, 255.0);
     } else {
         write_hud = hud_frame;
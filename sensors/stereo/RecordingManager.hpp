@@ -2,12 +2,202 @@
 #define RECORDING_MANAGER_H_
 
 #include "opencv-stereo-util.hpp"
+#include "HardwareVideoWriter.hpp"
 #include "../../ui/hud/hud.hpp"
 #include <boost/algorithm/string.hpp>
 #include <boost/format.hpp>
 #include "../../utils/utils/RealtimeUtils.hpp"
+#include "../../utils/utils/MemoryAccounting.hpp"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <pthread.h>
+
+#define RINGBUFFER_FRAMERATE 50
+#define RINGBUFFER_SIZE (120*RINGBUFFER_FRAMERATE) // number of seconds to allocate for recording * framerate
+
+// with triggered recording, the ringbuffer only holds the pre-trigger time
+// and this much more, for the writer to catch up in
+#define RECORDING_TRIGGER_SLACK_SECONDS 5
+
+// the ringbuffer is rounded up to this so it can go in hugepages
+#define RINGBUFFER_HUGEPAGE_SIZE (2*1024*1024)
+
+// ringbuffer slots (which are also the records in .rec files) and the .rec
+// file header are padded to this so they can be written with O_DIRECT
+#define RECORDING_BLOCK_SIZE 4096
+
+// the streaming writer writes up to this many frames at once
+#define RECORDING_WRITE_BATCH 16
+
+// without O_DIRECT, the streaming writer calls fdatasync after this much
+#define RECORDING_SYNC_BYTES (64*1024*1024)
+
+// how long the streaming writer sleeps once it has caught up
+#define RECORDING_WRITER_POLL_US 20000
+
+#define RECORDING_FILE_EXTENSION ".rec"
+#define RECORDING_FILE_MAGIC "PBSTREC1"
+#define RECORDING_INDEX_MAGIC "PBSTIDX1"
+
+// room for the free-form text in a .rec file's header
+#define RECORDING_METADATA_BYTES 2048
+
+// how the frames in a .rec file are stored
+#define RECORDING_CODEC_RAW 0
+#define RECORDING_CODEC_PNG 1
+
+// per-frame metadata next to a recording (cameras.recordMetadata)
+#define RECORDING_METADATA_FILE_EXTENSION ".meta"
+#define RECORDING_METADATA_FILE_MAGIC "PBSTMET1"
+
+// stdio buffer for the metadata file, so the frame loop only ever copies
+// into memory and a write goes out every few seconds
+#define RECORDING_METADATA_BUFFER_BYTES (64*1024)
+
+// in videoSaveDir, the last video number handed out and its date, so
+// GetNextVideoNumber() doesn't have to look through every recording
+#define RECORDING_NUMBER_MANIFEST ".video-numbers"
+
+// zlib level for compressed recordings.  Fastest, since it has to keep up
+// with the cameras.
+#define RECORDING_PNG_COMPRESSION 1
+
+// PGM and AVI frames decoded ahead of playback
+#define PLAYBACK_PREFETCH_FRAMES 8
+
+/**
+ * Start of a .rec file, padded out to RECORDING_BLOCK_SIZE.  After it come
+ * the frames, record_bytes each, in the same layout as the ringbuffer
+ * slots, and then (once the file is finished) the index.
+ */
+struct RecordingFileHeader {
+    char magic[8];
+
+    // left (0) and right (1) frames
+    int32_t width[2];
+    int32_t height[2];
+    int32_t type[2];
+
+    int32_t record_bytes;
+
+    // whatever SetRecordingMetadata() was given, NUL terminated
+    char metadata[RECORDING_METADATA_BYTES];
+
+    // RECORDING_CODEC_RAW or RECORDING_CODEC_PNG.  With PNG, record_bytes
+    // is just the size of an uncompressed record.
+    int32_t codec;
+};
+
+/**
+ * One record in a .rec file's index.
+ */
+struct RecordingIndexEntry {
+    int64_t frame_number;
+    int64_t timestamp;
+    int64_t offset;
+};
+
+/**
+ * Last bytes of a finished .rec file.  The index (num_entries
+ * RecordingIndexEntry's) starts at index_offset.  A file without one (if
+ * the program died while recording) gets its index rebuilt from the
+ * records.
+ */
+struct RecordingIndexFooter {
+    int64_t index_offset;
+    int64_t num_entries;
+    char magic[8];
+};
+
+/**
+ * A decoded PGM or AVI playback frame, waiting for GetFrames().
+ */
+struct PrefetchedFrame {
+    int frame_number;
+    Mat left;
+    Mat right;
+};
+
+/**
+ * Start of each ringbuffer slot, followed by the left and right frames.
+ */
+struct RecordingFrameHeader {
+    int64_t frame_number;
+    int64_t timestamp;
+};
+
+/**
+ * Start of each record in a compressed .rec file, followed by the left and
+ * right PNGs.  Records are padded to RECORDING_BLOCK_SIZE.
+ */
+struct RecordingCompressedFrameHeader {
+    RecordingFrameHeader frame;
+
+    int32_t png_bytes[2];
+
+    // the whole record, with this header and the padding
+    int64_t record_bytes;
+};
+
+/**
+ * Start of a .meta file.  After it come RecordingFrameMetadata's,
+ * record_bytes each.
+ */
+struct RecordingMetadataFileHeader {
+    char magic[8];
+    int32_t record_bytes;
+    int32_t reserved;
+};
 
-#define RINGBUFFER_SIZE (120*50) // number of seconds to allocate for recording * framerate
+/**
+ * What a frame was recorded and searched with, one per frame in a .meta
+ * file.  frame_number matches the frame's number in the .rec file (or the
+ * AVI/PGM frames).
+ */
+struct RecordingFrameMetadata {
+    int64_t frame_number;
+
+    // when the lcmt_stereo message went out (the message's timestamp)
+    int64_t timestamp;
+
+    // left (0) and right (1) frames, from dc1394 (0 for playback)
+    int64_t capture_timestamp[2];
+    int32_t frames_behind[2];
+
+    // from the ExposureController
+    uint32_t shutter;
+    uint32_t gain;
+
+    // the PushbroomStereoState the frame was searched with
+    int32_t stereo_ran;
+    int32_t disparity;
+    int32_t num_disparities;
+    int32_t zero_dist_disparity;
+    int32_t sobel_limit;
+    int32_t block_size;
+    int32_t sad_threshold;
+    float horizontal_invariance_multiplier;
+    int32_t census_matching;
+    int32_t census_threshold;
+    int32_t roi[4];     // top, bottom, left, right
+    int32_t deadline_us;
+
+    int32_t number_of_points;
+
+    // latest pose (utime 0 if there wasn't one), as in mav_pose_t
+    int64_t pose_utime;
+    double pos[3];
+    double vel[3];
+    double orientation[4];
+    double rotation_rate[3];
+};
 
 using namespace std;
 using namespace cv;
@@ -27,6 +217,22 @@ class RecordingManager {
 
         void FlushBufferToDisk();
 
+        // frames in this recording that were dropped because the
+        // streaming writer fell a whole ringbuffer behind
+        int GetNumDroppedFrames() { return num_dropped_frames_; }
+
+        static bool IsRecordingFile(string filename);
+
+        // stored in the header of .rec files started after this
+        void SetRecordingMetadata(string metadata) { recording_metadata_ = metadata; }
+
+        // metadata of the .rec file being played
+        string GetPlaybackMetadata();
+
+        bool ConvertToRecordingFile(string filename, int first_frame_number);
+
+        static int GetSkipNumber(string filename);
+
         void BeginNewRecording();
 
         bool LoadVideoFiles(string video_file_left, string video_file_right);
@@ -35,6 +241,12 @@ class RecordingManager {
 
         void SetRecordingOn(bool x) { recording_on_ = x; }
 
+        void Trigger();
+        bool IsTriggered() { return triggered_; }
+
+        void AddFrameMetadata(const RecordingFrameMetadata &metadata);
+        static bool ReadMetadataFile(string filename, cv::vector<RecordingFrameMetadata> *metadata);
+
         bool SetPlaybackVideoDirectory(string video_directory);
         void SetPlaybackVideoNumber(int video_number, long long timestamp);
         void SetPlaybackFrameNumber(int frame_number);
@@ -47,7 +259,8 @@ class RecordingManager {
 
         void SetHudNumbers(Hud *hud);
 
-        void RestartRecHud() { record_hud_setup_ = false; }
+        void RestartRecHud() { record_hud_setup_ = false; record_hud_hw_writer_.Close(); }
+        void GetHudFrameBuffer(Mat *hud_frame);
         void RecFrameHud(Mat hud_frame, bool is_color = true, std::string prepend_str = "HUD");
 
         void SetQuietMode(bool x) { quiet_mode_ = x; }
@@ -58,17 +271,57 @@ class RecordingManager {
 
         string SetupVideoWriterPGM(string dirnamePrefix, bool increment_number);
         VideoWriter SetupVideoWriterAVI(string filenamePrefix, Size frameSize, bool increment_number, bool is_color = false, int *this_video_number = NULL);
+        bool SetupHardwareWriter(HardwareVideoWriter *writer, string filenamePrefix, Size frameSize, bool increment_number, bool is_color, bool drop_when_behind, int *this_video_number = NULL);
 
         int LoadVideoFileFromDir(long long timestamp, int video_number);
 
+        Mat GetRingbufferFrame(int camera_number, long long slot_number);
+        Mat GetRecordFrame(int camera_number, uchar *record);
+        uchar* GetRingbufferSlot(long long slot_number);
+        void SetRecordLayout(Mat image_left, Mat image_right);
+        void FreeRingbuffer();
+
+        void OpenMetadataFile();
+        void CloseMetadataFile();
+
+        void StartStreaming();
+        void FinishStreaming();
+        static void* WriterThread(void *x);
+        void RunWriter();
+        long long GetDecidedHead(long long head, long long written);
+        bool KeepSlot(long long slot_number);
+
+        bool OpenStreamFile(string filename);
+        bool WriteToStream(const uchar *data, size_t bytes);
+        bool WriteRecords(uchar *records, int num_records);
+        void CompressRecord(uchar *record, int batch_number);
+        void AddToStreamIndex(const uchar *record, off_t offset);
+        void CloseStreamFile();
+
+        bool LoadRecordingFile(string filename);
+        bool LoadRecordingFileIndex(off_t file_bytes);
+        void GetFrameRecordingFile(Mat &left_image, Mat &right_image);
+        void CloseRecordingFile();
+
         void GetFramePGM(Mat &left_image, Mat &right_image);
         void GetFrameAVI(Mat &left_image, Mat &right_image);
+        void ReadFramePGM(int frame_number, Mat &left_image, Mat &right_image);
+        void ReadFrameAVI(int frame_number, Mat &left_image, Mat &right_image);
+        void ClampFrameNumberAVI();
+
+        void GetFramePrefetched(Mat &left_image, Mat &right_image);
+        void StartPrefetch();
+        void StopPrefetch();
+        static void* PrefetchThread(void *x);
+        void RunPrefetch();
 
         string GetNextVideoFilename(string filename_prefix, bool use_pgm, bool increment_number, int *this_video_number = NULL);
         int GetNextVideoNumber(bool use_pgm, bool increment_number);
 
+        int ReadNumberManifest(string datestr);
+        void WriteNumberManifest(string datestr, int number);
+
         int MatchVideoFile(string directory, string datestr, bool using_avi = false, int match_number = -1);
-        int GetSkipNumber(string filename);
         string GetDateSring();
         string CheckOrCreateDirectory(string dir);
 
@@ -76,12 +329,119 @@ class RecordingManager {
 
         OpenCvStereoConfig stereo_config_;
 
-        // allocate a huge array for a ringbuffer
-        Mat ringbufferL[RINGBUFFER_SIZE];
-        Mat ringbufferR[RINGBUFFER_SIZE];
+        // one huge mmap'd block for the ringbuffer.  Each slot is a
+        // RecordingFrameHeader and the left and right frames, padded to
+        // RECORDING_BLOCK_SIZE.
+        uchar *ringbuffer_;
+        size_t ringbuffer_bytes_;
+        size_t ringbuffer_slot_bytes_;
+
+        // slots in the ringbuffer (RINGBUFFER_SIZE unless triggered)
+        int ring_size_;
+
+        // layout of the left (0) and right (1) frames in each slot
+        Size ringbuffer_frame_size_[2];
+        int ringbuffer_frame_type_[2];
+        size_t ringbuffer_frame_bytes_[2];
+
+        // slots filled by AddFrames() and, when streaming, slots the
+        // writer has put on disk.  AddFrames() won't get a whole
+        // ringbuffer ahead of the writer.
+        atomic<long long> ring_head_;
+        atomic<long long> ring_written_;
+
+        // streaming the ringbuffer to a .rec file as it fills
+        // (cameras.streamRecording)
+        bool streaming_;
+        int stream_fd_;
+        bool stream_direct_;
+        string stream_filename_;
+        off_t stream_offset_;
+        size_t stream_unsynced_bytes_;
+        bool stream_write_failed_;
+
+        // one entry per record written, for the file's index
+        AccountedVector<RecordingIndexEntry, MEMORY_RECORDING> stream_index_;
+
+        // compressing records (cameras.compressRecording).  Each record in
+        // a batch gets its own buffers, so they can compress in parallel.
+        bool stream_compressed_;
+        cv::vector<uchar> compress_png_[RECORDING_WRITE_BATCH][2];
+        cv::vector<uchar> compress_records_[RECORDING_WRITE_BATCH];
+
+        // what compress_png_ and compress_records_ have grown to
+        MemoryGauge compress_memory_;
+
+        // aligned (for O_DIRECT) buffer the compressed batch is written from
+        uchar *compress_write_buffer_;
+        size_t compress_write_buffer_bytes_;
+
+        pthread_t writer_thread_;
+        atomic<bool> stop_writer_;
+
+        atomic<int> num_dropped_frames_;
+
+        // triggered recording (cameras.triggeredRecording).  Every frame
+        // goes in the ringbuffer, but the writer only keeps the ones
+        // within a window around a trigger and every trigger_decimation_'th
+        // one outside them.  It stays trigger_pre_us_ behind the cameras so
+        // a trigger can still reach back that far.
+        bool triggered_;
+        int64_t trigger_pre_us_;
+        int64_t trigger_post_us_;
+        int trigger_decimation_;
+
+        // (start, end) wall times of the windows, oldest first.  Trigger()
+        // adds them and the writer drops them once it's past.
+        std::mutex trigger_mutex_;
+        std::deque<std::pair<int64_t, int64_t> > trigger_windows_;
+
+        // frames the writer skipped because they were outside a window
+        atomic<int> num_decimated_frames_;
+
+        string recording_metadata_;
+
+        // the .meta file for this recording (cameras.recordMetadata)
+        FILE *metadata_file_;
+
+        // playing back a .rec file.  The file is mmap'd if there's room
+        // for it (it can be bigger than a 32-bit address space), otherwise
+        // frames are read into recording_file_buffer_.
+        bool reading_recording_file_;
+        int recording_file_fd_;
+        RecordingFileHeader recording_file_header_;
+        uchar *recording_file_map_;
+        size_t recording_file_map_bytes_;
+        cv::vector<uchar> recording_file_buffer_;
+
+        cv::vector<RecordingIndexEntry> recording_file_index_;
+
+        // index entry for each frame number from the first one on, so any
+        // frame is found right away (dropped frames point at the one
+        // before)
+        cv::vector<int> recording_file_lookup_;
 
         VideoCapture *left_video_capture_;
         VideoCapture *right_video_capture_;
+        int avi_frame_count_;
+
+        // position the captures will read next, so reading frames in
+        // order doesn't seek
+        int avi_next_position_;
+
+        // decoding PGM and AVI playback on another thread, so it overlaps
+        // with stereo.  The queue holds consecutive frames, starting with
+        // the one GetFrames() wants next.  Jumping anywhere else restarts
+        // it there.
+        pthread_t prefetch_thread_;
+        bool prefetch_running_;
+        bool stop_prefetch_;
+        std::mutex prefetch_mutex_;
+        std::condition_variable prefetch_cond_;
+        std::deque<PrefetchedFrame> prefetch_queue_;
+        int prefetch_next_; // next frame to decode
+        int prefetch_in_flight_; // frame being decoded, or -1
+        int prefetch_generation_; // changes on a restart, so the frame in flight gets thrown out
 
         string pgm_left_dir_; // directory for the "loaded" pgm files
         string pgm_right_dir_;
@@ -90,6 +450,9 @@ class RecordingManager {
 
         VideoWriter record_hud_writer_;
 
+        // used instead of record_hud_writer_ when there's a hardware encoder
+        HardwareVideoWriter record_hud_hw_writer_;
+
         int rec_num_frames_;
         int video_number_;
         int hud_video_number_;
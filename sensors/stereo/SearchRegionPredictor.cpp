@@ -0,0 +1,111 @@
+#include "SearchRegionPredictor.hpp"
+
+/**
+ * @param Q reprojection matrix (state.Q), for the camera's focal length
+ *      and center
+ * @param margin pixels to search around each predicted hit
+ */
+SearchRegionPredictor::SearchRegionPredictor(Mat Q, int margin) {
+
+    Mat q;
+    Q.convertTo(q, CV_64F);
+
+    // Q from stereoRectify maps (u, v, d) to (u - cx, v - cy, f)
+    focal_length_ = q.at<double>(2, 3);
+    center_x_ = -q.at<double>(0, 3);
+    center_y_ = -q.at<double>(1, 3);
+
+    margin_ = margin;
+
+    have_pose_ = false;
+    pose_utime_ = 0;
+
+    for (int i = 0; i < 3; i++) {
+        velocity_[i] = 0;
+        rotation_rate_[i] = 0;
+    }
+
+    hits_timestamp_ = 0;
+}
+
+/**
+ * Keeps the velocity and rotation rate from a pose message.
+ *
+ * @param msg pose, in the body frame (X forward, Z down)
+ */
+void SearchRegionPredictor::SetPose(const mav_pose_t *msg) {
+
+    // body (x, y, z) is opencvFrame (z, x, y)
+    velocity_[0] = msg->vel[1];
+    velocity_[1] = msg->vel[2];
+    velocity_[2] = msg->vel[0];
+
+    rotation_rate_[0] = msg->rotation_rate[1];
+    rotation_rate_[1] = msg->rotation_rate[2];
+    rotation_rate_[2] = msg->rotation_rate[0];
+
+    pose_utime_ = msg->utime;
+    have_pose_ = true;
+}
+
+/**
+ * Remembers a frame's hits to predict the next frame from.
+ *
+ * @param timestamp time of the frame, in microseconds
+ * @param buffers the frame's hits, in meters
+ */
+void SearchRegionPredictor::AddHits(int64_t timestamp, const PushbroomStereoFrameBuffers &buffers) {
+
+    hits_.resize(buffers.number_of_points);
+
+    for (int i = 0; i < buffers.number_of_points; i++) {
+        hits_[i] = Point3f(buffers.x[i], buffers.y[i], buffers.z[i]);
+    }
+
+    hits_timestamp_ = timestamp;
+}
+
+/**
+ * Moves the last frame's hits to where they should be now and gives a
+ * region around each one.
+ *
+ * @param timestamp time of the frame about to be searched, in microseconds
+ * @param regions (output) regions of the remapped image to search first.
+ *      Empty if there is nothing recent enough to predict from.
+ */
+void SearchRegionPredictor::Predict(int64_t timestamp, cv::vector<Rect> *regions) {
+
+    regions->clear();
+
+    int64_t hits_age = timestamp - hits_timestamp_;
+
+    if (!have_pose_ || hits_.empty() || hits_age <= 0 || hits_age > SEARCH_REGION_MAX_AGE_US
+        || llabs(timestamp - pose_utime_) > SEARCH_REGION_MAX_AGE_US) {
+
+        return;
+    }
+
+    float dt = hits_age / 1000000.0f;
+
+    Point3f velocity(velocity_[0], velocity_[1], velocity_[2]);
+    Point3f rotation_rate(rotation_rate_[0], rotation_rate_[1], rotation_rate_[2]);
+
+    int size = 2 * margin_ + 1;
+
+    for (size_t i = 0; i < hits_.size(); i++) {
+        const Point3f &hit = hits_[i];
+
+        // seen from the aircraft, the world moves back at its velocity
+        // and turns the other way
+        Point3f moved = hit - (velocity + rotation_rate.cross(hit)) * dt;
+
+        if (moved.z < SEARCH_REGION_MIN_DEPTH) {
+            continue;
+        }
+
+        int u = cvRound(focal_length_ * moved.x / moved.z + center_x_);
+        int v = cvRound(focal_length_ * moved.y / moved.z + center_y_);
+
+        regions->push_back(Rect(u - margin_, v - margin_, size, size));
+    }
+}
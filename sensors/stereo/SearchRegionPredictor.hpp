@@ -0,0 +1,62 @@
+#ifndef SEARCH_REGION_PREDICTOR_H_
+#define SEARCH_REGION_PREDICTOR_H_
+
+/**
+ * Predicts where this frame's obstacles will be in the image, so stereo
+ * can search there first (see PushbroomStereo::Submit).  Last frame's hits
+ * are moved by the aircraft's velocity and rotation rate from the latest
+ * pose and projected back into the image.
+ *
+ * Assumes the camera looks straight out the nose (opencvFrame x = body y,
+ * y = body z, z = body x).  A few degrees of mounting angle just moves the
+ * regions by a few pixels, which the margin around them takes care of.
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "opencv2/opencv.hpp"
+#include "../../LCM/mav_pose_t.h"
+#include "pushbroom-stereo.hpp"
+
+// poses and hits older than this are too old to predict from
+#define SEARCH_REGION_MAX_AGE_US 200000
+
+// hits that end up closer than this to the camera have gone by
+#define SEARCH_REGION_MIN_DEPTH 0.5f
+
+class SearchRegionPredictor {
+
+    public:
+        SearchRegionPredictor(Mat Q, int margin);
+
+        void SetPose(const mav_pose_t *msg);
+
+        void AddHits(int64_t timestamp, const PushbroomStereoFrameBuffers &buffers);
+
+        void Predict(int64_t timestamp, cv::vector<Rect> *regions);
+
+    private:
+        // from the reprojection matrix
+        float focal_length_;
+        float center_x_;
+        float center_y_;
+
+        // pixels around each predicted hit to search
+        int margin_;
+
+        // latest pose, in opencvFrame
+        bool have_pose_;
+        int64_t pose_utime_;
+        float velocity_[3];
+        float rotation_rate_[3];
+
+        // last frame's hits, in meters in opencvFrame
+        int64_t hits_timestamp_;
+        cv::vector<Point3f> hits_;
+};
+
+#endif
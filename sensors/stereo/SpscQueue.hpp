@@ -0,0 +1,71 @@
+#ifndef SPSC_QUEUE_H_
+#define SPSC_QUEUE_H_
+
+/**
+ * Lock-free queue for handing things between two threads.
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#include <atomic>
+
+using namespace std;
+
+/**
+ * Lock-free queue for one thread pushing and one thread popping.  Holds
+ * up to N - 1 items.  N must be a power of two.
+ */
+template <typename T, int N>
+class SpscQueue {
+
+    public:
+        SpscQueue() : head_(0), tail_(0) {}
+
+        // producer only
+        bool Push(const T &item) {
+            int tail = tail_.load(memory_order_relaxed);
+            int next = (tail + 1) & (N - 1);
+
+            if (next == head_.load(memory_order_acquire)) {
+                // full
+                return false;
+            }
+
+            items_[tail] = item;
+            tail_.store(next, memory_order_release);
+
+            return true;
+        }
+
+        // consumer only
+        bool Pop(T *item) {
+            int head = head_.load(memory_order_relaxed);
+
+            if (head == tail_.load(memory_order_acquire)) {
+                // empty
+                return false;
+            }
+
+            *item = items_[head];
+
+            // let go of the slot's copy now, not when it gets overwritten
+            items_[head] = T();
+
+            head_.store((head + 1) & (N - 1), memory_order_release);
+
+            return true;
+        }
+
+        bool Empty() {
+            return head_.load(memory_order_acquire) == tail_.load(memory_order_acquire);
+        }
+
+    private:
+        T items_[N];
+
+        atomic<int> head_;
+        atomic<int> tail_;
+};
+
+#endif
@@ -0,0 +1,178 @@
+#include "StereoCapture.hpp"
+
+/**
+ * Starts a capture thread for each camera.  The cameras must already be
+ * capturing.
+ *
+ * @param camera_left left camera
+ * @param camera_right right camera
+ */
+StereoCapture::StereoCapture(dc1394camera_t *camera_left, dc1394camera_t *camera_right) {
+
+    pools_[0] = new Format7FramePool(camera_left);
+    pools_[1] = new Format7FramePool(camera_right);
+
+    shutting_down_ = false;
+
+    for (int i = 0; i < 2; i++) {
+        period_us_[i] = 0;
+        num_dropped_[i] = 0;
+
+        thread_starter_[i].parent = this;
+        thread_starter_[i].camera_number = i;
+
+        pthread_create(&(threads_[i]), NULL, CaptureThread, &(thread_starter_[i]));
+    }
+}
+
+StereoCapture::~StereoCapture() {
+
+    shutting_down_ = true;
+
+    // the threads check shutting_down_ at least every 100ms
+    for (int i = 0; i < 2; i++) {
+        pthread_join(threads_[i], NULL);
+    }
+
+    // give the frames still queued back to the cameras before the pools go
+    for (int i = 0; i < 2; i++) {
+        {
+            Format7Frame frame;
+            while (queues_[i].Pop(&frame)) {}
+        }
+
+        delete pools_[i];
+    }
+}
+
+void* StereoCapture::CaptureThread(void *x) {
+
+    StereoCaptureThreadStarter *starter = (StereoCaptureThreadStarter*) x;
+
+    starter->parent->RunCapture(starter->camera_number);
+
+    return NULL;
+}
+
+/**
+ * Pulls every frame out of one camera as soon as it arrives and queues it
+ * for GetPair().
+ *
+ * @param camera_number 0 for left, 1 for right
+ */
+void StereoCapture::RunCapture(int camera_number) {
+
+    uint64_t last_timestamp = 0;
+
+    while (shutting_down_ == false) {
+
+        if (pools_[camera_number]->WaitForFrame(100) != true) {
+            continue;
+        }
+
+        Format7Frame frame = pools_[camera_number]->GetFrame();
+
+        if (last_timestamp > 0 && frame.timestamp > last_timestamp) {
+            int diff = frame.timestamp - last_timestamp;
+
+            period_us_[camera_number] = period_us_[camera_number] > 0 ?
+                (7 * period_us_[camera_number] + diff) / 8 : diff;
+        }
+
+        last_timestamp = frame.timestamp;
+
+        if (frame.frames_behind > 0) {
+            // a newer frame is already in the ring, skip straight to it
+            num_dropped_[camera_number] ++;
+            continue;
+        }
+
+        if (queues_[camera_number].Push(frame) != true) {
+            // stereo isn't keeping up, it'll still get the frames that
+            // are queued
+            num_dropped_[camera_number] ++;
+            continue;
+        }
+
+        {
+            lock_guard<mutex> lock(frame_mutex_);
+        }
+
+        cv_new_frame_.notify_one();
+    }
+}
+
+/**
+ * Takes every frame that is queued for a camera and keeps the newest.
+ *
+ * @param camera_number 0 for left, 1 for right
+ * @param frame (in/out) replaced with the newest frame if there are any
+ *
+ * @retval true if there were any frames
+ */
+bool StereoCapture::PopNewest(int camera_number, Format7Frame *frame) {
+
+    Format7Frame next;
+    bool got_frame = false;
+
+    while (queues_[camera_number].Pop(&next)) {
+        if (frame->image.data != NULL) {
+            num_dropped_[camera_number] ++;
+        }
+
+        *frame = next;
+        got_frame = true;
+    }
+
+    return got_frame;
+}
+
+/**
+ * Waits for the next left and right frames that go together.  Frames older
+ * than the pair are dropped, so this always returns the freshest pair.
+ *
+ * The cameras aren't triggered together, so a pair is taken once the two
+ * timestamps are within half a frame of each other, which is as close as
+ * they can get.  Otherwise the older of the two is dropped when the next
+ * frame from that camera comes in.
+ *
+ * @param left (output) left frame
+ * @param right (output) right frame
+ */
+void StereoCapture::GetPair(Format7Frame *left, Format7Frame *right) {
+
+    Format7Frame newest[2];
+
+    while (true) {
+
+        PopNewest(0, &newest[0]);
+        PopNewest(1, &newest[1]);
+
+        // camera we need another frame from
+        int waiting_for;
+
+        if (newest[0].image.data == NULL) {
+            waiting_for = 0;
+        } else if (newest[1].image.data == NULL) {
+            waiting_for = 1;
+        } else {
+            int64_t skew = (int64_t)newest[0].timestamp - (int64_t)newest[1].timestamp;
+            waiting_for = skew < 0 ? 0 : 1;
+
+            if (llabs(skew) <= period_us_[waiting_for] / 2) {
+                *left = newest[0];
+                *right = newest[1];
+                return;
+            }
+        }
+
+        unique_lock<mutex> lock(frame_mutex_);
+
+        while (queues_[0].Empty() && queues_[1].Empty()) {
+            if (cv_new_frame_.wait_for(lock, chrono::milliseconds(CAPTURE_WARN_TIMEOUT_MS)) == cv_status::timeout) {
+                fprintf(stderr, "Warning: no frames from the %s camera for %d ms.\n",
+                    waiting_for == 0 ? "left" : "right", CAPTURE_WARN_TIMEOUT_MS);
+            }
+        }
+    }
+}
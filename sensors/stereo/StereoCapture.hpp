@@ -0,0 +1,73 @@
+#ifndef STEREO_CAPTURE_H_
+#define STEREO_CAPTURE_H_
+
+/**
+ * Captures from both cameras at once, each on its own thread, and pairs up
+ * the newest left and right frames by their timestamps.
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#include "opencv-stereo-util.hpp"
+#include "SpscQueue.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <pthread.h>
+
+// slots in each camera's queue (one is always kept empty).  Must be a
+// power of two.
+#define CAPTURE_QUEUE_SIZE 4
+
+// how long GetPair() waits for a camera before warning
+#define CAPTURE_WARN_TIMEOUT_MS 1000
+
+using namespace std;
+using namespace cv;
+
+class StereoCapture;
+
+struct StereoCaptureThreadStarter {
+    StereoCapture *parent;
+    int camera_number;
+};
+
+class StereoCapture {
+
+    public:
+        StereoCapture(dc1394camera_t *camera_left, dc1394camera_t *camera_right);
+        ~StereoCapture();
+
+        void GetPair(Format7Frame *left, Format7Frame *right);
+
+        // frames thrown away because newer ones were already there
+        int GetNumDropped() { return num_dropped_[0] + num_dropped_[1]; }
+
+    private:
+        static void* CaptureThread(void *x);
+        void RunCapture(int camera_number);
+
+        bool PopNewest(int camera_number, Format7Frame *frame);
+
+        Format7FramePool *pools_[2];
+        SpscQueue<Format7Frame, CAPTURE_QUEUE_SIZE> queues_[2];
+
+        // time between frames from each camera (microseconds), so pairing
+        // can tell if the next frame would be a better match
+        atomic<int> period_us_[2];
+
+        atomic<int> num_dropped_[2];
+
+        pthread_t threads_[2];
+        StereoCaptureThreadStarter thread_starter_[2];
+
+        atomic<bool> shutting_down_;
+
+        // GetPair() sleeps on this until a capture thread pushes a frame
+        mutex frame_mutex_;
+        condition_variable cv_new_frame_;
+};
+
+#endif
@@ -0,0 +1,191 @@
+#include "StereoPair.hpp"
+
+/**
+ * @param config the pair's cameras, calibration and search settings
+ * @param thread_config how to split up the pair's frames, usually the
+ *      same as the main pair's (they share the pool)
+ * @param lcm LCM object to publish on
+ * @param publish_thread true to send the pair's results from a thread of
+ *      its own (see StereoPublisher)
+ */
+StereoPair::StereoPair(const StereoPairConfig &config, PushbroomStereoThreadConfig thread_config, lcm_t *lcm, bool publish_thread)
+    : stereo_(thread_config), publisher_(lcm, publish_thread, config.channel) {
+
+    config_ = config;
+
+    context_left_ = NULL;
+    context_right_ = NULL;
+    camera_left_ = NULL;
+    camera_right_ = NULL;
+
+    capture_ = NULL;
+    exposure_controller_ = NULL;
+
+    buffers_.number_of_points = 0;
+
+    frame_in_flight_ = false;
+}
+
+StereoPair::~StereoPair() {
+
+    // stop grabbing before the cameras go away
+    delete exposure_controller_;
+    delete capture_;
+
+    if (camera_left_ != NULL) {
+        StopCapture(context_left_, camera_left_);
+    }
+
+    if (camera_right_ != NULL) {
+        StopCapture(context_right_, camera_right_);
+    }
+}
+
+/**
+ * Loads the pair's calibration and starts its cameras, in the same
+ * Format7 mode and ROI as the main pair.
+ *
+ * @param capture_mode Format7 mode
+ * @param capture_roi part of the mode's image to send, or empty for all
+ *      of it
+ * @param enable_gamma as for InitBrightnessSettings
+ *
+ * @retval true on success, false (with a message) on failure
+ */
+bool StereoPair::Start(int capture_mode, Rect capture_roi, bool enable_gamma) {
+
+    if (LoadCalibration(config_.calibrationDir, &calibration_) != true) {
+        fprintf(stderr, "Error: failed to read the calibration for camera pair %s.\n", config_.name.c_str());
+        return false;
+    }
+
+    if (capture_roi.area() > 0) {
+        if (CropCalibration(capture_roi, &calibration_) != true) {
+            return false;
+        }
+
+        // the search region is in the captured image's pixels from here
+        // on, like ShiftRoiToCapture does for the main pair
+        config_.roiTop = std::max(0, config_.roiTop - capture_roi.y);
+        config_.roiLeft = std::max(0, config_.roiLeft - capture_roi.x);
+
+        if (config_.roiBottom >= 0) {
+            config_.roiBottom = std::max(0, config_.roiBottom - capture_roi.y);
+        }
+
+        if (config_.roiRight >= 0) {
+            config_.roiRight = std::max(0, config_.roiRight - capture_roi.x);
+        }
+    }
+
+    context_left_ = dc1394_new();
+    context_right_ = dc1394_new();
+
+    if (context_left_ == NULL || context_right_ == NULL) {
+        fprintf(stderr, "Error: could not create dc1394 contexts for camera pair %s.\n", config_.name.c_str());
+        return false;
+    }
+
+    camera_left_ = dc1394_camera_new(context_left_, config_.guidLeft);
+    camera_right_ = dc1394_camera_new(context_right_, config_.guidRight);
+
+    if (camera_left_ == NULL || camera_right_ == NULL) {
+        fprintf(stderr, "Error: could not open the %s camera of pair %s.\n", camera_left_ == NULL ? "left" : "right", config_.name.c_str());
+        return false;
+    }
+
+    Size mode_size;
+
+    if (SetupFormat7Capture(camera_left_, capture_mode, capture_roi, &mode_size) != DC1394_SUCCESS
+        || SetupFormat7Capture(camera_right_, capture_mode, capture_roi) != DC1394_SUCCESS) {
+
+        fprintf(stderr, "Error: could not set up the cameras of pair %s.\n", config_.name.c_str());
+        return false;
+    }
+
+    if (dc1394_video_set_transmission(camera_left_, DC1394_ON) != DC1394_SUCCESS
+        || dc1394_video_set_transmission(camera_right_, DC1394_ON) != DC1394_SUCCESS) {
+
+        fprintf(stderr, "Error: could not start the cameras of pair %s.\n", config_.name.c_str());
+        return false;
+    }
+
+    InitBrightnessSettings(camera_left_, camera_right_, enable_gamma);
+
+    capture_ = new StereoCapture(camera_left_, camera_right_);
+    exposure_controller_ = new ExposureController(camera_left_, camera_right_, enable_gamma);
+
+    return true;
+}
+
+/**
+ * Grabs the pair's next frames and starts stereo on them.
+ *
+ * @param state the main pair's stereo settings, which the pair's own
+ *      calibration, disparities and search region replace
+ * @param match_brightness_frames match the cameras' brightness every
+ *      this many frames
+ */
+void StereoPair::Submit(PushbroomStereoState state, int match_brightness_frames) {
+
+    capture_->GetPair(&frame_left_, &frame_right_);
+
+    exposure_controller_->AddFrames(frame_left_.image, frame_right_.image, match_brightness_frames);
+
+    state.mapxL = calibration_.mx1fp;
+    state.mapxR = calibration_.mx2fp;
+    state.Q = calibration_.qMat;
+
+    state.disparity = config_.disparity;
+    state.zero_dist_disparity = config_.infiniteDisparity;
+    state.num_disparities = 0;
+
+    state.roi_top = config_.roiTop;
+    state.roi_bottom = config_.roiBottom;
+    state.roi_left = config_.roiLeft;
+    state.roi_right = config_.roiRight;
+    state.roi_mask = Mat();
+
+    // the main pair's display and history don't apply
+    state.show_display = false;
+    state.keep_rectified = false;
+    state.temporal_skip = false;
+
+    frame_in_flight_ = stereo_.Submit(frame_left_.image, frame_right_.image, state);
+}
+
+/**
+ * Waits for the pair's frame and sends its hits on the pair's channel.
+ *
+ * @param timestamp time of the frame, in microseconds
+ * @param frame_number the main pair's frame number
+ * @param video_number the main pair's video number
+ * @param unit_conversion the 3D points are divided by this
+ */
+void StereoPair::Finish(int64_t timestamp, int frame_number, int video_number, float unit_conversion) {
+
+    if (!frame_in_flight_) {
+        return;
+    }
+
+    stereo_.Poll(&buffers_, unit_conversion, true);
+    frame_in_flight_ = false;
+
+    // give the buffers back to the cameras
+    frame_left_ = Format7Frame();
+    frame_right_ = Format7Frame();
+
+    lcmt_stereo msg;
+
+    msg.timestamp = timestamp;
+    msg.number_of_points = buffers_.number_of_points;
+    msg.frame_number = frame_number;
+    msg.video_number = video_number;
+
+    msg.x = buffers_.x.data();
+    msg.y = buffers_.y.data();
+    msg.z = buffers_.z.data();
+    msg.grey = buffers_.grey.data();
+
+    publisher_.Publish(&msg, &buffers_.image_hits);
+}
@@ -0,0 +1,67 @@
+#ifndef STEREO_PAIR_H_
+#define STEREO_PAIR_H_
+
+/**
+ * An extra camera pair (side- or up-looking) run by the same
+ * pushbroom-stereo process as the main pair, from a [pair-<name>] group of
+ * the configuration file.  Each pair has its own cameras, calibration,
+ * disparity, search region and output channel, and its own PushbroomStereo
+ * on the shared thread pool.  Every pair's frame is submitted before any of
+ * them is collected, so the pairs' bands share the cores instead of each
+ * pair needing a process with threads of its own.
+ *
+ * Only the main pair gets recorded, displayed and health-checked.
+ *
+ *   pair->Submit(state, MATCH_BRIGHTNESS_EVERY_N_FRAMES);
+ *   ... the main pair's frame ...
+ *   pair->Finish(timestamp, frame_number, video_number, unit_conversion);
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#include "opencv-stereo-util.hpp"
+#include "pushbroom-stereo.hpp"
+#include "StereoCapture.hpp"
+#include "StereoPublisher.hpp"
+#include "ExposureController.hpp"
+
+class StereoPair {
+
+    public:
+        StereoPair(const StereoPairConfig &config, PushbroomStereoThreadConfig thread_config, lcm_t *lcm, bool publish_thread);
+        ~StereoPair();
+
+        bool Start(int capture_mode, Rect capture_roi, bool enable_gamma);
+
+        void Submit(PushbroomStereoState state, int match_brightness_frames);
+        void Finish(int64_t timestamp, int frame_number, int video_number, float unit_conversion);
+
+        const string& GetName() const { return config_.name; }
+
+    private:
+        StereoPairConfig config_;
+
+        dc1394_t *context_left_;
+        dc1394_t *context_right_;
+        dc1394camera_t *camera_left_;
+        dc1394camera_t *camera_right_;
+
+        StereoCapture *capture_;
+        ExposureController *exposure_controller_;
+
+        OpenCvStereoCalibration calibration_;
+
+        PushbroomStereo stereo_;
+        StereoPublisher publisher_;
+
+        // held until stereo is done with them
+        Format7Frame frame_left_;
+        Format7Frame frame_right_;
+
+        PushbroomStereoFrameBuffers buffers_;
+
+        bool frame_in_flight_;
+};
+
+#endif
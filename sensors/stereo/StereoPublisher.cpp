@@ -0,0 +1,397 @@
+#include "StereoPublisher.hpp"
+
+/**
+ * Sets up the publisher.
+ *
+ * @param lcm LCM object to publish on
+ * @param use_thread true to send from a background thread, false to send
+ *      right away from Publish()
+ * @param channel channel for the lcmt_stereo messages (another camera
+ *      pair's go out on their own)
+ */
+StereoPublisher::StereoPublisher(lcm_t *lcm, bool use_thread, const string &channel) {
+
+    lcm_ = lcm;
+    use_thread_ = use_thread;
+    channel_ = channel;
+
+    ring_ = NULL;
+    use_udp_ = true;
+
+    compact_encoder_ = NULL;
+    hit_bitmap_encoder_ = NULL;
+
+    batch_max_frames_ = 0;
+    batch_max_us_ = 0;
+
+    shutting_down_ = false;
+
+    if (use_thread_) {
+        for (int i = 0; i < PUBLISH_QUEUE_SIZE - 1; i++) {
+            free_jobs_.Push(i);
+        }
+
+        pthread_create(&thread_, NULL, PublisherThread, this);
+    }
+}
+
+StereoPublisher::~StereoPublisher() {
+
+    if (use_thread_) {
+        {
+            lock_guard<mutex> lock(job_mutex_);
+            shutting_down_ = true;
+        }
+
+        cv_new_job_.notify_one();
+
+        // the thread sends whatever is still queued before it exits
+        pthread_join(thread_, NULL);
+    }
+
+    {
+        lock_guard<mutex> lock(send_mutex_);
+        SendBatch();
+    }
+
+    delete ring_;
+    delete compact_encoder_;
+    delete hit_bitmap_encoder_;
+}
+
+/**
+ * Also sends each message into a shared memory ring.  Call before the
+ * first Publish().
+ *
+ * @param ring_name ring to write (/dev/shm/lcm-<ring_name>)
+ * @param use_udp true to keep sending on LCM too, false for only the ring
+ *
+ * @retval false if the ring couldn't be made (messages still go on LCM)
+ */
+bool StereoPublisher::EnableSharedMemory(const string &ring_name, bool use_udp) {
+
+    ShmRingWriter *ring = new ShmRingWriter();
+
+    if (ring->Open(ring_name) != true) {
+        delete ring;
+        return false;
+    }
+
+    delete ring_;
+    ring_ = ring;
+
+    use_udp_ = use_udp;
+
+    return true;
+}
+
+/**
+ * Also sends each frame packed as an lcmt_stereo_compact.  Call before
+ * the first Publish().
+ *
+ * @param channel channel to send the packed messages on
+ * @param q the stereo's reprojection matrix (4x4)
+ * @param unit_conversion the stereo's calibrationUnitConversion
+ */
+void StereoPublisher::EnableCompact(const string &channel, Mat q, float unit_conversion) {
+
+    Mat q_double;
+    q.convertTo(q_double, CV_64F);
+
+    double q_values[16];
+
+    for (int i = 0; i < 16; i++) {
+        q_values[i] = q_double.at<double>(i / 4, i % 4);
+    }
+
+    delete compact_encoder_;
+    compact_encoder_ = new StereoCompactEncoder(q_values, unit_conversion);
+
+    compact_channel_ = channel;
+}
+
+/**
+ * Also sends which blocks of each frame had hits, as an
+ * lcmt_stereo_hit_bitmap.  Call before the first Publish().
+ *
+ * @param channel channel to send the bitmaps on
+ * @param image_size size of the stereo's (rectified) images
+ * @param block_size the stereo's blockSize
+ */
+void StereoPublisher::EnableHitBitmap(const string &channel, Size image_size, int block_size) {
+
+    delete hit_bitmap_encoder_;
+    hit_bitmap_encoder_ = new StereoHitBitmapEncoder(image_size.width, image_size.height, block_size);
+
+    hit_bitmap_channel_ = channel;
+}
+
+/**
+ * Also sends the frames in batches.  Call before the first Publish().
+ *
+ * @param channel channel to send the batches on
+ * @param max_frames most frames in a batch
+ * @param max_ms a batch is sent once it spans this long (by the frames'
+ *      timestamps), even if it has fewer frames
+ */
+void StereoPublisher::EnableBatching(const string &channel, int max_frames, int max_ms) {
+    batch_channel_ = channel;
+    batch_max_frames_ = max_frames > 1 ? max_frames : 1;
+    batch_max_us_ = (int64_t)max_ms * 1000;
+}
+
+/**
+ * Sends a frame's stereo message on its channel (and/or the
+ * ring).  With a thread,
+ * the message is copied and this returns right away.
+ *
+ * If the thread is somehow still busy with all of the older messages, this
+ * one is sent from here instead (ahead of the queued ones).
+ *
+ * @param msg stereo message
+ * @param image_hits the same hits as (u, v, d) for the compact message and
+ *      the hit bitmap (see PushbroomStereoFrameBuffers), or NULL to not
+ *      send them
+ */
+void StereoPublisher::Publish(const lcmt_stereo *msg, const cv::vector<Point3f> *image_hits) {
+
+    int job_number;
+
+    if (use_thread_ == false || free_jobs_.Pop(&job_number) != true) {
+        bool has_compact = PackCompact(msg, image_hits, &compact_);
+        bool has_hit_bitmap = PackHitBitmap(msg, image_hits, &hit_bitmap_);
+
+        Send(msg, has_compact ? &compact_ : NULL, has_hit_bitmap ? &hit_bitmap_ : NULL);
+        return;
+    }
+
+    StereoPublishJob *job = &jobs_[job_number];
+
+    job->msg = *msg;
+
+    // the message only points at the caller's buffers
+    job->x.assign(msg->x, msg->x + msg->number_of_points);
+    job->y.assign(msg->y, msg->y + msg->number_of_points);
+    job->z.assign(msg->z, msg->z + msg->number_of_points);
+    job->grey.assign(msg->grey, msg->grey + msg->number_of_points);
+
+    job->msg.x = job->x.data();
+    job->msg.y = job->y.data();
+    job->msg.z = job->z.data();
+    job->msg.grey = job->grey.data();
+
+    job->has_compact = PackCompact(msg, image_hits, &job->compact);
+    job->has_hit_bitmap = PackHitBitmap(msg, image_hits, &job->hit_bitmap);
+
+    ready_jobs_.Push(job_number);
+
+    {
+        lock_guard<mutex> lock(job_mutex_);
+    }
+
+    cv_new_job_.notify_one();
+}
+
+void* StereoPublisher::PublisherThread(void *x) {
+
+    ((StereoPublisher*) x)->RunPublisher();
+
+    return NULL;
+}
+
+/**
+ * Sends jobs as Publish() queues them.
+ */
+void StereoPublisher::RunPublisher() {
+
+    while (true) {
+
+        int job_number;
+
+        if (ready_jobs_.Pop(&job_number)) {
+            StereoPublishJob *job = &jobs_[job_number];
+
+            Send(&job->msg, job->has_compact ? &job->compact : NULL,
+                job->has_hit_bitmap ? &job->hit_bitmap : NULL);
+
+            free_jobs_.Push(job_number);
+            continue;
+        }
+
+        if (shutting_down_) {
+            return;
+        }
+
+        unique_lock<mutex> lock(job_mutex_);
+
+        while (ready_jobs_.Empty() && shutting_down_ == false) {
+            cv_new_job_.wait(lock);
+        }
+    }
+}
+
+/**
+ * Packs a frame's hits, if compact is on.
+ *
+ * @retval true if compact was filled in
+ */
+bool StereoPublisher::PackCompact(const lcmt_stereo *msg, const cv::vector<Point3f> *image_hits, lcmt::stereo_compact *compact) {
+
+    if (compact_encoder_ == NULL || image_hits == NULL || (int)image_hits->size() != msg->number_of_points) {
+        return false;
+    }
+
+    compact->timestamp = msg->timestamp;
+    compact->frame_number = msg->frame_number;
+    compact->video_number = msg->video_number;
+
+    compact_encoder_->Encode((const float*)image_hits->data(), msg->grey, msg->number_of_points, compact);
+
+    return true;
+}
+
+/**
+ * Finds which blocks a frame's hits are in, if the hit bitmap is on.
+ *
+ * @retval true if hit_bitmap was filled in
+ */
+bool StereoPublisher::PackHitBitmap(const lcmt_stereo *msg, const cv::vector<Point3f> *image_hits, lcmt::stereo_hit_bitmap *hit_bitmap) {
+
+    if (hit_bitmap_encoder_ == NULL || image_hits == NULL) {
+        return false;
+    }
+
+    hit_bitmap->timestamp = msg->timestamp;
+    hit_bitmap->frame_number = msg->frame_number;
+    hit_bitmap->video_number = msg->video_number;
+
+    hit_bitmap_encoder_->Encode((const float*)image_hits->data(), image_hits->size(), hit_bitmap);
+
+    return true;
+}
+
+/**
+ * Sends a message on LCM and/or the ring, its packed version and hit
+ * bitmap, and adds it to the batch.
+ */
+void StereoPublisher::Send(const lcmt_stereo *msg, const lcmt::stereo_compact *compact, const lcmt::stereo_hit_bitmap *hit_bitmap) {
+
+    if (ring_ == NULL || use_udp_) {
+        lcmt_stereo_publish(lcm_, channel_.c_str(), msg);
+    }
+
+    if (ring_ == NULL && compact == NULL && hit_bitmap == NULL && batch_max_frames_ == 0) {
+        return;
+    }
+
+    lock_guard<mutex> lock(send_mutex_);
+
+    if (batch_max_frames_ > 0) {
+        AddToBatch(msg);
+    }
+
+    if (compact != NULL) {
+        int compact_size = compact->getEncodedSize();
+
+        encode_buffer_.resize(compact_size);
+
+        if (compact->encode(encode_buffer_.data(), 0, compact_size) == compact_size) {
+            lcm_publish(lcm_, compact_channel_.c_str(), encode_buffer_.data(), compact_size);
+        }
+    }
+
+    if (hit_bitmap != NULL) {
+        int hit_bitmap_size = hit_bitmap->getEncodedSize();
+
+        encode_buffer_.resize(hit_bitmap_size);
+
+        if (hit_bitmap->encode(encode_buffer_.data(), 0, hit_bitmap_size) == hit_bitmap_size) {
+            lcm_publish(lcm_, hit_bitmap_channel_.c_str(), encode_buffer_.data(), hit_bitmap_size);
+        }
+    }
+
+    if (ring_ == NULL) {
+        return;
+    }
+
+    // encoded the same way as on LCM, so readers decode it the same way
+    int size = lcmt_stereo_encoded_size(msg);
+
+    encode_buffer_.resize(size);
+
+    if (lcmt_stereo_encode(encode_buffer_.data(), 0, size, msg) != size) {
+        return;
+    }
+
+    if (ring_->Write(encode_buffer_.data(), size) != true) {
+        // too big for a slot: send it on LCM so it isn't lost
+        if (use_udp_ == false) {
+            lcmt_stereo_publish(lcm_, channel_.c_str(), msg);
+        }
+    }
+}
+
+/**
+ * Adds a frame to the batch, and sends the batch if it's full.  Call with
+ * send_mutex_ held.
+ */
+void StereoPublisher::AddToBatch(const lcmt_stereo *msg) {
+
+    int num_points = msg->number_of_points;
+
+    batch_timestamps_.push_back(msg->timestamp);
+    batch_frame_numbers_.push_back(msg->frame_number);
+    batch_video_numbers_.push_back(msg->video_number);
+    batch_offsets_.push_back(batch_x_.size());
+
+    batch_x_.insert(batch_x_.end(), msg->x, msg->x + num_points);
+    batch_y_.insert(batch_y_.end(), msg->y, msg->y + num_points);
+    batch_z_.insert(batch_z_.end(), msg->z, msg->z + num_points);
+    batch_grey_.insert(batch_grey_.end(), msg->grey, msg->grey + num_points);
+
+    if ((int)batch_timestamps_.size() >= batch_max_frames_
+        || msg->timestamp - batch_timestamps_.front() >= batch_max_us_) {
+
+        SendBatch();
+    }
+}
+
+/**
+ * Sends the frames collected so far, if there are any.  Call with
+ * send_mutex_ held.
+ */
+void StereoPublisher::SendBatch() {
+
+    if (batch_timestamps_.empty()) {
+        return;
+    }
+
+    lcmt_stereo_batch batch;
+
+    batch.timestamp = batch_timestamps_.front();
+
+    batch.number_of_frames = batch_timestamps_.size();
+    batch.frame_timestamps = batch_timestamps_.data();
+    batch.frame_numbers = batch_frame_numbers_.data();
+    batch.video_numbers = batch_video_numbers_.data();
+    batch.frame_offsets = batch_offsets_.data();
+
+    batch.number_of_points = batch_x_.size();
+    batch.x = batch_x_.data();
+    batch.y = batch_y_.data();
+    batch.z = batch_z_.data();
+    batch.grey = batch_grey_.data();
+
+    lcmt_stereo_batch_publish(lcm_, batch_channel_.c_str(), &batch);
+
+    // clear() keeps the memory for the next batch
+    batch_timestamps_.clear();
+    batch_frame_numbers_.clear();
+    batch_video_numbers_.clear();
+    batch_offsets_.clear();
+
+    batch_x_.clear();
+    batch_y_.clear();
+    batch_z_.clear();
+    batch_grey_.clear();
+}
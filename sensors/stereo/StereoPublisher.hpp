@@ -0,0 +1,153 @@
+#ifndef STEREO_PUBLISHER_H_
+#define STEREO_PUBLISHER_H_
+
+/**
+ * Sends the stereo results over LCM from a background thread, so the
+ * stereo loop never waits on LCM encoding.  (Images go through
+ * ImageStreamer.)
+ *
+ * With EnableSharedMemory(), messages also go into a shared memory ring
+ * (ShmRing) that processes on the same computer read without going through
+ * the network stack.  UDP can stay on for anything off the board (like
+ * logging and the ground station).
+ *
+ * With EnableCompact(), each frame also goes out as an lcmt_stereo_compact
+ * (see StereoCompact) on its own channel, for the XBee link and logging.
+ *
+ * With EnableHitBitmap(), each frame also goes out as an
+ * lcmt_stereo_hit_bitmap (see StereoHitBitmap): which blocks of the image
+ * had hits, for the HUD and the XBee link to draw without reprojecting.
+ *
+ * With EnableBatching(), frames are also collected and sent a few at a
+ * time as an lcmt_stereo_batch, so listeners that don't need every frame
+ * right away (the logger, the ground station) get a tenth of the packets.
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#include "opencv-stereo-util.hpp"
+#include "SpscQueue.hpp"
+#include "../../utils/ShmRing/ShmRing.hpp"
+#include "../../utils/StereoCompact/StereoCompact.hpp"
+#include "../../utils/StereoCompact/StereoHitBitmap.hpp"
+
+#include <lcm/lcm.h>
+#include "../../LCM/lcmt_stereo.h"
+#include "../../LCM/lcmt_stereo_batch.h"
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <pthread.h>
+
+// slots in the publisher's queues (one is always kept empty).  Must be a
+// power of two.
+#define PUBLISH_QUEUE_SIZE 4
+
+using namespace std;
+using namespace cv;
+
+/**
+ * One frame's stereo message.  The publisher keeps a few of these around
+ * and reuses their buffers so queueing a frame doesn't allocate.
+ */
+struct StereoPublishJob {
+    lcmt_stereo msg;
+
+    cv::vector<float> x;
+    cv::vector<float> y;
+    cv::vector<float> z;
+    cv::vector<uchar> grey;
+
+    // packed on the stereo thread (it's quick), if compact is on
+    lcmt::stereo_compact compact;
+    bool has_compact;
+
+    // same for the hit bitmap
+    lcmt::stereo_hit_bitmap hit_bitmap;
+    bool has_hit_bitmap;
+};
+
+class StereoPublisher {
+
+    public:
+        StereoPublisher(lcm_t *lcm, bool use_thread, const string &channel = "stereo");
+        ~StereoPublisher();
+
+        bool EnableSharedMemory(const string &ring_name, bool use_udp);
+        void EnableCompact(const string &channel, Mat q, float unit_conversion);
+        void EnableHitBitmap(const string &channel, Size image_size, int block_size);
+        void EnableBatching(const string &channel, int max_frames, int max_ms);
+
+        void Publish(const lcmt_stereo *msg, const cv::vector<Point3f> *image_hits = NULL);
+
+    private:
+        static void* PublisherThread(void *x);
+        void RunPublisher();
+
+        void Send(const lcmt_stereo *msg, const lcmt::stereo_compact *compact, const lcmt::stereo_hit_bitmap *hit_bitmap);
+        void AddToBatch(const lcmt_stereo *msg);
+        void SendBatch();
+
+        bool PackCompact(const lcmt_stereo *msg, const cv::vector<Point3f> *image_hits, lcmt::stereo_compact *compact);
+        bool PackHitBitmap(const lcmt_stereo *msg, const cv::vector<Point3f> *image_hits, lcmt::stereo_hit_bitmap *hit_bitmap);
+
+        lcm_t *lcm_;
+        bool use_thread_;
+
+        // lcmt_stereo channel
+        string channel_;
+
+        ShmRingWriter *ring_;
+        bool use_udp_;
+
+        StereoCompactEncoder *compact_encoder_;
+        string compact_channel_;
+
+        StereoHitBitmapEncoder *hit_bitmap_encoder_;
+        string hit_bitmap_channel_;
+
+        // for Publish() when it sends itself
+        lcmt::stereo_compact compact_;
+        lcmt::stereo_hit_bitmap hit_bitmap_;
+
+        // 0 when batching is off
+        int batch_max_frames_;
+        int64_t batch_max_us_;
+        string batch_channel_;
+
+        // the frames collected so far, in lcmt_stereo_batch's layout
+        vector<int64_t> batch_timestamps_;
+        vector<int32_t> batch_frame_numbers_;
+        vector<int32_t> batch_video_numbers_;
+        vector<int32_t> batch_offsets_;
+
+        vector<float> batch_x_;
+        vector<float> batch_y_;
+        vector<float> batch_z_;
+        vector<uint8_t> batch_grey_;
+
+        // the ring has one writer, and Publish() can send while the thread
+        // is sending too, so the ring, the batch, and the encode buffers
+        // are shared
+        mutex send_mutex_;
+        vector<uint8_t> encode_buffer_;
+
+        StereoPublishJob jobs_[PUBLISH_QUEUE_SIZE - 1];
+
+        // indices into jobs_: the thread gives sent ones back in free_jobs_
+        // and Publish() hands it filled ones in ready_jobs_
+        SpscQueue<int, PUBLISH_QUEUE_SIZE> free_jobs_;
+        SpscQueue<int, PUBLISH_QUEUE_SIZE> ready_jobs_;
+
+        pthread_t thread_;
+
+        atomic<bool> shutting_down_;
+
+        // the thread sleeps on this until Publish() queues a job
+        mutex job_mutex_;
+        condition_variable cv_new_job_;
+};
+
+#endif
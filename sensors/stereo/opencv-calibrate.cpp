@@ -182,16 +182,30 @@ printf("got config\n");
                                   // later if we're only using one
                                   // camera
 
-        if (left_camera_mode || stereo_mode)
-        {
-            foundPattern = findChessboardCorners(chessL, Size(CHESS_X, CHESS_Y), cornersL);
-        }
+        bool foundL = true, foundR = true;
 
-        if (right_camera_mode || stereo_mode)
+        // look in both images at once
+        #pragma omp parallel sections
         {
-            foundPattern = foundPattern & findChessboardCorners(chessR, Size(CHESS_X, CHESS_Y), cornersR);
+            #pragma omp section
+            {
+                if (left_camera_mode || stereo_mode)
+                {
+                    foundL = findChessboardCorners(chessL, Size(CHESS_X, CHESS_Y), cornersL);
+                }
+            }
+
+            #pragma omp section
+            {
+                if (right_camera_mode || stereo_mode)
+                {
+                    foundR = findChessboardCorners(chessR, Size(CHESS_X, CHESS_Y), cornersR);
+                }
+            }
         }
 
+        foundPattern = foundL && foundR;
+
         if (left_camera_mode || stereo_mode)
         {
             cvtColor( chessL, chessLc, CV_GRAY2BGR );
@@ -255,10 +269,17 @@ printf("got config\n");
     printf("\n\n");
 
     // clear out the calibration directory
-    printf("Deleting old images...\nrm calibrationImages/*.ppm\n");
-    int retval = system("rm calibrationImages/*.ppm");
-    if (retval != 0) {
-        printf("Warning: Deleting images may have failed.\n");
+    printf("Deleting old images in calibrationImages/...\n");
+    try {
+        boost::filesystem::directory_iterator end;
+
+        for (boost::filesystem::directory_iterator it("calibrationImages"); it != end; ++it) {
+            if (it->path().extension() == ".ppm") {
+                boost::filesystem::remove(it->path());
+            }
+        }
+    } catch (const boost::filesystem::filesystem_error &e) {
+        printf("Warning: Deleting images may have failed: %s\n", e.what());
     }
     printf("done.\n");
 
@@ -344,7 +344,7 @@ int main(int argc, char *argv[]) {
         }
 
         lcmt_stereo msg;
-        msg.timestamp = getTimestampNow();
+        msg.timestamp = GetWallNow();
         msg.number_of_points = 0;
         msg.frame_number = numFrames;
 
@@ -6,6 +6,26 @@
  */
 
 #include "opencv-stereo-util.hpp"
+#include <string.h>
+
+/**
+ * @param camera the camera
+ *
+ * @retval a black frame the size the camera sends, for when capturing fails
+ */
+static Mat BlackFrame(dc1394camera_t *camera)
+{
+    dc1394video_mode_t video_mode;
+    uint32_t width, height;
+
+    if (dc1394_video_get_mode(camera, &video_mode) != DC1394_SUCCESS
+        || dc1394_get_image_size_from_video_mode(camera, video_mode, &width, &height) != DC1394_SUCCESS) {
+
+        return Mat::zeros(240, 376, CV_8UC1);
+    }
+
+    return Mat::zeros(height, width, CV_8UC1);
+}
 
 /**
  * Gets a Format7 frame from a Firefly MV USB camera.
@@ -37,7 +57,7 @@ Mat GetFrameFormat7(dc1394camera_t *camera)
         // maybe USB disconnect? Anyway, return a black
         // frame so we won't crash everything else
         // and pray that things will get better soon
-        return Mat::zeros(240, 376, CV_8UC1);
+        return BlackFrame(camera);
     }
 
     // make a Mat of the right size and type that we attach the the existing data
@@ -53,6 +73,123 @@ Mat GetFrameFormat7(dc1394camera_t *camera)
     return matOut;
 }
 
+/**
+ * Sets up a pool of zero-copy frames for a camera that is already capturing.
+ *
+ * @param camera the camera
+ * @param max_held most DMA buffers to hand out at once.  Must be less than
+ *      the number of DMA buffers the capture was set up with.
+ */
+Format7FramePool::Format7FramePool(dc1394camera_t *camera, int max_held) {
+    camera_ = camera;
+    max_held_ = max_held;
+    num_held_ = 0;
+    num_copied_ = 0;
+}
+
+/**
+ * Gets a Format7 frame like GetFrameFormat7, but without copying it out
+ * of the DMA buffer unless max_held frames from this pool are still in use.
+ *
+ * @retval frame, which keeps its DMA buffer until the last copy of it is gone
+ */
+Format7Frame Format7FramePool::GetFrame() {
+    Format7Frame frame_out;
+    frame_out.frames_behind = 0;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    dc1394error_t err;
+    dc1394video_frame_t *frame;
+
+    err = dc1394_capture_dequeue(camera_, DC1394_CAPTURE_POLICY_WAIT, &frame);
+    DC1394_WRN(err,"Could not capture a frame");
+
+    if (err != 0) {
+        std::cout << "Warning: failed to capture a frame, returning black frame." << std::endl;
+
+        if (frame) {
+            err = dc1394_capture_enqueue(camera_, frame);
+            DC1394_WRN(err,"releasing buffer after failure");
+        }
+
+        frame_out.image = BlackFrame(camera_);
+        frame_out.timestamp = GetWallNow();
+        return frame_out;
+    }
+
+    frame_out.timestamp = frame->timestamp;
+    frame_out.frames_behind = frame->frames_behind;
+
+    Mat mat_dma = Mat(frame->size[1], frame->size[0], CV_8UC1, frame->image, frame->size[0]);
+
+    if (num_held_ >= max_held_) {
+        // the ring is running low, copy this one and give the buffer
+        // right back
+        frame_out.image = mat_dma.clone();
+        num_copied_ ++;
+
+        err = dc1394_capture_enqueue(camera_, frame);
+        DC1394_WRN(err,"releasing buffer");
+
+        return frame_out;
+    }
+
+    num_held_ ++;
+
+    Format7FrameReleaser releaser;
+    releaser.pool = this;
+
+    frame_out.image = mat_dma;
+    frame_out.dma_frame = std::shared_ptr<dc1394video_frame_t>(frame, releaser);
+
+    return frame_out;
+}
+
+/**
+ * Waits until the camera has a frame ready, so that GetFrame() won't block.
+ *
+ * @param timeout_ms longest to wait in milliseconds
+ *
+ * @retval true if there is a frame, false on timeout
+ */
+bool Format7FramePool::WaitForFrame(int timeout_ms) {
+    struct pollfd fd;
+
+    fd.fd = dc1394_capture_get_fileno(camera_);
+    fd.events = POLLIN;
+    fd.revents = 0;
+
+    return poll(&fd, 1, timeout_ms) > 0;
+}
+
+/**
+ * @retval number of DMA buffers handed out and not released yet
+ */
+int Format7FramePool::GetNumHeld() {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return num_held_;
+}
+
+/**
+ * Gives a DMA buffer back to the camera.
+ *
+ * @param frame buffer from GetFrame()
+ */
+void Format7FramePool::Release(dc1394video_frame_t *frame) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    dc1394error_t err = dc1394_capture_enqueue(camera_, frame);
+    DC1394_WRN(err,"releasing buffer");
+
+    num_held_ --;
+}
+
+void Format7FrameReleaser::operator()(dc1394video_frame_t *frame) {
+    pool->Release(frame);
+}
+
 /**
  * Flushes the camera buffer to ensure
  * that we are returning the most recent frames
@@ -80,13 +217,87 @@ void FlushCameraBuffer(dc1394camera_t *camera) {
     }
 }
 
-int64_t getTimestampNow()
+
+/**
+ * Reads an extra camera pair's group of the configuration file.
+ *
+ * @param keyfile the configuration file
+ * @param group the pair's group, "pair-<name>"
+ * @param pair (output) the pair's settings
+ *
+ * @retval true on success, false if something it needs is missing
+ */
+static bool ParsePairConfig(GKeyFile *keyfile, const char *group, StereoPairConfig *pair)
 {
-    struct timeval thisTime;
-    gettimeofday(&thisTime, NULL);
-    return (thisTime.tv_sec * 1000000.0) + (float)thisTime.tv_usec + 0.5;
-}
+    GError *gerror = NULL;
+
+    pair->name = group + strlen("pair-");
+
+    const char *guid_keys[2] = { "left", "right" };
+    uint64 *guid_values[2] = { &pair->guidLeft, &pair->guidRight };
+
+    for (int i = 0; i < 2; i++) {
+        char *guidChar = g_key_file_get_string(keyfile, group, guid_keys[i], NULL);
+
+        if (guidChar == NULL)
+        {
+            fprintf(stderr, "Error: configuration file does not specify guid for camera pair %s (or I failed to read it). Parameter: %s.%s\n", pair->name.c_str(), group, guid_keys[i]);
+            return false;
+        }
+
+        std::stringstream ss;
+        ss << std::hex << guidChar;
+        ss >> *guid_values[i];
+
+        g_free(guidChar);
+    }
+
+    char *calibDir = g_key_file_get_string(keyfile, group, "calibrationDir", NULL);
+    if (calibDir == NULL)
+    {
+        fprintf(stderr, "Error: configuration file does not specify calibration directory for camera pair %s. Parameter: %s.calibrationDir\n", pair->name.c_str(), group);
+        return false;
+    }
+
+    pair->calibrationDir = ReplaceUserVarInPath(calibDir);
+    g_free(calibDir);
+
+    char *channel = g_key_file_get_string(keyfile, group, "channel", NULL);
+    if (channel == NULL)
+    {
+        fprintf(stderr, "Error: configuration file does not specify a channel for camera pair %s. Parameter: %s.channel\n", pair->name.c_str(), group);
+        return false;
+    }
+
+    pair->channel = channel;
+    g_free(channel);
+
+    const char *int_keys[6] = { "disparity", "infiniteDisparity", "roiTop", "roiBottom", "roiLeft", "roiRight" };
+    int *int_values[6] = { &pair->disparity, &pair->infiniteDisparity, &pair->roiTop, &pair->roiBottom, &pair->roiLeft, &pair->roiRight };
+
+    // the disparities are required, the region defaults to the whole
+    // image
+    int int_defaults[6] = { 0, 0, 0, -1, 0, -1 };
+
+    for (int i = 0; i < 6; i++) {
+        *int_values[i] = g_key_file_get_integer(keyfile, group, int_keys[i], &gerror);
+
+        if (gerror != NULL)
+        {
+            g_error_free(gerror);
+            gerror = NULL;
 
+            if (i < 2) {
+                fprintf(stderr, "Error: configuration file does not specify %s for camera pair %s. Parameter: %s.%s\n", int_keys[i], pair->name.c_str(), group, int_keys[i]);
+                return false;
+            }
+
+            *int_values[i] = int_defaults[i];
+        }
+    }
+
+    return true;
+}
 
 /**
  * Parses stereo configuration file to read parameters
@@ -301,6 +512,137 @@ bool ParseConfigFile(string configFile, OpenCvStereoConfig *configStruct)
     }
     configStruct->log_size_channel3 = log_size_channel3;
 
+    const char *stereo_timing_channel = g_key_file_get_string(keyfile, "lcm", "stereo_timing_channel", NULL);
+
+    if (stereo_timing_channel == NULL)
+    {
+        // optional, leave it empty to not publish timing
+        stereo_timing_channel = "";
+    }
+    configStruct->stereo_timing_channel = stereo_timing_channel;
+
+    const char *memory_stats_channel = g_key_file_get_string(keyfile, "lcm", "memory_stats_channel", NULL);
+
+    if (memory_stats_channel == NULL)
+    {
+        // optional, leave it empty to not publish memory use
+        memory_stats_channel = "";
+    }
+    configStruct->memory_stats_channel = memory_stats_channel;
+
+    const char *mono_alarm_channel = g_key_file_get_string(keyfile, "lcm", "mono_alarm_channel", NULL);
+
+    if (mono_alarm_channel == NULL)
+    {
+        // optional, leave it empty to not publish mono alarms
+        mono_alarm_channel = "";
+    }
+    configStruct->mono_alarm_channel = mono_alarm_channel;
+
+    const char *stereo_coverage_channel = g_key_file_get_string(keyfile, "lcm", "stereo_coverage_channel", NULL);
+
+    if (stereo_coverage_channel == NULL)
+    {
+        // optional, leave it empty to not publish coverage
+        stereo_coverage_channel = "";
+    }
+    configStruct->stereo_coverage_channel = stereo_coverage_channel;
+
+    const char *trace_request_channel = g_key_file_get_string(keyfile, "lcm", "trace_request_channel", NULL);
+
+    if (trace_request_channel == NULL)
+    {
+        // optional, leave it empty to only dump traces on SIGUSR2
+        trace_request_channel = "";
+    }
+    configStruct->trace_request_channel = trace_request_channel;
+
+    const char *state_machine_state_channel = g_key_file_get_string(keyfile, "lcm", "state_machine_state_channel", NULL);
+
+    if (state_machine_state_channel == NULL)
+    {
+        // optional, leave it empty to not trigger recording on state changes
+        state_machine_state_channel = "";
+    }
+    configStruct->state_machine_state_channel = state_machine_state_channel;
+
+    const char *fpga_hits_channel = g_key_file_get_string(keyfile, "lcm", "fpga_hits_channel", NULL);
+
+    if (fpga_hits_channel == NULL)
+    {
+        // optional, leave it empty to search whole frames on the CPU
+        fpga_hits_channel = "";
+    }
+    configStruct->fpga_hits_channel = fpga_hits_channel;
+
+    configStruct->publishThread = g_key_file_get_boolean(keyfile, "lcm", "publishThread", &gerror);
+    if (gerror != NULL)
+    {
+        // optional, default to publishing from the main thread
+        configStruct->publishThread = false;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    char *compactChannel = g_key_file_get_string(keyfile, "lcm", "compactChannel", NULL);
+    if (compactChannel == NULL)
+    {
+        // optional, leave it out to not send compact messages
+        compactChannel = (char*)"";
+    }
+    configStruct->compactChannel = compactChannel;
+
+    char *hitBitmapChannel = g_key_file_get_string(keyfile, "lcm", "hitBitmapChannel", NULL);
+    if (hitBitmapChannel == NULL)
+    {
+        // optional, leave it out to not send hit bitmaps
+        hitBitmapChannel = (char*)"";
+    }
+    configStruct->hitBitmapChannel = hitBitmapChannel;
+
+    char *shmRing = g_key_file_get_string(keyfile, "lcm", "shmRing", NULL);
+    if (shmRing == NULL)
+    {
+        // optional, leave it out to only send on LCM
+        shmRing = (char*)"";
+    }
+    configStruct->shmRing = shmRing;
+
+    configStruct->shmUdp = g_key_file_get_boolean(keyfile, "lcm", "shmUdp", &gerror);
+    if (gerror != NULL)
+    {
+        // optional, default to sending on LCM too
+        configStruct->shmUdp = true;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    char *batchChannel = g_key_file_get_string(keyfile, "lcm", "batchChannel", NULL);
+    if (batchChannel == NULL)
+    {
+        // optional, leave it out to not send batches
+        batchChannel = (char*)"";
+    }
+    configStruct->batchChannel = batchChannel;
+
+    configStruct->batchFrames = g_key_file_get_integer(keyfile, "lcm", "batchFrames", &gerror);
+    if (gerror != NULL)
+    {
+        // optional
+        configStruct->batchFrames = 10;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    configStruct->batchMs = g_key_file_get_integer(keyfile, "lcm", "batchMs", &gerror);
+    if (gerror != NULL)
+    {
+        // optional
+        configStruct->batchMs = 100;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
 
 
     char *lcmUrl = g_key_file_get_string(keyfile, "lcm", "url", NULL);
@@ -335,6 +677,68 @@ bool ParseConfigFile(string configFile, OpenCvStereoConfig *configStruct)
         return false;
     }
 
+    // optional region of interest
+    const char *roi_keys[4] = { "roiTop", "roiBottom", "roiLeft", "roiRight" };
+    int *roi_values[4] = { &configStruct->roiTop, &configStruct->roiBottom,
+        &configStruct->roiLeft, &configStruct->roiRight };
+
+    // default to the whole image
+    int roi_defaults[4] = { 0, -1, 0, -1 };
+
+    for (int i = 0; i < 4; i++) {
+        *roi_values[i] = g_key_file_get_integer(keyfile, "cameras", roi_keys[i], &gerror);
+
+        if (gerror != NULL)
+        {
+            *roi_values[i] = roi_defaults[i];
+            g_error_free(gerror);
+            gerror = NULL;
+        }
+    }
+
+    char *roiMask = g_key_file_get_string(keyfile, "cameras", "roiMask", NULL);
+    if (roiMask == NULL)
+    {
+        // optional, default to no mask
+        configStruct->roiMask = "";
+    } else {
+        configStruct->roiMask = ReplaceUserVarInPath(roiMask);
+        g_free(roiMask);
+    }
+
+    // optional Format7 mode and part of the image to capture
+    configStruct->captureMode = g_key_file_get_integer(keyfile, "cameras", "captureMode", &gerror);
+
+    if (gerror != NULL)
+    {
+        // default to the Firefly MV's binned mode
+        configStruct->captureMode = 1;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    gsize num_capture_roi;
+    gint *capture_roi = g_key_file_get_integer_list(keyfile, "cameras",
+        "captureRoi", &num_capture_roi, &gerror);
+
+    configStruct->captureRoi = Rect();
+
+    if (gerror != NULL)
+    {
+        // optional, default to the whole image
+        g_error_free(gerror);
+        gerror = NULL;
+    } else {
+        if (num_capture_roi == 4) {
+            configStruct->captureRoi = Rect(capture_roi[0], capture_roi[1], capture_roi[2], capture_roi[3]);
+        } else {
+            fprintf(stderr, "Error: cameras.captureRoi should be x;y;width;height.\n");
+            g_free(capture_roi);
+            return false;
+        }
+        g_free(capture_roi);
+    }
+
     // get the video saving directory
     const char *videoSaveDir = g_key_file_get_string(keyfile, "cameras", "videoSaveDir", NULL);
     if (videoSaveDir == NULL)
@@ -353,6 +757,14 @@ bool ParseConfigFile(string configFile, OpenCvStereoConfig *configStruct)
     }
     configStruct->fourcc = fourcc;
 
+    char *hardwareEncoder = g_key_file_get_string(keyfile, "cameras", "hardwareEncoder", NULL);
+    if (hardwareEncoder == NULL)
+    {
+        // optional, leave it out to encode with fourcc
+        hardwareEncoder = (char*)"";
+    }
+    configStruct->hardwareEncoder = hardwareEncoder;
+
     // get the fourcc video codec
     bool usePGM = g_key_file_get_boolean(keyfile, "cameras", "usePGM", &gerror);
     if (gerror != NULL)
@@ -363,110 +775,574 @@ bool ParseConfigFile(string configFile, OpenCvStereoConfig *configStruct)
     }
     configStruct->usePGM = usePGM;
 
+    configStruct->streamRecording = g_key_file_get_boolean(keyfile, "cameras", "streamRecording", &gerror);
+    if (gerror != NULL)
+    {
+        // optional, default to writing the video out at the end
+        configStruct->streamRecording = false;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
 
+    configStruct->compressRecording = g_key_file_get_boolean(keyfile, "cameras", "compressRecording", &gerror);
+    if (gerror != NULL)
+    {
+        // optional, default to raw frames
+        configStruct->compressRecording = false;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
 
-    configStruct->displayOffsetX = g_key_file_get_integer(keyfile,
-        "display", "offset_x", &gerror);
+    configStruct->compressRecordingThreads = g_key_file_get_integer(keyfile, "cameras", "compressRecordingThreads", &gerror);
     if (gerror != NULL)
     {
-        // no need to get upset, this is an optional parameter
-        configStruct->displayOffsetX = 0;
+        configStruct->compressRecordingThreads = 2;
         g_error_free(gerror);
         gerror = NULL;
     }
 
-    configStruct->displayOffsetY = g_key_file_get_integer(keyfile,
-        "display", "offset_y", &gerror);
+    configStruct->triggeredRecording = g_key_file_get_boolean(keyfile, "cameras", "triggeredRecording", &gerror);
     if (gerror != NULL)
     {
-        // no need to get upset, this is an optional parameter
-        configStruct->displayOffsetY = 0;
+        // optional, default to keeping every frame
+        configStruct->triggeredRecording = false;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    configStruct->triggerPreSeconds = g_key_file_get_double(keyfile, "cameras", "triggerPreSeconds", &gerror);
+    if (gerror != NULL)
+    {
+        configStruct->triggerPreSeconds = 5;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    configStruct->triggerPostSeconds = g_key_file_get_double(keyfile, "cameras", "triggerPostSeconds", &gerror);
+    if (gerror != NULL)
+    {
+        configStruct->triggerPostSeconds = 10;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    configStruct->triggerDecimation = g_key_file_get_integer(keyfile, "cameras", "triggerDecimation", &gerror);
+    if (gerror != NULL)
+    {
+        configStruct->triggerDecimation = 10;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    configStruct->triggerHits = g_key_file_get_integer(keyfile, "cameras", "triggerHits", &gerror);
+    if (gerror != NULL)
+    {
+        // optional, default to not triggering on hits
+        configStruct->triggerHits = 0;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    configStruct->recordMetadata = g_key_file_get_boolean(keyfile, "cameras", "recordMetadata", &gerror);
+    if (gerror != NULL)
+    {
+        // optional, default to just the frames
+        configStruct->recordMetadata = false;
         g_error_free(gerror);
         gerror = NULL;
     }
 
+    configStruct->captureThreads = g_key_file_get_boolean(keyfile, "cameras", "captureThreads", &gerror);
+    if (gerror != NULL)
+    {
+        // optional, default to grabbing frames on the main thread
+        configStruct->captureThreads = false;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+
+
+    configStruct->displayOffsetX = g_key_file_get_integer(keyfile,
+        "display", "offset_x", &gerror);
+    if (gerror != NULL)
+    {
+        // no need to get upset, this is an optional parameter
+        configStruct->displayOffsetX = 0;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    configStruct->displayOffsetY = g_key_file_get_integer(keyfile,
+        "display", "offset_y", &gerror);
+    if (gerror != NULL)
+    {
+        // no need to get upset, this is an optional parameter
+        configStruct->displayOffsetY = 0;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+
+    // get settings
+
+    // get disparity
+    configStruct->disparity = g_key_file_get_integer(keyfile,
+        "settings", "disparity", &gerror);
+
+    if (gerror != NULL)
+    {
+        fprintf(stderr, "Error: configuration file does not specify disparity (or I failed to read it). Parameter: settings.disparity\n");
+
+        g_error_free(gerror);
+
+        return false;
+    }
+
+    configStruct->infiniteDisparity = g_key_file_get_integer(keyfile,
+        "settings", "infiniteDisparity", &gerror);
+
+    if (gerror != NULL)
+    {
+        fprintf(stderr, "Error: configuration file does not specify infinite disparity (or I failed to read it). Parameter: settings.infiniteDisparity\n");
+
+        g_error_free(gerror);
+
+        return false;
+    }
+
+
+    // get interestOperatorLimit
+    configStruct->interestOperatorLimit =
+        g_key_file_get_integer(keyfile, "settings",
+        "interestOperatorLimit", &gerror);
+
+    if (gerror != NULL)
+    {
+        fprintf(stderr, "Error: configuration file does not specify interest operator limit (or I failed to read it). Parameter: settings.interestOperatorLimit\n");
+
+        g_error_free(gerror);
+
+        return false;
+    }
+
+    configStruct->horizontalInvarianceMultiplier =
+        g_key_file_get_double(keyfile, "settings",
+        "horizontalInvarianceMultiplier", &gerror);
+
+    if (gerror != NULL)
+    {
+        fprintf(stderr, "Error: configuration file does not specify unit conversion (or I failed to read it). Parameter: settings.horizontalInvarianceMultiplier\n");
+
+        g_error_free(gerror);
+
+        return false;
+    }
+
+    // get blockSize
+    configStruct->blockSize =
+        g_key_file_get_integer(keyfile, "settings",
+        "blockSize", &gerror);
+
+    if (gerror != NULL)
+    {
+        fprintf(stderr, "Error: configuration file does not specify block size (or I failed to read it). Parameter: settings.blockSize\n");
+
+        g_error_free(gerror);
+
+        return false;
+    }
+
+    // get sadThreshold
+    configStruct->sadThreshold =
+        g_key_file_get_integer(keyfile, "settings",
+        "sadThreshold", &gerror);
+
+    if (gerror != NULL)
+    {
+        fprintf(stderr, "Error: configuration file does not specify SAD threshold (or I failed to read it). Parameter: settings.sadThreshold\n");
+
+        g_error_free(gerror);
+
+        return false;
+    }
+
+    configStruct->fusedPipeline =
+        g_key_file_get_boolean(keyfile, "settings",
+        "fusedPipeline", &gerror);
+
+    if (gerror != NULL)
+    {
+        // optional parameter, default to the separate-stage pipeline
+        configStruct->fusedPipeline = false;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    configStruct->temporalSkip =
+        g_key_file_get_boolean(keyfile, "settings",
+        "temporalSkip", &gerror);
+
+    if (gerror != NULL)
+    {
+        // optional parameter, default to searching every block
+        configStruct->temporalSkip = false;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    configStruct->temporalSkipThreshold =
+        g_key_file_get_integer(keyfile, "settings",
+        "temporalSkipThreshold", &gerror);
+
+    if (gerror != NULL)
+    {
+        // optional parameter
+        configStruct->temporalSkipThreshold = 50;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    configStruct->subpixelRefinement =
+        g_key_file_get_boolean(keyfile, "settings",
+        "subpixelRefinement", &gerror);
+
+    if (gerror != NULL)
+    {
+        // optional parameter, default to integer disparities
+        configStruct->subpixelRefinement = false;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    char *interestOperator = g_key_file_get_string(keyfile, "settings", "interestOperator", NULL);
+    if (interestOperator == NULL)
+    {
+        // optional parameter, default to cv::Laplacian's
+        configStruct->interestOperator = "laplacian";
+    } else {
+        configStruct->interestOperator = interestOperator;
+        g_free(interestOperator);
+    }
+
+    configStruct->censusMatching =
+        g_key_file_get_boolean(keyfile, "settings",
+        "censusMatching", &gerror);
+
+    if (gerror != NULL)
+    {
+        // optional parameter, default to SAD
+        configStruct->censusMatching = false;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    configStruct->censusThreshold =
+        g_key_file_get_integer(keyfile, "settings",
+        "censusThreshold", &gerror);
+
+    if (gerror != NULL)
+    {
+        // optional parameter
+        configStruct->censusThreshold = 40;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    configStruct->openclBackend =
+        g_key_file_get_boolean(keyfile, "settings",
+        "openclBackend", &gerror);
+
+    if (gerror != NULL)
+    {
+        // optional parameter, default to the CPU
+        configStruct->openclBackend = false;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    configStruct->predictedRegions =
+        g_key_file_get_boolean(keyfile, "settings",
+        "predictedRegions", &gerror);
+
+    if (gerror != NULL)
+    {
+        // optional parameter, default to searching the frame in one go
+        configStruct->predictedRegions = false;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    configStruct->predictedRegionMargin =
+        g_key_file_get_integer(keyfile, "settings",
+        "predictedRegionMargin", &gerror);
+
+    if (gerror != NULL)
+    {
+        // optional parameter
+        configStruct->predictedRegionMargin = 8;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    configStruct->predictedRegionBudgetMs =
+        g_key_file_get_integer(keyfile, "settings",
+        "predictedRegionBudgetMs", &gerror);
+
+    if (gerror != NULL)
+    {
+        // optional parameter, default to always searching the rest
+        configStruct->predictedRegionBudgetMs = 0;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    configStruct->deadlineMs =
+        g_key_file_get_double(keyfile, "settings",
+        "deadlineMs", &gerror);
+
+    if (gerror != NULL)
+    {
+        // optional parameter, default to no deadline
+        configStruct->deadlineMs = 0;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    configStruct->adaptiveRateBand =
+        g_key_file_get_double(keyfile, "settings",
+        "adaptiveRateBand", &gerror);
+
+    if (gerror != NULL)
+    {
+        // optional parameter, default to every frame
+        configStruct->adaptiveRateBand = 0;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    configStruct->adaptiveRateMinHz =
+        g_key_file_get_double(keyfile, "settings",
+        "adaptiveRateMinHz", &gerror);
+
+    if (gerror != NULL)
+    {
+        // optional parameter
+        configStruct->adaptiveRateMinHz = 5;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    gsize num_disparities = 0;
+    gint *disparities = g_key_file_get_integer_list(keyfile, "settings",
+        "disparities", &num_disparities, &gerror);
+
+    configStruct->disparities.clear();
+
+    if (gerror != NULL)
+    {
+        // optional parameter, default to single-disparity stereo
+        g_error_free(gerror);
+        gerror = NULL;
+    } else {
+        for (gsize i = 0; i < num_disparities; i++) {
+            configStruct->disparities.push_back(disparities[i]);
+        }
+        g_free(disparities);
+    }
+
+    gsize num_pyramid_disparities = 0;
+    gint *pyramid_disparities = g_key_file_get_integer_list(keyfile, "settings",
+        "pyramidDisparities", &num_pyramid_disparities, &gerror);
+
+    configStruct->pyramidDisparities.clear();
+
+    if (gerror != NULL)
+    {
+        // optional parameter, default to no far search
+        g_error_free(gerror);
+        gerror = NULL;
+    } else {
+        for (gsize i = 0; i < num_pyramid_disparities; i++) {
+            configStruct->pyramidDisparities.push_back(pyramid_disparities[i]);
+        }
+        g_free(pyramid_disparities);
+    }
+
+    configStruct->pyramidMargin =
+        g_key_file_get_integer(keyfile, "settings",
+        "pyramidMargin", &gerror);
+
+    if (gerror != NULL)
+    {
+        // optional parameter
+        configStruct->pyramidMargin = 4;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    configStruct->fpgaHitsMargin =
+        g_key_file_get_integer(keyfile, "settings",
+        "fpgaHitsMargin", &gerror);
+
+    if (gerror != NULL)
+    {
+        // optional parameter
+        configStruct->fpgaHitsMargin = 8;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    configStruct->fpgaHitsMaxAgeMs =
+        g_key_file_get_integer(keyfile, "settings",
+        "fpgaHitsMaxAgeMs", &gerror);
+
+    if (gerror != NULL)
+    {
+        // optional parameter
+        configStruct->fpgaHitsMaxAgeMs = 50;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    configStruct->numThreads =
+        g_key_file_get_integer(keyfile, "settings",
+        "numThreads", &gerror);
+
+    if (gerror != NULL)
+    {
+        // optional parameter, default to the built-in thread count
+        configStruct->numThreads = 0;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
+
+    gsize num_thread_cpus = 0;
+    gint *thread_cpus = g_key_file_get_integer_list(keyfile, "settings",
+        "threadCpus", &num_thread_cpus, &gerror);
+
+    configStruct->threadCpus.clear();
+
+    if (gerror != NULL)
+    {
+        // optional parameter, default to not pinning threads
+        g_error_free(gerror);
+        gerror = NULL;
+    } else {
+        for (gsize i = 0; i < num_thread_cpus; i++) {
+            configStruct->threadCpus.push_back(thread_cpus[i]);
+        }
+        g_free(thread_cpus);
+    }
+
+    configStruct->threadPriority =
+        g_key_file_get_integer(keyfile, "settings",
+        "threadPriority", &gerror);
+
+    if (gerror != NULL)
+    {
+        // optional parameter, default to normal scheduling
+        configStruct->threadPriority = 0;
+        g_error_free(gerror);
+        gerror = NULL;
+    }
 
-    // get settings
+    gsize num_band_weights = 0;
+    gdouble *band_weights = g_key_file_get_double_list(keyfile, "settings",
+        "threadBandWeights", &num_band_weights, &gerror);
 
-    // get disparity
-    configStruct->disparity = g_key_file_get_integer(keyfile,
-        "settings", "disparity", &gerror);
+    configStruct->threadBandWeights.clear();
 
     if (gerror != NULL)
     {
-        fprintf(stderr, "Error: configuration file does not specify disparity (or I failed to read it). Parameter: settings.disparity\n");
-
+        // optional parameter, default to an even split
         g_error_free(gerror);
-
-        return false;
+        gerror = NULL;
+    } else {
+        for (gsize i = 0; i < num_band_weights; i++) {
+            configStruct->threadBandWeights.push_back(band_weights[i]);
+        }
+        g_free(band_weights);
     }
 
-    configStruct->infiniteDisparity = g_key_file_get_integer(keyfile,
-        "settings", "infiniteDisparity", &gerror);
+    configStruct->streamDownscale =
+        g_key_file_get_integer(keyfile, "image_stream",
+        "downscale", &gerror);
 
     if (gerror != NULL)
     {
-        fprintf(stderr, "Error: configuration file does not specify infinite disparity (or I failed to read it). Parameter: settings.infiniteDisparity\n");
-
+        // optional parameter, default to full size
+        configStruct->streamDownscale = 1;
         g_error_free(gerror);
-
-        return false;
+        gerror = NULL;
     }
 
+    gsize num_roi = 0;
+    gint *roi = g_key_file_get_integer_list(keyfile, "image_stream",
+        "roi", &num_roi, &gerror);
 
-    // get interestOperatorLimit
-    configStruct->interestOperatorLimit =
-        g_key_file_get_integer(keyfile, "settings",
-        "interestOperatorLimit", &gerror);
+    configStruct->streamRoi = Rect();
 
     if (gerror != NULL)
     {
-        fprintf(stderr, "Error: configuration file does not specify interest operator limit (or I failed to read it). Parameter: settings.interestOperatorLimit\n");
-
+        // optional parameter, default to the whole image
         g_error_free(gerror);
-
-        return false;
+        gerror = NULL;
+    } else {
+        if (num_roi == 4) {
+            configStruct->streamRoi = Rect(roi[0], roi[1], roi[2], roi[3]);
+        } else {
+            fprintf(stderr, "Warning: image_stream.roi should be x;y;width;height, streaming the whole image.\n");
+        }
+        g_free(roi);
     }
 
-    configStruct->horizontalInvarianceMultiplier =
-        g_key_file_get_double(keyfile, "settings",
-        "horizontalInvarianceMultiplier", &gerror);
+    configStruct->streamTargetKbps =
+        g_key_file_get_integer(keyfile, "image_stream",
+        "targetKbps", &gerror);
 
     if (gerror != NULL)
     {
-        fprintf(stderr, "Error: configuration file does not specify unit conversion (or I failed to read it). Parameter: settings.horizontalInvarianceMultiplier\n");
-
+        // optional parameter, default to no bitrate limit
+        configStruct->streamTargetKbps = 0;
         g_error_free(gerror);
-
-        return false;
+        gerror = NULL;
     }
 
-    // get blockSize
-    configStruct->blockSize =
-        g_key_file_get_integer(keyfile, "settings",
-        "blockSize", &gerror);
+    configStruct->streamDecimation =
+        g_key_file_get_integer(keyfile, "image_stream",
+        "decimation", &gerror);
 
     if (gerror != NULL)
     {
-        fprintf(stderr, "Error: configuration file does not specify block size (or I failed to read it). Parameter: settings.blockSize\n");
-
+        // optional parameter, default to every frame
+        configStruct->streamDecimation = 1;
         g_error_free(gerror);
-
-        return false;
+        gerror = NULL;
     }
 
-    // get sadThreshold
-    configStruct->sadThreshold =
-        g_key_file_get_integer(keyfile, "settings",
-        "sadThreshold", &gerror);
+    configStruct->streamQuality =
+        g_key_file_get_integer(keyfile, "image_stream",
+        "quality", &gerror);
 
     if (gerror != NULL)
     {
-        fprintf(stderr, "Error: configuration file does not specify SAD threshold (or I failed to read it). Parameter: settings.sadThreshold\n");
-
+        // optional parameter, default to the usual JPEG quality
+        configStruct->streamQuality = 80;
         g_error_free(gerror);
+        gerror = NULL;
+    }
 
-        return false;
+    configStruct->streamEncoderThreads =
+        g_key_file_get_integer(keyfile, "image_stream",
+        "encoderThreads", &gerror);
+
+    if (gerror != NULL)
+    {
+        // optional parameter, default to one encoder per camera
+        configStruct->streamEncoderThreads = 2;
+        g_error_free(gerror);
+        gerror = NULL;
     }
 
     configStruct->calibrationUnitConversion =
@@ -482,11 +1358,58 @@ bool ParseConfigFile(string configFile, OpenCvStereoConfig *configStruct)
         return false;
     }
 
+    // optional extra camera pairs
+    configStruct->extraPairs.clear();
+
+    gchar **groups = g_key_file_get_groups(keyfile, NULL);
+
+    for (int i = 0; groups[i] != NULL; i++) {
+        if (strncmp(groups[i], "pair-", strlen("pair-")) != 0) {
+            continue;
+        }
+
+        StereoPairConfig pair;
+
+        if (ParsePairConfig(keyfile, groups[i], &pair) != true) {
+            g_strfreev(groups);
+            return false;
+        }
+
+        configStruct->extraPairs.push_back(pair);
+    }
+
+    g_strfreev(groups);
+
     return true;
 }
 
 /**
- * Loads XML stereo calibration files and reamps them.
+ * Checks that a file exists and was modified no earlier than another
+ * one (or that the other one doesn't exist).
+ *
+ * @param filename file that should be newer
+ * @param other_filename file to compare against
+ *
+ * @retval true if filename exists and is at least as new
+ */
+static bool IsFileNewer(string filename, string other_filename)
+{
+    if (boost::filesystem::exists(filename) != true)
+    {
+        return false;
+    }
+
+    if (boost::filesystem::exists(other_filename) != true)
+    {
+        return true;
+    }
+
+    return boost::filesystem::last_write_time(filename) >= boost::filesystem::last_write_time(other_filename);
+}
+
+/**
+ * Loads XML stereo calibration files and reamps them.  Uses the binary
+ * calibration blob instead when there's a valid one.
  *
  * @param calibrationDir directory the calibration files are in
  * @param stereoCalibration calibration structure to fill in
@@ -496,6 +1419,31 @@ bool ParseConfigFile(string configFile, OpenCvStereoConfig *configStruct)
  */
 bool LoadCalibration(string calibrationDir, OpenCvStereoCalibration *stereoCalibration)
 {
+    // a blob that stereo_calibrate wrote from these same XML files has
+    // everything ready to use (see CalibrationBlob.hpp)
+    const char* blobNames[] = { "Q", "mx1fp", "mx2fp", "M1", "D1", "R1", "P1", "M2", "D2", "R2", "P2" };
+    std::map<string, Mat> blob;
+
+    if (ReadCalibrationBlob(calibrationDir + "/" + CALIBRATION_BLOB_FILE, HashCalibrationSources(calibrationDir),
+        vector<string>(blobNames, blobNames + sizeof(blobNames) / sizeof(blobNames[0])), &blob))
+    {
+        stereoCalibration->qMat = blob["Q"];
+        stereoCalibration->mx1fp = blob["mx1fp"];
+        stereoCalibration->mx2fp = blob["mx2fp"];
+
+        stereoCalibration->M1 = blob["M1"];
+        stereoCalibration->D1 = blob["D1"];
+        stereoCalibration->R1 = blob["R1"];
+        stereoCalibration->P1 = blob["P1"];
+
+        stereoCalibration->M2 = blob["M2"];
+        stereoCalibration->D2 = blob["D2"];
+        stereoCalibration->R2 = blob["R2"];
+        stereoCalibration->P2 = blob["P2"];
+
+        return true;
+    }
+
     Mat qMat, mx1Mat, my1Mat, mx2Mat, my2Mat, m1Mat, d1Mat, r1Mat, p1Mat, r2Mat, p2Mat, m2Mat, d2Mat;
 
     CvMat *Q = (CvMat *)cvLoad((calibrationDir + "/Q.xml").c_str(),NULL,NULL,NULL);
@@ -506,36 +1454,56 @@ bool LoadCalibration(string calibrationDir, OpenCvStereoCalibration *stereoCalib
         return false;
     }
 
-    CvMat *mx1 = (CvMat *)cvLoad((calibrationDir + "/mx1.xml").c_str(),NULL,NULL,NULL);
+    // stereo_calibrate also writes the maps already converted to fixed
+    // point, which are a quarter of the size and skip convertMaps.  Use
+    // them unless the float maps were written after them.
+    CvMat *mx1fpFile = NULL, *mx2fpFile = NULL;
 
-    if (mx1 == NULL)
+    if (IsFileNewer(calibrationDir + "/mx1fp.xml", calibrationDir + "/mx1.xml")
+        && IsFileNewer(calibrationDir + "/mx2fp.xml", calibrationDir + "/mx2.xml"))
     {
-        std::cerr << "Error: failed to read " << calibrationDir << "/mx1.xml." << std::endl;
-        return false;
+        mx1fpFile = (CvMat *)cvLoad((calibrationDir + "/mx1fp.xml").c_str(),NULL,NULL,NULL);
+        mx2fpFile = (CvMat *)cvLoad((calibrationDir + "/mx2fp.xml").c_str(),NULL,NULL,NULL);
     }
 
-    CvMat *my1 = (CvMat *)cvLoad((calibrationDir + "/my1.xml").c_str(),NULL,NULL,NULL);
+    bool fixedPointMaps = mx1fpFile != NULL && mx2fpFile != NULL
+        && CV_MAT_TYPE(mx1fpFile->type) == CV_16SC2 && CV_MAT_TYPE(mx2fpFile->type) == CV_16SC2;
+
+    CvMat *mx1 = NULL, *my1 = NULL, *mx2 = NULL, *my2 = NULL;
 
-    if (my1 == NULL)
+    if (fixedPointMaps != true)
     {
-        std::cerr << "Error: failed to read " << calibrationDir << "/my1.xml." << std::endl;
-        return false;
-    }
+        mx1 = (CvMat *)cvLoad((calibrationDir + "/mx1.xml").c_str(),NULL,NULL,NULL);
 
-    CvMat *mx2 = (CvMat *)cvLoad((calibrationDir + "/mx2.xml").c_str(),NULL,NULL,NULL);
+        if (mx1 == NULL)
+        {
+            std::cerr << "Error: failed to read " << calibrationDir << "/mx1.xml." << std::endl;
+            return false;
+        }
 
-    if (mx2 == NULL)
-    {
-        std::cerr << "Error: failed to read " << calibrationDir << "/mx2.xml." << std::endl;
-        return false;
-    }
+        my1 = (CvMat *)cvLoad((calibrationDir + "/my1.xml").c_str(),NULL,NULL,NULL);
 
-    CvMat *my2 = (CvMat *)cvLoad((calibrationDir + "/my2.xml").c_str(),NULL,NULL,NULL);
+        if (my1 == NULL)
+        {
+            std::cerr << "Error: failed to read " << calibrationDir << "/my1.xml." << std::endl;
+            return false;
+        }
 
-    if (my2 == NULL)
-    {
-        std::cerr << "Error: failed to read " << calibrationDir << "/my2.xml." << std::endl;
-        return false;
+        mx2 = (CvMat *)cvLoad((calibrationDir + "/mx2.xml").c_str(),NULL,NULL,NULL);
+
+        if (mx2 == NULL)
+        {
+            std::cerr << "Error: failed to read " << calibrationDir << "/mx2.xml." << std::endl;
+            return false;
+        }
+
+        my2 = (CvMat *)cvLoad((calibrationDir + "/my2.xml").c_str(),NULL,NULL,NULL);
+
+        if (my2 == NULL)
+        {
+            std::cerr << "Error: failed to read " << calibrationDir << "/my2.xml." << std::endl;
+            return false;
+        }
     }
 
     CvMat *m1 = (CvMat *)cvLoad((calibrationDir + "/M1.xml").c_str(),NULL,NULL,NULL);
@@ -605,10 +1573,6 @@ bool LoadCalibration(string calibrationDir, OpenCvStereoCalibration *stereoCalib
 
 
     qMat = Mat(Q, true);
-    mx1Mat = Mat(mx1,true);
-    my1Mat = Mat(my1,true);
-    mx2Mat = Mat(mx2,true);
-    my2Mat = Mat(my2,true);
 
     m1Mat = Mat(m1,true);
     d1Mat = Mat(d1,true);
@@ -622,9 +1586,20 @@ bool LoadCalibration(string calibrationDir, OpenCvStereoCalibration *stereoCalib
 
     Mat mx1fp, empty1, mx2fp, empty2;
 
-    // this will convert to a fixed-point notation
-    convertMaps(mx1Mat, my1Mat, mx1fp, empty1, CV_16SC2, true);
-    convertMaps(mx2Mat, my2Mat, mx2fp, empty2, CV_16SC2, true);
+    if (fixedPointMaps)
+    {
+        mx1fp = Mat(mx1fpFile, true);
+        mx2fp = Mat(mx2fpFile, true);
+    } else {
+        mx1Mat = Mat(mx1,true);
+        my1Mat = Mat(my1,true);
+        mx2Mat = Mat(mx2,true);
+        my2Mat = Mat(my2,true);
+
+        // this will convert to a fixed-point notation
+        convertMaps(mx1Mat, my1Mat, mx1fp, empty1, CV_16SC2, true);
+        convertMaps(mx2Mat, my2Mat, mx2fp, empty2, CV_16SC2, true);
+    }
 
     stereoCalibration->qMat = qMat;
     stereoCalibration->mx1fp = mx1fp;
@@ -644,6 +1619,203 @@ bool LoadCalibration(string calibrationDir, OpenCvStereoCalibration *stereoCalib
     return true;
 }
 
+// moves a camera matrix's principal point by -offset
+static void ShiftPrincipalPoint(Mat *cam_mat, Point offset)
+{
+    if (cam_mat->empty()) {
+        return;
+    }
+
+    Mat shifted;
+    cam_mat->convertTo(shifted, CV_64F);
+
+    shifted.at<double>(0, 2) -= offset.x;
+    shifted.at<double>(1, 2) -= offset.y;
+
+    shifted.convertTo(*cam_mat, cam_mat->type());
+}
+
+/**
+ * Cuts a calibration down to the part of the image the cameras send
+ * (OpenCvStereoConfig::captureRoi), so that pixel (0, 0) of the camera and
+ * rectified images is the region's corner.  The rectification maps keep
+ * only the region and point into the smaller camera images (pixels that
+ * come from outside of it are black), and the camera matrices and Q move
+ * their principal points to match.
+ *
+ * @param roi part of the calibrated image the cameras send
+ * @param stereoCalibration (in/out) calibration for the whole image
+ *
+ * @retval false if the region isn't inside the calibrated image or the maps
+ *      aren't fixed-point
+ */
+bool CropCalibration(Rect roi, OpenCvStereoCalibration *stereoCalibration)
+{
+    Rect full(0, 0, stereoCalibration->mx1fp.cols, stereoCalibration->mx1fp.rows);
+
+    if (roi.area() <= 0 || (roi & full) != roi)
+    {
+        fprintf(stderr, "Error: capture ROI %d;%d;%d;%d is not inside the %d x %d calibration.\n",
+            roi.x, roi.y, roi.width, roi.height, full.width, full.height);
+        return false;
+    }
+
+    Mat *maps[2] = { &stereoCalibration->mx1fp, &stereoCalibration->mx2fp };
+
+    for (int m = 0; m < 2; m++)
+    {
+        if (maps[m]->type() != CV_16SC2 || maps[m]->size() != full.size())
+        {
+            fprintf(stderr, "Error: can only crop two CV_16SC2 rectification maps the same size.\n");
+            return false;
+        }
+
+        Mat cropped = (*maps[m])(roi).clone();
+
+        for (int i = 0; i < cropped.rows; i++)
+        {
+            short *row = cropped.ptr<short>(i);
+
+            for (int j = 0; j < cropped.cols; j++)
+            {
+                row[2*j] -= roi.x;
+                row[2*j + 1] -= roi.y;
+            }
+        }
+
+        *maps[m] = cropped;
+    }
+
+    // Q takes rectified pixels, which are now roi.tl() less than they were
+    Mat q;
+    stereoCalibration->qMat.convertTo(q, CV_64F);
+
+    Mat q_offset = q.col(3) + roi.x * q.col(0) + roi.y * q.col(1);
+    q_offset.copyTo(q.col(3));
+
+    q.convertTo(stereoCalibration->qMat, stereoCalibration->qMat.type());
+
+    ShiftPrincipalPoint(&stereoCalibration->M1, roi.tl());
+    ShiftPrincipalPoint(&stereoCalibration->P1, roi.tl());
+    ShiftPrincipalPoint(&stereoCalibration->M2, roi.tl());
+    ShiftPrincipalPoint(&stereoCalibration->P2, roi.tl());
+
+    return true;
+}
+
+/**
+ * Moves the search region and last valid row from the whole image's pixels
+ * to the captured part's (see CropCalibration()).
+ *
+ * @param capture_roi part of the image the cameras send
+ * @param configStruct (in/out) configuration to update
+ */
+void ShiftRoiToCapture(Rect capture_roi, OpenCvStereoConfig *configStruct)
+{
+    configStruct->roiTop = std::max(0, configStruct->roiTop - capture_roi.y);
+    configStruct->roiLeft = std::max(0, configStruct->roiLeft - capture_roi.x);
+
+    // -1 is still the edge
+    if (configStruct->roiBottom >= 0)
+    {
+        configStruct->roiBottom = std::max(0, configStruct->roiBottom - capture_roi.y);
+    }
+
+    if (configStruct->roiRight >= 0)
+    {
+        configStruct->roiRight = std::max(0, configStruct->roiRight - capture_roi.x);
+    }
+
+    if (configStruct->lastValidPixelRow > 0)
+    {
+        // stays above 0, which would mean the whole image
+        configStruct->lastValidPixelRow = std::max(1, configStruct->lastValidPixelRow - capture_roi.y);
+    }
+}
+
+/**
+ * Like setup_gray_capture, but in any Format7 mode and sending only part
+ * of the image, so each frame takes less of the bus and the camera can run
+ * faster.
+ *
+ * @param camera the camera
+ * @param mode Format7 mode (0-7)
+ * @param roi part of the mode's image to send, or empty for all of it.  Its
+ *      corner and size must be in the camera's Format7 units.
+ * @param mode_size (optional output) size of the mode's whole image
+ *
+ * @retval DC1394_SUCCESS or the error
+ */
+dc1394error_t SetupFormat7Capture(dc1394camera_t *camera, int mode, Rect roi, Size *mode_size)
+{
+    dc1394error_t err;
+
+    if (mode < 0 || mode >= DC1394_VIDEO_MODE_FORMAT7_NUM)
+    {
+        fprintf(stderr, "Error: there is no Format7 mode %d.\n", mode);
+        return DC1394_INVALID_VIDEO_MODE;
+    }
+
+    dc1394video_mode_t video_mode = (dc1394video_mode_t)(DC1394_VIDEO_MODE_FORMAT7_0 + mode);
+
+    err = dc1394_camera_reset(camera);
+    DC1394_ERR_RTN(err, "Could not reset camera");
+
+    err = dc1394_video_set_iso_speed(camera, DC1394_ISO_SPEED_400);
+    DC1394_ERR_RTN(err, "Could not setup camera ISO speed");
+
+    err = dc1394_video_set_mode(camera, video_mode);
+    DC1394_ERR_RTN(err, "Could not set video mode");
+
+    uint32_t max_width, max_height, unit_width, unit_height, unit_x, unit_y;
+
+    err = dc1394_format7_get_max_image_size(camera, video_mode, &max_width, &max_height);
+    DC1394_ERR_RTN(err, "Could not get the Format7 image size");
+
+    err = dc1394_format7_get_unit_size(camera, video_mode, &unit_width, &unit_height);
+    DC1394_ERR_RTN(err, "Could not get the Format7 unit size");
+
+    err = dc1394_format7_get_unit_position(camera, video_mode, &unit_x, &unit_y);
+    DC1394_ERR_RTN(err, "Could not get the Format7 unit position");
+
+    // cameras that don't say move in size units
+    unit_x = unit_x > 0 ? unit_x : unit_width;
+    unit_y = unit_y > 0 ? unit_y : unit_height;
+
+    if (mode_size != NULL)
+    {
+        *mode_size = Size(max_width, max_height);
+    }
+
+    if (roi.area() <= 0)
+    {
+        roi = Rect(0, 0, max_width, max_height);
+    }
+
+    if (roi.x < 0 || roi.y < 0 || roi.width <= 0 || roi.height <= 0
+        || roi.x + roi.width > (int)max_width || roi.y + roi.height > (int)max_height
+        || roi.x % unit_x != 0 || roi.y % unit_y != 0
+        || roi.width % unit_width != 0 || roi.height % unit_height != 0)
+    {
+        fprintf(stderr, "Error: capture ROI %d;%d;%d;%d doesn't fit Format7 mode %d (%u x %u, corner in steps "
+            "of %u x %u, size in steps of %u x %u).\n", roi.x, roi.y, roi.width, roi.height, mode,
+            max_width, max_height, unit_x, unit_y, unit_width, unit_height);
+
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    }
+
+    // the biggest packets there's room for, so that smaller frames come
+    // faster instead of just taking less of the bus
+    err = dc1394_format7_set_roi(camera, video_mode, DC1394_COLOR_CODING_MONO8, DC1394_USE_MAX_AVAIL,
+        roi.x, roi.y, roi.width, roi.height);
+    DC1394_ERR_RTN(err, "Could not set the Format7 ROI");
+
+    err = dc1394_capture_setup(camera, FORMAT7_DMA_BUFFERS, DC1394_CAPTURE_FLAGS_DEFAULT);
+    DC1394_ERR_RTN(err, "Could not setup camera - make sure that the video mode is supported by your camera");
+
+    return DC1394_SUCCESS;
+}
+
 /**
  * Stops capture on a camera and frees its context.
  *
@@ -754,7 +1926,7 @@ void SendImageOverLcm(lcm_t* lcm, string channel, Mat image, int compression_qua
     // create LCM message
     bot_core_image_t msg;
 
-    msg.utime = getTimestampNow();
+    msg.utime = GetWallNow();
 
     msg.width = image.cols;
     msg.height = image.rows;
@@ -771,7 +1943,16 @@ void SendImageOverLcm(lcm_t* lcm, string channel, Mat image, int compression_qua
             int bufsize = image.cols * image.rows;
             uint8_t buffer[bufsize];
 
-            jpeg_compress_8u_gray(image.ptr(), image.cols, image.rows, image.step, buffer, &bufsize, compression_quality);
+            // one per thread, kept for the life of the thread
+            static __thread jpeg_utils_compressor_t *compressor = NULL;
+
+            if (compressor == NULL) {
+                compressor = jpeg_utils_compressor_new();
+            }
+
+            if (jpeg_utils_compress_8u_gray(compressor, image.ptr(), image.cols, image.rows, image.step, buffer, &bufsize, compression_quality) != 0) {
+                return;
+            }
 
             // got the compressed file, now push it to LCM
             msg.data = buffer;
@@ -880,6 +2061,85 @@ void Get3DPointsFromStereoMsg(const lcmt_stereo *msg, vector<Point3f> *points_ou
  * @param max_z maximum z value allowable to draw the point
  * @param box_size size of the box (default = 4)
  */
+/**
+ * Folds the rectification rotation, distortion, and camera matrix into a
+ * PointProjection for ProjectPointsFast().
+ *
+ * @param cam_mat_m camera matrix (M1)
+ * @param cam_mat_d distortion coefficients (D1), 4, 5, or 8 of them
+ * @param cam_mat_r rectification rotation (R1)
+ * @param projection (output)
+ */
+void MakePointProjection(Mat cam_mat_m, Mat cam_mat_d, Mat cam_mat_r, PointProjection *projection) {
+
+    Mat r_inv, m, d;
+
+    cam_mat_r.inv().convertTo(r_inv, CV_64F);
+    cam_mat_m.convertTo(m, CV_64F);
+    cam_mat_d.reshape(1, 1).convertTo(d, CV_64F);
+
+    for (int i = 0; i < 9; i++) {
+        projection->r[i] = r_inv.at<double>(i / 3, i % 3);
+    }
+
+    projection->fx = m.at<double>(0, 0);
+    projection->fy = m.at<double>(1, 1);
+    projection->cx = m.at<double>(0, 2);
+    projection->cy = m.at<double>(1, 2);
+
+    for (int i = 0; i < 8; i++) {
+        projection->k[i] = i < d.cols ? d.at<double>(0, i) : 0;
+    }
+}
+
+/**
+ * Projects points the way projectPoints(points, cam_mat_r.inv(), 0, cam_mat_m,
+ * cam_mat_d) does (same distortion model), as one tight loop with no
+ * allocation beyond the output.
+ *
+ * @param projection from MakePointProjection()
+ * @param points points in the camera frame
+ * @param img_points (output) pixel locations, one for each point
+ */
+void ProjectPointsFast(const PointProjection &projection, const vector<Point3f> &points, vector<Point2f> *img_points) {
+
+    const double *r = projection.r;
+    const double *k = projection.k;
+
+    img_points->resize(points.size());
+
+    Point2f *out = img_points->data();
+
+    for (int i = 0; i < int(points.size()); i++) {
+
+        double x = r[0] * points[i].x + r[1] * points[i].y + r[2] * points[i].z;
+        double y = r[3] * points[i].x + r[4] * points[i].y + r[5] * points[i].z;
+        double z = r[6] * points[i].x + r[7] * points[i].y + r[8] * points[i].z;
+
+        // same as projectPoints for points on the camera plane
+        z = z ? 1.0 / z : 1;
+        x *= z;
+        y *= z;
+
+        double r2 = x * x + y * y;
+        double r4 = r2 * r2;
+        double r6 = r4 * r2;
+
+        double a1 = 2 * x * y;
+        double a2 = r2 + 2 * x * x;
+        double a3 = r2 + 2 * y * y;
+
+        double cdist = 1 + k[0] * r2 + k[1] * r4 + k[4] * r6;
+        double icdist2 = 1.0 / (1 + k[5] * r2 + k[6] * r4 + k[7] * r6);
+
+        double xd = x * cdist * icdist2 + k[2] * a1 + k[3] * a2;
+        double yd = y * cdist * icdist2 + k[2] * a3 + k[3] * a1;
+
+        out[i].x = (float)(xd * projection.fx + projection.cx);
+        out[i].y = (float)(yd * projection.fy + projection.cy);
+    }
+}
+
 void Draw3DPointsOnImage(Mat camera_image, vector<Point3f> *points_list_in, Mat cam_mat_m, Mat cam_mat_d, Mat cam_mat_r, Scalar outline_color, Scalar inside_color, Point2d box_top, Point2d box_bottom, vector<int> *points_in_box,
 float min_z, float max_z, int box_size) {
     vector<Point3f> &points_list = *points_list_in;
@@ -890,10 +2150,12 @@ float min_z, float max_z, int box_size) {
         return;
     }
 
+    PointProjection projection;
+    MakePointProjection(cam_mat_m, cam_mat_d, cam_mat_r, &projection);
 
     vector<Point2f> img_points_list;
 
-    projectPoints(points_list, cam_mat_r.inv(), Mat::zeros(3, 1, CV_32F), cam_mat_m, cam_mat_d, img_points_list);
+    ProjectPointsFast(projection, points_list, &img_points_list);
 
 
     int min_x = min(box_top.x, box_bottom.x);
@@ -906,52 +2168,77 @@ float min_z, float max_z, int box_size) {
         box_bounding = true;
     }
 
-    int thickness = CV_FILLED;
-    if (inside_color[0] == -1) {
-        thickness = 1;
-    }
+    int num_points = int(img_points_list.size());
 
-    // now draw the points onto the image
-    for (int i=0; i<int(img_points_list.size()); i++)
-    {
+    // decide which points to draw without branching, so this loop
+    // vectorizes
+    vector<uint8_t> in_box(num_points), draw(num_points);
+
+    const Point2f *img_points = img_points_list.data();
+    const Point3f *points = points_list.data();
 
-        //line(camera_image, Point(img_points_list[i].x, 0), Point(img_points_list[i].x, camera_image.rows), color);
-        //line(camera_image, Point(0, img_points_list[i].y), Point(camera_image.cols, img_points_list[i].y), color);
+    for (int i = 0; i < num_points; i++) {
 
-        bool flag = false;
+        in_box[i] = (img_points[i].x >= min_x) & (img_points[i].x <= max_x)
+            & (img_points[i].y >= min_y) & (img_points[i].y <= max_y);
 
-        if (box_bounding) {
+        draw[i] = ((box_bounding == false) | in_box[i])
+            & ((min_z == 0) | (points[i].z >= min_z))
+            & ((max_z == 0) | (points[i].z <= max_z));
+    }
+
+    if (box_bounding && points_in_box) {
+        for (int i = 0; i < num_points; i++) {
+            if (in_box[i]) {
+                points_in_box->push_back(i);
+            }
+        }
+    }
 
-            if (img_points_list[i].x >= min_x && img_points_list[i].x <= max_x &&
-                img_points_list[i].y >= min_y && img_points_list[i].y <= max_y) {
+    // now draw the points onto the image
+    if (inside_color[0] == -1) {
+        // outlines: one polylines call for all of them
+        vector<vector<Point> > boxes;
+        boxes.reserve(num_points);
 
-                if (points_in_box) {
-                    points_in_box->push_back(i);
-                }
+        for (int i = 0; i < num_points; i++) {
+            if (draw[i]) {
+                Point corner_top(img_points[i].x - box_size, img_points[i].y - box_size);
+                Point corner_bottom(img_points[i].x + box_size, img_points[i].y + box_size);
 
-                flag = true;
+                boxes.push_back({ corner_top, Point(corner_bottom.x, corner_top.y), corner_bottom, Point(corner_top.x, corner_bottom.y) });
             }
         }
 
+        if (boxes.size() > 0) {
+            polylines(camera_image, boxes, true, outline_color);
+        }
+    } else {
+        // filled boxes are just rectangles of pixels, so set them directly
+        // (in order, so overlapping boxes come out the same as before)
+        Rect image_rect(0, 0, camera_image.cols, camera_image.rows);
 
-        if (box_bounding == false || flag == true) {
+        for (int i = 0; i < num_points; i++) {
+            if (draw[i]) {
+                Point corner_top(img_points[i].x - box_size, img_points[i].y - box_size);
+                Point corner_bottom(img_points[i].x + box_size, img_points[i].y + box_size);
 
-            if (min_z == 0 || points_list[i].z >= min_z) {
+                Rect outline_rect = Rect(corner_top, corner_bottom + Point(1, 1)) & image_rect;
 
-                if (max_z == 0 || points_list[i].z <= max_z) {
+                if (outline_rect.area() > 0) {
+                    camera_image(outline_rect).setTo(outline_color);
+                }
 
-                    rectangle(camera_image, Point(img_points_list[i].x - box_size, img_points_list[i].y - box_size),
-                        Point(img_points_list[i].x + box_size, img_points_list[i].y + box_size), outline_color, thickness);
+                Point inside_top(img_points[i].x - 2, img_points[i].y - box_size/2);
+                Point inside_bottom(img_points[i].x + box_size/2, img_points[i].y + box_size/2);
 
-                    if (inside_color[0] != -1) {
-                        rectangle(camera_image, Point(img_points_list[i].x - 2, img_points_list[i].y - box_size/2),
-                            Point(img_points_list[i].x + box_size/2, img_points_list[i].y + box_size/2), inside_color, thickness);
-                    }
+                Rect inside_rect = Rect(inside_top, inside_bottom + Point(1, 1)) & image_rect;
 
+                if (inside_rect.area() > 0) {
+                    camera_image(inside_rect).setTo(inside_color);
                 }
             }
         }
-
     }
 }
 
@@ -1013,8 +2300,10 @@ int GetDisparityForDistance(double distance, const OpenCvStereoCalibration &cali
  *
  * @param completeSet if true, will take longer but set more parameters. Useful on initialization or if brightness is expected to change a lot (indoors to outdoors)
  *
+ * @param grab_frames if false, a complete set waits for auto exposure instead of grabbing frames (when another thread is capturing)
+ *
  */
-void MatchBrightnessSettings(dc1394camera_t *camera1, dc1394camera_t *camera2, bool complete_set, int force_brightness, int force_exposure)
+void MatchBrightnessSettings(dc1394camera_t *camera1, dc1394camera_t *camera2, bool complete_set, int force_brightness, int force_exposure, bool grab_frames)
 {
 
 
@@ -1064,10 +2353,15 @@ void MatchBrightnessSettings(dc1394camera_t *camera1, dc1394camera_t *camera2, b
 
         dc1394_feature_set_mode(camera1, DC1394_FEATURE_BRIGHTNESS, DC1394_FEATURE_MODE_AUTO);
 
-        // take a bunch of frames with camera1 to let it set exposure
-        for (int i=0;i<25;i++)
-        {
-            Mat img = GetFrameFormat7(camera1);
+        // take a bunch of frames with camera1 to let it set exposure (or
+        // just wait if someone else is taking the frames)
+        if (grab_frames) {
+            for (int i=0;i<25;i++)
+            {
+                Mat img = GetFrameFormat7(camera1);
+            }
+        } else {
+            usleep(AUTO_EXPOSURE_SETTLE_US);
         }
 
         // turn off auto exposure
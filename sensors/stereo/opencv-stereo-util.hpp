@@ -14,16 +14,21 @@
 #include "opencv2/opencv.hpp"
 
 #include <sys/time.h>
+#include <poll.h>
+#include <unistd.h>
 
 #include <boost/filesystem.hpp>
 
 #include <string>
+#include <memory>
+#include <mutex>
 #include <glib.h> // for configuration files
 
 #include "lcmtypes/bot_core_image_t.h" // from libbot for images over LCM
 
 #include "../../LCM/lcmt_stereo.h"
 #include "../../utils/utils/RealtimeUtils.hpp"
+#include "CalibrationBlob.hpp"
 
 
 
@@ -45,6 +50,43 @@ extern "C"
 
 using namespace cv;
 
+// most DMA buffers a Format7FramePool hands out at once before it starts
+// copying frames instead, so the camera always has buffers to fill
+#define FORMAT7_MAX_HELD_FRAMES 2
+
+// DMA buffers SetupFormat7Capture asks for
+#define FORMAT7_DMA_BUFFERS 4
+
+// how long auto exposure gets to settle in MatchBrightnessSettings when it
+// can't grab frames to wait for it (about 25 frames)
+#define AUTO_EXPOSURE_SETTLE_US 1000000
+
+// an extra camera pair (side- or up-looking, see StereoPair) from a
+// [pair-<name>] group of the configuration file.  It is captured with the
+// main pair's Format7 mode and ROI, and searched with the main pair's
+// settings except for these.
+struct StereoPairConfig
+{
+    string name;
+
+    uint64 guidLeft;
+    uint64 guidRight;
+
+    string calibrationDir;
+
+    // its hits go out on this channel instead of "stereo"
+    string channel;
+
+    int disparity;
+    int infiniteDisparity;
+
+    // region to search, as for the main pair
+    int roiTop;
+    int roiBottom;
+    int roiLeft;
+    int roiRight;
+};
+
 struct OpenCvStereoConfig
 {
     uint64 guidLeft;
@@ -55,11 +97,61 @@ struct OpenCvStereoConfig
     string calibrationDir;
     float calibrationUnitConversion;
     int lastValidPixelRow;
+
+    // optional region to search (-1 for the bottom / right edge) and
+    // image file with a mask of where to search (empty for none)
+    int roiTop;
+    int roiBottom;
+    int roiLeft;
+    int roiRight;
+    string roiMask;
+
+    // Format7 mode the cameras capture in (the Firefly MV's mode 1 is 2x2
+    // binned) and the part of that mode's image they send (empty for all of
+    // it).  The calibration is for the mode's whole image; the ROI above is
+    // in the mode's pixels too.
+    int captureMode;
+    Rect captureRoi;
+
     string videoSaveDir;
     string fourcc;
 
+    // GStreamer elements that encode the AVI and HUD videos on a hardware
+    // encoder instead of with fourcc (see HardwareVideoWriter.hpp).  Empty
+    // for OpenCV's VideoWriter.
+    string hardwareEncoder;
+
     bool usePGM;
 
+    // write the recording to a .rec file as it happens instead of all
+    // at the end
+    bool streamRecording;
+
+    // losslessly compress the .rec frames (PNG), on this many threads
+    bool compressRecording;
+    int compressRecordingThreads;
+
+    // only keep full-rate frames from triggerPreSeconds before to
+    // triggerPostSeconds after a trigger (the stereo_control channel, a
+    // state machine state change, or at least triggerHits hits), and every
+    // triggerDecimation'th frame otherwise
+    bool triggeredRecording;
+    double triggerPreSeconds;
+    double triggerPostSeconds;
+    int triggerDecimation;
+    int triggerHits;
+
+    // write a .meta file of per-frame metadata (capture times, exposure,
+    // stereo parameters, hits and pose) next to each recording
+    bool recordMetadata;
+
+    // grab from each camera on its own thread and pair frames by timestamp
+    bool captureThreads;
+
+    // more camera pairs to run in this process (empty for just the main
+    // one)
+    std::vector<StereoPairConfig> extraPairs;
+
     string stereo_replay_channel;
     string baro_airspeed_channel;
     string pose_channel;
@@ -75,17 +167,135 @@ struct OpenCvStereoConfig
     string log_size_channel2;
     string log_size_channel3;
 
+    string stereo_timing_channel;
+
+    // lcmt_memory_stats, about once a second (empty for none)
+    string memory_stats_channel;
+
+    // coarse alarms from one camera, sent when the other one dies (empty
+    // for none)
+    string mono_alarm_channel;
+
+    // which rows each frame covered, with deadlineMs (empty for none)
+    string stereo_coverage_channel;
+
+    // dump the stereo trace (utils/utils/Trace.hpp) when an
+    // lcmt_trace_request comes in on this channel (empty to not listen)
+    string trace_request_channel;
+
+    // state machine state messages, to trigger recording on (empty to not
+    // listen)
+    string state_machine_state_channel;
+
+    // the FPGA's hits (lcmt_stereo, through fpga-mavlink-bridge), to only
+    // search around (empty to search whole frames).  See FpgaHitSeeds.
+    string fpga_hits_channel;
+
+    // send the stereo results and images from a background thread
+    bool publishThread;
+
+    // also send the stereo results into this shared memory ring (empty for
+    // none), and whether to keep sending them on LCM too
+    string shmRing;
+    bool shmUdp;
+
+    // also send the stereo results packed as lcmt_stereo_compact on this
+    // channel (empty for none)
+    string compactChannel;
+
+    // also send which blocks had hits as lcmt_stereo_hit_bitmap on this
+    // channel (empty for none)
+    string hitBitmapChannel;
+
+    // also send the stereo results in batches (lcmt_stereo_batch) on this
+    // channel (empty for none), each with up to batchFrames frames or
+    // batchMs milliseconds of them
+    string batchChannel;
+    int batchFrames;
+    int batchMs;
+
 
     int disparity;
     int infiniteDisparity;
     int interestOperatorLimit;
+
+    // "laplacian", "laplacian-abs" or "sobel-abs" (see
+    // PushbroomStereoInterestOperator)
+    string interestOperator;
     int blockSize;
     int sadThreshold;
     float horizontalInvarianceMultiplier;
 
+    bool fusedPipeline;
+
+    // skip blocks that didn't match last frame and haven't changed
+    bool temporalSkip;
+    int temporalSkipThreshold;
+
+    // fit sub-pixel disparities to hits
+    bool subpixelRefinement;
+
+    // match on the census transform instead of SAD
+    bool censusMatching;
+    int censusThreshold;
+
+    // run stereo on the GPU with OpenCL
+    bool openclBackend;
+
+    // search around where last frame's hits should be first, with this
+    // many pixels around each one, and skip the rest of the frame when it
+    // would run past the budget (0 for never)
+    bool predictedRegions;
+    int predictedRegionMargin;
+    int predictedRegionBudgetMs;
+
+    // time stereo gets for each frame before it searches more roughly
+    // and then stops (0 for no limit)
+    double deadlineMs;
+
+    // run stereo on a frame each time the aircraft flies this many meters
+    // (going by baro_airspeed_channel), but at least adaptiveRateMinHz
+    // times a second (0 to run on every frame)
+    double adaptiveRateBand;
+    double adaptiveRateMinHz;
+
+    // optional list of disparities to check in one pass (empty
+    // for single-disparity)
+    std::vector<int> disparities;
+
+    // optional full-resolution disparities to look for far obstacles at
+    // with a half-resolution pass first (empty for none), and the pixels
+    // to search around each of its hits (see PyramidStereo)
+    std::vector<int> pyramidDisparities;
+    int pyramidMargin;
+
+    // with fpga_hits_channel, pixels to search around each FPGA hit, and
+    // how old the FPGA's hits can be before whole frames get searched
+    int fpgaHitsMargin;
+    int fpgaHitsMaxAgeMs;
+
+    // stereo worker pool: number of threads (0 for the built-in
+    // default), CPU for each thread (-1 for any), SCHED_FIFO
+    // priority (0 for normal scheduling) and the relative share of
+    // the image each thread starts with
+    int numThreads;
+    std::vector<int> threadCpus;
+    int threadPriority;
+    std::vector<double> threadBandWeights;
+
     int displayOffsetX;
     int displayOffsetY;
 
+    // what -P streams (see ImageStreamer.hpp): downscale factor, crop
+    // (empty for the whole image), bitrate limit (0 for none), send every
+    // n'th frame, JPEG quality and number of encoder threads
+    int streamDownscale;
+    Rect streamRoi;
+    int streamTargetKbps;
+    int streamDecimation;
+    int streamQuality;
+    int streamEncoderThreads;
+
 };
 
 struct OpenCvStereoCalibration
@@ -105,27 +315,101 @@ struct OpenCvStereoCalibration
     Mat P2;
 };
 
+class Format7FramePool;
+
+// Gives a DMA buffer back to its pool when the last Format7Frame using it
+// goes away
+struct Format7FrameReleaser {
+    Format7FramePool *pool;
+
+    void operator()(dc1394video_frame_t *frame);
+};
+
+// A camera frame.  image points straight into the camera's DMA buffer
+// unless the pool had to copy it, and that buffer stays out of the camera's
+// ring until the last copy of this struct is gone, so hold on to the
+// Format7Frame (not just image) for as long as image is used.
+struct Format7Frame {
+    Mat image;
+
+    // NULL if image is a copy
+    std::shared_ptr<dc1394video_frame_t> dma_frame;
+
+    // when the frame finished arriving (microseconds, from dc1394) and how
+    // many newer frames were already waiting in the ring behind it
+    uint64_t timestamp;
+    uint32_t frames_behind;
+};
+
+// Hands out frames from one camera without copying them out of the DMA
+// ring, as long as fewer than max_held of them are still in use.  Must
+// outlive every frame it hands out.
+class Format7FramePool {
+    public:
+        Format7FramePool(dc1394camera_t *camera, int max_held = FORMAT7_MAX_HELD_FRAMES);
+
+        Format7Frame GetFrame();
+
+        bool WaitForFrame(int timeout_ms);
+
+        int GetNumHeld();
+        int GetNumCopied() { return num_copied_; }
+
+    private:
+        friend struct Format7FrameReleaser;
+
+        void Release(dc1394video_frame_t *frame);
+
+        dc1394camera_t *camera_;
+        int max_held_;
+
+        // dc1394 calls on a camera aren't thread safe, and frames can be
+        // released from any thread
+        std::mutex mutex_;
+        int num_held_;
+
+        // frames that got copied because too many buffers were held
+        int num_copied_;
+};
+
 Mat GetFrameFormat7(dc1394camera_t *camera);
 
 void FlushCameraBuffer(dc1394camera_t *camera);
 
-int64_t getTimestampNow();
-
 bool ParseConfigFile(string configFile, OpenCvStereoConfig *configStruct);
 
 bool LoadCalibration(string calibrationDir, OpenCvStereoCalibration *stereoCalibration);
 
+bool CropCalibration(Rect roi, OpenCvStereoCalibration *stereoCalibration);
+
+void ShiftRoiToCapture(Rect capture_roi, OpenCvStereoConfig *configStruct);
+
+dc1394error_t SetupFormat7Capture(dc1394camera_t *camera, int mode, Rect roi, Size *mode_size = NULL);
+
 void StopCapture(dc1394_t *dcContext, dc1394camera_t *camera);
 
 
 void InitBrightnessSettings(dc1394camera_t *camera1, dc1394camera_t *camera2, bool enable_gamma = false);
 
-void MatchBrightnessSettings(dc1394camera_t *camera1, dc1394camera_t *camera2, bool complete_set = false, int force_brightness = -1, int force_exposure = -1);
+void MatchBrightnessSettings(dc1394camera_t *camera1, dc1394camera_t *camera2, bool complete_set = false, int force_brightness = -1, int force_exposure = -1, bool grab_frames = true);
 
 void SendImageOverLcm(lcm_t* lcm, string channel, Mat image, int compression_quality = 80);
 
 void Get3DPointsFromStereoMsg(const lcmt_stereo *msg, vector<Point3f> *points_out);
 
+// camera matrix, distortion, and rectification rotation folded together
+// once so points can be projected without projectPoints' per-call setup
+struct PointProjection
+{
+    double r[9]; // cam_mat_r.inv(), row-major
+    double fx, fy, cx, cy;
+    double k[8]; // k1, k2, p1, p2, k3, k4, k5, k6 (missing ones are 0)
+};
+
+void MakePointProjection(Mat cam_mat_m, Mat cam_mat_d, Mat cam_mat_r, PointProjection *projection);
+
+void ProjectPointsFast(const PointProjection &projection, const vector<Point3f> &points, vector<Point2f> *img_points);
+
 void Draw3DPointsOnImage(Mat camera_image, vector<Point3f> *points_list_in, Mat cam_mat_m, Mat cam_mat_d, Mat cam_mat_r, Scalar outline_color = 128, Scalar inside_color = 255, Point2d box_top = Point2d(-1, -1), Point2d box_bottom = Point2d(-1, -1), vector<int> *points_in_box = NULL, float min_z = 0, float max_z = 0, int box_size = 4);
 
 int GetDisparityForDistance(double distance, const OpenCvStereoCalibration &calibration, int *inf_disparity = NULL);
@@ -0,0 +1,321 @@
+/**
+ * Benchmark for pushbroom stereo on recorded frames.
+ *
+ * Example:
+ *   ./pushbroom-stereo-bench -c deltawing-stereo-odroid-cam1.conf
+ *       -l vids/videoL-... -t vids/videoR-... -b 3,5,7 -n 4,8 -o new.csv
+ *       -B baseline.csv
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#include "pushbroom-stereo-bench.hpp"
+
+int main(int argc, char *argv[]) {
+
+    string config_file = "";
+    string left_dir = "", right_dir = "";
+    string block_sizes_arg = "";
+    string threads_arg = "1,2,4,8";
+    string output_file = "";
+    string baseline_file = "";
+    int max_frames = 100;
+    int iterations = 5;
+    int warmup = 1;
+    bool both_pipelines = false;
+
+    ConciseArgs parser(argc, argv);
+    parser.add(config_file, "c", "config", "Configuration file with the stereo settings and calibration directory.", true);
+    parser.add(left_dir, "l", "left-dir", "Directory of left PGM frames (left00000.pgm, ...).", true);
+    parser.add(right_dir, "t", "right-dir", "Directory of right PGM frames (right00000.pgm, ...).", true);
+    parser.add(max_frames, "m", "max-frames", "Most frames to load from the directories.");
+    parser.add(iterations, "i", "iterations", "Timed passes over all of the frames.");
+    parser.add(warmup, "w", "warmup", "Untimed passes over all of the frames before timing.");
+    parser.add(block_sizes_arg, "b", "block-sizes", "Comma separated block sizes to run (defaults to the config file's).");
+    parser.add(threads_arg, "n", "threads", "Comma separated worker thread counts to run.");
+    parser.add(both_pipelines, "f", "both-pipelines", "Run both the staged and the fused pipeline, not just the config file's.");
+    parser.add(output_file, "o", "output", "Write the CSV results to this file instead of stdout.");
+    parser.add(baseline_file, "B", "baseline", "CSV from an earlier run to compare timing and hits against.");
+    parser.parse();
+
+    OpenCvStereoConfig stereo_config;
+
+    if (ParseConfigFile(config_file, &stereo_config) != true) {
+        fprintf(stderr, "Failed to parse configuration file, quitting.\n");
+        return 1;
+    }
+
+    OpenCvStereoCalibration stereo_calibration;
+
+    if (LoadCalibration(stereo_config.calibrationDir, &stereo_calibration) != true) {
+        fprintf(stderr, "Error: failed to read calibration files. Quitting.\n");
+        return 1;
+    }
+
+    cv::vector<Mat> left_frames, right_frames;
+
+    int num_frames = LoadFrames(left_dir, right_dir, max_frames, &left_frames, &right_frames);
+
+    if (num_frames < 1) {
+        fprintf(stderr, "Error: no frames found in %s and %s.\n", left_dir.c_str(), right_dir.c_str());
+        return 1;
+    }
+
+    if (left_frames[0].size() != stereo_calibration.mx1fp.size()) {
+        fprintf(stderr, "Error: frames are %d x %d, the calibration is for %d x %d.\n",
+            left_frames[0].cols, left_frames[0].rows, stereo_calibration.mx1fp.cols, stereo_calibration.mx1fp.rows);
+        return 1;
+    }
+
+    PushbroomStereoState state;
+    SetupState(stereo_config, stereo_calibration, &state);
+
+    cv::vector<int> block_sizes = ParseIntList(block_sizes_arg);
+    cv::vector<int> thread_counts = ParseIntList(threads_arg);
+
+    if (block_sizes.size() == 0) {
+        block_sizes.push_back(state.blockSize);
+    }
+
+    cv::vector<bool> pipelines;
+    pipelines.push_back(state.fused_pipeline);
+
+    if (both_pipelines) {
+        pipelines.push_back(!state.fused_pipeline);
+    }
+
+    #if defined(USE_NEON)
+        const char *simd = "neon";
+    #elif defined(USE_AVX2)
+        const char *simd = "avx2";
+    #elif defined(USE_SSE2)
+        const char *simd = "sse2";
+    #else
+        const char *simd = "scalar";
+    #endif
+
+    fprintf(stderr, "%d frames (%d x %d), %d timed passes, %s kernels\n", num_frames,
+        left_frames[0].cols, left_frames[0].rows, iterations, simd);
+
+    cv::vector<BenchResult> results;
+
+    for (unsigned int b = 0; b < block_sizes.size(); b++) {
+        for (unsigned int p = 0; p < pipelines.size(); p++) {
+            for (unsigned int t = 0; t < thread_counts.size(); t++) {
+
+                if (thread_counts[t] < 1 || thread_counts[t] > MAX_THREADS) {
+                    fprintf(stderr, "Warning: skipping %d threads (must be 1 to %d).\n", thread_counts[t], MAX_THREADS);
+                    continue;
+                }
+
+                state.blockSize = block_sizes[b];
+                state.fused_pipeline = pipelines[p];
+
+                fprintf(stderr, "block size %d, %d threads, %s pipeline...\n", state.blockSize,
+                    thread_counts[t], state.fused_pipeline ? "fused" : "staged");
+
+                RunBenchmark(left_frames, right_frames, state, thread_counts[t], iterations, warmup, &results);
+            }
+        }
+    }
+
+    FILE *out = stdout;
+
+    if (output_file.length() > 0) {
+        out = fopen(output_file.c_str(), "w");
+
+        if (out == NULL) {
+            fprintf(stderr, "Error: failed to open %s for writing.\n", output_file.c_str());
+            return 1;
+        }
+    }
+
+    WriteResults(out, results, simd);
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    if (baseline_file.length() > 0 && CompareToBaseline(baseline_file, results) != true) {
+        return 2;
+    }
+
+    return 0;
+}
+
+/**
+ * Runs stereo over all of the frames with a fresh worker pool and adds
+ * the timing of each stage (from PushbroomStereo's histograms) and of
+ * whole ProcessImages calls (measured here, as the "wall" stage) to the
+ * results.
+ *
+ * @param left_frames left images
+ * @param right_frames right images
+ * @param state stereo state to run with
+ * @param num_threads number of worker threads
+ * @param iterations timed passes over the frames
+ * @param warmup untimed passes over the frames before timing
+ * @param results (output) results to append to
+ */
+void RunBenchmark(const cv::vector<Mat> &left_frames, const cv::vector<Mat> &right_frames, PushbroomStereoState state, int num_threads, int iterations, int warmup, cv::vector<BenchResult> *results) {
+
+    // a pool of this run's size rather than the shared one
+    ThreadPoolConfig pool_config = ThreadPool::DefaultConfig();
+    pool_config.num_threads = num_threads;
+
+    ThreadPool pool(pool_config);
+
+    PushbroomStereoThreadConfig thread_config = PushbroomStereo::DefaultThreadConfig();
+    thread_config.num_threads = num_threads;
+    thread_config.pool = &pool;
+
+    PushbroomStereo pushbroom_stereo(thread_config);
+
+    PushbroomStereoFrameBuffers buffers;
+    buffers.number_of_points = 0;
+
+    for (int pass = 0; pass < warmup; pass++) {
+        for (unsigned int i = 0; i < left_frames.size(); i++) {
+            pushbroom_stereo.ProcessImages(left_frames[i], right_frames[i], &buffers, state);
+        }
+    }
+
+    pushbroom_stereo.ResetTiming();
+
+    cv::vector<float> wall_ms;
+    int points = 0;
+
+    for (int pass = 0; pass < iterations; pass++) {
+        for (unsigned int i = 0; i < left_frames.size(); i++) {
+            int64_t start = GetRawMonotonicNow();
+            pushbroom_stereo.ProcessImages(left_frames[i], right_frames[i], &buffers, state);
+            int64_t end = GetRawMonotonicNow();
+
+            wall_ms.push_back((end - start) / 1000.0f);
+            points += buffers.number_of_points;
+        }
+    }
+
+    BenchResult result;
+    result.block_size = state.blockSize;
+    result.num_threads = num_threads;
+    result.fused = state.fused_pipeline;
+    result.points = points;
+
+    for (int stage = 0; stage < NUM_STAGES; stage++) {
+        PushbroomStereoTiming timing;
+        pushbroom_stereo.GetStageTiming(stage, &timing);
+
+        result.stage = PushbroomStereo::GetStageName(stage);
+        result.count = timing.count;
+        result.p50_ms = timing.p50_ms;
+        result.p99_ms = timing.p99_ms;
+        result.max_ms = timing.max_ms;
+
+        results->push_back(result);
+    }
+
+    // exact percentiles for the whole call, since the histograms round up
+    if (wall_ms.size() > 0) {
+        sort(wall_ms.begin(), wall_ms.end());
+
+        result.stage = "wall";
+        result.count = wall_ms.size();
+        result.p50_ms = wall_ms[wall_ms.size() / 2];
+        result.p99_ms = wall_ms[(wall_ms.size() * 99) / 100];
+        result.max_ms = wall_ms.back();
+
+        results->push_back(result);
+    }
+}
+
+/**
+ * Writes the results as CSV with a header line.
+ *
+ * @param out file to write to
+ * @param results results to write
+ * @param simd which kernels this was built with
+ */
+void WriteResults(FILE *out, const cv::vector<BenchResult> &results, const char *simd) {
+    fprintf(out, "simd,block_size,threads,fused,stage,count,p50_ms,p99_ms,max_ms,points\n");
+
+    for (unsigned int i = 0; i < results.size(); i++) {
+        const BenchResult &r = results[i];
+
+        fprintf(out, "%s,%d,%d,%d,%s,%d,%.3f,%.3f,%.3f,%d\n", simd, r.block_size, r.num_threads,
+            r.fused ? 1 : 0, r.stage.c_str(), r.count, r.p50_ms, r.p99_ms, r.max_ms, r.points);
+    }
+}
+
+/**
+ * Compares results against a CSV from an earlier run, matching rows on
+ * block size, thread count, pipeline and stage (but not on the kernels,
+ * so a scalar build can be the baseline for a SIMD one).  Prints the
+ * change in median time for each match.  Hit counts are totals, so the
+ * baseline must be from the same frames and number of passes.
+ *
+ * @param baseline_file CSV written by WriteResults
+ * @param results results of this run
+ *
+ * @retval false if the baseline couldn't be read or some run found a
+ *      different number of hits than the baseline did
+ */
+bool CompareToBaseline(string baseline_file, const cv::vector<BenchResult> &results) {
+    FILE *in = fopen(baseline_file.c_str(), "r");
+
+    if (in == NULL) {
+        fprintf(stderr, "Error: failed to open baseline %s.\n", baseline_file.c_str());
+        return false;
+    }
+
+    map<string, BenchResult> baseline;
+    char line[512];
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        char simd[32], stage[32];
+        int fused;
+        BenchResult r;
+
+        if (sscanf(line, "%31[^,],%d,%d,%d,%31[^,],%d,%f,%f,%f,%d", simd, &r.block_size, &r.num_threads,
+                &fused, stage, &r.count, &r.p50_ms, &r.p99_ms, &r.max_ms, &r.points) != 10) {
+            // header or blank line
+            continue;
+        }
+
+        boost::format key = boost::format("%d,%d,%d,%s") % r.block_size % r.num_threads % fused % stage;
+        baseline[key.str()] = r;
+    }
+
+    fclose(in);
+
+    bool same_hits = true;
+
+    for (unsigned int i = 0; i < results.size(); i++) {
+        const BenchResult &r = results[i];
+
+        boost::format key = boost::format("%d,%d,%d,%s") % r.block_size % r.num_threads % (r.fused ? 1 : 0) % r.stage;
+        map<string, BenchResult>::iterator it = baseline.find(key.str());
+
+        if (it == baseline.end()) {
+            continue;
+        }
+
+        const BenchResult &b = it->second;
+
+        float change = b.p50_ms > 0 ? 100.0f * (r.p50_ms - b.p50_ms) / b.p50_ms : 0;
+
+        fprintf(stderr, "block size %d, %2d threads, %s, %-8s p50 %8.3f -> %8.3f ms (%+.1f%%)\n",
+            r.block_size, r.num_threads, r.fused ? "fused " : "staged", r.stage.c_str(),
+            b.p50_ms, r.p50_ms, change);
+
+        if (r.stage == "wall" && r.points != b.points) {
+            fprintf(stderr, "Error: block size %d, %d threads, %s found %d hits, baseline found %d.\n",
+                r.block_size, r.num_threads, r.fused ? "fused" : "staged", r.points, b.points);
+
+            same_hits = false;
+        }
+    }
+
+    return same_hits;
+}
@@ -0,0 +1,64 @@
+/**
+ * Benchmark for pushbroom stereo.  Runs PushbroomStereo over a recorded
+ * directory of PGM frames (as written by RecordingManager) for a set of
+ * block sizes and thread counts and prints each stage's timing and the
+ * number of hits as CSV, so kernel changes can be compared to a baseline.
+ *
+ * Build the scalar kernels with "make -f pushbroom-stereo-bench.mk clean"
+ * and then "make -f pushbroom-stereo-bench.mk NO_SIMD=1" to compare them
+ * against NEON / SSE2.
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#ifndef PUSHBROOM_STEREO_BENCH_HPP
+#define PUSHBROOM_STEREO_BENCH_HPP
+
+#include <cv.h>
+#include <highgui.h>
+
+#include "opencv2/opencv.hpp"
+
+#include "../../externals/ConciseArgs.hpp"
+#include "../../utils/utils/Clock.hpp"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <map>
+#include <sstream>
+#include <algorithm>
+
+#include "boost/format.hpp"
+
+#include "opencv-stereo-util.hpp"
+#include "pushbroom-stereo.hpp"
+#include "stereo-bench-util.hpp"
+
+using namespace std;
+using namespace cv;
+
+// timing for one stage of one block size / thread count / pipeline run
+struct BenchResult {
+    int block_size;
+    int num_threads;
+    bool fused;
+    string stage;
+
+    int count;
+    float p50_ms;
+    float p99_ms;
+    float max_ms;
+
+    // total hits over all timed frames
+    int points;
+};
+
+void RunBenchmark(const cv::vector<Mat> &left_frames, const cv::vector<Mat> &right_frames, PushbroomStereoState state, int num_threads, int iterations, int warmup, cv::vector<BenchResult> *results);
+
+void WriteResults(FILE *out, const cv::vector<BenchResult> &results, const char *simd);
+
+bool CompareToBaseline(string baseline_file, const cv::vector<BenchResult> &results);
+
+#endif
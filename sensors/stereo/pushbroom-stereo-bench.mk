@@ -0,0 +1,17 @@
+TARGET = pushbroom-stereo-bench
+SOURCES = pushbroom-stereo-bench.cpp stereo-bench-util.cpp opencv-stereo-util.cpp pushbroom-stereo.cpp pushbroom-stereo-opencl.cpp ../../externals/jpeg-utils/jpeg-utils.c ../../utils/utils/RealtimeUtils.cpp ../../utils/ThreadPool/ThreadPool.cpp
+
+# "make USE_OPENCL=1" builds the GPU backend (see pushbroom-stereo-opencl.hpp)
+ifeq ($(USE_OPENCL),1)
+CPPFLAGS_EXTRA += -DUSE_OPENCL
+LDPOSTFLAGS_EXTRA += -lOpenCL
+endif
+
+# "make NO_SIMD=1" builds only the scalar kernels.  The objects are shared
+# with pushbroom-stereo, so "make clean" when switching.
+ifeq ($(NO_SIMD),1)
+CPPFLAGS_EXTRA += -DNO_SIMD
+endif
+
+# include a standard makefile that uses these variables and builds everything
+include ../../utils/make/flight.mk
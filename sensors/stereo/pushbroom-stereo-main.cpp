@@ -42,6 +42,7 @@ PushbroomStereoState state; // HACK
 
 // subscriptions to data
 lcmt_stereo_subscription_t *stereo_replay_sub;
+lcmt_stereo_subscription_t *fpga_hits_sub;
 lcmt_cpu_info_subscription_t *cpu_info_sub1;
 lcmt_cpu_info_subscription_t *cpu_info_sub2;
 lcmt_cpu_info_subscription_t *cpu_info_sub3;
@@ -66,6 +67,37 @@ dc1394camera_t  *camera;
 dc1394_t        *d2;
 dc1394camera_t  *camera2;
 
+// capture threads for the cameras, if the config file asks for them
+StereoCapture *stereo_capture = NULL;
+
+// replays the video against an LCM log (-r)
+PlaybackSynchronizer *playback_synchronizer = NULL;
+
+// matches the cameras' brightness settings off the frame loop
+ExposureController *exposure_controller = NULL;
+
+// sends the stereo results over LCM
+StereoPublisher *stereo_publisher = NULL;
+
+// streams the images over LCM with -P
+ImageStreamer *image_streamer = NULL;
+
+// predicts where to search first, with predictedRegions
+SearchRegionPredictor *region_predictor = NULL;
+
+// more camera pairs run alongside the main one (see StereoPair)
+std::vector<StereoPair*> extra_pairs;
+
+// skips frames when flying slowly, with adaptiveRateBand
+AdaptiveFrameRate *adaptive_rate = NULL;
+
+// only searches around the FPGA's hits, with fpga_hits_channel
+FpgaHitSeeds *fpga_seeds = NULL;
+
+// latest pose, for the recording's metadata
+mav_pose_t last_pose;
+bool have_last_pose = false;
+
 OpenCvStereoConfig stereoConfig;
 
 /**
@@ -79,8 +111,28 @@ void control_c_handler(int s)
 {
     cout << endl << "exiting via ctrl-c" << endl;
 
+    // send anything that's still queued
+    delete stereo_publisher;
+    stereo_publisher = NULL;
+
+    delete image_streamer;
+    image_streamer = NULL;
+
     if (recording_manager.UsingLiveCameras()) {
 
+        // stop grabbing before the cameras go away
+        delete exposure_controller;
+        exposure_controller = NULL;
+
+        delete stereo_capture;
+        stereo_capture = NULL;
+
+        for (size_t i = 0; i < extra_pairs.size(); i++) {
+            delete extra_pairs[i];
+        }
+
+        extra_pairs.clear();
+
         StopCapture(d, camera);
         StopCapture(d2, camera2);
 
@@ -102,14 +154,23 @@ void lcm_stereo_control_handler(const lcm_recv_buf_t *rbuf, const char* channel,
      * the program starts, stereo is always running.
      *
      * stereo control:
-     *   0: write to disk and then restart
+     *   0: write to disk and then restart (with triggered recording,
+     *      trigger a recording window instead)
      *   1: (re)start record
      *   2: pause
      *
      */
 
     // got a control message, so parse it and figure out what we should do
-    if (msg->stereo_control == 0)
+    if (msg->stereo_control == 0 && recording_manager.IsTriggered())
+    {
+        // the frames around now get written, along with the decimated
+        // ones that already are
+        cout << endl << "Recording triggered." << endl;
+
+        recording_manager.Trigger();
+
+    } else if (msg->stereo_control == 0)
     {
         // write video, then start recording again
 
@@ -146,8 +207,17 @@ int main(int argc, char *argv[])
     string configFile = "";
     string video_file_left = "", video_file_right = "", video_directory = "";
     int starting_frame_number = 0;
+    string replay_log = "";
+    float replay_speed = 1;
     bool enable_gamma = false;
     float random_results = -1.0;
+    string random_layout = "uniform";
+    int random_seed = 0;
+    string trace_dir = "/tmp";
+
+#ifdef STEREO_WITH_STATE_MACHINE
+    bool run_state_machine = false;
+#endif
 
     int last_frame_number = -1;
 
@@ -162,18 +232,29 @@ int main(int argc, char *argv[])
     parser.add(force_brightness, "b", "force-brightness", "Force a brightness setting.");
     parser.add(force_exposure, "e", "force-exposure", "Force an exposure setting.");
     parser.add(quiet_mode, "q", "quiet", "Reduce text output.");
-    parser.add(video_file_left, "l", "video-file-left", "Do not use cameras, instead use this video file (also requires a right video file).");
+    parser.add(video_file_left, "l", "video-file-left", "Do not use cameras, instead use this video file (also requires a right video file, unless it is a .rec recording).");
     parser.add(video_file_right, "t", "video-file-right", "Right video file, only for use with the -l option.");
     parser.add(video_directory, "i", "video-directory", "Directory to search for videos in (for playback).");
     parser.add(starting_frame_number, "f", "starting-frame", "Frame to start at when playing back videos.");
+    parser.add(replay_log, "r", "replay-log", "LCM log to replay the videos against, instead of following lcm-logplayer (for playback).");
+    parser.add(replay_speed, "S", "replay-speed", "Speed to replay the LCM log at: 1 for real time, 2 for twice as fast, 0 for as fast as possible.");
     parser.add(display_hud, "v", "hud", "Overlay HUD on display images.");
     parser.add(record_hud, "x", "record-hud", "Record the HUD display.");
     parser.add(file_frame_skip, "p", "skip", "Number of frames skipped in recording (for playback).");
     parser.add(enable_gamma, "g", "enable-gamma", "Turn gamma on for both cameras.");
     parser.add(random_results, "R", "random-results", "Number of random points to produce per frame.  Can be a float in which case we'll take a random sample to decide if to produce the last one.  Disables real stereo processing.  Only for debugging / analysis!");
+    parser.add(random_layout, "L", "random-layout", "Where -R puts its points: uniform, trees or walls.");
+    parser.add(random_seed, "N", "random-seed", "Seed for -R.  The same seed gives the same points for the same frames.");
     parser.add(publish_all_images, "P", "publish-all-images", "Publish all images to LCM");
+    parser.add(trace_dir, "T", "trace-dir", "Directory to write traces of the stereo stages to, on SIGUSR2 or a trace request.");
+#ifdef STEREO_WITH_STATE_MACHINE
+    parser.add(run_state_machine, "F", "state-machine", "Run the state machine in this process and hand it the stereo hits directly (they still go out on LCM too).");
+#endif
     parser.parse();
 
+    // before any threads start, so they leave SIGUSR2 to the trace thread
+    TraceDumpOnSignal(SIGUSR2, trace_dir, "pushbroom-stereo");
+
     // parse the config file
     if (ParseConfigFile(configFile, &stereoConfig) != true)
     {
@@ -182,7 +263,8 @@ int main(int argc, char *argv[])
     }
 
     if (video_file_left.length() > 0
-        && video_file_right.length() <= 0) {
+        && video_file_right.length() <= 0
+        && RecordingManager::IsRecordingFile(video_file_left) != true) {
 
         fprintf(stderr, "Error: for playback you must specify both "
             "a right and left video file. (Only got a left one.)\n");
@@ -201,6 +283,9 @@ int main(int argc, char *argv[])
 
     recording_manager.Init(stereoConfig);
 
+    // so .rec files say what they were recorded with
+    recording_manager.SetRecordingMetadata("config: " + configFile + "\ncalibration: " + stereoConfig.calibrationDir);
+
     // attempt to load video files / directories
     if (video_file_left.length() > 0) {
         if (recording_manager.LoadVideoFiles(video_file_left, video_file_right) != true) {
@@ -228,6 +313,45 @@ int main(int argc, char *argv[])
     lcm_t * lcm;
     lcm = lcm_create (stereoConfig.lcmUrl.c_str());
 
+    // messages for playback come from here.  When replaying an LCM log,
+    // that's an in-process LCM the log gets played into.
+    lcm_t *lcm_input = lcm;
+
+    if (replay_log.length() > 0) {
+        if (recording_manager.UsingLiveCameras()) {
+            fprintf(stderr, "Error: replaying an LCM log (-r) needs videos to play (-l or -i).\n");
+            return -1;
+        }
+
+        lcm_input = lcm_create("memq://");
+
+        playback_synchronizer = new PlaybackSynchronizer(lcm_input, stereoConfig.stereo_replay_channel, replay_speed);
+
+        if (playback_synchronizer->Open(replay_log) != true) {
+            return -1;
+        }
+
+        if (starting_frame_number > 0) {
+            playback_synchronizer->SeekToFrame(starting_frame_number);
+        }
+    }
+
+    stereo_publisher = new StereoPublisher(lcm, stereoConfig.publishThread);
+
+    if (stereoConfig.shmRing.length() > 0) {
+        if (stereo_publisher->EnableSharedMemory(stereoConfig.shmRing, stereoConfig.shmUdp) != true) {
+            fprintf(stderr, "Warning: failed to make the shared memory ring \"%s\", sending stereo on LCM only.\n", stereoConfig.shmRing.c_str());
+        }
+    }
+
+    if (stereoConfig.batchChannel.length() > 0) {
+        stereo_publisher->EnableBatching(stereoConfig.batchChannel, stereoConfig.batchFrames, stereoConfig.batchMs);
+    }
+
+    if (publish_all_images) {
+        image_streamer = new ImageStreamer(lcm, stereoConfig);
+    }
+
 
     unsigned long elapsed;
 
@@ -252,6 +376,10 @@ int main(int argc, char *argv[])
     // own threading without a fight
     setNumThreads(1);
 
+    // size of the Format7 mode's whole image, when SetupFormat7Capture
+    // sets up the cameras
+    Size capture_mode_size;
+
     if (recording_manager.UsingLiveCameras()) {
         d = dc1394_new ();
         if (!d)
@@ -276,11 +404,20 @@ int main(int argc, char *argv[])
         dc1394_reset_bus(camera2);
 
         // setup
-        err = setup_gray_capture(camera, DC1394_VIDEO_MODE_FORMAT7_1);
-        DC1394_ERR_CLN_RTN(err, cleanup_and_exit(camera), "Could not setup camera");
+        if (stereoConfig.captureMode == 1 && stereoConfig.captureRoi.area() == 0) {
+            err = setup_gray_capture(camera, DC1394_VIDEO_MODE_FORMAT7_1);
+            DC1394_ERR_CLN_RTN(err, cleanup_and_exit(camera), "Could not setup camera");
 
-        err2 = setup_gray_capture(camera2, DC1394_VIDEO_MODE_FORMAT7_1);
-        DC1394_ERR_CLN_RTN(err2, cleanup_and_exit(camera2), "Could not setup camera number 2");
+            err2 = setup_gray_capture(camera2, DC1394_VIDEO_MODE_FORMAT7_1);
+            DC1394_ERR_CLN_RTN(err2, cleanup_and_exit(camera2), "Could not setup camera number 2");
+        } else {
+            // only send the part of the image we use
+            err = SetupFormat7Capture(camera, stereoConfig.captureMode, stereoConfig.captureRoi, &capture_mode_size);
+            DC1394_ERR_CLN_RTN(err, cleanup_and_exit(camera), "Could not setup camera");
+
+            err2 = SetupFormat7Capture(camera2, stereoConfig.captureMode, stereoConfig.captureRoi);
+            DC1394_ERR_CLN_RTN(err2, cleanup_and_exit(camera2), "Could not setup camera number 2");
+        }
 
         // enable camera
         err = dc1394_video_set_transmission(camera, DC1394_ON);
@@ -319,45 +456,45 @@ int main(int argc, char *argv[])
 
     } // show display
 
-    if (show_display || publish_all_images) {
+    if (show_display || publish_all_images || playback_synchronizer != NULL) {
         // if a channel exists, subscribe to it
         if (stereoConfig.stereo_replay_channel.length() > 0) {
-            stereo_replay_sub = lcmt_stereo_subscribe(lcm, stereoConfig.stereo_replay_channel.c_str(), &stereo_replay_handler, &hud);
+            stereo_replay_sub = lcmt_stereo_subscribe(lcm_input, stereoConfig.stereo_replay_channel.c_str(), &stereo_replay_handler, &hud);
         }
 
         if (stereoConfig.pose_channel.length() > 0) {
-            mav_pose_t_sub = mav_pose_t_subscribe(lcm, stereoConfig.pose_channel.c_str(), &mav_pose_t_handler, &hud);
+            mav_pose_t_sub = mav_pose_t_subscribe(lcm_input, stereoConfig.pose_channel.c_str(), &mav_pose_t_handler, &hud);
         }
 
         if (stereoConfig.gps_channel.length() > 0) {
-            mav_gps_data_t_sub = mav_gps_data_t_subscribe(lcm, stereoConfig.gps_channel.c_str(), &mav_gps_data_t_handler, &hud);
+            mav_gps_data_t_sub = mav_gps_data_t_subscribe(lcm_input, stereoConfig.gps_channel.c_str(), &mav_gps_data_t_handler, &hud);
         }
 
         if (stereoConfig.baro_airspeed_channel.length() > 0) {
-            baro_airspeed_sub = lcmt_baro_airspeed_subscribe(lcm, stereoConfig.baro_airspeed_channel.c_str(), &baro_airspeed_handler, &hud);
+            baro_airspeed_sub = lcmt_baro_airspeed_subscribe(lcm_input, stereoConfig.baro_airspeed_channel.c_str(), &baro_airspeed_handler, &hud);
         }
 
         if (stereoConfig.servo_out_channel.length() > 0) {
-            servo_out_sub = lcmt_deltawing_u_subscribe(lcm, stereoConfig.servo_out_channel.c_str(), &servo_out_handler, &hud);
+            servo_out_sub = lcmt_deltawing_u_subscribe(lcm_input, stereoConfig.servo_out_channel.c_str(), &servo_out_handler, &hud);
         }
 
         if (stereoConfig.battery_status_channel.length() > 0) {
-            battery_status_sub = lcmt_battery_status_subscribe(lcm, stereoConfig.battery_status_channel.c_str(), &battery_status_handler, &hud);
+            battery_status_sub = lcmt_battery_status_subscribe(lcm_input, stereoConfig.battery_status_channel.c_str(), &battery_status_handler, &hud);
         }
 
         if (stereoConfig.cpu_info_channel1.length() > 0) {
-            cpu_info_sub1 = lcmt_cpu_info_subscribe(lcm, stereoConfig.cpu_info_channel1.c_str(), &cpu_info_handler, &recording_manager);
-            cpu_info_sub2 = lcmt_cpu_info_subscribe(lcm, stereoConfig.cpu_info_channel2.c_str(), &cpu_info_handler, &recording_manager);
-            cpu_info_sub3 = lcmt_cpu_info_subscribe(lcm, stereoConfig.cpu_info_channel3.c_str(), &cpu_info_handler, &recording_manager);
+            cpu_info_sub1 = lcmt_cpu_info_subscribe(lcm_input, stereoConfig.cpu_info_channel1.c_str(), &cpu_info_handler, &recording_manager);
+            cpu_info_sub2 = lcmt_cpu_info_subscribe(lcm_input, stereoConfig.cpu_info_channel2.c_str(), &cpu_info_handler, &recording_manager);
+            cpu_info_sub3 = lcmt_cpu_info_subscribe(lcm_input, stereoConfig.cpu_info_channel3.c_str(), &cpu_info_handler, &recording_manager);
         }
 
         if (stereoConfig.log_size_channel1.length() > 0) {
-            log_size_sub1 = lcmt_log_size_subscribe(lcm, stereoConfig.log_size_channel1.c_str(), &log_size_handler, &hud);
-            log_size_sub2 = lcmt_log_size_subscribe(lcm, stereoConfig.log_size_channel2.c_str(), &log_size_handler, &hud);
-            log_size_sub3 = lcmt_log_size_subscribe(lcm, stereoConfig.log_size_channel3.c_str(), &log_size_handler, &hud);
+            log_size_sub1 = lcmt_log_size_subscribe(lcm_input, stereoConfig.log_size_channel1.c_str(), &log_size_handler, &hud);
+            log_size_sub2 = lcmt_log_size_subscribe(lcm_input, stereoConfig.log_size_channel2.c_str(), &log_size_handler, &hud);
+            log_size_sub3 = lcmt_log_size_subscribe(lcm_input, stereoConfig.log_size_channel3.c_str(), &log_size_handler, &hud);
         }
 
-    } // end show_display || publish_all_images
+    } // end show_display || publish_all_images || playback_synchronizer
 
     // load calibration
     OpenCvStereoCalibration stereoCalibration;
@@ -368,6 +505,25 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    // the calibration is for the capture mode's whole image
+    Size calibration_size = stereoCalibration.mx1fp.size();
+
+    if (capture_mode_size.area() > 0 && capture_mode_size != calibration_size) {
+        fprintf(stderr, "Error: Format7 mode %d is %d x %d, but the calibration is for %d x %d.\n",
+            stereoConfig.captureMode, capture_mode_size.width, capture_mode_size.height,
+            calibration_size.width, calibration_size.height);
+        return -1;
+    }
+
+    if (stereoConfig.captureRoi.area() > 0) {
+        if (CropCalibration(stereoConfig.captureRoi, &stereoCalibration) != true) {
+            return -1;
+        }
+
+        // everything below is in the captured image's pixels
+        ShiftRoiToCapture(stereoConfig.captureRoi, &stereoConfig);
+    }
+
     int inf_disparity_tester, disparity_tester;
     disparity_tester = GetDisparityForDistance(10, stereoCalibration, &inf_disparity_tester);
 
@@ -376,6 +532,14 @@ int main(int argc, char *argv[])
     // subscribe to the stereo control channel
     stereo_control_sub = lcmt_stereo_control_subscribe(lcm, stereoConfig.stereoControlChannel.c_str(), &lcm_stereo_control_handler, NULL);
 
+    if (stereoConfig.trace_request_channel.length() > 0) {
+        lcmt_trace_request_subscribe(lcm, stereoConfig.trace_request_channel.c_str(), &trace_request_handler, NULL);
+    }
+
+    if (stereoConfig.triggeredRecording && stereoConfig.state_machine_state_channel.length() > 0) {
+        lcmt_debug_subscribe(lcm, stereoConfig.state_machine_state_channel.c_str(), &state_machine_state_handler, NULL);
+    }
+
 
     Mat imgDisp;
     Mat imgDisp2;
@@ -386,9 +550,12 @@ int main(int argc, char *argv[])
     state.disparity = stereoConfig.disparity;
     state.zero_dist_disparity = stereoConfig.infiniteDisparity;
     state.sobelLimit = stereoConfig.interestOperatorLimit;
+    state.interest_operator = PushbroomStereo::InterestOperatorFromName(stereoConfig.interestOperator);
     state.horizontalInvarianceMultiplier = stereoConfig.horizontalInvarianceMultiplier;
     state.blockSize = stereoConfig.blockSize;
     state.random_results = random_results;
+    state.random_layout = PushbroomStereo::RandomLayoutFromName(random_layout);
+    state.random_seed = random_seed;
     state.check_horizontal_invariance = true;
 
     if (state.blockSize > 10 || state.blockSize < 1)
@@ -403,9 +570,112 @@ int main(int argc, char *argv[])
     state.mapxR = stereoCalibration.mx2fp;
     state.Q = stereoCalibration.qMat;
     state.show_display = show_display;
+    state.keep_rectified = show_display;
+
+    if (stereoConfig.compactChannel.length() > 0) {
+        stereo_publisher->EnableCompact(stereoConfig.compactChannel, stereoCalibration.qMat, stereoConfig.calibrationUnitConversion);
+    }
+
+    if (stereoConfig.hitBitmapChannel.length() > 0) {
+        stereo_publisher->EnableHitBitmap(stereoConfig.hitBitmapChannel, state.mapxL.size(), state.blockSize);
+    }
 
     state.lastValidPixelRow = stereoConfig.lastValidPixelRow;
 
+    state.roi_top = stereoConfig.roiTop;
+    state.roi_bottom = stereoConfig.roiBottom;
+    state.roi_left = stereoConfig.roiLeft;
+    state.roi_right = stereoConfig.roiRight;
+
+    if (stereoConfig.roiMask.length() > 0) {
+        state.roi_mask = imread(stereoConfig.roiMask, CV_LOAD_IMAGE_GRAYSCALE);
+
+        if (state.roi_mask.size() == calibration_size && stereoConfig.captureRoi.area() > 0) {
+            // drawn on the whole image
+            state.roi_mask = state.roi_mask(stereoConfig.captureRoi).clone();
+        }
+
+        if (state.roi_mask.empty()) {
+            fprintf(stderr, "Warning: failed to read ROI mask (%s), searching the whole image.\n", stereoConfig.roiMask.c_str());
+        } else if (state.roi_mask.size() != state.mapxL.size()) {
+            fprintf(stderr, "Warning: ROI mask is %d x %d, the images are %d x %d.  Not using it.\n",
+                state.roi_mask.cols, state.roi_mask.rows, state.mapxL.cols, state.mapxL.rows);
+
+            state.roi_mask = Mat();
+        }
+    }
+
+    state.fused_pipeline = stereoConfig.fusedPipeline;
+
+    state.temporal_skip = stereoConfig.temporalSkip;
+    state.temporal_skip_threshold = stereoConfig.temporalSkipThreshold;
+
+    state.subpixel_refinement = stereoConfig.subpixelRefinement;
+
+    state.use_opencl = stereoConfig.openclBackend;
+
+    state.deadline_us = stereoConfig.deadlineMs * 1000;
+
+    state.census_matching = stereoConfig.censusMatching;
+    state.census_threshold = stereoConfig.censusThreshold;
+
+    state.num_disparities = stereoConfig.disparities.size();
+
+    if (state.num_disparities > MAX_DISPARITIES) {
+        fprintf(stderr, "Warning: %d disparities requested, only using the "
+            "first %d.\n", state.num_disparities, MAX_DISPARITIES);
+
+        state.num_disparities = MAX_DISPARITIES;
+    }
+
+    for (int i = 0; i < state.num_disparities; i++) {
+        state.disparities[i] = stereoConfig.disparities[i];
+    }
+
+    // regions to search first, from last frame's hits and the pose
+    cv::vector<Rect> predicted_regions;
+
+    // never skip the rest of two frames in a row
+    bool skipped_rest = false;
+    double last_rest_ms = 0;
+
+    if (stereoConfig.predictedRegions) {
+        if (stereoConfig.pose_channel.length() > 0) {
+            region_predictor = new SearchRegionPredictor(state.Q, stereoConfig.predictedRegionMargin);
+
+            if (mav_pose_t_sub == NULL) {
+                mav_pose_t_sub = mav_pose_t_subscribe(lcm_input, stereoConfig.pose_channel.c_str(), &mav_pose_t_handler, &hud);
+            }
+        } else {
+            fprintf(stderr, "Warning: predictedRegions needs a pose_channel, searching whole frames.\n");
+        }
+    }
+
+    if (stereoConfig.adaptiveRateBand > 0) {
+        if (stereoConfig.baro_airspeed_channel.length() > 0) {
+            adaptive_rate = new AdaptiveFrameRate(stereoConfig.adaptiveRateBand, stereoConfig.adaptiveRateMinHz);
+
+            if (baro_airspeed_sub == NULL) {
+                baro_airspeed_sub = lcmt_baro_airspeed_subscribe(lcm_input, stereoConfig.baro_airspeed_channel.c_str(), &baro_airspeed_handler, &hud);
+            }
+        } else {
+            fprintf(stderr, "Warning: adaptiveRateBand needs a baro_airspeed_channel, processing every frame.\n");
+        }
+    }
+
+    // regions around the FPGA's hits, in hybrid mode
+    cv::vector<Rect> fpga_regions;
+
+    if (stereoConfig.fpga_hits_channel.length() > 0) {
+        fpga_seeds = new FpgaHitSeeds(state.Q, stereoConfig.fpgaHitsMargin, stereoConfig.fpgaHitsMaxAgeMs * 1000);
+
+        fpga_hits_sub = lcmt_stereo_subscribe(lcm_input, stereoConfig.fpga_hits_channel.c_str(), &fpga_hits_handler, NULL);
+    }
+
+    if (stereoConfig.recordMetadata && stereoConfig.pose_channel.length() > 0 && mav_pose_t_sub == NULL) {
+        mav_pose_t_sub = mav_pose_t_subscribe(lcm_input, stereoConfig.pose_channel.c_str(), &mav_pose_t_handler, &hud);
+    }
+
     Mat matL, matR;
     bool quit = false;
 
@@ -450,7 +720,111 @@ int main(int argc, char *argv[])
     } // recording_manager.UsingLiveCameras()
 
     // spool up worker threads
-    PushbroomStereo pushbroom_stereo;
+    PushbroomStereoThreadConfig thread_config = PushbroomStereo::DefaultThreadConfig();
+
+    if (stereoConfig.numThreads > 0) {
+        thread_config.num_threads = stereoConfig.numThreads;
+    }
+
+    if (thread_config.num_threads > MAX_THREADS) {
+        fprintf(stderr, "Warning: %d threads requested, only using %d.\n",
+            thread_config.num_threads, MAX_THREADS);
+
+        thread_config.num_threads = MAX_THREADS;
+    }
+
+    // the process's thread pool gets a thread per stereo worker, with the
+    // CPUs and priority the stereo threads had
+    ThreadPoolConfig pool_config = ThreadPool::DefaultConfig();
+
+    pool_config.num_threads = thread_config.num_threads;
+    pool_config.fifo_priority = stereoConfig.threadPriority;
+
+    for (int i = 0; i < thread_config.num_threads; i++) {
+        if (i < (int)stereoConfig.threadCpus.size()) {
+            pool_config.cpus[i] = stereoConfig.threadCpus[i];
+        }
+
+        if (i < (int)stereoConfig.threadBandWeights.size()) {
+            thread_config.band_weights[i] = stereoConfig.threadBandWeights[i];
+        }
+    }
+
+    ThreadPool::ConfigureShared(pool_config);
+
+#ifdef STEREO_WITH_STATE_MACHINE
+    // the state machine gets the hits straight from the stereo loop, and
+    // its trajectory searches share the pool with stereo
+    InProcessStereoQueue *fsm_stereo_queue = NULL;
+
+    if (run_state_machine) {
+        fsm_stereo_queue = new InProcessStereoQueue();
+
+        StateMachineOptions fsm_options;
+
+        // this process answers trace requests itself
+        fsm_options.trace_request_channel = "";
+
+        std::thread fsm_thread([fsm_options, fsm_stereo_queue]() {
+            if (RunStateMachine(fsm_options, fsm_stereo_queue) != 0) {
+                fprintf(stderr, "Error: the state machine failed to start, quitting.\n");
+                exit(1);
+            }
+        });
+
+        fsm_thread.detach();
+    }
+#endif
+
+    PushbroomStereo pushbroom_stereo(thread_config);
+
+    // optional coarse-to-fine search for far obstacles after each frame
+    PyramidStereo *pyramid_stereo = NULL;
+
+    if (stereoConfig.pyramidDisparities.size() > 0) {
+        pyramid_stereo = new PyramidStereo(stereoConfig.pyramidDisparities, stereoConfig.pyramidMargin, thread_config);
+    }
+
+    // hits from each frame, reused so the main loop doesn't allocate
+    PushbroomStereoFrameBuffers stereo_buffers;
+    stereo_buffers.number_of_points = 0;
+
+    // what recording, stereo, the octomap and the trajectories hold (the
+    // last two only when the state machine is built in)
+    MemoryStatsPublisher memory_stats("pushbroom-stereo");
+    int64_t next_memory_stats = GetMonotonicNow() + PUBLISH_MEMORY_STATS_EVERY_USEC;
+
+    // frames get handed to stereo and the recorder straight from the
+    // cameras' DMA buffers
+    Format7FramePool frame_pool_left(camera), frame_pool_right(camera2);
+
+    // falls back to one camera's alarms if the other one dies
+    CameraHealthMonitor camera_health;
+    MonoObstacleDetector mono_detector;
+    MonoObstacleAlarms mono_alarms;
+
+    if (recording_manager.UsingLiveCameras()) {
+        if (stereoConfig.captureThreads) {
+            stereo_capture = new StereoCapture(camera, camera2);
+        }
+
+        exposure_controller = new ExposureController(camera, camera2, enable_gamma);
+
+        for (size_t i = 0; i < stereoConfig.extraPairs.size(); i++) {
+            StereoPair *pair = new StereoPair(stereoConfig.extraPairs[i], thread_config, lcm, stereoConfig.publishThread);
+
+            if (pair->Start(stereoConfig.captureMode, stereoConfig.captureRoi, enable_gamma) != true) {
+                fprintf(stderr, "Warning: camera pair %s failed to start, running without it.\n", pair->GetName().c_str());
+                delete pair;
+                continue;
+            }
+
+            extra_pairs.push_back(pair);
+        }
+    }
+
+    // calibration is loaded and the cameras are running
+    PublishProcessReady(lcm);
 
     // start the framerate clock
     struct timeval start, now;
@@ -458,48 +832,157 @@ int main(int argc, char *argv[])
 
     while (quit == false) {
 
+        // hold on to the camera buffers until the end of this loop, when
+        // stereo and the recorder are done with them
+        Format7Frame frame_left, frame_right;
+
         // get the frames from the camera
         if (recording_manager.UsingLiveCameras()) {
-            // we would like to match brightness every frame
-            // but that would really hurt our framerate
-            // match brightness every 10 frames instead
-            if (numFrames % MATCH_BRIGHTNESS_EVERY_N_FRAMES == 0)
-            {
-                MatchBrightnessSettings(camera, camera2);
+            // capture images from the cameras
+            if (stereo_capture != NULL) {
+                stereo_capture->GetPair(&frame_left, &frame_right);
+            } else {
+                frame_left = frame_pool_left.GetFrame();
+                frame_right = frame_pool_right.GetFrame();
             }
 
-            // capture images from the cameras
-            matL = GetFrameFormat7(camera);
-            matR = GetFrameFormat7(camera2);
+            matL = frame_left.image;
+            matR = frame_right.image;
 
-            // record video
-            recording_manager.AddFrames(matL, matR);
+            // we would like to match brightness every frame, but
+            // even off the frame loop that's a lot of USB traffic.
+            // check every 10 frames instead (census matching doesn't
+            // care much, so check less often then)
+            int match_brightness_frames = state.census_matching ?
+                MATCH_BRIGHTNESS_EVERY_N_FRAMES_CENSUS : MATCH_BRIGHTNESS_EVERY_N_FRAMES;
+
+            // look for a dead camera, and share the brightness with the
+            // exposure check when they land on the same frame
+            FrameStats stats_left, stats_right;
+            int last_camera_mode = camera_health.GetMode();
 
+            bool measured = camera_health.AddFrames(matL, matR, &stats_left, &stats_right);
+
+            exposure_controller->AddFrames(matL, matR, match_brightness_frames,
+                measured ? &stats_left : NULL, measured ? &stats_right : NULL);
+
+            if (camera_health.GetMode() != last_camera_mode) {
+                printf("\nCamera health: %s -> %s\n", CameraHealthMonitor::GetModeName(last_camera_mode), CameraHealthMonitor::GetModeName(camera_health.GetMode()));
+
+                exposure_controller->SetCameraHealth(camera_health.IsLeftOk(), camera_health.IsRightOk());
+                mono_detector.Reset();
+            }
+
+            bool reset_left, reset_right;
+
+            if (measured && camera_health.GetReset(&reset_left, &reset_right)) {
+                exposure_controller->RequestCameraReset(reset_left, reset_right);
+            }
 
         } else {
+            if (playback_synchronizer != NULL && playback_synchronizer->NextFrame() != true) {
+                printf("\nEnd of the LCM log.\n");
+                break;
+            }
+
             // using a video file -- get the next frame
             recording_manager.GetFrames(matL, matR);
         }
 
-        cv::vector<Point3f> pointVector3d;
-        cv::vector<uchar> pointColors;
-        cv::vector<Point3i> pointVector2d; // for display
-        cv::vector<Point3i> pointVector2d_inf; // for display
+        gettimeofday( &now, NULL );
+        double before = now.tv_usec + now.tv_sec * 1000 * 1000;
+
+        // stereo needs both cameras
+        bool run_stereo = disable_stereo != true && camera_health.GetMode() == CAMERA_MODE_STEREO;
+
+        int64_t frame_timestamp = (recording_manager.UsingLiveCameras() || stereo_lcm_msg == NULL) ?
+            GetWallNow() : stereo_lcm_msg->timestamp;
+
+        // flying slowly, so this frame wouldn't show anything new.  It
+        // still gets recorded, but there is nothing to publish.
+        bool rate_skipped = run_stereo && adaptive_rate != NULL && !adaptive_rate->ShouldProcess(frame_timestamp);
+
+        if (rate_skipped) {
+            run_stereo = false;
+        }
+
+        // with fresh FPGA hits, the CPU only checks the blocks around
+        // them, and has nothing to do if there aren't any
+        bool fpga_seeded = run_stereo && fpga_seeds != NULL && fpga_seeds->GetRegions(frame_timestamp, &fpga_regions);
+
+        if (fpga_seeded && fpga_regions.empty()) {
+            run_stereo = false;
+        }
+
+        // start the main stereo processing
+        if (run_stereo) {
+            if (fpga_seeded) {
+                pushbroom_stereo.Submit(matL, matR, state, &fpga_regions);
+            } else {
+                if (region_predictor != NULL) {
+                    region_predictor->Predict(frame_timestamp, &predicted_regions);
+                }
+
+                pushbroom_stereo.Submit(matL, matR, state, region_predictor != NULL ? &predicted_regions : NULL);
+            }
+        }
+
+        // the other pairs' frames run on the pool alongside this one
+        for (size_t i = 0; i < extra_pairs.size(); i++) {
+            extra_pairs[i]->Submit(state, state.census_matching ?
+                MATCH_BRIGHTNESS_EVERY_N_FRAMES_CENSUS : MATCH_BRIGHTNESS_EVERY_N_FRAMES);
+        }
+
+        if (recording_manager.UsingLiveCameras()) {
+            // record video while the stereo runs
+            recording_manager.AddFrames(matL, matR);
+        }
+
+        cv::vector<Point3i> &pointVector2d = stereo_buffers.pointVector2d; // for display
+
+        // finish the main stereo processing
+        if (run_stereo) {
 
-        // do the main stereo processing
-        if (disable_stereo != true) {
+            // the hits in the predicted regions come first.  If the rest
+            // of the frame would take it over budget (going by how long the
+            // rest took last time), those are all it gets.
+            gettimeofday( &now, NULL );
+            double elapsed_ms = (now.tv_usec + now.tv_sec * 1000 * 1000 - before) / 1000.0;
+
+            // (the FPGA already searched the rest)
+            bool search_rest = !fpga_seeded && (stereoConfig.predictedRegionBudgetMs <= 0 || skipped_rest
+                || elapsed_ms + last_rest_ms < stereoConfig.predictedRegionBudgetMs);
+
+            bool got_predicted = pushbroom_stereo.PollPredicted(&stereo_buffers, stereoConfig.calibrationUnitConversion, true, search_rest);
+
+            if (!fpga_seeded) {
+                skipped_rest = got_predicted && !search_rest;
+            }
 
             gettimeofday( &now, NULL );
-            double before = now.tv_usec + now.tv_sec * 1000 * 1000;
+            double rest_start = now.tv_usec + now.tv_sec * 1000 * 1000;
 
-            pushbroom_stereo.ProcessImages(matL, matR, &pointVector3d, &pointColors, &pointVector2d, state);
+            pushbroom_stereo.Poll(&stereo_buffers, stereoConfig.calibrationUnitConversion, true);
+
+            // the FPGA's hits already cover the far obstacles
+            if (pyramid_stereo != NULL && !fpga_seeded) {
+                pyramid_stereo->ProcessImages(matL, matR, &pushbroom_stereo, state, &stereo_buffers, stereoConfig.calibrationUnitConversion);
+            }
 
             gettimeofday( &now, NULL );
             double after = now.tv_usec + now.tv_sec * 1000 * 1000;
 
+            if (got_predicted && search_rest) {
+                last_rest_ms = (after - rest_start) / 1000.0;
+            }
+
             timer_sum += after-before;
             timer_count ++;
 
+        } else {
+            stereo_buffers.number_of_points = 0;
+            stereo_buffers.image_hits.clear();
+            stereo_buffers.pointVector2d.clear();
         }
 
         // build an LCM message for the stereo data
@@ -507,7 +990,7 @@ int main(int argc, char *argv[])
 
 
         if (recording_manager.UsingLiveCameras() || stereo_lcm_msg == NULL) {
-            msg.timestamp = getTimestampNow();
+            msg.timestamp = GetWallNow();
         } else {
             // if we are replaying videos, preserve the timestamp of the original video
             msg.timestamp = stereo_lcm_msg->timestamp;
@@ -515,25 +998,13 @@ int main(int argc, char *argv[])
         }
 
 
-        msg.number_of_points = (int)pointVector3d.size();
-
-        float x[msg.number_of_points];
-        float y[msg.number_of_points];
-        float z[msg.number_of_points];
-        uchar grey[msg.number_of_points];
+        // already converted by calibrationUnitConversion
+        msg.number_of_points = stereo_buffers.number_of_points;
 
-        for (unsigned int i=0;i<pointVector3d.size();i++) {
-
-            x[i] = pointVector3d[i].x / stereoConfig.calibrationUnitConversion;
-            y[i] = pointVector3d[i].y / stereoConfig.calibrationUnitConversion;
-            z[i] = pointVector3d[i].z / stereoConfig.calibrationUnitConversion;
-            grey[i] = pointColors[i];
-        }
-
-        msg.x = x;
-        msg.y = y;
-        msg.z = z;
-        msg.grey = grey;
+        msg.x = stereo_buffers.x.data();
+        msg.y = stereo_buffers.y.data();
+        msg.z = stereo_buffers.z.data();
+        msg.grey = stereo_buffers.grey.data();
         msg.frame_number = recording_manager.GetFrameNumber();
 
         if (recording_manager.UsingLiveCameras()) {
@@ -546,16 +1017,68 @@ int main(int argc, char *argv[])
 
         msg.video_number = recording_manager.GetRecVideoNumber();
 
+        for (size_t i = 0; i < extra_pairs.size(); i++) {
+            extra_pairs[i]->Finish(msg.timestamp, msg.frame_number, msg.video_number, stereoConfig.calibrationUnitConversion);
+        }
+
+        if (region_predictor != NULL && run_stereo) {
+            region_predictor->AddHits(msg.timestamp, stereo_buffers);
+        }
+
+        if (fpga_seeded) {
+            fpga_seeds->AddFrame(msg.number_of_points);
+        }
+
+        if (run_stereo && stereoConfig.triggerHits > 0 && msg.number_of_points >= stereoConfig.triggerHits) {
+            // something's in front of us, so keep the full-rate video
+            recording_manager.Trigger();
+        }
+
+        if (stereoConfig.recordMetadata && recording_manager.UsingLiveCameras()) {
+            RecordFrameMetadata(msg, state, run_stereo, frame_left, frame_right);
+        }
+
         // publish the LCM message
-        if (last_frame_number != msg.frame_number) {
-            lcmt_stereo_publish(lcm, "stereo", &msg);
+        if (last_frame_number != msg.frame_number && !rate_skipped) {
+#ifdef STEREO_WITH_STATE_MACHINE
+            // into the map before anything goes out on LCM
+            if (fsm_stereo_queue != NULL) {
+                fsm_stereo_queue->Push(msg.timestamp, msg.frame_number, msg.video_number, msg.number_of_points,
+                    msg.x, msg.y, msg.z, msg.grey);
+            }
+#endif
+
+            stereo_publisher->Publish(&msg, &stereo_buffers.image_hits);
             last_frame_number = msg.frame_number;
+
+            if (run_stereo && state.deadline_us > 0 && stereoConfig.stereo_coverage_channel.length() > 0) {
+                PublishStereoCoverage(lcm, stereoConfig.stereo_coverage_channel.c_str(), &pushbroom_stereo, state,
+                    msg.timestamp, msg.frame_number, msg.video_number);
+            }
+
+            // with a dead camera, the other one's alarms go out instead
+            // of stereo
+            int camera_mode = camera_health.GetMode();
+
+            if (camera_mode != CAMERA_MODE_STEREO && stereoConfig.mono_alarm_channel.length() > 0) {
+                int mono_camera = -1;
+
+                if (camera_mode == CAMERA_MODE_MONO_LEFT) {
+                    mono_detector.ProcessImage(matL, state.mapxL, state, &mono_alarms);
+                    mono_camera = 0;
+                } else if (camera_mode == CAMERA_MODE_MONO_RIGHT) {
+                    mono_detector.ProcessImage(matR, state.mapxR, state, &mono_alarms);
+                    mono_camera = 1;
+                }
+
+                PublishMonoAlarms(lcm, stereoConfig.mono_alarm_channel.c_str(), mono_camera,
+                    mono_camera >= 0 ? &mono_alarms : NULL, msg.timestamp, msg.frame_number, msg.video_number);
+            }
         }
 
         if (publish_all_images) {
             if (recording_manager.GetFrameNumber() != last_playback_frame_number) {
-                SendImageOverLcm(lcm, "stereo_image_left", matL, 80);
-                SendImageOverLcm(lcm, "stereo_image_right", matR, 80);
+                image_streamer->SendImages(matL, matR);
 
                 last_playback_frame_number = recording_manager.GetFrameNumber();
             }
@@ -565,18 +1088,20 @@ int main(int argc, char *argv[])
             while (NonBlockingLcm(lcm)) {}
         }
 
-        Mat matDisp, remapL, remapR;
+        Mat matDisp, remapL, remapR, laplacianL, laplacianR;
 
         if (show_display) {
-            // we remap again here because we're just in display
-            Mat remapLtemp(matL.rows, matL.cols, matL.depth());
-            Mat remapRtemp(matR.rows, matR.cols, matR.depth());
+            if (run_stereo) {
+                // stereo already rectified them (state.keep_rectified)
+                remapL = stereo_buffers.remapped_left;
+                remapR = stereo_buffers.remapped_right;
 
-            remapL = remapLtemp;
-            remapR = remapRtemp;
-
-            remap(matL, remapL, stereoCalibration.mx1fp, Mat(), INTER_NEAREST);
-            remap(matR, remapR, stereoCalibration.mx2fp, Mat(), INTER_NEAREST);
+                laplacianL = stereo_buffers.laplacian_left;
+                laplacianR = stereo_buffers.laplacian_right;
+            } else {
+                remap(matL, remapL, stereoCalibration.mx1fp, Mat(), INTER_NEAREST);
+                remap(matR, remapR, stereoCalibration.mx2fp, Mat(), INTER_NEAREST);
+            }
 
             remapL.copyTo(matDisp);
 
@@ -599,7 +1124,7 @@ int main(int argc, char *argv[])
 
             // draw pixel blocks
             if (lineLeftImgPosition >= 0 && lineLeftImgPositionY > 1) {
-                DisplayPixelBlocks(remapL, remapR, lineLeftImgPosition - state.blockSize/2, lineLeftImgPositionY - state.blockSize/2, state, &pushbroom_stereo);
+                DisplayPixelBlocks(remapL, remapR, laplacianL, laplacianR, lineLeftImgPosition - state.blockSize/2, lineLeftImgPositionY - state.blockSize/2, state, &pushbroom_stereo);
             }
 
             // draw a line for the user to show disparity
@@ -633,6 +1158,11 @@ int main(int argc, char *argv[])
 
                 recording_manager.SetHudNumbers(&hud);
 
+                if (record_hud) {
+                    // draw straight into the encoder's buffer
+                    recording_manager.GetHudFrameBuffer(&with_hud);
+                }
+
                 hud.DrawHud(matDisp, with_hud);
 
                 if (record_hud) {
@@ -708,35 +1238,35 @@ int main(int argc, char *argv[])
 
                 case 'm':
                     if (recording_manager.UsingLiveCameras()) {
-                        MatchBrightnessSettings(camera, camera2, true, force_brightness, force_exposure);
+                        exposure_controller->RequestCompleteSet(force_brightness, force_exposure);
                     }
                     break;
 
                 case '1':
                     force_brightness --;
                     if (recording_manager.UsingLiveCameras()) {
-                        MatchBrightnessSettings(camera, camera2, true, force_brightness, force_exposure);
+                        exposure_controller->RequestCompleteSet(force_brightness, force_exposure);
                     }
                     break;
 
                 case '2':
                     force_brightness ++;
                     if (recording_manager.UsingLiveCameras()) {
-                        MatchBrightnessSettings(camera, camera2, true, force_brightness, force_exposure);
+                        exposure_controller->RequestCompleteSet(force_brightness, force_exposure);
                     }
                     break;
 
                 case '3':
                     force_exposure --;
                     if (recording_manager.UsingLiveCameras()) {
-                        MatchBrightnessSettings(camera, camera2, true, force_brightness, force_exposure);
+                        exposure_controller->RequestCompleteSet(force_brightness, force_exposure);
                     }
                     break;
 
                 case '4':
                     force_exposure ++;
                     if (recording_manager.UsingLiveCameras()) {
-                        MatchBrightnessSettings(camera, camera2, true, force_brightness, force_exposure);
+                        exposure_controller->RequestCompleteSet(force_brightness, force_exposure);
                     }
                     break;
 
@@ -750,6 +1280,10 @@ int main(int argc, char *argv[])
                     state.check_horizontal_invariance = !state.check_horizontal_invariance;
                     break;
 
+                case 'F':
+                    state.fused_pipeline = !state.fused_pipeline;
+                    break;
+
                 case '.':
                     recording_manager.SetPlaybackFrameNumber(recording_manager.GetFrameNumber() + 1);
                     break;
@@ -873,6 +1407,7 @@ int main(int argc, char *argv[])
                 cout << "inf_disparity = " << state.zero_dist_disparity << endl;
                 cout << "inf_sad_add = " << inf_sad_add << endl;
                 cout << "blockSize = " << state.blockSize << endl;
+                cout << "fused_pipeline = " << state.fused_pipeline << endl;
                 cout << "frame_number = " << recording_manager.GetFrameNumber() << endl;
                 cout << "y offset = " << y_offset << endl;
                 cout << "PitchRangeOfLens = " << hud.GetPitchRangeOfLens() << endl;
@@ -881,6 +1416,17 @@ int main(int argc, char *argv[])
 
         numFrames ++;
 
+        if (stereoConfig.stereo_timing_channel.length() > 0
+            && numFrames % PUBLISH_TIMING_EVERY_N_FRAMES == 0) {
+
+            PublishStereoTiming(lcm, stereoConfig.stereo_timing_channel.c_str(), &pushbroom_stereo, PUBLISH_TIMING_EVERY_N_FRAMES);
+        }
+
+        if (stereoConfig.memory_stats_channel.length() > 0 && GetMonotonicNow() >= next_memory_stats) {
+            memory_stats.Publish(lcm, stereoConfig.memory_stats_channel.c_str());
+            next_memory_stats = GetMonotonicNow() + PUBLISH_MEMORY_STATS_EVERY_USEC;
+        }
+
         // check for new LCM messages
         NonBlockingLcm(lcm);
 
@@ -892,6 +1438,37 @@ int main(int argc, char *argv[])
             (start.tv_usec / 1000 + start.tv_sec * 1000);
 
             printf("\r%d frames (%lu ms) - %4.1f fps | %4.1f ms/frame, stereo: %f", numFrames, elapsed, (float)numFrames/elapsed * 1000, elapsed/(float)numFrames, timer_sum/(double)timer_count);
+
+            if (state.temporal_skip) {
+                int blocks_searched, blocks_skipped;
+                pushbroom_stereo.GetBlockCounts(&blocks_searched, &blocks_skipped);
+
+                printf(" | skipped %d of %d blocks", blocks_skipped, blocks_searched + blocks_skipped);
+            }
+
+            if (stereo_capture != NULL) {
+                printf(" | dropped %d camera frames", stereo_capture->GetNumDropped());
+            }
+
+            if (camera_health.GetMode() != CAMERA_MODE_STEREO) {
+                printf(" | %s", CameraHealthMonitor::GetModeName(camera_health.GetMode()));
+            }
+
+            if (stereoConfig.streamRecording && recording_manager.UsingLiveCameras()) {
+                printf(" | recording dropped %d frames", recording_manager.GetNumDroppedFrames());
+            }
+
+            if (image_streamer != NULL) {
+                printf(" | streamed %d image pairs, dropped %d", image_streamer->GetNumSent(), image_streamer->GetNumDropped());
+            }
+
+            if (playback_synchronizer != NULL) {
+                printf(" | log frame %d/%d", playback_synchronizer->GetFrameIndex(), playback_synchronizer->GetNumFrames());
+            }
+
+            if (fpga_seeds != NULL) {
+                printf(" | %ld hits around %ld FPGA hits", (long)fpga_seeds->GetNumConfirmed(), (long)fpga_seeds->GetNumSeeds());
+            }
             fflush(stdout);
         }
 
@@ -904,8 +1481,45 @@ int main(int argc, char *argv[])
     destroyWindow("Input2");
     destroyWindow("Stereo");
 
+    delete stereo_publisher;
+    stereo_publisher = NULL;
+
+    delete image_streamer;
+    image_streamer = NULL;
+
+    delete region_predictor;
+    region_predictor = NULL;
+
+    delete adaptive_rate;
+    adaptive_rate = NULL;
+
+    delete fpga_seeds;
+    fpga_seeds = NULL;
+
+    delete pyramid_stereo;
+    pyramid_stereo = NULL;
+
+    if (playback_synchronizer != NULL) {
+        delete playback_synchronizer;
+        playback_synchronizer = NULL;
+
+        lcm_destroy(lcm_input);
+    }
+
     // close camera
     if (recording_manager.UsingLiveCameras()) {
+        delete exposure_controller;
+        exposure_controller = NULL;
+
+        delete stereo_capture;
+        stereo_capture = NULL;
+
+        for (size_t i = 0; i < extra_pairs.size(); i++) {
+            delete extra_pairs[i];
+        }
+
+        extra_pairs.clear();
+
         StopCapture(d, camera);
         StopCapture(d2, camera2);
     }
@@ -1030,13 +1644,15 @@ Mat WriteDisparityMap(cv::vector<Point3i> *pointVector2d, PushbroomStereoState s
  *
  * @param left_image the left image
  * @param right_image the right image
+ * @param laplacian_left laplacian of the left image, or empty to compute it
+ * @param laplacian_right laplacian of the right image, or empty to compute it
  * @param left left coordinate of the box
  * @param top top coordinate of the box
  * @param state PushbroomStereoState containing stereo information
  * @param pushbroom_stereo stereo object so we can run GetSAD
  *
  */
-void DisplayPixelBlocks(Mat left_image, Mat right_image, int left, int top, PushbroomStereoState state, PushbroomStereo *pushbroom_stereo) {
+void DisplayPixelBlocks(Mat left_image, Mat right_image, Mat laplacian_left, Mat laplacian_right, int left, int top, PushbroomStereoState state, PushbroomStereo *pushbroom_stereo) {
     if (left + state.blockSize > left_image.cols || top+state.blockSize > left_image.rows
         || left + state.blockSize > right_image.cols || top+state.blockSize > right_image.rows
         || left + state.disparity < 0) { // remember, disparity can be negative
@@ -1050,11 +1666,15 @@ void DisplayPixelBlocks(Mat left_image, Mat right_image, int left, int top, Push
     Mat right_block = right_image.rowRange(top, top+state.blockSize).colRange(left+state.disparity, left+state.disparity+state.blockSize);
 
 
-    Mat laplacian_left;
-    Laplacian(left_image, laplacian_left, -1, 3, 1, 0, BORDER_DEFAULT);
+    if (laplacian_left.empty()) {
+        laplacian_left.create(left_image.size(), left_image.type());
+        PushbroomStereo::InterestOperator(left_image, 0, left_image.rows, Range(0, left_image.cols), laplacian_left, state.interest_operator);
+    }
 
-    Mat laplacian_right;
-    Laplacian(right_image, laplacian_right, -1, 3, 1, 0, BORDER_DEFAULT);
+    if (laplacian_right.empty()) {
+        laplacian_right.create(right_image.size(), right_image.type());
+        PushbroomStereo::InterestOperator(right_image, 0, right_image.rows, Range(0, right_image.cols), laplacian_right, state.interest_operator);
+    }
 
     // compute stats about block
     int left_interest, right_interest, raw_sad;
@@ -1112,6 +1732,10 @@ void baro_airspeed_handler(const lcm_recv_buf_t *rbuf, const char* channel, cons
     Hud *hud = (Hud*)user;
 
     hud->SetAirspeed(msg->airspeed);
+
+    if (adaptive_rate != NULL) {
+        adaptive_rate->SetAirspeed(msg->utime, msg->airspeed);
+    }
 }
 
 void battery_status_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_battery_status *msg, void *user) {
@@ -1147,6 +1771,12 @@ void log_size_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcm
     hud->SetLogNumber(msg->log_number);
 }
 
+void fpga_hits_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo *msg, void *user) {
+    if (fpga_seeds != NULL) {
+        fpga_seeds->SetHits(msg);
+    }
+}
+
 void mav_pose_t_handler(const lcm_recv_buf_t *rbuf, const char* channel, const mav_pose_t *msg, void *user) {
     Hud *hud = (Hud*)user;
 
@@ -1156,6 +1786,76 @@ void mav_pose_t_handler(const lcm_recv_buf_t *rbuf, const char* channel, const m
     hud->SetAirspeed(msg->vel[0]);
 
     hud->SetTimestamp(msg->utime);
+
+    if (region_predictor != NULL) {
+        region_predictor->SetPose(msg);
+    }
+
+    last_pose = *msg;
+    have_last_pose = true;
+}
+
+/**
+ * Sends a frame's metadata to the recording's .meta file.
+ *
+ * @param msg the frame's stereo message
+ * @param state stereo parameters the frame was searched with
+ * @param stereo_ran false if stereo didn't run on the frame
+ * @param frame_left left camera frame
+ * @param frame_right right camera frame
+ */
+void RecordFrameMetadata(const lcmt_stereo &msg, const PushbroomStereoState &state, bool stereo_ran,
+    const Format7Frame &frame_left, const Format7Frame &frame_right) {
+
+    RecordingFrameMetadata metadata;
+    memset(&metadata, 0, sizeof(metadata));
+
+    metadata.frame_number = msg.frame_number;
+    metadata.timestamp = msg.timestamp;
+
+    metadata.capture_timestamp[0] = frame_left.timestamp;
+    metadata.capture_timestamp[1] = frame_right.timestamp;
+    metadata.frames_behind[0] = frame_left.frames_behind;
+    metadata.frames_behind[1] = frame_right.frames_behind;
+
+    if (exposure_controller != NULL) {
+        metadata.shutter = exposure_controller->GetShutter();
+        metadata.gain = exposure_controller->GetGain();
+    }
+
+    metadata.stereo_ran = stereo_ran;
+    metadata.disparity = state.disparity;
+    metadata.num_disparities = state.num_disparities;
+    metadata.zero_dist_disparity = state.zero_dist_disparity;
+    metadata.sobel_limit = state.sobelLimit;
+    metadata.block_size = state.blockSize;
+    metadata.sad_threshold = state.sadThreshold;
+    metadata.horizontal_invariance_multiplier = state.horizontalInvarianceMultiplier;
+    metadata.census_matching = state.census_matching;
+    metadata.census_threshold = state.census_threshold;
+    metadata.roi[0] = state.roi_top;
+    metadata.roi[1] = state.roi_bottom;
+    metadata.roi[2] = state.roi_left;
+    metadata.roi[3] = state.roi_right;
+    metadata.deadline_us = state.deadline_us;
+
+    metadata.number_of_points = msg.number_of_points;
+
+    if (have_last_pose) {
+        metadata.pose_utime = last_pose.utime;
+
+        for (int i = 0; i < 3; i++) {
+            metadata.pos[i] = last_pose.pos[i];
+            metadata.vel[i] = last_pose.vel[i];
+            metadata.rotation_rate[i] = last_pose.rotation_rate[i];
+        }
+
+        for (int i = 0; i < 4; i++) {
+            metadata.orientation[i] = last_pose.orientation[i];
+        }
+    }
+
+    recording_manager.AddFrameMetadata(metadata);
 }
 
 void cpu_info_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_cpu_info *msg, void *user) {
@@ -1171,6 +1871,156 @@ void cpu_info_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcm
     rec_m->SetHostname(hostname);
 }
 
+/**
+ * Publishes the per-stage and per-thread stereo timing since the last call
+ * and starts a new window.
+ *
+ * @param lcm lcm object to publish with
+ * @param channel channel to publish on
+ * @param pushbroom_stereo stereo object to read the timing from
+ * @param num_frames number of frames since the last call
+ */
+void PublishStereoTiming(lcm_t *lcm, const char *channel, PushbroomStereo *pushbroom_stereo, int num_frames) {
+    int num_threads = pushbroom_stereo->GetNumThreads() + 1;
+
+    char *stage_names[NUM_STAGES];
+    int32_t stage_counts[NUM_STAGES];
+    float stage_p50_ms[NUM_STAGES], stage_p99_ms[NUM_STAGES], stage_max_ms[NUM_STAGES];
+    float thread_p50_ms[MAX_THREADS+1], thread_p99_ms[MAX_THREADS+1], thread_max_ms[MAX_THREADS+1];
+
+    for (int i = 0; i < NUM_STAGES; i++) {
+        PushbroomStereoTiming timing;
+        pushbroom_stereo->GetStageTiming(i, &timing);
+
+        stage_names[i] = (char*) PushbroomStereo::GetStageName(i);
+        stage_counts[i] = timing.count;
+        stage_p50_ms[i] = timing.p50_ms;
+        stage_p99_ms[i] = timing.p99_ms;
+        stage_max_ms[i] = timing.max_ms;
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        PushbroomStereoTiming timing;
+        pushbroom_stereo->GetThreadTiming(i, &timing);
+
+        thread_p50_ms[i] = timing.p50_ms;
+        thread_p99_ms[i] = timing.p99_ms;
+        thread_max_ms[i] = timing.max_ms;
+    }
+
+    lcmt_stereo_timing msg;
+    msg.timestamp = GetWallNow();
+    msg.num_frames = num_frames;
+
+    msg.num_stages = NUM_STAGES;
+    msg.stage_names = stage_names;
+    msg.stage_counts = stage_counts;
+    msg.stage_p50_ms = stage_p50_ms;
+    msg.stage_p99_ms = stage_p99_ms;
+    msg.stage_max_ms = stage_max_ms;
+
+    msg.num_threads = num_threads;
+    msg.thread_p50_ms = thread_p50_ms;
+    msg.thread_p99_ms = thread_p99_ms;
+    msg.thread_max_ms = thread_max_ms;
+
+    lcmt_stereo_timing_publish(lcm, channel, &msg);
+
+    pushbroom_stereo->ResetTiming();
+}
+
+/**
+ * Publishes one camera's obstacle alarms.
+ *
+ * @param lcm lcm object to publish with
+ * @param channel channel to publish on
+ * @param camera camera the alarms are from (0 for left, 1 for right), or
+ *      -1 if both cameras are dead
+ * @param alarms the alarms, or NULL if camera is -1
+ * @param timestamp timestamp of the frame
+ * @param frame_number frame number of the frame
+ * @param video_number video number of the frame
+ */
+void PublishMonoAlarms(lcm_t *lcm, const char *channel, int camera, const MonoObstacleAlarms *alarms, int64_t timestamp, int frame_number, int video_number) {
+
+    lcmt_mono_alarm msg;
+    msg.timestamp = timestamp;
+    msg.frame_number = frame_number;
+    msg.video_number = video_number;
+    msg.camera = camera;
+
+    msg.grid_rows = MONO_GRID_ROWS;
+    msg.grid_cols = MONO_GRID_COLS;
+
+    if (alarms == NULL || alarms->texture.size() == 0) {
+        msg.roi_top = msg.roi_bottom = msg.roi_left = msg.roi_right = 0;
+        msg.num_cells = 0;
+        msg.texture = NULL;
+        msg.flow = NULL;
+        msg.alarm = NULL;
+        msg.num_alarms = 0;
+    } else {
+        msg.roi_top = alarms->roi_top;
+        msg.roi_bottom = alarms->roi_bottom;
+        msg.roi_left = alarms->roi_left;
+        msg.roi_right = alarms->roi_right;
+
+        msg.num_cells = alarms->texture.size();
+        msg.texture = (float*) alarms->texture.data();
+        msg.flow = (float*) alarms->flow.data();
+        msg.alarm = (int8_t*) alarms->alarm.data();
+        msg.num_alarms = alarms->num_alarms;
+    }
+
+    lcmt_mono_alarm_publish(lcm, channel, &msg);
+}
+
+/**
+ * Publishes which rows the last frame's stereo covered, and how well.
+ *
+ * @param lcm lcm object to publish with
+ * @param channel channel to publish on
+ * @param pushbroom_stereo stereo object that ran the frame
+ * @param state stereo state the frame ran with
+ * @param timestamp timestamp of the frame
+ * @param frame_number frame number of the frame
+ * @param video_number video number of the frame
+ */
+void PublishStereoCoverage(lcm_t *lcm, const char *channel, PushbroomStereo *pushbroom_stereo, const PushbroomStereoState &state, int64_t timestamp, int frame_number, int video_number) {
+
+    // kept from frame to frame so publishing doesn't allocate
+    static cv::vector<PushbroomStereoCoverage> coverage;
+    static cv::vector<int32_t> row_start, row_end;
+    static cv::vector<int8_t> quality;
+
+    pushbroom_stereo->GetCoverage(&coverage);
+
+    int num_bands = coverage.size();
+
+    row_start.resize(num_bands);
+    row_end.resize(num_bands);
+    quality.resize(num_bands);
+
+    for (int i = 0; i < num_bands; i++) {
+        row_start[i] = coverage[i].row_start;
+        row_end[i] = coverage[i].row_end;
+        quality[i] = coverage[i].quality;
+    }
+
+    lcmt_stereo_coverage msg;
+    msg.timestamp = timestamp;
+    msg.frame_number = frame_number;
+    msg.video_number = video_number;
+    msg.deadline_ms = state.deadline_us / 1000.0f;
+
+    msg.num_bands = num_bands;
+    msg.row_start = row_start.data();
+    msg.row_end = row_end.data();
+    msg.quality = quality.data();
+
+    lcmt_stereo_coverage_publish(lcm, channel, &msg);
+}
+
 
 # if 0
 /**
@@ -1252,3 +2102,17 @@ bool ResetPointGreyCameras()
 
 }
 #endif
+
+void trace_request_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_trace_request *msg, void *user) {
+    TraceHandleRequest(msg->process_name, msg->dir);
+}
+
+/**
+ * The state machine sends its state when it changes, so every message
+ * triggers a recording window.
+ */
+void state_machine_state_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_debug *msg, void *user) {
+    cout << endl << "State machine: " << msg->debug << ", recording triggered." << endl;
+
+    recording_manager.Trigger();
+}
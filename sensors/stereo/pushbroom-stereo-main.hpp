@@ -33,6 +33,11 @@
 #include "../../LCM/mav_pose_t.h"
 #include "../../LCM/lcmt_cpu_info.h"
 #include "../../LCM/lcmt_log_size.h"
+#include "../../LCM/lcmt_stereo_timing.h"
+#include "../../LCM/lcmt_mono_alarm.h"
+#include "../../LCM/lcmt_stereo_coverage.h"
+#include "../../LCM/lcmt_trace_request.h"
+#include "../../LCM/lcmt_debug.h"
 
 #include "../../LCM/lcmt_stereo_control.h"
 
@@ -53,6 +58,24 @@
 #include "pushbroom-stereo.hpp"
 #include "../../ui/hud/hud.hpp"
 #include "RecordingManager.hpp"
+#include "StereoCapture.hpp"
+#include "ExposureController.hpp"
+#include "CameraHealthMonitor.hpp"
+#include "MonoObstacleDetector.hpp"
+#include "StereoPublisher.hpp"
+#include "ImageStreamer.hpp"
+#include "PlaybackSynchronizer.hpp"
+#include "SearchRegionPredictor.hpp"
+#include "PyramidStereo.hpp"
+#include "AdaptiveFrameRate.hpp"
+#include "StereoPair.hpp"
+#include "FpgaHitSeeds.hpp"
+#include "../../utils/utils/Trace.hpp"
+
+#ifdef STEREO_WITH_STATE_MACHINE
+#include "../../controllers/state-machine/StateMachineProcess.hpp"
+#include <thread>
+#endif
 
 using namespace std;
 using namespace cv;
@@ -81,6 +104,10 @@ using namespace cv;
 #define USE_IMAGE 0 // set to 1 to use left.jpg and right.jpg as test images
 
 #define MATCH_BRIGHTNESS_EVERY_N_FRAMES 10
+#define MATCH_BRIGHTNESS_EVERY_N_FRAMES_CENSUS 100
+
+#define PUBLISH_TIMING_EVERY_N_FRAMES 100
+#define PUBLISH_MEMORY_STATS_EVERY_USEC 1000000
 
 struct RemapState
 {
@@ -101,12 +128,14 @@ void onMouse( int event, int x, int y, int, void* );
 void onMouseStereo( int event, int x, int y, int, void* hud);
 void DrawLines(Mat leftImg, Mat rightImg, Mat stereoImg, int lineX, int lineY, int disparity, int inf_disparity);
 
-void DisplayPixelBlocks(Mat left_image, Mat right_image, int left, int top, PushbroomStereoState state, PushbroomStereo *barry_moore_stereo);
+void DisplayPixelBlocks(Mat left_image, Mat right_image, Mat laplacian_left, Mat laplacian_right, int left, int top, PushbroomStereoState state, PushbroomStereo *barry_moore_stereo);
 
 Mat WriteDisparityMap(cv::vector<Point3i> *pointVector2d, PushbroomStereoState state, int pixel_value = 128, Mat existing_map = Mat::zeros(240, 376, CV_8UC1));
 
 void stereo_replay_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo *msg, void *user);
 
+void fpga_hits_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo *msg, void *user);
+
 void baro_airspeed_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_baro_airspeed *msg, void *user);
 
 void battery_status_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_battery_status *msg, void *user);
@@ -117,8 +146,21 @@ void mav_gps_data_t_handler(const lcm_recv_buf_t *rbuf, const char* channel, con
 
 void mav_pose_t_handler(const lcm_recv_buf_t *rbuf, const char* channel, const mav_pose_t *msg, void *user);
 
+void RecordFrameMetadata(const lcmt_stereo &msg, const PushbroomStereoState &state, bool stereo_ran,
+    const Format7Frame &frame_left, const Format7Frame &frame_right);
+
 void cpu_info_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_cpu_info *msg, void *user);
 
 void log_size_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_log_size *msg, void *user);
 
+void trace_request_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_trace_request *msg, void *user);
+
+void state_machine_state_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_debug *msg, void *user);
+
+void PublishStereoTiming(lcm_t *lcm, const char *channel, PushbroomStereo *pushbroom_stereo, int num_frames);
+
+void PublishMonoAlarms(lcm_t *lcm, const char *channel, int camera, const MonoObstacleAlarms *alarms, int64_t timestamp, int frame_number, int video_number);
+
+void PublishStereoCoverage(lcm_t *lcm, const char *channel, PushbroomStereo *pushbroom_stereo, const PushbroomStereoState &state, int64_t timestamp, int frame_number, int video_number);
+
 #endif
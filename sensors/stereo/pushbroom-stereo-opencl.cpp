@@ -0,0 +1,784 @@
+/**
+ * OpenCL (GPU) backend for pushbroom stereo.
+ *
+ * The camera images, remap maps, mask and hit list are allocated with
+ * CL_MEM_ALLOC_HOST_PTR and mapped to read and write them, so on a GPU
+ * that shares memory with the CPU (like the Mali on the Odroids) nothing
+ * gets copied to or from the device.  The remapped images and laplacians
+ * never leave the GPU.
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#include "pushbroom-stereo-opencl.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+/**
+ * Checks if the GPU version does everything a frame asks for.
+ *
+ * @param state stereo parameters for the frame
+ *
+ * @retval true if the frame can run on the GPU
+ */
+bool PushbroomStereoOpenCL::Supports(const PushbroomStereoState &state) {
+    return state.num_disparities <= 0
+        && !state.subpixel_refinement
+        && !state.census_matching
+        && state.interest_operator == INTEREST_OP_LAPLACIAN
+        && state.random_results < 0
+        && state.mapxL.type() == CV_16SC2
+        && state.mapxR.type() == CV_16SC2
+        && state.mapxL.size() == state.mapxR.size()
+        && (state.roi_mask.empty() || state.roi_mask.size() == state.mapxL.size());
+}
+
+#ifdef USE_OPENCL
+
+#include <CL/cl.h>
+
+// same as PushbroomStereo, one work item per pixel for remap and the
+// interest operator and one per block for stereo
+static const char *kernel_source = R"CLC(
+
+// cv::BORDER_REFLECT_101
+int Reflect101(int i, int n)
+{
+    if (n == 1) {
+        return 0;
+    } else if (i < 0) {
+        return -i;
+    } else if (i >= n) {
+        return 2 * n - 2 - i;
+    }
+
+    return i;
+}
+
+// cv::remap with INTER_NEAREST and a constant (0) border, for a CV_16SC2 map
+__kernel void RemapNearest(__global const uchar *image, int image_rows, int image_cols,
+    __global const short *map, int rows, int cols, __global uchar *remapped)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+
+    if (x >= cols || y >= rows) {
+        return;
+    }
+
+    int map_x = map[2 * (y * cols + x)];
+    int map_y = map[2 * (y * cols + x) + 1];
+
+    uchar value = 0;
+
+    if (map_x >= 0 && map_y >= 0 && map_x < image_cols && map_y < image_rows) {
+        value = image[map_y * image_cols + map_x];
+    }
+
+    remapped[y * cols + x] = value;
+}
+
+// cv::Laplacian with ksize = 3 (which is [2 0 2; 0 -8 0; 2 0 2]) and
+// BORDER_DEFAULT, saturated to uchar
+__kernel void Laplacian3(__global const uchar *image, int rows, int cols, __global uchar *laplacian)
+{
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+
+    if (x >= cols || y >= rows) {
+        return;
+    }
+
+    int up = Reflect101(y - 1, rows) * cols;
+    int down = Reflect101(y + 1, rows) * cols;
+    int left = Reflect101(x - 1, cols);
+    int right = Reflect101(x + 1, cols);
+
+    int value = 2 * (image[up + left] + image[up + right] + image[down + left] + image[down + right])
+        - 8 * image[y * cols + x];
+
+    laplacian[y * cols + x] = convert_uchar_sat(value);
+}
+
+// see PushbroomStereo::CheckHorizontalInvariance.  Returns 1 if the block
+// also matches around the zero-disparity position (or is too close to the
+// edge to tell), which means it might be a false positive.
+int HorizontalInvarianceMatch(__global const uchar *left, __global const uchar *right,
+    __global const uchar *laplacian_left, __global const uchar *laplacian_right,
+    int rows, int cols, int i, int j, int block_size, int disparity,
+    int sobel_limit, int sad_threshold, float horizontal_invariance_multiplier)
+{
+    if (j + disparity + INVARIANCE_CHECK_HORZ_OFFSET_MIN < 0
+        || j + block_size - 1 + disparity + INVARIANCE_CHECK_HORZ_OFFSET_MAX >= cols
+        || i + INVARIANCE_CHECK_VERT_OFFSET_MIN < 0
+        || i + block_size - 1 + INVARIANCE_CHECK_VERT_OFFSET_MAX >= rows) {
+
+        return 1;
+    }
+
+    int left_interest = 0;
+
+    for (int y = i; y < i + block_size; y++) {
+        for (int x = j; x < j + block_size; x++) {
+            left_interest += laplacian_left[y * cols + x];
+        }
+    }
+
+    for (int vert_offset = INVARIANCE_CHECK_VERT_OFFSET_MIN;
+        vert_offset <= INVARIANCE_CHECK_VERT_OFFSET_MAX;
+        vert_offset += INVARIANCE_CHECK_VERT_OFFSET_INCREMENT) {
+
+        for (int horz_offset = INVARIANCE_CHECK_HORZ_OFFSET_MIN;
+            horz_offset <= INVARIANCE_CHECK_HORZ_OFFSET_MAX;
+            horz_offset++) {
+
+            int shift = vert_offset * cols + disparity + horz_offset;
+
+            int sad = 0;
+            int right_interest = 0;
+
+            for (int y = i; y < i + block_size; y++) {
+                for (int x = j; x < j + block_size; x++) {
+                    int p = y * cols + x;
+
+                    sad += abs(left[p] - right[p + shift]);
+                    right_interest += laplacian_right[p + shift];
+                }
+            }
+
+            if (right_interest >= sobel_limit && NUMERIC_CONST * horizontal_invariance_multiplier
+                * (float)sad / (float)(left_interest + right_interest) < sad_threshold) {
+
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// one block per work item, block (x, y) has its top left corner at
+// (col_start + x * block_size, row_start + y * block_size).  counts[0] is
+// the number of hits and counts[1] the number of blocks that passed the
+// interest operator.  Hits are (column, row, score, left pixel).
+__kernel void StereoBlocks(__global const uchar *left, __global const uchar *right,
+    __global const uchar *laplacian_left, __global const uchar *laplacian_right,
+    int rows, int cols, int row_start, int row_end, int col_start, int col_end,
+    __global const uchar *mask, int use_mask,
+    int block_size, int disparity, int zero_dist_disparity, int sobel_limit,
+    int sad_threshold, float horizontal_invariance_multiplier, int check_horizontal_invariance,
+    __global int *counts, __global int4 *hits)
+{
+    int j = col_start + get_global_id(0) * block_size;
+    int i = row_start + get_global_id(1) * block_size;
+
+    if (j >= col_end || i >= row_end) {
+        return;
+    }
+
+    if (use_mask && mask[i * cols + j] == 0) {
+        return;
+    }
+
+    int sad = 0;
+    int left_interest = 0;
+    int right_interest = 0;
+
+    for (int y = i; y < i + block_size; y++) {
+        for (int x = j; x < j + block_size; x++) {
+            int p = y * cols + x;
+
+            sad += abs(left[p] - right[p + disparity]);
+            left_interest += laplacian_left[p];
+            right_interest += laplacian_right[p + disparity];
+        }
+    }
+
+    if (left_interest < sobel_limit || right_interest < sobel_limit) {
+        return;
+    }
+
+    atomic_inc(&counts[1]);
+
+    // a score of 0 / 0 is never a hit on the CPU either
+    if (left_interest + right_interest == 0) {
+        return;
+    }
+
+    int score = (int)(NUMERIC_CONST * (float)sad / (float)(left_interest + right_interest));
+
+    if (score >= sad_threshold) {
+        return;
+    }
+
+    if (check_horizontal_invariance && HorizontalInvarianceMatch(left, right, laplacian_left,
+        laplacian_right, rows, cols, i, j, block_size, zero_dist_disparity, sobel_limit,
+        sad_threshold, horizontal_invariance_multiplier)) {
+
+        return;
+    }
+
+    int hit = atomic_inc(&counts[0]);
+
+    hits[hit] = (int4)(j, i, score, left[i * cols + j]);
+}
+
+)CLC";
+
+// commands in a frame, in queue order, for timing
+enum { EVENT_REMAP_LEFT, EVENT_REMAP_RIGHT, EVENT_LAPLACIAN_LEFT, EVENT_LAPLACIAN_RIGHT, EVENT_STEREO, NUM_EVENTS };
+
+// a hit as the stereo kernel writes it (an int4)
+struct PushbroomStereoOpenCLHit {
+    cl_int x;
+    cl_int y;
+    cl_int score;
+    cl_int grey;
+};
+
+struct PushbroomStereoOpenCLContext {
+    cl_context context;
+    cl_command_queue queue;
+    cl_program program;
+
+    cl_kernel remap_kernel;
+    cl_kernel laplacian_kernel;
+    cl_kernel stereo_kernel;
+
+    // host-visible
+    cl_mem image_left;
+    cl_mem image_right;
+    cl_mem map_left;
+    cl_mem map_right;
+    cl_mem mask;
+    cl_mem counts;
+    cl_mem hits;
+
+    // GPU only
+    cl_mem remapped_left;
+    cl_mem remapped_right;
+    cl_mem laplacian_left;
+    cl_mem laplacian_right;
+
+    // what the buffers are sized for and filled with
+    int image_rows;
+    int image_cols;
+    int rows;
+    int cols;
+    int max_hits;
+    const uchar *map_left_data;
+    const uchar *map_right_data;
+    const uchar *mask_data;
+
+    // the frame in progress
+    cl_event events[NUM_EVENTS];
+    bool stereo_enqueued;
+    int block_size;
+    int disparity;
+    bool show_display;
+
+    // written to counts at the start of each frame, so it has to
+    // outlive the (non-blocking) write
+    cl_int zero_counts[2];
+
+    // reused from frame to frame for sorting the hits
+    cv::vector<PushbroomStereoOpenCLHit> sorted_hits;
+};
+
+static bool ClOk(cl_int err, const char *what) {
+    if (err != CL_SUCCESS) {
+        fprintf(stderr, "Warning: OpenCL %s failed (error %d).\n", what, err);
+        return false;
+    }
+
+    return true;
+}
+
+static void ReleaseBuffer(cl_mem *buffer) {
+    if (*buffer != NULL) {
+        clReleaseMemObject(*buffer);
+        *buffer = NULL;
+    }
+}
+
+static cl_mem CreateBuffer(cl_context context, cl_mem_flags flags, size_t size) {
+    cl_int err;
+    cl_mem buffer = clCreateBuffer(context, flags, size, NULL, &err);
+
+    ClOk(err, "clCreateBuffer");
+
+    return buffer;
+}
+
+/**
+ * Copies a Mat (which might have padded rows) into a host-visible buffer
+ * with no padding.
+ *
+ * @param queue command queue
+ * @param buffer buffer at least mat.rows * mat.cols * mat.elemSize() bytes
+ * @param mat image or map to copy
+ */
+static void UploadMat(cl_command_queue queue, cl_mem buffer, Mat mat) {
+    size_t row_bytes = mat.cols * mat.elemSize();
+
+    cl_int err;
+    uchar *dst = (uchar*) clEnqueueMapBuffer(queue, buffer, CL_TRUE, CL_MAP_WRITE, 0,
+        mat.rows * row_bytes, 0, NULL, NULL, &err);
+
+    if (!ClOk(err, "clEnqueueMapBuffer")) {
+        return;
+    }
+
+    for (int i = 0; i < mat.rows; i++) {
+        memcpy(dst + i * row_bytes, mat.ptr(i), row_bytes);
+    }
+
+    clEnqueueUnmapMemObject(queue, buffer, dst, 0, NULL, NULL);
+}
+
+static int64_t EventMicroseconds(cl_event start, cl_event end) {
+    cl_ulong start_ns = 0, end_ns = 0;
+
+    clGetEventProfilingInfo(start, CL_PROFILING_COMMAND_START, sizeof(start_ns), &start_ns, NULL);
+    clGetEventProfilingInfo(end, CL_PROFILING_COMMAND_END, sizeof(end_ns), &end_ns, NULL);
+
+    return end_ns > start_ns ? (end_ns - start_ns) / 1000 : 0;
+}
+
+static bool HitBefore(const PushbroomStereoOpenCLHit &a, const PushbroomStereoOpenCLHit &b) {
+    return a.y < b.y || (a.y == b.y && a.x < b.x);
+}
+
+PushbroomStereoOpenCL::PushbroomStereoOpenCL() {
+    cl_ = new PushbroomStereoOpenCLContext();
+
+    memset(cl_->events, 0, sizeof(cl_->events));
+    cl_->zero_counts[0] = 0;
+    cl_->zero_counts[1] = 0;
+}
+
+PushbroomStereoOpenCL::~PushbroomStereoOpenCL() {
+    if (cl_->queue != NULL) {
+        clFinish(cl_->queue);
+    }
+
+    for (int i = 0; i < NUM_EVENTS; i++) {
+        if (cl_->events[i] != NULL) {
+            clReleaseEvent(cl_->events[i]);
+        }
+    }
+
+    cl_mem *buffers[] = { &cl_->image_left, &cl_->image_right, &cl_->map_left, &cl_->map_right,
+        &cl_->mask, &cl_->counts, &cl_->hits, &cl_->remapped_left, &cl_->remapped_right,
+        &cl_->laplacian_left, &cl_->laplacian_right };
+
+    for (unsigned int i = 0; i < sizeof(buffers) / sizeof(buffers[0]); i++) {
+        ReleaseBuffer(buffers[i]);
+    }
+
+    if (cl_->remap_kernel != NULL) {
+        clReleaseKernel(cl_->remap_kernel);
+    }
+
+    if (cl_->laplacian_kernel != NULL) {
+        clReleaseKernel(cl_->laplacian_kernel);
+    }
+
+    if (cl_->stereo_kernel != NULL) {
+        clReleaseKernel(cl_->stereo_kernel);
+    }
+
+    if (cl_->program != NULL) {
+        clReleaseProgram(cl_->program);
+    }
+
+    if (cl_->queue != NULL) {
+        clReleaseCommandQueue(cl_->queue);
+    }
+
+    if (cl_->context != NULL) {
+        clReleaseContext(cl_->context);
+    }
+
+    delete cl_;
+}
+
+/**
+ * Finds a GPU and builds the kernels for it.
+ *
+ * @retval true if the GPU is ready, false (with a warning) if there is no
+ *      usable OpenCL GPU
+ */
+bool PushbroomStereoOpenCL::Init() {
+
+    cl_platform_id platforms[8];
+    cl_uint num_platforms = 0;
+
+    if (clGetPlatformIDs(8, platforms, &num_platforms) != CL_SUCCESS) {
+        num_platforms = 0;
+    }
+
+    cl_device_id device = NULL;
+
+    for (cl_uint i = 0; i < min(num_platforms, (cl_uint)8) && device == NULL; i++) {
+        if (clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_GPU, 1, &device, NULL) != CL_SUCCESS) {
+            device = NULL;
+        }
+    }
+
+    if (device == NULL) {
+        fprintf(stderr, "Warning: no OpenCL GPU found.\n");
+        return false;
+    }
+
+    char device_name[256] = "";
+    clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(device_name), device_name, NULL);
+
+    cl_int err;
+
+    cl_->context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+    if (!ClOk(err, "clCreateContext")) {
+        return false;
+    }
+
+    cl_->queue = clCreateCommandQueue(cl_->context, device, CL_QUEUE_PROFILING_ENABLE, &err);
+    if (!ClOk(err, "clCreateCommandQueue")) {
+        return false;
+    }
+
+    cl_->program = clCreateProgramWithSource(cl_->context, 1, &kernel_source, NULL, &err);
+    if (!ClOk(err, "clCreateProgramWithSource")) {
+        return false;
+    }
+
+    // the scores are compared to integer thresholds after a division,
+    // so ask for the same rounding as the CPU if the device can do it
+    cl_device_fp_config fp_config = 0;
+    clGetDeviceInfo(device, CL_DEVICE_SINGLE_FP_CONFIG, sizeof(fp_config), &fp_config, NULL);
+
+    char options[512];
+    snprintf(options, sizeof(options),
+        "-D NUMERIC_CONST=%d "
+        "-D INVARIANCE_CHECK_VERT_OFFSET_MIN=%d -D INVARIANCE_CHECK_VERT_OFFSET_MAX=%d "
+        "-D INVARIANCE_CHECK_VERT_OFFSET_INCREMENT=%d "
+        "-D INVARIANCE_CHECK_HORZ_OFFSET_MIN=%d -D INVARIANCE_CHECK_HORZ_OFFSET_MAX=%d %s",
+        NUMERIC_CONST,
+        INVARIANCE_CHECK_VERT_OFFSET_MIN, INVARIANCE_CHECK_VERT_OFFSET_MAX,
+        INVARIANCE_CHECK_VERT_OFFSET_INCREMENT,
+        INVARIANCE_CHECK_HORZ_OFFSET_MIN, INVARIANCE_CHECK_HORZ_OFFSET_MAX,
+        (fp_config & CL_FP_CORRECTLY_ROUNDED_DIVIDE_SQRT) ? "-cl-fp32-correctly-rounded-divide-sqrt" : "");
+
+    if (clBuildProgram(cl_->program, 1, &device, options, NULL, NULL) != CL_SUCCESS) {
+        char log[4096] = "";
+        clGetProgramBuildInfo(cl_->program, device, CL_PROGRAM_BUILD_LOG, sizeof(log), log, NULL);
+
+        fprintf(stderr, "Warning: failed to build the OpenCL stereo kernels for %s:\n%s\n", device_name, log);
+        return false;
+    }
+
+    cl_->remap_kernel = clCreateKernel(cl_->program, "RemapNearest", &err);
+    if (!ClOk(err, "clCreateKernel")) {
+        return false;
+    }
+
+    cl_->laplacian_kernel = clCreateKernel(cl_->program, "Laplacian3", &err);
+    if (!ClOk(err, "clCreateKernel")) {
+        return false;
+    }
+
+    cl_->stereo_kernel = clCreateKernel(cl_->program, "StereoBlocks", &err);
+    if (!ClOk(err, "clCreateKernel")) {
+        return false;
+    }
+
+    cl_->counts = CreateBuffer(cl_->context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, 2 * sizeof(cl_int));
+
+    printf("OpenCL stereo on %s\n", device_name);
+
+    return cl_->counts != NULL;
+}
+
+/**
+ * Starts a frame on the GPU and returns right away.
+ *
+ * @param left_image left camera image as a CV_8UC1
+ * @param right_image right camera image as a CV_8UC1
+ * @param state stereo parameters for the frame
+ * @param row_start first row blocks can start on
+ * @param row_end blocks start on rows before this
+ * @param col_start first column blocks can start on
+ * @param col_end blocks start on columns before this
+ */
+void PushbroomStereoOpenCL::Enqueue(Mat left_image, Mat right_image, const PushbroomStereoState &state, int row_start, int row_end, int col_start, int col_end) {
+
+    int image_rows = left_image.rows;
+    int image_cols = left_image.cols;
+    int rows = state.mapxL.rows;
+    int cols = state.mapxL.cols;
+
+    int block_size = state.blockSize;
+
+    int blocks_x = col_end > col_start ? (col_end - col_start + block_size - 1) / block_size : 0;
+    int blocks_y = row_end > row_start ? (row_end - row_start + block_size - 1) / block_size : 0;
+
+    cl_context context = cl_->context;
+    cl_command_queue queue = cl_->queue;
+
+    // (re)allocate when the sizes change
+    if (image_rows != cl_->image_rows || image_cols != cl_->image_cols) {
+        ReleaseBuffer(&cl_->image_left);
+        ReleaseBuffer(&cl_->image_right);
+
+        cl_->image_left = CreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, image_rows * image_cols);
+        cl_->image_right = CreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, image_rows * image_cols);
+
+        cl_->image_rows = image_rows;
+        cl_->image_cols = image_cols;
+    }
+
+    if (rows != cl_->rows || cols != cl_->cols) {
+        cl_mem *buffers[] = { &cl_->map_left, &cl_->map_right, &cl_->mask, &cl_->remapped_left,
+            &cl_->remapped_right, &cl_->laplacian_left, &cl_->laplacian_right };
+
+        for (unsigned int i = 0; i < sizeof(buffers) / sizeof(buffers[0]); i++) {
+            ReleaseBuffer(buffers[i]);
+        }
+
+        cl_->map_left = CreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, rows * cols * 2 * sizeof(cl_short));
+        cl_->map_right = CreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, rows * cols * 2 * sizeof(cl_short));
+        cl_->mask = CreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, rows * cols);
+
+        cl_->remapped_left = CreateBuffer(context, CL_MEM_READ_WRITE, rows * cols);
+        cl_->remapped_right = CreateBuffer(context, CL_MEM_READ_WRITE, rows * cols);
+        cl_->laplacian_left = CreateBuffer(context, CL_MEM_READ_WRITE, rows * cols);
+        cl_->laplacian_right = CreateBuffer(context, CL_MEM_READ_WRITE, rows * cols);
+
+        cl_->rows = rows;
+        cl_->cols = cols;
+        cl_->map_left_data = NULL;
+        cl_->map_right_data = NULL;
+        cl_->mask_data = NULL;
+    }
+
+    // one hit per block at most
+    if (blocks_x * blocks_y > cl_->max_hits) {
+        ReleaseBuffer(&cl_->hits);
+
+        cl_->max_hits = blocks_x * blocks_y;
+        cl_->hits = CreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, cl_->max_hits * sizeof(PushbroomStereoOpenCLHit));
+    }
+
+    // the maps and mask only get uploaded when they change
+    if (state.mapxL.data != cl_->map_left_data) {
+        UploadMat(queue, cl_->map_left, state.mapxL);
+        cl_->map_left_data = state.mapxL.data;
+    }
+
+    if (state.mapxR.data != cl_->map_right_data) {
+        UploadMat(queue, cl_->map_right, state.mapxR);
+        cl_->map_right_data = state.mapxR.data;
+    }
+
+    bool use_mask = !state.roi_mask.empty();
+
+    if (use_mask && state.roi_mask.data != cl_->mask_data) {
+        UploadMat(queue, cl_->mask, state.roi_mask);
+        cl_->mask_data = state.roi_mask.data;
+    }
+
+    UploadMat(queue, cl_->image_left, left_image);
+    UploadMat(queue, cl_->image_right, right_image);
+
+    clEnqueueWriteBuffer(queue, cl_->counts, CL_FALSE, 0, sizeof(cl_->zero_counts), cl_->zero_counts, 0, NULL, NULL);
+
+    cl_->block_size = block_size;
+    cl_->disparity = state.disparity;
+    cl_->show_display = state.show_display;
+
+    size_t image_size[2] = { (size_t)cols, (size_t)rows };
+
+    cl_mem images[2] = { cl_->image_left, cl_->image_right };
+    cl_mem maps[2] = { cl_->map_left, cl_->map_right };
+    cl_mem remapped[2] = { cl_->remapped_left, cl_->remapped_right };
+    cl_mem laplacians[2] = { cl_->laplacian_left, cl_->laplacian_right };
+
+    for (int i = 0; i < 2; i++) {
+        cl_kernel kernel = cl_->remap_kernel;
+
+        clSetKernelArg(kernel, 0, sizeof(cl_mem), &images[i]);
+        clSetKernelArg(kernel, 1, sizeof(int), &image_rows);
+        clSetKernelArg(kernel, 2, sizeof(int), &image_cols);
+        clSetKernelArg(kernel, 3, sizeof(cl_mem), &maps[i]);
+        clSetKernelArg(kernel, 4, sizeof(int), &rows);
+        clSetKernelArg(kernel, 5, sizeof(int), &cols);
+        clSetKernelArg(kernel, 6, sizeof(cl_mem), &remapped[i]);
+
+        ClOk(clEnqueueNDRangeKernel(queue, kernel, 2, NULL, image_size, NULL, 0, NULL,
+            &cl_->events[EVENT_REMAP_LEFT + i]), "remap");
+    }
+
+    for (int i = 0; i < 2; i++) {
+        cl_kernel kernel = cl_->laplacian_kernel;
+
+        clSetKernelArg(kernel, 0, sizeof(cl_mem), &remapped[i]);
+        clSetKernelArg(kernel, 1, sizeof(int), &rows);
+        clSetKernelArg(kernel, 2, sizeof(int), &cols);
+        clSetKernelArg(kernel, 3, sizeof(cl_mem), &laplacians[i]);
+
+        ClOk(clEnqueueNDRangeKernel(queue, kernel, 2, NULL, image_size, NULL, 0, NULL,
+            &cl_->events[EVENT_LAPLACIAN_LEFT + i]), "interest operator");
+    }
+
+    cl_->stereo_enqueued = blocks_x > 0 && blocks_y > 0;
+
+    if (cl_->stereo_enqueued) {
+        cl_kernel kernel = cl_->stereo_kernel;
+
+        int use_mask_arg = use_mask;
+        int check_horizontal_invariance = state.check_horizontal_invariance;
+
+        int arg = 0;
+        clSetKernelArg(kernel, arg++, sizeof(cl_mem), &cl_->remapped_left);
+        clSetKernelArg(kernel, arg++, sizeof(cl_mem), &cl_->remapped_right);
+        clSetKernelArg(kernel, arg++, sizeof(cl_mem), &cl_->laplacian_left);
+        clSetKernelArg(kernel, arg++, sizeof(cl_mem), &cl_->laplacian_right);
+        clSetKernelArg(kernel, arg++, sizeof(int), &rows);
+        clSetKernelArg(kernel, arg++, sizeof(int), &cols);
+        clSetKernelArg(kernel, arg++, sizeof(int), &row_start);
+        clSetKernelArg(kernel, arg++, sizeof(int), &row_end);
+        clSetKernelArg(kernel, arg++, sizeof(int), &col_start);
+        clSetKernelArg(kernel, arg++, sizeof(int), &col_end);
+        clSetKernelArg(kernel, arg++, sizeof(cl_mem), &cl_->mask);
+        clSetKernelArg(kernel, arg++, sizeof(int), &use_mask_arg);
+        clSetKernelArg(kernel, arg++, sizeof(int), &block_size);
+        clSetKernelArg(kernel, arg++, sizeof(int), &state.disparity);
+        clSetKernelArg(kernel, arg++, sizeof(int), &state.zero_dist_disparity);
+        clSetKernelArg(kernel, arg++, sizeof(int), &state.sobelLimit);
+        clSetKernelArg(kernel, arg++, sizeof(int), &state.sadThreshold);
+        clSetKernelArg(kernel, arg++, sizeof(float), &state.horizontalInvarianceMultiplier);
+        clSetKernelArg(kernel, arg++, sizeof(int), &check_horizontal_invariance);
+        clSetKernelArg(kernel, arg++, sizeof(cl_mem), &cl_->counts);
+        clSetKernelArg(kernel, arg++, sizeof(cl_mem), &cl_->hits);
+
+        size_t blocks_size[2] = { (size_t)blocks_x, (size_t)blocks_y };
+
+        ClOk(clEnqueueNDRangeKernel(queue, kernel, 2, NULL, blocks_size, NULL, 0, NULL,
+            &cl_->events[EVENT_STEREO]), "stereo");
+    }
+
+    // get the GPU going now instead of when we wait on it
+    clFlush(queue);
+}
+
+/**
+ * Checks if the GPU is done with the frame, or waits for it, and puts the
+ * hits in a band, in the same format and order as the CPU version.
+ *
+ * @param wait if true, wait for the frame to finish
+ * @param band (output) band to put the hits in, which must be empty
+ * @param stage_us (output) GPU time in microseconds for remap, the
+ *      interest operator and stereo
+ *
+ * @retval true if the frame is done
+ */
+bool PushbroomStereoOpenCL::Finish(bool wait, PushbroomStereoBand *band, int64_t stage_us[3]) {
+
+    cl_event last = cl_->events[cl_->stereo_enqueued ? EVENT_STEREO : EVENT_LAPLACIAN_RIGHT];
+
+    if (!wait && last != NULL) {
+        cl_int status = CL_COMPLETE;
+        clGetEventInfo(last, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL);
+
+        // (negative is an error, which we find out about below)
+        if (status > CL_COMPLETE) {
+            return false;
+        }
+    }
+
+    clFinish(cl_->queue);
+
+    cl_int err;
+    cl_int *counts = (cl_int*) clEnqueueMapBuffer(cl_->queue, cl_->counts, CL_TRUE, CL_MAP_READ, 0,
+        2 * sizeof(cl_int), 0, NULL, NULL, &err);
+
+    int num_hits = 0;
+
+    if (ClOk(err, "clEnqueueMapBuffer")) {
+        num_hits = min((int)counts[0], cl_->max_hits);
+        band->blocks_searched = counts[1];
+
+        clEnqueueUnmapMemObject(cl_->queue, cl_->counts, counts, 0, NULL, NULL);
+    }
+
+    if (num_hits > 0) {
+        PushbroomStereoOpenCLHit *hits = (PushbroomStereoOpenCLHit*) clEnqueueMapBuffer(cl_->queue,
+            cl_->hits, CL_TRUE, CL_MAP_READ, 0, num_hits * sizeof(PushbroomStereoOpenCLHit),
+            0, NULL, NULL, &err);
+
+        if (ClOk(err, "clEnqueueMapBuffer")) {
+            // the work items finish in any order, sort to match the CPU
+            cl_->sorted_hits.assign(hits, hits + num_hits);
+            std::sort(cl_->sorted_hits.begin(), cl_->sorted_hits.end(), HitBefore);
+
+            clEnqueueUnmapMemObject(cl_->queue, cl_->hits, hits, 0, NULL, NULL);
+        } else {
+            num_hits = 0;
+        }
+    }
+
+    int block_size = cl_->block_size;
+
+    for (int i = 0; i < num_hits; i++) {
+        const PushbroomStereoOpenCLHit &hit = cl_->sorted_hits[i];
+
+        // center of the block, like the CPU version
+        band->localHitPoints.push_back(Point3f(hit.x + block_size/2.0, hit.y + block_size/2.0, -cl_->disparity));
+        band->pointColors.push_back(hit.grey);
+        band->pointDisparities.push_back(cl_->disparity);
+
+        if (cl_->show_display) {
+            band->pointVector2d.push_back(Point3i(hit.x, hit.y, hit.score));
+        }
+    }
+
+    stage_us[0] = EventMicroseconds(cl_->events[EVENT_REMAP_LEFT], cl_->events[EVENT_REMAP_RIGHT]);
+    stage_us[1] = EventMicroseconds(cl_->events[EVENT_LAPLACIAN_LEFT], cl_->events[EVENT_LAPLACIAN_RIGHT]);
+    stage_us[2] = cl_->stereo_enqueued ? EventMicroseconds(cl_->events[EVENT_STEREO], cl_->events[EVENT_STEREO]) : 0;
+
+    for (int i = 0; i < NUM_EVENTS; i++) {
+        if (cl_->events[i] != NULL) {
+            clReleaseEvent(cl_->events[i]);
+            cl_->events[i] = NULL;
+        }
+    }
+
+    return true;
+}
+
+#else // USE_OPENCL
+
+struct PushbroomStereoOpenCLContext {
+};
+
+PushbroomStereoOpenCL::PushbroomStereoOpenCL() {
+    cl_ = NULL;
+}
+
+PushbroomStereoOpenCL::~PushbroomStereoOpenCL() {
+}
+
+bool PushbroomStereoOpenCL::Init() {
+    fprintf(stderr, "Warning: built without OpenCL (rebuild with \"make USE_OPENCL=1\").\n");
+    return false;
+}
+
+void PushbroomStereoOpenCL::Enqueue(Mat left_image, Mat right_image, const PushbroomStereoState &state, int row_start, int row_end, int col_start, int col_end) {
+}
+
+bool PushbroomStereoOpenCL::Finish(bool wait, PushbroomStereoBand *band, int64_t stage_us[3]) {
+    return true;
+}
+
+#endif // USE_OPENCL
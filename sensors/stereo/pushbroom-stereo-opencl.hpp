@@ -0,0 +1,38 @@
+/**
+ * OpenCL (GPU) backend for pushbroom stereo.  Runs the remap, interest
+ * operator and block search for a frame as OpenCL kernels and returns the
+ * same hits the CPU version finds.
+ *
+ * Only built with OpenCL if USE_OPENCL is defined ("make USE_OPENCL=1"),
+ * otherwise Init() always fails and PushbroomStereo stays on the CPU.
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#ifndef PUSHBROOM_STEREO_OPENCL_HPP
+#define PUSHBROOM_STEREO_OPENCL_HPP
+
+#include "pushbroom-stereo.hpp"
+
+// OpenCL objects and buffers, only defined when built with OpenCL
+struct PushbroomStereoOpenCLContext;
+
+class PushbroomStereoOpenCL {
+    private:
+        PushbroomStereoOpenCLContext *cl_;
+
+    public:
+        PushbroomStereoOpenCL();
+        ~PushbroomStereoOpenCL();
+
+        bool Init();
+
+        static bool Supports(const PushbroomStereoState &state);
+
+        void Enqueue(Mat left_image, Mat right_image, const PushbroomStereoState &state, int row_start, int row_end, int col_start, int col_end);
+
+        bool Finish(bool wait, PushbroomStereoBand *band, int64_t stage_us[3]);
+};
+
+#endif
@@ -0,0 +1,494 @@
+/**
+ * Regression check for pushbroom stereo on labeled recordings.
+ *
+ * Example:
+ *   ./pushbroom-stereo-regression -c deltawing-stereo-odroid-cam1.conf
+ *       -d regression-dataset.txt -o new.csv -B baseline.csv
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#include "pushbroom-stereo-regression.hpp"
+
+int main(int argc, char *argv[]) {
+
+    string config_file = "";
+    string dataset_file = "";
+    string output_file = "";
+    string baseline_file = "";
+    int max_frames = 1000;
+    int num_threads = 4;
+    int iterations = 3;
+    int warmup = 1;
+    int min_hits = 1;
+    float max_slowdown = 10;
+    float max_accuracy_drop = 0.02;
+
+    ConciseArgs parser(argc, argv);
+    parser.add(config_file, "c", "config", "Configuration file with the stereo settings and calibration directory.", true);
+    parser.add(dataset_file, "d", "dataset", "File listing the labeled recordings (see pushbroom-stereo-regression.hpp).", true);
+    parser.add(max_frames, "m", "max-frames", "Most frames to load from each recording.");
+    parser.add(num_threads, "n", "threads", "Worker threads to run with.");
+    parser.add(iterations, "i", "iterations", "Timed passes over each recording.");
+    parser.add(warmup, "w", "warmup", "Untimed passes over each recording before timing.");
+    parser.add(min_hits, "k", "min-hits", "Hits on the obstacle for a frame to count as detected.");
+    parser.add(max_slowdown, "s", "max-slowdown", "Percent that the median ms/frame can go up before failing.");
+    parser.add(max_accuracy_drop, "a", "max-accuracy-drop", "How much precision or recall (0 to 1) can drop before failing.");
+    parser.add(output_file, "o", "output", "Write the CSV results to this file instead of stdout.");
+    parser.add(baseline_file, "B", "baseline", "CSV from an earlier run to check against.");
+    parser.parse();
+
+    OpenCvStereoConfig stereo_config;
+
+    if (ParseConfigFile(config_file, &stereo_config) != true) {
+        fprintf(stderr, "Failed to parse configuration file, quitting.\n");
+        return 1;
+    }
+
+    OpenCvStereoCalibration stereo_calibration;
+
+    if (LoadCalibration(stereo_config.calibrationDir, &stereo_calibration) != true) {
+        fprintf(stderr, "Error: failed to read calibration files. Quitting.\n");
+        return 1;
+    }
+
+    if (num_threads < 1 || num_threads > MAX_THREADS) {
+        fprintf(stderr, "Error: threads must be 1 to %d.\n", MAX_THREADS);
+        return 1;
+    }
+
+    cv::vector<RegressionRecording> recordings;
+
+    if (LoadDataset(dataset_file, &recordings) != true) {
+        return 1;
+    }
+
+    PushbroomStereoState state;
+    SetupState(stereo_config, stereo_calibration, &state);
+
+    cv::vector<RegressionResult> results;
+
+    for (unsigned int r = 0; r < recordings.size(); r++) {
+
+        map<int, Rect> boxes;
+
+        if (LoadBoxes(recordings[r].boxes_file, &boxes) != true) {
+            return 1;
+        }
+
+        cv::vector<LabeledFrame> frames;
+
+        if (LoadLabeledFrames(recordings[r], boxes, max_frames, &frames) < 1) {
+            fprintf(stderr, "Error: no frames found for %s.\n", recordings[r].name.c_str());
+            return 1;
+        }
+
+        if (frames[0].left.size() != stereo_calibration.mx1fp.size()) {
+            fprintf(stderr, "Error: %s frames are %d x %d, the calibration is for %d x %d.\n",
+                recordings[r].name.c_str(), frames[0].left.cols, frames[0].left.rows,
+                stereo_calibration.mx1fp.cols, stereo_calibration.mx1fp.rows);
+            return 1;
+        }
+
+        fprintf(stderr, "%s: %d frames...\n", recordings[r].name.c_str(), (int)frames.size());
+
+        RegressionResult result;
+        result.name = recordings[r].name;
+
+        RunRecording(frames, state, num_threads, iterations, warmup, min_hits, &result);
+
+        results.push_back(result);
+    }
+
+    FILE *out = stdout;
+
+    if (output_file.length() > 0) {
+        out = fopen(output_file.c_str(), "w");
+
+        if (out == NULL) {
+            fprintf(stderr, "Error: failed to open %s for writing.\n", output_file.c_str());
+            return 1;
+        }
+    }
+
+    WriteResults(out, results);
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    if (baseline_file.length() > 0) {
+        map<string, RegressionResult> baseline;
+
+        if (LoadBaseline(baseline_file, &baseline) != true) {
+            return 1;
+        }
+
+        if (CheckAgainstBaseline(baseline, results, max_slowdown, max_accuracy_drop) != true) {
+            return 2;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Reads the list of recordings.  Blank lines and lines starting with #
+ * are skipped.
+ *
+ * @param dataset_file file to read
+ * @param recordings (output) recordings in the file
+ *
+ * @retval false if the file couldn't be read or a line is incomplete
+ */
+bool LoadDataset(string dataset_file, cv::vector<RegressionRecording> *recordings) {
+    ifstream in(dataset_file.c_str());
+
+    if (!in.is_open()) {
+        fprintf(stderr, "Error: failed to open dataset %s.\n", dataset_file.c_str());
+        return false;
+    }
+
+    string line;
+    int line_number = 0;
+
+    while (getline(in, line)) {
+        line_number ++;
+
+        stringstream stream(line);
+        RegressionRecording recording;
+
+        if (!(stream >> recording.name) || recording.name[0] == '#') {
+            continue;
+        }
+
+        if (!(stream >> recording.left_dir >> recording.right_dir >> recording.boxes_file)) {
+            fprintf(stderr, "Error: %s:%d: expected name, left directory, right directory and box file.\n",
+                dataset_file.c_str(), line_number);
+            return false;
+        }
+
+        if (!(stream >> recording.frame_offset)) {
+            recording.frame_offset = 0;
+        }
+
+        recordings->push_back(recording);
+    }
+
+    if (recordings->size() == 0) {
+        fprintf(stderr, "Error: no recordings in %s.\n", dataset_file.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Reads a box_clicking file.
+ *
+ * @param boxes_file file to read
+ * @param boxes (output) box for each frame number that has one
+ *
+ * @retval false if the file couldn't be read
+ */
+bool LoadBoxes(string boxes_file, map<int, Rect> *boxes) {
+    CsvReader reader;
+
+    if (reader.Open(boxes_file, false) != true) {
+        fprintf(stderr, "Error: %s\n", reader.GetError().c_str());
+        return false;
+    }
+
+    // frame number and the corners.  Lines go on with the indexes of
+    // StereoBM's hits in the box, which we don't need.
+    cv::vector<int> columns;
+
+    for (int i = 1; i <= 5; i++) {
+        columns.push_back(i);
+    }
+
+    std::vector<std::vector<long> > values;
+
+    if (reader.ReadColumns(columns, &values) != true) {
+        fprintf(stderr, "Error: %s\n", reader.GetError().c_str());
+        return false;
+    }
+
+    for (int row = 0; row < reader.GetNumRows(); row++) {
+        int frame_number = values[0][row];
+
+        if (boxes->count(frame_number) > 0) {
+            fprintf(stderr, "Warning: %s has frame %d more than once, using the last box.\n",
+                boxes_file.c_str(), frame_number);
+        }
+
+        // the corners were clicked in either order
+        Point corner1(values[1][row], values[2][row]);
+        Point corner2(values[3][row], values[4][row]);
+
+        (*boxes)[frame_number] = Rect(corner1, corner2);
+    }
+
+    return true;
+}
+
+/**
+ * Loads the frames from a recording's first box to its last.
+ *
+ * @param recording recording to load
+ * @param boxes its boxes (see LoadBoxes)
+ * @param max_frames most frames to load
+ * @param frames (output) frames with their boxes
+ *
+ * @retval number of frames loaded (stops at the first missing one)
+ */
+int LoadLabeledFrames(const RegressionRecording &recording, const map<int, Rect> &boxes, int max_frames, cv::vector<LabeledFrame> *frames) {
+
+    if (boxes.size() == 0) {
+        return 0;
+    }
+
+    int first_frame = boxes.begin()->first;
+    int last_frame = min(boxes.rbegin()->first, first_frame + max_frames - 1);
+
+    for (int frame_number = first_frame; frame_number <= last_frame; frame_number++) {
+        LabeledFrame frame;
+        frame.frame_number = frame_number;
+
+        if (LoadFrame(recording.left_dir, recording.right_dir, frame_number - recording.frame_offset, &frame.left, &frame.right) != true) {
+            fprintf(stderr, "Warning: %s is missing frame %d, stopping there.\n", recording.name.c_str(), frame_number);
+            break;
+        }
+
+        map<int, Rect>::const_iterator it = boxes.find(frame_number);
+
+        frame.has_box = it != boxes.end();
+
+        if (frame.has_box) {
+            frame.box = it->second;
+        }
+
+        frames->push_back(frame);
+    }
+
+    return frames->size();
+}
+
+/**
+ * Runs stereo over a recording, timing each frame, and scores the hits of
+ * the last pass against the boxes.  A hit is on the obstacle if the
+ * center of its block is in the box.
+ *
+ * @param frames the recording's frames
+ * @param state stereo state to run with
+ * @param num_threads number of worker threads
+ * @param iterations timed passes over the frames
+ * @param warmup untimed passes over the frames before timing
+ * @param min_hits hits on the obstacle for a frame to count as detected
+ * @param result (output) timing and accuracy (the name is left alone)
+ */
+void RunRecording(const cv::vector<LabeledFrame> &frames, const PushbroomStereoState &state, int num_threads, int iterations, int warmup, int min_hits, RegressionResult *result) {
+
+    // a pool of this run's size rather than the shared one
+    ThreadPoolConfig pool_config = ThreadPool::DefaultConfig();
+    pool_config.num_threads = num_threads;
+
+    ThreadPool pool(pool_config);
+
+    PushbroomStereoThreadConfig thread_config = PushbroomStereo::DefaultThreadConfig();
+    thread_config.num_threads = num_threads;
+    thread_config.pool = &pool;
+
+    PushbroomStereo pushbroom_stereo(thread_config);
+
+    PushbroomStereoFrameBuffers buffers;
+    buffers.number_of_points = 0;
+
+    for (int pass = 0; pass < warmup; pass++) {
+        for (unsigned int i = 0; i < frames.size(); i++) {
+            pushbroom_stereo.ProcessImages(frames[i].left, frames[i].right, &buffers, state);
+        }
+    }
+
+    cv::vector<float> frame_ms;
+    float total_ms = 0;
+
+    int hits = 0, hits_on_obstacle = 0;
+    int frames_in_view = 0, frames_detected = 0;
+    int frames_with_hits = 0, frames_with_hits_right = 0;
+
+    for (int pass = 0; pass < iterations; pass++) {
+        for (unsigned int i = 0; i < frames.size(); i++) {
+            int64_t start = GetRawMonotonicNow();
+            pushbroom_stereo.ProcessImages(frames[i].left, frames[i].right, &buffers, state);
+            int64_t end = GetRawMonotonicNow();
+
+            float ms = (end - start) / 1000.0f;
+
+            frame_ms.push_back(ms);
+            total_ms += ms;
+
+            if (pass != iterations - 1) {
+                continue;
+            }
+
+            int on_obstacle = 0;
+
+            if (frames[i].has_box) {
+                for (unsigned int j = 0; j < buffers.image_hits.size(); j++) {
+                    if (frames[i].box.contains(Point(buffers.image_hits[j].x, buffers.image_hits[j].y))) {
+                        on_obstacle ++;
+                    }
+                }
+
+                frames_in_view ++;
+
+                if (on_obstacle >= min_hits) {
+                    frames_detected ++;
+                }
+            }
+
+            hits += buffers.image_hits.size();
+            hits_on_obstacle += on_obstacle;
+
+            if ((int)buffers.image_hits.size() >= min_hits) {
+                frames_with_hits ++;
+
+                if (on_obstacle >= min_hits) {
+                    frames_with_hits_right ++;
+                }
+            }
+        }
+    }
+
+    result->frames = frames.size();
+
+    result->mean_ms = frame_ms.size() > 0 ? total_ms / frame_ms.size() : 0;
+    result->p50_ms = 0;
+    result->p99_ms = 0;
+
+    if (frame_ms.size() > 0) {
+        sort(frame_ms.begin(), frame_ms.end());
+
+        result->p50_ms = frame_ms[frame_ms.size() / 2];
+        result->p99_ms = frame_ms[(frame_ms.size() * 99) / 100];
+    }
+
+    result->hits_per_frame = frames.size() > 0 ? (float)hits / frames.size() : 0;
+    result->hit_precision = hits > 0 ? (float)hits_on_obstacle / hits : 0;
+    result->frame_recall = frames_in_view > 0 ? (float)frames_detected / frames_in_view : 0;
+    result->frame_precision = frames_with_hits > 0 ? (float)frames_with_hits_right / frames_with_hits : 0;
+}
+
+/**
+ * Writes the results as CSV with a header line.
+ *
+ * @param out file to write to
+ * @param results results to write
+ */
+void WriteResults(FILE *out, const cv::vector<RegressionResult> &results) {
+    fprintf(out, "recording,frames,mean_ms,p50_ms,p99_ms,hits_per_frame,hit_precision,frame_recall,frame_precision\n");
+
+    for (unsigned int i = 0; i < results.size(); i++) {
+        const RegressionResult &r = results[i];
+
+        fprintf(out, "%s,%d,%.3f,%.3f,%.3f,%.2f,%.4f,%.4f,%.4f\n", r.name.c_str(), r.frames,
+            r.mean_ms, r.p50_ms, r.p99_ms, r.hits_per_frame, r.hit_precision, r.frame_recall,
+            r.frame_precision);
+    }
+}
+
+/**
+ * Reads a CSV written by WriteResults.
+ *
+ * @param baseline_file file to read
+ * @param baseline (output) results by recording name
+ *
+ * @retval false if the file couldn't be read
+ */
+bool LoadBaseline(string baseline_file, map<string, RegressionResult> *baseline) {
+    FILE *in = fopen(baseline_file.c_str(), "r");
+
+    if (in == NULL) {
+        fprintf(stderr, "Error: failed to open baseline %s.\n", baseline_file.c_str());
+        return false;
+    }
+
+    char line[512];
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        char name[256];
+        RegressionResult r;
+
+        if (sscanf(line, "%255[^,],%d,%f,%f,%f,%f,%f,%f,%f", name, &r.frames, &r.mean_ms, &r.p50_ms,
+                &r.p99_ms, &r.hits_per_frame, &r.hit_precision, &r.frame_recall, &r.frame_precision) != 9) {
+            // header or blank line
+            continue;
+        }
+
+        r.name = name;
+        (*baseline)[r.name] = r;
+    }
+
+    fclose(in);
+
+    return true;
+}
+
+/**
+ * Compares results against a baseline, printing the change for each
+ * recording.  Timing is only comparable to a baseline from the same
+ * machine and settings.
+ *
+ * @param baseline results from an earlier run, by recording name
+ * @param results results of this run
+ * @param max_slowdown percent that the median ms/frame can go up
+ * @param max_accuracy_drop how much hit precision, frame recall or frame
+ *      precision can go down
+ *
+ * @retval false if any recording regressed past a threshold
+ */
+bool CheckAgainstBaseline(const map<string, RegressionResult> &baseline, const cv::vector<RegressionResult> &results, float max_slowdown, float max_accuracy_drop) {
+
+    bool passed = true;
+
+    for (unsigned int i = 0; i < results.size(); i++) {
+        const RegressionResult &r = results[i];
+
+        map<string, RegressionResult>::const_iterator it = baseline.find(r.name);
+
+        if (it == baseline.end()) {
+            fprintf(stderr, "%s: not in the baseline\n", r.name.c_str());
+            continue;
+        }
+
+        const RegressionResult &b = it->second;
+
+        if (r.frames != b.frames) {
+            fprintf(stderr, "Warning: %s ran %d frames, the baseline ran %d.\n", r.name.c_str(), r.frames, b.frames);
+        }
+
+        float slowdown = b.p50_ms > 0 ? 100.0f * (r.p50_ms - b.p50_ms) / b.p50_ms : 0;
+
+        fprintf(stderr, "%s: p50 %.3f -> %.3f ms (%+.1f%%), hit precision %.4f -> %.4f, "
+            "frame recall %.4f -> %.4f, frame precision %.4f -> %.4f\n", r.name.c_str(),
+            b.p50_ms, r.p50_ms, slowdown, b.hit_precision, r.hit_precision,
+            b.frame_recall, r.frame_recall, b.frame_precision, r.frame_precision);
+
+        if (slowdown > max_slowdown) {
+            fprintf(stderr, "Error: %s is %.1f%% slower (limit %.1f%%).\n", r.name.c_str(), slowdown, max_slowdown);
+            passed = false;
+        }
+
+        if (b.hit_precision - r.hit_precision > max_accuracy_drop
+            || b.frame_recall - r.frame_recall > max_accuracy_drop
+            || b.frame_precision - r.frame_precision > max_accuracy_drop) {
+
+            fprintf(stderr, "Error: %s is less accurate (limit %.4f).\n", r.name.c_str(), max_accuracy_drop);
+            passed = false;
+        }
+    }
+
+    return passed;
+}
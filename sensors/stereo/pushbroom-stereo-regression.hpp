@@ -0,0 +1,102 @@
+/**
+ * Accuracy and throughput regression check for pushbroom stereo.  Runs
+ * PushbroomStereo over recordings that have obstacle bounding boxes
+ * clicked on them (sensors/bm-stereo/box_clicking) and reports how many
+ * hits land on the obstacle and how many frames it's detected on,
+ * alongside ms/frame.  Given a baseline CSV from an earlier run, it
+ * fails if a recording got slower or less accurate by more than the
+ * thresholds, so a speedup can't quietly change what gets detected.
+ *
+ * The dataset file has one recording per line:
+ *
+ *   name left_dir right_dir boxes.csv [frame_offset]
+ *
+ * Each line of a box file is "video_number,frame_number,x1,y1,x2,y2"
+ * with the box's corners in the rectified left image (anything after
+ * that is ignored).  The frames from the first to the last box are run,
+ * and frames without a box are ones where the obstacle isn't in view.
+ * frame_offset is subtracted from the frame numbers to get the PGM file
+ * numbers.
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#ifndef PUSHBROOM_STEREO_REGRESSION_HPP
+#define PUSHBROOM_STEREO_REGRESSION_HPP
+
+#include <cv.h>
+#include <highgui.h>
+
+#include "opencv2/opencv.hpp"
+
+#include "../../externals/ConciseArgs.hpp"
+#include "../../utils/utils/Clock.hpp"
+#include "../../utils/CsvReader/CsvReader.hpp"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include "opencv-stereo-util.hpp"
+#include "pushbroom-stereo.hpp"
+#include "stereo-bench-util.hpp"
+
+using namespace std;
+using namespace cv;
+
+struct RegressionRecording {
+    string name;
+    string left_dir;
+    string right_dir;
+    string boxes_file;
+    int frame_offset;
+};
+
+struct LabeledFrame {
+    int frame_number;
+
+    // false if the obstacle isn't in view
+    bool has_box;
+    Rect box;
+
+    Mat left;
+    Mat right;
+};
+
+struct RegressionResult {
+    string name;
+    int frames;
+
+    float mean_ms;
+    float p50_ms;
+    float p99_ms;
+
+    // hits per frame, fraction of hits on the obstacle, fraction of
+    // frames with the obstacle in view that it was detected on, and
+    // fraction of frames with a detection that were right
+    float hits_per_frame;
+    float hit_precision;
+    float frame_recall;
+    float frame_precision;
+};
+
+bool LoadDataset(string dataset_file, cv::vector<RegressionRecording> *recordings);
+
+bool LoadBoxes(string boxes_file, map<int, Rect> *boxes);
+
+int LoadLabeledFrames(const RegressionRecording &recording, const map<int, Rect> &boxes, int max_frames, cv::vector<LabeledFrame> *frames);
+
+void RunRecording(const cv::vector<LabeledFrame> &frames, const PushbroomStereoState &state, int num_threads, int iterations, int warmup, int min_hits, RegressionResult *result);
+
+void WriteResults(FILE *out, const cv::vector<RegressionResult> &results);
+
+bool LoadBaseline(string baseline_file, map<string, RegressionResult> *baseline);
+
+bool CheckAgainstBaseline(const map<string, RegressionResult> &baseline, const cv::vector<RegressionResult> &results, float max_slowdown, float max_accuracy_drop);
+
+#endif
@@ -0,0 +1,11 @@
+TARGET = pushbroom-stereo-regression
+SOURCES = pushbroom-stereo-regression.cpp stereo-bench-util.cpp opencv-stereo-util.cpp pushbroom-stereo.cpp pushbroom-stereo-opencl.cpp ../../externals/jpeg-utils/jpeg-utils.c ../../utils/utils/RealtimeUtils.cpp ../../utils/CsvReader/CsvReader.cpp ../../utils/ThreadPool/ThreadPool.cpp
+
+# "make USE_OPENCL=1" builds the GPU backend (see pushbroom-stereo-opencl.hpp)
+ifeq ($(USE_OPENCL),1)
+CPPFLAGS_EXTRA += -DUSE_OPENCL
+LDPOSTFLAGS_EXTRA += -lOpenCL
+endif
+
+# include a standard makefile that uses these variables and builds everything
+include ../../utils/make/flight.mk
@@ -6,122 +6,288 @@
  */
 
 #include "pushbroom-stereo.hpp"
-#include <pthread.h>
+#include "pushbroom-stereo-opencl.hpp"
+#include <thread>
+#include <algorithm>
+#include <float.h>
+#include <limits.h>
+#include <time.h>
+
+#include "../../utils/utils/Clock.hpp"
+#include "../../utils/utils/Trace.hpp"
+#include "../../utils/utils/NoAllocGuard.hpp"
+
+// monotonic clock in microseconds, for timing the stages
+static inline int64_t NowMicroseconds() {
+    return GetRawMonotonicNow();
+}
 
-// if USE_SAFTEY_CHECKS is 1, GetSAD will try to make sure
-// that it will do the right thing even if you ask it for pixel
-// values near the edges of images.  Set to 0 for a small speedup.
-#define USE_SAFTEY_CHECKS 0
+// remap offset for pixels that map to outside of the camera image
+#define REMAP_LUT_OUTSIDE (-32768)
 
-#define INVARIANCE_CHECK_VERT_OFFSET_MIN (-8)
-#define INVARIANCE_CHECK_VERT_OFFSET_MAX 8
-#define INVARIANCE_CHECK_VERT_OFFSET_INCREMENT 2
+// extra columns on the census images so that the NEON census distance can
+// always load 8 bytes
+#define CENSUS_PADDING 8
 
-#define INVARIANCE_CHECK_HORZ_OFFSET_MIN (-3)
-#define INVARIANCE_CHECK_HORZ_OFFSET_MAX 3
+// The remapped and laplacian images (and the tiles) sit inside a bigger
+// buffer with this many zeroed columns on each side and rows above and
+// below, so the SIMD loads that run past the last block of a row (up to
+// 16 bytes at a time) always read memory that belongs to us, and with
+// every row starting on a cache line.  What's in the guard band never
+// makes it into a result.
+#define IMAGE_GUARD_COLS 16
+#define IMAGE_GUARD_ROWS 1
+#define IMAGE_ROW_ALIGN 64
 
-#define NUMERIC_CONST 333 // just a constant that we multiply the score by to make
-                          // all the parameters in a nice integer range
+/**
+ * Makes *image a rows x cols view into a zeroed buffer with guard borders
+ * (see IMAGE_GUARD_COLS) and 64-byte aligned rows.  Like Mat::create(),
+ * does nothing if it already is one of the right size.
+ *
+ * The view is a submatrix, so filters that look past its edges (like
+ * cv::Laplacian without BORDER_ISOLATED) see the guard band: wrap it in a
+ * header of its own first if that matters.
+ */
+static void CreatePadded(Mat *image, int rows, int cols, int type) {
 
-PushbroomStereoThreadStarter thread_starter[NUM_THREADS+1];
+    if (image->rows == rows && image->cols == cols && image->type() == type && image->isSubmatrix()) {
+        return;
+    }
 
+    int elem_size = CV_ELEM_SIZE(type);
 
-PushbroomStereo::PushbroomStereo() {
-    // init worker threads
+    // room for the guard columns on both sides and for shifting the
+    // image over to an aligned address
+    int step = (cols + 2 * IMAGE_GUARD_COLS) * elem_size + IMAGE_ROW_ALIGN;
+    step = (step + IMAGE_ROW_ALIGN - 1) / IMAGE_ROW_ALIGN * IMAGE_ROW_ALIGN;
 
+    Mat buffer = Mat::zeros(rows + 2 * IMAGE_GUARD_ROWS, step / elem_size, type);
 
+    uintptr_t first = (uintptr_t)(buffer.data + IMAGE_GUARD_COLS * elem_size);
+    int shift = (IMAGE_ROW_ALIGN - first % IMAGE_ROW_ALIGN) % IMAGE_ROW_ALIGN;
 
-    for (int i = 0; i < NUM_THREADS; i++) {
-        // start all the worker threads
+    *image = buffer(Rect(IMAGE_GUARD_COLS + shift / elem_size, IMAGE_GUARD_ROWS, cols, rows));
+}
 
 
-        data_mutexes_[i].lock();
-        SetHasNewData(i, false);
+#ifdef USE_SSE2
+    // SSE2 kernels work on one block row per 8-byte load, so they handle
+    // blocks up to 8 pixels wide; wider blocks use the scalar code
+    #define SSE2_MAX_BLOCK_SIZE 8
 
-        thread_starter[i].thread_number = i;
-        thread_starter[i].data_mutex = &(data_mutexes_[i]);
-        thread_starter[i].cv_new_data = &(cv_new_data_[i]);
-        thread_starter[i].cv_thread_finish = &(cv_thread_finish_[i]);
-        thread_starter[i].parent = this;
+    // loading 8 bytes from offset (8 - blockSize) gives a mask with the first
+    // blockSize bytes set
+    static const uchar sse2_block_mask_table[16] = {
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0, 0, 0, 0, 0, 0, 0, 0 };
 
-        lockers_[i] = unique_lock<mutex>(data_mutexes_[i], std::defer_lock);
+    static inline __m128i BlockRowMask(int blockSize) {
+        return _mm_loadl_epi64((const __m128i*)(sse2_block_mask_table + SSE2_MAX_BLOCK_SIZE - blockSize));
+    }
 
-        // start the thread
-        pthread_create(&(worker_pool_[i]), NULL, WorkerThread, &(thread_starter[i]));
+    // Loads one row of a block into the low 8 bytes of a register, with
+    // the pixels past the block zeroed.  Like the NEON code, this reads
+    // (but ignores) up to 8 - blockSize bytes past the end of the block.
+    static inline __m128i LoadBlockRow(const uchar *row, __m128i mask) {
+        return _mm_and_si128(_mm_loadl_epi64((const __m128i*)row), mask);
+    }
 
+    // Loads the same block row from two places into the two halves of a
+    // register, so a single _mm_sad_epu8 gives both sums.
+    static inline __m128i LoadBlockRowPair(const uchar *row0, const uchar *row1, __m128i mask) {
+        return _mm_unpacklo_epi64(LoadBlockRow(row0, mask), LoadBlockRow(row1, mask));
     }
-}
 
-void* PushbroomStereo::WorkerThread(void *x) {
+    // Splits a 16-byte row of the invariance check's search window into the
+    // 8-byte rows at offsets 0-6, two to a register (the last one twice),
+    // masked to the block width.  Like LoadBlockRow, the load can run a
+    // few bytes past the end of the window.
+    static inline void WindowOffsetPairs(__m128i window, __m128i pair_mask, __m128i *pairs) {
+        pairs[0] = _mm_and_si128(_mm_unpacklo_epi64(window, _mm_srli_si128(window, 1)), pair_mask);
+        pairs[1] = _mm_and_si128(_mm_unpacklo_epi64(_mm_srli_si128(window, 2), _mm_srli_si128(window, 3)), pair_mask);
+        pairs[2] = _mm_and_si128(_mm_unpacklo_epi64(_mm_srli_si128(window, 4), _mm_srli_si128(window, 5)), pair_mask);
+        pairs[3] = _mm_and_si128(_mm_unpacklo_epi64(_mm_srli_si128(window, 6), _mm_srli_si128(window, 6)), pair_mask);
+    }
 
-    PushbroomStereoThreadStarter *statet = (PushbroomStereoThreadStarter*) x;
+    // Loads 8 pixels widened to 16 bits, for the interest operator's sums.
+    static inline __m128i LoadWiden8(const uchar *p) {
+        return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)p), _mm_setzero_si128());
+    }
 
-    mutex *data_mutex = statet->data_mutex;
-    int thread_number = statet->thread_number;
-    condition_variable *cv_new_data = statet->cv_new_data;
-    condition_variable *cv_thread_finish = statet->cv_thread_finish;
+    // SSE2 has no 16-bit abs
+    static inline __m128i Abs16(__m128i x) {
+        return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+    }
+#endif // USE_SSE2
 
-    PushbroomStereo *parent = statet->parent;
+#ifdef USE_NEON
+    static inline int16x8_t LoadWiden8(const uchar *p) {
+        return vreinterpretq_s16_u16(vmovl_u8(vld1_u8(p)));
+    }
+#endif // USE_NEON
+
+// GetSADPairBlock needs SIMD: two blocks' rows side by side in one 128-bit
+// register
+#if defined(USE_NEON) || defined(USE_SSE2)
+    #define SAD_PAIR_KERNEL(size) (&PushbroomStereo::GetSADPairBlock<size>)
+#else
+    #define SAD_PAIR_KERNEL(size) NULL
+#endif
+
+// block sizes that get their own compile-time specialized SAD kernels
+#define SAD_KERNEL_CASE(size) \
+    case size: \
+        get_sad_ = &PushbroomStereo::GetSADBlock<size>; \
+        get_sad_early_exit_ = &PushbroomStereo::GetSADEarlyExitBlock<size>; \
+        get_sad_pair_ = SAD_PAIR_KERNEL(size); \
+        break
+
+
+PushbroomStereo::PushbroomStereo() : memory_(MEMORY_STEREO) {
+    StartWorkers(DefaultThreadConfig());
+}
 
-    unique_lock<mutex> locker(*data_mutex, std::defer_lock);
+PushbroomStereo::PushbroomStereo(PushbroomStereoThreadConfig thread_config) : memory_(MEMORY_STEREO) {
+    StartWorkers(thread_config);
+}
 
-    while (true) {
+/**
+ * NUM_THREADS workers with an even split of the image, on the shared pool.
+ */
+PushbroomStereoThreadConfig PushbroomStereo::DefaultThreadConfig() {
+    PushbroomStereoThreadConfig config;
 
-        // wait on the condition variable for
-        // "has new data"
-        data_mutex->lock();
-        //cout << "[thread locked]" << endl;
+    config.num_threads = NUM_THREADS;
+    config.pool = NULL;
 
-        //cout << "[thread " << thread_number << "] waiting" << endl;
-        while (parent->GetHasNewData(thread_number) == false) {
-            //cout << "[thread " << thread_number << "] inside while loop" << endl;
-            //cout << "[thread " << thread_number << "] ready for notifictaions" << endl;
-            //cout << "[thread unlocked]" << endl;
-            cv_new_data->wait(locker);
-            //cout << "[thread locked]" << endl;
-            //cout << "[thread " << thread_number << "] after wait in while loop" << endl;
-        }
+    for (int i = 0; i < MAX_THREADS; i++) {
+        config.band_weights[i] = 1;
+    }
 
-        // if we don't already have the mutex, get it
+    return config;
+}
 
-        //cout << "[thread " << thread_number << "] going" << endl;
+/**
+ * Sets up the scheduler.
+ *
+ * @param config number of workers, band weights and the pool to run them on
+ */
+void PushbroomStereo::StartWorkers(PushbroomStereoThreadConfig config) {
+
+    frame_number_ = 0;
+    frame_done_ = true;
+    workers_active_ = 0;
+    tasks_pending_ = 0;
+    frame_in_flight_ = false;
+    frame_start_us_ = 0;
+    opencl_ = NULL;
+    opencl_failed_ = false;
+    frame_on_gpu_ = false;
+    num_bands_ = 0;
+    tile_halo_ = 1;
+    tasks_per_band_ = 2;
+    block_grid_rows_ = 0;
+    block_grid_cols_ = 0;
+    temporal_frame_ = -1;
+    search_frame_ = 0;
+    frame_pass_ = PASS_ALL;
+    predicted_grid_cols_ = 0;
+    blocks_searched_ = 0;
+    blocks_skipped_ = 0;
+
+    remap_lut_left_.usable = false;
+    remap_lut_left_.map_data = NULL;
+    remap_lut_right_.usable = false;
+    remap_lut_right_.map_data = NULL;
+
+    remap_col_start_ = 0;
+    remap_col_end_ = 0;
+    interest_col_start_ = 0;
+    interest_col_end_ = 0;
+
+    get_sad_ = &PushbroomStereo::GetSADBlock<0>;
+    get_sad_early_exit_ = &PushbroomStereo::GetSADEarlyExitBlock<0>;
+    get_sad_pair_ = NULL;
+
+    num_threads_ = max(1, min(config.num_threads, MAX_THREADS));
+
+    if (num_threads_ != config.num_threads) {
+        fprintf(stderr, "Warning: %d stereo threads requested, using %d.\n", config.num_threads, num_threads_);
+    }
 
+    for (int i = 0; i < num_threads_; i++) {
+        band_weights_[i] = max(0.0f, config.band_weights[i]);
+    }
 
-        // if we're here, there's work to be done
-        //cout << "[thread " << thread_number << "] running" << endl;
+    for (int i = 0; i < MAX_BANDS; i++) {
+        band_ready_[i] = 0;
+    }
 
-        // see if that work is remapping or stereo processing
-        switch (parent->GetWorkType(thread_number)) {
-            case REMAP:
-                parent->RunRemapping(parent->GetRemapState(thread_number));
-                break;
+    ResetTiming();
 
-            case INTEREST_OP:
-                parent->RunInterestOp(parent->GetInterestOpState(thread_number));
-                break;
+    for (int i = 0; i < MAX_THREADS + 1; i++) {
+        queue_first_band_[i] = 0;
+        queue_num_bands_[i] = 0;
+        queue_next_task_[i] = 0;
+    }
 
-            case STEREO:
-                parent->RunStereoPushbroomStereo(parent->GetThreadedState(thread_number));
-                break;
+    pool_ = config.pool != NULL ? config.pool : ThreadPool::GetShared();
+}
 
-            default:
-                cerr << "Warning: unknown thread work type." << endl;
-                break;
+PushbroomStereo::~PushbroomStereo() {
+
+    // worker tasks still in the pool's queue point at us
+    {
+        unique_lock<mutex> locker(frame_mutex_);
+
+        while (tasks_pending_ > 0) {
+            cv_frame_finished_.wait(locker);
         }
+    }
+
+    delete opencl_;
+}
+
+/**
+ * One worker's share of a frame, run on the pool: its own bands, then
+ * whatever it can steal from everyone else.
+ *
+ * @param thread_number worker number, for its queue and scratch buffers
+ * @param frame_number frame it was started for
+ */
+void PushbroomStereo::WorkerTask(int thread_number, int frame_number) {
 
-        // done, signal the waiting main thread
+    bool run;
 
-        parent->SetHasNewData(thread_number, false);
-        cv_thread_finish->notify_one();
+    {
+        unique_lock<mutex> locker(frame_mutex_);
 
-        data_mutex->unlock();
-        //cout << "[thread unlocked]" << endl;
+        // if the pool got to us late, the frame is over and someone else
+        // did our work
+        run = frame_number == frame_number_ && !frame_done_;
 
-        //cout << "[thread " << thread_number << "] done" << endl;
+        if (run) {
+            workers_active_ ++;
+        }
+    }
 
+    if (run) {
+        RunTasks(thread_number);
     }
 
-    return NULL;
+    {
+        unique_lock<mutex> locker(frame_mutex_);
+
+        if (run) {
+            workers_active_ --;
+        }
+
+        tasks_pending_ --;
+
+        // while still locked: once tasks_pending_ is 0 the destructor can
+        // run, and cv_frame_finished_ goes with it
+        cv_frame_finished_.notify_all();
+    }
 }
 
 /**
@@ -133,368 +299,2894 @@ void* PushbroomStereo::WorkerThread(void *x) {
  * @param hitVector a cv::vector that we will populate with cv::Point()s
  * @param state set of configuration parameters for the function.
  *      You can change these on each run of the function if you'd like.
+ * @param pointDisparities (optional) filled in with the disparity that
+ *      each point in pointVector3d was found at
  */
-void PushbroomStereo::ProcessImages(InputArray _leftImage, InputArray _rightImage, cv::vector<Point3f> *pointVector3d, cv::vector<uchar> *pointColors, cv::vector<Point3i> *pointVector2d, PushbroomStereoState state) {
+void PushbroomStereo::ProcessImages(InputArray _leftImage, InputArray _rightImage, cv::vector<Point3f> *pointVector3d, cv::vector<uchar> *pointColors, cv::vector<Point3i> *pointVector2d, PushbroomStereoState state, cv::vector<int> *pointDisparities) {
 
-    //cout << "[main] entering process images" << endl;
+    // don't mix with Submit() / Poll()
+    CV_Assert(!frame_in_flight_);
 
-    Mat leftImage = _leftImage.getMat();
-    Mat rightImage = _rightImage.getMat();
+    StartFrame(_leftImage, _rightImage, state);
+    FinishFrame(true);
 
-    // make sure that the inputs are of the right type
-    CV_Assert(leftImage.type() == CV_8UC1 && rightImage.type() == CV_8UC1);
+    int64_t merge_start = NowMicroseconds();
 
-    // we want to use the sum-of-absolute-differences (SAD) algorithm
-    // on a single disparity
+    int numPoints = 0;
+    // compute the required size of our return vector
+    // this prevents multiple memory allocations
+    for (int i = 0; i < num_bands_; i++)
+    {
+        numPoints += bands_[i].localHitPoints.size();
+    }
+    pointColors->reserve(numPoints);
 
-    // split things up so we can parallelize
-    int rows = leftImage.rows;
+    int counter = pointVector3d->size();
+    pointVector3d->resize(counter + numPoints);
+
+    // combine the hit vectors (in band order, so the output is in
+    // the same order no matter which thread ran which band)
+    for (int i = 0; i < num_bands_; i++)
+    {
+        if (bands_[i].localHitPoints.size() > 0) {
+            Point3f *out = &((*pointVector3d)[counter]);
+
+            ReprojectHits(bands_[i].localHitPoints, 1, &(out->x), &(out->y), &(out->z), 3);
 
-    // first parallelize remaping
+            counter += bands_[i].localHitPoints.size();
+        }
 
-    // we split these arrays up and send them into each
-    // thread so at the end, each thread has written to the
-    // appropriate spot in the array
-    Mat remapped_left(state.mapxL.rows, state.mapxL.cols, leftImage.depth());
-    Mat remapped_right(state.mapxR.rows, state.mapxR.cols, rightImage.depth());
+        pointColors->insert( pointColors->end(), bands_[i].pointColors.begin(), bands_[i].pointColors.end() );
 
+        if (state.show_display)
+        {
+            pointVector2d->insert( pointVector2d->end(), bands_[i].pointVector2d.begin(), bands_[i].pointVector2d.end() );
+        }
 
+        if (pointDisparities != NULL)
+        {
+            pointDisparities->insert( pointDisparities->end(), bands_[i].pointDisparities.begin(), bands_[i].pointDisparities.end() );
+        }
+    }
 
-    for (int i = 0; i < NUM_THREADS; i++) {
+    RecordTiming(&stage_timing_[STAGE_MERGE], merge_start, NowMicroseconds());
 
-        int start = rows/NUM_THREADS*i;
-        int end = rows/NUM_THREADS*(i+1);
+}
 
-        remap_thread_states_[i].left_image = leftImage;
-        remap_thread_states_[i].right_image = rightImage;
+/**
+ * Same as above, but writes the hits straight into caller-owned arrays in
+ * the layout of an lcmt_stereo message, reusing their memory.
+ *
+ * @param _leftImage left camera image as a CV_8UC1
+ * @param _rightImage right camera image as a CV_8UC1
+ * @param buffers (output) hits for this frame.  Pass the same buffers
+ *      every frame.
+ * @param state set of configuration parameters for the function.
+ * @param unit_conversion the 3D points are divided by this (for
+ *      calibrationUnitConversion)
+ */
+void PushbroomStereo::ProcessImages(InputArray _leftImage, InputArray _rightImage, PushbroomStereoFrameBuffers *buffers, PushbroomStereoState state, float unit_conversion) {
+    NO_ALLOC_SCOPE("stereo-process-images");
 
-        // send in a subset of the map
-        remap_thread_states_[i].submapxL = state.mapxL.rowRange(start, end);
-        remap_thread_states_[i].submapxR = state.mapxR.rowRange(start, end);
+    CV_Assert(!frame_in_flight_);
 
-        // send in subsets of the arrays to be filled in
-        remap_thread_states_[i].sub_remapped_left_image = remapped_left.rowRange(start, end);
+    StartFrame(_leftImage, _rightImage, state);
+    FinishFrame(true);
 
-        remap_thread_states_[i].sub_remapped_right_image = remapped_right.rowRange(start, end);
+    CollectHits(buffers, unit_conversion);
+    CollectRectified(buffers);
+}
 
-        StartWorkerThread(i, REMAP);
+/**
+ * Starts stereo on a frame and returns right away.  The worker threads
+ * hold on to the images until the frame is done, so don't write to them
+ * or give them back to the camera (see Format7FramePool) in the meantime.
+ *
+ * If there are predicted regions, the frame runs in two passes over the
+ * same blocks: first the blocks that touch a region, whose hits
+ * PollPredicted() returns, and then the rest.  The passes get the same
+ * hits as searching the frame in one go, but the row bands around the
+ * regions are remapped and filtered twice.  Frames that go to the GPU
+ * or use random_results ignore the regions.
+ *
+ * @param _leftImage left camera image as a CV_8UC1
+ * @param _rightImage right camera image as a CV_8UC1
+ * @param state set of configuration parameters for the function.
+ * @param predicted_regions (optional) regions of the remapped image to
+ *      search first
+ *
+ * @retval false if the last frame hasn't been collected with Poll() yet,
+ *      in which case this frame is not started
+ */
+bool PushbroomStereo::Submit(InputArray _leftImage, InputArray _rightImage, PushbroomStereoState state, const cv::vector<Rect> *predicted_regions) {
+    NO_ALLOC_SCOPE("stereo-submit");
 
+    if (frame_in_flight_) {
+        return false;
     }
-    //cout << "[main] all remap threads started" << endl;
 
+    PushbroomStereoState predicted_state;
 
-    // wait for all remapping threads to finish
-    SyncWorkerThreads();
+    if (predicted_regions != NULL && SetupPredictedBlocks(*predicted_regions, state, &predicted_state)) {
+        search_state_ = state;
+        StartFrame(_leftImage, _rightImage, predicted_state, PASS_PREDICTED);
+    } else {
+        StartFrame(_leftImage, _rightImage, state);
+    }
 
-    //cout << "[main] all remap threads finished" << endl;
+    frame_in_flight_ = true;
 
+    return true;
+}
 
-    Mat laplacian_left(remapped_left.rows, remapped_left.cols, remapped_left.depth());
-    Mat laplacian_right(remapped_right.rows, remapped_right.cols, remapped_right.depth());
+/**
+ * Collects the hits in the predicted regions of the frame started with
+ * Submit(), once they have all been searched, and starts on the rest of
+ * the frame.
+ *
+ * @param buffers (output) hits in the predicted regions.  Pass the same
+ *      buffers to Poll() to add the rest of the frame's hits to them.
+ * @param unit_conversion the 3D points are divided by this
+ * @param wait if true, help the workers finish the regions and wait for
+ *      them instead of returning right away
+ * @param search_rest if false, the rest of the frame is skipped (when
+ *      there isn't time for it) and the frame is over
+ *
+ * @retval true if buffers got the hits, false if there is no frame, it
+ *      didn't have predicted regions (or they have already been
+ *      collected), or (without wait) they aren't done yet
+ */
+bool PushbroomStereo::PollPredicted(PushbroomStereoFrameBuffers *buffers, float unit_conversion, bool wait, bool search_rest) {
 
-    for (int i = 0; i < NUM_THREADS; i++) {
+    if (!frame_in_flight_ || frame_pass_ != PASS_PREDICTED || !FinishFrame(wait)) {
+        return false;
+    }
 
-        int start = rows/NUM_THREADS*i;
-        int end = rows/NUM_THREADS*(i+1);
+    CollectHits(buffers, unit_conversion);
 
-        interest_op_states_[i].left_image = remapped_left;
-        interest_op_states_[i].right_image = remapped_right;
+    if (search_rest) {
+        StartFrame(left_image_, right_image_, search_state_, PASS_REST);
+    } else {
+        frame_in_flight_ = false;
+        RecordTiming(&stage_timing_[STAGE_FRAME], frame_start_us_, NowMicroseconds());
 
-        // send in subsets of the arrays to be filled in
+        CollectRectified(buffers);
+    }
 
-        interest_op_states_[i].sub_laplacian_left = laplacian_left.rowRange(start, end);
-        interest_op_states_[i].sub_laplacian_right = laplacian_right.rowRange(start, end);
+    return true;
+}
 
-        interest_op_states_[i].row_start = start;
-        interest_op_states_[i].row_end = end;
+/**
+ * Collects the hits from the frame started with Submit(), if it is done.
+ *
+ * @param buffers (output) hits for the frame, as for ProcessImages().
+ *      If PollPredicted() already put the predicted regions' hits in
+ *      them, the rest are added after those.
+ * @param unit_conversion the 3D points are divided by this
+ * @param wait if true, help the workers finish the frame and wait for
+ *      it instead of returning right away
+ *
+ * @retval true if buffers got the frame's hits, false if there is no
+ *      frame or (without wait) it isn't done yet
+ */
+bool PushbroomStereo::Poll(PushbroomStereoFrameBuffers *buffers, float unit_conversion, bool wait) {
+    NO_ALLOC_SCOPE("stereo-poll");
 
+    if (frame_in_flight_ && frame_pass_ == PASS_PREDICTED) {
+        if (!PollPredicted(buffers, unit_conversion, wait)) {
+            return false;
+        }
+    }
 
-        StartWorkerThread(i, INTEREST_OP);
+    if (!frame_in_flight_ || !FinishFrame(wait)) {
+        return false;
     }
 
-    SyncWorkerThreads();
+    frame_in_flight_ = false;
 
-    // now we have fully remapped both images
-    //imshow("Left Block", remapped_right);
-    //imshow("Right Block", laplacian_right);
+    CollectHits(buffers, unit_conversion, frame_pass_ == PASS_REST);
+    CollectRectified(buffers);
+
+    return true;
+}
+
+/**
+ * Merges the bands' hits from the last frame into the output arrays.
+ *
+ * @param buffers (output) hits for the frame
+ * @param unit_conversion the 3D points are divided by this
+ * @param append if true, add the hits after the ones already in buffers
+ *      (from the first pass of the frame) instead of replacing them
+ */
+void PushbroomStereo::CollectHits(PushbroomStereoFrameBuffers *buffers, float unit_conversion, bool append) {
+    TRACE_SCOPE("stereo-collect-hits");
 
-    //cout << "[main] imshow2 ok" << endl;
+    PushbroomStereoState &state = frame_state_;
 
-    cv::vector<Point3f> pointVector3dArray[NUM_THREADS+1];
-    cv::vector<Point3i> pointVector2dArray[NUM_THREADS+1];
-    cv::vector<uchar> pointColorsArray[NUM_THREADS+1];
+    int64_t merge_start = NowMicroseconds();
 
-    //cout << "[main] firing worker threads..." << endl;
+    // where this pass's hits go
+    int counter = append ? buffers->number_of_points : 0;
+    int counter2d = append ? (int)buffers->pointVector2d.size() : 0;
 
-    if (state.lastValidPixelRow > 0) {
+    int numPoints = counter, num2dPoints = counter2d;
 
-        // crop image to be only include valid pixels
-        rows = state.lastValidPixelRow;
+    for (int i = 0; i < num_bands_; i++)
+    {
+        numPoints += bands_[i].localHitPoints.size();
+        num2dPoints += bands_[i].pointVector2d.size();
     }
 
+    // resize() keeps the capacity, so this only allocates when a
+    // frame has more hits than any frame before it
+    buffers->x.resize(numPoints);
+    buffers->y.resize(numPoints);
+    buffers->z.resize(numPoints);
+    buffers->grey.resize(numPoints);
+    buffers->disparities.resize(numPoints);
+    buffers->image_hits.resize(numPoints);
+    buffers->pointVector2d.resize(state.show_display ? num2dPoints : 0);
 
-    // figure out how to split up the work
-    int thread_increment = RoundUp(rows/NUM_THREADS, state.blockSize);
-    int last_thread_num_rows = rows - thread_increment * (NUM_THREADS - 1);
+    buffers->number_of_points = numPoints;
 
-    // make sure the last thread has a number of rows divisible by the block size
-    last_thread_num_rows = last_thread_num_rows - last_thread_num_rows % state.blockSize;
+    // in band order, like above
+    for (int i = 0; i < num_bands_; i++)
+    {
+        PushbroomStereoBand *band = &(bands_[i]);
 
-    //printf("thread increment: %d, last thread: %d\n", thread_increment, last_thread_num_rows);
+        int band_points = band->localHitPoints.size();
 
-    for (int i=0;i<NUM_THREADS;i++)
-    {
+        if (band_points > 0)
+        {
+            ReprojectHits(band->localHitPoints, 1.0f / unit_conversion,
+                &(buffers->x[counter]), &(buffers->y[counter]), &(buffers->z[counter]), 1);
 
-        thread_states_[i].state = state;
+            std::copy(band->pointColors.begin(), band->pointColors.end(), buffers->grey.begin() + counter);
+            std::copy(band->pointDisparities.begin(), band->pointDisparities.end(), buffers->disparities.begin() + counter);
+            std::copy(band->localHitPoints.begin(), band->localHitPoints.end(), buffers->image_hits.begin() + counter);
 
-        int start = thread_increment * i;
-        int end;
+            counter += band_points;
+        }
 
-        if (i < NUM_THREADS - 1) {
-            // not the last thread
-            end = thread_increment*(i+1) - 1;
-        } else {
-            // the last thread
-            end = start + last_thread_num_rows - 1;
+        if (state.show_display)
+        {
+            std::copy(band->pointVector2d.begin(), band->pointVector2d.end(), buffers->pointVector2d.begin() + counter2d);
+            counter2d += band->pointVector2d.size();
         }
+    }
 
-        //printf("start: %d, end: %d\n", start, end);
+    RecordTiming(&stage_timing_[STAGE_MERGE], merge_start, NowMicroseconds());
 
-        // send in the whole image because each thread needs
-        // the entire image to do its small remapping job
-        thread_states_[i].remapped_left = remapped_left;
-        thread_states_[i].remapped_right = remapped_right;
+    MeasureMemory();
+}
 
-        thread_states_[i].laplacian_left = laplacian_left;
-        thread_states_[i].laplacian_right = laplacian_right;
+// bytes a Mat's data takes up, shared or not
+static int64_t MatBytes(const Mat &mat) {
+    return mat.data == NULL ? 0 : (int64_t)(mat.dataend - mat.datastart);
+}
 
-        thread_states_[i].pointVector3d = &pointVector3dArray[i];
-        thread_states_[i].pointVector2d = &pointVector2dArray[i];
-        thread_states_[i].pointColors = &pointColorsArray[i];
-        thread_states_[i].row_start = start;
-        thread_states_[i].row_end = end;
+/**
+ * Reports what the per-frame images, tiles, band hit lists and block
+ * memory have grown to (see MemoryAccounting.hpp).  The caller's
+ * PushbroomStereoFrameBuffers aren't counted.
+ */
+void PushbroomStereo::MeasureMemory() {
 
+    int64_t bytes = MatBytes(remapped_left_) + MatBytes(remapped_right_) + MatBytes(laplacian_left_)
+        + MatBytes(laplacian_right_) + MatBytes(census_left_) + MatBytes(census_right_)
+        + MatBytes(remap_lut_left_.offsets) + MatBytes(remap_lut_right_.offsets);
 
+    for (int i = 0; i < MAX_THREADS + 1; i++) {
+        bytes += MatBytes(remap_tile_left_[i]) + MatBytes(remap_tile_right_[i])
+            + MatBytes(laplacian_tile_left_[i]) + MatBytes(laplacian_tile_right_[i])
+            + MatBytes(census_tile_left_[i]) + MatBytes(census_tile_right_[i])
+            + MatBytes(interest_integral_left_[i]) + MatBytes(interest_integral_right_[i]);
+    }
 
-        // fire the worker thread
-        StartWorkerThread(i, STEREO);
+    for (int i = 0; i < MAX_BANDS; i++) {
+        bytes += VectorBytes(bands_[i].localHitPoints) + VectorBytes(bands_[i].pointVector2d)
+            + VectorBytes(bands_[i].pointColors) + VectorBytes(bands_[i].pointDisparities);
     }
 
-    // wait for all the threads to come back
-    SyncWorkerThreads();
+    bytes += VectorBytes(block_history_) + VectorBytes(block_hits_[0]) + VectorBytes(block_hits_[1])
+        + VectorBytes(predicted_blocks_);
 
-    //cout << "[main] got all stereo" << endl;
+    memory_.Set(bytes);
+}
 
-    int numPoints = 0;
-    // compute the required size of our return vector
-    // this prevents multiple memory allocations
-    for (int i=0;i<NUM_THREADS;i++)
-    {
-        numPoints += pointVector3dArray[i].size();
+/**
+ * Hands the last frame's rectified images and laplacians to the caller,
+ * if state.keep_rectified is set.  If the frame made all of them, the
+ * buffers are swapped, otherwise (a search region, the fused pipeline,
+ * the GPU or predicted regions) the whole images are remapped and
+ * filtered here.
+ *
+ * @param buffers (output) the frame's buffers
+ */
+void PushbroomStereo::CollectRectified(PushbroomStereoFrameBuffers *buffers) {
+
+    if (!frame_state_.keep_rectified) {
+        return;
     }
-    pointVector3d->reserve(numPoints);
-    pointColors->reserve(numPoints);
 
-    // combine the hit vectors
-    for (int i=0;i<NUM_THREADS;i++)
-    {
-        pointVector3d->insert( pointVector3d->end(), pointVector3dArray[i].begin(), pointVector3dArray[i].end() );
+    TRACE_SCOPE("stereo-collect-rectified");
 
-        pointColors->insert( pointColors->end(), pointColorsArray[i].begin(), pointColorsArray[i].end() );
+    if (rectified_whole_) {
+        // the next frame writes into the caller's old ones, which are
+        // already the right size
+        swap(buffers->remapped_left, remapped_left_);
+        swap(buffers->remapped_right, remapped_right_);
+        swap(buffers->laplacian_left, laplacian_left_);
+        swap(buffers->laplacian_right, laplacian_right_);
+        return;
+    }
 
-        if (state.show_display)
-        {
-            pointVector2d->insert( pointVector2d->end(), pointVector2dArray[i].begin(), pointVector2dArray[i].end() );
+    int rows = frame_state_.mapxL.rows;
+    int cols = frame_state_.mapxL.cols;
+
+    buffers->remapped_left.create(rows, cols, left_image_.type());
+    buffers->remapped_right.create(rows, cols, right_image_.type());
+
+    RemapRows(left_image_, frame_state_.mapxL, &remap_lut_left_, 0, rows, Range(0, cols), buffers->remapped_left);
+    RemapRows(right_image_, frame_state_.mapxR, &remap_lut_right_, 0, rows, Range(0, cols), buffers->remapped_right);
+
+    // these can be padded views (see CreatePadded) from an earlier swap,
+    // which InterestOperator doesn't read past
+    buffers->laplacian_left.create(rows, cols, left_image_.type());
+    buffers->laplacian_right.create(rows, cols, right_image_.type());
+
+    InterestOperator(buffers->remapped_left, 0, rows, Range(0, cols), buffers->laplacian_left, frame_state_.interest_operator);
+    InterestOperator(buffers->remapped_right, 0, rows, Range(0, cols), buffers->laplacian_right, frame_state_.interest_operator);
+}
+
+/**
+ * Reads the reprojection matrix for this frame into doubles.
+ *
+ * @param Q 4x4 reprojection matrix (CV_64F or CV_32F), as for
+ *      perspectiveTransform
+ */
+void PushbroomStereo::LoadReprojection(Mat Q) {
+
+    for (int i = 0; i < 16; i++) {
+        if (Q.depth() == CV_32F) {
+            reprojection_[i] = Q.at<float>(i / 4, i % 4);
+        } else {
+            reprojection_[i] = Q.at<double>(i / 4, i % 4);
         }
     }
-
 }
 
-void PushbroomStereo::StartWorkerThread(int i, ThreadWorkType work_type) {
+/**
+ * Reprojects hits from (u, v, -disparity) to 3D, like perspectiveTransform
+ * with state.Q, and scales them.
+ *
+ * For a Q from stereoRectify, w only depends on the disparity, so for a
+ * run of hits at the same disparity (a whole band, in single-disparity
+ * mode) the reprojection is an affine function of (u, v).  The
+ * coefficients get worked out once per run and the inner loop is just
+ * multiply-adds.
+ *
+ * @param hits hits as (u, v, -disparity)
+ * @param scale multiply the 3D points by this
+ * @param x (output) x coordinates
+ * @param y (output) y coordinates
+ * @param z (output) z coordinates
+ * @param stride distance between consecutive outputs, in floats (1 for
+ *      separate arrays, 3 to write into Point3fs)
+ */
+void PushbroomStereo::ReprojectHits(const cv::vector<Point3f> &hits, float scale, float *x, float *y, float *z, int stride) {
+
+    const double *m = reprojection_;
 
-    work_type_[i] = work_type;
+    int num_hits = hits.size();
 
-    SetHasNewData(i, true);
+    if (m[12] != 0 || m[13] != 0) {
+        // w depends on u and v, so do the full projective transform
 
-    data_mutexes_[i].unlock();
-    //cout << "[main unlocked]" << endl;
+        for (int i = 0; i < num_hits; i++) {
+            double u = hits[i].x, v = hits[i].y, d = hits[i].z;
 
+            double w = m[12]*u + m[13]*v + m[14]*d + m[15];
+            w = fabs(w) > FLT_EPSILON ? scale / w : 0;
 
-    //cout << "[main] notifying [" << i << "]" << endl;
-    cv_new_data_[i].notify_one();
-}
+            x[i*stride] = (float)((m[0]*u + m[1]*v + m[2]*d + m[3]) * w);
+            y[i*stride] = (float)((m[4]*u + m[5]*v + m[6]*d + m[7]) * w);
+            z[i*stride] = (float)((m[8]*u + m[9]*v + m[10]*d + m[11]) * w);
+        }
+        return;
+    }
+
+    int run_start = 0;
+
+    while (run_start < num_hits) {
+
+        float d = hits[run_start].z;
 
-void PushbroomStereo::SyncWorkerThreads() {
+        int run_end = run_start + 1;
+        while (run_end < num_hits && hits[run_end].z == d) {
+            run_end ++;
+        }
+
+        double w = m[14]*d + m[15];
+        w = fabs(w) > FLT_EPSILON ? scale / w : 0;
 
-    //cout << "[main] in sync workers" << endl;
-    for (int i=0;i<NUM_THREADS;i++) {
+        float ax = m[0]*w, bx = m[1]*w, cx = (m[2]*d + m[3])*w;
+        float ay = m[4]*w, by = m[5]*w, cy = (m[6]*d + m[7])*w;
+        float az = m[8]*w, bz = m[9]*w, cz = (m[10]*d + m[11])*w;
 
-        //cout << "[main] trying for lock [" << i << "]" << endl;
-        data_mutexes_[i].lock();
-        //cout << "[main locked]" << endl;
+        for (int i = run_start; i < run_end; i++) {
+            float u = hits[i].x, v = hits[i].y;
 
-        while (GetHasNewData(i) == true) {
-            //cout << "[main] waiting on [" << i << "]" << endl;
-            // wait for the thread to finish
-            //cout << "[main unlocked]" << endl;
-            cv_thread_finish_[i].wait(lockers_[i]);
-            //cout << "[main locked]" << endl;
+            x[i*stride] = ax*u + bx*v + cx;
+            y[i*stride] = ay*u + by*v + cy;
+            z[i*stride] = az*u + bz*v + cz;
         }
+
+        run_start = run_end;
     }
-    //cout << "[main] leaving sync workers" << endl;
 }
 
 /**
- * Function (for running in a thread) that remaps images
+ * Sets up a frame and wakes up the worker threads to run it.  Once
+ * FinishFrame() says it is done, each band's vectors hold its hits.
  *
+ * @param pass PASS_ALL for the whole frame, or which of the two passes
+ *      of a frame with predicted regions this is (see Submit())
  */
-void PushbroomStereo::RunRemapping(RemapThreadState *remap_state) {
+void PushbroomStereo::StartFrame(InputArray _leftImage, InputArray _rightImage, PushbroomStereoState state, int pass) {
+    TRACE_SCOPE("stereo-start-frame");
 
-    // remap this part of the image
+    //cout << "[main] entering process images" << endl;
 
-    remap(remap_state->left_image, remap_state->sub_remapped_left_image, remap_state->submapxL, Mat(), INTER_NEAREST);
-    remap(remap_state->right_image, remap_state->sub_remapped_right_image, remap_state->submapxR, Mat(), INTER_NEAREST);
+    if (pass != PASS_REST) {
+        frame_start_us_ = NowMicroseconds();
+    }
 
+    if (pass == PASS_ALL) {
+        search_state_ = state;
+    }
 
+    frame_pass_ = pass;
 
-}
+    Mat leftImage = _leftImage.getMat();
+    Mat rightImage = _rightImage.getMat();
+
+    // make sure that the inputs are of the right type
+    CV_Assert(leftImage.type() == CV_8UC1 && rightImage.type() == CV_8UC1);
+
+    // we want to use the sum-of-absolute-differences (SAD) algorithm
+    // on a single disparity
+
+    frame_state_ = state;
+    LoadReprojection(state.Q);
+
+    left_image_ = leftImage;
+    right_image_ = rightImage;
+
+    UpdateRemapLut(state.mapxL, leftImage, &remap_lut_left_);
+    UpdateRemapLut(state.mapxR, rightImage, &remap_lut_right_);
+
+    // each band task writes its rows of these, so at the end
+    // of the frame they are fully filled in.  CreatePadded() is a no-op
+    // when the size hasn't changed, so these get reused from frame to frame
+    CreatePadded(&remapped_left_, state.mapxL.rows, state.mapxL.cols, leftImage.depth());
+    CreatePadded(&remapped_right_, state.mapxR.rows, state.mapxR.cols, rightImage.depth());
+
+    CreatePadded(&laplacian_left_, remapped_left_.rows, remapped_left_.cols, remapped_left_.depth());
+    CreatePadded(&laplacian_right_, remapped_right_.rows, remapped_right_.cols, remapped_right_.depth());
+
+    if (state.census_matching) {
+        census_left_.create(remapped_left_.rows, remapped_left_.cols + CENSUS_PADDING, CV_8UC1);
+        census_right_.create(remapped_right_.rows, remapped_right_.cols + CENSUS_PADDING, CV_8UC1);
+    }
+
+    // split things up so we can parallelize
+    SetupBands(remapped_left_.rows, remapped_left_.cols, state);
+
+    frame_on_gpu_ = StartFrameOpenCL(state);
+
+    rectified_whole_ = pass == PASS_ALL && !frame_on_gpu_ && !state.fused_pipeline && num_bands_ > 0
+        && bands_[0].row_start == 0 && bands_[num_bands_ - 1].row_end == remapped_left_.rows
+        && interest_col_start_ == 0 && interest_col_end_ == remapped_left_.cols;
+
+    if (frame_on_gpu_) {
+        // the workers sit this one out
+        return;
+    }
+
+    // start the frame: one task per worker, ahead of anything else waiting
+    // for the pool
+    int frame_number;
+
+    {
+        unique_lock<mutex> locker(frame_mutex_);
 
-void PushbroomStereo::RunInterestOp(InterestOpState *interest_state) {
+        frame_number = ++frame_number_;
+        frame_done_ = false;
 
-    // apply interest operator
-    Laplacian(interest_state->left_image.rowRange(interest_state->row_start, interest_state->row_end), interest_state->sub_laplacian_left, -1, 3, 1, 0, BORDER_DEFAULT);
+        if (pass != PASS_REST) {
+            search_frame_ ++;
+        }
+
+        tasks_pending_ += num_threads_;
+    }
 
-    Laplacian(interest_state->right_image.rowRange(interest_state->row_start, interest_state->row_end), interest_state->sub_laplacian_right, -1, 3, 1, 0, BORDER_DEFAULT);
+    // the pool's queues are deques, which take a new block every few
+    // tasks (and the lambda fits in std::function without allocating)
+    NO_ALLOC_ALLOW();
 
+    for (int i = 0; i < num_threads_; i++) {
+        pool_->Submit([this, i, frame_number]() { WorkerTask(i, frame_number); }, THREAD_POOL_HIGH);
+    }
 }
 
 /**
- * Function that actually does the work for the PushbroomStereo algorithm.
+ * Checks if the worker threads are done with the frame, or waits for them.
  *
- * @param statet all the parameters are set
- *          as a PushbroomStereoStateThreaded struct.
+ * @param wait if true, steal work from the workers until the frame is
+ *      done and wait for them to come back
  *
- * @retval will always be NULL since the real values are passed
- *      back in the vector that is in statet.
+ * @retval true if the frame is done
  */
-void PushbroomStereo::RunStereoPushbroomStereo(PushbroomStereoStateThreaded *statet)
-{
+bool PushbroomStereo::FinishFrame(bool wait) {
+    TRACE_SCOPE("stereo-finish-frame");
 
-    Mat leftImage = statet->remapped_left;
-    Mat rightImage = statet->remapped_right;
-    Mat laplacian_left = statet->laplacian_left;
-    Mat laplacian_right = statet->laplacian_right;
+    if (frame_on_gpu_) {
+        int64_t stage_us[3];
 
-    cv::vector<Point3f> *pointVector3d = statet->pointVector3d;
-    cv::vector<Point3i> *pointVector2d = statet->pointVector2d;
-    cv::vector<uchar> *pointColors = statet->pointColors;
+        if (!opencl_->Finish(wait, &(bands_[0]), stage_us)) {
+            return false;
+        }
 
-    int row_start = statet->row_start;
-    int row_end = statet->row_end;
+        // the GPU times the whole frame's remap, interest operator and
+        // stereo instead of each band's
+        RecordTiming(&stage_timing_[STAGE_REMAP], 0, stage_us[0]);
+        RecordTiming(&stage_timing_[STAGE_INTEREST], 0, stage_us[1]);
+        RecordTiming(&stage_timing_[STAGE_STEREO], 0, stage_us[2]);
 
-    PushbroomStereoState state = statet->state;
+    } else {
+        if (wait) {
+            // the calling thread has no bands of its own, but it would be idle
+            // otherwise, so it steals work from everyone else
+            RunTasks(num_threads_);
+        }
 
-    // we will do this by looping through every block in the left image
-    // (defined by blockSize) and checking for a matching value on
-    // the right image
+        // wait for the workers that started to come back.  Once every task
+        // is claimed, ones that haven't started yet have nothing to do.
+        {
+            unique_lock<mutex> locker(frame_mutex_);
 
-    cv::vector<Point3f> localHitPoints;
+            if (!wait && (workers_active_ > 0 || TasksLeft())) {
+                return false;
+            }
 
-    int blockSize = state.blockSize;
-    int disparity = state.disparity;
-    int sadThreshold = state.sadThreshold;
+            while (workers_active_ > 0) {
+                cv_frame_finished_.wait(locker);
+            }
 
-    int startJ = 0;
-    int stopJ = leftImage.cols - (disparity + blockSize);
-    if (disparity < 0)
-    {
-        startJ = -disparity;
-        stopJ = leftImage.cols - blockSize;
+            frame_done_ = true;
+        }
     }
 
-    //printf("row_start: %d, row_end: %d, startJ: %d, stopJ: %d, rows: %d, cols: %d\n", row_start, row_end, startJ, stopJ, leftImage.rows, leftImage.cols);
+    if (frame_pass_ != PASS_PREDICTED) {
+        RecordTiming(&stage_timing_[STAGE_FRAME], frame_start_us_, NowMicroseconds());
+    }
 
-    int hitCounter = 0;
+    // the second pass adds to the first one's counts
+    if (frame_pass_ != PASS_REST) {
+        blocks_searched_ = 0;
+        blocks_skipped_ = 0;
+    }
 
+    for (int i = 0; i < num_bands_; i++) {
+        blocks_searched_ += bands_[i].blocks_searched;
+        blocks_skipped_ += bands_[i].blocks_skipped;
+    }
 
-    if (state.random_results < 0) {
-        for (int i=row_start; i < row_end; i+=blockSize)
-        {
-            for (int j=startJ; j < stopJ; j+=blockSize)
-            {
-                // get the sum of absolute differences for this location
-                // on both images
-                int sad = GetSAD(leftImage, rightImage, laplacian_left, laplacian_right, j, i, state);
-                // check to see if the SAD is below the threshold,
-                // indicating a hit
-                if (sad < sadThreshold && sad >= 0)
-                {
-                    // got a hit
+    //cout << "[main] got all stereo" << endl;
+
+    return true;
+}
+
+/**
+ * Hands the frame to the GPU, if state.use_opencl is set and the OpenCL
+ * backend can do it.  Call after SetupBands(), which works out the
+ * rows to search.
+ *
+ * @param state stereo parameters for this frame
+ *
+ * @retval true if the frame is running on the GPU, false if it should
+ *      go to the worker threads
+ */
+bool PushbroomStereo::StartFrameOpenCL(PushbroomStereoState state) {
+
+    if (!state.use_opencl || opencl_failed_ || num_bands_ < 1
+        || !PushbroomStereoOpenCL::Supports(state)) {
+
+        return false;
+    }
+
+    if (opencl_ == NULL) {
+        opencl_ = new PushbroomStereoOpenCL();
+
+        if (!opencl_->Init()) {
+            fprintf(stderr, "Warning: OpenCL stereo is not available, using the CPU.\n");
 
-                    // now check for horizontal invariance
-                    // (ie check for parts of the image that look the same as this
-                    // which would indicate that this might be a false-positive)
+            delete opencl_;
+            opencl_ = NULL;
+            opencl_failed_ = true;
+
+            return false;
+        }
+    }
+
+    // all of the bands' blocks, which all start a multiple of blockSize
+    // down from the first band
+    int row_start = bands_[0].stereo_row_start;
+    int row_end = row_start;
+
+    for (int i = 0; i < num_bands_; i++) {
+        row_end = max(row_end, bands_[i].stereo_row_end);
+    }
+
+    // same columns as RunStereoPushbroomStereo
+    int col_start = max(max(0, -state.disparity), state.roi_left);
+    int col_end = remapped_left_.cols - state.blockSize - max(0, state.disparity);
+
+    if (state.roi_right > 0) {
+        col_end = min(col_end, state.roi_right - state.blockSize + 1);
+    }
+
+    // the hits all go in the first band, SetupBands has emptied the others
+    opencl_->Enqueue(left_image_, right_image_, state, row_start, row_end, col_start, col_end);
+
+    return true;
+}
+
+void PushbroomStereo::GetBlockCounts(int *blocks_searched, int *blocks_skipped) {
+    *blocks_searched = blocks_searched_;
+    *blocks_skipped = blocks_skipped_;
+}
+
+/**
+ * Works out the region that blocks have to fit in: state's region, cut
+ * down by lastValidPixelRow and the mask.  Blocks start on rows top,
+ * top + blockSize, ...
+ *
+ * @param rows number of rows in the (remapped) image
+ * @param cols number of columns in the (remapped) image
+ * @param state stereo parameters for this frame
+ * @param top (output) first row of the region
+ * @param bottom (output) one past the last row of the region
+ * @param left (output) first column of the region
+ * @param right (output) one past the last column of the region
+ */
+void PushbroomStereo::GetSearchRegion(int rows, int cols, PushbroomStereoState state, int *top, int *bottom, int *left, int *right) {
+
+    *top = max(0, state.roi_top);
+    *bottom = state.roi_bottom > 0 ? min(rows, state.roi_bottom) : rows;
+    *left = max(0, state.roi_left);
+    *right = state.roi_right > 0 ? min(cols, state.roi_right) : cols;
+
+    if (state.lastValidPixelRow > 0) {
+
+        // crop image to be only include valid pixels
+        *bottom = min(*bottom, state.lastValidPixelRow);
+    }
+
+    if (!state.roi_mask.empty()) {
+        // no need to look at anything outside of the mask either
+        int mask_top, mask_bottom, mask_left, mask_right;
+        GetMaskBounds(state.roi_mask, &mask_top, &mask_bottom, &mask_left, &mask_right);
+
+        *top = max(*top, mask_top);
+        *bottom = min(*bottom, mask_bottom + state.blockSize - 1);
+        *left = max(*left, mask_left);
+        *right = min(*right, mask_right + state.blockSize - 1);
+    }
+}
+
+/**
+ * Gets the rows that the last frame's bands covered.  Without
+ * state.deadline_us, every band is BAND_FULL.
+ *
+ * @param coverage (output) one entry per band with rows to search, from
+ *      the top down
+ */
+void PushbroomStereo::GetCoverage(cv::vector<PushbroomStereoCoverage> *coverage) {
+
+    coverage->clear();
+
+    int blockSize = frame_state_.blockSize;
+
+    for (int i = 0; i < num_bands_; i++) {
+        const PushbroomStereoBand *band = &(bands_[i]);
+
+        if (band->stereo_row_end <= band->stereo_row_start) {
+            continue;
+        }
+
+        // through the bottom of the band's last row of blocks
+        int last_block_row = band->stereo_row_start
+            + (band->stereo_row_end - 1 - band->stereo_row_start) / blockSize * blockSize;
+
+        PushbroomStereoCoverage band_coverage;
+        band_coverage.row_start = band->stereo_row_start;
+        band_coverage.row_end = last_block_row + blockSize;
+        band_coverage.quality = band->quality;
+
+        coverage->push_back(band_coverage);
+    }
+}
+
+/**
+ * Splits the rows the stereo search reads into bands, figures out which
+ * bands each band's stereo task depends on, and hands out contiguous runs
+ * of bands to each worker's queue.  Also works out which columns need to
+ * be remapped and filtered.
+ *
+ * @param rows number of rows in the (remapped) image
+ * @param cols number of columns in the (remapped) image
+ * @param state stereo parameters for this frame
+ */
+void PushbroomStereo::SetupBands(int rows, int cols, PushbroomStereoState state) {
+
+    int blockSize = state.blockSize;
+
+    int bands_per_thread = state.fused_pipeline ? FUSED_BANDS_PER_THREAD : BANDS_PER_THREAD;
+
+    // region that blocks have to fit in
+    int roi_top, roi_bottom, roi_left, roi_right;
+    GetSearchRegion(rows, cols, state, &roi_top, &roi_bottom, &roi_left, &roi_right);
+
+    // how far above and below a block the stereo task reads
+    int halo = 0;
+    if (state.check_horizontal_invariance) {
+        halo = max(-INVARIANCE_CHECK_VERT_OFFSET_MIN, INVARIANCE_CHECK_VERT_OFFSET_MAX);
+    }
+
+    // blocks start on rows roi_top, roi_top + blockSize, ... so the
+    // bands are a multiple of the block size from there, so that a block
+    // never straddles two bands.
+    int stereo_rows = max(0, roi_bottom - roi_top);
+
+    int band_rows = max(blockSize, RoundUp((stereo_rows + num_threads_ * bands_per_thread - 1) / (num_threads_ * bands_per_thread), blockSize));
+
+    while ((stereo_rows + band_rows - 1) / band_rows > MAX_BANDS) {
+        band_rows += blockSize;
+    }
+
+    num_bands_ = (stereo_rows + band_rows - 1) / band_rows;
+
+    // the separate-stage pipeline remaps and filters a band's rows for
+    // everyone, so the first and last bands also cover the rows that the
+    // stereo search reads above and below the region.  The fused
+    // pipeline's tiles already include those.
+    int work_halo = state.fused_pipeline ? 0 : halo;
+    int work_start = max(0, roi_top - work_halo);
+    int work_end = min(rows, roi_bottom + work_halo);
+
+    // columns that the stereo search reads, in either image: the blocks,
+    // shifted by any of the disparities and the horizontal invariance
+    // offsets, plus the widest load the SAD kernels do past a block
+    int max_shift = max(abs(state.disparity), abs(state.zero_dist_disparity));
+    for (int k = 0; k < min(state.num_disparities, MAX_DISPARITIES); k++) {
+        max_shift = max(max_shift, abs(state.disparities[k]));
+    }
+
+    int col_margin = max_shift + max(-INVARIANCE_CHECK_HORZ_OFFSET_MIN, INVARIANCE_CHECK_HORZ_OFFSET_MAX) + 8;
+
+    interest_col_start_ = max(0, roi_left - col_margin);
+    interest_col_end_ = min(cols, roi_right + col_margin);
+
+    // plus one more column on each side for the interest operator
+    remap_col_start_ = max(0, interest_col_start_ - 1);
+    remap_col_end_ = min(cols, interest_col_end_ + 1);
+
+    if (state.fused_pipeline) {
+        // the band's tile has to hold everything the stereo task reads,
+        // plus one more row for the interest operator
+        tile_halo_ = halo + 1;
+        tasks_per_band_ = 1;
+    } else {
+        tile_halo_ = 1;
+        tasks_per_band_ = 2;
+    }
+
+    // pick the SAD kernels for this block size
+    switch (blockSize) {
+        SAD_KERNEL_CASE(3);
+        SAD_KERNEL_CASE(4);
+        SAD_KERNEL_CASE(5);
+        SAD_KERNEL_CASE(6);
+        SAD_KERNEL_CASE(7);
+        SAD_KERNEL_CASE(8);
+
+        default:
+            get_sad_ = &PushbroomStereo::GetSADBlock<0>;
+            get_sad_early_exit_ = &PushbroomStereo::GetSADEarlyExitBlock<0>;
+            get_sad_pair_ = NULL;
+            break;
+    }
+
+    // the block memory is per frame, not per pass, and goes by the whole
+    // frame's parameters
+    if (frame_pass_ != PASS_REST) {
+        SetupTemporalSkip(rows, cols, search_state_);
+    }
+
+    int max_band_rows = 0;
+
+    for (int i = 0; i < num_bands_; i++) {
+        PushbroomStereoBand *band = &(bands_[i]);
+
+        band->stereo_row_start = roi_top + band_rows * i;
+        band->stereo_row_end = min(roi_top + band_rows * (i + 1), roi_bottom);
+
+        band->row_start = i == 0 ? work_start : band->stereo_row_start;
+        band->row_end = i == num_bands_ - 1 ? work_end : band->stereo_row_end;
+
+        max_band_rows = max(max_band_rows, band->row_end - band->row_start);
+
+        // only start blocks that fit entirely in the region
+        band->stereo_row_end = min(band->stereo_row_end, roi_bottom - blockSize + 1);
+
+        if (band->stereo_row_end > band->stereo_row_start && !state.fused_pipeline) {
+            int first_row_read = max(0, band->stereo_row_start - halo);
+            int last_row_read = min(rows - 1, band->stereo_row_end - 1 + blockSize - 1 + halo);
+
+            // rows above the region belong to band 0 and rows below it
+            // to the last band
+            band->depends_on_first = min(num_bands_ - 1, max(0, first_row_read - roi_top) / band_rows);
+            band->depends_on_last = min(num_bands_ - 1, max(0, last_row_read - roi_top) / band_rows);
+        } else {
+            // nothing for stereo to wait on in this band
+            band->depends_on_first = i;
+            band->depends_on_last = i - 1;
+        }
+
+        band->localHitPoints.clear();
+        band->pointVector2d.clear();
+        band->pointColors.clear();
+        band->pointDisparities.clear();
+
+        band->blocks_searched = 0;
+        band->blocks_skipped = 0;
+
+        band->quality = BAND_FULL;
+
+        PushbroomStereoStateThreaded *statet = &(band_states_[i]);
+
+        statet->state = state;
+
+        if (state.random_results >= 0) {
+            // random_results used to be counted per thread, keep the
+            // same number of points per frame now that there are more bands
+            statet->state.random_results = state.random_results * NUM_THREADS / (float)num_bands_;
+        }
+
+        statet->remapped_left = remapped_left_;
+        statet->remapped_right = remapped_right_;
+
+        statet->laplacian_left = laplacian_left_;
+        statet->laplacian_right = laplacian_right_;
+
+        statet->census_left = census_left_;
+        statet->census_right = census_right_;
+
+        statet->localHitPoints = &(band->localHitPoints);
+        statet->pointVector2d = &(band->pointVector2d);
+        statet->pointColors = &(band->pointColors);
+        statet->pointDisparities = &(band->pointDisparities);
+
+        statet->blocks_searched = &(band->blocks_searched);
+        statet->blocks_skipped = &(band->blocks_skipped);
+
+        statet->row_start = band->stereo_row_start;
+        statet->row_end = band->stereo_row_end;
+        statet->block_stride = 1;
+        statet->row_offset = 0;
+    }
+
+    // scratch space for each thread's remap (band + a halo on each side)
+    for (int i = 0; i < num_threads_ + 1; i++) {
+        CreatePadded(&remap_tile_left_[i], max_band_rows + 2 * tile_halo_, remapped_left_.cols, remapped_left_.type());
+        CreatePadded(&remap_tile_right_[i], max_band_rows + 2 * tile_halo_, remapped_right_.cols, remapped_right_.type());
+
+        if (state.fused_pipeline) {
+            CreatePadded(&laplacian_tile_left_[i], max_band_rows + 2 * tile_halo_, remapped_left_.cols, remapped_left_.type());
+            CreatePadded(&laplacian_tile_right_[i], max_band_rows + 2 * tile_halo_, remapped_right_.cols, remapped_right_.type());
+
+            if (state.census_matching) {
+                census_tile_left_[i].create(max_band_rows + 2 * tile_halo_, remapped_left_.cols + CENSUS_PADDING, CV_8UC1);
+                census_tile_right_[i].create(max_band_rows + 2 * tile_halo_, remapped_right_.cols + CENSUS_PADDING, CV_8UC1);
+            }
+        }
+
+        // the stereo task's blocks can run blockSize - 1 rows past its band
+        interest_integral_left_[i].create(band_rows + blockSize, remapped_left_.cols + 1, CV_32SC1);
+        interest_integral_right_[i].create(band_rows + blockSize, remapped_right_.cols + 1, CV_32SC1);
+    }
+
+    // give each worker a contiguous run of bands, sized by its weight.
+    // The main thread's queue is empty, it only steals.
+    float total_weight = 0;
+    for (int i = 0; i < num_threads_; i++) {
+        total_weight += band_weights_[i];
+    }
+
+    float weight_so_far = 0;
+    int next_band = 0;
+
+    for (int i = 0; i < num_threads_; i++) {
+        weight_so_far += band_weights_[i];
+
+        int last_band = num_bands_;
+        if (i < num_threads_ - 1 && total_weight > 0) {
+            last_band = min(num_bands_, (int)round(num_bands_ * weight_so_far / total_weight));
+        }
+
+        queue_first_band_[i] = next_band;
+        queue_num_bands_[i] = last_band - next_band;
+        queue_next_task_[i] = 0;
+
+        next_band = last_band;
+    }
+
+    queue_first_band_[num_threads_] = 0;
+    queue_num_bands_[num_threads_] = 0;
+    queue_next_task_[num_threads_] = 0;
+
+    for (int i = 0; i < num_bands_; i++) {
+        band_order_[i] = i;
+    }
+
+    if (state.deadline_us > 0 && num_threads_ > 0) {
+        // hand the bands out a band at a time to each worker in turn,
+        // closest to the middle of the search region first, so everyone
+        // works from the middle out and whatever is left when time runs
+        // out is at the top and bottom
+        int middle = roi_top + roi_bottom;
+
+        std::stable_sort(band_order_, band_order_ + num_bands_, [this, middle](int a, int b) {
+            return abs(bands_[a].stereo_row_start + bands_[a].stereo_row_end - middle)
+                < abs(bands_[b].stereo_row_start + bands_[b].stereo_row_end - middle);
+        });
+
+        int by_priority[MAX_BANDS];
+        std::copy(band_order_, band_order_ + num_bands_, by_priority);
+
+        int filled[MAX_THREADS] = { 0 };
+        int queue = 0;
+
+        for (int i = 0; i < num_bands_; i++) {
+            while (filled[queue] >= queue_num_bands_[queue]) {
+                queue = (queue + 1) % num_threads_;
+            }
+
+            band_order_[queue_first_band_[queue] + filled[queue]] = by_priority[i];
+            filled[queue] ++;
+
+            queue = (queue + 1) % num_threads_;
+        }
+    }
+}
+
+/**
+ * Gets the block memory for state.temporal_skip ready for this frame.
+ * It is thrown away if the last frame didn't use it, or if anything that
+ * changes which blocks there are or whether they match has changed.
+ *
+ * @param rows number of rows in the (remapped) image
+ * @param cols number of columns in the (remapped) image
+ * @param state stereo parameters for this frame
+ */
+void PushbroomStereo::SetupTemporalSkip(int rows, int cols, PushbroomStereoState state) {
+
+    if (!state.temporal_skip) {
+        return;
+    }
+
+    int blockSize = state.blockSize;
+
+    // blocks start every blockSize pixels, so each one gets its own cell
+    int grid_rows = rows / blockSize + 1;
+    int grid_cols = cols / blockSize + 1;
+
+    PushbroomStereoState *last = &temporal_state_;
+
+    bool reset = temporal_frame_ != search_frame_
+        || grid_rows != block_grid_rows_ || grid_cols != block_grid_cols_
+        || state.blockSize != last->blockSize
+        || state.disparity != last->disparity
+        || state.num_disparities != last->num_disparities
+        || state.zero_dist_disparity != last->zero_dist_disparity
+        || state.sobelLimit != last->sobelLimit
+        || state.sadThreshold != last->sadThreshold
+        || state.census_matching != last->census_matching
+        || state.census_threshold != last->census_threshold
+        || state.horizontalInvarianceMultiplier != last->horizontalInvarianceMultiplier
+        || state.check_horizontal_invariance != last->check_horizontal_invariance
+        || state.roi_top != last->roi_top
+        || state.roi_left != last->roi_left
+        || state.mapxL.data != last->mapxL.data
+        || state.mapxR.data != last->mapxR.data;
+
+    if (reset) {
+        PushbroomStereoBlockHistory empty;
+        empty.left_interest = 0;
+        empty.right_interest = 0;
+        empty.can_skip = false;
+
+        block_grid_rows_ = grid_rows;
+        block_grid_cols_ = grid_cols;
+
+        block_history_.assign(grid_rows * grid_cols, empty);
+        block_hits_[0].assign(grid_rows * grid_cols, 0);
+        block_hits_[1].assign(grid_rows * grid_cols, 0);
+    }
+
+    temporal_state_ = state;
+
+    // the frame we are about to run
+    temporal_frame_ = search_frame_ + 1;
+
+    std::fill(block_hits_[temporal_frame_ % 2].begin(), block_hits_[temporal_frame_ % 2].end(), 0);
+}
+
+/**
+ * Marks the blocks that touch the predicted regions and works out the
+ * parameters for the pass that searches them.  That pass only covers the
+ * rows with marked blocks, but starts on one of the whole frame's block
+ * rows, so both passes search the same blocks the whole frame would.
+ *
+ * @param regions predicted regions of the remapped image
+ * @param state stereo parameters for the whole frame
+ * @param predicted_state (output) stereo parameters for the first pass
+ *
+ * @retval false if the frame should be searched in one go: there is
+ *      nothing predicted inside the search region, or the frame goes
+ *      to the GPU or uses random_results
+ */
+bool PushbroomStereo::SetupPredictedBlocks(const cv::vector<Rect> &regions, PushbroomStereoState state, PushbroomStereoState *predicted_state) {
+
+    if (regions.empty() || state.random_results >= 0
+        || (state.use_opencl && !opencl_failed_ && PushbroomStereoOpenCL::Supports(state))) {
+
+        return false;
+    }
+
+    int rows = state.mapxL.rows;
+    int cols = state.mapxL.cols;
+    int blockSize = state.blockSize;
+
+    // same grid as the block memory: blocks start every blockSize pixels,
+    // so each one gets its own cell
+    int grid_rows = rows / blockSize + 1;
+    predicted_grid_cols_ = cols / blockSize + 1;
+
+    predicted_blocks_.assign(grid_rows * predicted_grid_cols_, 0);
+
+    Rect image(0, 0, cols, rows);
+
+    for (size_t k = 0; k < regions.size(); k++) {
+        Rect region = regions[k] & image;
+
+        if (region.area() <= 0) {
+            continue;
+        }
+
+        // blocks that start less than blockSize pixels before the region
+        // overlap it.  Going by cells can take in one more block on each
+        // side, which just gets searched a bit earlier.
+        int first_row = max(0, region.y - blockSize + 1) / blockSize;
+        int last_row = (region.y + region.height - 1) / blockSize;
+        int first_col = max(0, region.x - blockSize + 1) / blockSize;
+        int last_col = (region.x + region.width - 1) / blockSize;
+
+        for (int i = first_row; i <= last_row; i++) {
+            uchar *cells = &(predicted_blocks_[i * predicted_grid_cols_]);
+            std::fill(cells + first_col, cells + last_col + 1, 1);
+        }
+    }
+
+    // the whole frame's block rows that have a marked block
+    int top, bottom, left, right;
+    GetSearchRegion(rows, cols, state, &top, &bottom, &left, &right);
+
+    int first_block_row = -1, last_block_row = -1;
+
+    for (int i = top; i + blockSize <= bottom; i += blockSize) {
+        const uchar *cells = &(predicted_blocks_[(i / blockSize) * predicted_grid_cols_]);
+
+        if (std::find(cells, cells + predicted_grid_cols_, 1) != cells + predicted_grid_cols_) {
+            if (first_block_row < 0) {
+                first_block_row = i;
+            }
+
+            last_block_row = i;
+        }
+    }
+
+    if (first_block_row < 0) {
+        return false;
+    }
+
+    *predicted_state = state;
+    predicted_state->roi_top = first_block_row;
+    predicted_state->roi_bottom = last_block_row + blockSize;
+
+    return true;
+}
+
+/**
+ * Checks last frame's hits for a block and the blocks around it.
+ *
+ * @param block_row row of the block in the block grid
+ * @param block_col column of the block in the block grid
+ *
+ * @retval true if any of them matched last frame
+ */
+bool PushbroomStereo::BlockHitLastFrame(int block_row, int block_col) {
+
+    const uchar *last_hits = &(block_hits_[(search_frame_ + 1) % 2][0]);
+
+    for (int i = max(0, block_row - 1); i <= min(block_grid_rows_ - 1, block_row + 1); i++) {
+        for (int j = max(0, block_col - 1); j <= min(block_grid_cols_ - 1, block_col + 1); j++) {
+            if (last_hits[i * block_grid_cols_ + j]) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Finds the bounding box of the non-zero pixels in a mask.
+ *
+ * @param mask CV_8UC1 mask
+ * @param top (output) first row with a non-zero pixel
+ * @param bottom (output) one past the last row with a non-zero pixel
+ * @param left (output) first column with a non-zero pixel
+ * @param right (output) one past the last column with a non-zero pixel
+ */
+void PushbroomStereo::GetMaskBounds(Mat mask, int *top, int *bottom, int *left, int *right) {
+
+    *top = mask.rows;
+    *bottom = 0;
+    *left = mask.cols;
+    *right = 0;
+
+    for (int i = 0; i < mask.rows; i++) {
+        const uchar *mask_row = mask.ptr<uchar>(i);
+
+        int first = 0;
+        while (first < mask.cols && mask_row[first] == 0) {
+            first ++;
+        }
+
+        if (first == mask.cols) {
+            // nothing in this row
+            continue;
+        }
+
+        int last = mask.cols - 1;
+        while (mask_row[last] == 0) {
+            last --;
+        }
+
+        *top = min(*top, i);
+        *bottom = i + 1;
+        *left = min(*left, first);
+        *right = max(*right, last + 1);
+    }
+}
+
+/**
+ * Runs tasks from this thread's queue until it is empty, then
+ * steals tasks from the other queues until there is nothing left.
+ *
+ * @param thread_number index of the thread (num_threads_ for the main thread)
+ */
+void PushbroomStereo::RunTasks(int thread_number) {
+    int task;
+
+    // time spent running tasks, to see how well the load is balanced
+    int64_t busy_us = 0;
+
+    for (int offset = 0; offset < num_threads_ + 1; offset++) {
+        int queue = (thread_number + offset) % (num_threads_ + 1);
+
+        while (ClaimTask(queue, &task)) {
+            int64_t task_start = NowMicroseconds();
+
+            RunTask(queue, task, thread_number);
+
+            busy_us += NowMicroseconds() - task_start;
+        }
+    }
+
+    RecordTiming(&thread_timing_[thread_number], 0, busy_us);
+}
+
+/**
+ * @retval true if any queue has a task no one has claimed
+ */
+bool PushbroomStereo::TasksLeft() {
+    for (int queue = 0; queue < num_threads_ + 1; queue++) {
+        if (queue_next_task_[queue].load() < tasks_per_band_ * queue_num_bands_[queue]) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Takes the next task off the front of a queue.  Lock-free, so the owner
+ * and any thieves can all call this at the same time.
+ *
+ * @param queue queue to take from
+ * @param task (output) index of the task in the queue
+ *
+ * @retval true if we got a task, false if the queue is empty
+ */
+bool PushbroomStereo::ClaimTask(int queue, int *task) {
+    int num_tasks = tasks_per_band_ * queue_num_bands_[queue];
+
+    // check first so that empty queues don't keep counting up
+    if (queue_next_task_[queue].load() >= num_tasks) {
+        return false;
+    }
+
+    int this_task = queue_next_task_[queue].fetch_add(1);
+
+    if (this_task >= num_tasks) {
+        return false;
+    }
+
+    *task = this_task;
+    return true;
+}
+
+void PushbroomStereo::RunTask(int queue, int task, int thread_number) {
+
+    int num_bands = queue_num_bands_[queue];
+
+    if (task < num_bands) {
+
+        int band = band_order_[queue_first_band_[queue] + task];
+
+        if (frame_state_.fused_pipeline) {
+            if (SetBandQuality(band)) {
+                RunFusedBand(band, thread_number);
+            }
+        } else {
+            RunRemapInterestOp(band, thread_number);
+        }
+
+        // let any stereo tasks waiting on this band go
+        band_ready_[band].store(frame_number_);
+
+    } else {
+
+        int band = band_order_[queue_first_band_[queue] + task - num_bands];
+
+        if (bands_[band].stereo_row_end > bands_[band].stereo_row_start) {
+
+            WaitForBands(bands_[band].depends_on_first, bands_[band].depends_on_last);
+
+            // after the wait, which can eat into the deadline
+            if (!SetBandQuality(band)) {
+                return;
+            }
+
+            band_states_[band].interest_integral_left = interest_integral_left_[thread_number];
+            band_states_[band].interest_integral_right = interest_integral_right_[thread_number];
+
+            int64_t stereo_start = NowMicroseconds();
+
+            RunStereoPushbroomStereo(&(band_states_[band]));
+
+            RecordTiming(&stage_timing_[STAGE_STEREO], stereo_start, NowMicroseconds());
+        }
+    }
+}
+
+/**
+ * Picks how thoroughly to search a band from how much of the frame's
+ * deadline (state.deadline_us) has gone by, and sets up its stereo task
+ * to match.  Call just before searching the band.
+ *
+ * @param band band to search
+ *
+ * @retval false if the frame is out of time and the band shouldn't be
+ *      searched at all
+ */
+bool PushbroomStereo::SetBandQuality(int band) {
+
+    int deadline_us = frame_state_.deadline_us;
+    int quality = BAND_FULL;
+
+    if (deadline_us > 0) {
+        int64_t elapsed_us = NowMicroseconds() - frame_start_us_;
+
+        if (elapsed_us >= deadline_us) {
+            quality = BAND_SKIPPED;
+        } else if (elapsed_us >= deadline_us * DEADLINE_SPARSE_FRACTION) {
+            quality = BAND_SPARSE;
+        } else if (elapsed_us >= deadline_us * DEADLINE_NO_INVARIANCE_FRACTION) {
+            quality = BAND_NO_INVARIANCE;
+        }
+    }
+
+    bands_[band].quality = quality;
+
+    PushbroomStereoStateThreaded *statet = &(band_states_[band]);
+
+    if (quality != BAND_FULL) {
+        statet->state.check_horizontal_invariance = false;
+    }
+
+    statet->block_stride = quality == BAND_SPARSE ? 2 : 1;
+
+    return quality != BAND_SKIPPED;
+}
+
+/**
+ * Waits for a range of bands to finish their remap and interest operator.
+ * All remap tasks in a queue come before its stereo tasks, and remap tasks
+ * never wait, so this will always finish.
+ */
+void PushbroomStereo::WaitForBands(int first, int last) {
+    for (int i = first; i <= last; i++) {
+        while (band_ready_[i].load() != frame_number_) {
+            this_thread::yield();
+        }
+    }
+}
+
+/**
+ * Builds the offset table for nearest-neighbor remapping with a CV_16SC2
+ * map, if it isn't already built for this map and image layout.
+ *
+ * Each entry is (y - i) * image step + (x - j) for the pixel at (i, j)
+ * that the map says comes from (x, y).  Rectification only moves pixels a
+ * few rows, so that fits in 16 bits, half the size of the map, and
+ * remapping is just one load per pixel.
+ *
+ * @param map remap map (anything other than CV_16SC2 will use cv::remap)
+ * @param image camera image that will be remapped
+ * @param lut (output) table to build
+ */
+void PushbroomStereo::UpdateRemapLut(Mat map, Mat image, PushbroomStereoRemapLut *lut) {
+
+    if (lut->map_data == map.data && lut->image_step == image.step[0]
+        && lut->image_rows == image.rows && lut->image_cols == image.cols) {
+        // already built
+        return;
+    }
+
+    lut->map_data = map.data;
+    lut->image_step = image.step[0];
+    lut->image_rows = image.rows;
+    lut->image_cols = image.cols;
+
+    lut->usable = map.type() == CV_16SC2 && image.type() == CV_8UC1;
+
+    if (!lut->usable) {
+        return;
+    }
+
+    lut->offsets.create(map.rows, map.cols, CV_16SC1);
+
+    int step = (int)image.step[0];
+
+    for (int i = 0; i < map.rows && lut->usable; i++) {
+        const short *map_row = map.ptr<short>(i);
+        short *offset_row = lut->offsets.ptr<short>(i);
+
+        for (int j = 0; j < map.cols; j++) {
+            int x = map_row[2*j];
+            int y = map_row[2*j + 1];
+
+            if (x < 0 || y < 0 || x >= image.cols || y >= image.rows) {
+                offset_row[j] = REMAP_LUT_OUTSIDE;
+                continue;
+            }
+
+            int offset = (y - i) * step + (x - j);
+
+            if (offset <= REMAP_LUT_OUTSIDE || offset > 32767) {
+                // moves too far, use cv::remap for this map
+                lut->usable = false;
+                break;
+            }
+
+            offset_row[j] = offset;
+        }
+    }
+}
+
+/**
+ * Nearest-neighbor remap of some rows and columns of the image, with the
+ * offset table if we have one.  Same results as cv::remap with
+ * INTER_NEAREST and a constant (0) border.
+ *
+ * @param image camera image
+ * @param map remap map
+ * @param lut offset table for this map and image
+ * @param row_start first row to remap
+ * @param row_end one past the last row to remap
+ * @param cols columns to remap
+ * @param dst (output) remapped rows, with cols.end - cols.start columns
+ */
+void PushbroomStereo::RemapRows(Mat image, Mat map, PushbroomStereoRemapLut *lut, int row_start, int row_end, Range cols, Mat dst) {
+
+    if (!lut->usable) {
+        remap(image, dst, map(Range(row_start, row_end), cols), Mat(), INTER_NEAREST);
+        return;
+    }
+
+    for (int i = row_start; i < row_end; i++) {
+        const short *offset_row = lut->offsets.ptr<short>(i) + cols.start;
+
+        // pixel (i, cols.start) if the image were rectified already.  Only
+        // ever indexed with an offset that lands inside the image.
+        const uchar *image_row = image.data + i * image.step[0] + cols.start;
+
+        uchar *dst_row = dst.ptr<uchar>(i - row_start);
+
+        for (int j = 0; j < cols.end - cols.start; j++) {
+            int offset = offset_row[j];
+
+            dst_row[j] = offset == REMAP_LUT_OUTSIDE ? 0 : image_row[j + offset];
+        }
+    }
+}
+
+/**
+ * Function (for running in a thread) that remaps a band of the images
+ * and runs the interest operator on it.
+ *
+ * The remap is done into a scratch tile with one extra row above and
+ * below the band so that the interest operator doesn't need to wait for
+ * the neighboring bands.
+ *
+ * @param band band to process
+ * @param thread_number thread we are running on (for scratch space)
+ */
+void PushbroomStereo::RunRemapInterestOp(int band, int thread_number) {
+    TRACE_SCOPE("stereo-remap-interest");
+
+    int rows = remapped_left_.rows;
+
+    int row_start = bands_[band].row_start;
+    int row_end = bands_[band].row_end;
+
+    int tile_start = max(0, row_start - 1);
+    int tile_end = min(rows, row_end + 1);
+
+    // wrap the scratch space in a header of its own, not a rowRange(), so
+    // the Laplacian sees the tile as the whole image and uses the same
+    // border handling at the top and bottom of the image that it
+    // would on the full frame
+    Mat tile_left(tile_end - tile_start, remapped_left_.cols, remapped_left_.type(), remap_tile_left_[thread_number].data, remap_tile_left_[thread_number].step);
+    Mat tile_right(tile_end - tile_start, remapped_right_.cols, remapped_right_.type(), remap_tile_right_[thread_number].data, remap_tile_right_[thread_number].step);
+
+    Range remap_cols(remap_col_start_, remap_col_end_);
+    Range interest_cols(interest_col_start_, interest_col_end_);
+
+    int64_t remap_start = NowMicroseconds();
+
+    // remap this part of the image
+    RemapRows(left_image_, frame_state_.mapxL, &remap_lut_left_, tile_start, tile_end, remap_cols, tile_left.colRange(remap_cols));
+    RemapRows(right_image_, frame_state_.mapxR, &remap_lut_right_, tile_start, tile_end, remap_cols, tile_right.colRange(remap_cols));
+
+    Mat band_left = tile_left.rowRange(row_start - tile_start, row_end - tile_start);
+    Mat band_right = tile_right.rowRange(row_start - tile_start, row_end - tile_start);
+
+    Mat sub_remapped_left = remapped_left_(Range(row_start, row_end), remap_cols);
+    Mat sub_remapped_right = remapped_right_(Range(row_start, row_end), remap_cols);
+
+    band_left.colRange(remap_cols).copyTo(sub_remapped_left);
+    band_right.colRange(remap_cols).copyTo(sub_remapped_right);
+
+    int64_t interest_start = NowMicroseconds();
+    RecordTiming(&stage_timing_[STAGE_REMAP], remap_start, interest_start);
+
+    // apply interest operator.  It reads the columns next to interest_cols
+    // and the halo rows, so this matches filtering the whole image.
+    InterestOperator(tile_left, row_start - tile_start, row_end - tile_start, interest_cols, laplacian_left_.rowRange(row_start, row_end), frame_state_.interest_operator);
+    InterestOperator(tile_right, row_start - tile_start, row_end - tile_start, interest_cols, laplacian_right_.rowRange(row_start, row_end), frame_state_.interest_operator);
+
+    if (frame_state_.census_matching) {
+        CensusTransform(tile_left, row_start - tile_start, row_end - tile_start, interest_cols, census_left_.rowRange(row_start, row_end));
+        CensusTransform(tile_right, row_start - tile_start, row_end - tile_start, interest_cols, census_right_.rowRange(row_start, row_end));
+    }
+
+    RecordTiming(&stage_timing_[STAGE_INTEREST], interest_start, NowMicroseconds());
+
+}
+
+/**
+ * Fused pipeline: remaps a band plus the rows around it that the stereo
+ * check reads, runs the interest operator, and runs stereo on it, all in a
+ * per-thread tile that stays in cache.  Never touches the full-frame images.
+ *
+ * @param band band to process
+ * @param thread_number thread we are running on (for scratch space)
+ */
+void PushbroomStereo::RunFusedBand(int band, int thread_number) {
+    TRACE_SCOPE("stereo-band");
+
+    PushbroomStereoBand *this_band = &(bands_[band]);
+
+    if (this_band->stereo_row_end <= this_band->stereo_row_start) {
+        // below the last valid row, nothing to do
+        return;
+    }
+
+    int rows = remapped_left_.rows;
+    int cols = remapped_left_.cols;
+    int type = remapped_left_.type();
+
+    int tile_start = max(0, this_band->row_start - tile_halo_);
+    int tile_end = min(rows, this_band->row_end + tile_halo_);
+    int tile_rows = tile_end - tile_start;
+
+    // standalone headers so the interest operator treats the tile as the
+    // whole image (see RunRemapInterestOp)
+    Mat tile_left(tile_rows, cols, type, remap_tile_left_[thread_number].data, remap_tile_left_[thread_number].step);
+    Mat tile_right(tile_rows, cols, type, remap_tile_right_[thread_number].data, remap_tile_right_[thread_number].step);
+
+    Mat tile_laplacian_left(tile_rows, cols, type, laplacian_tile_left_[thread_number].data, laplacian_tile_left_[thread_number].step);
+    Mat tile_laplacian_right(tile_rows, cols, type, laplacian_tile_right_[thread_number].data, laplacian_tile_right_[thread_number].step);
+
+    Range remap_cols(remap_col_start_, remap_col_end_);
+    Range interest_cols(interest_col_start_, interest_col_end_);
+
+    int64_t remap_start = NowMicroseconds();
+
+    RemapRows(left_image_, frame_state_.mapxL, &remap_lut_left_, tile_start, tile_end, remap_cols, tile_left.colRange(remap_cols));
+    RemapRows(right_image_, frame_state_.mapxR, &remap_lut_right_, tile_start, tile_end, remap_cols, tile_right.colRange(remap_cols));
+
+    int64_t interest_start = NowMicroseconds();
+    RecordTiming(&stage_timing_[STAGE_REMAP], remap_start, interest_start);
+
+    // the outermost rows of the tile get the wrong border unless they are
+    // the edge of the image, but stereo never reads them
+    InterestOperator(tile_left, 0, tile_rows, interest_cols, tile_laplacian_left, frame_state_.interest_operator);
+    InterestOperator(tile_right, 0, tile_rows, interest_cols, tile_laplacian_right, frame_state_.interest_operator);
+
+    Mat tile_census_left, tile_census_right;
+
+    if (frame_state_.census_matching) {
+        tile_census_left = Mat(tile_rows, cols + CENSUS_PADDING, CV_8UC1, census_tile_left_[thread_number].data);
+        tile_census_right = Mat(tile_rows, cols + CENSUS_PADDING, CV_8UC1, census_tile_right_[thread_number].data);
+
+        CensusTransform(tile_left, 0, tile_rows, interest_cols, tile_census_left);
+        CensusTransform(tile_right, 0, tile_rows, interest_cols, tile_census_right);
+    }
+
+    int64_t stereo_start = NowMicroseconds();
+    RecordTiming(&stage_timing_[STAGE_INTEREST], interest_start, stereo_start);
+
+    PushbroomStereoStateThreaded statet = band_states_[band];
+
+    statet.remapped_left = tile_left;
+    statet.remapped_right = tile_right;
+    statet.laplacian_left = tile_laplacian_left;
+    statet.laplacian_right = tile_laplacian_right;
+    statet.census_left = tile_census_left;
+    statet.census_right = tile_census_right;
+
+    statet.row_start = this_band->stereo_row_start - tile_start;
+    statet.row_end = this_band->stereo_row_end - tile_start;
+    statet.row_offset = tile_start;
+
+    statet.interest_integral_left = interest_integral_left_[thread_number];
+    statet.interest_integral_right = interest_integral_right_[thread_number];
+
+    RunStereoPushbroomStereo(&statet);
+
+    RecordTiming(&stage_timing_[STAGE_STEREO], stereo_start, NowMicroseconds());
+}
+
+/**
+ * Function that actually does the work for the PushbroomStereo algorithm.
+ *
+ * @param statet all the parameters are set
+ *          as a PushbroomStereoStateThreaded struct.
+ *
+ * @retval will always be NULL since the real values are passed
+ *      back in the vector that is in statet.
+ */
+void PushbroomStereo::RunStereoPushbroomStereo(PushbroomStereoStateThreaded *statet)
+{
+    TRACE_SCOPE("stereo-block-search");
+
+    Mat leftImage = statet->remapped_left;
+    Mat rightImage = statet->remapped_right;
+    Mat laplacian_left = statet->laplacian_left;
+    Mat laplacian_right = statet->laplacian_right;
+    Mat census_left = statet->census_left;
+    Mat census_right = statet->census_right;
+
+    cv::vector<Point3i> *pointVector2d = statet->pointVector2d;
+    cv::vector<uchar> *pointColors = statet->pointColors;
+    cv::vector<int> *pointDisparities = statet->pointDisparities;
+
+    int row_start = statet->row_start;
+    int row_end = statet->row_end;
+    int row_offset = statet->row_offset;
+
+    PushbroomStereoState state = statet->state;
+
+    // we will do this by looping through every block in the left image
+    // (defined by blockSize) and checking for a matching value on
+    // the right image
+
+    // kept in the band so its memory gets reused from frame to frame
+    cv::vector<Point3f> &localHitPoints = *(statet->localHitPoints);
+
+    int blockSize = state.blockSize;
+    int disparity = state.disparity;
+    // census matching thresholds the number of differing bits instead
+    int sadThreshold = state.census_matching ? state.census_threshold : state.sadThreshold;
+
+    // in multi-disparity mode, every block is checked at all of
+    // state.disparities instead of just state.disparity
+    int num_disparities = 1;
+    int disparities[MAX_DISPARITIES];
+    disparities[0] = disparity;
+
+    if (state.num_disparities > 0) {
+        num_disparities = min(state.num_disparities, MAX_DISPARITIES);
+
+        for (int k = 0; k < num_disparities; k++) {
+            disparities[k] = state.disparities[k];
+        }
+    }
+
+    int min_disparity = disparities[0];
+    int max_disparity = disparities[0];
+
+    for (int k = 1; k < num_disparities; k++) {
+        min_disparity = min(min_disparity, disparities[k]);
+        max_disparity = max(max_disparity, disparities[k]);
+    }
+
+    // make sure every disparity stays inside the right image
+    int startJ = max(0, -min_disparity);
+    int stopJ = leftImage.cols - blockSize - max(0, max_disparity);
+
+    // and inside the region of interest
+    startJ = max(startJ, state.roi_left);
+
+    if (state.roi_right > 0) {
+        stopJ = min(stopJ, state.roi_right - blockSize + 1);
+    }
+
+    bool use_mask = !state.roi_mask.empty();
+
+    //printf("row_start: %d, row_end: %d, startJ: %d, stopJ: %d, rows: %d, cols: %d\n", row_start, row_end, startJ, stopJ, leftImage.rows, leftImage.cols);
+
+    int hitCounter = 0;
+
+    int sads[MAX_DISPARITIES];
+
+    // Most blocks fail the interest operator check in GetSAD, so look up
+    // the laplacian sums in summed-area tables first and skip those
+    // blocks without touching their pixels.  There's nothing to reject
+    // if sobelLimit is 0.
+    bool interest_precheck = state.sobelLimit > 0 && state.random_results < 0;
+
+    // skip blocks that didn't match last frame and haven't changed since
+    bool temporal_skip = state.temporal_skip && interest_precheck && state.num_disparities <= 0;
+
+    uchar *block_hits = temporal_skip ? &(block_hits_[search_frame_ % 2][0]) : NULL;
+
+    // in a frame with predicted regions, each pass only searches its own
+    // blocks
+    const uchar *predicted_blocks = frame_pass_ != PASS_ALL ? &(predicted_blocks_[0]) : NULL;
+    uchar predicted_value = frame_pass_ == PASS_PREDICTED;
+
+    Mat integral_left = statet->interest_integral_left;
+    Mat integral_right = statet->interest_integral_right;
+
+    #ifdef USE_NEON
+        // the NEON GetSAD always sums 5 columns
+        int interest_width = 5;
+    #else
+        int interest_width = blockSize;
+    #endif
+
+    // without the pre-check every block goes through GetSAD, so do them
+    // two at a time: the second block's score is kept for when the loop
+    // gets to it
+    bool pair_sad = get_sad_pair_ != NULL && !interest_precheck && !state.census_matching && state.num_disparities <= 0;
+
+    if (interest_precheck) {
+        int integral_end = min(row_end + blockSize - 1, laplacian_left.rows);
+
+        BuildInterestIntegral(laplacian_left, row_start, integral_end, integral_left);
+        BuildInterestIntegral(laplacian_right, row_start, integral_end, integral_right);
+    }
+
+    if (state.random_results < 0) {
+        // every other block in each direction for BAND_SPARSE
+        int block_step = blockSize * statet->block_stride;
+
+        for (int i=row_start; i < row_end; i+=block_step)
+        {
+            // integral image rows for the top and bottom of this row of blocks
+            int *integral_top_L = NULL, *integral_bottom_L = NULL;
+            int *integral_top_R = NULL, *integral_bottom_R = NULL;
+
+            if (interest_precheck) {
+                integral_top_L = integral_left.ptr<int>(i - row_start);
+                integral_bottom_L = integral_left.ptr<int>(i - row_start + blockSize);
+                integral_top_R = integral_right.ptr<int>(i - row_start);
+                integral_bottom_R = integral_right.ptr<int>(i - row_start + blockSize);
+            }
+
+            const uchar *mask_row = use_mask ? state.roi_mask.ptr<uchar>(i + row_offset) : NULL;
+
+            // block the last pair kernel call already scored
+            int paired_j = -1;
+            int paired_sad = 0;
+
+            for (int j=startJ; j < stopJ; j+=block_step)
+            {
+                if (use_mask && mask_row[j] == 0) {
+                    continue;
+                }
+
+                int block_row = (i + row_offset) / blockSize;
+                int block_col = j / blockSize;
+
+                if (predicted_blocks != NULL
+                    && predicted_blocks[block_row * predicted_grid_cols_ + block_col] != predicted_value) {
+
+                    continue;
+                }
+
+                // leftVal + rightVal for the single disparity, if we
+                // got it from the summed-area tables
+                int interest_value = -1;
+                int leftVal = 0, rightVal = 0;
+
+                PushbroomStereoBlockHistory *history = NULL;
+
+                if (temporal_skip) {
+                    history = &(block_history_[block_row * block_grid_cols_ + block_col]);
+                }
+
+                if (interest_precheck) {
+                    leftVal = integral_bottom_L[j + interest_width] - integral_bottom_L[j]
+                        - integral_top_L[j + interest_width] + integral_top_L[j];
+
+                    if (leftVal < state.sobelLimit) {
+                        if (history != NULL) {
+                            history->can_skip = false;
+                        }
+                        continue;
+                    }
+
+                    bool right_interest = false;
+
+                    for (int k = 0; k < num_disparities && !right_interest; k++) {
+                        int jR = j + disparities[k];
+
+                        rightVal = integral_bottom_R[jR + interest_width] - integral_bottom_R[jR]
+                            - integral_top_R[jR + interest_width] + integral_top_R[jR];
+
+                        right_interest = rightVal >= state.sobelLimit;
+
+                        interest_value = leftVal + rightVal;
+                    }
+
+                    if (!right_interest) {
+                        if (history != NULL) {
+                            history->can_skip = false;
+                        }
+                        continue;
+                    }
+                }
+
+                if (history != NULL) {
+                    if (history->can_skip
+                        && abs(leftVal - history->left_interest) < state.temporal_skip_threshold
+                        && abs(rightVal - history->right_interest) < state.temporal_skip_threshold
+                        && !BlockHitLastFrame(block_row, block_col)) {
+
+                        (*statet->blocks_skipped) ++;
+                        continue;
+                    }
+                }
+
+                (*statet->blocks_searched) ++;
+
+                // get the sum of absolute differences for this location
+                // on both images
+                if (state.census_matching) {
+                    for (int k = 0; k < num_disparities; k++) {
+                        sads[k] = GetCensusScore(laplacian_left, laplacian_right, census_left, census_right, j, i, state, disparities[k]);
+                    }
+                } else if (state.num_disparities > 0) {
+                    GetSADMulti(leftImage, rightImage, laplacian_left, laplacian_right, j, i, state, sads);
+                } else if (interest_value >= 0) {
+                    // the interest value is already known, so the SAD
+                    // can give up as soon as the block can't pass
+                    sads[0] = (this->*get_sad_early_exit_)(leftImage, rightImage, j, i, state, interest_value);
+                } else if (pair_sad && j == paired_j) {
+                    sads[0] = paired_sad;
+                } else if (pair_sad && j + block_step < stopJ) {
+                    int pair[2];
+                    (this->*get_sad_pair_)(leftImage, rightImage, laplacian_left, laplacian_right, j, j + block_step, i, state, pair);
+
+                    sads[0] = pair[0];
+                    paired_j = j + block_step;
+                    paired_sad = pair[1];
+                } else {
+                    sads[0] = (this->*get_sad_)(leftImage, rightImage, laplacian_left, laplacian_right, j, i, state, NULL, NULL, NULL);
+                }
+
+                if (history != NULL) {
+                    bool hit = sads[0] < sadThreshold && sads[0] >= 0;
+
+                    block_hits[block_row * block_grid_cols_ + block_col] = hit;
+
+                    history->left_interest = leftVal;
+                    history->right_interest = rightVal;
+                    history->can_skip = !hit;
+                }
+
+                // the horizontal invariance check doesn't depend on the
+                // disparity, so only run it once per block (-1 = not run yet)
+                int invariance_match = -1;
+
+                for (int k = 0; k < num_disparities; k++) {
+
+                    int sad = sads[k];
+
+                    // check to see if the SAD is below the threshold,
+                    // indicating a hit
+                    if (sad < sadThreshold && sad >= 0)
+                    {
+                        // got a hit
+
+                        // now check for horizontal invariance
+                        // (ie check for parts of the image that look the same as this
+                        // which would indicate that this might be a false-positive)
+
+                        if (state.check_horizontal_invariance && invariance_match < 0) {
+                            if (state.census_matching) {
+                                invariance_match = CheckHorizontalInvarianceCensus(laplacian_left, laplacian_right, census_left, census_right, j, i, state);
+                            } else {
+                                invariance_match = CheckHorizontalInvariance(leftImage, rightImage, laplacian_left, laplacian_right, j, i, state);
+                            }
+                        }
+
+                        if (!state.check_horizontal_invariance || invariance_match == 0) {
+
+                            // add it to the vector of matches
+                            // don't forget to offset it by the blockSize,
+                            // so we match the center of the block instead
+                            // of the top left corner
+                            float hit_disparity = disparities[k];
+
+                            if (state.subpixel_refinement) {
+                                hit_disparity = RefineDisparity(leftImage, rightImage, laplacian_left, laplacian_right, census_left, census_right, j, i, state, disparities[k]);
+                            }
+
+                            localHitPoints.push_back(Point3f(j+blockSize/2.0, i+row_offset+blockSize/2.0, -hit_disparity));
+
+                            //localHitPoints.push_back(Point3f(state.debugJ, state.debugI, -disparity));
+
+
+                            uchar pxL = leftImage.at<uchar>(i,j);
+                            pointColors->push_back(pxL); // TODO: this is the corner of the box, not the center
+
+                            pointDisparities->push_back(disparities[k]);
+
+                            hitCounter ++;
+
+                            if (state.show_display)
+                            {
+                                pointVector2d->push_back(Point3i(j, i+row_offset, sad));
+                            }
+                        } // check horizontal invariance
+                    }
+                }
+            }
+        }
+    } else {
+        hitCounter = RandomResults(statet, startJ, stopJ, disparity);
+    }
+
+    // the hits get transformed to 3d points when the bands are
+    // merged, see ReprojectHits
+}
+
+
+/**
+ * Makes up state.random_results hits in a band instead of searching it.
+ * The layout of trees or walls is the same in every band of a frame and
+ * changes from frame to frame.
+ *
+ * @param statet the band
+ * @param startJ first column blocks can start on
+ * @param stopJ one past the last column blocks can start on
+ * @param disparity disparity to give the hits
+ *
+ * @retval number of hits made
+ */
+int PushbroomStereo::RandomResults(PushbroomStereoStateThreaded *statet, int startJ, int stopJ, int disparity) {
+
+    const PushbroomStereoState &state = statet->state;
+
+    int row_start = statet->row_start;
+    int row_end = statet->row_end;
+    int row_offset = statet->row_offset;
+
+    if (stopJ <= startJ || row_end <= row_start) {
+        return 0;
+    }
+
+    uint64_t frame_seed = (uint64_t)state.random_seed << 32 | (uint32_t)search_frame_;
+
+    PushbroomStereoRandom layout_random(frame_seed);
+    PushbroomStereoRandom random(frame_seed ^ (uint64_t)(row_start + row_offset + 1) << 48);
+
+    double intpart;
+    float fractpart = modf(state.random_results, &intpart);
+
+    int num_hits = intpart;
+
+    // sometimes one more, so the average comes out right
+    if (fractpart > random.UniformFloat()) {
+        num_hits ++;
+    }
+
+    // columns [first, last) of each tree or wall
+    int first[RANDOM_LAYOUT_NUM_TREES + RANDOM_LAYOUT_NUM_WALLS];
+    int last[RANDOM_LAYOUT_NUM_TREES + RANDOM_LAYOUT_NUM_WALLS];
+
+    int num_objects = 0;
+    int width = stopJ - startJ;
+
+    if (state.random_layout == RANDOM_LAYOUT_TREES) {
+        num_objects = RANDOM_LAYOUT_NUM_TREES;
+
+        for (int i = 0; i < num_objects; i++) {
+            int center = layout_random.Uniform(startJ, stopJ);
+            int half_width = state.blockSize * layout_random.Uniform(1, 4);
+
+            first[i] = max(startJ, center - half_width);
+            last[i] = min(stopJ, center + half_width + 1);
+        }
+    } else if (state.random_layout == RANDOM_LAYOUT_WALLS) {
+        num_objects = RANDOM_LAYOUT_NUM_WALLS;
+
+        for (int i = 0; i < num_objects; i++) {
+            int wall_width = layout_random.Uniform(width / 8, width / 3) + 1;
+
+            first[i] = layout_random.Uniform(startJ, stopJ - min(wall_width, width) + 1);
+            last[i] = min(stopJ, first[i] + wall_width);
+        }
+    }
+
+    Mat leftImage = statet->remapped_left;
+
+    cv::vector<Point3f> &localHitPoints = *(statet->localHitPoints);
+
+    for (int i = 0; i < num_hits; i++) {
+
+        int x;
+
+        if (num_objects > 0) {
+            int object = random.Uniform(0, num_objects);
+            x = random.Uniform(first[object], last[object]);
+        } else {
+            x = random.Uniform(startJ, stopJ);
+        }
+
+        int y = random.Uniform(row_start, row_end) + row_offset;
+
+        localHitPoints.push_back(Point3f(x, y, -disparity));
+        statet->pointColors->push_back(leftImage.at<uchar>(y - row_offset, x));
+        statet->pointDisparities->push_back(disparity);
+    }
+
+    return num_hits;
+}
+
+/**
+ * Builds a summed-area table of the interest operator for some rows of an
+ * image.  integral_image(y, x) is the sum of laplacian over rows
+ * [row_start, row_start + y) and columns [0, x), so the interest value of
+ * any block in those rows is four lookups.
+ *
+ * @param laplacian laplacian-filtered image
+ * @param row_start first row to include
+ * @param row_end one past the last row to include
+ * @param integral_image (output) CV_32SC1 with at least
+ *      row_end - row_start + 1 rows and laplacian.cols + 1 columns
+ */
+void PushbroomStereo::BuildInterestIntegral(Mat laplacian, int row_start, int row_end, Mat integral_image) {
+
+    // a view of exactly the size integral() wants, so it writes into our
+    // scratch space instead of allocating
+    Mat integral_rows = integral_image.rowRange(0, row_end - row_start + 1);
+
+    integral(laplacian.rowRange(row_start, row_end), integral_rows, CV_32S);
+}
+
+/**
+ * Get the sum of absolute differences for a specific pixel location and disparity
+ *
+ * @param leftImage left image
+ * @param rightImage right image
+ * @param laplacianL laplacian-fitlered left image
+ * @param laplacianR laplacian-filtered right image
+ * @param pxX row pixel location
+ * @param pxY column pixel location
+ * @param state state structure that includes a number of parameters
+ * @param left_interest optional parameter that will be filled with the value for the left interest operation
+ * @param right_interest same as above, for the right image
+ *
+ * @retval scaled sum of absolute differences for this block --
+ *      the value is the sum/numberOfPixels
+ */
+int PushbroomStereo::GetSAD(Mat leftImage, Mat rightImage, Mat laplacianL, Mat laplacianR, int pxX, int pxY, PushbroomStereoState state, int *left_interest, int *right_interest, int *raw_sad)
+{
+    return GetSADBlock<0>(leftImage, rightImage, laplacianL, laplacianR, pxX, pxY, state, left_interest, right_interest, raw_sad);
+}
+
+/**
+ * GetSAD for a block size known at compile time, so the loops over the
+ * block have a fixed trip count and get unrolled.  BLOCK_SIZE = 0 means
+ * use state.blockSize.
+ */
+template <int BLOCK_SIZE>
+int PushbroomStereo::GetSADBlock(Mat leftImage, Mat rightImage, Mat laplacianL, Mat laplacianR, int pxX, int pxY, PushbroomStereoState state, int *left_interest, int *right_interest, int *raw_sad)
+{
+    // init parameters
+    int blockSize = BLOCK_SIZE > 0 ? BLOCK_SIZE : state.blockSize;
+    int disparity = state.disparity;
+    int sobelLimit = state.sobelLimit;
+
+    // top left corner of the SAD box
+    int startX = pxX;
+    int startY = pxY;
+
+    // bottom right corner of the SAD box
+    #ifndef USE_NEON
+        int endX = pxX + blockSize - 1;
+    #endif
+
+    int endY = pxY + blockSize - 1;
+
+
+    //printf("startX = %d, endX = %d, disparity = %d, startY = %d, endY = %d, rows = %d, cols = %d\n", startX, endX, disparity, startY, endY, leftImage.rows, leftImage.cols);
+
+    int leftVal = 0, rightVal = 0;
+
+    int sad = 0;
+
+    #ifdef USE_NEON
+        uint16x8_t interest_op_sum_8x_L, interest_op_sum_8x_R, sad_sum_8x;
+
+        // load zeros into everything
+        interest_op_sum_8x_L = vdupq_n_u16(0);
+        interest_op_sum_8x_R = vdupq_n_u16(0);
+        sad_sum_8x = vdupq_n_u16(0);
+
+    #endif
+
+    #ifdef USE_SSE2
+        bool use_sse2 = blockSize <= SSE2_MAX_BLOCK_SIZE;
+
+        __m128i block_mask = BlockRowMask(min(blockSize, SSE2_MAX_BLOCK_SIZE));
+        __m128i zero = _mm_setzero_si128();
+
+        // the left interest sum is in the low half, the right in the high half
+        __m128i interest_op_sum_LR = zero, sad_sum = zero;
+    #endif
+
+    for (int i=startY;i<=endY;i++) {
+        // get a pointer for this row
+        uchar *this_rowL = leftImage.ptr<uchar>(i);
+        uchar *this_rowR = rightImage.ptr<uchar>(i);
+
+        uchar *this_row_laplacianL = laplacianL.ptr<uchar>(i);
+        uchar *this_row_laplacianR = laplacianR.ptr<uchar>(i);
+
+        #ifdef USE_SSE2
+            if (use_sse2) {
+                __m128i row_L = LoadBlockRow(this_rowL + startX, block_mask);
+                __m128i row_R = LoadBlockRow(this_rowR + startX + disparity, block_mask);
+
+                __m128i interest_op_LR = LoadBlockRowPair(this_row_laplacianL + startX,
+                    this_row_laplacianR + startX + disparity, block_mask);
+
+                sad_sum = _mm_add_epi32(sad_sum, _mm_sad_epu8(row_L, row_R));
+                interest_op_sum_LR = _mm_add_epi32(interest_op_sum_LR, _mm_sad_epu8(interest_op_LR, zero));
+
+                continue;
+            }
+        #endif
+
+        #ifdef USE_NEON
+            // load this row into memory
+            uint8x8_t this_row_8x8_L = vld1_u8(this_rowL + startX);
+            uint8x8_t this_row_8x8_R = vld1_u8(this_rowR + startX + disparity);
+
+            uint8x8_t interest_op_8x8_L = vld1_u8(this_row_laplacianL + startX);
+            uint8x8_t interest_op_8x8_R = vld1_u8(this_row_laplacianR + startX + disparity);
+
+            // do absolute differencing for the entire row in one operation!
+            uint8x8_t sad_8x = vabd_u8(this_row_8x8_L, this_row_8x8_R);
+
+            // sum up
+            sad_sum_8x = vaddw_u8(sad_sum_8x, sad_8x);
+
+            // sum laplacian values
+            interest_op_sum_8x_L = vaddw_u8(interest_op_sum_8x_L, interest_op_8x8_L);
+            interest_op_sum_8x_R = vaddw_u8(interest_op_sum_8x_R, interest_op_8x8_R);
+
+        #else // USE_NEON
+
+            for (int j=startX;j<=endX;j++) {
+                // we are now looking at a single pixel value
+                /*uchar pxL = leftImage.at<uchar>(i,j);
+                uchar pxR = rightImage.at<uchar>(i,j + disparity);
+
+                uchar sL = laplacianL.at<uchar>(i,j);
+                uchar sR = laplacianR.at<uchar>(i,j + disparity);
+                */
+
+
+                uchar sL = this_row_laplacianL[j];//laplacianL.at<uchar>(i,j);
+                uchar sR = this_row_laplacianR[j + disparity]; //laplacianR.at<uchar>(i,j + disparity);
+
+                leftVal += sL;
+                rightVal += sR;
+
+                uchar pxL = this_rowL[j];
+                uchar pxR = this_rowR[j + disparity];
+
+                sad += abs(pxL - pxR);
+            }
+        #endif // USE_NEON
+    }
+
+    #ifdef USE_NEON
+        // sum up
+        sad = vgetq_lane_u16(sad_sum_8x, 0) + vgetq_lane_u16(sad_sum_8x, 1)
+           + vgetq_lane_u16(sad_sum_8x, 2) + vgetq_lane_u16(sad_sum_8x, 3)
+           + vgetq_lane_u16(sad_sum_8x, 4);// + vgetq_lane_u16(sad_sum_8x, 5)
+    //           + vgetq_lane_u16(sad_sum_8x, 6) + vgetq_lane_u16(sad_sum_8x, 7);
+
+        leftVal = vgetq_lane_u16(interest_op_sum_8x_L, 0)
+                + vgetq_lane_u16(interest_op_sum_8x_L, 1)
+                + vgetq_lane_u16(interest_op_sum_8x_L, 2)
+                + vgetq_lane_u16(interest_op_sum_8x_L, 3)
+                + vgetq_lane_u16(interest_op_sum_8x_L, 4);
+
+
+        rightVal = vgetq_lane_u16(interest_op_sum_8x_R, 0)
+                 + vgetq_lane_u16(interest_op_sum_8x_R, 1)
+                 + vgetq_lane_u16(interest_op_sum_8x_R, 2)
+                 + vgetq_lane_u16(interest_op_sum_8x_R, 3)
+                 + vgetq_lane_u16(interest_op_sum_8x_R, 4);
+    #endif
+
+    #ifdef USE_SSE2
+        if (use_sse2) {
+            sad = _mm_cvtsi128_si32(sad_sum);
+            leftVal = _mm_cvtsi128_si32(interest_op_sum_LR);
+            rightVal = _mm_cvtsi128_si32(_mm_srli_si128(interest_op_sum_LR, 8));
+        }
+    #endif
+
+    //cout << "(" << leftVal << ", " << rightVal << ") vs. (" << leftVal2 << ", " << rightVal2 << ")" << endl;
+
+    int laplacian_value = leftVal + rightVal;
+
+    //cout << "sad with neon: " << sad << " without neon: " << sad2 << endl;
+
+    if (left_interest != NULL) {
+        *left_interest = leftVal;
+    }
+
+    if (right_interest != NULL) {
+        *right_interest = rightVal;
+    }
+
+    // percentage of total interest value that is different
+    //float diff_score = 100*(float)abs(leftVal - rightVal)/(float)laplacian_value;
+
+    if (raw_sad != NULL) {
+        *raw_sad = sad;
+    }
+
+
+    if (leftVal < sobelLimit || rightVal < sobelLimit)// || diff_score > state.interest_diff_limit)
+    {
+        return -1;
+    }
+
+    // weight laplacian_value into the score
+
+    //return sobel;
+    return NUMERIC_CONST*(float)sad/(float)laplacian_value;
+}
+
+#if defined(USE_NEON) || defined(USE_SSE2)
+/**
+ * GetSAD for two blocks on the same rows at once, with each block row of
+ * both blocks in one 128-bit register, so every SIMD operation does both
+ * blocks.  The blocks don't have to be next to each other.  Same scores
+ * as GetSADBlock (for BLOCK_SIZE, see there).  SSE2 builds only use it
+ * for blocks up to SSE2_MAX_BLOCK_SIZE wide.
+ *
+ * @param leftImage left image
+ * @param rightImage right image
+ * @param laplacianL laplacian-fitlered left image
+ * @param laplacianR laplacian-filtered right image
+ * @param pxX0 column of the first block's top left corner
+ * @param pxX1 column of the second block's top left corner
+ * @param pxY row of both blocks' top left corners
+ * @param state state structure that includes a number of parameters
+ * @param sad_out (output) the two blocks' scores, as GetSAD returns them
+ */
+template <int BLOCK_SIZE>
+void PushbroomStereo::GetSADPairBlock(Mat leftImage, Mat rightImage, Mat laplacianL, Mat laplacianR, int pxX0, int pxX1, int pxY, PushbroomStereoState state, int *sad_out)
+{
+    int blockSize = BLOCK_SIZE > 0 ? BLOCK_SIZE : state.blockSize;
+    int disparity = state.disparity;
+
+    int endY = pxY + blockSize - 1;
+
+    int sad[2], leftVal[2], rightVal[2];
+
+    #ifdef USE_NEON
+        // GetSAD sums the first 5 lanes of each block row
+        uint8x16_t lane_mask = vcombine_u8(vcreate_u8(0x000000FFFFFFFFFFULL), vcreate_u8(0x000000FFFFFFFFFFULL));
+
+        // lanes 0-3 add up the first block, 4-7 the second
+        uint16x8_t sad_sum = vdupq_n_u16(0);
+        uint16x8_t interest_op_sum_L = vdupq_n_u16(0);
+        uint16x8_t interest_op_sum_R = vdupq_n_u16(0);
+    #else
+        __m128i block_mask = BlockRowMask(min(blockSize, SSE2_MAX_BLOCK_SIZE));
+        __m128i zero = _mm_setzero_si128();
+
+        // the first block in the low half, the second in the high half
+        __m128i sad_sum = zero, interest_op_sum_L = zero, interest_op_sum_R = zero;
+    #endif
+
+    for (int i=pxY;i<=endY;i++) {
+        uchar *this_rowL = leftImage.ptr<uchar>(i);
+        uchar *this_rowR = rightImage.ptr<uchar>(i);
+
+        uchar *this_row_laplacianL = laplacianL.ptr<uchar>(i);
+        uchar *this_row_laplacianR = laplacianR.ptr<uchar>(i);
+
+        #ifdef USE_NEON
+            uint8x16_t row_L = vcombine_u8(vld1_u8(this_rowL + pxX0), vld1_u8(this_rowL + pxX1));
+            uint8x16_t row_R = vcombine_u8(vld1_u8(this_rowR + pxX0 + disparity), vld1_u8(this_rowR + pxX1 + disparity));
+
+            uint8x16_t interest_op_L = vcombine_u8(vld1_u8(this_row_laplacianL + pxX0), vld1_u8(this_row_laplacianL + pxX1));
+            uint8x16_t interest_op_R = vcombine_u8(vld1_u8(this_row_laplacianR + pxX0 + disparity), vld1_u8(this_row_laplacianR + pxX1 + disparity));
+
+            sad_sum = vpadalq_u8(sad_sum, vandq_u8(vabdq_u8(row_L, row_R), lane_mask));
+
+            interest_op_sum_L = vpadalq_u8(interest_op_sum_L, vandq_u8(interest_op_L, lane_mask));
+            interest_op_sum_R = vpadalq_u8(interest_op_sum_R, vandq_u8(interest_op_R, lane_mask));
+        #else
+            __m128i row_L = LoadBlockRowPair(this_rowL + pxX0, this_rowL + pxX1, block_mask);
+            __m128i row_R = LoadBlockRowPair(this_rowR + pxX0 + disparity, this_rowR + pxX1 + disparity, block_mask);
+
+            __m128i interest_op_L = LoadBlockRowPair(this_row_laplacianL + pxX0, this_row_laplacianL + pxX1, block_mask);
+            __m128i interest_op_R = LoadBlockRowPair(this_row_laplacianR + pxX0 + disparity, this_row_laplacianR + pxX1 + disparity, block_mask);
+
+            sad_sum = _mm_add_epi32(sad_sum, _mm_sad_epu8(row_L, row_R));
+
+            interest_op_sum_L = _mm_add_epi32(interest_op_sum_L, _mm_sad_epu8(interest_op_L, zero));
+            interest_op_sum_R = _mm_add_epi32(interest_op_sum_R, _mm_sad_epu8(interest_op_R, zero));
+        #endif
+    }
+
+    #ifdef USE_NEON
+        uint64x2_t sad_2x = vpaddlq_u32(vpaddlq_u16(sad_sum));
+        uint64x2_t left_2x = vpaddlq_u32(vpaddlq_u16(interest_op_sum_L));
+        uint64x2_t right_2x = vpaddlq_u32(vpaddlq_u16(interest_op_sum_R));
+
+        sad[0] = vgetq_lane_u64(sad_2x, 0);
+        sad[1] = vgetq_lane_u64(sad_2x, 1);
+        leftVal[0] = vgetq_lane_u64(left_2x, 0);
+        leftVal[1] = vgetq_lane_u64(left_2x, 1);
+        rightVal[0] = vgetq_lane_u64(right_2x, 0);
+        rightVal[1] = vgetq_lane_u64(right_2x, 1);
+    #else
+        sad[0] = _mm_cvtsi128_si32(sad_sum);
+        sad[1] = _mm_cvtsi128_si32(_mm_srli_si128(sad_sum, 8));
+        leftVal[0] = _mm_cvtsi128_si32(interest_op_sum_L);
+        leftVal[1] = _mm_cvtsi128_si32(_mm_srli_si128(interest_op_sum_L, 8));
+        rightVal[0] = _mm_cvtsi128_si32(interest_op_sum_R);
+        rightVal[1] = _mm_cvtsi128_si32(_mm_srli_si128(interest_op_sum_R, 8));
+    #endif
+
+    for (int k = 0; k < 2; k++) {
+        if (leftVal[k] < state.sobelLimit || rightVal[k] < state.sobelLimit) {
+            sad_out[k] = -1;
+        } else {
+            sad_out[k] = NUMERIC_CONST*(float)sad[k]/(float)(leftVal[k] + rightVal[k]);
+        }
+    }
+}
+#endif // USE_NEON || USE_SSE2
+
+/**
+ * Refines the disparity of a hit to sub-pixel precision by fitting a
+ * parabola through the raw SADs (or census distances, with
+ * state.census_matching) at disparity - 1, disparity and disparity + 1 and
+ * taking its minimum.
+ *
+ * @param leftImage left image
+ * @param rightImage right image
+ * @param laplacianL laplacian-fitlered left image
+ * @param laplacianR laplacian-filtered right image
+ * @param censusL census transform of the left image (if census_matching)
+ * @param censusR census transform of the right image (if census_matching)
+ * @param pxX column of the block's top left corner
+ * @param pxY row of the block's top left corner
+ * @param state state structure that includes a number of parameters
+ * @param disparity disparity the block matched at
+ *
+ * @retval refined disparity, within 0.5 of disparity (or disparity
+ *      itself if the neighboring disparities are off the image or the
+ *      SADs don't have a minimum)
+ */
+float PushbroomStereo::RefineDisparity(Mat leftImage, Mat rightImage, Mat laplacianL, Mat laplacianR, Mat censusL, Mat censusR, int pxX, int pxY, PushbroomStereoState state, int disparity) {
+
+    int blockSize = state.blockSize;
+
+    if (pxX + disparity - 1 < 0 || pxX + blockSize + disparity + 1 > rightImage.cols) {
+        return disparity;
+    }
+
+    int sads[3];
+
+    for (int k = 0; k < 3; k++) {
+        if (state.census_matching) {
+            sads[k] = GetCensusDistance(censusL, censusR, pxX, pxY, blockSize, disparity + k - 1, 0);
+            continue;
+        }
+
+        state.disparity = disparity + k - 1;
+
+        // only the raw SAD is used, so it doesn't matter if the
+        // neighboring blocks fail the interest operator
+        (this->*get_sad_)(leftImage, rightImage, laplacianL, laplacianR, pxX, pxY, state, NULL, NULL, &(sads[k]));
+    }
+
+    int curvature = sads[0] - 2 * sads[1] + sads[2];
+
+    if (curvature <= 0) {
+        // flat or a maximum, nothing to fit
+        return disparity;
+    }
+
+    float offset = (sads[0] - sads[2]) / (2.0f * curvature);
+
+    return disparity + max(-0.5f, min(0.5f, offset));
+}
+
+/**
+ * Census transform of some rows of an image: each pixel gets one bit per
+ * neighbor (in a 3x3 window), set if the neighbor is darker than it.
+ * Pixels past the edge of the image count as the nearest edge pixel.
+ *
+ * @param image remapped image (or tile) to transform
+ * @param row_start first row of image to transform
+ * @param row_end one past the last row of image to transform
+ * @param cols columns to transform
+ * @param census (output) CV_8UC1, row 0 is image row row_start
+ */
+void PushbroomStereo::CensusTransform(Mat image, int row_start, int row_end, Range cols, Mat census) {
+
+    for (int i = row_start; i < row_end; i++) {
+        const uchar *row_above = image.ptr<uchar>(max(0, i - 1));
+        const uchar *row = image.ptr<uchar>(i);
+        const uchar *row_below = image.ptr<uchar>(min(image.rows - 1, i + 1));
+
+        uchar *census_row = census.ptr<uchar>(i - row_start);
+
+        for (int j = cols.start; j < cols.end; j++) {
+            int left = max(0, j - 1);
+            int right = min(image.cols - 1, j + 1);
+
+            uchar center = row[j];
+
+            census_row[j] = (row_above[left] < center)
+                | (row_above[j] < center) << 1
+                | (row_above[right] < center) << 2
+                | (row[left] < center) << 3
+                | (row[right] < center) << 4
+                | (row_below[left] < center) << 5
+                | (row_below[j] < center) << 6
+                | (row_below[right] < center) << 7;
+        }
+    }
+}
+
+/**
+ * @param name interest operator from the config file: "laplacian",
+ *      "laplacian-abs" or "sobel-abs"
+ *
+ * @retval the PushbroomStereoInterestOperator, INTEREST_OP_LAPLACIAN (with
+ *      a warning) if the name is unknown
+ */
+int PushbroomStereo::InterestOperatorFromName(string name) {
+    if (name == "laplacian") {
+        return INTEREST_OP_LAPLACIAN;
+    } else if (name == "laplacian-abs") {
+        return INTEREST_OP_LAPLACIAN_ABS;
+    } else if (name == "sobel-abs") {
+        return INTEREST_OP_SOBEL_ABS;
+    }
+
+    fprintf(stderr, "Warning: unknown interest operator \"%s\", using \"laplacian\".\n", name.c_str());
+    return INTEREST_OP_LAPLACIAN;
+}
+
+/**
+ * @param name random_results layout: "uniform", "trees" or "walls"
+ *
+ * @retval the PushbroomStereoRandomLayout, RANDOM_LAYOUT_UNIFORM (with a
+ *      warning) if the name is unknown
+ */
+int PushbroomStereo::RandomLayoutFromName(string name) {
+    if (name == "uniform") {
+        return RANDOM_LAYOUT_UNIFORM;
+    } else if (name == "trees") {
+        return RANDOM_LAYOUT_TREES;
+    } else if (name == "walls") {
+        return RANDOM_LAYOUT_WALLS;
+    }
+
+    fprintf(stderr, "Warning: unknown random layout \"%s\", using \"uniform\".\n", name.c_str());
+    return RANDOM_LAYOUT_UNIFORM;
+}
+
+// reflects an index past either end of [0, n) back in, like
+// BORDER_DEFAULT (BORDER_REFLECT_101)
+static inline int ReflectIndex(int i, int n) {
+    if (n == 1) {
+        return 0;
+    } else if (i < 0) {
+        return -i;
+    } else if (i >= n) {
+        return 2 * n - 2 - i;
+    }
+
+    return i;
+}
+
+// one pixel of the interest operator, from the rows above and below it and
+// the columns to either side
+static inline uchar InterestResponse(const uchar *above, const uchar *row, const uchar *below,
+    int left, int j, int right, int interest_operator) {
+
+    int response;
+
+    if (interest_operator == INTEREST_OP_SOBEL_ABS) {
+        int gx = (above[right] + 2 * row[right] + below[right]) - (above[left] + 2 * row[left] + below[left]);
+        int gy = (below[left] + 2 * below[j] + below[right]) - (above[left] + 2 * above[j] + above[right]);
+
+        response = abs(gx) + abs(gy);
+    } else {
+        // cv::Laplacian's 3x3 kernel
+        response = 2 * (above[left] + above[right] + below[left] + below[right]) - 8 * row[j];
+
+        if (interest_operator == INTEREST_OP_LAPLACIAN_ABS) {
+            response = abs(response);
+        }
+    }
+
+    return saturate_cast<uchar>(response);
+}
+
+/**
+ * 3x3 interest operator (see PushbroomStereoInterestOperator) on some rows
+ * of an image, saturated to 8 bits.  Pixels past the edge of the image are
+ * reflected like BORDER_DEFAULT, so INTEREST_OP_LAPLACIAN gives the same
+ * result as cv::Laplacian(image, dst, -1, 3) in a single pass.  The middle of
+ * each row is done 8 pixels at a time with NEON or SSE2.
+ *
+ * @param image remapped image (or tile) to filter
+ * @param row_start first row of image to filter
+ * @param row_end one past the last row of image to filter
+ * @param cols columns to filter
+ * @param dst (output) CV_8UC1, row 0 is image row row_start
+ * @param interest_operator a PushbroomStereoInterestOperator
+ */
+void PushbroomStereo::InterestOperator(Mat image, int row_start, int row_end, Range cols, Mat dst, int interest_operator) {
+
+    // columns with both neighbors in the image, which the SIMD code can do
+    int inside_start = min(max(cols.start, 1), cols.end);
+    int inside_end = max(min(cols.end, image.cols - 1), inside_start);
+
+    bool sobel = interest_operator == INTEREST_OP_SOBEL_ABS;
+    bool absolute = interest_operator == INTEREST_OP_LAPLACIAN_ABS;
+
+    for (int i = row_start; i < row_end; i++) {
+        const uchar *above = image.ptr<uchar>(ReflectIndex(i - 1, image.rows));
+        const uchar *row = image.ptr<uchar>(i);
+        const uchar *below = image.ptr<uchar>(ReflectIndex(i + 1, image.rows));
+
+        uchar *dst_row = dst.ptr<uchar>(i - row_start);
+
+        int j = cols.start;
+
+        for (; j < inside_start; j++) {
+            dst_row[j] = InterestResponse(above, row, below, ReflectIndex(j - 1, image.cols), j,
+                ReflectIndex(j + 1, image.cols), interest_operator);
+        }
+
+        #if defined(USE_NEON) || defined(USE_SSE2)
+            for (; j + 8 <= inside_end; j += 8) {
+                #ifdef USE_NEON
+                    int16x8_t a0 = LoadWiden8(above + j - 1), a1 = LoadWiden8(above + j), a2 = LoadWiden8(above + j + 1);
+                    int16x8_t r0 = LoadWiden8(row + j - 1), r1 = LoadWiden8(row + j), r2 = LoadWiden8(row + j + 1);
+                    int16x8_t b0 = LoadWiden8(below + j - 1), b1 = LoadWiden8(below + j), b2 = LoadWiden8(below + j + 1);
+
+                    int16x8_t response;
+
+                    if (sobel) {
+                        int16x8_t gx = vsubq_s16(vaddq_s16(vaddq_s16(a2, b2), vshlq_n_s16(r2, 1)),
+                            vaddq_s16(vaddq_s16(a0, b0), vshlq_n_s16(r0, 1)));
+                        int16x8_t gy = vsubq_s16(vaddq_s16(vaddq_s16(b0, b2), vshlq_n_s16(b1, 1)),
+                            vaddq_s16(vaddq_s16(a0, a2), vshlq_n_s16(a1, 1)));
+
+                        response = vaddq_s16(vabsq_s16(gx), vabsq_s16(gy));
+                    } else {
+                        int16x8_t corners = vaddq_s16(vaddq_s16(a0, a2), vaddq_s16(b0, b2));
+
+                        response = vsubq_s16(vshlq_n_s16(corners, 1), vshlq_n_s16(r1, 3));
+
+                        if (absolute) {
+                            response = vabsq_s16(response);
+                        }
+                    }
+
+                    // saturates negatives to 0 like saturate_cast
+                    vst1_u8(dst_row + j, vqmovun_s16(response));
+                #else
+                    __m128i a0 = LoadWiden8(above + j - 1), a1 = LoadWiden8(above + j), a2 = LoadWiden8(above + j + 1);
+                    __m128i r0 = LoadWiden8(row + j - 1), r1 = LoadWiden8(row + j), r2 = LoadWiden8(row + j + 1);
+                    __m128i b0 = LoadWiden8(below + j - 1), b1 = LoadWiden8(below + j), b2 = LoadWiden8(below + j + 1);
+
+                    __m128i response;
+
+                    if (sobel) {
+                        __m128i gx = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(a2, b2), _mm_slli_epi16(r2, 1)),
+                            _mm_add_epi16(_mm_add_epi16(a0, b0), _mm_slli_epi16(r0, 1)));
+                        __m128i gy = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(b0, b2), _mm_slli_epi16(b1, 1)),
+                            _mm_add_epi16(_mm_add_epi16(a0, a2), _mm_slli_epi16(a1, 1)));
+
+                        response = _mm_add_epi16(Abs16(gx), Abs16(gy));
+                    } else {
+                        __m128i corners = _mm_add_epi16(_mm_add_epi16(a0, a2), _mm_add_epi16(b0, b2));
+
+                        response = _mm_sub_epi16(_mm_slli_epi16(corners, 1), _mm_slli_epi16(r1, 3));
+
+                        if (absolute) {
+                            response = Abs16(response);
+                        }
+                    }
+
+                    // saturates negatives to 0 like saturate_cast
+                    _mm_storel_epi64((__m128i*)(dst_row + j), _mm_packus_epi16(response, response));
+                #endif
+            }
+        #endif
+
+        for (; j < inside_end; j++) {
+            dst_row[j] = InterestResponse(above, row, below, j - 1, j, j + 1, interest_operator);
+        }
+
+        for (; j < cols.end; j++) {
+            dst_row[j] = InterestResponse(above, row, below, ReflectIndex(j - 1, image.cols), j,
+                ReflectIndex(j + 1, image.cols), interest_operator);
+        }
+    }
+}
+
+/**
+ * Number of census bits that differ between a block in the left image and
+ * the same block, moved, in the right image.
+ *
+ * @param censusL census transform of the left image
+ * @param censusR census transform of the right image
+ * @param pxX column of the block's top left corner
+ * @param pxY row of the block's top left corner
+ * @param blockSize size of the block
+ * @param offset_x columns to move the block by in the right image
+ * @param offset_y rows to move the block by in the right image
+ *
+ * @retval Hamming distance between the blocks
+ */
+int PushbroomStereo::GetCensusDistance(Mat censusL, Mat censusR, int pxX, int pxY, int blockSize, int offset_x, int offset_y) {
+
+    int distance = 0;
+
+    #ifdef USE_NEON
+        // lanes [0, blockSize) of the mask are set
+        static const uint8_t lane_mask_bytes[16] = { 255, 255, 255, 255, 255, 255, 255, 255, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+        bool use_neon = blockSize <= 8;
+
+        uint8x8_t lane_mask = vld1_u8(lane_mask_bytes + 8 - min(blockSize, 8));
+        uint16x4_t distance_4x = vdup_n_u16(0);
+    #endif
+
+    for (int i = pxY; i < pxY + blockSize; i++) {
+        const uchar *row_L = censusL.ptr<uchar>(i) + pxX;
+        const uchar *row_R = censusR.ptr<uchar>(i + offset_y) + pxX + offset_x;
+
+        #ifdef USE_NEON
+            if (use_neon) {
+                // count the differing bits of 8 pixels at once, and
+                // drop the ones past the block
+                uint8x8_t bits = vcnt_u8(veor_u8(vld1_u8(row_L), vld1_u8(row_R)));
+
+                distance_4x = vpadal_u8(distance_4x, vand_u8(bits, lane_mask));
+                continue;
+            }
+        #endif
+
+        for (int j = 0; j < blockSize; j++) {
+            distance += __builtin_popcount(row_L[j] ^ row_R[j]);
+        }
+    }
+
+    #ifdef USE_NEON
+        if (use_neon) {
+            distance = vget_lane_u16(distance_4x, 0) + vget_lane_u16(distance_4x, 1)
+                + vget_lane_u16(distance_4x, 2) + vget_lane_u16(distance_4x, 3);
+        }
+    #endif
+
+    return distance;
+}
+
+/**
+ * Census version of GetSAD: checks the interest operator and then matches
+ * the block on the census transforms.
+ *
+ * @param laplacianL laplacian-filtered left image
+ * @param laplacianR laplacian-filtered right image
+ * @param censusL census transform of the left image
+ * @param censusR census transform of the right image
+ * @param pxX column of the block's top left corner
+ * @param pxY row of the block's top left corner
+ * @param state state structure that includes a number of parameters
+ * @param disparity disparity to match at
+ *
+ * @retval number of census bits that differ, or -1 if the block doesn't
+ *      pass the interest operator
+ */
+int PushbroomStereo::GetCensusScore(Mat laplacianL, Mat laplacianR, Mat censusL, Mat censusR, int pxX, int pxY, PushbroomStereoState state, int disparity) {
+
+    int blockSize = state.blockSize;
+
+    int leftVal = 0, rightVal = 0;
+
+    for (int i = pxY; i < pxY + blockSize; i++) {
+        const uchar *row_L = laplacianL.ptr<uchar>(i) + pxX;
+        const uchar *row_R = laplacianR.ptr<uchar>(i) + pxX + disparity;
+
+        for (int j = 0; j < blockSize; j++) {
+            leftVal += row_L[j];
+            rightVal += row_R[j];
+        }
+    }
+
+    if (leftVal < state.sobelLimit || rightVal < state.sobelLimit) {
+        return -1;
+    }
+
+    return GetCensusDistance(censusL, censusR, pxX, pxY, blockSize, disparity, 0);
+}
+
+/**
+ * Census version of CheckHorizontalInvariance: looks for the block around
+ * the zero-disparity position with textured enough blocks that have
+ * fewer than census_threshold / horizontalInvarianceMultiplier differing
+ * census bits.
+ *
+ * @param laplacianL laplacian-filtered left image
+ * @param laplacianR laplacian-filtered right image
+ * @param censusL census transform of the left image
+ * @param censusR census transform of the right image
+ * @param pxX column of the block's top left corner
+ * @param pxY row of the block's top left corner
+ * @param state state structure that includes a number of parameters
+ *
+ * @retval true if the block might be a false positive
+ */
+bool PushbroomStereo::CheckHorizontalInvarianceCensus(Mat laplacianL, Mat laplacianR, Mat censusL, Mat censusR, int pxX, int pxY, PushbroomStereoState state) {
+
+    int blockSize = state.blockSize;
+    int disparity = state.zero_dist_disparity;
+
+    // same as CheckHorizontalInvariance: give up near the edges
+    if (   pxX + disparity + INVARIANCE_CHECK_HORZ_OFFSET_MIN < 0
+        || pxX + blockSize - 1 + disparity + INVARIANCE_CHECK_HORZ_OFFSET_MAX >= laplacianR.cols
+        || pxY + INVARIANCE_CHECK_VERT_OFFSET_MIN < 0
+        || pxY + blockSize - 1 + INVARIANCE_CHECK_VERT_OFFSET_MAX >= laplacianR.rows) {
+
+        return true;
+    }
+
+    for (int vert_offset = INVARIANCE_CHECK_VERT_OFFSET_MIN;
+        vert_offset <= INVARIANCE_CHECK_VERT_OFFSET_MAX;
+        vert_offset+= INVARIANCE_CHECK_VERT_OFFSET_INCREMENT) {
+
+        for (int horz_offset = INVARIANCE_CHECK_HORZ_OFFSET_MIN;
+            horz_offset <= INVARIANCE_CHECK_HORZ_OFFSET_MAX;
+            horz_offset++) {
+
+            int right_val = 0;
+
+            for (int i = pxY; i < pxY + blockSize; i++) {
+                const uchar *row_R = laplacianR.ptr<uchar>(i + vert_offset) + pxX + disparity + horz_offset;
+
+                for (int j = 0; j < blockSize; j++) {
+                    right_val += row_R[j];
+                }
+            }
+
+            if (right_val < state.sobelLimit) {
+                continue;
+            }
+
+            int distance = GetCensusDistance(censusL, censusR, pxX, pxY, blockSize, disparity + horz_offset, vert_offset);
+
+            if (state.horizontalInvarianceMultiplier * distance < state.census_threshold) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
 
-                    if (!state.check_horizontal_invariance || CheckHorizontalInvariance(leftImage, rightImage, laplacian_left, laplacian_right, j, i, state) == false) {
+/**
+ * Finds the largest raw SAD that GetSAD would still score below
+ * sadThreshold for a block with this interest value.  The score only grows
+ * with the SAD, so any block whose partial sum is past this can't be a hit.
+ *
+ * @param laplacian_value leftVal + rightVal for the block
+ * @param sadThreshold threshold on the scaled score
+ *
+ * @retval largest passing raw SAD, or -1 if no SAD passes
+ */
+static int MaxPassingSAD(int laplacian_value, int sadThreshold) {
 
-                        // add it to the vector of matches
-                        // don't forget to offset it by the blockSize,
-                        // so we match the center of the block instead
-                        // of the top left corner
-                        localHitPoints.push_back(Point3f(j+blockSize/2.0, i+blockSize/2.0, -disparity));
+    if (sadThreshold <= 0 || laplacian_value <= 0) {
+        return -1;
+    }
 
-                        //localHitPoints.push_back(Point3f(state.debugJ, state.debugI, -disparity));
+    // start from the exact answer and then step until the float
+    // computation in GetSAD agrees with us
+    int max_sad = (int)((long long)sadThreshold * laplacian_value / NUMERIC_CONST);
 
+    while ((int)(NUMERIC_CONST*(float)(max_sad + 1)/(float)laplacian_value) < sadThreshold) {
+        max_sad ++;
+    }
 
-                        uchar pxL = leftImage.at<uchar>(i,j);
-                        pointColors->push_back(pxL); // TODO: this is the corner of the box, not the center
+    while (max_sad >= 0 && (int)(NUMERIC_CONST*(float)max_sad/(float)laplacian_value) >= sadThreshold) {
+        max_sad --;
+    }
 
-                        hitCounter ++;
+    return max_sad;
+}
 
-                        if (state.show_display)
-                        {
-                            pointVector2d->push_back(Point3i(j, i, sad));
-                        }
-                    } // check horizontal invariance
-                }
-            }
-        }
-    } else {
+/**
+ * Version of GetSAD for blocks that have already passed the interest
+ * operator check.  The SAD is compared against sadThreshold after every row
+ * and stops as soon as the block can't be a hit, so most blocks only read
+ * a few rows.
+ *
+ * @param leftImage left image
+ * @param rightImage right image
+ * @param pxX row pixel location
+ * @param pxY column pixel location
+ * @param state state structure that includes a number of parameters
+ * @param laplacian_value leftVal + rightVal for this block, as GetSAD would
+ *      compute it
+ *
+ * @retval same as GetSAD when the block is a hit.  Otherwise some value
+ *      >= state.sadThreshold.
+ */
+int PushbroomStereo::GetSADEarlyExit(Mat leftImage, Mat rightImage, int pxX, int pxY, PushbroomStereoState state, int laplacian_value)
+{
+    return GetSADEarlyExitBlock<0>(leftImage, rightImage, pxX, pxY, state, laplacian_value);
+}
 
-        double intpart;
+/**
+ * GetSADEarlyExit for a block size known at compile time (see
+ * GetSADBlock).
+ */
+template <int BLOCK_SIZE>
+int PushbroomStereo::GetSADEarlyExitBlock(Mat leftImage, Mat rightImage, int pxX, int pxY, PushbroomStereoState state, int laplacian_value)
+{
+    int blockSize = BLOCK_SIZE > 0 ? BLOCK_SIZE : state.blockSize;
+    int disparity = state.disparity;
 
-        float fractpart = modf(state.random_results , &intpart);
-        hitCounter = round(intpart);
+    int max_sad = MaxPassingSAD(laplacian_value, state.sadThreshold);
 
-        // determine if this is a time we'll use that last point
-        std::random_device rd;
-        std::default_random_engine generator(rd()); // rd() provides a random seed
-        std::uniform_real_distribution<float> distribution(0, 1);
+    if (max_sad < 0) {
+        return state.sadThreshold;
+    }
 
-        if (fractpart > distribution(generator)) {
-            hitCounter ++;
-        }
+    int startX = pxX;
+    int endY = pxY + blockSize - 1;
 
-        for (int i = 0; i < hitCounter; i++) {
+    int sad = 0;
 
-            int randx = rand() % (stopJ - startJ) + startJ;
-            int randy = rand() % (row_end - row_start) + row_start;
+    #ifdef USE_NEON
+        // GetSAD sums the first 5 lanes
+        uint8x8_t lane_mask = vcreate_u8(0x000000FFFFFFFFFFULL);
+    #elif defined(USE_SSE2)
+        bool use_sse2 = blockSize <= SSE2_MAX_BLOCK_SIZE;
+        __m128i block_mask = BlockRowMask(min(blockSize, SSE2_MAX_BLOCK_SIZE));
+    #endif
 
-            localHitPoints.push_back(Point3f(randx, randy, -disparity));
-        }
-    }
+    for (int i=pxY;i<=endY;i++) {
+        uchar *this_rowL = leftImage.ptr<uchar>(i);
+        uchar *this_rowR = rightImage.ptr<uchar>(i);
 
-    // now we have an array of hits -- transform them to 3d points
-    if (hitCounter > 0) {
+        #ifdef USE_NEON
+            uint8x8_t sad_8x = vand_u8(vabd_u8(vld1_u8(this_rowL + startX),
+                vld1_u8(this_rowR + startX + disparity)), lane_mask);
+
+            sad += vget_lane_u64(vpaddl_u32(vpaddl_u16(vpaddl_u8(sad_8x))), 0);
+        #else
+            #ifdef USE_SSE2
+            if (use_sse2) {
+                sad += _mm_cvtsi128_si32(_mm_sad_epu8(LoadBlockRow(this_rowL + startX, block_mask),
+                    LoadBlockRow(this_rowR + startX + disparity, block_mask)));
+            } else
+            #endif
+            {
+                for (int j=startX;j<startX+blockSize;j++) {
+                    sad += abs(this_rowL[j] - this_rowR[j + disparity]);
+                }
+            }
+        #endif
 
-        perspectiveTransform(localHitPoints, *pointVector3d, state.Q);
+        if (sad > max_sad) {
+            return state.sadThreshold;
+        }
     }
 
+    return NUMERIC_CONST*(float)sad/(float)laplacian_value;
 }
 
-
 /**
- * Get the sum of absolute differences for a specific pixel location and disparity
+ * Get the sum of absolute differences for a specific pixel location at each
+ * of the disparities in state.disparities, in one pass over the block.
+ * The left block and its interest operator are only loaded once, and the
+ * right image rows are only looked up once for all disparities.
  *
  * @param leftImage left image
  * @param rightImage right image
@@ -503,18 +3195,16 @@ void PushbroomStereo::RunStereoPushbroomStereo(PushbroomStereoStateThreaded *sta
  * @param pxX row pixel location
  * @param pxY column pixel location
  * @param state state structure that includes a number of parameters
- * @param left_interest optional parameter that will be filled with the value for the left interest operation
- * @param right_interest same as above, for the right image
- *
- * @retval scaled sum of absolute differences for this block --
- *      the value is the sum/numberOfPixels
+ * @param sad_out (output) array of state.num_disparities results with the
+ *      same meaning as the return value of GetSAD (-1 if the block failed
+ *      the interest operator check at that disparity)
  */
-int PushbroomStereo::GetSAD(Mat leftImage, Mat rightImage, Mat laplacianL, Mat laplacianR, int pxX, int pxY, PushbroomStereoState state, int *left_interest, int *right_interest, int *raw_sad)
+void PushbroomStereo::GetSADMulti(Mat leftImage, Mat rightImage, Mat laplacianL, Mat laplacianR, int pxX, int pxY, PushbroomStereoState state, int *sad_out)
 {
     // init parameters
     int blockSize = state.blockSize;
-    int disparity = state.disparity;
     int sobelLimit = state.sobelLimit;
+    int num_disparities = min(state.num_disparities, MAX_DISPARITIES);
 
     // top left corner of the SAD box
     int startX = pxX;
@@ -527,85 +3217,39 @@ int PushbroomStereo::GetSAD(Mat leftImage, Mat rightImage, Mat laplacianL, Mat l
 
     int endY = pxY + blockSize - 1;
 
-    #if USE_SAFTEY_CHECKS
-        int flag = false;
-        if (startX < 0)
-        {
-            printf("Warning: startX < 0\n");
-            flag = true;
-        }
-
-        if (endX > rightImage.cols)
-        {
-            printf("Warning: endX > leftImage.cols\n");
-            flag = true;
-        }
-
-        if (startX + disparity < 0)
-        {
-            printf("Warning: startX + disparity < 0\n");
-            flag = true;
-        }
-
-        if (endX + disparity > rightImage.cols)
-        {
-            printf("Warning: endX + disparity > leftImage.cols\n");
-            flag = true;
-        }
-
-        if (endX + disparity > rightImage.cols)
-        {
-            printf("Warning: endX + disparity > rightImage.cols\n");
-            endX = rightImage.cols - disparity;
-            flag = true;
-        }
+    int leftVal = 0;
+    int rightVal[MAX_DISPARITIES];
+    int sad[MAX_DISPARITIES];
 
-        if (startY < 0) {
-            printf("Warning: startY < 0\n");
-            flag = true;
-        }
+    #ifdef USE_NEON
+        uint16x8_t interest_op_sum_8x_L, interest_op_sum_8x_R[MAX_DISPARITIES], sad_sum_8x[MAX_DISPARITIES];
 
-        if (endY > rightImage.rows) {
-            printf("Warning: endY > rightImage.rows\n");
-            flag = true;
-        }
+        // load zeros into everything
+        interest_op_sum_8x_L = vdupq_n_u16(0);
 
-        // disparity might be negative as well
-        if (disparity < 0 && startX + disparity < 0)
-        {
-            printf("Warning: disparity < 0 && startX + disparity < 0\n");
-            startX = -disparity;
-            flag = true;
+        for (int k = 0; k < num_disparities; k++) {
+            interest_op_sum_8x_R[k] = vdupq_n_u16(0);
+            sad_sum_8x[k] = vdupq_n_u16(0);
         }
-
-        if (flag == true)
-        {
-            printf("startX = %d, endX = %d, disparity = %d, startY = %d, endY = %d\n", startX, endX, disparity, startY, endY);
+    #else
+        for (int k = 0; k < num_disparities; k++) {
+            rightVal[k] = 0;
+            sad[k] = 0;
         }
-
-
-
-        startX = max(0, startX);
-        startY = max(0, startY);
-
-        endX = min(leftImage.cols - disparity, endX);
-        endY = min(leftImage.rows, endY);
     #endif
 
-    //printf("startX = %d, endX = %d, disparity = %d, startY = %d, endY = %d, rows = %d, cols = %d\n", startX, endX, disparity, startY, endY, leftImage.rows, leftImage.cols);
-
-    int leftVal = 0, rightVal = 0;
-
-    int sad = 0;
+    #ifdef USE_SSE2
+        bool use_sse2 = blockSize <= SSE2_MAX_BLOCK_SIZE;
 
-    #ifdef USE_NEON
-        uint16x8_t interest_op_sum_8x_L, interest_op_sum_8x_R, sad_sum_8x;
+        __m128i block_mask = BlockRowMask(min(blockSize, SSE2_MAX_BLOCK_SIZE));
+        __m128i zero = _mm_setzero_si128();
 
-        // load zeros into everything
-        interest_op_sum_8x_L = vdupq_n_u16(0);
-        interest_op_sum_8x_R = vdupq_n_u16(0);
-        sad_sum_8x = vdupq_n_u16(0);
+        __m128i interest_op_sum_L = zero, interest_op_sum_R[MAX_DISPARITIES], sad_sum[MAX_DISPARITIES];
 
+        for (int k = 0; k < num_disparities; k++) {
+            interest_op_sum_R[k] = zero;
+            sad_sum[k] = zero;
+        }
     #endif
 
     for (int i=startY;i<=endY;i++) {
@@ -616,102 +3260,104 @@ int PushbroomStereo::GetSAD(Mat leftImage, Mat rightImage, Mat laplacianL, Mat l
         uchar *this_row_laplacianL = laplacianL.ptr<uchar>(i);
         uchar *this_row_laplacianR = laplacianR.ptr<uchar>(i);
 
-        #ifdef USE_NEON
-            // load this row into memory
-            uint8x8_t this_row_8x8_L = vld1_u8(this_rowL + startX);
-            uint8x8_t this_row_8x8_R = vld1_u8(this_rowR + startX + disparity);
+        #ifdef USE_SSE2
+            if (use_sse2) {
+                // the left side is shared by all disparities
+                __m128i row_L = LoadBlockRow(this_rowL + startX, block_mask);
 
-            uint8x8_t interest_op_8x8_L = vld1_u8(this_row_laplacianL + startX);
-            uint8x8_t interest_op_8x8_R = vld1_u8(this_row_laplacianR + startX + disparity);
+                interest_op_sum_L = _mm_add_epi32(interest_op_sum_L,
+                    _mm_sad_epu8(LoadBlockRow(this_row_laplacianL + startX, block_mask), zero));
 
-            // do absolute differencing for the entire row in one operation!
-            uint8x8_t sad_8x = vabd_u8(this_row_8x8_L, this_row_8x8_R);
+                for (int k = 0; k < num_disparities; k++) {
+                    int disparity = state.disparities[k];
 
-            // sum up
-            sad_sum_8x = vaddw_u8(sad_sum_8x, sad_8x);
+                    __m128i row_R = LoadBlockRow(this_rowR + startX + disparity, block_mask);
+                    __m128i interest_op_R = LoadBlockRow(this_row_laplacianR + startX + disparity, block_mask);
 
-            // sum laplacian values
-            interest_op_sum_8x_L = vaddw_u8(interest_op_sum_8x_L, interest_op_8x8_L);
-            interest_op_sum_8x_R = vaddw_u8(interest_op_sum_8x_R, interest_op_8x8_R);
+                    sad_sum[k] = _mm_add_epi32(sad_sum[k], _mm_sad_epu8(row_L, row_R));
+                    interest_op_sum_R[k] = _mm_add_epi32(interest_op_sum_R[k], _mm_sad_epu8(interest_op_R, zero));
+                }
 
-        #else // USE_NEON
+                continue;
+            }
+        #endif
 
-            for (int j=startX;j<=endX;j++) {
-                // we are now looking at a single pixel value
-                /*uchar pxL = leftImage.at<uchar>(i,j);
-                uchar pxR = rightImage.at<uchar>(i,j + disparity);
+        #ifdef USE_NEON
+            // the left side is shared by all disparities
+            uint8x8_t this_row_8x8_L = vld1_u8(this_rowL + startX);
+            uint8x8_t interest_op_8x8_L = vld1_u8(this_row_laplacianL + startX);
 
-                uchar sL = laplacianL.at<uchar>(i,j);
-                uchar sR = laplacianR.at<uchar>(i,j + disparity);
-                */
+            interest_op_sum_8x_L = vaddw_u8(interest_op_sum_8x_L, interest_op_8x8_L);
 
+            for (int k = 0; k < num_disparities; k++) {
+                int disparity = state.disparities[k];
 
-                uchar sL = this_row_laplacianL[j];//laplacianL.at<uchar>(i,j);
-                uchar sR = this_row_laplacianR[j + disparity]; //laplacianR.at<uchar>(i,j + disparity);
+                uint8x8_t this_row_8x8_R = vld1_u8(this_rowR + startX + disparity);
+                uint8x8_t interest_op_8x8_R = vld1_u8(this_row_laplacianR + startX + disparity);
 
-                leftVal += sL;
-                rightVal += sR;
+                uint8x8_t sad_8x = vabd_u8(this_row_8x8_L, this_row_8x8_R);
+
+                sad_sum_8x[k] = vaddw_u8(sad_sum_8x[k], sad_8x);
+                interest_op_sum_8x_R[k] = vaddw_u8(interest_op_sum_8x_R[k], interest_op_8x8_R);
+            }
 
+        #else // USE_NEON
+
+            for (int j=startX;j<=endX;j++) {
                 uchar pxL = this_rowL[j];
-                uchar pxR = this_rowR[j + disparity];
 
-                sad += abs(pxL - pxR);
+                leftVal += this_row_laplacianL[j];
+
+                for (int k = 0; k < num_disparities; k++) {
+                    int disparity = state.disparities[k];
+
+                    rightVal[k] += this_row_laplacianR[j + disparity];
+                    sad[k] += abs(pxL - this_rowR[j + disparity]);
+                }
             }
         #endif // USE_NEON
     }
 
     #ifdef USE_NEON
-        // sum up
-        sad = vgetq_lane_u16(sad_sum_8x, 0) + vgetq_lane_u16(sad_sum_8x, 1)
-           + vgetq_lane_u16(sad_sum_8x, 2) + vgetq_lane_u16(sad_sum_8x, 3)
-           + vgetq_lane_u16(sad_sum_8x, 4);// + vgetq_lane_u16(sad_sum_8x, 5)
-    //           + vgetq_lane_u16(sad_sum_8x, 6) + vgetq_lane_u16(sad_sum_8x, 7);
-
+        // sum up (first 5 lanes, like GetSAD)
         leftVal = vgetq_lane_u16(interest_op_sum_8x_L, 0)
                 + vgetq_lane_u16(interest_op_sum_8x_L, 1)
                 + vgetq_lane_u16(interest_op_sum_8x_L, 2)
                 + vgetq_lane_u16(interest_op_sum_8x_L, 3)
                 + vgetq_lane_u16(interest_op_sum_8x_L, 4);
 
+        for (int k = 0; k < num_disparities; k++) {
+            sad[k] = vgetq_lane_u16(sad_sum_8x[k], 0) + vgetq_lane_u16(sad_sum_8x[k], 1)
+                   + vgetq_lane_u16(sad_sum_8x[k], 2) + vgetq_lane_u16(sad_sum_8x[k], 3)
+                   + vgetq_lane_u16(sad_sum_8x[k], 4);
 
-        rightVal = vgetq_lane_u16(interest_op_sum_8x_R, 0)
-                 + vgetq_lane_u16(interest_op_sum_8x_R, 1)
-                 + vgetq_lane_u16(interest_op_sum_8x_R, 2)
-                 + vgetq_lane_u16(interest_op_sum_8x_R, 3)
-                 + vgetq_lane_u16(interest_op_sum_8x_R, 4);
+            rightVal[k] = vgetq_lane_u16(interest_op_sum_8x_R[k], 0)
+                        + vgetq_lane_u16(interest_op_sum_8x_R[k], 1)
+                        + vgetq_lane_u16(interest_op_sum_8x_R[k], 2)
+                        + vgetq_lane_u16(interest_op_sum_8x_R[k], 3)
+                        + vgetq_lane_u16(interest_op_sum_8x_R[k], 4);
+        }
     #endif
 
-    //cout << "(" << leftVal << ", " << rightVal << ") vs. (" << leftVal2 << ", " << rightVal2 << ")" << endl;
-
-    int laplacian_value = leftVal + rightVal;
-
-    //cout << "sad with neon: " << sad << " without neon: " << sad2 << endl;
-
-    if (left_interest != NULL) {
-        *left_interest = leftVal;
-    }
-
-    if (right_interest != NULL) {
-        *right_interest = rightVal;
-    }
-
-    // percentage of total interest value that is different
-    //float diff_score = 100*(float)abs(leftVal - rightVal)/(float)laplacian_value;
-
-    if (raw_sad != NULL) {
-        *raw_sad = sad;
-    }
+    #ifdef USE_SSE2
+        if (use_sse2) {
+            leftVal = _mm_cvtsi128_si32(interest_op_sum_L);
 
+            for (int k = 0; k < num_disparities; k++) {
+                sad[k] = _mm_cvtsi128_si32(sad_sum[k]);
+                rightVal[k] = _mm_cvtsi128_si32(interest_op_sum_R[k]);
+            }
+        }
+    #endif
 
-    if (leftVal < sobelLimit || rightVal < sobelLimit)// || diff_score > state.interest_diff_limit)
-    {
-        return -1;
+    for (int k = 0; k < num_disparities; k++) {
+        if (leftVal < sobelLimit || rightVal[k] < sobelLimit)
+        {
+            sad_out[k] = -1;
+        } else {
+            sad_out[k] = NUMERIC_CONST*(float)sad[k]/(float)(leftVal + rightVal[k]);
+        }
     }
-
-    // weight laplacian_value into the score
-
-    //return sobel;
-    return NUMERIC_CONST*(float)sad/(float)laplacian_value;
 }
 
 /**
@@ -750,13 +3396,13 @@ bool PushbroomStereo::CheckHorizontalInvariance(Mat leftImage, Mat rightImage, M
     // (note: this used to be false and caused bad detections on real flight
     // data near the edge of the frame)
     if (   startX + disparity + INVARIANCE_CHECK_HORZ_OFFSET_MIN < 0
-        || endX + disparity + INVARIANCE_CHECK_HORZ_OFFSET_MAX > rightImage.cols) {
+        || endX + disparity + INVARIANCE_CHECK_HORZ_OFFSET_MAX >= rightImage.cols) {
 
         return true;
     }
 
     if (startY + INVARIANCE_CHECK_VERT_OFFSET_MIN < 0
-        || endY + INVARIANCE_CHECK_VERT_OFFSET_MAX > rightImage.rows) {
+        || endY + INVARIANCE_CHECK_VERT_OFFSET_MAX >= rightImage.rows) {
         // we are limited in the vertical range we can check here
 
         // TODO: be smarter here
@@ -788,6 +3434,117 @@ bool PushbroomStereo::CheckHorizontalInvariance(Mat leftImage, Mat rightImage, M
 
     int counter = 0;
 
+    #if defined(USE_SSE2) && INVARIANCE_CHECK_HORZ_OFFSET_MAX - INVARIANCE_CHECK_HORZ_OFFSET_MIN == 6
+    if (blockSize <= SSE2_MAX_BLOCK_SIZE) {
+        // All the horizontal offsets for one row of the right block fit in
+        // a single 16-byte load (7 offsets + 8 pixels - 1), so the search
+        // window is loaded once per row and shifted into place for each
+        // offset.  Every vertical offset scores all its horizontal offsets
+        // together and we return as soon as one of them matches.
+
+        __m128i block_mask = BlockRowMask(blockSize);
+        __m128i pair_mask = _mm_unpacklo_epi64(block_mask, block_mask);
+        __m128i zero = _mm_setzero_si128();
+
+        // left block rows, copied into each 8-byte lane so they line up
+        // with the offsets
+        #ifdef USE_AVX2
+            __m256i left_rows[SSE2_MAX_BLOCK_SIZE];
+        #else
+            __m128i left_rows[SSE2_MAX_BLOCK_SIZE];
+        #endif
+
+        __m128i left_val_sum = zero;
+
+        for (int y = 0; y < blockSize; y++) {
+            __m128i row_L = LoadBlockRow(leftImage.ptr<uchar>(startY + y) + startX, block_mask);
+
+            #ifdef USE_AVX2
+                left_rows[y] = _mm256_broadcastq_epi64(row_L);
+            #else
+                left_rows[y] = _mm_unpacklo_epi64(row_L, row_L);
+            #endif
+
+            left_val_sum = _mm_add_epi32(left_val_sum,
+                _mm_sad_epu8(LoadBlockRow(sobelL.ptr<uchar>(startY + y) + startX, block_mask), zero));
+        }
+
+        leftVal = _mm_cvtsi128_si32(left_val_sum);
+
+        for (int vert_offset = INVARIANCE_CHECK_VERT_OFFSET_MIN;
+            vert_offset <= INVARIANCE_CHECK_VERT_OFFSET_MAX;
+            vert_offset+= INVARIANCE_CHECK_VERT_OFFSET_INCREMENT) {
+
+            // one 64-bit lane per horizontal offset (the last lane is a
+            // copy of the 7th offset)
+            #ifdef USE_AVX2
+                __m256i sad_sum[2], right_val_sum[2];
+                for (int k = 0; k < 2; k++) {
+                    sad_sum[k] = _mm256_setzero_si256();
+                    right_val_sum[k] = _mm256_setzero_si256();
+                }
+            #else
+                __m128i sad_sum[4], right_val_sum[4];
+                for (int k = 0; k < 4; k++) {
+                    sad_sum[k] = zero;
+                    right_val_sum[k] = zero;
+                }
+            #endif
+
+            for (int y = 0; y < blockSize; y++) {
+                int row = startY + y + vert_offset;
+                int col = startX + disparity + INVARIANCE_CHECK_HORZ_OFFSET_MIN;
+
+                __m128i pairs[4], pairs_sobel[4];
+
+                WindowOffsetPairs(_mm_loadu_si128((const __m128i*)(rightImage.ptr<uchar>(row) + col)), pair_mask, pairs);
+                WindowOffsetPairs(_mm_loadu_si128((const __m128i*)(sobelR.ptr<uchar>(row) + col)), pair_mask, pairs_sobel);
+
+                #ifdef USE_AVX2
+                    for (int k = 0; k < 2; k++) {
+                        __m256i right = _mm256_inserti128_si256(_mm256_castsi128_si256(pairs[2*k]), pairs[2*k + 1], 1);
+                        __m256i right_sobel = _mm256_inserti128_si256(_mm256_castsi128_si256(pairs_sobel[2*k]), pairs_sobel[2*k + 1], 1);
+
+                        sad_sum[k] = _mm256_add_epi32(sad_sum[k], _mm256_sad_epu8(left_rows[y], right));
+                        right_val_sum[k] = _mm256_add_epi32(right_val_sum[k],
+                            _mm256_sad_epu8(right_sobel, _mm256_setzero_si256()));
+                    }
+                #else
+                    for (int k = 0; k < 4; k++) {
+                        sad_sum[k] = _mm_add_epi32(sad_sum[k], _mm_sad_epu8(left_rows[y], pairs[k]));
+                        right_val_sum[k] = _mm_add_epi32(right_val_sum[k], _mm_sad_epu8(pairs_sobel[k], zero));
+                    }
+                #endif
+            }
+
+            long long sads[8], right_vals[8];
+
+            #ifdef USE_AVX2
+                for (int k = 0; k < 2; k++) {
+                    _mm256_storeu_si256((__m256i*)(sads + 4*k), sad_sum[k]);
+                    _mm256_storeu_si256((__m256i*)(right_vals + 4*k), right_val_sum[k]);
+                }
+            #else
+                for (int k = 0; k < 4; k++) {
+                    _mm_storeu_si128((__m128i*)(sads + 2*k), sad_sum[k]);
+                    _mm_storeu_si128((__m128i*)(right_vals + 2*k), right_val_sum[k]);
+                }
+            #endif
+
+            // same test as the scalar code below
+            for (int k = 0; k <= INVARIANCE_CHECK_HORZ_OFFSET_MAX - INVARIANCE_CHECK_HORZ_OFFSET_MIN; k++) {
+                int right_val = (int)right_vals[k];
+
+                if (right_val >= sobelLimit && NUMERIC_CONST*state.horizontalInvarianceMultiplier*(float)sads[k]/((float)(leftVal + right_val)) < state.sadThreshold) {
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+    #endif // USE_SSE2
+
     for (int i=startY;i<=endY;i++)
     {
         for (int j=startX;j<=endX;j++)
@@ -848,6 +3605,127 @@ bool PushbroomStereo::CheckHorizontalInvariance(Mat leftImage, Mat rightImage, M
 
 }
 
+/**
+ * Adds a duration to a histogram.  Safe to call from any number of
+ * threads at once.
+ *
+ * @param histogram histogram to add to
+ * @param start_us start time, in microseconds
+ * @param end_us end time, in microseconds
+ */
+void PushbroomStereo::RecordTiming(PushbroomStereoHistogram *histogram, int64_t start_us, int64_t end_us) {
+
+    int duration = (int)max((int64_t)0, min(end_us - start_us, (int64_t)INT_MAX));
+
+    // 4 buckets per power of two: the position of the top bit and the
+    // two bits below it
+    int bucket = duration;
+
+    if (duration >= 4) {
+        int top_bit = 31 - __builtin_clz(duration);
+        bucket = top_bit * 4 + ((duration >> (top_bit - 2)) & 3) - 4;
+    }
+
+    bucket = min(bucket, TIMING_BUCKETS - 1);
+
+    histogram->counts[bucket].fetch_add(1, memory_order_relaxed);
+
+    int old_max = histogram->max_us.load(memory_order_relaxed);
+    while (duration > old_max
+        && !histogram->max_us.compare_exchange_weak(old_max, duration, memory_order_relaxed)) {
+    }
+}
+
+/**
+ * Top of a histogram bucket, in microseconds (see RecordTiming).
+ */
+static int TimingBucketTop(int bucket) {
+    if (bucket < 4) {
+        return bucket;
+    }
+
+    int top_bit = (bucket + 4) / 4;
+    int fraction = (bucket + 4) % 4;
+
+    return ((4 + fraction + 1) << (top_bit - 2)) - 1;
+}
+
+/**
+ * Summarizes a histogram.
+ *
+ * @param histogram histogram to read
+ * @param timing (output) number of durations, median, 99th percentile and max
+ */
+void PushbroomStereo::GetTiming(PushbroomStereoHistogram *histogram, PushbroomStereoTiming *timing) {
+
+    int counts[TIMING_BUCKETS];
+    int total = 0;
+
+    for (int i = 0; i < TIMING_BUCKETS; i++) {
+        counts[i] = histogram->counts[i].load(memory_order_relaxed);
+        total += counts[i];
+    }
+
+    timing->count = total;
+    timing->p50_ms = 0;
+    timing->p99_ms = 0;
+    timing->max_ms = histogram->max_us.load(memory_order_relaxed) / 1000.0f;
+
+    int so_far = 0;
+    bool have_p50 = false;
+
+    for (int i = 0; i < TIMING_BUCKETS && total > 0; i++) {
+        so_far += counts[i];
+
+        float top_ms = min(TimingBucketTop(i) / 1000.0f, timing->max_ms);
+
+        if (!have_p50 && so_far * 2 >= total) {
+            timing->p50_ms = top_ms;
+            have_p50 = true;
+        }
+
+        if (so_far * 100 >= total * 99) {
+            timing->p99_ms = top_ms;
+            break;
+        }
+    }
+}
+
+void PushbroomStereo::ResetHistogram(PushbroomStereoHistogram *histogram) {
+    for (int i = 0; i < TIMING_BUCKETS; i++) {
+        histogram->counts[i].store(0);
+    }
+
+    histogram->max_us.store(0);
+}
+
+void PushbroomStereo::GetStageTiming(int stage, PushbroomStereoTiming *timing) {
+    GetTiming(&stage_timing_[stage], timing);
+}
+
+void PushbroomStereo::GetThreadTiming(int thread_number, PushbroomStereoTiming *timing) {
+    GetTiming(&thread_timing_[thread_number], timing);
+}
+
+/**
+ * Clears all of the timing histograms.  Call between frames.
+ */
+void PushbroomStereo::ResetTiming() {
+    for (int i = 0; i < NUM_STAGES; i++) {
+        ResetHistogram(&stage_timing_[i]);
+    }
+
+    for (int i = 0; i < MAX_THREADS + 1; i++) {
+        ResetHistogram(&thread_timing_[i]);
+    }
+}
+
+const char* PushbroomStereo::GetStageName(int stage) {
+    static const char *names[NUM_STAGES] = { "remap", "interest", "stereo", "merge", "frame" };
+
+    return names[stage];
+}
+
 /**
  * Round up to the nearest multiple of a number.
  * From: http://stackoverflow.com/questions/3407012/c-rounding-up-to-the-nearest-multiple-of-a-number
@@ -12,33 +12,184 @@
 #include <cv.h>
 #include <iostream>
 #include <mutex>
+#include <atomic>
 #include <condition_variable>
 #include <math.h>
-#include <random> // for debug random generator
+#include <stdint.h>
+
+#include "../../utils/ThreadPool/ThreadPool.hpp"
+#include "../../utils/utils/MemoryAccounting.hpp"
+
+// NO_SIMD builds only the scalar kernels, to benchmark against
+// (see pushbroom-stereo-bench.hpp)
+#ifdef NO_SIMD
+#undef USE_NEON
+#endif
 
 #ifdef USE_NEON
 #include <arm_neon.h>
+#elif defined(__SSE2__) && !defined(NO_SIMD)
+// x86 builds get the SSE2 block-SAD kernels (and AVX2 for the horizontal
+// invariance check when compiled with -mavx2).  Results are identical to the
+// scalar code.
+#define USE_SSE2
+#include <emmintrin.h>
+#ifdef __AVX2__
+#define USE_AVX2
+#include <immintrin.h>
+#endif // __AVX2__
 #endif // USE_NEON
 
+// default number of worker tasks (see PushbroomStereoThreadConfig)
 #define NUM_THREADS 8
 //#define NUM_REMAP_THREADS 8
 
+// most worker tasks a frame can be split into
+#define MAX_THREADS 16
+
+// the image is cut into this many row bands per worker thread so that
+// threads that finish early have something to steal
+#define BANDS_PER_THREAD 4
+#define MAX_BANDS 256
+
+// in the fused pipeline, every band re-does the remap and interest operator
+// for the rows around it that the stereo check reads, so use fewer,
+// taller bands to keep that overlap small
+#define FUSED_BANDS_PER_THREAD 1
+
+// most disparities that can be checked in one pass in multi-disparity mode
+#define MAX_DISPARITIES 8
+
+// where the horizontal invariance check looks for the same texture
+// around the zero-disparity match (used by the OpenCL kernels too)
+#define INVARIANCE_CHECK_VERT_OFFSET_MIN (-8)
+#define INVARIANCE_CHECK_VERT_OFFSET_MAX 8
+#define INVARIANCE_CHECK_VERT_OFFSET_INCREMENT 2
+
+#define INVARIANCE_CHECK_HORZ_OFFSET_MIN (-3)
+#define INVARIANCE_CHECK_HORZ_OFFSET_MAX 3
+
+#define NUMERIC_CONST 333 // just a constant that we multiply the score by to make
+                          // all the parameters in a nice integer range
+
 using namespace cv;
 using namespace std;
 
-enum ThreadWorkType { REMAP, INTEREST_OP, STEREO };
+class PushbroomStereoOpenCL;
+
+// each band is two tasks: remap + interest operator (which only needs
+// this band and a 1-row halo) and then stereo (which needs the bands
+// around it to have finished their remap and interest operator)
+enum ThreadWorkType { REMAP_INTEREST_OP, STEREO };
+
+// a frame submitted with predicted regions runs as two passes over the
+// same blocks: the blocks that touch the regions, then everything else
+enum PushbroomStereoPass { PASS_ALL, PASS_PREDICTED, PASS_REST };
+
+// how a band's blocks got searched, with state.deadline_us: all of them,
+// all of them without the horizontal invariance check, only every other
+// block in each direction (also without the check), or none because the
+// frame was out of time
+enum PushbroomStereoBandQuality { BAND_FULL, BAND_NO_INVARIANCE, BAND_SPARSE, BAND_SKIPPED };
+
+// with state.deadline_us, bands that start after this fraction of the
+// deadline drop the horizontal invariance check, and after the second one
+// they only search every other block
+#define DEADLINE_NO_INVARIANCE_FRACTION 0.5
+#define DEADLINE_SPARSE_FRACTION 0.75
+
+// interest operator for state.interest_operator, all 3x3 and saturated to
+// 8 bits: the Laplacian as cv::Laplacian gives it (negative responses are
+// 0), the Laplacian's magnitude, or |Sobel x| + |Sobel y|
+enum PushbroomStereoInterestOperator { INTEREST_OP_LAPLACIAN, INTEREST_OP_LAPLACIAN_ABS, INTEREST_OP_SOBEL_ABS };
+
+// where state.random_results puts its hits: anywhere in the search region,
+// around a few narrow columns (tree trunks), or across a few wide ones
+// (walls)
+enum PushbroomStereoRandomLayout { RANDOM_LAYOUT_UNIFORM, RANDOM_LAYOUT_TREES, RANDOM_LAYOUT_WALLS };
+
+#define RANDOM_LAYOUT_NUM_TREES 8
+#define RANDOM_LAYOUT_NUM_WALLS 2
+
+// xoroshiro128+, for state.random_results.  Each band gets its own, seeded
+// from the frame and the band, so the hits don't depend on which thread
+// ran what or when.
+class PushbroomStereoRandom {
+    public:
+        explicit PushbroomStereoRandom(uint64_t seed) {
+            // splitmix64 spreads out seeds that are close together
+            for (int i = 0; i < 2; i++) {
+                seed += 0x9e3779b97f4a7c15ull;
+
+                uint64_t z = seed;
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+
+                s_[i] = z ^ (z >> 31);
+            }
+        }
+
+        uint64_t Next() {
+            uint64_t s0 = s_[0];
+            uint64_t s1 = s_[1];
+            uint64_t result = s0 + s1;
+
+            s1 ^= s0;
+            s_[0] = ((s0 << 24) | (s0 >> 40)) ^ s1 ^ (s1 << 16);
+            s_[1] = (s1 << 37) | (s1 >> 27);
+
+            return result;
+        }
+
+        // in [low, high)
+        int Uniform(int low, int high) {
+            return low + (int)((Next() >> 32) * (uint64_t)(high - low) >> 32);
+        }
+
+        // in [0, 1)
+        float UniformFloat() {
+            return (Next() >> 40) * (1.0f / (1 << 24));
+        }
+
+    private:
+        uint64_t s_[2];
+};
 
 struct PushbroomStereoState
 {
     int disparity;
+
+    // if num_disparities > 0, check all of these disparities in one
+    // pass instead of just disparity
+    int num_disparities;
+    int disparities[MAX_DISPARITIES];
+
     int zero_dist_disparity;
     int sobelLimit;
+
+    // a PushbroomStereoInterestOperator.  The GPU only does
+    // INTEREST_OP_LAPLACIAN, frames with the others run on the CPU.
+    int interest_operator;
     int blockSize;
     int sadThreshold;
     float horizontalInvarianceMultiplier;
 
     int lastValidPixelRow;
 
+    // region of the image to search, as [roi_top, roi_bottom) x
+    // [roi_left, roi_right).  Set roi_bottom or roi_right to -1 for the
+    // bottom or right edge of the image.  Rows and columns outside of it
+    // (and below lastValidPixelRow) are not remapped or filtered either.
+    int roi_top;
+    int roi_bottom;
+    int roi_left;
+    int roi_right;
+
+    // optional CV_8UC1 mask the size of the image, blocks whose top left
+    // pixel is 0 are not searched.  Leave empty to search everything
+    // in the region above.
+    Mat roi_mask;
+
     Mat mapxL;
 
     Mat mapxR;
@@ -47,7 +198,61 @@ struct PushbroomStereoState
 
     bool show_display, check_horizontal_invariance;
 
+    // if true, the frame's rectified images and their laplacians are
+    // handed back in PushbroomStereoFrameBuffers, so a display doesn't
+    // have to remap the images again
+    bool keep_rectified;
+
+    // if true, each band is remapped, filtered and matched in one pass
+    // in a per-thread tile instead of going through full-frame images
+    bool fused_pipeline;
+
+    // if true, a block that passed the interest operator but didn't match
+    // last frame is not searched again if no block around it matched last
+    // frame and its interest operator sums (left and right) have each
+    // changed by less than temporal_skip_threshold since it was last
+    // searched.  Only used with sobelLimit > 0 and a single disparity.
+    bool temporal_skip;
+    int temporal_skip_threshold;
+
+    // if true, each hit's disparity is refined to sub-pixel precision by
+    // fitting a parabola to the SADs at disparity - 1, disparity and
+    // disparity + 1, so the 3D points get a sub-pixel depth
+    bool subpixel_refinement;
+
+    // if true, run remap, the interest operator and the block search on
+    // the GPU with OpenCL (see PushbroomStereoOpenCL) instead of the
+    // worker threads.  Frames that use something the GPU version doesn't
+    // do (multiple disparities, sub-pixel refinement, census matching,
+    // random results) still run on the CPU, as does everything if there is
+    // no usable OpenCL device.  The GPU ignores temporal_skip and searches every
+    // block.
+    bool use_opencl;
+
+    // if true, blocks are matched on the census transform of the images
+    // (one bit per neighbor of each pixel, set if the neighbor is darker
+    // than the pixel) by counting the bits that differ, instead of with
+    // SAD on the intensities.  That doesn't care about gain or brightness
+    // differences between the cameras.  A block is a hit if fewer than
+    // census_threshold of its bits differ (and it passes the interest
+    // operator as usual).
+    bool census_matching;
+    int census_threshold;
+
+    // if > 0, the frame has this many microseconds from when it starts.
+    // Bands are searched from the middle of the search region out, and
+    // bands that start late are searched more roughly or not at all (see
+    // PushbroomStereoBandQuality and GetCoverage()), so a busy CPU costs
+    // coverage instead of frame rate.  The GPU ignores it.
+    int deadline_us;
+
+    // if >= 0, skip stereo and make up this many hits per frame, for load
+    // testing what comes after stereo.  A fraction is the chance of one
+    // more.  random_layout is a PushbroomStereoRandomLayout, and the same
+    // random_seed gives the same hits for the same frames.
     float random_results;
+    int random_layout;
+    uint32_t random_seed;
 
     float debugJ, debugI, debugDisparity;
 
@@ -63,108 +268,439 @@ struct PushbroomStereoStateThreaded {
     Mat laplacian_left;
     Mat laplacian_right;
 
-    cv::vector<Point3f> *pointVector3d;
+    // census transforms, if state.census_matching
+    Mat census_left;
+    Mat census_right;
+
+    // hits as (u, v, -disparity), before reprojection to 3D
+    cv::vector<Point3f> *localHitPoints;
     cv::vector<Point3i> *pointVector2d;
     cv::vector<uchar> *pointColors;
+    cv::vector<int> *pointDisparities;
+
+    // blocks searched and blocks skipped by state.temporal_skip
+    int *blocks_searched;
+    int *blocks_skipped;
 
     int row_start;
     int row_end;
 
+    // search every block_stride'th block in each direction (2 for
+    // BAND_SPARSE)
+    int block_stride;
+
+    // rows in the images above are this many rows down from the
+    // top of the full frame (non-zero when they are a tile)
+    int row_offset;
+
+    // per-thread scratch for the summed-area tables of the
+    // laplacians, used to skip blocks without enough texture
+    Mat interest_integral_left;
+    Mat interest_integral_right;
 
 };
 
-struct RemapThreadState {
-    Mat left_image;
-    Mat right_image;
+struct PushbroomStereoBand {
+    int row_start; // first row of the band
+    int row_end;   // one past the last row of the band
 
-    Mat sub_remapped_left_image;
-    Mat sub_remapped_right_image;
+    // rows that the stereo task is allowed to start blocks on
+    int stereo_row_start;
+    int stereo_row_end;
 
-    Mat sub_laplacian_left;
-    Mat sub_laplacian_right;
+    // range of bands that must be remapped and filtered before
+    // the stereo task for this band can run
+    int depends_on_first;
+    int depends_on_last;
 
-    Mat submapxL;
-    Mat submapxR;
-};
+    cv::vector<Point3f> localHitPoints;
+    cv::vector<Point3i> pointVector2d;
+    cv::vector<uchar> pointColors;
+    cv::vector<int> pointDisparities;
 
-struct InterestOpState {
-    Mat left_image;
-    Mat right_image;
+    int blocks_searched;
+    int blocks_skipped;
 
-    Mat sub_laplacian_left;
-    Mat sub_laplacian_right;
+    // PushbroomStereoBandQuality the band got this frame
+    int quality;
+};
 
+// Rows of the image a band's blocks cover, [row_start, row_end), and how
+// they were searched (a PushbroomStereoBandQuality)
+struct PushbroomStereoCoverage {
     int row_start;
     int row_end;
+    int quality;
+};
+
+// What state.temporal_skip remembers about a block from the last time it
+// was searched
+struct PushbroomStereoBlockHistory {
+    int left_interest;
+    int right_interest;
+
+    // true if it was searched and didn't match
+    bool can_skip;
+};
+
+// Output of a frame, laid out the way lcmt_stereo wants it.  Keep one of
+// these around from frame to frame: the arrays are only resized, so once
+// they have seen a busy frame, processing a frame doesn't allocate.
+struct PushbroomStereoFrameBuffers {
+    int number_of_points;
+
+    cv::vector<float> x;
+    cv::vector<float> y;
+    cv::vector<float> z;
+    cv::vector<uchar> grey;
+
+    cv::vector<int> disparities;
+
+    // the same hits as (u, v, d), before they're reprojected with Q (for
+    // lcmt_stereo_compact)
+    cv::vector<Point3f> image_hits;
+
+    // only filled in if state.show_display is set
+    cv::vector<Point3i> pointVector2d;
+
+    // the whole rectified images and their laplacians, only filled in if
+    // state.keep_rectified is set.  When the frame already made them, they
+    // are swapped with the stereo's own buffers instead of copied, so
+    // they're only good until the next frame is collected.
+    Mat remapped_left;
+    Mat remapped_right;
+    Mat laplacian_left;
+    Mat laplacian_right;
+};
+
+// Nearest-neighbor remap map turned into one 16-bit offset per pixel,
+// from where the pixel is to where it comes from in the camera image
+// (see UpdateRemapLut).  Built on the first frame and whenever the map or
+// the camera image layout changes.
+struct PushbroomStereoRemapLut {
+    Mat offsets;
+
+    // false if some offset doesn't fit in 16 bits, in which case
+    // cv::remap gets used instead
+    bool usable;
+
+    // what the table was built for
+    const uchar *map_data;
+    size_t image_step;
+    int image_rows;
+    int image_cols;
+};
+
+// stages of a frame that get timed
+enum PushbroomStereoStage { STAGE_REMAP, STAGE_INTEREST, STAGE_STEREO, STAGE_MERGE, STAGE_FRAME, NUM_STAGES };
+
+// histogram buckets: 4 per power of two microseconds, up to about 1 second
+#define TIMING_BUCKETS 80
+
+// Fixed-bucket histogram of durations.  Worker threads add to it with
+// atomics, so recording never takes a lock.
+struct PushbroomStereoHistogram {
+    atomic<int> counts[TIMING_BUCKETS];
+    atomic<int> max_us;
+};
+
+// Summary of a histogram.  Percentiles are rounded up to the top of their
+// bucket (within 19%).
+struct PushbroomStereoTiming {
+    int count;
+    float p50_ms;
+    float p99_ms;
+    float max_ms;
 };
 
+// How to split up each frame.  Each worker is a task on a thread pool
+// (see ThreadPool.hpp), which is what sets the threads' CPUs and priority.
+// DefaultThreadConfig() gives NUM_THREADS evenly loaded workers on the
+// shared pool.
+struct PushbroomStereoThreadConfig {
+    int num_threads;
+
+    // relative share of the image each worker starts with, so that
+    // workers on faster cores can be given more rows
+    float band_weights[MAX_THREADS];
+
+    // pool to run on, or NULL for ThreadPool::GetShared()
+    ThreadPool *pool;
+};
 
 class PushbroomStereo {
     private:
+        void StartFrame(InputArray _leftImage, InputArray _rightImage, PushbroomStereoState state, int pass = PASS_ALL);
+        bool StartFrameOpenCL(PushbroomStereoState state);
+        bool FinishFrame(bool wait);
+        void CollectHits(PushbroomStereoFrameBuffers *buffers, float unit_conversion, bool append = false);
+        void CollectRectified(PushbroomStereoFrameBuffers *buffers);
+
+        void LoadReprojection(Mat Q);
+        void ReprojectHits(const cv::vector<Point3f> &hits, float scale, float *x, float *y, float *z, int stride);
+
         void RunStereoPushbroomStereo(PushbroomStereoStateThreaded *statet);
 
-        void RunRemapping(RemapThreadState *remap_state);
+        void RunRemapInterestOp(int band, int thread_number);
+        void RunFusedBand(int band, int thread_number);
 
-        void RunInterestOp(InterestOpState *interest_state);
+        float RefineDisparity(Mat leftImage, Mat rightImage, Mat laplacianL, Mat laplacianR, Mat censusL, Mat censusR, int pxX, int pxY, PushbroomStereoState state, int disparity);
 
         bool CheckHorizontalInvariance(Mat leftImage, Mat rightImage, Mat sobelL, Mat sobelR, int pxX, int pxY, PushbroomStereoState state);
 
-        void StartWorkerThread(int i, ThreadWorkType work_type);
-        void SyncWorkerThreads();
+        static void CensusTransform(Mat image, int row_start, int row_end, Range cols, Mat census);
+        int GetCensusDistance(Mat censusL, Mat censusR, int pxX, int pxY, int blockSize, int offset_x, int offset_y);
+        int GetCensusScore(Mat laplacianL, Mat laplacianR, Mat censusL, Mat censusR, int pxX, int pxY, PushbroomStereoState state, int disparity);
+        bool CheckHorizontalInvarianceCensus(Mat laplacianL, Mat laplacianR, Mat censusL, Mat censusR, int pxX, int pxY, PushbroomStereoState state);
 
-        // this must be static so the threading won't have to
-        // deal with the implicit 'this' variable
-        static void* WorkerThread(void *x);
+        void UpdateRemapLut(Mat map, Mat image, PushbroomStereoRemapLut *lut);
+        void RemapRows(Mat image, Mat map, PushbroomStereoRemapLut *lut, int row_start, int row_end, Range cols, Mat dst);
 
-        int RoundUp(int numToRound, int multiple);
+        void BuildInterestIntegral(Mat laplacian, int row_start, int row_end, Mat integral_image);
+
+        int RandomResults(PushbroomStereoStateThreaded *statet, int startJ, int stopJ, int disparity);
 
-        pthread_t worker_pool_[NUM_THREADS+1];
-        ThreadWorkType work_type_[NUM_THREADS+1];
+        template <int BLOCK_SIZE>
+        int GetSADBlock(Mat leftImage, Mat rightImage, Mat laplacianL, Mat laplacianR, int pxX, int pxY, PushbroomStereoState state, int *left_interest, int *right_interest, int *raw_sad);
 
-        bool has_new_data_[NUM_THREADS+1];
+        template <int BLOCK_SIZE>
+        int GetSADEarlyExitBlock(Mat leftImage, Mat rightImage, int pxX, int pxY, PushbroomStereoState state, int laplacian_value);
 
-        PushbroomStereoStateThreaded thread_states_[NUM_THREADS+1];
-        RemapThreadState remap_thread_states_[NUM_THREADS+1];
-        InterestOpState interest_op_states_[NUM_THREADS+1];
+        template <int BLOCK_SIZE>
+        void GetSADPairBlock(Mat leftImage, Mat rightImage, Mat laplacianL, Mat laplacianR, int pxX0, int pxX1, int pxY, PushbroomStereoState state, int *sad_out);
 
-        mutex data_mutexes_[NUM_THREADS+1];
+        void GetSearchRegion(int rows, int cols, PushbroomStereoState state, int *top, int *bottom, int *left, int *right);
+        void SetupBands(int rows, int cols, PushbroomStereoState state);
+        bool SetupPredictedBlocks(const cv::vector<Rect> &regions, PushbroomStereoState state, PushbroomStereoState *predicted_state);
+        void SetupTemporalSkip(int rows, int cols, PushbroomStereoState state);
+        bool BlockHitLastFrame(int block_row, int block_col);
+        void GetMaskBounds(Mat mask, int *top, int *bottom, int *left, int *right);
 
-        condition_variable cv_new_data_[NUM_THREADS+1];
-        condition_variable cv_thread_finish_[NUM_THREADS+1];
+        bool SetBandQuality(int band);
 
-        unique_lock<mutex> lockers_[NUM_THREADS+1];
+        void RunTasks(int thread_number);
+        bool ClaimTask(int queue, int *task);
+        void RunTask(int queue, int task, int thread_number);
+        void WaitForBands(int first, int last);
+
+        void WorkerTask(int thread_number, int frame_number);
+        bool TasksLeft();
+
+        int RoundUp(int numToRound, int multiple);
+
+        static void RecordTiming(PushbroomStereoHistogram *histogram, int64_t start_us, int64_t end_us);
+        static void GetTiming(PushbroomStereoHistogram *histogram, PushbroomStereoTiming *timing);
+        static void ResetHistogram(PushbroomStereoHistogram *histogram);
+
+        void StartWorkers(PushbroomStereoThreadConfig config);
+        void MeasureMemory();
+
+        int num_threads_;
+        float band_weights_[MAX_THREADS];
+
+        ThreadPool *pool_;
+
+        // per-frame data, written by ProcessImages before the frame
+        // is started and read-only in the workers for the rest of it
+        PushbroomStereoState frame_state_;
+        Mat left_image_;
+        Mat right_image_;
+        Mat remapped_left_;
+        Mat remapped_right_;
+        Mat laplacian_left_;
+        Mat laplacian_right_;
+        Mat census_left_;
+        Mat census_right_;
+
+        // per-thread scratch space for the remap halo rows (and the
+        // interest operator and census, in the fused pipeline)
+        Mat remap_tile_left_[MAX_THREADS+1];
+        Mat remap_tile_right_[MAX_THREADS+1];
+        Mat laplacian_tile_left_[MAX_THREADS+1];
+        Mat laplacian_tile_right_[MAX_THREADS+1];
+        Mat census_tile_left_[MAX_THREADS+1];
+        Mat census_tile_right_[MAX_THREADS+1];
+
+        // per-thread summed-area tables for the stereo task's rows
+        Mat interest_integral_left_[MAX_THREADS+1];
+        Mat interest_integral_right_[MAX_THREADS+1];
+
+        // number of rows above and below a band that get remapped with it
+        int tile_halo_;
+
+        // columns this frame remaps, and the (narrower) columns it runs
+        // the interest operator on, so that every column the stereo
+        // search reads is filtered the same as it would be in the full
+        // frame
+        int remap_col_start_;
+        int remap_col_end_;
+        int interest_col_start_;
+        int interest_col_end_;
+
+        // 2 normally (remap + interest op, then stereo), 1 when fused
+        int tasks_per_band_;
+
+        // true if this frame remaps and filters every pixel of the full
+        // frame images (one CPU pass, not fused, no search region), so
+        // CollectRectified() can hand them over as they are
+        bool rectified_whole_;
+
+        // per-block memory for state.temporal_skip, on a grid of
+        // blockSize x blockSize cells.  block_hits_[frame_number_ % 2] is
+        // this frame's, the other one is last frame's.
+        cv::vector<PushbroomStereoBlockHistory> block_history_;
+        cv::vector<uchar> block_hits_[2];
+        int block_grid_rows_;
+        int block_grid_cols_;
+
+        // frame and parameters the block memory is from
+        int temporal_frame_;
+        PushbroomStereoState temporal_state_;
+
+        // frames the block memory has seen.  Unlike frame_number_, this
+        // doesn't count the second pass of a predicted frame, so both
+        // passes share last frame's hits and this frame's.
+        int search_frame_;
+
+        // which pass of the frame is running (see PushbroomStereoPass),
+        // and the parameters the caller gave for the whole frame
+        int frame_pass_;
+        PushbroomStereoState search_state_;
+
+        // 1 for each block on the block memory's grid that touches one
+        // of this frame's predicted regions
+        cv::vector<uchar> predicted_blocks_;
+        int predicted_grid_cols_;
+
+        // totals for the last frame
+        int blocks_searched_;
+        int blocks_skipped_;
+
+        // offset tables for remapping the left and right images
+        PushbroomStereoRemapLut remap_lut_left_;
+        PushbroomStereoRemapLut remap_lut_right_;
+
+        // state.Q for this frame, as doubles
+        double reprojection_[16];
+
+        // SAD kernels specialized for this frame's block size, picked
+        // in SetupBands
+        int (PushbroomStereo::*get_sad_)(Mat leftImage, Mat rightImage, Mat laplacianL, Mat laplacianR, int pxX, int pxY, PushbroomStereoState state, int *left_interest, int *right_interest, int *raw_sad);
+        int (PushbroomStereo::*get_sad_early_exit_)(Mat leftImage, Mat rightImage, int pxX, int pxY, PushbroomStereoState state, int laplacian_value);
+
+        // NULL if there's no SIMD pair kernel for this block size
+        void (PushbroomStereo::*get_sad_pair_)(Mat leftImage, Mat rightImage, Mat laplacianL, Mat laplacianR, int pxX0, int pxX1, int pxY, PushbroomStereoState state, int *sad_out);
+
+        int num_bands_;
+        PushbroomStereoBand bands_[MAX_BANDS];
+
+        // band that each slot of the queues below runs.  Normally each
+        // worker's run of bands from the top down, with a deadline the
+        // bands closest to the middle of the search region first.
+        int band_order_[MAX_BANDS];
+        PushbroomStereoStateThreaded band_states_[MAX_BANDS];
+
+        // set to the frame number once the band's remap and interest
+        // operator are done, so they never need to be cleared
+        atomic<int> band_ready_[MAX_BANDS];
+
+        // each thread owns a contiguous run of bands and pops tasks from
+        // the front of its queue; idle threads steal from the front of
+        // others.  Tasks [0, n) are the remap tasks for the run of bands
+        // and [n, 2n) are the stereo tasks (the fused pipeline only has
+        // the first n).
+        int queue_first_band_[MAX_THREADS+1];
+        int queue_num_bands_[MAX_THREADS+1];
+        atomic<int> queue_next_task_[MAX_THREADS+1];
+
+        // frame start / finish handshake (once per frame, not per stage).
+        // Worker tasks that start after the frame is done (the calling
+        // thread stole all of their work) don't run; the ones that start in
+        // time are counted in workers_active_.  tasks_pending_ is every task
+        // still in the pool's queue or running, which the destructor waits
+        // for.
+        mutex frame_mutex_;
+        condition_variable cv_frame_finished_;
+        int frame_number_;
+        bool frame_done_;
+        int workers_active_;
+        int tasks_pending_;
+
+        // true between Submit() and the Poll() that returns its hits
+        bool frame_in_flight_;
+
+        // how long each stage takes (per band for remap, interest and
+        // stereo, per frame for merge and the whole frame) and how long
+        // each thread works on each frame
+        PushbroomStereoHistogram stage_timing_[NUM_STAGES];
+        PushbroomStereoHistogram thread_timing_[MAX_THREADS+1];
+
+        int64_t frame_start_us_;
+
+        // GPU backend, created on the first frame with state.use_opencl.
+        // opencl_failed_ is set if it couldn't start, so we don't keep
+        // trying.
+        PushbroomStereoOpenCL *opencl_;
+        bool opencl_failed_;
+
+        // true if the frame in progress is running on the GPU
+        bool frame_on_gpu_;
+
+        // what the buffers above have grown to (MeasureMemory())
+        MemoryGauge memory_;
 
 
     public:
         PushbroomStereo();
+        PushbroomStereo(PushbroomStereoThreadConfig thread_config);
+        ~PushbroomStereo();
 
-        void ProcessImages(InputArray _leftImage, InputArray _rightImage, cv::vector<Point3f> *pointVector3d, cv::vector<uchar> *pointColors, cv::vector<Point3i> *pointVector2d, PushbroomStereoState state);
+        static PushbroomStereoThreadConfig DefaultThreadConfig();
 
-        ThreadWorkType GetWorkType(int i) { return work_type_[i]; }
+        void ProcessImages(InputArray _leftImage, InputArray _rightImage, cv::vector<Point3f> *pointVector3d, cv::vector<uchar> *pointColors, cv::vector<Point3i> *pointVector2d, PushbroomStereoState state, cv::vector<int> *pointDisparities = NULL);
 
-        PushbroomStereoStateThreaded* GetThreadedState(int i) {
-            return &(thread_states_[i]);
-        }
+        void ProcessImages(InputArray _leftImage, InputArray _rightImage, PushbroomStereoFrameBuffers *buffers, PushbroomStereoState state, float unit_conversion = 1);
 
-        bool GetHasNewData(int i) { return has_new_data_[i]; }
-        void SetHasNewData(int i, bool val) { has_new_data_[i] = val; }
+        // asynchronous version of the above, so the caller can do other
+        // work (like grabbing or recording frames) while stereo runs.
+        // With predicted_regions (in remapped image coordinates, like
+        // where last frame's obstacles should be now), the blocks that
+        // touch them are searched first and PollPredicted() gets their
+        // hits before the rest of the frame is done.
+        bool Submit(InputArray _leftImage, InputArray _rightImage, PushbroomStereoState state, const cv::vector<Rect> *predicted_regions = NULL);
+        bool PollPredicted(PushbroomStereoFrameBuffers *buffers, float unit_conversion = 1, bool wait = false, bool search_rest = true);
+        bool Poll(PushbroomStereoFrameBuffers *buffers, float unit_conversion = 1, bool wait = false);
 
-        int GetSAD(Mat leftImage, Mat rightImage, Mat laplacianL, Mat laplacianR, int pxX, int pxY, PushbroomStereoState state, int *left_interest = NULL, int *right_interest = NULL, int *raw_sad = NULL);
+        // timing since the last ResetTiming().  Workers are numbered 0 to
+        // GetNumThreads() - 1, and GetNumThreads() is the calling thread.
+        void GetStageTiming(int stage, PushbroomStereoTiming *timing);
+        void GetThreadTiming(int thread_number, PushbroomStereoTiming *timing);
+        void ResetTiming();
+        int GetNumThreads() { return num_threads_; }
+        static const char* GetStageName(int stage);
 
-        RemapThreadState* GetRemapState(int i) { return &(remap_thread_states_[i]); }
+        // state.interest_operator on some rows of an image, for anyone who
+        // wants the same laplacians as stereo (like a display)
+        static int InterestOperatorFromName(string name);
+        static void InterestOperator(Mat image, int row_start, int row_end, Range cols, Mat dst, int interest_operator);
 
-        InterestOpState* GetInterestOpState(int i) { return &(interest_op_states_[i]); }
+        // state.random_layout from its name on the command line
+        static int RandomLayoutFromName(string name);
 
-};
+        // blocks that were searched and blocks that state.temporal_skip
+        // skipped in the last frame
+        void GetBlockCounts(int *blocks_searched, int *blocks_skipped);
+
+        // rows the last frame's bands covered and how well, for
+        // state.deadline_us
+        void GetCoverage(cv::vector<PushbroomStereoCoverage> *coverage);
+
+        int GetSAD(Mat leftImage, Mat rightImage, Mat laplacianL, Mat laplacianR, int pxX, int pxY, PushbroomStereoState state, int *left_interest = NULL, int *right_interest = NULL, int *raw_sad = NULL);
+
+        int GetSADEarlyExit(Mat leftImage, Mat rightImage, int pxX, int pxY, PushbroomStereoState state, int laplacian_value);
 
-struct PushbroomStereoThreadStarter {
-    int thread_number;
-    mutex *data_mutex;
-    condition_variable *cv_new_data;
-    condition_variable *cv_thread_finish;
-    bool *is_working;
+        void GetSADMulti(Mat leftImage, Mat rightImage, Mat laplacianL, Mat laplacianR, int pxX, int pxY, PushbroomStereoState state, int *sad_out);
 
-    PushbroomStereo *parent;
 };
 
 
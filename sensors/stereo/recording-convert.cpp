@@ -0,0 +1,84 @@
+/**
+ * Converts PGM or AVI recordings to .rec files.
+ *
+ * Example:
+ *   ./recording-convert -l vids/videoL-skip-226-2013-11-16.00
+ *       -t vids/videoR-skip-226-2013-11-16.00 -o vids/videoLR-2013-11-16.00.rec
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#include "recording-convert.hpp"
+
+int main(int argc, char *argv[]) {
+
+    string video_file_left = "", video_file_right = "";
+    string output_file = "";
+    string metadata = "";
+    int first_frame_number = -1;
+    bool compress = false;
+    int compress_threads = 2;
+    bool quiet_mode = false;
+
+    ConciseArgs parser(argc, argv);
+    parser.add(video_file_left, "l", "left-video", "Left video directory of PGM files or .avi file.", true);
+    parser.add(video_file_right, "t", "right-video", "Right video directory of PGM files or .avi file.", true);
+    parser.add(output_file, "o", "output", ".rec file to write.", true);
+    parser.add(first_frame_number, "f", "first-frame", "Frame number of the first frame (defaults to the skip number in the left video's name).");
+    parser.add(compress, "z", "compress", "Losslessly compress the frames (PNG).");
+    parser.add(compress_threads, "n", "threads", "Threads to compress on.");
+    parser.add(metadata, "m", "metadata", "Text to store in the .rec file (defaults to the names of the videos).");
+    parser.add(quiet_mode, "q", "quiet", "Reduce text output.");
+    parser.parse();
+
+    if (first_frame_number < 0) {
+        // old recordings are numbered from the skip in their name, for
+        // example videoL-skip-226-2013-11-16.00
+        string left_name = video_file_left;
+
+        while (left_name.length() > 1 && left_name.back() == '/') {
+            left_name = left_name.substr(0, left_name.length() - 1);
+        }
+
+        if (left_name.find_last_of('/') != string::npos) {
+            left_name = left_name.substr(left_name.find_last_of('/') + 1);
+        }
+
+        first_frame_number = 0;
+
+        if (left_name.find("-skip-") != string::npos) {
+            first_frame_number = max(RecordingManager::GetSkipNumber(left_name), 0);
+        }
+    }
+
+    if (metadata.length() <= 0) {
+        metadata = "converted from: " + video_file_left + "\nand: " + video_file_right;
+    }
+
+    // only the video settings matter for reading and converting
+    OpenCvStereoConfig stereo_config;
+    stereo_config.usePGM = true;
+    stereo_config.streamRecording = false;
+    stereo_config.compressRecording = compress;
+    stereo_config.compressRecordingThreads = compress_threads;
+
+    RecordingManager recording_manager;
+
+    recording_manager.Init(stereo_config);
+    recording_manager.SetQuietMode(quiet_mode);
+    recording_manager.SetRecordingMetadata(metadata);
+
+    if (recording_manager.LoadVideoFiles(video_file_left, video_file_right) != true) {
+        return 1;
+    }
+
+    printf("Converting from frame %d...\n", first_frame_number);
+
+    if (recording_manager.ConvertToRecordingFile(output_file, first_frame_number) != true) {
+        fprintf(stderr, "Error: failed to convert to %s.\n", output_file.c_str());
+        return 1;
+    }
+
+    return 0;
+}
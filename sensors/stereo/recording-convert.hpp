@@ -0,0 +1,28 @@
+/**
+ * Converts a PGM or AVI recording (a left and right directory of PGM files
+ * or a left and right .avi, as written by RecordingManager) into a single
+ * indexed .rec file, which plays back and seeks much faster.
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#ifndef RECORDING_CONVERT_HPP
+#define RECORDING_CONVERT_HPP
+
+#include <cv.h>
+#include <highgui.h>
+
+#include "opencv2/opencv.hpp"
+
+#include "../../externals/ConciseArgs.hpp"
+
+#include <stdio.h>
+
+#include "opencv-stereo-util.hpp"
+#include "RecordingManager.hpp"
+
+using namespace std;
+using namespace cv;
+
+#endif
@@ -0,0 +1,4 @@
+TARGET = recording-convert
+SOURCES = recording-convert.cpp opencv-stereo-util.cpp ../../externals/jpeg-utils/jpeg-utils.c RecordingManager.cpp HardwareVideoWriter.cpp ../../utils/utils/RealtimeUtils.cpp
+
+include ../../utils/make/flight.mk
@@ -0,0 +1,139 @@
+#include "stereo-bench-util.hpp"
+
+/**
+ * Parses a comma separated list of integers, like "1,2,4,8".
+ *
+ * @param list string to parse
+ *
+ * @retval the integers in the list (empty if the string is)
+ */
+cv::vector<int> ParseIntList(string list) {
+    cv::vector<int> values;
+
+    stringstream stream(list);
+    string item;
+
+    while (getline(stream, item, ',')) {
+        if (item.length() > 0) {
+            values.push_back(atoi(item.c_str()));
+        }
+    }
+
+    return values;
+}
+
+/**
+ * Loads one frame pair that RecordingManager recorded into a pair of PGM
+ * directories.
+ *
+ * @param left_dir directory with left00000.pgm, left00001.pgm, ...
+ * @param right_dir directory with right00000.pgm, right00001.pgm, ...
+ * @param file_number number in the file names
+ * @param left (output) left image
+ * @param right (output) right image
+ *
+ * @retval false if either image couldn't be read
+ */
+bool LoadFrame(string left_dir, string right_dir, int file_number, Mat *left, Mat *right) {
+    boost::format formatter_left = boost::format("/left%05d.pgm") % file_number;
+    boost::format formatter_right = boost::format("/right%05d.pgm") % file_number;
+
+    *left = imread(left_dir + formatter_left.str(), -1);
+    *right = imread(right_dir + formatter_right.str(), -1);
+
+    return left->data != NULL && right->data != NULL;
+}
+
+/**
+ * Loads the frames that RecordingManager recorded into a pair of PGM
+ * directories, starting at frame 0 and stopping at the first missing one.
+ *
+ * @param left_dir directory with left00000.pgm, left00001.pgm, ...
+ * @param right_dir directory with right00000.pgm, right00001.pgm, ...
+ * @param max_frames most frames to load
+ * @param left_frames (output) left images
+ * @param right_frames (output) right images
+ *
+ * @retval number of frame pairs loaded
+ */
+int LoadFrames(string left_dir, string right_dir, int max_frames, cv::vector<Mat> *left_frames, cv::vector<Mat> *right_frames) {
+
+    for (int i = 0; i < max_frames; i++) {
+        Mat left, right;
+
+        if (LoadFrame(left_dir, right_dir, i, &left, &right) != true) {
+            break;
+        }
+
+        left_frames->push_back(left);
+        right_frames->push_back(right);
+    }
+
+    return left_frames->size();
+}
+
+/**
+ * Sets up the stereo state from the config file the same way
+ * pushbroom-stereo does, without the display.
+ *
+ * @param config parsed configuration file
+ * @param calibration calibration that the config file points to
+ * @param state (output) stereo state
+ */
+void SetupState(const OpenCvStereoConfig &config, const OpenCvStereoCalibration &calibration, PushbroomStereoState *state) {
+    state->disparity = config.disparity;
+    state->zero_dist_disparity = config.infiniteDisparity;
+    state->sobelLimit = config.interestOperatorLimit;
+    state->interest_operator = PushbroomStereo::InterestOperatorFromName(config.interestOperator);
+    state->horizontalInvarianceMultiplier = config.horizontalInvarianceMultiplier;
+    state->blockSize = config.blockSize;
+    state->random_results = -1;
+    state->random_layout = RANDOM_LAYOUT_UNIFORM;
+    state->random_seed = 0;
+    state->check_horizontal_invariance = true;
+    state->sadThreshold = config.sadThreshold;
+
+    state->mapxL = calibration.mx1fp;
+    state->mapxR = calibration.mx2fp;
+    state->Q = calibration.qMat;
+    state->show_display = false;
+    state->keep_rectified = false;
+
+    state->lastValidPixelRow = config.lastValidPixelRow;
+
+    state->roi_top = config.roiTop;
+    state->roi_bottom = config.roiBottom;
+    state->roi_left = config.roiLeft;
+    state->roi_right = config.roiRight;
+
+    if (config.roiMask.length() > 0) {
+        state->roi_mask = imread(config.roiMask, CV_LOAD_IMAGE_GRAYSCALE);
+
+        if (state->roi_mask.size() != state->mapxL.size()) {
+            fprintf(stderr, "Warning: failed to read ROI mask (%s) or it is the wrong size, searching the whole image.\n", config.roiMask.c_str());
+
+            state->roi_mask = Mat();
+        }
+    }
+
+    state->fused_pipeline = config.fusedPipeline;
+
+    state->temporal_skip = config.temporalSkip;
+    state->temporal_skip_threshold = config.temporalSkipThreshold;
+
+    state->subpixel_refinement = config.subpixelRefinement;
+
+    state->use_opencl = config.openclBackend;
+
+    // benchmarks time the whole search, however long it takes
+    state->deadline_us = 0;
+
+    state->census_matching = config.censusMatching;
+    state->census_threshold = config.censusThreshold;
+
+    state->num_disparities = min((int)config.disparities.size(), MAX_DISPARITIES);
+
+    for (int i = 0; i < state->num_disparities; i++) {
+        state->disparities[i] = config.disparities[i];
+    }
+}
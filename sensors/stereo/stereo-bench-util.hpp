@@ -0,0 +1,39 @@
+/**
+ * Loading recorded frames and setting up the stereo state from a config
+ * file, shared by the stereo benchmarks (pushbroom-stereo-bench,
+ * pushbroom-stereo-regression and bm-stereo's stereo-compare-bench).
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#ifndef STEREO_BENCH_UTIL_HPP
+#define STEREO_BENCH_UTIL_HPP
+
+#include <cv.h>
+#include <highgui.h>
+
+#include "opencv2/opencv.hpp"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <sstream>
+
+#include "boost/format.hpp"
+
+#include "opencv-stereo-util.hpp"
+#include "pushbroom-stereo.hpp"
+
+using namespace std;
+using namespace cv;
+
+cv::vector<int> ParseIntList(string list);
+
+bool LoadFrame(string left_dir, string right_dir, int file_number, Mat *left, Mat *right);
+
+int LoadFrames(string left_dir, string right_dir, int max_frames, cv::vector<Mat> *left_frames, cv::vector<Mat> *right_frames);
+
+void SetupState(const OpenCvStereoConfig &config, const OpenCvStereoCalibration &calibration, PushbroomStereoState *state);
+
+#endif
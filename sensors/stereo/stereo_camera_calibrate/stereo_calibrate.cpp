@@ -40,17 +40,206 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <sys/stat.h>
 
 #include <iostream>
 
 #include "opencv2/opencv.hpp"
 
+#include "../CalibrationBlob.hpp"
+
 using namespace std;
 using namespace cv;
 
 // global flags for camera calibration
 bool calibrateOnlyLeft = false;
 bool calibrateOnlyRight = false;
+bool showWindows = true;
+
+// where detected corners are kept between runs ("" to not cache)
+string cornerCacheDir = "corner-cache";
+
+// chessboard corners found in one image
+struct CornerResult
+{
+    bool loaded;
+    bool cached;
+    int result;
+    int count;
+    CvSize size;
+    vector<CvPoint2D32f> corners;
+};
+
+//
+// 64-bit FNV-1a hash of a file's contents, as hex, so that the corner
+// cache notices when an image is replaced by one with the same name.
+// Returns "" if the file can't be read.
+//
+static string HashFile(const string &filename)
+{
+    FILE *in = fopen(filename.c_str(), "rb");
+
+    if (in == NULL)
+        return "";
+
+    uint64_t hash = 14695981039346656037ULL;
+    unsigned char buffer[65536];
+    size_t length;
+
+    while ((length = fread(buffer, 1, sizeof(buffer), in)) > 0)
+    {
+        for (size_t b = 0; b < length; b++)
+        {
+            hash ^= buffer[b];
+            hash *= 1099511628211ULL;
+        }
+    }
+
+    fclose(in);
+
+    char hex[17];
+    sprintf(hex, "%016llx", (unsigned long long)hash);
+
+    return hex;
+}
+
+//
+// Finds (and refines) the chessboard corners in one image, or reads them
+// from the cache if this image has been seen before with the same board.
+// Runs on many images at once, so it only touches its own result.
+//
+static void FindCorners(const string &filename, int nx, int ny, int maxScale, CornerResult *out)
+{
+    int n = nx*ny;
+
+    out->loaded = false;
+    out->cached = false;
+    out->result = 0;
+    out->count = 0;
+    out->corners.assign(n, cvPoint2D32f(0,0));
+
+    string cacheFile = "";
+
+    if (cornerCacheDir.length() > 0)
+    {
+        string hash = HashFile(filename);
+
+        if (hash.length() > 0)
+        {
+            char suffix[64];
+            sprintf(suffix, "-%dx%d.yml", nx, ny);
+            cacheFile = cornerCacheDir + "/" + hash + suffix;
+        }
+    }
+
+    if (cacheFile.length() > 0)
+    {
+        FileStorage fs(cacheFile, FileStorage::READ);
+
+        if (fs.isOpened())
+        {
+            Mat cornerMat;
+
+            fs["found"] >> out->result;
+            fs["count"] >> out->count;
+            fs["width"] >> out->size.width;
+            fs["height"] >> out->size.height;
+            fs["corners"] >> cornerMat;
+
+            if (cornerMat.type() == CV_32FC2 && (int)cornerMat.total() == n)
+            {
+                for (int j = 0; j < n; j++)
+                {
+                    Point2f p = cornerMat.at<Point2f>(j);
+                    out->corners[j] = cvPoint2D32f(p.x, p.y);
+                }
+
+                out->loaded = true;
+                out->cached = true;
+                return;
+            }
+        }
+    }
+
+    IplImage* img = cvLoadImage( filename.c_str(), 0 );
+    if( !img )
+        return;
+
+    out->loaded = true;
+    out->size = cvGetSize(img);
+
+    vector<CvPoint2D32f> &temp = out->corners;
+    int count = 0, result = 0;
+
+    for( int s = 1; s <= maxScale; s++ )
+    {
+        IplImage* timg = img;
+        if( s > 1 )
+        {
+            timg = cvCreateImage(cvSize(img->width*s,img->height*s),
+                img->depth, img->nChannels );
+            cvResize( img, timg, CV_INTER_CUBIC );
+        }
+        result = cvFindChessboardCorners( timg, cvSize(nx, ny),
+            &temp[0], &count,
+            CV_CALIB_CB_ADAPTIVE_THRESH |
+            CV_CALIB_CB_NORMALIZE_IMAGE);
+        if( timg != img )
+            cvReleaseImage( &timg );
+        if( result || s == maxScale )
+            for( int j = 0; j < count; j++ )
+        {
+            temp[j].x /= s;
+            temp[j].y /= s;
+        }
+        if( result )
+            break;
+    }
+
+    if( result )
+    {
+     //Calibration will suffer without subpixel interpolation
+        cvFindCornerSubPix( img, &temp[0], count,
+            cvSize(11, 11), cvSize(-1,-1),
+            cvTermCriteria(CV_TERMCRIT_ITER+CV_TERMCRIT_EPS,
+            30, 0.01) );
+    }
+    cvReleaseImage( &img );
+
+    out->result = result;
+    out->count = count;
+
+    if (cacheFile.length() > 0)
+    {
+        Mat cornerMat(n, 1, CV_32FC2);
+
+        for (int j = 0; j < n; j++)
+            cornerMat.at<Point2f>(j) = Point2f(temp[j].x, temp[j].y);
+
+        // write and rename, so another thread (or a crash) never leaves
+        // half a file behind
+        char tmpSuffix[64];
+        sprintf(tmpSuffix, ".%p.tmp", (void*)out);
+        string tmpFile = cacheFile + tmpSuffix;
+
+        {
+            FileStorage fs(tmpFile, FileStorage::WRITE);
+
+            if (fs.isOpened())
+            {
+                fs << "found" << result;
+                fs << "count" << count;
+                fs << "width" << out->size.width;
+                fs << "height" << out->size.height;
+                fs << "corners" << cornerMat;
+            }
+        }
+
+        if (rename(tmpFile.c_str(), cacheFile.c_str()) != 0)
+            remove(tmpFile.c_str());
+    }
+}
 
 //
 // Given a list of chessboard images, the number of corners (nx, ny)
@@ -62,7 +251,7 @@ bool calibrateOnlyRight = false;
 static void
 StereoCalib(const char* imageList, int nx, int ny, int useUncalibrated, float _squareSize)
 {
-    int displayCorners = 1;
+    int displayCorners = showWindows ? 1 : 0;
     int showUndistorted = 1;
     bool isVerticalStereo = false;//OpenCV can handle left-right
                                       //or up-down camera arrangements
@@ -153,12 +342,14 @@ StereoCalib(const char* imageList, int nx, int ny, int useUncalibrated, float _s
         fprintf(stderr, "can not open file %s\n", imageList );
         return;
     }
-    
+
+    vector<string> listNames;
+    vector<int> listSides;
+
     for(i=0;;i++)
     {
         char buf[1024];
-        int count = 0, result=0;
-        
+
         if (calibrateOnlyLeft == true)
         {
             lr = 0;
@@ -168,7 +359,6 @@ StereoCalib(const char* imageList, int nx, int ny, int useUncalibrated, float _s
         } else {
             lr = i % 2;
         }
-        vector<CvPoint2D32f>& pts = points[lr];
         if( !fgets( buf, sizeof(buf)-3, f ))
             break;
         size_t len = strlen(buf);
@@ -176,47 +366,59 @@ StereoCalib(const char* imageList, int nx, int ny, int useUncalibrated, float _s
             buf[--len] = '\0';
         if( buf[0] == '#')
             continue;
-        IplImage* img = cvLoadImage( buf, 0 );
-        if( !img )
-            break;
-        imageSize = cvGetSize(img);
-        imageNames[lr].push_back(buf);
-        
-        
-    //FIND CHESSBOARDS AND CORNERS THEREIN:
-        for( int s = 1; s <= maxScale; s++ )
+        listNames.push_back(buf);
+        listSides.push_back(lr);
+    }
+    fclose(f);
+
+//FIND CHESSBOARDS AND CORNERS THEREIN, all of the images at once
+    int numImages = listNames.size();
+    vector<CornerResult> corners(numImages);
+
+    #pragma omp parallel for schedule(dynamic)
+    for( int k = 0; k < numImages; k++ )
+    {
+        FindCorners(listNames[k], nx, ny, maxScale, &corners[k]);
+    }
+
+    // like before, the list ends at the first image that can't be read
+    for( int k = 0; k < numImages; k++ )
+    {
+        if( !corners[k].loaded )
         {
-            IplImage* timg = img;
-            if( s > 1 )
-            {
-                timg = cvCreateImage(cvSize(img->width*s,img->height*s),
-                    img->depth, img->nChannels );
-                cvResize( img, timg, CV_INTER_CUBIC );
-            }
-            result = cvFindChessboardCorners( timg, cvSize(nx, ny),
-                &temp[0], &count,
-                CV_CALIB_CB_ADAPTIVE_THRESH |
-                CV_CALIB_CB_NORMALIZE_IMAGE);
-            if( timg != img )
-                cvReleaseImage( &timg );
-            if( result || s == maxScale )
-                for( j = 0; j < count; j++ )
-            {
-                temp[j].x /= s;
-                temp[j].y /= s;
-            }
-            if( result )
-                break;
+            numImages = k;
+            break;
         }
+    }
+
+    int numCached = 0;
+
+    for( int k = 0; k < numImages; k++ )
+    {
+        const char *buf = listNames[k].c_str();
+        lr = listSides[k];
+        int result = corners[k].result;
+        int count = corners[k].count;
+        vector<CvPoint2D32f>& pts = points[lr];
+
+        copy( corners[k].corners.begin(), corners[k].corners.end(), temp.begin() );
+        imageSize = corners[k].size;
+        imageNames[lr].push_back(buf);
+
+        if( corners[k].cached )
+            numCached ++;
+
         if( displayCorners )
         {
             printf("%s\n", buf);
+            IplImage* img = cvLoadImage( buf, 0 );
             IplImage* cimg = cvCreateImage( imageSize, 8, 3 );
             cvCvtColor( img, cimg, CV_GRAY2BGR );
             cvDrawChessboardCorners( cimg, cvSize(nx, ny), &temp[0],
                 count, result );
             cvShowImage( "corners", cimg );
             cvReleaseImage( &cimg );
+            cvReleaseImage( &img );
             if( cvWaitKey(0) == 27 ) //Allow ESC to quit
                 exit(-1);
         }
@@ -228,18 +430,11 @@ StereoCalib(const char* imageList, int nx, int ny, int useUncalibrated, float _s
     //assert( result != 0 );
         if( result )
         {
-         //Calibration will suffer without subpixel interpolation
-            cvFindCornerSubPix( img, &temp[0], count,
-                cvSize(11, 11), cvSize(-1,-1),
-                cvTermCriteria(CV_TERMCRIT_ITER+CV_TERMCRIT_EPS,
-                30, 0.01) );
             copy( temp.begin(), temp.end(), pts.begin() + N );
         }
-        cvReleaseImage( &img );
-        
     }
-    fclose(f);
     printf("\n");
+    printf("%d images, %d corner sets from the cache.\n", numImages, numCached);
 // HARVEST CHESSBOARD 3D OBJECT POINT LIST:
     if (calibrateOnlyRight == true)
     {
@@ -266,7 +461,8 @@ StereoCalib(const char* imageList, int nx, int ny, int useUncalibrated, float _s
     //cvZero(&_D1);
     //cvZero(&_D2);
     
-    cvNamedWindow( "rect", 1 );
+    if( showWindows )
+        cvNamedWindow( "rect", 1 );
     
     
 // CALIBRATE THE STEREO CAMERAS
@@ -440,6 +636,36 @@ StereoCalib(const char* imageList, int nx, int ny, int useUncalibrated, float _s
                 cvSave("my1.xml",my1);
                 cvSave("mx2.xml",mx2);
                 cvSave("my2.xml",my2);
+
+                // and the same maps in the fixed point format that the
+                // stereo code remaps with, so it doesn't have to convert
+                // them every time it starts up (see LoadCalibration)
+                Mat mx1fp, mx2fp, empty1, empty2;
+                convertMaps(Mat(mx1), Mat(my1), mx1fp, empty1, CV_16SC2, true);
+                convertMaps(Mat(mx2), Mat(my2), mx2fp, empty2, CV_16SC2, true);
+
+                CvMat _mx1fp = mx1fp;
+                CvMat _mx2fp = mx2fp;
+                cvSave("mx1fp.xml",&_mx1fp);
+                cvSave("mx2fp.xml",&_mx2fp);
+
+                // everything LoadCalibration needs, ready to use, with a
+                // hash of the XML files just written so it can tell if
+                // they've changed since
+                const char* blobNames[] = { "Q", "M1", "D1", "R1", "P1", "M2", "D2", "R2", "P2",
+                    "mx1fp", "mx2fp", "mx1", "my1", "mx2", "my2" };
+                Mat blobMats[] = { Mat(&_Q), Mat(&_M1), Mat(&_D1), Mat(&_R1), Mat(&_P1),
+                    Mat(&_M2), Mat(&_D2), Mat(&_R2), Mat(&_P2), mx1fp, mx2fp,
+                    Mat(mx1), Mat(my1), Mat(mx2), Mat(my2) };
+                int numBlob = sizeof(blobNames) / sizeof(blobNames[0]);
+
+                if (WriteCalibrationBlob(CALIBRATION_BLOB_FILE, HashCalibrationSources("."),
+                    vector<string>(blobNames, blobNames + numBlob), vector<Mat>(blobMats, blobMats + numBlob)))
+                {
+                    printf("Wrote %s.\n", CALIBRATION_BLOB_FILE);
+                } else {
+                    fprintf(stderr, "Warning: failed to write %s.\n", CALIBRATION_BLOB_FILE);
+                }
                 printf("done.\n");
             }
 
@@ -475,7 +701,8 @@ StereoCalib(const char* imageList, int nx, int ny, int useUncalibrated, float _s
         }
         else
             assert(0);
-        cvNamedWindow( "rectified", 1 );
+        if( showWindows )
+            cvNamedWindow( "rectified", 1 );
 // RECTIFY THE IMAGES AND FIND DISPARITY MAPS
         if( !isVerticalStereo )
             pair = cvCreateMat( imageSize.height, imageSize.width*2,
@@ -493,7 +720,7 @@ StereoCalib(const char* imageList, int nx, int ny, int useUncalibrated, float _s
         BMState->numberOfDisparities=128;
         BMState->textureThreshold=10;
         BMState->uniquenessRatio=15;
-        for( i = 0; i < nframes; i++ )
+        for( i = 0; showWindows && i < nframes; i++ )
         {
             IplImage *img1, *img2;
             
@@ -574,15 +801,41 @@ int main(int argc, char *argv[])
     int nx, ny;
     float squareSize;
     int fail = 0;
+
+    // options can go anywhere; everything else is positional
+    vector<char*> args;
+
+    for (int a = 0; a < argc; a++)
+    {
+        if (strcmp(argv[a], "--no-display") == 0)
+        {
+            showWindows = false;
+        } else if (strcmp(argv[a], "--no-cache") == 0)
+        {
+            cornerCacheDir = "";
+        } else if (strncmp(argv[a], "--cache-dir=", 12) == 0)
+        {
+            cornerCacheDir = argv[a] + 12;
+        } else {
+            args.push_back(argv[a]);
+        }
+    }
+
+    argc = args.size();
+    argv = &args[0];
+
     //Check command line
     if (argc != 5 && argc != 6)
     {
-        fprintf(stderr,"USAGE: %s imageList nx ny squareSize\n",argv[0]);
+        fprintf(stderr,"USAGE: %s [--no-display] [--no-cache] [--cache-dir=DIR] imageList nx ny squareSize\n",argv[0]);
         fprintf(stderr,"\t imageList : Filename of the image list (string). Example : list.txt\n");
         fprintf(stderr,"\t nx : Number of horizontal squares (int > 0). Example : 9\n");
         fprintf(stderr,"\t ny : Number of vertical squares (int > 0). Example : 6\n");
         fprintf(stderr,"\t squareSize : Size of a square (float > 0). Example : 2.5\n");
         fprintf(stderr,"\t (optional) calibrate only a single camera, L for left, R for right. Example : L\n");
+        fprintf(stderr,"\t --no-display : don't show each image's corners and rectification\n");
+        fprintf(stderr,"\t --cache-dir : where to keep detected corners between runs (default: corner-cache)\n");
+        fprintf(stderr,"\t --no-cache : always detect corners\n");
         return 1;
     }
 
@@ -623,6 +876,12 @@ int main(int argc, char *argv[])
 
     if(fail != 0) return 1;
 
+    if (cornerCacheDir.length() > 0)
+    {
+        // fine if it's already there
+        mkdir(cornerCacheDir.c_str(), 0755);
+    }
+
     StereoCalib(argv[1], nx, ny, 0, squareSize);
     return 0;
 }
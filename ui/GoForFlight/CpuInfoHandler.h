@@ -35,6 +35,10 @@ class CpuInfoHandler : public MultiStatusHandler
             }
             std::string text = formatter.str();
 
+            if (msg->throttled) {
+                text += " / Throttled";
+            }
+
             SetText(index, text);
 
             bool status;
@@ -46,7 +50,7 @@ class CpuInfoHandler : public MultiStatusHandler
                     status = true;
                 }
             } else {
-                if (msg->cpu_temp >= MAX_CPU_C_ODROID || msg->cpu_freq < CPU_SPEED_ODROID) {
+                if (msg->cpu_temp >= MAX_CPU_C_ODROID || msg->cpu_freq < CPU_SPEED_ODROID || msg->throttled) {
                     status = false;
                 } else {
                     status = true;
@@ -417,8 +417,13 @@ void GoForFlightFrame::OnAbout(wxCommandEvent& event)
 
 void GoForFlightFrame::OntmrUpdateLcmTrigger(wxTimerEvent& event)
 {
-    while(NonBlockingLcm(&lcm)) {
-        UpdateLabels();
+    // handle everything that's waiting (but give the GUI a turn if it
+    // keeps coming), then draw once.  The handlers just keep track of the
+    // latest status.
+    int64_t start_time = StatusHandler::GetTimestampNow();
+
+    while (NonBlockingLcm(&lcm)
+        && StatusHandler::GetTimestampNow() - start_time < MAX_LCM_HANDLE_USEC) {
     }
 
     UpdateLabels();
@@ -468,7 +473,10 @@ void GoForFlightFrame::UpdateLabels() {
         lblGoForFlight->SetForegroundColour(StatusHandler::GetColour(false));
     }
 
-    Layout();
+    if (StatusHandler::NeedsLayout()) {
+        Layout();
+        StatusHandler::NeedsLayout() = false;
+    }
 
 }
 
@@ -35,6 +35,9 @@
 #include "StateMachineHandler.h"
 #include "RcSwitchHandler.h"
 
+// longest to spend handling LCM messages before redrawing
+#define MAX_LCM_HANDLE_USEC 50000
+
 class GoForFlightFrame: public wxFrame
 {
     public:
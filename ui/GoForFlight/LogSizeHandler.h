@@ -101,8 +101,6 @@ class LogSizeHandler : public MultiStatusHandler
             last_log_size_[index] = msg->log_size;
             last_log_number_[index] = msg->log_number;
 
-            Update();
-
         }
 
         void Update() {
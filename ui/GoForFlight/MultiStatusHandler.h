@@ -46,6 +46,11 @@ class MultiStatusHandler : public StatusHandler {
                 label_text_[i] = "";
             }
 
+            value_text_.resize(NUM_TYPES);
+            for (int i = 0; i < NUM_TYPES; i++) {
+                value_text_[i] = "";
+            }
+
         }
 
         ~MultiStatusHandler() {}
@@ -57,15 +62,6 @@ class MultiStatusHandler : public StatusHandler {
 
         void SetStatus(ComputerType type, bool value, long utime) {
             status_array_[type] = value;
-
-            if (lbl_labels_[type] != NULL) {
-                lbl_labels_[type]->SetForegroundColour(GetColour(value));
-            }
-
-            if (lbl_values_[type] != NULL) {
-                lbl_values_[type]->SetForegroundColour(GetColour(value));
-            }
-
             last_utime_[type] = utime;
         }
 
@@ -77,10 +73,7 @@ class MultiStatusHandler : public StatusHandler {
         void SetText(ComputerType type, std::string text) {
 
             label_text_[type] = text;
-
-            if (lbl_values_[type] != NULL) {
-                lbl_values_[type]->SetLabel(text);
-            }
+            value_text_[type] = text;
         }
 
         void SetTimeout(ComputerType type, bool timeout) {
@@ -88,23 +81,14 @@ class MultiStatusHandler : public StatusHandler {
 
             if (GetStatus(type) == true && timeout_array_[type]) {
 
-                std::string text = label_text_[type] + " (timeout)";
                 SetStatus(type, false, last_utime_[type]);
 
-                if (lbl_values_[type] != NULL) {
-                    lbl_values_[type]->SetLabel(text);
-                }
+                value_text_[type] = label_text_[type] + " (timeout)";
             }
         }
 
         std::string GetText(ComputerType type) {
-            std::string str = "";
-
-            if (lbl_values_[type] != NULL) {
-                str = std::string(lbl_values_[type]->GetLabel());
-            }
-
-            return str;
+            return value_text_[type];
         }
 
         bool GetStatus() {
@@ -125,13 +109,9 @@ class MultiStatusHandler : public StatusHandler {
 
 
             for (int i = 0; i < NUM_TYPES; i++) {
-                if (lbl_labels_[i] != NULL) {
-                    lbl_labels_[i]->SetForegroundColour(GetColour(status_array_[i]));
-                }
-
-                if (lbl_values_[i] != NULL) {
-                    lbl_values_[i]->SetForegroundColour(GetColour(status_array_[i]));
-                }
+                UpdateLabelColour(lbl_labels_[i], GetColour(status_array_[i]));
+                UpdateLabelColour(lbl_values_[i], GetColour(status_array_[i]));
+                UpdateLabelText(lbl_values_[i], value_text_[i]);
             }
 
 
@@ -178,6 +158,9 @@ class MultiStatusHandler : public StatusHandler {
         std::vector<bool> timeout_array_;
         std::vector<std::string> label_text_;
 
+        // what the value label shows: label_text_, maybe with " (timeout)"
+        std::vector<std::string> value_text_;
+
 
 };
 
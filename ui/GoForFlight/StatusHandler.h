@@ -5,6 +5,12 @@
 #include <string.h>
 #include <sys/time.h>
 
+/**
+ * Status of one thing for the checklist.  handleMessage() only updates
+ * the status and strings.  The labels are written in Update(), which the
+ * UI timer calls, and only when what they show has changed, so the GUI's
+ * cost doesn't depend on how many messages arrive.
+ */
 class StatusHandler
 {
     public:
@@ -39,17 +45,35 @@ class StatusHandler
         }
 
         void SetText(std::string text) {
-            if (lbl_to_update_ != NULL) {
-                lbl_to_update_->SetLabel(text);
-            }
+            UpdateLabelText(lbl_to_update_, text);
         }
 
         void SetColour(wxColor color) {
-            if (lbl_to_update_ != NULL) {
-                lbl_to_update_->SetForegroundColour(color);
+            UpdateLabelColour(lbl_to_update_, color);
+        }
+
+        // sets a label's text if it's different.  Changing the text means
+        // the window needs to lay out again (see NeedsLayout()).
+        static void UpdateLabelText(wxStaticText *label, const std::string &text) {
+            if (label != NULL && label->GetLabel() != wxString(text)) {
+                label->SetLabel(text);
+                NeedsLayout() = true;
+            }
+        }
+
+        static void UpdateLabelColour(wxStaticText *label, const wxColor &color) {
+            if (label != NULL && label->GetForegroundColour() != color) {
+                label->SetForegroundColour(color);
+                label->Refresh();
             }
         }
 
+        // true if any label's text changed since it was last reset
+        static bool& NeedsLayout() {
+            static bool needs_layout = true;
+            return needs_layout;
+        }
+
         bool GetStatus() { return status_; }
 
         void SetStatus(bool status, long utime) {
@@ -132,7 +156,7 @@ class StatusHandler
 
         long utime_ = -1;
 
-        wxStaticText *lbl_to_update_;
+        wxStaticText *lbl_to_update_ = NULL;
 
         bool timeout_;
 
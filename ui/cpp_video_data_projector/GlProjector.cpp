@@ -0,0 +1,258 @@
+#include "GlProjector.hpp"
+
+/**
+ * Sets up the projector for an OpenGL window.  The window must already
+ * exist and have been made with CV_WINDOW_OPENGL.
+ *
+ * @param window_name OpenCV window to draw into
+ * @param camera_matrix 3x3 camera matrix (M1 from the calibration)
+ * @param near_plane closest point that is drawn (in the points' units)
+ * @param far_plane farthest point that is drawn
+ */
+GlProjector::GlProjector(const string &window_name, const Mat &camera_matrix, double near_plane, double far_plane) {
+
+    window_name_ = window_name;
+
+    camera_matrix.convertTo(camera_matrix_, CV_64F);
+    near_plane_ = near_plane;
+    far_plane_ = far_plane;
+
+    frame_dirty_ = false;
+
+    texture_ = 0;
+    texture_created_ = false;
+
+    read_back_ = false;
+    read_back_ready_ = false;
+
+    setOpenGlDrawCallback(window_name_, DrawCallback, this);
+}
+
+GlProjector::~GlProjector() {
+    setOpenGlDrawCallback(window_name_, NULL, NULL);
+
+    if (texture_created_) {
+        setOpenGlContext(window_name_);
+        glDeleteTextures(1, &texture_);
+    }
+}
+
+void GlProjector::SetFrame(const Mat &frame) {
+
+    if (frame.cols != frame_.cols || frame.rows != frame_.rows) {
+        BuildProjection(camera_matrix_, frame.cols, frame.rows);
+        resizeWindow(window_name_, frame.cols, frame.rows);
+    }
+
+    frame_ = frame;
+    frame_dirty_ = true;
+}
+
+void GlProjector::AddPoints(const vector<Point3f> &points, Scalar color, float point_size) {
+
+    Layer layer;
+    layer.mode = GL_POINTS;
+    layer.color = color;
+    layer.size = point_size;
+
+    layer.vertices.reserve(3 * points.size());
+
+    for (const Point3f &point : points) {
+        layer.vertices.push_back(point.x);
+        layer.vertices.push_back(point.y);
+        layer.vertices.push_back(point.z);
+    }
+
+    layers_.push_back(layer);
+}
+
+void GlProjector::AddPolyline(const vector<Point3f> &points, Scalar color, float line_width) {
+
+    AddPoints(points, color, line_width);
+
+    layers_.back().mode = GL_LINE_STRIP;
+}
+
+void GlProjector::ClearLayers() {
+    layers_.clear();
+}
+
+void GlProjector::Update() {
+    updateWindow(window_name_);
+}
+
+/**
+ * Gets the last drawing read back with SetReadBack(true).
+ *
+ * @param image (output) BGR image the size of the frame
+ *
+ * @retval true if there was a new drawing since the last call
+ */
+bool GlProjector::TakeReadBack(Mat *image) {
+
+    if (read_back_ready_ != true) {
+        return false;
+    }
+
+    *image = read_back_image_;
+    read_back_image_ = Mat();
+    read_back_ready_ = false;
+
+    return true;
+}
+
+void GlProjector::DrawCallback(void *x) {
+    ((GlProjector*)x)->Draw();
+}
+
+void GlProjector::Draw() {
+
+    if (frame_.empty()) {
+        return;
+    }
+
+    int width = frame_.cols;
+    int height = frame_.rows;
+
+    UploadFrame();
+
+    glViewport(0, 0, width, height);
+    glClearColor(0, 0, 0, 1);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glDisable(GL_DEPTH_TEST);
+
+    // the frame, as a textured quad in pixel coordinates
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glOrtho(0, width, height, 0, -1, 1);
+
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, texture_);
+    glColor3ub(255, 255, 255);
+
+    glBegin(GL_QUADS);
+        glTexCoord2f(0, 0); glVertex2f(0, 0);
+        glTexCoord2f(1, 0); glVertex2f(width, 0);
+        glTexCoord2f(1, 1); glVertex2f(width, height);
+        glTexCoord2f(0, 1); glVertex2f(0, height);
+    glEnd();
+
+    glDisable(GL_TEXTURE_2D);
+
+    // points and lines, projected by the camera matrix.  Each layer is one
+    // draw call no matter how many points it has.
+    glMatrixMode(GL_PROJECTION);
+    glLoadMatrixf(projection_);
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+
+    for (const Layer &layer : layers_) {
+
+        if (layer.vertices.size() == 0) {
+            continue;
+        }
+
+        // colors are BGR, like the rest of OpenCV
+        glColor3ub(layer.color[2], layer.color[1], layer.color[0]);
+
+        if (layer.mode == GL_POINTS) {
+            glPointSize(layer.size);
+        } else {
+            glLineWidth(layer.size);
+        }
+
+        glVertexPointer(3, GL_FLOAT, 0, &layer.vertices[0]);
+        glDrawArrays(layer.mode, 0, layer.vertices.size() / 3);
+    }
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+
+    if (read_back_) {
+        read_back_image_.create(height, width, CV_8UC3);
+
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, width, height, GL_BGR, GL_UNSIGNED_BYTE, read_back_image_.data);
+
+        // OpenGL's rows go bottom up
+        flip(read_back_image_, read_back_image_, 0);
+
+        read_back_ready_ = true;
+    }
+}
+
+void GlProjector::UploadFrame() {
+
+    if (frame_dirty_ != true) {
+        return;
+    }
+
+    if (texture_created_ != true) {
+        glGenTextures(1, &texture_);
+        texture_created_ = true;
+
+        glBindTexture(GL_TEXTURE_2D, texture_);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    Mat bgr;
+
+    if (frame_.channels() == 1) {
+        cvtColor(frame_, bgr, CV_GRAY2BGR);
+    } else {
+        bgr = frame_;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, texture_);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, bgr.step / bgr.elemSize());
+
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, bgr.cols, bgr.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, bgr.data);
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+    frame_dirty_ = false;
+}
+
+/**
+ * Builds a projection that puts a point (in camera coordinates: x right,
+ * y down, z forward) at the pixel the camera matrix would, in OpenGL clip
+ * coordinates, with depth between the near and far planes.
+ */
+void GlProjector::BuildProjection(const Mat &camera_matrix, int width, int height) {
+
+    double fx = camera_matrix.at<double>(0, 0);
+    double fy = camera_matrix.at<double>(1, 1);
+    double cx = camera_matrix.at<double>(0, 2);
+    double cy = camera_matrix.at<double>(1, 2);
+
+    double n = near_plane_;
+    double f = far_plane_;
+
+    for (int i = 0; i < 16; i++) {
+        projection_[i] = 0;
+    }
+
+    // column-major: projection_[column * 4 + row]
+
+    // x_clip = 2 fx / w * x + (2 cx / w - 1) * z
+    projection_[0] = 2 * fx / width;
+    projection_[8] = 2 * cx / width - 1;
+
+    // y_clip = -2 fy / h * y + (1 - 2 cy / h) * z  (image rows go down)
+    projection_[5] = -2 * fy / height;
+    projection_[9] = 1 - 2 * cy / height;
+
+    // z_clip goes from -1 at the near plane to 1 at the far plane
+    projection_[10] = (f + n) / (f - n);
+    projection_[14] = -2 * f * n / (f - n);
+
+    // w_clip = z
+    projection_[11] = 1;
+}
@@ -0,0 +1,85 @@
+#ifndef GL_PROJECTOR_H_
+#define GL_PROJECTOR_H_
+
+/**
+ * Draws a video frame and 3D points / polylines over it with OpenGL, in an
+ * OpenCV window made with CV_WINDOW_OPENGL.  The frame goes up as a texture
+ * and the points go up as one vertex array per layer, projected by the GPU
+ * with a projection matrix built from the camera matrix, so drawing
+ * thousands of points costs about what drawing the frame does.
+ *
+ * Lens distortion isn't applied (projectPoints does apply it), so points
+ * near the edges of the image can be a pixel or two off from the CPU
+ * drawing.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include "opencv2/opencv.hpp"
+
+#include <GL/gl.h>
+
+#include <vector>
+#include <string>
+
+using namespace std;
+using namespace cv;
+
+class GlProjector {
+
+    public:
+        GlProjector(const string &window_name, const Mat &camera_matrix, double near_plane = 0.01, double far_plane = 10000);
+        ~GlProjector();
+
+        void SetFrame(const Mat &frame);
+
+        // layers are drawn in the order they were added, until ClearLayers()
+        void AddPoints(const vector<Point3f> &points, Scalar color, float point_size = 5);
+        void AddPolyline(const vector<Point3f> &points, Scalar color, float line_width = 2);
+        void ClearLayers();
+
+        // asks the window to redraw with what's been set
+        void Update();
+
+        // reads the next drawing back into memory (for recording)
+        void SetReadBack(bool read_back) { read_back_ = read_back; }
+        bool TakeReadBack(Mat *image);
+
+    private:
+        struct Layer {
+            GLenum mode;
+            Scalar color;
+            float size;
+            vector<float> vertices;
+        };
+
+        static void DrawCallback(void *x);
+        void Draw();
+
+        void UploadFrame();
+        void BuildProjection(const Mat &camera_matrix, int width, int height);
+
+        string window_name_;
+
+        Mat camera_matrix_;
+        double near_plane_;
+        double far_plane_;
+
+        // column-major, for glLoadMatrixf
+        GLfloat projection_[16];
+
+        Mat frame_;
+        bool frame_dirty_;
+
+        GLuint texture_;
+        bool texture_created_;
+
+        vector<Layer> layers_;
+
+        bool read_back_;
+        bool read_back_ready_;
+        Mat read_back_image_;
+};
+
+#endif
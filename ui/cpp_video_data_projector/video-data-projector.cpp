@@ -22,6 +22,8 @@
 #include "../../LCM/lcmt_stereo_reprojected.h"
 #include "../../LCM/lcmt_trajectory_number.h"
 #include "../../controllers/cpp_stereo_obstacles/Trajectory.hpp"
+#include "../../externals/ConciseArgs.hpp"
+#include "GlProjector.hpp"
 
 #include <bot_core/bot_core.h>
 #include <bot_param/param_client.h>
@@ -30,6 +32,7 @@
 
 #include "mav_ins_t.h" // from Fixie
 #include "mav_gps_data_t.h" // from Fixie
+#include "../../utils/utils/Clock.hpp"
 
 
 using namespace std;
@@ -58,16 +61,11 @@ Mat camMatL, dMatL, camMatR, dMatR;
 
 char *channelReprojected = NULL;
 
+// OpenGL drawing (NULL when drawing on the CPU)
+GlProjector *glProjector = NULL;
 
-static void usage(void)
-{
-        fprintf(stderr, "usage: video-data-projector video-file stereo-lcm-channel-name trajectory-number-lcm-channel-name [projected-channel]\n");
-        fprintf(stderr, "    video-file: .avi file with video\n");
-        fprintf(stderr, "    stereo-lcm-channel-name : LCM channel to receive stereo matches on\n");
-        fprintf(stderr, "    reprojected channel (optional): if passed, will publish LCM messages with image-based x, y, and depth data.\n");
-        fprintf(stderr, "  example:\n");
-        fprintf(stderr, "    ./video-data-projector videoL-2013-03-27-18-53-43.avi stereo trajectory_number\n");
-}
+// recording (not opened if there's no output file)
+VideoWriter outputVideo;
 
 
 void sighandler(int dum)
@@ -78,6 +76,11 @@ void sighandler(int dum)
     lcmt_trajectory_number_unsubscribe(lcm, trajnum_sub);
     
     lcm_destroy (lcm);
+
+    delete glProjector;
+
+    // finish the video file
+    outputVideo.release();
     
     // let opencv close it's windows
     waitKey(5);
@@ -87,13 +90,6 @@ void sighandler(int dum)
     exit(0);
 }
 
-int64_t getTimestampNow()
-{
-    struct timeval thisTime;
-    gettimeofday(&thisTime, NULL);
-    return (thisTime.tv_sec * 1000000.0) + (float)thisTime.tv_usec + 0.5;
-}
-
 void Get3DPointsFromStereoMsg(const lcmt_stereo *msg, vector<Point3f> *pointsOut)
 {
     for (int i=0; i<msg->number_of_points; i++)
@@ -157,6 +153,22 @@ void Draw3DPointsOnImage(Mat cameraImage, vector<Point3f> *pointsListIn, Scalar
         return;
     }
     
+    if (glProjector != NULL)
+    {
+        // the GPU projects them, so only project on the CPU if someone wants
+        // the pixel locations
+        glProjector->AddPoints(pointsList, color);
+        
+        if (channelReprojected != NULL)
+        {
+            vector<Point2f> imgPointsList;
+            projectPoints(pointsList, Mat::zeros(3, 1, CV_32F), Mat::zeros(3, 1, CV_32F), camMatL, dMatL, imgPointsList);
+            
+            PublishReprojectedPoints(imgPointsList, pointsListIn, cameraImage.cols, cameraImage.rows);
+        }
+        return;
+    }
+    
     vector<Point2f> imgPointsList;
 
     projectPoints(pointsList, Mat::zeros(3, 1, CV_32F), Mat::zeros(3, 1, CV_32F), camMatL, dMatL, imgPointsList);
@@ -218,6 +230,12 @@ void stereo_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_
     Mat thisImg;
     thisImg = fullVideo[msg->frame_number];
     
+    if (glProjector != NULL)
+    {
+        glProjector->ClearLayers();
+        glProjector->SetFrame(thisImg);
+    }
+    
     // project points from 3D to 2D based on our calibration
     vector<Point3f> stereoPoints;
     Get3DPointsFromStereoMsg(msg, &stereoPoints);
@@ -232,15 +250,39 @@ void stereo_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_
         if (lastTrajMsg != NULL)
         {
             Get3DPointsFromTrajMsg(lastTrajMsg, &trajPoints);
+            
+            if (glProjector != NULL && trajPoints.size() > 0)
+            {
+                glProjector->AddPolyline(trajPoints, Scalar(255, 0, 0));
+            }
+            
             Draw3DPointsOnImage(thisImg, &trajPoints, Scalar(255, 0, 0));
         }
     }
 
     trajnumMutex.unlock();
 
-    imshow("Data on video", thisImg);
+    if (glProjector != NULL)
+    {
+        glProjector->Update();
+    } else {
+        imshow("Data on video", thisImg);
+    }
     
     waitKey(5); // must do a waitKey to get GUI events to be called
+    
+    if (outputVideo.isOpened())
+    {
+        Mat drawnImg;
+        
+        if (glProjector == NULL)
+        {
+            outputVideo << thisImg;
+        } else if (glProjector->TakeReadBack(&drawnImg))
+        {
+            outputVideo << drawnImg;
+        }
+    }
 }
 
 void trajnum_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_trajectory_number *msg, void *user)
@@ -252,22 +294,25 @@ void trajnum_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt
 
 int main(int argc,char** argv)
 {
-    char *channelStereo = NULL;
-    char *channelTrajNum = NULL;
-    char *videoFile = NULL;
-    
-    if (argc!=4 && argc!=5) {
-        usage();
-        exit(0);
-    }
-
-    videoFile = argv[1];
-    channelStereo = argv[2];
-    channelTrajNum = argv[3];
-    
-    if (argc == 5)
+    string videoFileStr, channelStereoStr, channelTrajNumStr;
+    string channelReprojectedStr = "";
+    bool useOpenGl = false;
+    string outputFile = "";
+    
+    ConciseArgs parser(argc, argv, "video-file stereo-lcm-channel-name trajectory-number-lcm-channel-name",
+        "example: ./video-data-projector videoL-2013-03-27-18-53-43.avi stereo trajectory_number");
+    parser.add(channelReprojectedStr, "p", "reprojected-channel", "If passed, will publish LCM messages with image-based x, y, and depth data on this channel.");
+    parser.add(useOpenGl, "g", "opengl", "Draw with OpenGL (frame as a texture, points projected on the GPU) instead of with OpenCV on the CPU.");
+    parser.add(outputFile, "o", "output", "Record what is drawn to this .avi file.");
+    parser.parse(videoFileStr, channelStereoStr, channelTrajNumStr);
+    
+    char *videoFile = (char*)videoFileStr.c_str();
+    char *channelStereo = (char*)channelStereoStr.c_str();
+    char *channelTrajNum = (char*)channelTrajNumStr.c_str();
+    
+    if (channelReprojectedStr != "")
     {
-        channelReprojected = argv[4];
+        channelReprojected = (char*)channelReprojectedStr.c_str();
     }
 
     lcm = lcm_create ("udpm://239.255.76.67:7667?ttl=0");
@@ -308,7 +353,13 @@ int main(int argc,char** argv)
     
     cout << "Calibration loaded successfully." << endl;
     
-    namedWindow("Data on video", CV_WINDOW_AUTOSIZE);
+    if (useOpenGl)
+    {
+        namedWindow("Data on video", CV_WINDOW_OPENGL);
+        glProjector = new GlProjector("Data on video", camMatL);
+    } else {
+        namedWindow("Data on video", CV_WINDOW_AUTOSIZE);
+    }
     
     VideoCapture videoFileCap;
     // open the video file
@@ -334,6 +385,23 @@ int main(int argc,char** argv)
             printf("\rFrame: %d/%d -- (%2.1f%%)", framenum, totalFrames, (float)framenum/totalFrames*100);
             fflush(stdout);
         }
+        
+        if (outputFile != "" && fullVideo.size() > 0)
+        {
+            double fps = videoFileCap.get(CV_CAP_PROP_FPS);
+            
+            if (outputVideo.open(outputFile, CV_FOURCC('M', 'J', 'P', 'G'), fps > 0 ? fps : 30, fullVideo[0].size()) != true)
+            {
+                cout << endl << "ERROR: failed to open output video file: " << outputFile << endl;
+                exit(1);
+            }
+            
+            if (glProjector != NULL)
+            {
+                glProjector->SetReadBack(true);
+            }
+        }
+        
         videoLoaded = true;
         cout << endl << "Ready." << endl;
         
@@ -0,0 +1,196 @@
+#include "FramePrefetcher.hpp"
+
+/**
+ * Starts the prefetch thread.
+ *
+ * @param get_filename gives the image file for a frame number
+ * @param min_frame first frame there is an image for
+ * @param max_frame last frame there is an image for
+ * @param prefetch_count frames to decode ahead of the one asked for
+ * @param cache_size most decoded frames to keep (at least prefetch_count
+ *      times two, so turning around doesn't evict what was just played)
+ */
+FramePrefetcher::FramePrefetcher(string (*get_filename)(int), int min_frame, int max_frame, int prefetch_count, int cache_size) {
+
+    get_filename_ = get_filename;
+
+    min_frame_ = min_frame;
+    max_frame_ = max_frame;
+    prefetch_count_ = max(prefetch_count, 0);
+    cache_size_ = max(cache_size, 2 * prefetch_count_ + 1);
+
+    last_frame_ = -1;
+
+    request_frame_ = -1;
+    request_direction_ = 1;
+    request_number_ = 0;
+    shutting_down_ = false;
+
+    num_hits_ = 0;
+    num_misses_ = 0;
+
+    pthread_create(&thread_, NULL, PrefetchThread, this);
+}
+
+FramePrefetcher::~FramePrefetcher() {
+
+    {
+        lock_guard<mutex> lock(cache_mutex_);
+        shutting_down_ = true;
+    }
+
+    cv_request_.notify_one();
+
+    pthread_join(thread_, NULL);
+}
+
+/**
+ * Gets a decoded frame, from the cache if it's there, and starts
+ * prefetching the frames after it in the direction playback is going.
+ *
+ * @param frame_number frame to get
+ *
+ * @retval the image (empty if it couldn't be read)
+ */
+Mat FramePrefetcher::GetFrame(int frame_number) {
+
+    Mat image;
+
+    bool found;
+
+    {
+        lock_guard<mutex> lock(cache_mutex_);
+        found = FindInCache(frame_number, &image);
+    }
+
+    if (found) {
+        num_hits_ ++;
+    } else {
+        num_misses_ ++;
+
+        image = imread(get_filename_(frame_number));
+
+        if (image.empty() != true) {
+            lock_guard<mutex> lock(cache_mutex_);
+
+            // the prefetcher might have just read it too
+            if (cache_.count(frame_number) == 0) {
+                AddToCache(frame_number, image);
+            }
+        }
+    }
+
+    // playing backwards if we went back, otherwise keep the direction we had
+    int direction;
+
+    {
+        lock_guard<mutex> lock(cache_mutex_);
+
+        direction = request_direction_;
+
+        if (last_frame_ >= 0 && frame_number < last_frame_) {
+            direction = -1;
+        } else if (last_frame_ >= 0 && frame_number > last_frame_) {
+            direction = 1;
+        }
+
+        request_frame_ = frame_number;
+        request_direction_ = direction;
+        request_number_ ++;
+    }
+
+    cv_request_.notify_one();
+
+    last_frame_ = frame_number;
+
+    return image;
+}
+
+void* FramePrefetcher::PrefetchThread(void *x) {
+
+    ((FramePrefetcher*)x)->RunPrefetcher();
+
+    return NULL;
+}
+
+void FramePrefetcher::RunPrefetcher() {
+
+    unique_lock<mutex> lock(cache_mutex_);
+
+    long done_request = 0;
+
+    while (true) {
+
+        while (request_number_ == done_request && shutting_down_ != true) {
+            cv_request_.wait(lock);
+        }
+
+        if (shutting_down_) {
+            return;
+        }
+
+        done_request = request_number_;
+
+        for (int i = 1; i <= prefetch_count_; i++) {
+
+            int frame_number = request_frame_ + i * request_direction_;
+
+            if (frame_number < min_frame_ || frame_number > max_frame_) {
+                break;
+            }
+
+            if (cache_.count(frame_number) > 0) {
+                continue;
+            }
+
+            lock.unlock();
+
+            Mat image = imread(get_filename_(frame_number));
+
+            lock.lock();
+
+            if (image.empty() != true && cache_.count(frame_number) == 0) {
+                AddToCache(frame_number, image);
+            }
+
+            if (shutting_down_ || request_number_ != done_request) {
+                // playback moved on, so start from where it is now
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Looks a frame up and marks it most recently used.  Call with
+ * cache_mutex_ held.
+ */
+bool FramePrefetcher::FindInCache(int frame_number, Mat *image) {
+
+    auto it = cache_.find(frame_number);
+
+    if (it == cache_.end()) {
+        return false;
+    }
+
+    lru_.splice(lru_.begin(), lru_, it->second.second);
+
+    *image = it->second.first;
+
+    return true;
+}
+
+/**
+ * Adds a frame as the most recently used one, evicting the least recently
+ * used if the cache is full.  Call with cache_mutex_ held.
+ */
+void FramePrefetcher::AddToCache(int frame_number, Mat image) {
+
+    lru_.push_front(frame_number);
+    cache_[frame_number] = make_pair(image, lru_.begin());
+
+    while (cache_.size() > cache_size_) {
+        cache_.erase(lru_.back());
+        lru_.pop_back();
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef FRAME_PREFETCHER_H_
+#define FRAME_PREFETCHER_H_
+
+/**
+ * Keeps decoded FPGA frames in an LRU cache and decodes the next frames in
+ * the direction playback is going from a background thread, so steady
+ * playback finds its frames already loaded and seeking back and forth over
+ * the same stretch doesn't read anything.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include "opencv2/opencv.hpp"
+#include <cv.h>
+
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <pthread.h>
+
+using namespace std;
+using namespace cv;
+
+class FramePrefetcher {
+
+    public:
+        FramePrefetcher(string (*get_filename)(int), int min_frame, int max_frame, int prefetch_count, int cache_size);
+        ~FramePrefetcher();
+
+        Mat GetFrame(int frame_number);
+
+        // frames found in the cache and frames GetFrame() had to read itself
+        int GetNumHits() { return num_hits_; }
+        int GetNumMisses() { return num_misses_; }
+
+    private:
+        static void* PrefetchThread(void *x);
+        void RunPrefetcher();
+
+        bool FindInCache(int frame_number, Mat *image);
+        void AddToCache(int frame_number, Mat image);
+
+        string (*get_filename_)(int);
+
+        int min_frame_;
+        int max_frame_;
+        int prefetch_count_;
+        size_t cache_size_;
+
+        int last_frame_;
+
+        pthread_t thread_;
+
+        // everything below is under cache_mutex_.  The thread never holds
+        // it while it reads a file.
+        mutex cache_mutex_;
+        condition_variable cv_request_;
+
+        // most recently used at the front
+        list<int> lru_;
+        unordered_map<int, pair<Mat, list<int>::iterator> > cache_;
+
+        // frame to prefetch from and which way (1 or -1).  request_number_
+        // changes with each request, so the thread notices a new one
+        // part way through.
+        int request_frame_;
+        int request_direction_;
+        long request_number_;
+        bool shutting_down_;
+
+        int num_hits_;
+        int num_misses_;
+};
+
+#endif
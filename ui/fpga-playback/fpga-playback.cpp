@@ -12,6 +12,9 @@ using namespace std;
 lcm_t * lcm;
 
 vector<long> frame_table;
+
+// (timestamp, frame) for every frame, sorted by timestamp
+vector<pair<long, int> > frame_table_sorted;
 string fpga_img_path = "";
 string publish_channel = "stereo_image_left";
 long fpga_offset;
@@ -32,6 +35,8 @@ int main(int argc,char** argv) {
 
     string listen_channel = "servo_out";
     string fpga_log_filename = "";
+    int prefetch_count = 30;
+    int cache_size = 240;
 
 
     ConciseArgs parser(argc, argv);
@@ -41,6 +46,8 @@ int main(int argc,char** argv) {
     parser.add(publish_channel, "p", "publish-channel", "Channel to publish images on.");
     parser.add(fpga_delta, "d", "frame-delta", "Frame delta in microseconds. Default 120fps");
     parser.add(frame_offset, "o", "frame-offset", "Offset frames by this amount.");
+    parser.add(prefetch_count, "n", "prefetch", "Frames to load ahead of playback.");
+    parser.add(cache_size, "k", "cache-size", "Decoded frames to keep in memory.");
     parser.parse();
 
 
@@ -62,20 +69,32 @@ int main(int argc,char** argv) {
 
 
 
-    io::CSVReader<2> csv_reader(fpga_log_filename);
-    csv_reader.read_header(io::ignore_extra_column, "frame", "vicon_time_us");
-    int frame;
-    long timestamp;
+    CsvReader csv_reader;
+
+    vector<vector<long> > columns;
+
+    if (csv_reader.Open(fpga_log_filename) != true
+        || csv_reader.ReadColumns({ csv_reader.FindColumn("frame"), csv_reader.FindColumn("vicon_time_us") }, &columns) != true) {
+
+        cerr << "Error: " << csv_reader.GetError() << endl;
+        return -1;
+    }
 
-    while (csv_reader.read_row(frame, timestamp)) {
+    for (int i = 0; i < csv_reader.GetNumRows(); i++) {
         // load this row
 
-        frame_table.insert(frame_table.begin()+frame, timestamp);
+        frame_table.insert(frame_table.begin() + columns[0][i], columns[1][i]);
 
     }
 
     cout << "Done reading CSV file." << endl;
 
+    for (int i = 0; i < (int) frame_table.size(); i++) {
+        frame_table_sorted.push_back(make_pair(frame_table.at(i), i));
+    }
+
+    sort(frame_table_sorted.begin(), frame_table_sorted.end());
+
     // the table is not super-accurate, so figure out a constant
     // timestamp for each frame
 
@@ -92,6 +111,8 @@ int main(int argc,char** argv) {
 
     cout << "img path: " << fpga_img_path << endl;
 
+    FramePrefetcher prefetcher(&GetFpgaImageFilename, frame_offset, frame_table.size() - 1 + frame_offset, prefetch_count, cache_size);
+
     //namedWindow("Input", CV_WINDOW_AUTOSIZE | CV_WINDOW_KEEPRATIO);
 
     bool change_flag = false;
@@ -109,11 +130,12 @@ int main(int argc,char** argv) {
 
             cout << frame_number << " vs " << GetNearestFpgaFrameFromTable(global_timestamp) << endl;
 
-            string filename = GetFpgaImageFilename(frame_number);
+            Mat image = prefetcher.GetFrame(frame_number);
 
-            cout << filename << endl;
-
-            Mat image = imread(filename);
+            if (image.empty()) {
+                cout << "Failed to read " << GetFpgaImageFilename(frame_number) << endl;
+                continue;
+            }
 
             //imshow("Input", image);
 
@@ -170,31 +192,29 @@ int GetNearestFpgaFrame(long timestamp) {
 }
 
 int GetNearestFpgaFrameFromTable(long timestamp) {
-    // a binary search would be more efficient
-
-    long best_diff = -1, this_diff;
-    int best_frame = -1;
-
-    bool first = true;
 
+    if (frame_table_sorted.size() == 0) {
+        return -1;
+    }
 
+    // first frame at or after the timestamp
+    auto after = lower_bound(frame_table_sorted.begin(), frame_table_sorted.end(), make_pair(timestamp, INT_MIN));
 
-    for (int i = 0; i < (int) frame_table.size(); i++) {
-
-        long this_time = frame_table.at(i);
-
-        this_diff = abs(this_time - timestamp);
+    if (after == frame_table_sorted.end()) {
+        return frame_table_sorted.back().second;
+    }
 
-        if (first == true || this_diff < best_diff) {
-            first = false;
+    if (after == frame_table_sorted.begin()) {
+        return after->second;
+    }
 
-            best_diff = this_diff;
-            best_frame = i;
-        }
+    auto before = after - 1;
 
+    if (timestamp - before->first <= after->first - timestamp) {
+        return before->second;
     }
 
-    return best_frame;
+    return after->second;
 }
 
 string GetFpgaImageFilename(int frame_number) {
@@ -21,11 +21,15 @@
 #include <mutex>
 #include <fstream>
 
-// header-only csv parsing library from https://code.google.com/p/fast-cpp-csv-parser/
-#include "csv.h"
+#include "../../utils/CsvReader/CsvReader.hpp"
 
 #include <boost/format.hpp>
 
+#include <algorithm>
+#include <climits>
+
+#include "FramePrefetcher.hpp"
+
 void sighandler(int dum);
 
 void servo_out_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_deltawing_u *msg, void *user);
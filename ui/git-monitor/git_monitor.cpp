@@ -1,6 +1,11 @@
 /*
  * Monitors local git repo and sends LCM messages about it
  *
+ * Sends as soon as the checkout or the last build changes (see
+ * GitMonitor), and otherwise every --heartbeat seconds from what it
+ * already read, so Go For Flight doesn't time it out.  Nothing is run and
+ * nothing is read in between.
+ *
  * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
  *
  */
@@ -9,26 +14,144 @@
 #include "git_monitor.hpp"
 #include "../../externals/ConciseArgs.hpp"
 
-GitMonitor::GitMonitor(lcm::LCM *lcm, std::string git_status_channel) {
+#include <poll.h>
+
+GitMonitor::GitMonitor(lcm::LCM *lcm, std::string git_status_channel, std::string repo_dir) {
     lcm_ = lcm;
     git_status_channel_ = git_status_channel;
+
+    repo_dir_ = repo_dir;
+    git_dir_ = repo_dir + "/.git";
+
+    msg_.timestamp = 0;
+    msg_.sha = "";
+    msg_.sha_last_build = "";
+    msg_.last_build_timestamp = 0;
+
+    ref_wd_ = -1;
+
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (inotify_fd_ < 0) {
+        perror("inotify_init1");
+        exit(1);
+    }
+
+    // HEAD and packed-refs are in .git, lastbuild.txt is in the repo.  Git
+    // writes through a .lock file and renames it, hence IN_MOVED_TO.
+    git_wd_ = inotify_add_watch(inotify_fd_, git_dir_.c_str(), GIT_MONITOR_INOTIFY_MASK);
+    if (git_wd_ < 0) {
+        perror(git_dir_.c_str());
+        exit(1);
+    }
+
+    repo_wd_ = inotify_add_watch(inotify_fd_, repo_dir_.c_str(), GIT_MONITOR_INOTIFY_MASK);
+    if (repo_wd_ < 0) {
+        perror(repo_dir_.c_str());
+        exit(1);
+    }
+
+    ReadStatus();
 }
 
-void GitMonitor::PublishMessage() {
-    std::string sha = ExecuteProcessGetString(GetRealtimeDir() + "/scripts/getCurrentSHA");
+GitMonitor::~GitMonitor() {
+    close(inotify_fd_);
+}
+
+bool GitMonitor::HandleEvents() {
+    char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+
+    bool reread = false;
+
+    std::string ref_name = ref_.substr(ref_.find_last_of("/") + 1);
+
+    while ((length = read(inotify_fd_, buffer, sizeof(buffer))) > 0) {
+        for (char *ptr = buffer; ptr < buffer + length; ) {
+            const struct inotify_event *event = (const struct inotify_event*) ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                // lost events, look at everything
+                reread = true;
+                continue;
+            }
+
+            std::string name = event->len > 0 ? event->name : "";
+
+            // the ref's directory can be .git itself or the repo, so check
+            // each watch's names on their own
+            if ((event->wd == git_wd_ && (name == "HEAD" || name == "packed-refs"))
+                || (event->wd == repo_wd_ && name == "lastbuild.txt")
+                || (event->wd == ref_wd_ && !ref_name.empty() && name == ref_name)) {
+
+                reread = true;
+            }
+        }
+    }
+
+    return reread && ReadStatus();
+}
+
+bool GitMonitor::ReadStatus() {
+    std::string old_sha = msg_.sha;
+    std::string old_sha_last_build = msg_.sha_last_build;
+    int64_t old_last_build_timestamp = msg_.last_build_timestamp;
+
+    msg_.sha = ReadSha();
+    ReadLastBuild();
+
+    return msg_.sha != old_sha || msg_.sha_last_build != old_sha_last_build
+        || msg_.last_build_timestamp != old_last_build_timestamp;
+}
 
-    lcmt::git_status msg;
+std::string GitMonitor::ReadSha() {
+    std::ifstream head_stream(git_dir_ + "/HEAD");
+    std::string head;
+    std::getline(head_stream, head);
 
-    msg.timestamp = GetTimestampNow();
-    sha.erase(std::remove(sha.begin(), sha.end(), '\n'), sha.end());
-    msg.sha = sha;
+    // HEAD is either a SHA (detached) or "ref: refs/heads/<branch>"
+    if (head.compare(0, 5, "ref: ") != 0) {
+        ref_ = "";
+        WatchRefDir("");
+        return head;
+    }
+
+    ref_ = head.substr(5);
+    WatchRefDir(git_dir_ + "/" + ref_.substr(0, ref_.find_last_of("/")));
+
+    std::ifstream ref_stream(git_dir_ + "/" + ref_);
+    if (ref_stream.is_open()) {
+        std::string sha;
+        std::getline(ref_stream, sha);
+        return sha;
+    }
+
+    // not a loose ref (after a gc), look in packed-refs.  Its lines look
+    // like:
+    // 113737bc481244a943bc78cb0d572395b7681a84 refs/heads/master
+    std::ifstream packed_stream(git_dir_ + "/packed-refs");
+    std::string line;
+
+    while (std::getline(packed_stream, line)) {
+        size_t pos = line.find(' ');
+
+        if (pos != std::string::npos && line.substr(pos + 1) == ref_) {
+            return line.substr(0, pos);
+        }
+    }
+
+    // a branch with no commits yet
+    return "";
+}
+
+void GitMonitor::ReadLastBuild() {
+    msg_.sha_last_build = "";
+    msg_.last_build_timestamp = 0;
 
     // get stuff from the last build file
-    std::ifstream last_build_stream(GetRealtimeDir() + "/lastbuild.txt");
+    std::ifstream last_build_stream(repo_dir_ + "/lastbuild.txt");
     if (last_build_stream.is_open() == false) {
-        msg.sha_last_build = "";
-        msg.last_build_timestamp = 0;
-        lcm_->publish(git_status_channel_, &msg);
         return;
     }
 
@@ -42,13 +165,10 @@ void GitMonitor::PublishMessage() {
 
     size_t pos = last_build_string.find_last_of(":");
     if (pos == std::string::npos) {
-        msg.sha_last_build = "";
-        msg.last_build_timestamp = 0;
-        lcm_->publish(git_status_channel_, &msg);
         return;
     }
 
-    msg.sha_last_build = last_build_string.substr(pos+2); // + 2 to remove the space
+    std::string sha_last_build = last_build_string.substr(pos+2); // + 2 to remove the space
 
     // get the timestamp at last build
     std::getline(last_build_stream, last_build_string);
@@ -56,18 +176,44 @@ void GitMonitor::PublishMessage() {
     pos = last_build_string.find_last_of(":");
 
     if (pos == std::string::npos) {
-        msg.sha_last_build = "";
-        msg.last_build_timestamp = 0;
-        lcm_->publish(git_status_channel_, &msg);
         return;
     }
 
     std::string last_build_time_str = last_build_string.substr(pos+2); // + 2 to remove the space
 
-    msg.last_build_timestamp = int64_t(stoi(last_build_time_str)) * 1000000;
+    msg_.sha_last_build = sha_last_build;
+    msg_.last_build_timestamp = int64_t(stoi(last_build_time_str)) * 1000000;
+}
+
+void GitMonitor::WatchRefDir(const std::string &dir) {
+    if (dir == ref_dir_) {
+        return;
+    }
+
+    // a branch in .git or the repo shares that directory's watch, which
+    // has to stay
+    if (ref_wd_ >= 0 && ref_wd_ != git_wd_ && ref_wd_ != repo_wd_) {
+        inotify_rm_watch(inotify_fd_, ref_wd_);
+    }
+
+    ref_dir_ = dir;
+    ref_wd_ = -1;
+
+    if (dir.empty()) {
+        return;
+    }
 
+    ref_wd_ = inotify_add_watch(inotify_fd_, dir.c_str(), GIT_MONITOR_INOTIFY_MASK);
 
-    lcm_->publish(git_status_channel_, &msg);
+    if (ref_wd_ < 0) {
+        fprintf(stderr, "Warning: failed to watch %s: %s\n", dir.c_str(), strerror(errno));
+    }
+}
+
+void GitMonitor::PublishMessage() {
+    msg_.timestamp = GetTimestampNow();
+
+    lcm_->publish(git_status_channel_, &msg_);
 }
 
 
@@ -75,6 +221,8 @@ int main(int argc,char** argv) {
 
     bool ttl_one = false;
     std::string git_status_channel;
+    std::string repo_dir = GetRealtimeDir();
+    double heartbeat = 5;
 
     // use this computers hostname by default
     char hostname[100];
@@ -85,6 +233,8 @@ int main(int argc,char** argv) {
 
     ConciseArgs parser(argc, argv);
     parser.add(ttl_one, "t", "ttl-one", "Pass to set LCM TTL=1");
+    parser.add(repo_dir, "r", "repo-dir", "Git checkout to monitor.");
+    parser.add(heartbeat, "H", "heartbeat", "Seconds between messages when nothing changes.");
     parser.parse();
 
     std::string lcm_url;
@@ -101,21 +251,36 @@ int main(int argc,char** argv) {
         return 1;
     }
 
-    printf("Sending LCM:\n\tGit Status: %s\n", git_status_channel.c_str());
+    printf("Sending LCM:\n\tGit Status: %s\nWatching:\n\t%s\n", git_status_channel.c_str(), repo_dir.c_str());
 
-    GitMonitor monitor(&lcm, git_status_channel);
+    GitMonitor monitor(&lcm, git_status_channel, repo_dir);
 
     // wait for 1 second on start to let Go For Flight start up
     // if they were both started at once to give a little better
     // responsiveness
     sleep(1);
 
+    int64_t heartbeat_period = heartbeat * 1000000.0;
+    int64_t last_publish = GetMonotonicNow() - heartbeat_period;
+
     while (true) {
+        int64_t now = GetMonotonicNow();
+
+        int64_t next_publish = last_publish + heartbeat_period;
+        int timeout_ms = next_publish > now ? (next_publish - now + 999) / 1000 : 0;
+
+        struct pollfd pfd;
+        pfd.fd = monitor.GetFd();
+        pfd.events = POLLIN;
+
+        bool changed = poll(&pfd, 1, timeout_ms) > 0 && monitor.HandleEvents();
 
-        monitor.PublishMessage();
+        now = GetMonotonicNow();
 
-        // wait 5 seconds
-        sleep(5);
+        if (changed || now - last_publish >= heartbeat_period) {
+            monitor.PublishMessage();
+            last_publish = now;
+        }
     }
 
     return 0;
@@ -7,17 +7,66 @@
 #include "../../LCM/lcmt/git_status.hpp"
 #include <fstream>
 
+#include <sys/inotify.h>
+
+#define GIT_MONITOR_INOTIFY_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE)
+
+/**
+ * Reads the checkout's SHA straight out of .git (HEAD, then the branch's
+ * ref file or packed-refs) instead of running git, and watches those files
+ * and lastbuild.txt with inotify so it only rereads them when they change.
+ */
 class GitMonitor {
 
     public:
-        GitMonitor(lcm::LCM *lcm, std::string git_status_channel);
-        void PublishMessage();
+        GitMonitor(lcm::LCM *lcm, std::string git_status_channel, std::string repo_dir);
+        ~GitMonitor();
+
+        int GetFd() const { return inotify_fd_; }
 
+        /**
+         * Reads the events waiting on GetFd() and, if any were for a file
+         * the status comes from, reads the status again.
+         *
+         * @retval true if the status changed
+         */
+        bool HandleEvents();
+
+        /**
+         * Reads HEAD, its ref and lastbuild.txt, and (re)watches the
+         * directory the ref is in, since checking out another branch can
+         * move it.
+         *
+         * @retval true if the status changed
+         */
+        bool ReadStatus();
+
+        // sends the status from the last ReadStatus()
+        void PublishMessage();
 
     private:
+        std::string ReadSha();
+        void ReadLastBuild();
+
+        void WatchRefDir(const std::string &dir);
+
         lcm::LCM *lcm_;
         std::string git_status_channel_;
 
+        std::string repo_dir_;
+        std::string git_dir_;
+
+        // the ref HEAD points at ("refs/heads/master"), empty when detached
+        std::string ref_;
+
+        int inotify_fd_;
+        int git_wd_;
+        int repo_wd_;
+        int ref_wd_;
+        std::string ref_dir_;
+
+        lcmt::git_status msg_;
+
 };
 
 
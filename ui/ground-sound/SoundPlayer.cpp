@@ -0,0 +1,282 @@
+#include "SoundPlayer.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <algorithm>
+
+// samples quieter than this at the ends of a phrase are trimmed off, so
+// phrases strung together sound like one sentence
+#define SILENCE_THRESHOLD 200
+
+// silence left on each end of a trimmed phrase
+#define PHRASE_PAD_MS 30
+
+/**
+ * Opens the sound card and starts the player thread.  Check IsOpen()
+ * before using it.
+ *
+ * @param device ALSA device name ("default", say)
+ * @param sample_rate rate to synthesize phrases at and play them
+ * @param period_ms length of the periods fed to the sound card.  The card
+ *      buffers two of them, so an alert starts within about twice this.
+ */
+SoundPlayer::SoundPlayer(string device, int sample_rate, int period_ms) {
+
+    pcm_ = NULL;
+    sample_rate_ = sample_rate;
+    period_frames_ = 0;
+
+    playing_priority_ = -1;
+    preempt_ = false;
+    shutting_down_ = false;
+
+    num_preempted_ = 0;
+
+    int err = snd_pcm_open(&pcm_, device.c_str(), SND_PCM_STREAM_PLAYBACK, 0);
+    if (err < 0) {
+        fprintf(stderr, "Error: failed to open sound device %s: %s\n", device.c_str(), snd_strerror(err));
+        pcm_ = NULL;
+        return;
+    }
+
+    err = snd_pcm_set_params(pcm_, SND_PCM_FORMAT_S16, SND_PCM_ACCESS_RW_INTERLEAVED,
+        1, sample_rate_, 1, 2 * period_ms * 1000);
+
+    snd_pcm_uframes_t buffer_frames;
+    if (err >= 0) {
+        err = snd_pcm_get_params(pcm_, &buffer_frames, &period_frames_);
+    }
+
+    if (err < 0) {
+        fprintf(stderr, "Error: failed to set up sound device %s: %s\n", device.c_str(), snd_strerror(err));
+        snd_pcm_close(pcm_);
+        pcm_ = NULL;
+        return;
+    }
+
+    pthread_create(&thread_, NULL, PlayThread, this);
+}
+
+SoundPlayer::~SoundPlayer() {
+
+    if (pcm_ == NULL) {
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(alert_mutex_);
+        shutting_down_ = true;
+    }
+
+    pthread_join(thread_, NULL);
+
+    snd_pcm_drop(pcm_);
+    snd_pcm_close(pcm_);
+}
+
+/**
+ * Synthesizes a phrase with festival so it can be played later.  Call
+ * this at startup -- it takes as long as festival does.
+ *
+ * @param name what Play() calls the phrase
+ * @param text what to say (letters, numbers and spaces)
+ *
+ * @retval true if the phrase was synthesized
+ */
+bool SoundPlayer::AddPhrase(string name, string text) {
+
+    vector<int16_t> samples;
+
+    if (Synthesize(text, &samples) != true) {
+        fprintf(stderr, "Warning: failed to synthesize \"%s\".\n", text.c_str());
+        return false;
+    }
+
+    // trim the silence festival leaves at each end, keeping a little
+    int first = 0;
+    int last = int(samples.size()) - 1;
+
+    while (first < last && abs(samples[first]) < SILENCE_THRESHOLD) {
+        first ++;
+    }
+
+    while (last > first && abs(samples[last]) < SILENCE_THRESHOLD) {
+        last --;
+    }
+
+    int pad = sample_rate_ * PHRASE_PAD_MS / 1000;
+
+    first = max(first - pad, 0);
+    last = min(last + pad, int(samples.size()) - 1);
+
+    phrases_[name] = vector<int16_t>(samples.begin() + first, samples.begin() + last + 1);
+
+    return true;
+}
+
+/**
+ * Queues phrases to be said one after the other.  Phrases that were never
+ * added are skipped.
+ *
+ * @param phrase_names phrases to say
+ * @param priority alerts with a higher priority cut this one off, and this
+ *      one cuts off any with a lower priority (at least 0)
+ */
+void SoundPlayer::Play(const vector<string> &phrase_names, int priority) {
+
+    if (pcm_ == NULL) {
+        return;
+    }
+
+    Alert alert;
+    alert.priority = priority;
+
+    for (string name : phrase_names) {
+        auto it = phrases_.find(name);
+
+        if (it != phrases_.end()) {
+            alert.samples.insert(alert.samples.end(), it->second.begin(), it->second.end());
+        }
+    }
+
+    if (alert.samples.empty()) {
+        return;
+    }
+
+    lock_guard<mutex> lock(alert_mutex_);
+
+    if (playing_priority_ >= 0 && priority > playing_priority_) {
+        preempt_ = true;
+        num_preempted_ ++;
+    }
+
+    // a newer alert of the same priority replaces the waiting one
+    for (auto it = waiting_.begin(); it != waiting_.end(); it++) {
+        if (it->priority == priority) {
+            waiting_.erase(it);
+            num_preempted_ ++;
+            break;
+        }
+    }
+
+    auto it = waiting_.begin();
+    while (it != waiting_.end() && it->priority > priority) {
+        it ++;
+    }
+
+    waiting_.insert(it, alert);
+}
+
+/**
+ * Synthesizes text with festival's text2wave.
+ *
+ * @param text what to say
+ * @param samples (output) mono samples at sample_rate_
+ *
+ * @retval true on success
+ */
+bool SoundPlayer::Synthesize(string text, vector<int16_t> *samples) {
+
+    // the text goes through the shell, so keep it to plain words
+    for (char c : text) {
+        if (isalnum((unsigned char)c) == 0 && c != ' ') {
+            return false;
+        }
+    }
+
+    string cmd = "echo \"" + text + "\" | text2wave -otype raw -F " + to_string(sample_rate_);
+
+    FILE *pipe = popen(cmd.c_str(), "r");
+    if (pipe == NULL) {
+        return false;
+    }
+
+    samples->clear();
+
+    int16_t buffer[4096];
+    size_t count;
+
+    while ((count = fread(buffer, sizeof(int16_t), 4096, pipe)) > 0) {
+        samples->insert(samples->end(), buffer, buffer + count);
+    }
+
+    return pclose(pipe) == 0 && samples->empty() == false;
+}
+
+void* SoundPlayer::PlayThread(void *x) {
+    ((SoundPlayer*)x)->RunPlayer();
+    return NULL;
+}
+
+/**
+ * Feeds the sound card one period at a time, silence when there's nothing
+ * to say, so it never has to be restarted for an alert.  Writing blocks
+ * until the card has room, which paces the loop.
+ */
+void SoundPlayer::RunPlayer() {
+
+    vector<int16_t> silence(period_frames_, 0);
+
+    vector<int16_t> current;
+    size_t position = 0;
+    bool playing = false;
+
+    while (true) {
+
+        {
+            lock_guard<mutex> lock(alert_mutex_);
+
+            if (shutting_down_) {
+                break;
+            }
+
+            if (preempt_) {
+                preempt_ = false;
+                playing = false;
+            }
+
+            if (playing == false && waiting_.empty() == false) {
+                current.swap(waiting_.front().samples);
+                playing_priority_ = waiting_.front().priority;
+                waiting_.erase(waiting_.begin());
+
+                position = 0;
+                playing = true;
+            } else if (playing == false) {
+                playing_priority_ = -1;
+            }
+        }
+
+        const int16_t *out = silence.data();
+        snd_pcm_uframes_t frames = period_frames_;
+
+        if (playing) {
+            frames = min(period_frames_, snd_pcm_uframes_t(current.size() - position));
+            out = current.data() + position;
+
+            position += frames;
+            if (position >= current.size()) {
+                playing = false;
+            }
+        }
+
+        while (frames > 0) {
+            snd_pcm_sframes_t written = snd_pcm_writei(pcm_, out, frames);
+
+            if (written < 0) {
+                // recovers from underruns (the card ran dry) and suspends
+                written = snd_pcm_recover(pcm_, written, 1);
+
+                if (written < 0) {
+                    fprintf(stderr, "Error: failed to write to sound device: %s\n", snd_strerror(written));
+                    break;
+                }
+                continue;
+            }
+
+            out += written;
+            frames -= written;
+        }
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef SOUND_PLAYER_H_
+#define SOUND_PLAYER_H_
+
+/**
+ * Plays spoken alerts from phrases synthesized once at startup.  The sound
+ * card stays open and a resident thread feeds it short periods, so an alert
+ * starts within a period or two instead of after a shell and festival have
+ * started up.
+ *
+ * Each alert has a priority.  A higher-priority alert cuts off the one
+ * playing, and a new alert replaces any waiting alert with the same
+ * priority, so stale announcements don't pile up.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <alsa/asoundlib.h>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <pthread.h>
+
+using namespace std;
+
+class SoundPlayer {
+
+    public:
+        SoundPlayer(string device, int sample_rate, int period_ms);
+        ~SoundPlayer();
+
+        bool IsOpen() { return pcm_ != NULL; }
+
+        bool AddPhrase(string name, string text);
+        bool HasPhrase(string name) { return phrases_.count(name) > 0; }
+
+        void Play(const vector<string> &phrase_names, int priority);
+
+        // alerts that were cut off or replaced before they finished
+        int GetNumPreempted() { return num_preempted_; }
+
+    private:
+        struct Alert {
+            vector<int16_t> samples;
+            int priority;
+        };
+
+        static void* PlayThread(void *x);
+        void RunPlayer();
+
+        bool Synthesize(string text, vector<int16_t> *samples);
+
+        snd_pcm_t *pcm_;
+        int sample_rate_;
+        snd_pcm_uframes_t period_frames_;
+
+        // only used from the caller's thread.  The player thread only sees
+        // the copies in waiting_.
+        map<string, vector<int16_t> > phrases_;
+
+        pthread_t thread_;
+
+        // everything below is under alert_mutex_
+        mutex alert_mutex_;
+
+        // waiting alerts, highest priority first
+        vector<Alert> waiting_;
+
+        int playing_priority_;
+        bool preempt_;
+        bool shutting_down_;
+
+        int num_preempted_;
+};
+
+#endif
@@ -7,6 +7,7 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
 
 
 #include "../../LCM/lcmt_stereo_monitor.h"
@@ -14,6 +15,8 @@
 
 #include "../../externals/ConciseArgs.hpp"
 
+#include "SoundPlayer.hpp"
+
 using namespace std;
 
 char *lcm_out = NULL;
@@ -23,6 +26,19 @@ long lastBeepTime = 0;
 
 int last_rec_frame = -1;
 
+SoundPlayer *player;
+
+// recording starting cuts off an altitude call
+#define PRIORITY_ALTITUDE 0
+#define PRIORITY_RECORDING 1
+
+const string ONES[] = { "zero", "one", "two", "three", "four", "five", "six",
+    "seven", "eight", "nine", "ten", "eleven", "twelve", "thirteen",
+    "fourteen", "fifteen", "sixteen", "seventeen", "eighteen", "nineteen" };
+
+const string TENS[] = { "", "", "twenty", "thirty", "forty", "fifty", "sixty",
+    "seventy", "eighty", "ninety" };
+
 lcm_t * lcm;
 mav_pose_t_subscription_t * mav_pose_sub;
 lcmt_stereo_monitor_subscription_t *stereo_monitor_sub;
@@ -35,24 +51,84 @@ void sighandler(int dum)
     mav_pose_t_unsubscribe (lcm, mav_pose_sub);
     lcm_destroy (lcm);
 
+    delete player;
+
 
     printf("done.\n");
     
     exit(0);
 }
 
-void PlaySound(string sound_str)
+/**
+ * Synthesizes everything ground-sound says, so alerts are only strung
+ * together from these while flying.
+ */
+void LoadPhrases()
 {
-    string soundcmd = "echo \"";
-    
-    soundcmd = soundcmd + sound_str;
-    
-    soundcmd = soundcmd + "\" | festival --tts &";
-    
-    // play the sound
-    //cout << soundcmd << endl;
-    system(soundcmd.c_str());
-    
+    for (string word : ONES)
+    {
+        player->AddPhrase(word, word);
+    }
+
+    for (string word : TENS)
+    {
+        if (word.empty() == false)
+        {
+            player->AddPhrase(word, word);
+        }
+    }
+
+    player->AddPhrase("hundred", "hundred");
+    player->AddPhrase("thousand", "thousand");
+    player->AddPhrase("altitude", "altitude");
+    player->AddPhrase("negative", "negative");
+    player->AddPhrase("feet", "feet");
+    player->AddPhrase("recording", "video recording started");
+}
+
+/**
+ * Adds the words for a number to a phrase list ("one hundred twenty three").
+ *
+ * @param number number to say (at least 0)
+ * @param words (output) the words are appended here
+ */
+void NumberWords(int number, vector<string> *words)
+{
+    if (number >= 1000)
+    {
+        NumberWords(number / 1000, words);
+        words->push_back("thousand");
+        number %= 1000;
+
+        if (number == 0)
+        {
+            return;
+        }
+    }
+
+    if (number >= 100)
+    {
+        words->push_back(ONES[number / 100]);
+        words->push_back("hundred");
+        number %= 100;
+
+        if (number == 0)
+        {
+            return;
+        }
+    }
+
+    if (number < 20)
+    {
+        words->push_back(ONES[number]);
+    } else {
+        words->push_back(TENS[number / 10]);
+
+        if (number % 10 != 0)
+        {
+            words->push_back(ONES[number % 10]);
+        }
+    }
 }
 
 void stereo_monitor_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo_monitor *msg, void *user)
@@ -64,7 +140,7 @@ void stereo_monitor_handler(const lcm_recv_buf_t *rbuf, const char* channel, con
         
     } else {
         // recording just started
-        PlaySound("video recording started");
+        player->Play({ "recording" }, PRIORITY_RECORDING);
     }
     
     last_rec_frame = msg->frame_number;
@@ -78,8 +154,6 @@ void pose_handler(const lcm_recv_buf_t *rbuf, const char* channel, const mav_pos
         
     long thisTime = msg->utime;
     
-    string soundcmd = "";
-
     if (lastBeepTime + (long)5000*(long)500 < thisTime)
     {
         // build the altitude command
@@ -88,19 +162,25 @@ void pose_handler(const lcm_recv_buf_t *rbuf, const char* channel, const mav_pos
         double altitudeFt = 3.28084 * msg->pos[2];
         
         
+        vector<string> words;
+
         if (altitudeFt < 0)
         {
-            soundcmd = soundcmd + "altitude negative " + to_string(int(-1*altitudeFt));
+            words.push_back("altitude");
+            words.push_back("negative");
+            NumberWords(int(-1*altitudeFt), &words);
         } else if (altitudeFt < 20)
         {
-            soundcmd = soundcmd + "altitude " + to_string(int(altitudeFt));
+            words.push_back("altitude");
+            NumberWords(int(altitudeFt), &words);
         } else {
-            
-            soundcmd = soundcmd + to_string(int(altitudeFt)) + " feet\"";
+
+            NumberWords(int(altitudeFt), &words);
+            words.push_back("feet");
         }
-        
-        PlaySound(soundcmd);
-        
+
+        player->Play(words, PRIORITY_ALTITUDE);
+
         lastBeepTime = thisTime;
     }    
     
@@ -115,14 +195,31 @@ int main(int argc,char** argv)
     
     string pose_channel_str = "STATE_ESTIMATOR_POSE";
     string stereo_monitor_channel_str = "stereo_monitor";
+    string sound_device_str = "default";
     
     ConciseArgs parser(argc, argv);
     parser.add(pose_channel_str, "p", "pose-channel",
         "LCM channel for state estimate input");
     parser.add(stereo_monitor_channel_str, "m", "stereo-monitor-channel",
         "LCM channel for stereo monitoring messages");
+    parser.add(sound_device_str, "d", "sound-device",
+        "ALSA device to play alerts on");
     parser.parse();
     
+    // 16 kHz is festival's own rate, and 10 ms periods keep alerts
+    // starting within about 20 ms
+    player = new SoundPlayer(sound_device_str, 16000, 10);
+    if (player->IsOpen() != true)
+    {
+        fprintf(stderr, "Failed to open the sound device.  Quitting.\n");
+        return 1;
+    }
+    
+    printf("Synthesizing phrases... ");
+    fflush(stdout);
+    LoadPhrases();
+    printf("done.\n");
+    
     
     lcm = lcm_create ("udpm://239.255.76.67:7667?ttl=0");
     if (!lcm)
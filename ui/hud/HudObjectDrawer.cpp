@@ -1,4 +1,5 @@
 #include "HudObjectDrawer.hpp"
+#include "hud.hpp"
 
 HudObjectDrawer::HudObjectDrawer(const TrajectoryLibrary *trajlib, BotFrames *bot_frames, const OpenCvStereoCalibration *stereo_calibration, bool show_unremapped) {
    trajlib_ = trajlib;
@@ -82,23 +83,65 @@ void HudObjectDrawer::DrawTrajectory(Mat hud_img) {
         rpy[2] = state(5);
 
         //DrawBox(hud_img, xyz, rpy, 0.84, .5, hud_color_);
-        DrawBox(hud_img, xyz, rpy, 0.84*4, 0.5*4, hud_color_);
+        DrawBox(hud_img, xyz, rpy, 0.84*4, 0.5*4, Hud::ColorForDepth(hud_color_, hud_img.depth()));
     }
 }
 
-void HudObjectDrawer::DrawObstacles(Mat hud_img, lcmt_stereo *msg) {
-    for (int i = 0; i < msg->number_of_points; i++) {
-        double xyz[3];
+/**
+ * Brings the obstacles up to date with what the octomap says changed.
+ *
+ * @param msg added and removed voxels
+ */
+void HudObjectDrawer::UpdateObstacles(const lcmt_octomap_delta *msg) {
+    if (msg->reset) {
+        obstacles_.clear();
+
+        for (int i = 0; i < 3; i++) {
+            obstacle_origin_[i] = msg->origin[i];
+        }
+
+        obstacle_voxel_size_ = msg->voxel_size;
+    } else if (obstacle_voxel_size_ == 0) {
+        // haven't seen everything yet, so these changes wouldn't mean much
+        return;
+    }
+
+    for (int i = 0; i < msg->number_removed; i++) {
+        obstacles_.erase(GetObstacleKey(msg->removed_x[i], msg->removed_y[i], msg->removed_z[i]));
+    }
+
+    for (int i = 0; i < msg->number_added; i++) {
+        obstacles_.insert(GetObstacleKey(msg->added_x[i], msg->added_y[i], msg->added_z[i]));
+    }
+}
+
+void HudObjectDrawer::DrawObstacles(Mat hud_img) {
+    BotTrans local_to_body;
+    bot_frames_get_trans(bot_frames_, "local", "body", &local_to_body);
+
+    Scalar obstacle_color = Hud::ColorForDepth(Scalar(0, 0, 1), hud_img.depth());
+
+    for (int64_t key : obstacles_) {
+        int16_t voxel[3] = { (int16_t)(key >> 32), (int16_t)(key >> 16), (int16_t)key };
+
+        double xyz_local[3], xyz[3];
         double rpy[3] = { 0, 0, 0 };
 
-        xyz[0] = msg->x[i];
-        xyz[1] = msg->y[i];
-        xyz[2] = msg->z[i];
+        // center of the voxel
+        for (int i = 0; i < 3; i++) {
+            xyz_local[i] = (obstacle_origin_[i] + voxel[i] + 0.5) * obstacle_voxel_size_;
+        }
+
+        bot_trans_apply_vec(&local_to_body, xyz_local, xyz);
 
-        DrawCube(hud_img, xyz, rpy, 0.25, 0.25, 0.25, Scalar(0, 0, 1));
+        DrawCube(hud_img, xyz, rpy, obstacle_voxel_size_, obstacle_voxel_size_, obstacle_voxel_size_, obstacle_color);
     }
 }
 
+int64_t HudObjectDrawer::GetObstacleKey(int16_t x, int16_t y, int16_t z) {
+    return ((int64_t)(uint16_t)x << 32) | ((int64_t)(uint16_t)y << 16) | (uint16_t)z;
+}
+
 /**
  * Draws a 2D box around the xyz coordinates in  the body frame
  *
@@ -10,6 +10,8 @@
 #include "../../sensors/stereo/opencv-stereo-util.hpp"
 #include "../../utils/utils/RealtimeUtils.hpp"
 #include "../../LCM/mav_pose_t.h"
+#include "../../LCM/lcmt_octomap_delta.h"
+#include <unordered_set>
 
 using namespace cv;
 
@@ -29,7 +31,8 @@ class HudObjectDrawer {
 
         void DrawTrajectory(Mat hud_img);
 
-        void DrawObstacles(Mat hud_img, lcmt_stereo *msg);
+        void UpdateObstacles(const lcmt_octomap_delta *msg);
+        void DrawObstacles(Mat hud_img);
 
         bool GetCurrentU0(Eigen::VectorXd *u0) const;
 
@@ -46,6 +49,8 @@ class HudObjectDrawer {
         std::vector<Point2d> DrawBox(Mat hud_img, double xyz[3], double rpy[3], double width, double height, Scalar color);
         void DrawCube(Mat hud_img, double xyz[3], double rpy[3], double width, double height, double length, Scalar color);
 
+        static int64_t GetObstacleKey(int16_t x, int16_t y, int16_t z);
+
         void InitializeState(const mav_pose_t *msg);
         Eigen::VectorXd GetStateMinusInit(const mav_pose_t *msg);
 
@@ -59,6 +64,12 @@ class HudObjectDrawer {
         Eigen::VectorXd last_state_; // keep so we can do angle unwrapping
         Eigen::Matrix3d Mz_; // rotation matrix that transforms global state into local state by removing yaw
 
+        // obstacle voxels from the octomap, by GetObstacleKey() of their
+        // coordinates relative to obstacle_origin_
+        std::unordered_set<int64_t> obstacles_;
+        int64_t obstacle_origin_[3] = { 0, 0, 0 };
+        double obstacle_voxel_size_ = 0;
+
 };
 
 #endif
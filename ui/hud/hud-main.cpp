@@ -25,10 +25,11 @@ lcmt_deltawing_u_subscription_t *servo_out_sub;
 mav_gps_data_t_subscription_t *mav_gps_data_t_sub;
 bot_core_image_t_subscription_t *stereo_image_left_sub;
 lcmt_stereo_subscription_t *stereo_replay_sub;
-lcmt_stereo_subscription_t *octomap_hud_sub;
+lcmt_octomap_delta_subscription_t *octomap_hud_sub;
 lcmt_stereo_subscription_t *mono_sub;
 lcmt_stereo_subscription_t *stereo_sub;
 lcmt_stereo_with_xy_subscription_t *stereo_xy_sub;
+lcm_subscription_t *stereo_hit_bitmap_sub;
 lcmt_stereo_subscription_t *stereo_bm_sub;
 lcmt_tvlqr_controller_action_subscription_t *tvlqr_action_sub;
 lcmt_debug_subscription_t *state_machine_sub;
@@ -41,9 +42,15 @@ Mat left_image = Mat::zeros(240, 376, CV_8UC1); // global so we can update it in
 ofstream box_file;
 
 mutex stereo_mutex, stereo_bm_mutex, stereo_xy_mutex, ui_box_mutex, stereo_replay_mutex;
-lcmt_stereo *last_stereo_msg, *last_stereo_bm_msg, *last_stereo_replay_msg, *last_octomap_hud_msg = nullptr;
+lcmt_stereo *last_stereo_msg, *last_stereo_bm_msg, *last_stereo_replay_msg;
 lcmt_stereo_with_xy *last_stereo_xy_msg;
 
+// the stereo's hits as image blocks, if it sends them.  Drawn instead of
+// reprojecting last_stereo_msg.
+mutex stereo_hit_bitmap_mutex;
+lcmt::stereo_hit_bitmap last_stereo_hit_bitmap;
+bool has_stereo_hit_bitmap = false;
+
 BotFrames *bot_frames;
 
 bool ui_box = false;
@@ -53,6 +60,13 @@ bool ui_box_done = false;
 bool real_frame_loaded = false;
 bool new_camera_frame = false;
 
+// images from LCM for the decoder thread, and set when it has decoded one
+LatestValueMailbox<CameraImage> camera_image_mailbox;
+atomic<bool> camera_image_decoded(false);
+
+// JPEG camera images are decoded at 1/decode_scale size, then scaled back up
+int decode_scale = 1;
+
 Point2d box_top(-1, -1);
 Point2d box_bottom(-1, -1);
 
@@ -63,9 +77,9 @@ struct HudObjects {
 
 int main(int argc,char** argv) {
 
-    Scalar bm_color(.5, .5, .5);
-    Scalar block_match_color(.8, 0, 0);
-    Scalar block_match_fill_color(1, 1, 1);
+    Scalar bm_color(128, 128, 128);
+    Scalar block_match_color(204, 0, 0);
+    Scalar block_match_fill_color(255, 255, 255);
 
     string config_file = "";
     int move_window_x = -1, move_window_y = -1;
@@ -98,6 +112,7 @@ int main(int argc,char** argv) {
     parser.add(rec_only_vision, "o", "record only on vision frame updates", "Only write new frames to the recording if there is an updated camera image.");
     parser.add(draw_traj_boxes, "t", "draw-traj-boxes", "Draw trajectory boxes.");
     parser.add(traj_boxes_in_manual_mode, "T", "traj-boxes-in-manual-mode", "Draw trajectory boxes even in manual mode.");
+    parser.add(decode_scale, "D", "decode-scale", "Decode JPEG camera images at 1/2, 1/4 or 1/8 size to save CPU (blurrier).");
     parser.parse();
 
     OpenCvStereoConfig stereo_config;
@@ -146,6 +161,11 @@ int main(int argc,char** argv) {
         return 1;
     }
 
+    if (decode_scale != 1 && decode_scale != 2 && decode_scale != 4 && decode_scale != 8) {
+        fprintf(stderr, "Error: decode scale must be 1, 2, 4 or 8.\n");
+        return 1;
+    }
+
     float bm_depth_min = 0, bm_depth_max = 0;
 
     if (depth_crop_bm) {
@@ -246,6 +266,11 @@ int main(int argc,char** argv) {
         stereo_xy_sub = lcmt_stereo_with_xy_subscribe(lcm, stereo_xy_channel, &stereo_xy_handler, NULL);
     }
 
+    char *stereo_hit_bitmap_channel;
+    if (bot_param_get_str(param, "lcm_channels.stereo_hit_bitmap", &stereo_hit_bitmap_channel) >= 0) {
+        stereo_hit_bitmap_sub = lcm_subscribe(lcm, stereo_hit_bitmap_channel, &stereo_hit_bitmap_handler, NULL);
+    }
+
     char *stereo_image_left_channel;
     if (bot_param_get_str(param, "lcm_channels.stereo_image_left", &stereo_image_left_channel) >= 0) {
         stereo_image_left_sub = bot_core_image_t_subscribe(lcm, stereo_image_left_channel, &stereo_image_left_handler, &hud);
@@ -268,7 +293,7 @@ int main(int argc,char** argv) {
 
     char *octomap_hud_channel;
     if (bot_param_get_str(param, "lcm_channels.octomap_hud", &octomap_hud_channel) >= 0) {
-        octomap_hud_sub = lcmt_stereo_subscribe(lcm, octomap_hud_channel, &octomap_hud_handler, &hud);
+        octomap_hud_sub = lcmt_octomap_delta_subscribe(lcm, octomap_hud_channel, &octomap_hud_handler, &hud_objects);
     }
 
     char *log_size_channel;
@@ -285,6 +310,9 @@ int main(int argc,char** argv) {
 
 
 
+    thread decoder_thread(DecoderThread);
+    decoder_thread.detach();
+
     // control-c handler
     signal(SIGINT,sighandler);
 
@@ -308,6 +336,10 @@ int main(int argc,char** argv) {
             change_flag = true;
         }
 
+        if (camera_image_decoded.exchange(false)) {
+            change_flag = true;
+        }
+
         if (change_flag == true || ui_box) {
             change_flag = false;
             real_frame_loaded_and_run = false;
@@ -323,19 +355,18 @@ int main(int argc,char** argv) {
 
             Mat color_img;
 
+            // everything is drawn in 8-bit color, which is a quarter of the
+            // memory of float color and what the recorder wants anyway
             if (gray_img.type() == CV_8UC1) {
                 // convert to color
-                Mat gray_img2;
-                gray_img.convertTo(gray_img2, CV_32FC3, 1/255.0);
+                cvtColor(gray_img, color_img, CV_GRAY2BGR);
 
-
-                cvtColor(gray_img2, color_img, CV_GRAY2BGR);
             } else if (gray_img.type() == CV_8UC3) {
 
-                gray_img.convertTo(color_img, CV_32FC3, 1/255.0);
+                color_img = gray_img;
 
             } else if (gray_img.type() == CV_32FC3) {
-                color_img = gray_img;
+                gray_img.convertTo(color_img, CV_8UC3, 255.0);
 
             } else {
                 cout << "Error: unsupported image type." << endl;
@@ -374,8 +405,26 @@ int main(int argc,char** argv) {
             //octomap_mutex.unlock();
 
             // -- stereo -- //
-            // transform the point from 3D space back onto the image's 2D space
+            // the blocks the stereo says had hits, if it sends them
+            bool drew_hit_bitmap = false;
+
             if (draw_stereo_2d) {
+                vector<Rect> hit_blocks;
+
+                stereo_hit_bitmap_mutex.lock();
+                if (has_stereo_hit_bitmap) {
+                    drew_hit_bitmap = DecodeStereoHitBitmap(last_stereo_hit_bitmap, &hit_blocks);
+                }
+                stereo_hit_bitmap_mutex.unlock();
+
+                for (const Rect &block : hit_blocks) {
+                    rectangle(color_img, block, block_match_color);
+                }
+            }
+
+            // otherwise transform the points from 3D space back onto the
+            // image's 2D space
+            if (draw_stereo_2d && !drew_hit_bitmap) {
                 vector<Point3f> lcm_points;
 
                 stereo_mutex.lock();
@@ -401,7 +450,7 @@ int main(int argc,char** argv) {
                 stereo_replay_mutex.unlock();
 
                 // smaller box
-                Draw3DPointsOnImage(color_img, &lcm_replay_points, stereo_calibration.M1, stereo_calibration.D1, stereo_calibration.R1, Scalar(1, 1, 1), 0, Point2d(-1, -1), Point2d(-1, -1), NULL, 0, 0, 2);
+                Draw3DPointsOnImage(color_img, &lcm_replay_points, stereo_calibration.M1, stereo_calibration.D1, stereo_calibration.R1, Scalar(255, 255, 255), 0, Point2d(-1, -1), Point2d(-1, -1), NULL, 0, 0, 2);
             }
 
             // -- octomap XY -- //
@@ -483,8 +532,13 @@ int main(int argc,char** argv) {
 
             // -- octomap-hud -- //
 
-            if (hud_object_drawer != nullptr && last_octomap_hud_msg != nullptr) {
-                hud_object_drawer->DrawObstacles(remapped_image, last_octomap_hud_msg);
+            if (hud_object_drawer != nullptr) {
+                hud_object_drawer->DrawObstacles(remapped_image);
+            }
+
+            if (record_hud) {
+                // draw straight into the encoder's buffer
+                recording_manager.GetHudFrameBuffer(&hud_image);
             }
 
             hud.DrawHud(remapped_image, hud_image);
@@ -577,11 +631,7 @@ int main(int argc,char** argv) {
                 // take a screen cap
                 printf("\nWriting hud.png...");
 
-                Mat converted_hud, converted_hud2;
-
-                hud_image.convertTo(converted_hud, CV_16U, 65536);
-
-                imwrite("hud.png", converted_hud);
+                imwrite("hud.png", hud_image);
                 printf("\ndone.");
 
                 break;
@@ -670,6 +720,12 @@ void stereo_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_
     stereo_mutex.unlock();
 }
 
+void stereo_hit_bitmap_handler(const lcm_recv_buf_t *rbuf, const char* channel, void *user) {
+    stereo_hit_bitmap_mutex.lock();
+    has_stereo_hit_bitmap = last_stereo_hit_bitmap.decode(rbuf->data, 0, rbuf->data_size) >= 0;
+    stereo_hit_bitmap_mutex.unlock();
+}
+
 void stereo_xy_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo_with_xy *msg, void *user) {
     stereo_xy_mutex.lock();
     if (last_stereo_xy_msg) {
@@ -692,42 +748,109 @@ void stereo_bm_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lc
     stereo_bm_mutex.unlock();
 }
 
+/**
+ * Copies the image out of the LCM buffer for the decoder thread.  Decoding
+ * here would hold up every other message, so this only copies, into
+ * buffers that are reused from frame to frame.
+ */
 void stereo_image_left_handler(const lcm_recv_buf_t *rbuf, const char* channel, const bot_core_image_t *msg, void *user) {
 
-    image_mutex.lock();
+    static CameraImage image;
+
+    image.pixelformat = msg->pixelformat;
+    image.width = msg->width;
+    image.height = msg->height;
+    image.row_stride = msg->row_stride;
+    image.data.assign(msg->data, msg->data + msg->size);
+
+    camera_image_mailbox.Put(image);
+}
 
-    if (msg->pixelformat == 1196444237) { // PIXEL_FORMAT_MJPEG
+/**
+ * Decodes the newest camera image whenever there is one.  Images that come
+ * in while one is being decoded are dropped, except for the newest, so the
+ * HUD never falls behind the camera.
+ */
+void DecoderThread() {
 
-        left_image = Mat::zeros(msg->height, msg->width, CV_8UC1);
+    CameraImage image;
 
-        // decompress JPEG
-        jpeg_decompress_8u_gray(msg->data, msg->size, left_image.data, msg->width, msg->height, left_image.step);
-        //jpeg_decompress_8u_rgb(msg->data, msg->size, left_image.data, msg->width, msg->height, left_image.step);
+    // the decoded frame is swapped with left_image, so these two buffers
+    // are used over and over
+    Mat decoded;
 
-    } else if (msg->pixelformat == 1497715271) { // PIXEL_FORMAT_GRAY
+    while (true) {
+        camera_image_mailbox.Wait(&image);
 
-        Mat temp_image(msg->height, msg->width, CV_8UC1, msg->data);
+        if (DecodeCameraImage(image, &decoded) != true) {
+            continue;
+        }
 
-        temp_image.copyTo(left_image);
+        image_mutex.lock();
 
-    } else if (msg->pixelformat == 859981650) { // PIXEL_FORMAT_RGB
+        swap(left_image, decoded);
 
-        Mat temp_image(msg->height, msg->width, CV_8UC3, msg->data, msg->row_stride);
+        real_frame_loaded = true;
+        new_camera_frame = true;
 
-        cvtColor(temp_image, left_image, CV_RGB2BGR);
+        image_mutex.unlock();
 
-    } else {
-        cerr << "Warning: reading images other than GRAY and JPEG not yet implemented." << endl;
-        return;
+        camera_image_decoded = true;
     }
+}
+
+/**
+ * Decodes a camera image into 8-bit grey or BGR.
+ *
+ * @param image image from LCM
+ * @param decoded (output) decoded image.  Its buffer is reused if it's the
+ *      right size.
+ *
+ * @retval false if the pixel format isn't supported or the image couldn't
+ *      be decoded
+ */
+bool DecodeCameraImage(const CameraImage &image, Mat *decoded) {
+
+    if (image.pixelformat == 1196444237) { // PIXEL_FORMAT_MJPEG
+
+        // only ever called from the decoder thread
+        static jpeg_utils_decompressor_t *decompressor = jpeg_utils_decompressor_new();
+        static Mat scaled;
+
+        if (decode_scale == 1) {
+            decoded->create(image.height, image.width, CV_8UC1);
 
+            return jpeg_utils_decompress_8u_gray(decompressor, image.data.data(), image.data.size(), decoded->data, image.width, image.height, decoded->step, 1) == 0;
+        }
+
+        // decode small in the DCT domain, then scale back up so everything
+        // drawn on top still lines up
+        scaled.create(jpeg_utils_scaled_size(image.height, decode_scale), jpeg_utils_scaled_size(image.width, decode_scale), CV_8UC1);
+
+        if (jpeg_utils_decompress_8u_gray(decompressor, image.data.data(), image.data.size(), scaled.data, image.width, image.height, scaled.step, decode_scale) != 0) {
+            return false;
+        }
+
+        resize(scaled, *decoded, Size(image.width, image.height), 0, 0, INTER_LINEAR);
+
+    } else if (image.pixelformat == 1497715271) { // PIXEL_FORMAT_GRAY
+
+        Mat temp_image(image.height, image.width, CV_8UC1, (void*)image.data.data());
+
+        temp_image.copyTo(*decoded);
 
-    real_frame_loaded = true;
-    new_camera_frame = true;
+    } else if (image.pixelformat == 859981650) { // PIXEL_FORMAT_RGB
 
+        Mat temp_image(image.height, image.width, CV_8UC3, (void*)image.data.data(), image.row_stride);
 
-    image_mutex.unlock();
+        cvtColor(temp_image, *decoded, CV_RGB2BGR);
 
+    } else {
+        cerr << "Warning: reading images other than GRAY and JPEG not yet implemented." << endl;
+        return false;
+    }
+
+    return true;
 }
 
 // for replaying videos, subscribe to the stereo replay channel and set the frame number
@@ -743,8 +866,12 @@ void stereo_replay_handler(const lcm_recv_buf_t *rbuf, const char* channel, cons
 
 }
 
-void octomap_hud_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo *msg, void *user) {
-    last_octomap_hud_msg = lcmt_stereo_copy(msg);
+void octomap_hud_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_octomap_delta *msg, void *user) {
+    HudObjects *hud_objects = (HudObjects*)user;
+
+    if (hud_objects->hud_object_drawer != nullptr) {
+        hud_objects->hud_object_drawer->UpdateObstacles(msg);
+    }
 }
 
 void mono_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo *msg, void *user) {
@@ -849,7 +976,7 @@ void Get2DPointsFromLcmXY(const lcmt_stereo_with_xy *msg, vector<Point> *xy_poin
 
 void Draw2DPointsOnImage(Mat image, const vector<Point> *points) {
     for (Point point : *points) {
-        rectangle(image, Point(point.x-1, point.y-1), Point(point.x+1, point.y+1), Scalar(0, 0, 0.8));
+        rectangle(image, Point(point.x-1, point.y-1), Point(point.x+1, point.y+1), Scalar(0, 0, 204));
     }
 }
 
@@ -14,6 +14,7 @@
 #include "../../LCM/mav_pose_t.h"
 #include "../../LCM/lcmt_debug.h"
 #include "../../LCM/lcmt_log_size.h"
+#include "../../LCM/lcmt_octomap_delta.h"
 
 #include "lcmtypes/bot_core_image_t.h" // from libbot for images over LCM
 #include "lcmtypes/mav_indexed_measurement_t.h" // from pronto
@@ -22,6 +23,7 @@
 #include "../../sensors/stereo/opencv-stereo-util.hpp"
 #include "../../sensors/stereo/RecordingManager.hpp"
 #include "../../utils/ServoConverter/ServoConverter.hpp"
+#include "../../utils/StereoCompact/StereoHitBitmap.hpp"
 
 #include <bot_core/bot_core.h>
 #include <bot_param/param_client.h>
@@ -34,10 +36,22 @@
 
 #include <mutex>
 #include <fstream>
+#include <thread>
+#include <atomic>
 
 #include "../../controllers/TrajectoryLibrary/TrajectoryLibrary.hpp"
 #include "../../utils/utils/RealtimeUtils.hpp"
 
+/**
+ * A camera image as it came over LCM, still compressed if it was.
+ */
+struct CameraImage {
+    int32_t pixelformat;
+    int width, height, row_stride;
+
+    vector<uint8_t> data;
+};
+
 void sighandler(int dum);
 
 // stereo handlers
@@ -46,6 +60,10 @@ void stereo_image_left_handler(const lcm_recv_buf_t *rbuf, const char* channel,
 void stereo_replay_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo *msg, void *user);
 void mono_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo *msg, void *user);
 void stereo_xy_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo_with_xy *msg, void *user);
+void stereo_hit_bitmap_handler(const lcm_recv_buf_t *rbuf, const char* channel, void *user);
+
+void DecoderThread();
+bool DecodeCameraImage(const CameraImage &image, Mat *decoded);
 
 void stereo_bm_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo *msg, void *user);
 
@@ -71,7 +89,7 @@ void AskForFrame(int video_number, int frame_number);
 
 
 void state_machine_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_debug *msg, void *user);
-void octomap_hud_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo *msg, void *user);
+void octomap_hud_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_octomap_delta *msg, void *user);
 void log_size_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_log_size *msg, void *user);
 
 #endif
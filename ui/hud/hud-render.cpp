@@ -0,0 +1,417 @@
+/*
+ * Renders a HUD video offline from a recording and the LCM log of the
+ * flight.  The log is read through once to collect what the HUD shows at
+ * each camera frame (the frames are the messages on the stereo replay
+ * channel), then the frames are rendered in parallel, each worker with its
+ * own Hud and RecordingManager, and written in order.
+ *
+ * Example:
+ *   ./hud-render -c ../../config/plane-odroid-gps1.cfg -l ~/logs/lcmlog-2015-01-14.05 -i ~/videos/2015-01-14
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include "hud-render.hpp"
+
+int main(int argc, char** argv) {
+
+    string config_file = "";
+    string log_file = "";
+    string video_directory = "";
+    int num_threads = thread::hardware_concurrency();
+    int first_frame = 0;
+    int last_frame = -1;
+    int clutter_level = 5;
+    bool draw_stereo = true;
+    bool draw_stereo_replay = true;
+
+    ConciseArgs parser(argc, argv);
+    parser.add(config_file, "c", "config", "Configuration file containing camera GUIDs, etc.", true);
+    parser.add(log_file, "l", "log", "LCM log of the flight.", true);
+    parser.add(video_directory, "i", "video-directory", "Directory to search for the recording in.", true);
+    parser.add(num_threads, "n", "threads", "Frames to render at once (defaults to the number of cores).");
+    parser.add(first_frame, "f", "first-frame", "First frame number to render.");
+    parser.add(last_frame, "e", "last-frame", "Last frame number to render (defaults to the end of the log).");
+    parser.add(clutter_level, "C", "clutter-level", "Sets clutter level for HUD display from 0 (just image) to 5 (full HUD)");
+    parser.add(draw_stereo, "s", "draw-stereo", "Display raw stereo hits.");
+    parser.add(draw_stereo_replay, "S", "draw-stereo-replay", "Display stereo points from the stereo_replay channel.");
+    parser.parse();
+
+    if (clutter_level < 0 || clutter_level > 5) {
+        fprintf(stderr, "Error: clutter level out of bounds.\n");
+        return 1;
+    }
+
+    num_threads = max(num_threads, 1);
+
+    OpenCvStereoConfig stereo_config;
+
+    if (ParseConfigFile(config_file, &stereo_config) != true) {
+        fprintf(stderr, "Failed to parse configuration file, quitting.\n");
+        return 1;
+    }
+
+    OpenCvStereoCalibration stereo_calibration;
+
+    if (LoadCalibration(stereo_config.calibrationDir, &stereo_calibration) != true) {
+        cerr << "Error: failed to read calibration files. Quitting." << endl;
+        return 1;
+    }
+
+    BotParam *param = bot_param_new_from_file(config_file.c_str());
+
+    if (param == NULL) {
+        fprintf(stderr, "Failed to parse configuration file, quitting.\n");
+        return 1;
+    }
+
+    // the log is delivered in-process, so nothing goes out on the network
+    lcm_t *lcm = lcm_create("memq://");
+
+    if (!lcm) {
+        fprintf(stderr, "lcm_create failed.  Quitting.\n");
+        return 1;
+    }
+
+    // -- collect the HUD's state at each frame -- //
+
+    HudRenderFrame state;
+    state.hud.SetClutterLevel(clutter_level);
+    state.video_number = -1;
+    state.frame_number = -1;
+    state.timestamp = 0;
+
+    lcmt_stereo_subscribe(lcm, stereo_config.stereo_replay_channel.c_str(), &stereo_replay_handler, &state);
+
+    char *channel;
+    if (bot_param_get_str(param, "coordinate_frames.body.pose_update_channel", &channel) >= 0) {
+        mav_pose_t_subscribe(lcm, channel, &mav_pose_t_handler, &state);
+    }
+
+    if (bot_param_get_str(param, "lcm_channels.gps", &channel) >= 0) {
+        mav_gps_data_t_subscribe(lcm, channel, &mav_gps_data_t_handler, &state);
+    }
+
+    if (bot_param_get_str(param, "lcm_channels.servo_out", &channel) >= 0) {
+        lcmt_deltawing_u_subscribe(lcm, channel, &servo_out_handler, &state);
+    }
+
+    if (bot_param_get_str(param, "lcm_channels.battery_status", &channel) >= 0) {
+        lcmt_battery_status_subscribe(lcm, channel, &battery_status_handler, &state);
+    }
+
+    if (bot_param_get_str(param, "lcm_channels.stereo", &channel) >= 0) {
+        lcmt_stereo_subscribe(lcm, channel, &stereo_handler, &state);
+    }
+
+    if (bot_param_get_str(param, "lcm_channels.tvlqr_action", &channel) >= 0) {
+        lcmt_tvlqr_controller_action_subscribe(lcm, channel, &tvlqr_action_handler, &state);
+    }
+
+    if (bot_param_get_str(param, "lcm_channels.state_machine_state", &channel) >= 0) {
+        lcmt_debug_subscribe(lcm, channel, &state_machine_handler, &state);
+    }
+
+    if (bot_param_get_str(param, "lcm_channels.log_size_channel", &channel) >= 0) {
+        for (int i = 1; i <= 3; i++) {
+            lcmt_log_size_subscribe(lcm, (string(channel) + to_string(i)).c_str(), &log_size_handler, &state);
+        }
+    }
+
+    // as fast as possible, and every frame gets its messages
+    PlaybackSynchronizer synchronizer(lcm, stereo_config.stereo_replay_channel, 0);
+
+    if (synchronizer.Open(log_file) != true) {
+        return 1;
+    }
+
+    synchronizer.SeekToFrame(first_frame);
+
+    vector<HudRenderFrame> frames;
+
+    while (synchronizer.NextFrame()) {
+        if (last_frame >= 0 && state.frame_number > last_frame) {
+            break;
+        }
+
+        frames.push_back(state);
+    }
+
+    lcm_destroy(lcm);
+
+    if (frames.size() == 0) {
+        fprintf(stderr, "Error: no frames to render.\n");
+        return 1;
+    }
+
+    // -- render -- //
+
+    printf("Rendering %d frames on %d threads...\n", (int)frames.size(), num_threads);
+
+    // each worker renders a whole frame, so OpenCV's own threads would just
+    // compete with them
+    setNumThreads(1);
+
+    HudRenderQueue queue;
+    queue.num_frames = frames.size();
+    queue.next_to_claim = 0;
+    queue.next_to_write = 0;
+    queue.max_ahead = num_threads * RENDER_BATCH * RENDER_BATCHES_AHEAD;
+
+    HudRenderContext context;
+    context.frames = &frames;
+    context.queue = &queue;
+    context.stereo_config = stereo_config;
+    context.stereo_calibration = &stereo_calibration;
+    context.video_directory = video_directory;
+    context.draw_stereo = draw_stereo;
+    context.draw_stereo_replay = draw_stereo_replay;
+
+    vector<thread> workers;
+
+    for (int i = 0; i < num_threads; i++) {
+        workers.push_back(thread(RenderWorker, &context));
+    }
+
+    RecordingManager recording_manager;
+    recording_manager.Init(stereo_config);
+
+    int64_t start_utime = GetTimestampNow();
+
+    for (int i = 0; i < queue.num_frames; i++) {
+        Mat hud_image;
+
+        {
+            unique_lock<mutex> lock(queue.queue_mutex);
+
+            while (queue.rendered.count(i) == 0) {
+                queue.changed.wait(lock);
+            }
+
+            hud_image = queue.rendered[i];
+            queue.rendered.erase(i);
+
+            queue.next_to_write = i + 1;
+        }
+
+        queue.changed.notify_all();
+
+        if (hud_image.empty() != true) {
+            recording_manager.RecFrameHud(hud_image);
+        }
+
+        if (i % 100 == 0) {
+            printf("\rframe %d/%d", i, queue.num_frames);
+            fflush(stdout);
+        }
+    }
+
+    for (thread &worker : workers) {
+        worker.join();
+    }
+
+    double elapsed = (GetTimestampNow() - start_utime) / 1000000.0;
+
+    printf("\rRendered %d frames in %.1f sec (%.1f fps).\n", queue.num_frames, elapsed, queue.num_frames / max(elapsed, 0.001));
+
+    return 0;
+}
+
+/**
+ * Renders batches of frames until there aren't any left.  Frames that fail
+ * to load are handed back empty, so the writer skips them.
+ */
+void RenderWorker(HudRenderContext *context) {
+
+    HudRenderQueue *queue = context->queue;
+
+    RecordingManager recording_manager;
+    recording_manager.Init(context->stereo_config);
+    recording_manager.SetQuietMode(true);
+
+    if (recording_manager.SetPlaybackVideoDirectory(context->video_directory) != true) {
+        cerr << "Error: failed to open " << context->video_directory << endl;
+    }
+
+    Hud hud;
+
+    while (true) {
+        int first, last;
+
+        {
+            unique_lock<mutex> lock(queue->queue_mutex);
+
+            while (queue->next_to_claim < queue->num_frames
+                && queue->next_to_claim >= queue->next_to_write + queue->max_ahead) {
+
+                queue->changed.wait(lock);
+            }
+
+            if (queue->next_to_claim >= queue->num_frames) {
+                return;
+            }
+
+            first = queue->next_to_claim;
+            last = min(first + RENDER_BATCH, queue->num_frames);
+
+            queue->next_to_claim = last;
+        }
+
+        for (int i = first; i < last; i++) {
+            Mat hud_image;
+
+            if (RenderFrame((*context->frames)[i], *context, &recording_manager, &hud, &hud_image) != true) {
+                hud_image = Mat();
+            }
+
+            {
+                lock_guard<mutex> lock(queue->queue_mutex);
+                queue->rendered[i] = hud_image;
+            }
+
+            queue->changed.notify_all();
+        }
+    }
+}
+
+/**
+ * Draws one frame the way hud-main does.
+ *
+ * @param frame frame to draw
+ * @param context settings for drawing
+ * @param recording_manager this thread's RecordingManager, to read the
+ *      camera frame with
+ * @param hud this thread's Hud
+ * @param hud_image set to the frame with the HUD on it
+ *
+ * @retval false if the camera frame couldn't be loaded
+ */
+bool RenderFrame(const HudRenderFrame &frame, const HudRenderContext &context, RecordingManager *recording_manager, Hud *hud, Mat *hud_image) {
+
+    if (frame.video_number < 0) {
+        return false;
+    }
+
+    recording_manager->SetPlaybackVideoNumber(frame.video_number, frame.timestamp);
+    recording_manager->SetPlaybackFrameNumber(frame.frame_number);
+
+    Mat left_image, right_image;
+    recording_manager->GetFrames(left_image, right_image);
+
+    if (left_image.empty()) {
+        return false;
+    }
+
+    Mat color_img;
+
+    if (left_image.type() == CV_8UC1) {
+        cvtColor(left_image, color_img, CV_GRAY2BGR);
+    } else if (left_image.type() == CV_8UC3) {
+        color_img = left_image;
+    } else {
+        left_image.convertTo(color_img, CV_8UC3, 255.0);
+    }
+
+    const OpenCvStereoCalibration &calibration = *context.stereo_calibration;
+
+    if (context.draw_stereo && frame.stereo_points) {
+        vector<Point3f> points = *frame.stereo_points;
+        Draw3DPointsOnImage(color_img, &points, calibration.M1, calibration.D1, calibration.R1, Scalar(204, 0, 0), Scalar(255, 255, 255));
+    }
+
+    if (context.draw_stereo_replay && frame.replay_points) {
+        vector<Point3f> points = *frame.replay_points;
+
+        // smaller box
+        Draw3DPointsOnImage(color_img, &points, calibration.M1, calibration.D1, calibration.R1, Scalar(255, 255, 255), 0, Point2d(-1, -1), Point2d(-1, -1), NULL, 0, 0, 2);
+    }
+
+    Mat remapped_image;
+    remap(color_img, remapped_image, calibration.mx1fp, Mat(), INTER_NEAREST);
+
+    hud->CopyState(frame.hud);
+    hud->DrawHud(remapped_image, *hud_image);
+
+    return true;
+}
+
+// -- handlers, the same as hud-main's, but onto a HudRenderFrame -- //
+
+void stereo_replay_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo *msg, void *user) {
+    HudRenderFrame *state = (HudRenderFrame*)user;
+
+    state->hud.SetFrameNumber(msg->frame_number);
+    state->hud.SetVideoNumber(msg->video_number);
+
+    state->video_number = msg->video_number;
+    state->frame_number = msg->frame_number;
+    state->timestamp = msg->timestamp;
+
+    vector<Point3f> *points = new vector<Point3f>();
+    Get3DPointsFromStereoMsg(msg, points);
+    state->replay_points.reset(points);
+}
+
+void stereo_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo *msg, void *user) {
+    HudRenderFrame *state = (HudRenderFrame*)user;
+
+    vector<Point3f> *points = new vector<Point3f>();
+    Get3DPointsFromStereoMsg(msg, points);
+    state->stereo_points.reset(points);
+}
+
+void battery_status_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_battery_status *msg, void *user) {
+    HudRenderFrame *state = (HudRenderFrame*)user;
+
+    state->hud.SetBatteryVoltage(msg->voltage);
+}
+
+void servo_out_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_deltawing_u *msg, void *user) {
+    HudRenderFrame *state = (HudRenderFrame*)user;
+
+    float throttle_percent = (msg->throttle - THROTTLE_MIN_US) * 100.0f / (THROTTLE_MAX_US - THROTTLE_MIN_US);
+
+    state->hud.SetServoCommands(throttle_percent, (msg->elevonL-1000)/10.0, (msg->elevonR-1000)/10.0);
+    state->hud.SetAutonomous(msg->is_autonomous);
+}
+
+void mav_gps_data_t_handler(const lcm_recv_buf_t *rbuf, const char* channel, const mav_gps_data_t *msg, void *user) {
+    HudRenderFrame *state = (HudRenderFrame*)user;
+
+    state->hud.SetGpsSpeed(msg->speed);
+    state->hud.SetGpsHeading(msg->heading);
+}
+
+void mav_pose_t_handler(const lcm_recv_buf_t *rbuf, const char* channel, const mav_pose_t *msg, void *user) {
+    HudRenderFrame *state = (HudRenderFrame*)user;
+
+    state->hud.SetAltitude(msg->pos[2]);
+    state->hud.SetOrientation(msg->orientation[0], msg->orientation[1], msg->orientation[2], msg->orientation[3]);
+    state->hud.SetAcceleration(msg->accel[0], msg->accel[1], msg->accel[2]);
+    state->hud.SetAirspeed(msg->vel[0]);
+
+    state->hud.SetTimestamp(msg->utime);
+}
+
+void tvlqr_action_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_tvlqr_controller_action *msg, void *user) {
+    HudRenderFrame *state = (HudRenderFrame*)user;
+
+    state->hud.SetTrajectoryNumber(msg->trajectory_number);
+}
+
+void state_machine_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_debug *msg, void *user) {
+    HudRenderFrame *state = (HudRenderFrame*)user;
+
+    state->hud.SetStateMachineState(msg->debug);
+}
+
+void log_size_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_log_size *msg, void *user) {
+    HudRenderFrame *state = (HudRenderFrame*)user;
+
+    // plane number is the last character of the channel name
+    char last_char = channel[strlen(channel)-1];
+
+    state->hud.SetPlaneNumber(last_char - '0');
+    state->hud.SetLogNumber(msg->log_number);
+}
@@ -0,0 +1,115 @@
+/**
+ * Renders HUD videos offline, straight from the recording and the LCM log,
+ * instead of playing the log through hud-main in real time.
+ *
+ * Copyright 2013-2015, Andrew Barry <abarry@csail.mit.edu>
+ *
+ */
+
+#ifndef HUD_RENDER_HPP
+#define HUD_RENDER_HPP
+
+#include "hud.hpp"
+
+#include "../../LCM/lcmt_stereo.h"
+#include "../../LCM/lcmt_battery_status.h"
+#include "../../LCM/lcmt_deltawing_u.h"
+#include "../../LCM/lcmt_tvlqr_controller_action.h"
+#include "../../LCM/mav_gps_data_t.h"
+#include "../../LCM/mav_pose_t.h"
+#include "../../LCM/lcmt_debug.h"
+#include "../../LCM/lcmt_log_size.h"
+
+#include "../../externals/ConciseArgs.hpp"
+#include "../../sensors/stereo/opencv-stereo-util.hpp"
+#include "../../sensors/stereo/RecordingManager.hpp"
+#include "../../sensors/stereo/PlaybackSynchronizer.hpp"
+
+#include <bot_param/param_client.h>
+
+#include "opencv2/opencv.hpp"
+#include <cv.h>
+
+#include <stdio.h>
+
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+
+#include "../../utils/utils/RealtimeUtils.hpp"
+
+#define THROTTLE_MIN_US 1212
+#define THROTTLE_MAX_US 1744
+
+// frames a worker takes at a time.  Consecutive frames, so AVIs don't have
+// to seek for each one.
+#define RENDER_BATCH 16
+
+// how many batches per worker can be rendered ahead of the one being
+// written, so a slow frame doesn't let the rest pile up in memory
+#define RENDER_BATCHES_AHEAD 2
+
+using namespace std;
+using namespace cv;
+
+/**
+ * Everything needed to render one frame: what the HUD showed and the
+ * stereo points.  Points are shared between frames until they change.
+ * While the log is indexed, the LCM handlers keep one of these up to date
+ * and it's copied for each frame.
+ */
+struct HudRenderFrame {
+    Hud hud;
+
+    int video_number;
+    int frame_number;
+    int64_t timestamp; // of the replay message, for finding the video
+
+    shared_ptr<const vector<Point3f> > stereo_points;
+    shared_ptr<const vector<Point3f> > replay_points;
+};
+
+/**
+ * Hands out batches of frames to the workers and collects the rendered
+ * frames so they can be written in order.
+ */
+struct HudRenderQueue {
+    mutex queue_mutex;
+    condition_variable changed;
+
+    int num_frames;
+    int next_to_claim;
+    int next_to_write;
+    int max_ahead;
+
+    map<int, Mat> rendered;
+};
+
+struct HudRenderContext {
+    const vector<HudRenderFrame> *frames;
+    HudRenderQueue *queue;
+
+    OpenCvStereoConfig stereo_config;
+    const OpenCvStereoCalibration *stereo_calibration;
+
+    string video_directory;
+    bool draw_stereo;
+    bool draw_stereo_replay;
+};
+
+void RenderWorker(HudRenderContext *context);
+bool RenderFrame(const HudRenderFrame &frame, const HudRenderContext &context, RecordingManager *recording_manager, Hud *hud, Mat *hud_image);
+
+void stereo_replay_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo *msg, void *user);
+void stereo_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo *msg, void *user);
+void battery_status_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_battery_status *msg, void *user);
+void servo_out_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_deltawing_u *msg, void *user);
+void mav_gps_data_t_handler(const lcm_recv_buf_t *rbuf, const char* channel, const mav_gps_data_t *msg, void *user);
+void mav_pose_t_handler(const lcm_recv_buf_t *rbuf, const char* channel, const mav_pose_t *msg, void *user);
+void tvlqr_action_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_tvlqr_controller_action *msg, void *user);
+void state_machine_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_debug *msg, void *user);
+void log_size_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_log_size *msg, void *user);
+
+#endif
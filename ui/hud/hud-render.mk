@@ -0,0 +1,4 @@
+TARGET = hud-render
+SOURCES = hud-render.cpp hud.cpp ../../sensors/stereo/opencv-stereo-util.cpp ../../sensors/stereo/RecordingManager.cpp ../../sensors/stereo/HardwareVideoWriter.cpp ../../sensors/stereo/PlaybackSynchronizer.cpp ../../utils/LogIndex/LogIndex.cpp ../../externals/jpeg-utils/jpeg-utils.c ../../utils/utils/RealtimeUtils.cpp
+
+include ../../utils/make/flight.mk
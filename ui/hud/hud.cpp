@@ -2,6 +2,7 @@
 
 Hud::Hud(Scalar hud_color) {
     scale_factor_ = 2;
+    hud_color_unit_ = hud_color;
     hud_color_ = hud_color;
     box_line_width_ = 2;
     text_font_ = FONT_HERSHEY_DUPLEX;
@@ -39,6 +40,9 @@ Hud::Hud(Scalar hud_color) {
 /**
  * Draws the HUD (Heads Up Display)
  *
+ * 8-bit images (grey or color) are drawn on in 8-bit color, and float color
+ * images in float color, so the output type follows the input.
+ *
  * @param _input_image image to draw the HUD on
  * @param _output_image image that is returned and contains the HUD
  *
@@ -57,25 +61,32 @@ void Hud::DrawHud(InputArray _input_image, OutputArray _output_image) {
 
     Size output_size = input_image.size()*scale_factor_;
 
-    _output_image.create(output_size, CV_32FC3);
-    hud_img = _output_image.getMat();
+    int output_type = input_image.depth() == CV_8U ? CV_8UC3 : CV_32FC3;
 
     if (input_image.type() == CV_8UC1) {
 
+        // scale while it's one channel, then color it
         Mat gray_img;
-        input_image.copyTo(gray_img);
-
-        Mat gray_img2;
-        gray_img.convertTo(gray_img2, CV_32FC3, 1/255.0);
+        resize(input_image, gray_img, output_size);
 
-        Mat color_img;
-        cvtColor(gray_img2, color_img, CV_GRAY2BGR);
-
-        resize(color_img, hud_img, output_size);
+        cvtColor(gray_img, _output_image, CV_GRAY2BGR);
+        hud_img = _output_image.getMat();
     } else {
+        _output_image.create(output_size, output_type);
+        hud_img = _output_image.getMat();
+
         resize(input_image, hud_img, output_size);
     }
 
+    hud_color_ = ColorForDepth(hud_color_unit_, hud_img.depth());
+
+    // the parts that don't change from frame to frame
+    UpdateStaticLayer(output_size, output_type);
+
+    if (clutter_level_ != 99) {
+        static_layer_.copyTo(hud_img, static_mask_);
+    }
+
     if (clutter_level_ == 99) {
         DrawArtificialHorizon(hud_img);
 
@@ -87,9 +98,6 @@ void Hud::DrawHud(InputArray _input_image, OutputArray _output_image) {
 
             DrawAltitude(hud_img);
             DrawLadder(hud_img, altitude_, false, 20, 4);
-
-            DrawCenterMark(hud_img);
-
         }
 
         if (clutter_level_ > 1) {
@@ -99,7 +107,6 @@ void Hud::DrawHud(InputArray _input_image, OutputArray _output_image) {
             DrawFrameNumber(hud_img);
             DrawBatteryVoltage(hud_img);
             DrawDateTime(hud_img);
-            DrawPlaneAndLogNumbers(hud_img);
         }
 
         if (clutter_level_ > 2) {
@@ -122,18 +129,96 @@ void Hud::DrawHud(InputArray _input_image, OutputArray _output_image) {
 
 }
 
-void Hud::DrawAirspeed(Mat hud_img) {
-    string airspeed_str;
-    if (airspeed_ > -10000) {
-        char airspeed_char[100];
+/**
+ * Takes everything that is drawn (values, clutter level, color, etc.) from
+ * another HUD but keeps this one's static layer, so a HUD that renders
+ * frames whose values were collected elsewhere only redraws the layer when
+ * it has to.
+ *
+ * @param other HUD to copy
+ */
+void Hud::CopyState(const Hud &other) {
+
+    Mat static_layer = static_layer_;
+    Mat static_mask = static_mask_;
+    int static_clutter_level = static_clutter_level_;
+    int static_plane_number = static_plane_number_;
+    int static_log_number = static_log_number_;
+    Scalar static_color_unit = static_color_unit_;
+
+    *this = other;
+
+    static_layer_ = static_layer;
+    static_mask_ = static_mask;
+    static_clutter_level_ = static_clutter_level;
+    static_plane_number_ = static_plane_number;
+    static_log_number_ = static_log_number;
+    static_color_unit_ = static_color_unit;
+}
 
-        sprintf(airspeed_char, "%.0f", airspeed_);
+/**
+ * Draws the elements that only change with the clutter level and the plane
+ * and log numbers.
+ */
+void Hud::DrawStaticElements(Mat hud_img) {
 
-        airspeed_str = airspeed_char;
-    } else {
-        airspeed_str = "---";
+    if (clutter_level_ == 99) {
+        return;
     }
 
+    if (clutter_level_ > 0) {
+        DrawAirspeedBox(hud_img);
+        DrawAltitudeBox(hud_img);
+        DrawCenterMark(hud_img);
+    }
+
+    if (clutter_level_ > 1) {
+        DrawPlaneAndLogNumbers(hud_img);
+    }
+
+    if (clutter_level_ > 2) {
+        DrawThrottleFrame(hud_img);
+    }
+
+    if (clutter_level_ > 3) {
+        DrawAllAccelerationIndicatorFrames(hud_img);
+    }
+}
+
+/**
+ * Redraws the static layer and its mask if anything they're drawn from has
+ * changed.  The mask is the same drawing in white on one channel, so copying
+ * through it is exactly the same as drawing the elements on the frame.
+ */
+void Hud::UpdateStaticLayer(Size size, int type) {
+
+    if (static_layer_.size() == size && static_layer_.type() == type
+        && static_clutter_level_ == clutter_level_
+        && static_plane_number_ == plane_number_
+        && static_log_number_ == log_number_
+        && static_color_unit_ == hud_color_unit_) {
+
+        return;
+    }
+
+    static_layer_ = Mat::zeros(size, type);
+    DrawStaticElements(static_layer_);
+
+    Scalar color = hud_color_;
+
+    static_mask_ = Mat::zeros(size, CV_8UC1);
+    hud_color_ = Scalar::all(255);
+    DrawStaticElements(static_mask_);
+    hud_color_ = color;
+
+    static_clutter_level_ = clutter_level_;
+    static_plane_number_ = plane_number_;
+    static_log_number_ = log_number_;
+    static_color_unit_ = hud_color_unit_;
+}
+
+void Hud::DrawAirspeedBox(Mat hud_img) {
+
     // draw airspeed ladder box
 
     // figure out the coordinates for the top and bottom on the airspeed box
@@ -159,7 +244,26 @@ void Hud::DrawAirspeed(Mat hud_img) {
 
     // draw the bottom of the arrow
     line(hud_img, Point(airspeed_left + airspeed_box_width, airspeed_top + airspeed_box_height), Point(airspeed_left + airspeed_box_width + arrow_width, airspeed_top + airspeed_box_height / 2), hud_color_, box_line_width_);
+}
 
+void Hud::DrawAirspeed(Mat hud_img) {
+    string airspeed_str;
+    if (airspeed_ > -10000) {
+        char airspeed_char[100];
+
+        sprintf(airspeed_char, "%.0f", airspeed_);
+
+        airspeed_str = airspeed_char;
+    } else {
+        airspeed_str = "---";
+    }
+
+    // the box is on the static layer (DrawAirspeedBox)
+    int airspeed_box_height = GetLadderBoxHeight(hud_img);
+    int airspeed_box_width = GetLadderBoxWidth(hud_img);
+
+    int airspeed_top = GetLadderBoxTop(hud_img);
+    int airspeed_left = GetAirspeedLeft(hud_img);
 
     // draw the airspeed numbers on the HUD
 
@@ -194,19 +298,7 @@ void Hud::DrawAirspeed(Mat hud_img) {
     */
 }
 
-void Hud::DrawAltitude(Mat hud_img) {
-
-    // convert into a reasonable string
-    string altitude_str;
-    if (altitude_ > -10000) {
-        char altitude_char[100];
-
-        sprintf(altitude_char, "%.0f", altitude_);
-
-        altitude_str = altitude_char;
-    } else {
-        altitude_str = "---";
-    }
+void Hud::DrawAltitudeBox(Mat hud_img) {
 
     int top = GetLadderBoxTop(hud_img);
 
@@ -232,6 +324,29 @@ void Hud::DrawAltitude(Mat hud_img) {
 
     // draw the bottom of the arrow
     line(hud_img, Point(left - arrow_width, top + height/2), Point(left, top + height), hud_color_, box_line_width_);
+}
+
+void Hud::DrawAltitude(Mat hud_img) {
+
+    // convert into a reasonable string
+    string altitude_str;
+    if (altitude_ > -10000) {
+        char altitude_char[100];
+
+        sprintf(altitude_char, "%.0f", altitude_);
+
+        altitude_str = altitude_char;
+    } else {
+        altitude_str = "---";
+    }
+
+    // the box is on the static layer (DrawAltitudeBox)
+    int top = GetLadderBoxTop(hud_img);
+
+    int left = GetAltitudeLeft(hud_img);
+
+    int width = GetLadderBoxWidth(hud_img);
+    int height = GetLadderBoxHeight(hud_img);
 
     // get the size of the text string
     int baseline = 0;
@@ -897,7 +1012,7 @@ void Hud::DrawCompass(Mat hud_img) {
     //line(hud_img, Point(gps_left, gps_top), Point(gps_mid_left, gps_mid_top), hud_color_, box_line_width_ + 10);
 }
 
-void Hud::DrawAllAccelerationIndicators(Mat hud_img) {
+void Hud::DrawAllAccelerationIndicatorFrames(Mat hud_img) {
 
     int x = 0.83 * hud_img.rows;
     int y = 0.89 * hud_img.rows;
@@ -909,53 +1024,41 @@ void Hud::DrawAllAccelerationIndicators(Mat hud_img) {
     int min_value = -4;
     int mark_increment = 1;
 
-    DrawGraphIndicator(hud_img, left, x, "x", min_value, max_value, mark_increment, "+%.1fG", "-%.1fG", x_accel_, true, true);
-    DrawGraphIndicator(hud_img, left, y, "y", min_value, max_value, mark_increment, "+%.1fG", "-%.1fG", y_accel_, true, true);
-    DrawGraphIndicator(hud_img, left, z, "z", min_value, max_value, mark_increment, "+%.1fG", "-%.1fG", z_accel_, true, true);
+    DrawGraphIndicatorFrame(hud_img, left, x, "x", min_value, max_value, mark_increment);
+    DrawGraphIndicatorFrame(hud_img, left, y, "y", min_value, max_value, mark_increment);
+    DrawGraphIndicatorFrame(hud_img, left, z, "z", min_value, max_value, mark_increment);
 }
 
-void Hud::DrawGraphIndicator(Mat hud_img, int left, int top, string label, int min_value, int max_value, int mark_increment, string plus_format, string minus_format, float value, bool zero_in_center, bool reverse_graph_direction) {
-    // draw graphs for x, y, and z acceleration
+void Hud::DrawAllAccelerationIndicators(Mat hud_img) {
 
+    int x = 0.83 * hud_img.rows;
+    int y = 0.89 * hud_img.rows;
+    int z = 0.95 * hud_img.rows;
 
-    int width = 0.19 * hud_img.cols;
+    int left = 0.05 * hud_img.cols;
 
-    int height = 0.01 * hud_img.cols;
+    int max_value = 4;
+    int min_value = -4;
+
+    DrawGraphIndicator(hud_img, left, x, min_value, max_value, "+%.1fG", "-%.1fG", x_accel_, true, true);
+    DrawGraphIndicator(hud_img, left, y, min_value, max_value, "+%.1fG", "-%.1fG", y_accel_, true, true);
+    DrawGraphIndicator(hud_img, left, z, min_value, max_value, "+%.1fG", "-%.1fG", z_accel_, true, true);
+}
+
+void Hud::DrawGraphIndicator(Mat hud_img, int left, int top, int min_value, int max_value, string plus_format, string minus_format, float value, bool zero_in_center, bool reverse_graph_direction) {
+    // draw the arrow and value on a graph (the rest is in DrawGraphIndicatorFrame)
+
+
+    int width = 0.19 * hud_img.cols;
 
     int line_width = 1;
-    int center_line_height_extra = 2;
     int arrow_width = 10;
     int arrow_gap = 3;
     int arrow_height = 10;
     int text_gap = 10;
 
-    // draw the bottom line of the graph
-    line(hud_img, Point(left, top + height), Point(left + width, top + height), hud_color_, line_width);
-
-    // draw the markers on either end
-    line(hud_img, Point(left, top + height), Point(left, top), hud_color_, line_width);
-
-    line(hud_img, Point(left + width, top + height), Point(left + width, top), hud_color_, line_width);
-
     float value_per_px = width / float(max_value - min_value);
 
-    int extra_line_height;
-
-    // draw little marker lines
-    for (int i = min_value; i <= max_value; i += mark_increment) {
-
-        int delta = max_value - min_value;
-        int this_delta = delta - (i - min_value);
-        int this_location = left + (float)this_delta * value_per_px;
-
-        if (i == 0 || i == min_value || i == max_value) {
-            extra_line_height = center_line_height_extra;
-        } else {
-            extra_line_height = 0;
-        }
-        line(hud_img, Point(this_location, top + height), Point(this_location, top - extra_line_height), hud_color_, line_width);
-    }
-
     // draw the arrow
 
     // figure out where the arrow should be
@@ -1013,12 +1116,6 @@ void Hud::DrawGraphIndicator(Mat hud_img, int left, int top, string label, int m
         line(hud_img, Point(this_location - arrow_width/2, top - arrow_gap - arrow_height), Point(this_location + arrow_width/2, top - arrow_gap - arrow_height), hud_color_, line_width);
     }
 
-    // draw label
-    int baseline = 0;
-    Size text_size = getTextSize(label, text_font_, hud_font_scale_small_, text_thickness_, &baseline);
-
-    PutHudTextSmall(hud_img, label, Point(left - text_gap - text_size.width, top + text_size.height/2 ));
-
     // draw value
     char accel_char[100];
     if (value < 0) {
@@ -1028,8 +1125,8 @@ void Hud::DrawGraphIndicator(Mat hud_img, int left, int top, string label, int m
     }
     string accel_str = accel_char;
 
-    baseline = 0;
-    text_size = getTextSize(accel_str, text_font_, hud_font_scale_small_, text_thickness_, &baseline);
+    int baseline = 0;
+    Size text_size = getTextSize(accel_str, text_font_, hud_font_scale_small_, text_thickness_, &baseline);
 
     PutHudTextSmall(hud_img, accel_str, Point(left + width + text_gap, top + text_size.height/2));
 
@@ -1105,12 +1202,64 @@ void Hud::DrawCenterMark(Mat hud_img) {
 
 }
 
+void Hud::DrawGraphIndicatorFrame(Mat hud_img, int left, int top, string label, int min_value, int max_value, int mark_increment) {
+
+    int width = 0.19 * hud_img.cols;
+
+    int height = 0.01 * hud_img.cols;
+
+    int line_width = 1;
+    int center_line_height_extra = 2;
+    int text_gap = 10;
+
+    // draw the bottom line of the graph
+    line(hud_img, Point(left, top + height), Point(left + width, top + height), hud_color_, line_width);
+
+    // draw the markers on either end
+    line(hud_img, Point(left, top + height), Point(left, top), hud_color_, line_width);
+
+    line(hud_img, Point(left + width, top + height), Point(left + width, top), hud_color_, line_width);
+
+    float value_per_px = width / float(max_value - min_value);
+
+    int extra_line_height;
+
+    // draw little marker lines
+    for (int i = min_value; i <= max_value; i += mark_increment) {
+
+        int delta = max_value - min_value;
+        int this_delta = delta - (i - min_value);
+        int this_location = left + (float)this_delta * value_per_px;
+
+        if (i == 0 || i == min_value || i == max_value) {
+            extra_line_height = center_line_height_extra;
+        } else {
+            extra_line_height = 0;
+        }
+        line(hud_img, Point(this_location, top + height), Point(this_location, top - extra_line_height), hud_color_, line_width);
+    }
+
+    // draw label
+    int baseline = 0;
+    Size text_size = getTextSize(label, text_font_, hud_font_scale_small_, text_thickness_, &baseline);
+
+    PutHudTextSmall(hud_img, label, Point(left - text_gap - text_size.width, top + text_size.height/2 ));
+}
+
+void Hud::DrawThrottleFrame(Mat hud_img) {
+
+    int left = 70;
+    int top = 60;
+
+    DrawGraphIndicatorFrame(hud_img, left, top, "Thr", 0, 100, 25);
+}
+
 void Hud::DrawThrottle(Mat hud_img) {
 
     int left = 70;
     int top = 60;
 
-    DrawGraphIndicator(hud_img, left, top, "Thr", 0, 100, 25, "%.0f%%", "-%.0f%%", throttle_, false, false);
+    DrawGraphIndicator(hud_img, left, top, 0, 100, "%.0f%%", "-%.0f%%", throttle_, false, false);
 }
 
 void Hud::DrawPlaneAndLogNumbers(Mat hud_img) {
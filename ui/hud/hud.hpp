@@ -20,7 +20,8 @@ class Hud {
         int frame_number_, video_number_;
         int plane_number_, log_number_;
         int scale_factor_;
-        Scalar hud_color_ ;
+        Scalar hud_color_unit_; // each channel from 0 to 1
+        Scalar hud_color_ ; // scaled for the image being drawn on
         int box_line_width_;
         int text_font_;
         double hud_font_scale_;
@@ -39,7 +40,9 @@ class Hud {
         void PutHudTextSmall(Mat hud_img, string str_in, Point text_orgin);
 
         void DrawAirspeed(Mat hud_img);
+        void DrawAirspeedBox(Mat hud_img);
         void DrawAltitude(Mat hud_img);
+        void DrawAltitudeBox(Mat hud_img);
         void DrawLadder(Mat hud_img, float value, bool for_airspeed, int major_increment, int minor_increment);
         void DrawFrameNumber(Mat hud_img);
         void DrawGpsSpeed(Mat hud_img);
@@ -59,10 +62,28 @@ class Hud {
 
         void DrawCenterMark(Mat hud_img);
         void DrawThrottle(Mat hud_img);
+        void DrawThrottleFrame(Mat hud_img);
         void DrawPlaneAndLogNumbers(Mat hud_img);
 
         void DrawAllAccelerationIndicators(Mat hud_img);
-        void DrawGraphIndicator(Mat hud_img, int left, int top, string label, int min_value, int max_value, int mark_increment, string plus_format, string minus_format, float value, bool zero_in_center = false, bool reverse_graph_direction = false);
+        void DrawAllAccelerationIndicatorFrames(Mat hud_img);
+        void DrawGraphIndicator(Mat hud_img, int left, int top, int min_value, int max_value, string plus_format, string minus_format, float value, bool zero_in_center = false, bool reverse_graph_direction = false);
+        void DrawGraphIndicatorFrame(Mat hud_img, int left, int top, string label, int min_value, int max_value, int mark_increment);
+
+        // Elements that only change with the settings below (box outlines,
+        // graph scales, labels, plane / log numbers) are drawn once onto
+        // static_layer_ and copied onto each frame through static_mask_.
+        void DrawStaticElements(Mat hud_img);
+        void UpdateStaticLayer(Size size, int type);
+
+        Mat static_layer_;
+        Mat static_mask_;
+
+        // what static_layer_ was drawn with
+        int static_clutter_level_ = -1;
+        int static_plane_number_ = -1;
+        int static_log_number_ = -1;
+        Scalar static_color_unit_;
 
         void GetEulerAngles(float *yaw, float *pitch, float *roll);
 
@@ -144,6 +165,13 @@ class Hud {
 
         void DrawHud(InputArray _input_image, OutputArray _output_image);
 
+        void CopyState(const Hud &other);
+
+        // colors are given from 0 to 1, so 8-bit images need them scaled
+        static Scalar ColorForDepth(Scalar unit_color, int depth) {
+            return depth == CV_8U ? unit_color * 255.0 : unit_color;
+        }
+
 };
 
 #endif
@@ -0,0 +1,163 @@
+#include "LodVoxelMap.hpp"
+
+// voxels whose weight has decayed below this are dropped (a single hit
+// lasts decay_time * ln(2))
+#define LOD_MIN_WEIGHT 0.5
+
+/**
+ * @param voxel_size size of the finest voxels, in meters
+ * @param lod_distance voxels closer than this are drawn at full detail.
+ *      Each time the distance doubles past it, the voxels double in size.
+ * @param num_levels most levels of detail
+ * @param decay_time seconds for a voxel's weight to decay by a factor of e
+ * @param max_points most points GetPoints() returns
+ */
+LodVoxelMap::LodVoxelMap(double voxel_size, double lod_distance, int num_levels, double decay_time, int max_points) {
+    voxel_size_ = voxel_size;
+    lod_distance_ = lod_distance;
+    num_levels_ = max(num_levels, 1);
+    decay_time_ = decay_time;
+    max_points_ = max_points;
+}
+
+int64_t LodVoxelMap::Key(int x, int y, int z) const {
+    // 21 bits each, which is +/- 250 km at 25 cm voxels
+    return ((int64_t)(x & 0x1FFFFF) << 42) | ((int64_t)(y & 0x1FFFFF) << 21) | (int64_t)(z & 0x1FFFFF);
+}
+
+double LodVoxelMap::DecayedWeight(const Voxel &voxel, int64_t timestamp) const {
+    if (decay_time_ <= 0) {
+        return voxel.weight;
+    }
+
+    return voxel.weight * exp(-(timestamp - voxel.last_t) / 1000000.0 / decay_time_);
+}
+
+/**
+ * Adds a hit to the voxel it's in.
+ *
+ * @param xyz point in the local frame
+ * @param timestamp time of the hit
+ */
+void LodVoxelMap::AddPoint(const double xyz[3], int64_t timestamp) {
+
+    int64_t key = Key(floor(xyz[0] / voxel_size_), floor(xyz[1] / voxel_size_), floor(xyz[2] / voxel_size_));
+
+    auto it = voxels_.find(key);
+
+    if (it == voxels_.end()) {
+        Voxel voxel;
+
+        for (int i = 0; i < 3; i++) {
+            voxel.sum[i] = xyz[i];
+        }
+
+        voxel.weight = 1;
+        voxel.last_t = timestamp;
+
+        voxels_[key] = voxel;
+        return;
+    }
+
+    Voxel &voxel = it->second;
+
+    // the centroid is weighted the same way, so old hits fade out of it too
+    double decay = DecayedWeight(voxel, timestamp) / voxel.weight;
+
+    for (int i = 0; i < 3; i++) {
+        voxel.sum[i] = voxel.sum[i] * decay + xyz[i];
+    }
+
+    voxel.weight = voxel.weight * decay + 1;
+    voxel.last_t = timestamp;
+}
+
+/**
+ * Drops voxels that have faded out, then merges the rest into points with
+ * coarser voxels farther from center.
+ *
+ * @param center where the aircraft is, in the local frame
+ * @param timestamp now
+ * @param points (output) at most max_points (the highest weight ones, if
+ *      there were more)
+ */
+void LodVoxelMap::GetPoints(const double center[3], int64_t timestamp, vector<LodPoint> *points) {
+
+    points->clear();
+
+    // merged voxels, keyed by level and coarse coordinates
+    vector<unordered_map<int64_t, LodPoint> > merged(num_levels_);
+
+    for (auto it = voxels_.begin(); it != voxels_.end(); ) {
+
+        Voxel &voxel = it->second;
+
+        double weight = DecayedWeight(voxel, timestamp);
+
+        if (weight < LOD_MIN_WEIGHT) {
+            it = voxels_.erase(it);
+            continue;
+        }
+
+        double xyz[3];
+
+        for (int i = 0; i < 3; i++) {
+            xyz[i] = voxel.sum[i] / voxel.weight;
+        }
+
+        double dx = xyz[0] - center[0];
+        double dy = xyz[1] - center[1];
+        double dz = xyz[2] - center[2];
+        double distance = sqrt(dx * dx + dy * dy + dz * dz);
+
+        int level = 0;
+
+        if (distance > lod_distance_ && lod_distance_ > 0) {
+            level = min((int)log2(distance / lod_distance_) + 1, num_levels_ - 1);
+        }
+
+        double size = voxel_size_ * (1 << level);
+
+        int64_t key = Key(floor(xyz[0] / size), floor(xyz[1] / size), floor(xyz[2] / size));
+
+        auto merged_it = merged[level].find(key);
+
+        if (merged_it == merged[level].end()) {
+            LodPoint &point = merged[level][key];
+
+            for (int i = 0; i < 3; i++) {
+                point.xyz[i] = xyz[i] * weight;
+            }
+
+            point.weight = weight;
+            point.level = level;
+        } else {
+            for (int i = 0; i < 3; i++) {
+                merged_it->second.xyz[i] += xyz[i] * weight;
+            }
+
+            merged_it->second.weight += weight;
+        }
+
+        ++it;
+    }
+
+    for (int level = 0; level < num_levels_; level++) {
+        for (auto &merged_point : merged[level]) {
+            LodPoint point = merged_point.second;
+
+            for (int i = 0; i < 3; i++) {
+                point.xyz[i] /= point.weight;
+            }
+
+            points->push_back(point);
+        }
+    }
+
+    if (max_points_ > 0 && (int)points->size() > max_points_) {
+        nth_element(points->begin(), points->begin() + max_points_, points->end(),
+            [](const LodPoint &a, const LodPoint &b) { return a.weight > b.weight; });
+
+        points->resize(max_points_);
+    }
+}
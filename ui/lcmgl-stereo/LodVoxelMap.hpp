@@ -0,0 +1,60 @@
+#ifndef LOD_VOXEL_MAP_H_
+#define LOD_VOXEL_MAP_H_
+
+/**
+ * Accumulates stereo hits into voxels that fade out over time, and reduces
+ * them to a bounded set of points to draw: voxels farther from the aircraft
+ * are merged into coarser ones (each level of detail doubles the voxel
+ * size), and if that's still too many, only the most-hit ones are kept.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <stdint.h>
+#include <math.h>
+
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+struct LodPoint {
+    float xyz[3];
+    float weight;
+    int level;
+};
+
+class LodVoxelMap {
+
+    public:
+        LodVoxelMap(double voxel_size, double lod_distance, int num_levels, double decay_time, int max_points);
+
+        void AddPoint(const double xyz[3], int64_t timestamp);
+
+        void GetPoints(const double center[3], int64_t timestamp, vector<LodPoint> *points);
+
+        int GetNumVoxels() const { return voxels_.size(); }
+
+    private:
+        struct Voxel {
+            float sum[3]; // for the centroid
+            float weight;
+            int64_t last_t;
+        };
+
+        int64_t Key(int x, int y, int z) const;
+
+        double DecayedWeight(const Voxel &voxel, int64_t timestamp) const;
+
+        double voxel_size_;
+        double lod_distance_;
+        int num_levels_;
+        double decay_time_; // seconds
+        int max_points_;
+
+        unordered_map<int64_t, Voxel> voxels_;
+};
+
+#endif
@@ -28,6 +28,10 @@ using namespace std;
 
 #include <bot_core/rotations.h>
 #include <bot_frames/bot_frames.h>
+
+#include "../../externals/ConciseArgs.hpp"
+#include "LodVoxelMap.hpp"
+#include "../../utils/utils/Clock.hpp"
    
 
 lcm_t * lcm;
@@ -40,15 +44,11 @@ lcmt_stereo_subscription_t *stereo_sub;
 //Global bot frames
 BotFrames *botFrames;
 
-static void usage(void)
-{
-        fprintf(stderr, "usage: optotrak-lcmgl optotrak-quat-channel-name lcmgl-channel-name\n");
-        fprintf(stderr, "    optotrak-quat-channel-name : LCM channel name with optotrak QUAT messages\n");
-        fprintf(stderr, "    lcmgl-channel-name : LCM channel to publish LCMGL messages on\n");
-        fprintf(stderr, "  example:\n");
-        fprintf(stderr, "    ./optotrak-lcmgl wingeron_x_quat wingeron_x_lcmgl\n");
-        fprintf(stderr, "    reads optotrak LCM messages and draws the position using  LCMGL\n");
-}
+// every hit so far, fading out, drawn with less detail far from the aircraft
+LodVoxelMap *voxelMap;
+
+int64_t publishPeriod; // usec
+int64_t lastPublishTime = 0;
 
 
 void sighandler(int dum)
@@ -63,22 +63,13 @@ void sighandler(int dum)
     exit(0);
 }
 
-int64_t getTimestampNow()
-{
-    struct timeval thisTime;
-    gettimeofday(&thisTime, NULL);
-    return (thisTime.tv_sec * 1000000.0) + (float)thisTime.tv_usec + 0.5;
-}
-
 
 void stereo_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo *msg, void *user)
 {
-    bot_lcmgl_push_matrix(lcmgl);
-    bot_lcmgl_point_size(lcmgl, 10.5f);
-    
     BotTrans toOpenCv;
     bot_frames_get_trans(botFrames, "opencvFrame", "local", &toOpenCv);
     int numHits = msg -> number_of_points;
+    int64_t now = GetWallNow();
     //printf("numHits: %d \n", numHits);
     for (int i=0; i< numHits; i++) {
     
@@ -91,11 +82,45 @@ void stereo_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_
 
         double transPoint[3];
         bot_trans_apply_vec(&toOpenCv,originalCoords, transPoint); 
-        //Draw the point
-        //printf("x: %f, y: %f, z: %f \n", transPoint[0], transPoint[1], transPoint[2]);
-        bot_lcmgl_begin(lcmgl, GL_POINTS);
-        bot_lcmgl_color3f(lcmgl,0,0,255);
-        bot_lcmgl_vertex3f(lcmgl, transPoint[0], transPoint[1], transPoint[2]);
+        
+        voxelMap->AddPoint(transPoint, now);
+    }
+    
+    if (now - lastPublishTime < publishPeriod)
+    {
+        return;
+    }
+    
+    lastPublishTime = now;
+    
+    // draw around where the aircraft is now
+    BotTrans bodyToLocal;
+    bot_frames_get_trans(botFrames, "body", "local", &bodyToLocal);
+    
+    vector<LodPoint> points;
+    voxelMap->GetPoints(bodyToLocal.trans_vec, now, &points);
+    
+    // one batch per level of detail, since coarser voxels get bigger points
+    sort(points.begin(), points.end(), [](const LodPoint &a, const LodPoint &b) { return a.level < b.level; });
+    
+    bot_lcmgl_push_matrix(lcmgl);
+    bot_lcmgl_color3f(lcmgl,0,0,255);
+    
+    for (int i = 0; i < int(points.size()); i++) {
+        
+        if (i == 0 || points[i].level != points[i-1].level) {
+            if (i > 0) {
+                bot_lcmgl_end(lcmgl);
+            }
+            
+            bot_lcmgl_point_size(lcmgl, 10.5f * (1 << points[i].level));
+            bot_lcmgl_begin(lcmgl, GL_POINTS);
+        }
+        
+        bot_lcmgl_vertex3f(lcmgl, points[i].xyz[0], points[i].xyz[1], points[i].xyz[2]);
+    }
+    
+    if (points.size() > 0) {
         bot_lcmgl_end(lcmgl);
     }
     
@@ -109,16 +134,29 @@ void stereo_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_
 
 int main(int argc,char** argv)
 {
-    char *channelStereo = NULL;
-    char *channelLcmGl = NULL;
+    string channelStereoStr, channelLcmGlStr;
+    double voxelSize = 0.25;
+    double lodDistance = 20;
+    int numLevels = 4;
+    double decayTime = 30;
+    int maxPoints = 20000;
+    double publishRate = 5;
     
-    if (argc!=3) {
-        usage();
-        exit(0);
-    }
-
-    channelStereo = argv[1];
-    channelLcmGl = argv[2];
+    ConciseArgs parser(argc, argv, "stereo-channel-name lcmgl-channel-name",
+        "Accumulates stereo hits from stereo-channel-name and draws them with LCMGL on lcmgl-channel-name.");
+    parser.add(voxelSize, "v", "voxel-size", "Size of the finest voxels hits are merged into (m).");
+    parser.add(lodDistance, "d", "lod-distance", "Voxels closer than this are drawn at full detail.  They double in size each time the distance doubles past it (m).");
+    parser.add(numLevels, "l", "levels", "Number of levels of detail.");
+    parser.add(decayTime, "t", "decay-time", "Time for hits to fade out (s).  A voxel hit once is drawn for about 0.7 times this.");
+    parser.add(maxPoints, "m", "max-points", "Most points to send at once.");
+    parser.add(publishRate, "r", "rate", "Most times a second to send points.");
+    parser.parse(channelStereoStr, channelLcmGlStr);
+    
+    const char *channelStereo = channelStereoStr.c_str();
+    const char *channelLcmGl = channelLcmGlStr.c_str();
+    
+    voxelMap = new LodVoxelMap(voxelSize, lodDistance, numLevels, decayTime, maxPoints);
+    publishPeriod = publishRate > 0 ? 1000000.0 / publishRate : 0;
 
     lcm = lcm_create ("udpm://239.255.76.67:7667?ttl=0");
     if (!lcm)
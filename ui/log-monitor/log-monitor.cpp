@@ -1,6 +1,14 @@
 /*
  * Monitors the log file size and sends LCM messages about it
  *
+ * Watches the log directory (and optionally the stereo recording
+ * directory) with inotify instead of polling, and sends the log size, the
+ * write rates, the free space and how long until the disk fills when
+ * something changes, at most --max-rate times a second.  With nothing
+ * changing it still sends every --heartbeat seconds, so a writer that has
+ * stalled shows up as a rate of zero and a growing time since the last
+ * write.
+ *
  * Author: Andrew Barry, <abarry@csail.mit.edu> 2013
  *
  */
@@ -15,8 +23,15 @@
 #include <time.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/inotify.h>
+#include <dirent.h>
+#include <poll.h>
+
+#include <map>
+#include <set>
 
 #include "../../LCM/lcmt_log_size.h"
+#include "../../LCM/lcmt_storage_status.h"
 
 #include "../../externals/ConciseArgs.hpp"
 
@@ -24,10 +39,33 @@
 
 #include <sys/statvfs.h>
 
+// write rates are averaged with this time constant (seconds)
+#define RATE_TIME_CONSTANT 3.0
+
+#define INOTIFY_MASK (IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE)
+
 lcm_t * lcm;
 
 std::string log_dir = "/home/odroid";
+std::string recording_dir = "";
 std::string log_info_channel_str = "log-info-hostname";
+std::string storage_channel_str = "storage-status-hostname";
+
+double max_rate = 2;
+double heartbeat = 5;
+
+int inotify_fd = -1;
+
+// watch descriptor of the log directory, and of the recording directory
+// and its subdirectories (PGM recordings)
+int log_wd = -1;
+std::map<int, std::string> recording_wds;
+
+struct RateEstimate {
+    int64_t bytes_since_update = 0;
+    double mb_per_s = 0;
+    int64_t last_write_utime = -1;
+};
 
 
 void sighandler(int dum) {
@@ -46,6 +84,148 @@ long GetFileSize(std::string filename) {
     return rc == 0 ? stat_buf.st_size : -1;
 }
 
+std::string WithSlash(std::string dir) {
+    if (!dir.empty() && *dir.rbegin() != '/') {
+        return dir + "/";
+    }
+    return dir;
+}
+
+/**
+ * Finds today's newest LCM log, named something like
+ * "lcmlog-2013-07-18.00".
+ *
+ * @param the_log (output) file name of the log
+ *
+ * @retval log number, or -1 if there isn't one
+ */
+int FindTodaysLog(std::string *the_log) {
+    // get the date
+    time_t rawtime;
+    struct tm * timeinfo;
+    char date_string[80];
+
+    time ( &rawtime );
+    timeinfo = localtime ( &rawtime );
+
+    strftime (date_string, 80, "%Y-%m-%d", timeinfo);
+
+    std::string lcm_prefix = "lcmlog-" + std::string(date_string) + ".";
+
+    int largest_log = -1;
+
+    DIR *dir;
+    struct dirent *ent;
+    if ((dir = opendir (log_dir.c_str())) != NULL) {
+        while ((ent = readdir (dir)) != NULL) {
+            // see if this name starts with lcmlog-
+            std::string this_name = ent->d_name;
+
+            if (!this_name.compare(0, lcm_prefix.size(), lcm_prefix)) {
+                // get the number of this log
+                std::string num_string = this_name.substr(lcm_prefix.size());
+                int log_num = atoi(num_string.c_str());
+
+                if (log_num > largest_log) {
+                    largest_log = log_num;
+                    *the_log = this_name;
+                }
+            }
+
+        }
+        closedir (dir);
+    } else {
+        /* could not open directory */
+        perror (log_dir.c_str());
+    }
+
+    return largest_log;
+}
+
+/**
+ * Watches a recording directory and the directories in it, and counts
+ * the files that are already there as written.
+ *
+ * @param dir directory to watch
+ * @param file_sizes (output) sizes of the files in it
+ */
+void WatchRecordingDir(std::string dir, std::map<std::string, long> *file_sizes) {
+    int wd = inotify_add_watch(inotify_fd, dir.c_str(), INOTIFY_MASK);
+
+    if (wd < 0) {
+        fprintf(stderr, "Warning: failed to watch %s: %s\n", dir.c_str(), strerror(errno));
+        return;
+    }
+
+    recording_wds[wd] = dir;
+
+    DIR *d;
+    struct dirent *ent;
+    if ((d = opendir (dir.c_str())) != NULL) {
+        while ((ent = readdir (d)) != NULL) {
+            std::string name = ent->d_name;
+
+            if (name == "." || name == "..") {
+                continue;
+            }
+
+            std::string path = dir + name;
+            struct stat stat_buf;
+
+            if (stat(path.c_str(), &stat_buf) != 0) {
+                continue;
+            }
+
+            if (S_ISDIR(stat_buf.st_mode)) {
+                WatchRecordingDir(WithSlash(path), file_sizes);
+            } else {
+                (*file_sizes)[path] = stat_buf.st_size;
+            }
+        }
+        closedir (d);
+    }
+}
+
+double GetDiskFree(std::string dir) {
+    struct statvfs fi_data;
+
+    if((statvfs(dir.c_str(), &fi_data)) < 0 ) {
+        printf("Failed to stat %s:\n", dir.c_str());
+        return -1;
+    }
+
+    return (double)fi_data.f_bavail * (double)fi_data.f_bsize / 1048576.0d;
+}
+
+bool SameDisk(std::string dir1, std::string dir2) {
+    struct stat stat1, stat2;
+
+    return stat(dir1.c_str(), &stat1) == 0 && stat(dir2.c_str(), &stat2) == 0
+        && stat1.st_dev == stat2.st_dev;
+}
+
+/**
+ * Folds the bytes written since the last update into a rate.
+ *
+ * @param rate rate to update
+ * @param dt seconds since the last update
+ */
+void UpdateRate(RateEstimate *rate, double dt) {
+    if (dt <= 0) {
+        return;
+    }
+
+    double instant = rate->bytes_since_update / 1048576.0 / dt;
+    double alpha = 1 - exp(-dt / RATE_TIME_CONSTANT);
+
+    rate->mb_per_s += alpha * (instant - rate->mb_per_s);
+    rate->bytes_since_update = 0;
+}
+
+float SecondsSince(int64_t utime, int64_t now) {
+    return utime < 0 ? -1 : (now - utime) / 1000000.0;
+}
+
 
 int main(int argc,char** argv) {
 
@@ -55,24 +235,31 @@ int main(int argc,char** argv) {
 
     gethostname(hostname, hostname_len);
     log_info_channel_str = "log-info-" + std::string(hostname);
+    storage_channel_str = "storage-status-" + std::string(hostname);
 
     ConciseArgs parser(argc, argv);
     parser.add(log_info_channel_str, "c", "log-info-channel",
         "LCM channel for publishing log info.");
+    parser.add(storage_channel_str, "s", "storage-channel",
+        "LCM channel for publishing write rates and time until the disk is full.");
     parser.add(log_dir, "d", "log-directory",
         "Directory containing log files.", true);
+    parser.add(recording_dir, "r", "recording-directory",
+        "Directory the stereo recordings go in (videoSaveDir), to watch too.");
+    parser.add(max_rate, "m", "max-rate",
+        "Most messages a second to send while things are changing.");
+    parser.add(heartbeat, "b", "heartbeat",
+        "Seconds between messages when nothing is changing.");
     parser.parse();
 
     if (!log_dir.empty()) {
-        char last_char = *log_dir.rbegin();
-        if (last_char != '/') {
-            log_dir = log_dir + "/";
-        }
+        log_dir = WithSlash(log_dir);
     } else {
         fprintf(stderr, "directory can't be empty.  Try \".\" if you want this directory.\n");
         return 1;
     }
 
+    recording_dir = WithSlash(recording_dir);
 
     lcm = lcm_create ("udpm://239.255.76.67:7667?ttl=1");
     if (!lcm) {
@@ -82,98 +269,218 @@ int main(int argc,char** argv) {
 
     signal(SIGINT,sighandler);
 
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
 
+    if (inotify_fd < 0) {
+        perror("inotify_init1");
+        return 1;
+    }
 
-    printf("Publishing:\n\tLog size: %s\n\n", log_info_channel_str.c_str());
+    log_wd = inotify_add_watch(inotify_fd, log_dir.c_str(), INOTIFY_MASK);
 
-    while (true) {
-        // find the logfile for today
-        // formatted something like "lcmlog-2013-07-18.00"
+    if (log_wd < 0) {
+        perror(log_dir.c_str());
+        return EXIT_FAILURE;
+    }
 
-        // get the date
-        time_t rawtime;
-        struct tm * timeinfo;
-        char date_string[80];
+    std::map<std::string, long> recording_sizes;
+
+    if (!recording_dir.empty()) {
+        WatchRecordingDir(recording_dir, &recording_sizes);
+    }
 
-        time ( &rawtime );
-        timeinfo = localtime ( &rawtime );
+    bool same_disk = recording_dir.empty() || SameDisk(log_dir, recording_dir);
 
-        strftime (date_string, 80, "%Y-%m-%d", timeinfo);
+    std::string the_log;
+    int log_number = FindTodaysLog(&the_log);
+    long log_size = log_number >= 0 ? GetFileSize(log_dir + the_log) : -1;
 
-        std::string lcm_prefix = "lcmlog-" + std::string(date_string) + ".";
+    RateEstimate log_rate, recording_rate;
+    int64_t recording_bytes = 0;
 
-        int largest_log = -1;
-        long log_size = -1;
-        std::string the_log;
+    // what changed since the last message
+    bool log_changed = true;
+    bool rescan_log = false;
+    std::set<std::string> changed_recordings;
 
-        DIR *dir;
-        struct dirent *ent;
-        if ((dir = opendir (log_dir.c_str())) != NULL) {
-            /* print all the files and directories within directory */
-            while ((ent = readdir (dir)) != NULL) {
-                //printf ("%s\n", ent->d_name);
-                // see if this name starts with lcmlog-
+    int64_t min_period = max_rate > 0 ? 1000000.0 / max_rate : 0;
+    int64_t heartbeat_period = heartbeat * 1000000.0;
+    int64_t last_publish = GetMonotonicNow() - heartbeat_period;
 
-                std::string this_name = ent->d_name;
+    printf("Publishing:\n\tLog size: %s\n\tStorage status: %s\nWatching:\n\tLogs: %s\n\tRecordings: %s\n\n", log_info_channel_str.c_str(), storage_channel_str.c_str(), log_dir.c_str(), recording_dir.empty() ? "(none)" : recording_dir.c_str());
+
+    char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    while (true) {
+        int64_t now = GetMonotonicNow();
 
-                if (!this_name.compare(0, lcm_prefix.size(), lcm_prefix)) {
-                    // get the number of this log
-                    std::string num_string = this_name.substr(lcm_prefix.size());
-                    int log_num = atoi(num_string.c_str());
+        bool changed = log_changed || rescan_log || !changed_recordings.empty();
 
-                    if (log_num > largest_log) {
-                        largest_log = log_num;
-                        the_log = this_name;
+        // sleep until the next message is allowed (if something changed) or
+        // the heartbeat is due
+        int64_t next_publish = last_publish + (changed ? min_period : heartbeat_period);
+        int timeout_ms = next_publish > now ? (next_publish - now + 999) / 1000 : 0;
+
+        struct pollfd pfd;
+        pfd.fd = inotify_fd;
+        pfd.events = POLLIN;
+
+        if (poll(&pfd, 1, timeout_ms) > 0) {
+            ssize_t length;
+
+            while ((length = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+                for (char *ptr = buffer; ptr < buffer + length; ) {
+                    const struct inotify_event *event = (const struct inotify_event*) ptr;
+                    ptr += sizeof(struct inotify_event) + event->len;
+
+                    if (event->mask & IN_Q_OVERFLOW) {
+                        // lost events, look at everything
+                        rescan_log = true;
+
+                        for (auto &it : recording_sizes) {
+                            changed_recordings.insert(it.first);
+                        }
+                        continue;
+                    }
+
+                    std::string name = event->len > 0 ? event->name : "";
+
+                    if (event->wd == log_wd) {
+                        if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                            rescan_log = true;
+                        } else if (name == the_log) {
+                            log_changed = true;
+                        }
+                    } else if (recording_wds.count(event->wd) > 0) {
+                        std::string path = recording_wds[event->wd] + name;
+
+                        if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+                            // a new PGM recording
+                            WatchRecordingDir(WithSlash(path), &recording_sizes);
+                        } else if ((event->mask & IN_ISDIR) == 0) {
+                            changed_recordings.insert(path);
+                        }
                     }
                 }
+            }
+        }
+
+        now = GetMonotonicNow();
+        changed = log_changed || rescan_log || !changed_recordings.empty();
+
+        if (now - last_publish < (changed ? min_period : heartbeat_period)) {
+            continue;
+        }
+
+        int64_t utime_now = GetTimestampNow();
 
+        // the day rolls over without an event, so look again on the
+        // heartbeat too
+        if (rescan_log || changed == false) {
+            std::string new_log;
+            int new_number = FindTodaysLog(&new_log);
+
+            if (new_number != log_number) {
+                log_number = new_number;
+                the_log = new_log;
+                log_size = 0;
             }
-            closedir (dir);
-        } else {
-          /* could not open directory */
-          perror ("");
-          return EXIT_FAILURE;
         }
 
-        if (largest_log < 0) {
-            // didn't find a log
-            //cout << "Failed to find any logs" << endl;
+        if (log_number >= 0) {
+            long new_size = GetFileSize(log_dir + the_log);
 
-            log_size = -1;
+            if (new_size > log_size) {
+                log_rate.bytes_since_update += new_size - log_size;
+                log_rate.last_write_utime = utime_now;
+            }
 
+            log_size = new_size;
         } else {
-            // found a log, get the filesize
+            log_size = -1;
+        }
 
+        for (const std::string &path : changed_recordings) {
+            long new_size = GetFileSize(path);
+            long old_size = recording_sizes.count(path) > 0 ? recording_sizes[path] : 0;
 
-            //cout << "Filesize of log " << theLog << " is " << GetFileSize(string(logDir) + theLog) << endl;
+            if (new_size < 0) {
+                recording_sizes.erase(path);
+                continue;
+            }
 
-            log_size = GetFileSize(std::string(log_dir) + the_log);
+            if (new_size > old_size) {
+                recording_rate.bytes_since_update += new_size - old_size;
+                recording_bytes += new_size - old_size;
+                recording_rate.last_write_utime = utime_now;
+            }
 
+            recording_sizes[path] = new_size;
         }
 
+        double dt = (now - last_publish) / 1000000.0;
+
+        UpdateRate(&log_rate, dt);
+        UpdateRate(&recording_rate, dt);
+
+        log_changed = false;
+        rescan_log = false;
+        changed_recordings.clear();
+        last_publish = now;
+
         // get disk space free
-        struct statvfs fi_data;
-        double disk_free = -1;
+        double disk_free = GetDiskFree(log_dir);
+        double recording_disk_free = recording_dir.empty() ? disk_free : GetDiskFree(recording_dir);
 
-        if((statvfs(log_dir.c_str(), &fi_data)) < 0 ) {
-            printf("Failed to stat %s:\n", log_dir.c_str());
-        } else {
-            disk_free = (double)fi_data.f_bavail * (double)fi_data.f_bsize / 1048576.0d;
+        // time until the first disk fills
+        float seconds_to_full = -1;
+
+        double log_disk_rate = log_rate.mb_per_s + (same_disk ? recording_rate.mb_per_s : 0);
+
+        if (log_disk_rate > 1e-3 && disk_free >= 0) {
+            seconds_to_full = disk_free / log_disk_rate;
+        }
+
+        if (same_disk != true && recording_rate.mb_per_s > 1e-3 && recording_disk_free >= 0) {
+            float recording_to_full = recording_disk_free / recording_rate.mb_per_s;
+
+            if (seconds_to_full < 0 || recording_to_full < seconds_to_full) {
+                seconds_to_full = recording_to_full;
+            }
         }
 
         // publish to LCM
         lcmt_log_size msg;
 
-        msg.timestamp = GetTimestampNow();
+        msg.timestamp = utime_now;
 
-        msg.log_number = largest_log;
+        msg.log_number = log_number;
         msg.log_size = log_size;
 
         msg.disk_space_free = disk_free;
 
+        // only the logger itself knows these
+        msg.num_dropped = 0;
+        msg.write_latency_ms_avg = 0;
+        msg.write_latency_ms_max = 0;
+
         lcmt_log_size_publish (lcm, log_info_channel_str.c_str(), &msg);
 
-        sleep(1);
+        lcmt_storage_status status;
+
+        status.timestamp = utime_now;
+        status.log_number = log_number;
+        status.log_size = log_size;
+        status.recording_bytes = recording_bytes;
+        status.log_mb_per_s = log_rate.mb_per_s;
+        status.recording_mb_per_s = recording_rate.mb_per_s;
+        status.disk_space_free = disk_free;
+        status.recording_disk_space_free = recording_disk_free;
+        status.seconds_to_full = seconds_to_full;
+        status.seconds_since_log_write = SecondsSince(log_rate.last_write_utime, utime_now);
+        status.seconds_since_recording_write = SecondsSince(recording_rate.last_write_utime, utime_now);
+
+        lcmt_storage_status_publish (lcm, storage_channel_str.c_str(), &status);
     }
 
     return 0;
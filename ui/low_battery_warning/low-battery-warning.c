@@ -5,7 +5,9 @@
 #include <time.h>
 #include <sys/time.h>
 
-#include "../../LCM/lcmt_battery_status.h"
+#include <string.h>
+
+#include "../../LCM/lcmt_health_status.h"
 
 
 char *lcm_out = NULL;
@@ -16,11 +18,12 @@ long lastSoundTime = 0;
 long lastBeepTime = 0;
 
 lcm_t * lcm;
-lcmt_battery_status_subscription_t * battery_status_sub;
+lcmt_health_status_subscription_t * health_status_sub;
 
 static void usage(void)
 {
-        fprintf(stderr, "usage: low-battery-warning input-channel-name\n\n");
+        fprintf(stderr, "usage: low-battery-warning health-status-channel-name\n\n");
+        fprintf(stderr, "Beeps while plane-health-monitor's \"battery-low\" rule is failing.\n\n");
 }
 
 int stop=0;
@@ -29,7 +32,7 @@ void sighandler(int dum)
 {
     printf("\nClosing... ");
 
-    lcmt_battery_status_unsubscribe (lcm, battery_status_sub);
+    lcmt_health_status_unsubscribe (lcm, health_status_sub);
     lcm_destroy (lcm);
 
 
@@ -40,16 +43,24 @@ void sighandler(int dum)
 
 
 
-void lcm_battery_status_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_battery_status *msg, void *user)
+void lcm_health_status_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_health_status *msg, void *user)
 {
-    // check to see if the object has entered or left the view
-    // if it has, play a sound
-        
-    int haveMarker = 0;
+    // the threshold lives in plane-health-monitor's rules, we just make the
+    // noise
+    int batteryLow = 0;
+    int i;
+
+    for (i = 0; i < msg->num_rules; i++)
+    {
+        if (strcmp(msg->rules[i], "battery-low") == 0)
+        {
+            batteryLow = msg->failing[i];
+        }
+    }
 
     long thisTime = msg->timestamp;
 
-    if (msg->voltage < 10.9 && lastBeepTime + 5000*1000 < thisTime)
+    if (batteryLow && lastBeepTime + 5000*1000 < thisTime)
     {
         system(lowbatcmd);
         lastBeepTime = thisTime;
@@ -83,7 +94,7 @@ int main(int argc,char** argv)
         }
         
         
-        battery_status_sub =  lcmt_battery_status_subscribe (lcm, lcm_in, &lcm_battery_status_handler, NULL);
+        health_status_sub =  lcmt_health_status_subscribe (lcm, lcm_in, &lcm_health_status_handler, NULL);
 
         
     
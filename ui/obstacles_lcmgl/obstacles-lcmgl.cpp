@@ -20,6 +20,7 @@
 #include <bot_param/param_client.h>
 #include <GL/gl.h>
 #include <bot_lcmgl_client/lcmgl.h>
+#include "../../utils/utils/Clock.hpp"
 
 
 lcm_t * lcm;
@@ -37,13 +38,6 @@ void sighandler(int dum)
     exit(0);
 }
 
-int64_t getTimestampNow()
-{
-    struct timeval thisTime;
-    gettimeofday(&thisTime, NULL);
-    return (thisTime.tv_sec * 1000000.0) + (float)thisTime.tv_usec + 0.5;
-}
-
 void usage() {
     fprintf(stderr, "provide channel name to publish lcmgl data to as argument.");
 }
@@ -27,6 +27,7 @@ using namespace std;
 
 #include <bot_core/rotations.h>
 #include <bot_frames/bot_frames.h>
+#include "../../utils/utils/Clock.hpp"
    
 
 lcm_t * lcm;
@@ -42,6 +43,12 @@ lcmt_optotrak_quat_subscription_t *optotrak_quat_sub;
 
 BotTrans optotrakToLocal, optotrakToLocal2;
 
+// the frames are updated on every message, but drawing waits this long
+// (usec) after the last drawing, so LCMGL doesn't slow down the frames
+#define DRAW_PERIOD_USEC 33000
+
+int64_t last_draw_utime = 0;
+
 
 static void usage(void)
 {
@@ -66,13 +73,6 @@ void sighandler(int dum)
     exit(0);
 }
 
-int64_t getTimestampNow()
-{
-    struct timeval thisTime;
-    gettimeofday(&thisTime, NULL);
-    return (thisTime.tv_sec * 1000000.0) + (float)thisTime.tv_usec + 0.5;
-}
-
 void PlotLcmGlCoordinateTri(BotTrans *trans)
 {
     double origin[3];
@@ -159,19 +159,21 @@ void optotrak_quat_handler(const lcm_recv_buf_t *rbuf, const char* channel, cons
     
     bot_trans_set_from_quat_trans(&newTrans, quat, xyz);
     
-    bot_frames_get_trans(botFrames, "optotrak", "local", &optotrakToLocal);
-    
-    //bot_trans_apply_trans(&newTrans, &optotrakToLocal);
-    bot_trans_apply_trans(&optotrakToLocal, &newTrans);
+    // optotrak to local is fixed, and was looked up at startup
+    BotTrans drawTrans = optotrakToLocal;
     
-    //bot_trans_apply_trans(&newTrans, &optotrakToLocal2);
+    bot_trans_apply_trans(&drawTrans, &newTrans);
     
     // update transform
-    bot_frames_update_frame(botFrames, "optotrak-local", "local", &optotrakToLocal, getTimestampNow());
-    bot_frames_update_frame(botFrames, "body", "local", &optotrakToLocal, getTimestampNow()); // HUGE HACK TODO TODO WARNING HUGE HACK BE AWARE FIXME FIXME FIXME
+    int64_t now = GetWallNow();
+    bot_frames_update_frame(botFrames, "optotrak-local", "local", &drawTrans, now);
+    bot_frames_update_frame(botFrames, "body", "local", &drawTrans, now); // HUGE HACK TODO TODO WARNING HUGE HACK BE AWARE FIXME FIXME FIXME
+    
+    if (now - last_draw_utime < DRAW_PERIOD_USEC) {
+        return;
+    }
     
-    BotTrans drawTrans;
-    bot_frames_get_trans(botFrames, "optotrak-local", "local", &drawTrans);
+    last_draw_utime = now;
     
     // draw obstacle
     // publish to LCMGL
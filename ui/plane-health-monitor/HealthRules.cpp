@@ -0,0 +1,116 @@
+#include "HealthRules.hpp"
+
+HealthRules::HealthRules(const HealthRule *rules, int num_rules) {
+    rules_ = rules;
+    num_rules_ = num_rules;
+    num_failing_ = 0;
+
+    failing_.assign(num_rules, false);
+    values_.assign(num_rules, 0);
+
+    for (int i = 0; i < NUM_HEALTH_SIGNALS; i++) {
+        snapshot_[i].utime = -1;
+        snapshot_[i].value = 0;
+        snapshot_[i].last_utime = -1;
+        snapshot_[i].last_value = 0;
+    }
+}
+
+/**
+ * Checks every rule against the snapshot.
+ *
+ * @param now current time (usec, same clock as the Set() times)
+ * @param changes (output) cleared, then filled with the rules that started
+ *      or stopped failing since the last call
+ */
+void HealthRules::Evaluate(int64_t now, std::vector<HealthRuleChange> *changes) {
+    changes->clear();
+
+    for (int i = 0; i < num_rules_; i++) {
+        double value;
+        bool failing = Check(rules_[i], now, &value);
+
+        values_[i] = value;
+
+        if (failing != failing_[i]) {
+            failing_[i] = failing;
+            num_failing_ += failing ? 1 : -1;
+
+            HealthRuleChange change;
+            change.rule = i;
+            change.failing = failing;
+            change.value = value;
+
+            changes->push_back(change);
+        }
+    }
+}
+
+/**
+ * @param rule rule to check
+ * @param now current time (usec)
+ * @param value (output) what the rule looked at
+ *
+ * @retval true if the rule is failing
+ */
+bool HealthRules::Check(const HealthRule &rule, int64_t now, double *value) const {
+    const SignalSnapshot &s = snapshot_[rule.signal];
+
+    switch (rule.type) {
+        case RULE_STALE:
+            if (s.utime < 0) {
+                *value = -1;
+                return true;
+            }
+
+            *value = (now - s.utime) / 1000000.0;
+            return now - s.utime > rule.max_age_usec;
+
+        case RULE_RANGE:
+            // nothing yet is for a staleness rule to catch
+            if (s.utime < 0) {
+                *value = 0;
+                return false;
+            }
+
+            *value = s.value;
+            return s.value < rule.min || s.value > rule.max;
+
+        case RULE_RATE:
+            if (s.last_utime < 0 || s.utime <= s.last_utime) {
+                *value = 0;
+                return false;
+            }
+
+            *value = (s.value - s.last_value) / ((s.utime - s.last_utime) / 1000000.0);
+            return *value < rule.min || *value > rule.max;
+
+        case RULE_MEAN:
+        case RULE_STDDEV:
+            // wait for a full window, so one reading isn't a stuck sensor
+            if (s.stats.GetCount() < HEALTH_ROLLING_WINDOW) {
+                *value = 0;
+                return false;
+            }
+
+            *value = rule.type == RULE_MEAN ? s.stats.GetMean() : s.stats.GetStandardDeviation();
+            return *value < rule.min || *value > rule.max;
+
+        case RULE_DIFFERENCE: {
+            const SignalSnapshot &other = snapshot_[rule.other];
+
+            if (s.utime < 0 || other.utime < 0
+                || (rule.max_age_usec > 0 && (now - s.utime > rule.max_age_usec || now - other.utime > rule.max_age_usec))) {
+
+                *value = 0;
+                return false;
+            }
+
+            *value = s.value - other.value;
+            return *value < rule.min || *value > rule.max;
+        }
+    }
+
+    *value = 0;
+    return false;
+}
@@ -0,0 +1,145 @@
+#ifndef HEALTH_RULES_HPP
+#define HEALTH_RULES_HPP
+
+/*
+ * Rule engine for plane-health-monitor.
+ *
+ * The LCM handlers only copy the numbers the rules look at into a fixed
+ * snapshot (the latest value per signal, plus the one before it for rates).
+ * The rules are checked against that snapshot at a fixed rate, so a fast
+ * channel like the state estimator costs a few stores per message no matter
+ * how many rules there are.  Evaluate() reports only the rules that changed
+ * state since the last time.
+ *
+ * Each signal also keeps its last HEALTH_ROLLING_WINDOW values in a fixed
+ * ring (FixedRollingStatistics), for the rules on its mean and standard
+ * deviation, and a rule can compare two signals (say, the airspeed and
+ * the GPS speed), so every channel is decoded once, here, for all the
+ * checks on it.
+ *
+ * The handlers and Evaluate() run on the same thread (the LCM loop), so
+ * the snapshot needs no lock.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <stdint.h>
+#include <vector>
+
+#include "../../utils/RollingStatistics/RollingStatistics.hpp"
+
+// values each signal's rolling statistics are over (about a second of
+// airspeed)
+#define HEALTH_ROLLING_WINDOW 70
+
+enum HealthSignal {
+    SIGNAL_PROCESSES_DOWN,
+    SIGNAL_PROCESS_EXITS,
+    SIGNAL_LOG_SIZE,
+    SIGNAL_FRAME_NUMBER,
+    SIGNAL_POSE_SPEED,
+    SIGNAL_AIRSPEED,
+    SIGNAL_GPS_SPEED,
+    SIGNAL_BATTERY_VOLTAGE,
+
+    NUM_HEALTH_SIGNALS
+};
+
+enum HealthRuleType {
+    // fails when the signal hasn't been set for more than max_age_usec
+    // (or ever)
+    RULE_STALE,
+
+    // fails when the latest value is outside [min, max]
+    RULE_RANGE,
+
+    // fails when the change per second between the last two values is
+    // outside [min, max]
+    RULE_RATE,
+
+    // fail when the mean or standard deviation of the last
+    // HEALTH_ROLLING_WINDOW values is outside [min, max]
+    RULE_MEAN,
+    RULE_STDDEV,
+
+    // fails when the signal minus the other one is outside [min, max].
+    // Both have to have been set within max_age_usec (if it isn't 0) to
+    // be compared.
+    RULE_DIFFERENCE
+};
+
+struct HealthRule {
+    const char *name;
+
+    HealthSignal signal;
+    HealthRuleType type;
+
+    double min;
+    double max;
+
+    int64_t max_age_usec;
+
+    // the second signal, for RULE_DIFFERENCE
+    HealthSignal other;
+};
+
+struct SignalSnapshot {
+    int64_t utime;      // when the value arrived, -1 if it hasn't
+    double value;
+
+    int64_t last_utime; // the one before, for RULE_RATE
+    double last_value;
+
+    // for RULE_MEAN and RULE_STDDEV
+    FixedRollingStatistics<HEALTH_ROLLING_WINDOW> stats;
+};
+
+struct HealthRuleChange {
+    int rule;           // index into the rule table
+    bool failing;
+    double value;       // what was checked against the limits
+};
+
+class HealthRules {
+
+    public:
+        HealthRules(const HealthRule *rules, int num_rules);
+
+        void Set(HealthSignal signal, int64_t utime, double value) {
+            SignalSnapshot &s = snapshot_[signal];
+
+            s.last_utime = s.utime;
+            s.last_value = s.value;
+
+            s.utime = utime;
+            s.value = value;
+
+            s.stats.AddValue(value);
+        }
+
+        void Evaluate(int64_t now, std::vector<HealthRuleChange> *changes);
+
+        const HealthRule& GetRule(int rule) const { return rules_[rule]; }
+        int GetNumRules() const { return num_rules_; }
+        int GetNumFailing() const { return num_failing_; }
+
+        // as of the last Evaluate()
+        bool IsFailing(int rule) const { return failing_[rule]; }
+        double GetValue(int rule) const { return values_[rule]; }
+
+    private:
+        bool Check(const HealthRule &rule, int64_t now, double *value) const;
+
+        const HealthRule *rules_;
+        int num_rules_;
+        int num_failing_;
+
+        // one per rule, so Evaluate() doesn't allocate
+        std::vector<bool> failing_;
+        std::vector<double> values_;
+
+        SignalSnapshot snapshot_[NUM_HEALTH_SIGNALS];
+};
+
+#endif
@@ -13,11 +13,18 @@
 #include <signal.h>
 #include <time.h>
 #include <sys/time.h>
-#include <mutex>
+#include <math.h>
 
-#include "../../LCM/lcmt_process_control.h"
+#include "../../LCM/lcmt_process_status.h"
 #include "../../LCM/lcmt_log_size.h"
 #include "../../LCM/lcmt_stereo_monitor.h"
+#include "../../LCM/lcmt_health_alert.h"
+#include "../../LCM/lcmt_health_status.h"
+#include "../../LCM/lcmt_battery_status.h"
+#include "../../LCM/mav_pose_t.h"
+
+#include "lcmtypes/mav_gps_data_t.h" // from pronto
+#include "lcmtypes/mav_indexed_measurement_t.h" // from pronto
 
 #include <bot_core/bot_core.h>
 #include <bot_param/param_client.h>
@@ -28,21 +35,61 @@
 #include <bot_frames/bot_frames.h>
 
 #include "../../externals/ConciseArgs.hpp"
+#include "../../utils/utils/RealtimeUtils.hpp"
 
-lcm_t * lcm;
+#include "HealthRules.hpp"
 
-std::mutex mux;
+lcm_t * lcm;
 
 
-lcmt_process_control_subscription_t *process_sub;
+lcmt_process_status_subscription_t *process_sub;
 lcmt_log_size_subscription_t *log_size_sub;
 lcmt_stereo_monitor_subscription_t *stereo_monitor_sub;
+mav_pose_t_subscription_t *pose_sub;
+mav_indexed_measurement_t_subscription_t *airspeed_sub;
+mav_gps_data_t_subscription_t *gps_sub;
+lcmt_battery_status_subscription_t *battery_sub;
+
+// checked against the latest values at a fixed rate, see HealthRules.hpp
+const HealthRule health_rules[] = {
+    // name                 signal                  type        min     max     max age (usec)  other signal
+    { "process-status-stale", SIGNAL_PROCESSES_DOWN, RULE_STALE, 0,     0,      3000000 },
+    { "processes-down",     SIGNAL_PROCESSES_DOWN,  RULE_RANGE, 0,      0,      0 },
+    { "process-crashing",   SIGNAL_PROCESS_EXITS,   RULE_RATE,  0,      0,      0 },
+    { "log-size-stale",     SIGNAL_LOG_SIZE,        RULE_STALE, 0,      0,      5000000 },
+    { "log-not-growing",    SIGNAL_LOG_SIZE,        RULE_RATE,  1,      1e12,   0 },
+    { "stereo-stale",       SIGNAL_FRAME_NUMBER,    RULE_STALE, 0,      0,      2000000 },
+    { "stereo-frame-rate",  SIGNAL_FRAME_NUMBER,    RULE_RATE,  5,      1e6,    0 },
+    { "pose-stale",         SIGNAL_POSE_SPEED,      RULE_STALE, 0,      0,      500000 },
+    { "pose-speed",         SIGNAL_POSE_SPEED,      RULE_RANGE, 0,      30,     0 },
+    { "airspeed-stale",     SIGNAL_AIRSPEED,        RULE_STALE, 0,      0,      1000000 },
+    { "airspeed-stuck",     SIGNAL_AIRSPEED,        RULE_STDDEV, 0.1,   1e6,    0 },
+    { "airspeed-gps-mismatch", SIGNAL_AIRSPEED,     RULE_DIFFERENCE, -3.5, 3.5, 1000000,        SIGNAL_GPS_SPEED },
+    { "battery-stale",      SIGNAL_BATTERY_VOLTAGE, RULE_STALE, 0,      0,      5000000 },
+    { "battery-low",        SIGNAL_BATTERY_VOLTAGE, RULE_RANGE, 10.9,   1e6,    0 }
+};
+
+HealthRules rules(health_rules, sizeof(health_rules) / sizeof(health_rules[0]));
+
+std::vector<HealthRuleChange> rule_changes;
+
+std::string alert_channel = "health_alert";
+std::string status_channel = "health_status";
+
+// for lcmt_health_status, filled in once so publishing doesn't allocate
+std::vector<char*> status_names;
+std::vector<int8_t> status_failing;
+std::vector<double> status_values;
+
+int last_video_number = -1;
 
 
 struct StringsOutStruct {
     std::string time;
     std::string logfilesize;
     std::string frame_number;
+    std::string processes;
+    std::string failing;
 };
 
 StringsOutStruct stringsOut;
@@ -52,18 +99,13 @@ StringsOutStruct stringsOut;
 
 void PrintStatus()
 {
-    mux.lock();
-
-    printf("\rTime: %s\tLogfile: %s        Frame #: %s", stringsOut.time.c_str(), stringsOut.logfilesize.c_str(), stringsOut.frame_number.c_str());
+    printf("\rTime: %s\tLogfile: %s        Frame #: %s        Processes: %s        Failing: %s", stringsOut.time.c_str(), stringsOut.logfilesize.c_str(), stringsOut.frame_number.c_str(), stringsOut.processes.c_str(), stringsOut.failing.c_str());
 
     fflush(stdout);
-    mux.unlock();
 }
 
 void UpdateTimestamp(long timestamp)
 {
-     mux.lock();
-
     char tmbuf[64], buf[64];
 
     // figure out what time the plane thinks it is
@@ -75,18 +117,78 @@ void UpdateTimestamp(long timestamp)
 
 
     stringsOut.time = buf;
+}
+
+/**
+ * Checks the rules, publishes an alert for each one that started or stopped
+ * failing, and prints the status line.
+ */
+void EvaluateRules()
+{
+    int64_t now = GetTimestampNow();
+
+    rules.Evaluate(now, &rule_changes);
 
-    mux.unlock();
+    for (const HealthRuleChange &change : rule_changes) {
+        const HealthRule &rule = rules.GetRule(change.rule);
+
+        lcmt_health_alert msg;
+
+        msg.timestamp = now;
+        msg.rule = (char*) rule.name;
+        msg.failing = change.failing;
+        msg.value = change.value;
+        msg.min = rule.min;
+        msg.max = rule.max;
+
+        lcmt_health_alert_publish(lcm, alert_channel.c_str(), &msg);
+
+        printf("\n%s: %s (%g)\n", change.failing ? "FAILING" : "cleared", rule.name, change.value);
+    }
 
+    char buf[50];
+    sprintf(buf, "%d/%d", rules.GetNumFailing(), rules.GetNumRules());
+    stringsOut.failing = buf;
 
+    PrintStatus();
+}
+
+/**
+ * Publishes every rule's state as of the last EvaluateRules(), for the
+ * programs that act on it (like low-battery-warning) and for the logs.
+ */
+void PublishStatus()
+{
+    int num_rules = rules.GetNumRules();
+
+    for (int i = 0; i < num_rules; i++) {
+        status_failing[i] = rules.IsFailing(i);
+        status_values[i] = rules.GetValue(i);
+    }
+
+    lcmt_health_status msg;
+
+    msg.timestamp = GetTimestampNow();
+    msg.num_rules = num_rules;
+    msg.rules = status_names.data();
+    msg.failing = status_failing.data();
+    msg.values = status_values.data();
+    msg.num_failing = rules.GetNumFailing();
+
+    lcmt_health_status_publish(lcm, status_channel.c_str(), &msg);
 }
 
 void sighandler(int dum)
 {
     printf("\nClosing... ");
 
-    lcmt_process_control_unsubscribe(lcm, process_sub);
+    lcmt_process_status_unsubscribe(lcm, process_sub);
     lcmt_log_size_unsubscribe(lcm, log_size_sub);
+    lcmt_stereo_monitor_unsubscribe(lcm, stereo_monitor_sub);
+    mav_pose_t_unsubscribe(lcm, pose_sub);
+    mav_indexed_measurement_t_unsubscribe(lcm, airspeed_sub);
+    mav_gps_data_t_unsubscribe(lcm, gps_sub);
+    lcmt_battery_status_unsubscribe(lcm, battery_sub);
     lcm_destroy (lcm);
 
     printf("done.\n");
@@ -94,59 +196,88 @@ void sighandler(int dum)
     exit(0);
 }
 
-int64_t getTimestampNow()
+void process_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_process_status *msg, void *user)
 {
-    struct timeval thisTime;
-    gettimeofday(&thisTime, NULL);
-    return (thisTime.tv_sec * 1000000.0) + (float)thisTime.tv_usec + 0.5;
-}
+    int num_running = 0;
+    int num_exits = 0;
+
+    for (int i = 0; i < msg->num_processes; i++) {
+        if (msg->running[i]) {
+            num_running ++;
+        }
+        num_exits += msg->num_exits[i];
+    }
 
-void process_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_process_control *msg, void *user)
-{
-   UpdateTimestamp(msg->timestamp);
-   PrintStatus();
+    char buf[500];
+
+    sprintf(buf, "%d/%d up, %d crashed", num_running, msg->num_processes, num_exits);
+    stringsOut.processes = buf;
+
+    rules.Set(SIGNAL_PROCESSES_DOWN, rbuf->recv_utime, msg->num_processes - num_running);
+    rules.Set(SIGNAL_PROCESS_EXITS, rbuf->recv_utime, num_exits);
+
+    UpdateTimestamp(msg->timestamp);
 }
 
 
 void log_size_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_log_size *msg, void *user)
 {
-
-    mux.lock();
-
     char buf[500];
 
     // got a log size message, display it
     sprintf(buf, "#%d, %010d", msg->log_number, msg->log_size);
     stringsOut.logfilesize = buf;
 
-
-
-    mux.unlock();
+    rules.Set(SIGNAL_LOG_SIZE, rbuf->recv_utime, msg->log_size);
 
     UpdateTimestamp(msg->timestamp);
-
-
-    PrintStatus();
 }
 
 void stereo_monitor_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo_monitor *msg, void *user)
 {
-
-    mux.lock();
-
     char buf[500];
 
-    // got a log size message, display it
+    // got a stereo monitor message, display it
     sprintf(buf, "%05d", msg->frame_number);
     stringsOut.frame_number = buf;
 
+    if (msg->video_number != last_video_number) {
+        // frame numbers start over with a new video, so don't take a rate
+        // across it
+        rules.Set(SIGNAL_FRAME_NUMBER, rbuf->recv_utime, msg->frame_number);
+        last_video_number = msg->video_number;
+    }
 
-
-    mux.unlock();
+    rules.Set(SIGNAL_FRAME_NUMBER, rbuf->recv_utime, msg->frame_number);
 
     UpdateTimestamp(msg->timestamp);
+}
 
-    PrintStatus();
+void pose_handler(const lcm_recv_buf_t *rbuf, const char* channel, const mav_pose_t *msg, void *user)
+{
+    // this one is fast, so it only stores the speed for the rules
+    double speed = sqrt(msg->vel[0] * msg->vel[0] + msg->vel[1] * msg->vel[1] + msg->vel[2] * msg->vel[2]);
+
+    rules.Set(SIGNAL_POSE_SPEED, rbuf->recv_utime, speed);
+}
+
+void airspeed_handler(const lcm_recv_buf_t *rbuf, const char* channel, const mav_indexed_measurement_t *msg, void *user)
+{
+    rules.Set(SIGNAL_AIRSPEED, rbuf->recv_utime, msg->z_effective[0]);
+}
+
+void gps_handler(const lcm_recv_buf_t *rbuf, const char* channel, const mav_gps_data_t *msg, void *user)
+{
+    // without a 3D fix the speed means nothing, and letting it go stale
+    // turns off the checks against it
+    if (msg->gps_lock >= 3) {
+        rules.Set(SIGNAL_GPS_SPEED, rbuf->recv_utime, msg->speed);
+    }
+}
+
+void battery_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_battery_status *msg, void *user)
+{
+    rules.Set(SIGNAL_BATTERY_VOLTAGE, rbuf->recv_utime, msg->voltage);
 }
 
 
@@ -154,19 +285,54 @@ int main(int argc,char** argv)
 {
     stringsOut.time = "-------------------";
     stringsOut.logfilesize = "---";
+    stringsOut.processes = "---";
+    stringsOut.failing = "---";
     std::string channel_process_str = "process_status";
     std::string channel_log_size_str = "log_size";
     std::string channel_stereo_monitor_str = "stereo_monitor";
+    std::string channel_pose_str = "STATE_ESTIMATOR_POSE";
+    std::string channel_airspeed_str = "airspeed-unchecked";
+    std::string channel_gps_str = "gps";
+    std::string channel_battery_str = "battery-status";
+    double rate_hz = 10;
+    double status_rate_hz = 1;
 
     ConciseArgs parser(argc, argv);
     parser.add(channel_process_str, "p", "process-control-channel",
-        "LCM channel for process control");
+        "LCM channel for process status");
     parser.add(channel_log_size_str, "l", "log-size-channel",
         "LCM channel for log size");
     parser.add(channel_stereo_monitor_str, "s", "stereo-monitor",
         "LCM channel for stereo-monitor");
+    parser.add(channel_pose_str, "e", "pose-channel",
+        "LCM channel for the state estimator's pose");
+    parser.add(channel_airspeed_str, "i", "airspeed-channel",
+        "LCM channel for the raw airspeed (before airspeed-check)");
+    parser.add(channel_gps_str, "g", "gps-channel",
+        "LCM channel for GPS");
+    parser.add(channel_battery_str, "b", "battery-channel",
+        "LCM channel for battery status");
+    parser.add(alert_channel, "a", "alert-channel",
+        "LCM channel to publish alerts on when a rule starts or stops failing");
+    parser.add(status_channel, "t", "status-channel",
+        "LCM channel to publish every rule's state on");
+    parser.add(rate_hz, "r", "rate",
+        "Rate to check the rules at (Hz)");
+    parser.add(status_rate_hz, "R", "status-rate",
+        "Rate to publish the rules' state at (Hz)");
     parser.parse();
 
+    if (rate_hz <= 0 || status_rate_hz <= 0) {
+        fprintf(stderr, "error: rates must be positive.\n");
+        return 1;
+    }
+
+    for (int i = 0; i < rules.GetNumRules(); i++) {
+        status_names.push_back((char*) rules.GetRule(i).name);
+    }
+    status_failing.resize(rules.GetNumRules());
+    status_values.resize(rules.GetNumRules());
+
     lcm = lcm_create ("udpm://239.255.76.67:7667?ttl=0");
     if (!lcm)
     {
@@ -179,23 +345,65 @@ int main(int argc,char** argv)
     signal(SIGINT,sighandler);
 
 
-    process_sub = lcmt_process_control_subscribe(lcm,
+    process_sub = lcmt_process_status_subscribe(lcm,
         channel_process_str.c_str(), &process_handler, NULL);
     log_size_sub = lcmt_log_size_subscribe(lcm,
         channel_log_size_str.c_str(), &log_size_handler, NULL);
     stereo_monitor_sub = lcmt_stereo_monitor_subscribe(lcm,
         channel_stereo_monitor_str.c_str(), &stereo_monitor_handler, NULL);
+    pose_sub = mav_pose_t_subscribe(lcm,
+        channel_pose_str.c_str(), &pose_handler, NULL);
+    airspeed_sub = mav_indexed_measurement_t_subscribe(lcm,
+        channel_airspeed_str.c_str(), &airspeed_handler, NULL);
+    gps_sub = mav_gps_data_t_subscribe(lcm,
+        channel_gps_str.c_str(), &gps_handler, NULL);
+    battery_sub = lcmt_battery_status_subscribe(lcm,
+        channel_battery_str.c_str(), &battery_handler, NULL);
 
 
-    printf("Receiving:\n\t%s\n\t%s\n\t%s\n--------------------------------------\n",
-        channel_process_str.c_str(), channel_log_size_str.c_str(), channel_stereo_monitor_str.c_str());
+    printf("Receiving:\n\t%s\n\t%s\n\t%s\n\t%s\n\t%s\n\t%s\n\t%s\nPublishing:\n\tAlerts: %s\n\tStatus: %s\n--------------------------------------\n",
+        channel_process_str.c_str(), channel_log_size_str.c_str(), channel_stereo_monitor_str.c_str(),
+        channel_pose_str.c_str(), channel_airspeed_str.c_str(), channel_gps_str.c_str(),
+        channel_battery_str.c_str(), alert_channel.c_str(), status_channel.c_str());
 
     PrintStatus();
 
+    LcmReactor reactor(lcm);
+
+    int64_t period_usec = 1000000 / rate_hz;
+    int64_t next_tick = GetMonotonicNow() + period_usec;
+
+    int64_t status_period_usec = 1000000 / status_rate_hz;
+    int64_t next_status = GetMonotonicNow() + status_period_usec;
+
     while (true)
     {
-        // read the LCM channel
-        lcm_handle (lcm);
+        int64_t now = GetMonotonicNow();
+
+        if (now >= next_tick) {
+            EvaluateRules();
+
+            next_tick += period_usec;
+
+            if (next_tick < now) {
+                next_tick = now + period_usec;
+            }
+        }
+
+        if (now >= next_status) {
+            PublishStatus();
+
+            next_status += status_period_usec;
+
+            if (next_status < now) {
+                next_status = now + status_period_usec;
+            }
+        }
+
+        int64_t wake = next_tick < next_status ? next_tick : next_status;
+
+        // handlers only update the snapshot, the rules run on the tick
+        reactor.WaitAndHandle((wake - now) / 1000 + 1);
     }
 
     return 0;
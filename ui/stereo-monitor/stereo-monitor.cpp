@@ -37,6 +37,7 @@ using namespace std;
 #include <bot_frames/bot_frames.h>
 
 #include "../../externals/ConciseArgs.hpp"
+#include "../../utils/utils/Clock.hpp"
    
    
 
@@ -68,13 +69,6 @@ void sighandler(int dum)
     exit(0);
 }
 
-int64_t getTimestampNow()
-{
-    struct timeval thisTime;
-    gettimeofday(&thisTime, NULL);
-    return (thisTime.tv_sec * 1000000.0) + (float)thisTime.tv_usec + 0.5;
-}
-
 void stereo_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo *msg, void *user)
 {
     // republish every N stereo messages
@@ -86,7 +80,7 @@ void stereo_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_
         
         // send a message
         lcmt_stereo_monitor monitor_msg;
-        monitor_msg.timestamp = getTimestampNow();
+        monitor_msg.timestamp = GetWallNow();
         
         monitor_msg.video_number = msg->video_number;
         monitor_msg.frame_number = msg->frame_number;
@@ -116,7 +110,7 @@ void stereo_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_
     }
     
     lcmt_beep beep_msg;
-    beep_msg.timestamp = getTimestampNow();
+    beep_msg.timestamp = GetWallNow();
     beep_msg.beep = beep;
     
     lcmt_beep_publish(lcm, beep_channel, &beep_msg);
@@ -1,5 +1,25 @@
 /*
- * Converts old stereo type to new stereo type.
+ * Converts old stereo types (lcmt_stereo_old2, lcmt_stereo_old and
+ * lcmt_stereo_reprojected) to the current lcmt_stereo.
+ *
+ * Live, it republishes a log being played back.  With -i and -o it
+ * converts a log file directly instead: the log is read through its index
+ * (see LogIndex.hpp) in chunks of CONVERTER_CHUNK_EVENTS events, each
+ * chunk is converted on several threads, and the chunks are written out in
+ * order with everything else in the log as it was.  A whole archive goes
+ * as fast as the disk does:
+ *
+ *   for log in lcmlog-*; do
+ *       ./stereo-type-converter -i $log -o new/$log stereo-old stereo
+ *   done
+ *
+ * Messages without frame numbers (old and reprojected) are numbered in
+ * the order they came.  Video numbers start over each time the frame
+ * number goes down, like they do on the aircraft.
+ *
+ * Reprojected messages only have pixels and a depth, so they're turned
+ * back into points with the left camera's calibration, the inverse of
+ * what video-data-projector did to them.
  *
  * Author: Andrew Barry, <abarry@csail.mit.edu> 2013
  *
@@ -14,99 +34,476 @@
 #include <time.h>
 #include <sys/time.h>
 #include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
 
+#include <lcm/lcm.h>
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/core_c.h>
+#include <opencv2/imgproc/imgproc.hpp>
 
 #include "../../LCM/lcmt_stereo.h"
+#include "../../LCM/lcmt_stereo_old.h"
 #include "../../LCM/lcmt_stereo_old2.h"
+#include "../../LCM/lcmt_stereo_reprojected.h"
+#include "../../externals/ConciseArgs.hpp"
+#include "../../utils/utils/Clock.hpp"
+#include "../../utils/LogIndex/LogIndex.hpp"
 
+// log events converted at once
+#define CONVERTER_CHUNK_EVENTS 4096
 
 using namespace std;
 
+enum OldStereoType { STEREO_OLD2, STEREO_OLD, STEREO_REPROJECTED };
+
+// a converted message, with the arrays it points to
+struct ConvertedStereo {
+    lcmt_stereo msg;
+    vector<float> x, y, z;
+};
+
+OldStereoType old_type = STEREO_OLD2;
+
+// the left camera, for reprojected messages
+cv::Mat cam_mat_l, d_mat_l;
+
 int g_v_number = 0;
 int last_frame_number = 0;
 
 lcm_t * lcm;
 
-lcmt_stereo_old2_subscription_t * stereo_old2_sub;
+void *old_sub = NULL;
 
 char *channelStereo = NULL;
 
 int numFrames = 0;
 
 
-static void usage(void)
-{
-        fprintf(stderr, "usage: stereo-type-converter stereo-old-channel stereo-new-channel\n");
-        fprintf(stderr, "    ./stereo-type-converter stereo-old stereo\n");
-}
-
-
 void sighandler(int dum)
 {
     printf("\nClosing... ");
 
-    lcmt_stereo_old2_unsubscribe(lcm, stereo_old2_sub);
-    
+    switch (old_type) {
+        case STEREO_OLD2:
+            lcmt_stereo_old2_unsubscribe(lcm, (lcmt_stereo_old2_subscription_t*)old_sub);
+            break;
+        case STEREO_OLD:
+            lcmt_stereo_old_unsubscribe(lcm, (lcmt_stereo_old_subscription_t*)old_sub);
+            break;
+        case STEREO_REPROJECTED:
+            lcmt_stereo_reprojected_unsubscribe(lcm, (lcmt_stereo_reprojected_subscription_t*)old_sub);
+            break;
+    }
+
     lcm_destroy (lcm);
-    
+
     printf("done.\n");
-    
+
     exit(0);
 }
 
-int64_t getTimestampNow()
+// video number for the next frame, counting the times the frame number
+// went down
+int NextVideoNumber(int frame_number, int *video_number, int *last_frame)
 {
-    struct timeval thisTime;
-    gettimeofday(&thisTime, NULL);
-    return (thisTime.tv_sec * 1000000.0) + (float)thisTime.tv_usec + 0.5;
+    if (frame_number < *last_frame) {
+        (*video_number) ++;
+    }
+
+    *last_frame = frame_number;
+    return *video_number;
 }
 
+/**
+ * Converts an old message.  The new one's arrays point into the old one's
+ * or into out's, so it's only good as long as both are.
+ *
+ * @param msg lcmt_stereo_old2, lcmt_stereo_old or lcmt_stereo_reprojected,
+ *      by type
+ * @param type what msg is
+ * @param frame_number frame number for types that don't have one
+ * @param out (output) the new message
+ */
+void ConvertStereo(const void *msg, OldStereoType type, int frame_number, ConvertedStereo *out)
+{
+    lcmt_stereo &new_msg = out->msg;
 
-void stereo_old2_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo_old2 *msg, void *user)
+    if (type == STEREO_OLD2) {
+        const lcmt_stereo_old2 *old2 = (const lcmt_stereo_old2*)msg;
+
+        new_msg.timestamp = old2->timestamp;
+        new_msg.number_of_points = old2->number_of_points;
+        new_msg.frame_number = old2->frame_number;
+
+        new_msg.x = old2->x;
+        new_msg.y = old2->y;
+        new_msg.z = old2->z;
+        new_msg.grey = old2->grey;
+
+    } else if (type == STEREO_OLD) {
+        const lcmt_stereo_old *old = (const lcmt_stereo_old*)msg;
+
+        new_msg.timestamp = old->timestamp;
+        new_msg.number_of_points = old->number_of_points;
+        new_msg.frame_number = frame_number;
+
+        new_msg.x = old->x;
+        new_msg.y = old->y;
+        new_msg.z = old->z;
+        new_msg.grey = old->grey;
+
+    } else {
+        const lcmt_stereo_reprojected *reprojected = (const lcmt_stereo_reprojected*)msg;
+        int num_points = reprojected->number_of_points;
+
+        new_msg.timestamp = reprojected->timestamp;
+        new_msg.number_of_points = num_points;
+        new_msg.frame_number = frame_number;
+
+        out->x.resize(num_points);
+        out->y.resize(num_points);
+        out->z.resize(num_points);
+
+        if (num_points > 0) {
+            vector<cv::Point2f> pixels(num_points), normalized;
+
+            for (int i = 0; i < num_points; i++) {
+                pixels[i] = cv::Point2f(reprojected->x[i], reprojected->y[i]);
+            }
+
+            cv::undistortPoints(pixels, normalized, cam_mat_l, d_mat_l);
+
+            for (int i = 0; i < num_points; i++) {
+                // video-data-projector wrote depth = -z / 10
+                float z = -10 * reprojected->depth[i];
+
+                out->x[i] = normalized[i].x * z;
+                out->y[i] = normalized[i].y * z;
+                out->z[i] = z;
+            }
+        }
+
+        new_msg.x = out->x.data();
+        new_msg.y = out->y.data();
+        new_msg.z = out->z.data();
+        new_msg.grey = reprojected->grey;
+    }
+}
+
+void PublishConverted(const void *msg)
 {
-    // republish messages
-    // make a new message
-    lcmt_stereo newMsg;
-    
-    newMsg.timestamp = msg->timestamp;
-    newMsg.number_of_points = msg->number_of_points;
-    
-    newMsg.x = msg->x;
-    newMsg.y = msg->y;
-    newMsg.z = msg->z;
-    
-    newMsg.grey = msg->grey;
-    
-    newMsg.frame_number = msg->frame_number;
-    
-    // figure out the video number
-    if (msg->frame_number < last_frame_number) {
-        g_v_number ++;
-    }
-    
-    last_frame_number = msg->frame_number;
-    newMsg.video_number = g_v_number;
-    
+    ConvertedStereo converted;
+    ConvertStereo(msg, old_type, numFrames, &converted);
+
+    converted.msg.video_number = NextVideoNumber(converted.msg.frame_number, &g_v_number, &last_frame_number);
+
     // send the message
-    lcmt_stereo_publish(lcm, channelStereo, &newMsg);
-    
+    lcmt_stereo_publish(lcm, channelStereo, &converted.msg);
+
     // update frame number
     numFrames ++;
 }
 
+void stereo_old2_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo_old2 *msg, void *user)
+{
+    PublishConverted(msg);
+}
+
+void stereo_old_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo_old *msg, void *user)
+{
+    PublishConverted(msg);
+}
+
+void stereo_reprojected_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_stereo_reprojected *msg, void *user)
+{
+    PublishConverted(msg);
+}
+
+/**
+ * Decodes an old message, converts it and encodes the new one.
+ *
+ * @retval false if it didn't decode
+ */
+bool ConvertEncoded(const uint8_t *data, int data_size, int frame_number, int video_number, vector<uint8_t> *encoded)
+{
+    // only the one for the type gets used
+    lcmt_stereo_old2 old2;
+    lcmt_stereo_old old;
+    lcmt_stereo_reprojected reprojected;
+
+    void *msg;
+    int status;
+
+    switch (old_type) {
+        case STEREO_OLD2:
+            status = lcmt_stereo_old2_decode(data, 0, data_size, &old2);
+            msg = &old2;
+            break;
+        case STEREO_OLD:
+            status = lcmt_stereo_old_decode(data, 0, data_size, &old);
+            msg = &old;
+            break;
+        default:
+            status = lcmt_stereo_reprojected_decode(data, 0, data_size, &reprojected);
+            msg = &reprojected;
+            break;
+    }
+
+    if (status < 0) {
+        return false;
+    }
+
+    ConvertedStereo converted;
+    ConvertStereo(msg, old_type, frame_number, &converted);
+    converted.msg.video_number = video_number;
+
+    encoded->resize(lcmt_stereo_encoded_size(&converted.msg));
+    bool ok = lcmt_stereo_encode(encoded->data(), 0, encoded->size(), &converted.msg) >= 0;
+
+    switch (old_type) {
+        case STEREO_OLD2:
+            lcmt_stereo_old2_decode_cleanup(&old2);
+            break;
+        case STEREO_OLD:
+            lcmt_stereo_old_decode_cleanup(&old);
+            break;
+        default:
+            lcmt_stereo_reprojected_decode_cleanup(&reprojected);
+            break;
+    }
+
+    return ok;
+}
+
+/**
+ * Writes a copy of a log with the old stereo messages converted.
+ *
+ * @param input_log log to read (indexed if it isn't already)
+ * @param output_log log to write
+ * @param channel_old channel with the old messages
+ * @param channel_new channel to write the new ones on
+ * @param num_threads threads to convert on
+ *
+ * @retval false if the logs couldn't be read or written
+ */
+bool ConvertLog(const string &input_log, const string &output_log, const string &channel_old, const string &channel_new,
+    int num_threads)
+{
+    int64_t start_time = GetRawMonotonicNow();
+
+    LogIndex index;
+
+    if (!index.Open(input_log)) {
+        fprintf(stderr, "Error: could not index %s\n", input_log.c_str());
+        return false;
+    }
+
+    int old_channel = index.GetChannel(channel_old);
+
+    if (old_channel < 0) {
+        fprintf(stderr, "Warning: no %s messages in %s, copying it as it is.\n", channel_old.c_str(), input_log.c_str());
+    }
+
+    // which of the old messages each event is, for the frame and video
+    // numbers
+    vector<int> message_number(index.GetNumEvents(), -1);
+    vector<int> frame_numbers, video_numbers;
+
+    if (old_channel >= 0) {
+        const vector<size_t> &channel_events = index.GetChannelEvents(old_channel);
+
+        for (size_t i = 0; i < channel_events.size(); i++) {
+            message_number[channel_events[i]] = i;
+        }
+
+        frame_numbers.resize(channel_events.size());
+
+        for (size_t i = 0; i < frame_numbers.size(); i++) {
+            frame_numbers[i] = i;
+        }
+
+        if (old_type == STEREO_OLD2) {
+            index.ForEachEvent(channel_old, INT64_MIN, INT64_MAX,
+                [&frame_numbers](size_t i, const LogIndexEvent &event, const uint8_t *data) {
+                    lcmt_stereo_old2 msg;
+
+                    if (lcmt_stereo_old2_decode(data, 0, event.data_size, &msg) < 0) {
+                        return false;
+                    }
+
+                    frame_numbers[i] = msg.frame_number;
+                    lcmt_stereo_old2_decode_cleanup(&msg);
+                    return true;
+                }, num_threads);
+        }
+
+        // in order, since each depends on the one before
+        int video_number = 0, last_frame = 0;
+        video_numbers.resize(frame_numbers.size());
+
+        for (size_t i = 0; i < frame_numbers.size(); i++) {
+            video_numbers[i] = NextVideoNumber(frame_numbers[i], &video_number, &last_frame);
+        }
+    }
+
+    lcm_eventlog_t *out = lcm_eventlog_create(output_log.c_str(), "w");
+
+    if (out == NULL) {
+        fprintf(stderr, "Error: could not open %s for writing.\n", output_log.c_str());
+        return false;
+    }
+
+    size_t num_events = index.GetNumEvents();
+
+    vector<vector<uint8_t>> chunk(CONVERTER_CHUNK_EVENTS);
+    // not vector<bool>, since the threads set them at once
+    vector<uint8_t> converted(CONVERTER_CHUNK_EVENTS);
+
+    atomic<int> num_failed(0);
+    int num_converted = 0;
+    bool ok = true;
+
+    for (size_t chunk_start = 0; chunk_start < num_events && ok; chunk_start += CONVERTER_CHUNK_EVENTS) {
+        size_t chunk_size = min((size_t)CONVERTER_CHUNK_EVENTS, num_events - chunk_start);
+
+        atomic<size_t> next(0);
+
+        auto worker = [&]() {
+            vector<uint8_t> data;
+
+            for (size_t i = next++; i < chunk_size; i = next++) {
+                size_t event = chunk_start + i;
+                int number = message_number[event];
+
+                converted[i] = false;
+
+                if (!index.ReadEvent(event, number >= 0 ? &data : &chunk[i])) {
+                    chunk[i].clear();
+                    num_failed ++;
+                } else if (number >= 0) {
+                    if (ConvertEncoded(data.data(), data.size(), frame_numbers[number], video_numbers[number], &chunk[i])) {
+                        converted[i] = true;
+                    } else {
+                        // leave it as it was
+                        chunk[i] = data;
+                        num_failed ++;
+                    }
+                }
+            }
+        };
+
+        vector<thread> threads;
+
+        for (int i = 1; i < num_threads; i++) {
+            threads.push_back(thread(worker));
+        }
+
+        worker();
+
+        for (size_t i = 0; i < threads.size(); i++) {
+            threads[i].join();
+        }
+
+        for (size_t i = 0; i < chunk_size && ok; i++) {
+            const LogIndexEvent &event = index.GetEvent(chunk_start + i);
+            const string &channel = converted[i] ? channel_new : index.GetChannelName(event.channel);
+
+            lcm_eventlog_event_t log_event;
+            log_event.timestamp = event.timestamp;
+            log_event.channellen = channel.length();
+            log_event.channel = (char*)channel.c_str();
+            log_event.datalen = chunk[i].size();
+            log_event.data = chunk[i].data();
+
+            if (lcm_eventlog_write_event(out, &log_event) != 0) {
+                fprintf(stderr, "Error: failed to write to %s\n", output_log.c_str());
+                ok = false;
+            }
+
+            if (converted[i]) {
+                num_converted ++;
+            }
+        }
+    }
+
+    lcm_eventlog_destroy(out);
+
+    if (num_failed > 0) {
+        fprintf(stderr, "Warning: %d events in %s didn't read or convert, and were copied as they were (or left out).\n",
+            num_failed.load(), input_log.c_str());
+    }
+
+    printf("%s -> %s: converted %d of %lld events in %.2f sec.\n", input_log.c_str(), output_log.c_str(), num_converted,
+        (long long)num_events, (GetRawMonotonicNow() - start_time) / 1000000.0);
+
+    return ok;
+}
+
+bool LoadCalibration(const string &calib_dir)
+{
+    CvMat *m1 = (CvMat *)cvLoad((calib_dir + "/M1.xml").c_str(), NULL, NULL, NULL);
+    CvMat *d1 = (CvMat *)cvLoad((calib_dir + "/D1.xml").c_str(), NULL, NULL, NULL);
+
+    if (m1 == NULL || d1 == NULL) {
+        fprintf(stderr, "Error: could not load the left camera's calibration from %s\n", calib_dir.c_str());
+        return false;
+    }
+
+    cam_mat_l = cv::Mat(m1, true);
+    d_mat_l = cv::Mat(d1, true);
+
+    cvReleaseMat(&m1);
+    cvReleaseMat(&d1);
+
+    return true;
+}
 
 int main(int argc,char** argv)
 {
-    char *channelStereoOld = NULL;
-    
-    if (argc!=3) {
-        usage();
-        exit(0);
+    string channelStereoOldStr, channelStereoStr;
+    string type_str = "old2";
+    string input_log = "", output_log = "";
+    string calib_dir = "../../sensors/stereo/calib";
+    int num_threads = LOG_INDEX_DEFAULT_THREADS;
+
+    ConciseArgs parser(argc, argv, "stereo-old-channel stereo-new-channel",
+        "example: ./stereo-type-converter stereo-old stereo");
+    parser.add(type_str, "t", "type", "Old type: old2 (lcmt_stereo_old2), old (lcmt_stereo_old) or reprojected (lcmt_stereo_reprojected).");
+    parser.add(input_log, "i", "input", "Convert this log file instead of listening to LCM (needs --output).");
+    parser.add(output_log, "o", "output", "Log file to write the converted log to.");
+    parser.add(num_threads, "j", "threads", "Threads to convert a log file on.");
+    parser.add(calib_dir, "c", "calib-dir", "Directory with the left camera's calibration (M1.xml and D1.xml), for reprojected messages.");
+    parser.parse(channelStereoOldStr, channelStereoStr);
+
+    if (type_str == "old2") {
+        old_type = STEREO_OLD2;
+    } else if (type_str == "old") {
+        old_type = STEREO_OLD;
+    } else if (type_str == "reprojected") {
+        old_type = STEREO_REPROJECTED;
+    } else {
+        fprintf(stderr, "Error: unknown type \"%s\".\n", type_str.c_str());
+        return 1;
+    }
+
+    if (old_type == STEREO_REPROJECTED && !LoadCalibration(calib_dir)) {
+        return 1;
+    }
+
+    if (input_log.length() > 0 || output_log.length() > 0) {
+        if (input_log.length() == 0 || output_log.length() == 0) {
+            fprintf(stderr, "Error: converting a log file needs both --input and --output.\n");
+            return 1;
+        }
+
+        return ConvertLog(input_log, output_log, channelStereoOldStr, channelStereoStr, max(1, num_threads)) ? 0 : 1;
     }
 
-    channelStereoOld = argv[1];
-    channelStereo = argv[2];
-    
+    char *channelStereoOld = (char*)channelStereoOldStr.c_str();
+    channelStereo = (char*)channelStereoStr.c_str();
+
     lcm = lcm_create ("udpm://239.255.76.67:7667?ttl=0");
     if (!lcm)
     {
@@ -114,12 +511,22 @@ int main(int argc,char** argv)
         return 1;
     }
 
-    stereo_old2_sub = lcmt_stereo_old2_subscribe (lcm, channelStereoOld, &stereo_old2_handler, NULL);
+    switch (old_type) {
+        case STEREO_OLD2:
+            old_sub = lcmt_stereo_old2_subscribe (lcm, channelStereoOld, &stereo_old2_handler, NULL);
+            break;
+        case STEREO_OLD:
+            old_sub = lcmt_stereo_old_subscribe (lcm, channelStereoOld, &stereo_old_handler, NULL);
+            break;
+        case STEREO_REPROJECTED:
+            old_sub = lcmt_stereo_reprojected_subscribe (lcm, channelStereoOld, &stereo_reprojected_handler, NULL);
+            break;
+    }
 
     signal(SIGINT,sighandler);
 
-    printf("Reading:\nStereo old: %s\nWriting:\n\tStereo: %s\n", channelStereoOld, channelStereo);
-    
+    printf("Reading:\n\tStereo old (%s): %s\nWriting:\n\tStereo: %s\n", type_str.c_str(), channelStereoOld, channelStereo);
+
     while (true)
     {
         // read the LCM channel
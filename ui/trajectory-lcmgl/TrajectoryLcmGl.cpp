@@ -6,6 +6,99 @@ TrajectoryLcmGl::TrajectoryLcmGl(lcm::LCM *lcm, const TrajectoryLibrary *trajlib
     trajlib_ = trajlib;
     BotParam *param = bot_param_new_from_server(lcm_->getUnderlyingLCM(), 0);
     bot_frames_ = bot_frames_new(lcm_->getUnderlyingLCM(), param);
+
+    geometry_.resize(trajlib_->GetNumberTrajectories());
+
+    for (int i = 0; i < trajlib_->GetNumberTrajectories(); i++) {
+        CacheGeometry(*trajlib_->GetTrajectoryByNumber(i), &geometry_[i]);
+    }
+}
+
+/**
+ * Samples a trajectory the way Trajectory::Draw() does.
+ *
+ * @param traj trajectory to sample
+ * @param geometry (output) its samples
+ */
+void TrajectoryLcmGl::CacheGeometry(const Trajectory &traj, TrajectoryGeometry *geometry) {
+    Eigen::Vector3d unit_z;
+    unit_z << 0, 0, 1;
+
+    BotTrans identity;
+    bot_trans_set_identity(&identity);
+
+    double final_time = traj.GetMaxTime();
+
+    // the same sums as Draw(), so the same samples
+    double t = 0;
+    int sample = 0;
+
+    while (t < final_time) {
+        double xyz[3];
+        traj.GetXyzYawTransformedPoint(t, identity, xyz);
+
+        geometry->times.push_back(t);
+        geometry->x.push_back(xyz[0]);
+        geometry->y.push_back(xyz[1]);
+        geometry->z.push_back(xyz[2]);
+
+        if (sample % 2 == 0) {
+            Eigen::VectorXd state = traj.GetState(t);
+            Eigen::Vector3d rpy;
+            rpy << -state(3), state(4), state(5); // HACK?, like Draw()
+            Eigen::Vector3d rot_z = rpy2rotmat(rpy) * unit_z;
+
+            geometry->roll_offsets.push_back(rot_z(0));
+            geometry->roll_offsets.push_back(rot_z(1));
+            geometry->roll_offsets.push_back(rot_z(2));
+        }
+
+        t += traj.GetDT();
+        sample ++;
+    }
+}
+
+/**
+ * Draws a trajectory's first samples, already transformed: the origin, the
+ * path, its knot points and the roll lines, one batch each.
+ *
+ * @param lcmgl LCMGL to draw on
+ * @param geometry the trajectory's cached geometry
+ * @param xyz its transformed samples, x, y, z each
+ * @param num_samples samples to draw, for trimming
+ */
+void TrajectoryLcmGl::DrawCached(bot_lcmgl_t *lcmgl, const TrajectoryGeometry &geometry, const double *xyz, int num_samples) const {
+    bot_lcmgl_color3f(lcmgl, 0, 0, 1);
+
+    if (num_samples > 0) {
+        float origin_size[3] = { .25, .25, .25 };
+        bot_lcmgl_box(lcmgl, xyz, origin_size);
+    }
+
+    bot_lcmgl_line_width(lcmgl, 2.0f);
+
+    bot_lcmgl_begin(lcmgl, GL_LINE_STRIP);
+    for (int i = 0; i < num_samples; i++) {
+        bot_lcmgl_vertex3f(lcmgl, xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2]);
+    }
+    bot_lcmgl_end(lcmgl);
+
+    bot_lcmgl_point_size(lcmgl, 6.0f);
+
+    bot_lcmgl_begin(lcmgl, GL_POINTS);
+    for (int i = 0; i < num_samples; i++) {
+        bot_lcmgl_vertex3f(lcmgl, xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2]);
+    }
+    bot_lcmgl_end(lcmgl);
+
+    bot_lcmgl_begin(lcmgl, GL_LINES);
+    for (int i = 0; i < num_samples; i += 2) {
+        const double *offset = &geometry.roll_offsets[3 * (i / 2)];
+
+        bot_lcmgl_vertex3f(lcmgl, xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2]);
+        bot_lcmgl_vertex3f(lcmgl, xyz[3 * i] + offset[0], xyz[3 * i + 1] + offset[1], xyz[3 * i + 2] + offset[2]);
+    }
+    bot_lcmgl_end(lcmgl);
 }
 
 void TrajectoryLcmGl::ProcessTrajectoryMsg(const lcm::ReceiveBuffer *rbus, const std::string &chan, const lcmt::tvlqr_controller_action *msg) {
@@ -15,14 +108,27 @@ void TrajectoryLcmGl::ProcessTrajectoryMsg(const lcm::ReceiveBuffer *rbus, const
 void TrajectoryLcmGl::DrawTrajectoryLcmGl(int traj_number, int64_t timestamp) {
     std::cout << "Drawing t=" << timestamp << std::endl;
 
-    if (!last_traj_name_.empty() && timestamp > last_traj_timestamp_) {
-        // redraw the old trajectory to remove anything that we didn't actually execute
-        bot_lcmgl_t *lcmgl = bot_lcmgl_init(lcm_->getUnderlyingLCM(), last_traj_name_.c_str());
-        bot_lcmgl_color3f(lcmgl, 0, 0, 1);
+    if (traj_number < 0 || traj_number >= (int)geometry_.size()) {
+        std::cerr << "WARNING: trajectory #" << traj_number << " is not in the library, not drawing it." << std::endl;
+        return;
+    }
+
+    if (last_lcmgl_ != nullptr) {
+        if (timestamp > last_traj_timestamp_) {
+            // redraw the old trajectory to remove anything that we didn't
+            // actually execute: the samples before now, already transformed
+            const TrajectoryGeometry &last_geometry = geometry_[last_traj_->GetTrajectoryNumber()];
+            double final_time = ConvertTimestampToSeconds(timestamp - last_traj_timestamp_);
+
+            int num_samples = std::lower_bound(last_geometry.times.begin(), last_geometry.times.end(), final_time)
+                - last_geometry.times.begin();
 
-        last_traj_->Draw(lcmgl, &last_draw_transform_, ConvertTimestampToSeconds(timestamp - last_traj_timestamp_));
-        bot_lcmgl_switch_buffer(lcmgl);
-        bot_lcmgl_destroy(lcmgl);
+            DrawCached(last_lcmgl_, last_geometry, last_xyz_.data(), num_samples);
+            bot_lcmgl_switch_buffer(last_lcmgl_);
+        }
+
+        bot_lcmgl_destroy(last_lcmgl_);
+        last_lcmgl_ = nullptr;
     }
 
     // draw the trajectory via lcmgl
@@ -30,16 +136,21 @@ void TrajectoryLcmGl::DrawTrajectoryLcmGl(int traj_number, int64_t timestamp) {
     BotTrans body_to_local;
     bot_frames_get_trans(bot_frames_, "body", "local", &body_to_local);
 
+    const Trajectory *traj = trajlib_->GetTrajectoryByNumber(traj_number);
+    const TrajectoryGeometry &geometry = geometry_[traj_number];
+
+    int num_samples = geometry.times.size();
+    last_xyz_.resize(3 * num_samples);
+
+    Trajectory::TransformXyzYaw(body_to_local, geometry.x.data(), geometry.y.data(), geometry.z.data(), num_samples, last_xyz_.data());
+
+    // kept for trimming it when the next one comes
     bot_lcmgl_t *lcmgl = bot_lcmgl_init(lcm_->getUnderlyingLCM(), name.c_str());
-    bot_lcmgl_color3f(lcmgl, 0, 0, 1);
 
-    const Trajectory *traj = trajlib_->GetTrajectoryByNumber(traj_number);
-    traj->Draw(lcmgl, &body_to_local);
+    DrawCached(lcmgl, geometry, last_xyz_.data(), num_samples);
     bot_lcmgl_switch_buffer(lcmgl);
-    bot_lcmgl_destroy(lcmgl);
 
-    last_traj_name_ = name;
-    last_draw_transform_ = body_to_local;
+    last_lcmgl_ = lcmgl;
     last_traj_timestamp_ = timestamp;
     last_traj_ = traj;
     std::cout << "done" << std::endl;
@@ -3,12 +3,25 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
 #include <lcm/lcm-cpp.hpp>
 #include <bot_core/bot_core.h>
 #include "../../controllers/TrajectoryLibrary/TrajectoryLibrary.hpp"
 #include "../../utils/utils/RealtimeUtils.hpp"
 #include "../../LCM/lcmt/tvlqr_controller_action.hpp"
 
+// what Trajectory::Draw() draws for a trajectory, in its own frame, so
+// drawing it is only a transform of each vertex
+struct TrajectoryGeometry {
+    // the samples Draw() takes, every dt
+    std::vector<double> times;
+    std::vector<double> x, y, z;
+
+    // the roll line's offset at every other sample (not rotated with the
+    // trajectory, like in Draw())
+    std::vector<double> roll_offsets;
+};
+
 class TrajectoryLcmGl {
 
     public:
@@ -20,14 +33,22 @@ class TrajectoryLcmGl {
 
         void DrawTrajectoryLcmGl(int traj_number, int64_t timestamp);
 
+        static void CacheGeometry(const Trajectory &traj, TrajectoryGeometry *geometry);
+        void DrawCached(bot_lcmgl_t *lcmgl, const TrajectoryGeometry &geometry, const double *xyz, int num_samples) const;
+
         lcm::LCM *lcm_;
         const TrajectoryLibrary *trajlib_;
         BotFrames *bot_frames_;
-        std::string last_traj_name_ = "";
-        BotTrans last_draw_transform_;
         int64_t last_traj_timestamp_;
         const Trajectory *last_traj_;
 
+        // by trajectory number, made once from the library
+        std::vector<TrajectoryGeometry> geometry_;
+
+        // the last trajectory's transformed samples and its LCMGL, to trim
+        // it without transforming it again
+        std::vector<double> last_xyz_;
+        bot_lcmgl_t *last_lcmgl_ = nullptr;
 
 };
 
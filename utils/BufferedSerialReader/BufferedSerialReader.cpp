@@ -0,0 +1,83 @@
+#include "BufferedSerialReader.hpp"
+
+/**
+ * @param fd port to read from
+ * @param buffer_size most bytes to take per Read()
+ */
+BufferedSerialReader::BufferedSerialReader(int fd, int buffer_size) {
+    fd_ = fd;
+
+    buffer_.resize(buffer_size);
+    size_ = 0;
+
+    num_reads_ = 0;
+    num_bytes_ = 0;
+}
+
+/**
+ * Waits for data and reads everything that's arrived (up to the buffer
+ * size).  The bytes are in GetData() until the next Read().
+ *
+ * @param timeout_ms longest to wait (-1 for as long as it takes)
+ *
+ * @retval number of bytes read, 0 if it timed out (or was interrupted), or
+ *      -1 on an error or end of file
+ */
+int BufferedSerialReader::Read(int timeout_ms) {
+
+    size_ = 0;
+
+    struct pollfd port_poll;
+
+    port_poll.fd = fd_;
+    port_poll.events = POLLIN;
+
+    int ready = poll(&port_poll, 1, timeout_ms);
+
+    if (ready < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+
+    if (ready == 0) {
+        return 0;
+    }
+
+    int bytes = read(fd_, buffer_.data(), buffer_.size());
+
+    if (bytes < 0) {
+        return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+    }
+
+    if (bytes == 0) {
+        // poll said there was something, so this is the end of the file
+        // (or the port went away)
+        return -1;
+    }
+
+    size_ = bytes;
+
+    num_reads_ ++;
+    num_bytes_ += bytes;
+
+    return bytes;
+}
+
+/**
+ * Makes read() on a serial port return as soon as there's a byte, with
+ * everything else that has arrived, instead of waiting on a timer.
+ *
+ * @retval false if fd isn't a serial port or couldn't be set
+ */
+bool BufferedSerialReader::ConfigureForBulkReads(int fd) {
+
+    struct termios config;
+
+    if (tcgetattr(fd, &config) < 0) {
+        return false;
+    }
+
+    config.c_cc[VMIN] = 1;
+    config.c_cc[VTIME] = 0;
+
+    return tcsetattr(fd, TCSANOW, &config) == 0;
+}
@@ -0,0 +1,53 @@
+#ifndef BUFFERED_SERIAL_READER_HPP
+#define BUFFERED_SERIAL_READER_HPP
+
+/*
+ * Reads a serial port (or anything with an fd) a buffer at a time: waits
+ * for data with poll(), then takes everything that's arrived in one
+ * read(), so a 57600 baud stream is a few syscalls a packet instead of one
+ * a byte.  Parse the whole buffer after each Read().
+ *
+ * Set the port up with VMIN = 1 and VTIME = 0 (see ConfigureForBulkReads()),
+ * so read() returns whatever is there instead of waiting for more.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <termios.h>
+
+#include <vector>
+
+// most bytes one Read() takes
+#define SERIAL_READ_BUFFER_SIZE 256
+
+class BufferedSerialReader {
+
+    public:
+        BufferedSerialReader(int fd, int buffer_size = SERIAL_READ_BUFFER_SIZE);
+
+        int Read(int timeout_ms);
+
+        const uint8_t* GetData() const { return buffer_.data(); }
+        int GetSize() const { return size_; }
+
+        int64_t GetNumReads() const { return num_reads_; }
+        int64_t GetNumBytes() const { return num_bytes_; }
+
+        static bool ConfigureForBulkReads(int fd);
+
+    private:
+        int fd_;
+
+        std::vector<uint8_t> buffer_;
+        int size_;
+
+        int64_t num_reads_;
+        int64_t num_bytes_;
+};
+
+#endif
@@ -0,0 +1,74 @@
+#include "BufferedSerialReader.hpp"
+#include "gtest/gtest.h"
+
+#include <string.h>
+
+class BufferedSerialReaderTest : public testing::Test {
+
+    protected:
+
+        virtual void SetUp() {
+            ASSERT_EQ(pipe(fds_), 0);
+        }
+
+        virtual void TearDown() {
+            close(fds_[0]);
+            if (fds_[1] >= 0) {
+                close(fds_[1]);
+            }
+        }
+
+        int fds_[2];
+};
+
+TEST_F(BufferedSerialReaderTest, ReadsEverythingAtOnce) {
+    BufferedSerialReader reader(fds_[0]);
+
+    // nothing yet
+    EXPECT_EQ(reader.Read(10), 0);
+    EXPECT_EQ(reader.GetSize(), 0);
+
+    uint8_t data[100];
+
+    for (int i = 0; i < 100; i++) {
+        data[i] = i;
+    }
+
+    ASSERT_EQ(write(fds_[1], data, sizeof(data)), (ssize_t)sizeof(data));
+
+    // one read gets all of it
+    ASSERT_EQ(reader.Read(1000), 100);
+    ASSERT_EQ(reader.GetSize(), 100);
+    EXPECT_EQ(memcmp(reader.GetData(), data, sizeof(data)), 0);
+    EXPECT_EQ(reader.GetNumReads(), 1);
+
+    EXPECT_EQ(reader.Read(10), 0);
+}
+
+TEST_F(BufferedSerialReaderTest, BufferSize) {
+    BufferedSerialReader reader(fds_[0], 64);
+
+    uint8_t data[100] = { 0 };
+    data[64] = 7;
+
+    ASSERT_EQ(write(fds_[1], data, sizeof(data)), (ssize_t)sizeof(data));
+
+    // a buffer at a time, with the rest left for the next read
+    EXPECT_EQ(reader.Read(1000), 64);
+    EXPECT_EQ(reader.Read(1000), 36);
+    EXPECT_EQ(reader.GetData()[0], 7);
+    EXPECT_EQ(reader.GetNumBytes(), 100);
+}
+
+TEST_F(BufferedSerialReaderTest, EndOfFile) {
+    BufferedSerialReader reader(fds_[0]);
+
+    close(fds_[1]);
+    fds_[1] = -1;
+
+    EXPECT_EQ(reader.Read(1000), -1);
+}
+
+TEST_F(BufferedSerialReaderTest, NotASerialPort) {
+    EXPECT_FALSE(BufferedSerialReader::ConfigureForBulkReads(fds_[0]));
+}
@@ -0,0 +1,149 @@
+#include "ClockSync.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+ClockSyncEstimator::ClockSyncEstimator() {
+    num_resets_ = 0;
+
+    Reset();
+}
+
+void ClockSyncEstimator::Reset() {
+    num_ = 0;
+    next_ = 0;
+    last_rtt_ = 0;
+}
+
+/**
+ * Adds a request / reply exchange.
+ *
+ * @param t1 when we sent the request (our monotonic clock)
+ * @param t2 when the reference got it (its clock)
+ * @param t3 when the reference replied (its clock)
+ * @param t4 when we got the reply (our monotonic clock)
+ *
+ * @retval false if the times don't make sense and it was dropped
+ */
+bool ClockSyncEstimator::AddExchange(int64_t t1, int64_t t2, int64_t t3, int64_t t4) {
+
+    int64_t rtt = (t4 - t1) - (t3 - t2);
+
+    if (t4 < t1 || t3 < t2 || rtt < 0) {
+        return false;
+    }
+
+    int64_t midpoint = t1 + (t4 - t1) / 2;
+    int64_t offset = ((t2 - t1) + (t3 - t4)) / 2;
+
+    if (num_ > 0) {
+        ClockSyncEstimate estimate;
+        GetEstimate(&estimate);
+
+        int64_t predicted = estimate.synced_utime - estimate.monotonic_utime
+            + (int64_t)((midpoint - estimate.monotonic_utime) * estimate.drift_ppm / 1e6);
+
+        if (std::abs(offset - predicted) > CLOCK_SYNC_STEP_USEC + rtt) {
+            Reset();
+            num_resets_ ++;
+        }
+    }
+
+    midpoints_[next_] = midpoint;
+    offsets_[next_] = offset;
+    rtts_[next_] = rtt;
+
+    next_ = (next_ + 1) % CLOCK_SYNC_HISTORY;
+    num_ = std::min(num_ + 1, CLOCK_SYNC_HISTORY);
+
+    last_rtt_ = rtt;
+
+    return true;
+}
+
+/**
+ * Fits the offset and drift to the exchanges that were close to the quickest,
+ * as of the newest exchange.
+ */
+void ClockSyncEstimator::GetEstimate(ClockSyncEstimate *estimate) const {
+
+    memset(estimate, 0, sizeof(*estimate));
+
+    if (num_ == 0) {
+        return;
+    }
+
+    int newest = (next_ - 1 + CLOCK_SYNC_HISTORY) % CLOCK_SYNC_HISTORY;
+    int64_t x0 = midpoints_[newest];
+
+    int64_t min_rtt = rtts_[newest];
+    for (int i = 0; i < num_; i++) {
+        min_rtt = std::min(min_rtt, rtts_[i]);
+    }
+
+    int64_t max_rtt = min_rtt + min_rtt / 2 + CLOCK_SYNC_RTT_SLACK_USEC;
+
+    // fit offset = intercept + slope * (midpoint - x0), around the means so
+    // the sums stay small
+    int n = 0;
+    double sum_x = 0, sum_y = 0;
+    int64_t y0 = offsets_[newest];
+    int64_t first_x = x0;
+
+    for (int i = 0; i < num_; i++) {
+        if (rtts_[i] <= max_rtt) {
+            n ++;
+            sum_x += midpoints_[i] - x0;
+            sum_y += offsets_[i] - y0;
+            first_x = std::min(first_x, midpoints_[i]);
+        }
+    }
+
+    double mean_x = sum_x / n;
+    double mean_y = sum_y / n;
+
+    double slope = 0;
+
+    if (n >= CLOCK_SYNC_MIN_DRIFT_SAMPLES && x0 - first_x >= CLOCK_SYNC_MIN_DRIFT_SPAN_USEC) {
+        double sxx = 0, sxy = 0;
+
+        for (int i = 0; i < num_; i++) {
+            if (rtts_[i] <= max_rtt) {
+                double dx = midpoints_[i] - x0 - mean_x;
+                double dy = offsets_[i] - y0 - mean_y;
+
+                sxx += dx * dx;
+                sxy += dx * dy;
+            }
+        }
+
+        if (sxx > 0) {
+            slope = sxy / sxx;
+        }
+    }
+
+    // the line at x0
+    double offset_at_x0 = y0 + mean_y - slope * mean_x;
+
+    estimate->synced = true;
+    estimate->monotonic_utime = x0;
+    estimate->synced_utime = x0 + (int64_t)(offset_at_x0 + 0.5);
+    estimate->drift_ppm = slope * 1e6;
+    estimate->error_usec = (min_rtt + 1) / 2;
+    estimate->rtt_usec = last_rtt_;
+    estimate->num_samples = n;
+}
+
+/**
+ * Fills in the estimate's part of an lcmt_clock_sync (not the timestamp or
+ * host).
+ */
+void ClockSyncEstimator::EstimateToMsg(const ClockSyncEstimate &estimate, lcmt_clock_sync *msg) {
+    msg->monotonic_utime = estimate.monotonic_utime;
+    msg->synced_utime = estimate.synced_utime;
+    msg->drift_ppm = estimate.drift_ppm;
+    msg->error_usec = estimate.error_usec;
+    msg->rtt_usec = estimate.rtt_usec;
+    msg->num_samples = estimate.num_samples;
+    msg->synced = estimate.synced;
+}
@@ -0,0 +1,88 @@
+#ifndef CLOCK_SYNC_HPP
+#define CLOCK_SYNC_HPP
+
+/*
+ * Estimates the offset and drift between this computer's monotonic clock and
+ * a reference computer's clock from request / reply exchanges, like NTP:
+ *
+ *   t1: we send a request (our monotonic clock)
+ *   t2: the reference gets it (its clock)
+ *   t3: the reference replies (its clock)
+ *   t4: we get the reply (our monotonic clock)
+ *
+ * The offset is ((t2 - t1) + (t3 - t4)) / 2 at (t1 + t4) / 2, and the round
+ * trip is (t4 - t1) - (t3 - t2).  Queueing only ever makes a round trip
+ * longer and the offset less certain, so only the exchanges that were close
+ * to the quickest one are used, and a line through them gives the offset and
+ * drift.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "../../LCM/lcmt_clock_sync.h"
+
+// exchanges remembered (a minute's worth at 4 Hz)
+#define CLOCK_SYNC_HISTORY 256
+
+// exchanges and time (usec) needed before fitting drift
+#define CLOCK_SYNC_MIN_DRIFT_SAMPLES 16
+#define CLOCK_SYNC_MIN_DRIFT_SPAN_USEC 10000000
+
+// an exchange is used if its round trip is at most 1.5x the quickest one
+// plus this (usec)
+#define CLOCK_SYNC_RTT_SLACK_USEC 50
+
+// an offset this far (usec) from the estimate means the reference's clock
+// was set, so start over
+#define CLOCK_SYNC_STEP_USEC 100000
+
+struct ClockSyncEstimate {
+    bool synced;
+
+    // the reference's clock was synced_utime when ours was monotonic_utime
+    int64_t monotonic_utime;
+    int64_t synced_utime;
+
+    double drift_ppm;
+
+    // half the quickest round trip
+    int64_t error_usec;
+
+    int64_t rtt_usec;
+    int num_samples;
+};
+
+class ClockSyncEstimator {
+
+    public:
+        ClockSyncEstimator();
+
+        bool AddExchange(int64_t t1, int64_t t2, int64_t t3, int64_t t4);
+
+        void GetEstimate(ClockSyncEstimate *estimate) const;
+
+        void Reset();
+
+        int64_t GetNumResets() const { return num_resets_; }
+
+        static void EstimateToMsg(const ClockSyncEstimate &estimate, lcmt_clock_sync *msg);
+
+    private:
+        // monotonic time (usec) of each exchange's midpoint, and its offset
+        // and round trip
+        int64_t midpoints_[CLOCK_SYNC_HISTORY];
+        int64_t offsets_[CLOCK_SYNC_HISTORY];
+        int64_t rtts_[CLOCK_SYNC_HISTORY];
+
+        int num_;
+        int next_;
+
+        int64_t last_rtt_;
+        int64_t num_resets_;
+};
+
+#endif
@@ -0,0 +1,246 @@
+/*
+ * Clock synchronization daemon.
+ *
+ * One computer (the ground station, say) runs with --reference and answers
+ * requests with its clock.  Every other computer runs it without, asks a few
+ * times a second, and publishes how its monotonic clock maps to the
+ * reference's (see ClockSync.hpp) on clock-sync-<hostname>.  Processes turn
+ * that into synchronized timestamps with SyncedClock in RealtimeUtils.
+ *
+ * Nothing sets the system clock, so durations on each computer stay
+ * trustworthy even while the estimate settles.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <iostream>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <lcm/lcm.h>
+
+#include "../../LCM/lcmt_clock_sync.h"
+#include "../../LCM/lcmt_clock_sync_exchange.h"
+
+#include "../../externals/ConciseArgs.hpp"
+
+#include "../../utils/utils/RealtimeUtils.hpp"
+
+#include "ClockSync.hpp"
+
+lcm_t * lcm;
+
+lcmt_clock_sync_exchange_subscription_t *exchange_sub;
+
+std::string hostname;
+std::string request_channel = "CLOCK_SYNC_REQUEST";
+std::string reply_channel = "CLOCK_SYNC_REPLY";
+std::string clock_sync_channel;
+
+ClockSyncEstimator estimator;
+
+// the request we're waiting on a reply to
+int64_t pending_nonce = 0;
+
+int64_t num_requests = 0;
+int64_t num_replies = 0;
+
+void sighandler(int dum)
+{
+    printf("\n%ld requests, %ld replies, %ld resets\n", (long)num_requests, (long)num_replies, (long)estimator.GetNumResets());
+
+    printf("\nClosing... ");
+
+    lcmt_clock_sync_exchange_unsubscribe(lcm, exchange_sub);
+    lcm_destroy (lcm);
+
+    printf("done.\n");
+
+    exit(0);
+}
+
+/**
+ * Converts liblcm's receive time (wall clock) to our monotonic clock, so time
+ * spent waiting to be handled isn't counted.
+ */
+int64_t ReceiveTimeMonotonic(const lcm_recv_buf_t *rbuf)
+{
+    int64_t now = GetMonotonicNow();
+
+    if (rbuf->recv_utime <= 0) {
+        return now;
+    }
+
+    int64_t waited = GetTimestampNow() - rbuf->recv_utime;
+
+    if (waited < 0) {
+        return now;
+    }
+
+    return now - waited;
+}
+
+void request_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_clock_sync_exchange *msg, void *user)
+{
+    lcmt_clock_sync_exchange reply = *msg;
+
+    reply.reference_receive_utime = rbuf->recv_utime > 0 ? rbuf->recv_utime : GetTimestampNow();
+    reply.reference_send_utime = GetTimestampNow();
+
+    lcmt_clock_sync_exchange_publish(lcm, reply_channel.c_str(), &reply);
+}
+
+void reply_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_clock_sync_exchange *msg, void *user)
+{
+    int64_t t4 = ReceiveTimeMonotonic(rbuf);
+
+    if (hostname != msg->requester || msg->nonce != pending_nonce) {
+        // someone else's, or one we've given up on
+        return;
+    }
+
+    pending_nonce = 0;
+    num_replies ++;
+
+    estimator.AddExchange(msg->request_utime, msg->reference_receive_utime, msg->reference_send_utime, t4);
+
+    ClockSyncEstimate estimate;
+    estimator.GetEstimate(&estimate);
+
+    lcmt_clock_sync sync_msg;
+
+    sync_msg.host = (char*)hostname.c_str();
+    ClockSyncEstimator::EstimateToMsg(estimate, &sync_msg);
+
+    SyncedClock synced_clock;
+    synced_clock.Update(&sync_msg);
+
+    sync_msg.timestamp = synced_clock.GetSyncedNow();
+
+    lcmt_clock_sync_publish(lcm, clock_sync_channel.c_str(), &sync_msg);
+}
+
+void SendRequest()
+{
+    lcmt_clock_sync_exchange request;
+
+    request.requester = (char*)hostname.c_str();
+    request.nonce = ((int64_t)rand() << 31) ^ rand() ^ GetMonotonicNow();
+    request.reference_receive_utime = 0;
+    request.reference_send_utime = 0;
+
+    pending_nonce = request.nonce;
+    num_requests ++;
+
+    request.request_utime = GetMonotonicNow();
+    lcmt_clock_sync_exchange_publish(lcm, request_channel.c_str(), &request);
+}
+
+// the reference's own clock is the synchronized one
+void PublishReferenceSync()
+{
+    lcmt_clock_sync sync_msg;
+
+    sync_msg.host = (char*)hostname.c_str();
+    sync_msg.monotonic_utime = GetMonotonicNow();
+    sync_msg.synced_utime = GetTimestampNow();
+    sync_msg.drift_ppm = 0;
+    sync_msg.error_usec = 0;
+    sync_msg.rtt_usec = 0;
+    sync_msg.num_samples = 0;
+    sync_msg.synced = true;
+
+    sync_msg.timestamp = sync_msg.synced_utime;
+
+    lcmt_clock_sync_publish(lcm, clock_sync_channel.c_str(), &sync_msg);
+}
+
+int main(int argc,char** argv)
+{
+    bool reference = false;
+    double rate_hz = 4;
+    double print_every_sec = 10;
+
+    char hostname_buf[100];
+    gethostname(hostname_buf, sizeof(hostname_buf));
+    hostname = hostname_buf;
+
+    clock_sync_channel = "clock-sync-" + hostname;
+
+    ConciseArgs parser(argc, argv);
+    parser.add(reference, "r", "reference", "Be the reference clock (run on one computer).");
+    parser.add(clock_sync_channel, "c", "clock-sync-channel", "LCM channel to publish this computer's estimate on.");
+    parser.add(request_channel, "q", "request-channel", "LCM channel for requests.");
+    parser.add(reply_channel, "p", "reply-channel", "LCM channel for replies.");
+    parser.add(rate_hz, "f", "rate", "Requests (or reference estimates) per second.");
+    parser.add(print_every_sec, "v", "print-every", "Seconds between printing the estimate (0 for never).");
+    parser.parse();
+
+    lcm = lcm_create ("udpm://239.255.76.67:7667?ttl=1");
+    if (!lcm)
+    {
+        fprintf(stderr, "lcm_create failed.  Quitting.\n");
+        return 1;
+    }
+
+    srand(GetTimestampNow() ^ getpid());
+
+    if (reference) {
+        exchange_sub = lcmt_clock_sync_exchange_subscribe(lcm, request_channel.c_str(), &request_handler, NULL);
+    } else {
+        exchange_sub = lcmt_clock_sync_exchange_subscribe(lcm, reply_channel.c_str(), &reply_handler, NULL);
+    }
+
+    signal(SIGINT,sighandler);
+
+    printf("%s\n\tRequests: %s\n\tReplies: %s\nPublishing:\n\tClock sync: %s\n",
+        reference ? "Reference clock." : "Syncing to the reference clock.",
+        request_channel.c_str(), reply_channel.c_str(), clock_sync_channel.c_str());
+
+    LcmReactor reactor(lcm);
+
+    int64_t period_usec = 1000000 / rate_hz;
+    int64_t print_every_usec = print_every_sec * 1000000;
+
+    int64_t next_tick = GetMonotonicNow();
+    int64_t next_print = next_tick + print_every_usec;
+
+    while (true)
+    {
+        int64_t now = GetMonotonicNow();
+
+        if (now >= next_tick) {
+            if (reference) {
+                PublishReferenceSync();
+            } else {
+                // a request still pending is lost
+                SendRequest();
+            }
+
+            next_tick += period_usec;
+
+            if (next_tick < now) {
+                next_tick = now + period_usec;
+            }
+        }
+
+        if (print_every_usec > 0 && now >= next_print && !reference) {
+            ClockSyncEstimate estimate;
+            estimator.GetEstimate(&estimate);
+
+            printf("offset: %ld usec, drift: %.2f ppm, error: %ld usec, rtt: %ld usec, samples: %d\n",
+                (long)(estimate.synced_utime - estimate.monotonic_utime), estimate.drift_ppm,
+                (long)estimate.error_usec, (long)estimate.rtt_usec, estimate.num_samples);
+
+            next_print = now + print_every_usec;
+        }
+
+        reactor.WaitAndHandle((next_tick - now) / 1000 + 1);
+    }
+
+    return 0;
+}
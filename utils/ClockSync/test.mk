@@ -0,0 +1,6 @@
+TARGET = test
+
+SOURCES = ClockSync.cpp tests.cpp
+
+
+include ../../utils/make/flight.mk
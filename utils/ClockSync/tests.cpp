@@ -0,0 +1,114 @@
+#include "ClockSync.hpp"
+#include "gtest/gtest.h"
+
+// an exchange with the reference offset from us by offset (usec), taking
+// there and back (usec) on the wire
+static void Exchange(ClockSyncEstimator *estimator, int64_t t1, int64_t offset, int64_t there, int64_t back, double drift_ppm = 0) {
+    int64_t t2 = t1 + there + offset + (int64_t)(t1 * drift_ppm / 1e6);
+    int64_t t3 = t2 + 20;
+    int64_t t4 = t1 + there + 20 + back;
+
+    estimator->AddExchange(t1, t2, t3, t4);
+}
+
+TEST(ClockSync, NotSyncedAtFirst) {
+    ClockSyncEstimator estimator;
+
+    ClockSyncEstimate estimate;
+    estimator.GetEstimate(&estimate);
+
+    EXPECT_FALSE(estimate.synced);
+}
+
+TEST(ClockSync, SymmetricExchange) {
+    ClockSyncEstimator estimator;
+
+    Exchange(&estimator, 1000000, 5000000, 200, 200);
+
+    ClockSyncEstimate estimate;
+    estimator.GetEstimate(&estimate);
+
+    EXPECT_TRUE(estimate.synced);
+    EXPECT_EQ(estimate.synced_utime - estimate.monotonic_utime, 5000000);
+    EXPECT_EQ(estimate.rtt_usec, 400);
+    EXPECT_EQ(estimate.error_usec, 200);
+}
+
+TEST(ClockSync, SlowExchangesIgnored) {
+    ClockSyncEstimator estimator;
+
+    for (int i = 0; i < 10; i++) {
+        Exchange(&estimator, 1000000 + i * 250000, 5000000, 200, 200);
+    }
+
+    // queued on the way back: it'd look 5 ms off
+    Exchange(&estimator, 4000000, 5000000, 200, 10200);
+
+    ClockSyncEstimate estimate;
+    estimator.GetEstimate(&estimate);
+
+    EXPECT_EQ(estimate.synced_utime - estimate.monotonic_utime, 5000000);
+    EXPECT_EQ(estimate.num_samples, 10);
+    EXPECT_EQ(estimate.rtt_usec, 10400);
+}
+
+TEST(ClockSync, Drift) {
+    ClockSyncEstimator estimator;
+
+    // 20 ppm over a minute, with a little jitter
+    for (int i = 0; i < 240; i++) {
+        Exchange(&estimator, 1000000 + i * 250000, 5000000, 200 + (i % 3) * 10, 200 + (i % 5) * 10, 20);
+    }
+
+    ClockSyncEstimate estimate;
+    estimator.GetEstimate(&estimate);
+
+    EXPECT_NEAR(estimate.drift_ppm, 20, 1);
+
+    // within 100 usec of the truth at the newest exchange
+    int64_t truth = 5000000 + (int64_t)(estimate.monotonic_utime * 20 / 1e6);
+    EXPECT_NEAR(estimate.synced_utime - estimate.monotonic_utime, truth, 100);
+}
+
+TEST(ClockSync, NoDriftUntilEnoughSpan) {
+    ClockSyncEstimator estimator;
+
+    for (int i = 0; i < 20; i++) {
+        Exchange(&estimator, 1000000 + i * 100000, 5000000, 200, 200 + (i % 2) * 20);
+    }
+
+    ClockSyncEstimate estimate;
+    estimator.GetEstimate(&estimate);
+
+    EXPECT_EQ(estimate.drift_ppm, 0);
+}
+
+TEST(ClockSync, ReferenceClockStepResets) {
+    ClockSyncEstimator estimator;
+
+    for (int i = 0; i < 10; i++) {
+        Exchange(&estimator, 1000000 + i * 250000, 5000000, 200, 200);
+    }
+
+    // the reference's clock was set a second ahead
+    Exchange(&estimator, 4000000, 6000000, 200, 200);
+
+    ClockSyncEstimate estimate;
+    estimator.GetEstimate(&estimate);
+
+    EXPECT_EQ(estimate.synced_utime - estimate.monotonic_utime, 6000000);
+    EXPECT_EQ(estimate.num_samples, 1);
+    EXPECT_EQ(estimator.GetNumResets(), 1);
+}
+
+TEST(ClockSync, NonsenseDropped) {
+    ClockSyncEstimator estimator;
+
+    // the reply came back before the request went out
+    EXPECT_FALSE(estimator.AddExchange(1000, 5000, 5010, 900));
+
+    ClockSyncEstimate estimate;
+    estimator.GetEstimate(&estimate);
+
+    EXPECT_FALSE(estimate.synced);
+}
@@ -0,0 +1,343 @@
+#include "CsvReader.hpp"
+
+CsvReader::CsvReader() {
+    data_ = NULL;
+    size_ = 0;
+
+    rows_start_ = NULL;
+    position_ = NULL;
+    line_number_ = 0;
+    rows_start_line_ = 0;
+
+    num_rows_ = 0;
+    num_columns_ = 0;
+}
+
+CsvReader::~CsvReader() {
+    Close();
+}
+
+/**
+ * Maps a file and counts its rows and columns.
+ *
+ * @param filename file to read
+ * @param has_header true if the first line is column names
+ *
+ * @retval false if the file couldn't be read (see GetError())
+ */
+bool CsvReader::Open(const std::string &filename, bool has_header) {
+
+    Close();
+
+    filename_ = filename;
+    error_ = "";
+
+    int fd = open(filename.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+        return SetError("failed to open the file");
+    }
+
+    struct stat file_stat;
+
+    if (fstat(fd, &file_stat) != 0) {
+        close(fd);
+        return SetError("failed to stat the file");
+    }
+
+    size_ = file_stat.st_size;
+
+    if (size_ > 0) {
+        void *map = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (map == MAP_FAILED) {
+            close(fd);
+            size_ = 0;
+            return SetError("failed to map the file");
+        }
+
+        data_ = (const char*)map;
+
+        // read straight through, once
+        madvise(map, size_, MADV_SEQUENTIAL);
+    }
+
+    close(fd);
+
+    position_ = data_;
+    line_number_ = 0;
+
+    const char *line, *line_end;
+
+    if (has_header) {
+        if (NextLine(&line, &line_end) != true) {
+            return SetError("no header");
+        }
+
+        while (line <= line_end) {
+            const char *comma = (const char*)memchr(line, ',', line_end - line);
+            const char *field_end = comma != NULL ? comma : line_end;
+
+            // names can have spaces around them
+            const char *name = line, *name_end = field_end;
+
+            while (name < name_end && (*name == ' ' || *name == '\t')) {
+                name ++;
+            }
+
+            while (name_end > name && (*(name_end - 1) == ' ' || *(name_end - 1) == '\t')) {
+                name_end --;
+            }
+
+            header_.push_back(std::string(name, name_end - name));
+
+            line = field_end + 1;
+        }
+
+        num_columns_ = header_.size();
+    }
+
+    rows_start_ = position_;
+    rows_start_line_ = line_number_;
+
+    // count the rows (and the columns, if there wasn't a header)
+    while (NextLine(&line, &line_end)) {
+
+        if (num_rows_ == 0 && has_header != true) {
+            num_columns_ = 1;
+
+            for (const char *c = line; (c = (const char*)memchr(c, ',', line_end - c)) != NULL; c ++) {
+                num_columns_ ++;
+            }
+        }
+
+        num_rows_ ++;
+    }
+
+    Rewind();
+
+    return true;
+}
+
+void CsvReader::Close() {
+
+    if (data_ != NULL) {
+        munmap((void*)data_, size_);
+    }
+
+    data_ = NULL;
+    size_ = 0;
+
+    rows_start_ = NULL;
+    position_ = NULL;
+
+    num_rows_ = 0;
+    num_columns_ = 0;
+
+    header_.clear();
+}
+
+int CsvReader::FindColumn(const std::string &name) const {
+
+    for (int i = 0; i < (int)header_.size(); i++) {
+        if (header_[i] == name) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Reads every row into a matrix with a column for each CSV column.
+ *
+ * @param matrix (output) resized to GetNumRows() by GetNumColumns()
+ *
+ * @retval false if a row has the wrong number of fields or a field isn't a
+ *      number (see GetError())
+ */
+bool CsvReader::ReadMatrix(Eigen::MatrixXd *matrix) {
+
+    matrix->resize(num_rows_, num_columns_);
+
+    Rewind();
+
+    const char *line, *line_end;
+
+    for (int row = 0; row < num_rows_ && NextLine(&line, &line_end); row ++) {
+
+        for (int column = 0; column < num_columns_; column ++) {
+
+            const char *comma = (const char*)memchr(line, ',', line_end - line);
+            const char *field_end = comma != NULL ? comma : line_end;
+
+            if (comma == NULL && column != num_columns_ - 1) {
+                return SetError("too few fields");
+            } else if (comma != NULL && column == num_columns_ - 1) {
+                return SetError("too many fields");
+            }
+
+            if (ParseDouble(line, field_end, &(*matrix)(row, column)) != true) {
+                return SetError("field " + std::to_string(column + 1) + " isn't a number");
+            }
+
+            line = field_end + 1;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Reads some of the columns as integers.  Other columns are ignored.
+ *
+ * @param columns columns to read (see FindColumn())
+ * @param values (output) a vector of GetNumRows() values for each column
+ *
+ * @retval false if a row doesn't have the columns or one of them isn't an
+ *      integer (see GetError())
+ */
+bool CsvReader::ReadColumns(const std::vector<int> &columns, std::vector<std::vector<long> > *values) {
+
+    int last_column = -1;
+
+    for (int column : columns) {
+        if (column < 0) {
+            return SetError("column not found");
+        }
+
+        last_column = std::max(last_column, column);
+    }
+
+    values->assign(columns.size(), std::vector<long>(num_rows_));
+
+    Rewind();
+
+    const char *line, *line_end;
+
+    for (int row = 0; row < num_rows_ && NextLine(&line, &line_end); row ++) {
+
+        for (int column = 0; column <= last_column; column ++) {
+
+            const char *comma = (const char*)memchr(line, ',', line_end - line);
+            const char *field_end = comma != NULL ? comma : line_end;
+
+            if (comma == NULL && column != last_column) {
+                return SetError("too few fields");
+            }
+
+            for (int i = 0; i < (int)columns.size(); i++) {
+                if (columns[i] == column && ParseLong(line, field_end, &(*values)[i][row]) != true) {
+                    return SetError("field " + std::to_string(column + 1) + " isn't an integer");
+                }
+            }
+
+            line = field_end + 1;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Finds the next line that isn't empty.
+ *
+ * @param line (output) start of the line
+ * @param line_end (output) end of the line, not counting "\r\n"
+ *
+ * @retval false at the end of the file
+ */
+bool CsvReader::NextLine(const char **line, const char **line_end) {
+
+    const char *end = data_ + size_;
+
+    while (position_ != NULL && position_ < end) {
+
+        const char *newline = (const char*)memchr(position_, '\n', end - position_);
+
+        *line = position_;
+        *line_end = newline != NULL ? newline : end;
+
+        position_ = newline != NULL ? newline + 1 : end;
+        line_number_ ++;
+
+        if (*line_end > *line && *(*line_end - 1) == '\r') {
+            (*line_end) --;
+        }
+
+        if (*line_end > *line) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void CsvReader::Rewind() {
+    position_ = rows_start_;
+    line_number_ = rows_start_line_;
+}
+
+/**
+ * Parses a field the way atof would, but only if the whole field (other
+ * than spaces) is the number.  The field isn't NUL terminated in the file,
+ * so it's copied out first.
+ */
+bool CsvReader::ParseDouble(const char *field, const char *field_end, double *value) {
+
+    char buffer[CSV_READER_MAX_FIELD];
+
+    size_t length = field_end - field;
+
+    if (length == 0 || length >= sizeof(buffer)) {
+        return false;
+    }
+
+    memcpy(buffer, field, length);
+    buffer[length] = '\0';
+
+    char *end;
+    *value = strtod(buffer, &end);
+
+    while (*end == ' ' || *end == '\t') {
+        end ++;
+    }
+
+    return end != buffer && *end == '\0';
+}
+
+bool CsvReader::ParseLong(const char *field, const char *field_end, long *value) {
+
+    char buffer[CSV_READER_MAX_FIELD];
+
+    size_t length = field_end - field;
+
+    if (length == 0 || length >= sizeof(buffer)) {
+        return false;
+    }
+
+    memcpy(buffer, field, length);
+    buffer[length] = '\0';
+
+    char *end;
+    *value = strtol(buffer, &end, 10);
+
+    while (*end == ' ' || *end == '\t') {
+        end ++;
+    }
+
+    return end != buffer && *end == '\0';
+}
+
+bool CsvReader::SetError(const std::string &error) {
+
+    error_ = filename_ + ":";
+
+    if (line_number_ > 0) {
+        error_ += std::to_string(line_number_) + ":";
+    }
+
+    error_ += " " + error;
+
+    return false;
+}
@@ -0,0 +1,92 @@
+/**
+ * Reads numeric CSV files (trajectories, frame tables) straight into an
+ * Eigen::MatrixXd or a std::vector.
+ *
+ * The file is mmap'd, so nothing is copied line by line and nothing is
+ * allocated per field.  Lines and fields are found with memchr (which
+ * glibc vectorizes).  The only other pass over the file is a memchr count
+ * of the lines, so the matrix can be allocated once.  Fields are parsed
+ * with strtod, so values are exactly what atof would give.
+ *
+ * Empty lines are skipped, and "\r\n" line endings are fine.  Quoted
+ * fields aren't supported.
+ *
+ * (C) 2015 Andrew Barry <abarry@csail.mit.edu>
+ */
+
+#ifndef CSV_READER_HPP
+#define CSV_READER_HPP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <Eigen/Core>
+
+// longest field that can be parsed (numbers, so it's plenty)
+#define CSV_READER_MAX_FIELD 64
+
+class CsvReader {
+
+    public:
+        CsvReader();
+        ~CsvReader();
+
+        bool Open(const std::string &filename, bool has_header = true);
+        void Close();
+
+        int GetNumRows() const { return num_rows_; }
+        int GetNumColumns() const { return num_columns_; }
+
+        // column names from the header (empty without one)
+        const std::vector<std::string>& GetHeader() const { return header_; }
+
+        // index of a column by its name in the header, or -1
+        int FindColumn(const std::string &name) const;
+
+        bool ReadMatrix(Eigen::MatrixXd *matrix);
+        bool ReadColumns(const std::vector<int> &columns, std::vector<std::vector<long> > *values);
+
+        // what went wrong, after Open() or a read returns false
+        const std::string& GetError() const { return error_; }
+
+    private:
+
+        CsvReader(const CsvReader&);
+        CsvReader& operator=(const CsvReader&);
+
+        bool NextLine(const char **line, const char **line_end);
+        void Rewind();
+
+        static bool ParseDouble(const char *field, const char *field_end, double *value);
+        static bool ParseLong(const char *field, const char *field_end, long *value);
+
+        bool SetError(const std::string &error);
+
+        const char *data_;
+        size_t size_;
+
+        // where the rows start (after the header) and where the next line is
+        const char *rows_start_;
+        const char *position_;
+        int line_number_;
+        int rows_start_line_;
+
+        int num_rows_;
+        int num_columns_;
+
+        std::vector<std::string> header_;
+
+        std::string filename_;
+        std::string error_;
+};
+
+#endif
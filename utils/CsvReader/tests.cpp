@@ -0,0 +1,106 @@
+#include "CsvReader.hpp"
+#include "gtest/gtest.h"
+
+static std::string WriteTempFile(const std::string &contents) {
+    char filename[] = "/tmp/csv-reader-test-XXXXXX";
+
+    int fd = mkstemp(filename);
+
+    if (fd < 0) {
+        return "";
+    }
+
+    if (write(fd, contents.data(), contents.size()) != (ssize_t)contents.size()) {
+        close(fd);
+        return "";
+    }
+
+    close(fd);
+
+    return filename;
+}
+
+TEST(CsvReader, Matrix) {
+    std::string filename = WriteTempFile("t,x,y\n0,1.5,-2\n0.01,2.5,3e-3\n\n0.02,3.5,4\n");
+
+    CsvReader reader;
+    ASSERT_TRUE(reader.Open(filename));
+
+    EXPECT_EQ(reader.GetNumRows(), 3);
+    EXPECT_EQ(reader.GetNumColumns(), 3);
+    EXPECT_EQ(reader.FindColumn("y"), 2);
+    EXPECT_EQ(reader.FindColumn("z"), -1);
+
+    Eigen::MatrixXd matrix;
+    ASSERT_TRUE(reader.ReadMatrix(&matrix));
+
+    ASSERT_EQ(matrix.rows(), 3);
+    ASSERT_EQ(matrix.cols(), 3);
+
+    // the same as atof
+    EXPECT_EQ(matrix(1, 0), atof("0.01"));
+    EXPECT_EQ(matrix(1, 2), atof("3e-3"));
+    EXPECT_EQ(matrix(0, 2), -2);
+    EXPECT_EQ(matrix(2, 1), 3.5);
+
+    unlink(filename.c_str());
+}
+
+TEST(CsvReader, NoHeaderOrNewlineAtTheEnd) {
+    std::string filename = WriteTempFile("1,2\r\n3,4");
+
+    CsvReader reader;
+    ASSERT_TRUE(reader.Open(filename, false));
+
+    EXPECT_EQ(reader.GetNumRows(), 2);
+    EXPECT_EQ(reader.GetNumColumns(), 2);
+
+    Eigen::MatrixXd matrix;
+    ASSERT_TRUE(reader.ReadMatrix(&matrix));
+
+    EXPECT_EQ(matrix(0, 1), 2);
+    EXPECT_EQ(matrix(1, 1), 4);
+
+    unlink(filename.c_str());
+}
+
+TEST(CsvReader, Columns) {
+    std::string filename = WriteTempFile("frame, vicon_time_us, extra\n0,1000,a\n1,9000000000,b\n");
+
+    CsvReader reader;
+    ASSERT_TRUE(reader.Open(filename));
+
+    std::vector<int> columns = { reader.FindColumn("vicon_time_us"), reader.FindColumn("frame") };
+
+    std::vector<std::vector<long> > values;
+    ASSERT_TRUE(reader.ReadColumns(columns, &values));
+
+    ASSERT_EQ(values.size(), 2u);
+    EXPECT_EQ(values[0][1], 9000000000L);
+    EXPECT_EQ(values[1][1], 1);
+
+    unlink(filename.c_str());
+}
+
+TEST(CsvReader, BadRows) {
+    CsvReader reader;
+    Eigen::MatrixXd matrix;
+
+    std::string filename = WriteTempFile("a,b\n1,2\n3\n");
+    ASSERT_TRUE(reader.Open(filename));
+    EXPECT_FALSE(reader.ReadMatrix(&matrix));
+    EXPECT_NE(reader.GetError().find(":3:"), std::string::npos);
+    unlink(filename.c_str());
+
+    filename = WriteTempFile("a,b\n1,2,3\n");
+    ASSERT_TRUE(reader.Open(filename));
+    EXPECT_FALSE(reader.ReadMatrix(&matrix));
+    unlink(filename.c_str());
+
+    filename = WriteTempFile("a,b\n1,x\n");
+    ASSERT_TRUE(reader.Open(filename));
+    EXPECT_FALSE(reader.ReadMatrix(&matrix));
+    unlink(filename.c_str());
+
+    EXPECT_FALSE(reader.Open("/nonexistent/file.csv"));
+}
@@ -0,0 +1,131 @@
+#include "ChannelRules.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include "FlightLogWriter.hpp"
+
+ChannelRules::~ChannelRules() {
+    for (ChannelRule &rule : rules_) {
+        regfree(&rule.regex);
+    }
+}
+
+/**
+ * Adds a rule after the ones already there.  Channels that have already
+ * been seen keep the rule they got.
+ *
+ * @param pattern regex the whole channel name has to match
+ * @param decimation log 1 of every this many messages (at least 1)
+ * @param priority a FlightLogPriority
+ *
+ * @retval false if the regex doesn't compile
+ */
+bool ChannelRules::AddRule(std::string pattern, int decimation, int priority) {
+
+    rules_.push_back(ChannelRule());
+    ChannelRule &rule = rules_.back();
+
+    if (regcomp(&rule.regex, ("^(" + pattern + ")$").c_str(), REG_EXTENDED | REG_NOSUB) != 0) {
+        fprintf(stderr, "Error: bad channel regex \"%s\"\n", pattern.c_str());
+        rules_.pop_back();
+        return false;
+    }
+
+    rule.pattern = pattern;
+    rule.decimation = std::max(decimation, 1);
+    rule.priority = std::min(std::max(priority, 0), FLIGHT_LOG_NUM_PRIORITIES - 1);
+
+    return true;
+}
+
+/**
+ * Adds the rules in a file (see ChannelRules.hpp).
+ *
+ * @param filename rules file
+ *
+ * @retval false if it couldn't be read or a line is bad
+ */
+bool ChannelRules::LoadFile(std::string filename) {
+
+    std::ifstream file(filename.c_str());
+
+    if (!file.is_open()) {
+        fprintf(stderr, "Error: can't read rules file %s\n", filename.c_str());
+        return false;
+    }
+
+    std::string line;
+    int line_number = 0;
+
+    while (std::getline(file, line)) {
+        line_number ++;
+
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream fields(line);
+        std::string pattern;
+        int decimation, priority;
+
+        if (!(fields >> pattern)) {
+            // blank or just a comment
+            continue;
+        }
+
+        if (!(fields >> decimation >> priority) || AddRule(pattern, decimation, priority) != true) {
+            fprintf(stderr, "Error: bad rule on line %d of %s\n", line_number, filename.c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Counts a message on a channel against its rule.
+ *
+ * @param channel channel the message came in on
+ * @param priority (output) the channel's priority
+ *
+ * @retval false if decimation skips this message
+ */
+bool ChannelRules::ShouldLog(const char *channel, int *priority) {
+
+    auto it = channels_.find(channel);
+
+    if (it == channels_.end()) {
+        ChannelState state;
+        state.decimation = 1;
+        state.priority = FLIGHT_LOG_NORMAL;
+        state.count = 0;
+
+        for (const ChannelRule &rule : rules_) {
+            if (regexec(&rule.regex, channel, 0, NULL, 0) == 0) {
+                state.decimation = rule.decimation;
+                state.priority = rule.priority;
+                break;
+            }
+        }
+
+        it = channels_.insert(std::make_pair(std::string(channel), state)).first;
+    }
+
+    ChannelState &state = it->second;
+
+    *priority = state.priority;
+
+    // always the first message, so a slow channel shows up right away
+    bool log = state.count % state.decimation == 0;
+
+    state.count ++;
+
+    if (log != true) {
+        num_decimated_ ++;
+    }
+
+    return log;
+}
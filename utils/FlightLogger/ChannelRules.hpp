@@ -0,0 +1,67 @@
+#ifndef CHANNEL_RULES_HPP
+#define CHANNEL_RULES_HPP
+
+/*
+ * Decides which messages flight-logger keeps and how important they are,
+ * by channel.  A rule is a channel regex (matching the whole name, like
+ * lcm_subscribe()), a decimation (log 1 of every N messages) and a
+ * FlightLogPriority.  The first rule that matches a channel is used, and
+ * channels no rule matches are logged in full at normal priority.
+ *
+ * Rules files have one rule per line, with # for comments:
+ *
+ *   # channel         decimation  priority (0 critical, 1 normal, 2 bulk)
+ *   stereo-image.*    5           2
+ *   STATE_ESTIMATOR.* 1           0
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <stdint.h>
+#include <regex.h>
+
+#include <string>
+#include <list>
+#include <unordered_map>
+
+struct ChannelRule {
+    std::string pattern;
+    regex_t regex;
+    int decimation;
+    int priority;
+};
+
+class ChannelRules {
+
+    public:
+        ChannelRules() { num_decimated_ = 0; }
+        ~ChannelRules();
+
+        bool AddRule(std::string pattern, int decimation, int priority);
+        bool LoadFile(std::string filename);
+
+        bool ShouldLog(const char *channel, int *priority);
+
+        int GetNumRules() const { return rules_.size(); }
+
+        // messages skipped by decimation
+        int64_t GetNumDecimated() const { return num_decimated_; }
+
+    private:
+        struct ChannelState {
+            int decimation;
+            int priority;
+            int64_t count;
+        };
+
+        // a list, so the regex_ts never move
+        std::list<ChannelRule> rules_;
+
+        // each channel's rule, looked up the first time it's seen
+        std::unordered_map<std::string, ChannelState> channels_;
+
+        int64_t num_decimated_;
+};
+
+#endif
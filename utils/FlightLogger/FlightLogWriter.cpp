@@ -0,0 +1,456 @@
+#include "FlightLogWriter.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/falloc.h>
+
+#include <algorithm>
+
+#include "../../utils/utils/RealtimeUtils.hpp"
+
+// first bytes of every event in an LCM log
+#define LCM_LOG_SYNC 0xEDA1DA01
+
+// sync word, event number, timestamp, channel length, data length
+#define LOG_EVENT_HEADER_SIZE (4 + 8 + 8 + 4 + 4)
+
+static void WriteBigEndian(uint8_t *out, int64_t value, int num_bytes) {
+    for (int i = 0; i < num_bytes; i++) {
+        out[i] = (uint64_t)value >> (8 * (num_bytes - 1 - i));
+    }
+}
+
+/**
+ * Makes the buffers.  Nothing is written until Open().
+ *
+ * @param buffer_size bytes per buffer (rounded up to FLIGHT_LOG_ALIGNMENT)
+ * @param num_buffers buffers in the ring (at least 2)
+ * @param preallocate_bytes how far ahead of the writes to keep the file
+ *      allocated (0 to not preallocate)
+ */
+FlightLogWriter::FlightLogWriter(int buffer_size, int num_buffers, int64_t preallocate_bytes) {
+
+    buffer_size_ = std::max((buffer_size + FLIGHT_LOG_ALIGNMENT - 1) / FLIGHT_LOG_ALIGNMENT * FLIGHT_LOG_ALIGNMENT,
+        FLIGHT_LOG_ALIGNMENT);
+    num_buffers_ = std::max(num_buffers, 2);
+    preallocate_bytes_ = std::max(preallocate_bytes, (int64_t)0);
+
+    for (int i = 0; i < num_buffers_; i++) {
+        void *buffer;
+
+        if (posix_memalign(&buffer, FLIGHT_LOG_ALIGNMENT, buffer_size_) != 0) {
+            fprintf(stderr, "ERROR: failed to allocate the log buffers.\n");
+            exit(1);
+        }
+
+        buffers_.push_back((char*)buffer);
+    }
+
+    fd_ = -1;
+    direct_io_ = false;
+    preallocating_ = false;
+
+    thread_running_ = false;
+
+    file_offset_ = 0;
+    preallocated_end_ = 0;
+
+    current_ = -1;
+    used_ = 0;
+
+    closing_ = false;
+
+    log_size_ = 0;
+    event_number_ = 0;
+
+    num_messages_ = 0;
+    num_write_errors_ = 0;
+
+    for (int i = 0; i < FLIGHT_LOG_NUM_PRIORITIES; i++) {
+        num_dropped_[i] = 0;
+    }
+
+    ResetWindow();
+}
+
+FlightLogWriter::~FlightLogWriter() {
+    Close();
+
+    for (char *buffer : buffers_) {
+        free(buffer);
+    }
+}
+
+/**
+ * Creates the log file and starts the writer thread.
+ *
+ * @param filename log to write (replaced if it's there)
+ *
+ * @retval false if the file couldn't be created
+ */
+bool FlightLogWriter::Open(std::string filename) {
+
+    direct_io_ = true;
+    fd_ = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+
+    if (fd_ < 0 && errno == EINVAL) {
+        // tmpfs and some others don't do O_DIRECT
+        direct_io_ = false;
+        fd_ = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+
+    if (fd_ < 0) {
+        perror(filename.c_str());
+        return false;
+    }
+
+    file_offset_ = 0;
+    preallocated_end_ = 0;
+    preallocating_ = preallocate_bytes_ > 0;
+
+    Preallocate(preallocate_bytes_);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        free_.clear();
+        full_.clear();
+
+        for (int i = 0; i < num_buffers_; i++) {
+            free_.push_back(i);
+        }
+
+        current_ = -1;
+        used_ = 0;
+        closing_ = false;
+
+        log_size_ = 0;
+        event_number_ = 0;
+
+        TakeFreeBuffer();
+    }
+
+    pthread_create(&thread_, NULL, WriterThread, this);
+    thread_running_ = true;
+
+    return true;
+}
+
+/**
+ * Writes everything that's left, trims the file to the log's size and
+ * closes it.
+ */
+void FlightLogWriter::Close() {
+
+    if (fd_ < 0) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (current_ >= 0 && used_ > 0) {
+            // the last write has to be whole blocks too.  The padding is
+            // trimmed off below.
+            int length = (used_ + FLIGHT_LOG_ALIGNMENT - 1) / FLIGHT_LOG_ALIGNMENT * FLIGHT_LOG_ALIGNMENT;
+            memset(buffers_[current_] + used_, 0, length - used_);
+
+            SubmitCurrent(length);
+        }
+
+        closing_ = true;
+    }
+
+    cv_full_.notify_one();
+
+    if (thread_running_) {
+        pthread_join(thread_, NULL);
+        thread_running_ = false;
+    }
+
+    // also gives back what was preallocated past the end
+    if (ftruncate(fd_, log_size_) != 0) {
+        perror("ftruncate");
+    }
+
+    close(fd_);
+    fd_ = -1;
+}
+
+/**
+ * Adds a message to the log, unless there isn't room for a message of its
+ * priority (see FlightLogWriter.hpp).  Call from one thread.
+ *
+ * @param channel channel it came in on
+ * @param utime when it was received
+ * @param data the encoded message
+ * @param data_size its size in bytes
+ * @param priority a FlightLogPriority
+ *
+ * @retval false if it was dropped
+ */
+bool FlightLogWriter::Write(const char *channel, int64_t utime, const void *data, int data_size, int priority) {
+
+    priority = std::min(std::max(priority, 0), FLIGHT_LOG_NUM_PRIORITIES - 1);
+
+    int channel_length = strlen(channel);
+    int64_t size = LOG_EVENT_HEADER_SIZE + channel_length + data_size;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (fd_ < 0 || closing_) {
+        return false;
+    }
+
+    if (current_ < 0) {
+        TakeFreeBuffer();
+    }
+
+    int64_t room = (int64_t)free_.size() * buffer_size_;
+
+    if (current_ >= 0) {
+        room += buffer_size_ - used_;
+    }
+
+    // buffers kept back for more important messages
+    int64_t reserve = 0;
+
+    if (priority == FLIGHT_LOG_NORMAL) {
+        reserve = buffer_size_;
+    } else if (priority == FLIGHT_LOG_BULK) {
+        reserve = (int64_t)(num_buffers_ / 2) * buffer_size_;
+    }
+
+    if (size + reserve > room) {
+        num_dropped_[priority] ++;
+        return false;
+    }
+
+    uint8_t header[LOG_EVENT_HEADER_SIZE];
+
+    WriteBigEndian(header, LCM_LOG_SYNC, 4);
+    WriteBigEndian(header + 4, event_number_, 8);
+    WriteBigEndian(header + 12, utime, 8);
+    WriteBigEndian(header + 20, channel_length, 4);
+    WriteBigEndian(header + 24, data_size, 4);
+
+    Append(header, LOG_EVENT_HEADER_SIZE);
+    Append(channel, channel_length);
+    Append(data, data_size);
+
+    event_number_ ++;
+    num_messages_ ++;
+
+    return true;
+}
+
+/**
+ * Hands the whole blocks in the buffer being filled to the writer, so a
+ * slow channel doesn't sit in memory until a buffer fills.  What's left
+ * past the last whole block moves to the next buffer.
+ */
+void FlightLogWriter::Flush() {
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (current_ < 0 || used_ < FLIGHT_LOG_ALIGNMENT || free_.empty() || closing_) {
+            // nothing to write yet, or the writer is behind anyway
+            return;
+        }
+
+        int length = used_ / FLIGHT_LOG_ALIGNMENT * FLIGHT_LOG_ALIGNMENT;
+        int remainder = used_ - length;
+
+        int flushed = current_;
+
+        SubmitCurrent(length);
+        TakeFreeBuffer();
+
+        memcpy(buffers_[current_], buffers_[flushed] + length, remainder);
+        used_ = remainder;
+    }
+
+    cv_full_.notify_one();
+}
+
+void FlightLogWriter::GetStats(FlightLogStats *stats) {
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    stats->num_messages = num_messages_;
+    stats->log_size = log_size_;
+    stats->num_write_errors = num_write_errors_;
+
+    for (int i = 0; i < FLIGHT_LOG_NUM_PRIORITIES; i++) {
+        stats->num_dropped[i] = num_dropped_[i];
+    }
+
+    stats->num_writes = num_writes_;
+    stats->write_latency_ms_avg = num_writes_ > 0 ? write_latency_sum_ / num_writes_ : 0;
+    stats->write_latency_ms_max = write_latency_max_;
+
+    stats->direct_io = direct_io_;
+    stats->preallocating = preallocating_;
+}
+
+void FlightLogWriter::ResetWindow() {
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    num_writes_ = 0;
+    write_latency_sum_ = 0;
+    write_latency_max_ = 0;
+}
+
+// copies into the buffers, handing each one to the writer as it fills.
+// Call with mutex_ held, after checking there's room.
+void FlightLogWriter::Append(const void *data, int length) {
+
+    const char *bytes = (const char*)data;
+
+    log_size_ += length;
+
+    while (length > 0) {
+        if (current_ < 0 && TakeFreeBuffer() != true) {
+            // Write() checked for room, so this doesn't happen
+            return;
+        }
+
+        int count = std::min(length, buffer_size_ - used_);
+
+        memcpy(buffers_[current_] + used_, bytes, count);
+
+        used_ += count;
+        bytes += count;
+        length -= count;
+
+        if (used_ == buffer_size_) {
+            SubmitCurrent(buffer_size_);
+            cv_full_.notify_one();
+        }
+    }
+}
+
+// call with mutex_ held
+void FlightLogWriter::SubmitCurrent(int length) {
+
+    FullBuffer full;
+    full.index = current_;
+    full.length = length;
+
+    full_.push_back(full);
+
+    current_ = -1;
+    used_ = 0;
+}
+
+// call with mutex_ held
+bool FlightLogWriter::TakeFreeBuffer() {
+
+    if (free_.empty()) {
+        return false;
+    }
+
+    current_ = free_.front();
+    free_.pop_front();
+    used_ = 0;
+
+    return true;
+}
+
+// keeps the file allocated out to end.  Allocating doesn't change the
+// file's size, so log-monitor still sees how much has been written.
+void FlightLogWriter::Preallocate(int64_t end) {
+
+    if (preallocating_ != true || end <= preallocated_end_) {
+        return;
+    }
+
+    if (fallocate(fd_, FALLOC_FL_KEEP_SIZE, preallocated_end_, end - preallocated_end_) != 0) {
+        fprintf(stderr, "Warning: can't preallocate the log (%s), writing without it.\n", strerror(errno));
+        preallocating_ = false;
+        return;
+    }
+
+    preallocated_end_ = end;
+}
+
+void* FlightLogWriter::WriterThread(void *x) {
+    ((FlightLogWriter*)x)->RunWriter();
+    return NULL;
+}
+
+void FlightLogWriter::RunWriter() {
+
+    while (true) {
+        FullBuffer full;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+
+            cv_full_.wait(lock, [this]{ return full_.empty() != true || closing_; });
+
+            if (full_.empty()) {
+                // closing, and everything's written
+                break;
+            }
+
+            full = full_.front();
+            full_.pop_front();
+        }
+
+        // stay a chunk ahead of the writes
+        if (file_offset_ + full.length > preallocated_end_ - preallocate_bytes_ / 2) {
+            Preallocate(file_offset_ + full.length + preallocate_bytes_);
+        }
+
+        int64_t start = GetMonotonicNow();
+
+        const char *data = buffers_[full.index];
+        int remaining = full.length;
+        int64_t offset = file_offset_;
+        bool failed = false;
+
+        while (remaining > 0) {
+            ssize_t written = pwrite(fd_, data, remaining, offset);
+
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (written <= 0) {
+                perror("log write");
+                failed = true;
+                break;
+            }
+
+            data += written;
+            remaining -= written;
+            offset += written;
+        }
+
+        double latency_ms = (GetMonotonicNow() - start) / 1000.0;
+
+        // the next write goes after this one even if it failed, so the
+        // rest of the log is where its events say it is
+        file_offset_ += full.length;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            num_writes_ ++;
+            write_latency_sum_ += latency_ms;
+            write_latency_max_ = std::max(write_latency_max_, latency_ms);
+
+            if (failed) {
+                num_write_errors_ ++;
+            }
+
+            free_.push_back(full.index);
+        }
+    }
+}
@@ -0,0 +1,143 @@
+#ifndef FLIGHT_LOG_WRITER_HPP
+#define FLIGHT_LOG_WRITER_HPP
+
+/*
+ * Writes an LCM log file (the same format lcm-logger writes, so
+ * lcm-logplayer and log-index read it) without making the LCM thread wait
+ * on the card.
+ *
+ * Messages are copied into a ring of big aligned buffers and a writer
+ * thread writes the full ones with O_DIRECT, so the page cache doesn't
+ * fill up with log data and then flush it all at once while the stereo
+ * recordings are trying to write too.  The file is preallocated ahead of
+ * the writes with fallocate, so the filesystem isn't finding blocks for
+ * every write.  (Both fall back to normal writes on filesystems that don't
+ * support them.)
+ *
+ * When the card falls behind and the buffers fill up, messages are
+ * dropped by priority: bulk messages (images) once half the buffers are
+ * full, normal ones with one buffer left, and critical ones only when
+ * there's no room at all.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <pthread.h>
+
+// O_DIRECT writes have to be a multiple of this long, from memory aligned
+// to it, at offsets that are multiples of it
+#define FLIGHT_LOG_ALIGNMENT 4096
+
+enum FlightLogPriority {
+    FLIGHT_LOG_CRITICAL = 0,
+    FLIGHT_LOG_NORMAL = 1,
+    FLIGHT_LOG_BULK = 2,
+
+    FLIGHT_LOG_NUM_PRIORITIES = 3
+};
+
+struct FlightLogStats {
+    // messages written and dropped, and the log's size, since it was opened
+    int64_t num_messages;
+    int64_t num_dropped[FLIGHT_LOG_NUM_PRIORITIES];
+    int64_t log_size;
+
+    int64_t num_write_errors;
+
+    // writes to the card since the last ResetWindow()
+    int num_writes;
+    float write_latency_ms_avg;
+    float write_latency_ms_max;
+
+    bool direct_io;
+    bool preallocating;
+};
+
+class FlightLogWriter {
+
+    public:
+        FlightLogWriter(int buffer_size, int num_buffers, int64_t preallocate_bytes);
+        ~FlightLogWriter();
+
+        bool Open(std::string filename);
+        void Close();
+
+        bool Write(const char *channel, int64_t utime, const void *data, int data_size, int priority);
+
+        void Flush();
+
+        void GetStats(FlightLogStats *stats);
+        void ResetWindow();
+
+    private:
+        struct FullBuffer {
+            int index;
+            int length;
+        };
+
+        static void* WriterThread(void *x);
+        void RunWriter();
+
+        void Append(const void *data, int length);
+        void SubmitCurrent(int length);
+        bool TakeFreeBuffer();
+
+        void Preallocate(int64_t end);
+
+        int buffer_size_;
+        int num_buffers_;
+        int64_t preallocate_bytes_;
+
+        std::vector<char*> buffers_;
+
+        int fd_;
+        bool direct_io_;
+        bool preallocating_;
+
+        pthread_t thread_;
+        bool thread_running_;
+
+        // only used by the writer thread (and by Close() after it's done)
+        int64_t file_offset_;
+        int64_t preallocated_end_;
+
+        // everything below is under mutex_.  The writer thread doesn't hold
+        // it while it writes.
+        std::mutex mutex_;
+        std::condition_variable cv_full_;
+
+        // buffer being filled (-1 if there wasn't a free one) and how much
+        // of it is
+        int current_;
+        int used_;
+
+        std::deque<int> free_;
+        std::deque<FullBuffer> full_;
+
+        bool closing_;
+
+        // bytes handed to Append(), which is the log's size once it's all
+        // written
+        int64_t log_size_;
+
+        int64_t event_number_;
+
+        int64_t num_messages_;
+        int64_t num_dropped_[FLIGHT_LOG_NUM_PRIORITIES];
+        int64_t num_write_errors_;
+
+        int num_writes_;
+        double write_latency_sum_;
+        double write_latency_max_;
+};
+
+#endif
@@ -0,0 +1,257 @@
+/*
+ * LCM logger for the plane: logs every channel like lcm-logger, but writes
+ * through FlightLogWriter (preallocated, O_DIRECT, buffered away from the
+ * LCM thread) and thins out channels by the rules in ChannelRules, so it
+ * keeps up on an SD card while the stereo recordings are writing too.
+ *
+ * Logs are named like lcm-logger's (lcmlog-2015-07-18.00) so log-monitor
+ * finds them.  Drops and write latency go out on an lcmt_log_size message.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <iostream>
+#include <algorithm>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+#include <lcm/lcm.h>
+
+#include "../../LCM/lcmt_log_size.h"
+
+#include "../../externals/ConciseArgs.hpp"
+
+#include "../../utils/utils/RealtimeUtils.hpp"
+
+#include "FlightLogWriter.hpp"
+#include "ChannelRules.hpp"
+
+lcm_t * lcm;
+
+lcm_subscription_t *all_sub;
+
+std::string status_channel = "log-info-logger-hostname";
+
+ChannelRules rules;
+FlightLogWriter *writer;
+
+volatile sig_atomic_t stop = 0;
+
+void sighandler(int dum)
+{
+    // the log has to be closed properly, so that happens in main()
+    stop = 1;
+}
+
+void all_handler(const lcm_recv_buf_t *rbuf, const char* channel, void *user)
+{
+    if (status_channel == channel) {
+        // don't log ourselves
+        return;
+    }
+
+    int priority;
+
+    if (rules.ShouldLog(channel, &priority) != true) {
+        return;
+    }
+
+    int64_t recv_utime = rbuf->recv_utime > 0 ? rbuf->recv_utime : GetTimestampNow();
+
+    writer->Write(channel, recv_utime, rbuf->data, rbuf->data_size, priority);
+}
+
+/**
+ * Picks the next free log name for today, like lcm-logger does.
+ *
+ * @param dir directory for the log, ending in /
+ * @param log_number (output) the log's number
+ *
+ * @retval the log's path
+ */
+std::string NextLogName(std::string dir, int *log_number)
+{
+    time_t rawtime;
+    char date_string[80];
+
+    time(&rawtime);
+    strftime(date_string, 80, "%Y-%m-%d", localtime(&rawtime));
+
+    for (int i = 0; i < 100; i++)
+    {
+        char name[200];
+        snprintf(name, sizeof(name), "%slcmlog-%s.%02d", dir.c_str(), date_string, i);
+
+        struct stat stat_buf;
+
+        if (stat(name, &stat_buf) != 0)
+        {
+            *log_number = i;
+            return name;
+        }
+    }
+
+    return "";
+}
+
+double GetDiskFree(std::string dir)
+{
+    struct statvfs fi_data;
+
+    if (statvfs(dir.c_str(), &fi_data) < 0) {
+        return -1;
+    }
+
+    return (double)fi_data.f_bavail * (double)fi_data.f_bsize / 1048576.0;
+}
+
+int64_t TotalDropped(const FlightLogStats &stats)
+{
+    int64_t total = 0;
+
+    for (int i = 0; i < FLIGHT_LOG_NUM_PRIORITIES; i++) {
+        total += stats.num_dropped[i];
+    }
+
+    return total;
+}
+
+void PublishStatus(int log_number, std::string log_dir)
+{
+    FlightLogStats stats;
+    writer->GetStats(&stats);
+    writer->ResetWindow();
+
+    lcmt_log_size msg;
+
+    msg.timestamp = GetTimestampNow();
+
+    msg.log_number = log_number;
+    msg.log_size = stats.log_size;
+
+    msg.disk_space_free = GetDiskFree(log_dir);
+
+    msg.num_dropped = TotalDropped(stats) + stats.num_write_errors;
+    msg.write_latency_ms_avg = stats.write_latency_ms_avg;
+    msg.write_latency_ms_max = stats.write_latency_ms_max;
+
+    lcmt_log_size_publish(lcm, status_channel.c_str(), &msg);
+}
+
+int main(int argc,char** argv)
+{
+    std::string log_dir = ".";
+    std::string rules_file = "";
+    int buffer_kb = 1024;
+    int num_buffers = 16;
+    int preallocate_mb = 256;
+    double flush_every_sec = 0.5;
+    double status_rate = 1;
+
+    // use this computers hostname by default
+    char hostname[100];
+    gethostname(hostname, sizeof(hostname));
+    status_channel = "log-info-logger-" + std::string(hostname);
+
+    ConciseArgs parser(argc, argv);
+    parser.add(log_dir, "d", "log-directory", "Directory to write the log in.");
+    parser.add(rules_file, "r", "rules", "Channel rules file (decimation and priority, see ChannelRules.hpp).");
+    parser.add(status_channel, "c", "status-channel", "LCM channel to publish the log's size, drops and write latency on.");
+    parser.add(buffer_kb, "b", "buffer-kb", "Size of each write buffer (KB).");
+    parser.add(num_buffers, "n", "num-buffers", "Write buffers.  More rides out longer stalls.");
+    parser.add(preallocate_mb, "p", "preallocate-mb", "How far ahead to allocate the log file (MB, 0 for not at all).");
+    parser.add(flush_every_sec, "f", "flush-every", "Most seconds a message waits in a buffer before being written.");
+    parser.add(status_rate, "s", "status-rate", "Status messages per second.");
+    parser.parse();
+
+    if (!log_dir.empty() && *log_dir.rbegin() != '/') {
+        log_dir += "/";
+    }
+
+    if (!rules_file.empty() && rules.LoadFile(rules_file) != true) {
+        return 1;
+    }
+
+    int log_number;
+    std::string log_name = NextLogName(log_dir, &log_number);
+
+    if (log_name.empty()) {
+        fprintf(stderr, "Error: already 100 logs today in %s\n", log_dir.c_str());
+        return 1;
+    }
+
+    writer = new FlightLogWriter(buffer_kb * 1024, num_buffers, (int64_t)preallocate_mb * 1024 * 1024);
+
+    if (writer->Open(log_name) != true) {
+        return 1;
+    }
+
+    lcm = lcm_create ("udpm://239.255.76.67:7667?ttl=0");
+    if (!lcm)
+    {
+        fprintf(stderr, "lcm_create for recieve failed.  Quitting.\n");
+        return 1;
+    }
+
+    all_sub = lcm_subscribe(lcm, ".*", &all_handler, NULL);
+
+    signal(SIGINT,sighandler);
+    signal(SIGTERM,sighandler);
+
+    FlightLogStats stats;
+    writer->GetStats(&stats);
+
+    printf("Logging all channels to %s (%d rules, %s, %s)\nPublishing LCM:\n\tStatus: %s\n", log_name.c_str(),
+        rules.GetNumRules(), stats.direct_io ? "direct I/O" : "buffered I/O",
+        stats.preallocating ? "preallocated" : "not preallocated", status_channel.c_str());
+
+    LcmReactor reactor(lcm);
+
+    int64_t flush_period_usec = flush_every_sec * 1000000;
+    int64_t status_period_usec = 1000000 / status_rate;
+
+    int64_t next_flush = GetMonotonicNow() + flush_period_usec;
+    int64_t next_status = GetMonotonicNow() + status_period_usec;
+
+    while (!stop)
+    {
+        int64_t now = GetMonotonicNow();
+
+        if (now >= next_flush) {
+            writer->Flush();
+            next_flush = now + flush_period_usec;
+        }
+
+        if (now >= next_status) {
+            PublishStatus(log_number, log_dir);
+            next_status = now + status_period_usec;
+        }
+
+        reactor.WaitAndHandle((std::min(next_flush, next_status) - now) / 1000 + 1);
+    }
+
+    printf("\nClosing... ");
+
+    lcm_unsubscribe(lcm, all_sub);
+
+    writer->Close();
+    writer->GetStats(&stats);
+
+    printf("done.\n%lld messages (%lld decimated), dropped %lld critical, %lld normal, %lld bulk, %lld write errors, %lld bytes.\n",
+        (long long)stats.num_messages, (long long)rules.GetNumDecimated(),
+        (long long)stats.num_dropped[FLIGHT_LOG_CRITICAL], (long long)stats.num_dropped[FLIGHT_LOG_NORMAL],
+        (long long)stats.num_dropped[FLIGHT_LOG_BULK], (long long)stats.num_write_errors, (long long)stats.log_size);
+
+    delete writer;
+
+    lcm_destroy (lcm);
+
+    return 0;
+}
@@ -0,0 +1,7 @@
+TARGET = test
+
+SOURCES = FlightLogWriter.cpp ChannelRules.cpp ../LogIndex/LogIndex.cpp ../../utils/utils/RealtimeUtils.cpp tests.cpp
+
+LDPOSTFLAGS_EXTRA += -lpthread
+
+include ../../utils/make/flight.mk
@@ -0,0 +1,182 @@
+#include "FlightLogWriter.hpp"
+#include "ChannelRules.hpp"
+#include "../LogIndex/LogIndex.hpp"
+#include "gtest/gtest.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static std::string TempLogName() {
+    char name[] = "/tmp/flight-logger-testXXXXXX";
+    int fd = mkstemp(name);
+    close(fd);
+
+    return name;
+}
+
+static int64_t FileSize(const std::string &filename) {
+    struct stat stat_buf;
+    return stat(filename.c_str(), &stat_buf) == 0 ? stat_buf.st_size : -1;
+}
+
+TEST(FlightLogWriter, WritesAnLcmLog) {
+    std::string filename = TempLogName();
+
+    // messages span buffers, and there's room for all of them however
+    // slow the writes are
+    FlightLogWriter writer(64 * 1024, 4, 1024 * 1024);
+    ASSERT_TRUE(writer.Open(filename));
+
+    std::vector<uint8_t> data;
+
+    for (int i = 0; i < 200; i++) {
+        data.assign(10 + (i * 37) % 1000, (uint8_t)i);
+
+        EXPECT_TRUE(writer.Write(i % 2 == 0 ? "imu" : "gps", 1000 + i, data.data(), data.size(), FLIGHT_LOG_CRITICAL));
+
+        if (i % 50 == 0) {
+            // partial buffers go out too
+            writer.Flush();
+        }
+    }
+
+    writer.Close();
+
+    FlightLogStats stats;
+    writer.GetStats(&stats);
+
+    EXPECT_EQ(stats.num_messages, 200);
+    EXPECT_EQ(stats.num_write_errors, 0);
+
+    // no padding or preallocation left at the end
+    EXPECT_EQ(FileSize(filename), stats.log_size);
+
+    LogIndex index;
+    ASSERT_TRUE(index.Build(filename));
+
+    ASSERT_EQ(index.GetNumEvents(), 200u);
+    EXPECT_EQ(index.GetNumChannels(), 2);
+
+    std::vector<uint8_t> read;
+
+    for (int i = 0; i < 200; i++) {
+        const LogIndexEvent &event = index.GetEvent(i);
+
+        EXPECT_EQ(event.timestamp, 1000 + i);
+        EXPECT_EQ(index.GetChannelName(event.channel), i % 2 == 0 ? "imu" : "gps");
+
+        ASSERT_TRUE(index.ReadEvent(i, &read));
+        ASSERT_EQ(read.size(), 10u + (i * 37) % 1000);
+        EXPECT_EQ(read[0], (uint8_t)i);
+        EXPECT_EQ(read.back(), (uint8_t)i);
+    }
+
+    unlink(filename.c_str());
+}
+
+TEST(FlightLogWriter, DropsByPriority) {
+    std::string filename = TempLogName();
+
+    // 16 KB of buffers.  Bulk messages leave half of them free and normal
+    // ones leave one.
+    FlightLogWriter writer(4096, 4, 0);
+    ASSERT_TRUE(writer.Open(filename));
+
+    std::vector<uint8_t> data(11000, 0x5a);
+
+    EXPECT_FALSE(writer.Write("stereo-image", 1, data.data(), data.size(), FLIGHT_LOG_BULK));
+    EXPECT_TRUE(writer.Write("stereo-image", 2, data.data(), data.size(), FLIGHT_LOG_NORMAL));
+
+    // bigger than all the buffers
+    data.resize(20000);
+    EXPECT_FALSE(writer.Write("pose", 3, data.data(), data.size(), FLIGHT_LOG_CRITICAL));
+
+    writer.Close();
+
+    FlightLogStats stats;
+    writer.GetStats(&stats);
+
+    EXPECT_EQ(stats.num_messages, 1);
+    EXPECT_EQ(stats.num_dropped[FLIGHT_LOG_BULK], 1);
+    EXPECT_EQ(stats.num_dropped[FLIGHT_LOG_NORMAL], 0);
+    EXPECT_EQ(stats.num_dropped[FLIGHT_LOG_CRITICAL], 1);
+
+    LogIndex index;
+    ASSERT_TRUE(index.Build(filename));
+    ASSERT_EQ(index.GetNumEvents(), 1u);
+    EXPECT_EQ(index.GetEvent(0).timestamp, 2);
+
+    unlink(filename.c_str());
+}
+
+TEST(ChannelRules, FirstMatchWins) {
+    ChannelRules rules;
+
+    ASSERT_TRUE(rules.AddRule("stereo-image.*", 3, FLIGHT_LOG_BULK));
+    ASSERT_TRUE(rules.AddRule("stereo.*", 1, FLIGHT_LOG_CRITICAL));
+
+    int priority;
+
+    EXPECT_TRUE(rules.ShouldLog("stereo-image-left", &priority));
+    EXPECT_EQ(priority, FLIGHT_LOG_BULK);
+
+    EXPECT_TRUE(rules.ShouldLog("stereo", &priority));
+    EXPECT_EQ(priority, FLIGHT_LOG_CRITICAL);
+
+    // the whole name has to match
+    EXPECT_TRUE(rules.ShouldLog("my-stereo", &priority));
+    EXPECT_EQ(priority, FLIGHT_LOG_NORMAL);
+
+    EXPECT_FALSE(rules.AddRule("(", 1, 1));
+}
+
+TEST(ChannelRules, Decimation) {
+    ChannelRules rules;
+    ASSERT_TRUE(rules.AddRule("images", 3, FLIGHT_LOG_BULK));
+
+    int priority;
+    int logged = 0;
+
+    for (int i = 0; i < 9; i++) {
+        bool log = rules.ShouldLog("images", &priority);
+
+        // the first of every three
+        EXPECT_EQ(log, i % 3 == 0);
+
+        if (log) {
+            logged ++;
+        }
+
+        // other channels aren't decimated
+        EXPECT_TRUE(rules.ShouldLog("gps", &priority));
+    }
+
+    EXPECT_EQ(logged, 3);
+    EXPECT_EQ(rules.GetNumDecimated(), 6);
+}
+
+TEST(ChannelRules, LoadFile) {
+    std::string filename = TempLogName();
+
+    FILE *file = fopen(filename.c_str(), "w");
+    fprintf(file, "# channel decimation priority\n\nstereo-image.*  5 2  # images\nSTATE_ESTIMATOR.* 1 0\n");
+    fclose(file);
+
+    ChannelRules rules;
+    ASSERT_TRUE(rules.LoadFile(filename));
+    EXPECT_EQ(rules.GetNumRules(), 2);
+
+    int priority;
+    EXPECT_TRUE(rules.ShouldLog("STATE_ESTIMATOR_POSE", &priority));
+    EXPECT_EQ(priority, FLIGHT_LOG_CRITICAL);
+
+    file = fopen(filename.c_str(), "w");
+    fprintf(file, "gps five 1\n");
+    fclose(file);
+
+    ChannelRules bad_rules;
+    EXPECT_FALSE(bad_rules.LoadFile(filename));
+
+    unlink(filename.c_str());
+}
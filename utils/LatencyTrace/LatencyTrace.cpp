@@ -0,0 +1,167 @@
+#include "LatencyTrace.hpp"
+
+LatencyTrace::LatencyTrace() {
+    have_offset_ = false;
+    min_offset_ = 0;
+    last_device_time_ = 0;
+
+    for (int i = 0; i < LATENCY_TRACE_IMU_HISTORY; i++) {
+        imu_utimes_[i] = -1;
+        imu_latencies_[i] = 0;
+    }
+    next_imu_ = 0;
+
+    Reset();
+}
+
+/**
+ * Records an IMU message from the bridge.
+ *
+ * @param utime when the bridge got it
+ * @param device_time when the APM sampled it (its own clock)
+ */
+void LatencyTrace::AddImu(int64_t utime, int64_t device_time) {
+
+    int64_t offset = utime - device_time;
+
+    if (!have_offset_ || device_time < last_device_time_) {
+        // first one, or the APM restarted and its clock did too
+        min_offset_ = offset;
+        have_offset_ = true;
+    } else if (offset < min_offset_) {
+        min_offset_ = offset;
+    }
+
+    last_device_time_ = device_time;
+
+    int64_t latency = offset - min_offset_;
+
+    Record(HOP_SAMPLE_TO_BRIDGE, latency);
+
+    imu_utimes_[next_imu_] = utime;
+    imu_latencies_[next_imu_] = latency;
+    next_imu_ = (next_imu_ + 1) % LATENCY_TRACE_IMU_HISTORY;
+}
+
+/**
+ * Records a command's trace from the controller, matching it to its IMU
+ * message for the total.
+ */
+void LatencyTrace::AddControl(const lcmt_control_latency *msg) {
+
+    Record(HOP_BRIDGE_TO_ESTIMATE, msg->pose_receive_utime - msg->pose_utime);
+    Record(HOP_CONTROLLER_QUEUE, msg->pose_handled_utime - msg->pose_receive_utime);
+    Record(HOP_CONTROL, msg->timestamp - msg->pose_handled_utime);
+
+    // newest first, since it's usually one of the last few
+    for (int i = 1; i <= LATENCY_TRACE_IMU_HISTORY; i++) {
+        int index = (next_imu_ - i + LATENCY_TRACE_IMU_HISTORY) % LATENCY_TRACE_IMU_HISTORY;
+
+        if (imu_utimes_[index] == msg->pose_utime) {
+            Record(HOP_TOTAL, imu_latencies_[index] + msg->timestamp - msg->pose_utime);
+            return;
+        }
+    }
+
+    num_unmatched_ ++;
+}
+
+void LatencyTrace::Record(int hop, int64_t latency_us) {
+
+    // a little negative is clock skew between machines
+    int duration = (int)std::max((int64_t)0, std::min(latency_us, (int64_t)INT32_MAX));
+
+    // 4 buckets per power of two: the position of the top bit and the two
+    // bits below it
+    int bucket = duration;
+
+    if (duration >= 4) {
+        int top_bit = 31 - __builtin_clz(duration);
+        bucket = top_bit * 4 + ((duration >> (top_bit - 2)) & 3) - 4;
+    }
+
+    bucket = std::min(bucket, LATENCY_TRACE_BUCKETS - 1);
+
+    counts_[hop][bucket] ++;
+    max_us_[hop] = std::max(max_us_[hop], (int64_t)duration);
+}
+
+/**
+ * Top of a histogram bucket, in microseconds (see Record()).
+ */
+int LatencyTrace::BucketTop(int bucket) {
+    if (bucket < 4) {
+        return bucket;
+    }
+
+    int top_bit = (bucket + 4) / 4;
+    int fraction = (bucket + 4) % 4;
+
+    return ((4 + fraction + 1) << (top_bit - 2)) - 1;
+}
+
+void LatencyTrace::GetSummary(int hop, LatencySummary *summary) const {
+
+    int64_t total = 0;
+
+    for (int i = 0; i < LATENCY_TRACE_BUCKETS; i++) {
+        total += counts_[hop][i];
+    }
+
+    summary->count = total;
+    summary->p50_ms = 0;
+    summary->p99_ms = 0;
+    summary->max_ms = max_us_[hop] / 1000.0f;
+
+    int64_t so_far = 0;
+    bool have_p50 = false;
+
+    for (int i = 0; i < LATENCY_TRACE_BUCKETS && total > 0; i++) {
+        so_far += counts_[hop][i];
+
+        float top_ms = std::min(BucketTop(i) / 1000.0f, summary->max_ms);
+
+        if (!have_p50 && so_far * 2 >= total) {
+            summary->p50_ms = top_ms;
+            have_p50 = true;
+        }
+
+        if (so_far * 100 >= total * 99) {
+            summary->p99_ms = top_ms;
+            break;
+        }
+    }
+}
+
+void LatencyTrace::Print(FILE *out) const {
+
+    fprintf(out, "%-20s %8s %9s %9s %9s\n", "hop", "count", "p50 ms", "p99 ms", "max ms");
+
+    for (int hop = 0; hop < NUM_HOPS; hop++) {
+        LatencySummary summary;
+        GetSummary(hop, &summary);
+
+        fprintf(out, "%-20s %8lld %9.2f %9.2f %9.2f\n", GetHopName(hop), (long long)summary.count,
+            summary.p50_ms, summary.p99_ms, summary.max_ms);
+    }
+
+    if (num_unmatched_ > 0) {
+        fprintf(out, "(%lld commands with no IMU message to match)\n", (long long)num_unmatched_);
+    }
+}
+
+/**
+ * Clears the histograms.  The IMU messages are kept to match commands to.
+ */
+void LatencyTrace::Reset() {
+    memset(counts_, 0, sizeof(counts_));
+    memset(max_us_, 0, sizeof(max_us_));
+
+    num_unmatched_ = 0;
+}
+
+const char* LatencyTrace::GetHopName(int hop) {
+    static const char *names[NUM_HOPS] = { "sample to bridge", "bridge to estimate", "controller queue", "control", "total" };
+
+    return names[hop];
+}
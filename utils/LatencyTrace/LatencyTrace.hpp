@@ -0,0 +1,99 @@
+#ifndef LATENCY_TRACE_HPP
+#define LATENCY_TRACE_HPP
+
+/*
+ * Breaks the time from an APM sensor sample to the servo command it leads
+ * to into hops:
+ *
+ *   sample to bridge: the APM's time_usec (device_time) to when the bridge
+ *      got the MAVLink message (the IMU message's utime).  The two clocks
+ *      aren't synced, so this is how much longer than the quickest one a
+ *      message took: a lower bound that catches the radio / serial / mavconn
+ *      queueing, not the fixed part.
+ *   bridge to estimate: the IMU message's utime to when the controller
+ *      received the pose made from it (pronto stamps poses with the IMU's
+ *      utime)
+ *   controller queue: the pose being received to the controller getting
+ *      to it
+ *   control: that to the lcmt_deltawing_u going out
+ *   total: all of the above
+ *
+ * The IMU messages come from the bridge's attitude channel and the rest
+ * from the lcmt_control_latency messages TVLQR sends with each command.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "../../LCM/lcmt_control_latency.h"
+
+// histogram buckets: 4 per power of two microseconds, up to about 1 second
+#define LATENCY_TRACE_BUCKETS 80
+
+// IMU messages remembered to match poses to (a few seconds' worth)
+#define LATENCY_TRACE_IMU_HISTORY 512
+
+enum LatencyHop {
+    HOP_SAMPLE_TO_BRIDGE,
+    HOP_BRIDGE_TO_ESTIMATE,
+    HOP_CONTROLLER_QUEUE,
+    HOP_CONTROL,
+    HOP_TOTAL,
+    NUM_HOPS
+};
+
+// Summary of a hop.  Percentiles are rounded up to the top of their bucket
+// (within 19%).
+struct LatencySummary {
+    int64_t count;
+    float p50_ms;
+    float p99_ms;
+    float max_ms;
+};
+
+class LatencyTrace {
+
+    public:
+        LatencyTrace();
+
+        void AddImu(int64_t utime, int64_t device_time);
+        void AddControl(const lcmt_control_latency *msg);
+
+        void GetSummary(int hop, LatencySummary *summary) const;
+        void Print(FILE *out) const;
+        void Reset();
+
+        // control messages whose IMU message we didn't have
+        int64_t GetNumUnmatched() const { return num_unmatched_; }
+
+        static const char* GetHopName(int hop);
+
+    private:
+        void Record(int hop, int64_t latency_us);
+
+        static int BucketTop(int bucket);
+
+        int64_t counts_[NUM_HOPS][LATENCY_TRACE_BUCKETS];
+        int64_t max_us_[NUM_HOPS];
+
+        // quickest (utime - device_time) yet, and the last device_time, to
+        // tell when the APM restarts
+        int64_t min_offset_;
+        int64_t last_device_time_;
+        bool have_offset_;
+
+        // recent IMU messages' utimes and sample to bridge latencies
+        int64_t imu_utimes_[LATENCY_TRACE_IMU_HISTORY];
+        int64_t imu_latencies_[LATENCY_TRACE_IMU_HISTORY];
+        int next_imu_;
+
+        int64_t num_unmatched_;
+};
+
+#endif
@@ -0,0 +1,107 @@
+/*
+ * Reports how long each hop from an APM sensor sample to a servo command
+ * takes (see LatencyTrace.hpp).  Run TVLQR with --latency-channel.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <iostream>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#include <lcm/lcm.h>
+#include "lcmtypes/mav_ins_t.h" // from pronto
+
+#include "../../LCM/lcmt_control_latency.h"
+
+#include "../../externals/ConciseArgs.hpp"
+
+#include "../../utils/utils/RealtimeUtils.hpp"
+
+#include "LatencyTrace.hpp"
+
+lcm_t * lcm;
+
+mav_ins_t_subscription_t *ins_sub;
+lcmt_control_latency_subscription_t *control_latency_sub;
+
+LatencyTrace trace;
+
+int64_t report_every_usec = 5000000;
+int64_t last_report = 0;
+
+void sighandler(int dum)
+{
+    printf("\n");
+    trace.Print(stdout);
+
+    printf("\nClosing... ");
+
+    mav_ins_t_unsubscribe(lcm, ins_sub);
+    lcmt_control_latency_unsubscribe(lcm, control_latency_sub);
+    lcm_destroy (lcm);
+
+    printf("done.\n");
+
+    exit(0);
+}
+
+void mav_ins_t_handler(const lcm_recv_buf_t *rbuf, const char* channel, const mav_ins_t *msg, void *user)
+{
+    trace.AddImu(msg->utime, msg->device_time);
+}
+
+void lcmt_control_latency_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_control_latency *msg, void *user)
+{
+    trace.AddControl(msg);
+
+    int64_t now = GetTimestampNow();
+
+    if (now - last_report > report_every_usec) {
+        printf("\n");
+        trace.Print(stdout);
+
+        trace.Reset();
+        last_report = now;
+    }
+}
+
+int main(int argc,char** argv)
+{
+    std::string attitude_channel = "attitude";
+    std::string control_latency_channel = "control-latency";
+    double report_every_sec = 5;
+
+    ConciseArgs parser(argc, argv);
+    parser.add(attitude_channel, "i", "attitude-channel", "LCM channel for IMU messages from the bridge.");
+    parser.add(control_latency_channel, "l", "latency-channel", "LCM channel TVLQR sends latency traces on.");
+    parser.add(report_every_sec, "r", "report-every", "Seconds between reports.");
+    parser.parse();
+
+    report_every_usec = report_every_sec * 1000000;
+
+    lcm = lcm_create ("udpm://239.255.76.67:7667?ttl=0");
+    if (!lcm)
+    {
+        fprintf(stderr, "lcm_create for recieve failed.  Quitting.\n");
+        return 1;
+    }
+
+    ins_sub = mav_ins_t_subscribe(lcm, attitude_channel.c_str(), &mav_ins_t_handler, NULL);
+    control_latency_sub = lcmt_control_latency_subscribe(lcm, control_latency_channel.c_str(), &lcmt_control_latency_handler, NULL);
+
+    signal(SIGINT,sighandler);
+
+    printf("Receiving LCM:\n\tIMU: %s\n\tLatency traces: %s\n", attitude_channel.c_str(), control_latency_channel.c_str());
+
+    while (true)
+    {
+        // read the LCM channel
+        lcm_handle (lcm);
+    }
+
+    return 0;
+}
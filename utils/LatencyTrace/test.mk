@@ -0,0 +1,6 @@
+TARGET = test
+
+SOURCES = LatencyTrace.cpp tests.cpp
+
+
+include ../../utils/make/flight.mk
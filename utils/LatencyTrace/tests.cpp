@@ -0,0 +1,127 @@
+#include "LatencyTrace.hpp"
+#include "gtest/gtest.h"
+
+static lcmt_control_latency MakeTrace(int64_t pose_utime, int64_t receive, int64_t handled, int64_t command) {
+    lcmt_control_latency msg;
+
+    msg.timestamp = command;
+    msg.pose_utime = pose_utime;
+    msg.pose_receive_utime = receive;
+    msg.pose_handled_utime = handled;
+
+    return msg;
+}
+
+TEST(LatencyTrace, SampleToBridgeIsOverTheQuickest) {
+    LatencyTrace trace;
+
+    // the device clock is 1 second behind, and messages take 2 to 5 ms
+    trace.AddImu(1002000, 0);
+    trace.AddImu(1013000, 10000);
+    trace.AddImu(1025000, 20000);
+
+    LatencySummary summary;
+    trace.GetSummary(HOP_SAMPLE_TO_BRIDGE, &summary);
+
+    EXPECT_EQ(summary.count, 3);
+
+    // 3 ms more than the quickest
+    EXPECT_FLOAT_EQ(summary.max_ms, 3.0f);
+}
+
+TEST(LatencyTrace, DeviceRestartResetsOffset) {
+    LatencyTrace trace;
+
+    trace.AddImu(1001000, 1000);
+
+    // the APM restarted, so its clock is way behind now
+    trace.AddImu(5001000, 0);
+    trace.AddImu(5011000, 10000);
+
+    LatencySummary summary;
+    trace.GetSummary(HOP_SAMPLE_TO_BRIDGE, &summary);
+
+    EXPECT_EQ(summary.count, 3);
+    EXPECT_FLOAT_EQ(summary.max_ms, 0.0f);
+}
+
+TEST(LatencyTrace, Hops) {
+    LatencyTrace trace;
+
+    trace.AddImu(1000000, 0);
+    trace.AddImu(1010000, 9000);
+
+    // the pose from the second IMU message: 4 ms in the estimator, 1 ms
+    // waiting, 0.5 ms computing
+    lcmt_control_latency msg = MakeTrace(1010000, 1014000, 1015000, 1015500);
+    trace.AddControl(&msg);
+
+    LatencySummary summary;
+
+    trace.GetSummary(HOP_BRIDGE_TO_ESTIMATE, &summary);
+    EXPECT_EQ(summary.count, 1);
+    EXPECT_FLOAT_EQ(summary.max_ms, 4.0f);
+
+    trace.GetSummary(HOP_CONTROLLER_QUEUE, &summary);
+    EXPECT_FLOAT_EQ(summary.max_ms, 1.0f);
+
+    trace.GetSummary(HOP_CONTROL, &summary);
+    EXPECT_FLOAT_EQ(summary.max_ms, 0.5f);
+
+    // and the 1 ms the IMU message was late
+    trace.GetSummary(HOP_TOTAL, &summary);
+    EXPECT_EQ(summary.count, 1);
+    EXPECT_FLOAT_EQ(summary.max_ms, 6.5f);
+
+    EXPECT_EQ(trace.GetNumUnmatched(), 0);
+}
+
+TEST(LatencyTrace, UnmatchedHasNoTotal) {
+    LatencyTrace trace;
+
+    trace.AddImu(1000000, 0);
+
+    lcmt_control_latency msg = MakeTrace(2000000, 2004000, 2005000, 2005500);
+    trace.AddControl(&msg);
+
+    LatencySummary summary;
+
+    trace.GetSummary(HOP_CONTROL, &summary);
+    EXPECT_EQ(summary.count, 1);
+
+    trace.GetSummary(HOP_TOTAL, &summary);
+    EXPECT_EQ(summary.count, 0);
+
+    EXPECT_EQ(trace.GetNumUnmatched(), 1);
+}
+
+TEST(LatencyTrace, Percentiles) {
+    LatencyTrace trace;
+
+    trace.AddImu(0, 0);
+
+    // 99 quick ones and a slow one
+    for (int i = 0; i < 99; i++) {
+        lcmt_control_latency msg = MakeTrace(0, 0, 0, 1000);
+        trace.AddControl(&msg);
+    }
+
+    lcmt_control_latency slow = MakeTrace(0, 0, 0, 50000);
+    trace.AddControl(&slow);
+
+    LatencySummary summary;
+    trace.GetSummary(HOP_CONTROL, &summary);
+
+    EXPECT_EQ(summary.count, 100);
+
+    // within a bucket (19%)
+    EXPECT_GE(summary.p50_ms, 1.0f);
+    EXPECT_LE(summary.p50_ms, 1.19f);
+    EXPECT_LE(summary.p99_ms, 1.19f);
+    EXPECT_FLOAT_EQ(summary.max_ms, 50.0f);
+
+    trace.Reset();
+    trace.GetSummary(HOP_CONTROL, &summary);
+
+    EXPECT_EQ(summary.count, 0);
+}
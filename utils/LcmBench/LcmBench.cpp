@@ -0,0 +1,52 @@
+#include "LcmBench.hpp"
+
+#include <algorithm>
+
+void BenchSamples::GetSummary(BenchSummary *summary) const {
+
+    summary->count = samples_.size();
+    summary->mean = 0;
+    summary->p50 = 0;
+    summary->p90 = 0;
+    summary->p99 = 0;
+    summary->max = 0;
+
+    if (samples_.empty()) {
+        return;
+    }
+
+    // sorting a copy is fine once at the end of a run
+    std::vector<double> sorted(samples_);
+    std::sort(sorted.begin(), sorted.end());
+
+    double sum = 0;
+
+    for (size_t i = 0; i < sorted.size(); i++) {
+        sum += sorted[i];
+    }
+
+    int last = sorted.size() - 1;
+
+    summary->mean = sum / sorted.size();
+    summary->p50 = sorted[last * 50 / 100];
+    summary->p90 = sorted[last * 90 / 100];
+    summary->p99 = sorted[last * 99 / 100];
+    summary->max = sorted[last];
+}
+
+void BenchSamples::Print(FILE *out, const char *name) const {
+
+    BenchSummary summary;
+    GetSummary(&summary);
+
+    fprintf(out, "%-10s %8lld %10.2f %10.2f %10.2f %10.2f %10.2f\n", name, (long long)summary.count, summary.mean,
+        summary.p50, summary.p90, summary.p99, summary.max);
+
+    if (num_over_ > 0) {
+        fprintf(out, "(%lld more %s samples than there was room for)\n", (long long)num_over_, name);
+    }
+}
+
+void BenchSamples::PrintHeader(FILE *out) {
+    fprintf(out, "%-10s %8s %10s %10s %10s %10s %10s\n", "usec", "count", "mean", "p50", "p90", "p99", "max");
+}
@@ -0,0 +1,56 @@
+#ifndef LCM_BENCH_HPP
+#define LCM_BENCH_HPP
+
+/*
+ * Measurements for lcm-bench: every sample is kept (in space allocated up
+ * front, so recording one doesn't allocate mid-run) and the percentiles
+ * are exact.  Fine for a benchmark run of a few hundred thousand messages;
+ * lcm-stats is the one to leave running.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <vector>
+
+struct BenchSummary {
+    int64_t count;
+
+    // usec
+    double mean;
+    double p50;
+    double p90;
+    double p99;
+    double max;
+};
+
+class BenchSamples {
+
+    public:
+        BenchSamples(int capacity) { samples_.reserve(capacity); num_over_ = 0; }
+
+        // samples past the capacity are counted but not kept
+        void Add(double usec) {
+            if (samples_.size() < samples_.capacity()) {
+                samples_.push_back(usec);
+            } else {
+                num_over_ ++;
+            }
+        }
+
+        void GetSummary(BenchSummary *summary) const;
+
+        void Print(FILE *out, const char *name) const;
+        static void PrintHeader(FILE *out);
+
+        int64_t GetNumOverCapacity() const { return num_over_; }
+
+    private:
+        std::vector<double> samples_;
+        int64_t num_over_;
+};
+
+#endif
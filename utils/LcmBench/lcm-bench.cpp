@@ -0,0 +1,491 @@
+/*
+ * Benchmarks sending our real message types between processes, to compare
+ * transports and message formats on numbers instead of feel.
+ *
+ * Run a receiver, then a sender with the same type and transport:
+ *
+ *   lcm-bench -t stereo
+ *   lcm-bench -s -t stereo -n 3000 -r 30 -d 20
+ *
+ * The sender reports how long encoding took.  The receiver reports how
+ * long decoding took, the latency from the sender stamping a message to the
+ * receiver's handler getting it, how many were dropped and the throughput.
+ *
+ * Transports:
+ *      LCM, with any URL (-u), multicast by default.  For the XBee link,
+ *          run lcm-to-xbee-bridge on both ends with the bench channel
+ *          bridged.
+ *      the shared memory ring (-m), for processes on the same computer.
+ *
+ * The sender and receiver have to be on the same computer (or ones with
+ * synced clocks) for the latency to mean anything.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <iostream>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <lcm/lcm.h>
+
+#include "../../LCM/lcmt_stereo.h"
+#include "../../LCM/mav_pose_t.h"
+#include "lcmtypes/bot_core_image_t.h" // from libbot
+
+#include "../../LCM/lcmt_lcm_bench_done.h"
+
+#include "../../externals/ConciseArgs.hpp"
+
+#include "../../utils/utils/RealtimeUtils.hpp"
+#include "../../utils/ShmRing/ShmRing.hpp"
+
+#include "LcmBench.hpp"
+
+// PIXEL_FORMAT_MJPEG
+#define BENCH_PIXEL_FORMAT_MJPEG 1196444237
+
+enum BenchType {
+    BENCH_STEREO,
+    BENCH_POSE,
+    BENCH_IMAGE
+};
+
+lcm_t * lcm;
+
+BenchType bench_type;
+std::string type_name = "stereo";
+
+std::string channel = "lcm-bench";
+std::string done_channel = "lcm-bench-done";
+
+// empty for LCM
+std::string shm_name = "";
+
+// message to send, for each type
+lcmt_stereo stereo_msg;
+mav_pose_t pose_msg;
+bot_core_image_t image_msg;
+
+std::vector<float> stereo_x, stereo_y, stereo_z;
+std::vector<uint8_t> stereo_grey;
+std::vector<uint8_t> image_data;
+
+/**
+ * Fills in the message that'll be sent (with random data, since encoding
+ * time doesn't depend on it).
+ *
+ * @param num_points points in a stereo message
+ * @param image_bytes size of an image's JPEG data
+ */
+void MakeMessage(int num_points, int image_bytes)
+{
+    switch (bench_type) {
+        case BENCH_STEREO:
+            stereo_x.resize(num_points);
+            stereo_y.resize(num_points);
+            stereo_z.resize(num_points);
+            stereo_grey.resize(num_points);
+
+            for (int i = 0; i < num_points; i++) {
+                stereo_x[i] = rand() / (float)RAND_MAX * 10;
+                stereo_y[i] = rand() / (float)RAND_MAX * 10 - 5;
+                stereo_z[i] = rand() / (float)RAND_MAX * 4 - 2;
+                stereo_grey[i] = rand();
+            }
+
+            stereo_msg.timestamp = 0;
+            stereo_msg.number_of_points = num_points;
+            stereo_msg.frame_number = 0;
+            stereo_msg.video_number = 0;
+            stereo_msg.x = stereo_x.data();
+            stereo_msg.y = stereo_y.data();
+            stereo_msg.z = stereo_z.data();
+            stereo_msg.grey = stereo_grey.data();
+            break;
+
+        case BENCH_POSE:
+            memset(&pose_msg, 0, sizeof(pose_msg));
+            pose_msg.orientation[0] = 1;
+            break;
+
+        case BENCH_IMAGE:
+            image_data.resize(image_bytes);
+
+            for (int i = 0; i < image_bytes; i++) {
+                image_data[i] = rand();
+            }
+
+            memset(&image_msg, 0, sizeof(image_msg));
+            image_msg.width = 376;
+            image_msg.height = 240;
+            image_msg.row_stride = 376;
+            image_msg.pixelformat = BENCH_PIXEL_FORMAT_MJPEG;
+            image_msg.size = image_bytes;
+            image_msg.data = image_data.data();
+            image_msg.nmetadata = 0;
+            image_msg.metadata = NULL;
+            break;
+    }
+}
+
+/**
+ * Stamps and encodes the message.
+ *
+ * @retval the encoded size, or -1 on failure
+ */
+int EncodeMessage(int64_t stamp, int sequence, std::vector<uint8_t> *buffer)
+{
+    int size;
+
+    switch (bench_type) {
+        case BENCH_STEREO:
+            stereo_msg.timestamp = stamp;
+            stereo_msg.frame_number = sequence;
+
+            size = lcmt_stereo_encoded_size(&stereo_msg);
+            buffer->resize(size);
+            return lcmt_stereo_encode(buffer->data(), 0, size, &stereo_msg);
+
+        case BENCH_POSE:
+            pose_msg.utime = stamp;
+
+            size = mav_pose_t_encoded_size(&pose_msg);
+            buffer->resize(size);
+            return mav_pose_t_encode(buffer->data(), 0, size, &pose_msg);
+
+        case BENCH_IMAGE:
+            image_msg.utime = stamp;
+
+            size = bot_core_image_t_encoded_size(&image_msg);
+            buffer->resize(size);
+            return bot_core_image_t_encode(buffer->data(), 0, size, &image_msg);
+    }
+
+    return -1;
+}
+
+/**
+ * Decodes a message the way a subscriber would.
+ *
+ * @param stamp (output) when the sender stamped it
+ *
+ * @retval false if it didn't decode
+ */
+bool DecodeMessage(const void *data, int size, int64_t *stamp)
+{
+    switch (bench_type) {
+        case BENCH_STEREO:
+        {
+            lcmt_stereo msg;
+
+            if (lcmt_stereo_decode(data, 0, size, &msg) < 0) {
+                return false;
+            }
+
+            *stamp = msg.timestamp;
+            lcmt_stereo_decode_cleanup(&msg);
+            return true;
+        }
+
+        case BENCH_POSE:
+        {
+            mav_pose_t msg;
+
+            if (mav_pose_t_decode(data, 0, size, &msg) < 0) {
+                return false;
+            }
+
+            *stamp = msg.utime;
+            mav_pose_t_decode_cleanup(&msg);
+            return true;
+        }
+
+        case BENCH_IMAGE:
+        {
+            bot_core_image_t msg;
+
+            if (bot_core_image_t_decode(data, 0, size, &msg) < 0) {
+                return false;
+            }
+
+            *stamp = msg.utime;
+            bot_core_image_t_decode_cleanup(&msg);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void RunSender(double rate, double duration_sec)
+{
+    int num_to_send = rate * duration_sec;
+    int64_t period_usec = 1000000 / rate;
+
+    BenchSamples encode_usec(num_to_send);
+
+    std::vector<uint8_t> buffer;
+    buffer.reserve(1024 * 1024);
+
+    ShmRingWriter ring;
+
+    if (shm_name.length() > 0) {
+        int size = EncodeMessage(0, 0, &buffer);
+
+        if (ring.Open(shm_name, SHM_RING_DEFAULT_SLOTS, std::max(size, SHM_RING_DEFAULT_SLOT_SIZE)) != true) {
+            fprintf(stderr, "ERROR: failed to open shared memory ring %s.\n", shm_name.c_str());
+            exit(1);
+        }
+    }
+
+    // calibrates the cycle counter now instead of in the first sample
+    CyclesToUsec(0);
+
+    int64_t num_sent = 0;
+    int64_t bytes_sent = 0;
+
+    int64_t next_send = GetMonotonicNow();
+
+    for (int i = 0; i < num_to_send; i++) {
+
+        int64_t stamp = GetTimestampNow();
+
+        uint64_t start = GetCycleCount();
+        int size = EncodeMessage(stamp, i, &buffer);
+        encode_usec.Add(CyclesToUsec(GetCycleCount() - start));
+
+        if (size < 0) {
+            fprintf(stderr, "ERROR: failed to encode.\n");
+            exit(1);
+        }
+
+        bool sent;
+
+        if (shm_name.length() > 0) {
+            sent = ring.Write(buffer.data(), size);
+        } else {
+            sent = lcm_publish(lcm, channel.c_str(), buffer.data(), size) == 0;
+        }
+
+        if (sent) {
+            num_sent ++;
+            bytes_sent += size;
+        }
+
+        next_send += period_usec;
+
+        int64_t wait = next_send - GetMonotonicNow();
+
+        if (wait > 0) {
+            usleep(wait);
+        }
+    }
+
+    lcmt_lcm_bench_done done;
+
+    done.timestamp = GetTimestampNow();
+    done.message_type = (char*)type_name.c_str();
+    done.num_sent = num_sent;
+    done.bytes_sent = bytes_sent;
+
+    lcmt_lcm_bench_done_publish(lcm, done_channel.c_str(), &done);
+
+    printf("Sent %lld %s messages (%lld bytes each).\n\n", (long long)num_sent, type_name.c_str(),
+        num_sent > 0 ? (long long)(bytes_sent / num_sent) : 0LL);
+
+    BenchSamples::PrintHeader(stdout);
+    encode_usec.Print(stdout, "encode");
+}
+
+// receiver state
+BenchSamples *decode_usec;
+BenchSamples *latency_usec;
+
+int64_t num_received = 0;
+int64_t num_bad = 0;
+int64_t bytes_received = 0;
+int64_t first_receive = -1;
+int64_t last_receive = -1;
+
+bool sender_done = false;
+lcmt_lcm_bench_done done_msg;
+int64_t done_at = 0;
+
+void Receive(const void *data, int size)
+{
+    int64_t now = GetTimestampNow();
+
+    int64_t stamp;
+
+    uint64_t start = GetCycleCount();
+    bool ok = DecodeMessage(data, size, &stamp);
+    decode_usec->Add(CyclesToUsec(GetCycleCount() - start));
+
+    if (ok != true) {
+        num_bad ++;
+        return;
+    }
+
+    latency_usec->Add(now - stamp);
+
+    num_received ++;
+    bytes_received += size;
+
+    if (first_receive < 0) {
+        first_receive = now;
+    }
+
+    last_receive = now;
+}
+
+void bench_handler(const lcm_recv_buf_t *rbuf, const char* channel, void *user)
+{
+    Receive(rbuf->data, rbuf->data_size);
+}
+
+void done_handler(const lcm_recv_buf_t *rbuf, const char* channel, const lcmt_lcm_bench_done *msg, void *user)
+{
+    sender_done = true;
+    done_at = GetMonotonicNow();
+
+    done_msg.num_sent = msg->num_sent;
+    done_msg.bytes_sent = msg->bytes_sent;
+
+    if (type_name != msg->message_type) {
+        fprintf(stderr, "WARNING: sender sent %s, but we're decoding %s.\n", msg->message_type, type_name.c_str());
+    }
+}
+
+void RunReceiver(int max_messages)
+{
+    decode_usec = new BenchSamples(max_messages);
+    latency_usec = new BenchSamples(max_messages);
+
+    CyclesToUsec(0);
+
+    LcmReactor reactor(lcm);
+
+    lcm_subscription_t *bench_sub = NULL;
+    ShmRingReader ring;
+    std::vector<uint8_t> ring_data;
+
+    if (shm_name.length() > 0) {
+        // the sender makes the ring
+        while (ring.Open(shm_name) != true) {
+            usleep(100000);
+        }
+
+        int ring_fd = ring.StartNotifier();
+
+        reactor.AddFd(ring_fd, [&]() {
+            uint64_t count;
+
+            if (read(ring_fd, &count, sizeof(count)) < 0) {
+                // already cleared
+            }
+
+            while (ring.Read(&ring_data)) {
+                Receive(ring_data.data(), ring_data.size());
+            }
+        });
+    } else {
+        bench_sub = lcm_subscribe(lcm, channel.c_str(), &bench_handler, NULL);
+    }
+
+    lcmt_lcm_bench_done_subscription_t *done_sub = lcmt_lcm_bench_done_subscribe(lcm, done_channel.c_str(), &done_handler, NULL);
+
+    printf("Waiting for %s messages on %s...\n", type_name.c_str(),
+        shm_name.length() > 0 ? ("shared memory ring " + shm_name).c_str() : channel.c_str());
+
+    // wait a little after the sender's done for the last ones in flight
+    while (sender_done == false || GetMonotonicNow() - done_at < 500000) {
+        reactor.WaitAndHandle(100);
+    }
+
+    int64_t num_dropped = done_msg.num_sent - num_received;
+
+    if (shm_name.length() > 0) {
+        // the ring says how many it skipped ahead of us
+        num_dropped = std::max(num_dropped, ring.GetNumDropped());
+    }
+
+    double elapsed_sec = std::max(last_receive - first_receive, (int64_t)1) / 1000000.0;
+
+    printf("\nReceived %lld of %lld %s messages (%.2f%% dropped), %lld didn't decode.\n",
+        (long long)num_received, (long long)done_msg.num_sent, type_name.c_str(),
+        done_msg.num_sent > 0 ? 100.0 * num_dropped / done_msg.num_sent : 0.0, (long long)num_bad);
+
+    printf("%.1f messages/sec, %.2f MB/sec\n\n", num_received / elapsed_sec, bytes_received / elapsed_sec / 1000000.0);
+
+    BenchSamples::PrintHeader(stdout);
+    decode_usec->Print(stdout, "decode");
+    latency_usec->Print(stdout, "latency");
+
+    if (bench_sub != NULL) {
+        lcm_unsubscribe(lcm, bench_sub);
+    }
+
+    lcmt_lcm_bench_done_unsubscribe(lcm, done_sub);
+}
+
+int main(int argc,char** argv)
+{
+    bool send = false;
+    double rate = 30;
+    double duration_sec = 10;
+    int num_points = 2000;
+    int image_bytes = 25000;
+    int max_messages = 1000000;
+    std::string lcm_url = "udpm://239.255.76.67:7667?ttl=0";
+
+    ConciseArgs parser(argc, argv);
+    parser.add(send, "s", "send", "Send (otherwise receive).");
+    parser.add(type_name, "t", "type", "Message type: stereo, pose, or image.");
+    parser.add(rate, "r", "rate", "Messages per second to send.");
+    parser.add(duration_sec, "d", "duration", "Seconds to send for.");
+    parser.add(num_points, "n", "num-points", "Points in each stereo message.");
+    parser.add(image_bytes, "b", "image-bytes", "Bytes of JPEG in each image message.");
+    parser.add(max_messages, "x", "max-messages", "Most messages the receiver keeps timings for.");
+    parser.add(channel, "c", "channel", "LCM channel to send on.");
+    parser.add(shm_name, "m", "shm-ring", "Send on this shared memory ring instead of LCM.");
+    parser.add(lcm_url, "u", "lcm-url", "LCM URL (for the transport).");
+    parser.parse();
+
+    if (type_name == "stereo") {
+        bench_type = BENCH_STEREO;
+    } else if (type_name == "pose") {
+        bench_type = BENCH_POSE;
+    } else if (type_name == "image") {
+        bench_type = BENCH_IMAGE;
+    } else {
+        fprintf(stderr, "ERROR: unknown message type %s (stereo, pose, or image).\n", type_name.c_str());
+        return 1;
+    }
+
+    lcm = lcm_create (lcm_url.c_str());
+    if (!lcm)
+    {
+        fprintf(stderr, "lcm_create failed.  Quitting.\n");
+        return 1;
+    }
+
+    if (send) {
+        srand(GetTimestampNow());
+        MakeMessage(num_points, image_bytes);
+
+        RunSender(rate, duration_sec);
+    } else {
+        RunReceiver(max_messages);
+    }
+
+    lcm_destroy (lcm);
+
+    return 0;
+}
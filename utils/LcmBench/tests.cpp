@@ -0,0 +1,47 @@
+#include "LcmBench.hpp"
+#include "gtest/gtest.h"
+
+TEST(LcmBench, Percentiles) {
+    BenchSamples samples(1000);
+
+    // 1 to 100, out of order
+    for (int i = 0; i < 100; i++) {
+        samples.Add((i * 37) % 100 + 1);
+    }
+
+    BenchSummary summary;
+    samples.GetSummary(&summary);
+
+    EXPECT_EQ(summary.count, 100);
+    EXPECT_DOUBLE_EQ(summary.mean, 50.5);
+    EXPECT_DOUBLE_EQ(summary.p50, 50);
+    EXPECT_DOUBLE_EQ(summary.p90, 90);
+    EXPECT_DOUBLE_EQ(summary.p99, 99);
+    EXPECT_DOUBLE_EQ(summary.max, 100);
+}
+
+TEST(LcmBench, Empty) {
+    BenchSamples samples(10);
+
+    BenchSummary summary;
+    samples.GetSummary(&summary);
+
+    EXPECT_EQ(summary.count, 0);
+    EXPECT_DOUBLE_EQ(summary.max, 0);
+}
+
+TEST(LcmBench, OverCapacityIsCounted) {
+    BenchSamples samples(10);
+
+    for (int i = 0; i < 15; i++) {
+        samples.Add(i);
+    }
+
+    BenchSummary summary;
+    samples.GetSummary(&summary);
+
+    // the first ten are kept
+    EXPECT_EQ(summary.count, 10);
+    EXPECT_DOUBLE_EQ(summary.max, 9);
+    EXPECT_EQ(samples.GetNumOverCapacity(), 5);
+}
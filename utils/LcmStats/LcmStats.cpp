@@ -0,0 +1,306 @@
+#include "LcmStats.hpp"
+
+#include <math.h>
+
+LcmStats::LcmStats() {
+    num_channels_ = 0;
+    num_dropped_messages_ = 0;
+
+    for (int i = 0; i < 2 * LCM_STATS_MAX_CHANNELS; i++) {
+        hash_table_[i] = -1;
+    }
+
+    ResetWindow(0);
+}
+
+/**
+ * Counts a message.
+ *
+ * @param channel channel it came in on
+ * @param recv_utime when it was received (wall clock, like liblcm's
+ *      recv_utime)
+ * @param data the encoded message
+ * @param data_size its size in bytes
+ */
+void LcmStats::AddMessage(const char *channel, int64_t recv_utime, const void *data, int data_size) {
+
+    int index = FindChannel(channel);
+
+    if (index < 0) {
+        num_dropped_messages_ ++;
+        return;
+    }
+
+    LcmChannelStats &stats = channels_[index];
+
+    stats.count ++;
+    stats.bytes += data_size;
+
+    if (stats.last_utime >= 0) {
+        int64_t interval = std::max(recv_utime - stats.last_utime, (int64_t)0);
+
+        stats.num_intervals ++;
+        stats.interval_sum += interval;
+        stats.interval_sum_squares += (double)interval * interval;
+        stats.interval_max = std::max(stats.interval_max, interval);
+    }
+
+    stats.last_utime = recv_utime;
+
+    int64_t timestamp;
+
+    if (GetMessageTimestamp(data, data_size, recv_utime, &timestamp)) {
+        // a little negative is clock skew between machines
+        int64_t latency = std::max(recv_utime - timestamp, (int64_t)0);
+
+        stats.latency_counts[Bucket(latency)] ++;
+        stats.latency_max = std::max(stats.latency_max, latency);
+    }
+}
+
+/**
+ * Reads the int64_t right after the fingerprint, if it looks like a
+ * timestamp (see LcmStats.hpp).
+ *
+ * @param data the encoded message
+ * @param data_size its size in bytes
+ * @param recv_utime when it was received
+ * @param timestamp (output) the timestamp
+ *
+ * @retval true if the message starts with a timestamp
+ */
+bool LcmStats::GetMessageTimestamp(const void *data, int data_size, int64_t recv_utime, int64_t *timestamp) {
+
+    if (data_size < 16) {
+        return false;
+    }
+
+    // LCM encodes big endian
+    const uint8_t *bytes = (const uint8_t*)data + 8;
+    uint64_t value = 0;
+
+    for (int i = 0; i < 8; i++) {
+        value = (value << 8) | bytes[i];
+    }
+
+    *timestamp = (int64_t)value;
+
+    int64_t offset = recv_utime - *timestamp;
+
+    return offset < LCM_STATS_MAX_STAMP_OFFSET_USEC && offset > -LCM_STATS_MAX_STAMP_OFFSET_USEC;
+}
+
+/**
+ * Finds a channel's index, adding it if it's new.
+ *
+ * @retval index into channels_, or -1 if the table is full
+ */
+int LcmStats::FindChannel(const char *channel) {
+
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+
+    for (const char *c = channel; *c != '\0'; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+
+    for (int probe = 0; probe < 2 * LCM_STATS_MAX_CHANNELS; probe++) {
+        int slot = (hash + probe) % (2 * LCM_STATS_MAX_CHANNELS);
+        int index = hash_table_[slot];
+
+        if (index >= 0) {
+            if (strncmp(channels_[index].name, channel, LCM_STATS_MAX_CHANNEL_NAME - 1) == 0) {
+                return index;
+            }
+            continue;
+        }
+
+        if (num_channels_ >= LCM_STATS_MAX_CHANNELS) {
+            return -1;
+        }
+
+        index = num_channels_;
+        num_channels_ ++;
+
+        LcmChannelStats &stats = channels_[index];
+
+        memset(&stats, 0, sizeof(stats));
+        strncpy(stats.name, channel, LCM_STATS_MAX_CHANNEL_NAME - 1);
+        stats.last_utime = -1;
+
+        hash_table_[slot] = index;
+
+        return index;
+    }
+
+    return -1;
+}
+
+/**
+ * Histogram bucket for a latency: 4 per power of two, from the position of
+ * the top bit and the two bits below it.
+ */
+int LcmStats::Bucket(int64_t latency_us) {
+
+    int duration = (int)std::min(latency_us, (int64_t)INT32_MAX);
+    int bucket = duration;
+
+    if (duration >= 4) {
+        int top_bit = 31 - __builtin_clz(duration);
+        bucket = top_bit * 4 + ((duration >> (top_bit - 2)) & 3) - 4;
+    }
+
+    return std::min(bucket, LCM_STATS_BUCKETS - 1);
+}
+
+/**
+ * Top of a histogram bucket, in microseconds (see Bucket()).
+ */
+int LcmStats::BucketTop(int bucket) {
+    if (bucket < 4) {
+        return bucket;
+    }
+
+    int top_bit = (bucket + 4) / 4;
+    int fraction = (bucket + 4) % 4;
+
+    return ((4 + fraction + 1) << (top_bit - 2)) - 1;
+}
+
+/**
+ * Summarizes a channel since the last ResetWindow().
+ *
+ * @param index channel, from 0 to GetNumChannels() - 1
+ * @param now current time (same clock as the receive times)
+ * @param summary (output) its stats.  The channel name points into this
+ *      object.
+ */
+void LcmStats::GetSummary(int index, int64_t now, LcmChannelSummary *summary) const {
+
+    const LcmChannelStats &stats = channels_[index];
+    double window_sec = GetWindowSec(now);
+
+    summary->channel = stats.name;
+
+    summary->rate_hz = stats.count / window_sec;
+    summary->bytes_per_sec = stats.bytes / window_sec;
+
+    summary->interval_stddev_ms = 0;
+    summary->interval_max_ms = stats.interval_max / 1000.0f;
+
+    if (stats.num_intervals > 1) {
+        double mean = stats.interval_sum / stats.num_intervals;
+        double variance = (stats.interval_sum_squares - stats.num_intervals * mean * mean) / (stats.num_intervals - 1);
+
+        summary->interval_stddev_ms = sqrt(std::max(variance, 0.0)) / 1000.0;
+    }
+
+    summary->age_sec = stats.last_utime < 0 ? -1 : (now - stats.last_utime) / 1000000.0f;
+
+    int64_t total = 0;
+
+    for (int i = 0; i < LCM_STATS_BUCKETS; i++) {
+        total += stats.latency_counts[i];
+    }
+
+    summary->latency_count = total;
+    summary->latency_p50_ms = 0;
+    summary->latency_p99_ms = 0;
+    summary->latency_max_ms = stats.latency_max / 1000.0f;
+
+    int64_t so_far = 0;
+    bool have_p50 = false;
+
+    for (int i = 0; i < LCM_STATS_BUCKETS && total > 0; i++) {
+        so_far += stats.latency_counts[i];
+
+        float top_ms = std::min(BucketTop(i) / 1000.0f, summary->latency_max_ms);
+
+        if (!have_p50 && so_far * 2 >= total) {
+            summary->latency_p50_ms = top_ms;
+            have_p50 = true;
+        }
+
+        if (so_far * 100 >= total * 99) {
+            summary->latency_p99_ms = top_ms;
+            break;
+        }
+    }
+}
+
+/**
+ * Rate and bandwidth of every tracked channel together since the last
+ * ResetWindow().
+ */
+void LcmStats::GetTotals(int64_t now, float *rate_hz, float *bytes_per_sec) const {
+
+    int64_t count = 0;
+    int64_t bytes = 0;
+
+    for (int i = 0; i < num_channels_; i++) {
+        count += channels_[i].count;
+        bytes += channels_[i].bytes;
+    }
+
+    double window_sec = GetWindowSec(now);
+
+    *rate_hz = count / window_sec;
+    *bytes_per_sec = bytes / window_sec;
+}
+
+void LcmStats::Print(FILE *out, int64_t now) const {
+
+    fprintf(out, "%-32s %9s %10s %11s %10s %9s %9s %9s\n", "channel", "rate Hz", "KB/s",
+        "jitter ms", "gap ms", "age s", "lat p50", "lat p99");
+
+    for (int i = 0; i < num_channels_; i++) {
+        LcmChannelSummary summary;
+        GetSummary(i, now, &summary);
+
+        fprintf(out, "%-32s %9.1f %10.1f %11.2f %10.1f %9.1f", summary.channel, summary.rate_hz,
+            summary.bytes_per_sec / 1000.0f, summary.interval_stddev_ms, summary.interval_max_ms,
+            summary.age_sec);
+
+        if (summary.latency_count > 0) {
+            fprintf(out, " %9.2f %9.2f\n", summary.latency_p50_ms, summary.latency_p99_ms);
+        } else {
+            fprintf(out, " %9s %9s\n", "-", "-");
+        }
+    }
+
+    float rate_hz, bytes_per_sec;
+    GetTotals(now, &rate_hz, &bytes_per_sec);
+
+    fprintf(out, "%-32s %9.1f %10.1f\n", "total", rate_hz, bytes_per_sec / 1000.0f);
+
+    if (num_dropped_messages_ > 0) {
+        fprintf(out, "(%lld messages on channels past the first %d)\n", (long long)num_dropped_messages_,
+            LCM_STATS_MAX_CHANNELS);
+    }
+}
+
+/**
+ * Starts a new window.  Channels and their last message times are kept, so
+ * the first interval in the new window is still counted.
+ *
+ * @param now current time (same clock as the receive times)
+ */
+void LcmStats::ResetWindow(int64_t now) {
+
+    for (int i = 0; i < num_channels_; i++) {
+        LcmChannelStats &stats = channels_[i];
+
+        stats.count = 0;
+        stats.bytes = 0;
+
+        stats.num_intervals = 0;
+        stats.interval_sum = 0;
+        stats.interval_sum_squares = 0;
+        stats.interval_max = 0;
+
+        memset(stats.latency_counts, 0, sizeof(stats.latency_counts));
+        stats.latency_max = 0;
+    }
+
+    window_start_ = now;
+}
@@ -0,0 +1,119 @@
+#ifndef LCM_STATS_HPP
+#define LCM_STATS_HPP
+
+/*
+ * Per channel statistics for everything on the LCM bus, like lcm-spy shows
+ * but headless: message rate, bytes per second, the time between messages
+ * (its standard deviation is the jitter) and, for messages that start with
+ * a timestamp, how long they took from being stamped to being received.
+ *
+ * Memory is fixed: a table of LCM_STATS_MAX_CHANNELS channels, each with
+ * running sums for the current window and a latency histogram.  Messages
+ * on channels past that are counted, not tracked.
+ *
+ * A message "starts with a timestamp" if its first field (after LCM's 8 byte
+ * type fingerprint) is an int64_t within LCM_STATS_MAX_STAMP_OFFSET_USEC of
+ * the receive time.  That catches nearly every lcmt_ type and pronto's
+ * utime, and a first field that's something else is almost never that
+ * close to the current time in microseconds.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+// channels tracked
+#define LCM_STATS_MAX_CHANNELS 256
+
+// LCM's channel name limit, plus the terminator
+#define LCM_STATS_MAX_CHANNEL_NAME 64
+
+// latency histogram buckets: 4 per power of two microseconds, up to about
+// 1 second
+#define LCM_STATS_BUCKETS 80
+
+// a first field further than this from the receive time isn't a timestamp
+#define LCM_STATS_MAX_STAMP_OFFSET_USEC 10000000
+
+// Stats for a channel over the current window.
+struct LcmChannelSummary {
+    const char *channel;
+
+    float rate_hz;
+    float bytes_per_sec;
+
+    float interval_stddev_ms;
+    float interval_max_ms;
+
+    float age_sec;
+
+    int latency_count;
+    float latency_p50_ms;
+    float latency_p99_ms;
+    float latency_max_ms;
+};
+
+struct LcmChannelStats {
+    char name[LCM_STATS_MAX_CHANNEL_NAME];
+
+    int64_t last_utime;     // -1 before the first message
+
+    // this window
+    int64_t count;
+    int64_t bytes;
+
+    int64_t num_intervals;
+    double interval_sum;    // usec
+    double interval_sum_squares;
+    int64_t interval_max;
+
+    int64_t latency_counts[LCM_STATS_BUCKETS];
+    int64_t latency_max;
+};
+
+class LcmStats {
+
+    public:
+        LcmStats();
+
+        void AddMessage(const char *channel, int64_t recv_utime, const void *data, int data_size);
+
+        void GetSummary(int index, int64_t now, LcmChannelSummary *summary) const;
+        void GetTotals(int64_t now, float *rate_hz, float *bytes_per_sec) const;
+
+        void Print(FILE *out, int64_t now) const;
+
+        void ResetWindow(int64_t now);
+
+        int GetNumChannels() const { return num_channels_; }
+        int64_t GetNumDroppedMessages() const { return num_dropped_messages_; }
+
+        double GetWindowSec(int64_t now) const { return std::max(now - window_start_, (int64_t)1) / 1000000.0; }
+
+        static bool GetMessageTimestamp(const void *data, int data_size, int64_t recv_utime, int64_t *timestamp);
+
+    private:
+        int FindChannel(const char *channel);
+
+        static int Bucket(int64_t latency_us);
+        static int BucketTop(int bucket);
+
+        LcmChannelStats channels_[LCM_STATS_MAX_CHANNELS];
+        int num_channels_;
+
+        // open addressing table of indexes into channels_, -1 for empty.
+        // Twice the channels so probes stay short.
+        int hash_table_[2 * LCM_STATS_MAX_CHANNELS];
+
+        // messages on channels that didn't fit in the table
+        int64_t num_dropped_messages_;
+
+        int64_t window_start_;
+};
+
+#endif
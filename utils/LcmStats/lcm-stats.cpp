@@ -0,0 +1,180 @@
+/*
+ * Headless lcm-spy: subscribes to every channel and publishes each one's
+ * rate, bandwidth, jitter and latency (see LcmStats.hpp) once a second, so
+ * a saturated multicast bus or a stalled producer shows up without anyone
+ * watching lcm-spy.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <iostream>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#include <lcm/lcm.h>
+
+#include "../../LCM/lcmt_lcm_stats.h"
+
+#include "../../externals/ConciseArgs.hpp"
+
+#include "../../utils/utils/RealtimeUtils.hpp"
+
+#include "LcmStats.hpp"
+
+lcm_t * lcm;
+
+lcm_subscription_t *all_sub;
+
+std::string stats_channel = "lcm-stats";
+
+LcmStats stats;
+
+// the message's arrays, made once
+char *channel_names[LCM_STATS_MAX_CHANNELS];
+float rate_hz[LCM_STATS_MAX_CHANNELS];
+float bytes_per_sec[LCM_STATS_MAX_CHANNELS];
+float interval_stddev_ms[LCM_STATS_MAX_CHANNELS];
+float interval_max_ms[LCM_STATS_MAX_CHANNELS];
+float age_sec[LCM_STATS_MAX_CHANNELS];
+int32_t latency_count[LCM_STATS_MAX_CHANNELS];
+float latency_p50_ms[LCM_STATS_MAX_CHANNELS];
+float latency_p99_ms[LCM_STATS_MAX_CHANNELS];
+float latency_max_ms[LCM_STATS_MAX_CHANNELS];
+
+void sighandler(int dum)
+{
+    printf("\n");
+    stats.Print(stdout, GetTimestampNow());
+
+    printf("\nClosing... ");
+
+    lcm_unsubscribe(lcm, all_sub);
+    lcm_destroy (lcm);
+
+    printf("done.\n");
+
+    exit(0);
+}
+
+void all_handler(const lcm_recv_buf_t *rbuf, const char* channel, void *user)
+{
+    if (stats_channel == channel) {
+        // don't count ourselves
+        return;
+    }
+
+    int64_t recv_utime = rbuf->recv_utime > 0 ? rbuf->recv_utime : GetTimestampNow();
+
+    stats.AddMessage(channel, recv_utime, rbuf->data, rbuf->data_size);
+}
+
+void PublishStats(int64_t now)
+{
+    lcmt_lcm_stats msg;
+
+    msg.timestamp = now;
+    msg.period_sec = stats.GetWindowSec(now);
+    msg.num_dropped_messages = stats.GetNumDroppedMessages();
+
+    stats.GetTotals(now, &msg.total_rate_hz, &msg.total_bytes_per_sec);
+
+    msg.num_channels = stats.GetNumChannels();
+
+    for (int i = 0; i < msg.num_channels; i++) {
+        LcmChannelSummary summary;
+        stats.GetSummary(i, now, &summary);
+
+        channel_names[i] = (char*)summary.channel;
+        rate_hz[i] = summary.rate_hz;
+        bytes_per_sec[i] = summary.bytes_per_sec;
+        interval_stddev_ms[i] = summary.interval_stddev_ms;
+        interval_max_ms[i] = summary.interval_max_ms;
+        age_sec[i] = summary.age_sec;
+        latency_count[i] = summary.latency_count;
+        latency_p50_ms[i] = summary.latency_p50_ms;
+        latency_p99_ms[i] = summary.latency_p99_ms;
+        latency_max_ms[i] = summary.latency_max_ms;
+    }
+
+    msg.channel = channel_names;
+    msg.rate_hz = rate_hz;
+    msg.bytes_per_sec = bytes_per_sec;
+    msg.interval_stddev_ms = interval_stddev_ms;
+    msg.interval_max_ms = interval_max_ms;
+    msg.age_sec = age_sec;
+    msg.latency_count = latency_count;
+    msg.latency_p50_ms = latency_p50_ms;
+    msg.latency_p99_ms = latency_p99_ms;
+    msg.latency_max_ms = latency_max_ms;
+
+    lcmt_lcm_stats_publish(lcm, stats_channel.c_str(), &msg);
+}
+
+int main(int argc,char** argv)
+{
+    double rate = 1;
+    double print_every_sec = 0;
+
+    ConciseArgs parser(argc, argv);
+    parser.add(stats_channel, "c", "stats-channel", "LCM channel to publish stats on.");
+    parser.add(rate, "r", "rate", "Stats messages per second.");
+    parser.add(print_every_sec, "v", "print-every", "Seconds between printing the table (0 for never).");
+    parser.parse();
+
+    lcm = lcm_create ("udpm://239.255.76.67:7667?ttl=0");
+    if (!lcm)
+    {
+        fprintf(stderr, "lcm_create for recieve failed.  Quitting.\n");
+        return 1;
+    }
+
+    all_sub = lcm_subscribe(lcm, ".*", &all_handler, NULL);
+
+    signal(SIGINT,sighandler);
+
+    printf("Receiving LCM:\n\tAll channels\nPublishing LCM:\n\tStats: %s\n", stats_channel.c_str());
+
+    LcmReactor reactor(lcm);
+
+    int64_t period_usec = 1000000 / rate;
+    int64_t print_every_usec = print_every_sec * 1000000;
+
+    // the window is on the receive times' clock (the wall clock), the
+    // schedule on the monotonic one
+    stats.ResetWindow(GetTimestampNow());
+
+    int64_t next_tick = GetMonotonicNow() + period_usec;
+    int64_t next_print = GetMonotonicNow() + print_every_usec;
+
+    while (true)
+    {
+        int64_t now = GetMonotonicNow();
+
+        if (now >= next_tick) {
+            int64_t wall_now = GetTimestampNow();
+
+            if (print_every_usec > 0 && now >= next_print) {
+                printf("\n");
+                stats.Print(stdout, wall_now);
+
+                next_print = now + print_every_usec;
+            }
+
+            PublishStats(wall_now);
+            stats.ResetWindow(wall_now);
+
+            next_tick += period_usec;
+
+            if (next_tick < now) {
+                next_tick = now + period_usec;
+            }
+        }
+
+        reactor.WaitAndHandle((next_tick - now) / 1000 + 1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,6 @@
+TARGET = test
+
+SOURCES = LcmStats.cpp tests.cpp
+
+
+include ../../utils/make/flight.mk
@@ -0,0 +1,168 @@
+#include "LcmStats.hpp"
+#include "gtest/gtest.h"
+
+// an encoded message: a fingerprint, then its first field as a big endian
+// int64_t, then padding to size
+static void MakeMessage(int64_t first_field, int size, uint8_t *buf) {
+    memset(buf, 0xab, size);
+
+    for (int i = 0; i < 8; i++) {
+        buf[8 + i] = (uint64_t)first_field >> (8 * (7 - i));
+    }
+}
+
+TEST(LcmStats, RateAndBandwidth) {
+    LcmStats stats;
+    uint8_t buf[100];
+
+    int64_t start = 1400000000000000;
+    stats.ResetWindow(start);
+
+    // 100 Hz of 100 byte messages for a second
+    for (int i = 0; i < 100; i++) {
+        MakeMessage(0, 100, buf);
+        stats.AddMessage("gps", start + i * 10000, buf, 100);
+    }
+
+    ASSERT_EQ(stats.GetNumChannels(), 1);
+
+    LcmChannelSummary summary;
+    stats.GetSummary(0, start + 1000000, &summary);
+
+    EXPECT_STREQ(summary.channel, "gps");
+    EXPECT_FLOAT_EQ(summary.rate_hz, 100);
+    EXPECT_FLOAT_EQ(summary.bytes_per_sec, 10000);
+
+    // evenly spaced, so no jitter
+    EXPECT_NEAR(summary.interval_stddev_ms, 0, 1e-3);
+    EXPECT_FLOAT_EQ(summary.interval_max_ms, 10);
+
+    EXPECT_NEAR(summary.age_sec, 0.01, 1e-6);
+
+    // first field isn't a timestamp
+    EXPECT_EQ(summary.latency_count, 0);
+}
+
+TEST(LcmStats, Jitter) {
+    LcmStats stats;
+    uint8_t buf[16];
+    MakeMessage(0, 16, buf);
+
+    // intervals alternating 5 and 15 ms
+    int64_t t = 1000000;
+    stats.AddMessage("imu", t, buf, 16);
+
+    for (int i = 0; i < 100; i++) {
+        t += i % 2 == 0 ? 5000 : 15000;
+        stats.AddMessage("imu", t, buf, 16);
+    }
+
+    LcmChannelSummary summary;
+    stats.GetSummary(0, t, &summary);
+
+    EXPECT_NEAR(summary.interval_stddev_ms, 5, 0.05);
+    EXPECT_FLOAT_EQ(summary.interval_max_ms, 15);
+}
+
+TEST(LcmStats, Latency) {
+    LcmStats stats;
+    uint8_t buf[32];
+
+    int64_t start = 1400000000000000;
+
+    // stamped 2 ms before they arrive, and one 40 ms before
+    for (int i = 0; i < 99; i++) {
+        int64_t recv = start + i * 10000;
+
+        MakeMessage(recv - 2000, 32, buf);
+        stats.AddMessage("pose", recv, buf, 32);
+    }
+
+    MakeMessage(start + 990000 - 40000, 32, buf);
+    stats.AddMessage("pose", start + 990000, buf, 32);
+
+    LcmChannelSummary summary;
+    stats.GetSummary(0, start + 1000000, &summary);
+
+    EXPECT_EQ(summary.latency_count, 100);
+
+    // rounded up to the top of the bucket
+    EXPECT_GE(summary.latency_p50_ms, 2.0f);
+    EXPECT_LE(summary.latency_p50_ms, 2.0f * 1.19f);
+    EXPECT_FLOAT_EQ(summary.latency_max_ms, 40);
+}
+
+TEST(LcmStats, TimestampDetection) {
+    uint8_t buf[16];
+    int64_t timestamp;
+
+    int64_t now = 1400000000000000;
+
+    MakeMessage(now - 5000, 16, buf);
+    EXPECT_TRUE(LcmStats::GetMessageTimestamp(buf, 16, now, &timestamp));
+    EXPECT_EQ(timestamp, now - 5000);
+
+    // a count, not a time
+    MakeMessage(42, 16, buf);
+    EXPECT_FALSE(LcmStats::GetMessageTimestamp(buf, 16, now, &timestamp));
+
+    // too short to have one
+    EXPECT_FALSE(LcmStats::GetMessageTimestamp(buf, 12, now, &timestamp));
+}
+
+TEST(LcmStats, ResetKeepsChannels) {
+    LcmStats stats;
+    uint8_t buf[16];
+    MakeMessage(0, 16, buf);
+
+    stats.ResetWindow(0);
+    stats.AddMessage("a", 100000, buf, 16);
+    stats.AddMessage("b", 200000, buf, 16);
+
+    stats.ResetWindow(1000000);
+
+    ASSERT_EQ(stats.GetNumChannels(), 2);
+
+    LcmChannelSummary summary;
+    stats.GetSummary(1, 2000000, &summary);
+
+    EXPECT_STREQ(summary.channel, "b");
+    EXPECT_FLOAT_EQ(summary.rate_hz, 0);
+
+    // a stalled producer: nothing for 1.8 seconds
+    EXPECT_NEAR(summary.age_sec, 1.8, 1e-6);
+
+    // the first message after the reset still has its interval
+    stats.AddMessage("b", 2000000, buf, 16);
+    stats.GetSummary(1, 2000000, &summary);
+
+    EXPECT_FLOAT_EQ(summary.interval_max_ms, 1800);
+}
+
+TEST(LcmStats, ManyChannels) {
+    LcmStats stats;
+    uint8_t buf[16];
+    MakeMessage(0, 16, buf);
+
+    char name[LCM_STATS_MAX_CHANNEL_NAME];
+
+    for (int i = 0; i < LCM_STATS_MAX_CHANNELS + 10; i++) {
+        snprintf(name, sizeof(name), "channel-%d", i);
+
+        stats.AddMessage(name, 1000, buf, 16);
+        stats.AddMessage(name, 2000, buf, 16);
+    }
+
+    EXPECT_EQ(stats.GetNumChannels(), LCM_STATS_MAX_CHANNELS);
+    EXPECT_EQ(stats.GetNumDroppedMessages(), 20);
+
+    // each tracked channel found again, not added twice
+    LcmChannelSummary summary;
+
+    for (int i = 0; i < LCM_STATS_MAX_CHANNELS; i++) {
+        snprintf(name, sizeof(name), "channel-%d", i);
+
+        stats.GetSummary(i, 2000, &summary);
+        EXPECT_STREQ(summary.channel, name);
+    }
+}
@@ -0,0 +1,180 @@
+#include "LogColumns.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fstream>
+#include <sstream>
+
+LogColumns::~LogColumns() {
+    for (auto &map : maps_) {
+        if (map.second.second > 0) {
+            munmap((void*)map.second.first, map.second.second);
+        }
+    }
+}
+
+/**
+ * Reads a converted log's manifest.  The fields are mapped as they're asked
+ * for.
+ *
+ * @param directory directory log_to_columns.py wrote
+ *
+ * @retval false if there's no readable manifest
+ */
+bool LogColumns::Open(const std::string &directory) {
+    directory_ = directory;
+    columns_.clear();
+
+    std::ifstream manifest((directory + "/" + LOG_COLUMNS_MANIFEST).c_str());
+
+    if (!manifest) {
+        fprintf(stderr, "Error: no %s in %s\n", LOG_COLUMNS_MANIFEST, directory.c_str());
+        return false;
+    }
+
+    std::string line;
+
+    while (std::getline(manifest, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        std::istringstream fields(line);
+
+        LogColumnInfo info;
+        std::string shape;
+
+        if (!(fields >> info.channel >> info.field >> info.type >> info.num_messages >> shape)) {
+            fprintf(stderr, "Error: bad line in %s: %s\n", LOG_COLUMNS_MANIFEST, line.c_str());
+            return false;
+        }
+
+        info.ragged = shape == "ragged";
+
+        if (!info.ragged) {
+            // "1", "3" or "4x4"
+            std::istringstream dims(shape);
+            std::string dim;
+
+            while (std::getline(dims, dim, 'x')) {
+                info.shape.push_back(atoi(dim.c_str()));
+            }
+        }
+
+        columns_.push_back(info);
+    }
+
+    return true;
+}
+
+const LogColumnInfo* LogColumns::GetColumnInfo(const std::string &channel, const std::string &field) const {
+    for (size_t i = 0; i < columns_.size(); i++) {
+        if (columns_[i].channel == channel && columns_[i].field == field) {
+            return &columns_[i];
+        }
+    }
+
+    return NULL;
+}
+
+int LogColumns::GetValuesPerMessage(const LogColumnInfo &info) {
+    int values = 1;
+
+    for (size_t i = 0; i < info.shape.size(); i++) {
+        values *= info.shape[i];
+    }
+
+    return values;
+}
+
+std::string LogColumns::GetChannelDirectory(const std::string &channel) {
+    // log_to_columns.py's channel_dir()
+    std::string name = channel;
+
+    for (size_t i = 0; i < name.size(); i++) {
+        unsigned char c = name[i];
+
+        if (!isalnum(c) && c != '_' && c != '.' && c != '-') {
+            name[i] = '_';
+        }
+    }
+
+    return name;
+}
+
+bool LogColumns::MapColumn(const LogColumnInfo &info, size_t value_size, const void **data, const void **offsets) {
+    std::string path = directory_ + "/" + GetChannelDirectory(info.channel) + "/" + info.field;
+
+    size_t data_size, expected_size;
+
+    if (info.ragged) {
+        size_t offsets_size;
+        *offsets = MapFile(path + ".offsets.bin", &offsets_size);
+
+        if (*offsets == NULL || offsets_size != (info.num_messages + 1) * sizeof(int64_t)) {
+            fprintf(stderr, "Error: %s.offsets.bin is missing or the wrong size\n", path.c_str());
+            return false;
+        }
+
+        expected_size = ((const int64_t*)*offsets)[info.num_messages] * value_size;
+    } else {
+        expected_size = info.num_messages * GetValuesPerMessage(info) * value_size;
+    }
+
+    *data = MapFile(path + ".bin", &data_size);
+
+    if (*data == NULL || data_size != expected_size) {
+        fprintf(stderr, "Error: %s.bin is missing or the wrong size\n", path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+const void* LogColumns::MapFile(const std::string &filename, size_t *size) {
+    auto existing = maps_.find(filename);
+
+    if (existing != maps_.end()) {
+        *size = existing->second.second;
+        return existing->second.first;
+    }
+
+    int fd = open(filename.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat file_stat;
+
+    if (fstat(fd, &file_stat) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    *size = file_stat.st_size;
+
+    // mmap() won't map nothing, but nothing will be read from it either
+    static const int64_t empty = 0;
+    const void *map = &empty;
+
+    if (*size > 0) {
+        map = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    maps_[filename] = std::make_pair(map, *size);
+
+    return map;
+}
@@ -0,0 +1,133 @@
+#ifndef LOG_COLUMNS_HPP
+#define LOG_COLUMNS_HPP
+
+/*
+ * Reads logs converted to columns by scripts/logs/log_to_columns.py: each
+ * field of each channel is a flat file, memory-mapped here, so getting every
+ * altitude in a flight is one mmap() instead of decoding the whole log.
+ *
+ *   LogColumns columns;
+ *   columns.Open("lcmlog-2015-05-01.00.columns");
+ *
+ *   LogColumn<double> pos;
+ *   columns.GetColumn("STATE_ESTIMATOR_POSE", "pos", &pos);
+ *
+ *   double z = pos.Get(i)[2];
+ *
+ * Variable-length fields (and strings) are "ragged": their values are all
+ * in one array, with offsets saying where each message's start.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <map>
+
+// the manifest, in the converted log's directory
+#define LOG_COLUMNS_MANIFEST "columns.txt"
+
+struct LogColumnInfo {
+    std::string channel;
+    std::string field;
+    std::string type;       // "float64", "int32", ... (see LogColumnType)
+    int64_t num_messages;
+
+    bool ragged;
+    std::vector<int> shape; // values per message, if not ragged
+};
+
+/**
+ * A memory-mapped field: valid as long as the LogColumns it came from.
+ */
+template <typename T>
+struct LogColumn {
+    const T *data;
+    int64_t num_messages;
+
+    int values_per_message;     // 0 if ragged
+    const int64_t *offsets;     // num_messages + 1 of them, if ragged
+
+    LogColumn() : data(NULL), num_messages(0), values_per_message(0), offsets(NULL) {}
+
+    const T* Get(int64_t message) const {
+        return offsets == NULL ? data + message * values_per_message : data + offsets[message];
+    }
+
+    int64_t GetSize(int64_t message) const {
+        return offsets == NULL ? values_per_message : offsets[message + 1] - offsets[message];
+    }
+};
+
+// the column type each C++ type reads
+template <typename T> struct LogColumnType;
+template <> struct LogColumnType<int8_t> { static const char* Name() { return "int8"; } };
+template <> struct LogColumnType<int16_t> { static const char* Name() { return "int16"; } };
+template <> struct LogColumnType<int32_t> { static const char* Name() { return "int32"; } };
+template <> struct LogColumnType<int64_t> { static const char* Name() { return "int64"; } };
+template <> struct LogColumnType<uint8_t> { static const char* Name() { return "uint8"; } };
+template <> struct LogColumnType<float> { static const char* Name() { return "float32"; } };
+template <> struct LogColumnType<double> { static const char* Name() { return "float64"; } };
+
+class LogColumns {
+
+    public:
+        LogColumns() {}
+        ~LogColumns();
+
+        bool Open(const std::string &directory);
+
+        const std::vector<LogColumnInfo>& GetColumns() const { return columns_; }
+        const LogColumnInfo* GetColumnInfo(const std::string &channel, const std::string &field) const;
+
+        /**
+         * Maps a field.
+         *
+         * @param channel channel name
+         * @param field field name ("pos", "pts.x", or "log_utime" for when the
+         *      log got each message)
+         * @param column (output) the field
+         *
+         * @retval false if there's no such field, it isn't of type T, or its
+         *      files are missing or the wrong size
+         */
+        template <typename T>
+        bool GetColumn(const std::string &channel, const std::string &field, LogColumn<T> *column) {
+            const LogColumnInfo *info = GetColumnInfo(channel, field);
+
+            if (info == NULL || info->type != LogColumnType<T>::Name()) {
+                return false;
+            }
+
+            const void *data, *offsets = NULL;
+
+            if (!MapColumn(*info, sizeof(T), &data, &offsets)) {
+                return false;
+            }
+
+            column->data = (const T*)data;
+            column->num_messages = info->num_messages;
+            column->values_per_message = info->ragged ? 0 : GetValuesPerMessage(*info);
+            column->offsets = (const int64_t*)offsets;
+
+            return true;
+        }
+
+    private:
+        bool MapColumn(const LogColumnInfo &info, size_t value_size, const void **data, const void **offsets);
+        const void* MapFile(const std::string &filename, size_t *size);
+
+        static int GetValuesPerMessage(const LogColumnInfo &info);
+        static std::string GetChannelDirectory(const std::string &channel);
+
+        std::string directory_;
+        std::vector<LogColumnInfo> columns_;
+
+        // filename -> mapping, so each file is mapped once
+        std::map<std::string, std::pair<const void*, size_t>> maps_;
+};
+
+#endif
@@ -0,0 +1,463 @@
+#include "LogIndex.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <thread>
+#include <algorithm>
+
+// sync word, event number, timestamp, channel length, data length
+#define LOG_EVENT_HEADER_SIZE (4 + 8 + 8 + 4 + 4)
+
+static int64_t ReadBigEndian(const uint8_t *bytes, int num_bytes) {
+    int64_t value = 0;
+
+    for (int i = 0; i < num_bytes; i++) {
+        value = (value << 8) | bytes[i];
+    }
+
+    return value;
+}
+
+static bool GetFileStats(const std::string &filename, int64_t *size, int64_t *mtime) {
+    struct stat file_stat;
+
+    if (stat(filename.c_str(), &file_stat) != 0) {
+        return false;
+    }
+
+    *size = file_stat.st_size;
+    *mtime = file_stat.st_mtime;
+    return true;
+}
+
+LogIndex::LogIndex() {
+    fd_ = -1;
+}
+
+LogIndex::~LogIndex() {
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+/**
+ * Opens a log, loading its index file if there is one that matches the log
+ * and otherwise building the index (and saving it, if it can).
+ *
+ * @param log_filename log to open
+ * @param save_index true to write the index next to the log after building it
+ *
+ * @retval false if the log couldn't be read
+ */
+bool LogIndex::Open(const std::string &log_filename, bool save_index) {
+    std::string index_filename = GetIndexFilename(log_filename);
+
+    if (Load(log_filename, index_filename)) {
+        return true;
+    }
+
+    if (!Build(log_filename)) {
+        return false;
+    }
+
+    if (save_index && !Save(index_filename)) {
+        // the log might be somewhere read-only, the index still works
+        fprintf(stderr, "Warning: could not write log index %s\n", index_filename.c_str());
+    }
+
+    return true;
+}
+
+/**
+ * Reads every event header in a log.  A partly-written event at the end
+ * (the logger is still running) is left out, and a corrupt event ends the
+ * index there with a warning.
+ *
+ * @param log_filename log to index
+ *
+ * @retval false if the log couldn't be opened
+ */
+bool LogIndex::Build(const std::string &log_filename) {
+    events_.clear();
+    channel_names_.clear();
+    channel_events_.clear();
+
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+
+    fd_ = open(log_filename.c_str(), O_RDONLY);
+
+    if (fd_ < 0) {
+        fprintf(stderr, "Error: could not open log %s\n", log_filename.c_str());
+        return false;
+    }
+
+    FILE *log = fopen(log_filename.c_str(), "rb");
+
+    if (log == NULL) {
+        fprintf(stderr, "Error: could not open log %s\n", log_filename.c_str());
+        return false;
+    }
+
+    // big reads, since most of what's read is skipped over anyway
+    setvbuf(log, NULL, _IOFBF, 1 << 20);
+
+    int64_t log_size, log_mtime;
+
+    if (!GetFileStats(log_filename, &log_size, &log_mtime)) {
+        fprintf(stderr, "Error: could not stat log %s\n", log_filename.c_str());
+        fclose(log);
+        return false;
+    }
+
+    uint8_t header[LOG_EVENT_HEADER_SIZE];
+    char channel[256];
+
+    int64_t offset = 0;
+    int last_channel = -1;
+
+    while (fread(header, 1, LOG_EVENT_HEADER_SIZE, log) == LOG_EVENT_HEADER_SIZE) {
+
+        int64_t channel_size = ReadBigEndian(header + 20, 4);
+        int64_t data_size = ReadBigEndian(header + 24, 4);
+
+        if ((uint32_t)ReadBigEndian(header, 4) != LOG_INDEX_LCM_SYNC
+            || channel_size <= 0 || channel_size >= (int64_t)sizeof(channel) || data_size < 0) {
+
+            fprintf(stderr, "Warning: corrupt event at offset %lld in %s, indexing stopped there.\n",
+                (long long)offset, log_filename.c_str());
+            break;
+        }
+
+        int64_t event_size = LOG_EVENT_HEADER_SIZE + channel_size + data_size;
+
+        if (offset + event_size > log_size
+            || fread(channel, 1, channel_size, log) != (size_t)channel_size
+            || fseeko(log, data_size, SEEK_CUR) != 0) {
+            break;
+        }
+
+        channel[channel_size] = '\0';
+
+        // most logs have long runs of the same channel
+        int channel_number = last_channel;
+
+        if (channel_number < 0 || channel_names_[channel_number] != channel) {
+            channel_number = GetChannel(channel);
+
+            if (channel_number < 0) {
+                channel_number = AddChannel(channel);
+            }
+
+            last_channel = channel_number;
+        }
+
+        LogIndexEvent event;
+        event.timestamp = ReadBigEndian(header + 12, 8);
+        event.offset = offset;
+        event.channel = channel_number;
+        event.data_size = data_size;
+
+        channel_events_[channel_number].push_back(events_.size());
+        events_.push_back(event);
+
+        offset += event_size;
+    }
+
+    fclose(log);
+    return true;
+}
+
+/**
+ * Writes the index to a file.  It records the log's size and modification
+ * time so Load() can tell if the log has changed since.
+ *
+ * @param index_filename file to write
+ *
+ * @retval false on a write error
+ */
+bool LogIndex::Save(const std::string &index_filename) const {
+    if (fd_ < 0) {
+        return false;
+    }
+
+    struct stat log_stat;
+
+    if (fstat(fd_, &log_stat) != 0) {
+        return false;
+    }
+
+    // write to a temporary file and rename it so a reader never sees half
+    // an index
+    std::string temp_filename = index_filename + ".tmp";
+
+    FILE *out = fopen(temp_filename.c_str(), "wb");
+
+    if (out == NULL) {
+        return false;
+    }
+
+    int64_t log_size = log_stat.st_size;
+    int64_t log_mtime = log_stat.st_mtime;
+    uint32_t num_channels = channel_names_.size();
+    uint64_t num_events = events_.size();
+
+    bool ok = fwrite(LOG_INDEX_MAGIC, 1, 8, out) == 8
+        && fwrite(&log_size, sizeof(log_size), 1, out) == 1
+        && fwrite(&log_mtime, sizeof(log_mtime), 1, out) == 1
+        && fwrite(&num_channels, sizeof(num_channels), 1, out) == 1;
+
+    for (uint32_t i = 0; ok && i < num_channels; i++) {
+        uint32_t length = channel_names_[i].size();
+
+        ok = fwrite(&length, sizeof(length), 1, out) == 1
+            && fwrite(channel_names_[i].data(), 1, length, out) == length;
+    }
+
+    ok = ok && fwrite(&num_events, sizeof(num_events), 1, out) == 1
+        && fwrite(events_.data(), sizeof(LogIndexEvent), num_events, out) == num_events;
+
+    ok = (fclose(out) == 0) && ok;
+
+    if (!ok || rename(temp_filename.c_str(), index_filename.c_str()) != 0) {
+        unlink(temp_filename.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Loads an index written by Save().
+ *
+ * @param log_filename log the index is for
+ * @param index_filename index file
+ *
+ * @retval false if there's no index, it's unreadable, or the log has
+ *      changed since it was written
+ */
+bool LogIndex::Load(const std::string &log_filename, const std::string &index_filename) {
+    events_.clear();
+    channel_names_.clear();
+    channel_events_.clear();
+
+    int64_t log_size, log_mtime;
+
+    if (!GetFileStats(log_filename, &log_size, &log_mtime)) {
+        return false;
+    }
+
+    FILE *in = fopen(index_filename.c_str(), "rb");
+
+    if (in == NULL) {
+        return false;
+    }
+
+    char magic[8];
+    int64_t index_log_size, index_log_mtime;
+    uint32_t num_channels;
+    uint64_t num_events;
+
+    bool ok = fread(magic, 1, 8, in) == 8 && memcmp(magic, LOG_INDEX_MAGIC, 8) == 0
+        && fread(&index_log_size, sizeof(index_log_size), 1, in) == 1
+        && fread(&index_log_mtime, sizeof(index_log_mtime), 1, in) == 1
+        && index_log_size == log_size && index_log_mtime == log_mtime
+        && fread(&num_channels, sizeof(num_channels), 1, in) == 1;
+
+    for (uint32_t i = 0; ok && i < num_channels; i++) {
+        uint32_t length;
+        char channel[256];
+
+        ok = fread(&length, sizeof(length), 1, in) == 1 && length < sizeof(channel)
+            && fread(channel, 1, length, in) == length;
+
+        if (ok) {
+            AddChannel(std::string(channel, length));
+        }
+    }
+
+    ok = ok && fread(&num_events, sizeof(num_events), 1, in) == 1;
+
+    if (ok) {
+        events_.resize(num_events);
+        ok = fread(events_.data(), sizeof(LogIndexEvent), num_events, in) == num_events;
+    }
+
+    fclose(in);
+
+    for (size_t i = 0; ok && i < events_.size(); i++) {
+        if (events_[i].channel >= num_channels) {
+            ok = false;
+        } else {
+            channel_events_[events_[i].channel].push_back(i);
+        }
+    }
+
+    if (ok) {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+
+        fd_ = open(log_filename.c_str(), O_RDONLY);
+        ok = fd_ >= 0;
+    }
+
+    if (!ok) {
+        events_.clear();
+        channel_names_.clear();
+        channel_events_.clear();
+    }
+
+    return ok;
+}
+
+/**
+ * @param name channel name
+ *
+ * @retval the channel's number or -1 if it's not in the log
+ */
+int LogIndex::GetChannel(const std::string &name) const {
+    for (size_t i = 0; i < channel_names_.size(); i++) {
+        if (channel_names_[i] == name) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+int LogIndex::AddChannel(const std::string &name) {
+    channel_names_.push_back(name);
+    channel_events_.push_back(std::vector<size_t>());
+
+    return channel_names_.size() - 1;
+}
+
+/**
+ * @param utime time to find
+ *
+ * @retval the first event at or after utime, or GetNumEvents() if there
+ *      isn't one
+ */
+size_t LogIndex::Seek(int64_t utime) const {
+    return std::lower_bound(events_.begin(), events_.end(), utime,
+        [](const LogIndexEvent &event, int64_t t) { return event.timestamp < t; }) - events_.begin();
+}
+
+/**
+ * @param channel channel number
+ * @param utime time to find
+ *
+ * @retval position in GetChannelEvents(channel) of the first event at or
+ *      after utime, or its size if there isn't one
+ */
+size_t LogIndex::SeekChannel(int channel, int64_t utime) const {
+    const std::vector<size_t> &channel_events = channel_events_[channel];
+
+    return std::lower_bound(channel_events.begin(), channel_events.end(), utime,
+        [this](size_t event, int64_t t) { return events_[event].timestamp < t; }) - channel_events.begin();
+}
+
+size_t LogIndex::CountChannel(int channel, int64_t start_utime, int64_t end_utime) const {
+    size_t start = SeekChannel(channel, start_utime);
+    size_t end = SeekChannel(channel, end_utime);
+
+    return end > start ? end - start : 0;
+}
+
+/**
+ * Reads an event's data.  Safe to call from several threads.
+ *
+ * @param event event number
+ * @param data (output) the message bytes
+ *
+ * @retval false on a read error
+ */
+bool LogIndex::ReadEvent(size_t event, std::vector<uint8_t> *data) const {
+    const LogIndexEvent &this_event = events_[event];
+
+    data->resize(this_event.data_size);
+
+    off_t offset = this_event.offset + LOG_EVENT_HEADER_SIZE + channel_names_[this_event.channel].size();
+    size_t done = 0;
+
+    while (done < this_event.data_size) {
+        ssize_t num_read = pread(fd_, data->data() + done, this_event.data_size - done, offset + done);
+
+        if (num_read <= 0) {
+            return false;
+        }
+
+        done += num_read;
+    }
+
+    return true;
+}
+
+/**
+ * Reads every event on a channel in a time range and hands each to a
+ * function, on several threads.  The events are split up as the threads
+ * ask for them, so a few large messages don't hold up one thread.
+ *
+ * @param channel channel to read
+ * @param start_utime only events at or after this time
+ * @param end_utime only events before this time
+ * @param function called with each event's number (0 for the first one in
+ *      the range), the event, and its data.  Returns false if it couldn't
+ *      use the event.
+ * @param num_threads threads to read on
+ *
+ * @retval number of events that couldn't be read or that function returned
+ *      false for, or -1 if the channel isn't in the log
+ */
+int LogIndex::ForEachEvent(const std::string &channel, int64_t start_utime, int64_t end_utime,
+    LogIndexEventFunction function, int num_threads) const {
+
+    int channel_number = GetChannel(channel);
+
+    if (channel_number < 0) {
+        return -1;
+    }
+
+    const std::vector<size_t> &channel_events = channel_events_[channel_number];
+
+    size_t start = SeekChannel(channel_number, start_utime);
+    size_t count = CountChannel(channel_number, start_utime, end_utime);
+
+    std::atomic<size_t> next(0);
+    std::atomic<int> num_failed(0);
+
+    auto worker = [&]() {
+        std::vector<uint8_t> data;
+
+        for (size_t i = next++; i < count; i = next++) {
+            size_t event = channel_events[start + i];
+
+            if (!ReadEvent(event, &data) || !function(i, events_[event], data.data())) {
+                num_failed++;
+            }
+        }
+    };
+
+    num_threads = std::max(1, std::min(num_threads, (int)count));
+
+    std::vector<std::thread> threads;
+
+    for (int i = 1; i < num_threads; i++) {
+        threads.push_back(std::thread(worker));
+    }
+
+    worker();
+
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+
+    return num_failed;
+}
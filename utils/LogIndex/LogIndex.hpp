@@ -0,0 +1,133 @@
+#ifndef LOG_INDEX_HPP
+#define LOG_INDEX_HPP
+
+/*
+ * Random access into LCM logs.  The index is every event's time, channel,
+ * size and offset in the log, made by reading only the event headers (the
+ * data is skipped over) and saved next to the log as <log>.idx, so the next
+ * tool to open the log loads it instead.
+ *
+ * With it, finding a time is a binary search instead of a replay from the
+ * start, and a channel's messages can be read and decoded on several
+ * threads at once (each read is a pread(), so the threads don't share a
+ * file position):
+ *
+ *   LogIndex index;
+ *   index.Open("lcmlog-2015-05-01.00");
+ *
+ *   std::vector<mav::pose_t> poses;
+ *   index.DecodeChannel("STATE_ESTIMATOR_POSE", &poses);
+ *
+ * Seeking by time assumes the log's timestamps don't go backwards, which is
+ * how lcm-logger writes them (unless the computer's clock was set during
+ * the flight).
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <functional>
+
+// first bytes of every event in an LCM log
+#define LOG_INDEX_LCM_SYNC 0xEDA1DA01
+
+// first bytes of an index file, and its version
+#define LOG_INDEX_MAGIC "LCMIDX01"
+
+// threads DecodeChannel() and ForEachEvent() use by default
+#define LOG_INDEX_DEFAULT_THREADS 4
+
+struct LogIndexEvent {
+    int64_t timestamp;
+    int64_t offset;     // of the event's header in the log
+    uint32_t channel;   // index into GetChannelName()
+    uint32_t data_size;
+};
+
+// called with an event's number (among the ones asked for), the event,
+// and its data, from several threads at once
+typedef std::function<bool(size_t, const LogIndexEvent&, const uint8_t*)> LogIndexEventFunction;
+
+class LogIndex {
+
+    public:
+        LogIndex();
+        ~LogIndex();
+
+        bool Open(const std::string &log_filename, bool save_index = true);
+
+        bool Build(const std::string &log_filename);
+        bool Save(const std::string &index_filename) const;
+        bool Load(const std::string &log_filename, const std::string &index_filename);
+
+        static std::string GetIndexFilename(const std::string &log_filename) { return log_filename + ".idx"; }
+
+        size_t GetNumEvents() const { return events_.size(); }
+        const LogIndexEvent& GetEvent(size_t event) const { return events_[event]; }
+
+        int GetNumChannels() const { return channel_names_.size(); }
+        const std::string& GetChannelName(int channel) const { return channel_names_[channel]; }
+        int GetChannel(const std::string &name) const;
+
+        // event numbers (into GetEvent()) on a channel, in log order
+        const std::vector<size_t>& GetChannelEvents(int channel) const { return channel_events_[channel]; }
+
+        size_t Seek(int64_t utime) const;
+        size_t SeekChannel(int channel, int64_t utime) const;
+
+        bool ReadEvent(size_t event, std::vector<uint8_t> *data) const;
+
+        int ForEachEvent(const std::string &channel, int64_t start_utime, int64_t end_utime, LogIndexEventFunction function,
+            int num_threads = LOG_INDEX_DEFAULT_THREADS) const;
+
+        /**
+         * Decodes every message on a channel (C++ LCM types) into an array, in
+         * log order, on several threads.
+         *
+         * @param channel channel to decode
+         * @param msgs (output) the messages
+         * @param start_utime only messages at or after this time
+         * @param end_utime only messages before this time
+         * @param num_threads threads to decode on
+         *
+         * @retval false if the channel isn't in the log or any message didn't
+         *      read or decode
+         */
+        template <typename T>
+        bool DecodeChannel(const std::string &channel, std::vector<T> *msgs, int64_t start_utime = INT64_MIN,
+            int64_t end_utime = INT64_MAX, int num_threads = LOG_INDEX_DEFAULT_THREADS) const {
+
+            int channel_number = GetChannel(channel);
+
+            if (channel_number < 0) {
+                msgs->clear();
+                return false;
+            }
+
+            msgs->resize(CountChannel(channel_number, start_utime, end_utime));
+
+            int num_failed = ForEachEvent(channel, start_utime, end_utime,
+                [msgs](size_t i, const LogIndexEvent &event, const uint8_t *data) {
+                    return (*msgs)[i].decode(data, 0, event.data_size) >= 0;
+                }, num_threads);
+
+            return num_failed == 0;
+        }
+
+    private:
+        size_t CountChannel(int channel, int64_t start_utime, int64_t end_utime) const;
+        int AddChannel(const std::string &name);
+
+        int fd_;
+
+        std::vector<LogIndexEvent> events_;
+
+        std::vector<std::string> channel_names_;
+        std::vector<std::vector<size_t>> channel_events_;
+};
+
+#endif
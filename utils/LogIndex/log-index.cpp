@@ -0,0 +1,75 @@
+/*
+ * Builds (or refreshes) a log's index file and prints what's in the log:
+ * each channel's message count, size and rate.  Run it once after copying
+ * logs off the aircraft so the playback tools start instantly.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <iostream>
+
+#include <stdio.h>
+
+#include "../../externals/ConciseArgs.hpp"
+
+#include "../../utils/utils/Clock.hpp"
+
+#include "LogIndex.hpp"
+
+int main(int argc, char** argv) {
+
+    std::string log_filename;
+    bool rebuild = false;
+    bool quiet = false;
+
+    ConciseArgs parser(argc, argv);
+    parser.add(log_filename, "l", "log", "LCM log to index.", true);
+    parser.add(rebuild, "f", "force", "Rebuild the index even if the log has an up-to-date one.");
+    parser.add(quiet, "q", "quiet", "Don't print the channel table.");
+    parser.parse();
+
+    LogIndex index;
+
+    int64_t start_time = GetRawMonotonicNow();
+
+    bool ok;
+
+    if (rebuild) {
+        ok = index.Build(log_filename) && index.Save(LogIndex::GetIndexFilename(log_filename));
+    } else {
+        ok = index.Open(log_filename);
+    }
+
+    if (!ok) {
+        fprintf(stderr, "Error: could not index %s\n", log_filename.c_str());
+        return 1;
+    }
+
+    printf("%s: %lld events on %d channels, indexed in %.2f sec.\n", log_filename.c_str(),
+        (long long)index.GetNumEvents(), index.GetNumChannels(), (GetRawMonotonicNow() - start_time) / 1000000.0);
+
+    if (quiet || index.GetNumEvents() == 0) {
+        return 0;
+    }
+
+    double duration = (index.GetEvent(index.GetNumEvents() - 1).timestamp - index.GetEvent(0).timestamp) / 1000000.0;
+
+    printf("Duration: %.1f sec\n\n", duration);
+    printf("%-40s %10s %12s %10s\n", "channel", "count", "MB", "rate (Hz)");
+
+    for (int i = 0; i < index.GetNumChannels(); i++) {
+        const std::vector<size_t> &events = index.GetChannelEvents(i);
+
+        int64_t bytes = 0;
+
+        for (size_t j = 0; j < events.size(); j++) {
+            bytes += index.GetEvent(events[j]).data_size;
+        }
+
+        printf("%-40s %10lld %12.2f %10.2f\n", index.GetChannelName(i).c_str(), (long long)events.size(),
+            bytes / 1e6, duration > 0 ? events.size() / duration : 0);
+    }
+
+    return 0;
+}
@@ -0,0 +1,7 @@
+TARGET = test
+
+SOURCES = LogIndex.cpp LogColumns.cpp tests.cpp
+
+LDPOSTFLAGS_EXTRA += -lpthread
+
+include ../../utils/make/flight.mk
@@ -0,0 +1,356 @@
+#include "LogIndex.hpp"
+#include "LogColumns.hpp"
+#include "gtest/gtest.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+static void WriteBigEndian(FILE *out, int64_t value, int num_bytes) {
+    for (int i = num_bytes - 1; i >= 0; i--) {
+        fputc((value >> (8 * i)) & 0xFF, out);
+    }
+}
+
+static void WriteEvent(FILE *out, int64_t event_number, int64_t timestamp, const std::string &channel,
+    const std::vector<uint8_t> &data) {
+
+    WriteBigEndian(out, LOG_INDEX_LCM_SYNC, 4);
+    WriteBigEndian(out, event_number, 8);
+    WriteBigEndian(out, timestamp, 8);
+    WriteBigEndian(out, channel.size(), 4);
+    WriteBigEndian(out, data.size(), 4);
+    fwrite(channel.data(), 1, channel.size(), out);
+    fwrite(data.data(), 1, data.size(), out);
+}
+
+// stands in for an LCM type: its data is its value, repeated
+struct FakeMessage {
+    int value;
+    int size;
+
+    int decode(const void *buf, int offset, int maxlen) {
+        const uint8_t *bytes = (const uint8_t*)buf + offset;
+
+        for (int i = 1; i < maxlen; i++) {
+            if (bytes[i] != bytes[0]) {
+                return -1;
+            }
+        }
+
+        value = maxlen > 0 ? bytes[0] : -1;
+        size = maxlen;
+        return maxlen;
+    }
+};
+
+// 200 events, 1 ms apart, alternating between two channels, with "pose"
+// messages 3 bytes long and "stereo" ones a variable length
+static std::string WriteTestLog() {
+    char filename[] = "/tmp/log-index-test-XXXXXX";
+    int fd = mkstemp(filename);
+    close(fd);
+
+    FILE *out = fopen(filename, "wb");
+
+    for (int i = 0; i < 200; i++) {
+        std::string channel = i % 2 == 0 ? "pose" : "stereo";
+        int size = i % 2 == 0 ? 3 : i;
+
+        WriteEvent(out, i, 1000000 + i * 1000, channel, std::vector<uint8_t>(size, i / 2));
+    }
+
+    fclose(out);
+
+    unlink(LogIndex::GetIndexFilename(filename).c_str());
+
+    return filename;
+}
+
+static void RemoveTestLog(const std::string &filename) {
+    unlink(filename.c_str());
+    unlink(LogIndex::GetIndexFilename(filename).c_str());
+}
+
+TEST(LogIndex, Build) {
+    std::string filename = WriteTestLog();
+
+    LogIndex index;
+    ASSERT_TRUE(index.Build(filename));
+
+    EXPECT_EQ(index.GetNumEvents(), 200u);
+    EXPECT_EQ(index.GetNumChannels(), 2);
+
+    int pose = index.GetChannel("pose");
+    int stereo = index.GetChannel("stereo");
+
+    ASSERT_GE(pose, 0);
+    ASSERT_GE(stereo, 0);
+    EXPECT_EQ(index.GetChannel("not-a-channel"), -1);
+
+    EXPECT_EQ(index.GetChannelEvents(pose).size(), 100u);
+    EXPECT_EQ(index.GetChannelEvents(stereo).size(), 100u);
+
+    EXPECT_EQ(index.GetEvent(5).timestamp, 1005000);
+    EXPECT_EQ((int)index.GetEvent(5).channel, stereo);
+    EXPECT_EQ(index.GetEvent(5).data_size, 5u);
+
+    std::vector<uint8_t> data;
+    ASSERT_TRUE(index.ReadEvent(7, &data));
+    EXPECT_EQ(data, std::vector<uint8_t>(7, 3));
+
+    RemoveTestLog(filename);
+}
+
+TEST(LogIndex, Seek) {
+    std::string filename = WriteTestLog();
+
+    LogIndex index;
+    ASSERT_TRUE(index.Open(filename));
+
+    EXPECT_EQ(index.Seek(0), 0u);
+    EXPECT_EQ(index.Seek(1000000), 0u);
+    EXPECT_EQ(index.Seek(1000001), 1u);
+    EXPECT_EQ(index.Seek(1050000), 50u);
+    EXPECT_EQ(index.Seek(2000000), 200u);
+
+    int stereo = index.GetChannel("stereo");
+
+    // stereo is every odd event: 1001000, 1003000, ...
+    EXPECT_EQ(index.SeekChannel(stereo, 1001000), 0u);
+    EXPECT_EQ(index.SeekChannel(stereo, 1002000), 1u);
+    EXPECT_EQ(index.GetChannelEvents(stereo)[index.SeekChannel(stereo, 1050000)], 51u);
+
+    RemoveTestLog(filename);
+}
+
+TEST(LogIndex, SaveAndLoad) {
+    std::string filename = WriteTestLog();
+
+    LogIndex built;
+    ASSERT_TRUE(built.Open(filename));
+
+    ASSERT_EQ(access(LogIndex::GetIndexFilename(filename).c_str(), F_OK), 0);
+
+    LogIndex loaded;
+    ASSERT_TRUE(loaded.Load(filename, LogIndex::GetIndexFilename(filename)));
+
+    ASSERT_EQ(loaded.GetNumEvents(), built.GetNumEvents());
+    ASSERT_EQ(loaded.GetNumChannels(), built.GetNumChannels());
+
+    for (int i = 0; i < built.GetNumChannels(); i++) {
+        EXPECT_EQ(loaded.GetChannelName(i), built.GetChannelName(i));
+        EXPECT_EQ(loaded.GetChannelEvents(i), built.GetChannelEvents(i));
+    }
+
+    for (size_t i = 0; i < built.GetNumEvents(); i++) {
+        EXPECT_EQ(loaded.GetEvent(i).timestamp, built.GetEvent(i).timestamp);
+        EXPECT_EQ(loaded.GetEvent(i).offset, built.GetEvent(i).offset);
+    }
+
+    std::vector<uint8_t> data;
+    ASSERT_TRUE(loaded.ReadEvent(9, &data));
+    EXPECT_EQ(data, std::vector<uint8_t>(9, 4));
+
+    RemoveTestLog(filename);
+}
+
+TEST(LogIndex, StaleIndexRebuilt) {
+    std::string filename = WriteTestLog();
+
+    LogIndex index;
+    ASSERT_TRUE(index.Open(filename));
+    ASSERT_EQ(index.GetNumEvents(), 200u);
+
+    // the logger wrote more since the index was made
+    FILE *out = fopen(filename.c_str(), "ab");
+    WriteEvent(out, 200, 1200000, "pose", std::vector<uint8_t>(3, 100));
+    fclose(out);
+
+    LogIndex stale;
+    EXPECT_FALSE(stale.Load(filename, LogIndex::GetIndexFilename(filename)));
+
+    LogIndex reopened;
+    ASSERT_TRUE(reopened.Open(filename));
+    EXPECT_EQ(reopened.GetNumEvents(), 201u);
+
+    RemoveTestLog(filename);
+}
+
+TEST(LogIndex, PartialLastEvent) {
+    std::string filename = WriteTestLog();
+
+    // half of an event, like a log that is still being written
+    FILE *out = fopen(filename.c_str(), "ab");
+    WriteBigEndian(out, LOG_INDEX_LCM_SYNC, 4);
+    WriteBigEndian(out, 200, 8);
+    WriteBigEndian(out, 1200000, 8);
+    WriteBigEndian(out, 4, 4);
+    WriteBigEndian(out, 1000, 4);
+    fwrite("pose", 1, 4, out);
+    fclose(out);
+
+    LogIndex index;
+    ASSERT_TRUE(index.Build(filename));
+    EXPECT_EQ(index.GetNumEvents(), 200u);
+
+    RemoveTestLog(filename);
+}
+
+TEST(LogIndex, DecodeChannel) {
+    std::string filename = WriteTestLog();
+
+    LogIndex index;
+    ASSERT_TRUE(index.Open(filename));
+
+    for (int num_threads = 1; num_threads <= 8; num_threads *= 2) {
+        std::vector<FakeMessage> msgs;
+
+        ASSERT_TRUE(index.DecodeChannel("stereo", &msgs, INT64_MIN, INT64_MAX, num_threads));
+        ASSERT_EQ(msgs.size(), 100u);
+
+        // in log order, whichever thread decoded them
+        for (int i = 0; i < 100; i++) {
+            EXPECT_EQ(msgs[i].value, i);
+            EXPECT_EQ(msgs[i].size, 2 * i + 1);
+        }
+    }
+
+    // a time range: pose messages at 1010000 through 1018000
+    std::vector<FakeMessage> msgs;
+    ASSERT_TRUE(index.DecodeChannel("pose", &msgs, 1010000, 1020000));
+    ASSERT_EQ(msgs.size(), 5u);
+    EXPECT_EQ(msgs[0].value, 5);
+    EXPECT_EQ(msgs[4].value, 9);
+
+    EXPECT_FALSE(index.DecodeChannel("not-a-channel", &msgs));
+    EXPECT_TRUE(msgs.empty());
+
+    RemoveTestLog(filename);
+}
+
+static void WriteFile(const std::string &filename, const void *data, size_t size) {
+    FILE *out = fopen(filename.c_str(), "wb");
+    ASSERT_TRUE(out != NULL);
+
+    // an empty column has no data to point at
+    if (size > 0) {
+        fwrite(data, 1, size, out);
+    }
+
+    fclose(out);
+}
+
+// what log_to_columns.py writes for three messages on "POSE-1"
+static std::string WriteTestColumns() {
+    char directory[] = "/tmp/log-columns-test-XXXXXX";
+    EXPECT_TRUE(mkdtemp(directory) != NULL);
+
+    std::string channel_dir = std::string(directory) + "/POSE-1";
+    mkdir(channel_dir.c_str(), 0755);
+
+    FILE *manifest = fopen((std::string(directory) + "/" + LOG_COLUMNS_MANIFEST).c_str(), "w");
+    fprintf(manifest, "# channel field type messages shape\n");
+    fprintf(manifest, "POSE-1 log_utime int64 3 1\n");
+    fprintf(manifest, "POSE-1 pos float64 3 3\n");
+    fprintf(manifest, "POSE-1 pts.x float32 3 ragged\n");
+    fprintf(manifest, "POSE-1 name uint8 3 ragged\n");
+    fclose(manifest);
+
+    int64_t utime[] = { 100, 200, 300 };
+    WriteFile(channel_dir + "/log_utime.bin", utime, sizeof(utime));
+
+    double pos[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+    WriteFile(channel_dir + "/pos.bin", pos, sizeof(pos));
+
+    // 2, 0 and 1 points
+    float x[] = { 0.5, 1.5, 2.5 };
+    int64_t x_offsets[] = { 0, 2, 2, 3 };
+    WriteFile(channel_dir + "/pts.x.bin", x, sizeof(x));
+    WriteFile(channel_dir + "/pts.x.offsets.bin", x_offsets, sizeof(x_offsets));
+
+    // all empty strings
+    int64_t name_offsets[] = { 0, 0, 0, 0 };
+    WriteFile(channel_dir + "/name.bin", NULL, 0);
+    WriteFile(channel_dir + "/name.offsets.bin", name_offsets, sizeof(name_offsets));
+
+    return directory;
+}
+
+static void RemoveTestColumns(const std::string &directory) {
+    if (system(("rm -rf " + directory).c_str()) != 0) {
+        fprintf(stderr, "Warning: could not remove %s\n", directory.c_str());
+    }
+}
+
+TEST(LogColumns, Fixed) {
+    std::string directory = WriteTestColumns();
+
+    LogColumns columns;
+    ASSERT_TRUE(columns.Open(directory));
+    EXPECT_EQ(columns.GetColumns().size(), 4u);
+
+    LogColumn<int64_t> utime;
+    ASSERT_TRUE(columns.GetColumn("POSE-1", "log_utime", &utime));
+    EXPECT_EQ(utime.num_messages, 3);
+    EXPECT_EQ(utime.Get(2)[0], 300);
+
+    LogColumn<double> pos;
+    ASSERT_TRUE(columns.GetColumn("POSE-1", "pos", &pos));
+    EXPECT_EQ(pos.values_per_message, 3);
+    EXPECT_EQ(pos.GetSize(1), 3);
+    EXPECT_DOUBLE_EQ(pos.Get(1)[0], 4);
+    EXPECT_DOUBLE_EQ(pos.Get(2)[2], 9);
+
+    RemoveTestColumns(directory);
+}
+
+TEST(LogColumns, Ragged) {
+    std::string directory = WriteTestColumns();
+
+    LogColumns columns;
+    ASSERT_TRUE(columns.Open(directory));
+
+    LogColumn<float> x;
+    ASSERT_TRUE(columns.GetColumn("POSE-1", "pts.x", &x));
+
+    EXPECT_EQ(x.GetSize(0), 2);
+    EXPECT_EQ(x.GetSize(1), 0);
+    EXPECT_EQ(x.GetSize(2), 1);
+    EXPECT_FLOAT_EQ(x.Get(0)[1], 1.5);
+    EXPECT_FLOAT_EQ(x.Get(2)[0], 2.5);
+
+    LogColumn<uint8_t> name;
+    ASSERT_TRUE(columns.GetColumn("POSE-1", "name", &name));
+    EXPECT_EQ(name.GetSize(1), 0);
+
+    RemoveTestColumns(directory);
+}
+
+TEST(LogColumns, Mismatches) {
+    std::string directory = WriteTestColumns();
+
+    LogColumns columns;
+    ASSERT_TRUE(columns.Open(directory));
+
+    // wrong type, no such field, no such channel
+    LogColumn<float> pos;
+    EXPECT_FALSE(columns.GetColumn("POSE-1", "pos", &pos));
+
+    LogColumn<double> missing;
+    EXPECT_FALSE(columns.GetColumn("POSE-1", "vel", &missing));
+    EXPECT_FALSE(columns.GetColumn("POSE-2", "pos", &missing));
+
+    // a field cut short
+    double short_pos[] = { 1, 2, 3 };
+    WriteFile(directory + "/POSE-1/pos.bin", short_pos, sizeof(short_pos));
+
+    LogColumns reopened;
+    ASSERT_TRUE(reopened.Open(directory));
+    EXPECT_FALSE(reopened.GetColumn("POSE-1", "pos", &missing));
+
+    EXPECT_FALSE(reopened.Open("/tmp/no-such-log-columns"));
+
+    RemoveTestColumns(directory);
+}
@@ -4,25 +4,30 @@
 RollingStatistics::RollingStatistics(unsigned int window_size) {
     window_size_ = window_size;
     current_mean_ = 0;
-    current_variance_ = 0;
+    sum_squares_ = 0;
+
+    ring_.resize(window_size_);
+    next_ = 0;
+    count_ = 0;
 }
 
 
 /**
- * Adds a value and computes statistics for that value, since this allows us to compute
- * stats based on the incoming and outgoing value, instead of recomputing every time.
- *
- * See: http://jonisalonen.com/2014/efficient-and-accurate-rolling-standard-deviation/
- *
+ * Adds a value and updates the statistics from just it and the value it
+ * pushes out of the window (if any), instead of recomputing every time.
  */
 void RollingStatistics::AddValue(double new_value) {
 
-    queue_.push_back(new_value);
+    if (count_ < window_size_) {
+        // still filling the window: Welford's running update
+        count_ ++;
 
-    if (queue_.size() > window_size_) {
-        double old_value = queue_.front();
-        queue_.pop_front();
+        double delta = new_value - current_mean_;
+        current_mean_ += delta / count_;
+        sum_squares_ += delta * (new_value - current_mean_);
 
+    } else {
+        double old_value = ring_[next_];
 
         // compute rolling stats
         double old_mean = current_mean_;
@@ -31,41 +36,11 @@ void RollingStatistics::AddValue(double new_value) {
 
         current_mean_ += change_in_mean;
 
-
-        double change_in_variance = (new_value - old_value) * (new_value - current_mean_ + old_value - old_mean) / (window_size_ - 1);
-
-        current_variance_ += change_in_variance;
-
-
-
-    } else {
-        // still adding to the queue, so just compute global stats
-
-        std::deque<double>::iterator iter;
-
-
-        double sum = 0;
-
-        for (iter = queue_.begin(); iter != queue_.end(); iter++) {
-            sum += *iter;
-        }
-
-        current_mean_ = sum/queue_.size();
-
-        double var_sum = 0;
-
-        for (iter = queue_.begin(); iter != queue_.end(); iter++) {
-            var_sum += (*iter - current_mean_) * (*iter - current_mean_);
-        }
-
-        if (queue_.size() < 2) {
-            current_variance_ = 0;
-        } else {
-            current_variance_ = var_sum / (queue_.size() - 1);
-        }
-
+        sum_squares_ += (new_value - old_value) * (new_value - current_mean_ + old_value - old_mean);
     }
 
+    ring_[next_] = new_value;
+    next_ = next_ + 1 < window_size_ ? next_ + 1 : 0;
 }
 
 
@@ -101,3 +76,62 @@ TEST(RollingStatstics, RollingStats) {
 
 
 }
+
+TEST(RollingStatstics, FixedRollingStats) {
+
+    RollingStatistics rolling_stats(5);
+    FixedRollingStatistics<5> fixed_stats;
+    FixedRollingStatistics<5, float> float_stats;
+
+    double values[] = { 10, 11, -3.4312, -4, 0, 43, -0.11, 7, 7, 7, 7, 7, 7 };
+
+    for (double value : values) {
+        rolling_stats.AddValue(value);
+        fixed_stats.AddValue(value);
+        float_stats.AddValue(value);
+
+        EXPECT_NEAR(rolling_stats.GetMean(), fixed_stats.GetMean(), 0.00001);
+        EXPECT_NEAR(rolling_stats.GetStandardDeviation(), fixed_stats.GetStandardDeviation(), 0.00001);
+
+        EXPECT_NEAR(rolling_stats.GetMean(), float_stats.GetMean(), 0.001);
+        // float drifts a little in the sum of squares, so compare variance
+        EXPECT_NEAR(rolling_stats.GetVariance(), float_stats.GetVariance(), 0.001);
+    }
+
+    // window is all 7s now
+    EXPECT_NEAR(7, fixed_stats.GetMean(), 0.00001);
+    EXPECT_NEAR(0, fixed_stats.GetStandardDeviation(), 0.00001);
+    EXPECT_FALSE(isnan(fixed_stats.GetStandardDeviation()));
+}
+
+TEST(RollingStatstics, MultiRollingStats) {
+
+    const int num_channels = 3;
+
+    MultiRollingStatistics<4, num_channels> multi_stats;
+    RollingStatistics *single_stats[num_channels];
+
+    for (int k = 0; k < num_channels; k++) {
+        single_stats[k] = new RollingStatistics(4);
+    }
+
+    for (int i = 0; i < 20; i++) {
+        double values[num_channels] = { double(i), sin(i), i % 3 == 0 ? 100.0 : -2.5 };
+
+        multi_stats.AddValues(values);
+
+        for (int k = 0; k < num_channels; k++) {
+            single_stats[k]->AddValue(values[k]);
+
+            EXPECT_NEAR(single_stats[k]->GetMean(), multi_stats.GetMean(k), 0.00001);
+            EXPECT_NEAR(single_stats[k]->GetStandardDeviation(), multi_stats.GetStandardDeviation(k), 0.00001);
+        }
+    }
+
+    // the last 4 of 0..19
+    EXPECT_NEAR(17.5, multi_stats.GetMean(0), 0.00001);
+
+    for (int k = 0; k < num_channels; k++) {
+        delete single_stats[k];
+    }
+}
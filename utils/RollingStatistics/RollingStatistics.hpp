@@ -1,14 +1,20 @@
 #ifndef ROLLING_STATS_HPP
 #define ROLLING_STATS_HPP
 
-#include <deque>
+#include <vector>
 #include <math.h>
 
 #include <iostream>
 
 #include "gtest/gtest.h"
 
-
+/**
+ * Mean and standard deviation of the last window_size values.  Values are
+ * kept in a ring buffer allocated once, and every update (including while
+ * the window is still filling) is O(1), using Welford's method.
+ *
+ * See: http://jonisalonen.com/2014/efficient-and-accurate-rolling-standard-deviation/
+ */
 class RollingStatistics {
 
     public:
@@ -16,21 +22,142 @@ class RollingStatistics {
 
         void AddValue(double new_value);
         double GetMean() { return current_mean_; }
-        double GetStandardDeviation() { return sqrt(current_variance_); }
+        double GetStandardDeviation() { return sqrt(GetVariance()); }
+        double GetVariance() { return count_ < 2 || sum_squares_ < 0 ? 0 : sum_squares_ / (count_ - 1); }
 
 
     private:
 
         double current_mean_;
-        double current_variance_;
+
+        // sum of squared differences from the mean
+        double sum_squares_;
 
         unsigned int window_size_;
 
-        std::deque<double> queue_;
+        std::vector<double> ring_;
+        unsigned int next_; // where the next value goes (the oldest one, once full)
+        unsigned int count_;
+
+
+
+
+};
+
+/**
+ * RollingStatistics with the window size fixed at compile time, so the ring
+ * buffer lives in the object and nothing is allocated.
+ */
+template <unsigned int N, typename T = double>
+class FixedRollingStatistics {
+
+    public:
+        FixedRollingStatistics() : current_mean_(0), sum_squares_(0), next_(0), count_(0) {}
+
+        void AddValue(T new_value) {
+
+            if (count_ < N) {
+                // still filling: Welford's running update
+                count_ ++;
+
+                T delta = new_value - current_mean_;
+                current_mean_ += delta / count_;
+                sum_squares_ += delta * (new_value - current_mean_);
+
+            } else {
+                // full: swap the oldest value for the new one
+                T old_value = ring_[next_];
+                T old_mean = current_mean_;
+
+                current_mean_ += (new_value - old_value) / N;
+                sum_squares_ += (new_value - old_value) * (new_value - current_mean_ + old_value - old_mean);
+            }
+
+            ring_[next_] = new_value;
+            next_ = next_ + 1 < N ? next_ + 1 : 0;
+        }
+
+        T GetMean() const { return current_mean_; }
+        T GetVariance() const { return count_ < 2 || sum_squares_ < 0 ? 0 : sum_squares_ / (count_ - 1); }
+        T GetStandardDeviation() const { return sqrt(GetVariance()); }
+
+        unsigned int GetCount() const { return count_; }
+
+    private:
+        T ring_[N];
 
+        T current_mean_;
+        T sum_squares_;
 
+        unsigned int next_;
+        unsigned int count_;
+};
+
+/**
+ * FixedRollingStatistics for K signals sampled together (say, every
+ * airspeed and barometer channel).  All K are updated in one loop over
+ * contiguous arrays, which the compiler vectorizes.
+ */
+template <unsigned int N, unsigned int K, typename T = double>
+class MultiRollingStatistics {
+
+    public:
+        MultiRollingStatistics() : next_(0), count_(0) {
+            for (unsigned int k = 0; k < K; k++) {
+                current_mean_[k] = 0;
+                sum_squares_[k] = 0;
+            }
+        }
+
+        // new_values is K values, one for each signal
+        void AddValues(const T *new_values) {
+
+            T *oldest = ring_[next_];
+
+            if (count_ < N) {
+                count_ ++;
+
+                T inverse_count = T(1) / count_;
+
+                for (unsigned int k = 0; k < K; k++) {
+                    T delta = new_values[k] - current_mean_[k];
+                    current_mean_[k] += delta * inverse_count;
+                    sum_squares_[k] += delta * (new_values[k] - current_mean_[k]);
+
+                    oldest[k] = new_values[k];
+                }
+
+            } else {
+                const T inverse_n = T(1) / N;
+
+                for (unsigned int k = 0; k < K; k++) {
+                    T change = new_values[k] - oldest[k];
+                    T old_mean = current_mean_[k];
+
+                    current_mean_[k] += change * inverse_n;
+                    sum_squares_[k] += change * (new_values[k] - current_mean_[k] + oldest[k] - old_mean);
+
+                    oldest[k] = new_values[k];
+                }
+            }
+
+            next_ = next_ + 1 < N ? next_ + 1 : 0;
+        }
+
+        T GetMean(unsigned int k) const { return current_mean_[k]; }
+        T GetVariance(unsigned int k) const { return count_ < 2 || sum_squares_[k] < 0 ? 0 : sum_squares_[k] / (count_ - 1); }
+        T GetStandardDeviation(unsigned int k) const { return sqrt(GetVariance(k)); }
+
+        unsigned int GetCount() const { return count_; }
+
+    private:
+        T ring_[N][K];
 
+        T current_mean_[K];
+        T sum_squares_[K];
 
+        unsigned int next_;
+        unsigned int count_;
 };
 
 #endif
@@ -34,26 +34,62 @@ ServoConverter::ServoConverter(BotParam *param) {
     elevR_trim_ = bot_param_get_int_or_fail(param, "servo_commands.elevR_flight_trim");
     throttle_trim_ = bot_param_get_int_or_fail(param, "servo_commands.throttle_flight_trim");
 
+    rad_to_servo_slope_[0] = rad_to_servo_.elevL_slope;
+    rad_to_servo_slope_[1] = rad_to_servo_.elevR_slope;
+    rad_to_servo_slope_[2] = rad_to_servo_.throttle_slope;
+
+    rad_to_servo_intercept_[0] = rad_to_servo_.elevL_y_intercept;
+    rad_to_servo_intercept_[1] = rad_to_servo_.elevR_y_intercept;
+    rad_to_servo_intercept_[2] = rad_to_servo_.throttle_y_intercept;
+
+    servo_min_[0] = elevL_min_;
+    servo_min_[1] = elevR_min_;
+    servo_min_[2] = throttle_min_;
+
+    servo_max_[0] = elevL_max_;
+    servo_max_[1] = elevR_max_;
+    servo_max_[2] = throttle_max_;
 }
 
 Eigen::Vector3i ServoConverter::RadiansToServoCommands(Eigen::Vector3d commands) const {
 
     Eigen::Vector3i output;
 
-    output(0) = round(commands(0) * rad_to_servo_.elevL_slope + rad_to_servo_.elevL_y_intercept);
-    output(1) = round(commands(1) * rad_to_servo_.elevR_slope + rad_to_servo_.elevR_y_intercept);
+    // one multiply-add and clamp for each channel.  The limits are whole
+    // numbers, so clamping before rounding gives the same answer as
+    // MinMaxCommands() after.
+    for (int i = 0; i < 3; i++) {
+        double servo = commands(i) * rad_to_servo_slope_[i] + rad_to_servo_intercept_[i];
+
+        servo = std::min(std::max(servo, servo_min_[i]), servo_max_[i]);
+
+        output(i) = round(servo);
+    }
 
     if (commands(2) <= 0) {
         // throttle = 0
         output(2) = throttle_min_;
-    } else {
-        output(2) = round(commands(2) * rad_to_servo_.throttle_slope + rad_to_servo_.throttle_y_intercept);
     }
 
-    return MinMaxCommands(output);
+    return output;
 
 }
 
+/**
+ * Converts a run of commands (from a log, say) at once.
+ *
+ * @param commands elevL, elevR, throttle in each column, in radians
+ * @param servo_commands (output) resized to match, the servo commands
+ */
+void ServoConverter::RadiansToServoCommands(const Eigen::Matrix3Xd &commands, Eigen::Matrix3Xi *servo_commands) const {
+
+    servo_commands->resize(3, commands.cols());
+
+    for (int i = 0; i < commands.cols(); i++) {
+        servo_commands->col(i) = RadiansToServoCommands(Eigen::Vector3d(commands.col(i)));
+    }
+}
+
 Eigen::Vector3d ServoConverter::ServoCommandsToRadians(Eigen::Vector3i commands) const {
 
     Eigen::Vector3d output;
@@ -68,6 +104,21 @@ Eigen::Vector3d ServoConverter::ServoCommandsToRadians(Eigen::Vector3i commands)
 
 }
 
+/**
+ * Converts a run of servo commands (from a log, say) at once.
+ *
+ * @param commands elevL, elevR, throttle in each column, as servo commands
+ * @param radians (output) resized to match, the commands in radians
+ */
+void ServoConverter::ServoCommandsToRadians(const Eigen::Matrix3Xi &commands, Eigen::Matrix3Xd *radians) const {
+
+    radians->resize(3, commands.cols());
+
+    for (int i = 0; i < commands.cols(); i++) {
+        radians->col(i) = ServoCommandsToRadians(Eigen::Vector3i(commands.col(i)));
+    }
+}
+
 Eigen::Vector3i ServoConverter::MinMaxCommands(Eigen::Vector3i commands) const {
 
     Eigen::Vector3i output;
@@ -41,8 +41,10 @@ class ServoConverter {
         ServoConverter(BotParam *param);
 
         Eigen::Vector3i RadiansToServoCommands(Eigen::Vector3d commands) const;
+        void RadiansToServoCommands(const Eigen::Matrix3Xd &commands, Eigen::Matrix3Xi *servo_commands) const;
 
         Eigen::Vector3d ServoCommandsToRadians(Eigen::Vector3i commands) const;
+        void ServoCommandsToRadians(const Eigen::Matrix3Xi &commands, Eigen::Matrix3Xd *radians) const;
 
         Eigen::Vector3i MinMaxCommands(Eigen::Vector3i commands) const;
 
@@ -66,6 +68,12 @@ class ServoConverter {
         int elevR_trim_;
         int throttle_trim_;
 
+        // the radians to servo maps and limits of (elevL, elevR, throttle)
+        // as arrays, so all three channels are converted the same way
+        double rad_to_servo_slope_[3];
+        double rad_to_servo_intercept_[3];
+        double servo_min_[3];
+        double servo_max_[3];
 
 
 
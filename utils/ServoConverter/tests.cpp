@@ -95,6 +95,41 @@ TEST_F(ServoConverterTest, MinMaxCommands2) {
 
 }
 
+TEST_F(ServoConverterTest, Batch) {
+
+    Eigen::Matrix3Xd tester(3, 4);
+
+    tester << 0.5235, 0.2, 10, -0.3,
+        -1.1, 0.2, -10, 0.1,
+        3.99, 4.8058, 100, -1;
+
+    Eigen::Matrix3Xi output;
+    converter_->RadiansToServoCommands(tester, &output);
+
+    ASSERT_TRUE(output.cols() == 4);
+
+    Eigen::Vector3i matlab_output;
+    matlab_output << 1672, 2082, 1610;
+
+    EXPECT_TRUE(matlab_output == output.col(0)) << "Expected:" << std::endl << matlab_output << std::endl << "Actual:" << std::endl << output.col(0);
+
+    for (int i = 0; i < tester.cols(); i++) {
+        Eigen::Vector3i expected = converter_->RadiansToServoCommands(Eigen::Vector3d(tester.col(i)));
+
+        EXPECT_TRUE(expected == output.col(i)) << "Expected:" << std::endl << expected << std::endl << "Actual:" << std::endl << output.col(i);
+    }
+
+    Eigen::Matrix3Xd radians;
+    converter_->ServoCommandsToRadians(output, &radians);
+
+    ASSERT_TRUE(radians.cols() == 4);
+
+    for (int i = 0; i < output.cols(); i++) {
+        Eigen::Vector3d expected = converter_->ServoCommandsToRadians(Eigen::Vector3i(output.col(i)));
+
+        EXPECT_TRUE(expected.isApprox(radians.col(i))) << "Expected:" << std::endl << expected << std::endl << "Actual:" << std::endl << radians.col(i);
+    }
+}
 
 
 int main(int argc, char **argv) {
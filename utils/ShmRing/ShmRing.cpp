@@ -0,0 +1,353 @@
+#include "ShmRing.hpp"
+
+static std::string GetShmName(const std::string &name) {
+    return "/lcm-" + name;
+}
+
+static size_t GetSlotStride(uint32_t slot_size) {
+    // keep each slot's sequence number 8-byte aligned
+    return (sizeof(ShmRingSlot) + slot_size + 7) & ~(size_t)7;
+}
+
+static int Futex(std::atomic<uint32_t> *word, int op, uint32_t value, const struct timespec *timeout) {
+    return syscall(SYS_futex, (uint32_t*)word, op, value, timeout, NULL, 0);
+}
+
+ShmRingWriter::ShmRingWriter() {
+    header_ = NULL;
+    slots_ = NULL;
+    mapped_size_ = 0;
+}
+
+ShmRingWriter::~ShmRingWriter() {
+    if (header_ != NULL) {
+        munmap(header_, mapped_size_);
+    }
+}
+
+/**
+ * Makes (or takes over) the ring in /dev/shm/lcm-<name>.  Readers that
+ * had an older ring by this name keep reading that one until they reopen.
+ *
+ * @param name ring name, like an LCM channel
+ * @param num_slots messages the ring holds
+ * @param slot_size biggest message (bytes)
+ *
+ * @retval true on success
+ */
+bool ShmRingWriter::Open(const std::string &name, int num_slots, int slot_size) {
+
+    std::string shm_name = GetShmName(name);
+
+    // a fresh file so readers of an old ring with a different layout
+    // don't see this one change under them
+    shm_unlink(shm_name.c_str());
+
+    int fd = shm_open(shm_name.c_str(), O_CREAT | O_RDWR, 0666);
+
+    if (fd < 0) {
+        std::cerr << "Error: failed to create shared memory " << shm_name << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    size_t size = sizeof(ShmRingHeader) + num_slots * GetSlotStride(slot_size);
+
+    if (ftruncate(fd, size) != 0) {
+        std::cerr << "Error: failed to size shared memory " << shm_name << ": " << strerror(errno) << std::endl;
+        close(fd);
+        return false;
+    }
+
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (mem == MAP_FAILED) {
+        std::cerr << "Error: failed to map shared memory " << shm_name << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // ftruncate zeroed it, so the sequence numbers and counts start at 0
+    header_ = (ShmRingHeader*)mem;
+    slots_ = (uint8_t*)mem + sizeof(ShmRingHeader);
+    mapped_size_ = size;
+
+    header_->num_slots = num_slots;
+    header_->slot_size = slot_size;
+
+    header_->magic.store(SHM_RING_MAGIC, std::memory_order_release);
+
+    return true;
+}
+
+/**
+ * Copies a message into the next slot and wakes up any readers.  Never
+ * blocks.
+ *
+ * @retval false if the message is bigger than a slot (it isn't sent)
+ */
+bool ShmRingWriter::Write(const void *data, int size) {
+
+    if (header_ == NULL || size < 0 || (uint32_t)size > header_->slot_size) {
+        return false;
+    }
+
+    // we're the only writer, so nothing else changes write_count
+    uint64_t n = header_->write_count.load(std::memory_order_relaxed);
+
+    ShmRingSlot *slot = (ShmRingSlot*)(slots_ + (n % header_->num_slots) * GetSlotStride(header_->slot_size));
+
+    // mark it as being written before any of the data changes
+    slot->seq.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->size = size;
+    memcpy((uint8_t*)slot + sizeof(ShmRingSlot), data, size);
+
+    slot->seq.store(2 * n + 2, std::memory_order_release);
+    header_->write_count.store(n + 1, std::memory_order_release);
+
+    header_->futex_word.fetch_add(1, std::memory_order_release);
+
+    if (header_->num_waiters.load(std::memory_order_seq_cst) > 0) {
+        Futex(&header_->futex_word, FUTEX_WAKE, INT_MAX, NULL);
+    }
+
+    return true;
+}
+
+ShmRingReader::ShmRingReader() {
+    header_ = NULL;
+    slots_ = NULL;
+    mapped_size_ = 0;
+
+    next_ = 0;
+    num_dropped_ = 0;
+
+    notify_fd_ = -1;
+    shutting_down_ = false;
+}
+
+ShmRingReader::~ShmRingReader() {
+    if (notify_fd_ >= 0) {
+        shutting_down_ = true;
+
+        // the notifier waits with a timeout, so it sees this soon
+        pthread_join(notifier_thread_, NULL);
+        close(notify_fd_);
+    }
+
+    if (header_ != NULL) {
+        munmap(header_, mapped_size_);
+    }
+}
+
+/**
+ * Opens a ring that a writer has made.  Reading starts with the next
+ * message written.
+ *
+ * @retval false if there's no ring by that name (yet)
+ */
+bool ShmRingReader::Open(const std::string &name) {
+
+    std::string shm_name = GetShmName(name);
+
+    int fd = shm_open(shm_name.c_str(), O_RDWR, 0);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ShmRingHeader)) {
+        close(fd);
+        return false;
+    }
+
+    void *mem = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (mem == MAP_FAILED) {
+        return false;
+    }
+
+    ShmRingHeader *header = (ShmRingHeader*)mem;
+
+    if (header->magic.load(std::memory_order_acquire) != SHM_RING_MAGIC
+        || sizeof(ShmRingHeader) + header->num_slots * GetSlotStride(header->slot_size) > (size_t)st.st_size) {
+
+        std::cerr << "Error: " << shm_name << " isn't a ring." << std::endl;
+        munmap(mem, st.st_size);
+        return false;
+    }
+
+    header_ = header;
+    slots_ = (uint8_t*)mem + sizeof(ShmRingHeader);
+    mapped_size_ = st.st_size;
+
+    next_ = header_->write_count.load(std::memory_order_acquire);
+
+    return true;
+}
+
+/**
+ * Copies out the next message, if there is one.
+ *
+ * Messages are copied before they're looked at, since the writer can
+ * overwrite a slot at any time: decoding in place could see half of two
+ * messages.
+ *
+ * @param data (output) the message
+ *
+ * @retval false if there are no new messages
+ */
+bool ShmRingReader::Read(std::vector<uint8_t> *data) {
+
+    if (header_ == NULL) {
+        return false;
+    }
+
+    uint32_t num_slots = header_->num_slots;
+    size_t stride = GetSlotStride(header_->slot_size);
+
+    while (true) {
+        uint64_t written = header_->write_count.load(std::memory_order_acquire);
+
+        if (next_ >= written) {
+            return false;
+        }
+
+        if (written - next_ > num_slots) {
+            // lapped: the oldest message still there is a ring back
+            num_dropped_ += written - next_ - num_slots;
+            next_ = written - num_slots;
+        }
+
+        const ShmRingSlot *slot = (const ShmRingSlot*)(slots_ + (next_ % num_slots) * stride);
+
+        uint64_t seq = slot->seq.load(std::memory_order_acquire);
+
+        if (seq == 2 * next_ + 2) {
+            uint32_t size = slot->size;
+
+            if (size <= header_->slot_size) {
+                data->resize(size);
+                memcpy(data->data(), (const uint8_t*)slot + sizeof(ShmRingSlot), size);
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (slot->seq.load(std::memory_order_relaxed) == seq && size <= header_->slot_size) {
+                next_ ++;
+                return true;
+            }
+        }
+
+        // the writer has been here since: that message is gone, so
+        // look again from where the writer is now
+        num_dropped_ ++;
+        next_ ++;
+    }
+}
+
+/**
+ * Waits for a message we haven't read.
+ *
+ * @param timeout_ms longest to wait, or -1 for forever
+ *
+ * @retval true if there's a message to read
+ */
+bool ShmRingReader::Wait(int timeout_ms) {
+
+    if (header_ == NULL) {
+        return false;
+    }
+
+    struct timespec timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+
+    header_->num_waiters.fetch_add(1, std::memory_order_seq_cst);
+
+    // read the word before checking, so a write in between changes it
+    // and the futex doesn't sleep
+    uint32_t word = header_->futex_word.load(std::memory_order_seq_cst);
+
+    if (next_ >= header_->write_count.load(std::memory_order_acquire)) {
+        Futex(&header_->futex_word, FUTEX_WAIT, word, timeout_ms < 0 ? NULL : &timeout);
+    }
+
+    header_->num_waiters.fetch_sub(1, std::memory_order_seq_cst);
+
+    return next_ < header_->write_count.load(std::memory_order_acquire);
+}
+
+/**
+ * Starts a thread that waits on the ring and makes an eventfd readable
+ * when there's something new, for epoll (LcmReactor::AddFd()).  Read the
+ * eventfd to clear it, then Read() until there's nothing left.
+ *
+ * @retval the eventfd, or -1 on error
+ */
+int ShmRingReader::StartNotifier() {
+
+    if (header_ == NULL) {
+        return -1;
+    }
+
+    if (notify_fd_ >= 0) {
+        return notify_fd_;
+    }
+
+    notify_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (notify_fd_ < 0) {
+        return -1;
+    }
+
+    if (pthread_create(&notifier_thread_, NULL, NotifierThread, this) != 0) {
+        close(notify_fd_);
+        notify_fd_ = -1;
+        return -1;
+    }
+
+    return notify_fd_;
+}
+
+void* ShmRingReader::NotifierThread(void *x) {
+    ((ShmRingReader*)x)->RunNotifier();
+
+    return NULL;
+}
+
+void ShmRingReader::RunNotifier() {
+
+    // the last write we signaled for, so we don't spin while the main
+    // thread is still reading
+    uint64_t signaled = header_->write_count.load(std::memory_order_acquire);
+
+    while (!shutting_down_) {
+        header_->num_waiters.fetch_add(1, std::memory_order_seq_cst);
+
+        uint32_t word = header_->futex_word.load(std::memory_order_seq_cst);
+
+        if (header_->write_count.load(std::memory_order_acquire) == signaled) {
+            struct timespec timeout = { 0, 100 * 1000000L };
+            Futex(&header_->futex_word, FUTEX_WAIT, word, &timeout);
+        }
+
+        header_->num_waiters.fetch_sub(1, std::memory_order_seq_cst);
+
+        uint64_t written = header_->write_count.load(std::memory_order_acquire);
+
+        if (written != signaled) {
+            signaled = written;
+
+            uint64_t one = 1;
+
+            if (write(notify_fd_, &one, sizeof(one)) != sizeof(one)) {
+                // already readable
+            }
+        }
+    }
+}
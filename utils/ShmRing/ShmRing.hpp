@@ -0,0 +1,123 @@
+/**
+ * A ring of messages in shared memory (/dev/shm) that one process writes
+ * and any number of processes on the same computer read, so high-rate
+ * channels like stereo don't go through the UDP stack to get next door.
+ *
+ * Each slot has a sequence number that's odd while the writer is filling
+ * it, so a reader can tell when it was lapped mid-copy and throw that
+ * message out.  The writer never waits for readers: ones that fall more
+ * than a ring behind skip ahead and count what they missed.
+ *
+ * Readers sleep on a futex in the ring's header.  StartNotifier() turns
+ * that into an fd for an LcmReactor, so ring messages get handled on the
+ * same thread as LCM ones.
+ *
+ * (C) 2015 Andrew Barry <abarry@csail.mit.edu>
+ */
+
+#ifndef SHM_RING_HPP
+#define SHM_RING_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <linux/futex.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+
+// "SHMR", written last when a ring is set up
+#define SHM_RING_MAGIC 0x53484d52
+
+// enough for a few hundred milliseconds of stereo frames with a few
+// thousand hits each
+#define SHM_RING_DEFAULT_SLOTS 16
+#define SHM_RING_DEFAULT_SLOT_SIZE (128 * 1024)
+
+// at the start of the shared memory
+struct ShmRingHeader {
+    std::atomic<uint32_t> magic;
+
+    uint32_t num_slots;
+    uint32_t slot_size;
+
+    // messages written so far
+    std::atomic<uint64_t> write_count;
+
+    // bumped on every write for readers to wait on, and how many are
+    // waiting (so the writer only makes a syscall when someone is)
+    std::atomic<uint32_t> futex_word;
+    std::atomic<uint32_t> num_waiters;
+};
+
+// at the start of each slot, followed by slot_size bytes of message
+struct ShmRingSlot {
+    // 2n + 1 while message n is being written, 2n + 2 once it's done
+    std::atomic<uint64_t> seq;
+
+    uint32_t size;
+};
+
+class ShmRingWriter {
+
+    public:
+        ShmRingWriter();
+        ~ShmRingWriter();
+
+        bool Open(const std::string &name, int num_slots = SHM_RING_DEFAULT_SLOTS, int slot_size = SHM_RING_DEFAULT_SLOT_SIZE);
+
+        bool Write(const void *data, int size);
+
+        int GetSlotSize() const { return header_ != NULL ? header_->slot_size : 0; }
+
+    private:
+        ShmRingHeader *header_;
+        uint8_t *slots_;
+        size_t mapped_size_;
+};
+
+class ShmRingReader {
+
+    public:
+        ShmRingReader();
+        ~ShmRingReader();
+
+        bool Open(const std::string &name);
+
+        bool Read(std::vector<uint8_t> *data);
+        bool Wait(int timeout_ms);
+
+        int StartNotifier();
+
+        // messages the writer got more than a ring ahead of us on
+        int64_t GetNumDropped() const { return num_dropped_; }
+
+    private:
+        static void* NotifierThread(void *x);
+        void RunNotifier();
+
+        ShmRingHeader *header_;
+        uint8_t *slots_;
+        size_t mapped_size_;
+
+        // the next message to read
+        uint64_t next_;
+        int64_t num_dropped_;
+
+        int notify_fd_;
+        pthread_t notifier_thread_;
+        std::atomic<bool> shutting_down_;
+};
+
+#endif
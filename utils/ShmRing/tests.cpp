@@ -0,0 +1,165 @@
+#include "ShmRing.hpp"
+#include "gtest/gtest.h"
+
+#include <thread>
+
+class ShmRingTest : public testing::Test {
+
+    protected:
+
+        virtual void SetUp() {
+            name_ = "shm-ring-test-" + std::to_string(getpid());
+        }
+
+        virtual void TearDown() {
+            shm_unlink(("/lcm-" + name_).c_str());
+        }
+
+        std::string name_;
+};
+
+TEST_F(ShmRingTest, WriteAndRead) {
+    ShmRingReader reader;
+
+    // no ring until the writer makes it
+    EXPECT_FALSE(reader.Open(name_));
+
+    ShmRingWriter writer;
+    ASSERT_TRUE(writer.Open(name_, 4, 64));
+
+    ASSERT_TRUE(reader.Open(name_));
+
+    std::vector<uint8_t> data;
+    EXPECT_FALSE(reader.Read(&data));
+
+    for (uint8_t i = 0; i < 3; i++) {
+        uint8_t msg[3] = { i, (uint8_t)(i + 1), (uint8_t)(i + 2) };
+        EXPECT_TRUE(writer.Write(msg, i + 1));
+    }
+
+    // in order, each its own size
+    for (uint8_t i = 0; i < 3; i++) {
+        ASSERT_TRUE(reader.Read(&data));
+        ASSERT_EQ(data.size(), (size_t)(i + 1));
+        EXPECT_EQ(data[0], i);
+    }
+
+    EXPECT_FALSE(reader.Read(&data));
+    EXPECT_EQ(reader.GetNumDropped(), 0);
+
+    // too big for a slot
+    std::vector<uint8_t> big(65);
+    EXPECT_FALSE(writer.Write(big.data(), big.size()));
+    EXPECT_FALSE(reader.Read(&data));
+}
+
+TEST_F(ShmRingTest, Lapped) {
+    ShmRingWriter writer;
+    ASSERT_TRUE(writer.Open(name_, 4, 16));
+
+    ShmRingReader reader;
+    ASSERT_TRUE(reader.Open(name_));
+
+    for (int i = 0; i < 10; i++) {
+        EXPECT_TRUE(writer.Write(&i, sizeof(i)));
+    }
+
+    // the last ring's worth is still there
+    std::vector<uint8_t> data;
+
+    for (int i = 6; i < 10; i++) {
+        ASSERT_TRUE(reader.Read(&data));
+        ASSERT_EQ(data.size(), sizeof(int));
+        EXPECT_EQ(*(int*)data.data(), i);
+    }
+
+    EXPECT_FALSE(reader.Read(&data));
+    EXPECT_EQ(reader.GetNumDropped(), 6);
+}
+
+TEST_F(ShmRingTest, WaitAndNotify) {
+    ShmRingWriter writer;
+    ASSERT_TRUE(writer.Open(name_, 4, 16));
+
+    ShmRingReader reader;
+    ASSERT_TRUE(reader.Open(name_));
+
+    EXPECT_FALSE(reader.Wait(10));
+
+    int fd = reader.StartNotifier();
+    ASSERT_TRUE(fd >= 0);
+
+    std::thread writer_thread([&writer]() {
+        usleep(10000);
+
+        int value = 7;
+        writer.Write(&value, sizeof(value));
+    });
+
+    EXPECT_TRUE(reader.Wait(1000));
+
+    writer_thread.join();
+
+    // the notifier makes the fd readable
+    struct pollfd notify_poll;
+    notify_poll.fd = fd;
+    notify_poll.events = POLLIN;
+
+    EXPECT_EQ(poll(&notify_poll, 1, 1000), 1);
+
+    std::vector<uint8_t> data;
+    ASSERT_TRUE(reader.Read(&data));
+    EXPECT_EQ(*(int*)data.data(), 7);
+}
+
+// a reader racing a writer never sees a torn message: each one is the
+// same byte all the way through
+TEST_F(ShmRingTest, NoTornReads) {
+    const int kSize = 4096;
+
+    ShmRingWriter writer;
+    ASSERT_TRUE(writer.Open(name_, 2, kSize));
+
+    ShmRingReader reader;
+    ASSERT_TRUE(reader.Open(name_));
+
+    std::atomic<bool> done(false);
+
+    std::thread writer_thread([&writer, &done]() {
+        std::vector<uint8_t> msg(kSize);
+
+        for (int i = 0; i < 20000; i++) {
+            memset(msg.data(), i & 0xff, kSize);
+            writer.Write(msg.data(), kSize);
+        }
+
+        done = true;
+    });
+
+    std::vector<uint8_t> data;
+    int num_read = 0;
+
+    while (true) {
+        bool finished = done;
+
+        if (!reader.Read(&data)) {
+            if (finished) {
+                break;
+            }
+
+            continue;
+        }
+
+        ASSERT_EQ(data.size(), (size_t)kSize);
+
+        for (int i = 1; i < kSize; i++) {
+            ASSERT_EQ(data[i], data[0]);
+        }
+
+        num_read ++;
+    }
+
+    writer_thread.join();
+
+    EXPECT_GT(num_read, 0);
+}
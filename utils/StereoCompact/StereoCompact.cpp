@@ -0,0 +1,236 @@
+#include "StereoCompact.hpp"
+
+static int16_t ToHalfPixels(float value) {
+    long half_pixels = lrintf(2 * value);
+
+    if (half_pixels > INT16_MAX) {
+        return INT16_MAX;
+    } else if (half_pixels < INT16_MIN) {
+        return INT16_MIN;
+    }
+
+    return half_pixels;
+}
+
+/**
+ * @retval an id for a reprojection (FNV-1a of its values), never 0
+ */
+int64_t GetStereoCalibrationId(const double q[16], float unit_conversion) {
+
+    uint64_t hash = 14695981039346656037ULL;
+
+    const uint8_t *bytes = (const uint8_t*)q;
+
+    for (size_t i = 0; i < 16 * sizeof(double); i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+
+    bytes = (const uint8_t*)&unit_conversion;
+
+    for (size_t i = 0; i < sizeof(float); i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+
+    return hash != 0 ? (int64_t)hash : 1;
+}
+
+/**
+ * @param q 4x4 reprojection matrix the stereo uses (row-major)
+ * @param unit_conversion the stereo's calibrationUnitConversion
+ */
+StereoCompactEncoder::StereoCompactEncoder(const double q[16], float unit_conversion) {
+    calibration_id_ = GetStereoCalibrationId(q, unit_conversion);
+    last_index_ = -1;
+}
+
+/**
+ * Packs a frame's hits.  Fills in everything but the timestamp, frame
+ * number, and video number.  Pass the same message every frame so its
+ * arrays keep their memory.
+ *
+ * @param image_hits the hits as (u, v, d) triples, where d is what the
+ *      stereo reprojects with Q (see PushbroomStereo::ReprojectHits)
+ * @param grey each hit's brightness
+ * @param num_hits number of hits
+ * @param msg (output) packed message
+ */
+void StereoCompactEncoder::Encode(const float *image_hits, const uint8_t *grey, int num_hits, lcmt::stereo_compact *msg) {
+
+    msg->calibration_id = calibration_id_;
+
+    msg->disparities.clear();
+    last_index_ = -1;
+
+    msg->number_of_points = num_hits;
+
+    msg->u.resize(num_hits);
+    msg->v.resize(num_hits);
+    msg->disparity_index.resize(num_hits);
+    msg->grey.assign(grey, grey + num_hits);
+
+    for (int i = 0; i < num_hits; i++) {
+        const float *hit = &image_hits[3 * i];
+
+        msg->u[i] = ToHalfPixels(hit[0]);
+        msg->v[i] = ToHalfPixels(hit[1]);
+        msg->disparity_index[i] = GetDisparityIndex(hit[2], msg);
+    }
+
+    msg->number_of_disparities = msg->disparities.size();
+}
+
+/**
+ * @retval the index of a disparity in msg's table, added if it's new.  If
+ *      the table is full, the closest one in it.
+ */
+int StereoCompactEncoder::GetDisparityIndex(float disparity, lcmt::stereo_compact *msg) {
+
+    float rounded = roundf(disparity / STEREO_COMPACT_DISPARITY_STEP) * STEREO_COMPACT_DISPARITY_STEP;
+
+    std::vector<float> &disparities = msg->disparities;
+
+    if (last_index_ >= 0 && disparities[last_index_] == rounded) {
+        return last_index_;
+    }
+
+    int closest = -1;
+
+    for (int i = 0; i < (int)disparities.size(); i++) {
+        if (disparities[i] == rounded) {
+            last_index_ = i;
+            return i;
+        }
+
+        if (closest < 0 || fabsf(disparities[i] - rounded) < fabsf(disparities[closest] - rounded)) {
+            closest = i;
+        }
+    }
+
+    if (disparities.size() < STEREO_COMPACT_MAX_DISPARITIES) {
+        disparities.push_back(rounded);
+        last_index_ = disparities.size() - 1;
+    } else {
+        last_index_ = closest;
+    }
+
+    return last_index_;
+}
+
+StereoCompactDecoder::StereoCompactDecoder() {
+    memset(q_, 0, sizeof(q_));
+    unit_conversion_ = 1;
+    calibration_id_ = 0;
+}
+
+/**
+ * @param q 4x4 reprojection matrix (row-major), the same as the stereo's
+ * @param unit_conversion the stereo's calibrationUnitConversion
+ */
+void StereoCompactDecoder::SetReprojection(const double q[16], float unit_conversion) {
+    memcpy(q_, q, sizeof(q_));
+    unit_conversion_ = unit_conversion;
+
+    calibration_id_ = GetStereoCalibrationId(q_, unit_conversion_);
+}
+
+/**
+ * Reads Q from a calibration directory's Q.xml.
+ *
+ * @retval false if it couldn't be read
+ */
+bool StereoCompactDecoder::LoadReprojection(const std::string &q_file, float unit_conversion) {
+
+    cv::FileStorage storage(q_file, cv::FileStorage::READ);
+
+    cv::Mat q_mat;
+
+    if (storage.isOpened()) {
+        storage["Q"] >> q_mat;
+    }
+
+    if (q_mat.rows != 4 || q_mat.cols != 4) {
+        std::cerr << "Error: failed to read a 4x4 Q from " << q_file << std::endl;
+        return false;
+    }
+
+    q_mat.convertTo(q_mat, CV_64F);
+
+    double q[16];
+
+    for (int i = 0; i < 16; i++) {
+        q[i] = q_mat.at<double>(i / 4, i % 4);
+    }
+
+    SetReprojection(q, unit_conversion);
+
+    return true;
+}
+
+/**
+ * Unpacks a message into 3D points, as the stereo would have sent them.
+ *
+ * @param compact packed message
+ * @param msg (output) stereo message.  Pass the same one every time so
+ *      its arrays keep their memory.
+ *
+ * @retval false if the message was packed with a different calibration
+ *      (msg is left alone)
+ */
+bool StereoCompactDecoder::Decode(const lcmt::stereo_compact &compact, lcmt::stereo *msg) {
+
+    if (calibration_id_ == 0 || compact.calibration_id != calibration_id_) {
+        return false;
+    }
+
+    int num_points = compact.number_of_points;
+    int num_disparities = compact.number_of_disparities;
+
+    msg->timestamp = compact.timestamp;
+    msg->frame_number = compact.frame_number;
+    msg->video_number = compact.video_number;
+    msg->number_of_points = num_points;
+
+    msg->x.resize(num_points);
+    msg->y.resize(num_points);
+    msg->z.resize(num_points);
+    msg->grey.assign(compact.grey.begin(), compact.grey.end());
+
+    const double *m = q_;
+    double scale = 1.0 / unit_conversion_;
+
+    // the parts of the reprojection that only depend on the disparity
+    std::vector<double> d_terms(4 * num_disparities);
+
+    for (int j = 0; j < num_disparities; j++) {
+        double d = compact.disparities[j];
+
+        d_terms[4*j + 0] = m[2]*d + m[3];
+        d_terms[4*j + 1] = m[6]*d + m[7];
+        d_terms[4*j + 2] = m[10]*d + m[11];
+        d_terms[4*j + 3] = m[14]*d + m[15];
+    }
+
+    for (int i = 0; i < num_points; i++) {
+        int j = compact.disparity_index[i];
+
+        if (j >= num_disparities) {
+            // shouldn't happen, but don't read past the table
+            msg->x[i] = msg->y[i] = msg->z[i] = 0;
+            continue;
+        }
+
+        double u = 0.5 * compact.u[i];
+        double v = 0.5 * compact.v[i];
+
+        const double *terms = &d_terms[4 * j];
+
+        double w = m[12]*u + m[13]*v + terms[3];
+        w = fabs(w) > FLT_EPSILON ? scale / w : 0;
+
+        msg->x[i] = (float)((m[0]*u + m[1]*v + terms[0]) * w);
+        msg->y[i] = (float)((m[4]*u + m[5]*v + terms[1]) * w);
+        msg->z[i] = (float)((m[8]*u + m[9]*v + terms[2]) * w);
+    }
+
+    return true;
+}
@@ -0,0 +1,81 @@
+/**
+ * Packs stereo hits into an lcmt::stereo_compact (image position and
+ * disparity instead of 3D points) and unpacks them back into an
+ * lcmt::stereo.
+ *
+ * Both ends reproject with the same Q: the encoder stamps each message
+ * with an id of its Q and unit conversion, and the decoder won't decode a
+ * message whose id doesn't match its own.
+ *
+ * Positions are rounded to half a pixel (the hits are at block centers,
+ * so that's exact) and disparities to STEREO_COMPACT_DISPARITY_STEP.
+ *
+ * (C) 2015 Andrew Barry <abarry@csail.mit.edu>
+ */
+
+#ifndef STEREO_COMPACT_HPP
+#define STEREO_COMPACT_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "../../LCM/lcmt/stereo.hpp"
+#include "../../LCM/lcmt/stereo_compact.hpp"
+
+// disparities are rounded to this (pixels), which is finer than subpixel
+// refinement gets them
+#define STEREO_COMPACT_DISPARITY_STEP 0.125f
+
+// most disparities one message can have (one byte indexes them)
+#define STEREO_COMPACT_MAX_DISPARITIES 256
+
+class StereoCompactEncoder {
+
+    public:
+        StereoCompactEncoder(const double q[16], float unit_conversion);
+
+        void Encode(const float *image_hits, const uint8_t *grey, int num_hits, lcmt::stereo_compact *msg);
+
+        int64_t GetCalibrationId() const { return calibration_id_; }
+
+    private:
+        int GetDisparityIndex(float disparity, lcmt::stereo_compact *msg);
+
+        int64_t calibration_id_;
+
+        // the last disparity looked up, since hits come in runs at the
+        // same one
+        int last_index_;
+};
+
+class StereoCompactDecoder {
+
+    public:
+        StereoCompactDecoder();
+
+        void SetReprojection(const double q[16], float unit_conversion);
+        bool LoadReprojection(const std::string &q_file, float unit_conversion);
+
+        bool Decode(const lcmt::stereo_compact &compact, lcmt::stereo *msg);
+
+        int64_t GetCalibrationId() const { return calibration_id_; }
+
+    private:
+        double q_[16];
+        float unit_conversion_;
+
+        // 0 until there's a reprojection
+        int64_t calibration_id_;
+};
+
+int64_t GetStereoCalibrationId(const double q[16], float unit_conversion);
+
+#endif
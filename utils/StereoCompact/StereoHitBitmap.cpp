@@ -0,0 +1,121 @@
+#include "StereoHitBitmap.hpp"
+
+/**
+ * @param width width of the stereo's (rectified) images
+ * @param height height of the stereo's images
+ * @param block_size the stereo's blockSize
+ */
+StereoHitBitmapEncoder::StereoHitBitmapEncoder(int width, int height, int block_size) {
+    block_size_ = block_size > 0 ? block_size : 1;
+
+    cols_ = (width + block_size_ - 1) / block_size_;
+    rows_ = (height + block_size_ - 1) / block_size_;
+
+    cells_.resize(cols_ * rows_);
+}
+
+/**
+ * Packs a frame's hits.  Fills in everything but the timestamp, frame
+ * number, and video number.  Pass the same message every frame so its
+ * runs keep their memory.
+ *
+ * @param image_hits the hits as (u, v, d) triples, like
+ *      PushbroomStereoFrameBuffers::image_hits (d isn't used)
+ * @param num_hits number of hits
+ * @param msg (output) packed message
+ */
+void StereoHitBitmapEncoder::Encode(const float *image_hits, int num_hits, lcmt::stereo_hit_bitmap *msg) {
+
+    std::fill(cells_.begin(), cells_.end(), 0);
+
+    for (int i = 0; i < num_hits; i++) {
+        const float *hit = &image_hits[3 * i];
+
+        // hits are at their block's center, so this is the cell with most
+        // of the block in it
+        int col = (int)floorf(hit[0] / block_size_);
+        int row = (int)floorf(hit[1] / block_size_);
+
+        if (col >= 0 && col < cols_ && row >= 0 && row < rows_) {
+            cells_[row * cols_ + col] = 1;
+        }
+    }
+
+    msg->block_size = block_size_;
+    msg->cols = cols_;
+    msg->rows = rows_;
+
+    msg->number_of_hits = 0;
+    msg->runs.clear();
+
+    uint8_t value = 0;
+    int length = 0;
+
+    for (uint8_t cell : cells_) {
+        if (cell != value) {
+            AddRun(length, msg);
+
+            value = cell;
+            length = 0;
+        }
+
+        length ++;
+        msg->number_of_hits += cell;
+    }
+
+    // a trailing empty run is implied
+    if (value != 0) {
+        AddRun(length, msg);
+    }
+
+    msg->number_of_runs = msg->runs.size();
+}
+
+void StereoHitBitmapEncoder::AddRun(int length, lcmt::stereo_hit_bitmap *msg) {
+    while (length > STEREO_HIT_BITMAP_MAX_RUN) {
+        msg->runs.push_back(STEREO_HIT_BITMAP_MAX_RUN);
+        msg->runs.push_back(0);
+
+        length -= STEREO_HIT_BITMAP_MAX_RUN;
+    }
+
+    msg->runs.push_back(length);
+}
+
+/**
+ * Unpacks a message into the image boxes of the blocks that had hits.
+ *
+ * @param msg packed message
+ * @param blocks (output) a box for each block with a hit, in pixels.  Pass
+ *      the same vector every time so it keeps its memory.
+ *
+ * @retval false if the runs go past the grid (blocks has the ones that
+ *      fit)
+ */
+bool DecodeStereoHitBitmap(const lcmt::stereo_hit_bitmap &msg, std::vector<cv::Rect> *blocks) {
+
+    blocks->clear();
+
+    int num_cells = msg.cols * msg.rows;
+    int cell = 0;
+
+    for (int i = 0; i < msg.number_of_runs; i++) {
+        int length = msg.runs[i];
+
+        if (cell + length > num_cells) {
+            return false;
+        }
+
+        // odd runs are hits
+        if (i % 2 == 1) {
+            for (int j = cell; j < cell + length; j++) {
+                blocks->push_back(cv::Rect((j % msg.cols) * msg.block_size, (j / msg.cols) * msg.block_size,
+                    msg.block_size, msg.block_size));
+            }
+        }
+
+        cell += length;
+    }
+
+    return true;
+}
@@ -0,0 +1,52 @@
+/**
+ * Packs which blocks of the image had stereo hits into an
+ * lcmt::stereo_hit_bitmap, and unpacks them back into boxes to draw.
+ *
+ * No reprojection at either end: a hit goes into the block its (u, v) is
+ * in, so the boxes land on the rectified left image where the stereo
+ * found them.  At 376x240 and a block size of 5, a frame is usually a few
+ * hundred bytes.
+ *
+ * (C) 2015 Andrew Barry <abarry@csail.mit.edu>
+ */
+
+#ifndef STEREO_HIT_BITMAP_HPP
+#define STEREO_HIT_BITMAP_HPP
+
+#include <stdint.h>
+#include <math.h>
+
+#include <vector>
+#include <algorithm>
+
+#include <opencv2/core/core.hpp>
+
+#include "../../LCM/lcmt/stereo_hit_bitmap.hpp"
+
+// longest run one byte holds
+#define STEREO_HIT_BITMAP_MAX_RUN 255
+
+class StereoHitBitmapEncoder {
+
+    public:
+        StereoHitBitmapEncoder(int width, int height, int block_size);
+
+        void Encode(const float *image_hits, int num_hits, lcmt::stereo_hit_bitmap *msg);
+
+        int GetCols() const { return cols_; }
+        int GetRows() const { return rows_; }
+
+    private:
+        void AddRun(int length, lcmt::stereo_hit_bitmap *msg);
+
+        int block_size_;
+        int cols_;
+        int rows_;
+
+        // one per cell, reused every frame
+        std::vector<uint8_t> cells_;
+};
+
+bool DecodeStereoHitBitmap(const lcmt::stereo_hit_bitmap &msg, std::vector<cv::Rect> *blocks);
+
+#endif
@@ -0,0 +1,221 @@
+#include "StereoCompact.hpp"
+#include "StereoHitBitmap.hpp"
+#include "gtest/gtest.h"
+
+class StereoCompactTest : public testing::Test {
+
+    protected:
+
+        virtual void SetUp() {
+            // calib-odroid-cam1's Q
+            const double q[16] = { 1, 0, 0, -196.83418655395508,
+                                   0, 1, 0, -102.89849662780762,
+                                   0, 0, 0, 386.87487297066497,
+                                   0, 0, 2.9922757777026492, -60.596620789055081 };
+
+            memcpy(q_, q, sizeof(q_));
+        }
+
+        // what the stereo would have sent (see PushbroomStereo::ReprojectHits)
+        void Reproject(const float hit[3], float unit_conversion, float point[3]) {
+            double u = hit[0], v = hit[1], d = hit[2];
+            double w = (q_[12]*u + q_[13]*v + q_[14]*d + q_[15]) * unit_conversion;
+
+            point[0] = (q_[0]*u + q_[1]*v + q_[2]*d + q_[3]) / w;
+            point[1] = (q_[4]*u + q_[5]*v + q_[6]*d + q_[7]) / w;
+            point[2] = (q_[8]*u + q_[9]*v + q_[10]*d + q_[11]) / w;
+        }
+
+        double q_[16];
+};
+
+TEST_F(StereoCompactTest, RoundTrip) {
+
+    // block centers at two disparities, and one refined to a fraction
+    std::vector<float> hits = { 10.5, 20.5, 33,
+                                11.5, 20.5, 33,
+                                300, 100.5, 40,
+                                150.5, 60, 33.25 };
+
+    std::vector<uint8_t> grey = { 1, 2, 3, 4 };
+
+    int num_hits = grey.size();
+
+    StereoCompactEncoder encoder(q_, 1);
+
+    lcmt::stereo_compact compact;
+    compact.timestamp = 1234;
+    compact.frame_number = 5;
+    compact.video_number = 6;
+
+    encoder.Encode(hits.data(), grey.data(), num_hits, &compact);
+
+    EXPECT_EQ(compact.number_of_points, num_hits);
+    EXPECT_EQ(compact.number_of_disparities, 3);
+    EXPECT_EQ(compact.disparity_index[0], compact.disparity_index[1]);
+
+    StereoCompactDecoder decoder;
+    decoder.SetReprojection(q_, 1);
+
+    lcmt::stereo msg;
+    ASSERT_TRUE(decoder.Decode(compact, &msg));
+
+    EXPECT_EQ(msg.timestamp, 1234);
+    EXPECT_EQ(msg.frame_number, 5);
+    EXPECT_EQ(msg.video_number, 6);
+    ASSERT_EQ(msg.number_of_points, num_hits);
+
+    for (int i = 0; i < num_hits; i++) {
+        float point[3];
+        Reproject(&hits[3 * i], 1, point);
+
+        EXPECT_NEAR(msg.x[i], point[0], 1e-3);
+        EXPECT_NEAR(msg.y[i], point[1], 1e-3);
+        EXPECT_NEAR(msg.z[i], point[2], 1e-3);
+        EXPECT_EQ(msg.grey[i], grey[i]);
+    }
+}
+
+TEST_F(StereoCompactTest, Size) {
+
+    // a busy frame: a few thousand hits at the pushbroom disparity
+    int num_hits = 3000;
+
+    std::vector<float> hits(3 * num_hits);
+    std::vector<uint8_t> grey(num_hits);
+
+    for (int i = 0; i < num_hits; i++) {
+        hits[3*i + 0] = 2.5 + i % 370;
+        hits[3*i + 1] = 2.5 + i / 370;
+        hits[3*i + 2] = 33;
+    }
+
+    StereoCompactEncoder encoder(q_, 1);
+
+    lcmt::stereo_compact compact;
+    compact.timestamp = 0;
+    compact.frame_number = 0;
+    compact.video_number = 0;
+
+    encoder.Encode(hits.data(), grey.data(), num_hits, &compact);
+
+    StereoCompactDecoder decoder;
+    decoder.SetReprojection(q_, 1);
+
+    lcmt::stereo msg;
+    ASSERT_TRUE(decoder.Decode(compact, &msg));
+
+    // less than half the size of the message it replaces
+    EXPECT_LT(compact.getEncodedSize(), msg.getEncodedSize() / 2);
+}
+
+TEST_F(StereoCompactTest, CalibrationMismatch) {
+
+    std::vector<float> hits = { 10.5, 20.5, 33 };
+    std::vector<uint8_t> grey = { 1 };
+
+    StereoCompactEncoder encoder(q_, 1);
+
+    lcmt::stereo_compact compact;
+    compact.timestamp = 0;
+    compact.frame_number = 0;
+    compact.video_number = 0;
+
+    encoder.Encode(hits.data(), grey.data(), 1, &compact);
+
+    lcmt::stereo msg;
+
+    // no calibration yet
+    StereoCompactDecoder decoder;
+    EXPECT_FALSE(decoder.Decode(compact, &msg));
+
+    // different units
+    decoder.SetReprojection(q_, 100);
+    EXPECT_FALSE(decoder.Decode(compact, &msg));
+
+    decoder.SetReprojection(q_, 1);
+    EXPECT_TRUE(decoder.Decode(compact, &msg));
+    EXPECT_EQ(decoder.GetCalibrationId(), encoder.GetCalibrationId());
+}
+
+TEST_F(StereoCompactTest, LoadReprojection) {
+    StereoCompactDecoder decoder;
+
+    EXPECT_FALSE(decoder.LoadReprojection("does-not-exist.xml", 1));
+
+    // the Q above, so it's the same calibration
+    ASSERT_TRUE(decoder.LoadReprojection("../../sensors/stereo/calib-odroid-cam1/Q.xml", 1));
+
+    StereoCompactEncoder encoder(q_, 1);
+
+    EXPECT_EQ(decoder.GetCalibrationId(), encoder.GetCalibrationId());
+}
+
+TEST(StereoHitBitmap, RoundTrip) {
+
+    // 376x240 at block size 5 is 76x48 cells
+    StereoHitBitmapEncoder encoder(376, 240, 5);
+
+    EXPECT_EQ(encoder.GetCols(), 76);
+    EXPECT_EQ(encoder.GetRows(), 48);
+
+    // a run of three, a lone one in the last cell, two in the same cell,
+    // and one off the image
+    std::vector<float> hits = { 12.5, 7.5, 33,
+                                17.5, 7.5, 33,
+                                22.5, 7.5, 34,
+                                377.5, 237.5, 40,
+                                100.5, 100.5, 35,
+                                102, 102, 35.5,
+                                400, 10, 30 };
+
+    lcmt::stereo_hit_bitmap msg;
+    msg.timestamp = 1234;
+    msg.frame_number = 5;
+    msg.video_number = 6;
+
+    encoder.Encode(hits.data(), hits.size() / 3, &msg);
+
+    EXPECT_EQ(msg.number_of_hits, 5);
+
+    // the empty space before the last cell is split into runs of 255
+    EXPECT_EQ(msg.number_of_runs, (int)msg.runs.size());
+    EXPECT_LT(msg.getEncodedSize(), 100);
+
+    std::vector<cv::Rect> blocks;
+    ASSERT_TRUE(DecodeStereoHitBitmap(msg, &blocks));
+
+    ASSERT_EQ(blocks.size(), 5u);
+
+    EXPECT_EQ(blocks[0], cv::Rect(10, 5, 5, 5));
+    EXPECT_EQ(blocks[1], cv::Rect(15, 5, 5, 5));
+    EXPECT_EQ(blocks[2], cv::Rect(20, 5, 5, 5));
+    EXPECT_EQ(blocks[3], cv::Rect(100, 100, 5, 5));
+    EXPECT_EQ(blocks[4], cv::Rect(375, 235, 5, 5));
+
+    // a new frame doesn't keep the old one's hits
+    encoder.Encode(hits.data(), 1, &msg);
+
+    EXPECT_EQ(msg.number_of_hits, 1);
+    ASSERT_TRUE(DecodeStereoHitBitmap(msg, &blocks));
+    ASSERT_EQ(blocks.size(), 1u);
+    EXPECT_EQ(blocks[0], cv::Rect(10, 5, 5, 5));
+}
+
+TEST(StereoHitBitmap, BadRuns) {
+    lcmt::stereo_hit_bitmap msg;
+    msg.block_size = 5;
+    msg.cols = 4;
+    msg.rows = 2;
+
+    // 8 cells, but 3 + 6 in the runs
+    msg.runs = { 3, 6 };
+    msg.number_of_runs = msg.runs.size();
+
+    std::vector<cv::Rect> blocks;
+    EXPECT_FALSE(DecodeStereoHitBitmap(msg, &blocks));
+
+    msg.runs = { 3, 5 };
+    EXPECT_TRUE(DecodeStereoHitBitmap(msg, &blocks));
+    EXPECT_EQ(blocks.size(), 5u);
+}
@@ -0,0 +1,341 @@
+#include "ThreadPool.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+
+#include <thread>
+#include <algorithm>
+
+// the process-wide pool, made on first use
+static std::mutex shared_mutex;
+static std::unique_ptr<ThreadPool> shared_pool;
+static ThreadPoolConfig shared_config = ThreadPool::DefaultConfig();
+
+/**
+ * Starts the worker threads.
+ *
+ * @param config number of threads, affinity and priority
+ */
+ThreadPool::ThreadPool(ThreadPoolConfig config) {
+
+    shutting_down_ = false;
+
+    num_threads_ = config.num_threads;
+
+    if (num_threads_ <= 0) {
+        num_threads_ = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+    }
+
+    if (num_threads_ > THREAD_POOL_MAX_THREADS) {
+        fprintf(stderr, "Warning: %d pool threads requested, using %d.\n", num_threads_, THREAD_POOL_MAX_THREADS);
+        num_threads_ = THREAD_POOL_MAX_THREADS;
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+
+    if (config.fifo_priority > 0) {
+        struct sched_param param;
+        param.sched_priority = config.fifo_priority;
+
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+    }
+
+    for (int i = 0; i < num_threads_; i++) {
+
+        if (pthread_create(&threads_[i], &attr, WorkerThread, this) != 0) {
+            // usually not being allowed to use SCHED_FIFO
+            fprintf(stderr, "Warning: failed to start pool thread %d with SCHED_FIFO priority %d, "
+                "using normal scheduling.\n", i, config.fifo_priority);
+
+            pthread_create(&threads_[i], NULL, WorkerThread, this);
+        }
+
+        if (config.cpus[i] >= 0) {
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            CPU_SET(config.cpus[i], &cpu_set);
+
+            if (pthread_setaffinity_np(threads_[i], sizeof(cpu_set), &cpu_set) != 0) {
+                fprintf(stderr, "Warning: failed to pin pool thread %d to CPU %d.\n", i, config.cpus[i]);
+            }
+        }
+    }
+
+    pthread_attr_destroy(&attr);
+}
+
+/**
+ * Lets running tasks finish and stops the workers.  Tasks that haven't
+ * started don't run.
+ */
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> locker(mutex_);
+        shutting_down_ = true;
+    }
+
+    cv_task_.notify_all();
+
+    for (int i = 0; i < num_threads_; i++) {
+        pthread_join(threads_[i], NULL);
+    }
+}
+
+/**
+ * A thread per core but one, not pinned, normal scheduling.
+ */
+ThreadPoolConfig ThreadPool::DefaultConfig() {
+    ThreadPoolConfig config;
+
+    config.num_threads = 0;
+    config.fifo_priority = 0;
+
+    for (int i = 0; i < THREAD_POOL_MAX_THREADS; i++) {
+        config.cpus[i] = -1;
+    }
+
+    return config;
+}
+
+/**
+ * Sets up the shared pool.  Call it from main() before anything uses the
+ * pool.
+ *
+ * @param config number of threads, affinity and priority
+ *
+ * @retval false if the shared pool was already started (and is kept as it
+ *      was)
+ */
+bool ThreadPool::ConfigureShared(ThreadPoolConfig config) {
+    std::unique_lock<std::mutex> locker(shared_mutex);
+
+    if (shared_pool) {
+        fprintf(stderr, "Warning: the shared thread pool is already running, not reconfiguring it.\n");
+        return false;
+    }
+
+    shared_config = config;
+    return true;
+}
+
+/**
+ * @retval the process-wide pool, started with ConfigureShared()'s settings
+ *      (or the defaults) the first time
+ */
+ThreadPool* ThreadPool::GetShared() {
+    std::unique_lock<std::mutex> locker(shared_mutex);
+
+    if (!shared_pool) {
+        shared_pool.reset(new ThreadPool(shared_config));
+    }
+
+    return shared_pool.get();
+}
+
+/**
+ * Queues a task for the workers.
+ *
+ * @param task function to run
+ * @param priority THREAD_POOL_HIGH, THREAD_POOL_NORMAL or THREAD_POOL_LOW
+ */
+void ThreadPool::Submit(std::function<void()> task, int priority) {
+    priority = std::max(0, std::min(priority, THREAD_POOL_NUM_PRIORITIES - 1));
+
+    {
+        std::unique_lock<std::mutex> locker(mutex_);
+        queues_[priority].push_back(std::move(task));
+    }
+
+    cv_task_.notify_one();
+}
+
+void* ThreadPool::WorkerThread(void *x) {
+    ThreadPool *pool = (ThreadPool*)x;
+
+    while (true) {
+        std::function<void()> task;
+
+        {
+            std::unique_lock<std::mutex> locker(pool->mutex_);
+
+            while (true) {
+                if (pool->shutting_down_) {
+                    return NULL;
+                }
+
+                int priority = 0;
+
+                while (priority < THREAD_POOL_NUM_PRIORITIES && pool->queues_[priority].empty()) {
+                    priority++;
+                }
+
+                if (priority < THREAD_POOL_NUM_PRIORITIES) {
+                    task = std::move(pool->queues_[priority].front());
+                    pool->queues_[priority].pop_front();
+                    break;
+                }
+
+                pool->cv_task_.wait(locker);
+            }
+        }
+
+        task();
+    }
+
+    return NULL;
+}
+
+/**
+ * Runs body(i) for every i in [begin, end) on the workers and the calling
+ * thread, and returns once they've all finished.  Indices are handed out
+ * one at a time, so uneven ones balance out.
+ *
+ * @param begin first index
+ * @param end one past the last index
+ * @param body function to run on each index, from several threads at once
+ * @param priority of the helper tasks
+ */
+void ThreadPool::ParallelFor(int begin, int end, const std::function<void(int)> &body, int priority) {
+
+    int count = end - begin;
+
+    if (count <= 0) {
+        return;
+    }
+
+    if (count == 1) {
+        body(begin);
+        return;
+    }
+
+    // the helpers can start after the loop is over (the calling thread
+    // did everything), so they share this instead of using the stack
+    struct LoopState {
+        std::atomic<int> next;
+        std::atomic<int> done;
+        int end;
+        int count;
+        std::function<void(int)> body;
+
+        std::mutex mutex;
+        std::condition_variable cv_done;
+    };
+
+    std::shared_ptr<LoopState> state = std::make_shared<LoopState>();
+
+    state->next = begin;
+    state->done = 0;
+    state->end = end;
+    state->count = count;
+    state->body = body;
+
+    auto work = [state]() {
+        int completed = 0;
+
+        for (int i = state->next++; i < state->end; i = state->next++) {
+            state->body(i);
+            completed++;
+        }
+
+        if (completed > 0 && (state->done += completed) == state->count) {
+            std::unique_lock<std::mutex> locker(state->mutex);
+            state->cv_done.notify_all();
+        }
+    };
+
+    int num_helpers = std::min(count - 1, num_threads_);
+
+    for (int i = 0; i < num_helpers; i++) {
+        Submit(work, priority);
+    }
+
+    work();
+
+    // everything has been handed out, so what's left is running on the
+    // workers and will finish
+    std::unique_lock<std::mutex> locker(state->mutex);
+
+    while (state->done.load() < count) {
+        state->cv_done.wait(locker);
+    }
+}
+
+ThreadPoolGroup::ThreadPoolGroup(ThreadPool *pool, int priority) {
+    pool_ = pool;
+    priority_ = priority;
+
+    state_ = std::make_shared<State>();
+    state_->pending = 0;
+}
+
+ThreadPoolGroup::~ThreadPoolGroup() {
+    Wait();
+}
+
+/**
+ * Starts a task in the group.
+ *
+ * @param task function to run
+ */
+void ThreadPoolGroup::Run(std::function<void()> task) {
+    {
+        std::unique_lock<std::mutex> locker(state_->mutex);
+
+        state_->tasks.push_back(std::move(task));
+        state_->pending++;
+    }
+
+    std::shared_ptr<State> state = state_;
+
+    pool_->Submit([state]() { RunNext(state); }, priority_);
+}
+
+/**
+ * Runs the group's tasks that haven't started yet and waits for the rest
+ * to finish.
+ */
+void ThreadPoolGroup::Wait() {
+    while (true) {
+        RunNext(state_);
+
+        std::unique_lock<std::mutex> locker(state_->mutex);
+
+        if (state_->tasks.empty()) {
+            while (state_->pending > 0) {
+                state_->cv_done.wait(locker);
+            }
+
+            return;
+        }
+    }
+}
+
+void ThreadPoolGroup::RunNext(const std::shared_ptr<State> &state) {
+    std::function<void()> task;
+
+    {
+        std::unique_lock<std::mutex> locker(state->mutex);
+
+        if (state->tasks.empty()) {
+            // Wait() or another runner got to it first
+            return;
+        }
+
+        task = std::move(state->tasks.front());
+        state->tasks.pop_front();
+    }
+
+    task();
+
+    std::unique_lock<std::mutex> locker(state->mutex);
+
+    state->pending--;
+
+    if (state->pending == 0) {
+        state->cv_done.notify_all();
+    }
+}
@@ -0,0 +1,121 @@
+/**
+ * One set of worker threads for everything in a process that wants to run
+ * in parallel (stereo bands, trajectory searches, the octomap's distance
+ * field), so that they share the cores instead of each starting their own
+ * threads and fighting over them.
+ *
+ * The process's main() sets the number of threads, their CPUs and their
+ * priority once with ConfigureShared(), and everything else uses
+ * GetShared().  Tasks run in priority order, so a stereo frame doesn't
+ * wait behind a background ranking.
+ *
+ * ParallelFor() and ThreadPoolGroup::Wait() run their own work on the
+ * calling thread while they wait, so they finish even if every worker is
+ * busy, and they can be nested (a parallel loop inside a task of another
+ * one).  They never pick up anyone else's work, so waiting on a short loop
+ * can't get stuck behind someone's long one.
+ *
+ *   ThreadPool::GetShared()->ParallelFor(0, n, [&](int i) {
+ *       distances[i] = TrajectoryClearance(i);
+ *   });
+ *
+ * (C) 2015 Andrew Barry <abarry@csail.mit.edu>
+ */
+
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <pthread.h>
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+
+#define THREAD_POOL_MAX_THREADS 32
+
+// tasks in higher priorities all run before any in lower ones
+enum ThreadPoolPriority {
+    THREAD_POOL_HIGH = 0,       // per-frame work someone is waiting on
+    THREAD_POOL_NORMAL = 1,
+    THREAD_POOL_LOW = 2,        // background work
+    THREAD_POOL_NUM_PRIORITIES = 3
+};
+
+struct ThreadPoolConfig {
+    // worker threads (0 for one fewer than the number of cores, since
+    // whoever waits on the work helps with it)
+    int num_threads;
+
+    // CPU to pin each worker to, or -1 to leave it to the scheduler
+    int cpus[THREAD_POOL_MAX_THREADS];
+
+    // SCHED_FIFO priority for the workers, or 0 for normal scheduling
+    int fifo_priority;
+};
+
+class ThreadPool {
+
+    public:
+        explicit ThreadPool(ThreadPoolConfig config = DefaultConfig());
+        ~ThreadPool();
+
+        static ThreadPoolConfig DefaultConfig();
+
+        static bool ConfigureShared(ThreadPoolConfig config);
+        static ThreadPool* GetShared();
+
+        int GetNumThreads() const { return num_threads_; }
+
+        void Submit(std::function<void()> task, int priority = THREAD_POOL_NORMAL);
+
+        void ParallelFor(int begin, int end, const std::function<void(int)> &body, int priority = THREAD_POOL_NORMAL);
+
+    private:
+        static void* WorkerThread(void *x);
+
+        int num_threads_;
+        pthread_t threads_[THREAD_POOL_MAX_THREADS];
+
+        std::mutex mutex_;
+        std::condition_variable cv_task_;
+        std::deque<std::function<void()>> queues_[THREAD_POOL_NUM_PRIORITIES];
+        bool shutting_down_;
+};
+
+/**
+ * Tasks to wait for together.  Wait() runs the group's tasks that haven't
+ * started yet on the calling thread, then waits for the rest.
+ */
+class ThreadPoolGroup {
+
+    public:
+        ThreadPoolGroup(ThreadPool *pool, int priority = THREAD_POOL_NORMAL);
+        ~ThreadPoolGroup();
+
+        void Run(std::function<void()> task);
+        void Wait();
+
+    private:
+        ThreadPool *pool_;
+        int priority_;
+
+        // the group's own queue.  Each Run() also queues a runner in the
+        // pool that takes one task from here, so the tasks get done by
+        // whoever comes first.  Runners can still be in the pool's queue
+        // after Wait() took their tasks, so they share this.
+        struct State {
+            std::mutex mutex;
+            std::condition_variable cv_done;
+            std::deque<std::function<void()>> tasks;
+            int pending;
+        };
+
+        static void RunNext(const std::shared_ptr<State> &state);
+
+        std::shared_ptr<State> state_;
+};
+
+#endif
@@ -0,0 +1,173 @@
+#include "ThreadPool.hpp"
+#include "gtest/gtest.h"
+
+#include <vector>
+#include <thread>
+#include <chrono>
+
+static ThreadPoolConfig Config(int num_threads) {
+    ThreadPoolConfig config = ThreadPool::DefaultConfig();
+    config.num_threads = num_threads;
+    return config;
+}
+
+// keeps a pool's worker busy until Release()
+class Blocker {
+    public:
+        Blocker() : started_(false), released_(false) {}
+
+        void Block(ThreadPool *pool) {
+            pool->Submit([this]() {
+                started_ = true;
+
+                while (!released_) {
+                    std::this_thread::yield();
+                }
+            }, THREAD_POOL_HIGH);
+
+            while (!started_) {
+                std::this_thread::yield();
+            }
+        }
+
+        void Release() { released_ = true; }
+
+    private:
+        std::atomic<bool> started_;
+        std::atomic<bool> released_;
+};
+
+TEST(ThreadPool, ParallelForRunsEachIndexOnce) {
+    ThreadPool pool(Config(4));
+
+    std::vector<std::atomic<int>> counts(1000);
+
+    for (size_t i = 0; i < counts.size(); i++) {
+        counts[i] = 0;
+    }
+
+    pool.ParallelFor(0, counts.size(), [&counts](int i) { counts[i]++; });
+
+    for (size_t i = 0; i < counts.size(); i++) {
+        EXPECT_EQ(counts[i].load(), 1) << i;
+    }
+
+    // empty and single ranges
+    int calls = 0;
+    pool.ParallelFor(5, 5, [&calls](int i) { calls++; });
+    pool.ParallelFor(7, 8, [&calls](int i) { EXPECT_EQ(i, 7); calls++; });
+    EXPECT_EQ(calls, 1);
+}
+
+TEST(ThreadPool, ParallelForNests) {
+    ThreadPool pool(Config(3));
+
+    std::atomic<int> total(0);
+
+    pool.ParallelFor(0, 20, [&](int i) {
+        pool.ParallelFor(0, 50, [&](int j) { total++; });
+    });
+
+    EXPECT_EQ(total.load(), 20 * 50);
+}
+
+TEST(ThreadPool, FinishesWithEveryWorkerBusy) {
+    ThreadPool pool(Config(1));
+
+    Blocker blocker;
+    blocker.Block(&pool);
+
+    // nobody else can help, so the calling threads do it all
+    std::atomic<int> total(0);
+    pool.ParallelFor(0, 100, [&total](int i) { total++; });
+    EXPECT_EQ(total.load(), 100);
+
+    ThreadPoolGroup group(&pool);
+
+    for (int i = 0; i < 10; i++) {
+        group.Run([&total]() { total++; });
+    }
+
+    group.Wait();
+    EXPECT_EQ(total.load(), 110);
+
+    blocker.Release();
+}
+
+TEST(ThreadPool, Priorities) {
+    ThreadPool pool(Config(1));
+
+    Blocker blocker;
+    blocker.Block(&pool);
+
+    std::mutex order_mutex;
+    std::vector<int> order;
+
+    auto record = [&](int n) {
+        return [&, n]() {
+            std::unique_lock<std::mutex> locker(order_mutex);
+            order.push_back(n);
+        };
+    };
+
+    ThreadPoolGroup low(&pool, THREAD_POOL_LOW), normal(&pool, THREAD_POOL_NORMAL), high(&pool, THREAD_POOL_HIGH);
+
+    low.Run(record(3));
+    normal.Run(record(2));
+    high.Run(record(1));
+    high.Run(record(1));
+
+    blocker.Release();
+
+    // let the worker run them all before anyone waits and takes one
+    while (true) {
+        {
+            std::unique_lock<std::mutex> locker(order_mutex);
+
+            if (order.size() == 4) {
+                break;
+            }
+        }
+
+        std::this_thread::yield();
+    }
+
+    std::vector<int> expected = { 1, 1, 2, 3 };
+    EXPECT_EQ(order, expected);
+}
+
+TEST(ThreadPool, GroupWaitsForRunningTasks) {
+    ThreadPool pool(Config(4));
+
+    std::atomic<int> finished(0);
+
+    {
+        ThreadPoolGroup group(&pool);
+
+        for (int i = 0; i < 8; i++) {
+            group.Run([&finished]() {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                finished++;
+            });
+        }
+
+        // the destructor waits too
+    }
+
+    EXPECT_EQ(finished.load(), 8);
+}
+
+TEST(ThreadPool, Shared) {
+    ThreadPoolConfig config = Config(2);
+
+    EXPECT_TRUE(ThreadPool::ConfigureShared(config));
+
+    ThreadPool *pool = ThreadPool::GetShared();
+    ASSERT_TRUE(pool != NULL);
+    EXPECT_EQ(pool->GetNumThreads(), 2);
+    EXPECT_EQ(ThreadPool::GetShared(), pool);
+
+    // too late once it's running
+    EXPECT_FALSE(ThreadPool::ConfigureShared(Config(5)));
+    EXPECT_EQ(ThreadPool::GetShared()->GetNumThreads(), 2);
+}
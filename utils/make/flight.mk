@@ -48,11 +48,34 @@ OCTOMAP_LIB=-Wl,-rpath $(OCTOMAP_LIB_DIR)
 
 GTEST_LIB=../../externals/gtest/libgtest.a ../../externals/gtest/libgtest_main.a
 
+# "make TURBOJPEG=1" builds jpeg-utils' reusable compressors and
+# decompressors on TurboJPEG instead of plain libjpeg (see
+# externals/jpeg-utils/jpeg-utils.h)
+ifeq ($(TURBOJPEG),1)
+CPPFLAGS_EXTRA += -DUSE_TURBOJPEG
+LDPOSTFLAGS_EXTRA += -lturbojpeg
+endif
+
+# "make GSTREAMER=1" builds the hardware video encoder for recordings (see
+# sensors/stereo/HardwareVideoWriter.hpp)
+ifeq ($(GSTREAMER),1)
+CPPFLAGS_EXTRA += -DUSE_GSTREAMER
+REQUIRES_EXTRA += gstreamer-1.0 gstreamer-app-1.0
+endif
+
+# "make NO_ALLOC_GUARD=1" checks that NO_ALLOC_SCOPE regions don't
+# allocate once they're warmed up (see utils/utils/NoAllocGuard.hpp).
+# -rdynamic so the reports' stack traces have names.
+ifeq ($(NO_ALLOC_GUARD),1)
+CPPFLAGS_EXTRA += -DUSE_NO_ALLOC_GUARD
+LDPOSTFLAGS_EXTRA += -rdynamic
+endif
+
 CXXFLAGS=-std=c++0x
 
-CPPFLAGS=-c -Wall -O3 -fopenmp -I/usr/local/include/opencv2 `PKG_CONFIG_PATH=$(PKG_CONFIG_PATH_PRONTO) pkg-config --cflags $(REQUIRES) $(REQUIRES_EXTRA)` -I$(MAVCONN_INCLUDE) -I$(LOCAL_MAVLINK) -I$(MAVLINK_INCLUDE) -I$(FIREFLY_MV_UTILS) -I$(DC1394) -I$(GTEST_INCLUDE) -I$(SMC_INCLUDE)
+CPPFLAGS=-c -Wall -O3 -fopenmp -I/usr/local/include/opencv2 `PKG_CONFIG_PATH=$(PKG_CONFIG_PATH_PRONTO) pkg-config --cflags $(REQUIRES) $(REQUIRES_EXTRA)` -I$(MAVCONN_INCLUDE) -I$(LOCAL_MAVLINK) -I$(MAVLINK_INCLUDE) -I$(FIREFLY_MV_UTILS) -I$(DC1394) -I$(GTEST_INCLUDE) -I$(SMC_INCLUDE) $(CPPFLAGS_EXTRA)
 
-LDPOSTFLAGS = -fopenmp `PKG_CONFIG_PATH=$(PKG_CONFIG_PATH_PRONTO) pkg-config --libs $(REQUIRES) $(REQUIRES_EXTRA)` -lgthread-2.0 -lboost_system -lboost_filesystem $(LCMLIB) $(MAVCONN) $(FIREFLY_MV_UTILS_LIB) $(GTEST_LIB) $(OCTOMAP_LIB) $(LCM_PRONTO_LIB) -L $(DC1394_LIB) -ldc1394
+LDPOSTFLAGS = -fopenmp `PKG_CONFIG_PATH=$(PKG_CONFIG_PATH_PRONTO) pkg-config --libs $(REQUIRES) $(REQUIRES_EXTRA)` -lgthread-2.0 -lboost_system -lboost_filesystem $(LCMLIB) $(MAVCONN) $(FIREFLY_MV_UTILS_LIB) $(GTEST_LIB) $(OCTOMAP_LIB) $(LCM_PRONTO_LIB) -L $(DC1394_LIB) -ldc1394 $(LDPOSTFLAGS_EXTRA)
 
 
 # include a standard makefile that uses these variables and builds everything
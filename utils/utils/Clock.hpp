@@ -0,0 +1,126 @@
+#ifndef CLOCK_HPP
+#define CLOCK_HPP
+
+/*
+ * The clocks everything should read, instead of each program keeping its
+ * own gettimeofday() copy:
+ *
+ *   GetRawMonotonicNow(): CLOCK_MONOTONIC_RAW in usec.  Never steps or
+ *      slews, so it's the one to measure durations and run timeouts on.
+ *
+ *   GetWallNow(): wall clock time in usec for timestamps that go in
+ *      messages and logs, so other computers can line them up.  It's the
+ *      raw monotonic clock plus an offset to the wall clock.  The offset
+ *      follows small wall clock corrections (NTP) by slewing at most
+ *      CLOCK_MAX_SLEW_PPM, so the stamps never jump backwards and
+ *      differences between them stay true.  A wall clock step bigger than
+ *      CLOCK_MAX_SLEW_USEC (the clock being set at boot, or from the GPS)
+ *      is taken right away, since being hours off from every other program
+ *      is worse.
+ *
+ *   GetCycleCount(): the CPU's cycle counter, for timing hot loops where
+ *      even a vDSO call shows up.  CyclesToUsec() converts a difference.
+ *      Where there isn't a counter user code can read (32-bit ARM), it's
+ *      CLOCK_MONOTONIC in nanoseconds.
+ *
+ * All header, so C++ programs that don't link RealtimeUtils can use it too.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// slew limit on GetWallNow()'s offset (like adjtime's)
+#define CLOCK_MAX_SLEW_PPM 500
+
+// a wall clock change bigger than this (usec) is stepped to, not slewed
+#define CLOCK_MAX_SLEW_USEC 1000000
+
+inline int64_t ClockRead(clockid_t clock) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+inline int64_t GetRawMonotonicNow() {
+    return ClockRead(CLOCK_MONOTONIC_RAW);
+}
+
+inline int64_t GetWallNow() {
+    // one copy for the whole program, since it's an inline function's
+    static std::atomic<int64_t> offset(INT64_MIN);
+    static std::atomic<int64_t> last_raw(0);
+
+    int64_t raw = GetRawMonotonicNow();
+    int64_t target = ClockRead(CLOCK_REALTIME) - raw;
+
+    int64_t current = offset.load(std::memory_order_relaxed);
+    int64_t error = target - current;
+
+    if (current == INT64_MIN || error > CLOCK_MAX_SLEW_USEC || error < -CLOCK_MAX_SLEW_USEC) {
+        current = target;
+    } else {
+        int64_t max_slew = (raw - last_raw.load(std::memory_order_relaxed)) * CLOCK_MAX_SLEW_PPM / 1000000;
+
+        if (max_slew < 0) {
+            // another thread read the clock after this one did
+            max_slew = 0;
+        }
+
+        if (error > max_slew) {
+            error = max_slew;
+        } else if (error < -max_slew) {
+            error = -max_slew;
+        }
+
+        current += error;
+    }
+
+    // racing threads just redo a slew step
+    offset.store(current, std::memory_order_relaxed);
+    last_raw.store(raw, std::memory_order_relaxed);
+
+    return raw + current;
+}
+
+inline uint64_t GetCycleCount() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t count;
+    asm volatile("mrs %0, cntvct_el0" : "=r" (count));
+    return count;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+inline double CyclesToUsec(uint64_t cycles) {
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+    // measured once against the monotonic clock, the first time it's needed
+    static const double usec_per_cycle = []() {
+        int64_t start_usec = GetRawMonotonicNow();
+        uint64_t start = GetCycleCount();
+
+        struct timespec wait = { 0, 10000000 };
+        nanosleep(&wait, NULL);
+
+        return (GetRawMonotonicNow() - start_usec) / (double)(GetCycleCount() - start);
+    }();
+
+    return cycles * usec_per_cycle;
+#else
+    return cycles / 1000.0;
+#endif
+}
+
+#endif
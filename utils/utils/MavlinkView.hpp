@@ -0,0 +1,96 @@
+#ifndef MAVLINK_VIEW_HPP
+#define MAVLINK_VIEW_HPP
+
+/*
+ * Read-only views of MAVLink messages' payloads, for the message types that
+ * come in fast enough for mavlink_msg_*_decode()'s copy to show up:
+ *
+ *   mavlink_raw_imu_t buffer;
+ *   const mavlink_raw_imu_t *raw_imu = MavlinkView(mavmsg, &buffer);
+ *
+ * MAVLink orders a message's fields largest first, so on a little-endian
+ * computer the payload is laid out just like the message's struct and the
+ * view points right into it.  buffer is only used on big-endian computers,
+ * where the message still has to be decoded.  Either way, the view is good
+ * for as long as the message (and buffer) are.
+ *
+ * Include the dialect's mavlink.h first.  Views are only made for the
+ * message types it has.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <stdint.h>
+
+template <typename T>
+struct MavlinkViewTraits;
+
+// the length on the wire and the generated decode for each message type
+#define MAVLINK_VIEW(name, NAME) \
+    template <> \
+    struct MavlinkViewTraits<mavlink_##name##_t> { \
+        static const int length = MAVLINK_MSG_ID_##NAME##_LEN; \
+        static void Decode(const mavlink_message_t *msg, mavlink_##name##_t *out) { mavlink_msg_##name##_decode(msg, out); } \
+    };
+
+#ifdef MAVLINK_MSG_ID_RAW_IMU
+MAVLINK_VIEW(raw_imu, RAW_IMU)
+#endif
+
+#ifdef MAVLINK_MSG_ID_GPS_RAW_INT
+MAVLINK_VIEW(gps_raw_int, GPS_RAW_INT)
+#endif
+
+#ifdef MAVLINK_MSG_ID_SCALED_PRESSURE
+MAVLINK_VIEW(scaled_pressure, SCALED_PRESSURE)
+#endif
+
+#ifdef MAVLINK_MSG_ID_SERVO_OUTPUT_RAW
+MAVLINK_VIEW(servo_output_raw, SERVO_OUTPUT_RAW)
+#endif
+
+#ifdef MAVLINK_MSG_ID_LCM_TRANSPORT
+MAVLINK_VIEW(lcm_transport, LCM_TRANSPORT)
+#endif
+
+#undef MAVLINK_VIEW
+
+/**
+ * @param msg message to view
+ * @param buffer where to decode the message if it can't be viewed in place
+ *
+ * @retval the message's fields
+ */
+template <typename T>
+inline const T* MavlinkView(const mavlink_message_t *msg, T *buffer) {
+
+    // the struct can only have padding at the end, past the payload
+    static_assert(sizeof(T) >= MavlinkViewTraits<T>::length && sizeof(T) - MavlinkViewTraits<T>::length < alignof(T),
+        "MAVLink message struct doesn't match its payload");
+
+#if MAVLINK_NEED_BYTE_SWAP
+    MavlinkViewTraits<T>::Decode(msg, buffer);
+    return buffer;
+#else
+    (void)buffer;
+    return reinterpret_cast<const T*>(_MAV_PAYLOAD(msg));
+#endif
+}
+
+/**
+ * Converts raw integer readings (an IMU's x, y and z, say) to doubles in one
+ * pass the compiler can vectorize.
+ *
+ * @param in readings
+ * @param scale each reading is multiplied by this
+ * @param out (output) the converted readings
+ * @param count number of readings
+ */
+inline void ScaleInt16(const int16_t *in, double scale, double *out, int count) {
+    for (int i = 0; i < count; i++) {
+        out[i] = in[i] * scale;
+    }
+}
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef MEMORY_ACCOUNTING_HPP
+#define MEMORY_ACCOUNTING_HPP
+
+/*
+ * Counts the memory each of the big subsystems of a process holds, so when
+ * one grows over a long session it shows up in telemetry (see
+ * MemoryStatsPublisher in RealtimeUtils.hpp) instead of as an OOM.
+ *
+ * Two ways in:
+ *   - containers that own their memory use AccountedAllocator (or
+ *     AccountedVector), which counts every allocation as it happens
+ *   - memory a subsystem doesn't allocate itself (cv::Mats, Eigen
+ *     matrices, mmap'd buffers) is measured and reported with a
+ *     MemoryGauge, or with MemoryAccountAlloc() / MemoryAccountFree()
+ *
+ * Everything is relaxed atomics, so it's cheap enough for any thread.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+enum MemorySubsystem {
+    MEMORY_RECORDING,       // RecordingManager
+    MEMORY_STEREO,          // PushbroomStereo
+    MEMORY_OCTOMAP,         // StereoOctomap
+    MEMORY_TRAJECTORIES,    // TrajectoryLibrary
+    MEMORY_NUM_SUBSYSTEMS
+};
+
+inline const char* MemorySubsystemName(int subsystem) {
+    switch (subsystem) {
+        case MEMORY_RECORDING:      return "recording";
+        case MEMORY_STEREO:         return "stereo";
+        case MEMORY_OCTOMAP:        return "octomap";
+        case MEMORY_TRAJECTORIES:   return "trajectories";
+        default:                    return "unknown";
+    }
+}
+
+struct MemoryCounters {
+    std::atomic<int64_t> live_bytes;
+    std::atomic<int64_t> peak_bytes;
+
+    // every byte ever allocated, for the allocation rate
+    std::atomic<int64_t> allocated_bytes;
+};
+
+// one set for the whole program, since it's an inline function's.  Static,
+// so they start at zero.
+inline MemoryCounters* MemoryGetCounters() {
+    static MemoryCounters counters[MEMORY_NUM_SUBSYSTEMS];
+    return counters;
+}
+
+inline void MemoryAccountAlloc(int subsystem, int64_t bytes) {
+    MemoryCounters &counters = MemoryGetCounters()[subsystem];
+
+    int64_t live = counters.live_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    counters.allocated_bytes.fetch_add(bytes, std::memory_order_relaxed);
+
+    int64_t peak = counters.peak_bytes.load(std::memory_order_relaxed);
+
+    while (live > peak && !counters.peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+        // someone else raised it, try again against theirs
+    }
+}
+
+inline void MemoryAccountFree(int subsystem, int64_t bytes) {
+    MemoryGetCounters()[subsystem].live_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+/**
+ * std::allocator that counts what it allocates against a subsystem.  Use it
+ * in place of a container's allocator, like AccountedVector does.
+ */
+template <typename T, int Subsystem>
+class AccountedAllocator : public std::allocator<T> {
+
+    public:
+        typedef T value_type;
+        typedef T* pointer;
+        typedef size_t size_type;
+
+        template <typename U>
+        struct rebind {
+            typedef AccountedAllocator<U, Subsystem> other;
+        };
+
+        AccountedAllocator() {}
+        AccountedAllocator(const AccountedAllocator &other) : std::allocator<T>(other) {}
+
+        template <typename U>
+        AccountedAllocator(const AccountedAllocator<U, Subsystem> &other) {}
+
+        T* allocate(size_t n, const void *hint = 0) {
+            T *p = std::allocator<T>::allocate(n);
+            MemoryAccountAlloc(Subsystem, n * sizeof(T));
+            return p;
+        }
+
+        void deallocate(T *p, size_t n) {
+            MemoryAccountFree(Subsystem, n * sizeof(T));
+            std::allocator<T>::deallocate(p, n);
+        }
+};
+
+template <typename T, typename U, int Subsystem>
+inline bool operator==(const AccountedAllocator<T, Subsystem>&, const AccountedAllocator<U, Subsystem>&) { return true; }
+
+template <typename T, typename U, int Subsystem>
+inline bool operator!=(const AccountedAllocator<T, Subsystem>&, const AccountedAllocator<U, Subsystem>&) { return false; }
+
+template <typename T, int Subsystem>
+using AccountedVector = std::vector<T, AccountedAllocator<T, Subsystem> >;
+
+/**
+ * Memory a subsystem holds but measures instead of allocating through an
+ * AccountedAllocator.  Set() it to the current size whenever it might
+ * have changed; growing counts as an allocation.
+ *
+ * Copies count again, since they're usually part of an object whose data
+ * got copied too.  Whatever is left is freed when it's destroyed.
+ */
+class MemoryGauge {
+
+    public:
+        MemoryGauge(int subsystem) : subsystem_(subsystem), bytes_(0) {}
+        MemoryGauge(const MemoryGauge &other) : subsystem_(other.subsystem_), bytes_(0) { Set(other.bytes_); }
+
+        MemoryGauge& operator=(const MemoryGauge &other) {
+            if (this != &other) {
+                Set(0);
+                subsystem_ = other.subsystem_;
+                Set(other.bytes_);
+            }
+            return *this;
+        }
+
+        ~MemoryGauge() { Set(0); }
+
+        void Set(int64_t bytes) {
+            if (bytes > bytes_) {
+                MemoryAccountAlloc(subsystem_, bytes - bytes_);
+            } else if (bytes < bytes_) {
+                MemoryAccountFree(subsystem_, bytes_ - bytes);
+            }
+            bytes_ = bytes;
+        }
+
+        int64_t Get() const { return bytes_; }
+
+    private:
+        int subsystem_;
+        int64_t bytes_;
+};
+
+// bytes a vector has allocated, used or not
+template <typename V>
+inline int64_t VectorBytes(const V &vec) {
+    return (int64_t)vec.capacity() * sizeof(typename V::value_type);
+}
+
+#endif
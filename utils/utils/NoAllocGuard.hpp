@@ -0,0 +1,165 @@
+#ifndef NO_ALLOC_GUARD_HPP
+#define NO_ALLOC_GUARD_HPP
+
+/*
+ * Checks that flight-critical loops don't touch the heap once they're
+ * warmed up.  Put NO_ALLOC_SCOPE("name") at the top of a loop body (like
+ * TRACE_SCOPE) and, in builds with USE_NO_ALLOC_GUARD ("make
+ * NO_ALLOC_GUARD=1"), every malloc, calloc, realloc or aligned allocation
+ * (operator new comes through malloc) the calling thread makes inside it
+ * is counted and reported with a stack trace.  Without it the macros are
+ * empty.
+ *
+ * Each region is only checked after its first NO_ALLOC_WARMUP_ENTRIES
+ * entries, so buffers can grow to their working size first.  Allocations
+ * that are part of the design (a map adding a node for a new voxel) go
+ * in a NO_ALLOC_ALLOW() scope.
+ *
+ * The NO_ALLOC_GUARD environment variable picks what happens:
+ *   "count" (default) report the first NO_ALLOC_MAX_REPORTS and count them
+ *   "abort" report the first one and abort(), for tests and simulations
+ *   "off"   don't check
+ *
+ * The hooks are in RealtimeUtils.cpp, so any program linking it gets them.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+
+#define NO_ALLOC_WARMUP_ENTRIES 100
+#define NO_ALLOC_MAX_REPORTS 20
+#define NO_ALLOC_MAX_REGIONS 32
+#define NO_ALLOC_MAX_STACK 32
+
+enum NoAllocMode { NO_ALLOC_OFF, NO_ALLOC_COUNT, NO_ALLOC_ABORT };
+
+/**
+ * One NO_ALLOC_SCOPE: how often it was entered and how many allocations
+ * were caught in it.
+ */
+struct NoAllocRegion {
+    NoAllocRegion(const char *region_name);
+
+    const char *name;
+
+    std::atomic<int64_t> entries;
+    std::atomic<int64_t> violations;
+};
+
+struct NoAllocSettings {
+    NoAllocSettings() : mode(NO_ALLOC_COUNT), warmup_entries(NO_ALLOC_WARMUP_ENTRIES), num_reports(0), violations(0), num_regions(0) {}
+
+    std::atomic<int> mode;
+    std::atomic<int> warmup_entries;
+
+    std::atomic<int> num_reports;
+    std::atomic<int64_t> violations;
+
+    std::atomic<int> num_regions;
+    std::atomic<NoAllocRegion*> regions[NO_ALLOC_MAX_REGIONS];
+};
+
+// one for the whole program, since it's an inline function's
+inline NoAllocSettings& NoAllocGetSettings() {
+    static NoAllocSettings settings;
+    return settings;
+}
+
+inline NoAllocRegion::NoAllocRegion(const char *region_name) : name(region_name), entries(0), violations(0) {
+    NoAllocSettings &settings = NoAllocGetSettings();
+
+    int slot = settings.num_regions.fetch_add(1);
+
+    if (slot < NO_ALLOC_MAX_REGIONS) {
+        settings.regions[slot].store(this);
+    }
+}
+
+// what the hooks check on each allocation.  Plain data, so it can be
+// __thread.
+struct NoAllocThreadState {
+    // outermost checked region the thread is in, or NULL
+    NoAllocRegion *region;
+
+    // NO_ALLOC_ALLOW() scopes the thread is in
+    int allow_depth;
+
+    // set while reporting, so the report's own allocations go through
+    bool reporting;
+};
+
+inline NoAllocThreadState& NoAllocGetThreadState() {
+    static __thread NoAllocThreadState state;
+    return state;
+}
+
+inline void NoAllocSetMode(int mode) {
+    NoAllocGetSettings().mode.store(mode);
+}
+
+// entries each region gets before it's checked
+inline void NoAllocSetWarmup(int entries) {
+    NoAllocGetSettings().warmup_entries.store(entries);
+}
+
+inline int64_t NoAllocGetNumViolations() {
+    return NoAllocGetSettings().violations.load();
+}
+
+// called by the hooks for an allocation in a checked region
+void NoAllocReport(NoAllocThreadState *state, size_t bytes);
+
+void NoAllocPrintSummary(FILE *out);
+
+class NoAllocScope {
+
+    public:
+        NoAllocScope(NoAllocRegion *region) {
+            NoAllocThreadState &state = NoAllocGetThreadState();
+            NoAllocSettings &settings = NoAllocGetSettings();
+
+            outer_ = state.region;
+
+            int64_t entries = region->entries.fetch_add(1, std::memory_order_relaxed);
+
+            // nested regions are blamed on the outermost one
+            if (outer_ == NULL && entries >= settings.warmup_entries.load(std::memory_order_relaxed)
+                && settings.mode.load(std::memory_order_relaxed) != NO_ALLOC_OFF) {
+
+                state.region = region;
+            }
+        }
+
+        ~NoAllocScope() {
+            NoAllocGetThreadState().region = outer_;
+        }
+
+    private:
+        NoAllocRegion *outer_;
+};
+
+class NoAllocAllowScope {
+
+    public:
+        NoAllocAllowScope() { NoAllocGetThreadState().allow_depth ++; }
+        ~NoAllocAllowScope() { NoAllocGetThreadState().allow_depth --; }
+};
+
+#define NO_ALLOC_CONCAT2(a, b) a##b
+#define NO_ALLOC_CONCAT(a, b) NO_ALLOC_CONCAT2(a, b)
+
+#ifdef USE_NO_ALLOC_GUARD
+#define NO_ALLOC_SCOPE(name) \
+    static NoAllocRegion NO_ALLOC_CONCAT(no_alloc_region_, __LINE__)(name); \
+    NoAllocScope NO_ALLOC_CONCAT(no_alloc_scope_, __LINE__)(&NO_ALLOC_CONCAT(no_alloc_region_, __LINE__))
+#define NO_ALLOC_ALLOW() NoAllocAllowScope NO_ALLOC_CONCAT(no_alloc_allow_, __LINE__)
+#else
+#define NO_ALLOC_SCOPE(name)
+#define NO_ALLOC_ALLOW()
+#endif
+
+#endif
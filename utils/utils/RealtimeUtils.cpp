@@ -1,45 +1,46 @@
 #include "RealtimeUtils.hpp"
+#include "NoAllocGuard.hpp"
+#include <thread>
+#include <map>
 
-#define PI 3.14159265359
+#ifdef USE_NO_ALLOC_GUARD
+#include <execinfo.h>
+#include <malloc.h>
+#include <sys/syscall.h>
+#endif
 
+#include <Eigen/Geometry> // for cross()
 
-Eigen::VectorXd PoseMsgToStateEstimatorVector(const mav_pose_t *msg, const Eigen::Matrix3d Mz) {
-    // convert message to 12-state vector in the State estimator frame
+#define PI 3.14159265359
 
-    Eigen::VectorXd state(12);
 
-    Eigen::Vector3d pos_eigen;
+Eigen::VectorXd PoseMsgToStateEstimatorVector(const mav_pose_t *msg, const Eigen::Matrix3d Mz) {
+    return PoseMsgToStateEstimatorVector12d(msg, Mz);
+}
 
+Vector12d PoseMsgToStateEstimatorVector12d(const mav_pose_t *msg, const Eigen::Matrix3d &Mz) {
+    // convert message to 12-state vector in the State estimator frame
 
-    pos_eigen(0) = msg->pos[0];
-    pos_eigen(1) = msg->pos[1];
-    pos_eigen(2) = msg->pos[2];
+    Vector12d state;
 
     // x, y, and z are always in global frame (add in any custom rotation)
-    Eigen::Vector3d pos_global = Mz * pos_eigen;
-
-    state(0) = pos_global(0);
-    state(1) = pos_global(1);
-    state(2) = pos_global(2);
-
-    // roll, pitch, and yaw come from the quats in the message
-
-    Eigen::Vector4d q_eigen;
-    q_eigen(0) = msg->orientation[0];
-    q_eigen(1) = msg->orientation[1];
-    q_eigen(2) = msg->orientation[2];
-    q_eigen(3) = msg->orientation[3];
-
-    double rpy_array[3];
-    bot_quat_to_roll_pitch_yaw(msg->orientation, rpy_array);
+    Eigen::Map<const Eigen::Vector3d> pos(msg->pos);
+    state.head<3>() = Mz * pos;
 
-    Eigen::Matrix3d rot_mat = quat2rotmat(q_eigen);
+    // roll, pitch, and yaw come from the quats in the message, through the
+    // rotation matrix so the custom rotation is in them too.  Only the
+    // entries rotmat2rpy() uses are computed.
+    Eigen::Matrix3d rot_mat = QuatArrayToRotmat(msg->orientation);
 
-    Eigen::Vector3d rpy = rotmat2rpy(Mz * rot_mat);
+    double r00 = Mz.row(0).dot(rot_mat.col(0));
+    double r10 = Mz.row(1).dot(rot_mat.col(0));
+    double r20 = Mz.row(2).dot(rot_mat.col(0));
+    double r21 = Mz.row(2).dot(rot_mat.col(1));
+    double r22 = Mz.row(2).dot(rot_mat.col(2));
 
-    state(3) = rpy(0);
-    state(4) = rpy(1);
-    state(5) = rpy(2);
+    state(3) = atan2(r21, r22);
+    state(4) = atan2(-r20, sqrt(r21*r21 + r22*r22));
+    state(5) = atan2(r10, r00);
 
     // velocities are in body frame
     state(6) = msg->vel[0];
@@ -56,6 +57,14 @@ Eigen::VectorXd PoseMsgToStateEstimatorVector(const mav_pose_t *msg, const Eigen
     return state;
 }
 
+void PoseMsgsToStateEstimatorVectors(const mav_pose_t *msgs, int num_msgs, Matrix12Xd *states, const Eigen::Matrix3d &Mz) {
+    states->resize(12, num_msgs);
+
+    for (int i = 0; i < num_msgs; i++) {
+        states->col(i) = PoseMsgToStateEstimatorVector12d(&msgs[i], Mz);
+    }
+}
+
 
 TEST(Utils, PoseMsgToStateEstimatorVector) {
 
@@ -136,6 +145,146 @@ TEST(Utils, PoseMsgToStateEstimatorVectorMz) {
 
     EXPECT_TRUE( output.isApprox(matlab_output, 0.001) ) << std::endl << "Expected:" << std::endl << matlab_output << std::endl << "Got:" << std::endl << output << std::endl;
 
+    Vector12d output12d = PoseMsgToStateEstimatorVector12d(&msg, rotz_mat);
+
+    EXPECT_APPROX_MAT(output, output12d, 0.000001);
+
+}
+
+TEST(Utils, PoseMsgsToStateEstimatorVectors) {
+
+    mav_pose_t msgs[3];
+
+    for (int i = 0; i < 3; i++) {
+        msgs[i].pos[0] = 0.1829 + i;
+        msgs[i].pos[1] = 0.2399 - i;
+        msgs[i].pos[2] = 0.8865 * i;
+
+        double rpy[3] = { 0.1 * i, -0.3 + 0.2 * i, 2.5 - 1.7 * i };
+        bot_roll_pitch_yaw_to_quat(rpy, msgs[i].orientation);
+
+        msgs[i].vel[0] = 0.9787;
+        msgs[i].vel[1] = 0.7127 * i;
+        msgs[i].vel[2] = 0.5005;
+
+        msgs[i].rotation_rate[0] = 0.4711;
+        msgs[i].rotation_rate[1] = 0.0596 * i;
+        msgs[i].rotation_rate[2] = 0.6820;
+    }
+
+    Eigen::Matrix3d rotz_mat = rotz(0.7);
+
+    Matrix12Xd states;
+    PoseMsgsToStateEstimatorVectors(msgs, 3, &states, rotz_mat);
+
+    ASSERT_TRUE(states.cols() == 3);
+
+    for (int i = 0; i < 3; i++) {
+        // the slow way: every piece separately
+        Eigen::Vector4d q(msgs[i].orientation[0], msgs[i].orientation[1], msgs[i].orientation[2], msgs[i].orientation[3]);
+        Eigen::Vector3d pos(msgs[i].pos[0], msgs[i].pos[1], msgs[i].pos[2]);
+
+        Eigen::VectorXd expected(12);
+        expected << rotz_mat * pos, rotmat2rpy(rotz_mat * quat2rotmat(q)), msgs[i].vel[0], msgs[i].vel[1], msgs[i].vel[2],
+            msgs[i].rotation_rate[0], msgs[i].rotation_rate[1], msgs[i].rotation_rate[2];
+
+        Vector12d got = states.col(i);
+
+        EXPECT_LT((expected - got).norm(), 0.000001) << std::endl << "Expected:" << std::endl << expected << std::endl << "Got:" << std::endl << got << std::endl;
+    }
+}
+
+void PredictPose(const mav_pose_t *msg, double dt, mav_pose_t *predicted) {
+
+    *predicted = *msg;
+
+    Eigen::Map<const Eigen::Vector3d> vel(msg->vel);
+    Eigen::Map<const Eigen::Vector3d> accel(msg->accel);
+    Eigen::Map<const Eigen::Vector3d> omega(msg->rotation_rate);
+
+    // position moves along the body velocity as the body is pointed now
+    Eigen::Matrix3d rot_mat = QuatArrayToRotmat(msg->orientation);
+
+    Eigen::Map<Eigen::Vector3d> pos(predicted->pos);
+    pos += rot_mat * (vel * dt + 0.5 * accel * dt * dt);
+
+    // the body frame turns under the velocity as well
+    Eigen::Map<Eigen::Vector3d> vel_out(predicted->vel);
+    vel_out = vel + (accel - omega.cross(vel)) * dt;
+
+    // orientation turns by the rotation rate: q * [cos(angle/2), sin(angle/2) * axis]
+    double angle = omega.norm() * dt;
+
+    if (angle > 0) {
+        double w = cos(angle / 2);
+        double s = sin(angle / 2) / omega.norm();
+
+        double dq[4] = { w, s * omega(0), s * omega(1), s * omega(2) };
+
+        bot_quat_mult(predicted->orientation, msg->orientation, dq);
+        bot_quat_normalize(predicted->orientation);
+    }
+
+    predicted->utime = msg->utime + (int64_t)(dt * 1000000.0);
+}
+
+TEST(Utils, PredictPose) {
+
+    mav_pose_t msg;
+
+    msg.utime = 1000000;
+
+    msg.pos[0] = 1;
+    msg.pos[1] = 2;
+    msg.pos[2] = 3;
+
+    // yawed 90 degrees, so body x is local y
+    double rpy[3] = { 0, 0, PI / 2 };
+    bot_roll_pitch_yaw_to_quat(rpy, msg.orientation);
+
+    msg.vel[0] = 10;
+    msg.vel[1] = 0;
+    msg.vel[2] = 0;
+
+    msg.accel[0] = 2;
+    msg.accel[1] = 0;
+    msg.accel[2] = 0;
+
+    msg.rotation_rate[0] = 0;
+    msg.rotation_rate[1] = 0;
+    msg.rotation_rate[2] = 0.5;
+
+    mav_pose_t predicted;
+
+    // not moving ahead leaves it alone
+    PredictPose(&msg, 0, &predicted);
+
+    EXPECT_TRUE(memcmp(&msg, &predicted, sizeof(msg)) == 0);
+
+    PredictPose(&msg, 0.1, &predicted);
+
+    EXPECT_EQ_ARM(predicted.utime, 1100000);
+
+    EXPECT_NEAR(predicted.pos[0], 1, 0.000001);
+    EXPECT_NEAR(predicted.pos[1], 2 + 10 * 0.1 + 0.5 * 2 * 0.01, 0.000001);
+    EXPECT_NEAR(predicted.pos[2], 3, 0.000001);
+
+    // forward speed picks up the acceleration, and the yaw turns some of
+    // it into sideways speed in body frame
+    EXPECT_NEAR(predicted.vel[0], 10.2, 0.000001);
+    EXPECT_NEAR(predicted.vel[1], -0.5 * 10 * 0.1, 0.000001);
+    EXPECT_NEAR(predicted.vel[2], 0, 0.000001);
+
+    double rpy_out[3];
+    bot_quat_to_roll_pitch_yaw(predicted.orientation, rpy_out);
+
+    EXPECT_NEAR(rpy_out[0], 0, 0.000001);
+    EXPECT_NEAR(rpy_out[1], 0, 0.000001);
+    EXPECT_NEAR(rpy_out[2], PI / 2 + 0.05, 0.000001);
+
+    // the rates are held
+    EXPECT_EQ_ARM(predicted.rotation_rate[2], 0.5);
+    EXPECT_EQ_ARM(predicted.accel[0], 2);
 }
 
 double AngleUnwrap(double angle_rad_in, double last_angle_rad) {
@@ -444,27 +593,7 @@ TEST(Utils, AngularVel2RpyDot) {
 }
 
 Eigen::Matrix3d quat2rotmat(Eigen::Vector4d q) {
-
-    double qdotq = q.dot(q);
-
-    double norm_q = sqrt(qdotq);
-
-    Eigen::Vector4d q_norm = q/norm_q;
-
-
-    double w = q_norm(0);
-    double x = q_norm(1);
-    double y = q_norm(2);
-    double z = q_norm(3);
-
-    Eigen::Matrix3d rot_mat;
-
-    rot_mat << w*w + x*x - y*y - z*z, 2*x*y - 2*w*z, 2*x*z + 2*w*y,
-        2*x*y + 2*w*z,  w*w + y*y - x*x - z*z, 2*y*z - 2*w*x,
-        2*x*z - 2*w*y, 2*y*z + 2*w*x, w*w + z*z - x*x - y*y;
-
-    return rot_mat;
-
+    return QuatArrayToRotmat(q.data());
 }
 
 TEST(Utils, quat2rotmat) {
@@ -540,10 +669,17 @@ TEST(Utils, rotmat2rpy) {
 }
 
 
+// simulated time, or -1 for the wall clock
+static std::atomic<int64_t> simulated_utime(-1);
+
 int64_t GetTimestampNow() {
-    struct timeval thisTime;
-    gettimeofday(&thisTime, NULL);
-    return (thisTime.tv_sec * 1000000.0) + (float)thisTime.tv_usec + 0.5;
+    int64_t simulated = simulated_utime.load(std::memory_order_relaxed);
+
+    if (simulated >= 0) {
+        return simulated;
+    }
+
+    return GetWallNow();
 }
 
 TEST(Utils, TimestampSanity2015) {
@@ -551,6 +687,173 @@ TEST(Utils, TimestampSanity2015) {
     EXPECT_TRUE(GetTimestampNow() > 1422487159500367) << "Timestamp should be after Jan 28, 2015.";
 }
 
+void SetSimulatedTime(int64_t utime) {
+    simulated_utime.store(utime, std::memory_order_relaxed);
+}
+
+void ClearSimulatedTime() {
+    simulated_utime.store(-1, std::memory_order_relaxed);
+}
+
+TEST(Utils, SimulatedTime) {
+
+    SetSimulatedTime(1000000);
+    EXPECT_EQ_ARM(GetTimestampNow(), 1000000);
+
+    SetSimulatedTime(1010000);
+    EXPECT_EQ_ARM(GetTimestampNow(), 1010000);
+
+    ClearSimulatedTime();
+    EXPECT_TRUE(GetTimestampNow() > 1422487159500367) << "Timestamp should be back on the wall clock.";
+}
+
+int64_t GetMonotonicNow() {
+    int64_t simulated = simulated_utime.load(std::memory_order_relaxed);
+
+    if (simulated >= 0) {
+        return simulated;
+    }
+
+    return GetRawMonotonicNow();
+}
+
+TEST(Utils, MonotonicNow) {
+    int64_t first = GetMonotonicNow();
+    usleep(1000);
+    int64_t second = GetMonotonicNow();
+
+    EXPECT_TRUE(second - first >= 1000);
+    EXPECT_TRUE(second - first < 1000000);
+}
+
+TEST(Utils, WallNowFollowsWallClock) {
+    int64_t last = GetWallNow();
+
+    EXPECT_TRUE(llabs(last - ClockRead(CLOCK_REALTIME)) < 1000000);
+
+    for (int i = 0; i < 10000; i++) {
+        int64_t now = GetWallNow();
+
+        EXPECT_TRUE(now >= last);
+        last = now;
+    }
+}
+
+TEST(Utils, CycleCount) {
+    uint64_t start = GetCycleCount();
+    int64_t start_usec = GetRawMonotonicNow();
+
+    usleep(20000);
+
+    uint64_t cycles = GetCycleCount() - start;
+    int64_t expected = GetRawMonotonicNow() - start_usec;
+
+    // (the first call calibrates, which takes a while itself)
+    double usec = CyclesToUsec(cycles);
+
+    EXPECT_NEAR(usec, expected, 0.1 * expected);
+}
+
+SyncedClock::SyncedClock() : synced_(false), monotonic_utime_(0), synced_utime_(0), drift_ppm_(0), error_usec_(-1) {}
+
+/**
+ * Takes a new estimate from clock-sync.  Ones that aren't synced yet are
+ * ignored.
+ */
+void SyncedClock::Update(const lcmt_clock_sync *msg) {
+
+    if (!msg->synced) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    synced_ = true;
+    monotonic_utime_ = msg->monotonic_utime;
+    synced_utime_ = msg->synced_utime;
+    drift_ppm_ = msg->drift_ppm;
+    error_usec_ = msg->error_usec;
+}
+
+bool SyncedClock::IsSynced() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return synced_;
+}
+
+int64_t SyncedClock::MonotonicToSynced(int64_t monotonic_utime) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (!synced_) {
+        return monotonic_utime + (GetTimestampNow() - GetMonotonicNow());
+    }
+
+    int64_t elapsed = monotonic_utime - monotonic_utime_;
+
+    return synced_utime_ + elapsed + (int64_t)(elapsed * drift_ppm_ / 1e6);
+}
+
+int64_t SyncedClock::SyncedToMonotonic(int64_t synced_utime) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (!synced_) {
+        return synced_utime - (GetTimestampNow() - GetMonotonicNow());
+    }
+
+    int64_t elapsed = synced_utime - synced_utime_;
+
+    return monotonic_utime_ + (int64_t)(elapsed / (1 + drift_ppm_ / 1e6));
+}
+
+/**
+ * The synchronized time now (or the simulated time, if there is one).
+ */
+int64_t SyncedClock::GetSyncedNow() const {
+    if (simulated_utime.load(std::memory_order_relaxed) >= 0) {
+        return GetTimestampNow();
+    }
+
+    return MonotonicToSynced(GetMonotonicNow());
+}
+
+int64_t SyncedClock::GetErrorBound() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return synced_ ? error_usec_ : -1;
+}
+
+TEST(Utils, SyncedClock) {
+    SyncedClock clock;
+
+    EXPECT_FALSE(clock.IsSynced());
+    EXPECT_EQ_ARM(clock.GetErrorBound(), -1);
+
+    // not synced yet: the wall clock
+    EXPECT_TRUE(std::abs(clock.GetSyncedNow() - GetTimestampNow()) < 10000);
+
+    lcmt_clock_sync msg;
+    memset(&msg, 0, sizeof(msg));
+
+    // the reference was at 5 s when we were at 1 s, and runs 100 ppm fast
+    msg.monotonic_utime = 1000000;
+    msg.synced_utime = 5000000;
+    msg.drift_ppm = 100;
+    msg.error_usec = 80;
+    msg.synced = true;
+
+    clock.Update(&msg);
+
+    EXPECT_TRUE(clock.IsSynced());
+    EXPECT_EQ_ARM(clock.GetErrorBound(), 80);
+
+    EXPECT_EQ_ARM(clock.MonotonicToSynced(1000000), 5000000);
+
+    // 10 s later, plus 1 ms of drift
+    EXPECT_EQ_ARM(clock.MonotonicToSynced(11000000), 15001000);
+    EXPECT_TRUE(std::abs(clock.SyncedToMonotonic(15001000) - 11000000) <= 1);
+
+    // before the estimate too
+    EXPECT_EQ_ARM(clock.MonotonicToSynced(0), 3999900);
+}
+
 
 double deg2rad(double input_in_deg) {
     return PI/180.0d * input_in_deg;
@@ -605,93 +908,1186 @@ bool NonBlockingLcm(lcm_t *lcm)
 
 }
 
-Eigen::Matrix3d rotz(double rotation_around_z) {
+LcmReactor::LcmReactor(lcm_t *lcm) {
+    lcm_ = lcm;
+    lcm_fd_ = lcm_get_fileno(lcm);
 
-    Eigen::Matrix3d rot_mat;
+    epoll_fd_ = epoll_create1(0);
+    wake_fd_ = eventfd(0, EFD_NONBLOCK);
 
-    double s = sin(rotation_around_z);
-    double c = cos(rotation_around_z);
+    if (epoll_fd_ < 0 || wake_fd_ < 0) {
+        std::cerr << "ERROR: failed to create the LCM reactor's epoll or eventfd." << std::endl;
+        exit(1);
+    }
 
-    rot_mat(0,0) = c;
-    rot_mat(0,1) = -s;
-    rot_mat(0,2) = 0;
+    struct epoll_event event;
 
-    rot_mat(1,0) = s;
-    rot_mat(1,1) = c;
-    rot_mat(1,2) = 0;
+    event.events = EPOLLIN;
+    event.data.fd = lcm_fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, lcm_fd_, &event);
 
-    rot_mat(2,0) = 0;
-    rot_mat(2,1) = 0;
-    rot_mat(2,2) = 1;
+    event.events = EPOLLIN;
+    event.data.fd = wake_fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+}
 
-    return rot_mat;
+LcmReactor::~LcmReactor() {
+    close(epoll_fd_);
+    close(wake_fd_);
 }
 
+/**
+ * Waits on another fd along with LCM.  The fd stays open and is the
+ * caller's to close.
+ */
+void LcmReactor::AddFd(int fd, std::function<void()> handler) {
+    struct epoll_event event;
+
+    event.events = EPOLLIN;
+    event.data.fd = fd;
 
-TEST(Utils, rotz) {
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+        std::cerr << "WARNING: failed to add fd " << fd << " to the LCM reactor: " << strerror(errno) << std::endl;
+        return;
+    }
 
-    double theta = 0.8147;
+    fd_handlers_.push_back(std::make_pair(fd, handler));
+}
 
-    Eigen::Matrix3d matlab_output;
-    matlab_output << 0.6861, -0.7275, 0, 0.7275, 0.6861, 0, 0, 0, 1;
+/**
+ * Blocks until there are LCM messages, a Wake(), or an added fd is
+ * readable, handles everything that's waiting, then runs the idle task.
+ *
+ * @param timeout_ms longest to wait (-1 for as long as it takes)
+ *
+ * @retval false if it timed out with nothing to do
+ */
+bool LcmReactor::WaitAndHandle(int timeout_ms) {
 
+    struct epoll_event events[LCM_REACTOR_MAX_EVENTS];
 
-    Eigen::Matrix3d output = rotz(theta);
+    int num_events = epoll_wait(epoll_fd_, events, LCM_REACTOR_MAX_EVENTS, timeout_ms);
 
-    EXPECT_TRUE(matlab_output.isApprox(output, 0.0001));
+    if (num_events <= 0) {
+        // timed out (or interrupted by a signal)
+        return false;
+    }
+
+    for (int i = 0; i < num_events; i++) {
+        if (events[i].data.fd == wake_fd_) {
+            uint64_t count;
+
+            if (read(wake_fd_, &count, sizeof(count)) < 0) {
+                // already cleared, nothing to do
+            }
+        } else {
+            for (auto &fd_handler : fd_handlers_) {
+                if (events[i].data.fd == fd_handler.first) {
+                    fd_handler.second();
+                }
+            }
+        }
+    }
 
+    // everything that's arrived, without waiting for more
+    struct pollfd lcm_poll;
 
-    double theta2 = 3.235;
-    Eigen::Matrix3d matlab_output2;
-    matlab_output2 << -0.9956, 0.0933, 0, -0.0933, -0.9956, 0, 0, 0, 1;
+    lcm_poll.fd = lcm_fd_;
+    lcm_poll.events = POLLIN;
 
-    Eigen::Matrix3d output2 = rotz(theta2);
+    while (poll(&lcm_poll, 1, 0) > 0 && (lcm_poll.revents & POLLIN)) {
+        lcm_handle(lcm_);
+    }
 
-    EXPECT_TRUE(matlab_output2.isApprox(output2, 0.0001));
+    if (idle_task_) {
+        idle_task_();
+    }
 
+    return true;
 }
 
-void DrawOriginLcmGl(lcm_t *lcm) {
+/**
+ * Handles messages forever.
+ */
+void LcmReactor::Run() {
+    while (true) {
+        WaitAndHandle();
+    }
+}
 
-    bot_lcmgl_t *lcmgl = bot_lcmgl_init(lcm, "Origin");
-    bot_lcmgl_line_width(lcmgl, 4.0f);
+/**
+ * Makes WaitAndHandle() return (after running the idle task) even if there
+ * are no messages.  Safe to call from any thread.
+ */
+void LcmReactor::Wake() {
+    uint64_t one = 1;
 
-    bot_lcmgl_color3f(lcmgl, 1, 0, 0);
-    bot_lcmgl_begin(lcmgl, GL_LINE_STRIP);
-    bot_lcmgl_vertex3d(lcmgl, 0, 0, 0);
-    bot_lcmgl_vertex3d(lcmgl, 1, 0, 0);
-    bot_lcmgl_end(lcmgl);
+    if (write(wake_fd_, &one, sizeof(one)) < 0) {
+        std::cerr << "WARNING: failed to wake the LCM reactor." << std::endl;
+    }
+}
 
-    bot_lcmgl_color3f(lcmgl, 0, 1, 0);
-    bot_lcmgl_begin(lcmgl, GL_LINE_STRIP);
-    bot_lcmgl_vertex3d(lcmgl, 0, 0, 0);
-    bot_lcmgl_vertex3d(lcmgl, 0, 1, 0);
-    bot_lcmgl_end(lcmgl);
+void CountLcmMessage(const lcm_recv_buf_t *rbuf, const char *channel, void *user) {
+    (*(int*)user) ++;
+}
 
-    bot_lcmgl_color3f(lcmgl, 0, 0, 1);
-    bot_lcmgl_begin(lcmgl, GL_LINE_STRIP);
-    bot_lcmgl_vertex3d(lcmgl, 0, 0, 0);
-    bot_lcmgl_vertex3d(lcmgl, 0, 0, 1);
-    bot_lcmgl_end(lcmgl);
+TEST(Utils, LcmReactor) {
+    lcm_t *lcm = lcm_create("memq://");
 
-    bot_lcmgl_switch_buffer(lcmgl);
+    ASSERT_TRUE(lcm != NULL);
 
-    bot_lcmgl_destroy(lcmgl);
-}
+    int num_messages = 0;
+    lcm_subscribe(lcm, "REACTOR_TEST", &CountLcmMessage, &num_messages);
 
-std::string ReplaceUserVarInPath(std::string path) {
-    std::string username = std::string(getenv("USER"));
+    LcmReactor reactor(lcm);
 
-    boost::algorithm::replace_all(path, "$USER", username);
-    return path;
-}
+    int num_idle = 0;
+    reactor.SetIdleTask([&num_idle]() { num_idle ++; });
 
+    // nothing to do
+    EXPECT_FALSE(reactor.WaitAndHandle(10));
+    EXPECT_EQ_ARM(num_idle, 0);
 
-double ConvertTimestampToSeconds(int64_t timestamp) {
-    return timestamp / 1000000.0;
-}
+    // a batch of messages is handled all at once, then the idle task once
+    char data[1] = { 0 };
 
-/**
+    for (int i = 0; i < 3; i++) {
+        lcm_publish(lcm, "REACTOR_TEST", data, sizeof(data));
+    }
+
+    EXPECT_TRUE(reactor.WaitAndHandle(1000));
+    EXPECT_EQ_ARM(num_messages, 3);
+    EXPECT_EQ_ARM(num_idle, 1);
+
+    // woken without messages
+    reactor.Wake();
+
+    EXPECT_TRUE(reactor.WaitAndHandle(1000));
+    EXPECT_EQ_ARM(num_messages, 3);
+    EXPECT_EQ_ARM(num_idle, 2);
+
+    EXPECT_FALSE(reactor.WaitAndHandle(10));
+
+    lcm_destroy(lcm);
+}
+
+TEST(Utils, LcmReactorAddFd) {
+    lcm_t *lcm = lcm_create("memq://");
+
+    ASSERT_TRUE(lcm != NULL);
+
+    LcmReactor reactor(lcm);
+
+    int num_idle = 0;
+    reactor.SetIdleTask([&num_idle]() { num_idle ++; });
+
+    int fd = eventfd(0, EFD_NONBLOCK);
+    ASSERT_TRUE(fd >= 0);
+
+    int num_handled = 0;
+
+    reactor.AddFd(fd, [fd, &num_handled]() {
+        uint64_t count;
+
+        if (read(fd, &count, sizeof(count)) == sizeof(count)) {
+            num_handled ++;
+        }
+    });
+
+    EXPECT_FALSE(reactor.WaitAndHandle(10));
+
+    // the handler runs, then the idle task
+    uint64_t one = 1;
+    ASSERT_EQ(write(fd, &one, sizeof(one)), (ssize_t)sizeof(one));
+
+    EXPECT_TRUE(reactor.WaitAndHandle(1000));
+    EXPECT_EQ_ARM(num_handled, 1);
+    EXPECT_EQ_ARM(num_idle, 1);
+
+    // the handler cleared it
+    EXPECT_FALSE(reactor.WaitAndHandle(10));
+
+    close(fd);
+    lcm_destroy(lcm);
+}
+
+TEST(Utils, LatestValueMailbox) {
+    LatestValueMailbox<int> mailbox;
+
+    int value = -1;
+
+    // nothing yet
+    EXPECT_FALSE(mailbox.Take(&value));
+    EXPECT_FALSE(mailbox.Wait(&value, 10));
+
+    // only the newest is taken, and only once
+    mailbox.Put(1);
+    mailbox.Put(2);
+    mailbox.Put(3);
+
+    EXPECT_TRUE(mailbox.Take(&value));
+    EXPECT_EQ_ARM(value, 3);
+    EXPECT_FALSE(mailbox.Take(&value));
+
+    // from another thread
+    std::thread putter([&mailbox]() {
+        usleep(10000);
+        mailbox.Put(4);
+    });
+
+    EXPECT_TRUE(mailbox.Wait(&value, 1000));
+    EXPECT_EQ_ARM(value, 4);
+
+    putter.join();
+
+    EXPECT_FALSE(mailbox.Wait(&value, 10));
+}
+
+/**
+ * Counts a latency.
+ *
+ * @param latency_usec how long it took, in microseconds
+ */
+void DeadlineMonitor::Add(int64_t latency_usec) {
+
+    num_samples_ ++;
+
+    if (deadline_usec_ > 0 && latency_usec > deadline_usec_) {
+        num_misses_ ++;
+    }
+
+    // only one thread adds
+    if (latency_usec > worst_usec_.load()) {
+        worst_usec_.store(latency_usec);
+    }
+}
+
+TEST(Utils, DeadlineMonitor) {
+    DeadlineMonitor monitor(1000);
+
+    monitor.Add(500);
+    monitor.Add(1000);
+    monitor.Add(2500);
+    monitor.Add(1200);
+
+    EXPECT_EQ_ARM(monitor.GetNumSamples(), 4);
+    EXPECT_EQ_ARM(monitor.GetNumMisses(), 2);
+    EXPECT_EQ_ARM(monitor.GetWorstLatency(), 2500);
+}
+
+/**
+ * @param process_name name to put in the messages
+ */
+MemoryStatsPublisher::MemoryStatsPublisher(std::string process_name) : process_name_(process_name) {
+
+    MemoryCounters *counters = MemoryGetCounters();
+
+    for (int i = 0; i < MEMORY_NUM_SUBSYSTEMS; i++) {
+        last_allocated_[i] = counters[i].allocated_bytes.load(std::memory_order_relaxed);
+        names_[i] = (char*) MemorySubsystemName(i);
+    }
+
+    last_utime_ = GetMonotonicNow();
+}
+
+/**
+ * Fills in a message with the counters now and the allocation rates since
+ * the last one.
+ *
+ * @param msg (output) the message
+ */
+void MemoryStatsPublisher::GetStats(lcmt_memory_stats *msg) {
+
+    MemoryCounters *counters = MemoryGetCounters();
+
+    int64_t now = GetMonotonicNow();
+    double period_sec = (now - last_utime_) / 1000000.0;
+
+    for (int i = 0; i < MEMORY_NUM_SUBSYSTEMS; i++) {
+        int64_t allocated = counters[i].allocated_bytes.load(std::memory_order_relaxed);
+
+        live_[i] = counters[i].live_bytes.load(std::memory_order_relaxed);
+        peak_[i] = counters[i].peak_bytes.load(std::memory_order_relaxed);
+        rate_[i] = period_sec > 0 ? (allocated - last_allocated_[i]) / period_sec : 0;
+
+        last_allocated_[i] = allocated;
+    }
+
+    last_utime_ = now;
+
+    msg->timestamp = GetTimestampNow();
+    msg->process_name = (char*) process_name_.c_str();
+    msg->period_sec = period_sec;
+    msg->rss_bytes = GetRssBytes();
+
+    msg->num_subsystems = MEMORY_NUM_SUBSYSTEMS;
+    msg->subsystem_names = names_;
+    msg->live_bytes = live_;
+    msg->peak_bytes = peak_;
+    msg->alloc_bytes_per_sec = rate_;
+}
+
+void MemoryStatsPublisher::Publish(lcm_t *lcm, const char *channel) {
+
+    lcmt_memory_stats msg;
+    GetStats(&msg);
+
+    lcmt_memory_stats_publish(lcm, channel, &msg);
+}
+
+/**
+ * @retval the process' resident set size in bytes, or -1 if it can't be
+ *      read
+ */
+int64_t MemoryStatsPublisher::GetRssBytes() {
+
+    std::ifstream statm("/proc/self/statm");
+
+    int64_t total_pages, resident_pages;
+
+    if (!(statm >> total_pages >> resident_pages)) {
+        return -1;
+    }
+
+    return resident_pages * sysconf(_SC_PAGESIZE);
+}
+
+TEST(Utils, MemoryAccounting) {
+    MemoryStatsPublisher publisher("test");
+
+    lcmt_memory_stats msg;
+    publisher.GetStats(&msg);
+
+    int64_t live_before = msg.live_bytes[MEMORY_OCTOMAP];
+
+    {
+        AccountedVector<double, MEMORY_OCTOMAP> vec(1000);
+
+        MemoryGauge gauge(MEMORY_OCTOMAP);
+        gauge.Set(500);
+
+        // copies count again
+        MemoryGauge copy(gauge);
+
+        usleep(1000);
+        publisher.GetStats(&msg);
+
+        EXPECT_EQ_ARM(msg.live_bytes[MEMORY_OCTOMAP] - live_before, (int64_t)(1000 * sizeof(double) + 1000));
+        EXPECT_TRUE(msg.peak_bytes[MEMORY_OCTOMAP] >= msg.live_bytes[MEMORY_OCTOMAP]);
+        EXPECT_TRUE(msg.alloc_bytes_per_sec[MEMORY_OCTOMAP] > 0);
+
+        // shrinking the gauge isn't an allocation
+        gauge.Set(100);
+    }
+
+    publisher.GetStats(&msg);
+
+    EXPECT_EQ_ARM(msg.live_bytes[MEMORY_OCTOMAP], live_before);
+    EXPECT_EQ_ARM(msg.num_subsystems, MEMORY_NUM_SUBSYSTEMS);
+    EXPECT_EQ_ARM(std::string(msg.subsystem_names[MEMORY_RECORDING]), "recording");
+
+    EXPECT_TRUE(msg.rss_bytes > 0);
+}
+
+/**
+ * Prints each NO_ALLOC_SCOPE region that has been entered: how often, and
+ * how many allocations were caught in it.
+ *
+ * @param out where to print
+ */
+void NoAllocPrintSummary(FILE *out) {
+    NoAllocSettings &settings = NoAllocGetSettings();
+
+    int num_regions = std::min(settings.num_regions.load(), NO_ALLOC_MAX_REGIONS);
+
+    for (int i = 0; i < num_regions; i++) {
+        NoAllocRegion *region = settings.regions[i].load();
+
+        if (region != NULL) {
+            fprintf(out, "no-alloc %s: %lld entries, %lld allocations\n", region->name,
+                (long long)region->entries.load(), (long long)region->violations.load());
+        }
+    }
+}
+
+#ifdef USE_NO_ALLOC_GUARD
+
+// glibc's own allocator, which the hooks below pass everything on to
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t num, size_t size);
+extern "C" void* __libc_realloc(void *ptr, size_t size);
+extern "C" void* __libc_memalign(size_t alignment, size_t size);
+
+// reads NO_ALLOC_GUARD and gets backtrace() to load libgcc now, since it
+// allocates the first time
+static struct NoAllocInit {
+    NoAllocInit() {
+        const char *mode = getenv("NO_ALLOC_GUARD");
+
+        if (mode != NULL && strcmp(mode, "abort") == 0) {
+            NoAllocSetMode(NO_ALLOC_ABORT);
+        } else if (mode != NULL && strcmp(mode, "off") == 0) {
+            NoAllocSetMode(NO_ALLOC_OFF);
+        }
+
+        void *stack[1];
+        backtrace(stack, 1);
+    }
+} no_alloc_init;
+
+/**
+ * Counts an allocation made in a checked region, and prints where it came
+ * from (the first NO_ALLOC_MAX_REPORTS times).  Runs inside malloc, so it
+ * only writes straight to stderr.
+ *
+ * @param state the allocating thread's state
+ * @param bytes size of the allocation
+ */
+void NoAllocReport(NoAllocThreadState *state, size_t bytes) {
+    NoAllocSettings &settings = NoAllocGetSettings();
+
+    state->reporting = true;
+
+    state->region->violations.fetch_add(1, std::memory_order_relaxed);
+    settings.violations.fetch_add(1, std::memory_order_relaxed);
+
+    bool abort_now = settings.mode.load() == NO_ALLOC_ABORT;
+
+    if (abort_now || settings.num_reports.fetch_add(1) < NO_ALLOC_MAX_REPORTS) {
+        char line[200];
+        int length = snprintf(line, sizeof(line), "no-alloc: %zu byte allocation in %s (thread %ld):\n", bytes,
+            state->region->name, (long)syscall(SYS_gettid));
+
+        if (write(STDERR_FILENO, line, std::min(length, (int)sizeof(line) - 1)) < 0) {
+            // nowhere else to say it
+        }
+
+        void *stack[NO_ALLOC_MAX_STACK];
+        int depth = backtrace(stack, NO_ALLOC_MAX_STACK);
+
+        // skip ourselves and the hook
+        backtrace_symbols_fd(stack + 2, std::max(depth - 2, 0), STDERR_FILENO);
+    }
+
+    if (abort_now) {
+        abort();
+    }
+
+    state->reporting = false;
+}
+
+static inline void NoAllocCheck(size_t bytes) {
+    NoAllocThreadState &state = NoAllocGetThreadState();
+
+    if (state.region != NULL && state.allow_depth == 0 && state.reporting == false) {
+        NoAllocReport(&state, bytes);
+    }
+}
+
+extern "C" void* malloc(size_t size) {
+    NoAllocCheck(size);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t num, size_t size) {
+    NoAllocCheck(num * size);
+    return __libc_calloc(num, size);
+}
+
+extern "C" void* realloc(void *ptr, size_t size) {
+    NoAllocCheck(size);
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void* memalign(size_t alignment, size_t size) {
+    NoAllocCheck(size);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void* aligned_alloc(size_t alignment, size_t size) {
+    NoAllocCheck(size);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void **ptr, size_t alignment, size_t size) {
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+
+    NoAllocCheck(size);
+    *ptr = __libc_memalign(alignment, size);
+
+    return *ptr == NULL ? ENOMEM : 0;
+}
+
+TEST(Utils, NoAllocGuard) {
+    NoAllocSetWarmup(1);
+
+    int64_t violations = NoAllocGetNumViolations();
+
+    for (int i = 0; i < 3; i++) {
+        NO_ALLOC_SCOPE("test");
+
+        {
+            NO_ALLOC_ALLOW();
+            void * volatile allowed = malloc(16);
+            free(allowed);
+        }
+
+        // volatile so the compiler can't drop the pair
+        void * volatile caught = malloc(16);
+        free(caught);
+    }
+
+    // the first entry is the warmup
+    EXPECT_EQ_ARM(NoAllocGetNumViolations() - violations, 2);
+
+    // not in a region
+    void * volatile outside = malloc(16);
+    free(outside);
+
+    EXPECT_EQ_ARM(NoAllocGetNumViolations() - violations, 2);
+
+    NoAllocSetWarmup(NO_ALLOC_WARMUP_ENTRIES);
+}
+
+#endif // USE_NO_ALLOC_GUARD
+
+/**
+ * @param bot_frames frames to follow, or NULL for a cache that's only fed
+ *      with Update() and SetCameraToBody()
+ */
+TransformCache::TransformCache(BotFrames *bot_frames) : bot_frames_(bot_frames), version_(0), camera_seq_(0), have_camera_(false) {
+
+    for (int i = 0; i < TRANSFORM_CACHE_HISTORY; i++) {
+        history_[i].seq.store(0);
+        history_[i].utime = 0;
+    }
+
+    if (bot_frames_ == NULL) {
+        return;
+    }
+
+    BotTrans camera_to_body;
+
+    if (bot_frames_get_trans(bot_frames_, "opencvFrame", "body", &camera_to_body) != 0) {
+        SetCameraToBody(camera_to_body);
+    }
+
+    bot_frames_add_update_subscriber(bot_frames_, &TransformCache::FramesUpdateHandler, this);
+}
+
+TransformCache* TransformCache::Get(BotFrames *bot_frames) {
+    static std::mutex caches_mutex;
+    static std::vector<std::pair<BotFrames*, TransformCache*>> caches;
+
+    std::lock_guard<std::mutex> lock(caches_mutex);
+
+    for (const std::pair<BotFrames*, TransformCache*> &cache : caches) {
+        if (cache.first == bot_frames) {
+            return cache.second;
+        }
+    }
+
+    TransformCache *cache = new TransformCache(bot_frames);
+    caches.push_back(std::make_pair(bot_frames, cache));
+
+    return cache;
+}
+
+void TransformCache::FramesUpdateHandler(BotFrames *bot_frames, const char *frame, const char *relative_to, int64_t utime, void *user) {
+    TransformCache *cache = (TransformCache*) user;
+
+    if (strcmp(frame, "body") == 0) {
+        BotTrans body_to_local;
+
+        if (bot_frames_get_trans(bot_frames, "body", "local", &body_to_local) != 0) {
+            cache->Update(utime, body_to_local);
+        }
+    } else {
+        // something on the way to the camera moved
+        BotTrans camera_to_body;
+
+        if (bot_frames_get_trans(bot_frames, "opencvFrame", "body", &camera_to_body) != 0) {
+            cache->SetCameraToBody(camera_to_body);
+        }
+    }
+}
+
+/**
+ * Adds a body pose.  Only one thread can update.
+ *
+ * @param utime the pose's time
+ * @param body_to_local the pose
+ */
+void TransformCache::Update(int64_t utime, const BotTrans &body_to_local) {
+
+    uint64_t n = version_.load(std::memory_order_relaxed);
+    Entry &entry = history_[n % TRANSFORM_CACHE_HISTORY];
+
+    entry.seq.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    entry.utime = utime;
+    entry.body_to_local = body_to_local;
+
+    entry.seq.store(2 * n + 2, std::memory_order_release);
+    version_.store(n + 1, std::memory_order_release);
+}
+
+void TransformCache::SetCameraToBody(const BotTrans &camera_to_body) {
+
+    uint64_t seq = camera_seq_.load(std::memory_order_relaxed);
+
+    camera_seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    camera_to_body_ = camera_to_body;
+    have_camera_ = true;
+
+    camera_seq_.store(seq + 2, std::memory_order_release);
+}
+
+/**
+ * Copies out body update n.
+ *
+ * @retval false if it's been overwritten (or is being)
+ */
+bool TransformCache::ReadEntry(uint64_t n, int64_t *utime, BotTrans *body_to_local) const {
+
+    const Entry &entry = history_[n % TRANSFORM_CACHE_HISTORY];
+
+    uint64_t seq = entry.seq.load(std::memory_order_acquire);
+
+    if (seq != 2 * n + 2) {
+        return false;
+    }
+
+    *utime = entry.utime;
+    *body_to_local = entry.body_to_local;
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    return entry.seq.load(std::memory_order_relaxed) == seq;
+}
+
+bool TransformCache::GetCameraToBody(BotTrans *camera_to_body) const {
+
+    while (true) {
+        uint64_t seq = camera_seq_.load(std::memory_order_acquire);
+
+        if (seq % 2 == 1) {
+            continue;
+        }
+
+        bool have_camera = have_camera_;
+        *camera_to_body = camera_to_body_;
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (camera_seq_.load(std::memory_order_relaxed) == seq) {
+            return have_camera;
+        }
+    }
+}
+
+/**
+ * The latest body to local transform.
+ *
+ * @param body_to_local (output) the transform
+ * @param utime (optional output) its time (0 if it came from bot_frames)
+ *
+ * @retval false if there isn't one
+ */
+bool TransformCache::GetBodyToLocal(BotTrans *body_to_local, int64_t *utime) const {
+
+    int64_t entry_utime = 0;
+
+    while (true) {
+        uint64_t version = GetVersion();
+
+        if (version == 0) {
+            if (bot_frames_ == NULL || bot_frames_get_trans(bot_frames_, "body", "local", body_to_local) == 0) {
+                return false;
+            }
+            break;
+        }
+
+        if (ReadEntry(version - 1, &entry_utime, body_to_local)) {
+            break;
+        }
+
+        // lapped mid-copy: try the newer one
+    }
+
+    if (utime != NULL) {
+        *utime = entry_utime;
+    }
+
+    return true;
+}
+
+/**
+ * The body to local transform at a time, interpolated between the poses on
+ * either side.  A time after the latest pose, or from before the history,
+ * gets the latest pose (like not interpolating at all), so a clock that's
+ * off or a log being replayed doesn't make it worse than before.
+ *
+ * @param utime time to get it at
+ * @param body_to_local (output) the transform
+ *
+ * @retval false if there isn't one
+ */
+bool TransformCache::GetBodyToLocalAt(int64_t utime, BotTrans *body_to_local) const {
+
+    uint64_t version = GetVersion();
+
+    if (version == 0) {
+        return GetBodyToLocal(body_to_local);
+    }
+
+    int64_t newer_utime;
+    BotTrans newer;
+
+    if (ReadEntry(version - 1, &newer_utime, &newer) == false || utime >= newer_utime) {
+        return GetBodyToLocal(body_to_local);
+    }
+
+    uint64_t oldest = version > TRANSFORM_CACHE_HISTORY ? version - TRANSFORM_CACHE_HISTORY : 0;
+
+    for (uint64_t n = version - 1; n > oldest; n--) {
+        int64_t older_utime;
+        BotTrans older;
+
+        if (ReadEntry(n - 1, &older_utime, &older) == false) {
+            // overwritten while we looked: past the history
+            break;
+        }
+
+        if (older_utime <= utime) {
+            double weight = newer_utime > older_utime ? (utime - older_utime) / (double)(newer_utime - older_utime) : 1;
+
+            bot_trans_interpolate(body_to_local, &older, &newer, weight);
+            return true;
+        }
+
+        newer_utime = older_utime;
+        newer = older;
+    }
+
+    return GetBodyToLocal(body_to_local);
+}
+
+/**
+ * The latest camera (opencvFrame) to local transform.
+ *
+ * @retval false if there isn't one
+ */
+bool TransformCache::GetCameraToLocal(BotTrans *camera_to_local) const {
+
+    BotTrans body_to_local;
+
+    if (GetCameraToBody(camera_to_local) == false || GetVersion() == 0) {
+        return bot_frames_ != NULL && bot_frames_get_trans(bot_frames_, "opencvFrame", "local", camera_to_local) != 0;
+    }
+
+    if (GetBodyToLocal(&body_to_local) == false) {
+        return false;
+    }
+
+    bot_trans_apply_trans(camera_to_local, &body_to_local);
+    return true;
+}
+
+/**
+ * The camera (opencvFrame) to local transform at a time (see
+ * GetBodyToLocalAt()), like a stereo frame's.
+ *
+ * @retval false if there isn't one
+ */
+bool TransformCache::GetCameraToLocalAt(int64_t utime, BotTrans *camera_to_local) const {
+
+    BotTrans body_to_local;
+
+    if (GetCameraToBody(camera_to_local) == false || GetVersion() == 0) {
+        return GetCameraToLocal(camera_to_local);
+    }
+
+    if (GetBodyToLocalAt(utime, &body_to_local) == false) {
+        return false;
+    }
+
+    bot_trans_apply_trans(camera_to_local, &body_to_local);
+    return true;
+}
+
+static BotTrans MakeTrans(double x, double y, double z, double yaw) {
+    BotTrans trans;
+    double rpy[3] = { 0, 0, yaw };
+    double xyz[3] = { x, y, z };
+    double quat[4];
+
+    bot_roll_pitch_yaw_to_quat(rpy, quat);
+    bot_trans_set_from_quat_trans(&trans, quat, xyz);
+
+    return trans;
+}
+
+TEST(Utils, TransformCacheLatest) {
+    TransformCache cache(NULL);
+
+    BotTrans trans;
+
+    // nothing yet, and no bot_frames to ask
+    EXPECT_FALSE(cache.GetBodyToLocal(&trans));
+
+    cache.Update(1000, MakeTrans(1, 2, 3, 0));
+    cache.Update(2000, MakeTrans(4, 5, 6, 0));
+
+    EXPECT_EQ_ARM(cache.GetVersion(), 2u);
+
+    int64_t utime;
+    ASSERT_TRUE(cache.GetBodyToLocal(&trans, &utime));
+
+    EXPECT_EQ_ARM(utime, 2000);
+    EXPECT_NEAR(trans.trans_vec[0], 4, 0.0001);
+    EXPECT_NEAR(trans.trans_vec[2], 6, 0.0001);
+}
+
+TEST(Utils, TransformCacheInterpolates) {
+    TransformCache cache(NULL);
+
+    cache.Update(1000, MakeTrans(0, 0, 0, 0));
+    cache.Update(2000, MakeTrans(10, 0, 0, 0.2));
+    cache.Update(3000, MakeTrans(20, 0, 0, 0.4));
+
+    BotTrans trans;
+    ASSERT_TRUE(cache.GetBodyToLocalAt(1500, &trans));
+
+    EXPECT_NEAR(trans.trans_vec[0], 5, 0.0001);
+
+    double rpy[3];
+    bot_quat_to_roll_pitch_yaw(trans.rot_quat, rpy);
+    EXPECT_NEAR(rpy[2], 0.1, 0.0001);
+
+    // past the latest, or before the history: the latest
+    ASSERT_TRUE(cache.GetBodyToLocalAt(5000, &trans));
+    EXPECT_NEAR(trans.trans_vec[0], 20, 0.0001);
+
+    ASSERT_TRUE(cache.GetBodyToLocalAt(500, &trans));
+    EXPECT_NEAR(trans.trans_vec[0], 20, 0.0001);
+}
+
+TEST(Utils, TransformCacheHistoryWraps) {
+    TransformCache cache(NULL);
+
+    for (int i = 0; i < 3 * TRANSFORM_CACHE_HISTORY; i++) {
+        cache.Update(i * 1000, MakeTrans(i, 0, 0, 0));
+    }
+
+    BotTrans trans;
+
+    // in the history
+    int64_t recent = (3 * TRANSFORM_CACHE_HISTORY - 10) * 1000 + 250;
+    ASSERT_TRUE(cache.GetBodyToLocalAt(recent, &trans));
+    EXPECT_NEAR(trans.trans_vec[0], 3 * TRANSFORM_CACHE_HISTORY - 10 + 0.25, 0.0001);
+
+    // overwritten
+    ASSERT_TRUE(cache.GetBodyToLocalAt(5500, &trans));
+    EXPECT_NEAR(trans.trans_vec[0], 3 * TRANSFORM_CACHE_HISTORY - 1, 0.0001);
+}
+
+TEST(Utils, TransformCacheCamera) {
+    TransformCache cache(NULL);
+
+    // camera 1 m ahead of the body, and the body yawed 90 degrees at (10, 0, 0)
+    cache.SetCameraToBody(MakeTrans(1, 0, 0, 0));
+    cache.Update(1000, MakeTrans(10, 0, 0, PI / 2));
+
+    BotTrans trans;
+    ASSERT_TRUE(cache.GetCameraToLocal(&trans));
+
+    EXPECT_NEAR(trans.trans_vec[0], 10, 0.0001);
+    EXPECT_NEAR(trans.trans_vec[1], 1, 0.0001);
+}
+
+/**
+ * Tells process-control this process has finished starting up (loaded its
+ * parameters, calibration or trajectories), so it can start the ones that
+ * depend on it.  Harmless if process-control didn't start us.
+ *
+ * @param lcm LCM to publish on
+ */
+void PublishProcessReady(lcm_t *lcm) {
+
+    lcmt_process_ready msg;
+
+    msg.timestamp = GetWallNow();
+    msg.pid = getpid();
+    msg.name = program_invocation_short_name;
+
+    lcmt_process_ready_publish(lcm, PROCESS_READY_CHANNEL, &msg);
+}
+
+// reads a whole file.  Returns false if it can't.
+static bool ReadWholeFile(std::string filename, std::string *contents) {
+
+    std::ifstream file(filename);
+
+    if (!file) {
+        return false;
+    }
+
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+
+    *contents = buffer.str();
+
+    return true;
+}
+
+// writes the parameters to the snapshot, atomically (processes starting
+// together may all be writing it).  contents gets what was written if it
+// isn't NULL.
+static bool WriteParamSnapshot(BotParam *param, std::string filename, std::string *contents) {
+
+    std::string temp_filename = filename + "." + std::to_string(getpid()) + ".tmp";
+
+    FILE *file = fopen(temp_filename.c_str(), "w");
+
+    if (file == NULL) {
+        std::cerr << "WARNING: failed to write the param snapshot " << temp_filename << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    bot_param_write(param, file);
+
+    bool ok = fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = fclose(file) == 0 && ok;
+
+    if (ok && contents != NULL) {
+        ok = ReadWholeFile(temp_filename, contents);
+    }
+
+    if (!ok || rename(temp_filename.c_str(), filename.c_str()) != 0) {
+        std::cerr << "WARNING: failed to write the param snapshot " << filename << ": " << strerror(errno) << std::endl;
+        unlink(temp_filename.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// waits for the param server in the background and brings the snapshot up
+// to date, on its own LCM so it doesn't get in the process's way
+static void ReconcileParamSnapshot(std::string lcm_url, std::string filename, std::string snapshot) {
+
+    lcm_t *lcm = lcm_create(lcm_url.c_str());
+
+    if (lcm == NULL) {
+        return;
+    }
+
+    BotParam *param;
+
+    while ((param = bot_param_new_from_server(lcm, 0)) == NULL) {
+        sleep(PARAM_SNAPSHOT_RETRY_SEC);
+    }
+
+    std::string contents;
+
+    if (WriteParamSnapshot(param, filename, &contents) && contents != snapshot) {
+        std::cerr << "WARNING: the param server's parameters are different from the snapshot ("
+            << filename << ") this process started with.  Restart it to use them." << std::endl;
+    }
+
+    bot_param_destroy(param);
+    lcm_destroy(lcm);
+}
+
+/**
+ * Gets the parameters without waiting for the param server, from the
+ * snapshot the last process to hear from the server left behind.  The
+ * server is asked in the background, and the snapshot updated for next
+ * time (with a warning if they were different).  The first time, with no
+ * snapshot, waits for the server as usual.
+ *
+ * Use it like bot_param_new_from_server(lcm, 0).
+ *
+ * @param lcm LCM the process uses
+ * @param lcm_url its URL, for the background check's own LCM
+ *
+ * @retval the parameters, or NULL if there's no snapshot and no param
+ *      server
+ */
+BotParam* NewParamWithSnapshot(lcm_t *lcm, std::string lcm_url) {
+
+    std::string filename = GetRealtimeDir() + "/config/" + PARAM_SNAPSHOT_FILE;
+    std::string snapshot;
+
+    if (ReadWholeFile(filename, &snapshot)) {
+        BotParam *param = bot_param_new_from_file(filename.c_str());
+
+        if (param != NULL) {
+            std::thread(ReconcileParamSnapshot, lcm_url, filename, snapshot).detach();
+            return param;
+        }
+
+        std::cerr << "WARNING: failed to read the param snapshot " << filename << ", waiting for the param server." << std::endl;
+    }
+
+    BotParam *param = bot_param_new_from_server(lcm, 0);
+
+    if (param != NULL) {
+        WriteParamSnapshot(param, filename, NULL);
+    }
+
+    return param;
+}
+
+/**
+ * Locks the process's memory (now and from now on) into RAM so a page fault
+ * never stalls the control loop.  Needs root or CAP_IPC_LOCK.
+ *
+ * @retval false if it couldn't
+ */
+bool LockMemory() {
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        std::cerr << "WARNING: failed to lock memory (mlockall): " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Makes the calling thread real-time: SCHED_FIFO at a priority, optionally
+ * pinned to a CPU.  Needs root or CAP_SYS_NICE.
+ *
+ * @param priority SCHED_FIFO priority (1 to 99)
+ * @param cpu CPU to run on (-1 for any)
+ *
+ * @retval false if either failed (the thread keeps running as it was)
+ */
+bool MakeThreadRealtime(int priority, int cpu) {
+
+    bool ok = true;
+
+    if (cpu >= 0) {
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+
+        int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+        if (error != 0) {
+            std::cerr << "WARNING: failed to pin thread to CPU " << cpu << ": " << strerror(error) << std::endl;
+            ok = false;
+        }
+    }
+
+    struct sched_param param;
+    param.sched_priority = priority;
+
+    int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+
+    if (error != 0) {
+        std::cerr << "WARNING: failed to set SCHED_FIFO priority " << priority << ": " << strerror(error) << std::endl;
+        ok = false;
+    }
+
+    return ok;
+}
+
+Eigen::Matrix3d rotz(double rotation_around_z) {
+
+    Eigen::Matrix3d rot_mat;
+
+    double s = sin(rotation_around_z);
+    double c = cos(rotation_around_z);
+
+    rot_mat(0,0) = c;
+    rot_mat(0,1) = -s;
+    rot_mat(0,2) = 0;
+
+    rot_mat(1,0) = s;
+    rot_mat(1,1) = c;
+    rot_mat(1,2) = 0;
+
+    rot_mat(2,0) = 0;
+    rot_mat(2,1) = 0;
+    rot_mat(2,2) = 1;
+
+    return rot_mat;
+}
+
+
+TEST(Utils, rotz) {
+
+    double theta = 0.8147;
+
+    Eigen::Matrix3d matlab_output;
+    matlab_output << 0.6861, -0.7275, 0, 0.7275, 0.6861, 0, 0, 0, 1;
+
+
+    Eigen::Matrix3d output = rotz(theta);
+
+    EXPECT_TRUE(matlab_output.isApprox(output, 0.0001));
+
+
+    double theta2 = 3.235;
+    Eigen::Matrix3d matlab_output2;
+    matlab_output2 << -0.9956, 0.0933, 0, -0.0933, -0.9956, 0, 0, 0, 1;
+
+    Eigen::Matrix3d output2 = rotz(theta2);
+
+    EXPECT_TRUE(matlab_output2.isApprox(output2, 0.0001));
+
+}
+
+void DrawOriginLcmGl(lcm_t *lcm) {
+
+    bot_lcmgl_t *lcmgl = bot_lcmgl_init(lcm, "Origin");
+    bot_lcmgl_line_width(lcmgl, 4.0f);
+
+    bot_lcmgl_color3f(lcmgl, 1, 0, 0);
+    bot_lcmgl_begin(lcmgl, GL_LINE_STRIP);
+    bot_lcmgl_vertex3d(lcmgl, 0, 0, 0);
+    bot_lcmgl_vertex3d(lcmgl, 1, 0, 0);
+    bot_lcmgl_end(lcmgl);
+
+    bot_lcmgl_color3f(lcmgl, 0, 1, 0);
+    bot_lcmgl_begin(lcmgl, GL_LINE_STRIP);
+    bot_lcmgl_vertex3d(lcmgl, 0, 0, 0);
+    bot_lcmgl_vertex3d(lcmgl, 0, 1, 0);
+    bot_lcmgl_end(lcmgl);
+
+    bot_lcmgl_color3f(lcmgl, 0, 0, 1);
+    bot_lcmgl_begin(lcmgl, GL_LINE_STRIP);
+    bot_lcmgl_vertex3d(lcmgl, 0, 0, 0);
+    bot_lcmgl_vertex3d(lcmgl, 0, 0, 1);
+    bot_lcmgl_end(lcmgl);
+
+    bot_lcmgl_switch_buffer(lcmgl);
+
+    bot_lcmgl_destroy(lcmgl);
+}
+
+std::string ReplaceUserVarInPath(std::string path) {
+    std::string username = std::string(getenv("USER"));
+
+    boost::algorithm::replace_all(path, "$USER", username);
+    return path;
+}
+
+
+double ConvertTimestampToSeconds(int64_t timestamp) {
+    return timestamp / 1000000.0;
+}
+
+/**
  * Converts a timestamp into a date, searches for that date in the directory
  * given by the user, and returns the directory name if it is unique.  Returns the
  * first if there is more than one directory.
@@ -708,6 +2104,23 @@ std::tuple<std::string, std::string> GetVideoDirectory(int64_t timestamp, std::s
 
     std::string date_str = std::string(buf);
 
+    // playback asks again every time the video changes, and log
+    // directories on an SD card are slow to list, so remember what we found
+    static std::mutex cache_mutex;
+    static std::map<std::string, std::string> cache;
+
+    std::string cache_key = log_directory + "/" + date_str;
+
+    {
+        std::unique_lock<std::mutex> locker(cache_mutex);
+
+        auto cached = cache.find(cache_key);
+
+        if (cached != cache.end()) {
+            return std::tuple<std::string, std::string>(cached->second, date_str);
+        }
+    }
+
     boost::filesystem::directory_iterator end_itr; // default construction
                                                    // yields past-the-end
     for (boost::filesystem::directory_iterator itr(log_directory);
@@ -719,6 +2132,10 @@ std::tuple<std::string, std::string> GetVideoDirectory(int64_t timestamp, std::s
         std::string this_file = itr->path().leaf().string();
 
         if (this_file.find(date_str) != std::string::npos) {
+            // only hits are kept, since the directory could still show up
+            std::unique_lock<std::mutex> locker(cache_mutex);
+            cache[cache_key] = this_file;
+
             return std::tuple<std::string, std::string>(this_file, date_str);
         }
 
@@ -727,6 +2144,39 @@ std::tuple<std::string, std::string> GetVideoDirectory(int64_t timestamp, std::s
     return std::tuple<std::string, std::string>("", date_str);
 }
 
+TEST(Utils, GetVideoDirectoryCaches) {
+
+    char dir_template[] = "/tmp/video-directory-XXXXXX";
+    std::string log_directory = mkdtemp(dir_template);
+
+    // noon, so any time zone is still on the same day
+    struct tm date = {};
+    date.tm_year = 2015 - 1900;
+    date.tm_mon = 2;
+    date.tm_mday = 4;
+    date.tm_hour = 12;
+    date.tm_isdst = -1;
+
+    int64_t timestamp = (int64_t)mktime(&date) * 1000000;
+
+    std::string video_dir, date_str;
+
+    std::tie(video_dir, date_str) = GetVideoDirectory(timestamp, log_directory);
+    EXPECT_EQ(video_dir, "");
+    EXPECT_EQ(date_str, "2015-03-04");
+
+    boost::filesystem::create_directory(log_directory + "/odroid-cam1-2015-03-04");
+
+    std::tie(video_dir, date_str) = GetVideoDirectory(timestamp, log_directory);
+    EXPECT_EQ(video_dir, "odroid-cam1-2015-03-04");
+
+    // found without looking again
+    boost::filesystem::remove_all(log_directory);
+
+    std::tie(video_dir, date_str) = GetVideoDirectory(timestamp, log_directory);
+    EXPECT_EQ(video_dir, "odroid-cam1-2015-03-04");
+}
+
 // from http://stackoverflow.com/a/478960/730138
 std::string ExecuteProcessGetString(std::string cmd) {
     FILE* pipe = popen(cmd.c_str(), "r");
@@ -13,17 +13,38 @@
 #include <fstream>
 #include <vector>
 #include <sstream>
+#include <functional>
+#include <atomic>
+#include <mutex>
 #include <boost/algorithm/string/replace.hpp> // for substring replacement
 #include <boost/format.hpp>
 #include <boost/filesystem.hpp>
 
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include <bot_core/rotations.h>
+#include <bot_core/trans.h>
 #include <bot_frames/bot_frames.h>
+#include <bot_param/param_client.h>
 
 #include <GL/gl.h>
 #include <bot_lcmgl_client/lcmgl.h>
 
 #include "../../LCM/mav_pose_t.h"
+#include "../../LCM/lcmt_clock_sync.h"
+#include "../../LCM/lcmt_process_ready.h"
+#include "../../LCM/lcmt_memory_stats.h"
+
+#include "Clock.hpp"
+#include "MemoryAccounting.hpp"
 
 #include <Eigen/Core>
 
@@ -35,6 +56,8 @@
 
 #define EXPECT_APPROX_MAT(expected_val, got_val, tolerance) EXPECT_TRUE( expected_val.isApprox(got_val, tolerance) ) << std::endl << "Expected:" << std::endl << expected_val << std::endl << "Got:" << std::endl << got_val << std::endl;
 
+typedef Eigen::Matrix<double, 12, 1> Vector12d;
+
 /**
  * Converts mav_pose_t message into a 12-state vector in the State Estimator frame.
  * @param msg message to convert
@@ -42,6 +65,58 @@
  */
 Eigen::VectorXd PoseMsgToStateEstimatorVector(const mav_pose_t *msg, const Eigen::Matrix3d Mz = Eigen::Matrix3d::Identity());
 
+/**
+ * Same as PoseMsgToStateEstimatorVector(), but fixed-size, so it doesn't
+ * allocate (for the control loop).
+ */
+Vector12d PoseMsgToStateEstimatorVector12d(const mav_pose_t *msg, const Eigen::Matrix3d &Mz = Eigen::Matrix3d::Identity());
+
+typedef Eigen::Matrix<double, 12, Eigen::Dynamic> Matrix12Xd;
+
+/**
+ * Converts a run of poses (from a log, say) at once.
+ *
+ * @param msgs poses to convert
+ * @param num_msgs number of poses
+ * @param states (output) resized to 12 x num_msgs, with column i the state of msgs[i]
+ * @param Mz (optional) yaw rotation
+ */
+void PoseMsgsToStateEstimatorVectors(const mav_pose_t *msgs, int num_msgs, Matrix12Xd *states, const Eigen::Matrix3d &Mz = Eigen::Matrix3d::Identity());
+
+/**
+ * Moves a pose dt seconds ahead with its own velocity, acceleration and
+ * rotation rate (all in body frame), holding the acceleration and rotation
+ * rate constant.  For making up for the time between a pose being measured
+ * and a command computed from it taking effect.
+ *
+ * @param msg pose to start from
+ * @param dt seconds to move it ahead
+ * @param predicted (output) the pose dt later, with utime moved ahead too
+ */
+void PredictPose(const mav_pose_t *msg, double dt, mav_pose_t *predicted);
+
+/**
+ * Rotation matrix of a quaternion (w, x, y, z), which doesn't have to be
+ * normalized.  Each product of the quaternion's entries is computed once and
+ * shared between the matrix's entries.
+ */
+inline Eigen::Matrix3d QuatArrayToRotmat(const double q[4]) {
+    double ww = q[0]*q[0], xx = q[1]*q[1], yy = q[2]*q[2], zz = q[3]*q[3];
+    double wx = q[0]*q[1], wy = q[0]*q[2], wz = q[0]*q[3];
+    double xy = q[1]*q[2], xz = q[1]*q[3], yz = q[2]*q[3];
+
+    // dividing by the norm squared normalizes every product at once
+    double s = 1.0 / (ww + xx + yy + zz);
+
+    Eigen::Matrix3d rot_mat;
+
+    rot_mat << s*(ww + xx - yy - zz), 2*s*(xy - wz), 2*s*(xz + wy),
+        2*s*(xy + wz), s*(ww + yy - xx - zz), 2*s*(yz - wx),
+        2*s*(xz - wy), 2*s*(yz + wx), s*(ww + zz - xx - yy);
+
+    return rot_mat;
+}
+
 /**
  * Converts mav_pose_t message into the Drake global frame.
  *
@@ -70,10 +145,345 @@ Eigen::Vector3d rotmat2rpy(Eigen::Matrix3d rot_mat);
 
 double deg2rad(double input_in_deg);
 
+// GetWallNow() (see Clock.hpp), or the simulated time
 int64_t GetTimestampNow();
 
+// for simulations: GetTimestampNow() and GetMonotonicNow() return this time
+// (in usec) from now on instead of the real clocks, until
+// ClearSimulatedTime()
+void SetSimulatedTime(int64_t utime);
+void ClearSimulatedTime();
+
+// GetRawMonotonicNow() (see Clock.hpp), or the simulated time: never steps
+// when the wall clock is set, so it's what to measure durations with
+int64_t GetMonotonicNow();
+
+/**
+ * Converts between this computer's monotonic clock and the synchronized
+ * timebase (the reference computer's clock) using clock-sync's estimates
+ * (utils/ClockSync).  Until the first estimate, it falls back on the wall
+ * clock.
+ *
+ * Update() and the conversions can be called from different threads.
+ */
+class SyncedClock {
+
+    public:
+        SyncedClock();
+
+        void Update(const lcmt_clock_sync *msg);
+
+        bool IsSynced() const;
+
+        int64_t MonotonicToSynced(int64_t monotonic_utime) const;
+        int64_t SyncedToMonotonic(int64_t synced_utime) const;
+
+        int64_t GetSyncedNow() const;
+
+        // how far off the synchronized time could be (usec), or -1 if
+        // it isn't synced
+        int64_t GetErrorBound() const;
+
+    private:
+        mutable std::mutex mutex_;
+
+        bool synced_;
+        int64_t monotonic_utime_;
+        int64_t synced_utime_;
+        double drift_ppm_;
+        int64_t error_usec_;
+};
+
 bool NonBlockingLcm(lcm_t *lcm);
 
+// events handled per epoll_wait (LCM, Wake(), and added fds)
+#define LCM_REACTOR_MAX_EVENTS 8
+
+/**
+ * Waits for LCM messages (or a Wake() from another thread, or an added fd
+ * like a shared memory ring's) without spinning, handles everything that's
+ * arrived, and then runs an idle task once, so work that only needs the
+ * latest message (like an IMU update) is done once per batch instead of
+ * once per message.
+ */
+class LcmReactor {
+
+    public:
+        LcmReactor(lcm_t *lcm);
+        ~LcmReactor();
+
+        // run after each batch of messages and after each Wake()
+        void SetIdleTask(std::function<void()> task) { idle_task_ = task; }
+
+        // handler runs (before the idle task) when fd is readable, and has
+        // to read it so it isn't readable again right away
+        void AddFd(int fd, std::function<void()> handler);
+
+        bool WaitAndHandle(int timeout_ms = -1);
+        void Run();
+
+        void Wake();
+
+    private:
+        lcm_t *lcm_;
+
+        int lcm_fd_;
+        int epoll_fd_;
+        int wake_fd_;
+
+        std::function<void()> idle_task_;
+
+        std::vector<std::pair<int, std::function<void()>>> fd_handlers_;
+};
+
+/**
+ * Hands the latest value of something from one thread to another without
+ * locks.  Put() never waits, and Take() gets the newest value put since the
+ * last Take(); ones in between are dropped.  It's a triple buffer, so
+ * values are copied into slots made up front and nothing is allocated.
+ *
+ * One thread puts and one thread takes.
+ */
+template <typename T>
+class LatestValueMailbox {
+
+    public:
+        LatestValueMailbox() {
+            write_slot_ = 0;
+            middle_slot_ = 1;
+            read_slot_ = 2;
+
+            wake_fd_ = eventfd(0, EFD_NONBLOCK);
+
+            if (wake_fd_ < 0) {
+                std::cerr << "ERROR: failed to create the mailbox's eventfd." << std::endl;
+                exit(1);
+            }
+        }
+
+        ~LatestValueMailbox() {
+            close(wake_fd_);
+        }
+
+        // putting thread only
+        void Put(const T &value) {
+            slots_[write_slot_] = value;
+
+            // swap the filled slot into the middle, marked new
+            write_slot_ = middle_slot_.exchange(write_slot_ | kNewValue) & kSlotMask;
+
+            uint64_t one = 1;
+
+            if (write(wake_fd_, &one, sizeof(one)) < 0) {
+                // the count is already high enough to wake the taker
+            }
+        }
+
+        // taking thread only.  Returns false if nothing new has been put.
+        bool Take(T *value) {
+            if ((middle_slot_.load() & kNewValue) == 0) {
+                return false;
+            }
+
+            read_slot_ = middle_slot_.exchange(read_slot_) & kSlotMask;
+
+            *value = slots_[read_slot_];
+
+            return true;
+        }
+
+        /**
+         * Takes a new value, sleeping until one is put if there isn't one.
+         *
+         * @param value (output) the value
+         * @param timeout_ms longest to wait (-1 for as long as it takes)
+         *
+         * @retval false if it timed out
+         */
+        bool Wait(T *value, int timeout_ms = -1) {
+            while (Take(value) == false) {
+                struct pollfd wake_poll;
+
+                wake_poll.fd = wake_fd_;
+                wake_poll.events = POLLIN;
+
+                if (poll(&wake_poll, 1, timeout_ms) <= 0) {
+                    // timed out (or interrupted by a signal)
+                    return Take(value);
+                }
+
+                uint64_t count;
+
+                if (read(wake_fd_, &count, sizeof(count)) < 0) {
+                    // already cleared, nothing to do
+                }
+            }
+
+            return true;
+        }
+
+    private:
+
+        LatestValueMailbox(const LatestValueMailbox&);
+        LatestValueMailbox& operator=(const LatestValueMailbox&);
+
+        static const int kSlotMask = 3;
+        static const int kNewValue = 4;
+
+        T slots_[3];
+
+        // the putter's and taker's slots, and the one between them (with
+        // kNewValue set if it has something the taker hasn't seen)
+        int write_slot_;
+        std::atomic<int> middle_slot_;
+        int read_slot_;
+
+        int wake_fd_;
+};
+
+/**
+ * Counts how often a latency (like pose to servo command) goes over a
+ * deadline.  One thread adds; any thread can read the counts.
+ */
+class DeadlineMonitor {
+
+    public:
+        DeadlineMonitor(int64_t deadline_usec = 0) : deadline_usec_(deadline_usec), num_samples_(0), num_misses_(0), worst_usec_(0) {}
+
+        void SetDeadline(int64_t deadline_usec) { deadline_usec_ = deadline_usec; }
+        int64_t GetDeadline() const { return deadline_usec_; }
+
+        void Add(int64_t latency_usec);
+
+        int64_t GetNumSamples() const { return num_samples_.load(); }
+        int64_t GetNumMisses() const { return num_misses_.load(); }
+        int64_t GetWorstLatency() const { return worst_usec_.load(); }
+
+    private:
+        int64_t deadline_usec_;
+
+        std::atomic<int64_t> num_samples_;
+        std::atomic<int64_t> num_misses_;
+        std::atomic<int64_t> worst_usec_;
+};
+
+/**
+ * Publishes what each subsystem in MemoryAccounting.hpp holds, how fast
+ * it's allocating, and the whole process' RSS, as lcmt_memory_stats.
+ * Rates are since the last message.
+ */
+class MemoryStatsPublisher {
+
+    public:
+        MemoryStatsPublisher(std::string process_name);
+
+        // the message's arrays point into the publisher, so they're only
+        // good until the next one
+        void GetStats(lcmt_memory_stats *msg);
+
+        void Publish(lcm_t *lcm, const char *channel);
+
+        static int64_t GetRssBytes();
+
+    private:
+        std::string process_name_;
+
+        // MemoryCounters::allocated_bytes at the last message
+        int64_t last_allocated_[MEMORY_NUM_SUBSYSTEMS];
+        int64_t last_utime_;
+
+        // what the message's arrays point to
+        char *names_[MEMORY_NUM_SUBSYSTEMS];
+        int64_t live_[MEMORY_NUM_SUBSYSTEMS];
+        int64_t peak_[MEMORY_NUM_SUBSYSTEMS];
+        float rate_[MEMORY_NUM_SUBSYSTEMS];
+};
+
+// body poses TransformCache keeps to interpolate between (a second or two
+// of state estimator poses)
+#define TRANSFORM_CACHE_HISTORY 256
+
+/**
+ * The body to local and camera (opencvFrame) to local transforms without
+ * bot_frames_get_trans()'s lock and frame graph walk on every lookup.
+ *
+ * bot_frames tells the cache whenever a frame is updated.  Body updates go
+ * into a history of recent poses, each with a version number, and anything
+ * else refreshes the (normally fixed) camera to body transform.  Readers
+ * copy out of the history without locks, retrying if the writer lapped them
+ * mid-copy, so the map and planner threads never wait on the LCM thread.
+ *
+ * Until the first body update, lookups go through bot_frames like before.
+ *
+ * One thread updates (the one handling bot_frames' LCM); any thread reads.
+ */
+class TransformCache {
+
+    public:
+        TransformCache(BotFrames *bot_frames);
+
+        // the cache for a BotFrames, made the first time.  BotFrames are
+        // never destroyed here, so the caches aren't either (bot_frames
+        // has no way to stop calling one).
+        static TransformCache* Get(BotFrames *bot_frames);
+
+        void Update(int64_t utime, const BotTrans &body_to_local);
+        void SetCameraToBody(const BotTrans &camera_to_body);
+
+        bool GetBodyToLocal(BotTrans *body_to_local, int64_t *utime = NULL) const;
+        bool GetBodyToLocalAt(int64_t utime, BotTrans *body_to_local) const;
+
+        bool GetCameraToLocal(BotTrans *camera_to_local) const;
+        bool GetCameraToLocalAt(int64_t utime, BotTrans *camera_to_local) const;
+
+        // body updates so far
+        uint64_t GetVersion() const { return version_.load(std::memory_order_acquire); }
+
+    private:
+        struct Entry {
+            // 2n + 1 while update n is being written, 2n + 2 once it's done
+            std::atomic<uint64_t> seq;
+
+            int64_t utime;
+            BotTrans body_to_local;
+        };
+
+        static void FramesUpdateHandler(BotFrames *bot_frames, const char *frame, const char *relative_to, int64_t utime, void *user);
+
+        bool ReadEntry(uint64_t n, int64_t *utime, BotTrans *body_to_local) const;
+        bool GetCameraToBody(BotTrans *camera_to_body) const;
+
+        BotFrames *bot_frames_;
+
+        std::atomic<uint64_t> version_;
+        Entry history_[TRANSFORM_CACHE_HISTORY];
+
+        // same scheme as the entries
+        std::atomic<uint64_t> camera_seq_;
+        BotTrans camera_to_body_;
+        bool have_camera_;
+};
+
+// process-control listens for lcmt_process_ready here (see
+// drivers/process_control)
+#define PROCESS_READY_CHANNEL "process-ready"
+
+void PublishProcessReady(lcm_t *lcm);
+
+// last parameters a process got from the param server, in
+// GetRealtimeDir()/config.  See NewParamWithSnapshot().
+#define PARAM_SNAPSHOT_FILE "param-snapshot.cfg"
+
+// how long the snapshot's background check waits between asking a param
+// server that isn't answering
+#define PARAM_SNAPSHOT_RETRY_SEC 5
+
+BotParam* NewParamWithSnapshot(lcm_t *lcm, std::string lcm_url);
+
+bool LockMemory();
+
+bool MakeThreadRealtime(int priority, int cpu = -1);
+
 void DrawOriginLcmGl(lcm_t *lcm);
 
 std::string ReplaceUserVarInPath(std::string path);
@@ -0,0 +1,375 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+/*
+ * Low overhead tracing for finding where the time goes, instead of
+ * printf()ing gettimeofday() differences.
+ *
+ *   void PushbroomStereo::RunFusedBand(...) {
+ *       TRACE_SCOPE("stereo-band");
+ *       ...
+ *   }
+ *
+ * records when the scope started and ended on the cycle counter
+ * (GetCycleCount(), see Clock.hpp) into a ring of the last
+ * TRACE_RING_EVENTS events for the thread it ran on.  That's two counter
+ * reads and three stores, with no locks and no system calls.  The name has
+ * to be a string literal (only the pointer is kept).
+ *
+ * TRACE_INSTANT(name) records a moment instead of a span, like a state
+ * machine changing states.  Its name can be any string that outlives the
+ * trace.
+ *
+ * TraceDump() writes every thread's ring as a Chrome trace (the JSON array
+ * format, which chrome://tracing and Perfetto both open), with the events
+ * on the wall clock (GetWallNow()) so traces from different processes, or
+ * different computers with synced clocks, line up.  Since the closing ]
+ * is optional in that format, traces can be merged with:
+ *
+ *   (echo '['; tail -q -n +2 trace-*.json) > flight.json
+ *
+ * Programs dump on a signal (TraceDumpOnSignal()) or when they get an LCM
+ * message asking them to.
+ *
+ * Build with -DNO_TRACE to compile the scopes out.
+ *
+ * Header only, so anything can be instrumented without changing what it
+ * links.
+ *
+ * Author: Andrew Barry, <abarry@csail.mit.edu> 2015
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include <atomic>
+#include <string>
+
+#include "Clock.hpp"
+
+// events kept per thread (a power of two); at 24 bytes each, a thread's
+// ring is 192 KB
+#define TRACE_RING_EVENTS 8192
+
+// threads past this many aren't traced
+#define TRACE_MAX_THREADS 64
+
+struct TraceEvent {
+    const char *name;
+    uint64_t start;     // cycles
+    uint64_t end;
+};
+
+struct TraceRing {
+    int tid;
+
+    // events ever written: the next goes in count % TRACE_RING_EVENTS
+    std::atomic<uint64_t> count;
+
+    TraceEvent events[TRACE_RING_EVENTS];
+};
+
+struct TraceRegistry {
+    TraceRegistry() : enabled(true), num_rings(0) {
+        for (int i = 0; i < TRACE_MAX_THREADS; i++) {
+            rings[i].store(NULL);
+        }
+
+        base_cycles = GetCycleCount();
+        base_wall = GetWallNow();
+    }
+
+    std::atomic<bool> enabled;
+
+    std::atomic<int> num_rings;
+    std::atomic<TraceRing*> rings[TRACE_MAX_THREADS];
+
+    // the cycle counter and the wall clock at the same moment, to put the
+    // events on the wall clock
+    uint64_t base_cycles;
+    int64_t base_wall;
+
+    std::string dump_dir;
+    std::string process_name;
+};
+
+// one for the whole program, since it's an inline function's
+inline TraceRegistry& TraceGetRegistry() {
+    static TraceRegistry registry;
+    return registry;
+}
+
+inline void TraceSetEnabled(bool enabled) {
+    TraceGetRegistry().enabled.store(enabled, std::memory_order_relaxed);
+}
+
+/**
+ * The calling thread's ring, made the first time the thread records
+ * anything.  NULL if there are already TRACE_MAX_THREADS.
+ */
+inline TraceRing* TraceGetThreadRing() {
+    static __thread TraceRing *ring = NULL;
+    static __thread bool untraced = false;
+
+    if (ring == NULL && untraced == false) {
+        TraceRegistry &registry = TraceGetRegistry();
+
+        int slot = registry.num_rings.fetch_add(1);
+
+        if (slot >= TRACE_MAX_THREADS) {
+            untraced = true;
+            return NULL;
+        }
+
+        ring = new TraceRing;
+        ring->tid = syscall(SYS_gettid);
+        ring->count.store(0);
+
+        registry.rings[slot].store(ring, std::memory_order_release);
+    }
+
+    return ring;
+}
+
+inline void TraceRecord(const char *name, uint64_t start, uint64_t end) {
+    TraceRing *ring = TraceGetThreadRing();
+
+    if (ring == NULL) {
+        return;
+    }
+
+    uint64_t count = ring->count.load(std::memory_order_relaxed);
+    TraceEvent &event = ring->events[count & (TRACE_RING_EVENTS - 1)];
+
+    event.name = name;
+    event.start = start;
+    event.end = end;
+
+    ring->count.store(count + 1, std::memory_order_release);
+}
+
+class TraceScope {
+
+    public:
+        TraceScope(const char *name) : name_(name) {
+            start_ = TraceGetRegistry().enabled.load(std::memory_order_relaxed) ? GetCycleCount() : 0;
+        }
+
+        ~TraceScope() {
+            if (start_ != 0) {
+                TraceRecord(name_, start_, GetCycleCount());
+            }
+        }
+
+    private:
+        const char *name_;
+        uint64_t start_;
+};
+
+// a span with no length: shows up as an instant event
+inline void TraceInstant(const char *name) {
+    if (TraceGetRegistry().enabled.load(std::memory_order_relaxed)) {
+        uint64_t now = GetCycleCount();
+        TraceRecord(name, now, now);
+    }
+}
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+
+#ifdef NO_TRACE
+#define TRACE_SCOPE(name)
+#define TRACE_INSTANT(name)
+#else
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_INSTANT(name) TraceInstant(name)
+#endif
+
+inline double TraceCyclesToWall(const TraceRegistry &registry, uint64_t cycles) {
+    return registry.base_wall + CyclesToUsec(cycles - registry.base_cycles);
+}
+
+/**
+ * Writes every thread's events to a file as a Chrome trace.  Threads keep
+ * recording while it reads, so events overwritten during the read are left
+ * out.
+ *
+ * @param out file to write to
+ * @param process_name name to show for this process
+ *
+ * @retval number of events written
+ */
+inline int TraceWriteChromeJson(FILE *out, const char *process_name) {
+    TraceRegistry &registry = TraceGetRegistry();
+
+    int pid = getpid();
+    int num_written = 0;
+
+    fprintf(out, "[\n");
+    fprintf(out, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"%s\"}},\n", pid, process_name);
+
+    int num_rings = registry.num_rings.load();
+
+    if (num_rings > TRACE_MAX_THREADS) {
+        num_rings = TRACE_MAX_THREADS;
+    }
+
+    for (int i = 0; i < num_rings; i++) {
+        TraceRing *ring = registry.rings[i].load(std::memory_order_acquire);
+
+        if (ring == NULL) {
+            // still being set up
+            continue;
+        }
+
+        uint64_t end = ring->count.load(std::memory_order_acquire);
+        uint64_t begin = end > TRACE_RING_EVENTS ? end - TRACE_RING_EVENTS : 0;
+
+        for (uint64_t j = begin; j < end; j++) {
+            TraceEvent event = ring->events[j & (TRACE_RING_EVENTS - 1)];
+
+            // skip it if the thread has lapped us and may have written over
+            // it while we copied it
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (ring->count.load(std::memory_order_relaxed) - j >= TRACE_RING_EVENTS) {
+                continue;
+            }
+
+            double start = TraceCyclesToWall(registry, event.start);
+
+            if (event.end == event.start) {
+                fprintf(out, "{\"name\": \"%s\", \"ph\": \"i\", \"s\": \"t\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f},\n",
+                    event.name, pid, ring->tid, start);
+
+                num_written ++;
+                continue;
+            }
+
+            fprintf(out, "{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f},\n",
+                event.name, pid, ring->tid, start, CyclesToUsec(event.end - event.start));
+
+            num_written ++;
+        }
+    }
+
+    return num_written;
+}
+
+/**
+ * Writes the trace to dir/trace-<process name>-<pid>-<time>.json.
+ *
+ * @param dir directory to write to
+ * @param process_name name for the file and to show for this process
+ * @param filename (optional output) the file written
+ *
+ * @retval false if the file couldn't be written
+ */
+inline bool TraceDump(const std::string &dir, const std::string &process_name, std::string *filename = NULL) {
+    char name[1024];
+
+    snprintf(name, sizeof(name), "%s/trace-%s-%d-%ld.json", dir.c_str(), process_name.c_str(),
+        (int)getpid(), (long)(GetWallNow() / 1000000));
+
+    if (filename != NULL) {
+        *filename = name;
+    }
+
+    FILE *out = fopen(name, "w");
+
+    if (out == NULL) {
+        return false;
+    }
+
+    TraceWriteChromeJson(out, process_name.c_str());
+
+    bool ok = ferror(out) == 0;
+    ok = fclose(out) == 0 && ok;
+
+    return ok;
+}
+
+/**
+ * Dumps the trace for an lcmt_trace_request, if it's for this program.
+ * Needs TraceDumpOnSignal() to have been called, for the program's name.
+ *
+ * @param requested_process the request's process_name (empty for all)
+ * @param dir the request's directory (empty for the signal one)
+ *
+ * @retval true if a trace was written
+ */
+inline bool TraceHandleRequest(const std::string &requested_process, const std::string &dir) {
+    TraceRegistry &registry = TraceGetRegistry();
+
+    if (requested_process.length() > 0 && requested_process != registry.process_name) {
+        return false;
+    }
+
+    std::string filename;
+
+    if (TraceDump(dir.length() > 0 ? dir : registry.dump_dir, registry.process_name, &filename) == false) {
+        fprintf(stderr, "\nERROR: failed to write trace to %s\n", filename.c_str());
+        return false;
+    }
+
+    fprintf(stderr, "\nWrote trace to %s\n", filename.c_str());
+    return true;
+}
+
+inline void* TraceSignalThread(void *arg) {
+    sigset_t *signals = (sigset_t*) arg;
+    TraceRegistry &registry = TraceGetRegistry();
+
+    while (true) {
+        int signum;
+
+        if (sigwait(signals, &signum) != 0) {
+            continue;
+        }
+
+        std::string filename;
+
+        if (TraceDump(registry.dump_dir, registry.process_name, &filename)) {
+            fprintf(stderr, "\nWrote trace to %s\n", filename.c_str());
+        } else {
+            fprintf(stderr, "\nERROR: failed to write trace to %s\n", filename.c_str());
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Dumps the trace (TraceDump()) whenever the program gets signum.  The
+ * dump happens on a thread of its own, not in a signal handler.
+ *
+ * Call it before starting any threads: it blocks signum, and only threads
+ * started afterwards inherit that.
+ *
+ * @param signum signal to dump on, like SIGUSR2
+ * @param dir directory to write the traces to
+ * @param process_name name for the files
+ */
+inline void TraceDumpOnSignal(int signum, const std::string &dir, const std::string &process_name) {
+    TraceRegistry &registry = TraceGetRegistry();
+
+    registry.dump_dir = dir;
+    registry.process_name = process_name;
+
+    static sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, signum);
+
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, TraceSignalThread, &signals);
+    pthread_detach(thread);
+}
+
+#endif